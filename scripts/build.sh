@@ -27,8 +27,11 @@ root_dir=$script_dir/..
 build_clean=false
 build_documentation=false
 build_packages=false
+build_benchmarks=false
+enable_tracepoints=false
 platform_layer="linux"
 content_handlers="microsoft/swupdate,microsoft/apt,microsoft/simulator"
+builtin_content_handlers=""
 build_type=Debug
 adu_log_dir=""
 default_log_dir=/var/log/adu
@@ -47,6 +50,10 @@ print_help() {
     echo "-d, --build-docs                      Builds the documentation."
     echo "-u, --build-unit-tests                Builds unit tests."
     echo "--build-packages                      Builds and packages the client in various package formats e.g debian."
+    echo "--build-benchmarks                    Builds the microbenchmarks. Requires Google Benchmark."
+    echo "--enable-tracepoints                  Builds the tracepoints for perf, bpftrace and LTTng. Requires sys/sdt.h."
+    echo "--builtin-content-handlers <types>    Compiles the content handlers of the update types into the agent."
+    echo "                                      Types is a comma delimited list, e.g. microsoft/script:1,microsoft/steps:1"
     echo "-o, --out-dir <out_dir>               Sets the build output directory. Default is out."
     echo "-s, --static-analysis <tools...>      Runs static analysis as part of the build."
     echo "                                      Tools is a comma delimited list of static analysis tools to run at build time."
@@ -161,6 +168,20 @@ while [[ $1 != "" ]]; do
     --build-packages)
         build_packages=true
         ;;
+    --build-benchmarks)
+        build_benchmarks=true
+        ;;
+    --enable-tracepoints)
+        enable_tracepoints=true
+        ;;
+    --builtin-content-handlers)
+        shift
+        if [[ -z $1 || $1 == -* ]]; then
+            error "--builtin-content-handlers parameter is mandatory."
+            $ret 1
+        fi
+        builtin_content_handlers=$1
+        ;;
     -o | --out-dir)
         shift
         if [[ -z $1 || $1 == -* ]]; then
@@ -267,12 +288,15 @@ bullet "Clean build: $build_clean"
 bullet "Documentation: $build_documentation"
 bullet "Platform layer: $platform_layer"
 bullet "Content handlers: $content_handlers"
+bullet "Built-in content handlers: ${builtin_content_handlers:-(none)}"
 bullet "Build type: $build_type"
 bullet "Log directory: $adu_log_dir"
 bullet "Logging library: $log_lib"
 bullet "Output directory: $output_directory"
 bullet "Build unit tests: $build_unittests"
 bullet "Build packages: $build_packages"
+bullet "Build benchmarks: $build_benchmarks"
+bullet "Tracepoints: $enable_tracepoints"
 if [[ ${#static_analysis_tools[@]} -eq 0 ]]; then
     bullet "Static analysis: (none)"
 else
@@ -285,7 +309,10 @@ CMAKE_OPTIONS=(
     "-DADUC_BUILD_DOCUMENTATION:BOOL=$build_documentation"
     "-DADUC_BUILD_UNIT_TESTS:BOOL=$build_unittests"
     "-DADUC_BUILD_PACKAGES:BOOL=$build_packages"
+    "-DADUC_BUILD_BENCHMARKS:BOOL=$build_benchmarks"
+    "-DADUC_ENABLE_TRACEPOINTS:BOOL=$enable_tracepoints"
     "-DADUC_CONTENT_HANDLERS:STRING=$content_handlers"
+    "-DADUC_BUILTIN_CONTENT_HANDLERS:STRING=${builtin_content_handlers//,/;}"
     "-DADUC_LOG_FOLDER:STRING=$adu_log_dir"
     "-DADUC_LOGGING_LIBRARY:STRING=$log_lib"
     "-DADUC_PLATFORM_LAYER:STRING=$platform_layer"
@@ -29,6 +29,7 @@ typedef struct tagADUShell_LaunchArguments
     std::vector<char*> targetOptions; /**< Additional options to pass to target command */
     char* logFile; /**< Custom log file path */
     bool showVersion; /**< Show an agent version */
+    bool broker; /**< Serve requests read from the standard input socket, see ADUC_LaunchAduShell */
 } ADUShell_LaunchArguments;
 
 /**
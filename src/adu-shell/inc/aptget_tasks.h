@@ -48,6 +48,9 @@ ADUShellTaskResult Download(const ADUShell_LaunchArguments& launchArgs);
 /**
 * @brief Runs "apt-get -y --allow-downgrades install" command in  a child process.
 *
+* With the target option "Dpkg::Options::=--force-unsafe-io", the file systems dpkg writes to are synced once at the
+* end instead of at each file.
+*
 * @param launchArgs An adu-shell launch arguments.
 * @return A result from child process.
 */
@@ -11,6 +11,11 @@
 
 #include <adushell.hpp>
 
+/**
+ * @brief Number of bytes at the end of a child process' output kept in ADUShellTaskResult::Output().
+ */
+#define ADUSHELL_CHILD_OUTPUT_TAIL_SIZE (16 * 1024)
+
 namespace Adu
 {
 namespace Shell
@@ -22,11 +27,32 @@ namespace Common
 /**
  * @brief Reboot the system.
  *
+ * With kexecReboot set in the configuration file, and a kernel loaded for kexec, the system boots into that kernel
+ * without going through the firmware, see IsKexecRebootEnabled.
+ *
  * @param launchArgs The adu-shell launch command-line arguments that has been parsed.
  * @return A result from child process.
  */
 ADUShellTaskResult Reboot(const ADUShell_LaunchArguments& launchArgs);
 
+/**
+ * @brief Returns whether kexecReboot is set in the configuration file: the apply of an update then loads the kernel
+ * it boots into with kexec, and Reboot boots into it without going through the firmware.
+ */
+bool IsKexecRebootEnabled();
+
+/**
+ * @brief Runs @p command in a child process, logging each line of its output as it arrives.
+ *
+ * Sets the exit status of @p taskResult and appends the last ADUSHELL_CHILD_OUTPUT_TAIL_SIZE bytes of the
+ * output to its Output().
+ *
+ * @param command Name of a command to run.
+ * @param args List of arguments for the command.
+ * @param taskResult The result of the task running the command.
+ */
+void RunChildProcess(const std::string& command, const std::vector<std::string>& args, ADUShellTaskResult& taskResult);
+
 /**
 * @brief Runs appropriate command based on an action and other arguments in launchArgs.
 *
@@ -0,0 +1,44 @@
+/**
+ * @file rawimage_tasks.hpp
+ * @brief Implements functions related to microsoft/rawimage update type.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADU_SHELL_RAWIMAGE_TASKS_HPP
+#define ADU_SHELL_RAWIMAGE_TASKS_HPP
+
+#include <adushell.hpp>
+
+namespace Adu
+{
+namespace Shell
+{
+namespace Tasks
+{
+namespace RawImage
+{
+/**
+ * @brief Writes the image file or pipe in launchArgs.targetData to a block device.
+ * launchArgs.targetOptions are "device=<path>", and optionally "bmap=<path>", "hash=<base64>" and
+ * "hashType=<type>".
+ *
+ * @param launchArgs An adu-shell launch arguments.
+ * @return A result from the write.
+ */
+ADUShellTaskResult Install(const ADUShell_LaunchArguments& launchArgs);
+
+/**
+ * @brief Runs appropriate command based on an action and other arguments in launchArgs.
+ *
+ * @param launchArgs An adu-shell launch arguments.
+ * @return A result from child process.
+ */
+ADUShellTaskResult DoRawImageTask(const ADUShell_LaunchArguments& launchArgs);
+
+} // namespace RawImage
+} // namespace Tasks
+} // namespace Shell
+} // namespace Adu
+
+#endif // ADU_SHELL_RAWIMAGE_TASKS_HPP
@@ -14,10 +14,11 @@ else
 fi
 
 print_help() {
-    echo "adu-swupdate.sh [-a] [-h] [-i image_file] [-l log_dir] [-r] "
+    echo "adu-swupdate.sh [-a] [-h] [-i image_file] [-k] [-l log_dir] [-r] "
     echo "-a                Applies the install by telling the bootloader to boot to the updated partition."
     echo "-h                Show this help message."
-    echo "-i image_file     The update image file to install. For swupdate this is typically a .swu file"
+    echo "-i image_file     The update image file, or a pipe streaming it, to install. Typically a .swu file"
+    echo "-k                With -a, also loads the kernel of the updated partition with kexec, to reboot into it."
     echo "-l log_dir        The folder where logs should be written."
     echo "-r                Reverts the apply by telling the bootloader to boot into the current partition."
 }
@@ -25,8 +26,9 @@ print_help() {
 action=""
 num_actions=0
 log_dir="/tmp"
+kexec_load=0
 
-while getopts "ahi:l:r" opt; do
+while getopts "ahi:kl:r" opt; do
     case "$opt" in
     a)
         action="apply"
@@ -41,6 +43,9 @@ while getopts "ahi:l:r" opt; do
         image_file=$OPTARG
         num_actions=$((num_actions + 1))
         ;;
+    k)
+        kexec_load=1
+        ;;
     l)
         log_dir=$OPTARG
         ;;
@@ -86,6 +91,53 @@ else
     update_part=2
 fi
 
+# Loads the kernel, and initrd if any, of the updated partition with kexec, with the command line of the current
+# kernel rooted on the updated partition, so that the reboot boots into it without going through the firmware
+# and the bootloader. Best effort: if the kernel isn't loaded, the reboot goes through the bootloader.
+load_kexec_kernel() {
+    local update_dev="/dev/mmcblk0p${update_part}"
+    local mount_dir
+    local kernel=""
+    local initrd_opt=""
+    local cmdline
+
+    if ! command -v kexec > /dev/null; then
+        echo "kexec isn't installed, the reboot goes through the bootloader." >> "${log_dir}/swupdate.log"
+        return 0
+    fi
+
+    mount_dir=$(mktemp -d) || return 0
+    if ! mount -o ro "$update_dev" "$mount_dir" &>> "${log_dir}/swupdate.log"; then
+        rmdir "$mount_dir"
+        return 0
+    fi
+
+    for image in Image zImage vmlinuz; do
+        if [[ -f "${mount_dir}/boot/${image}" ]]; then
+            kernel="${mount_dir}/boot/${image}"
+            break
+        fi
+    done
+
+    if [[ -f "${mount_dir}/boot/initrd.img" ]]; then
+        initrd_opt="--initrd=${mount_dir}/boot/initrd.img"
+    fi
+
+    cmdline=$(sed -e 's/root=[^ ]*//' /proc/cmdline)
+    cmdline="root=${update_dev} ${cmdline}"
+
+    if [[ -n $kernel ]]; then
+        echo "Loading ${kernel##*/} of ${update_dev} with kexec." >> "${log_dir}/swupdate.log"
+        kexec -l "$kernel" $initrd_opt --command-line="$cmdline" &>> "${log_dir}/swupdate.log"
+    else
+        echo "No kernel found on ${update_dev}, the reboot goes through the bootloader." >> "${log_dir}/swupdate.log"
+    fi
+
+    umount "$mount_dir"
+    rmdir "$mount_dir"
+    return 0
+}
+
 if [[ $action == "apply" ]]; then
     # Set the bootloader environment variable
     # to tell the bootloader to boot into the current partition
@@ -93,7 +145,11 @@ if [[ $action == "apply" ]]; then
     # rpipart variable is specific to our boot.scr script.
     echo "Applying update." >> "${log_dir}/swupdate.log"
     fw_setenv rpipart $update_part
-    $ret $?
+    result=$?
+    if [[ $result == 0 && $kexec_load == 1 ]]; then
+        load_kexec_kernel
+    fi
+    $ret $result
 fi
 
 if [[ $action == "revert" ]]; then
@@ -102,13 +158,19 @@ if [[ $action == "revert" ]]; then
     # instead of the one that was updated.
     # rpipart variable is specific to our boot.scr script.
     echo "Reverting update." >> "${log_dir}/swupdate.log"
+    # Also unload the kernel the apply may have loaded, so that the reboot doesn't boot into it.
+    if command -v kexec > /dev/null; then
+        kexec -u &>> "${log_dir}/swupdate.log"
+    fi
     fw_setenv rpipart $current_part
     $ret $?
 fi
 
 if [[ $action == "install" ]]; then
     echo "Installing update." >> "${log_dir}/swupdate.log"
-    if [[ -f $image_file ]]; then
+    # The image is either a file, or a pipe the agent writes the image to while it's downloaded.
+    # swupdate reads the image sequentially, so it installs from the pipe as the content arrives.
+    if [[ -f $image_file || -p $image_file ]]; then
         # Swupdate will use a public key to validate the signature of an image.
         # Here is how we generated the private key for signing the image
         # and how we generated that public key file used to validate the image signature.
@@ -6,7 +6,14 @@
  * Licensed under the MIT License.
  */
 
+#include <algorithm>
+#include <cerrno>
 #include <unordered_map>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "aptget_tasks.h"
 #include "common_tasks.hpp"
@@ -26,6 +33,7 @@ namespace AptGet
 {
 const char* aptget_command = "apt-get";
 const char* apt_option_allow_downgrades = "--allow-downgrades";
+const char* apt_option_archives_dir = "Dir::Cache::Archives=";
 const char* apt_option_auto_remove = "--auto-remove";
 const char* apt_option_download = "download";
 const char* apt_option_download_only = "--download-only";
@@ -33,6 +41,13 @@ const char* apt_option_install = "install";
 const char* apt_option_remove = "remove";
 const char* apt_option_update = "update";
 const char* apt_option_y = "-y";
+const char* dpkg_option_force_unsafe_io = "Dpkg::Options::=--force-unsafe-io";
+
+/**
+ * @brief The folders dpkg writes to while installing packages; their file systems are synced after an install
+ * with dpkg_option_force_unsafe_io.
+ */
+static const char* const dpkg_written_folders[] = { "/", "/boot", "/etc", "/opt", "/usr", "/var", "/var/lib/dpkg" };
 
 /**
  * @brief Runs appropriate command based on an action and other arguments in launchArgs.
@@ -82,6 +97,18 @@ ADUShellTaskResult DoAptGetTask(const ADUShell_LaunchArguments& launchArgs)
     return taskResult;
 }
 
+/**
+ * @brief Returns whether @p option points apt-get at an archives folder under the agent's downloads folder,
+ * e.g. "Dir::Cache::Archives=/var/lib/adu/downloads/<workflow id>/apt-archives/". The APT handler prefetches
+ * package archives there.
+ */
+static bool IsDownloadsArchivesOption(const std::string& option)
+{
+    const std::string prefix = std::string(apt_option_archives_dir) + ADUC_DOWNLOADS_FOLDER "/";
+
+    return option.compare(0, prefix.size(), prefix) == 0 && option.find("..") == std::string::npos;
+}
+
 /**
  * @brief Add supported target options to the arguments list.
  *
@@ -104,7 +131,8 @@ void AddOptionsToArgs(const std::string& targetOptions, std::vector<std::string>
     {
         if (!option.empty()
             && ((option == "-o") || (option == "Dpkg::Options::=--force-confdef")
-                || (option == "Dpkg::Options::=--force-confold")))
+                || (option == "Dpkg::Options::=--force-confold") || (option == dpkg_option_force_unsafe_io)
+                || IsDownloadsArchivesOption(option)))
         {
             args->emplace_back(option);
         }
@@ -115,6 +143,44 @@ void AddOptionsToArgs(const std::string& targetOptions, std::vector<std::string>
     }
 }
 
+/**
+ * @brief Syncs the file systems of dpkg_written_folders, once each.
+ *
+ * With dpkg_option_force_unsafe_io, dpkg doesn't fsync each file it unpacks, which on eMMC and SD cards takes most
+ * of the install time. The files are made durable by this one sync of each file system at the end of the transaction
+ * instead. It relies on the file system, e.g. ext4 with its journal, to order the renames after the data.
+ *
+ * @return bool false if a file system couldn't be synced.
+ */
+static bool SyncDpkgFileSystems()
+{
+    std::unordered_set<dev_t> syncedDevices;
+    bool succeeded = true;
+
+    for (const char* folder : dpkg_written_folders)
+    {
+        struct stat st = {};
+        if (stat(folder, &st) != 0 || !syncedDevices.insert(st.st_dev).second)
+        {
+            continue;
+        }
+
+        const int fd = open(folder, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1 || syncfs(fd) != 0)
+        {
+            Log_Error("Cannot sync the file system of %s, errno: %d", folder, errno);
+            succeeded = false;
+        }
+
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+
+    return succeeded;
+}
+
 /**
  * @brief Removes enclosing single-quotes in targetData, if exist. Then add splitted package names to
  * the given output argument list.
@@ -159,7 +225,7 @@ ADUShellTaskResult Update(const ADUShell_LaunchArguments& /*launchArgs*/)
     ADUShellTaskResult taskResult;
 
     const std::vector<std::string> aptArgs = { apt_option_update };
-    taskResult.SetExitStatus(ADUC_LaunchChildProcess(aptget_command, aptArgs, taskResult.Output()));
+    Common::RunChildProcess(aptget_command, aptArgs, taskResult);
     if (taskResult.ExitStatus() != 0)
     {
         Log_Warn("apt-get update failed. (Exit code: %d)", taskResult.ExitStatus());
@@ -200,7 +266,7 @@ ADUShellTaskResult Download(const ADUShell_LaunchArguments& launchArgs)
         return taskResult;
     }
 
-    taskResult.SetExitStatus(ADUC_LaunchChildProcess(aptget_command, aptArgs, taskResult.Output()));
+    Common::RunChildProcess(aptget_command, aptArgs, taskResult);
     return taskResult;
 }
 
@@ -234,7 +300,16 @@ ADUShellTaskResult Install(const ADUShell_LaunchArguments& launchArgs)
         return taskResult;
     }
 
-    taskResult.SetExitStatus(ADUC_LaunchChildProcess(aptget_command, aptArgs, taskResult.Output()));
+    const bool unsafeIo = std::find(aptArgs.begin(), aptArgs.end(), dpkg_option_force_unsafe_io) != aptArgs.end();
+
+    Common::RunChildProcess(aptget_command, aptArgs, taskResult);
+
+    // Also after a failed install, since dpkg may have unpacked some of the packages.
+    if (unsafeIo && !SyncDpkgFileSystems() && taskResult.ExitStatus() == 0)
+    {
+        taskResult.SetExitStatus(EXIT_FAILURE);
+    }
+
     return taskResult;
 }
 
@@ -268,7 +343,7 @@ ADUShellTaskResult Remove(const ADUShell_LaunchArguments& launchArgs)
         return taskResult;
     }
 
-    taskResult.SetExitStatus(ADUC_LaunchChildProcess(aptget_command, aptArgs, taskResult.Output()));
+    Common::RunChildProcess(aptget_command, aptArgs, taskResult);
     return taskResult;
 }
 
@@ -285,7 +360,7 @@ ADUShellTaskResult RemoveUnusedDependencies(const ADUShell_LaunchArguments& /*la
 {
     ADUShellTaskResult taskResult;
     std::vector<std::string> aptArgs = { apt_option_y, apt_option_install, apt_option_auto_remove };
-    taskResult.SetExitStatus(ADUC_LaunchChildProcess(aptget_command, aptArgs, taskResult.Output()));
+    Common::RunChildProcess(aptget_command, aptArgs, taskResult);
     return taskResult;
 }
 
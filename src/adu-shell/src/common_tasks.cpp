@@ -6,8 +6,10 @@
  * Licensed under the MIT License.
  */
 #include "common_tasks.hpp"
+#include "aduc/config_utils.h"
 #include "aduc/process_utils.hpp"
 
+#include <fstream>
 #include <unordered_map>
 namespace Adu
 {
@@ -17,18 +19,73 @@ namespace Tasks
 {
 namespace Common
 {
+/**
+ * @brief Returns whether kexecReboot is set in the configuration file.
+ */
+bool IsKexecRebootEnabled()
+{
+    bool enabled = false;
+    ADUC_ConfigInfo config = {};
+
+    if (ADUC_ConfigInfo_Init(&config, ADUC_CONF_FILE_PATH))
+    {
+        enabled = config.kexecReboot;
+    }
+
+    ADUC_ConfigInfo_UnInit(&config);
+    return enabled;
+}
+
+/**
+ * @brief Returns whether a kernel is loaded for kexec, e.g. by the apply of an update.
+ */
+static bool IsKexecKernelLoaded()
+{
+    std::ifstream file{ "/sys/kernel/kexec_loaded" };
+    char loaded = '0';
+
+    return file.get(loaded) && loaded == '1';
+}
+
 /**
  * @brief Reboots the system.
  *
+ * With kexecReboot set in the configuration file, and a kernel loaded for kexec, the system shuts down as for a
+ * reboot, then boots into that kernel without going through the firmware and the bootloader. Otherwise, or if that
+ * fails, it reboots through the firmware.
+ *
  * @param launchArgs The adu-shell launch command-line arguments that has been parsed.
  * @return A result from child process.
  */
 ADUShellTaskResult Reboot(const ADUShell_LaunchArguments& /*launchArgs*/)
 {
-    Log_Info("Launching child process to reboot the device.");
     ADUShellTaskResult taskResult;
-    std::vector<std::string> args{ "--reboot", "--no-wall" };
     std::string output;
+
+    if (IsKexecRebootEnabled() && IsKexecKernelLoaded())
+    {
+        Log_Info("Launching child process to reboot the device into the loaded kernel with kexec.");
+
+        // Stops the services and unmounts the file systems, then runs 'kexec -e'.
+        const std::vector<std::string> kexecArgs{ "kexec" };
+        const int exitStatus = ADUC_LaunchChildProcess("/bin/systemctl", kexecArgs, output);
+        if (!output.empty())
+        {
+            Log_Info(output.c_str());
+        }
+
+        if (exitStatus == 0)
+        {
+            taskResult.SetExitStatus(exitStatus);
+            return taskResult;
+        }
+
+        Log_Warn("kexec reboot failed (exit code: %d), rebooting through the firmware.", exitStatus);
+        output.clear();
+    }
+
+    Log_Info("Launching child process to reboot the device.");
+    std::vector<std::string> args{ "--reboot", "--no-wall" };
     taskResult.SetExitStatus(ADUC_LaunchChildProcess("/sbin/reboot", args, output));
     if (!output.empty())
     {
@@ -37,6 +94,47 @@ ADUShellTaskResult Reboot(const ADUShell_LaunchArguments& /*launchArgs*/)
     return taskResult;
 }
 
+/**
+ * @brief Runs @p command in a child process, logging each line of its output as it arrives.
+ *
+ * Sets the exit status of @p taskResult and appends the last ADUSHELL_CHILD_OUTPUT_TAIL_SIZE bytes of the
+ * output to its Output().
+ *
+ * @param command Name of a command to run.
+ * @param args List of arguments for the command.
+ * @param taskResult The result of the task running the command.
+ */
+void RunChildProcess(
+    const std::string& command,
+    const std::vector<std::string>& args,
+    ADUShellTaskResult& taskResult) // NOLINT(google-runtime-references)
+{
+    bool loggedLine = false;
+    std::string outputTail;
+
+    const int exitStatus = ADUC_LaunchChildProcess(
+        command,
+        args,
+        [&loggedLine](const std::string& line) {
+            if (!loggedLine)
+            {
+                Log_Info("########## Begin Child's Logs ##########");
+                loggedLine = true;
+            }
+            Log_Info("#  %s", line.c_str());
+        },
+        ADUSHELL_CHILD_OUTPUT_TAIL_SIZE,
+        outputTail);
+
+    if (loggedLine)
+    {
+        Log_Info("########## End Child's Logs ##########");
+    }
+
+    taskResult.SetExitStatus(exitStatus);
+    taskResult.Output() += outputTail;
+}
+
 /**
  * @brief Runs appropriate command based on an action and other arguments in launchArgs.
  *
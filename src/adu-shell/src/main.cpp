@@ -7,10 +7,12 @@
  */
 #include <getopt.h>
 #include <string.h>
+#include <sys/socket.h> // for getsockopt, struct ucred
 #include <unistd.h> // for getegid, geteuid, and setuid.
 #include <unordered_map>
 #include <vector>
 
+#include "aduc/adushell_broker_utils.hpp"
 #include "aduc/c_utils.h"
 #include "aduc/config_utils.h"
 #include "aduc/logging.h"
@@ -30,6 +32,11 @@ namespace CommonTasks = Adu::Shell::Tasks::Common;
 namespace AptGetTasks = Adu::Shell::Tasks::AptGet;
 #endif
 
+#ifdef ADUSHELL_RAWIMAGE
+#    include "rawimage_tasks.hpp"
+namespace RawImageTasks = Adu::Shell::Tasks::RawImage;
+#endif
+
 #ifdef ADUSHELL_SCRIPT
 #   include "script_tasks.hpp"
 namespace ScriptTasks = Adu::Shell::Tasks::Script;
@@ -63,6 +70,7 @@ int ParseLaunchArguments(const int argc, char** argv, ADUShell_LaunchArguments*
     launchArgs->targetData = nullptr;
     launchArgs->logFile = nullptr;
     launchArgs->showVersion = false;
+    launchArgs->broker = false;
 
 #if _ADU_DEBUG
     launchArgs->logLevel = ADUC_LOG_DEBUG;
@@ -80,7 +88,7 @@ int ParseLaunchArguments(const int argc, char** argv, ADUShell_LaunchArguments*
         // "--version"           |   Show adu-shell version number.
         //
         // "--update-type"       |   An ADU Update Type.
-        //                             e.g., "microsoft/apt", "microsoft/swupdate", "common".
+        //                             e.g., "microsoft/apt", "microsoft/swupdate", "microsoft/rawimage", "common".
         //
         // "--update-action"     |   An action to perform.
         //                             e.g., "initialize", "download", "install", "apply", "cancel", "rollback", "reboot".
@@ -95,9 +103,12 @@ int ParseLaunchArguments(const int argc, char** argv, ADUShell_LaunchArguments*
         //
         // "--log-level"         |   Log verbosity level.
         //
+        // "--broker"            |   Serve requests read from the standard input socket, see ADUC_LaunchAduShell.
+        //
         static struct option long_options[] =
         {
             { "version",           no_argument,       nullptr, 'v' },
+            { "broker",            no_argument,       nullptr, 'b' },
             { "update-type",       required_argument, nullptr, 't' },
             { "update-action",     required_argument, nullptr, 'a' },
             { "target-data",       required_argument, nullptr, 'd' },
@@ -111,7 +122,7 @@ int ParseLaunchArguments(const int argc, char** argv, ADUShell_LaunchArguments*
 
         /* getopt_long stores the option index here. */
         int option_index = 0;
-        int option = getopt_long(argc, argv, "vt:a:d:o:f:l:", long_options, &option_index);
+        int option = getopt_long(argc, argv, "vbt:a:d:o:f:l:", long_options, &option_index);
 
         /* Detect the end of the options. */
         if (option == -1)
@@ -125,6 +136,10 @@ int ParseLaunchArguments(const int argc, char** argv, ADUShell_LaunchArguments*
             launchArgs->showVersion = true;
             break;
 
+        case 'b':
+            launchArgs->broker = true;
+            break;
+
         case 't':
             launchArgs->updateType = optarg;
             break;
@@ -195,6 +210,11 @@ int ParseLaunchArguments(const int argc, char** argv, ADUShell_LaunchArguments*
         }
     }
 
+    if (launchArgs->broker)
+    {
+        return result;
+    }
+
     if (launchArgs->updateType == nullptr)
     {
         printf("Missing --update-type option.\n");
@@ -210,25 +230,10 @@ int ParseLaunchArguments(const int argc, char** argv, ADUShell_LaunchArguments*
     return result;
 }
 
-void ShowChildProcessLogs(const std::string& output)
-{
-    if (!output.empty())
-    {
-        std::stringstream ss(output);
-        std::string token;
-        Log_Info("########## Begin Child's Logs ##########");
-        while (std::getline(ss, token, '\n'))
-        {
-            Log_Info("#  %s", token.c_str());
-        }
-        Log_Info("########## End Child's Logs ##########");
-    }
-}
-
 /**
- * @brief Starts a child process for task(s) for a given update actions.
+ * @brief Runs the task(s) for a given update action, in child processes.
  */
-int ADUShell_Dowork(const ADUShell_LaunchArguments& launchArgs)
+ADUShellTaskResult ADUShell_RunTask(const ADUShell_LaunchArguments& launchArgs)
 {
     ADUShellTaskResult taskResult;
 
@@ -237,6 +242,7 @@ int ADUShell_Dowork(const ADUShell_LaunchArguments& launchArgs)
         const std::unordered_map<std::string, ADUShellTaskFuncType> actionMap = {
             { adushconst::update_type_common, CommonTasks::DoCommonTask },
             { adushconst::update_type_microsoft_apt, AptGetTasks::DoAptGetTask },
+            { adushconst::update_type_microsoft_rawimage, RawImageTasks::DoRawImageTask },
             { adushconst::update_type_microsoft_script, ScriptTasks::DoScriptTask },
             { adushconst::update_type_microsoft_swupdate, SWUpdateTasks::DoSWUpdateTask }
         };
@@ -250,18 +256,26 @@ int ADUShell_Dowork(const ADUShell_LaunchArguments& launchArgs)
         taskResult.SetExitStatus(ADUSHELL_EXIT_UNSUPPORTED);
     }
 
-    ShowChildProcessLogs(taskResult.Output());
+    return taskResult;
+}
 
-    return taskResult.ExitStatus();
+/**
+ * @brief Starts a child process for task(s) for a given update actions.
+ */
+int ADUShell_Dowork(const ADUShell_LaunchArguments& launchArgs)
+{
+    return ADUShell_RunTask(launchArgs).ExitStatus();
 }
 
 /**
- * @brief Checking if the process has permission to run the adu shell operations
+ * @brief Checking if the user and group returned by @p geteuidFunc and @p getegidFunc may run the adu shell operations
  *
- * @return true if the process is either in the trusted Group, or is one of the adu shell trusted users.
+ * @param geteuidFunc The function for getting the effective user id.
+ * @param getegidFunc The function for getting the effective group id.
+ * @return true if the user is either in the trusted Group, or is one of the adu shell trusted users.
  * @return false otherwise
  */
-bool ADUShell_PermissionCheck()
+static bool ADUShell_IsTrusted(const std::function<uid_t()>& geteuidFunc, const std::function<gid_t()>& getegidFunc)
 {
     bool isTrusted = false;
 
@@ -271,7 +285,7 @@ bool ADUShell_PermissionCheck()
     {
         VECTOR_HANDLE aduShellTrustedUsers = ADUC_ConfigInfo_GetAduShellTrustedUsers(&config);
 
-        isTrusted = VerifyProcessEffectiveUser(aduShellTrustedUsers);
+        isTrusted = VerifyProcessEffectiveUser(aduShellTrustedUsers, geteuidFunc);
 
         ADUC_ConfigInfo_FreeAduShellTrustedUsers(aduShellTrustedUsers);
         aduShellTrustedUsers = nullptr;
@@ -282,7 +296,7 @@ bool ADUShell_PermissionCheck()
     // check whether the effective user is in the trusted group
     if (!isTrusted)
     {
-        isTrusted = VerifyProcessEffectiveGroup(ADUSHELL_EFFECTIVE_GROUP_NAME);
+        isTrusted = VerifyProcessEffectiveGroup(ADUSHELL_EFFECTIVE_GROUP_NAME, getegidFunc);
     }
 
     // If a trusted user list is provided, the permission check passes if the user is either in trusted group,
@@ -290,6 +304,81 @@ bool ADUShell_PermissionCheck()
     return isTrusted;
 }
 
+/**
+ * @brief Checking if the process has permission to run the adu shell operations
+ *
+ * @return true if the process is either in the trusted Group, or is one of the adu shell trusted users.
+ * @return false otherwise
+ */
+bool ADUShell_PermissionCheck()
+{
+    return ADUShell_IsTrusted(geteuid, getegid);
+}
+
+/**
+ * @brief Serves the requests read from the socket @p fd, until it's closed.
+ *
+ * Each request holds the adu-shell arguments for an action, which is run as if adu-shell was launched with
+ * them. The response holds the exit status and the end of the output of the action. The process at the other
+ * end of the socket must pass the same checks as the user launching adu-shell.
+ *
+ * @param fd The socket connected to the process sending the requests, see ADUC_LaunchAduShell.
+ * @return 0 once the socket is closed, EPERM if the process sending the requests isn't trusted.
+ */
+int ADUShell_RunBroker(int fd)
+{
+    struct ucred peer = {};
+    socklen_t peerSize = sizeof(peer);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peerSize) != 0
+        || !ADUShell_IsTrusted([&peer]() { return peer.uid; }, [&peer]() { return peer.gid; }))
+    {
+        Log_Error("The adu-shell broker's peer is not trusted.");
+        return EPERM;
+    }
+
+    Log_Info("Running as a broker for pid %d", peer.pid);
+
+    std::vector<std::string> request;
+    while (ADUC_AduShellBroker_ReadMessage(fd, &request))
+    {
+        std::vector<char*> argv;
+        argv.reserve(request.size() + 2);
+        argv.emplace_back(const_cast<char*>("adu-shell")); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+        for (std::string& arg : request)
+        {
+            argv.emplace_back(&arg[0]);
+        }
+        argv.emplace_back(nullptr);
+
+        ADUShell_LaunchArguments launchArgs;
+        ADUShellTaskResult taskResult;
+
+        // Start getopt over for each request.
+        optind = 0;
+
+        if (ParseLaunchArguments(static_cast<int>(argv.size() - 1), &argv[0], &launchArgs) != 0 || launchArgs.broker
+            || launchArgs.showVersion)
+        {
+            Log_Error("Invalid adu-shell broker request.");
+            taskResult.SetExitStatus(EXIT_FAILURE);
+        }
+        else
+        {
+            taskResult = ADUShell_RunTask(launchArgs);
+        }
+
+        if (!ADUC_AduShellBroker_WriteMessage(fd, { std::to_string(taskResult.ExitStatus()), taskResult.Output() }))
+        {
+            break;
+        }
+    }
+
+    Log_Info("adu-shell broker is done.");
+
+    return 0;
+}
+
 /**
  * @brief Main method.
  *
@@ -347,7 +436,10 @@ int main(int argc, char** argv)
             effectiveUserId,
             getegid());
 
-        ret = ADUShell_Dowork(launchArgs);
+        // As root, adu-shell can't be signaled by the agent, so it terminates its children itself once cancelled.
+        ADUC_StartChildProcessControlWatcher();
+
+        ret = launchArgs.broker ? ADUShell_RunBroker(STDIN_FILENO) : ADUShell_Dowork(launchArgs);
 
         ADUC_Logging_Uninit();
 
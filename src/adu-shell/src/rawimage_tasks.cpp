@@ -0,0 +1,127 @@
+/**
+ * @file rawimage_tasks.cpp
+ * @brief Implements tasks for microsoft/rawimage actions.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "rawimage_tasks.hpp"
+#include "aduc/hash_utils.h"
+#include "aduc/logging.h"
+#include "aduc/raw_image_utils.h"
+#include "common_tasks.hpp"
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+namespace Adu
+{
+namespace Shell
+{
+namespace Tasks
+{
+namespace RawImage
+{
+/**
+ * @brief Writes the image file or pipe in launchArgs.targetData to a block device.
+ *
+ * @param launchArgs An adu-shell launch arguments.
+ * @return A result from the write.
+ */
+ADUShellTaskResult Install(const ADUShell_LaunchArguments& launchArgs)
+{
+    ADUShellTaskResult taskResult;
+    std::unordered_map<std::string, std::string> options;
+    SHAversion algorithm = SHA256;
+    ADUC_RawImageStats stats = {};
+
+    for (const char* option : launchArgs.targetOptions)
+    {
+        const char* separator = strchr(option, '=');
+        if (separator != nullptr)
+        {
+            options[std::string(option, separator - option)] = separator + 1;
+        }
+    }
+
+    const std::string& device = options["device"];
+    const std::string& bmap = options["bmap"];
+    const std::string& hash = options["hash"];
+    const std::string& hashType = options["hashType"];
+
+    if (launchArgs.targetData == nullptr || device.empty())
+    {
+        Log_Error("Missing the image or the device option.");
+        taskResult.SetExitStatus(EXIT_FAILURE);
+        return taskResult;
+    }
+
+    if (!hashType.empty() && !ADUC_HashUtils_GetShaVersionForTypeString(hashType.c_str(), &algorithm))
+    {
+        Log_Error("Unsupported hash type: '%s'", hashType.c_str());
+        taskResult.SetExitStatus(EXIT_FAILURE);
+        return taskResult;
+    }
+
+    Log_Info("Writing image. Path: %s, Device: %s", launchArgs.targetData, device.c_str());
+
+    // adu-shell runs as root; only write to a block device nothing uses.
+    if (!ADUC_RawImage_WriteToDevice(
+            launchArgs.targetData,
+            bmap.empty() ? nullptr : bmap.c_str(),
+            device.c_str(),
+            hash.empty() ? nullptr : hash.c_str(),
+            algorithm,
+            &stats))
+    {
+        taskResult.SetExitStatus(EXIT_FAILURE);
+    }
+
+    return taskResult;
+}
+
+/**
+ * @brief Runs appropriate command based on an action and other arguments in launchArgs.
+ *
+ * @param launchArgs An adu-shell launch arguments.
+ * @return A result from child process.
+ */
+ADUShellTaskResult DoRawImageTask(const ADUShell_LaunchArguments& launchArgs)
+{
+    ADUShellTaskResult taskResult;
+    ADUShellTaskFuncType taskProc = nullptr;
+
+    try
+    {
+        const std::unordered_map<ADUShellAction, ADUShellTaskFuncType> actionMap = {
+            { ADUShellAction::Install, Install },
+            { ADUShellAction::Reboot, Adu::Shell::Tasks::Common::Reboot }
+        };
+
+        taskProc = actionMap.at(launchArgs.action);
+    }
+    catch (const std::exception& ex)
+    {
+        Log_Error("Unsupported action: '%s'", launchArgs.updateAction);
+        taskResult.SetExitStatus(ADUSHELL_EXIT_UNSUPPORTED);
+        return taskResult;
+    }
+
+    try
+    {
+        taskResult = taskProc(launchArgs);
+    }
+    catch (const std::exception& ex)
+    {
+        Log_Error("Exception occurred while running task: '%s'", ex.what());
+        taskResult.SetExitStatus(EXIT_FAILURE);
+    }
+
+    return taskResult;
+}
+
+} // namespace RawImage
+} // namespace Tasks
+} // namespace Shell
+} // namespace Adu
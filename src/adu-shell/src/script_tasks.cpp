@@ -64,7 +64,7 @@ ADUShellTaskResult Execute(const ADUShell_LaunchArguments& launchArgs)
         }
     }
 
-    taskResult.SetExitStatus(ADUC_LaunchChildProcess(launchArgs.targetData, args, taskResult.Output()));
+    Common::RunChildProcess(launchArgs.targetData, args, taskResult);
 
     if (filePermissionsChanged)
     {
@@ -49,7 +49,7 @@ ADUShellTaskResult Install(const ADUShell_LaunchArguments& launchArgs)
 
     args.emplace_back("-i");
     args.emplace_back(launchArgs.targetData);
-    taskResult.SetExitStatus(ADUC_LaunchChildProcess(SWUpdateCommand, args, taskResult.Output()));
+    Common::RunChildProcess(SWUpdateCommand, args, taskResult);
 
     return taskResult;
 }
@@ -75,9 +75,15 @@ ADUShellTaskResult Apply(const ADUShell_LaunchArguments& launchArgs)
         args.emplace_back(launchArgs.logFile);
     }
 
+    // Also loads the kernel of the updated partition, for Common::Reboot to boot into it with kexec.
+    if (Common::IsKexecRebootEnabled())
+    {
+        args.emplace_back("-k");
+    }
+
     args.emplace_back("-a");
 
-    taskResult.SetExitStatus(ADUC_LaunchChildProcess(SWUpdateCommand, args, taskResult.Output()));
+    Common::RunChildProcess(SWUpdateCommand, args, taskResult);
     return taskResult;
 }
 
@@ -114,7 +120,7 @@ ADUShellTaskResult Cancel(const ADUShell_LaunchArguments& launchArgs)
 
     args.emplace_back("-r");
 
-    taskResult.SetExitStatus(ADUC_LaunchChildProcess(SWUpdateCommand, args, taskResult.Output()));
+    Common::RunChildProcess(SWUpdateCommand, args, taskResult);
     return taskResult;
 }
 
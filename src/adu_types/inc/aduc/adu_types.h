@@ -27,8 +27,10 @@ typedef struct tagADUC_LaunchArguments
     bool iotHubTracingEnabled; /**< Whether to enable logging from IoT Hub SDK */
     bool showVersion; /**< Show an agent version */
     bool healthCheckOnly; /**< Only check agent health. Doesn't process any data or messages from services. */
+    bool profileStartup; /**< Print the timings of the startup phases once the first reported property is sent. */
     char* contentHandlerFilePath; /**< A full path of an update content handler to be registered */
     char* componentEnumeratorFilePath; /**< A full path of a component enumerator to be registered */
+    char* componentEnumeratorId; /**< The id of an additional component enumerator to be registered */
     char* contentDownloaderFilePath; /**< A full path of a content downloader to be registered */
     char* updateType;
 } ADUC_LaunchArguments;
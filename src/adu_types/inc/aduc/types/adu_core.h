@@ -151,6 +151,15 @@ typedef void (*SandboxDestroyCallbackFunc)(ADUC_Token token, const char* workflo
  */
 typedef void (*DoWorkCallbackFunc)(ADUC_Token Token, ADUC_WorkflowDataToken workflowData);
 
+/**
+ * @brief Callback method to download, in the background, the files of a deployment that waits for the current one to
+ * complete, so that they are already present once it starts. Stops the prefetch of any other deployment.
+ * @param token Opaque token.
+ * @param workflowHandle The ADUC_WorkflowHandle of the waiting deployment, only valid during the call,
+ * or NULL to only stop the prefetch.
+ */
+typedef void (*PrefetchCallbackFunc)(ADUC_Token token, void* workflowHandle);
+
 // ADUC_UpdateActionCallbacks structure, to be filled out by upper-layer.
 
 /**
@@ -173,6 +182,8 @@ typedef struct tagADUC_UpdateActionCallbacks
 
     DoWorkCallbackFunc DoWorkCallback; /**< DoWork function. */
 
+    PrefetchCallbackFunc PrefetchCallback; /**< Prefetch function. Optional, NULL if the platform doesn't prefetch. */
+
     ADUC_Token PlatformLayerHandle; /**< Opaque token, passed to callbacks. */
 } ADUC_UpdateActionCallbacks;
 
@@ -226,6 +237,7 @@ typedef enum tagADUC_ResultCode
 
     ADUC_Result_IsInstalled_Installed = 900,     /**< Succeeded and content is installed. */
     ADUC_Result_IsInstalled_NotInstalled = 901,  /**< Succeeded and content is not installed */
+    ADUC_Result_IsInstalled_InProgress = 902,    /**< Async operation started. CompletionCallback will be called when complete. */
 
 } ADUC_ResultCode;
 
@@ -8,7 +8,7 @@
 #ifndef ADUC_TYPES_DOWNLOAD_H
 #define ADUC_TYPES_DOWNLOAD_H
 
-#include <stdint.h> // uint64_t
+#include <stdint.h> // uint64_t, int64_t
 
 /**
  * @brief Defines download progress state for download progress callback.
@@ -32,4 +32,23 @@ typedef void (*ADUC_DownloadProgressCallback)(
     uint64_t bytesTransferred,
     uint64_t bytesTotal);
 
+/**
+ * @brief Describes a downloaded file whose content hash has already been verified.
+ *
+ * A downloader extension fills this in after it has validated the file hash, so that
+ * the caller can skip re-hashing the file for as long as the file size and
+ * modification time stay the same.
+ */
+typedef struct tagADUC_DownloadVerifiedFile
+{
+    char* FilePath; /**< Full path to the verified file. */
+    char* HashType; /**< The type of the verified hash, e.g. "sha256". */
+    char* HashValue; /**< The base64 encoded verified hash. */
+    uint64_t SizeInBytes; /**< File size at the time of verification. */
+    int64_t ModifiedTimeSec; /**< Seconds part of the file modification time at the time of verification. */
+    int64_t ModifiedTimeNsec; /**< Nanoseconds part of the file modification time at the time of verification. */
+    int64_t ChangeTimeSec; /**< Seconds part of the file status change time at the time of verification. */
+    int64_t ChangeTimeNsec; /**< Nanoseconds part of the file status change time at the time of verification. */
+} ADUC_DownloadVerifiedFile;
+
 #endif // ADUC_TYPES_DOWNLOAD_H
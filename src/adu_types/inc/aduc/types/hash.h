@@ -16,6 +16,11 @@
 
 EXTERN_C_BEGIN
 
+/**
+ * @brief The size of the largest supported digest, that of SHA-512, in bytes.
+ */
+#define ADUC_HASH_MAX_DIGEST_SIZE 64
+
 /**
  * @brief Encapsulates the hash and the hash type
  */
@@ -23,6 +28,9 @@ typedef struct tagADUC_Hash
 {
     char* value; /** The value of the actual hash */
     char* type; /** The type of hash held in the entry*/
+    int algorithm; /** The SHAversion of type, resolved by ADUC_Hash_Init. Only valid if digestSize isn't 0. */
+    size_t digestSize; /** The size of digest, or 0 if value wasn't decoded, e.g. it isn't a valid hash of type. */
+    unsigned char digest[ADUC_HASH_MAX_DIGEST_SIZE]; /** The binary value of the hash, decoded once from value. */
 } ADUC_Hash;
 
 EXTERN_C_END
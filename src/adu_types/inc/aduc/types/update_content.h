@@ -59,6 +59,16 @@ EXTERN_C_BEGIN
  */
 #define ADUCITF_FIELDNAME_STEPRESULTS "stepResults"
 
+/**
+ * @brief JSON field name for timing property, the time spent in each kind of operation of the deployment.
+ */
+#define ADUCITF_FIELDNAME_TIMING "timing"
+
+/**
+ * @brief JSON field name for resources property, the resource usage of the agent during the deployment.
+ */
+#define ADUCITF_FIELDNAME_RESOURCES "resources"
+
 /**
  * @brief JSON field name for ResultCode property.
  */
@@ -182,6 +192,39 @@ EXTERN_C_BEGIN
  */
 #define ADUCITF_FIELDNAME_SIZEINBYTES "sizeInBytes"
 
+/**
+ * @brief JSON field name for the optional hashes of the fixed-size chunks of a file, e.g.
+ * "chunkHashes": { "chunkSize": 4194304, "sha256": [ "<chunk 0 hash>", "<chunk 1 hash>", ... ] }
+ */
+#define ADUCITF_FIELDNAME_CHUNKHASHES "chunkHashes"
+
+/**
+ * @brief JSON field name for the size of the chunks (in bytes) in chunkHashes.
+ */
+#define ADUCITF_FIELDNAME_CHUNKSIZE "chunkSize"
+
+/**
+ * @brief JSON field name for the optional encoding a file is transferred in, e.g. "gzip". The hashes and size of the
+ * file are those of the decoded file, which is what's stored in the work folder.
+ */
+#define ADUCITF_FIELDNAME_TRANSPORTENCODING "transportEncoding"
+
+/**
+ * @brief JSON field name for the optional hashes of the encoded content of a file with a transport encoding.
+ */
+#define ADUCITF_FIELDNAME_TRANSPORTHASHES "transportHashes"
+
+/**
+ * @brief JSON field name for the optional size (in bytes) of the encoded content of a file with a transport encoding.
+ */
+#define ADUCITF_FIELDNAME_TRANSPORTSIZEINBYTES "transportSizeInBytes"
+
+/**
+ * @brief JSON field name for the optional array of other URIs a file can be downloaded from, e.g. mirrors of its
+ * download URI in other regions. They must serve the same content, which is verified against the same hashes.
+ */
+#define ADUCITF_FIELDNAME_ALTERNATEURIS "alternateUris"
+
 /**
  * @brief JSON field name for the updateManifest's hash held within the associated JWT
  */
@@ -286,6 +329,15 @@ typedef struct tagADUC_FileEntity
     char* TargetFilename; /**< File name to store content in DownloadUri to. */
     char* Arguments; //**< Arguments associate with this file. */
     size_t SizeInBytes; /**< File size. */
+    ADUC_Hash* ChunkHashes; /**< Hashes of the consecutive ChunkSizeInBytes chunks of the file, or NULL. */
+    size_t ChunkHashCount; /**< Total number of hashes in ChunkHashes; the last chunk may be shorter. */
+    size_t ChunkSizeInBytes; /**< Size of the chunks that ChunkHashes are for. */
+    char* TransportEncoding; /**< Encoding the file is downloaded in, e.g. "gzip", or NULL if none. */
+    ADUC_Hash* TransportHashes; /**< Hashes of the encoded content, or NULL. */
+    size_t TransportHashCount; /**< Total number of hashes in TransportHashes. */
+    size_t TransportSizeInBytes; /**< Size of the encoded content, or 0 if unknown. */
+    char** AlternateUris; /**< Other URIs of the same content, e.g. mirrors, or NULL. */
+    size_t AlternateUriCount; /**< Total number of URIs in AlternateUris. */
 } ADUC_FileEntity;
 
 /**
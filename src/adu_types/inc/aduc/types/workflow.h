@@ -10,6 +10,7 @@
 
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "aduc/result.h"
 #include "aduc/types/adu_core.h"
@@ -162,12 +163,19 @@ typedef struct tagADUC_WorkflowData
 
     _Bool StartupIdleCallSent; /**< True once the initial Idle call is sent to the orchestrator on agent startup. */
 
+    _Bool WarmStartAttempted; /**< True once the goal state persisted by the previous run was resumed, if any. */
+
+    _Bool WarmStartUnconfirmed; /**< True while the workflow resumed by the warm start waits for the twin to confirm
+                                     it; until then it is only downloaded. */
+
     _Bool OperationCancelled; /**< Was the operation in progress requested to cancel? */
 
     ADUC_SystemRebootState SystemRebootState; /**< The system reboot state. */
 
     ADUC_AgentRestartState AgentRestartState; /**< The agent restart state. */
 
+    _Bool InProcessRestartPending; /**< True while an agent restart is done in-process, by reloading the update content handlers once the workflow is idle. */
+
     ADUC_DownloadProgressCallback DownloadProgressCallback; /**< Callback for download progress. */
 
     ADUC_ReportStateAndResultAsyncCallback ReportStateAndResultAsyncCallback; /**< Callback for reporting workflow state and result. */
@@ -234,6 +242,17 @@ typedef struct tagADUC_WorkflowData
 
     char* LastGoalStateJson; /**< The goal state data sent from DU Service to DU Agent. This data is needed when re-processing latest update on the device */
 
+    uint64_t LastGoalStateDigest; /**< The digest of LastGoalStateJson, see ADUC_WorkflowData_GetGoalStateDigest. */
+
+    //
+    // Per-device state, for a process that hosts several devices. NULL for the agent's own device.
+    //
+    void* ClientHandle; /**< The ADUC_ClientHandle of the device, or NULL for g_iotHubClientHandleForADUComponent. */
+
+    struct tagADUC_ReportingQueue* ReportingQueue; /**< The reports of the device not sent or acknowledged yet, or NULL for those of the agent's device. */
+
+    char* DataFolder; /**< The folder of the goal state and workflow state journal of the device, or NULL for ADUC_DATA_FOLDER. */
+
 #ifdef ADUC_BUILD_UNIT_TESTS
     ADUC_TestOverride_Hooks* TestOverrides; /**< Test hook overrides. This will be NULL when not testing. */
 #endif
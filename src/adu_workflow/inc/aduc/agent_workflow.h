@@ -10,6 +10,7 @@
 
 #include "aduc/types/workflow.h"
 #include <stdbool.h> // for _Bool
+#include <stdint.h> // for int64_t
 
 EXTERN_C_BEGIN
 
@@ -19,6 +20,10 @@ void ADUC_Workflow_HandlePropertyUpdate(ADUC_WorkflowData* currentWorkflowData,
 
 void ADUC_Workflow_HandleComponentChanged(ADUC_WorkflowData* workflowData);
 
+void ADUC_Workflow_WarmStart(ADUC_WorkflowData* workflowData);
+
+void ADUC_Workflow_CompleteInProcessRestart(ADUC_WorkflowData* workflowData);
+
 void ADUC_Workflow_HandleUpdateAction(ADUC_WorkflowData* workflowData);
 
 void ADUC_Workflow_TransitionWorkflow(ADUC_WorkflowData* workflowData);
@@ -34,6 +39,9 @@ typedef struct tagADUC_MethodCall_Data
 {
     ADUC_WorkCompletionData WorkCompletionData;
     ADUC_WorkflowData* WorkflowData;
+    int64_t StartTime; //!< When the operation started, see ADUC_Timing_Now.
+    ADUC_Result CompletionResult; //!< The result of the operation, while its completion is queued for the main loop.
+    struct tagADUC_MethodCall_Data* NextCompletion; //!< The next queued completion.
 } ADUC_MethodCall_Data;
 
 void ADUC_Workflow_MethodCall_Idle(ADUC_WorkflowData* workflowData);
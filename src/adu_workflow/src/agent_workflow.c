@@ -13,27 +13,139 @@
 #include "aduc/agent_workflow.h"
 
 #define __STDC_FORMAT_MACROS
+#include <errno.h>
 #include <inttypes.h> // PRIu64
+#include <limits.h> // for PATH_MAX
+#include <malloc.h> // for malloc_trim
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <time.h>
 
 #include "aduc/agent_orchestration.h"
+#include "aduc/component_inventory_cache.h"
+#include "aduc/event_loop_utils.h"
 #include "aduc/logging.h"
+#include "aduc/metrics_utils.h"
+#include "aduc/progress_telemetry.h"
 #include "aduc/result.h"
+#include "aduc/resource_sampler.h"
 #include "aduc/string_c_utils.h"
 #include "aduc/system_utils.h"
+#include "aduc/thermal_utils.h"
+#include "aduc/timing_utils.h"
+#include "aduc/tracepoints.h"
 #include "aduc/types/workflow.h"
 #include "aduc/workflow_data_utils.h"
 #include "aduc/workflow_utils.h"
 
+#include <parson.h>
 #include <pthread.h>
 
+/**
+ * @brief The last goal state received from the service, kept so that the next run of the agent can resume it
+ * before the twin is received.
+ */
+#define ADUC_GOAL_STATE_FILE_NAME "goalstate.json"
+
+/**
+ * @brief The compressed log of the lines of a workflow, in its sandbox, see StartWorkflowLog. When the workflow ends,
+ * it is copied to the log folder, where a diagnostics log component with this logFileName uploads just it.
+ */
+#define ADUC_WORKFLOW_LOG_FILE_NAME "du-workflow.log.gz"
+
+/**
+ * @brief Gets the path of a file in the data folder of the device of @p workflowData.
+ *
+ * @param workflowData The workflow data.
+ * @param fileName The name of the file.
+ * @param[out] path The path.
+ * @param pathSize The size of @p path.
+ * @return bool false if the path doesn't fit in @p path.
+ */
+static bool GetWorkflowDataFilePath(
+    const ADUC_WorkflowData* workflowData, const char* fileName, char* path, size_t pathSize)
+{
+    const char* dataFolder = workflowData->DataFolder != NULL ? workflowData->DataFolder : ADUC_DATA_FOLDER;
+    const int length = snprintf(path, pathSize, "%s/%s", dataFolder, fileName);
+    return length > 0 && (size_t)length < pathSize;
+}
+
+/**
+ * @brief Starts writing the lines logged for the workflow of @p workflowData to ADUC_WORKFLOW_LOG_FILE_NAME in its
+ * sandbox, once the sandbox exists. Does nothing if they are written already, e.g. on the next step.
+ *
+ * @param workflowData The workflow data.
+ */
+static void StartWorkflowLog(const ADUC_WorkflowData* workflowData)
+{
+    const size_t limitBytes = workflow_get_log_size_limit();
+    char* workflowId = NULL;
+    char* workFolder = NULL;
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (limitBytes == 0)
+    {
+        return;
+    }
+
+    workflowId = ADUC_WorkflowData_GetWorkflowId(workflowData);
+    workFolder = ADUC_WorkflowData_GetWorkFolder(workflowData);
+
+    // Before the download, the sandbox isn't created yet.
+    if (workflowId == NULL || workFolder == NULL || stat(workFolder, &st) != 0 || !S_ISDIR(st.st_mode)
+        || snprintf(path, sizeof(path), "%s/%s", workFolder, ADUC_WORKFLOW_LOG_FILE_NAME) >= (int)sizeof(path))
+    {
+        goto done;
+    }
+
+    if (Log_StartCapture(workflowId, path, limitBytes) != 0)
+    {
+        Log_Warn("Unable to write the log of the workflow to %s", path);
+    }
+
+done:
+    workflow_free_string(workflowId);
+    workflow_free_string(workFolder);
+}
+
+/**
+ * @brief Stops writing the log of the ending workflow, and copies it from its sandbox @p workFolder to the log folder,
+ * replacing the one of the previous workflow, before the sandbox is destroyed.
+ *
+ * @param workFolder The sandbox of the workflow.
+ */
+static void KeepWorkflowLog(const char* workFolder)
+{
+    char path[PATH_MAX];
+    struct stat st;
+
+    Log_StopCapture();
+
+    if (workFolder == NULL
+        || snprintf(path, sizeof(path), "%s/%s", workFolder, ADUC_WORKFLOW_LOG_FILE_NAME) >= (int)sizeof(path)
+        || stat(path, &st) != 0)
+    {
+        return;
+    }
+
+    if (ADUC_SystemUtils_CopyFileToDir(path, ADUC_LOG_FOLDER, true /* overwriteExistingFile */) != 0)
+    {
+        Log_Warn("Unable to keep the log of the workflow in %s", ADUC_LOG_FOLDER);
+    }
+}
+
 // This lock is used for critical sections where main and worker thread could read/write to ADUC_workflowData
 // It is used only at the top-level coarse granularity operations:
 //     * (main thread) ADUC_Workflow_HandlePropertyUpdate
-//     * (main thread and worker thread) ADUC_Workflow_WorkCompletionCallback
-//         - when asynchronously called (worker thread) it takes the lock
+//     * (main thread) DrainWorkCompletions
+//     * (worker thread) ADUC_Workflow_WorkCompletionCallback, until the main loop drains the completions, and then
+//       for the fast transitions from one step to the next, see IsFastTransition
+// Otherwise, once the main loop runs, both happen on the main thread and the lock is uncontended.
 static pthread_mutex_t s_workflow_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static inline void s_workflow_lock(void)
@@ -46,8 +158,22 @@ static inline void s_workflow_unlock(void)
     pthread_mutex_unlock(&s_workflow_mutex);
 }
 
+// The completions of operations that ran on a worker thread, oldest first. Worker threads queue them and wake up the
+// main loop, which handles them in ADUC_Workflow_DoWork, so that twin updates and reporting never wait behind a
+// completion handler. Guarded by s_completion_queue_mutex, which is only held to link and unlink them.
+static pthread_mutex_t s_completion_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ADUC_MethodCall_Data* s_completion_queue_head = NULL;
+static ADUC_MethodCall_Data* s_completion_queue_tail = NULL;
+
+// Set by the first ADUC_Workflow_DoWork. Until then, e.g. when there is no main loop, worker threads handle their
+// completions themselves under s_workflow_mutex.
+static bool s_main_loop_drains_completions = false;
+
 // fwd decl
+static void HandleWorkCompletion(ADUC_MethodCall_Data* methodCallData, ADUC_Result result);
+static int RestartAgent(ADUC_WorkflowData* workflowData);
 void ADUC_Workflow_WorkCompletionCallback(const void* workCompletionToken, ADUC_Result result, _Bool isAsync);
+void ADUC_Workflow_AutoTransitionWorkflow(ADUC_WorkflowData* workflowData);
 
 const char* ADUC_Workflow_CancellationTypeToString(ADUC_WorkflowCancellationType cancellationType)
 {
@@ -93,6 +219,53 @@ static const char* ADUCITF_WorkflowStepToString(ADUCITF_WorkflowStep workflowSte
     return "<Unknown>";
 }
 
+/**
+ * @brief Returns the name of the timing span of the operation of @p workflowStep.
+ */
+static const char* WorkflowStepToSpanName(ADUCITF_WorkflowStep workflowStep)
+{
+    switch (workflowStep)
+    {
+    case ADUCITF_WorkflowStep_ProcessDeployment:
+        return "workflow_processDeployment";
+    case ADUCITF_WorkflowStep_Download:
+        return "workflow_download";
+    case ADUCITF_WorkflowStep_Install:
+        return "workflow_install";
+    case ADUCITF_WorkflowStep_Apply:
+        return "workflow_apply";
+    case ADUCITF_WorkflowStep_Undefined:
+        break;
+    }
+
+    return "workflow_unknown";
+}
+
+/**
+ * @brief Records the duration of the workflow step @p workflowStep in its metrics histogram, if it has one.
+ *
+ * @param workflowStep The workflow step.
+ * @param startTime The start of the step, from ADUC_Timing_Now.
+ */
+static void RecordWorkflowStepDuration(ADUCITF_WorkflowStep workflowStep, int64_t startTime)
+{
+    switch (workflowStep)
+    {
+    case ADUCITF_WorkflowStep_Download:
+        ADUC_Metrics_ObserveDuration(ADUC_MetricsHistogram_WorkflowDownloadDuration, startTime);
+        break;
+    case ADUCITF_WorkflowStep_Install:
+        ADUC_Metrics_ObserveDuration(ADUC_MetricsHistogram_WorkflowInstallDuration, startTime);
+        break;
+    case ADUCITF_WorkflowStep_Apply:
+        ADUC_Metrics_ObserveDuration(ADUC_MetricsHistogram_WorkflowApplyDuration, startTime);
+        break;
+    case ADUCITF_WorkflowStep_ProcessDeployment:
+    case ADUCITF_WorkflowStep_Undefined:
+        break;
+    }
+}
+
 /**
  * @brief Generate a unique identifier.
  *
@@ -214,6 +387,108 @@ const ADUC_WorkflowHandlerMapEntry* GetWorkflowHandlerMapEntryForAction(ADUCITF_
     return entry;
 }
 
+/**
+ * @brief Returns whether the completion of an operation on a worker thread can be handled right there, rather than be
+ * queued for the main loop: a successful operation that auto-transitions to the next step of the workflow, e.g.
+ * Download to Install, needs nothing from the cloud in between, and the states in between aren't reported to it.
+ * @remark Caller must hold s_workflow_mutex.
+ *
+ * @param methodCallData The data of the operation.
+ * @param result The result of the operation.
+ * @return true if the worker thread may go on with the next step.
+ */
+static bool IsFastTransition(const ADUC_MethodCall_Data* methodCallData, ADUC_Result result)
+{
+    const ADUC_WorkflowData* workflowData = methodCallData->WorkflowData;
+    ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
+
+    // NOLINTNEXTLINE(misc-redundant-expression)
+    if (handle == NULL || !IsAducResultCodeSuccess(result.ResultCode)
+        || AducResultCodeIndicatesInProgress(result.ResultCode))
+    {
+        return false;
+    }
+
+    const ADUC_WorkflowHandlerMapEntry* entry =
+        GetWorkflowHandlerMapEntryForAction(workflow_get_current_workflowstep(handle));
+
+    // Cancels, retries, replacements and timeouts all go through the main loop.
+    return entry != NULL && !AgentOrchestration_IsWorkflowComplete(entry->AutoTransitionWorkflowStep)
+        && workflow_get_cancellation_type(handle) == ADUC_WorkflowCancellationType_None
+        && !workflow_get_operation_cancel_requested(handle) && !workflow_get_operation_timed_out(handle)
+        && ADUC_WorkflowData_GetCurrentAction(workflowData) != ADUCITF_UpdateAction_Cancel;
+}
+
+/**
+ * @brief Handles the completions queued by worker threads, in order.
+ */
+static void DrainWorkCompletions(void)
+{
+    pthread_mutex_lock(&s_completion_queue_mutex);
+    s_main_loop_drains_completions = true;
+    ADUC_MethodCall_Data* methodCallData = s_completion_queue_head;
+    s_completion_queue_head = NULL;
+    s_completion_queue_tail = NULL;
+    pthread_mutex_unlock(&s_completion_queue_mutex);
+
+    while (methodCallData != NULL)
+    {
+        // Handling the completion frees it.
+        ADUC_MethodCall_Data* next = methodCallData->NextCompletion;
+
+        s_workflow_lock();
+        HandleWorkCompletion(methodCallData, methodCallData->CompletionResult);
+        s_workflow_unlock();
+
+        methodCallData = next;
+    }
+}
+
+/**
+ * @brief Reports the state in progress again when heavy work pauses for the limits of the device, with the reason in
+ * its resultDetails, so that operators know why the deployment is slow, and when it resumes, without; see
+ * ADUC_Thermal_WaitForHeadroom.
+ *
+ * @param workflowData The workflow data.
+ */
+static void ReportHeavyWorkPause(ADUC_WorkflowData* workflowData)
+{
+    static unsigned int s_reportedPauseGeneration = 0;
+    char reason[ADUC_THERMAL_REASON_SIZE];
+    unsigned int generation = 0;
+
+    const bool paused = ADUC_Thermal_GetPause(&generation, reason, sizeof(reason));
+    if (generation == s_reportedPauseGeneration)
+    {
+        return;
+    }
+
+    s_reportedPauseGeneration = generation;
+
+    const ADUCITF_State state = ADUC_WorkflowData_GetLastReportedState(workflowData);
+    if (workflowData->WorkflowHandle == NULL
+        || (state != ADUCITF_State_DownloadStarted && state != ADUCITF_State_InstallStarted
+            && state != ADUCITF_State_ApplyStarted))
+    {
+        return;
+    }
+
+    if (paused)
+    {
+        workflow_set_result_details(workflowData->WorkflowHandle, "Paused for the device to recover: %s.", reason);
+    }
+    else
+    {
+        workflow_set_result_details(workflowData->WorkflowHandle, NULL);
+    }
+
+    if (!workflowData->ReportStateAndResultAsyncCallback(
+            (ADUC_WorkflowDataToken)workflowData, state, NULL /* result */, NULL /* installedUpdateId */))
+    {
+        Log_Warn("Cannot report that heavy work %s.", paused ? "paused" : "resumed");
+    }
+}
+
 /**
  * @brief Called regularly to allow for cooperative multitasking during work.
  *
@@ -221,6 +496,20 @@ const ADUC_WorkflowHandlerMapEntry* GetWorkflowHandlerMapEntryForAction(ADUCITF_
  */
 void ADUC_Workflow_DoWork(ADUC_WorkflowData* workflowData)
 {
+    DrainWorkCompletions();
+
+    // Watchdog of the operation in progress: one past its deadline, e.g. a hung install script, is cancelled, which
+    // kills the process group of its child processes, and completes as timed out.
+    s_workflow_lock();
+    if (workflow_check_operation_deadline(workflowData->WorkflowHandle, ADUC_Timing_Now()))
+    {
+        Log_Error("The operation in progress timed out. Cancelling it.");
+        ADUC_Workflow_MethodCall_Cancel(workflowData);
+    }
+
+    ReportHeavyWorkPause(workflowData);
+    s_workflow_unlock();
+
     // As this method will be called many times, rather than call into adu_core_export_helpers to call into upper-layer,
     // just call directly into upper-layer here.
     const ADUC_UpdateActionCallbacks* updateActionCallbacks = &(workflowData->UpdateActionCallbacks);
@@ -299,6 +588,27 @@ done:
     currentWorkflowData->StartupIdleCallSent = true;
 }
 
+/**
+ * @brief Asks the platform layer to download the files of a replacement in the background, while the current workflow
+ * installs or applies, if it supports prefetching.
+ *
+ * @param workflowData The current workflow data.
+ * @param replacementWorkflow The deferred replacement workflow.
+ */
+static void PrefetchReplacement(const ADUC_WorkflowData* workflowData, ADUC_WorkflowHandle replacementWorkflow)
+{
+    const ADUC_UpdateActionCallbacks* updateActionCallbacks = &(workflowData->UpdateActionCallbacks);
+
+    // A download in progress is cancelled for the replacement, which then downloads right away.
+    if (updateActionCallbacks->PrefetchCallback == NULL
+        || workflow_get_current_workflowstep(workflowData->WorkflowHandle) == ADUCITF_WorkflowStep_Download)
+    {
+        return;
+    }
+
+    updateActionCallbacks->PrefetchCallback(updateActionCallbacks->PlatformLayerHandle, replacementWorkflow);
+}
+
 /**
  * @brief Handles updates to a 1 or more PnP Properties in the ADU Core interface.
  *
@@ -313,6 +623,8 @@ void ADUC_Workflow_HandleComponentChanged(ADUC_WorkflowData* workflowData)
         return;
     }
 
+    ADUC_ComponentInventory_Invalidate();
+
     // Process the latest goal state, if successfully cached.
     if (workflowData->LastGoalStateJson != NULL)
     {
@@ -324,6 +636,186 @@ void ADUC_Workflow_HandleComponentChanged(ADUC_WorkflowData* workflowData)
     }
 }
 
+/**
+ * @brief Completes an agent restart done in-process, once the update content handlers are reloaded.
+ * @details Like after an actual restart, the current goal state goes through the startup logic, which reports the
+ * installed update, or resumes the deployment.
+ *
+ * @param[in,out] workflowData The current ADUC_WorkflowData object.
+ */
+void ADUC_Workflow_CompleteInProcessRestart(ADUC_WorkflowData* workflowData)
+{
+    workflowData->InProcessRestartPending = false;
+    workflowData->SystemRebootState = ADUC_SystemRebootState_None;
+    workflowData->AgentRestartState = ADUC_AgentRestartState_None;
+
+    ADUC_ComponentInventory_Invalidate();
+
+    if (workflowData->LastGoalStateJson == NULL)
+    {
+        Log_Warn("Agent restarted in-process, but the update data cache is not available.");
+        return;
+    }
+
+    Log_Info("Agent restarted in-process. Perform startup tasks.");
+
+    workflowData->StartupIdleCallSent = false;
+    ADUC_Workflow_HandlePropertyUpdate(workflowData, (const unsigned char*)workflowData->LastGoalStateJson, false /* forceDeferral */);
+}
+
+/**
+ * @brief Removes the goal state file, once the deployment is over, so that the next run of the agent doesn't resume it.
+ * A deployment resumed by the warm start that is over needs no confirmation from the twin either.
+ *
+ * @param[in,out] workflowData The current ADUC_WorkflowData object.
+ */
+static void RemoveGoalState(ADUC_WorkflowData* workflowData)
+{
+    char goalStatePath[PATH_MAX];
+
+    workflowData->WarmStartUnconfirmed = false;
+
+    if (GetWorkflowDataFilePath(workflowData, ADUC_GOAL_STATE_FILE_NAME, goalStatePath, sizeof(goalStatePath))
+        && remove(goalStatePath) != 0 && errno != ENOENT)
+    {
+        Log_Debug("Cannot remove goal state file %s, errno: %d", goalStatePath, errno);
+    }
+}
+
+/**
+ * @brief Keeps @p goalStateJson in memory, to re-process it, and on disk, for the next run of the agent.
+ * @details The file is replaced atomically. Only writing the file when the goal state changed keeps the twin
+ * reconciliation after a warm start from rewriting it.
+ *
+ * @param[in,out] workflowData The current ADUC_WorkflowData object.
+ * @param[in] goalStateJson The goal state.
+ */
+static void SaveGoalState(ADUC_WorkflowData* workflowData, const char* goalStateJson)
+{
+    char goalStatePath[PATH_MAX];
+    char tempPath[PATH_MAX];
+    FILE* tempFile = NULL;
+    bool written = false;
+
+    if (workflowData->LastGoalStateJson != NULL && strcmp(workflowData->LastGoalStateJson, goalStateJson) == 0)
+    {
+        return;
+    }
+
+    ADUC_WorkflowData_SaveLastGoalStateJson(workflowData, goalStateJson);
+
+    // There's nothing for the next run to resume from a cancel.
+    if (workflow_get_action(workflowData->WorkflowHandle) == ADUCITF_UpdateAction_Cancel)
+    {
+        RemoveGoalState(workflowData);
+        goto done;
+    }
+
+    if (!GetWorkflowDataFilePath(workflowData, ADUC_GOAL_STATE_FILE_NAME, goalStatePath, sizeof(goalStatePath))
+        || !GetWorkflowDataFilePath(workflowData, ADUC_GOAL_STATE_FILE_NAME ".tmp", tempPath, sizeof(tempPath)))
+    {
+        goto done;
+    }
+
+    // The goal state is already serialized JSON, so it's written as is rather than parsed and serialized again.
+    tempFile = fopen(tempPath, "w");
+    if (tempFile != NULL)
+    {
+        written = fputs(goalStateJson, tempFile) >= 0;
+        written = fclose(tempFile) == 0 && written;
+    }
+
+    if (!written)
+    {
+        Log_Debug("Cannot write goal state file %s", tempPath);
+        remove(tempPath);
+        goto done;
+    }
+
+    if (chmod(tempPath, S_IRUSR | S_IWUSR) != 0 || rename(tempPath, goalStatePath) != 0)
+    {
+        Log_Debug("Cannot replace goal state file %s, errno: %d", goalStatePath, errno);
+        remove(tempPath);
+    }
+
+done:
+    return;
+}
+
+/**
+ * @brief Resumes the goal state the previous run of the agent persisted, without waiting for the twin.
+ * @details Call once the content downloader is initialized, before the twin is processed. The goal state goes through
+ * the startup logic like one from the twin: an installed update is reported, while an in-flight deployment starts over,
+ * reusing the files already downloaded to its sandbox. The deployment stops once downloaded, as the service may have
+ * cancelled or replaced it meanwhile; it's installed once the twin confirms the same workflow id, see
+ * ADUC_Workflow_HandlePropertyUpdate. A different workflow replaces it. The goal state is validated like one from the
+ * twin, including its signature.
+ *
+ * @param[in,out] workflowData The current ADUC_WorkflowData object.
+ */
+void ADUC_Workflow_WarmStart(ADUC_WorkflowData* workflowData)
+{
+    char goalStatePath[PATH_MAX];
+    JSON_Value* goalStateValue = NULL;
+    char* goalStateJson = NULL;
+    struct stat st;
+
+    if (workflowData == NULL || workflowData->WarmStartAttempted)
+    {
+        return;
+    }
+
+    workflowData->WarmStartAttempted = true;
+
+    if (workflowData->WorkflowHandle != NULL || workflowData->StartupIdleCallSent)
+    {
+        // The twin came first.
+        return;
+    }
+
+    if (!GetWorkflowDataFilePath(workflowData, ADUC_GOAL_STATE_FILE_NAME, goalStatePath, sizeof(goalStatePath)))
+    {
+        return;
+    }
+
+    // Only a file the agent wrote itself is trusted to start a deployment.
+    if (lstat(goalStatePath, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+        || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+    {
+        return;
+    }
+
+    goalStateValue = json_parse_file(goalStatePath);
+    goalStateJson = json_serialize_to_string(goalStateValue);
+    if (goalStateJson == NULL)
+    {
+        Log_Warn("Ignoring unreadable goal state file %s", goalStatePath);
+        goto done;
+    }
+
+    Log_Info("Resuming the goal state of the previous run, before the twin is received.");
+
+    workflowData->WarmStartUnconfirmed = true;
+    ADUC_Workflow_HandlePropertyUpdate(workflowData, (const unsigned char*)goalStateJson, false /* forceDeferral */);
+
+done:
+    json_free_serialized_string(goalStateJson);
+    json_value_free(goalStateValue);
+}
+
+/**
+ * @brief Returns whether the workflow resumed by the warm start is downloaded, and waits for the twin to confirm it
+ * before it's installed.
+ *
+ * @param[in] workflowData The current ADUC_WorkflowData object.
+ */
+static _Bool IsWaitingForWarmStartConfirmation(const ADUC_WorkflowData* workflowData)
+{
+    return workflow_get_current_workflowstep(workflowData->WorkflowHandle) == ADUCITF_WorkflowStep_Download
+        && ADUC_WorkflowData_GetLastReportedState(workflowData) == ADUCITF_State_DownloadSucceeded
+        && !workflow_get_operation_in_progress(workflowData->WorkflowHandle);
+}
+
 /**
  * @brief Handles updates to a 1 or more PnP Properties in the ADU Core interface.
  *
@@ -335,6 +827,23 @@ void ADUC_Workflow_HandlePropertyUpdate(
     ADUC_WorkflowData* currentWorkflowData, const unsigned char* propertyUpdateValue, bool forceDeferral)
 {
     ADUC_WorkflowHandle nextWorkflow;
+
+    // The first goal state from the twin after a warm start confirms, or replaces, the workflow it resumed.
+    const _Bool confirmsWarmStart =
+        currentWorkflowData->WarmStartUnconfirmed && currentWorkflowData->StartupIdleCallSent && !forceDeferral;
+
+    // Twin reconnects and $version bumps deliver the latest goal state again, whether its workflow is current or
+    // completed; it's discarded before it's parsed and its signature verified. The goal state re-processed on purpose,
+    // e.g. after a component change or an in-process restart, forces deferral or goes through the startup logic.
+    if (!forceDeferral && !confirmsWarmStart && currentWorkflowData->StartupIdleCallSent
+        && currentWorkflowData->LastGoalStateJson != NULL
+        && ADUC_WorkflowData_GetGoalStateDigest((const char*)propertyUpdateValue)
+            == currentWorkflowData->LastGoalStateDigest)
+    {
+        Log_Info("Ignoring the goal state delivered again.");
+        return;
+    }
+
     ADUC_Result result = workflow_init((const char*)propertyUpdateValue, true, &nextWorkflow);
 
     if (IsAducResultCodeFailure(result.ResultCode))
@@ -357,6 +866,31 @@ void ADUC_Workflow_HandlePropertyUpdate(
 
     HandleUpdateActionFunc handleUpdateActionFunc = ADUC_WorkflowData_GetHandleUpdateActionFunc(currentWorkflowData);
 
+    if (confirmsWarmStart)
+    {
+        currentWorkflowData->WarmStartUnconfirmed = false;
+
+        // The same workflow, not retried, continues where it stopped: with the install, once downloaded. Otherwise,
+        // the goal state is handled as usual: a cancel, retry or replacement of the resumed workflow.
+        if (currentWorkflowData->WorkflowHandle != NULL && nextUpdateAction == ADUCITF_UpdateAction_ProcessDeployment
+            && workflow_id_compare(currentWorkflowData->WorkflowHandle, nextWorkflow) == 0
+            && !AgentOrchestration_IsRetryApplicable(
+                workflow_peek_retryTimestamp(currentWorkflowData->WorkflowHandle),
+                workflow_peek_retryTimestamp(nextWorkflow)))
+        {
+            Log_Info(
+                "The twin confirmed workflow '%s', resumed at startup.",
+                workflow_peek_id(currentWorkflowData->WorkflowHandle));
+
+            if (IsWaitingForWarmStartConfirmation(currentWorkflowData))
+            {
+                ADUC_Workflow_AutoTransitionWorkflow(currentWorkflowData);
+            }
+
+            goto done;
+        }
+    }
+
     if (currentWorkflowData->WorkflowHandle != NULL)
     {
         if (nextUpdateAction == ADUCITF_UpdateAction_Cancel)
@@ -419,6 +953,21 @@ void ADUC_Workflow_HandlePropertyUpdate(
                         workflow_peek_id(currentWorkflowData->WorkflowHandle),
                         workflow_peek_id(nextWorkflow));
 
+                    // A download of files that the new workflow needs too isn't cancelled; once it completes, the new
+                    // workflow reuses them instead of downloading them again.
+                    if (workflow_defer_replacement_after_download(currentWorkflowData->WorkflowHandle, nextWorkflow))
+                    {
+                        Log_Info(
+                            "Deferred Replacement workflow id [%s] until the download of workflow id [%s] completes,"
+                            " as it needs all of its files.",
+                            workflow_peek_id(nextWorkflow),
+                            workflow_peek_id(currentWorkflowData->WorkflowHandle));
+
+                        // Ownership was transferred to current workflow so ensure it doesn't get freed.
+                        nextWorkflow = NULL;
+                        goto done;
+                    }
+
                     // If operation is in progress, then in the same critical section we set cancellation type to replacement
                     // and set the pending workflow on the handle for use by WorkCompletionCallback to continue on with the
                     // replacement deployment instead of going to idle and reporting the results as a cancel failure.
@@ -433,6 +982,8 @@ void ADUC_Workflow_HandlePropertyUpdate(
                             workflow_peek_id(nextWorkflow),
                             workflow_peek_id(currentWorkflowData->WorkflowHandle));
 
+                        PrefetchReplacement(currentWorkflowData, nextWorkflow);
+
                         // Ownership was transferred to current workflow so ensure it doesn't get freed.
                         nextWorkflow = NULL;
 
@@ -444,7 +995,7 @@ void ADUC_Workflow_HandlePropertyUpdate(
                     workflow_transfer_data(
                         currentWorkflowData->WorkflowHandle /* wfTarget */, nextWorkflow /* wfSource */);
 
-                    ADUC_WorkflowData_SaveLastGoalStateJson(currentWorkflowData, (const char*)propertyUpdateValue);
+                    SaveGoalState(currentWorkflowData, (const char*)propertyUpdateValue);
 
                     (*handleUpdateActionFunc)(currentWorkflowData);
                     goto done;
@@ -464,7 +1015,7 @@ void ADUC_Workflow_HandlePropertyUpdate(
     workflow_free(currentWorkflowData->WorkflowHandle);
     currentWorkflowData->WorkflowHandle = nextWorkflow;
 
-    ADUC_WorkflowData_SaveLastGoalStateJson(currentWorkflowData, (const char*) propertyUpdateValue);
+    SaveGoalState(currentWorkflowData, (const char*)propertyUpdateValue);
 
     nextWorkflow = NULL;
 
@@ -552,6 +1103,7 @@ void ADUC_Workflow_HandleUpdateAction(ADUC_WorkflowData* workflowData)
             workflow_set_cancellation_type(workflowData->WorkflowHandle, ADUC_WorkflowCancellationType_None);
 
             Log_Info("Cancel received with no operation in progress - returning to Idle state");
+            RemoveGoalState(workflowData);
             goto done;
         }
         else {
@@ -631,6 +1183,13 @@ void ADUC_Workflow_AutoTransitionWorkflow(ADUC_WorkflowData* workflowData)
     {
         Log_Info("Workflow is Complete.");
     }
+    else if (workflowData->WarmStartUnconfirmed && currentWorkflowStep == ADUCITF_WorkflowStep_Download)
+    {
+        // The service may have cancelled or replaced the workflow while the agent wasn't running.
+        Log_Info(
+            "Workflow '%s' resumed at startup is downloaded. Waiting for the twin to confirm it before installing it.",
+            workflow_peek_id(workflowData->WorkflowHandle));
+    }
     else
     {
         workflow_set_current_workflowstep(workflowData->WorkflowHandle, postCompleteEntry->AutoTransitionWorkflowStep);
@@ -661,6 +1220,8 @@ void ADUC_Workflow_TransitionWorkflow(ADUC_WorkflowData* workflowData)
         goto done;
     }
 
+    Log_SetContext(workflow_peek_id(workflowData->WorkflowHandle), ADUCITF_WorkflowStepToString(entry->WorkflowStep));
+    StartWorkflowLog(workflowData);
     Log_Debug("Processing '%s' step", ADUCITF_WorkflowStepToString(entry->WorkflowStep));
 
     // Alloc this object on heap so that it will be valid for the entire (possibly async) operation func.
@@ -672,6 +1233,24 @@ void ADUC_Workflow_TransitionWorkflow(ADUC_WorkflowData* workflowData)
 
     methodCallData->WorkflowData = workflowData;
 
+    if (entry->WorkflowStep == ADUCITF_WorkflowStep_ProcessDeployment)
+    {
+        // A new deployment, or a retry or replacement of the current one, starts.
+        // Its components are enumerated afresh, they may have changed since the last one.
+        ADUC_Timing_Clear();
+        ADUC_ResourceSampler_Start(ADUC_DOWNLOADS_FOLDER);
+        ADUC_ComponentInventory_Invalidate();
+    }
+
+    methodCallData->StartTime = ADUC_Timing_Now();
+
+    const unsigned int timeoutSeconds =
+        workflow_get_operation_timeout(workflowData->WorkflowHandle, entry->WorkflowStep);
+    workflow_set_operation_deadline(
+        workflowData->WorkflowHandle,
+        timeoutSeconds == 0 ? 0 : methodCallData->StartTime + (int64_t)timeoutSeconds * 1000000000);
+    workflow_set_step_deadline(workflowData->WorkflowHandle, 0);
+
     // workCompletionData is sent to the upper-layer which will pass the WorkCompletionToken back
     // when it makes the async work complete call.
     WorkCompletionCallbackFunc workCompletionCallbackFunc = ADUC_Workflow_WorkCompletionCallback;
@@ -690,8 +1269,15 @@ void ADUC_Workflow_TransitionWorkflow(ADUC_WorkflowData* workflowData)
     Log_Debug("Setting operation_in_progress => true");
     workflow_set_operation_in_progress(workflowData->WorkflowHandle, true);
 
+    // Fail the workflow with a clear result while it's over its memory budget, rather than start an operation that
+    // could get the agent OOM-killed midway.
+    result = workflow_check_memory_budget(workflowData->WorkflowHandle);
+
     // Perform an update operation.
-    result = entry->OperationFunc(methodCallData);
+    if (IsAducResultCodeSuccess(result.ResultCode))
+    {
+        result = entry->OperationFunc(methodCallData);
+    }
 
     // Action is complete (i.e. we wont get a WorkCompletionCallback call from upper-layer) if:
     // * Upper-level did the work in a blocking manner.
@@ -708,7 +1294,7 @@ done:
 }
 
 /**
- * @brief Called when work is complete.
+ * @brief Called when work is complete. Completions from worker threads are queued for the main loop.
  *
  * @param workCompletionToken ADUC_MethodCall_Data pointer.
  * @param result Result of work.
@@ -718,6 +1304,100 @@ void ADUC_Workflow_WorkCompletionCallback(const void* workCompletionToken, ADUC_
 {
     // We own these objects, so no issue making them non-const.
     ADUC_MethodCall_Data* methodCallData = (ADUC_MethodCall_Data*)workCompletionToken;
+    bool queued = false;
+
+    // Synchronous completions come from the main thread, which typically holds the lock higher in the callstack
+    // above TransitionWorkflow.
+    if (!isAsync)
+    {
+        HandleWorkCompletion(methodCallData, result);
+        return;
+    }
+
+    // The worker thread goes on with the next step itself, unless earlier completions wait for the main loop, so
+    // that completions stay in order.
+    s_workflow_lock();
+    pthread_mutex_lock(&s_completion_queue_mutex);
+    const bool queueEmpty = s_completion_queue_head == NULL;
+    pthread_mutex_unlock(&s_completion_queue_mutex);
+
+    if (queueEmpty && IsFastTransition(methodCallData, result))
+    {
+        Log_Debug("Going on with the next step of the workflow on the worker thread.");
+        HandleWorkCompletion(methodCallData, result);
+        s_workflow_unlock();
+        ADUC_EventLoop_Wakeup();
+        return;
+    }
+    s_workflow_unlock();
+
+    pthread_mutex_lock(&s_completion_queue_mutex);
+    if (s_main_loop_drains_completions)
+    {
+        methodCallData->CompletionResult = result;
+        methodCallData->NextCompletion = NULL;
+
+        if (s_completion_queue_tail == NULL)
+        {
+            s_completion_queue_head = methodCallData;
+        }
+        else
+        {
+            s_completion_queue_tail->NextCompletion = methodCallData;
+        }
+
+        s_completion_queue_tail = methodCallData;
+        queued = true;
+    }
+    pthread_mutex_unlock(&s_completion_queue_mutex);
+
+    if (!queued)
+    {
+        s_workflow_lock();
+        HandleWorkCompletion(methodCallData, result);
+        s_workflow_unlock();
+    }
+
+    // Have the main loop handle the completion, or send the resulting reported state, right away.
+    ADUC_EventLoop_Wakeup();
+}
+
+/**
+ * @brief Destroys the sandbox of the workflow that the current one replaced, if it's still kept for its files.
+ *
+ * @param workflowData The workflow data.
+ */
+static void DestroyReplacedSandbox(const ADUC_WorkflowData* workflowData)
+{
+    const ADUC_UpdateActionCallbacks* updateActionCallbacks = &(workflowData->UpdateActionCallbacks);
+    char* workFolder = workflow_take_replaced_workfolder(workflowData->WorkflowHandle);
+
+    if (workFolder == NULL)
+    {
+        return;
+    }
+
+    // The sandbox is named after the id of its workflow.
+    const char* separator = strrchr(workFolder, '/');
+    const char* replacedWorkflowId = separator != NULL ? separator + 1 : workFolder;
+
+    Log_Info("Destroying sandbox of replaced workflow %s", replacedWorkflowId);
+
+    updateActionCallbacks->SandboxDestroyCallback(
+        updateActionCallbacks->PlatformLayerHandle, replacedWorkflowId, workFolder);
+
+    workflow_free_string(workFolder);
+}
+
+/**
+ * @brief Handles the completion of an operation, and moves the workflow to its next state.
+ * @remark Caller *must* be in a lock, or on the main thread, before calling
+ *
+ * @param methodCallData The data of the operation; freed.
+ * @param result Result of work.
+ */
+static void HandleWorkCompletion(ADUC_MethodCall_Data* methodCallData, ADUC_Result result)
+{
     ADUC_WorkflowData* workflowData = methodCallData->WorkflowData;
 
     // NOLINTNEXTLINE(misc-redundant-expression)
@@ -727,13 +1407,6 @@ void ADUC_Workflow_WorkCompletionCallback(const void* workCompletionToken, ADUC_
         goto done;
     }
 
-    // Need to avoid deadlock b/c main thread typically takes lock higher in the callstack above
-    // TransistionWorkflow and processing DeploymentInProgress state is synchronous
-    if (isAsync)
-    {
-        s_workflow_lock();
-    }
-
     ADUCITF_WorkflowStep currentWorkflowStep = workflow_get_current_workflowstep(workflowData->WorkflowHandle);
 
     const ADUC_WorkflowHandlerMapEntry* entry = GetWorkflowHandlerMapEntryForAction(currentWorkflowStep);
@@ -757,9 +1430,37 @@ void ADUC_Workflow_WorkCompletionCallback(const void* workCompletionToken, ADUC_
         result.ExtendedResultCode,
         result.ExtendedResultCode);
 
+    ADUC_Timing_EndSpan(WorkflowStepToSpanName(entry->WorkflowStep), NULL, methodCallData->StartTime);
+    RecordWorkflowStepDuration(entry->WorkflowStep, methodCallData->StartTime);
+    ADUC_Metrics_SetGauge(
+        ADUC_MetricsGauge_WorkflowPeakJsonBytes, workflow_get_memory_usage(workflowData->WorkflowHandle));
+
+    if (workflow_get_operation_timed_out(workflowData->WorkflowHandle)
+        && workflow_get_cancellation_type(workflowData->WorkflowHandle) == ADUC_WorkflowCancellationType_None)
+    {
+        // Cancelled by the watchdog in ADUC_Workflow_DoWork. Unlike a cancel from the service, that fails the
+        // workflow, whatever the handler made of the cancel.
+        result.ResultCode = ADUC_Result_Failure;
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_OPERATION_TIMED_OUT;
+        workflow_set_result_details(
+            workflowData->WorkflowHandle, "%s timed out.", ADUCITF_WorkflowStepToString(entry->WorkflowStep));
+        workflow_set_operation_cancel_requested(workflowData->WorkflowHandle, false);
+    }
+
     entry->OperationCompleteFunc(methodCallData, result);
 
-    if (IsAducResultCodeSuccess(result.ResultCode))
+    // The download had a chance to reuse the files of the workflow that this one replaced.
+    if (entry->WorkflowStep == ADUCITF_WorkflowStep_Download)
+    {
+        DestroyReplacedSandbox(workflowData);
+    }
+
+    // A replacement deferred until the operation completes starts whatever the result.
+    const _Bool replacementDeferred =
+        workflow_get_cancellation_type(workflowData->WorkflowHandle) == ADUC_WorkflowCancellationType_Replacement
+        && workflow_has_deferred_replacement(workflowData->WorkflowHandle);
+
+    if (IsAducResultCodeSuccess(result.ResultCode) && !replacementDeferred)
     {
         // Operation succeeded -- go to next state.
 
@@ -790,7 +1491,7 @@ void ADUC_Workflow_WorkCompletionCallback(const void* workCompletionToken, ADUC_
     {
         // Operation (e.g. Download) failed or was cancelled - both are considered AducResult failure codes.
 
-        if (workflow_get_operation_cancel_requested(workflowData->WorkflowHandle))
+        if (replacementDeferred || workflow_get_operation_cancel_requested(workflowData->WorkflowHandle))
         {
             ADUC_WorkflowCancellationType cancellationType =
                 workflow_get_cancellation_type(workflowData->WorkflowHandle);
@@ -809,6 +1510,9 @@ void ADUC_Workflow_WorkCompletionCallback(const void* workCompletionToken, ADUC_
 
                 if (cancellationType == ADUC_WorkflowCancellationType_Replacement)
                 {
+                    // That of a workflow replaced earlier, whose replacement didn't get to download.
+                    DestroyReplacedSandbox(workflowData);
+
                     // Reset workflow state to process deployment and transfer the deferred workflow to current.
                     workflow_update_for_replacement(workflowData->WorkflowHandle);
                 }
@@ -861,6 +1565,8 @@ void ADUC_Workflow_WorkCompletionCallback(const void* workCompletionToken, ADUC_
                 result.ExtendedResultCode,
                 result.ExtendedResultCode);
 
+            ADUC_Metrics_ObserveFailure(result.ExtendedResultCode, methodCallData->StartTime);
+
             ADUC_Workflow_SetUpdateStateWithResult(workflowData, ADUCITF_State_Failed, result);
 
             workflow_set_operation_in_progress(workflowData->WorkflowHandle, false);
@@ -870,11 +1576,6 @@ void ADUC_Workflow_WorkCompletionCallback(const void* workCompletionToken, ADUC_
 done:
     // lifetime of methodCallData now ends as the operation work has completed.
     free(methodCallData);
-
-    if (isAsync)
-    {
-        s_workflow_unlock();
-    }
 }
 
 static const char* DownloadProgressStateToString(ADUC_DownloadProgressState state)
@@ -913,6 +1614,9 @@ void ADUC_Workflow_DefaultDownloadProgressCallback(
         DownloadProgressStateToString(state),
         bytesTransferred,
         bytesTotal);
+
+    ADUC_ProgressTelemetry_RecordFile(
+        workflowId, fileId, DownloadProgressStateToString(state), bytesTransferred, bytesTotal);
 }
 
 /**
@@ -928,6 +1632,28 @@ static void ADUC_Workflow_SetUpdateStateHelper(
     Log_Info("Setting UpdateState to %s", ADUCITF_StateToString(updateState));
     ADUC_WorkflowHandle workflowHandle = workflowData->WorkflowHandle;
 
+    ADUC_TRACEPOINT3(
+        workflow_state,
+        (int)ADUC_WorkflowData_GetLastReportedState(workflowData),
+        (int)updateState,
+        workflow_peek_id(workflowHandle));
+
+    ADUC_ProgressTelemetry_RecordStep(
+        workflow_peek_id(workflowHandle),
+        ADUC_PROGRESS_TELEMETRY_UPDATE_STEP,
+        ADUCITF_StateToString(updateState),
+        result != NULL ? result->ResultCode : 0,
+        result != NULL ? result->ExtendedResultCode : 0);
+
+    if (updateState == ADUCITF_State_Idle || updateState == ADUCITF_State_Failed)
+    {
+        // The deployment is over, or waits for the service; keep its timing and resource usage for the diagnostics
+        // upload.
+        ADUC_Timing_WriteSpansFile(ADUC_LOG_FOLDER "/" ADUC_TIMING_SPANS_FILE_NAME);
+        ADUC_ResourceSampler_Stop();
+        ADUC_ResourceSampler_WriteSamplesFile(ADUC_LOG_FOLDER "/" ADUC_RESOURCE_SAMPLES_FILE_NAME);
+    }
+
     // If we're transitioning from Apply_Started to Idle, we need to report InstalledUpdateId.
     //  if apply succeeded.
     // This is required by ADU service.
@@ -977,6 +1703,9 @@ static void ADUC_Workflow_SetUpdateStateHelper(
             // Fall through to report Idle without InstalledUpdateId.
         }
 
+        // The deployment is over, e.g. cancelled; there's nothing for the next run to resume.
+        RemoveGoalState(workflowData);
+
         if (!workflowData->ReportStateAndResultAsyncCallback((ADUC_WorkflowDataToken)workflowData, updateState, result, NULL /* installedUpdateId */))
         {
             updateState = ADUCITF_State_Failed;
@@ -1047,12 +1776,59 @@ void ADUC_Workflow_SetInstalledUpdateIdAndGoToIdle(ADUC_WorkflowData* workflowDa
 
     ADUC_WorkflowData_SetLastReportedState(ADUCITF_State_Idle, workflowData);
 
+    RemoveGoalState(workflowData);
+
     ADUC_Workflow_MethodCall_Idle(workflowData);
 
     workflowData->SystemRebootState = ADUC_SystemRebootState_None;
     workflowData->AgentRestartState = ADUC_AgentRestartState_None;
 }
 
+/**
+ * @brief Returns the current resident set size of the agent process, in bytes, or 0 if unknown.
+ */
+static uint64_t GetCurrentRssBytes()
+{
+    unsigned long long sizePages = 0;
+    unsigned long long residentPages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL)
+    {
+        return 0;
+    }
+
+    if (fscanf(statm, "%llu %llu", &sizePages, &residentPages) != 2)
+    {
+        residentPages = 0;
+    }
+
+    fclose(statm);
+    return (uint64_t)residentPages * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * @brief Returns the memory of the freed workflow to the system.
+ * @details The JSON of a large deployment, and the output captured from its handlers, leave the malloc arenas
+ * fragmented, so that the agent stays at its peak footprint until the next deployment happens to reuse it.
+ * Trimming the heap releases the free pages at the top of the arenas, and the whole free pages within them.
+ */
+static void TrimWorkflowMemory()
+{
+    const uint64_t rssBeforeTrim = GetCurrentRssBytes();
+
+    malloc_trim(0);
+
+    const uint64_t rssAfterTrim = GetCurrentRssBytes();
+
+    ADUC_Metrics_SetGauge(ADUC_MetricsGauge_RssBeforeTrimBytes, rssBeforeTrim);
+    ADUC_Metrics_SetGauge(ADUC_MetricsGauge_RssAfterTrimBytes, rssAfterTrim);
+
+    Log_Info(
+        "Workflow memory released. RSS: %" PRIu64 " KiB before trimming the heap, %" PRIu64 " KiB after.",
+        rssBeforeTrim / 1024,
+        rssAfterTrim / 1024);
+}
+
 /**
  * @brief Called when entering Idle state.
  *
@@ -1086,6 +1862,8 @@ void ADUC_Workflow_MethodCall_Idle(ADUC_WorkflowData* workflowData)
         Log_Info("UpdateAction: Idle. Ending workflow with WorkflowId: %s", workflowId);
         if (workFolder != NULL)
         {
+            KeepWorkflowLog(workFolder);
+
             Log_Info("Calling SandboxDestroyCallback");
 
             updateActionCallbacks->SandboxDestroyCallback(
@@ -1105,11 +1883,16 @@ void ADUC_Workflow_MethodCall_Idle(ADUC_WorkflowData* workflowData)
 
     updateActionCallbacks->IdleCallback(updateActionCallbacks->PlatformLayerHandle, workflowId);
 
+    DestroyReplacedSandbox(workflowData);
+
     workflow_free_string(workflowId);
     workflow_free_string(workFolder);
 
     workflow_free(workflowData->WorkflowHandle);
     workflowData->WorkflowHandle = NULL;
+    Log_SetContext(NULL, NULL);
+
+    TrimWorkflowMemory();
 }
 
 /**
@@ -1177,6 +1960,14 @@ ADUC_Result ADUC_Workflow_MethodCall_Download(ADUC_MethodCall_Data* methodCallDa
     }
 
     Log_Info("Using sandbox %s", workFolder);
+    StartWorkflowLog(workflowData);
+
+    // Fail now, rather than once the files that fit are downloaded.
+    result = workflow_check_disk_space(workflowHandle);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        goto done;
+    }
 
     ADUC_Workflow_SetUpdateState(workflowData, ADUCITF_State_DownloadStarted);
 
@@ -1264,9 +2055,7 @@ void ADUC_Workflow_MethodCall_Install_Complete(ADUC_MethodCall_Data* methodCallD
         Log_Info("Install indicated success with AgentRestartRequired - restarting the agent now");
         methodCallData->WorkflowData->SystemRebootState = ADUC_SystemRebootState_Required;
 
-        RestartAgentFunc restartAgentFn = ADUC_WorkflowData_GetRestartAgentFunc(methodCallData->WorkflowData);
-
-        int success = (*restartAgentFn)();
+        int success = RestartAgent(methodCallData->WorkflowData);
         if (success == 0)
         {
             methodCallData->WorkflowData->AgentRestartState = ADUC_AgentRestartState_InProgress;
@@ -1279,6 +2068,35 @@ void ADUC_Workflow_MethodCall_Install_Complete(ADUC_MethodCall_Data* methodCallD
     }
 }
 
+/**
+ * @brief Restarts the agent, or, if its executable is unchanged, restarts it in-process: the update content handlers
+ * are reloaded once the workflow is idle, keeping the connection to the IoT Hub, see
+ * ADUC_Workflow_CompleteInProcessRestart.
+ *
+ * @param workflowData The workflow data.
+ * @return int errno, 0 if success.
+ */
+static int RestartAgent(ADUC_WorkflowData* workflowData)
+{
+    RestartAgentFunc restartAgentFn = ADUC_WorkflowData_GetRestartAgentFunc(workflowData);
+
+#ifdef ADUC_BUILD_UNIT_TESTS
+    if (workflowData->TestOverrides != NULL && workflowData->TestOverrides->RestartAgentFunc_TestOverride != NULL)
+    {
+        return (*restartAgentFn)();
+    }
+#endif
+
+    if (!ADUC_SystemUtils_IsCurrentExecutableReplaced())
+    {
+        Log_Info("The agent executable is unchanged - reloading the update content handlers instead of restarting");
+        workflowData->InProcessRestartPending = true;
+        return 0;
+    }
+
+    return (*restartAgentFn)();
+}
+
 /**
  * @brief Called to do apply.
  *
@@ -1342,9 +2160,7 @@ void ADUC_Workflow_MethodCall_Apply_Complete(ADUC_MethodCall_Data* methodCallDat
         Log_Info("Apply indicated success with AgentRestartRequired - restarting the agent now");
         methodCallData->WorkflowData->SystemRebootState = ADUC_SystemRebootState_Required;
 
-        RestartAgentFunc restartAgentFn = ADUC_WorkflowData_GetRestartAgentFunc(methodCallData->WorkflowData);
-
-        int success = (*restartAgentFn)();
+        int success = RestartAgent(methodCallData->WorkflowData);
         if (success == 0)
         {
             methodCallData->WorkflowData->AgentRestartState = ADUC_AgentRestartState_InProgress;
@@ -40,6 +40,23 @@ extern ADUC_ClientHandle g_iotHubClientHandleForADUComponent;
  */
 _Bool AzureDeviceUpdateCoreInterface_Create(void** context, int argc, char** argv);
 
+/**
+ * @brief Initialize the interface for one of the devices hosted by the process, e.g. by a fleet simulator.
+ *
+ * The device reports through @p clientHandle, with a reporting queue of its own, and keeps its goal state and
+ * workflow state journal in @p dataFolder. The workflow threads and the update content handlers are shared with the
+ * other devices.
+ *
+ * @param context Optional context object.
+ * @param clientHandle The client of the device, or NULL for g_iotHubClientHandleForADUComponent.
+ * @param dataFolder The existing data folder of the device, or NULL for ADUC_DATA_FOLDER.
+ * @param argc Count of arguments in @p argv
+ * @param argv Command line parameters.
+ * @return _Bool True on success.
+ */
+_Bool AzureDeviceUpdateCoreInterface_CreateForDevice(
+    void** context, ADUC_ClientHandle clientHandle, const char* dataFolder, int argc, char** argv);
+
 /**
  * @brief Called after the device connected to IoT Hub (device client handler is valid).
  *
@@ -56,6 +73,15 @@ void AzureDeviceUpdateCoreInterface_Connected(void* componentContext);
  */
 void AzureDeviceUpdateCoreInterface_DoWork(void* componentContext);
 
+/**
+ * @brief Gets the delay until DoWork is next due: right away before the warm start, shortly while an update action is
+ * in progress or reports are waiting to be sent, and rarely while idle.
+ *
+ * @param componentContext Context object from Create.
+ * @return unsigned int The delay, in milliseconds.
+ */
+unsigned int AzureDeviceUpdateCoreInterface_GetDoWorkDelay(void* componentContext);
+
 /**
  * @brief Uninitialize the component.
  *
@@ -88,6 +114,35 @@ _Bool AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
     const ADUC_Result* result,
     const char* installedUpdateId);
 
+/**
+ * @brief Shrinks a report of the 'agent' property that is over @p budgetBytes once serialized. In turn, until it fits:
+ * the resultDetails of the successful steps are dropped, those of the failures are truncated, and the successful steps
+ * are dropped. What is dropped or truncated is logged in full instead.
+ *
+ * @param reportValue The report, as made for AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync.
+ * @param budgetBytes The budget, in bytes.
+ * @returns true if the report fits in the budget.
+ */
+_Bool AzureDeviceUpdateCoreInterface_FitReportToBudget(JSON_Value* reportValue, size_t budgetBytes);
+
+/**
+ * @brief Sends the reports that are waiting to be merged with the following ones, unless IoT Hub throttles reports.
+ *
+ * @param workflowDataToken A pointer to workflow data object.
+ */
+void AzureDeviceUpdateCoreInterface_FlushReports(ADUC_WorkflowDataToken workflowDataToken);
+
+/**
+ * @brief Tells the component whether its device is connected to IoT Hub.
+ * @details While disconnected, the reports of the 'agent' property are merged instead of sent. After reconnecting,
+ * they are sent as one report, at a random time within a back off that doubles with each reconnection until the
+ * connection is stable.
+ *
+ * @param componentContext The component context.
+ * @param connected Whether the device is connected.
+ */
+void AzureDeviceUpdateCoreInterface_SetConnected(void* componentContext, _Bool connected);
+
 EXTERN_C_END
 
 #endif // ADUC_ADU_CORE_INTERFACE_H
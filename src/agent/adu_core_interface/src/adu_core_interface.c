@@ -12,19 +12,30 @@
 #include "aduc/agent_workflow.h"
 #include "aduc/c_utils.h"
 #include "aduc/client_handle_helper.h"
+#include "aduc/event_loop_utils.h"
+#include "aduc/extension_manager.h"
 #include "aduc/hash_utils.h"
 #include "aduc/logging.h"
+#include "aduc/metrics_utils.h"
+#include "aduc/resource_sampler.h"
 #include "aduc/string_c_utils.h"
+#include "aduc/timing_utils.h"
+#include "aduc/tracepoints.h"
 #include "aduc/types/update_content.h"
 #include "aduc/workflow_data_utils.h"
 #include "aduc/workflow_utils.h"
 
 #include "startup_msg_helper.h"
 
+#include <azure_c_shared_utility/crt_abstractions.h> // mallocAndStrcpy_s
 #include <azure_c_shared_utility/strings.h> // STRING_*
 #include <iothub_client_version.h>
 #include <parson.h>
 #include <pnp_protocol.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
 
 // Name of an Device Update Agent component that this device implements.
 static const char g_aduPnPComponentName[] = "deviceUpdate";
@@ -44,9 +55,289 @@ static const char g_aduPnPComponentServicePropertyName[] = "service";
  */
 ADUC_ClientHandle g_iotHubClientHandleForADUComponent;
 
+//
+// Reporting queue
+//
+// Reports of the 'agent' property are merged into one pending report, which is sent once it's been pending
+// for ADUC_REPORTING_DEBOUNCE_MS, or right away for terminal states. While IoT Hub throttles the reports,
+// they keep being merged and are sent once the back off is over.
+// While disconnected from IoT Hub, they keep being merged too, and are sent as one report after reconnecting,
+// at a random time within a back off that grows with each reconnection of an unstable connection.
+// When no report is in flight, only the properties that differ from the acknowledged ones are sent.
+//
+
+/**
+ * @brief How long a report that isn't urgent waits for more reports to be merged with.
+ */
+#define ADUC_REPORTING_DEBOUNCE_MS 500
+
+/**
+ * @brief The first back off after IoT Hub throttled or failed a report.
+ */
+#define ADUC_REPORTING_MIN_BACKOFF_MS 1000
+
+/**
+ * @brief The longest back off after IoT Hub throttled or failed reports.
+ */
+#define ADUC_REPORTING_MAX_BACKOFF_MS (60 * 1000)
+
+/**
+ * @brief The first back off after reconnecting to IoT Hub.
+ */
+#define ADUC_REPORTING_MIN_RECONNECT_BACKOFF_MS 1000
+
+/**
+ * @brief The longest back off after reconnecting to IoT Hub.
+ */
+#define ADUC_REPORTING_MAX_RECONNECT_BACKOFF_MS (5 * 60 * 1000)
+
+/**
+ * @brief How long a connection to IoT Hub lasts before the reconnect back off starts over.
+ */
+#define ADUC_REPORTING_STABLE_CONNECTION_MS (10 * 60 * 1000)
+
+/**
+ * @brief The number of sent reports kept until IoT Hub acknowledges them, to send them again if throttled.
+ */
+#define ADUC_REPORTING_MAX_IN_FLIGHT 8
+
+/**
+ * @brief The status code of a throttled reported properties update.
+ */
+#define ADUC_REPORTING_STATUS_THROTTLED 429
+
+/**
+ * @brief The size budget of the 'agent' property reports, well below the 32 KiB limit of the reported properties.
+ */
+#define ADUC_REPORTING_BUDGET_BYTES (8 * 1024)
+
+/**
+ * @brief The length that resultDetails of failures are truncated to when a report is over the budget.
+ */
+#define ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH 256
+
+/**
+ * @brief The DoWork interval while an update action is in progress.
+ */
+#define ADUC_CORE_ACTIVE_DOWORK_INTERVAL_MS 100
+
+/**
+ * @brief The DoWork interval while idle, for the periodic checks of the platform layer's DoWorkCallback.
+ * Completed operations and twin updates wake up the main loop, so they don't wait for it.
+ */
+#define ADUC_CORE_IDLE_DOWORK_INTERVAL_MS (60 * 1000)
+
+/**
+ * @brief The reports of the 'agent' property that haven't been sent or acknowledged yet.
+ */
+typedef struct tagADUC_ReportingQueue
+{
+    pthread_mutex_t Mutex; /**< Protects the other members. */
+    JSON_Value* Pending; /**< The merged reports not sent yet, NULL if none. */
+    uint64_t PendingSinceMs; /**< When the oldest of the merged reports was queued. */
+    JSON_Value* InFlight[ADUC_REPORTING_MAX_IN_FLIGHT]; /**< The sent reports, oldest first. */
+    size_t InFlightCount; /**< The number of sent reports. */
+    JSON_Value* Acknowledged; /**< The merged reports IoT Hub acknowledged, NULL if unknown. */
+    uint64_t BackoffMs; /**< The current back off, 0 if IoT Hub accepts the reports. */
+    uint64_t BackoffUntilMs; /**< No report is sent before this time. */
+    _Bool Offline; /**< Whether the device is disconnected from IoT Hub; no report is sent meanwhile. */
+    uint64_t ConnectedSinceMs; /**< When the device last reconnected to IoT Hub. */
+    uint64_t ReconnectBackoffMs; /**< The back off after the last reconnection, 0 if none. */
+    uint32_t JitterState; /**< The state of the generator of the random part of the reconnect back off. */
+    pthread_mutex_t WriterMutex; /**< Protects Writer, while a report is written and sent. */
+    PnP_ReportedPropertyWriter Writer; /**< The reused buffer the reports are written into. */
+} ADUC_ReportingQueue;
+
+/**
+ * @brief The reports of the agent's device, for the workflow data that doesn't have a queue of its own.
+ */
+static ADUC_ReportingQueue s_reportingQueue = { .Mutex = PTHREAD_MUTEX_INITIALIZER,
+                                                .WriterMutex = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief Gets the reporting queue of the device of @p workflowData.
+ */
+static ADUC_ReportingQueue* GetReportingQueue(const ADUC_WorkflowData* workflowData)
+{
+    return workflowData->ReportingQueue != NULL ? workflowData->ReportingQueue : &s_reportingQueue;
+}
+
+/**
+ * @brief Takes the reused writer of @p queue, or @p fallback if another thread is writing or sending with it.
+ * @details Never waits, as that thread may be waiting for the IoT Hub client's lock, which the caller may hold.
+ *
+ * @param queue The queue.
+ * @param fallback An empty writer to use instead.
+ * @return PnP_ReportedPropertyWriter* The writer, to be given back with ReleaseWriter.
+ */
+static PnP_ReportedPropertyWriter* AcquireWriter(ADUC_ReportingQueue* queue, PnP_ReportedPropertyWriter* fallback)
+{
+    return pthread_mutex_trylock(&queue->WriterMutex) == 0 ? &queue->Writer : fallback;
+}
+
+/**
+ * @brief Gives back a writer from AcquireWriter.
+ *
+ * @param queue The queue.
+ * @param writer The writer.
+ */
+static void ReleaseWriter(ADUC_ReportingQueue* queue, PnP_ReportedPropertyWriter* writer)
+{
+    if (writer == &queue->Writer)
+    {
+        pthread_mutex_unlock(&queue->WriterMutex);
+    }
+    else
+    {
+        PnP_ReportedPropertyWriter_Uninit(writer);
+    }
+}
+
+/**
+ * @brief Gets the IoT Hub client of the device of @p workflowData.
+ */
+static ADUC_ClientHandle GetClientHandle(const ADUC_WorkflowData* workflowData)
+{
+    return workflowData->ClientHandle != NULL ? (ADUC_ClientHandle)workflowData->ClientHandle
+                                              : g_iotHubClientHandleForADUComponent;
+}
+
+/**
+ * @brief Returns the time of a monotonic clock, in milliseconds.
+ */
+static uint64_t GetMonotonicTimeMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Merges @p source into @p target, the same way IoT Hub merges reported properties updates: the objects are
+ * merged recursively, other values of @p source replace those of @p target.
+ *
+ * @param target The object to merge into.
+ * @param source The object to merge.
+ */
+static void MergeReportedProperties(JSON_Object* target, const JSON_Object* source)
+{
+    const size_t count = json_object_get_count(source);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const char* name = json_object_get_name(source, i);
+        JSON_Value* value = json_object_get_value_at(source, i);
+        JSON_Object* targetObject = json_object_get_object(target, name);
+
+        if (targetObject != NULL && json_value_get_type(value) == JSONObject)
+        {
+            MergeReportedProperties(targetObject, json_value_get_object(value));
+            continue;
+        }
+
+        JSON_Value* copy = json_value_deep_copy(value);
+        if (copy == NULL || json_object_set_value(target, name, copy) != JSONSuccess)
+        {
+            json_value_free(copy);
+            Log_Warn("Cannot merge reported property '%s'", name);
+        }
+    }
+}
+
+/**
+ * @brief Returns the properties of @p report whose values differ from those of @p reported.
+ *
+ * @param report The report.
+ * @param reported The reported properties. May be NULL.
+ * @return JSON_Value* The properties of @p report that need to be sent, NULL if none does.
+ */
+static JSON_Value* GetChangedReportedProperties(const JSON_Object* report, const JSON_Object* reported)
+{
+    JSON_Value* changesValue = NULL;
+    const size_t count = json_object_get_count(report);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const char* name = json_object_get_name(report, i);
+        JSON_Value* value = json_object_get_value_at(report, i);
+        JSON_Value* reportedValue = json_object_get_value(reported, name);
+        JSON_Value* change = NULL;
+
+        if (json_value_get_type(value) == JSONObject && json_value_get_type(reportedValue) == JSONObject)
+        {
+            change = GetChangedReportedProperties(json_value_get_object(value), json_value_get_object(reportedValue));
+        }
+        else if (reportedValue == NULL || !json_value_equals(value, reportedValue))
+        {
+            change = json_value_deep_copy(value);
+        }
+
+        if (change == NULL)
+        {
+            continue;
+        }
+
+        if (changesValue == NULL)
+        {
+            changesValue = json_value_init_object();
+        }
+
+        if (json_object_set_value(json_value_get_object(changesValue), name, change) != JSONSuccess)
+        {
+            json_value_free(change);
+        }
+    }
+
+    return changesValue;
+}
+
+/**
+ * @brief Forgets the acknowledged reports, so that the next report is sent whole.
+ * Must be called with the queue's mutex held.
+ */
+static void ForgetAcknowledgedReportsLocked(ADUC_ReportingQueue* queue)
+{
+    json_value_free(queue->Acknowledged);
+    queue->Acknowledged = NULL;
+}
+
+/**
+ * @brief Puts the unacknowledged report @p value back in the queue, under the pending reports, which are newer.
+ * Must be called with the queue's mutex held.
+ *
+ * @param queue The queue.
+ * @param value The report. This function takes ownership of it.
+ */
+static void RequeueReportLocked(ADUC_ReportingQueue* queue, JSON_Value* value)
+{
+    if (queue->Pending != NULL)
+    {
+        MergeReportedProperties(json_value_get_object(value), json_value_get_object(queue->Pending));
+        json_value_free(queue->Pending);
+    }
+
+    queue->Pending = value;
+    queue->PendingSinceMs = 0;
+}
+
+/**
+ * @brief Called once IoT Hub processed a reported properties update, in the order they were sent.
+ *
+ * @param statusCode The status code of the update.
+ * @param context The ADUC_ReportingQueue the update was sent from, or NULL for that of the agent's device.
+ */
 void ClientReportedStateCallback(int statusCode, void* context)
 {
-    UNREFERENCED_PARAMETER(context);
+    ADUC_ReportingQueue* queue = context != NULL ? (ADUC_ReportingQueue*)context : &s_reportingQueue;
+    const _Bool retry = statusCode == ADUC_REPORTING_STATUS_THROTTLED || statusCode >= 500;
+    JSON_Value* report = NULL;
+
+    ADUC_TRACEPOINT1(twin_report_ack, statusCode);
+
+    if (statusCode == ADUC_REPORTING_STATUS_THROTTLED)
+    {
+        ADUC_Metrics_AddCounter(ADUC_MetricsCounter_TwinReportsThrottled, 1);
+    }
 
     if (statusCode < 200 || statusCode >= 300)
     {
@@ -55,6 +346,63 @@ void ClientReportedStateCallback(int statusCode, void* context)
             statusCode,
             MU_ENUM_TO_STRING(IOTHUB_CLIENT_RESULT, statusCode));
     }
+
+    pthread_mutex_lock(&queue->Mutex);
+
+    if (queue->InFlightCount > 0)
+    {
+        report = queue->InFlight[0];
+        queue->InFlightCount--;
+        memmove(queue->InFlight, queue->InFlight + 1, queue->InFlightCount * sizeof(queue->InFlight[0]));
+    }
+
+    if (report != NULL && statusCode >= 200 && statusCode < 300)
+    {
+        if (queue->Acknowledged == NULL)
+        {
+            queue->Acknowledged = report;
+            report = NULL;
+        }
+        else
+        {
+            MergeReportedProperties(
+                json_value_get_object(queue->Acknowledged), json_value_get_object(report));
+        }
+    }
+    else if (statusCode < 200 || statusCode >= 300)
+    {
+        // Some reported properties may be missing.
+        ForgetAcknowledgedReportsLocked(queue);
+    }
+
+    if (retry)
+    {
+        queue->BackoffMs = queue->BackoffMs == 0
+            ? ADUC_REPORTING_MIN_BACKOFF_MS
+            : queue->BackoffMs * 2;
+
+        if (queue->BackoffMs > ADUC_REPORTING_MAX_BACKOFF_MS)
+        {
+            queue->BackoffMs = ADUC_REPORTING_MAX_BACKOFF_MS;
+        }
+
+        queue->BackoffUntilMs = GetMonotonicTimeMs() + queue->BackoffMs;
+        Log_Warn("Reporting backs off for %llu ms", (unsigned long long)queue->BackoffMs);
+
+        if (report != NULL)
+        {
+            RequeueReportLocked(queue, report);
+            report = NULL;
+        }
+    }
+    else if (statusCode >= 200 && statusCode < 300)
+    {
+        queue->BackoffMs = 0;
+    }
+
+    pthread_mutex_unlock(&queue->Mutex);
+
+    json_value_free(report);
 }
 
 /**
@@ -147,36 +495,39 @@ static _Bool ReportClientJsonProperty(const char* json_value, ADUC_WorkflowData*
 {
     _Bool success = false;
 
-    if (g_iotHubClientHandleForADUComponent == NULL)
+    ADUC_ClientHandle clientHandle = GetClientHandle(workflowData);
+
+    if (clientHandle == NULL)
     {
         Log_Error("ReportClientJsonProperty called with invalid IoTHub Device Client handle! Can't report!");
         return false;
     }
 
     IOTHUB_CLIENT_RESULT iothubClientResult;
-    STRING_HANDLE jsonToSend =
-        PnP_CreateReportedProperty(g_aduPnPComponentName, g_aduPnPComponentAgentPropertyName, json_value);
+    ADUC_ReportingQueue* queue = GetReportingQueue(workflowData);
+    PnP_ReportedPropertyWriter fallbackWriter = { 0 };
+    PnP_ReportedPropertyWriter* writer = AcquireWriter(queue, &fallbackWriter);
 
-    if (jsonToSend == NULL)
+    if (!PnP_ReportedPropertyWriter_Write(
+            writer, g_aduPnPComponentName, g_aduPnPComponentAgentPropertyName, json_value))
     {
         Log_Error("Unable to create Reported property for ADU client.");
         goto done;
     }
 
-    const char* jsonToSendStr = STRING_c_str(jsonToSend);
-    size_t jsonToSendStrLen = strlen(jsonToSendStr);
-
-    Log_Debug("Reporting agent state:\n%s", jsonToSendStr);
+    Log_Debug("Reporting agent state:\n%s", writer->Buffer);
 
     ClientHandleSendReportFunc clientHandle_SendReportedState_Func =
         ADUC_WorkflowData_GetClientHandleSendReportFunc(workflowData);
 
+    ADUC_TRACEPOINT1(twin_report_send, writer->Length);
+
     iothubClientResult = (IOTHUB_CLIENT_RESULT)clientHandle_SendReportedState_Func(
-        g_iotHubClientHandleForADUComponent,
-        (const unsigned char*)jsonToSendStr,
-        jsonToSendStrLen,
+        clientHandle,
+        (const unsigned char*)writer->Buffer,
+        writer->Length,
         ClientReportedStateCallback,
-        NULL);
+        workflowData->ReportingQueue);
 
     if (iothubClientResult != IOTHUB_CLIENT_OK)
     {
@@ -188,14 +539,261 @@ static _Bool ReportClientJsonProperty(const char* json_value, ADUC_WorkflowData*
         goto done;
     }
 
+    ADUC_Metrics_AddCounter(ADUC_MetricsCounter_TwinReportsSent, 1);
     success = true;
 
 done:
-    STRING_delete(jsonToSend);
+    ReleaseWriter(queue, writer);
+
+    return success;
+}
+
+/**
+ * @brief Sends the pending reports, if any, unless reporting is backing off.
+ *
+ * @param workflowData The workflow data.
+ * @param force Whether to send reports that have been pending for less than ADUC_REPORTING_DEBOUNCE_MS.
+ * @return _Bool false if sending the reports failed; they stay pending.
+ */
+static _Bool FlushReports(ADUC_WorkflowData* workflowData, _Bool force)
+{
+    ADUC_ReportingQueue* queue = GetReportingQueue(workflowData);
+    _Bool success = true;
+    JSON_Value* report = NULL;
+    char* jsonString = NULL;
+
+    pthread_mutex_lock(&queue->Mutex);
+
+    const uint64_t now = GetMonotonicTimeMs();
+
+    if (queue->Pending == NULL || queue->Offline || now < queue->BackoffUntilMs
+        || (!force && now - queue->PendingSinceMs < ADUC_REPORTING_DEBOUNCE_MS))
+    {
+        goto done;
+    }
+
+    // While reports are in flight, the reported properties aren't known for sure.
+    if (queue->InFlightCount == 0 && queue->Acknowledged != NULL)
+    {
+        report = GetChangedReportedProperties(
+            json_value_get_object(queue->Pending), json_value_get_object(queue->Acknowledged));
+
+        json_value_free(queue->Pending);
+        queue->Pending = NULL;
+
+        if (report == NULL)
+        {
+            Log_Debug("Reported properties are up to date");
+            goto done;
+        }
+    }
+    else
+    {
+        report = queue->Pending;
+        queue->Pending = NULL;
+    }
+
+    jsonString = json_serialize_to_string(report);
+    if (jsonString == NULL)
+    {
+        Log_Error("Serializing JSON to string failed");
+        RequeueReportLocked(queue, report);
+        success = false;
+        goto done;
+    }
+
+    if (queue->InFlightCount == ADUC_REPORTING_MAX_IN_FLIGHT)
+    {
+        // Not acknowledged for a while; whether it was applied is unknown.
+        ForgetAcknowledgedReportsLocked(queue);
+        json_value_free(queue->InFlight[0]);
+        queue->InFlightCount--;
+        memmove(queue->InFlight, queue->InFlight + 1, queue->InFlightCount * sizeof(queue->InFlight[0]));
+    }
+
+    // Tracked before sending, as the acknowledgement may come before the send call returns.
+    queue->InFlight[queue->InFlightCount++] = report;
+
+    pthread_mutex_unlock(&queue->Mutex);
+
+    success = ReportClientJsonProperty(jsonString, workflowData);
+
+    pthread_mutex_lock(&queue->Mutex);
+
+    if (!success)
+    {
+        // Not sent, so it won't be acknowledged.
+        for (size_t i = 0; i < queue->InFlightCount; i++)
+        {
+            if (queue->InFlight[i] == report)
+            {
+                queue->InFlightCount--;
+                memmove(
+                    queue->InFlight + i,
+                    queue->InFlight + i + 1,
+                    (queue->InFlightCount - i) * sizeof(queue->InFlight[0]));
+                RequeueReportLocked(queue, report);
+                break;
+            }
+        }
+    }
+
+done:
+    pthread_mutex_unlock(&queue->Mutex);
+
+    json_free_serialized_string(jsonString);
 
     return success;
 }
 
+/**
+ * @brief Queues a report of the 'agent' property, merging it with the pending ones.
+ *
+ * @param json_value The json value to be reported.
+ * @param workflowData The workflow data.
+ * @param urgent Whether to send the pending reports now, instead of waiting for more reports to merge with.
+ * @return _Bool false if the report is invalid, or if it's urgent and sending it failed.
+ */
+static _Bool QueueClientJsonProperty(const char* json_value, ADUC_WorkflowData* workflowData, _Bool urgent)
+{
+    ADUC_ReportingQueue* queue = GetReportingQueue(workflowData);
+    JSON_Value* report = json_parse_string(json_value);
+
+    if (json_value_get_type(report) != JSONObject)
+    {
+        Log_Error("Invalid report: %s", json_value);
+        json_value_free(report);
+        return false;
+    }
+
+    pthread_mutex_lock(&queue->Mutex);
+
+    if (queue->Pending == NULL)
+    {
+        queue->Pending = report;
+        queue->PendingSinceMs = GetMonotonicTimeMs();
+    }
+    else
+    {
+        MergeReportedProperties(json_value_get_object(queue->Pending), json_value_get_object(report));
+        json_value_free(report);
+    }
+
+    if (urgent)
+    {
+        // Sent as soon as the back off, if any, is over.
+        queue->PendingSinceMs = 0;
+    }
+
+    pthread_mutex_unlock(&queue->Mutex);
+
+    return FlushReports(workflowData, urgent);
+}
+
+/**
+ * @brief Drops the pending and unacknowledged reports.
+ *
+ * @param queue The queue.
+ */
+static void ClearReports(ADUC_ReportingQueue* queue)
+{
+    pthread_mutex_lock(&queue->Mutex);
+
+    json_value_free(queue->Pending);
+    queue->Pending = NULL;
+
+    for (size_t i = 0; i < queue->InFlightCount; i++)
+    {
+        json_value_free(queue->InFlight[i]);
+    }
+
+    queue->InFlightCount = 0;
+
+    ForgetAcknowledgedReportsLocked(queue);
+
+    pthread_mutex_unlock(&queue->Mutex);
+}
+
+void AzureDeviceUpdateCoreInterface_FlushReports(ADUC_WorkflowDataToken workflowDataToken)
+{
+    FlushReports((ADUC_WorkflowData*)workflowDataToken, true);
+}
+
+/**
+ * @brief Draws a random delay in [0, @p maxMs], with a xorshift generator.
+ * Must be called with the queue's mutex held.
+ */
+static uint64_t DrawJitterMsLocked(ADUC_ReportingQueue* queue, uint64_t maxMs)
+{
+    if (queue->JitterState == 0)
+    {
+        // Seeded differently on each device, and for each queue of a device.
+        queue->JitterState = (uint32_t)(GetMonotonicTimeMs() ^ (uintptr_t)queue) | 1;
+    }
+
+    queue->JitterState ^= queue->JitterState << 13;
+    queue->JitterState ^= queue->JitterState >> 17;
+    queue->JitterState ^= queue->JitterState << 5;
+
+    return queue->JitterState % (maxMs + 1);
+}
+
+void AzureDeviceUpdateCoreInterface_SetConnected(void* componentContext, _Bool connected)
+{
+    ADUC_ReportingQueue* queue = GetReportingQueue((ADUC_WorkflowData*)componentContext);
+    _Bool wakeup = false;
+
+    pthread_mutex_lock(&queue->Mutex);
+
+    const uint64_t now = GetMonotonicTimeMs();
+
+    if (!connected && !queue->Offline)
+    {
+        queue->Offline = true;
+
+        if (now - queue->ConnectedSinceMs >= ADUC_REPORTING_STABLE_CONNECTION_MS)
+        {
+            queue->ReconnectBackoffMs = 0;
+        }
+
+        Log_Info("Disconnected from IoT Hub, reports are kept until reconnected");
+    }
+    else if (connected && queue->Offline)
+    {
+        queue->Offline = false;
+        queue->ConnectedSinceMs = now;
+
+        queue->ReconnectBackoffMs = queue->ReconnectBackoffMs == 0
+            ? ADUC_REPORTING_MIN_RECONNECT_BACKOFF_MS
+            : queue->ReconnectBackoffMs * 2;
+
+        if (queue->ReconnectBackoffMs > ADUC_REPORTING_MAX_RECONNECT_BACKOFF_MS)
+        {
+            queue->ReconnectBackoffMs = ADUC_REPORTING_MAX_RECONNECT_BACKOFF_MS;
+        }
+
+        // At a random time within the back off, so that the devices that reconnect together, e.g. after an outage,
+        // don't all report at once.
+        const uint64_t delay = DrawJitterMsLocked(queue, queue->ReconnectBackoffMs);
+        if (queue->BackoffUntilMs < now + delay)
+        {
+            queue->BackoffUntilMs = now + delay;
+        }
+
+        Log_Info("Reconnected to IoT Hub, pending reports are sent in %llu ms", (unsigned long long)delay);
+
+        wakeup = queue->Pending != NULL;
+    }
+
+    pthread_mutex_unlock(&queue->Mutex);
+
+    // The main loop doesn't wait for pending reports while disconnected.
+    if (wakeup)
+    {
+        ADUC_EventLoop_Wakeup();
+    }
+}
+
 /**
  * @brief Reports values to the cloud which do not change throughout ADUs execution
  * @details the current expectation is to report these values after the successful
@@ -205,7 +803,7 @@ done:
  */
 _Bool ReportStartupMsg(ADUC_WorkflowData* workflowData)
 {
-    if (g_iotHubClientHandleForADUComponent == NULL)
+    if (GetClientHandle(workflowData) == NULL)
     {
         Log_Error("ReportStartupMsg called before registration! Can't report!");
         return false;
@@ -251,7 +849,7 @@ _Bool ReportStartupMsg(ADUC_WorkflowData* workflowData)
         goto done;
     }
 
-    ReportClientJsonProperty(jsonString, workflowData);
+    QueueClientJsonProperty(jsonString, workflowData, true /* urgent */);
 
     success = true;
 done:
@@ -268,8 +866,17 @@ done:
 //
 
 _Bool AzureDeviceUpdateCoreInterface_Create(void** context, int argc, char** argv)
+{
+    return AzureDeviceUpdateCoreInterface_CreateForDevice(
+        context, NULL /* clientHandle */, NULL /* dataFolder */, argc, argv);
+}
+
+_Bool AzureDeviceUpdateCoreInterface_CreateForDevice(
+    void** context, ADUC_ClientHandle clientHandle, const char* dataFolder, int argc, char** argv)
 {
     _Bool succeeded = false;
+    ADUC_ReportingQueue* queue = NULL;
+    char* dataFolderCopy = NULL;
 
     ADUC_WorkflowData* workflowData = calloc(1, sizeof(ADUC_WorkflowData));
     if (workflowData == NULL)
@@ -277,6 +884,30 @@ _Bool AzureDeviceUpdateCoreInterface_Create(void** context, int argc, char** arg
         goto done;
     }
 
+    if (clientHandle != NULL)
+    {
+        queue = calloc(1, sizeof(*queue));
+        if (queue == NULL || pthread_mutex_init(&queue->Mutex, NULL) != 0)
+        {
+            free(queue);
+            queue = NULL;
+            goto done;
+        }
+
+        if (pthread_mutex_init(&queue->WriterMutex, NULL) != 0)
+        {
+            pthread_mutex_destroy(&queue->Mutex);
+            free(queue);
+            queue = NULL;
+            goto done;
+        }
+    }
+
+    if (dataFolder != NULL && mallocAndStrcpy_s(&dataFolderCopy, dataFolder) != 0)
+    {
+        goto done;
+    }
+
     Log_Info("ADUC agent started. Using IoT Hub Client SDK %s", IoTHubClient_GetVersionString());
 
     if (!ADUC_WorkflowData_Init(workflowData, argc, argv))
@@ -285,6 +916,13 @@ _Bool AzureDeviceUpdateCoreInterface_Create(void** context, int argc, char** arg
         goto done;
     }
 
+    // Set after the initialization, which clears the workflow data.
+    workflowData->ClientHandle = clientHandle;
+    workflowData->ReportingQueue = queue;
+    workflowData->DataFolder = dataFolderCopy;
+    queue = NULL;
+    dataFolderCopy = NULL;
+
     succeeded = true;
 
 done:
@@ -296,6 +934,15 @@ done:
         workflowData = NULL;
     }
 
+    if (queue != NULL)
+    {
+        pthread_mutex_destroy(&queue->WriterMutex);
+        pthread_mutex_destroy(&queue->Mutex);
+        free(queue);
+    }
+
+    free(dataFolderCopy);
+
     // Set out parameter.
     *context = workflowData;
 
@@ -321,18 +968,104 @@ void AzureDeviceUpdateCoreInterface_Connected(void* componentContext)
 void AzureDeviceUpdateCoreInterface_DoWork(void* componentContext)
 {
     ADUC_WorkflowData* workflowData = (ADUC_WorkflowData*)componentContext;
+
+    // The first call comes from the main loop, once the content downloader is initialized.
+    if (!workflowData->WarmStartAttempted)
+    {
+        ADUC_Workflow_WarmStart(workflowData);
+    }
+
+    // An agent restart done in-process, once the workflow that required it is idle.
+    if (workflowData->InProcessRestartPending && workflowData->WorkflowHandle == NULL)
+    {
+        ExtensionManager_ReloadUpdateContentHandlers();
+        ADUC_Workflow_CompleteInProcessRestart(workflowData);
+    }
+
+    // Between deployments, the extensions not used for a while free their memory.
+    if (workflowData->WorkflowHandle == NULL)
+    {
+        ExtensionManager_UnloadIdleExtensions();
+    }
+
+    FlushReports(workflowData, false /* force */);
+
     ADUC_Workflow_DoWork(workflowData);
 }
 
+unsigned int AzureDeviceUpdateCoreInterface_GetDoWorkDelay(void* componentContext)
+{
+    ADUC_WorkflowData* workflowData = (ADUC_WorkflowData*)componentContext;
+    ADUC_ReportingQueue* queue = GetReportingQueue(workflowData);
+    uint64_t delay = ADUC_CORE_IDLE_DOWORK_INTERVAL_MS;
+
+    if (!workflowData->WarmStartAttempted
+        || (workflowData->InProcessRestartPending && workflowData->WorkflowHandle == NULL))
+    {
+        return 0;
+    }
+
+    if (workflowData->InProcessRestartPending
+        || workflow_get_operation_in_progress(workflowData->WorkflowHandle))
+    {
+        delay = ADUC_CORE_ACTIVE_DOWORK_INTERVAL_MS;
+    }
+
+    // Pending reports are sent once debounced and no longer backed off, and wait for a reconnection.
+    pthread_mutex_lock(&queue->Mutex);
+    if (queue->Pending != NULL && !queue->Offline)
+    {
+        const uint64_t now = GetMonotonicTimeMs();
+        uint64_t due = queue->PendingSinceMs + ADUC_REPORTING_DEBOUNCE_MS;
+        if (due < queue->BackoffUntilMs)
+        {
+            due = queue->BackoffUntilMs;
+        }
+
+        if (due <= now)
+        {
+            delay = 0;
+        }
+        else if (due - now < delay)
+        {
+            delay = due - now;
+        }
+    }
+    pthread_mutex_unlock(&queue->Mutex);
+
+    return (unsigned int)delay;
+}
+
 void AzureDeviceUpdateCoreInterface_Destroy(void** componentContext)
 {
     ADUC_WorkflowData* workflowData = (ADUC_WorkflowData*)(*componentContext);
 
     Log_Info("ADUC agent stopping");
 
+    ADUC_ReportingQueue* queue = workflowData->ReportingQueue;
+    char* dataFolder = workflowData->DataFolder;
+
+    FlushReports(workflowData, true /* force */);
+
+    ADUC_ReportingQueue* reportingQueue = GetReportingQueue(workflowData);
+    ClearReports(reportingQueue);
+
+    pthread_mutex_lock(&reportingQueue->WriterMutex);
+    PnP_ReportedPropertyWriter_Uninit(&reportingQueue->Writer);
+    pthread_mutex_unlock(&reportingQueue->WriterMutex);
+
     ADUC_WorkflowData_Uninit(workflowData);
     free(workflowData);
 
+    if (queue != NULL)
+    {
+        pthread_mutex_destroy(&queue->WriterMutex);
+        pthread_mutex_destroy(&queue->Mutex);
+        free(queue);
+    }
+
+    free(dataFolder);
+
     *componentContext = NULL;
 }
 
@@ -340,7 +1073,9 @@ void OrchestratorUpdateCallback(
     ADUC_ClientHandle clientHandle, JSON_Value* propertyValue, int propertyVersion, void* context)
 {
     ADUC_WorkflowData* workflowData = (ADUC_WorkflowData*)context;
-    STRING_HANDLE jsonToSend = NULL;
+    ADUC_ReportingQueue* queue = GetReportingQueue(workflowData);
+    PnP_ReportedPropertyWriter fallbackWriter = { 0 };
+    PnP_ReportedPropertyWriter* writer = NULL;
 
     // Reads out the json string so we can Log Out what we've got.
     // The value will be parsed and handled in ADUC_Workflow_HandlePropertyUpdate.
@@ -366,28 +1101,26 @@ void OrchestratorUpdateCallback(
     Log_Debug("Update Action info string (%s), property version (%d)", ackString, propertyVersion);
 
     ADUC_Workflow_HandlePropertyUpdate(workflowData, (const unsigned char*)jsonString, false /* forceDeferral */);
-    free(jsonString);
+    json_free_serialized_string(jsonString);
     jsonString = ackString;
 
     // ACK the request.
-    jsonToSend = PnP_CreateReportedPropertyWithStatus(
-        g_aduPnPComponentName,
-        g_aduPnPComponentServicePropertyName,
-        jsonString,
-        PNP_STATUS_SUCCESS,
-        "", // Description for this acknowledgement.
-        propertyVersion);
-
-    if (jsonToSend == NULL)
+    writer = AcquireWriter(queue, &fallbackWriter);
+    if (!PnP_ReportedPropertyWriter_WriteWithStatus(
+            writer,
+            g_aduPnPComponentName,
+            g_aduPnPComponentServicePropertyName,
+            jsonString,
+            PNP_STATUS_SUCCESS,
+            "", // Description for this acknowledgement.
+            propertyVersion))
     {
         Log_Error("Unable to build reported property ACK response.");
         goto done;
     }
 
-    const char* jsonToSendStr = STRING_c_str(jsonToSend);
-    size_t jsonToSendStrLen = strlen(jsonToSendStr);
     IOTHUB_CLIENT_RESULT iothubClientResult = ClientHandle_SendReportedState(
-        clientHandle, (const unsigned char*)jsonToSendStr, jsonToSendStrLen, NULL, NULL);
+        clientHandle, (const unsigned char*)writer->Buffer, writer->Length, NULL, NULL);
 
     if (iothubClientResult != IOTHUB_CLIENT_OK)
     {
@@ -399,9 +1132,12 @@ void OrchestratorUpdateCallback(
     }
 
 done:
-    STRING_delete(jsonToSend);
+    if (writer != NULL)
+    {
+        ReleaseWriter(queue, writer);
+    }
 
-    free(jsonString);
+    json_free_serialized_string(jsonString);
 
     Log_Info("OrchestratorPropertyUpdateCallback ended");
 }
@@ -582,6 +1318,13 @@ JSON_Value* GetReportingJsonValue(
     //                 "extendedResultCode" : ####,
     //                 "resultDetails" : "..."
     //             }
+    //         },
+    //         "timing" : {
+    //             "workflow_download" : {
+    //                 "count" : #,
+    //                 "totalMs" : ####
+    //             },
+    //             ...
     //         }
     //     }
     // }
@@ -681,6 +1424,44 @@ JSON_Value* GetReportingJsonValue(
         stepResultsValue = NULL; // rootObject owns the value now.
     }
 
+    //
+    // Timing summary of the deployment, cleared when a new one starts like 'stepResults'.
+    //
+    if (updateState == ADUCITF_State_DownloadStarted || updateState == ADUCITF_State_DeploymentInProgress)
+    {
+        if (json_object_set_null(lastInstallResultObject, ADUCITF_FIELDNAME_TIMING) != JSONSuccess)
+        {
+            Log_Warn("Could not clear 'timing' property.");
+        }
+
+        if (json_object_set_null(lastInstallResultObject, ADUCITF_FIELDNAME_RESOURCES) != JSONSuccess)
+        {
+            Log_Warn("Could not clear 'resources' property.");
+        }
+    }
+    else
+    {
+        JSON_Value* timingValue = ADUC_Timing_GetSummary();
+        JSON_Value* resourcesValue = ADUC_ResourceSampler_GetSummary();
+
+        if (timingValue != NULL
+            && json_object_set_value(lastInstallResultObject, ADUCITF_FIELDNAME_TIMING, timingValue) != JSONSuccess)
+        {
+            // Informational only, report the result anyway.
+            Log_Warn("Could not add JSON field: %s", ADUCITF_FIELDNAME_TIMING);
+            json_value_free(timingValue);
+        }
+
+        if (resourcesValue != NULL
+            && json_object_set_value(lastInstallResultObject, ADUCITF_FIELDNAME_RESOURCES, resourcesValue)
+                != JSONSuccess)
+        {
+            // Informational only, report the result anyway.
+            Log_Warn("Could not add JSON field: %s", ADUCITF_FIELDNAME_RESOURCES);
+            json_value_free(resourcesValue);
+        }
+    }
+
     //
     // Report both state and result
     //
@@ -773,6 +1554,125 @@ done:
     return resultValue;
 }
 
+/**
+ * @brief Sets the resultDetails of @p resultObject to null, after logging them.
+ */
+static void SpillResultDetails(JSON_Object* resultObject, const char* name)
+{
+    const char* resultDetails = json_object_get_string(resultObject, ADUCITF_FIELDNAME_RESULTDETAILS);
+    if (resultDetails == NULL)
+    {
+        return;
+    }
+
+    Log_Info("Not reporting the resultDetails of %s: %s", name, resultDetails);
+    json_object_set_null(resultObject, ADUCITF_FIELDNAME_RESULTDETAILS);
+}
+
+/**
+ * @brief Truncates the resultDetails of @p resultObject to ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH, after
+ * logging them.
+ */
+static void TruncateResultDetails(JSON_Object* resultObject, const char* name)
+{
+    const char* resultDetails = json_object_get_string(resultObject, ADUCITF_FIELDNAME_RESULTDETAILS);
+    if (resultDetails == NULL || strlen(resultDetails) <= ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH)
+    {
+        return;
+    }
+
+    // Not in the middle of a UTF-8 sequence.
+    size_t length = ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH;
+    while (length > 0 && ((unsigned char)resultDetails[length] & 0xC0) == 0x80)
+    {
+        length--;
+    }
+
+    char truncated[ADUC_REPORTING_TRUNCATED_RESULT_DETAILS_LENGTH + sizeof("...")];
+    memcpy(truncated, resultDetails, length);
+    strcpy(truncated + length, "...");
+
+    Log_Info("Truncating the reported resultDetails of %s: %s", name, resultDetails);
+    json_object_set_string(resultObject, ADUCITF_FIELDNAME_RESULTDETAILS, truncated);
+}
+
+_Bool AzureDeviceUpdateCoreInterface_FitReportToBudget(JSON_Value* reportValue, size_t budgetBytes)
+{
+    JSON_Object* lastInstallResultObject =
+        json_object_get_object(json_value_get_object(reportValue), ADUCITF_FIELDNAME_LASTINSTALLRESULT);
+    JSON_Object* stepResultsObject = json_object_get_object(lastInstallResultObject, ADUCITF_FIELDNAME_STEPRESULTS);
+    const size_t stepsCount = json_object_get_count(stepResultsObject);
+
+    // Excluding the terminating null character.
+    const size_t reportBytes = json_serialization_size(reportValue) - 1;
+    if (reportBytes <= budgetBytes)
+    {
+        return true;
+    }
+
+    Log_Warn("The report is %zu bytes, over the budget of %zu bytes; summarizing it", reportBytes, budgetBytes);
+
+    // First, the details of the successful steps, which are the least useful.
+    for (size_t i = 0; i < stepsCount; i++)
+    {
+        JSON_Object* stepObject = json_value_get_object(json_object_get_value_at(stepResultsObject, i));
+        if (stepObject != NULL
+            && IsAducResultCodeSuccess((ADUC_Result_t)json_object_get_number(stepObject, ADUCITF_FIELDNAME_RESULTCODE)))
+        {
+            SpillResultDetails(stepObject, json_object_get_name(stepResultsObject, i));
+        }
+    }
+
+    if (json_serialization_size(reportValue) - 1 <= budgetBytes)
+    {
+        return true;
+    }
+
+    // Then, the details of the failures, which are truncated rather than dropped.
+    TruncateResultDetails(lastInstallResultObject, ADUCITF_FIELDNAME_LASTINSTALLRESULT);
+    for (size_t i = 0; i < stepsCount; i++)
+    {
+        JSON_Object* stepObject = json_value_get_object(json_object_get_value_at(stepResultsObject, i));
+        if (stepObject != NULL)
+        {
+            TruncateResultDetails(stepObject, json_object_get_name(stepResultsObject, i));
+        }
+    }
+
+    if (json_serialization_size(reportValue) - 1 <= budgetBytes)
+    {
+        return true;
+    }
+
+    // Last, the successful steps themselves; lastInstallResult tells whether they all succeeded.
+    size_t omittedCount = 0;
+    for (size_t i = 0; i < stepsCount; i++)
+    {
+        JSON_Object* stepObject = json_value_get_object(json_object_get_value_at(stepResultsObject, i));
+        if (stepObject != NULL
+            && IsAducResultCodeSuccess((ADUC_Result_t)json_object_get_number(stepObject, ADUCITF_FIELDNAME_RESULTCODE)))
+        {
+            json_object_set_null(stepResultsObject, json_object_get_name(stepResultsObject, i));
+            omittedCount++;
+        }
+    }
+
+    if (omittedCount != 0)
+    {
+        Log_Info("Not reporting the results of %zu successful steps", omittedCount);
+    }
+
+    const size_t summarizedBytes = json_serialization_size(reportValue) - 1;
+    if (summarizedBytes > budgetBytes)
+    {
+        Log_Warn(
+            "The summarized report is still %zu bytes, over the budget of %zu bytes", summarizedBytes, budgetBytes);
+        return false;
+    }
+
+    return true;
+}
+
 /**
  * @brief Report state, and optionally result to service.
  *
@@ -794,7 +1694,7 @@ _Bool AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
     JSON_Value* rootValue = NULL;
     char* jsonString = NULL;
 
-    if (g_iotHubClientHandleForADUComponent == NULL)
+    if (GetClientHandle(workflowData) == NULL)
     {
         Log_Error("ReportStateAsync called before registration! Can't report!");
         return false;
@@ -819,6 +1719,9 @@ _Bool AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
         goto done;
     }
 
+    // Sent anyway when over the budget, as IoT Hub may still accept it.
+    (void)AzureDeviceUpdateCoreInterface_FitReportToBudget(rootValue, ADUC_REPORTING_BUDGET_BYTES);
+
     jsonString = json_serialize_to_string(rootValue);
     if (jsonString == NULL)
     {
@@ -826,7 +1729,11 @@ _Bool AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
         goto done;
     }
 
-    if (!ReportClientJsonProperty(jsonString, workflowData))
+    // Only terminal states need to be sent right away; the others may be merged with the following reports.
+    if (!QueueClientJsonProperty(
+            jsonString,
+            workflowData,
+            updateState == ADUCITF_State_Idle || updateState == ADUCITF_State_Failed /* urgent */))
     {
         goto done;
     }
@@ -40,11 +40,11 @@ _Bool DeviceProperties_AddManufacturerAndModel(JSON_Object* devicePropsObj)
     char* manufacturer = NULL;
     char* model = NULL;
 
-    ADUC_ConfigInfo config = {};
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
 
-    if (ADUC_ConfigInfo_Init(&config, ADUC_CONF_FILE_PATH))
+    if (config != NULL)
     {
-        const ADUC_AgentInfo* agent = ADUC_ConfigInfo_GetAgent(&config, 0);
+        const ADUC_AgentInfo* agent = ADUC_ConfigInfo_GetAgent(config, 0);
         if (agent != NULL && agent->manufacturer != NULL && agent->model != NULL)
         {
             configExisted = true;
@@ -99,7 +99,7 @@ done:
     {
         Log_Error("Failed to get manufacturer and model device properties");
     }
-    ADUC_ConfigInfo_UnInit(&config);
+    ADUC_ConfigInfo_ReleaseInstance(config);
     return success;
 }
 
@@ -94,9 +94,9 @@ _Bool StartupMsg_AddCompatPropertyNames(JSON_Object* startupObj)
 
     _Bool success = false;
 
-    ADUC_ConfigInfo config = {};
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
 
-    if (!ADUC_ConfigInfo_Init(&config, ADUC_CONF_FILE_PATH))
+    if (config == NULL)
     {
         Log_Warn("Could not initialize config at: %s", ADUC_CONF_FILE_PATH);
     }
@@ -104,9 +104,9 @@ _Bool StartupMsg_AddCompatPropertyNames(JSON_Object* startupObj)
     JSON_Status jsonStatus = json_object_set_string(
         startupObj,
         ADUCITF_FIELDNAME_COMPAT_PROPERTY_NAMES,
-        IsNullOrEmpty(config.compatPropertyNames)
+        (config == NULL || IsNullOrEmpty(config->compatPropertyNames))
             ? DEFAULT_COMPAT_PROPERTY_NAMES_VALUE
-            : config.compatPropertyNames);
+            : config->compatPropertyNames);
 
     if (jsonStatus != JSONSuccess)
     {
@@ -118,7 +118,7 @@ _Bool StartupMsg_AddCompatPropertyNames(JSON_Object* startupObj)
 
 done:
 
-    ADUC_ConfigInfo_UnInit(&config);
+    ADUC_ConfigInfo_ReleaseInstance(config);
 
     return success;
 }
@@ -8,8 +8,10 @@
 #include <catch2/catch.hpp>
 
 #include <algorithm>
+#include <chrono>
 #include <sstream>
 #include <stdlib.h>
+#include <thread>
 
 #include "aduc/adu_core_export_helpers.h"
 #include "aduc/adu_core_exports.h"
@@ -272,6 +274,10 @@ TEST_CASE_METHOD(TestCaseFixture, "AzureDeviceUpdateCoreInterface_ReportStateAnd
         REQUIRE(AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
             &workflowData, updateState, &result, nullptr /* installedUpdateId */));
 
+        // Not a terminal state, so it waits for more reports to be merged with.
+        CHECK(g_SendReportedStateValues.reportedStates.empty());
+        AzureDeviceUpdateCoreInterface_FlushReports(&workflowData);
+
         CHECK(g_SendReportedStateValues.deviceHandle != nullptr);
         std::stringstream strm;
 
@@ -424,3 +430,220 @@ TEST_CASE_METHOD(TestCaseFixture, "AzureDeviceUpdateCoreInterface_ReportContentI
 
     ADUC_UpdateId_UninitAndFree(updateId);
 }
+
+TEST_CASE_METHOD(TestCaseFixture, "AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync merges reports")
+{
+    g_SendReportedStateValues.reportedStates.clear();
+
+    ADUC_WorkflowData workflowData{};
+    workflowData.CurrentAction = ADUCITF_UpdateAction_ProcessDeployment;
+
+    ADUC_WorkflowHandle bundle = nullptr;
+    ADUC_Result result = workflow_init(action_bundle_cancel, false, &bundle);
+    workflowData.WorkflowHandle = bundle;
+    CHECK(result.ResultCode != 0);
+
+    ADUC_TestOverride_Hooks testHooks = {};
+    testHooks.ClientHandle_SendReportedStateFunc_TestOverride = (void*)mockClientHandle_SendReportedState; // NOLINT
+    workflowData.TestOverrides = &testHooks;
+
+    result = { ADUC_Result_DeploymentInProgress_Success, 0 };
+    REQUIRE(AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
+        &workflowData, ADUCITF_State_DeploymentInProgress, &result, nullptr /* installedUpdateId */));
+    CHECK(g_SendReportedStateValues.reportedStates.empty());
+
+    // A terminal state is sent right away, along with the pending report.
+    result = { ADUC_Result_Failure, ADUC_ERC_NOTPERMITTED };
+    REQUIRE(AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
+        &workflowData, ADUCITF_State_Failed, &result, nullptr /* installedUpdateId */));
+
+    REQUIRE(g_SendReportedStateValues.reportedStates.size() == 1);
+    const std::string& reported = g_SendReportedStateValues.reportedStates[0];
+    CHECK(reported.find(R"("state":255)") != std::string::npos);
+    CHECK(reported.find(R"("state":6)") == std::string::npos);
+    CHECK(
+        reported.find(R"("extendedResultCode":)" + std::to_string(ADUC_ERC_NOTPERMITTED)) != std::string::npos);
+
+    workflow_free(bundle);
+}
+
+TEST_CASE_METHOD(TestCaseFixture, "AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync sends changes only")
+{
+    g_SendReportedStateValues.reportedStates.clear();
+
+    ADUC_WorkflowData workflowData{};
+    workflowData.CurrentAction = ADUCITF_UpdateAction_ProcessDeployment;
+
+    ADUC_WorkflowHandle bundle = nullptr;
+    ADUC_Result result = workflow_init(action_bundle_cancel, false, &bundle);
+    workflowData.WorkflowHandle = bundle;
+    CHECK(result.ResultCode != 0);
+
+    ADUC_TestOverride_Hooks testHooks = {};
+    testHooks.ClientHandle_SendReportedStateFunc_TestOverride = (void*)mockClientHandle_SendReportedState; // NOLINT
+    workflowData.TestOverrides = &testHooks;
+
+    result = { ADUC_Result_Failure, 0x1234 };
+    REQUIRE(AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
+        &workflowData, ADUCITF_State_Failed, &result, nullptr /* installedUpdateId */));
+    REQUIRE(g_SendReportedStateValues.reportedStates.size() == 1);
+
+    // Acknowledge this report, and any left over by the previous tests (more than the queue keeps).
+    REQUIRE(g_SendReportedStateValues.reportedStateCallback != nullptr);
+    for (int i = 0; i < 16; i++)
+    {
+        g_SendReportedStateValues.reportedStateCallback(204, nullptr);
+    }
+
+    // Nothing changed, nothing is sent.
+    REQUIRE(AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
+        &workflowData, ADUCITF_State_Failed, &result, nullptr /* installedUpdateId */));
+    CHECK(g_SendReportedStateValues.reportedStates.size() == 1);
+
+    result = { ADUC_Result_Failure, 0x5678 };
+    REQUIRE(AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
+        &workflowData, ADUCITF_State_Failed, &result, nullptr /* installedUpdateId */));
+    REQUIRE(g_SendReportedStateValues.reportedStates.size() == 2);
+
+    // clang-format off
+    std::stringstream strm;
+    strm << R"({)"
+            << R"("deviceUpdate":{)"
+                << R"("__t":"c",)"
+                << R"("agent":{)"
+                    << R"("lastInstallResult":{)"
+                        << R"("extendedResultCode":)" << 0x5678
+                    << R"(})"
+                << R"(})"
+            << R"(})"
+         << R"(})";
+    // clang-format on
+    CHECK(g_SendReportedStateValues.reportedStates[1] == strm.str());
+
+    workflow_free(bundle);
+}
+
+TEST_CASE_METHOD(TestCaseFixture, "AzureDeviceUpdateCoreInterface_SetConnected")
+{
+    g_SendReportedStateValues.reportedStates.clear();
+
+    ADUC_WorkflowData workflowData{};
+    workflowData.CurrentAction = ADUCITF_UpdateAction_ProcessDeployment;
+
+    ADUC_WorkflowHandle bundle = nullptr;
+    ADUC_Result result = workflow_init(action_bundle_cancel, false, &bundle);
+    workflowData.WorkflowHandle = bundle;
+    CHECK(result.ResultCode != 0);
+
+    ADUC_TestOverride_Hooks testHooks = {};
+    testHooks.ClientHandle_SendReportedStateFunc_TestOverride = (void*)mockClientHandle_SendReportedState; // NOLINT
+    workflowData.TestOverrides = &testHooks;
+
+    AzureDeviceUpdateCoreInterface_SetConnected(&workflowData, false);
+
+    // While disconnected, even terminal states are kept, and nothing is due.
+    result = { ADUC_Result_Failure, 0x1111 };
+    REQUIRE(AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
+        &workflowData, ADUCITF_State_Failed, &result, nullptr /* installedUpdateId */));
+    result = { ADUC_Result_Failure, 0x2222 };
+    REQUIRE(AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
+        &workflowData, ADUCITF_State_Failed, &result, nullptr /* installedUpdateId */));
+    AzureDeviceUpdateCoreInterface_FlushReports(&workflowData);
+    CHECK(g_SendReportedStateValues.reportedStates.empty());
+
+    // Once reconnected, the latest state is sent in one report, within the first reconnect back off.
+    AzureDeviceUpdateCoreInterface_SetConnected(&workflowData, true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    AzureDeviceUpdateCoreInterface_FlushReports(&workflowData);
+
+    REQUIRE(g_SendReportedStateValues.reportedStates.size() == 1);
+    const std::string& reported = g_SendReportedStateValues.reportedStates[0];
+    CHECK(reported.find(R"("extendedResultCode":)" + std::to_string(0x2222)) != std::string::npos);
+    CHECK(reported.find(R"("extendedResultCode":)" + std::to_string(0x1111)) == std::string::npos);
+
+    workflow_free(bundle);
+}
+
+TEST_CASE_METHOD(TestCaseFixture, "AzureDeviceUpdateCoreInterface_GetDoWorkDelay")
+{
+    g_SendReportedStateValues.reportedStates.clear();
+
+    ADUC_WorkflowData workflowData{};
+    workflowData.CurrentAction = ADUCITF_UpdateAction_ProcessDeployment;
+
+    ADUC_WorkflowHandle bundle = nullptr;
+    ADUC_Result result = workflow_init(action_bundle_cancel, false, &bundle);
+    workflowData.WorkflowHandle = bundle;
+    CHECK(result.ResultCode != 0);
+
+    ADUC_TestOverride_Hooks testHooks = {};
+    testHooks.ClientHandle_SendReportedStateFunc_TestOverride = (void*)mockClientHandle_SendReportedState; // NOLINT
+    workflowData.TestOverrides = &testHooks;
+
+    // The warm start is due right away.
+    CHECK(AzureDeviceUpdateCoreInterface_GetDoWorkDelay(&workflowData) == 0);
+
+    workflowData.WarmStartAttempted = true;
+
+    // A debounced report is due within the debounce delay.
+    result = { ADUC_Result_DeploymentInProgress_Success, 0 };
+    REQUIRE(AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
+        &workflowData, ADUCITF_State_DeploymentInProgress, &result, nullptr /* installedUpdateId */));
+    CHECK(AzureDeviceUpdateCoreInterface_GetDoWorkDelay(&workflowData) <= 500);
+
+    // Once sent, nothing is due for a while.
+    result = { ADUC_Result_Failure, ADUC_ERC_NOTPERMITTED };
+    REQUIRE(AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
+        &workflowData, ADUCITF_State_Failed, &result, nullptr /* installedUpdateId */));
+    CHECK(AzureDeviceUpdateCoreInterface_GetDoWorkDelay(&workflowData) > 500);
+
+    workflow_free(bundle);
+}
+
+TEST_CASE("AzureDeviceUpdateCoreInterface_FitReportToBudget")
+{
+    const std::string longDetails(1000, 'x');
+
+    std::stringstream strm;
+    strm << R"({"state":255,"lastInstallResult":{"resultCode":0,"extendedResultCode":1,"resultDetails":")"
+         << longDetails << R"(","stepResults":{)";
+    for (int i = 0; i < 8; i++)
+    {
+        strm << R"("step_)" << i << R"(":{"resultCode":)" << (i == 3 ? 0 : ADUC_Result_Apply_Success)
+             << R"(,"extendedResultCode":0,"resultDetails":")" << longDetails << R"("},)";
+    }
+    strm << R"("step_8":{"resultCode":700,"extendedResultCode":0,"resultDetails":null}}}})";
+
+    JSON_Value* reportValue = json_parse_string(strm.str().c_str());
+    REQUIRE(reportValue != nullptr);
+    JSON_Object* stepResults = json_object_get_object(json_value_get_object(reportValue), "lastInstallResult");
+    stepResults = json_object_get_object(stepResults, "stepResults");
+
+    SECTION("A report within the budget is unchanged")
+    {
+        CHECK(AzureDeviceUpdateCoreInterface_FitReportToBudget(reportValue, 64 * 1024));
+        CHECK(json_object_dotget_string(stepResults, "step_0.resultDetails") != nullptr);
+    }
+
+    SECTION("The details of successful steps go first")
+    {
+        CHECK(AzureDeviceUpdateCoreInterface_FitReportToBudget(reportValue, 4096));
+        CHECK(json_object_dotget_string(stepResults, "step_0.resultDetails") == nullptr);
+        CHECK(json_object_dotget_string(stepResults, "step_3.resultDetails") == longDetails);
+    }
+
+    SECTION("Then the details of failures are truncated, then successful steps are dropped")
+    {
+        CHECK(AzureDeviceUpdateCoreInterface_FitReportToBudget(reportValue, 1000));
+        CHECK(json_object_get_object(stepResults, "step_0") == nullptr);
+        CHECK(json_object_get_object(stepResults, "step_3") != nullptr);
+        CHECK(strlen(json_object_dotget_string(stepResults, "step_3.resultDetails")) < longDetails.size());
+    }
+
+    SECTION("A report that can't fit is reported as such")
+    {
+        CHECK_FALSE(AzureDeviceUpdateCoreInterface_FitReportToBudget(reportValue, 16));
+    }
+
+    json_value_free(reportValue);
+}
@@ -179,11 +179,8 @@ extern "C"
                 {
                     auto wf = (ADUC_Workflow*)workflowData->WorkflowHandle; // NOLINT
                     char* propertiesJson = json_serialize_to_string_pretty(json_object_get_wrapping_value(wf->PropertiesObject));
-                    CHECK_THAT(propertiesJson, Equals(
-                        "{\n"
-                        "    \"_workFolder\": \"\\/var\\/lib\\/adu\\/downloads\\/action_bundle\"\n"
-                        "}"
-                    ));
+                    CHECK_THAT(propertiesJson, Equals("{}"));
+                    CHECK_THAT(wf->WorkFolder, Equals("/var/lib/adu/downloads/action_bundle"));
                 }
                 REQUIRE(ADUC_WorkflowData_GetLastReportedState(workflowData) == ADUCITF_State_Idle);
                 REQUIRE(ADUC_WorkflowData_GetCurrentAction(workflowData) == ADUCITF_UpdateAction_ProcessDeployment);
@@ -203,11 +200,8 @@ extern "C"
                 {
                     auto wf = static_cast<ADUC_Workflow*>(workflowData->WorkflowHandle);
                     char* propertiesJson = json_serialize_to_string_pretty(json_object_get_wrapping_value(wf->PropertiesObject));
-                    CHECK_THAT(propertiesJson, Equals(
-                        "{\n"
-                        "    \"_workFolder\": \"\\/var\\/lib\\/adu\\/downloads\\/action_bundle\"\n"
-                        "}"
-                    ));
+                    CHECK_THAT(propertiesJson, Equals("{}"));
+                    CHECK_THAT(wf->WorkFolder, Equals("/var/lib/adu/downloads/action_bundle"));
                 }
                 REQUIRE(ADUC_WorkflowData_GetLastReportedState(workflowData) == ADUCITF_State_DownloadStarted);
                 REQUIRE(ADUC_WorkflowData_GetCurrentAction(workflowData) == ADUCITF_UpdateAction_ProcessDeployment);
@@ -43,6 +43,21 @@ _Bool DeviceInfoInterface_Create(void** componentContext, int argc, char** argv)
  */
 void DeviceInfoInterface_Connected(void* componentContext);
 
+/**
+ * @brief Reports the DeviceInfo properties once they were collected after Connected.
+ *
+ * @param componentContext Context object from Create.
+ */
+void DeviceInfoInterface_DoWork(void* componentContext);
+
+/**
+ * @brief Gets the delay until DoWork is next due.
+ *
+ * @param componentContext Context object from Create.
+ * @return unsigned int ADUC_EVENT_LOOP_ON_DEMAND, as DoWork only has work after the main loop was woken up.
+ */
+unsigned int DeviceInfoInterface_GetDoWorkDelay(void* componentContext);
+
 /**
  * @brief Uninitialize the interface.
  *
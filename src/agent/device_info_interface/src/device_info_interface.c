@@ -9,10 +9,12 @@
 #include "aduc/c_utils.h"
 #include "aduc/client_handle_helper.h"
 #include "aduc/device_info_exports.h"
+#include "aduc/event_loop_utils.h"
 #include "aduc/logging.h"
 #include "aduc/string_c_utils.h" // atoint64t
 #include "pnp_protocol.h"
 #include <ctype.h> // isalnum
+#include <pthread.h>
 #include <stdlib.h>
 
 // Name of the DeviceInformation component that this device implements.
@@ -48,7 +50,8 @@ typedef struct tagDeviceInfoInterfaceData
 
     // Values computed at runtime:
     char* Value; /**< Value of property, or NULL if not yet determined. */
-    _Bool IsDirty; /**< Specifies if Value has changed since last sent to service. */
+    _Bool IsDirty; /**< Specifies if Value has changed since the service last acknowledged it. */
+    unsigned int Generation; /**< Incremented each time Value changes. */
 } DeviceInfoInterface_Data;
 
 // The names in this struct must match the property names defined in "urn:azureiot:DeviceManagement:DeviceInformation:1".
@@ -63,6 +66,36 @@ static DeviceInfoInterface_Data deviceInfoInterface_Data[] = {
     { DIIP_TotalStorage, "totalStorage", DIIDT_Long },
 };
 
+/**
+ * @brief State of the collection of the DeviceInfo properties, which runs on a background thread
+ * so that connecting doesn't wait for it.
+ */
+typedef struct tagDeviceInfoCollection
+{
+    pthread_mutex_t Mutex; /**< Protects the other members. */
+    pthread_t Thread; /**< The collection thread, valid when Started is true. */
+    _Bool Started; /**< Specifies if the collection thread was started and not yet joined. */
+    _Bool Done; /**< Specifies if the collection thread finished and its properties are to be reported. */
+} DeviceInfoCollection;
+
+static DeviceInfoCollection s_collection = { .Mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief Protects the IsDirty and Generation members of deviceInfoInterface_Data, which the reported state callback
+ * updates once the service acknowledges a report.
+ */
+static pthread_mutex_t s_dirtyMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief The properties of a report in flight, the context of DeviceInfoReportedStateCallback.
+ */
+typedef struct tagDeviceInfoReport
+{
+    _Bool Reported[ARRAY_SIZE(deviceInfoInterface_Data)]; /**< Specifies if the property is in the report. */
+    unsigned int Generations[ARRAY_SIZE(deviceInfoInterface_Data)]; /**< Generation of each reported Value. */
+    unsigned int ReportedCount; /**< Number of properties in the report. */
+} DeviceInfoReport;
+
 /**
  * @brief Free the members in the device info interface struct.
  */
@@ -75,7 +108,9 @@ void DeviceInfoInterfaceData_Free()
         free(data->Value);
         data->Value = NULL;
 
+        pthread_mutex_lock(&s_dirtyMutex);
         data->IsDirty = false;
+        pthread_mutex_unlock(&s_dirtyMutex);
     }
 }
 
@@ -125,12 +160,57 @@ static void RefreshDeviceInfoInterfaceData()
         ApplyDeviceInfoPropertyConstraints(value);
         free(data->Value);
         data->Value = value;
+
+        pthread_mutex_lock(&s_dirtyMutex);
         data->IsDirty = true;
+        ++data->Generation;
+        pthread_mutex_unlock(&s_dirtyMutex);
 
         Log_Info("Property %s changed to %s", data->PropertyName, data->Value);
     }
 }
 
+static IOTHUB_CLIENT_RESULT ReportDeviceInfoInterfaceData();
+
+/**
+ * @brief Collects the DeviceInfo properties; the body of the collection thread.
+ * @details Until Done is set, deviceInfoInterface_Data belongs to this thread.
+ *
+ * @param arg Unused.
+ * @return void* NULL.
+ */
+static void* CollectDeviceInfoInterfaceData(void* arg)
+{
+    UNREFERENCED_PARAMETER(arg);
+
+    RefreshDeviceInfoInterfaceData();
+
+    pthread_mutex_lock(&s_collection.Mutex);
+    s_collection.Done = true;
+    pthread_mutex_unlock(&s_collection.Mutex);
+
+    // DoWork only runs on demand.
+    ADUC_EventLoop_Wakeup();
+
+    return NULL;
+}
+
+/**
+ * @brief Joins the collection thread, if it was started.
+ */
+static void JoinDeviceInfoCollection()
+{
+    pthread_mutex_lock(&s_collection.Mutex);
+    const _Bool started = s_collection.Started;
+    s_collection.Started = false;
+    pthread_mutex_unlock(&s_collection.Mutex);
+
+    if (started)
+    {
+        pthread_join(s_collection.Thread, NULL);
+    }
+}
+
 //
 // DeviceInfoInterface methods
 //
@@ -162,89 +242,151 @@ void DeviceInfoInterface_Connected(void* componentContext)
 {
     UNREFERENCED_PARAMETER(componentContext);
 
-    Log_Info("DeviceInformation component is ready - reporting properties");
+    Log_Info("DeviceInformation component is ready - collecting properties");
 
     //
     // After DeviceInfoInterface is registered, report current DeviceInfo properties, e.g. software version.
+    // They are collected on a background thread, and reported by DoWork once collected.
     //
 
-    IOTHUB_CLIENT_RESULT reportResult = DeviceInfoInterface_ReportChangedPropertiesAsync();
+    pthread_mutex_lock(&s_collection.Mutex);
+    if (!s_collection.Started)
+    {
+        s_collection.Done = false;
+        s_collection.Started = pthread_create(&s_collection.Thread, NULL, CollectDeviceInfoInterfaceData, NULL) == 0;
+    }
+    const _Bool started = s_collection.Started;
+    pthread_mutex_unlock(&s_collection.Mutex);
+
+    if (!started)
+    {
+        Log_Warn("Cannot start DeviceInfo collection thread, collecting properties now");
+
+        IOTHUB_CLIENT_RESULT reportResult = DeviceInfoInterface_ReportChangedPropertiesAsync();
+        if (reportResult != IOTHUB_CLIENT_OK)
+        {
+            Log_Warn("DeviceInfoInterface_ReportChangedPropertiesAsync() failed, %u", reportResult);
+        }
+    }
+}
+
+/**
+ * @brief Reports the DeviceInfo properties once the collection thread started by Connected finished.
+ *
+ * @param componentContext Context object from Create.
+ */
+void DeviceInfoInterface_DoWork(void* componentContext)
+{
+    UNREFERENCED_PARAMETER(componentContext);
+
+    pthread_mutex_lock(&s_collection.Mutex);
+    const _Bool done = s_collection.Done;
+    s_collection.Done = false;
+    pthread_mutex_unlock(&s_collection.Mutex);
+
+    if (!done)
+    {
+        return;
+    }
+
+    JoinDeviceInfoCollection();
+
+    // The client handle isn't thread safe, so the properties are sent from here rather than from the collection thread.
+    IOTHUB_CLIENT_RESULT reportResult = ReportDeviceInfoInterfaceData();
     if (reportResult != IOTHUB_CLIENT_OK)
     {
-        Log_Warn("DeviceInfoInterface_ReportChangedPropertiesAsync() failed, %u", reportResult);
+        Log_Warn("ReportDeviceInfoInterfaceData() failed, %u", reportResult);
     }
 }
 
+/**
+ * @brief Gets the delay until DoWork is due; DoWork only has work once the collection thread woke up the main loop.
+ *
+ * @param componentContext Context object from Create.
+ * @return unsigned int ADUC_EVENT_LOOP_ON_DEMAND.
+ */
+unsigned int DeviceInfoInterface_GetDoWorkDelay(void* componentContext)
+{
+    UNREFERENCED_PARAMETER(componentContext);
+
+    return ADUC_EVENT_LOOP_ON_DEMAND;
+}
+
 void DeviceInfoInterface_Destroy(void** componentContext)
 {
     UNREFERENCED_PARAMETER(componentContext);
 
     // context isn't used, as we reference the global deviceInfoInterface_Data.
+    JoinDeviceInfoCollection();
     DeviceInfoInterfaceData_Free();
 }
 
-IOTHUB_CLIENT_RESULT ReportChangedProperty(DeviceInfoInterface_Data* data)
+IOTHUB_CLIENT_RESULT DeviceInfoInterface_ReportChangedPropertiesAsync()
 {
-    ADUC_ClientHandle deviceClientLL = g_iotHubClientHandleForDeviceInfoComponent;
-    IOTHUB_CLIENT_RESULT iothubClientResult = IOTHUB_CLIENT_OK;
-    STRING_HANDLE jsonToSend = NULL;
-
-    if (!data->IsDirty)
-    {
-        goto done;
-    }
-
-    const char* propertyName = data->PropertyName;
-    const char* propertyValue = data->Value;
+    RefreshDeviceInfoInterfaceData();
 
-    Log_Info("Reporting changed property: %s, value: %s", propertyName, propertyValue);
+    return ReportDeviceInfoInterfaceData();
+}
 
-    jsonToSend = PnP_CreateReportedProperty(g_deviceInfoPnPComponentName, propertyName, propertyValue);
+/**
+ * @brief Called once the service processed a DeviceInfo report; marks its properties clean if it was accepted.
+ *
+ * @param statusCode The status code of the report.
+ * @param context The DeviceInfoReport of the report. This function frees it.
+ */
+static void DeviceInfoReportedStateCallback(int statusCode, void* context)
+{
+    DeviceInfoReport* report = (DeviceInfoReport*)context;
 
-    if (jsonToSend == NULL)
+    if (statusCode < 200 || statusCode >= 300)
     {
-        Log_Error(
-            "Unable to build reported property response for propertyName=%s, propertyValue=%s",
-            propertyName,
-            propertyValue);
-        iothubClientResult = IOTHUB_CLIENT_ERROR;
-        goto done;
+        // Left dirty, so that they are reported on the next connect.
+        Log_Error("DeviceInfoInterface: Report of %u properties failed, %d", report->ReportedCount, statusCode);
+        free(report);
+        return;
     }
 
-    const char* jsonToSendStr = STRING_c_str(jsonToSend);
-    size_t jsonToSendStrLen = strlen(jsonToSendStr);
-
-    iothubClientResult = ClientHandle_SendReportedState(
-        deviceClientLL, (const unsigned char*)jsonToSendStr, jsonToSendStrLen, NULL, NULL);
+    pthread_mutex_lock(&s_dirtyMutex);
 
-    if (iothubClientResult != IOTHUB_CLIENT_OK)
+    // A property that changed since it was reported stays dirty, for its new value.
+    for (unsigned index = 0; index < ARRAY_SIZE(deviceInfoInterface_Data); ++index)
     {
-        Log_Error(
-            "DeviceInfoInterface: Reporting property %s failed, error: %d, %s",
-            propertyName,
-            iothubClientResult,
-            MU_ENUM_TO_STRING(IOTHUB_CLIENT_RESULT, iothubClientResult));
-        goto done;
+        if (report->Reported[index] && deviceInfoInterface_Data[index].Generation == report->Generations[index])
+        {
+            deviceInfoInterface_Data[index].IsDirty = false;
+        }
     }
 
-done:
-    STRING_delete(jsonToSend);
+    pthread_mutex_unlock(&s_dirtyMutex);
 
-    return iothubClientResult;
+    Log_Info("DeviceInfoInterface: Reported %u changed properties.", report->ReportedCount);
+    free(report);
 }
 
-IOTHUB_CLIENT_RESULT DeviceInfoInterface_ReportChangedPropertiesAsync()
+/**
+ * @brief Report the DeviceInfo properties that changed since they were last reported up to server, all in one patch.
+ * They are marked clean once the service acknowledges the report, see DeviceInfoReportedStateCallback.
+ *
+ * @return IOTHUB_CLIENT_RESULT Result code. IOTHUB_CLIENT_OK without sending anything if none changed.
+ */
+static IOTHUB_CLIENT_RESULT ReportDeviceInfoInterfaceData()
 {
     IOTHUB_CLIENT_RESULT iothubClientResult = IOTHUB_CLIENT_OK;
-    RefreshDeviceInfoInterfaceData();
 
     STRING_HANDLE jsonToSend = NULL;
     char* serialized_string = NULL;
     JSON_Value* root_value = json_value_init_object();
     JSON_Object* root_object = json_value_get_object(root_value);
+    DeviceInfoReport* report = calloc(1, sizeof(*report));
 
     const char pnpReportedPropertyFormat[] = "{\"%s\":%s}";
 
+    if (report == NULL)
+    {
+        iothubClientResult = IOTHUB_CLIENT_ERROR;
+        goto done;
+    }
+
     json_object_set_string(root_object, "__t", "c");
 
     for (unsigned index = 0; index < ARRAY_SIZE(deviceInfoInterface_Data); ++index)
@@ -254,6 +396,17 @@ IOTHUB_CLIENT_RESULT DeviceInfoInterface_ReportChangedPropertiesAsync()
         const char* propertyName = data->PropertyName;
         const char* propertyValue = data->Value;
 
+        pthread_mutex_lock(&s_dirtyMutex);
+        const _Bool isDirty = data->IsDirty;
+        const unsigned int generation = data->Generation;
+        pthread_mutex_unlock(&s_dirtyMutex);
+
+        // The twin keeps the properties reported before, e.g. before a reconnect.
+        if (!isDirty || propertyValue == NULL)
+        {
+            continue;
+        }
+
         if (data->Type == DIIDT_String)
         {
             json_object_set_string(root_object, propertyName, propertyValue);
@@ -263,12 +416,21 @@ IOTHUB_CLIENT_RESULT DeviceInfoInterface_ReportChangedPropertiesAsync()
             unsigned long val = 0;
             if (!atoul(propertyValue, &val))
             {
-                Log_Error("Cannot convert property value to number. Value: %s", propertyValue);
-                iothubClientResult = IOTHUB_CLIENT_ERROR;
-                goto done;
+                Log_Error("Cannot convert property %s value to number. Value: %s", propertyName, propertyValue);
+                continue;
             }
             json_object_set_number(root_object, propertyName, val);
         }
+
+        report->Reported[index] = true;
+        report->Generations[index] = generation;
+        ++report->ReportedCount;
+    }
+
+    if (report->ReportedCount == 0)
+    {
+        Log_Debug("DeviceInfoInterface: No changed properties to report.");
+        goto done;
     }
 
     serialized_string = json_serialize_to_string(root_value);
@@ -286,7 +448,11 @@ IOTHUB_CLIENT_RESULT DeviceInfoInterface_ReportChangedPropertiesAsync()
     size_t jsonToSendStrLen = strlen(jsonToSendStr);
 
     iothubClientResult = ClientHandle_SendReportedState(
-        g_iotHubClientHandleForDeviceInfoComponent, (const unsigned char*)jsonToSendStr, jsonToSendStrLen, NULL, NULL);
+        g_iotHubClientHandleForDeviceInfoComponent,
+        (const unsigned char*)jsonToSendStr,
+        jsonToSendStrLen,
+        DeviceInfoReportedStateCallback,
+        report);
 
     if (iothubClientResult != IOTHUB_CLIENT_OK)
     {
@@ -294,9 +460,14 @@ IOTHUB_CLIENT_RESULT DeviceInfoInterface_ReportChangedPropertiesAsync()
             "DeviceInfoInterface: Report property failed, error: %d, %s",
             iothubClientResult,
             MU_ENUM_TO_STRING(IOTHUB_CLIENT_RESULT, iothubClientResult));
+        goto done;
     }
 
+    // Owned by DeviceInfoReportedStateCallback from now on.
+    report = NULL;
+
 done:
+    free(report);
     json_value_free(root_value);
     json_free_serialized_string(serialized_string);
     STRING_delete(jsonToSend);
@@ -67,6 +67,48 @@ STRING_HANDLE PnP_CreateReportedPropertyWithStatus(
     const char* description,
     int ackVersion);
 
+//
+// PnP_ReportedPropertyWriter is a growable buffer that PnP_ReportedPropertyWriter_Write and
+// PnP_ReportedPropertyWriter_WriteWithStatus write a reported property into, as PnP_CreateReportedProperty and
+// PnP_CreateReportedPropertyWithStatus would return it.  Each write replaces the previous one and reuses the buffer,
+// so an application that reports often does not allocate once the buffer has grown to fit its reports.
+// A zero-initialized writer is empty; a writer is not thread safe.
+//
+typedef struct tagPnP_ReportedPropertyWriter
+{
+    char* Buffer; // The NULL terminated JSON written last, NULL if none.
+    size_t Length; // The length of the JSON, excluding the NULL terminator.
+    size_t Capacity; // The allocated size of Buffer.
+} PnP_ReportedPropertyWriter;
+
+//
+// PnP_ReportedPropertyWriter_Write writes the JSON of PnP_CreateReportedProperty into writer.
+// Returns false if out of memory, in which case the writer is left empty.
+//
+bool PnP_ReportedPropertyWriter_Write(
+    PnP_ReportedPropertyWriter* writer,
+    const char* componentName,
+    const char* propertyName,
+    const char* propertyValue);
+
+//
+// PnP_ReportedPropertyWriter_WriteWithStatus writes the JSON of PnP_CreateReportedPropertyWithStatus into writer.
+// Returns false if out of memory, in which case the writer is left empty.
+//
+bool PnP_ReportedPropertyWriter_WriteWithStatus(
+    PnP_ReportedPropertyWriter* writer,
+    const char* componentName,
+    const char* propertyName,
+    const char* propertyValue,
+    int result,
+    const char* description,
+    int ackVersion);
+
+//
+// PnP_ReportedPropertyWriter_Uninit frees the buffer of writer, and leaves it empty.
+//
+void PnP_ReportedPropertyWriter_Uninit(PnP_ReportedPropertyWriter* writer);
+
 //
 // PnP_ParseCommandName is invoked by the application when an incoming device method arrives.  This function
 // parses the device method name into the targeted (optional) component and PnP specific command.  Note that
@@ -87,11 +129,31 @@ void PnP_ParseCommandName(
 //
 IOTHUB_MESSAGE_HANDLE PnP_CreateTelemetryMessageHandle(const char* componentName, const char* telemetryData);
 
+//
+// PnP_TwinDataCache remembers the desired $version and a digest of each property that PnP_ProcessTwinData visited,
+// so that twins and properties that did not change since they were processed are not visited again.
+// A cache is not thread safe; it must only be used by the device twin processing callback.
+//
+typedef struct tagPnP_TwinDataCache PnP_TwinDataCache;
+
+//
+// PnP_TwinDataCache_Create returns an empty PnP_TwinDataCache, or NULL if out of memory.
+//
+PnP_TwinDataCache* PnP_TwinDataCache_Create(void);
+
+//
+// PnP_TwinDataCache_Destroy frees a PnP_TwinDataCache created by PnP_TwinDataCache_Create.
+//
+void PnP_TwinDataCache_Destroy(PnP_TwinDataCache* cache);
+
 //
 // PnP_ProcessTwinData is invoked by the application when a device twin arrives to its device twin processing callback.
 // PnP_ProcessTwinData will visit the children of the desired portion of the twin and invoke the device's pnpPropertyCallback
 // function for each property that it visits.
 //
+// When the optional cache is specified, a twin whose desired $version was already processed is not visited, and
+// pnpPropertyCallback is only invoked for the properties whose value changed since they were last visited.
+//
 bool PnP_ProcessTwinData(
     DEVICE_TWIN_UPDATE_STATE updateState,
     const unsigned char* payload,
@@ -99,7 +161,8 @@ bool PnP_ProcessTwinData(
     const char** componentsInModel,
     size_t numComponentsInModel,
     PnP_PropertyCallbackFunction pnpPropertyCallback,
-    void* userContextCallback);
+    void* userContextCallback,
+    PnP_TwinDataCache* cache);
 
 //
 // PnP_CopyTwinPayloadToString takes the payload data, which arrives as a potentially non-NULL terminated string from the IoTHub SDK, and creates
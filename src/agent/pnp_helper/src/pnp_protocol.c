@@ -12,10 +12,16 @@
 // Header associated with this .c file
 #include "pnp_protocol.h"
 
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 // JSON parsing library
 #include "parson.h"
 
 // IoT core utility related header files
+#include "azure_c_shared_utility/crt_abstractions.h"
 #include "azure_c_shared_utility/strings.h"
 #include "azure_c_shared_utility/xlogging.h"
 
@@ -32,6 +38,12 @@ static const char g_propertyWithResponseSchemaWithComponent[] =
     "{\""
     "%s\":{\"__t\":\"c\",\"%s\":{\"value\":%s,\"ac\":%d,\"ad\":\"%s\",\"av\":%d}}}";
 
+// The initial capacity of the buffer of a PnP_ReportedPropertyWriter, which fits most reported properties.
+#define PNP_WRITER_INITIAL_CAPACITY 1024
+
+// Room for the JSON punctuation, metadata and numbers that a writer adds around the names and the value.
+#define PNP_WRITER_OVERHEAD 96
+
 // Character that separates a PnP component from the specific command on the component.
 static const char g_commandSeparator = '*';
 
@@ -48,6 +60,26 @@ static const char g_IoTHubTwinDesiredObjectName[] = "desired";
 // Telemetry message property used to indicate the message's component.
 static const char PnP_TelemetryComponentProperty[] = "$.sub";
 
+// Parameters of the 64-bit FNV-1a hash used to digest property values.
+#define PNP_DIGEST_OFFSET_BASIS 14695981039346656037ULL
+#define PNP_DIGEST_PRIME 1099511628211ULL
+
+// The digest of the last visited value of a property.
+typedef struct tagPnP_PropertyDigest
+{
+    char* componentName; // NULL for a property of the root component.
+    char* propertyName;
+    uint64_t digest;
+    struct tagPnP_PropertyDigest* next;
+} PnP_PropertyDigest;
+
+struct tagPnP_TwinDataCache
+{
+    bool hasVersion;
+    int version; // The last processed desired $version, when hasVersion is true.
+    PnP_PropertyDigest* properties;
+};
+
 STRING_HANDLE
 PnP_CreateReportedProperty(const char* componentName, const char* propertyName, const char* propertyValue)
 {
@@ -112,6 +144,154 @@ STRING_HANDLE PnP_CreateReportedPropertyWithStatus(
     return jsonToSend;
 }
 
+// Grows the buffer of the writer, if needed, to fit additional characters and the NULL terminator.
+static bool WriterReserve(PnP_ReportedPropertyWriter* writer, size_t additional)
+{
+    const size_t required = writer->Length + additional + 1;
+    if (required <= writer->Capacity)
+    {
+        return true;
+    }
+
+    size_t capacity = writer->Capacity != 0 ? writer->Capacity : PNP_WRITER_INITIAL_CAPACITY;
+    while (capacity < required)
+    {
+        capacity *= 2;
+    }
+
+    char* buffer = realloc(writer->Buffer, capacity);
+    if (buffer == NULL)
+    {
+        LogError("Unable to allocate JSON buffer");
+        return false;
+    }
+
+    writer->Buffer = buffer;
+    writer->Capacity = capacity;
+    return true;
+}
+
+static bool WriterAppend(PnP_ReportedPropertyWriter* writer, const char* text, size_t length)
+{
+    if (!WriterReserve(writer, length))
+    {
+        return false;
+    }
+
+    memcpy(writer->Buffer + writer->Length, text, length);
+    writer->Length += length;
+    writer->Buffer[writer->Length] = '\0';
+    return true;
+}
+
+static bool WriterAppendString(PnP_ReportedPropertyWriter* writer, const char* text)
+{
+    return WriterAppend(writer, text, strlen(text));
+}
+
+static bool WriterAppendInt(PnP_ReportedPropertyWriter* writer, int value)
+{
+    char digits[16];
+    const int length = snprintf(digits, sizeof(digits), "%d", value);
+    return length > 0 && WriterAppend(writer, digits, (size_t)length);
+}
+
+// Empties the writer, and writes the start of a reported property, up to its value.
+static bool WriterBegin(
+    PnP_ReportedPropertyWriter* writer,
+    const char* componentName,
+    const char* propertyName,
+    const char* propertyValue,
+    const char* description)
+{
+    writer->Length = 0;
+
+    // Grown once up front, rather than once per append.
+    size_t estimate = strlen(propertyName) + strlen(propertyValue) + PNP_WRITER_OVERHEAD;
+    if (componentName != NULL)
+    {
+        estimate += strlen(componentName);
+    }
+    if (description != NULL)
+    {
+        estimate += strlen(description);
+    }
+
+    if (!WriterReserve(writer, estimate) || !WriterAppend(writer, "{\"", 2))
+    {
+        return false;
+    }
+
+    if (componentName != NULL)
+    {
+        static const char componentMarker[] = "\":{\"__t\":\"c\",\"";
+        if (!WriterAppendString(writer, componentName)
+            || !WriterAppend(writer, componentMarker, sizeof(componentMarker) - 1))
+        {
+            return false;
+        }
+    }
+
+    return WriterAppendString(writer, propertyName) && WriterAppend(writer, "\":", 2);
+}
+
+// Leaves the writer empty after a failed write.
+static bool WriterFail(PnP_ReportedPropertyWriter* writer)
+{
+    writer->Length = 0;
+    if (writer->Buffer != NULL)
+    {
+        writer->Buffer[0] = '\0';
+    }
+
+    return false;
+}
+
+bool PnP_ReportedPropertyWriter_Write(
+    PnP_ReportedPropertyWriter* writer,
+    const char* componentName,
+    const char* propertyName,
+    const char* propertyValue)
+{
+    if (!WriterBegin(writer, componentName, propertyName, propertyValue, NULL)
+        || !WriterAppendString(writer, propertyValue) || !WriterAppend(writer, "}}", componentName == NULL ? 1 : 2))
+    {
+        return WriterFail(writer);
+    }
+
+    return true;
+}
+
+bool PnP_ReportedPropertyWriter_WriteWithStatus(
+    PnP_ReportedPropertyWriter* writer,
+    const char* componentName,
+    const char* propertyName,
+    const char* propertyValue,
+    int result,
+    const char* description,
+    int ackVersion)
+{
+    if (!WriterBegin(writer, componentName, propertyName, propertyValue, description)
+        || !WriterAppend(writer, "{\"value\":", 9) || !WriterAppendString(writer, propertyValue)
+        || !WriterAppend(writer, ",\"ac\":", 6) || !WriterAppendInt(writer, result)
+        || !WriterAppend(writer, ",\"ad\":\"", 7) || !WriterAppendString(writer, description)
+        || !WriterAppend(writer, "\",\"av\":", 7) || !WriterAppendInt(writer, ackVersion)
+        || !WriterAppend(writer, "}}}", componentName == NULL ? 2 : 3))
+    {
+        return WriterFail(writer);
+    }
+
+    return true;
+}
+
+void PnP_ReportedPropertyWriter_Uninit(PnP_ReportedPropertyWriter* writer)
+{
+    free(writer->Buffer);
+    writer->Buffer = NULL;
+    writer->Length = 0;
+    writer->Capacity = 0;
+}
+
 void PnP_ParseCommandName(
     const char* deviceMethodName,
     unsigned const char** componentName,
@@ -173,6 +353,183 @@ IOTHUB_MESSAGE_HANDLE PnP_CreateTelemetryMessageHandle(const char* componentName
     return messageHandle;
 }
 
+PnP_TwinDataCache* PnP_TwinDataCache_Create(void)
+{
+    PnP_TwinDataCache* cache = (PnP_TwinDataCache*)calloc(1, sizeof(*cache));
+
+    if (cache == NULL)
+    {
+        LogError("Unable to allocate twin data cache");
+    }
+
+    return cache;
+}
+
+void PnP_TwinDataCache_Destroy(PnP_TwinDataCache* cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    PnP_PropertyDigest* property = cache->properties;
+    while (property != NULL)
+    {
+        PnP_PropertyDigest* next = property->next;
+
+        free(property->componentName);
+        free(property->propertyName);
+        free(property);
+
+        property = next;
+    }
+
+    free(cache);
+}
+
+//
+// DigestBytes adds size bytes of data to digest.
+//
+static uint64_t DigestBytes(uint64_t digest, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        digest = (digest ^ bytes[i]) * PNP_DIGEST_PRIME;
+    }
+
+    return digest;
+}
+
+//
+// DigestJsonValue adds the type and content of value to digest, walking the parson tree rather than serializing it.
+//
+static uint64_t DigestJsonValue(uint64_t digest, const JSON_Value* value)
+{
+    const JSON_Value_Type type = json_value_get_type(value);
+
+    digest = DigestBytes(digest, &type, sizeof(type));
+
+    switch (type)
+    {
+    case JSONString:
+    {
+        // The terminator separates consecutive strings, e.g. the name and value of a member.
+        const char* str = json_value_get_string(value);
+        digest = DigestBytes(digest, str, strlen(str) + 1);
+        break;
+    }
+
+    case JSONNumber:
+    {
+        const double number = json_value_get_number(value);
+        digest = DigestBytes(digest, &number, sizeof(number));
+        break;
+    }
+
+    case JSONBoolean:
+    {
+        const int boolean = json_value_get_boolean(value);
+        digest = DigestBytes(digest, &boolean, sizeof(boolean));
+        break;
+    }
+
+    case JSONObject:
+    {
+        const JSON_Object* object = json_value_get_object(value);
+        const size_t count = json_object_get_count(object);
+
+        digest = DigestBytes(digest, &count, sizeof(count));
+        for (size_t i = 0; i < count; i++)
+        {
+            const char* name = json_object_get_name(object, i);
+            digest = DigestBytes(digest, name, strlen(name) + 1);
+            digest = DigestJsonValue(digest, json_object_get_value_at(object, i));
+        }
+        break;
+    }
+
+    case JSONArray:
+    {
+        const JSON_Array* array = json_value_get_array(value);
+        const size_t count = json_array_get_count(array);
+
+        digest = DigestBytes(digest, &count, sizeof(count));
+        for (size_t i = 0; i < count; i++)
+        {
+            digest = DigestJsonValue(digest, json_array_get_value(array, i));
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    return digest;
+}
+
+//
+// UpdatePropertyDigest records the digest of the value of a property in cache, and returns whether that value changed
+// since it was last recorded.  Without a cache, every value is considered changed.
+//
+static bool UpdatePropertyDigest(
+    PnP_TwinDataCache* cache, const char* componentName, const char* propertyName, const JSON_Value* value)
+{
+    if (cache == NULL)
+    {
+        return true;
+    }
+
+    const uint64_t digest = DigestJsonValue(PNP_DIGEST_OFFSET_BASIS, value);
+    PnP_PropertyDigest* property = cache->properties;
+
+    while (property != NULL)
+    {
+        const bool sameComponent = (componentName == NULL)
+            ? (property->componentName == NULL)
+            : (property->componentName != NULL && strcmp(componentName, property->componentName) == 0);
+
+        if (sameComponent && strcmp(propertyName, property->propertyName) == 0)
+        {
+            break;
+        }
+
+        property = property->next;
+    }
+
+    if (property == NULL)
+    {
+        // A property that can't be recorded is simply visited again on the next twin.
+        if ((property = (PnP_PropertyDigest*)calloc(1, sizeof(*property))) == NULL
+            || (componentName != NULL && mallocAndStrcpy_s(&property->componentName, componentName) != 0)
+            || mallocAndStrcpy_s(&property->propertyName, propertyName) != 0)
+        {
+            LogError("Unable to allocate digest of property=%s", propertyName);
+            if (property != NULL)
+            {
+                free(property->componentName);
+                free(property);
+            }
+            return true;
+        }
+
+        property->digest = digest;
+        property->next = cache->properties;
+        cache->properties = property;
+        return true;
+    }
+
+    if (property->digest == digest)
+    {
+        return false;
+    }
+
+    property->digest = digest;
+    return true;
+}
+
 //
 // VisitComponentProperties visits each sub element of the given objectName in the desired JSON.  Each of these sub elements corresponds to
 // a property of this component, which we'll invoke the application's pnpPropertyCallback to inform.
@@ -182,7 +539,8 @@ static void VisitComponentProperties(
     JSON_Value* value,
     int version,
     PnP_PropertyCallbackFunction pnpPropertyCallback,
-    void* userContextCallback)
+    void* userContextCallback,
+    PnP_TwinDataCache* cache)
 {
     JSON_Object* object = json_value_get_object(value);
     size_t numChildren = json_object_get_count(object);
@@ -210,6 +568,12 @@ static void VisitComponentProperties(
             continue;
         }
 
+        if (!UpdatePropertyDigest(cache, objectName, propertyName, propertyValue))
+        {
+            LogInfo("Property=%s of component=%s is unchanged, skipping it", propertyName, objectName);
+            continue;
+        }
+
         // Invoke the application's passed in callback for it to process this property.
         pnpPropertyCallback(objectName, propertyName, propertyValue, version, userContextCallback);
     }
@@ -244,7 +608,8 @@ static bool VisitDesiredObject(
     const char** componentsInModel,
     size_t numComponentsInModel,
     PnP_PropertyCallbackFunction pnpPropertyCallback,
-    void* userContextCallback)
+    void* userContextCallback,
+    PnP_TwinDataCache* cache)
 {
     JSON_Value* versionValue = NULL;
     size_t numChildren;
@@ -265,6 +630,13 @@ static bool VisitDesiredObject(
     {
         version = (int)json_value_get_number(versionValue);
 
+        if (cache != NULL && cache->hasVersion && cache->version == version)
+        {
+            // The properties of this version were already visited, e.g. when a full twin follows its last patch.
+            LogInfo("Desired properties version=%d was already processed, skipping it", version);
+            return true;
+        }
+
         numChildren = json_object_get_count(desiredObject);
 
         // Visit each child JSON element of the desired device twin.
@@ -284,9 +656,9 @@ static bool VisitDesiredObject(
             {
                 // If this current JSON is an element AND the name is one of the componentsInModel that the application knows about,
                 // then this json element represents a component.
-                VisitComponentProperties(name, value, version, pnpPropertyCallback, userContextCallback);
+                VisitComponentProperties(name, value, version, pnpPropertyCallback, userContextCallback, cache);
             }
-            else
+            else if (UpdatePropertyDigest(cache, NULL, name, value))
             {
                 // If the child element is NOT an object OR its not a model the application knows about, this is a property of the model's root component.
                 // Invoke the application's passed in callback for it to process this property.
@@ -294,6 +666,12 @@ static bool VisitDesiredObject(
             }
         }
 
+        if (cache != NULL)
+        {
+            cache->hasVersion = true;
+            cache->version = version;
+        }
+
         result = true;
     }
 
@@ -339,19 +717,24 @@ bool PnP_ProcessTwinData(
     const char** componentsInModel,
     size_t numComponentsInModel,
     PnP_PropertyCallbackFunction pnpPropertyCallback,
-    void* userContextCallback)
+    void* userContextCallback,
+    PnP_TwinDataCache* cache)
 {
     char* jsonStr = NULL;
     JSON_Value* rootValue = NULL;
     JSON_Object* desiredObject;
     bool result;
 
-    if ((jsonStr = PnP_CopyPayloadToString(payload, size)) == NULL)
+    // parson only parses NULL terminated strings. A payload that already ends with its NULL terminator is parsed in
+    // place, any other is copied first.
+    const bool isTerminated = size > 0 && payload[size - 1] == '\0';
+
+    if (!isTerminated && (jsonStr = PnP_CopyPayloadToString(payload, size)) == NULL)
     {
         LogError("Unable to allocate twin buffer");
         result = false;
     }
-    else if ((rootValue = json_parse_string(jsonStr)) == NULL)
+    else if ((rootValue = json_parse_string(isTerminated ? (const char*)payload : jsonStr)) == NULL)
     {
         LogError("Unable to parse device twin JSON");
         result = false;
@@ -365,7 +748,7 @@ bool PnP_ProcessTwinData(
     {
         // Visit each sub-element in the desired portion of the twin JSON and invoke pnpPropertyCallback as appropriate.
         result = VisitDesiredObject(
-            desiredObject, componentsInModel, numComponentsInModel, pnpPropertyCallback, userContextCallback);
+            desiredObject, componentsInModel, numComponentsInModel, pnpPropertyCallback, userContextCallback, cache);
     }
 
     json_value_free(rootValue);
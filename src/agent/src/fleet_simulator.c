@@ -0,0 +1,462 @@
+/**
+ * @file fleet_simulator.c
+ * @brief Hosts many simulated devices in one process, to load test the Device Update service.
+ *
+ * Each device has its own IoT Hub client, twin data cache and 'deviceUpdate' component, so its own workflow, reporting
+ * queue, goal state and workflow state journal. The devices share the process: the workflow worker threads, the
+ * extension manager and its update content handlers, the download throttle, the logging and the configuration.
+ * Built with the simulator platform layer only, so that no update is actually installed.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/adu_core_interface.h"
+#include "aduc/c_utils.h"
+#include "aduc/client_handle_helper.h"
+#include "aduc/connection_string_utils.h"
+#include "aduc/event_loop_utils.h"
+#include "aduc/extension_manager.h"
+#include "aduc/logging.h"
+#include "aduc/system_utils.h"
+#include "jws_utils.h"
+#include "pnp_protocol.h"
+#include <getopt.h>
+#include <iothub.h>
+#include <iothub_client_options.h>
+#include <iothubtransportmqtt.h>
+#include <limits.h> // for PATH_MAX
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief The main loop interval. Every device's IoT Hub client does its work at this interval.
+ */
+#define ADUC_FLEET_MAIN_LOOP_INTERVAL_MS 100
+
+/**
+ * @brief The longest line of the devices file.
+ */
+#define ADUC_FLEET_MAX_CONNECTION_STRING_LENGTH 1024
+
+/**
+ * @brief The model of the simulated devices; the same as the agent's.
+ */
+static const char g_aduModelId[] = "dtmi:azure:iot:deviceUpdateModel;1";
+
+/**
+ * @brief The only component of the simulated devices.
+ */
+static const char g_aduPnPComponentName[] = "deviceUpdate";
+
+static const char* g_modeledComponents[] = { g_aduPnPComponentName };
+
+/**
+ * @brief A simulated device.
+ */
+typedef struct tagADUC_FleetDevice
+{
+    char* DeviceId; /**< The device id, from the connection string. */
+    ADUC_ClientHandle ClientHandle; /**< The IoT Hub client of the device. */
+    void* Context; /**< The 'deviceUpdate' component of the device. */
+    PnP_TwinDataCache* TwinDataCache; /**< The desired properties processed so far. */
+    _Bool TwinProcessed; /**< True once the first twin of the device was processed. */
+    _Bool Connected; /**< True while the device is connected to IoT Hub. */
+} ADUC_FleetDevice;
+
+/**
+ * @brief The launch arguments of the fleet simulator.
+ */
+typedef struct tagADUC_FleetLaunchArguments
+{
+    const char* DevicesFilePath; /**< The file of the connection strings of the devices, one per line. */
+    const char* DataFolderRoot; /**< The folder of the data folders of the devices. */
+    ADUC_LOG_SEVERITY LogLevel; /**< The log level. */
+    int argc; /**< The count of the arguments passed to the platform layer. */
+    char** argv; /**< The arguments passed to the platform layer, e.g. --simulation_behavior_file. */
+} ADUC_FleetLaunchArguments;
+
+// Each device is allocated on its own, as the IoT Hub callbacks keep a pointer to it.
+static ADUC_FleetDevice** g_devices = NULL;
+static size_t g_deviceCount = 0;
+static volatile sig_atomic_t g_shutdownSignal = 0;
+
+static void PrintUsage(const char* programName)
+{
+    printf(
+        "Usage: %s --devices-file <path> [--data-folder-root <path>] [--log-level <0-3>] [-- <platform layer args>]\n"
+        "\n"
+        "Hosts a simulated device per connection string of the devices file, one per line.\n"
+        "Empty lines and lines starting with '#' are ignored.\n",
+        programName);
+}
+
+/**
+ * @brief Parses the launch arguments.
+ *
+ * @return int 0 on success, -1 on failure.
+ */
+static int ParseLaunchArguments(int argc, char** argv, ADUC_FleetLaunchArguments* launchArgs)
+{
+    static struct option longOptions[] = { { "devices-file", required_argument, 0, 'd' },
+                                           { "data-folder-root", required_argument, 0, 'r' },
+                                           { "log-level", required_argument, 0, 'l' },
+                                           { "help", no_argument, 0, 'h' },
+                                           { 0, 0, 0, 0 } };
+
+    memset(launchArgs, 0, sizeof(*launchArgs));
+    launchArgs->DataFolderRoot = ADUC_DATA_FOLDER "/fleet";
+    launchArgs->LogLevel = ADUC_LOG_INFO;
+
+    int option = 0;
+    while ((option = getopt_long(argc, argv, "d:r:l:h", longOptions, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            launchArgs->DevicesFilePath = optarg;
+            break;
+
+        case 'r':
+            launchArgs->DataFolderRoot = optarg;
+            break;
+
+        case 'l':
+            launchArgs->LogLevel = (ADUC_LOG_SEVERITY)atoi(optarg);
+            break;
+
+        case 'h':
+        default:
+            PrintUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (launchArgs->DevicesFilePath == NULL)
+    {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    // The arguments after '--' go to the platform layer of each device.
+    launchArgs->argc = argc - optind;
+    launchArgs->argv = argv + optind;
+
+    return 0;
+}
+
+static ADUC_ConnType GetConnTypeFromConnectionString(const char* connectionString)
+{
+    if (!ConnectionStringUtils_DoesKeyExist(connectionString, "DeviceId"))
+    {
+        return ADUC_ConnType_NotSet;
+    }
+
+    return ConnectionStringUtils_DoesKeyExist(connectionString, "ModuleId") ? ADUC_ConnType_Module
+                                                                             : ADUC_ConnType_Device;
+}
+
+//
+// Invoked by the PnP helper layer per property of a device's twin.
+//
+static void FleetDevice_PropertyUpdate_Callback(
+    const char* componentName,
+    const char* propertyName,
+    JSON_Value* propertyValue,
+    int version,
+    void* userContextCallback)
+{
+    ADUC_FleetDevice* device = (ADUC_FleetDevice*)userContextCallback;
+
+    if (componentName == NULL || strcmp(componentName, g_aduPnPComponentName) != 0)
+    {
+        return;
+    }
+
+    AzureDeviceUpdateCoreInterface_PropertyUpdateCallback(
+        device->ClientHandle, propertyName, propertyValue, version, device->Context);
+}
+
+//
+// Invoked by the IoT SDK when a device's twin - either full twin or a PATCH update - arrives.
+//
+static void FleetDevice_DeviceTwin_Callback(
+    DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char* payload, size_t size, void* userContextCallback)
+{
+    ADUC_FleetDevice* device = (ADUC_FleetDevice*)userContextCallback;
+
+    if (device->TwinDataCache == NULL)
+    {
+        device->TwinDataCache = PnP_TwinDataCache_Create();
+    }
+
+    if (!PnP_ProcessTwinData(
+            updateState,
+            payload,
+            size,
+            g_modeledComponents,
+            ARRAY_SIZE(g_modeledComponents),
+            FleetDevice_PropertyUpdate_Callback,
+            device,
+            device->TwinDataCache))
+    {
+        Log_Error("Device %s: unable to process twin JSON.", device->DeviceId);
+    }
+
+    ADUC_EventLoop_Wakeup();
+
+    if (!device->TwinProcessed)
+    {
+        device->TwinProcessed = true;
+        AzureDeviceUpdateCoreInterface_Connected(device->Context);
+    }
+}
+
+static void FleetDevice_ConnectionStatus_Callback(
+    IOTHUB_CLIENT_CONNECTION_STATUS result, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void* userContextCallback)
+{
+    ADUC_FleetDevice* device = (ADUC_FleetDevice*)userContextCallback;
+
+    device->Connected = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
+    Log_Debug("Device %s: IotHub connection status: %d, reason:%d", device->DeviceId, result, reason);
+
+    AzureDeviceUpdateCoreInterface_SetConnected(device->Context, device->Connected);
+}
+
+/**
+ * @brief Creates the client and the 'deviceUpdate' component of a device.
+ *
+ * @param[out] device The device.
+ * @param connectionString The connection string of the device.
+ * @param launchArgs The launch arguments.
+ * @return _Bool true on success.
+ */
+static _Bool FleetDevice_Create(
+    ADUC_FleetDevice* device, const char* connectionString, const ADUC_FleetLaunchArguments* launchArgs)
+{
+    _Bool succeeded = false;
+    char dataFolder[PATH_MAX];
+    ADUC_ConnType connType = GetConnTypeFromConnectionString(connectionString);
+
+    memset(device, 0, sizeof(*device));
+
+    if (connType == ADUC_ConnType_NotSet
+        || !ConnectionStringUtils_GetDeviceIdFromConnectionString(connectionString, &device->DeviceId))
+    {
+        Log_Error("Invalid connection string.");
+        goto done;
+    }
+
+    const int length = snprintf(dataFolder, sizeof(dataFolder), "%s/%s", launchArgs->DataFolderRoot, device->DeviceId);
+    if (length <= 0 || (size_t)length >= sizeof(dataFolder) || ADUC_SystemUtils_MkDirRecursiveDefault(dataFolder) != 0)
+    {
+        Log_Error("Device %s: cannot create the data folder.", device->DeviceId);
+        goto done;
+    }
+
+    if (!ClientHandle_CreateFromConnectionString(&device->ClientHandle, connType, connectionString, MQTT_Protocol))
+    {
+        Log_Error("Device %s: cannot create the IotHub device client.", device->DeviceId);
+        goto done;
+    }
+
+    if (!AzureDeviceUpdateCoreInterface_CreateForDevice(
+            &device->Context, device->ClientHandle, dataFolder, launchArgs->argc, launchArgs->argv))
+    {
+        Log_Error("Device %s: cannot create the 'deviceUpdate' component.", device->DeviceId);
+        goto done;
+    }
+
+    // Connects, and retrieves the full twin.
+    if (ClientHandle_SetOption(device->ClientHandle, OPTION_MODEL_ID, g_aduModelId) != IOTHUB_CLIENT_OK
+        || ClientHandle_SetConnectionStatusCallback(device->ClientHandle, FleetDevice_ConnectionStatus_Callback, device)
+            != IOTHUB_CLIENT_OK
+        || ClientHandle_SetClientTwinCallback(device->ClientHandle, FleetDevice_DeviceTwin_Callback, device)
+            != IOTHUB_CLIENT_OK)
+    {
+        Log_Error("Device %s: cannot register the IotHub callbacks.", device->DeviceId);
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    return succeeded;
+}
+
+static void FleetDevice_Destroy(ADUC_FleetDevice* device)
+{
+    // The client first, so that no callback uses the component once it's destroyed.
+    if (device->ClientHandle != NULL)
+    {
+        ClientHandle_Destroy(device->ClientHandle);
+        device->ClientHandle = NULL;
+    }
+
+    if (device->Context != NULL)
+    {
+        AzureDeviceUpdateCoreInterface_Destroy(&device->Context);
+    }
+
+    PnP_TwinDataCache_Destroy(device->TwinDataCache);
+    free(device->DeviceId);
+    memset(device, 0, sizeof(*device));
+}
+
+/**
+ * @brief Creates a device per connection string of the devices file.
+ *
+ * @return _Bool true if all the devices were created.
+ */
+static _Bool CreateDevices(const ADUC_FleetLaunchArguments* launchArgs)
+{
+    _Bool succeeded = false;
+    char line[ADUC_FLEET_MAX_CONNECTION_STRING_LENGTH];
+    size_t capacity = 0;
+
+    FILE* file = fopen(launchArgs->DevicesFilePath, "r");
+    if (file == NULL)
+    {
+        Log_Error("Cannot open the devices file %s", launchArgs->DevicesFilePath);
+        goto done;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+
+        if (g_deviceCount == capacity)
+        {
+            const size_t newCapacity = capacity == 0 ? 64 : capacity * 2;
+            ADUC_FleetDevice** devices = realloc(g_devices, newCapacity * sizeof(*devices));
+            if (devices == NULL)
+            {
+                goto done;
+            }
+
+            g_devices = devices;
+            capacity = newCapacity;
+        }
+
+        ADUC_FleetDevice* device = malloc(sizeof(*device));
+        if (device == NULL)
+        {
+            goto done;
+        }
+
+        if (!FleetDevice_Create(device, line, launchArgs))
+        {
+            FleetDevice_Destroy(device);
+            free(device);
+            goto done;
+        }
+
+        g_devices[g_deviceCount++] = device;
+    }
+
+    succeeded = g_deviceCount != 0;
+    if (!succeeded)
+    {
+        Log_Error("No device in the devices file %s", launchArgs->DevicesFilePath);
+    }
+
+done:
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+
+    return succeeded;
+}
+
+static void DestroyDevices()
+{
+    for (size_t i = 0; i < g_deviceCount; ++i)
+    {
+        FleetDevice_Destroy(g_devices[i]);
+        free(g_devices[i]);
+    }
+
+    free(g_devices);
+    g_devices = NULL;
+    g_deviceCount = 0;
+}
+
+static void OnShutdownSignal(int sig)
+{
+    g_shutdownSignal = sig;
+    ADUC_EventLoop_Wakeup();
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 1;
+    ADUC_FleetLaunchArguments launchArgs;
+
+    if (ParseLaunchArguments(argc, argv, &launchArgs) != 0)
+    {
+        return 1;
+    }
+
+    ADUC_Logging_Init(launchArgs.LogLevel, "du-fleet-simulator");
+
+    if (ADUC_SystemUtils_MkDirRecursiveDefault(launchArgs.DataFolderRoot) != 0)
+    {
+        Log_Error("Cannot create data folder root %s.", launchArgs.DataFolderRoot);
+        goto done;
+    }
+
+    // Shared by the devices: a manifest verified for one device isn't verified again for the others.
+    InitVerifiedJWSCache(ADUC_DATA_FOLDER "/verifiedmanifests.json");
+
+    ADUC_EventLoop_Init();
+
+    signal(SIGINT, OnShutdownSignal);
+    signal(SIGTERM, OnShutdownSignal);
+
+    ADUC_Result result = ExtensionManager_InitializeContentDownloader(NULL /*initializeData*/);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        Log_Error("Failed to initialize the content downloader, result: %d", result.ExtendedResultCode);
+        goto done;
+    }
+
+    if (!CreateDevices(&launchArgs))
+    {
+        goto done;
+    }
+
+    Log_Info("Fleet simulator running %zu devices.", g_deviceCount);
+
+    while (g_shutdownSignal == 0)
+    {
+        for (size_t i = 0; i < g_deviceCount; ++i)
+        {
+            AzureDeviceUpdateCoreInterface_DoWork(g_devices[i]->Context);
+            ClientHandle_DoWork(g_devices[i]->ClientHandle);
+        }
+
+        ADUC_EventLoop_Wait(ADUC_FLEET_MAIN_LOOP_INTERVAL_MS);
+    }
+
+    ret = 0;
+
+done:
+    Log_Info("Fleet simulator exited with code %d", ret);
+
+    DestroyDevices();
+    ExtensionManager_Uninit();
+    UninitVerifiedJWSCache();
+    ADUC_EventLoop_UnInit();
+    ADUC_Logging_Uninit();
+
+    IoTHub_Deinit();
+
+    return ret;
+}
@@ -13,9 +13,36 @@
 #include "aduc/system_utils.h" // for SystemUtils_IsDir, SystemUtils_IsFile
 #include <azure_c_shared_utility/strings.h> // for STRING_HANDLE, STRING_delete, STRING_c_str
 #include <ctype.h>
+#include <errno.h>
+#include <parson.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h> // for geteuid
+
+/**
+ * @brief The file remembering the checks that passed, and the metadata of the files they examined.
+ *
+ * Format:
+ * {
+ *     "checks":{
+ *         "confFile":"/etc/passwd=2049:10:0:0:100644;1650000000.0:1650000000.0:1846;...",
+ *         ...
+ *     }
+ * }
+ */
+#define HEALTH_CHECK_CACHE_FILE_PATH ADUC_DATA_FOLDER "/healthcheck.json"
+
+/**
+ * @brief Fieldname for the object holding the fingerprint of each passed check, keyed by the check's name.
+ */
+#define HEALTH_CHECK_CACHE_CHECKS_FIELDNAME "checks"
+
+/**
+ * @brief The user and group databases, whose metadata is part of the fingerprint of every check.
+ */
+static const char* health_check_account_files[] = { "/etc/passwd", "/etc/group" };
 
 /**
  * @brief The users that must exist on the system.
@@ -53,7 +80,7 @@ _Bool GetConnectionInfoFromConnectionString(ADUC_ConnectionInfo* info, const cha
  *
  * @return true if connection string can be obtained.
  */
-_Bool IsConnectionInfoValid(const ADUC_LaunchArguments* launchArgs, ADUC_ConfigInfo* config)
+_Bool IsConnectionInfoValid(const ADUC_LaunchArguments* launchArgs, const ADUC_ConfigInfo* config)
 {
     _Bool validInfo = false;
 
@@ -94,9 +121,9 @@ done:
  *
  * @return true if an ADU configuration file contains simulateUnhealthyState value (any value).
  */
-_Bool IsSimulatingUnhealthyState(ADUC_ConfigInfo* config)
+_Bool IsSimulatingUnhealthyState(const ADUC_ConfigInfo* config)
 {
-    return config->simulateUnhealthyState;
+    return config != NULL && config->simulateUnhealthyState;
 }
 
 /**
@@ -460,54 +487,251 @@ done:
     return result;
 }
 
+/**
+ * @brief Loads the checks that passed on a previous start.
+ * @details The cache is ignored unless it's a regular file owned by the effective user and not writable by others,
+ * i.e. only the agent itself can vouch for its past checks.
+ * @return JSON_Value* The cache, or an empty one if it's missing, malformed or can't be trusted.
+ */
+static JSON_Value* LoadHealthCheckCache()
+{
+    JSON_Value* cache = NULL;
+    struct stat st;
+
+    if (lstat(HEALTH_CHECK_CACHE_FILE_PATH, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == geteuid()
+        && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0)
+    {
+        cache = json_parse_file(HEALTH_CHECK_CACHE_FILE_PATH);
+    }
+
+    if (json_object_get_object(json_value_get_object(cache), HEALTH_CHECK_CACHE_CHECKS_FIELDNAME) == NULL)
+    {
+        json_value_free(cache);
+        cache = json_value_init_object();
+        if (cache != NULL)
+        {
+            json_object_set_value(
+                json_value_get_object(cache), HEALTH_CHECK_CACHE_CHECKS_FIELDNAME, json_value_init_object());
+        }
+    }
+
+    return cache;
+}
+
+/**
+ * @brief Saves @p cache for the next start, replacing the previous one atomically.
+ * @details The agent can't write it when the health check runs as another user, e.g. with --health-check as root;
+ * the checks then just run again on the next start.
+ */
+static void SaveHealthCheckCache(const JSON_Value* cache)
+{
+    const char* tempPath = HEALTH_CHECK_CACHE_FILE_PATH ".tmp";
+
+    if (json_serialize_to_file(cache, tempPath) != JSONSuccess)
+    {
+        Log_Debug("Cannot write health check cache %s", tempPath);
+        return;
+    }
+
+    if (chmod(tempPath, S_IRUSR | S_IWUSR) != 0 || rename(tempPath, HEALTH_CHECK_CACHE_FILE_PATH) != 0)
+    {
+        Log_Debug("Cannot replace health check cache %s, errno: %d", HEALTH_CHECK_CACHE_FILE_PATH, errno);
+        remove(tempPath);
+    }
+}
+
+/**
+ * @brief Appends the metadata of @p path to @p fingerprint: device, inode, owner, group and mode, plus the
+ * modification and change times and the size of a regular file.
+ * @details The times of directories aren't used as they change with their entries, e.g. on each log rotation,
+ * while the checks only examine the owner, group and mode of the directories themselves.
+ * @return true on success, false if @p path can't be stat'ed.
+ */
+static _Bool AppendHealthCheckFingerprint(STRING_HANDLE fingerprint, const char* path)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+    {
+        return false;
+    }
+
+    if (STRING_sprintf(
+            fingerprint,
+            "%s=%llu:%llu:%u:%u:%o;",
+            path,
+            (unsigned long long)st.st_dev,
+            (unsigned long long)st.st_ino,
+            (unsigned int)st.st_uid,
+            (unsigned int)st.st_gid,
+            (unsigned int)st.st_mode)
+        != 0)
+    {
+        return false;
+    }
+
+    if (S_ISREG(st.st_mode)
+        && STRING_sprintf(
+               fingerprint,
+               "%lld.%ld:%lld.%ld:%lld;",
+               (long long)st.st_mtim.tv_sec,
+               (long)st.st_mtim.tv_nsec,
+               (long long)st.st_ctim.tv_sec,
+               (long)st.st_ctim.tv_nsec,
+               (long long)st.st_size)
+            != 0)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Fingerprints the metadata that a check examines: the user and group databases, which map the expected
+ * owners to ids, and each of @p paths.
+ * @return STRING_HANDLE The fingerprint, or NULL if any of the files can't be stat'ed.
+ */
+static STRING_HANDLE GetHealthCheckFingerprint(const char** paths, size_t pathCount)
+{
+    STRING_HANDLE fingerprint = STRING_new();
+    _Bool succeeded = fingerprint != NULL;
+
+    for (size_t i = 0; succeeded && i < ARRAY_SIZE(health_check_account_files); ++i)
+    {
+        succeeded = AppendHealthCheckFingerprint(fingerprint, health_check_account_files[i]);
+    }
+
+    for (size_t i = 0; succeeded && i < pathCount; ++i)
+    {
+        succeeded = AppendHealthCheckFingerprint(fingerprint, paths[i]);
+    }
+
+    if (!succeeded)
+    {
+        STRING_delete(fingerprint);
+        fingerprint = NULL;
+    }
+
+    return fingerprint;
+}
+
+/**
+ * @brief Runs @p check, unless it passed on a previous start and the metadata of @p paths didn't change since.
+ *
+ * @param cache The cache from LoadHealthCheckCache, updated with the result of the check. May be NULL.
+ * @param name The name of the check in the cache.
+ * @param paths The files and directories that the check examines.
+ * @param pathCount The number of @p paths.
+ * @param check The check.
+ * @return true if the check passed, now or on a previous start.
+ */
+static _Bool RunCachedHealthCheck(
+    JSON_Value* cache, const char* name, const char** paths, size_t pathCount, _Bool (*check)())
+{
+    JSON_Object* checks = json_object_get_object(json_value_get_object(cache), HEALTH_CHECK_CACHE_CHECKS_FIELDNAME);
+    STRING_HANDLE fingerprint = GetHealthCheckFingerprint(paths, pathCount);
+    _Bool result = false;
+
+    if (checks != NULL && fingerprint != NULL)
+    {
+        const char* cachedFingerprint = json_object_get_string(checks, name);
+        if (cachedFingerprint != NULL && strcmp(cachedFingerprint, STRING_c_str(fingerprint)) == 0)
+        {
+            Log_Debug("Health check '%s' passed previously and its files are unchanged, skipping it.", name);
+            result = true;
+            goto done;
+        }
+    }
+
+    result = check();
+
+    // Only passed checks are remembered, so a failed one is reported again on each start.
+    if (checks != NULL)
+    {
+        if (result && fingerprint != NULL)
+        {
+            json_object_set_string(checks, name, STRING_c_str(fingerprint));
+        }
+        else
+        {
+            json_object_remove(checks, name);
+        }
+    }
+
+done:
+    STRING_delete(fingerprint);
+
+    return result;
+}
+
 /**
  * @brief Helper function for checking correct ownership and permissions for dirs and files.
+ * @details Checks that passed on a previous start are skipped while the metadata of the files they examine
+ * (including the user and group databases) is unchanged.
  * @return true if dirs and files have correct ownership and permissions.
  */
 static _Bool AreDirAndFilePermissionsValid()
 {
     _Bool result = true;
 
-    if (!ReportUserAndGroupRequirements())
+    JSON_Value* cache = LoadHealthCheckCache();
+
+    const char* confDir[] = { ADUC_CONF_FOLDER };
+    const char* confFile[] = { ADUC_CONF_FILE_PATH };
+    const char* logDir[] = { ADUC_LOG_FOLDER };
+    const char* dataDir[] = { ADUC_DATA_FOLDER };
+    const char* downloadsDir[] = { ADUC_DOWNLOADS_FOLDER };
+    const char* agentBinary[] = { ADUC_AGENT_FILEPATH };
+    const char* shellBinary[] = { ADUSHELL_FILE_PATH };
+
+    if (!RunCachedHealthCheck(cache, "users", NULL, 0, ReportUserAndGroupRequirements))
     {
         result = false; // continue
     }
 
-    if (!CheckConfDirOwnershipAndPermissions())
+    if (!RunCachedHealthCheck(
+            cache, "confDir", confDir, ARRAY_SIZE(confDir), CheckConfDirOwnershipAndPermissions))
     {
         result = false; // continue
     }
 
-    if (!CheckConfFile())
+    if (!RunCachedHealthCheck(cache, "confFile", confFile, ARRAY_SIZE(confFile), CheckConfFile))
     {
         result = false; // continue
     }
 
-    if (!CheckLogDir())
+    if (!RunCachedHealthCheck(cache, "logDir", logDir, ARRAY_SIZE(logDir), CheckLogDir))
     {
         result = false; // continue
     }
 
-    if (!CheckDataDir())
+    if (!RunCachedHealthCheck(cache, "dataDir", dataDir, ARRAY_SIZE(dataDir), CheckDataDir))
     {
         result = false; // continue
     }
 
-    if (!CheckDownloadsDir())
+    if (!RunCachedHealthCheck(cache, "downloadsDir", downloadsDir, ARRAY_SIZE(downloadsDir), CheckDownloadsDir))
     {
         result = false; // continue
     }
 
-    if (!CheckAgentBinary())
+    if (!RunCachedHealthCheck(cache, "agentBinary", agentBinary, ARRAY_SIZE(agentBinary), CheckAgentBinary))
     {
         result = false; // continue
     }
 
-    if (!CheckShellBinary())
+    if (!RunCachedHealthCheck(cache, "shellBinary", shellBinary, ARRAY_SIZE(shellBinary), CheckShellBinary))
     {
         result = false; // continue
     }
 
+    if (cache != NULL)
+    {
+        SaveHealthCheckCache(cache);
+        json_value_free(cache);
+    }
+
     return result;
 }
 
@@ -524,13 +748,13 @@ _Bool HealthCheck(const ADUC_LaunchArguments* launchArgs)
 {
     _Bool isHealthy = false;
 
-    ADUC_ConfigInfo config = {};
-    if (!ADUC_ConfigInfo_Init(&config, ADUC_CONF_FILE_PATH))
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    if (config == NULL)
     {
         Log_Warn("Cannot read configuration file: %s", ADUC_CONF_FILE_PATH);
     }
 
-    if (!IsConnectionInfoValid(launchArgs, &config))
+    if (!IsConnectionInfoValid(launchArgs, config))
     {
         Log_Error("Invalid connection info.");
         goto done;
@@ -542,7 +766,7 @@ _Bool HealthCheck(const ADUC_LaunchArguments* launchArgs)
     }
 
 #ifdef ADUC_PLATFORM_SIMULATOR
-    if (IsSimulatingUnhealthyState(&config))
+    if (IsSimulatingUnhealthyState(config))
     {
         Log_Error("Simulating an unhealthy state.");
         goto done;
@@ -553,7 +777,7 @@ _Bool HealthCheck(const ADUC_LaunchArguments* launchArgs)
 
 done:
     Log_Info("Health check %s.", isHealthy ? "passed" : "failed");
-    ADUC_ConfigInfo_UnInit(&config);
+    ADUC_ConfigInfo_ReleaseInstance(config);
 
     return isHealthy;
 }
@@ -13,15 +13,26 @@
 #include "aduc/client_handle_helper.h"
 #include "aduc/config_utils.h"
 #include "aduc/connection_string_utils.h"
+#include "aduc/cpu_affinity_utils.h"
 #include "aduc/device_info_interface.h"
+#include "aduc/event_loop_utils.h"
 #include "aduc/extension_manager.h"
 #include "aduc/extension_utils.h"
+#include "aduc/hash_utils.h"
 #include "aduc/health_management.h"
 #include "aduc/logging.h"
+#include "aduc/metrics_utils.h"
+#include "aduc/perf_profile_utils.h"
+#include "aduc/progress_telemetry.h"
+#include "aduc/resource_sampler.h"
 #include "aduc/string_c_utils.h"
 #include "aduc/system_utils.h"
+#include "aduc/thermal_utils.h"
+#include "aduc/timing_utils.h"
+#include "aduc/workflow_utils.h"
+#include "jws_utils.h"
+#include "parson_json_utils.h"
 #include <azure_c_shared_utility/shared_util_options.h>
-#include <azure_c_shared_utility/threadapi.h> // ThreadAPI_Sleep
 #include <ctype.h>
 #ifndef ADUC_PLATFORM_SIMULATOR // DO is not used in sim mode
 #    include "aduc/connection_string_utils.h"
@@ -34,15 +45,19 @@
 #include <iothub_client_options.h>
 #include <iothubtransportmqtt.h>
 #include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h> // strtol
+#include <sys/resource.h> // for getrusage
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "pnp_protocol.h"
 
+#include "eis_credential_manager.h"
 #include "eis_utils.h"
 
 /**
@@ -56,6 +71,31 @@
  */
 #define EIS_TOKEN_EXPIRY_TIME (3 * SECONDS_IN_MONTH)
 
+/**
+ * @brief The maximum time to wait for the first connection string from the Edge Identity Service, in ms.
+ * Covers the identity, signature and certificate requests.
+ */
+#define EIS_PROVISIONING_WAIT_TIME (4 * EIS_PROVISIONING_TIMEOUT)
+
+/**
+ * @brief The delay before switching to renewed credentials again, after the switch failed, in ms.
+ */
+#define EIS_CREDENTIAL_SWITCH_RETRY_INTERVAL_MS (60 * 1000)
+
+/**
+ * @brief The ClientHandle_DoWork interval recommended by the IoT Hub SDK, used while messages or reported properties
+ * are waiting to be sent or acknowledged, or while not connected to IoT Hub.
+ */
+#define ADUC_MAIN_LOOP_MIN_INTERVAL_MS 100
+
+/**
+ * @brief The ClientHandle_DoWork interval once it has backed off while there is no outstanding IoT Hub traffic.
+ * This bounds the latency of cloud-to-device messages, which the IoT Hub client only receives in DoWork.
+ */
+#ifndef ADUC_MAIN_LOOP_MAX_IDLE_INTERVAL_MS
+#    define ADUC_MAIN_LOOP_MAX_IDLE_INTERVAL_MS 1000
+#endif
+
 /**
  * @brief Make getopt* stop parsing as soon as non-option argument is encountered.
  * @remark See GETOPT.3 man page for more details.
@@ -105,6 +145,165 @@ ADUC_ClientHandle g_iotHubClientHandle = NULL;
  */
 static int g_shutdownSignal = 0;
 
+/**
+ * @brief Set by SIGHUP. The main loop then reloads the configuration file.
+ */
+static volatile sig_atomic_t g_reloadConfigSignal = 0;
+
+/**
+ * @brief Whether the IoT Hub client is authenticated. The main loop only backs off while it is.
+ */
+static bool g_iotHubConnected = false;
+
+/**
+ * @brief The monotonic time at which the agent started, to measure the startup critical path.
+ */
+static struct timespec g_startTime;
+
+/**
+ * @brief Whether the IoT Hub client was authenticated at least once since the agent started.
+ */
+static bool g_iotHubConnectedOnce = false;
+
+/**
+ * @brief The interval of the metrics telemetry messages, in ms, from the configuration file. 0 disables them.
+ */
+static unsigned long long g_metricsTelemetryIntervalMs = 0;
+
+/**
+ * @brief The interval of the progress telemetry messages, in ms, from the configuration file. 0 disables them.
+ */
+static unsigned long long g_progressTelemetryIntervalMs = 0;
+
+/**
+ * @brief The size limit of a progress telemetry message, in bytes, from the configuration file.
+ */
+static size_t g_progressTelemetryMaxBytes = ADUC_PROGRESS_TELEMETRY_DEFAULT_MAX_BYTES;
+
+/**
+ * @brief The generation of the Edge Identity Service credentials the IoT Hub client uses; 0 if not provisioned by it.
+ */
+static unsigned int g_eisCredentialGeneration = 0;
+
+/**
+ * @brief The startup phases timed with --profile-startup, in the order of the breakdown.
+ */
+typedef enum tagADUC_StartupPhase
+{
+    ADUC_StartupPhase_ConfigParsing,
+    ADUC_StartupPhase_HealthCheck,
+    ADUC_StartupPhase_ExtensionRegistration,
+    ADUC_StartupPhase_EisProvisioning,
+    ADUC_StartupPhase_IotClientCreation,
+    ADUC_StartupPhase_FirstTwinCallback,
+    ADUC_StartupPhase_FirstReportedProperty, /**< From the first twin callback until a reported state was sent. */
+    ADUC_StartupPhase_Count
+} ADUC_StartupPhase;
+
+/**
+ * @brief The timing of a startup phase, in nanoseconds of the monotonic clock, see ADUC_Timing_Now.
+ */
+typedef struct tagADUC_StartupPhaseTiming
+{
+    int64_t FirstStart; /**< When the phase first started, 0 if it never did. */
+    int64_t Start; /**< When the phase last started, 0 if it isn't running. */
+    int64_t Duration; /**< The total duration of the phase, which may run several times, e.g. on retries. */
+} ADUC_StartupPhaseTiming;
+
+/**
+ * @brief Whether --profile-startup was passed. Until the breakdown is printed, the phases are timed.
+ */
+static _Bool g_startupProfileEnabled = false;
+
+/**
+ * @brief The timings of the startup phases. Each phase is only timed on a single thread.
+ */
+static ADUC_StartupPhaseTiming g_startupPhaseTimings[ADUC_StartupPhase_Count];
+
+/**
+ * @brief Marks the start of @p phase, when profiling the startup.
+ */
+static void StartupProfile_BeginPhase(ADUC_StartupPhase phase)
+{
+    ADUC_StartupPhaseTiming* timing = &g_startupPhaseTimings[phase];
+
+    if (g_startupProfileEnabled)
+    {
+        timing->Start = ADUC_Timing_Now();
+        if (timing->FirstStart == 0)
+        {
+            timing->FirstStart = timing->Start;
+        }
+    }
+}
+
+/**
+ * @brief Marks the end of @p phase, when profiling the startup and the phase is running.
+ */
+static void StartupProfile_EndPhase(ADUC_StartupPhase phase)
+{
+    ADUC_StartupPhaseTiming* timing = &g_startupPhaseTimings[phase];
+
+    if (g_startupProfileEnabled && timing->Start != 0)
+    {
+        timing->Duration += ADUC_Timing_Now() - timing->Start;
+        timing->Start = 0;
+    }
+}
+
+/**
+ * @brief Prints when each startup phase started and how long it took, and stops profiling the startup.
+ * Phases may overlap, e.g. the health check with fastBoot.
+ */
+static void StartupProfile_Print()
+{
+    static const char* const phaseNames[ADUC_StartupPhase_Count] = {
+        "config parsing",      "health check",        "extension registration",  "EIS provisioning",
+        "IoT client creation", "first twin callback", "first reported property",
+    };
+    const int64_t startTime = (int64_t)g_startTime.tv_sec * 1000000000 + g_startTime.tv_nsec;
+
+    if (!g_startupProfileEnabled)
+    {
+        return;
+    }
+
+    g_startupProfileEnabled = false;
+
+    printf("Startup profile, in ms since the agent started:\n");
+    printf("  %-24s %10s %10s\n", "phase", "start", "duration");
+    for (unsigned index = 0; index < ADUC_StartupPhase_Count; ++index)
+    {
+        const ADUC_StartupPhaseTiming* timing = &g_startupPhaseTimings[index];
+
+        if (timing->FirstStart == 0)
+        {
+            printf("  %-24s %10s %10s\n", phaseNames[index], "-", "-");
+            continue;
+        }
+
+        printf(
+            "  %-24s %10.1f %10.1f%s\n",
+            phaseNames[index],
+            (double)(timing->FirstStart - startTime) / 1000000.0,
+            (double)timing->Duration / 1000000.0,
+            (timing->Start != 0) ? " (unfinished)" : "");
+    }
+
+    printf("  %-24s %10.1f\n", "total", (double)(ADUC_Timing_Now() - startTime) / 1000000.0);
+    fflush(stdout);
+}
+
+/**
+ * @brief State of the health check when it runs while the agent connects (fastBoot).
+ */
+typedef struct tagADUC_HealthCheckTask
+{
+    const ADUC_LaunchArguments* LaunchArgs; /**< The arguments to check. */
+    pthread_t Thread; /**< The thread running the health check. */
+    _Bool Healthy; /**< The result of the health check, once Thread is joined. */
+} ADUC_HealthCheckTask;
+
 //
 // Components that this agent supports.
 //
@@ -129,6 +328,15 @@ typedef void (*PnPComponentConnectedFunc)(void* componentContext);
  */
 typedef void (*PnPComponentDoWorkFunc)(void* componentContext);
 
+/**
+ * @brief Function signature for PnP component method that gets the delay until DoWork is next due.
+ *        Called after each DoWork.
+ *
+ * @return The delay in milliseconds, or ADUC_EVENT_LOOP_ON_DEMAND if DoWork only has work after the main loop was
+ * woken up.
+ */
+typedef unsigned int (*PnPComponentGetDoWorkDelayFunc)(void* componentContext);
+
 /**
  * @brief Function signature for PnP component uninitialize method.
  */
@@ -160,12 +368,15 @@ typedef struct tagPnPComponentEntry
     const PnPComponentDestroyFunc Destroy;
     const PnPComponentPropertyUpdateCallback
         PnPPropertyUpdateCallback; /**< Called when a component's property is updated. (optional) */
-    
+    const PnPComponentGetDoWorkDelayFunc
+        GetDoWorkDelay; /**< Gets the delay until DoWork is next due. (optional, 100 ms if NULL) */
+
     //
     // Following data is dynamic.
     // Must be initialized to NULL in map and remain last entries in this struct.
     //
     void* Context; /**< Opaque data returned from PnPComponentInitFunc(). */
+    unsigned long long NextDoWorkMs; /**< When DoWork is next due, in ms since the agent started. */
 } PnPComponentEntry;
 
 // clang-format off
@@ -181,9 +392,10 @@ static PnPComponentEntry componentList[] = {
         &g_iotHubClientHandleForDeviceInfoComponent,
         DeviceInfoInterface_Create,
         DeviceInfoInterface_Connected,
-        NULL /* DoWork method - not used */,
+        DeviceInfoInterface_DoWork,
         DeviceInfoInterface_Destroy,
         NULL, /* PropertyUpdateCallback - not used */
+        DeviceInfoInterface_GetDoWorkDelay,
     },
     {
         g_aduPnPComponentName,
@@ -192,7 +404,8 @@ static PnPComponentEntry componentList[] = {
         AzureDeviceUpdateCoreInterface_Connected,
         AzureDeviceUpdateCoreInterface_DoWork,
         AzureDeviceUpdateCoreInterface_Destroy,
-        AzureDeviceUpdateCoreInterface_PropertyUpdateCallback
+        AzureDeviceUpdateCoreInterface_PropertyUpdateCallback,
+        AzureDeviceUpdateCoreInterface_GetDoWorkDelay,
     },
     {
         g_diagnosticsPnPComponentName,
@@ -201,7 +414,8 @@ static PnPComponentEntry componentList[] = {
         DiagnosticsInterface_Connected,
         NULL,
         DiagnosticsInterface_Destroy,
-        DiagnosticsInterface_PropertyUpdateCallback
+        DiagnosticsInterface_PropertyUpdateCallback,
+        NULL, /* GetDoWorkDelay - no DoWork */
     },
 };
 
@@ -243,9 +457,11 @@ int ParseLaunchArguments(const int argc, char** argv, ADUC_LaunchArguments* laun
             { "connection-string",             required_argument, 0, 'c' },
             { "register-content-handler",      required_argument, 0, 'C' },
             { "register-component-enumerator", required_argument, 0, 'E' },
+            { "component-enumerator-id",       required_argument, 0, 'I' },
             { "register-content-downloader",   required_argument, 0, 'D' },
             { "update-type",                   required_argument, 0, 'u' },
             { "run-as-owner",                  no_argument,       0, 'a' },
+            { "profile-startup",               no_argument,       0, 'p' },
             { 0, 0, 0, 0 }
         };
         // clang-format on
@@ -256,7 +472,7 @@ int ParseLaunchArguments(const int argc, char** argv, ADUC_LaunchArguments* laun
         int option = getopt_long(
             argc,
             argv,
-            STOP_PARSE_ON_NONOPTION_ARG RET_COLON_FOR_MISSING_OPTIONARG "avehcu:l:r:d:n:C:E:D:",
+            STOP_PARSE_ON_NONOPTION_ARG RET_COLON_FOR_MISSING_OPTIONARG "avehpcu:l:r:d:n:C:E:I:D:",
             long_options,
             &option_index);
 
@@ -276,6 +492,10 @@ int ParseLaunchArguments(const int argc, char** argv, ADUC_LaunchArguments* laun
             launchArgs->iotHubTracingEnabled = true;
             break;
 
+        case 'p':
+            launchArgs->profileStartup = true;
+            break;
+
         case 'l':
         {
             unsigned int logLevel = 0;
@@ -313,6 +533,10 @@ int ParseLaunchArguments(const int argc, char** argv, ADUC_LaunchArguments* laun
             launchArgs->componentEnumeratorFilePath = optarg;
             break;
 
+        case 'I':
+            launchArgs->componentEnumeratorId = optarg;
+            break;
+
         case 'u':
             launchArgs->updateType = optarg;
             break;
@@ -418,6 +642,23 @@ done:
     return succeeded;
 }
 
+/**
+ * @brief Sets the device id the download start jitter of the workflows is derived from.
+ * @param connectionString connectionString to extract the device-id from
+ */
+static void SetWorkflowDeviceIdFromConnectionString(const char* connectionString)
+{
+    char* deviceId = NULL;
+
+    // Without a device id, e.g. with a module connection string lacking it, downloads start right away.
+    if (ConnectionStringUtils_GetDeviceIdFromConnectionString(connectionString, &deviceId))
+    {
+        workflow_set_device_id(deviceId);
+    }
+
+    free(deviceId);
+}
+
 //
 // IotHub methods.
 //
@@ -546,6 +787,10 @@ static const size_t g_numModeledComponents = ARRAY_SIZE(g_modeledComponents);
 
 static bool g_firstDeviceTwinDataProcessed = false;
 
+// The desired properties processed so far. Like the components' state, it outlives the IoT Hub client,
+// so that the full twin received on reconnection only dispatches the properties that changed meanwhile.
+static PnP_TwinDataCache* g_twinDataCache = NULL;
+
 static void InititalizeModeledComponents()
 {
     const size_t numModeledComponents = ARRAY_SIZE(g_modeledComponents);
@@ -563,8 +808,19 @@ static void InititalizeModeledComponents()
 static void ADUC_PnPDeviceTwin_Callback(
     DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char* payload, size_t size, void* userContextCallback)
 {
+    if (!g_firstDeviceTwinDataProcessed)
+    {
+        StartupProfile_BeginPhase(ADUC_StartupPhase_FirstTwinCallback);
+    }
+
     // Invoke PnP_ProcessTwinData to actually process the data.  PnP_ProcessTwinData uses a visitor pattern to parse
     // the JSON and then visit each property, invoking PnP_TempControlComponent_ApplicationPropertyCallback on each element.
+    // Without a cache (out of memory), every property is visited.
+    if (g_twinDataCache == NULL)
+    {
+        g_twinDataCache = PnP_TwinDataCache_Create();
+    }
+
     if (PnP_ProcessTwinData(
             updateState,
             payload,
@@ -572,7 +828,8 @@ static void ADUC_PnPDeviceTwin_Callback(
             g_modeledComponents,
             g_numModeledComponents,
             ADUC_PnP_ComponentClient_PropertyUpdate_Callback,
-            userContextCallback)
+            userContextCallback,
+            g_twinDataCache)
         == false)
     {
         // If we're unable to parse the JSON for any reason (typically because the JSON is malformed or we ran out of memory)
@@ -580,12 +837,18 @@ static void ADUC_PnPDeviceTwin_Callback(
         Log_Error("Unable to process twin JSON.  Ignoring any desired property update requests.");
     }
 
+    // Keep the main loop responsive while the update is processed.
+    ADUC_EventLoop_Wakeup();
+
     if (!g_firstDeviceTwinDataProcessed)
     {
         g_firstDeviceTwinDataProcessed = true;
 
         Log_Info("Processing existing Device Twin data after agent started.");
 
+        // The connected components report their properties.
+        StartupProfile_BeginPhase(ADUC_StartupPhase_FirstReportedProperty);
+
         const unsigned componentCount = ARRAY_SIZE(componentList);
         Log_Debug("Notifies components that all callback are subscribed.");
         for (unsigned index = 0; index < componentCount; ++index)
@@ -596,25 +859,59 @@ static void ADUC_PnPDeviceTwin_Callback(
                 entry->Connected(entry->Context);
             }
         }
+
+        StartupProfile_EndPhase(ADUC_StartupPhase_FirstTwinCallback);
     }
 }
 
+/**
+ * @brief Gets the milliseconds elapsed since the agent started.
+ */
+static unsigned long long GetMsSinceStart()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long long)((long long)(now.tv_sec - g_startTime.tv_sec) * 1000
+                                + (now.tv_nsec - g_startTime.tv_nsec) / 1000000);
+}
+
 static void ADUC_ConnectionStatus_Callback(
     IOTHUB_CLIENT_CONNECTION_STATUS result, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void* userContextCallback)
 {
     UNREFERENCED_PARAMETER(userContextCallback);
 
     Log_Debug("IotHub connection status: %d, reason:%d", result, reason);
+
+    g_iotHubConnected = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
+
+    if (g_iotHubConnected && !g_iotHubConnectedOnce)
+    {
+        g_iotHubConnectedOnce = true;
+        Log_Info("Connected to IoT Hub %llu ms after start.", GetMsSinceStart());
+    }
+
+    // The 'agent' reports are kept while disconnected, rather than queued in the client.
+    for (unsigned index = 0; index < ARRAY_SIZE(componentList); ++index)
+    {
+        PnPComponentEntry* entry = componentList + index;
+        if (strcmp(entry->ComponentName, g_aduPnPComponentName) == 0 && entry->Context != NULL)
+        {
+            AzureDeviceUpdateCoreInterface_SetConnected(entry->Context, g_iotHubConnected);
+        }
+    }
 }
 
 /**
- * @brief Creates an IoTHub device client handler and register all callbacks.
+ * @brief Creates an IoTHub device client handle and sets the options of @p connInfo on it.
  *
+ * @param[out] clientHandle the created handle; NULL on failure.
  * @param connInfo struct containing the connection information for the DeviceClient
  * @param launchArgs Launch command-line arguments.
  * @return true on success, false on failure
  */
-_Bool ADUC_DeviceClient_Create(ADUC_ConnectionInfo* connInfo, const ADUC_LaunchArguments* launchArgs)
+static _Bool ADUC_DeviceClient_CreateHandle(
+    ADUC_ClientHandle* clientHandle, const ADUC_ConnectionInfo* connInfo, const ADUC_LaunchArguments* launchArgs)
 {
     IOTHUB_CLIENT_RESULT iothubResult;
     bool result = true;
@@ -623,15 +920,14 @@ _Bool ADUC_DeviceClient_Create(ADUC_ConnectionInfo* connInfo, const ADUC_LaunchA
 
     // Create a connection to IoTHub.
     if (!ClientHandle_CreateFromConnectionString(
-            &g_iotHubClientHandle, connInfo->connType, connInfo->connectionString, MQTT_Protocol))
+            clientHandle, connInfo->connType, connInfo->connectionString, MQTT_Protocol))
     {
         Log_Error("Failure creating IotHub device client using MQTT protocol. Check your connection string.");
         result = false;
     }
     // Sets IoTHub tracing verbosity level.
     else if (
-        (iothubResult =
-             ClientHandle_SetOption(g_iotHubClientHandle, OPTION_LOG_TRACE, &(launchArgs->iotHubTracingEnabled)))
+        (iothubResult = ClientHandle_SetOption(*clientHandle, OPTION_LOG_TRACE, &(launchArgs->iotHubTracingEnabled)))
         != IOTHUB_CLIENT_OK)
     {
         Log_Error("Unable to set IoTHub tracing option, error=%d", iothubResult);
@@ -639,8 +935,7 @@ _Bool ADUC_DeviceClient_Create(ADUC_ConnectionInfo* connInfo, const ADUC_LaunchA
     }
     else if (
         connInfo->certificateString != NULL && connInfo->authType == ADUC_AuthType_SASCert
-        && (iothubResult =
-                ClientHandle_SetOption(g_iotHubClientHandle, SU_OPTION_X509_CERT, connInfo->certificateString))
+        && (iothubResult = ClientHandle_SetOption(*clientHandle, SU_OPTION_X509_CERT, connInfo->certificateString))
             != IOTHUB_CLIENT_OK)
     {
         Log_Error("Unable to set IotHub certificate, error=%d", iothubResult);
@@ -648,8 +943,7 @@ _Bool ADUC_DeviceClient_Create(ADUC_ConnectionInfo* connInfo, const ADUC_LaunchA
     }
     else if (
         connInfo->certificateString != NULL && connInfo->authType == ADUC_AuthType_NestedEdgeCert
-        && (iothubResult =
-                ClientHandle_SetOption(g_iotHubClientHandle, OPTION_TRUSTED_CERT, connInfo->certificateString))
+        && (iothubResult = ClientHandle_SetOption(*clientHandle, OPTION_TRUSTED_CERT, connInfo->certificateString))
             != IOTHUB_CLIENT_OK)
     {
         Log_Error("Could not add trusted certificate, error=%d ", iothubResult);
@@ -657,8 +951,7 @@ _Bool ADUC_DeviceClient_Create(ADUC_ConnectionInfo* connInfo, const ADUC_LaunchA
     }
     else if (
         connInfo->opensslEngine != NULL && connInfo->authType == ADUC_AuthType_SASCert
-        && (iothubResult =
-                ClientHandle_SetOption(g_iotHubClientHandle, OPTION_OPENSSL_ENGINE, connInfo->opensslEngine))
+        && (iothubResult = ClientHandle_SetOption(*clientHandle, OPTION_OPENSSL_ENGINE, connInfo->opensslEngine))
             != IOTHUB_CLIENT_OK)
     {
         Log_Error("Unable to set IotHub OpenSSL Engine, error=%d", iothubResult);
@@ -667,7 +960,7 @@ _Bool ADUC_DeviceClient_Create(ADUC_ConnectionInfo* connInfo, const ADUC_LaunchA
     else if (
         connInfo->opensslPrivateKey != NULL && connInfo->authType == ADUC_AuthType_SASCert
         && (iothubResult =
-                ClientHandle_SetOption(g_iotHubClientHandle, SU_OPTION_X509_PRIVATE_KEY, connInfo->opensslPrivateKey))
+                ClientHandle_SetOption(*clientHandle, SU_OPTION_X509_PRIVATE_KEY, connInfo->opensslPrivateKey))
             != IOTHUB_CLIENT_OK)
     {
         Log_Error("Unable to set IotHub OpenSSL Private Key, error=%d", iothubResult);
@@ -677,23 +970,37 @@ _Bool ADUC_DeviceClient_Create(ADUC_ConnectionInfo* connInfo, const ADUC_LaunchA
         connInfo->opensslEngine != NULL && connInfo->opensslPrivateKey != NULL
         && connInfo->authType == ADUC_AuthType_SASCert
         && (iothubResult =
-                ClientHandle_SetOption(g_iotHubClientHandle, OPTION_OPENSSL_PRIVATE_KEY_TYPE, &x509_key_from_engine))
+                ClientHandle_SetOption(*clientHandle, OPTION_OPENSSL_PRIVATE_KEY_TYPE, &x509_key_from_engine))
             != IOTHUB_CLIENT_OK)
     {
         Log_Error("Unable to set IotHub OpenSSL Private Key Type, error=%d", iothubResult);
         result = false;
     }
-    // Create PnP components.
-    else if (!ADUC_PnP_Components_Create(g_iotHubClientHandle, launchArgs->argc, launchArgs->argv))
+
+    if ((result == false) && (*clientHandle != NULL))
     {
-        result = false;
+        ClientHandle_Destroy(*clientHandle);
+        *clientHandle = NULL;
     }
+
+    return result;
+}
+
+/**
+ * @brief Registers the model id and the callbacks of the agent on an IoTHub device client handle.
+ *
+ * @param clientHandle the handle, not yet connected.
+ * @return true on success, false on failure
+ */
+static _Bool ADUC_DeviceClient_RegisterCallbacks(ADUC_ClientHandle clientHandle)
+{
+    IOTHUB_CLIENT_RESULT iothubResult;
+    bool result = true;
+
     // Sets the name of ModelId for this PnP device.
     // This *MUST* be set before the client is connected to IoTHub.  We do not automatically connect when the
     // handle is created, but will implicitly connect to subscribe for device method and device twin callbacks below.
-    else if (
-        (iothubResult = ClientHandle_SetOption(g_iotHubClientHandle, OPTION_MODEL_ID, g_aduModelId))
-        != IOTHUB_CLIENT_OK)
+    if ((iothubResult = ClientHandle_SetOption(clientHandle, OPTION_MODEL_ID, g_aduModelId)) != IOTHUB_CLIENT_OK)
     {
         Log_Error("Unable to set the Device Twin Model ID, error=%d", iothubResult);
         result = false;
@@ -702,16 +1009,15 @@ _Bool ADUC_DeviceClient_Create(ADUC_ConnectionInfo* connInfo, const ADUC_LaunchA
     // that PnP Properties are transferred over.
     // This will also automatically retrieve the full twin for the application.
     else if (
-        (iothubResult = ClientHandle_SetClientTwinCallback(
-             g_iotHubClientHandle, ADUC_PnPDeviceTwin_Callback, (void*)g_iotHubClientHandle))
+        (iothubResult =
+             ClientHandle_SetClientTwinCallback(clientHandle, ADUC_PnPDeviceTwin_Callback, (void*)clientHandle))
         != IOTHUB_CLIENT_OK)
     {
         Log_Error("Unable to set device twin callback, error=%d", iothubResult);
         result = false;
     }
     else if (
-        (iothubResult =
-             ClientHandle_SetConnectionStatusCallback(g_iotHubClientHandle, ADUC_ConnectionStatus_Callback, NULL))
+        (iothubResult = ClientHandle_SetConnectionStatusCallback(clientHandle, ADUC_ConnectionStatus_Callback, NULL))
         != IOTHUB_CLIENT_OK)
     {
         Log_Error("Unable to set connection status calback, error=%d", iothubResult);
@@ -723,6 +1029,34 @@ _Bool ADUC_DeviceClient_Create(ADUC_ConnectionInfo* connInfo, const ADUC_LaunchA
         result = true;
     }
 
+    return result;
+}
+
+/**
+ * @brief Creates an IoTHub device client handler and register all callbacks.
+ *
+ * @param connInfo struct containing the connection information for the DeviceClient
+ * @param launchArgs Launch command-line arguments.
+ * @return true on success, false on failure
+ */
+_Bool ADUC_DeviceClient_Create(ADUC_ConnectionInfo* connInfo, const ADUC_LaunchArguments* launchArgs)
+{
+    bool result = true;
+
+    if (!ADUC_DeviceClient_CreateHandle(&g_iotHubClientHandle, connInfo, launchArgs))
+    {
+        result = false;
+    }
+    // Create PnP components.
+    else if (!ADUC_PnP_Components_Create(g_iotHubClientHandle, launchArgs->argc, launchArgs->argv))
+    {
+        result = false;
+    }
+    else if (!ADUC_DeviceClient_RegisterCallbacks(g_iotHubClientHandle))
+    {
+        result = false;
+    }
+
     if ((result == false) && (g_iotHubClientHandle != NULL))
     {
         ClientHandle_Destroy(g_iotHubClientHandle);
@@ -732,6 +1066,43 @@ _Bool ADUC_DeviceClient_Create(ADUC_ConnectionInfo* connInfo, const ADUC_LaunchA
     return result;
 }
 
+/**
+ * @brief Replaces the IoTHub device client handle with one that connects with @p connInfo, e.g. renewed credentials.
+ * @details The PnP components and their state are kept; they send through the new handle from then on. The full twin
+ * the new handle receives only dispatches the properties that changed meanwhile. On failure, the current handle is
+ * kept.
+ *
+ * @param connInfo struct containing the connection information for the DeviceClient
+ * @param launchArgs Launch command-line arguments.
+ * @return true on success, false on failure
+ */
+static _Bool ADUC_DeviceClient_Replace(const ADUC_ConnectionInfo* connInfo, const ADUC_LaunchArguments* launchArgs)
+{
+    ADUC_ClientHandle clientHandle = NULL;
+
+    if (!ADUC_DeviceClient_CreateHandle(&clientHandle, connInfo, launchArgs))
+    {
+        return false;
+    }
+
+    if (!ADUC_DeviceClient_RegisterCallbacks(clientHandle))
+    {
+        ClientHandle_Destroy(clientHandle);
+        return false;
+    }
+
+    ADUC_DeviceClient_Destroy(g_iotHubClientHandle);
+    g_iotHubClientHandle = clientHandle;
+    g_iotHubConnected = false;
+
+    for (unsigned index = 0; index < ARRAY_SIZE(componentList); ++index)
+    {
+        *(componentList[index].clientHandle) = clientHandle;
+    }
+
+    return true;
+}
+
 /**
  * @brief Scans the connection string and returns the connection type related to the string
  * @details The connection string must use the valid, correct format for the DeviceId and/or the ModuleId
@@ -808,12 +1179,12 @@ _Bool GetConnectionInfoFromConnectionString(ADUC_ConnectionInfo* info, const cha
     info->authType = ADUC_AuthType_SASToken;
 
     // Optional: The certificate string is needed for Edge Gateway connection.
-    ADUC_ConfigInfo config = {};
-    if (ADUC_ConfigInfo_Init(&config, ADUC_CONF_FILE_PATH) && config.edgegatewayCertPath != NULL)
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    if (config != NULL && config->edgegatewayCertPath != NULL)
     {
-        if (!LoadBufferWithFileContents(config.edgegatewayCertPath, certificateString, ARRAY_SIZE(certificateString)))
+        if (!LoadBufferWithFileContents(config->edgegatewayCertPath, certificateString, ARRAY_SIZE(certificateString)))
         {
-            Log_Error("Failed to read the certificate from path: %s", config.edgegatewayCertPath);
+            Log_Error("Failed to read the certificate from path: %s", config->edgegatewayCertPath);
             goto done;
         }
 
@@ -829,7 +1200,7 @@ _Bool GetConnectionInfoFromConnectionString(ADUC_ConnectionInfo* info, const cha
     succeeded = true;
 
 done:
-    ADUC_ConfigInfo_UnInit(&config);
+    ADUC_ConfigInfo_ReleaseInstance(config);
     return succeeded;
 }
 
@@ -847,6 +1218,20 @@ _Bool GetConnectionInfoFromIdentityService(ADUC_ConnectionInfo* info)
     }
     memset(info, 0, sizeof(*info));
 
+    // Started at launch, the credential manager provisions while the agent starts up.
+    if (EISCredentialManager_IsStarted())
+    {
+        unsigned int generation = 0;
+        if (!EISCredentialManager_GetConnectionInfo(0, EIS_PROVISIONING_WAIT_TIME, info, &generation))
+        {
+            Log_Info("Failed to provision a connection string from eis");
+            goto done;
+        }
+
+        succeeded = true;
+        goto done;
+    }
+
     Log_Info("Requesting connection string from the Edge Identity Service");
 
     time_t expirySecsSinceEpoch = time(NULL) + EIS_TOKEN_EXPIRY_TIME;
@@ -869,34 +1254,734 @@ done:
     return succeeded;
 }
 
+//
+// Additional agents.
+//
+// The agents of the configuration file after the first one are hosted in this process too, each with an IoT Hub
+// connection of its own and only a 'deviceUpdate' component. They share the workflow worker threads, the extension
+// manager and its update content handlers, the download cache and throttle, the logging and the configuration with
+// the first agent, as the devices of the fleet simulator do.
+//
+
 /**
- * @brief Handles the startup of the agent
- * @details Provisions the connection string with the CLI or either
- * the Edge Identity Service or the configuration file
- * @param launchArgs CLI arguments passed to the client
- * @returns _Bool true on success.
+ * @brief An agent hosted after the first one of the configuration file.
  */
-_Bool StartupAgent(const ADUC_LaunchArguments* launchArgs)
+typedef struct tagADUC_AdditionalAgent
 {
-    _Bool succeeded = false;
-
-    ADUC_ConnectionInfo info = {};
+    char* Name; /**< The name of the agent, from the configuration file. */
+    ADUC_ClientHandle ClientHandle; /**< The IoT Hub client of the agent. */
+    void* Context; /**< The 'deviceUpdate' component of the agent. */
+    PnP_TwinDataCache* TwinDataCache; /**< The desired properties processed so far. */
+    _Bool TwinProcessed; /**< True once the first twin of the agent was processed. */
+    _Bool Connected; /**< True while the agent is connected to IoT Hub. */
+    unsigned long long NextDoWorkMs; /**< When the component gets its next DoWork, from GetMsSinceStart. */
+    unsigned long long NextClientDoWorkMs; /**< When the client gets its next DoWork, from GetMsSinceStart. */
+} ADUC_AdditionalAgent;
+
+// Each agent is allocated on its own, as the IoT Hub callbacks keep a pointer to it.
+static ADUC_AdditionalAgent** g_additionalAgents = NULL;
+static size_t g_additionalAgentCount = 0;
 
-    ADUC_ConfigInfo config = {};
+//
+// Invoked by the PnP helper layer per property of an additional agent's twin.
+//
+static void AdditionalAgent_PropertyUpdate_Callback(
+    const char* componentName,
+    const char* propertyName,
+    JSON_Value* propertyValue,
+    int version,
+    void* userContextCallback)
+{
+    ADUC_AdditionalAgent* agent = (ADUC_AdditionalAgent*)userContextCallback;
 
-    if (launchArgs->connectionString != NULL)
+    if (componentName == NULL || strcmp(componentName, g_aduPnPComponentName) != 0)
     {
-        ADUC_ConnType connType = GetConnTypeFromConnectionString(launchArgs->connectionString);
-
-        if (connType == ADUC_ConnType_NotSet)
-        {
-            Log_Error("Connection string is invalid");
-            goto done;
-        }
+        return;
+    }
 
-        ADUC_ConnectionInfo connInfo = {
-            ADUC_AuthType_NotSet, connType, launchArgs->connectionString, NULL, NULL, NULL
-        };
+    AzureDeviceUpdateCoreInterface_PropertyUpdateCallback(
+        agent->ClientHandle, propertyName, propertyValue, version, agent->Context);
+}
+
+//
+// Invoked by the IoT SDK when an additional agent's twin - either full twin or a PATCH update - arrives.
+//
+static void AdditionalAgent_DeviceTwin_Callback(
+    DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char* payload, size_t size, void* userContextCallback)
+{
+    static const char* modeledComponents[] = { g_aduPnPComponentName };
+    ADUC_AdditionalAgent* agent = (ADUC_AdditionalAgent*)userContextCallback;
+
+    if (agent->TwinDataCache == NULL)
+    {
+        agent->TwinDataCache = PnP_TwinDataCache_Create();
+    }
+
+    if (!PnP_ProcessTwinData(
+            updateState,
+            payload,
+            size,
+            modeledComponents,
+            ARRAY_SIZE(modeledComponents),
+            AdditionalAgent_PropertyUpdate_Callback,
+            agent,
+            agent->TwinDataCache))
+    {
+        Log_Error("Agent %s: unable to process twin JSON.", agent->Name);
+    }
+
+    ADUC_EventLoop_Wakeup();
+
+    if (!agent->TwinProcessed)
+    {
+        agent->TwinProcessed = true;
+        AzureDeviceUpdateCoreInterface_Connected(agent->Context);
+    }
+}
+
+static void AdditionalAgent_ConnectionStatus_Callback(
+    IOTHUB_CLIENT_CONNECTION_STATUS result, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void* userContextCallback)
+{
+    ADUC_AdditionalAgent* agent = (ADUC_AdditionalAgent*)userContextCallback;
+
+    agent->Connected = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
+    Log_Debug("Agent %s: IotHub connection status: %d, reason:%d", agent->Name, result, reason);
+
+    AzureDeviceUpdateCoreInterface_SetConnected(agent->Context, agent->Connected);
+}
+
+static void AdditionalAgent_Destroy(ADUC_AdditionalAgent* agent)
+{
+    // The client first, so that no callback uses the component once it's destroyed.
+    ADUC_DeviceClient_Destroy(agent->ClientHandle);
+    agent->ClientHandle = NULL;
+
+    if (agent->Context != NULL)
+    {
+        AzureDeviceUpdateCoreInterface_Destroy(&agent->Context);
+    }
+
+    PnP_TwinDataCache_Destroy(agent->TwinDataCache);
+    free(agent->Name);
+    memset(agent, 0, sizeof(*agent));
+}
+
+/**
+ * @brief Creates the client and the 'deviceUpdate' component of an additional agent, whose data folder is
+ * ADUC_DATA_FOLDER/agents/<name>.
+ *
+ * @param[out] agent The agent.
+ * @param agentInfo The agent in the configuration file.
+ * @param launchArgs Launch command-line arguments.
+ * @return _Bool true on success.
+ */
+static _Bool AdditionalAgent_Create(
+    ADUC_AdditionalAgent* agent, const ADUC_AgentInfo* agentInfo, const ADUC_LaunchArguments* launchArgs)
+{
+    _Bool succeeded = false;
+    char dataFolder[PATH_MAX];
+    ADUC_ConnectionInfo info = {};
+
+    memset(agent, 0, sizeof(*agent));
+
+    if (mallocAndStrcpy_s(&agent->Name, agentInfo->name) != 0)
+    {
+        goto done;
+    }
+
+    // The name is a folder name: not empty, and without a path separator.
+    if (agent->Name[0] == '\0' || strchr(agent->Name, '/') != NULL || strcmp(agent->Name, ".") == 0
+        || strcmp(agent->Name, "..") == 0)
+    {
+        Log_Error("Agent '%s': invalid name.", agent->Name);
+        goto done;
+    }
+
+    // The Edge Identity Service only provisions the identity of the first agent.
+    if (agentInfo->connectionType == NULL || strcmp(agentInfo->connectionType, "string") != 0)
+    {
+        Log_Error("Agent %s: the connection type %s is not supported.", agent->Name, agentInfo->connectionType);
+        goto done;
+    }
+
+    if (!GetConnectionInfoFromConnectionString(&info, agentInfo->connectionData))
+    {
+        Log_Error("Agent %s: invalid connection string.", agent->Name);
+        goto done;
+    }
+
+    const int length = snprintf(dataFolder, sizeof(dataFolder), "%s/agents/%s", ADUC_DATA_FOLDER, agent->Name);
+    if (length <= 0 || (size_t)length >= sizeof(dataFolder) || ADUC_SystemUtils_MkDirRecursiveDefault(dataFolder) != 0)
+    {
+        Log_Error("Agent %s: cannot create the data folder.", agent->Name);
+        goto done;
+    }
+
+    if (!ADUC_DeviceClient_CreateHandle(&agent->ClientHandle, &info, launchArgs))
+    {
+        Log_Error("Agent %s: cannot create the IotHub device client.", agent->Name);
+        goto done;
+    }
+
+    if (!AzureDeviceUpdateCoreInterface_CreateForDevice(
+            &agent->Context, agent->ClientHandle, dataFolder, launchArgs->argc, launchArgs->argv))
+    {
+        Log_Error("Agent %s: cannot create the 'deviceUpdate' component.", agent->Name);
+        goto done;
+    }
+
+    // Connects, and retrieves the full twin.
+    if (ClientHandle_SetOption(agent->ClientHandle, OPTION_MODEL_ID, g_aduModelId) != IOTHUB_CLIENT_OK
+        || ClientHandle_SetConnectionStatusCallback(
+               agent->ClientHandle, AdditionalAgent_ConnectionStatus_Callback, agent)
+            != IOTHUB_CLIENT_OK
+        || ClientHandle_SetClientTwinCallback(agent->ClientHandle, AdditionalAgent_DeviceTwin_Callback, agent)
+            != IOTHUB_CLIENT_OK)
+    {
+        Log_Error("Agent %s: cannot register the IotHub callbacks.", agent->Name);
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    ADUC_ConnectionInfo_DeAlloc(&info);
+    return succeeded;
+}
+
+/**
+ * @brief Creates the agents of the configuration file after the first one. An agent that can't be created is skipped,
+ * so that it doesn't keep the others from running.
+ *
+ * @param launchArgs Launch command-line arguments.
+ */
+static void AdditionalAgents_Create(const ADUC_LaunchArguments* launchArgs)
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+
+    if (config == NULL || config->agentCount < 2)
+    {
+        goto done;
+    }
+
+    g_additionalAgents = calloc(config->agentCount - 1, sizeof(*g_additionalAgents));
+    if (g_additionalAgents == NULL)
+    {
+        goto done;
+    }
+
+    for (unsigned int index = 1; index < config->agentCount; ++index)
+    {
+        const ADUC_AgentInfo* agentInfo = ADUC_ConfigInfo_GetAgent(config, index);
+        ADUC_AdditionalAgent* agent = malloc(sizeof(*agent));
+
+        if (agentInfo == NULL || agent == NULL)
+        {
+            free(agent);
+            continue;
+        }
+
+        if (!AdditionalAgent_Create(agent, agentInfo, launchArgs))
+        {
+            Log_Error("Skipping agent %u of the configuration file.", index);
+            AdditionalAgent_Destroy(agent);
+            free(agent);
+            continue;
+        }
+
+        g_additionalAgents[g_additionalAgentCount++] = agent;
+    }
+
+    Log_Info("Hosting %zu additional agents.", g_additionalAgentCount);
+
+done:
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Does the work of the additional agents that is due, at the intervals of the first agent's: their components
+ * at the delay they ask for, and their clients at ADUC_MAIN_LOOP_MIN_INTERVAL_MS while they have outstanding traffic.
+ *
+ * @param wokenUp True if the main loop was woken up, in which case all the work is due.
+ * @param clientIoThread True if the IoT Hub client I/O thread does the work of the clients.
+ * @param now The time, from GetMsSinceStart.
+ * @return unsigned long long When the next work is due, from GetMsSinceStart; ULLONG_MAX for none.
+ */
+static unsigned long long AdditionalAgents_DoWork(_Bool wokenUp, _Bool clientIoThread, unsigned long long now)
+{
+    unsigned long long deadline = ULLONG_MAX;
+
+    for (size_t i = 0; i < g_additionalAgentCount; ++i)
+    {
+        ADUC_AdditionalAgent* agent = g_additionalAgents[i];
+
+        if (wokenUp || now >= agent->NextDoWorkMs)
+        {
+            AzureDeviceUpdateCoreInterface_DoWork(agent->Context);
+
+            const unsigned int delay = AzureDeviceUpdateCoreInterface_GetDoWorkDelay(agent->Context);
+            agent->NextDoWorkMs = (delay == ADUC_EVENT_LOOP_ON_DEMAND) ? ULLONG_MAX : now + delay;
+        }
+
+        if (wokenUp || now >= agent->NextClientDoWorkMs)
+        {
+            ClientHandle_DoWork(agent->ClientHandle);
+
+            IOTHUB_CLIENT_STATUS sendStatus = IOTHUB_CLIENT_SEND_STATUS_IDLE;
+            const _Bool busy = !clientIoThread
+                && (!agent->Connected
+                    || ClientHandle_GetSendStatus(agent->ClientHandle, &sendStatus) != IOTHUB_CLIENT_OK
+                    || sendStatus == IOTHUB_CLIENT_SEND_STATUS_BUSY);
+
+            agent->NextClientDoWorkMs =
+                now + (busy ? ADUC_MAIN_LOOP_MIN_INTERVAL_MS : ADUC_MAIN_LOOP_MAX_IDLE_INTERVAL_MS);
+        }
+
+        if (agent->NextDoWorkMs < deadline)
+        {
+            deadline = agent->NextDoWorkMs;
+        }
+
+        if (agent->NextClientDoWorkMs < deadline)
+        {
+            deadline = agent->NextClientDoWorkMs;
+        }
+    }
+
+    return deadline;
+}
+
+static void AdditionalAgents_Destroy()
+{
+    for (size_t i = 0; i < g_additionalAgentCount; ++i)
+    {
+        AdditionalAgent_Destroy(g_additionalAgents[i]);
+        free(g_additionalAgents[i]);
+    }
+
+    free(g_additionalAgents);
+    g_additionalAgents = NULL;
+    g_additionalAgentCount = 0;
+}
+
+/**
+ * @brief Starts provisioning the connection string from the Edge Identity Service in the background, when the agent
+ * connects with it, so that the requests overlap the rest of the startup and the token is renewed before it expires.
+ * @param launchArgs CLI arguments passed to the client
+ */
+static void StartEISCredentialManager(const ADUC_LaunchArguments* launchArgs)
+{
+    if (launchArgs->connectionString != NULL)
+    {
+        return;
+    }
+
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    const ADUC_AgentInfo* agent = ADUC_ConfigInfo_GetAgent(config, 0);
+    if (agent != NULL && agent->connectionType != NULL && strcmp(agent->connectionType, "AIS") == 0)
+    {
+        if (!EISCredentialManager_Start(EIS_TOKEN_EXPIRY_TIME, EIS_PROVISIONING_TIMEOUT))
+        {
+            Log_Warn("Cannot provision from the Edge Identity Service in the background, provisioning on startup.");
+        }
+    }
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Switches the IoT Hub client to the credentials the Edge Identity Service renewed, if any.
+ * @param launchArgs CLI arguments passed to the client
+ */
+static void SwitchToRenewedCredentials(const ADUC_LaunchArguments* launchArgs)
+{
+    static unsigned long long nextAttemptMs = 0;
+
+    if (g_eisCredentialGeneration == 0 || GetMsSinceStart() < nextAttemptMs)
+    {
+        return;
+    }
+
+    ADUC_ConnectionInfo info = {};
+    unsigned int generation = 0;
+    if (!EISCredentialManager_GetConnectionInfo(g_eisCredentialGeneration, 0, &info, &generation))
+    {
+        return;
+    }
+
+    Log_Info("Switching the IoT Hub connection to the renewed credentials, generation %u.", generation);
+
+    if (ADUC_DeviceClient_Replace(&info, launchArgs))
+    {
+        g_eisCredentialGeneration = generation;
+    }
+    else
+    {
+        Log_Error("Cannot switch to the renewed credentials, keeping the current connection.");
+        nextAttemptMs = GetMsSinceStart() + EIS_CREDENTIAL_SWITCH_RETRY_INTERVAL_MS;
+    }
+
+    ADUC_ConnectionInfo_DeAlloc(&info);
+}
+
+/**
+ * @brief Applies the download settings from the configuration file to the extension manager.
+ */
+static void ConfigureDownloads()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    if (config != NULL)
+    {
+        ExtensionManager_SetMaxConcurrentDownloads(config->maxConcurrentDownloads);
+        ExtensionManager_SetDownloadCacheSizeLimit((uint64_t)config->downloadCacheSizeLimitMB * 1024 * 1024);
+        ExtensionManager_SetDownloadThrottle(
+            (uint64_t)config->downloadBandwidthLimitKBps * 1024,
+            (uint64_t)config->downloadBandwidthLimitPerDownloadKBps * 1024,
+            config->downloadWindows);
+        ExtensionManager_SetDownloadCacheHosts(config->downloadCacheHosts);
+        workflow_set_download_mirrors(config->downloadMirrors);
+        ExtensionManager_SetIdleUnloadTimeout(config->extensionIdleUnloadSeconds);
+        workflow_set_download_start_jitter(config->downloadStartJitterSeconds);
+        ADUC_SystemUtils_SetRamStaging(
+            (uint64_t)config->ramStagingThresholdKB * 1024, (uint64_t)config->ramStagingBudgetMB * 1024 * 1024);
+        ExtensionManager_SetDownloadProgressInterval(
+            config->downloadProgressIntervalMs, config->downloadProgressPercentStep);
+    }
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Applies the metrics settings from the configuration file.
+ */
+static void ConfigureMetrics()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+
+    g_metricsTelemetryIntervalMs =
+        config != NULL ? (unsigned long long)config->metricsTelemetryIntervalSeconds * 1000 : 0;
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Applies the progress telemetry settings from the configuration file.
+ */
+static void ConfigureProgressTelemetry()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+
+    g_progressTelemetryIntervalMs =
+        config != NULL ? (unsigned long long)config->progressTelemetryIntervalSeconds * 1000 : 0;
+
+    g_progressTelemetryMaxBytes = (config == NULL || config->progressTelemetryMaxBytes == 0)
+        ? ADUC_PROGRESS_TELEMETRY_DEFAULT_MAX_BYTES
+        : config->progressTelemetryMaxBytes;
+
+    if (g_progressTelemetryMaxBytes > ADUC_PROGRESS_TELEMETRY_LIMIT_MAX_BYTES)
+    {
+        Log_Warn(
+            "progressTelemetryMaxBytes %zu is larger than the IoT Hub message limit, using %d",
+            g_progressTelemetryMaxBytes,
+            ADUC_PROGRESS_TELEMETRY_LIMIT_MAX_BYTES);
+        g_progressTelemetryMaxBytes = ADUC_PROGRESS_TELEMETRY_LIMIT_MAX_BYTES;
+    }
+
+    // Records are only buffered while they're sent, so the buffer doesn't fill up for nothing.
+    ADUC_ProgressTelemetry_SetEnabled(g_progressTelemetryIntervalMs != 0);
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Applies the workflow memory budget from the configuration file.
+ */
+static void ConfigureWorkflowMemoryBudget()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+
+    workflow_set_memory_budget(config != NULL ? (size_t)config->workflowMemoryBudgetMB * 1024 * 1024 : 0);
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Applies the size limit of the log of each workflow from the configuration file, from the next workflow on.
+ */
+static void ConfigureWorkflowLog()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+
+    workflow_set_log_size_limit(config != NULL ? (size_t)config->workflowLogSizeLimitKB * 1024 : 0);
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Applies how long the enumeration of the components waits for each component enumerator.
+ */
+static void ConfigureComponentEnumerators()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    if (config != NULL)
+    {
+        ExtensionManager_SetComponentEnumeratorTimeout(config->componentEnumeratorTimeoutMs);
+    }
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Applies the default operation timeouts from the configuration file, from the next operation on.
+ */
+static void ConfigureOperationTimeouts()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+
+    workflow_set_default_operation_timeout(
+        ADUCITF_WorkflowStep_Download, config != NULL ? config->downloadTimeoutSeconds : 0);
+    workflow_set_default_operation_timeout(
+        ADUCITF_WorkflowStep_Install, config != NULL ? config->installTimeoutSeconds : 0);
+    workflow_set_default_operation_timeout(
+        ADUCITF_WorkflowStep_Apply, config != NULL ? config->applyTimeoutSeconds : 0);
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Applies the resource sample interval from the configuration file, from the next deployment on.
+ */
+static void ConfigureResourceSampler()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+
+    ADUC_ResourceSampler_SetInterval(config != NULL ? config->resourceSampleIntervalSeconds : 0);
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Applies the CPUs of the compute and I/O threads from the configuration file; the threads move to them at
+ * their next unit of work.
+ */
+static void ConfigureThreadAffinity()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+
+    if (!ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_Compute, config != NULL ? config->computeThreadCpus : NULL))
+    {
+        Log_Warn("Ignoring invalid computeThreadCpus '%s'", config->computeThreadCpus);
+    }
+
+    if (!ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, config != NULL ? config->ioThreadCpus : NULL))
+    {
+        Log_Warn("Ignoring invalid ioThreadCpus '%s'", config->ioThreadCpus);
+    }
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Seeds the defaults of the configuration with the performance profile of the device, measured at the first
+ * start. The fields of the configuration file override them.
+ */
+static void ConfigurePerformanceProfile()
+{
+    ADUC_PerfProfile profile;
+    JSON_Value* defaults = NULL;
+
+    if (ADUC_SystemUtils_MkDirRecursiveDefault(ADUC_DATA_FOLDER) != 0
+        || !ADUC_PerfProfile_LoadOrMeasure(&profile, ADUC_DATA_FOLDER "/perf-profile.json", ADUC_DATA_FOLDER))
+    {
+        Log_Warn("No performance profile, using the built-in defaults.");
+        return;
+    }
+
+    defaults = ADUC_PerfProfile_GetConfigDefaults(&profile);
+    ADUC_ConfigInfo_SetDefaults(defaults);
+    json_value_free(defaults);
+}
+
+/**
+ * @brief Applies the temperature and battery limits of heavy work from the configuration file.
+ */
+static void ConfigureThermalLimits()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+
+    ADUC_Thermal_SetLimits(
+        config != NULL ? config->heavyWorkMaxTemperatureC : 0, config != NULL ? config->heavyWorkMinBatteryPercent : 0);
+
+    // Called from the main loop, which must keep processing the twin and cancels while the device is hot.
+    ADUC_Thermal_ExcludeCurrentThread();
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Updates the memory gauges of the metrics.
+ */
+static void UpdateMemoryMetrics()
+{
+    struct rusage usage;
+
+    ADUC_Metrics_SetGauge(ADUC_MetricsGauge_JsonAllocatedBytes, ADUC_JSON_GetAllocatedBytes());
+
+    // ru_maxrss is in KiB on Linux.
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        ADUC_Metrics_SetGauge(ADUC_MetricsGauge_PeakRssBytes, (uint64_t)usage.ru_maxrss * 1024);
+    }
+}
+
+/**
+ * @brief Sends the metrics, see ADUC_Metrics_GetTelemetry, as a telemetry message.
+ */
+static void SendMetricsTelemetry()
+{
+    JSON_Value* telemetryValue = ADUC_Metrics_GetTelemetry();
+    char* telemetry = NULL;
+    IOTHUB_MESSAGE_HANDLE messageHandle = NULL;
+
+    if (telemetryValue == NULL)
+    {
+        goto done;
+    }
+
+    telemetry = json_serialize_to_string(telemetryValue);
+    if (telemetry == NULL)
+    {
+        goto done;
+    }
+
+    // Sent from the root component, which no model defines telemetry for, rather than from deviceUpdate.
+    messageHandle = PnP_CreateTelemetryMessageHandle(NULL, telemetry);
+    if (messageHandle == NULL)
+    {
+        goto done;
+    }
+
+    if (ClientHandle_SendEventAsync(g_iotHubClientHandle, messageHandle, NULL, NULL) != IOTHUB_CLIENT_OK)
+    {
+        Log_Warn("Cannot send the metrics telemetry.");
+    }
+
+done:
+    if (messageHandle != NULL)
+    {
+        IoTHubMessage_Destroy(messageHandle);
+    }
+
+    json_free_serialized_string(telemetry);
+    json_value_free(telemetryValue);
+}
+
+/**
+ * @brief Writes the metrics file every ADUC_METRICS_FILE_INTERVAL_SEC, and sends the metrics telemetry at the
+ * configured interval while connected. Called from the main loop.
+ */
+static void ReportMetrics()
+{
+    static unsigned long long lastFileWriteMs = 0;
+    static unsigned long long lastTelemetryMs = 0;
+    const unsigned long long nowMs = GetMsSinceStart();
+
+    if (lastFileWriteMs == 0 || nowMs - lastFileWriteMs >= ADUC_METRICS_FILE_INTERVAL_SEC * 1000ULL)
+    {
+        lastFileWriteMs = nowMs;
+
+        // zlog keeps its own counts. It never drops lines for lack of room: they wait for it instead.
+        ADUC_Metrics_SetCounter(ADUC_MetricsCounter_LogRingFullWaits, Log_GetRingFullWaitCount());
+        ADUC_Metrics_SetCounter(ADUC_MetricsCounter_LogLinesSuppressed, Log_GetSuppressedLineCount());
+        UpdateMemoryMetrics();
+        ADUC_Metrics_WritePrometheusFile(ADUC_LOG_FOLDER "/" ADUC_METRICS_FILE_NAME);
+    }
+
+    if (g_metricsTelemetryIntervalMs != 0 && g_iotHubConnected
+        && nowMs - lastTelemetryMs >= g_metricsTelemetryIntervalMs)
+    {
+        lastTelemetryMs = nowMs;
+
+        ADUC_Metrics_SetCounter(ADUC_MetricsCounter_LogRingFullWaits, Log_GetRingFullWaitCount());
+        ADUC_Metrics_SetCounter(ADUC_MetricsCounter_LogLinesSuppressed, Log_GetSuppressedLineCount());
+        UpdateMemoryMetrics();
+        SendMetricsTelemetry();
+    }
+}
+
+/**
+ * @brief Sends the buffered progress records, see ADUC_ProgressTelemetry_TakeBatch, as a telemetry message at the
+ * configured interval while connected. Called from the main loop.
+ */
+static void ReportProgressTelemetry()
+{
+    static unsigned long long lastTelemetryMs = 0;
+    const unsigned long long nowMs = GetMsSinceStart();
+    char* telemetry = NULL;
+    IOTHUB_MESSAGE_HANDLE messageHandle = NULL;
+
+    if (g_progressTelemetryIntervalMs == 0 || !g_iotHubConnected
+        || nowMs - lastTelemetryMs < g_progressTelemetryIntervalMs)
+    {
+        return;
+    }
+
+    lastTelemetryMs = nowMs;
+
+    // Records that don't fit in the message are sent at the next interval.
+    telemetry = ADUC_ProgressTelemetry_TakeBatch(g_progressTelemetryMaxBytes);
+    if (telemetry == NULL)
+    {
+        goto done;
+    }
+
+    messageHandle = PnP_CreateTelemetryMessageHandle(NULL, telemetry);
+    if (messageHandle == NULL)
+    {
+        goto done;
+    }
+
+    if (ClientHandle_SendEventAsync(g_iotHubClientHandle, messageHandle, NULL, NULL) != IOTHUB_CLIENT_OK)
+    {
+        Log_Warn("Cannot send the progress telemetry.");
+    }
+
+done:
+    if (messageHandle != NULL)
+    {
+        IoTHubMessage_Destroy(messageHandle);
+    }
+
+    json_free_serialized_string(telemetry);
+}
+
+/**
+ * @brief Handles the startup of the agent
+ * @details Provisions the connection string with the CLI or either
+ * the Edge Identity Service or the configuration file
+ * @param launchArgs CLI arguments passed to the client
+ * @returns _Bool true on success.
+ */
+_Bool StartupAgent(const ADUC_LaunchArguments* launchArgs)
+{
+    _Bool succeeded = false;
+
+    ADUC_ConnectionInfo info = {};
+
+    const ADUC_ConfigInfo* config = NULL;
+
+    if (launchArgs->connectionString != NULL)
+    {
+        ADUC_ConnType connType = GetConnTypeFromConnectionString(launchArgs->connectionString);
+
+        if (connType == ADUC_ConnType_NotSet)
+        {
+            Log_Error("Connection string is invalid");
+            goto done;
+        }
+
+        ADUC_ConnectionInfo connInfo = {
+            ADUC_AuthType_NotSet, connType, launchArgs->connectionString, NULL, NULL, NULL
+        };
 
         if (!ADUC_SetDiagnosticsDeviceNameFromConnectionString(connInfo.connectionString))
         {
@@ -904,7 +1989,13 @@ _Bool StartupAgent(const ADUC_LaunchArguments* launchArgs)
             goto done;
         }
 
-        if (!ADUC_DeviceClient_Create(&connInfo, launchArgs))
+        SetWorkflowDeviceIdFromConnectionString(connInfo.connectionString);
+
+        StartupProfile_BeginPhase(ADUC_StartupPhase_IotClientCreation);
+        const _Bool created = ADUC_DeviceClient_Create(&connInfo, launchArgs);
+        StartupProfile_EndPhase(ADUC_StartupPhase_IotClientCreation);
+
+        if (!created)
         {
             Log_Error("ADUC_DeviceClient_Create failed");
             goto done;
@@ -912,13 +2003,14 @@ _Bool StartupAgent(const ADUC_LaunchArguments* launchArgs)
     }
     else
     {
-        if (!ADUC_ConfigInfo_Init(&config, ADUC_CONF_FILE_PATH))
+        config = ADUC_ConfigInfo_GetInstance();
+        if (config == NULL)
         {
             Log_Error("No connnection string set from launch arguments or configuration file");
             goto done;
         }
 
-        const ADUC_AgentInfo* agent = ADUC_ConfigInfo_GetAgent(&config, 0);
+        const ADUC_AgentInfo* agent = ADUC_ConfigInfo_GetAgent(config, 0);
         if (agent == NULL)
         {
             Log_Error("ADUC_ConfigInfo_GetAgent failed to get the agent information.");
@@ -926,7 +2018,15 @@ _Bool StartupAgent(const ADUC_LaunchArguments* launchArgs)
         }
         if (strcmp(agent->connectionType, "AIS") == 0)
         {
-            if (!GetConnectionInfoFromIdentityService(&info))
+            // The IoT Hub client switches to the credentials the manager renews, see SwitchToRenewedCredentials.
+            StartupProfile_BeginPhase(ADUC_StartupPhase_EisProvisioning);
+            const _Bool provisioned = EISCredentialManager_IsStarted()
+                ? EISCredentialManager_GetConnectionInfo(
+                    0, EIS_PROVISIONING_WAIT_TIME, &info, &g_eisCredentialGeneration)
+                : GetConnectionInfoFromIdentityService(&info);
+            StartupProfile_EndPhase(ADUC_StartupPhase_EisProvisioning);
+
+            if (!provisioned)
             {
                 Log_Error("Failed to get connection information from AIS.");
                 goto done;
@@ -951,7 +2051,13 @@ _Bool StartupAgent(const ADUC_LaunchArguments* launchArgs)
             goto done;
         }
 
-        if (!ADUC_DeviceClient_Create(&info, launchArgs))
+        SetWorkflowDeviceIdFromConnectionString(info.connectionString);
+
+        StartupProfile_BeginPhase(ADUC_StartupPhase_IotClientCreation);
+        const _Bool created = ADUC_DeviceClient_Create(&info, launchArgs);
+        StartupProfile_EndPhase(ADUC_StartupPhase_IotClientCreation);
+
+        if (!created)
         {
             Log_Error("ADUC_DeviceClient_Create failed");
             goto done;
@@ -962,6 +2068,7 @@ _Bool StartupAgent(const ADUC_LaunchArguments* launchArgs)
 
     // The connection string is valid (IoT hub connection successful) and we are ready for further processing.
     // Send connection string to DO SDK for it to discover the Edge gateway if present.
+    StartupProfile_BeginPhase(ADUC_StartupPhase_ExtensionRegistration);
     if (ConnectionStringUtils_IsNestedEdge(info.connectionString))
     {
         result = ExtensionManager_InitializeContentDownloader(info.connectionString);
@@ -970,6 +2077,7 @@ _Bool StartupAgent(const ADUC_LaunchArguments* launchArgs)
     {
         result = ExtensionManager_InitializeContentDownloader(NULL /*initializeData*/);
     }
+    StartupProfile_EndPhase(ADUC_StartupPhase_ExtensionRegistration);
 
     if (IsAducResultCodeFailure(result.ResultCode))
     {
@@ -979,26 +2087,115 @@ _Bool StartupAgent(const ADUC_LaunchArguments* launchArgs)
         goto done;
     }
 
+    ConfigureDownloads();
+    ConfigureMetrics();
+    ConfigureProgressTelemetry();
+    ConfigureWorkflowMemoryBudget();
+    ConfigureWorkflowLog();
+    ConfigureComponentEnumerators();
+    ConfigureOperationTimeouts();
+    ConfigureResourceSampler();
+    ConfigureThreadAffinity();
+    ConfigureThermalLimits();
+
+    // With a connection string from the launch arguments, the configuration file's agents aren't used.
+    if (launchArgs->connectionString == NULL)
+    {
+        AdditionalAgents_Create(launchArgs);
+    }
+
+    // Verify and load the content handlers while the agent connects, rather than when the first workflow needs them.
+    const ADUC_ConfigInfo* preloadConfig = ADUC_ConfigInfo_GetInstance();
+    if (preloadConfig != NULL && preloadConfig->preloadContentHandlers)
+    {
+        StartupProfile_BeginPhase(ADUC_StartupPhase_ExtensionRegistration);
+        ExtensionManager_PreloadUpdateContentHandlers();
+        StartupProfile_EndPhase(ADUC_StartupPhase_ExtensionRegistration);
+    }
+    ADUC_ConfigInfo_ReleaseInstance(preloadConfig);
+
     succeeded = true;
 
 done:
 
     ADUC_ConnectionInfo_DeAlloc(&info);
-    ADUC_ConfigInfo_UnInit(&config);
+    ADUC_ConfigInfo_ReleaseInstance(config);
     return succeeded;
 }
 
+/**
+ * @brief Runs HealthCheck, timed as a startup phase.
+ */
+static _Bool ProfiledHealthCheck(const ADUC_LaunchArguments* launchArgs)
+{
+    StartupProfile_BeginPhase(ADUC_StartupPhase_HealthCheck);
+    const _Bool healthy = HealthCheck(launchArgs);
+    StartupProfile_EndPhase(ADUC_StartupPhase_HealthCheck);
+
+    return healthy;
+}
+
+/**
+ * @brief Runs the health check of a ADUC_HealthCheckTask; the body of its thread.
+ *
+ * @param arg The ADUC_HealthCheckTask.
+ * @return void* NULL.
+ */
+static void* HealthCheckThread(void* arg)
+{
+    ADUC_HealthCheckTask* task = (ADUC_HealthCheckTask*)arg;
+
+    task->Healthy = ProfiledHealthCheck(task->LaunchArgs);
+    Log_Info("Health check finished %llu ms after start.", GetMsSinceStart());
+
+    return NULL;
+}
+
+/**
+ * @brief Returns whether fastBoot is set in the configuration file.
+ */
+static _Bool IsFastBootEnabled()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    const _Bool enabled = config != NULL && config->fastBoot;
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+
+    return enabled;
+}
+
+/**
+ * @brief Returns whether iotHubClientIoThread is set in the configuration file.
+ */
+static _Bool IsIotHubClientIoThreadEnabled()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    const _Bool enabled = config != NULL && config->iotHubClientIoThread;
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+
+    return enabled;
+}
+
 /**
  * @brief Called at agent shutdown.
  */
 void ShutdownAgent()
 {
     Log_Info("Agent is shutting down with signal %d.", g_shutdownSignal);
+    AdditionalAgents_Destroy();
     ADUC_PnP_Components_Destroy();
     ADUC_DeviceClient_Destroy(g_iotHubClientHandle);
+    EISCredentialManager_Stop();
+    PnP_TwinDataCache_Destroy(g_twinDataCache);
+    g_twinDataCache = NULL;
     DiagnosticsComponent_DestroyDeviceName();
     ADUC_Logging_Uninit();
     ExtensionManager_Uninit();
+    UninitVerifiedJWSCache();
+    ADUC_DownloadVerifiedFile_UninitStore();
+    ADUC_ResourceSampler_Stop();
+    ADUC_ConfigInfo_UnloadInstance();
 }
 
 /**
@@ -1010,6 +2207,7 @@ void OnShutdownSignal(int sig)
 {
     // Main loop will break once this becomes true.
     g_shutdownSignal = sig;
+    ADUC_EventLoop_Wakeup();
 }
 
 /**
@@ -1023,6 +2221,21 @@ void OnRestartSignal(int sig)
     // adu-agent.service file to instruct systemd to restart the agent.
     Log_Info("Restart signal detect.");
     g_shutdownSignal = sig;
+    ADUC_EventLoop_Wakeup();
+}
+
+/**
+ * @brief Called when a reload configuration (SIGHUP) signal is detected.
+ *
+ * @param sig Signal value.
+ */
+void OnReloadConfigSignal(int sig)
+{
+    UNREFERENCED_PARAMETER(sig);
+
+    // Main loop reloads the configuration once this becomes true.
+    g_reloadConfigSignal = 1;
+    ADUC_EventLoop_Wakeup();
 }
 
 //
@@ -1042,6 +2255,11 @@ void OnRestartSignal(int sig)
  */
 int main(int argc, char** argv)
 {
+    clock_gettime(CLOCK_MONOTONIC, &g_startTime);
+
+    // Before any JSON value is allocated, so that they are all counted.
+    ADUC_JSON_EnableAllocationAccounting();
+
     InititalizeModeledComponents();
 
     ADUC_LaunchArguments launchArgs;
@@ -1088,7 +2306,11 @@ int main(int argc, char** argv)
 
     if (launchArgs.componentEnumeratorFilePath != NULL)
     {
-        if (RegisterComponentEnumeratorExtension(launchArgs.componentEnumeratorFilePath))
+        // With an id, the enumerator is registered in addition to the others, which all enumerate in parallel.
+        if (launchArgs.componentEnumeratorId != NULL
+                ? RegisterAdditionalComponentEnumeratorExtension(
+                    launchArgs.componentEnumeratorId, launchArgs.componentEnumeratorFilePath)
+                : RegisterComponentEnumeratorExtension(launchArgs.componentEnumeratorFilePath))
         {
             return 0;
         }
@@ -1112,7 +2334,35 @@ int main(int argc, char** argv)
 #endif
     Log_Info("Agent built with handlers: %s.", ADUC_CONTENT_HANDLERS);
 
-    _Bool healthy = HealthCheck(&launchArgs);
+    // Before the configuration is first loaded, so that its defaults suit the device.
+    ConfigurePerformanceProfile();
+
+    // Before any hashing, which then uses the SoC's hash engine when the kernel drives one faster than the CPU hashes.
+    (void)ADUC_HashUtils_SelectKernelBackend();
+
+    // Loads the configuration here, rather than in whichever component first reads it, to time it on its own.
+    g_startupProfileEnabled = launchArgs.profileStartup;
+    StartupProfile_BeginPhase(ADUC_StartupPhase_ConfigParsing);
+    ADUC_ConfigInfo_ReleaseInstance(ADUC_ConfigInfo_GetInstance());
+    StartupProfile_EndPhase(ADUC_StartupPhase_ConfigParsing);
+
+    StartEISCredentialManager(&launchArgs);
+
+    // With fastBoot, the health check runs while the connection is set up, and the main loop, which connects
+    // and processes the twin, only starts once it passed.
+    ADUC_HealthCheckTask healthCheckTask = { &launchArgs };
+    _Bool healthCheckPending = false;
+
+    if (IsFastBootEnabled())
+    {
+        healthCheckPending = pthread_create(&healthCheckTask.Thread, NULL, HealthCheckThread, &healthCheckTask) == 0;
+        if (!healthCheckPending)
+        {
+            Log_Warn("Cannot start health check thread, checking health now.");
+        }
+    }
+
+    _Bool healthy = healthCheckPending || ProfiledHealthCheck(&launchArgs);
     if (launchArgs.healthCheckOnly || !healthy)
     {
         if (healthy)
@@ -1137,6 +2387,15 @@ int main(int argc, char** argv)
         goto done;
     }
 
+    // Retried, re-sent and resumed deployments then skip verifying the signature of a manifest verified before.
+    InitVerifiedJWSCache(ADUC_DATA_FOLDER "/verifiedmanifests.json");
+
+    // Likewise, downloaded files verified before and unchanged since aren't hashed again.
+    ADUC_DownloadVerifiedFile_InitStore(ADUC_DATA_FOLDER "/verifiedfiles");
+
+    // Lets worker threads, callbacks and signals wake up the main loop. On failure, the loop just polls.
+    ADUC_EventLoop_Init();
+
     //
     // Catch ctrl-C and shutdown signals so we do a best effort of cleanup.
     //
@@ -1148,47 +2407,186 @@ int main(int argc, char** argv)
     //
     signal(SIGUSR1, OnRestartSignal);
 
+    //
+    // Catch reload configuration (SIGHUP) signal.
+    //
+    signal(SIGHUP, OnReloadConfigSignal);
+
     if (!StartupAgent(&launchArgs))
     {
         goto done;
     }
 
+    Log_Info("Agent started up %llu ms after start.", GetMsSinceStart());
+
+    if (healthCheckPending)
+    {
+        pthread_join(healthCheckTask.Thread, NULL);
+        healthCheckPending = false;
+
+        if (!healthCheckTask.Healthy)
+        {
+            Log_Error("Agent health check failed.");
+            ret = 1;
+            goto done;
+        }
+    }
+
     //
     // Main Loop
     //
 
+    // With the I/O thread, slow components don't delay keep-alives and acknowledgements. Its callbacks wake up the
+    // main loop, and still run in ClientHandle_DoWork.
+    _Bool clientIoThread = false;
+    if (IsIotHubClientIoThreadEnabled())
+    {
+        clientIoThread = ClientHandle_StartIoThread(ADUC_EventLoop_Wakeup);
+        if (!clientIoThread)
+        {
+            Log_Warn("Cannot start the IoT Hub client I/O thread, the main loop pumps the client");
+        }
+    }
+
     Log_Info("Agent running.");
+    unsigned int clientDoWorkInterval = ADUC_MAIN_LOOP_MIN_INTERVAL_MS;
+    unsigned long long nextClientDoWorkMs = 0;
+    _Bool wokenUp = true;
     while (g_shutdownSignal == 0)
     {
-        // If any components have requested a DoWork callback, regularly call it.
+        if (g_reloadConfigSignal != 0)
+        {
+            g_reloadConfigSignal = 0;
+
+            // Components get the new configuration the next time they read it. The connection isn't re-established.
+            if (ADUC_ConfigInfo_LoadInstance(ADUC_CONF_FILE_PATH))
+            {
+                Log_Info("Reloaded configuration file %s", ADUC_CONF_FILE_PATH);
+                ConfigureDownloads();
+                ConfigureMetrics();
+                ConfigureProgressTelemetry();
+                ConfigureWorkflowMemoryBudget();
+                ConfigureWorkflowLog();
+                ConfigureComponentEnumerators();
+                ConfigureOperationTimeouts();
+                ConfigureResourceSampler();
+                ConfigureThreadAffinity();
+                ConfigureThermalLimits();
+            }
+            else
+            {
+                Log_Error(
+                    "Cannot reload configuration file %s, keeping the current configuration", ADUC_CONF_FILE_PATH);
+            }
+        }
+
+        unsigned long long now = GetMsSinceStart();
+
+        // Components get DoWork when woken up, or once the delay they asked for after their last DoWork elapsed.
         for (unsigned index = 0; index < ARRAY_SIZE(componentList); ++index)
         {
             PnPComponentEntry* entry = componentList + index;
 
-            if (entry->DoWork != NULL)
+            if (entry->DoWork != NULL && (wokenUp || now >= entry->NextDoWorkMs))
             {
                 entry->DoWork(entry->Context);
+
+                unsigned int delay = ADUC_MAIN_LOOP_MIN_INTERVAL_MS;
+                if (entry->GetDoWorkDelay != NULL)
+                {
+                    delay = entry->GetDoWorkDelay(entry->Context);
+                }
+
+                entry->NextDoWorkMs = (delay == ADUC_EVENT_LOOP_ON_DEMAND) ? ULLONG_MAX : now + delay;
             }
         }
 
-        ClientHandle_DoWork(g_iotHubClientHandle);
+        SwitchToRenewedCredentials(&launchArgs);
 
         // NOTE: When using low level samples (iothub_ll_*), the IoTHubDeviceClient_LL_DoWork
         // function must be called regularly (eg. every 100 milliseconds) for the IoT device client to work properly.
         // See: https://github.com/Azure/azure-iot-sdk-c/tree/master/iothub_client/samples
         // NOTE: For this example the above has been wrapped to support module and device client methods using
         // the clienty_handle_helper.h function ClientHandle_DoWork()
+        //
+        // That rate is only needed while there is outstanding traffic. Otherwise, the interval doubles up to
+        // ADUC_MAIN_LOOP_MAX_IDLE_INTERVAL_MS.
+        if (wokenUp || now >= nextClientDoWorkMs)
+        {
+            // The DoWork after the first reported state was queued sends it.
+            const _Bool reportedStateQueued = g_startupProfileEnabled && ClientHandle_GetReportedStateCount() != 0;
+
+            ClientHandle_DoWork(g_iotHubClientHandle);
+
+            if (reportedStateQueued)
+            {
+                StartupProfile_EndPhase(ADUC_StartupPhase_FirstReportedProperty);
+                StartupProfile_Print();
+            }
+
+            IOTHUB_CLIENT_STATUS sendStatus = IOTHUB_CLIENT_SEND_STATUS_IDLE;
+            if (clientIoThread)
+            {
+                // Only runs the queued callbacks, which wake the loop up.
+                clientDoWorkInterval = ADUC_MAIN_LOOP_MAX_IDLE_INTERVAL_MS;
+            }
+            else if (wokenUp || !g_iotHubConnected
+                || ClientHandle_GetSendStatus(g_iotHubClientHandle, &sendStatus) != IOTHUB_CLIENT_OK
+                || sendStatus == IOTHUB_CLIENT_SEND_STATUS_BUSY)
+            {
+                clientDoWorkInterval = ADUC_MAIN_LOOP_MIN_INTERVAL_MS;
+            }
+            else if (clientDoWorkInterval < ADUC_MAIN_LOOP_MAX_IDLE_INTERVAL_MS)
+            {
+                clientDoWorkInterval = (clientDoWorkInterval * 2 < ADUC_MAIN_LOOP_MAX_IDLE_INTERVAL_MS)
+                    ? clientDoWorkInterval * 2
+                    : ADUC_MAIN_LOOP_MAX_IDLE_INTERVAL_MS;
+            }
+
+            nextClientDoWorkMs = now + clientDoWorkInterval;
+        }
 
-        ThreadAPI_Sleep(100);
+        const unsigned long long additionalAgentsDeadline = AdditionalAgents_DoWork(wokenUp, clientIoThread, now);
+
+        ReportMetrics();
+
+        ReportProgressTelemetry();
+
+        // Sleep until the next DoWork is due. Completed operations, twin updates and signals wake the loop up right
+        // away.
+        unsigned long long deadline =
+            (additionalAgentsDeadline < nextClientDoWorkMs) ? additionalAgentsDeadline : nextClientDoWorkMs;
+        for (unsigned index = 0; index < ARRAY_SIZE(componentList); ++index)
+        {
+            if (componentList[index].DoWork != NULL && componentList[index].NextDoWorkMs < deadline)
+            {
+                deadline = componentList[index].NextDoWorkMs;
+            }
+        }
+
+        now = GetMsSinceStart();
+        wokenUp = ADUC_EventLoop_Wait((deadline > now) ? (unsigned int)(deadline - now) : 0);
     };
 
     ret = 0; // Success.
 
 done:
+    if (healthCheckPending)
+    {
+        pthread_join(healthCheckTask.Thread, NULL);
+    }
+
+    // The agent didn't get that far, e.g. it couldn't connect.
+    StartupProfile_Print();
+
     Log_Info("Agent exited with code %d", ret);
 
+    ClientHandle_StopIoThread();
+
     ShutdownAgent();
 
+    ADUC_EventLoop_UnInit();
+
     IoTHub_Deinit();
 
     return ret;
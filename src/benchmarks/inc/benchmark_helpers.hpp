@@ -0,0 +1,55 @@
+/**
+ * @file benchmark_helpers.hpp
+ * @brief Helpers shared by the microbenchmarks.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_BENCHMARK_HELPERS_HPP
+#define ADUC_BENCHMARK_HELPERS_HPP
+
+#include <string>
+
+namespace ADUC
+{
+namespace Benchmarks
+{
+/**
+ * @brief A folder under /tmp for the files of a benchmark, removed with its content on destruction.
+ */
+class TempFolder
+{
+public:
+    TempFolder();
+    ~TempFolder();
+
+    TempFolder(const TempFolder&) = delete;
+    TempFolder& operator=(const TempFolder&) = delete;
+    TempFolder(TempFolder&&) = delete;
+    TempFolder& operator=(TempFolder&&) = delete;
+
+    /**
+     * @brief Returns the path of the folder.
+     */
+    const std::string& Path() const
+    {
+        return _path;
+    }
+
+private:
+    std::string _path;
+};
+
+/**
+ * @brief Writes @p size pseudo-random bytes to the file @p path, replacing it.
+ *
+ * @param path The path of the file.
+ * @param size The size of the file, in bytes.
+ * @returns True on success.
+ */
+bool WriteRandomFile(const std::string& path, size_t size);
+
+} // namespace Benchmarks
+} // namespace ADUC
+
+#endif // ADUC_BENCHMARK_HELPERS_HPP
@@ -0,0 +1,72 @@
+/**
+ * @file benchmark_helpers.cpp
+ * @brief Implements the helpers shared by the microbenchmarks.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "benchmark_helpers.hpp"
+
+#include <algorithm> // for std::min
+#include <cstdint>
+#include <cstdio> // for remove
+#include <cstdlib> // for mkdtemp
+#include <fstream>
+#include <ftw.h> // for nftw
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace ADUC
+{
+namespace Benchmarks
+{
+static int RemoveEntry(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+TempFolder::TempFolder()
+{
+    std::string folderTemplate{ "/tmp/aduc-benchmark-XXXXXX" };
+    if (mkdtemp(&folderTemplate[0]) == nullptr)
+    {
+        throw std::runtime_error("Cannot create the benchmark folder.");
+    }
+
+    _path = folderTemplate;
+}
+
+TempFolder::~TempFolder()
+{
+    // Children first, so that folders are empty when removed.
+    (void)nftw(_path.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+bool WriteRandomFile(const std::string& path, size_t size)
+{
+    std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+    std::mt19937_64 generator{ size };
+    std::vector<uint64_t> chunk(64 * 1024 / sizeof(uint64_t));
+
+    for (size_t written = 0; written < size && file;)
+    {
+        for (uint64_t& value : chunk)
+        {
+            value = generator();
+        }
+
+        const size_t chunkSize = std::min(size - written, chunk.size() * sizeof(uint64_t));
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        file.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(chunkSize));
+        written += chunkSize;
+    }
+
+    return static_cast<bool>(file);
+}
+
+} // namespace Benchmarks
+} // namespace ADUC
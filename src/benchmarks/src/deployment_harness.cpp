@@ -0,0 +1,828 @@
+/**
+ * @file deployment_harness.cpp
+ * @brief Replays synthetic deployments end to end, through the content downloader and the simulator handler, and
+ * reports where the time goes: the duration of each workflow phase, the peak RSS and the CPU time per MB.
+ *
+ * The files of the deployments are served by a local HTTP server, in a child process so that its CPU time isn't
+ * counted. The deployments are generated from a seed, so that runs are reproducible and can be compared.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "benchmark_helpers.hpp"
+
+#include <aduc/content_downloader_extension.hpp>
+#include <aduc/content_handler.hpp>
+#include <aduc/hash_utils.h>
+#include <aduc/logging.h>
+#include <aduc/timing_utils.h>
+#include <aduc/types/workflow.h>
+#include <aduc/workflow_utils.h>
+#include <parson.h>
+
+#include <algorithm> // for std::sort
+#include <arpa/inet.h> // for htonl
+#include <cmath> // for std::exp, std::log
+#include <csignal> // for kill, SIGTERM
+#include <cstdio>
+#include <cstdlib> // for free, strtoul
+#include <cstring> // for strcmp, strstr
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <netinet/in.h> // for sockaddr_in
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/resource.h> // for getrusage
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h> // for waitpid
+#include <unistd.h>
+#include <vector>
+
+#ifndef ADUC_HARNESS_DOWNLOADER_PATH
+#    define ADUC_HARNESS_DOWNLOADER_PATH "/var/lib/adu/extensions/sources/libcurl-content-downloader.so"
+#endif
+
+#ifndef ADUC_HARNESS_HANDLER_PATH
+#    define ADUC_HARNESS_HANDLER_PATH "libmicrosoft_simulator_1.so"
+#endif
+
+using ADUC::Benchmarks::TempFolder;
+using ADUC::Benchmarks::WriteRandomFile;
+
+typedef ContentHandler* (*CreateUpdateContentHandlerExtensionProc)(ADUC_LOG_SEVERITY logLevel);
+
+/**
+ * @brief The phases of a deployment the harness times.
+ */
+enum HarnessPhase
+{
+    HarnessPhase_Parse = 0, /**< Parsing the deployment into a workflow. */
+    HarnessPhase_Download, /**< Downloading the files, by the content downloader. */
+    HarnessPhase_Verify, /**< Verifying the hashes the downloader didn't verify. */
+    HarnessPhase_Install, /**< Installing the steps, by the simulator handler. */
+    HarnessPhase_Apply, /**< Applying the steps, by the simulator handler. */
+    HarnessPhase_Count
+};
+
+static const char* const PhaseNames[HarnessPhase_Count] = { "parse", "download", "verify", "install", "apply" };
+
+/**
+ * @brief The options of the harness.
+ */
+struct HarnessOptions
+{
+    unsigned int deployments = 10; /**< The number of deployments to replay. */
+    unsigned int seed = 1; /**< The seed the deployments are generated from. */
+    unsigned int maxSteps = 5; /**< The maximum number of steps of a deployment. */
+    unsigned int maxFilesPerStep = 4; /**< The maximum number of files of a step. */
+    unsigned int maxFileSizeMb = 16; /**< The maximum size of a file, in MB. */
+    std::string downloaderPath = ADUC_HARNESS_DOWNLOADER_PATH; /**< The content downloader extension. */
+    std::string handlerPath = ADUC_HARNESS_HANDLER_PATH; /**< The simulator handler extension. */
+    std::string jsonPath; /**< The file to write the results to, as JSON. Optional. */
+};
+
+/**
+ * @brief The results of a deployment.
+ */
+struct DeploymentResult
+{
+    unsigned int steps = 0;
+    unsigned int files = 0;
+    uint64_t bytes = 0;
+    double phaseMs[HarnessPhase_Count] = {};
+    double cpuMs = 0;
+    long peakRssKb = 0;
+    bool succeeded = false;
+};
+
+/**
+ * @brief The extensions the deployments go through.
+ */
+struct HarnessExtensions
+{
+    void* downloaderLib = nullptr;
+    void* handlerLib = nullptr;
+    DownloadProc download = nullptr;
+    DownloadAndVerifyProc downloadAndVerify = nullptr;
+    ContentHandler* handler = nullptr;
+};
+
+static double ElapsedMs(int64_t startTime)
+{
+    return static_cast<double>(ADUC_Timing_Now() - startTime) / 1e6;
+}
+
+static double CpuMs(const struct rusage& usage)
+{
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3
+        + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+//
+// HTTP file server
+//
+
+/**
+ * @brief Serves one request of @p connection: GET of a file of @p folder, by name.
+ */
+static void ServeConnection(int connection, const std::string& folder)
+{
+    char request[1024];
+    size_t length = 0;
+    char path[256] = {};
+    int fd = -1;
+    struct stat st = {};
+    std::string header;
+
+    // Read the request line and headers; the body of a GET is empty.
+    while (length < sizeof(request) - 1)
+    {
+        const ssize_t count = read(connection, request + length, sizeof(request) - 1 - length);
+        if (count <= 0)
+        {
+            goto done;
+        }
+
+        length += static_cast<size_t>(count);
+        request[length] = '\0';
+
+        if (strstr(request, "\r\n\r\n") != nullptr)
+        {
+            break;
+        }
+    }
+
+    // Files are only served from the folder, so names can't contain '/'.
+    if (sscanf(request, "GET /%255[^ /?] ", path) != 1 || strcmp(path, "..") == 0 || strcmp(path, ".") == 0)
+    {
+        header = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        (void)write(connection, header.c_str(), header.size());
+        goto done;
+    }
+
+    fd = open((folder + "/" + path).c_str(), O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) != 0)
+    {
+        header = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        (void)write(connection, header.c_str(), header.size());
+        goto done;
+    }
+
+    header = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: "
+        + std::to_string(st.st_size) + "\r\nConnection: close\r\n\r\n";
+    if (write(connection, header.c_str(), header.size()) != static_cast<ssize_t>(header.size()))
+    {
+        goto done;
+    }
+
+    for (off_t offset = 0; offset < st.st_size;)
+    {
+        if (sendfile(connection, fd, &offset, static_cast<size_t>(st.st_size - offset)) <= 0)
+        {
+            break;
+        }
+    }
+
+done:
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    close(connection);
+}
+
+/**
+ * @brief Starts a HTTP server of the files of @p folder on a free port of the loopback interface, in a child process.
+ *
+ * @param folder The folder of the files.
+ * @param port Receives the port.
+ * @returns The process ID of the server, or -1 on failure.
+ */
+static pid_t StartFileServer(const std::string& folder, unsigned short* port)
+{
+    pid_t pid = -1;
+    struct sockaddr_in address = {};
+    socklen_t addressLength = sizeof(address);
+
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener == -1)
+    {
+        return -1;
+    }
+
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    if (bind(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listener, 64) != 0
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        || getsockname(listener, reinterpret_cast<struct sockaddr*>(&address), &addressLength) != 0)
+    {
+        goto done;
+    }
+
+    *port = ntohs(address.sin_port);
+
+    pid = fork();
+    if (pid == 0)
+    {
+        for (;;)
+        {
+            const int connection = accept(listener, nullptr, nullptr);
+            if (connection != -1)
+            {
+                ServeConnection(connection, folder);
+            }
+        }
+    }
+
+done:
+
+    close(listener);
+    return pid;
+}
+
+static void StopFileServer(pid_t pid)
+{
+    if (pid > 0)
+    {
+        kill(pid, SIGTERM);
+        (void)waitpid(pid, nullptr, 0);
+    }
+}
+
+//
+// Deployments
+//
+
+/**
+ * @brief Generates the files of deployment @p index in @p serveFolder, and returns the action of the deployment.
+ * Its steps use the simulator handler. File sizes are log-uniform, from 1 KB to the maximum size.
+ *
+ * @param generator The generator of the deployment.
+ * @param options The options.
+ * @param index The index of the deployment.
+ * @param serveFolder The folder of the HTTP server.
+ * @param port The port of the HTTP server.
+ * @param result Receives the number of steps, files and bytes.
+ * @returns The action, or an empty string on failure.
+ */
+static std::string GenerateDeployment(
+    std::mt19937& generator,
+    const HarnessOptions& options,
+    unsigned int index,
+    const std::string& serveFolder,
+    unsigned short port,
+    DeploymentResult* result)
+{
+    std::uniform_int_distribution<unsigned int> stepCount{ 1, options.maxSteps };
+    std::uniform_int_distribution<unsigned int> fileCount{ 1, options.maxFilesPerStep };
+    std::uniform_real_distribution<double> logSize{ std::log(1024.0),
+                                                    std::log(static_cast<double>(options.maxFileSizeMb) * 1048576) };
+
+    std::stringstream steps;
+    std::stringstream files;
+    std::stringstream fileUrls;
+
+    result->steps = stepCount(generator);
+
+    for (unsigned int step = 0; step < result->steps; step++)
+    {
+        std::stringstream stepFiles;
+        const unsigned int stepFileCount = fileCount(generator);
+
+        for (unsigned int file = 0; file < stepFileCount; file++)
+        {
+            const std::string fileId = "f" + std::to_string(index) + "_" + std::to_string(step) + "_"
+                + std::to_string(file);
+            const std::string fileName = fileId + ".bin";
+            const size_t size = static_cast<size_t>(std::exp(logSize(generator)));
+            char* hash = nullptr;
+
+            if (!WriteRandomFile(serveFolder + "/" + fileName, size)
+                || !ADUC_HashUtils_GetFileHash((serveFolder + "/" + fileName).c_str(), SHA256, &hash))
+            {
+                return std::string{};
+            }
+
+            const char* separator = result->files == 0 ? "" : ",";
+            stepFiles << (file == 0 ? "" : ",") << '"' << fileId << '"';
+            files << separator << '"' << fileId << R"(": {"fileName": ")" << fileName << R"(", "sizeInBytes": )" << size
+                  << R"(, "hashes": {"sha256": ")" << hash << R"("}})";
+            fileUrls << separator << '"' << fileId << R"(": "http://127.0.0.1:)" << port << "/" << fileName << '"';
+
+            free(hash); // NOLINT(cppcoreguidelines-no-malloc)
+            result->files++;
+            result->bytes += size;
+        }
+
+        steps << (step == 0 ? "" : ",") << R"({"handler": "microsoft/simulator:1", "files": [)" << stepFiles.str()
+              << "]}";
+    }
+
+    std::stringstream action;
+    action << R"({"workflow": {"action": 3, "id": "harness-)" << index << R"("}, "updateManifest": {)"
+           << R"("manifestVersion": "4", "updateId": {"provider": "Contoso", "name": "Harness", "version": "1.0"}, )"
+           << R"("compatibility": [{"deviceManufacturer": "contoso", "deviceModel": "harness"}], )"
+           << R"("instructions": {"steps": [)" << steps.str() << R"(]}, "files": {)" << files.str()
+           << R"(}, "createdDateTime": "2022-01-27T13:45:05.8993329Z"}, "fileUrls": {)" << fileUrls.str() << "}}";
+
+    return action.str();
+}
+
+/**
+ * @brief Downloads the files of @p stepHandle to @p workFolder, and verifies the ones the downloader didn't verify,
+ * as the extension manager does.
+ *
+ * @returns True on success.
+ */
+static bool DownloadStepFiles(
+    const HarnessExtensions& extensions,
+    ADUC_WorkflowHandle stepHandle,
+    const char* workflowId,
+    const std::string& workFolder,
+    DeploymentResult* result)
+{
+    const size_t count = workflow_get_update_files_count(stepHandle);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const ADUC_FileEntity* entity = workflow_peek_update_file(stepHandle, i);
+        ADUC_DownloadVerifiedFile verifiedFile = {};
+        ADUC_Result downloadResult = {};
+        bool verified = false;
+
+        if (entity == nullptr)
+        {
+            return false;
+        }
+
+        const std::string filePath = workFolder + "/" + entity->TargetFilename;
+        const char* hashType = ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0);
+        const char* hashValue = ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0);
+
+        int64_t startTime = ADUC_Timing_Now();
+        downloadResult = extensions.downloadAndVerify != nullptr
+            ? extensions.downloadAndVerify(entity, workflowId, workFolder.c_str(), 0, nullptr, &verifiedFile)
+            : extensions.download(entity, workflowId, workFolder.c_str(), 0, nullptr);
+        result->phaseMs[HarnessPhase_Download] += ElapsedMs(startTime);
+
+        if (IsAducResultCodeSuccess(downloadResult.ResultCode))
+        {
+            startTime = ADUC_Timing_Now();
+            verified = ADUC_DownloadVerifiedFile_IsCurrent(&verifiedFile, filePath.c_str(), hashType, hashValue)
+                || ADUC_HashUtils_IsValidFileHash(filePath.c_str(), hashValue, SHA256);
+            result->phaseMs[HarnessPhase_Verify] += ElapsedMs(startTime);
+        }
+
+        ADUC_DownloadVerifiedFile_UnInit(&verifiedFile);
+
+        // The content is never needed again, so don't let the work folder grow.
+        (void)remove(filePath.c_str());
+
+        if (!verified)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Replays the deployment @p action: parses it, then downloads, installs and applies each step.
+ */
+static void RunDeployment(
+    const HarnessExtensions& extensions, const std::string& action, const std::string& workFolder,
+    DeploymentResult* result)
+{
+    ADUC_WorkflowHandle handle = nullptr;
+    char* workflowId = nullptr;
+    size_t stepCount = 0;
+    struct rusage usageBefore = {};
+    struct rusage usageAfter = {};
+
+    (void)getrusage(RUSAGE_SELF, &usageBefore);
+
+    int64_t startTime = ADUC_Timing_Now();
+    const ADUC_Result parseResult = workflow_init(action.c_str(), false /* validateManifest */, &handle);
+    result->phaseMs[HarnessPhase_Parse] = ElapsedMs(startTime);
+
+    if (IsAducResultCodeFailure(parseResult.ResultCode))
+    {
+        goto done;
+    }
+
+    workflowId = workflow_get_id(handle);
+    stepCount = workflow_get_instructions_steps_count(handle);
+
+    for (size_t step = 0; step < stepCount; step++)
+    {
+        ADUC_WorkflowHandle stepHandle = nullptr;
+        tagADUC_WorkflowData stepData = {};
+        bool stepSucceeded = false;
+
+        if (IsAducResultCodeFailure(
+                workflow_create_from_inline_step(handle, static_cast<int>(step), &stepHandle).ResultCode))
+        {
+            goto done;
+        }
+
+        stepData.WorkflowHandle = stepHandle;
+
+        if (DownloadStepFiles(extensions, stepHandle, workflowId, workFolder, result))
+        {
+            startTime = ADUC_Timing_Now();
+            const ADUC_Result installResult = extensions.handler->Install(&stepData);
+            result->phaseMs[HarnessPhase_Install] += ElapsedMs(startTime);
+
+            startTime = ADUC_Timing_Now();
+            const ADUC_Result applyResult = extensions.handler->Apply(&stepData);
+            result->phaseMs[HarnessPhase_Apply] += ElapsedMs(startTime);
+
+            stepSucceeded =
+                IsAducResultCodeSuccess(installResult.ResultCode) && IsAducResultCodeSuccess(applyResult.ResultCode);
+        }
+
+        workflow_free(stepHandle);
+
+        if (!stepSucceeded)
+        {
+            goto done;
+        }
+    }
+
+    result->succeeded = true;
+
+done:
+
+    (void)getrusage(RUSAGE_SELF, &usageAfter);
+    result->cpuMs = CpuMs(usageAfter) - CpuMs(usageBefore);
+    result->peakRssKb = usageAfter.ru_maxrss;
+
+    workflow_free_string(workflowId);
+    workflow_free(handle);
+}
+
+//
+// Report
+//
+
+static double Percentile(std::vector<double> values, double percentile)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+    const size_t index = static_cast<size_t>(percentile / 100 * static_cast<double>(values.size() - 1) + 0.5);
+    return values[index];
+}
+
+/**
+ * @brief Prints the distribution of the duration of each phase, and the totals, and writes them to the JSON file of
+ * @p options, if any.
+ *
+ * @returns True on success.
+ */
+static bool Report(const HarnessOptions& options, const std::vector<DeploymentResult>& results)
+{
+    JSON_Value* rootValue = json_value_init_object();
+    JSON_Object* root = json_object(rootValue);
+    JSON_Value* phasesValue = json_value_init_object();
+    JSON_Value* deploymentsValue = json_value_init_array();
+    uint64_t totalBytes = 0;
+    double totalCpuMs = 0;
+    long peakRssKb = 0;
+    unsigned int failures = 0;
+    bool succeeded = true;
+
+    for (const DeploymentResult& result : results)
+    {
+        JSON_Value* deploymentValue = json_value_init_object();
+        JSON_Object* deployment = json_object(deploymentValue);
+
+        json_object_set_number(deployment, "steps", result.steps);
+        json_object_set_number(deployment, "files", result.files);
+        json_object_set_number(deployment, "bytes", static_cast<double>(result.bytes));
+        for (int phase = 0; phase < HarnessPhase_Count; phase++)
+        {
+            json_object_dotset_number(deployment, (std::string{ "phaseMs." } + PhaseNames[phase]).c_str(),
+                                      result.phaseMs[phase]);
+        }
+        json_object_set_number(deployment, "cpuMs", result.cpuMs);
+        json_object_set_number(deployment, "peakRssKb", static_cast<double>(result.peakRssKb));
+        json_object_set_boolean(deployment, "succeeded", result.succeeded);
+        json_array_append_value(json_array(deploymentsValue), deploymentValue);
+
+        totalBytes += result.bytes;
+        totalCpuMs += result.cpuMs;
+        peakRssKb = std::max(peakRssKb, result.peakRssKb);
+        failures += result.succeeded ? 0 : 1;
+    }
+
+    printf("%-10s %12s %12s %12s %12s\n", "phase", "total ms", "mean ms", "p50 ms", "p95 ms");
+
+    for (int phase = 0; phase < HarnessPhase_Count; phase++)
+    {
+        std::vector<double> durations;
+        double total = 0;
+
+        for (const DeploymentResult& result : results)
+        {
+            durations.push_back(result.phaseMs[phase]);
+            total += result.phaseMs[phase];
+        }
+
+        const double mean = results.empty() ? 0 : total / static_cast<double>(results.size());
+        const double p50 = Percentile(durations, 50);
+        const double p95 = Percentile(durations, 95);
+
+        printf("%-10s %12.1f %12.1f %12.1f %12.1f\n", PhaseNames[phase], total, mean, p50, p95);
+
+        JSON_Value* phaseValue = json_value_init_object();
+        json_object_set_number(json_object(phaseValue), "totalMs", total);
+        json_object_set_number(json_object(phaseValue), "meanMs", mean);
+        json_object_set_number(json_object(phaseValue), "p50Ms", p50);
+        json_object_set_number(json_object(phaseValue), "p95Ms", p95);
+        json_object_set_value(json_object(phasesValue), PhaseNames[phase], phaseValue);
+    }
+
+    const double totalMb = static_cast<double>(totalBytes) / 1048576;
+    const double cpuMsPerMb = totalMb > 0 ? totalCpuMs / totalMb : 0;
+
+    printf(
+        "\n%zu deployments, %u failed, %.1f MB, %.1f CPU ms per MB, peak RSS %.1f MB\n",
+        results.size(),
+        failures,
+        totalMb,
+        cpuMsPerMb,
+        static_cast<double>(peakRssKb) / 1024);
+
+    json_object_set_number(root, "seed", options.seed);
+    json_object_set_number(root, "deploymentCount", static_cast<double>(results.size()));
+    json_object_set_number(root, "failureCount", failures);
+    json_object_set_number(root, "totalMb", totalMb);
+    json_object_set_number(root, "cpuMsPerMb", cpuMsPerMb);
+    json_object_set_number(root, "peakRssKb", static_cast<double>(peakRssKb));
+    json_object_set_value(root, "phases", phasesValue);
+    json_object_set_value(root, "deployments", deploymentsValue);
+
+    if (!options.jsonPath.empty() && json_serialize_to_file_pretty(rootValue, options.jsonPath.c_str()) != JSONSuccess)
+    {
+        fprintf(stderr, "Cannot write %s\n", options.jsonPath.c_str());
+        succeeded = false;
+    }
+
+    json_value_free(rootValue);
+
+    return succeeded && failures == 0;
+}
+
+//
+// Main
+//
+
+static void PrintUsage(const char* program)
+{
+    printf(
+        "Usage: %s [options]\n"
+        "  --deployments <n>       Number of deployments to replay. Default: 10\n"
+        "  --seed <n>              Seed the deployments are generated from. Default: 1\n"
+        "  --max-steps <n>         Maximum number of steps of a deployment. Default: 5\n"
+        "  --max-files <n>         Maximum number of files of a step. Default: 4\n"
+        "  --max-file-size-mb <n>  Maximum size of a file, in MB. Default: 16\n"
+        "  --downloader <path>     Content downloader extension. Default: " ADUC_HARNESS_DOWNLOADER_PATH "\n"
+        "  --handler <path>        Simulator handler extension. Default: " ADUC_HARNESS_HANDLER_PATH "\n"
+        "  --json <path>           Also write the results to this file, as JSON.\n",
+        program);
+}
+
+static bool ParseOptions(int argc, char** argv, HarnessOptions* options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* name = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        unsigned int* number = nullptr;
+
+        if (value == nullptr)
+        {
+            return false;
+        }
+
+        if (strcmp(name, "--deployments") == 0)
+        {
+            number = &options->deployments;
+        }
+        else if (strcmp(name, "--seed") == 0)
+        {
+            number = &options->seed;
+        }
+        else if (strcmp(name, "--max-steps") == 0)
+        {
+            number = &options->maxSteps;
+        }
+        else if (strcmp(name, "--max-files") == 0)
+        {
+            number = &options->maxFilesPerStep;
+        }
+        else if (strcmp(name, "--max-file-size-mb") == 0)
+        {
+            number = &options->maxFileSizeMb;
+        }
+        else if (strcmp(name, "--downloader") == 0)
+        {
+            options->downloaderPath = value;
+        }
+        else if (strcmp(name, "--handler") == 0)
+        {
+            options->handlerPath = value;
+        }
+        else if (strcmp(name, "--json") == 0)
+        {
+            options->jsonPath = value;
+        }
+        else
+        {
+            return false;
+        }
+
+        if (number != nullptr)
+        {
+            char* end = nullptr;
+            *number = static_cast<unsigned int>(strtoul(value, &end, 10));
+            if (end == value || *end != '\0')
+            {
+                return false;
+            }
+        }
+
+        i++;
+    }
+
+    return options->maxSteps > 0 && options->maxFilesPerStep > 0 && options->maxFileSizeMb > 0;
+}
+
+/**
+ * @brief Loads the content downloader and the simulator handler, as the extension manager does.
+ *
+ * @returns True on success.
+ */
+static bool LoadExtensions(const HarnessOptions& options, HarnessExtensions* extensions)
+{
+    InitializeProc initialize = nullptr;
+    CreateUpdateContentHandlerExtensionProc createHandler = nullptr;
+
+    extensions->downloaderLib = dlopen(options.downloaderPath.c_str(), RTLD_LAZY);
+    if (extensions->downloaderLib == nullptr)
+    {
+        fprintf(stderr, "Cannot load %s: %s\n", options.downloaderPath.c_str(), dlerror());
+        return false;
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    extensions->download = reinterpret_cast<DownloadProc>(dlsym(extensions->downloaderLib, "Download"));
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    extensions->downloadAndVerify =
+        reinterpret_cast<DownloadAndVerifyProc>(dlsym(extensions->downloaderLib, "DownloadAndVerify"));
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    initialize = reinterpret_cast<InitializeProc>(dlsym(extensions->downloaderLib, "Initialize"));
+
+    if (extensions->download == nullptr
+        || (initialize != nullptr && IsAducResultCodeFailure(initialize(nullptr).ResultCode)))
+    {
+        fprintf(stderr, "Cannot initialize the content downloader %s\n", options.downloaderPath.c_str());
+        return false;
+    }
+
+    extensions->handlerLib = dlopen(options.handlerPath.c_str(), RTLD_LAZY);
+    if (extensions->handlerLib == nullptr)
+    {
+        fprintf(stderr, "Cannot load %s: %s\n", options.handlerPath.c_str(), dlerror());
+        return false;
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    createHandler = reinterpret_cast<CreateUpdateContentHandlerExtensionProc>(
+        dlsym(extensions->handlerLib, "CreateUpdateContentHandlerExtension"));
+    extensions->handler = createHandler != nullptr ? createHandler(ADUC_LOG_WARN) : nullptr;
+    if (extensions->handler == nullptr)
+    {
+        fprintf(stderr, "Cannot create the content handler of %s\n", options.handlerPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static void UnloadExtensions(HarnessExtensions* extensions)
+{
+    delete extensions->handler;
+
+    if (extensions->handlerLib != nullptr)
+    {
+        dlclose(extensions->handlerLib);
+    }
+
+    if (extensions->downloaderLib != nullptr)
+    {
+        dlclose(extensions->downloaderLib);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    HarnessOptions options;
+    HarnessExtensions extensions;
+    std::vector<DeploymentResult> results;
+    unsigned short port = 0;
+    pid_t serverPid = -1;
+    int ret = 1;
+
+    if (!ParseOptions(argc, argv, &options))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    ADUC_Logging_Init(ADUC_LOG_WARN, "deployment-harness");
+
+    try
+    {
+        TempFolder serveFolder;
+        TempFolder workFolder;
+        std::mt19937 generator{ options.seed };
+
+        // Started first, so that the server doesn't inherit the extensions.
+        serverPid = StartFileServer(serveFolder.Path(), &port);
+        if (serverPid <= 0)
+        {
+            fprintf(stderr, "Cannot start the file server\n");
+            goto done;
+        }
+
+        if (!LoadExtensions(options, &extensions))
+        {
+            goto done;
+        }
+
+        for (unsigned int i = 0; i < options.deployments; i++)
+        {
+            DeploymentResult result;
+            const std::string action =
+                GenerateDeployment(generator, options, i, serveFolder.Path(), port, &result);
+
+            if (action.empty())
+            {
+                fprintf(stderr, "Cannot generate deployment %u\n", i);
+                goto done;
+            }
+
+            RunDeployment(extensions, action, workFolder.Path(), &result);
+            results.push_back(result);
+
+            printf(
+                "deployment %u: %u steps, %u files, %.1f MB, %s\n",
+                i,
+                result.steps,
+                result.files,
+                static_cast<double>(result.bytes) / 1048576,
+                result.succeeded ? "succeeded" : "failed");
+
+            // Each deployment has files of its own; a device doesn't keep the content of past updates either.
+            for (unsigned int step = 0; step < result.steps; step++)
+            {
+                for (unsigned int file = 0; file < options.maxFilesPerStep; file++)
+                {
+                    (void)remove((serveFolder.Path() + "/f" + std::to_string(i) + "_" + std::to_string(step) + "_"
+                                  + std::to_string(file) + ".bin")
+                                     .c_str());
+                }
+            }
+        }
+
+        printf("\n");
+        ret = Report(options, results) ? 0 : 1;
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+    }
+
+done:
+
+    StopFileServer(serverPid);
+    UnloadExtensions(&extensions);
+    ADUC_Logging_Uninit();
+
+    return ret;
+}
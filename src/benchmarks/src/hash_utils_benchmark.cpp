@@ -0,0 +1,50 @@
+/**
+ * @file hash_utils_benchmark.cpp
+ * @brief Benchmarks the verification of the hash of downloaded files.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "benchmark_helpers.hpp"
+
+#include <aduc/hash_utils.h>
+#include <benchmark/benchmark.h>
+
+#include <cstdlib> // for free
+
+/**
+ * @brief Verifies the hash of a file of state.range(0) bytes with the algorithm state.range(1).
+ */
+static void BM_HashUtils_IsValidFileHash(benchmark::State& state)
+{
+    const ADUC::Benchmarks::TempFolder folder;
+    const std::string path = folder.Path() + "/update.bin";
+    const auto size = static_cast<size_t>(state.range(0));
+    const auto algorithm = static_cast<SHAversion>(state.range(1));
+    char* hash = nullptr;
+
+    if (!ADUC::Benchmarks::WriteRandomFile(path, size) || !ADUC_HashUtils_GetFileHash(path.c_str(), algorithm, &hash))
+    {
+        state.SkipWithError("Cannot create the file to hash.");
+        return;
+    }
+
+    for (auto _ : state)
+    {
+        if (!ADUC_HashUtils_IsValidFileHash(path.c_str(), hash, algorithm))
+        {
+            state.SkipWithError("The hash doesn't match.");
+            break;
+        }
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+    free(hash); // NOLINT(cppcoreguidelines-no-malloc)
+}
+
+// From a small script to a large image, below and above ADUC_HASH_UTILS_MMAP_THRESHOLD.
+BENCHMARK(BM_HashUtils_IsValidFileHash)
+    ->ArgsProduct({ { 4 << 10, 1 << 20, 16 << 20, 256 << 20 }, { SHA1, SHA256, SHA384, SHA512 } })
+    ->ArgNames({ "bytes", "sha" })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,47 @@
+/**
+ * @file installed_criteria_utils_benchmark.cpp
+ * @brief Benchmarks the installed criteria lookup, which runs at startup and for each deployment.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "benchmark_helpers.hpp"
+
+#include <aduc/installed_criteria_utils.hpp>
+#include <aduc/types/adu_core.h> // for ADUC_Result_IsInstalled_Installed
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+/**
+ * @brief Looks up the last of state.range(0) installed criteria, i.e. the worst case.
+ */
+static void BM_GetIsInstalled(benchmark::State& state)
+{
+    const ADUC::Benchmarks::TempFolder folder;
+    const std::string path = folder.Path() + "/installedcriteria";
+    const auto count = static_cast<int>(state.range(0));
+    std::string installedCriteria;
+
+    for (int i = 0; i < count; i++)
+    {
+        installedCriteria = "contoso-firmware-1.0." + std::to_string(i);
+
+        if (!PersistInstalledCriteria(path.c_str(), installedCriteria))
+        {
+            state.SkipWithError("Cannot persist the installed criteria.");
+            return;
+        }
+    }
+
+    for (auto _ : state)
+    {
+        if (GetIsInstalled(path.c_str(), installedCriteria).ResultCode != ADUC_Result_IsInstalled_Installed)
+        {
+            state.SkipWithError("The installed criteria wasn't found.");
+            break;
+        }
+    }
+}
+
+BENCHMARK(BM_GetIsInstalled)->Arg(1)->Arg(100)->Arg(1000)->ArgName("entries")->Unit(benchmark::kMicrosecond);
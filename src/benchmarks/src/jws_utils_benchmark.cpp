@@ -0,0 +1,93 @@
+/**
+ * @file jws_utils_benchmark.cpp
+ * @brief Benchmarks the verification of update manifest signatures.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <benchmark/benchmark.h>
+#include <jws_utils.h>
+
+/**
+ * @brief A Signed JSON Web Key, signed by the root key ADU.200702.R. From jws_utils_ut.cpp.
+ */
+static const char* const s_signedJSONWebKey =
+    "eyJhbGciOiJSUzI1NiIsImtpZCI6IkFEVS4yMDA3MDIuUiJ9.eyJrdHkiOiJSU0EiLCJuIjoickhWQkVGS1IxdnNoZytBaElnL1N"
+    "EUU8zeDRrajNDVVQ3ZkduSmhBbXVEaHZIZmozZ0h6aTBUMklBcUMxeDJCQ1dkT281djh0dW1xUmovbllwZzk3ampQQ0t1Y2RPNm0"
+    "zN2RjT21hNDZoN08wa0hwd0wzblVIR0VySjVEQS9hcFlud0Vlc2V4VGpUOFNwLytiVHFXRW16Z0QzN3BmZEthcWp0SExHVmlZd1Z"
+    "IUHp0QmFid3dqaEF2enlSWS95OU9mbXpEZlhtclkxcm8vKzJoRXFFeWt1andRRVlraGpKYStCNDc2KzBtdUd5V0k1ZUl2L29sdDJ"
+    "SZVh4TWI5TWxsWE55b1AzYU5LSUppYlpNczd1S2Npd2t5aVVJYVljTWpzOWkvUkV5K2xNOXZJWnFyZnBDVVh1M3RuMUtnYzJRcy9"
+    "UZDh0TlRDR1Y2d3RWYXFpSXBUZFQ0UnJDZE1vTzVTTmVmZkR5YzJsQzd1ODUrb21Ua2NqUGptNmZhcGRJeUYycWVtdlNCRGZCN2N"
+    "hajVESUkyNVd3NUVKY2F2ZnlQNTRtcU5RUTNHY01RYjJkZ2hpY2xwallvKzQzWmdZQ2RHdGFaZDJFZkxad0gzUWcyckRsZmsvaWE"
+    "wLzF5cWlrL1haMW5zWlRpMEJjNUNwT01FcWZOSkZRazNCV29BMDVyQ1oiLCJlIjoiQVFBQiIsImFsZyI6IlJTMjU2Iiwia2lkIjo"
+    "iQURVLjIwMDcwMi5SLlMifQ.iSTgAEBXsd7AANkQMkaG-FAV6QOGUEuxuHg2YfSuWhtYXqbpM-jI5RVLKesSLCehK-lRC9x6-_Le"
+    "yxNh1DOFc-Fa6oCEGwUj8ziOF_AT6s6EOmckqPrxuvCWtyYkkDRF74dtaK1jNA7SdXrZzvWCsMqOUMNz0gCoVR0Cs1254kFMRmRP"
+    "VfEcjgT7j4lCpyDuWgr9SenSeqgKLYxjaaG0sRh9cdi2dKrwgaNaqAbHmCrrhxSPCTBzWMExZrLYzudEofyYHiVVRhSJpj0OQ18e"
+    "cu4DPXV1Tct1y3k7LLio7n8izKuq2m3TxF9vPdqb9NP6Sc9-myaptpbFpHeFkUL-F5ytl_UBFKpwN9CL4wp6yZ-jdXNagrmU_qL1"
+    "CyXw1omNCgTmJF3Gd3lyqKHHDerDs-MRpmKjwSwpZCQJGDRcRovWyL12vjw3LBJMhmUxsEdBaZP5wGdsfD8ldKYFVFEcZ0orMNrU"
+    "kSMAl6pIxtefEXiy5lqmiPzq_LJ1eRIrqY0_";
+
+/**
+ * @brief A JSON Web Signature with the Signed JSON Web Key above in its header. From jws_utils_ut.cpp.
+ */
+static const char* const s_signedJWT =
+    "eyJhbGciOiJSUzI1NiIsInNqd2siOiJleUpoYkdjaU9pSlNVekkxTmlJc0ltdHBaQ0k2SWtGRVZTNHlNREEzTURJdVVpSjkuZXlK"
+    "cmRIa2lPaUpTVTBFaUxDSnVJam9pY2toV1FrVkdTMUl4ZG5Ob1p5dEJhRWxuTDFORVVVOHplRFJyYWpORFZWUTNaa2R1U21oQmJY"
+    "VkVhSFpJWm1velowaDZhVEJVTWtsQmNVTXhlREpDUTFka1QyODFkamgwZFcxeFVtb3ZibGx3WnprM2FtcFFRMHQxWTJSUE5tMHpO"
+    "MlJqVDIxaE5EWm9OMDh3YTBod2Qwd3pibFZJUjBWeVNqVkVRUzloY0ZsdWQwVmxjMlY0VkdwVU9GTndMeXRpVkhGWFJXMTZaMFF6"
+    "TjNCbVpFdGhjV3AwU0V4SFZtbFpkMVpJVUhwMFFtRmlkM2RxYUVGMmVubFNXUzk1T1U5bWJYcEVabGh0Y2xreGNtOHZLekpvUlhG"
+    "RmVXdDFhbmRSUlZscmFHcEtZU3RDTkRjMkt6QnRkVWQ1VjBrMVpVbDJMMjlzZERKU1pWaDRUV0k1VFd4c1dFNTViMUF6WVU1TFNV"
+    "cHBZbHBOY3pkMVMyTnBkMnQ1YVZWSllWbGpUV3B6T1drdlVrVjVLMnhOT1haSlduRnlabkJEVlZoMU0zUnVNVXRuWXpKUmN5OVVa"
+    "RGgwVGxSRFIxWTJkM1JXWVhGcFNYQlVaRlEwVW5KRFpFMXZUelZUVG1WbVprUjVZekpzUXpkMU9EVXJiMjFVYTJOcVVHcHRObVpo"
+    "Y0dSSmVVWXljV1Z0ZGxOQ1JHWkNOMk5oYWpWRVNVa3lOVmQzTlVWS1kyRjJabmxRTlRSdGNVNVJVVE5IWTAxUllqSmtaMmhwWTJ4"
+    "d2FsbHZLelF6V21kWlEyUkhkR0ZhWkRKRlpreGFkMGd6VVdjeWNrUnNabXN2YVdFd0x6RjVjV2xyTDFoYU1XNXpXbFJwTUVKak5V"
+    "TndUMDFGY1daT1NrWlJhek5DVjI5Qk1EVnlRMW9pTENKbElqb2lRVkZCUWlJc0ltRnNaeUk2SWxKVE1qVTJJaXdpYTJsa0lqb2lR"
+    "VVJWTGpJd01EY3dNaTVTTGxNaWZRLmlTVGdBRUJYc2Q3QUFOa1FNa2FHLUZBVjZRT0dVRXV4dUhnMllmU3VXaHRZWHFicE0takk1"
+    "UlZMS2VzU0xDZWhLLWxSQzl4Ni1fTGV5eE5oMURPRmMtRmE2b0NFR3dVajh6aU9GX0FUNnM2RU9tY2txUHJ4dXZDV3R5WWtrRFJG"
+    "NzRkdGFLMWpOQTdTZFhyWnp2V0NzTXFPVU1OejBnQ29WUjBDczEyNTRrRk1SbVJQVmZFY2pnVDdqNGxDcHlEdVdncjlTZW5TZXFn"
+    "S0xZeGphYUcwc1JoOWNkaTJkS3J3Z2FOYXFBYkhtQ3JyaHhTUENUQnpXTUV4WnJMWXp1ZEVvZnlZSGlWVlJoU0pwajBPUTE4ZWN1"
+    "NERQWFYxVGN0MXkzazdMTGlvN244aXpLdXEybTNUeEY5dlBkcWI5TlA2U2M5LW15YXB0cGJGcEhlRmtVTC1GNXl0bF9VQkZLcHdO"
+    "OUNMNHdwNnlaLWpkWE5hZ3JtVV9xTDFDeVh3MW9tTkNnVG1KRjNHZDNseXFLSEhEZXJEcy1NUnBtS2p3U3dwWkNRSkdEUmNSb3ZX"
+    "eUwxMnZqdzNMQkpNaG1VeHNFZEJhWlA1d0dkc2ZEOGxkS1lGVkZFY1owb3JNTnJVa1NNQWw2cEl4dGVmRVhpeTVscW1pUHpxX0xK"
+    "MWVSSXJxWTBfIn0.eyJzaGEyNTYiOiI3Mk9BRTJmME5iVDArVEw5MzdvNzB4bzhvTzk2Z21WTFlESnB4WEh6ZVhFPSJ9.Sagxe9y"
+    "lLitBHD14QsqSCO1lhrsrqqMdJo73at50-C3B2OVu6n5uiQ-6AOnuwEY07cRtxLcUli92HiLFy-itD57amI8ovIRuonLsJqcplmw"
+    "6imdxDWD3CCkV_I3LfUBqjuaBew71Q2HrddHn3KVTFp562xMYgFZmWiERnz7c-q4IuH_7AqvNm8leznVrCscAs5UquHqz3oHLU9x"
+    "En-Sur1aP0xlbN-USD9WET5wXLpiu9ECZ86CFTpc_i3zlEKpl8Vbvsb0NHW_932Lrye6nz3TsYQNFxMcn5EIvHZoxIs_yHEtkJFy"
+    "jFnktojrxFxGKZ5nFH-CrQH6VIwSSIH1FkJOIJiI8QtovzlqdDkZNLMYQ3uM1yKt3anXTpwHbuBrpYKQXN4T7bWN_9PWxyhnzKID"
+    "i6BulyrD8-H8X7P_S7WBoFigb-nNrMFoSEm0qgAND01B0xJmsKf4Q6eB6L7k1S0bJPx5DwrPVW-9TK8GXM0VjZYZGtiLCPUTa6SV"
+    "RKTey";
+
+/**
+ * @brief Verifies a manifest signature. After the first iteration, the key of its SJWK comes from the verified key
+ * cache, as for the deployments that follow the first one.
+ */
+static void BM_VerifyJWSWithSJWK(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        if (VerifyJWSWithSJWK(s_signedJWT) != JWSResult_Success)
+        {
+            state.SkipWithError("The signature is invalid.");
+            break;
+        }
+    }
+}
+
+BENCHMARK(BM_VerifyJWSWithSJWK)->Unit(benchmark::kMicrosecond);
+
+/**
+ * @brief Verifies a Signed JSON Web Key with the root key, the uncached part of BM_VerifyJWSWithSJWK.
+ */
+static void BM_VerifySJWK(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        if (VerifySJWK(s_signedJSONWebKey) != JWSResult_Success)
+        {
+            state.SkipWithError("The signed key is invalid.");
+            break;
+        }
+    }
+}
+
+BENCHMARK(BM_VerifySJWK)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,35 @@
+/**
+ * @file process_utils_benchmark.cpp
+ * @brief Benchmarks the latency of running a child process, e.g. adu-shell.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <aduc/process_utils.hpp>
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Runs a command that exits right away, and captures its output.
+ */
+static void BM_LaunchChildProcess(benchmark::State& state)
+{
+    const std::vector<std::string> args{ "-c", "echo ok" };
+
+    for (auto _ : state)
+    {
+        std::string output;
+
+        if (ADUC_LaunchChildProcess("/bin/sh", args, output) != 0)
+        {
+            state.SkipWithError("The child process failed.");
+            break;
+        }
+
+        benchmark::DoNotOptimize(output);
+    }
+}
+
+BENCHMARK(BM_LaunchChildProcess)->Unit(benchmark::kMicrosecond)->UseRealTime();
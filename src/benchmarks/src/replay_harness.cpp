@@ -0,0 +1,585 @@
+/**
+ * @file replay_harness.cpp
+ * @brief Replays a recorded stream of 'deviceUpdate' desired properties through the agent workflow, with its timing,
+ * and reports the latency, the JSON allocations and the reported properties volume of each update state transition.
+ *
+ * The properties go through ADUC_Workflow_HandlePropertyUpdate, and the states through the reporting queue of the
+ * 'deviceUpdate' component, as in the agent; the steps go through the simulator handler, and the reported properties
+ * are acknowledged right away instead of being sent. Replaying the traces of production devices with two builds of
+ * the agent compares the workflow engine's cost on real deployment streams.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "benchmark_helpers.hpp"
+
+#include <aduc/adu_core_interface.h>
+#include <aduc/agent_workflow.h>
+#include <aduc/client_handle.h>
+#include <aduc/content_handler.hpp>
+#include <aduc/event_loop_utils.h>
+#include <aduc/logging.h>
+#include <aduc/timing_utils.h>
+#include <aduc/types/workflow.h>
+#include <aduc/workflow_utils.h>
+#include <parson.h>
+#include <parson_json_utils.h>
+
+#include <algorithm> // for std::sort
+#include <cstdio>
+#include <cstdlib> // for strtod
+#include <cstring> // for strcmp
+#include <dlfcn.h>
+#include <malloc.h> // for mallinfo2
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/resource.h> // for getrusage
+#include <vector>
+
+#ifndef ADUC_HARNESS_HANDLER_PATH
+#    define ADUC_HARNESS_HANDLER_PATH "libmicrosoft_simulator_1.so"
+#endif
+
+using ADUC::Benchmarks::TempFolder;
+
+typedef ContentHandler* (*CreateUpdateContentHandlerExtensionProc)(ADUC_LOG_SEVERITY logLevel);
+
+/**
+ * @brief Longest wait, once the last property was replayed, for the workflow to be over.
+ */
+static const int64_t DrainTimeoutMs = 60 * 1000;
+
+/**
+ * @brief The main loop interval of the harness; the agent's while there is activity.
+ */
+static const unsigned int PumpIntervalMs = 10;
+
+/**
+ * @brief The options of the harness.
+ */
+struct ReplayOptions
+{
+    std::string tracePath; /**< The recorded stream. */
+    double speed = 1; /**< How much faster than recorded the stream is replayed; 0 replays without waiting. */
+    std::string handlerPath = ADUC_HARNESS_HANDLER_PATH; /**< The simulator handler extension. */
+    std::string jsonPath; /**< The file to write the results to, as JSON. Optional. */
+};
+
+/**
+ * @brief A recorded desired property.
+ */
+struct TraceEvent
+{
+    double offsetMs = 0; /**< When it was received, from the start of the recording. */
+    std::string service; /**< The 'service' property of the 'deviceUpdate' component. */
+};
+
+/**
+ * @brief An update state the workflow reported.
+ */
+struct StateRecord
+{
+    int64_t time = 0; /**< When it was reported, from ADUC_Timing_Now. */
+    size_t event = 0; /**< The index of the last event replayed before it. */
+    std::string state; /**< The state. */
+    size_t jsonBytes = 0; /**< The JSON heap in use, see ADUC_JSON_GetAllocatedBytes. */
+    size_t peakJsonBytes = 0; /**< The JSON heap peak since the previous state. */
+    size_t heapBytes = 0; /**< The malloc heap in use. */
+    uint64_t reportedBytes = 0; /**< The reported properties bytes sent so far. */
+    unsigned int reports = 0; /**< The reported properties updates sent so far. */
+};
+
+/**
+ * @brief What the harness records, from the main loop and the workflow threads.
+ */
+struct ReplayRecorder
+{
+    std::mutex mutex;
+    std::vector<StateRecord> states;
+    std::vector<int64_t> eventTimes; /**< When each event was replayed. */
+    uint64_t reportedBytes = 0;
+    unsigned int reports = 0;
+};
+
+static ReplayRecorder s_recorder;
+
+static size_t GetHeapBytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+static double ToMs(int64_t durationNs)
+{
+    return static_cast<double>(durationNs) / 1e6;
+}
+
+//
+// Agent hooks
+//
+
+/**
+ * @brief Counts a reported properties update, and acknowledges it as IoT Hub would.
+ */
+static IOTHUB_CLIENT_RESULT RecordReportedState(
+    ADUC_CLIENT_HANDLE_TYPE /*clientHandle*/,
+    const unsigned char* /*reportedState*/,
+    size_t reportedStateLen,
+    IOTHUB_CLIENT_REPORTED_STATE_CALLBACK_TYPE reportedStateCallback,
+    void* userContextCallback)
+{
+    {
+        std::lock_guard<std::mutex> lock{ s_recorder.mutex };
+        s_recorder.reportedBytes += reportedStateLen;
+        s_recorder.reports++;
+    }
+
+    if (reportedStateCallback != nullptr)
+    {
+        reportedStateCallback(200, userContextCallback);
+    }
+
+    return IOTHUB_CLIENT_OK;
+}
+
+/**
+ * @brief Records the state, then reports it as the agent does.
+ */
+static _Bool RecordStateAndResult(
+    ADUC_WorkflowDataToken workflowData,
+    ADUCITF_State updateState,
+    const ADUC_Result* result,
+    const char* installedUpdateId)
+{
+    StateRecord record;
+    record.time = ADUC_Timing_Now();
+    record.state = ADUCITF_StateToString(updateState);
+    record.jsonBytes = ADUC_JSON_GetAllocatedBytes();
+    record.peakJsonBytes = ADUC_JSON_GetPeakAllocatedBytes();
+    record.heapBytes = GetHeapBytes();
+    ADUC_JSON_ResetPeakAllocatedBytes();
+
+    {
+        std::lock_guard<std::mutex> lock{ s_recorder.mutex };
+        record.event = s_recorder.eventTimes.empty() ? 0 : s_recorder.eventTimes.size() - 1;
+        record.reportedBytes = s_recorder.reportedBytes;
+        record.reports = s_recorder.reports;
+        s_recorder.states.push_back(record);
+    }
+
+    return AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
+        workflowData, updateState, result, installedUpdateId);
+}
+
+//
+// Trace
+//
+
+/**
+ * @brief Loads the recorded stream: a JSON object with an "events" array, each with the "offsetMs" it was received at
+ * and either the "service" property of the 'deviceUpdate' component, or the "desired" twin patch that carried it.
+ *
+ * @returns True on success.
+ */
+static bool LoadTrace(const std::string& path, std::vector<TraceEvent>* events)
+{
+    JSON_Value* rootValue = json_parse_file(path.c_str());
+    const JSON_Array* eventsArray = json_object_get_array(json_value_get_object(rootValue), "events");
+    bool succeeded = eventsArray != nullptr;
+
+    for (size_t i = 0; succeeded && i < json_array_get_count(eventsArray); i++)
+    {
+        const JSON_Object* eventObject = json_array_get_object(eventsArray, i);
+        const JSON_Value* serviceValue = json_object_get_value(eventObject, "service");
+        if (serviceValue == nullptr)
+        {
+            serviceValue = json_object_dotget_value(eventObject, "desired.deviceUpdate.service");
+        }
+
+        char* service = json_serialize_to_string(serviceValue);
+        if (service == nullptr)
+        {
+            fprintf(stderr, "Event %zu of %s has no 'deviceUpdate' service property\n", i, path.c_str());
+            succeeded = false;
+            break;
+        }
+
+        TraceEvent event;
+        event.offsetMs = json_object_get_number(eventObject, "offsetMs");
+        event.service = service;
+        events->push_back(event);
+
+        json_free_serialized_string(service);
+    }
+
+    json_value_free(rootValue);
+
+    if (!succeeded)
+    {
+        fprintf(stderr, "Cannot load the trace %s\n", path.c_str());
+    }
+
+    return succeeded && !events->empty();
+}
+
+//
+// Replay
+//
+
+static bool IsWorkflowOver(const ADUC_WorkflowData* workflowData)
+{
+    return (workflowData->LastReportedState == ADUCITF_State_Idle
+            || workflowData->LastReportedState == ADUCITF_State_Failed)
+        && (workflowData->WorkflowHandle == nullptr
+            || !workflow_get_operation_in_progress(workflowData->WorkflowHandle));
+}
+
+/**
+ * @brief Replays @p events at their offsets, divided by the speed, running the agent's main loop in between, then
+ * until the workflow is over.
+ *
+ * @returns True if the workflow was over in time.
+ */
+static bool Replay(const ReplayOptions& options, const std::vector<TraceEvent>& events, ADUC_WorkflowData* workflowData)
+{
+    const int64_t start = ADUC_Timing_Now();
+
+    for (const TraceEvent& event : events)
+    {
+        const int64_t due = start + static_cast<int64_t>(options.speed > 0 ? event.offsetMs / options.speed * 1e6 : 0);
+
+        while (ADUC_Timing_Now() < due)
+        {
+            AzureDeviceUpdateCoreInterface_DoWork(workflowData);
+            (void)ADUC_EventLoop_Wait(
+                static_cast<unsigned int>(std::min<int64_t>(PumpIntervalMs, (due - ADUC_Timing_Now()) / 1000000 + 1)));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{ s_recorder.mutex };
+            s_recorder.eventTimes.push_back(ADUC_Timing_Now());
+        }
+
+        ADUC_Workflow_HandlePropertyUpdate(
+            workflowData, reinterpret_cast<const unsigned char*>(event.service.c_str()), false /* forceDeferral */);
+    }
+
+    const int64_t deadline = ADUC_Timing_Now() + DrainTimeoutMs * 1000000;
+
+    do
+    {
+        AzureDeviceUpdateCoreInterface_DoWork(workflowData);
+        if (IsWorkflowOver(workflowData))
+        {
+            AzureDeviceUpdateCoreInterface_FlushReports(workflowData);
+            return true;
+        }
+
+        (void)ADUC_EventLoop_Wait(PumpIntervalMs);
+    } while (ADUC_Timing_Now() < deadline);
+
+    fprintf(stderr, "The workflow wasn't over %lld ms after the last event\n", static_cast<long long>(DrainTimeoutMs));
+    return false;
+}
+
+//
+// Report
+//
+
+static double Percentile(std::vector<double> values, double percentile)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+    const size_t index = static_cast<size_t>(percentile / 100 * static_cast<double>(values.size() - 1) + 0.5);
+    return values[index];
+}
+
+/**
+ * @brief The measures of the transitions between two states.
+ */
+struct TransitionStats
+{
+    std::vector<double> latencyMs;
+    double jsonBytes = 0; /**< The sum of the growth of the JSON heap. */
+    double peakJsonBytes = 0; /**< The sum of the peaks of the JSON heap. */
+    double heapBytes = 0; /**< The sum of the growth of the malloc heap. */
+    double reportedBytes = 0; /**< The sum of the reported properties bytes. */
+    double reports = 0; /**< The sum of the reported properties updates. */
+};
+
+/**
+ * @brief Prints the measures of each transition, and the totals, and writes them to the JSON file of @p options, if
+ * any. A transition goes from the previous state, or from the replayed event for the first state after an event.
+ *
+ * @returns True on success.
+ */
+static bool Report(const ReplayOptions& options, size_t eventCount, bool drained)
+{
+    std::map<std::string, TransitionStats> transitions;
+    const StateRecord* previous = nullptr;
+    JSON_Value* rootValue = json_value_init_object();
+    JSON_Object* root = json_object(rootValue);
+    JSON_Value* transitionsValue = json_value_init_object();
+    struct rusage usage = {};
+    bool succeeded = drained;
+
+    std::lock_guard<std::mutex> lock{ s_recorder.mutex };
+
+    for (const StateRecord& record : s_recorder.states)
+    {
+        const bool afterEvent = previous == nullptr || previous->event != record.event;
+        const std::string from = afterEvent ? "event" : previous->state;
+        const int64_t fromTime = afterEvent ? s_recorder.eventTimes[record.event] : previous->time;
+        TransitionStats& stats = transitions[from + " -> " + record.state];
+
+        stats.latencyMs.push_back(ToMs(record.time - fromTime));
+        stats.peakJsonBytes += static_cast<double>(record.peakJsonBytes);
+
+        if (previous != nullptr)
+        {
+            stats.jsonBytes += static_cast<double>(record.jsonBytes) - static_cast<double>(previous->jsonBytes);
+            stats.heapBytes += static_cast<double>(record.heapBytes) - static_cast<double>(previous->heapBytes);
+            stats.reportedBytes += static_cast<double>(record.reportedBytes - previous->reportedBytes);
+            stats.reports += record.reports - previous->reports;
+        }
+
+        previous = &record;
+    }
+
+    printf(
+        "%-48s %6s %10s %10s %12s %12s %12s\n",
+        "transition",
+        "count",
+        "p50 ms",
+        "p95 ms",
+        "json peak B",
+        "heap +B",
+        "reported B");
+
+    for (const auto& entry : transitions)
+    {
+        const TransitionStats& stats = entry.second;
+        const double count = static_cast<double>(stats.latencyMs.size());
+        const double p50 = Percentile(stats.latencyMs, 50);
+        const double p95 = Percentile(stats.latencyMs, 95);
+
+        printf(
+            "%-48s %6zu %10.2f %10.2f %12.0f %12.0f %12.0f\n",
+            entry.first.c_str(),
+            stats.latencyMs.size(),
+            p50,
+            p95,
+            stats.peakJsonBytes / count,
+            stats.heapBytes / count,
+            stats.reportedBytes / count);
+
+        JSON_Value* transitionValue = json_value_init_object();
+        JSON_Object* transition = json_object(transitionValue);
+        json_object_set_number(transition, "count", count);
+        json_object_set_number(transition, "p50Ms", p50);
+        json_object_set_number(transition, "p95Ms", p95);
+        json_object_set_number(transition, "meanJsonBytes", stats.jsonBytes / count);
+        json_object_set_number(transition, "meanPeakJsonBytes", stats.peakJsonBytes / count);
+        json_object_set_number(transition, "meanHeapBytes", stats.heapBytes / count);
+        json_object_set_number(transition, "meanReportedBytes", stats.reportedBytes / count);
+        json_object_set_number(transition, "meanReports", stats.reports / count);
+        json_object_set_value(json_object(transitionsValue), entry.first.c_str(), transitionValue);
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf(
+        "\n%zu events, %zu states, %u reports, %.1f KB reported, peak RSS %.1f MB%s\n",
+        eventCount,
+        s_recorder.states.size(),
+        s_recorder.reports,
+        static_cast<double>(s_recorder.reportedBytes) / 1024,
+        static_cast<double>(usage.ru_maxrss) / 1024,
+        drained ? "" : ", not drained");
+
+    json_object_set_string(root, "trace", options.tracePath.c_str());
+    json_object_set_number(root, "speed", options.speed);
+    json_object_set_number(root, "eventCount", static_cast<double>(eventCount));
+    json_object_set_number(root, "stateCount", static_cast<double>(s_recorder.states.size()));
+    json_object_set_number(root, "reportCount", s_recorder.reports);
+    json_object_set_number(root, "reportedBytes", static_cast<double>(s_recorder.reportedBytes));
+    json_object_set_number(root, "peakRssKb", static_cast<double>(usage.ru_maxrss));
+    json_object_set_boolean(root, "drained", drained);
+    json_object_set_value(root, "transitions", transitionsValue);
+
+    if (!options.jsonPath.empty() && json_serialize_to_file_pretty(rootValue, options.jsonPath.c_str()) != JSONSuccess)
+    {
+        fprintf(stderr, "Cannot write %s\n", options.jsonPath.c_str());
+        succeeded = false;
+    }
+
+    json_value_free(rootValue);
+
+    return succeeded;
+}
+
+//
+// Main
+//
+
+static void PrintUsage(const char* program)
+{
+    printf(
+        "Usage: %s --trace <path> [options]\n"
+        "  --trace <path>      Recorded stream of 'deviceUpdate' desired properties.\n"
+        "  --speed <factor>    How much faster than recorded to replay; 0 doesn't wait. Default: 1\n"
+        "  --handler <path>    Simulator handler extension. Default: " ADUC_HARNESS_HANDLER_PATH "\n"
+        "  --json <path>       Also write the results to this file, as JSON.\n",
+        program);
+}
+
+static bool ParseOptions(int argc, char** argv, ReplayOptions* options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* name = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (value == nullptr)
+        {
+            return false;
+        }
+
+        if (strcmp(name, "--trace") == 0)
+        {
+            options->tracePath = value;
+        }
+        else if (strcmp(name, "--speed") == 0)
+        {
+            char* end = nullptr;
+            options->speed = strtod(value, &end);
+            if (end == value || *end != '\0' || options->speed < 0)
+            {
+                return false;
+            }
+        }
+        else if (strcmp(name, "--handler") == 0)
+        {
+            options->handlerPath = value;
+        }
+        else if (strcmp(name, "--json") == 0)
+        {
+            options->jsonPath = value;
+        }
+        else
+        {
+            return false;
+        }
+
+        i++;
+    }
+
+    return !options->tracePath.empty();
+}
+
+int main(int argc, char** argv)
+{
+    ReplayOptions options;
+    std::vector<TraceEvent> events;
+    void* handlerLib = nullptr;
+    ContentHandler* handler = nullptr;
+    CreateUpdateContentHandlerExtensionProc createHandler = nullptr;
+    void* context = nullptr;
+    ADUC_WorkflowData* workflowData = nullptr;
+    ADUC_TestOverride_Hooks hooks = {};
+    int ret = 1;
+
+    if (!ParseOptions(argc, argv, &options))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // Before any JSON value is allocated, so that they are all counted.
+    ADUC_JSON_EnableAllocationAccounting();
+
+    ADUC_Logging_Init(ADUC_LOG_WARN, "replay-harness");
+    ADUC_EventLoop_Init();
+
+    try
+    {
+        // The goal state and the workflow state journal of the replayed device.
+        TempFolder dataFolder;
+
+        if (!LoadTrace(options.tracePath, &events))
+        {
+            goto done;
+        }
+
+        handlerLib = dlopen(options.handlerPath.c_str(), RTLD_LAZY);
+        if (handlerLib == nullptr)
+        {
+            fprintf(stderr, "Cannot load %s: %s\n", options.handlerPath.c_str(), dlerror());
+            goto done;
+        }
+
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        createHandler = reinterpret_cast<CreateUpdateContentHandlerExtensionProc>(
+            dlsym(handlerLib, "CreateUpdateContentHandlerExtension"));
+        handler = createHandler != nullptr ? createHandler(ADUC_LOG_WARN) : nullptr;
+        if (handler == nullptr)
+        {
+            fprintf(stderr, "Cannot create the content handler of %s\n", options.handlerPath.c_str());
+            goto done;
+        }
+
+        // The client handle is never used: the reported properties go to RecordReportedState.
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast,performance-no-int-to-ptr)
+        if (!AzureDeviceUpdateCoreInterface_CreateForDevice(
+                &context, reinterpret_cast<ADUC_ClientHandle>(-1), dataFolder.Path().c_str(), 0, nullptr))
+        {
+            fprintf(stderr, "Cannot create the 'deviceUpdate' component\n");
+            goto done;
+        }
+
+        workflowData = static_cast<ADUC_WorkflowData*>(context);
+
+        hooks.ContentHandler_TestOverride = handler;
+        hooks.ClientHandle_SendReportedStateFunc_TestOverride = reinterpret_cast<void*>(RecordReportedState); // NOLINT
+        workflowData->TestOverrides = &hooks;
+        workflowData->ReportStateAndResultAsyncCallback = RecordStateAndResult;
+
+        // The device is past its startup: the recorded properties are handled as they come.
+        workflowData->StartupIdleCallSent = true;
+        workflowData->WarmStartAttempted = true;
+        workflowData->LastReportedState = ADUCITF_State_Idle;
+
+        const bool drained = Replay(options, events, workflowData);
+
+        printf("\n");
+        ret = Report(options, events.size(), drained) ? 0 : 1;
+
+        AzureDeviceUpdateCoreInterface_Destroy(&context);
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+    }
+
+done:
+
+    delete handler;
+
+    if (handlerLib != nullptr)
+    {
+        dlclose(handlerLib);
+    }
+
+    ADUC_EventLoop_UnInit();
+    ADUC_Logging_Uninit();
+
+    return ret;
+}
@@ -0,0 +1,817 @@
+/**
+ * @file soak_harness.cpp
+ * @brief Runs thousands of back-to-back deployments, replacements and cancels through the agent workflow, sampling the
+ * RSS, the open file descriptors and the threads of the process after each one, and fails if they grew beyond a
+ * threshold.
+ *
+ * The deployments go through ADUC_Workflow_HandlePropertyUpdate and the platform layer, as in the agent; the content
+ * handler is the simulator handler, reloaded every so often as the extension manager would, and the reported
+ * properties are acknowledged right away instead of being sent. A leak in the workflow teardown, e.g. workflow_free or
+ * ADUC_WorkflowData_Uninit, or in the extension reloads, shows as a steady growth over the run.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "benchmark_helpers.hpp"
+
+#include <aduc/adu_core_interface.h>
+#include <aduc/agent_workflow.h>
+#include <aduc/client_handle.h>
+#include <aduc/content_handler.hpp>
+#include <aduc/event_loop_utils.h>
+#include <aduc/logging.h>
+#include <aduc/timing_utils.h>
+#include <aduc/types/workflow.h>
+#include <aduc/workflow_utils.h>
+#include <parson.h>
+#include <parson_json_utils.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib> // for setenv, strtoul
+#include <cstring> // for strcmp, strncmp
+#include <dirent.h> // for opendir
+#include <dlfcn.h>
+#include <fstream>
+#include <malloc.h> // for mallinfo2
+#include <random>
+#include <string>
+#include <unistd.h> // for sysconf
+#include <vector>
+
+#ifndef ADUC_HARNESS_HANDLER_PATH
+#    define ADUC_HARNESS_HANDLER_PATH "libmicrosoft_simulator_1.so"
+#endif
+
+using ADUC::Benchmarks::TempFolder;
+
+typedef ContentHandler* (*CreateUpdateContentHandlerExtensionProc)(ADUC_LOG_SEVERITY logLevel);
+
+/**
+ * @brief Longest wait for a deployment to be over, once its last property was sent.
+ */
+static const int64_t DrainTimeoutMs = 60 * 1000;
+
+/**
+ * @brief Longest wait, after a deployment is over, for its threads to exit before the process is sampled.
+ */
+static const int64_t SettleTimeoutMs = 1000;
+
+/**
+ * @brief The main loop interval of the harness; the agent's while there is activity.
+ */
+static const unsigned int PumpIntervalMs = 10;
+
+/**
+ * @brief The options of the harness.
+ */
+struct SoakOptions
+{
+    std::string deploymentPath; /**< The signed 'deviceUpdate' service property the deployments are made of. */
+    unsigned int deployments = 2000; /**< The deployments to run, after the warm-up. */
+    unsigned int warmup = 50; /**< The deployments run before the baseline is sampled. */
+    unsigned int seed = 1; /**< The seed of the deployment kinds and delays. */
+    unsigned int cancelPercent = 10; /**< The percent of deployments cancelled while in progress. */
+    unsigned int replacePercent = 10; /**< The percent of deployments replaced while in progress. */
+    unsigned int latencyMs = 20; /**< The most latency of each simulated download, install and apply. */
+    unsigned int reloadEvery = 100; /**< Reload the handler after this many deployments; 0 never does. */
+    unsigned int maxRssGrowthKb = 8192; /**< The RSS growth over the run that fails it. */
+    unsigned int maxFdGrowth = 0; /**< The open file descriptors growth over the run that fails it. */
+    unsigned int maxThreadGrowth = 0; /**< The threads growth over the run that fails it. */
+    unsigned int reportEvery = 100; /**< Print a sample after this many deployments. */
+    std::string handlerPath = ADUC_HARNESS_HANDLER_PATH; /**< The simulator handler extension. */
+    std::string jsonPath; /**< The file to write the samples to, as JSON. Optional. */
+};
+
+/**
+ * @brief The kinds of deployments of the run.
+ */
+enum class DeploymentKind
+{
+    Complete, /**< Runs to its end. */
+    Cancel, /**< Cancelled while in progress. */
+    Replace, /**< Replaced by another deployment while in progress, which then runs to its end. */
+};
+
+/**
+ * @brief The resources of the process after a deployment.
+ */
+struct ProcessSample
+{
+    unsigned int deployment = 0; /**< The deployments run so far, warm-up included. */
+    long rssKb = 0; /**< The resident set size. */
+    long fds = 0; /**< The open file descriptors. */
+    long threads = 0; /**< The threads. */
+    size_t heapBytes = 0; /**< The malloc heap in use. */
+    size_t jsonBytes = 0; /**< The JSON heap in use, see ADUC_JSON_GetAllocatedBytes. */
+};
+
+/**
+ * @brief The simulator handler extension, while loaded.
+ */
+struct HandlerExtension
+{
+    void* lib = nullptr;
+    ContentHandler* handler = nullptr;
+};
+
+/**
+ * @brief The states reported so far; a deployment is over once it reported a state and the workflow is idle.
+ */
+static std::atomic<unsigned int> s_reportedStates{ 0 };
+
+//
+// Process sampling
+//
+
+static size_t GetHeapBytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Returns the resident set size of the process, in KB, from /proc/self/statm.
+ */
+static long GetRssKb()
+{
+    std::ifstream statm{ "/proc/self/statm" };
+    long sizePages = 0;
+    long residentPages = 0;
+
+    if (!(statm >> sizePages >> residentPages))
+    {
+        return -1;
+    }
+
+    return residentPages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+ * @brief Returns the open file descriptors of the process, the entries of /proc/self/fd.
+ */
+static long GetOpenFdCount()
+{
+    DIR* dir = opendir("/proc/self/fd");
+    long count = 0;
+
+    if (dir == nullptr)
+    {
+        return -1;
+    }
+
+    for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        if (entry->d_name[0] != '.')
+        {
+            count++;
+        }
+    }
+
+    closedir(dir);
+
+    // Not the one of the directory itself.
+    return count - 1;
+}
+
+/**
+ * @brief Returns the threads of the process, from the Threads line of /proc/self/status.
+ */
+static long GetThreadCount()
+{
+    std::ifstream status{ "/proc/self/status" };
+    std::string line;
+
+    while (std::getline(status, line))
+    {
+        if (strncmp(line.c_str(), "Threads:", 8) == 0)
+        {
+            return strtol(line.c_str() + 8, nullptr, 10);
+        }
+    }
+
+    return -1;
+}
+
+static ProcessSample SampleProcess(unsigned int deployment)
+{
+    ProcessSample sample;
+    sample.deployment = deployment;
+    sample.rssKb = GetRssKb();
+    sample.fds = GetOpenFdCount();
+    sample.threads = GetThreadCount();
+    sample.heapBytes = GetHeapBytes();
+    sample.jsonBytes = ADUC_JSON_GetAllocatedBytes();
+    return sample;
+}
+
+//
+// Agent hooks
+//
+
+/**
+ * @brief Acknowledges a reported properties update, as IoT Hub would.
+ */
+static IOTHUB_CLIENT_RESULT AcknowledgeReportedState(
+    ADUC_CLIENT_HANDLE_TYPE /*clientHandle*/,
+    const unsigned char* /*reportedState*/,
+    size_t /*reportedStateLen*/,
+    IOTHUB_CLIENT_REPORTED_STATE_CALLBACK_TYPE reportedStateCallback,
+    void* userContextCallback)
+{
+    if (reportedStateCallback != nullptr)
+    {
+        reportedStateCallback(200, userContextCallback);
+    }
+
+    return IOTHUB_CLIENT_OK;
+}
+
+/**
+ * @brief Counts the state, then reports it as the agent does.
+ */
+static _Bool CountStateAndResult(
+    ADUC_WorkflowDataToken workflowData,
+    ADUCITF_State updateState,
+    const ADUC_Result* result,
+    const char* installedUpdateId)
+{
+    s_reportedStates++;
+
+    return AzureDeviceUpdateCoreInterface_ReportStateAndResultAsync(
+        workflowData, updateState, result, installedUpdateId);
+}
+
+//
+// Simulator
+//
+
+/**
+ * @brief Writes the simulator data file to @p folder: every update is not installed yet, and each download, install
+ * and apply takes up to the latency of @p options, so that cancels and replacements land while they are in progress.
+ *
+ * The simulator handler reads it from TMPDIR, and the simulator platform layer from its simulation_behavior_file.
+ *
+ * @returns True on success.
+ */
+static bool WriteSimulatorData(const SoakOptions& options, const std::string& folder)
+{
+    std::ofstream file{ folder + "/du-simulator-data.json", std::ios::trunc };
+    const std::string latency = R"({"latencyMs": {"distribution": "uniform", "min": 0, "max": )"
+        + std::to_string(options.latencyMs) + "}}";
+
+    file << R"({"version": "1.0", "isInstalled": {"*": {"resultCode": 901}}, "behavior": {"seed": )" << options.seed
+         << R"(, "download": )" << latency << R"(, "install": )" << latency << R"(, "apply": )" << latency << "}}";
+
+    return file.good();
+}
+
+static bool LoadHandler(const SoakOptions& options, HandlerExtension* extension)
+{
+    extension->lib = dlopen(options.handlerPath.c_str(), RTLD_LAZY);
+    if (extension->lib == nullptr)
+    {
+        fprintf(stderr, "Cannot load %s: %s\n", options.handlerPath.c_str(), dlerror());
+        return false;
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto createHandler = reinterpret_cast<CreateUpdateContentHandlerExtensionProc>(
+        dlsym(extension->lib, "CreateUpdateContentHandlerExtension"));
+    extension->handler = createHandler != nullptr ? createHandler(ADUC_LOG_WARN) : nullptr;
+    if (extension->handler == nullptr)
+    {
+        fprintf(stderr, "Cannot create the content handler of %s\n", options.handlerPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static void UnloadHandler(HandlerExtension* extension)
+{
+    delete extension->handler;
+    extension->handler = nullptr;
+
+    if (extension->lib != nullptr)
+    {
+        dlclose(extension->lib);
+        extension->lib = nullptr;
+    }
+}
+
+//
+// Deployments
+//
+
+/**
+ * @brief Loads the signed 'deviceUpdate' service property the deployments are made of: the service property itself,
+ * or the "desired" twin patch that carried it.
+ *
+ * @returns The parsed property, or nullptr on failure.
+ */
+static JSON_Value* LoadDeployment(const std::string& path)
+{
+    JSON_Value* rootValue = json_parse_file(path.c_str());
+    const JSON_Value* serviceValue =
+        json_object_dotget_value(json_value_get_object(rootValue), "desired.deviceUpdate.service");
+    JSON_Value* deploymentValue = serviceValue != nullptr ? json_value_deep_copy(serviceValue) : rootValue;
+
+    if (deploymentValue != rootValue)
+    {
+        json_value_free(rootValue);
+    }
+
+    if (json_object_dotget_number(json_value_get_object(deploymentValue), "workflow.action")
+        != ADUCITF_UpdateAction_ProcessDeployment)
+    {
+        fprintf(stderr, "%s isn't a deployment\n", path.c_str());
+        json_value_free(deploymentValue);
+        return nullptr;
+    }
+
+    return deploymentValue;
+}
+
+/**
+ * @brief Returns the deployment with the workflow id @p workflowId; the signature covers the manifest only.
+ */
+static std::string MakeDeployment(JSON_Value* deploymentValue, const std::string& workflowId)
+{
+    json_object_dotset_string(json_value_get_object(deploymentValue), "workflow.id", workflowId.c_str());
+
+    char* deployment = json_serialize_to_string(deploymentValue);
+    std::string result{ deployment == nullptr ? "" : deployment };
+    json_free_serialized_string(deployment);
+    return result;
+}
+
+static std::string MakeCancel(const std::string& workflowId)
+{
+    return R"({"workflow": {"action": 255, "id": ")" + workflowId + R"("}})";
+}
+
+static void SendProperty(ADUC_WorkflowData* workflowData, const std::string& property)
+{
+    ADUC_Workflow_HandlePropertyUpdate(
+        workflowData, reinterpret_cast<const unsigned char*>(property.c_str()), false /* forceDeferral */);
+}
+
+/**
+ * @brief Runs the agent's main loop for @p durationMs.
+ */
+static void Pump(ADUC_WorkflowData* workflowData, unsigned int durationMs)
+{
+    const int64_t due = ADUC_Timing_Now() + static_cast<int64_t>(durationMs) * 1000000;
+
+    do
+    {
+        AzureDeviceUpdateCoreInterface_DoWork(workflowData);
+        (void)ADUC_EventLoop_Wait(PumpIntervalMs);
+    } while (ADUC_Timing_Now() < due);
+}
+
+static bool IsWorkflowOver(const ADUC_WorkflowData* workflowData)
+{
+    return (workflowData->LastReportedState == ADUCITF_State_Idle
+            || workflowData->LastReportedState == ADUCITF_State_Failed)
+        && (workflowData->WorkflowHandle == nullptr
+            || !workflow_get_operation_in_progress(workflowData->WorkflowHandle));
+}
+
+/**
+ * @brief Runs the agent's main loop until the deployment is over: it reported a state since @p reportedStates, and
+ * the workflow is idle.
+ *
+ * @returns True if it was over in time.
+ */
+static bool Drain(ADUC_WorkflowData* workflowData, unsigned int reportedStates)
+{
+    const int64_t deadline = ADUC_Timing_Now() + DrainTimeoutMs * 1000000;
+
+    do
+    {
+        AzureDeviceUpdateCoreInterface_DoWork(workflowData);
+        if (s_reportedStates > reportedStates && IsWorkflowOver(workflowData))
+        {
+            AzureDeviceUpdateCoreInterface_FlushReports(workflowData);
+            return true;
+        }
+
+        (void)ADUC_EventLoop_Wait(PumpIntervalMs);
+    } while (ADUC_Timing_Now() < deadline);
+
+    return false;
+}
+
+/**
+ * @brief Runs the deployment @p index, of kind @p kind: sends it, then the cancel or the replacement, if any, after
+ * a random delay within the simulated latency, and waits for it to be over.
+ *
+ * @returns True if it was over in time.
+ */
+static bool RunDeployment(
+    const SoakOptions& options,
+    std::mt19937& generator,
+    JSON_Value* deploymentValue,
+    unsigned int index,
+    DeploymentKind kind,
+    ADUC_WorkflowData* workflowData)
+{
+    std::uniform_int_distribution<unsigned int> delayMs{ 0, options.latencyMs * 2 };
+    const std::string workflowId = "soak-" + std::to_string(index);
+    const unsigned int reportedStates = s_reportedStates;
+    const long threads = GetThreadCount();
+
+    SendProperty(workflowData, MakeDeployment(deploymentValue, workflowId));
+
+    if (kind == DeploymentKind::Cancel)
+    {
+        Pump(workflowData, delayMs(generator));
+        SendProperty(workflowData, MakeCancel(workflowId));
+    }
+    else if (kind == DeploymentKind::Replace)
+    {
+        Pump(workflowData, delayMs(generator));
+        SendProperty(workflowData, MakeDeployment(deploymentValue, workflowId + "-replacement"));
+    }
+
+    if (!Drain(workflowData, reportedStates))
+    {
+        fprintf(
+            stderr,
+            "Deployment %s wasn't over %lld ms after its last property\n",
+            workflowId.c_str(),
+            static_cast<long long>(DrainTimeoutMs));
+        return false;
+    }
+
+    // The workflow threads of the deployment may still be on their way out.
+    const int64_t settleDeadline = ADUC_Timing_Now() + SettleTimeoutMs * 1000000;
+    while (GetThreadCount() > threads && ADUC_Timing_Now() < settleDeadline)
+    {
+        Pump(workflowData, PumpIntervalMs);
+    }
+
+    return true;
+}
+
+//
+// Report
+//
+
+static void PrintSample(const char* label, const ProcessSample& sample)
+{
+    printf(
+        "%-10s %10u %10ld %6ld %8ld %12zu %12zu\n",
+        label,
+        sample.deployment,
+        sample.rssKb,
+        sample.fds,
+        sample.threads,
+        sample.heapBytes,
+        sample.jsonBytes);
+}
+
+static JSON_Value* SampleToJson(const ProcessSample& sample)
+{
+    JSON_Value* sampleValue = json_value_init_object();
+    JSON_Object* sampleObject = json_object(sampleValue);
+    json_object_set_number(sampleObject, "deployment", sample.deployment);
+    json_object_set_number(sampleObject, "rssKb", static_cast<double>(sample.rssKb));
+    json_object_set_number(sampleObject, "fds", static_cast<double>(sample.fds));
+    json_object_set_number(sampleObject, "threads", static_cast<double>(sample.threads));
+    json_object_set_number(sampleObject, "heapBytes", static_cast<double>(sample.heapBytes));
+    json_object_set_number(sampleObject, "jsonBytes", static_cast<double>(sample.jsonBytes));
+    return sampleValue;
+}
+
+/**
+ * @brief Prints the growth of each resource from the baseline to the last sample, and writes the samples to the JSON
+ * file of @p options, if any.
+ *
+ * @returns True if no resource grew beyond its threshold.
+ */
+static bool Report(const SoakOptions& options, const std::vector<ProcessSample>& samples, unsigned int failures)
+{
+    const ProcessSample& baseline = samples.front();
+    const ProcessSample& last = samples.back();
+    const long rssGrowthKb = last.rssKb - baseline.rssKb;
+    const long fdGrowth = last.fds - baseline.fds;
+    const long threadGrowth = last.threads - baseline.threads;
+    const bool rssOk = rssGrowthKb <= static_cast<long>(options.maxRssGrowthKb);
+    const bool fdsOk = fdGrowth <= static_cast<long>(options.maxFdGrowth);
+    const bool threadsOk = threadGrowth <= static_cast<long>(options.maxThreadGrowth);
+    JSON_Value* rootValue = json_value_init_object();
+    JSON_Object* root = json_object(rootValue);
+    JSON_Value* samplesValue = json_value_init_array();
+    bool succeeded = rssOk && fdsOk && threadsOk && failures == 0;
+
+    printf(
+        "\nGrowth over %u deployments: RSS %+ld KB (max %u)%s, FDs %+ld (max %u)%s, threads %+ld (max %u)%s, "
+        "heap %+lld B, JSON heap %+lld B\n",
+        last.deployment - baseline.deployment,
+        rssGrowthKb,
+        options.maxRssGrowthKb,
+        rssOk ? "" : " FAILED",
+        fdGrowth,
+        options.maxFdGrowth,
+        fdsOk ? "" : " FAILED",
+        threadGrowth,
+        options.maxThreadGrowth,
+        threadsOk ? "" : " FAILED",
+        static_cast<long long>(last.heapBytes) - static_cast<long long>(baseline.heapBytes),
+        static_cast<long long>(last.jsonBytes) - static_cast<long long>(baseline.jsonBytes));
+
+    if (failures != 0)
+    {
+        printf("%u deployments weren't over in time\n", failures);
+    }
+
+    for (const ProcessSample& sample : samples)
+    {
+        json_array_append_value(json_array(samplesValue), SampleToJson(sample));
+    }
+
+    json_object_set_string(root, "deployment", options.deploymentPath.c_str());
+    json_object_set_number(root, "deployments", options.deployments);
+    json_object_set_number(root, "warmup", options.warmup);
+    json_object_set_number(root, "seed", options.seed);
+    json_object_set_number(root, "rssGrowthKb", static_cast<double>(rssGrowthKb));
+    json_object_set_number(root, "fdGrowth", static_cast<double>(fdGrowth));
+    json_object_set_number(root, "threadGrowth", static_cast<double>(threadGrowth));
+    json_object_set_number(root, "failures", failures);
+    json_object_set_boolean(root, "succeeded", succeeded);
+    json_object_set_value(root, "samples", samplesValue);
+
+    if (!options.jsonPath.empty() && json_serialize_to_file_pretty(rootValue, options.jsonPath.c_str()) != JSONSuccess)
+    {
+        fprintf(stderr, "Cannot write %s\n", options.jsonPath.c_str());
+        succeeded = false;
+    }
+
+    json_value_free(rootValue);
+
+    return succeeded;
+}
+
+//
+// Main
+//
+
+static void PrintUsage(const char* program)
+{
+    printf(
+        "Usage: %s --deployment <path> [options]\n"
+        "  --deployment <path>          Signed 'deviceUpdate' service property to deploy, with new workflow ids.\n"
+        "  --deployments <count>        Deployments to run after the warm-up. Default: 2000\n"
+        "  --warmup <count>             Deployments to run before the baseline is sampled. Default: 50\n"
+        "  --seed <number>              Seed of the deployment kinds and delays. Default: 1\n"
+        "  --cancel-percent <percent>   Deployments cancelled while in progress. Default: 10\n"
+        "  --replace-percent <percent>  Deployments replaced while in progress. Default: 10\n"
+        "  --latency-ms <ms>            Most latency of each simulated download, install and apply. Default: 20\n"
+        "  --reload-every <count>       Reload the handler after this many deployments; 0 never. Default: 100\n"
+        "  --max-rss-growth-kb <kb>     RSS growth that fails the run. Default: 8192\n"
+        "  --max-fd-growth <count>      Open file descriptors growth that fails the run. Default: 0\n"
+        "  --max-thread-growth <count>  Threads growth that fails the run. Default: 0\n"
+        "  --report-every <count>       Print a sample after this many deployments. Default: 100\n"
+        "  --handler <path>             Simulator handler extension. Default: " ADUC_HARNESS_HANDLER_PATH "\n"
+        "  --json <path>                Also write the samples to this file, as JSON.\n",
+        program);
+}
+
+static bool ParseCount(const char* value, unsigned int* count)
+{
+    char* end = nullptr;
+    const unsigned long parsed = strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || parsed > UINT32_MAX)
+    {
+        return false;
+    }
+
+    *count = static_cast<unsigned int>(parsed);
+    return true;
+}
+
+static bool ParseOptions(int argc, char** argv, SoakOptions* options)
+{
+    const struct
+    {
+        const char* name;
+        unsigned int* count;
+    } counts[] = {
+        { "--deployments", &options->deployments },
+        { "--warmup", &options->warmup },
+        { "--seed", &options->seed },
+        { "--cancel-percent", &options->cancelPercent },
+        { "--replace-percent", &options->replacePercent },
+        { "--latency-ms", &options->latencyMs },
+        { "--reload-every", &options->reloadEvery },
+        { "--max-rss-growth-kb", &options->maxRssGrowthKb },
+        { "--max-fd-growth", &options->maxFdGrowth },
+        { "--max-thread-growth", &options->maxThreadGrowth },
+        { "--report-every", &options->reportEvery },
+    };
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* name = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool parsed = false;
+
+        if (value == nullptr)
+        {
+            return false;
+        }
+
+        if (strcmp(name, "--deployment") == 0)
+        {
+            options->deploymentPath = value;
+            parsed = true;
+        }
+        else if (strcmp(name, "--handler") == 0)
+        {
+            options->handlerPath = value;
+            parsed = true;
+        }
+        else if (strcmp(name, "--json") == 0)
+        {
+            options->jsonPath = value;
+            parsed = true;
+        }
+
+        for (const auto& count : counts)
+        {
+            if (!parsed && strcmp(name, count.name) == 0)
+            {
+                if (!ParseCount(value, count.count))
+                {
+                    return false;
+                }
+
+                parsed = true;
+            }
+        }
+
+        if (!parsed)
+        {
+            return false;
+        }
+
+        i++;
+    }
+
+    return !options->deploymentPath.empty() && options->deployments > 0
+        && options->cancelPercent + options->replacePercent <= 100;
+}
+
+int main(int argc, char** argv)
+{
+    SoakOptions options;
+    JSON_Value* deploymentValue = nullptr;
+    HandlerExtension extension;
+    void* context = nullptr;
+    ADUC_WorkflowData* workflowData = nullptr;
+    ADUC_TestOverride_Hooks hooks = {};
+    int ret = 1;
+
+    if (!ParseOptions(argc, argv, &options))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    ADUC_JSON_EnableAllocationAccounting();
+
+    ADUC_Logging_Init(ADUC_LOG_WARN, "soak-harness");
+    ADUC_EventLoop_Init();
+
+    try
+    {
+        // The simulator data file, the goal state and the workflow state journal of the device.
+        TempFolder dataFolder;
+        const std::string behaviorArg = "--simulation_behavior_file=" + dataFolder.Path() + "/du-simulator-data.json";
+        char* platformArgv[] = { const_cast<char*>(behaviorArg.c_str()) }; // NOLINT
+        std::mt19937 generator{ options.seed };
+        std::uniform_int_distribution<unsigned int> percent{ 0, 99 };
+        std::vector<ProcessSample> samples;
+        unsigned int failures = 0;
+
+        deploymentValue = LoadDeployment(options.deploymentPath);
+        if (deploymentValue == nullptr || !WriteSimulatorData(options, dataFolder.Path()))
+        {
+            goto done;
+        }
+
+        // Where the simulator handler looks for its data file.
+        setenv("TMPDIR", dataFolder.Path().c_str(), 1 /* overwrite */);
+
+        if (!LoadHandler(options, &extension))
+        {
+            goto done;
+        }
+
+        // The client handle is never used: the reported properties go to AcknowledgeReportedState.
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast,performance-no-int-to-ptr)
+        if (!AzureDeviceUpdateCoreInterface_CreateForDevice(
+                &context, reinterpret_cast<ADUC_ClientHandle>(-1), dataFolder.Path().c_str(), 1, platformArgv))
+        {
+            fprintf(stderr, "Cannot create the 'deviceUpdate' component\n");
+            goto done;
+        }
+
+        workflowData = static_cast<ADUC_WorkflowData*>(context);
+
+        hooks.ContentHandler_TestOverride = extension.handler;
+        hooks.ClientHandle_SendReportedStateFunc_TestOverride =
+            reinterpret_cast<void*>(AcknowledgeReportedState); // NOLINT
+        workflowData->TestOverrides = &hooks;
+        workflowData->ReportStateAndResultAsyncCallback = CountStateAndResult;
+
+        workflowData->StartupIdleCallSent = true;
+        workflowData->WarmStartAttempted = true;
+        workflowData->LastReportedState = ADUCITF_State_Idle;
+
+        printf("%-10s %10s %10s %6s %8s %12s %12s\n", "", "deployment", "RSS KB", "FDs", "threads", "heap B", "JSON B");
+
+        if (options.warmup == 0)
+        {
+            samples.push_back(SampleProcess(0));
+            PrintSample("baseline", samples.back());
+        }
+
+        for (unsigned int index = 0; index < options.warmup + options.deployments; index++)
+        {
+            const unsigned int draw = percent(generator);
+            DeploymentKind kind = DeploymentKind::Complete;
+
+            if (draw < options.cancelPercent)
+            {
+                kind = DeploymentKind::Cancel;
+            }
+            else if (draw < options.cancelPercent + options.replacePercent)
+            {
+                kind = DeploymentKind::Replace;
+            }
+
+            if (!RunDeployment(options, generator, deploymentValue, index, kind, workflowData))
+            {
+                failures++;
+            }
+
+            // As the extension manager does when the handler registration changes.
+            if (options.reloadEvery != 0 && (index + 1) % options.reloadEvery == 0)
+            {
+                UnloadHandler(&extension);
+                if (!LoadHandler(options, &extension))
+                {
+                    failures++;
+                    break;
+                }
+
+                hooks.ContentHandler_TestOverride = extension.handler;
+            }
+
+            if (index + 1 < options.warmup)
+            {
+                continue;
+            }
+
+            samples.push_back(SampleProcess(index + 1));
+
+            if (samples.size() == 1)
+            {
+                PrintSample("baseline", samples.back());
+            }
+            else if (options.reportEvery != 0 && (index + 1 - options.warmup) % options.reportEvery == 0)
+            {
+                PrintSample("", samples.back());
+            }
+        }
+
+        if (!samples.empty())
+        {
+            PrintSample("last", samples.back());
+            ret = Report(options, samples, failures) ? 0 : 1;
+        }
+
+        AzureDeviceUpdateCoreInterface_Destroy(&context);
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+    }
+
+done:
+
+    UnloadHandler(&extension);
+    json_value_free(deploymentValue);
+
+    ADUC_EventLoop_UnInit();
+    ADUC_Logging_Uninit();
+
+    return ret;
+}
@@ -0,0 +1,70 @@
+/**
+ * @file workflow_utils_benchmark.cpp
+ * @brief Benchmarks the parsing of update manifests into workflows.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <aduc/workflow_utils.h>
+#include <benchmark/benchmark.h>
+
+#include <sstream>
+#include <string>
+
+/**
+ * @brief Returns the action of a deployment whose update manifest has @p stepCount inline steps, with a file each.
+ *
+ * @param stepCount The number of steps.
+ */
+static std::string MakeActionWithSteps(int stepCount)
+{
+    std::stringstream steps;
+    std::stringstream files;
+    std::stringstream fileUrls;
+
+    for (int i = 0; i < stepCount; i++)
+    {
+        const char* separator = i == 0 ? "" : ",";
+
+        steps << separator << R"({"handler": "microsoft/script:1", "files": ["f)" << i
+              << R"("], "handlerProperties": {"scriptFileName": "step.sh", "arguments": "--step )" << i << R"("}})";
+        files << separator << R"("f)" << i << R"(": {"fileName": "step)" << i
+              << R"(.sh", "sizeInBytes": 1024, "hashes": {"sha256": "E2o94XQss/K8niR1pW6OdaIS/y3tInwhEKMn/6Rw1Gw="}})";
+        fileUrls << separator << R"("f)" << i << R"(": "http://contoso.com/step)" << i << R"(.sh")";
+    }
+
+    std::stringstream action;
+    action << R"({"workflow": {"action": 3, "id": "benchmark"}, "updateManifest": {"manifestVersion": "4", )"
+           << R"("updateId": {"provider": "Contoso", "name": "Virtual-Vacuum", "version": "5.0"}, )"
+           << R"("compatibility": [{"deviceManufacturer": "contoso", "deviceModel": "virtual-vacuum-v1"}], )"
+           << R"("instructions": {"steps": [)" << steps.str() << R"(]}, "files": {)" << files.str()
+           << R"(}, "createdDateTime": "2022-01-27T13:45:05.8993329Z"}, "fileUrls": {)" << fileUrls.str() << "}}";
+
+    return action.str();
+}
+
+/**
+ * @brief Parses a deployment with state.range(0) steps.
+ */
+static void BM_WorkflowInit(benchmark::State& state)
+{
+    const std::string action = MakeActionWithSteps(static_cast<int>(state.range(0)));
+
+    for (auto _ : state)
+    {
+        ADUC_WorkflowHandle handle = nullptr;
+        const ADUC_Result result = workflow_init(action.c_str(), false /* validateManifest */, &handle);
+
+        if (IsAducResultCodeFailure(result.ResultCode))
+        {
+            state.SkipWithError("Cannot parse the deployment.");
+            break;
+        }
+
+        workflow_free(handle);
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * action.size()));
+}
+
+BENCHMARK(BM_WorkflowInit)->Arg(1)->Arg(10)->Arg(100)->ArgName("steps")->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,57 @@
+/**
+ * @file zlog_benchmark.cpp
+ * @brief Benchmarks logging to the file log from several threads.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "benchmark_helpers.hpp"
+
+#include <benchmark/benchmark.h>
+#include <zlog.h>
+
+#include <memory>
+
+/**
+ * @brief The folder of the log files, created by the first thread and removed by it once all threads are done.
+ */
+static std::unique_ptr<ADUC::Benchmarks::TempFolder> s_logFolder;
+
+/**
+ * @brief Logs a typical line from state.threads() threads at once, to the file log only.
+ */
+static void BM_ZlogLog(benchmark::State& state)
+{
+    if (state.thread_index() == 0)
+    {
+        s_logFolder.reset(new ADUC::Benchmarks::TempFolder());
+
+        if (zlog_init(
+                s_logFolder->Path().c_str(), "benchmark", ZLOG_DISABLED, ZLOG_ENABLED, ZLOG_ERROR, ZLOG_INFO, 0)
+            != 0)
+        {
+            state.SkipWithError("Cannot initialize zlog.");
+        }
+    }
+
+    for (auto _ : state)
+    {
+        zlog_log(
+            ZLOG_INFO,
+            "BM_ZlogLog",
+            "Downloading file %s, %d%% done, %llu bytes",
+            "contoso-firmware-1.0.swu",
+            42,
+            123456789ULL);
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+
+    if (state.thread_index() == 0)
+    {
+        zlog_finish();
+        s_logFolder.reset();
+    }
+}
+
+BENCHMARK(BM_ZlogLog)->ThreadRange(1, 8)->UseRealTime();
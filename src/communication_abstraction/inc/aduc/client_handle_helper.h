@@ -19,6 +19,11 @@
 
 EXTERN_C_BEGIN
 
+/**
+ * @brief Called by the I/O thread when it queued callbacks, for the caller of ClientHandle_DoWork to run them.
+ */
+typedef void (*ADUC_ClientCallbacksQueuedFunc)(void);
+
 /**
  * @brief Wrapper function for the Device and Module CreateFromConnectionString functions
  * @details Uses either the device or module function depending on what the client type has been set to.
@@ -84,10 +89,28 @@ MOCKABLE_FUNCTION(
 /**
  * @brief Wrapper for the Device and Module DoWork functions
  * @details Uses either the device or module function depending on what the client type has been set to.
+ * While the I/O thread runs, only runs the callbacks of @p iotHubClientHandle that the I/O thread queued.
  * @param iotHubClientHandle the clientHandle to be used for the operation
  */
 MOCKABLE_FUNCTION(, void, ClientHandle_DoWork, ADUC_ClientHandle, iotHubClientHandle);
 
+/**
+ * @brief Wrapper for the Device and Module GetSendStatus functions
+ * @details Uses either the device or module function depending on what the client type has been set to.
+ * @param iotHubClientHandle the clientHandle to be used for the operation
+ * @param iotHubClientStatus Set to IOTHUB_CLIENT_SEND_STATUS_BUSY while messages or reported properties are waiting to
+ * be sent or acknowledged, IOTHUB_CLIENT_SEND_STATUS_IDLE otherwise
+ * @returns a value of IOTHUB_CLIENT_RESULT
+ */
+MOCKABLE_FUNCTION(
+    ,
+    IOTHUB_CLIENT_RESULT,
+    ClientHandle_GetSendStatus,
+    ADUC_ClientHandle,
+    iotHubClientHandle,
+    IOTHUB_CLIENT_STATUS*,
+    iotHubClientStatus);
+
 /**
  * @brief Wrapper for the Device and Module SetOption functions
  * @details Uses either the device or module function depending on what the client type has been set to.
@@ -151,6 +174,12 @@ MOCKABLE_FUNCTION(
     void*,
     userContextCallback)
 
+/**
+ * @brief Returns the number of reported states ClientHandle_SendReportedState queued since the process started, e.g.
+ * to tell when the first one was sent.
+ */
+MOCKABLE_FUNCTION(, unsigned int, ClientHandle_GetReportedStateCount)
+
 /**
  * @brief Wrapper for the Device and Module SetDeviceMethodCallback functions
  * @details Uses either the device or module function depending on what the client type has been set to.
@@ -177,5 +206,23 @@ MOCKABLE_FUNCTION(
  */
 MOCKABLE_FUNCTION(, void, ClientHandle_Destroy, ADUC_ClientHandle, iotHubClientHandle)
 
+/**
+ * @brief Starts a thread that does the DoWork of all the clients, instead of ClientHandle_DoWork.
+ * @details Keep-alives, acknowledgements and cloud-to-device messages are then processed even while the caller of
+ * ClientHandle_DoWork is busy. The callbacks set through these wrappers still run in ClientHandle_DoWork: the I/O
+ * thread queues them and calls @p callbacksQueued. The device method callback, which isn't queued, runs on the I/O
+ * thread.
+ * @param callbacksQueued Called on the I/O thread when it queued callbacks, e.g. to wake up the caller of
+ * ClientHandle_DoWork. May be NULL.
+ * @returns true on success false on failure
+ */
+MOCKABLE_FUNCTION(, _Bool, ClientHandle_StartIoThread, ADUC_ClientCallbacksQueuedFunc, callbacksQueued)
+
+/**
+ * @brief Stops the thread started by ClientHandle_StartIoThread, if any. ClientHandle_DoWork then does the DoWork of
+ * the clients again.
+ */
+MOCKABLE_FUNCTION(, void, ClientHandle_StopIoThread)
+
 EXTERN_C_END
 #endif // CLIENT_HANDLE_HELPER_H
@@ -11,9 +11,17 @@
 #include <aduc/logging.h>
 #include <azureiot/iothub_device_client_ll.h>
 #include <azureiot/iothub_module_client_ll.h>
+#include <pthread.h>
+#include <string.h> // memcpy
+#include <time.h>
 
 static ADUC_ConnType g_ClientHandleType = ADUC_ConnType_NotSet;
 
+/**
+ * @brief The number of reported states queued, see ClientHandle_GetReportedStateCount.
+ */
+static unsigned int g_ReportedStateCount = 0;
+
 /**
  * @brief Safely casts @p handle to an IOTHUB_DEVICE_CLIENT_LL_HANDLE
  * @param handle the pointer to be cast
@@ -44,6 +52,387 @@ IOTHUB_MODULE_CLIENT_LL_HANDLE GetModuleClientHandle(ADUC_ClientHandle handle)
     return (IOTHUB_MODULE_CLIENT_LL_HANDLE)handle;
 }
 
+//
+// I/O thread
+//
+// Without the I/O thread, ClientHandle_DoWork does the DoWork of the client on the caller's thread, and the
+// callbacks run there, from within DoWork.
+// With it, the I/O thread does the DoWork of all the clients. The clients aren't thread safe, so all calls into them
+// are serialized by s_clientMutex. The callbacks are queued instead, and ClientHandle_DoWork runs them, so that they
+// still run on the caller's thread.
+//
+
+/**
+ * @brief The DoWork interval of the I/O thread, as recommended by the IoT Hub SDK.
+ */
+#define ADUC_CLIENT_IO_THREAD_INTERVAL_MS 100
+
+/**
+ * @brief The callbacks set through these wrappers.
+ */
+typedef enum tagADUC_ClientCallbackType
+{
+    ADUC_ClientCallbackType_ConnectionStatus,
+    ADUC_ClientCallbackType_DeviceTwin,
+    ADUC_ClientCallbackType_ReportedState,
+    ADUC_ClientCallbackType_EventConfirmation,
+} ADUC_ClientCallbackType;
+
+/**
+ * @brief A callback call, queued by the I/O thread.
+ */
+typedef struct tagADUC_ClientCallback
+{
+    ADUC_ClientCallbackType Type; /**< Which of Callback is set. */
+    ADUC_ClientHandle ClientHandle; /**< The client that made the call. */
+    union
+    {
+        IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK ConnectionStatus;
+        IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK DeviceTwin;
+        IOTHUB_CLIENT_REPORTED_STATE_CALLBACK ReportedState;
+        IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK EventConfirmation;
+    } Callback; /**< The callback. */
+    void* UserContext; /**< The context of the callback. */
+    int Status; /**< The connection status, twin update state, reported state status code or confirmation result. */
+    int Reason; /**< The connection status reason. */
+    unsigned char* Payload; /**< A copy of the twin payload. */
+    size_t PayloadSize; /**< The size of Payload. */
+    struct tagADUC_ClientCallback* Next; /**< The next queued call. */
+} ADUC_ClientCallback;
+
+/**
+ * @brief A client created by ClientHandle_CreateFromConnectionString, and its callbacks that aren't per call.
+ */
+typedef struct tagADUC_Client
+{
+    ADUC_ClientHandle Handle; /**< The client. */
+    IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK ConnectionStatusCallback; /**< The connection status callback. */
+    void* ConnectionStatusContext; /**< The context of ConnectionStatusCallback. */
+    IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK DeviceTwinCallback; /**< The twin callback. */
+    void* DeviceTwinContext; /**< The context of DeviceTwinCallback. */
+    struct tagADUC_Client* Next; /**< The next client. */
+} ADUC_Client;
+
+/**
+ * @brief Serializes the calls into the clients, and protects s_clients and s_ioThreadRunning.
+ * Recursive, as the callbacks run from within DoWork without the I/O thread, and may call the wrappers.
+ */
+static pthread_mutex_t s_clientMutex;
+static pthread_once_t s_clientMutexOnce = PTHREAD_ONCE_INIT;
+
+static ADUC_Client* s_clients = NULL;
+static _Bool s_ioThreadRunning = false;
+
+/**
+ * @brief Protects the I/O thread's state and s_queuedCallbacks.
+ */
+static pthread_mutex_t s_ioThreadMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_ioThreadCondition;
+static pthread_t s_ioThread;
+static _Bool s_ioThreadStarted = false;
+static _Bool s_ioThreadStopping = false;
+static _Bool s_ioThreadKicked = false;
+static ADUC_ClientCallbacksQueuedFunc s_callbacksQueued = NULL;
+static ADUC_ClientCallback* s_queuedCallbacks = NULL;
+static ADUC_ClientCallback* s_lastQueuedCallback = NULL;
+
+static void InitClientMutex(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&s_clientMutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static void LockClients(void)
+{
+    pthread_once(&s_clientMutexOnce, InitClientMutex);
+    pthread_mutex_lock(&s_clientMutex);
+}
+
+static void UnlockClients(void)
+{
+    pthread_mutex_unlock(&s_clientMutex);
+}
+
+/**
+ * @brief Finds the client of @p handle. Must be called with s_clientMutex held.
+ * @returns NULL if @p handle wasn't created by ClientHandle_CreateFromConnectionString
+ */
+static ADUC_Client* FindClientLocked(ADUC_ClientHandle handle)
+{
+    for (ADUC_Client* client = s_clients; client != NULL; client = client->Next)
+    {
+        if (client->Handle == handle)
+        {
+            return client;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Runs @p callback, then frees it.
+ */
+static void RunCallback(ADUC_ClientCallback* callback)
+{
+    switch (callback->Type)
+    {
+    case ADUC_ClientCallbackType_ConnectionStatus:
+        callback->Callback.ConnectionStatus(
+            (IOTHUB_CLIENT_CONNECTION_STATUS)callback->Status,
+            (IOTHUB_CLIENT_CONNECTION_STATUS_REASON)callback->Reason,
+            callback->UserContext);
+        break;
+
+    case ADUC_ClientCallbackType_DeviceTwin:
+        callback->Callback.DeviceTwin(
+            (DEVICE_TWIN_UPDATE_STATE)callback->Status,
+            callback->Payload,
+            callback->PayloadSize,
+            callback->UserContext);
+        break;
+
+    case ADUC_ClientCallbackType_ReportedState:
+        callback->Callback.ReportedState(callback->Status, callback->UserContext);
+        break;
+
+    case ADUC_ClientCallbackType_EventConfirmation:
+        callback->Callback.EventConfirmation(
+            (IOTHUB_CLIENT_CONFIRMATION_RESULT)callback->Status, callback->UserContext);
+        break;
+    }
+
+    free(callback->Payload);
+    free(callback);
+}
+
+/**
+ * @brief Runs @p callback right away without the I/O thread, or queues it for ClientHandle_DoWork.
+ * Called from within DoWork, so with s_clientMutex held.
+ */
+static void RunOrQueueCallbackLocked(ADUC_ClientCallback* callback)
+{
+    if (!s_ioThreadRunning)
+    {
+        RunCallback(callback);
+        return;
+    }
+
+    callback->Next = NULL;
+
+    pthread_mutex_lock(&s_ioThreadMutex);
+    if (s_lastQueuedCallback == NULL)
+    {
+        s_queuedCallbacks = callback;
+    }
+    else
+    {
+        s_lastQueuedCallback->Next = callback;
+    }
+    s_lastQueuedCallback = callback;
+    const ADUC_ClientCallbacksQueuedFunc callbacksQueued = s_callbacksQueued;
+    pthread_mutex_unlock(&s_ioThreadMutex);
+
+    if (callbacksQueued != NULL)
+    {
+        callbacksQueued();
+    }
+}
+
+/**
+ * @brief Runs the queued callbacks of @p handle, in the order they were queued.
+ */
+static void RunQueuedCallbacks(ADUC_ClientHandle handle)
+{
+    ADUC_ClientCallback* callbacks = NULL;
+    ADUC_ClientCallback** lastCallback = &callbacks;
+
+    pthread_mutex_lock(&s_ioThreadMutex);
+    ADUC_ClientCallback** next = &s_queuedCallbacks;
+    s_lastQueuedCallback = NULL;
+    while (*next != NULL)
+    {
+        ADUC_ClientCallback* callback = *next;
+        if (callback->ClientHandle == handle)
+        {
+            *next = callback->Next;
+            callback->Next = NULL;
+            *lastCallback = callback;
+            lastCallback = &callback->Next;
+        }
+        else
+        {
+            s_lastQueuedCallback = callback;
+            next = &callback->Next;
+        }
+    }
+    pthread_mutex_unlock(&s_ioThreadMutex);
+
+    while (callbacks != NULL)
+    {
+        ADUC_ClientCallback* callback = callbacks;
+        callbacks = callback->Next;
+        RunCallback(callback);
+    }
+}
+
+/**
+ * @brief Has the I/O thread do its next DoWork right away, e.g. to send a message.
+ */
+static void KickIoThread(void)
+{
+    pthread_mutex_lock(&s_ioThreadMutex);
+    if (s_ioThreadStarted)
+    {
+        s_ioThreadKicked = true;
+        pthread_cond_signal(&s_ioThreadCondition);
+    }
+    pthread_mutex_unlock(&s_ioThreadMutex);
+}
+
+static void ConnectionStatusCallbackTrampoline(
+    IOTHUB_CLIENT_CONNECTION_STATUS result, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void* context)
+{
+    const ADUC_Client* client = (const ADUC_Client*)context;
+    ADUC_ClientCallback* callback = (ADUC_ClientCallback*)calloc(1, sizeof(*callback));
+    if (callback == NULL)
+    {
+        Log_Error("Out of memory, dropping the connection status %d", result);
+        return;
+    }
+
+    callback->Type = ADUC_ClientCallbackType_ConnectionStatus;
+    callback->ClientHandle = client->Handle;
+    callback->Callback.ConnectionStatus = client->ConnectionStatusCallback;
+    callback->UserContext = client->ConnectionStatusContext;
+    callback->Status = (int)result;
+    callback->Reason = (int)reason;
+
+    RunOrQueueCallbackLocked(callback);
+}
+
+static void DeviceTwinCallbackTrampoline(
+    DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char* payload, size_t size, void* context)
+{
+    const ADUC_Client* client = (const ADUC_Client*)context;
+    ADUC_ClientCallback* callback = (ADUC_ClientCallback*)calloc(1, sizeof(*callback));
+    if (callback == NULL || (size != 0 && (callback->Payload = (unsigned char*)malloc(size)) == NULL))
+    {
+        Log_Error("Out of memory, dropping a twin update");
+        free(callback);
+        return;
+    }
+
+    callback->Type = ADUC_ClientCallbackType_DeviceTwin;
+    callback->ClientHandle = client->Handle;
+    callback->Callback.DeviceTwin = client->DeviceTwinCallback;
+    callback->UserContext = client->DeviceTwinContext;
+    callback->Status = (int)updateState;
+    if (size != 0)
+    {
+        memcpy(callback->Payload, payload, size);
+    }
+    callback->PayloadSize = size;
+
+    RunOrQueueCallbackLocked(callback);
+}
+
+static void ReportedStateCallbackTrampoline(int statusCode, void* context)
+{
+    ADUC_ClientCallback* callback = (ADUC_ClientCallback*)context;
+    callback->Status = statusCode;
+
+    RunOrQueueCallbackLocked(callback);
+}
+
+static void EventConfirmationCallbackTrampoline(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void* context)
+{
+    ADUC_ClientCallback* callback = (ADUC_ClientCallback*)context;
+    callback->Status = (int)result;
+
+    RunOrQueueCallbackLocked(callback);
+}
+
+/**
+ * @brief Allocates the call of a per call callback, passed as the context of its trampoline.
+ * @returns NULL if out of memory
+ */
+static ADUC_ClientCallback*
+CreatePerCallCallback(ADUC_ClientHandle handle, ADUC_ClientCallbackType type, void* userContext)
+{
+    ADUC_ClientCallback* callback = (ADUC_ClientCallback*)calloc(1, sizeof(*callback));
+    if (callback != NULL)
+    {
+        callback->Type = type;
+        callback->ClientHandle = handle;
+        callback->UserContext = userContext;
+    }
+
+    return callback;
+}
+
+/**
+ * @brief Does the DoWork of @p iotHubClientHandle. Must be called with s_clientMutex held.
+ */
+static void DoWorkLocked(ADUC_ClientHandle iotHubClientHandle)
+{
+    if (g_ClientHandleType == ADUC_ConnType_Device)
+    {
+        IoTHubDeviceClient_LL_DoWork(GetDeviceClientHandle(iotHubClientHandle));
+    }
+    else if (g_ClientHandleType == ADUC_ConnType_Module)
+    {
+        IoTHubModuleClient_LL_DoWork(GetModuleClientHandle(iotHubClientHandle));
+    }
+    else
+    {
+        Log_Error("ClientHandle_DoWork before called ClientHandle_CreateFromConnectionString");
+    }
+}
+
+/**
+ * @brief The body of the I/O thread.
+ */
+static void* ClientIoThread(void* arg)
+{
+    UNREFERENCED_PARAMETER(arg);
+
+    pthread_mutex_lock(&s_ioThreadMutex);
+    while (!s_ioThreadStopping)
+    {
+        s_ioThreadKicked = false;
+        pthread_mutex_unlock(&s_ioThreadMutex);
+
+        LockClients();
+        for (ADUC_Client* client = s_clients; client != NULL; client = client->Next)
+        {
+            DoWorkLocked(client->Handle);
+        }
+        UnlockClients();
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += ADUC_CLIENT_IO_THREAD_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&s_ioThreadMutex);
+        while (!s_ioThreadStopping && !s_ioThreadKicked
+               && pthread_cond_timedwait(&s_ioThreadCondition, &s_ioThreadMutex, &deadline) == 0)
+        {
+        }
+    }
+    pthread_mutex_unlock(&s_ioThreadMutex);
+
+    return NULL;
+}
+
 /**
  * @brief Wrapper function for the Device and Module CreateFromConnectionString functions
  * @details Uses either the device or module function depending on what the client type has been set to.
@@ -58,10 +447,12 @@ _Bool ClientHandle_CreateFromConnectionString(
     const char* connectionString,
     IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol)
 {
-    if (g_ClientHandleType != ADUC_ConnType_NotSet)
+    // The clients of a process, e.g. the renewed client of the agent or the devices of the fleet simulator,
+    // are all device clients or all module clients.
+    if (g_ClientHandleType != ADUC_ConnType_NotSet && g_ClientHandleType != type)
     {
         Log_Error(
-            "ClientHandle_CreateFromConnectionString called for a second time. Only supports a single connection per agent");
+            "ClientHandle_CreateFromConnectionString called with another connection type. Only supports a single connection type per agent");
         return false;
     }
 
@@ -103,6 +494,23 @@ done:
     }
 
     g_ClientHandleType = type;
+
+    ADUC_Client* client = (ADUC_Client*)calloc(1, sizeof(*client));
+    if (client == NULL)
+    {
+        Log_Error("Out of memory, destroying the new client");
+        ClientHandle_Destroy(*iotHubClientHandle);
+        *iotHubClientHandle = NULL;
+        return false;
+    }
+
+    client->Handle = *iotHubClientHandle;
+
+    LockClients();
+    client->Next = s_clients;
+    s_clients = client;
+    UnlockClients();
+
     return true;
 }
 
@@ -121,6 +529,18 @@ IOTHUB_CLIENT_RESULT ClientHandle_SetConnectionStatusCallback(
 {
     IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_INVALID_ARG;
 
+    LockClients();
+
+    // The callback goes through a trampoline, which queues it while the I/O thread runs.
+    ADUC_Client* client = FindClientLocked(iotHubClientHandle);
+    if (client != NULL && connectionStatusCallback != NULL)
+    {
+        client->ConnectionStatusCallback = connectionStatusCallback;
+        client->ConnectionStatusContext = userContextCallback;
+        connectionStatusCallback = ConnectionStatusCallbackTrampoline;
+        userContextCallback = client;
+    }
+
     if (g_ClientHandleType == ADUC_ConnType_Device)
     {
         result = IoTHubDeviceClient_LL_SetConnectionStatusCallback(
@@ -136,6 +556,8 @@ IOTHUB_CLIENT_RESULT ClientHandle_SetConnectionStatusCallback(
         Log_Error("ClientHandle_SetConnectionStatusCallback before called ClientHandle_CreateFromConnectionString");
     }
 
+    UnlockClients();
+
     return result;
 }
 
@@ -155,6 +577,23 @@ IOTHUB_CLIENT_RESULT ClientHandle_SendEventAsync(
     void* userContextCallback)
 {
     IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_INVALID_ARG;
+    ADUC_ClientCallback* callback = NULL;
+
+    if (eventConfirmationCallback != NULL)
+    {
+        callback = CreatePerCallCallback(
+            iotHubClientHandle, ADUC_ClientCallbackType_EventConfirmation, userContextCallback);
+        if (callback == NULL)
+        {
+            return IOTHUB_CLIENT_ERROR;
+        }
+
+        callback->Callback.EventConfirmation = eventConfirmationCallback;
+        eventConfirmationCallback = EventConfirmationCallbackTrampoline;
+        userContextCallback = callback;
+    }
+
+    LockClients();
 
     if (g_ClientHandleType == ADUC_ConnType_Device)
     {
@@ -176,28 +615,71 @@ IOTHUB_CLIENT_RESULT ClientHandle_SendEventAsync(
     {
         Log_Error("ClientHandle_SendEventAsync before called ClientHandle_CreateFromConnectionString");
     }
+
+    UnlockClients();
+
+    if (result != IOTHUB_CLIENT_OK)
+    {
+        // Not sent, so the callback won't be called.
+        free(callback);
+    }
+    else
+    {
+        KickIoThread();
+    }
+
     return result;
 }
 
 /**
  * @brief Wrapper for the Device and Module DoWork functions
  * @details Uses either the device or module function depending on what the client type has been set to.
+ * While the I/O thread runs, only runs the callbacks of @p iotHubClientHandle that the I/O thread queued.
  * @param iotHubClientHandle the clientHandle to be used for the operation
  */
 void ClientHandle_DoWork(ADUC_ClientHandle iotHubClientHandle)
 {
+    // Including those queued before the I/O thread stopped.
+    RunQueuedCallbacks(iotHubClientHandle);
+
+    LockClients();
+    if (!s_ioThreadRunning)
+    {
+        DoWorkLocked(iotHubClientHandle);
+    }
+    UnlockClients();
+}
+
+/**
+ * @brief Wrapper for the Device and Module GetSendStatus functions
+ * @details Uses either the device or module function depending on what the client type has been set to.
+ * @param iotHubClientHandle the clientHandle to be used for the operation
+ * @param iotHubClientStatus Set to the send status of the client
+ * @returns a value of IOTHUB_CLIENT_RESULT
+ */
+IOTHUB_CLIENT_RESULT
+ClientHandle_GetSendStatus(ADUC_ClientHandle iotHubClientHandle, IOTHUB_CLIENT_STATUS* iotHubClientStatus)
+{
+    IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_INVALID_ARG;
+
+    LockClients();
+
     if (g_ClientHandleType == ADUC_ConnType_Device)
     {
-        IoTHubDeviceClient_LL_DoWork(GetDeviceClientHandle(iotHubClientHandle));
+        result = IoTHubDeviceClient_LL_GetSendStatus(GetDeviceClientHandle(iotHubClientHandle), iotHubClientStatus);
     }
     else if (g_ClientHandleType == ADUC_ConnType_Module)
     {
-        IoTHubModuleClient_LL_DoWork(GetModuleClientHandle(iotHubClientHandle));
+        result = IoTHubModuleClient_LL_GetSendStatus(GetModuleClientHandle(iotHubClientHandle), iotHubClientStatus);
     }
     else
     {
-        Log_Error("ClientHandle_DoWork before called ClientHandle_CreateFromConnectionString");
+        Log_Error("ClientHandle_GetSendStatus before called ClientHandle_CreateFromConnectionString");
     }
+
+    UnlockClients();
+
+    return result;
 }
 
 /**
@@ -213,6 +695,8 @@ ClientHandle_SetOption(ADUC_ClientHandle iotHubClientHandle, const char* optionN
 {
     IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_INVALID_ARG;
 
+    LockClients();
+
     if (g_ClientHandleType == ADUC_ConnType_Device)
     {
         result = IoTHubDeviceClient_LL_SetOption(GetDeviceClientHandle(iotHubClientHandle), optionName, value);
@@ -226,6 +710,8 @@ ClientHandle_SetOption(ADUC_ClientHandle iotHubClientHandle, const char* optionN
         Log_Error("ClientHandle_SetOption before called ClientHandle_CreateFromConnectionString");
     }
 
+    UnlockClients();
+
     return result;
 }
 
@@ -244,6 +730,18 @@ IOTHUB_CLIENT_RESULT ClientHandle_SetClientTwinCallback(
 {
     IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_INVALID_ARG;
 
+    LockClients();
+
+    // The callback goes through a trampoline, which queues it while the I/O thread runs.
+    ADUC_Client* client = FindClientLocked(iotHubClientHandle);
+    if (client != NULL && deviceTwinCallback != NULL)
+    {
+        client->DeviceTwinCallback = deviceTwinCallback;
+        client->DeviceTwinContext = userContextCallback;
+        deviceTwinCallback = DeviceTwinCallbackTrampoline;
+        userContextCallback = client;
+    }
+
     if (g_ClientHandleType == ADUC_ConnType_Device)
     {
         result = IoTHubDeviceClient_LL_SetDeviceTwinCallback(
@@ -259,6 +757,8 @@ IOTHUB_CLIENT_RESULT ClientHandle_SetClientTwinCallback(
         Log_Error("ClientHandle_SetClientTwinCallback before called ClientHandle_CreateFromConnectionString");
     }
 
+    UnlockClients();
+
     return result;
 }
 
@@ -280,6 +780,23 @@ IOTHUB_CLIENT_RESULT ClientHandle_SendReportedState(
     void* userContextCallback)
 {
     IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_INVALID_ARG;
+    ADUC_ClientCallback* callback = NULL;
+
+    if (reportedStateCallback != NULL)
+    {
+        callback =
+            CreatePerCallCallback(iotHubClientHandle, ADUC_ClientCallbackType_ReportedState, userContextCallback);
+        if (callback == NULL)
+        {
+            return IOTHUB_CLIENT_ERROR;
+        }
+
+        callback->Callback.ReportedState = reportedStateCallback;
+        reportedStateCallback = ReportedStateCallbackTrampoline;
+        userContextCallback = callback;
+    }
+
+    LockClients();
 
     if (g_ClientHandleType == ADUC_ConnType_Device)
     {
@@ -304,9 +821,27 @@ IOTHUB_CLIENT_RESULT ClientHandle_SendReportedState(
         Log_Error("ClientHandle_SendReportedState before called ClientHandle_CreateFromConnectionString");
     }
 
+    UnlockClients();
+
+    if (result != IOTHUB_CLIENT_OK)
+    {
+        // Not sent, so the callback won't be called.
+        free(callback);
+    }
+    else
+    {
+        __atomic_add_fetch(&g_ReportedStateCount, 1, __ATOMIC_RELAXED);
+        KickIoThread();
+    }
+
     return result;
 }
 
+unsigned int ClientHandle_GetReportedStateCount()
+{
+    return __atomic_load_n(&g_ReportedStateCount, __ATOMIC_RELAXED);
+}
+
 /**
  * @brief Wrapper for the Device and Module SetDeviceMethodCallback functions
  * @details Uses either the device or module function depending on what the client type has been set to.
@@ -322,6 +857,8 @@ IOTHUB_CLIENT_RESULT ClientHandle_SetDeviceMethodCallback(
 {
     IOTHUB_CLIENT_RESULT result = IOTHUB_CLIENT_INVALID_ARG;
 
+    LockClients();
+
     if (g_ClientHandleType == ADUC_ConnType_Device)
     {
         result = IoTHubDeviceClient_LL_SetDeviceMethodCallback(
@@ -337,6 +874,8 @@ IOTHUB_CLIENT_RESULT ClientHandle_SetDeviceMethodCallback(
         Log_Error("ClientHandle_SetDeviceMethodCallback before called ClientHandle_CreateFromConnectionString");
     }
 
+    UnlockClients();
+
     return result;
 }
 
@@ -347,6 +886,8 @@ IOTHUB_CLIENT_RESULT ClientHandle_SetDeviceMethodCallback(
  */
 void ClientHandle_Destroy(ADUC_ClientHandle iotHubClientHandle)
 {
+    LockClients();
+
     if (g_ClientHandleType == ADUC_ConnType_Device)
     {
         IoTHubDeviceClient_LL_Destroy(GetDeviceClientHandle(iotHubClientHandle));
@@ -359,4 +900,115 @@ void ClientHandle_Destroy(ADUC_ClientHandle iotHubClientHandle)
     {
         Log_Error("ClientHandle_Destroy before called ClientHandle_CreateFromConnectionString");
     }
+
+    for (ADUC_Client** next = &s_clients; *next != NULL; next = &(*next)->Next)
+    {
+        if ((*next)->Handle == iotHubClientHandle)
+        {
+            ADUC_Client* client = *next;
+            *next = client->Next;
+            free(client);
+            break;
+        }
+    }
+
+    UnlockClients();
+
+    // The client calls the callbacks of the pending calls as it is destroyed; run those that were queued.
+    RunQueuedCallbacks(iotHubClientHandle);
+}
+
+/**
+ * @brief Starts a thread that does the DoWork of all the clients, instead of ClientHandle_DoWork.
+ * @param callbacksQueued Called on the I/O thread when it queued callbacks. May be NULL.
+ * @returns true on success false on failure
+ */
+_Bool ClientHandle_StartIoThread(ADUC_ClientCallbacksQueuedFunc callbacksQueued)
+{
+    _Bool succeeded = false;
+    pthread_condattr_t attr;
+
+    pthread_mutex_lock(&s_ioThreadMutex);
+
+    if (s_ioThreadStarted)
+    {
+        Log_Error("The IoT Hub client I/O thread is already started");
+        goto done;
+    }
+
+    if (pthread_condattr_init(&attr) != 0)
+    {
+        goto done;
+    }
+
+    const _Bool conditionCreated = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0
+        && pthread_cond_init(&s_ioThreadCondition, &attr) == 0;
+    pthread_condattr_destroy(&attr);
+
+    if (!conditionCreated)
+    {
+        Log_Error("Cannot create the condition of the IoT Hub client I/O thread");
+        goto done;
+    }
+
+    s_callbacksQueued = callbacksQueued;
+    s_ioThreadStopping = false;
+    s_ioThreadKicked = false;
+
+    // Set first, so that DoWork stops pumping the clients before the thread starts.
+    LockClients();
+    s_ioThreadRunning = true;
+    UnlockClients();
+
+    if (pthread_create(&s_ioThread, NULL, ClientIoThread, NULL) != 0)
+    {
+        Log_Error("Cannot start the IoT Hub client I/O thread");
+
+        LockClients();
+        s_ioThreadRunning = false;
+        UnlockClients();
+
+        pthread_cond_destroy(&s_ioThreadCondition);
+        goto done;
+    }
+
+    s_ioThreadStarted = true;
+    succeeded = true;
+
+done:
+    pthread_mutex_unlock(&s_ioThreadMutex);
+
+    return succeeded;
+}
+
+/**
+ * @brief Stops the thread started by ClientHandle_StartIoThread, if any.
+ */
+void ClientHandle_StopIoThread()
+{
+    pthread_mutex_lock(&s_ioThreadMutex);
+    const _Bool started = s_ioThreadStarted;
+    s_ioThreadStopping = true;
+    if (started)
+    {
+        pthread_cond_signal(&s_ioThreadCondition);
+    }
+    pthread_mutex_unlock(&s_ioThreadMutex);
+
+    if (!started)
+    {
+        return;
+    }
+
+    pthread_join(s_ioThread, NULL);
+
+    LockClients();
+    s_ioThreadRunning = false;
+    UnlockClients();
+
+    pthread_mutex_lock(&s_ioThreadMutex);
+    s_ioThreadStarted = false;
+    s_callbacksQueued = NULL;
+    pthread_cond_destroy(&s_ioThreadCondition);
+    pthread_mutex_unlock(&s_ioThreadMutex);
 }
@@ -48,6 +48,11 @@ public:
     ADUC_Result Cancel(const tagADUC_WorkflowData* workflowData) override;
     ADUC_Result IsInstalled(const tagADUC_WorkflowData* workflowData) override;
 
+    bool DownloadBatch(
+        const tagADUC_WorkflowData* const* stepWorkflows, size_t stepCount, ADUC_Result* results) override;
+    bool InstallBatch(
+        const tagADUC_WorkflowData* const* stepWorkflows, size_t stepCount, ADUC_Result* results) override;
+
 
 protected:
     AptHandlerImpl()
@@ -56,6 +61,10 @@ protected:
 
 private:
     ADUC_Result ParseContent(const std::string& aptManifestFile, std::unique_ptr<AptContent>& aptContent);
+    ADUC_Result GetContent(
+        const tagADUC_WorkflowData* workflowData,
+        bool download,
+        std::unique_ptr<AptContent>& aptContent); // NOLINT(google-runtime-references)
 };
 
 /**
@@ -44,6 +44,18 @@ struct AptContent
     bool AgentRestartRequired;
 };
 
+/**
+ * @brief A package archive apt-get would download, as printed by 'apt-get --print-uris'.
+ */
+struct AptPackageUri
+{
+    std::string Uri;
+    std::string FileName; //!< The name of the archive in the APT archives folder.
+    size_t Size;
+    std::string HashType; //!< e.g. SHA256.
+    std::string HashHex; //!< The hash value, hex encoded.
+};
+
 namespace AptParser
 {
 /**
@@ -62,6 +74,16 @@ std::unique_ptr<AptContent> ParseAptContentFromFile(const std::string& filepath)
 */
 std::unique_ptr<AptContent> ParseAptContentFromString(const std::string& aptString);
 
+/**
+ * @brief Parses one line of the output of 'apt-get --print-uris'.
+ * e.g. 'http://deb.example.com/pool/main/f/foo/foo_1.0_amd64.deb' foo_1.0_amd64.deb 1234 SHA256:0123...
+ *
+ * @param line The line.
+ * @param packageUri Receives the package archive.
+ * @return bool false if the line doesn't describe a package archive.
+ */
+bool ParsePrintUrisLine(const std::string& line, AptPackageUri* packageUri);
+
 /**
  * @class APT ParserException
  * @brief Exception throw by APT Parser.
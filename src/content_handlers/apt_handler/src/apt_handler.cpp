@@ -10,30 +10,98 @@
  *   Expected files:
  *   <manifest>.json - contains apt configuration and package list.
  *
+ *   Optional prefetch: when handlerProperties has 'prefetchPackages' set to "true", Download resolves
+ *   the package archives with 'apt-get --print-uris' and fetches them with the content downloader,
+ *   several at a time, so they can resume and be served from the download cache. Install then points
+ *   apt-get at those archives. If they can't be resolved or fetched, apt-get downloads them as usual.
+ *
+ *   Optional fast install: when handlerProperties has 'fastInstall' set to "true", dpkg runs with
+ *   --force-unsafe-io, so it doesn't fsync each file it unpacks, and adu-shell syncs the file systems once
+ *   at the end of the transaction instead. Only for devices whose file system orders the renames after
+ *   the data, e.g. ext4 with its journal.
+ *
  * @copyright Copyright (c) Microsoft Corporation.
  * Licensed under the MIT License.
  */
 #include "aduc/apt_handler.hpp"
 #include "aduc/adu_core_exports.h"
+#include "aduc/adushell_broker_utils.hpp"
 #include "aduc/extension_manager.hpp"
+#include "aduc/hash_utils.h"
 #include "aduc/installed_criteria_utils.hpp"
 #include "aduc/logging.h"
 #include "aduc/process_utils.hpp"
+#include "aduc/system_utils.h"
 #include "aduc/types/update_content.h"
 #include "aduc/workflow_data_utils.h"
 #include "aduc/workflow_utils.h"
 #include "adushell_const.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <cstring>
 #include <fstream>
+#include <list>
+#include <mutex>
 #include <parson.h>
+#include <unordered_map>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include <azure_c_shared_utility/azure_base64.h>
+#include <azure_c_shared_utility/buffer_.h>
+#include <azure_c_shared_utility/strings.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace adushconst = Adu::Shell::Const;
 
+/**
+ * @brief How long the package lists refreshed by apt-get update are considered current, unless they
+ * or the APT sources change. Lets the steps of a bundle share one refresh.
+ */
+#define APT_CATALOG_FRESHNESS_WINDOW_SECONDS 300
+
+#define APT_SOURCES_LIST_FILE_PATH "/etc/apt/sources.list"
+#define APT_SOURCES_LIST_DIR_PATH "/etc/apt/sources.list.d"
+#define APT_LISTS_DIR_PATH "/var/lib/apt/lists"
+
+/**
+ * @brief The number of package archives prefetched at the same time.
+ */
+#define APT_PREFETCH_CONCURRENCY 4
+
+/**
+ * @brief The folder, in the update's work folder, that package archives are prefetched to.
+ */
+#define APT_PREFETCH_ARCHIVES_FOLDER_NAME "apt-archives"
+
+/**
+ * @brief Serializes package list refreshes, and protects the state of the last refresh.
+ */
+static std::mutex s_aptCatalogMutex;
+
+/**
+ * @brief The fingerprint of the APT sources and package lists right after the last successful refresh,
+ * empty if there wasn't one.
+ */
+static std::string s_aptCatalogFingerprint;
+
+/**
+ * @brief When the last successful refresh finished.
+ */
+static std::chrono::steady_clock::time_point s_aptCatalogRefreshTime;
+
 EXTERN_C_BEGIN
 
+#ifndef ADUC_BUILTIN_CONTENT_HANDLER
+
 /**
  * @brief Instantiates an Update Content Handler for 'microsoft/apt:1' update type.
  */
@@ -58,6 +126,8 @@ ContentHandler* CreateUpdateContentHandlerExtension(ADUC_LOG_SEVERITY logLevel)
     return nullptr;
 }
 
+#endif // ADUC_BUILTIN_CONTENT_HANDLER
+
 EXTERN_C_END
 
 /**
@@ -65,7 +135,9 @@ EXTERN_C_END
  */
 AptHandlerImpl::~AptHandlerImpl() // override
 {
+#ifndef ADUC_BUILTIN_CONTENT_HANDLER
     ADUC_Logging_Uninit();
+#endif
 }
 
 /**
@@ -79,6 +151,147 @@ ContentHandler* AptHandlerImpl::CreateContentHandler()
     return new AptHandlerImpl();
 }
 
+/**
+ * @brief Feeds the regular files of the directory at @p dirPath into @p context, in name order.
+ *
+ * @param context The hash context.
+ * @param dirPath The directory. A missing directory adds nothing.
+ * @param hashContent Whether to feed the content of the files, instead of their size and modification time.
+ * @return bool true on success.
+ */
+static bool HashDirectoryFiles(ADUC_HashUtils_Context* context, const char* dirPath, bool hashContent)
+{
+    std::vector<std::string> names;
+    DIR* dir = opendir(dirPath);
+
+    if (dir == nullptr)
+    {
+        return true;
+    }
+
+    for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        // The lock file is touched by apt itself, not by changes to the lists.
+        if (strcmp(entry->d_name, "lock") != 0)
+        {
+            names.emplace_back(entry->d_name);
+        }
+    }
+
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    for (const std::string& name : names)
+    {
+        const std::string path = std::string(dirPath) + "/" + name;
+        struct stat st = {};
+
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+
+        std::stringstream entry;
+        entry << path << "\n";
+
+        if (!hashContent)
+        {
+            entry << st.st_size << ":" << st.st_mtim.tv_sec << "." << st.st_mtim.tv_nsec << "\n";
+        }
+
+        const std::string entryString = entry.str();
+
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        if (!ADUC_HashUtils_ContextInput(
+                context, reinterpret_cast<const uint8_t*>(entryString.data()), entryString.size()))
+        {
+            return false;
+        }
+
+        if (hashContent && !ADUC_HashUtils_ContextInputFile(context, path.c_str()))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Gets a digest of the APT sources configuration, and of the names, sizes and modification times
+ * of the package lists.
+ *
+ * @param fingerprint Receives the digest.
+ * @return bool true on success.
+ */
+static bool GetAptCatalogFingerprint(std::string* fingerprint)
+{
+    ADUC_HashUtils_Context context = {};
+    char* hash = nullptr;
+    bool succeeded = false;
+
+    if (!ADUC_HashUtils_ContextReset(&context, SHA256))
+    {
+        goto done;
+    }
+
+    if (access(APT_SOURCES_LIST_FILE_PATH, F_OK) == 0
+        && !ADUC_HashUtils_ContextInputFile(&context, APT_SOURCES_LIST_FILE_PATH))
+    {
+        goto done;
+    }
+
+    if (!HashDirectoryFiles(&context, APT_SOURCES_LIST_DIR_PATH, true /* hashContent */)
+        || !HashDirectoryFiles(&context, APT_LISTS_DIR_PATH, false /* hashContent */))
+    {
+        goto done;
+    }
+
+    if (!ADUC_HashUtils_ContextResult(&context, nullptr, &hash))
+    {
+        goto done;
+    }
+
+    *fingerprint = hash;
+    succeeded = true;
+
+done:
+    ADUC_HashUtils_ContextUnInit(&context);
+    free(hash);
+    return succeeded;
+}
+
+/**
+ * @brief Returns whether the package lists were refreshed less than APT_CATALOG_FRESHNESS_WINDOW_SECONDS ago,
+ * and neither they nor the APT sources changed since. Must be called with s_aptCatalogMutex held.
+ */
+static bool IsAptCatalogFreshLocked()
+{
+    std::string fingerprint;
+
+    if (s_aptCatalogFingerprint.empty()
+        || std::chrono::steady_clock::now() - s_aptCatalogRefreshTime
+            > std::chrono::seconds(APT_CATALOG_FRESHNESS_WINDOW_SECONDS))
+    {
+        return false;
+    }
+
+    return GetAptCatalogFingerprint(&fingerprint) && fingerprint == s_aptCatalogFingerprint;
+}
+
+/**
+ * @brief Records a successful refresh of the package lists. Must be called with s_aptCatalogMutex held.
+ */
+static void RecordAptCatalogRefreshLocked()
+{
+    if (!GetAptCatalogFingerprint(&s_aptCatalogFingerprint))
+    {
+        s_aptCatalogFingerprint.clear();
+    }
+
+    s_aptCatalogRefreshTime = std::chrono::steady_clock::now();
+}
+
 ADUC_Result AptHandlerImpl::ParseContent(const std::string& aptManifestFile, std::unique_ptr<AptContent>& aptContent)
 {
     ADUC_Result result = { ADUC_GeneralResult_Success };
@@ -101,223 +314,678 @@ done:
 }
 
 /**
- * @brief Download implementation for APT handler.
+ * @brief Runs apt-get update, unless the package lists were just refreshed, see IsAptCatalogFreshLocked.
+ * A failure is only logged; the packages may still be available from the current lists.
+ */
+static void RefreshAptCatalog()
+{
+    std::string aptOutput;
+    int aptExitCode = -1;
+    std::lock_guard<std::mutex> catalogLock(s_aptCatalogMutex);
+
+    if (IsAptCatalogFreshLocked())
+    {
+        Log_Info("APT package lists are up to date, skipping apt-get update.");
+        return;
+    }
+
+    try
+    {
+        const std::vector<std::string> args = { adushconst::update_type_opt,
+                                                adushconst::update_type_microsoft_apt,
+                                                adushconst::update_action_opt,
+                                                adushconst::update_action_initialize };
+
+        aptExitCode = ADUC_LaunchAduShell(adushconst::adu_shell, args, aptOutput);
+
+        if (!aptOutput.empty())
+        {
+            Log_Info(aptOutput.c_str());
+        }
+    }
+    catch (const std::exception& de)
+    {
+        Log_Error("Exception occurred while processing apt-get update.\n%s", de.what());
+        aptExitCode = -1;
+    }
+
+    if (aptExitCode != 0)
+    {
+        Log_Error("APT update failed. (Exit code: %d)", aptExitCode);
+        return;
+    }
+
+    RecordAptCatalogRefreshLocked();
+}
+
+/**
+ * @brief Runs the adu-shell microsoft/apt @p action for @p packages.
  *
- * @return ADUC_Result The result of the download.
+ * @param action The adu-shell update action, i.e. download or install.
+ * @param packages The packages.
+ * @param archivesFolder The folder of the prefetched package archives to install from, or empty.
+ * @param fastInstall Whether the install runs dpkg with --force-unsafe-io, see the file comment.
+ * @param cancellationToken Terminates adu-shell once cancelled. Only for the download; dpkg must not be interrupted.
+ * @return int The exit code of adu-shell, -1 if it couldn't be launched.
  */
-ADUC_Result AptHandlerImpl::Download(const tagADUC_WorkflowData* workflowData)
+static int LaunchAptAction(
+    const char* action,
+    const std::list<std::string>& packages,
+    const std::string& archivesFolder,
+    bool fastInstall,
+    const ADUC_CancellationToken* cancellationToken = nullptr)
 {
-    ADUC_Result result = { ADUC_Result_Failure };
-    std::stringstream aptManifestFilename;
-    std::unique_ptr<AptContent> aptContent{ nullptr };
-    ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
+    std::string aptOutput;
+    int aptExitCode = -1;
 
-    // For 'microsoft/apt:1', we're expecting 1 payload file.
-    int fileCount = workflow_get_update_files_count(handle);
-    if (fileCount != 1)
+    try
     {
-        Log_Error("APT packages expecting one file. (%d)", fileCount);
-        return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_APT_HANDLER_PACKAGE_PREPARE_FAILURE_WRONG_FILECOUNT };
+        std::vector<std::string> args = { adushconst::update_type_opt,
+                                          adushconst::update_type_microsoft_apt,
+                                          adushconst::update_action_opt,
+                                          action };
+
+        std::stringstream data;
+
+        if (strcmp(action, adushconst::update_action_install) == 0)
+        {
+            //
+            // For public preview, we're passing following additional options to apt-get.
+            //
+            // '-y' (assumed yes)
+            //  -o Dpkg::Options::=--force-confdef -o Dpkg::Options::=--force-confold" (preserve existing config.yaml file by default)
+            //
+            std::string targetOptions = "-o Dpkg::Options::=--force-confdef -o Dpkg::Options::=--force-confold";
+
+            if (!archivesFolder.empty())
+            {
+                targetOptions += " -o Dir::Cache::Archives=" + archivesFolder + "/";
+            }
+
+            if (fastInstall)
+            {
+                targetOptions += " -o Dpkg::Options::=--force-unsafe-io";
+            }
+
+            args.emplace_back(adushconst::target_options_opt);
+            args.emplace_back(targetOptions);
+
+            // For microsoft/apt, target-data is a list of packages.
+            for (const std::string& package : packages)
+            {
+                data << package << " ";
+            }
+        }
+        else
+        {
+            // For microsoft/apt, target-data is a list of packages.
+            data << "'";
+            for (const std::string& package : packages)
+            {
+                data << package << " ";
+            }
+            data << "'";
+        }
+
+        args.emplace_back(adushconst::target_data_opt);
+        args.emplace_back(data.str());
+
+        aptExitCode = ADUC_LaunchAduShell(adushconst::adu_shell, args, aptOutput, cancellationToken);
+
+        if (!aptOutput.empty())
+        {
+            Log_Info(aptOutput.c_str());
+        }
+    }
+    catch (const std::exception& de)
+    {
+        Log_Error("Exception occurred during %s. %s", action, de.what());
+        aptExitCode = -1;
     }
 
-    char* workFolder = workflow_get_workfolder(handle);
-    char* workflowId = workflow_get_id(handle);
+    return aptExitCode;
+}
 
-    ADUC_FileEntity* fileEntity = nullptr;
+/**
+ * @brief Returns whether the package archives of the step @p handle are prefetched, see the file comment.
+ */
+static bool IsPrefetchEnabled(ADUC_WorkflowHandle handle)
+{
+    const char* prefetchPackages = workflow_peek_update_manifest_handler_properties_string(handle, "prefetchPackages");
+    return prefetchPackages != nullptr && strcmp(prefetchPackages, "true") == 0;
+}
 
-    if (!workflow_get_update_file(handle, 0, &fileEntity))
+/**
+ * @brief Returns whether the step @p handle installs with dpkg's --force-unsafe-io, see the file comment.
+ */
+static bool IsFastInstallEnabled(ADUC_WorkflowHandle handle)
+{
+    const char* fastInstall = workflow_peek_update_manifest_handler_properties_string(handle, "fastInstall");
+    return fastInstall != nullptr && strcmp(fastInstall, "true") == 0;
+}
+
+/**
+ * @brief Returns the folder the package archives of the step @p handle are prefetched to. The steps of a
+ * steps update share the folder of their parent, so that archives prefetched together are installed together.
+ */
+static std::string GetPrefetchArchivesFolder(ADUC_WorkflowHandle handle)
+{
+    ADUC_WorkflowHandle parent = workflow_get_parent(handle);
+    char* workFolder = workflow_get_workfolder(parent != nullptr ? parent : handle);
+    std::string archivesFolder;
+
+    if (workFolder != nullptr)
     {
-        result = { ADUC_Result_Failure, ADUC_ERC_APT_HANDLER_GET_FILEENTITY_FAILURE };
-        goto done;
+        archivesFolder = std::string(workFolder) + "/" APT_PREFETCH_ARCHIVES_FOLDER_NAME;
     }
 
-    aptManifestFilename << workFolder << "/" << fileEntity->TargetFilename;
+    workflow_free_string(workFolder);
+    return archivesFolder;
+}
 
-    // Download the APT manifest file.
-    result = ExtensionManager::Download(fileEntity, workflowId, workFolder, DO_RETRY_TIMEOUT_DEFAULT, nullptr);
+/**
+ * @brief Converts a hex encoded hash, as printed by apt-get, to base64, as expected by the content downloader.
+ */
+static bool HexHashToBase64(const std::string& hashHex, std::string* hashBase64)
+{
+    std::vector<unsigned char> hash;
 
-    workflow_free_file_entity(fileEntity);
-    fileEntity = nullptr;
+    if (hashHex.empty() || hashHex.size() % 2 != 0)
+    {
+        return false;
+    }
 
-    if (IsAducResultCodeFailure(result.ResultCode))
+    for (size_t i = 0; i < hashHex.size(); i += 2)
     {
-        goto done;
+        if (!isxdigit(static_cast<unsigned char>(hashHex[i]))
+            || !isxdigit(static_cast<unsigned char>(hashHex[i + 1])))
+        {
+            return false;
+        }
+
+        hash.push_back(static_cast<unsigned char>(std::stoul(hashHex.substr(i, 2), nullptr, 16)));
     }
 
-    result = ParseContent(aptManifestFilename.str(), aptContent);
-    if (IsAducResultCodeFailure(result.ResultCode))
+    STRING_HANDLE encoded = Azure_Base64_Encode_Bytes(hash.data(), hash.size());
+    if (encoded == nullptr)
     {
-        goto done;
+        return false;
     }
 
+    *hashBase64 = STRING_c_str(encoded);
+    STRING_delete(encoded);
+    return true;
+}
+
+/**
+ * @brief Resolves the package archives apt-get would download to install @p packages.
+ *
+ * @param packages The packages.
+ * @param packageUris Receives the package archives. Empty if the packages are already installed.
+ * @param cancellationToken Terminates apt-get once cancelled.
+ * @return bool false if apt-get failed, or an archive has no hash the content downloader can verify.
+ */
+static bool GetAptPackageUris(
+    const std::list<std::string>& packages,
+    std::vector<AptPackageUri>* packageUris,
+    const ADUC_CancellationToken* cancellationToken)
+{
+    std::vector<std::string> args = { "-qq", "-y", "--allow-downgrades", "--print-uris", "install" };
+    std::string outputTail;
+    bool validHashes = true;
+
+    args.insert(args.end(), packages.begin(), packages.end());
+
+    const int exitCode = ADUC_LaunchChildProcess(
+        "apt-get",
+        args,
+        [&](const std::string& line) {
+            AptPackageUri packageUri;
+
+            if (!AptParser::ParsePrintUrisLine(line, &packageUri))
+            {
+                return;
+            }
+
+            SHAversion algorithm;
+            if (!ADUC_HashUtils_GetShaVersionForTypeString(packageUri.HashType.c_str(), &algorithm))
+            {
+                Log_Info(
+                    "Package archive %s has an unsupported hash type %s.",
+                    packageUri.FileName.c_str(),
+                    packageUri.HashType.c_str());
+                validHashes = false;
+                return;
+            }
+
+            packageUris->emplace_back(std::move(packageUri));
+        },
+        1024,
+        outputTail,
+        cancellationToken);
+
+    if (exitCode != 0)
     {
-        std::string aptOutput;
-        int aptExitCode = -1;
+        Log_Warn("Cannot resolve the package archives. (Exit code: %d)\n%s", exitCode, outputTail.c_str());
+        return false;
+    }
 
-        // Perform apt-get update to fetch latest packages catalog.
-        // We'll log warning if failed, but will try to download specified packages.
-        try
+    return validHashes;
+}
+
+/**
+ * @brief Downloads the package archives of @p packages with the content downloader, APT_PREFETCH_CONCURRENCY
+ * at a time, to the prefetch archives folder.
+ *
+ * @param handle The workflow handle of the step.
+ * @param packages The packages.
+ * @param cancellationToken Aborts the downloads once cancelled.
+ * @return bool false if any archive couldn't be downloaded; apt-get then downloads the packages instead.
+ */
+static bool PrefetchAptPackages(
+    ADUC_WorkflowHandle handle, const std::list<std::string>& packages, const ADUC_CancellationToken* cancellationToken)
+{
+    const std::string archivesFolder = GetPrefetchArchivesFolder(handle);
+    std::vector<AptPackageUri> packageUris;
+    std::atomic<size_t> nextPackage{ 0 };
+    std::atomic<bool> failed{ false };
+    char* workflowId = nullptr;
+
+    // apt-get expects a 'partial' folder in its archives folder.
+    if (archivesFolder.empty()
+        || ADUC_SystemUtils_MkSandboxDirRecursive((archivesFolder + "/partial").c_str()) != 0)
+    {
+        Log_Warn("Cannot create the package archives folder.");
+        return false;
+    }
+
+    if (!GetAptPackageUris(packages, &packageUris, cancellationToken))
+    {
+        return false;
+    }
+
+    workflowId = workflow_get_id(handle);
+
+    auto worker = [&]() {
+        for (size_t i = nextPackage++; i < packageUris.size() && !failed; i = nextPackage++)
         {
-            // Perform apt-get update.
-            const std::vector<std::string> args = { adushconst::update_type_opt,
-                                                    adushconst::update_type_microsoft_apt,
-                                                    adushconst::update_action_opt,
-                                                    adushconst::update_action_initialize };
+            const AptPackageUri& packageUri = packageUris[i];
+            std::string fileName = packageUri.FileName;
+            std::string uri = packageUri.Uri;
+            std::string hashBase64;
+            ADUC_Hash hash = {};
+            ADUC_FileEntity entity = {};
 
-            aptExitCode = ADUC_LaunchChildProcess(adushconst::adu_shell, args, aptOutput);
+            if (!HexHashToBase64(packageUri.HashHex, &hashBase64)
+                || !ADUC_Hash_Init(&hash, hashBase64.c_str(), packageUri.HashType.c_str()))
+            {
+                failed = true;
+                break;
+            }
+
+            entity.FileId = &fileName[0];
+            entity.DownloadUri = &uri[0];
+            entity.TargetFilename = &fileName[0];
+            entity.Hash = &hash;
+            entity.HashCount = 1;
+            entity.SizeInBytes = packageUri.Size;
+
+            const ADUC_Result result = ExtensionManager::Download(
+                &entity, workflowId, archivesFolder.c_str(), DO_RETRY_TIMEOUT_DEFAULT, nullptr, cancellationToken);
 
-            if (!aptOutput.empty())
+            ADUC_Hash_UnInit(&hash);
+
+            if (IsAducResultCodeFailure(result.ResultCode))
             {
-                Log_Info(aptOutput.c_str());
+                Log_Warn("Cannot prefetch package archive %s (0x%X).", fileName.c_str(), result.ExtendedResultCode);
+                failed = true;
             }
         }
-        catch (const std::exception& de)
+    };
+
+    Log_Info("Prefetching %zu package archive(s) to %s.", packageUris.size(), archivesFolder.c_str());
+
+    const size_t workerCount = std::min<size_t>(APT_PREFETCH_CONCURRENCY, packageUris.size());
+    std::vector<std::thread> workers;
+
+    // The calling thread is a worker too.
+    for (size_t i = 1; i < workerCount; i++)
+    {
+        try
         {
-            Log_Error("Exception occurred while processing apt-get update.\n%s", de.what());
-            aptExitCode = -1;
+            workers.emplace_back(worker);
         }
+        catch (...)
+        {
+            break;
+        }
+    }
+
+    worker();
+
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+
+    workflow_free_string(workflowId);
+    return !failed;
+}
 
-        if (aptExitCode != 0)
+/**
+ * @brief Downloads @p packages for the step @p handle, prefetching their archives if enabled.
+ * The download is interrupted once the workflow is cancelled.
+ *
+ * @return int The exit code of the download, 0 on success.
+ */
+static int DownloadAptPackages(ADUC_WorkflowHandle handle, const std::list<std::string>& packages)
+{
+    const ADUC_CancellationToken* cancellationToken = workflow_peek_cancellation_token(handle);
+
+    if (IsPrefetchEnabled(handle))
+    {
+        if (PrefetchAptPackages(handle, packages, cancellationToken))
         {
-            Log_Error("APT update failed. (Exit code: %d)", aptExitCode);
+            return 0;
         }
 
-        // Download packages.
-        result = { ADUC_Result_Download_Success };
-        try
+        if (ADUC_CancellationToken_IsCancelled(cancellationToken))
         {
-            std::vector<std::string> args = { adushconst::update_type_opt,
-                                              adushconst::update_type_microsoft_apt,
-                                              adushconst::update_action_opt,
-                                              adushconst::update_action_download };
+            return -1;
+        }
 
-            // For microsoft/apt, target-data is a list of packages.
-            std::stringstream data;
-            data << "'";
-            for (const std::string& package : aptContent->Packages)
-            {
-                data << package << " ";
-            }
-            data << "'";
+        Log_Warn("Cannot prefetch the package archives, downloading them with apt-get.");
+    }
 
-            args.emplace_back(adushconst::target_data_opt);
-            args.emplace_back(data.str());
+    return LaunchAptAction(
+        adushconst::update_action_download, packages, std::string{}, false /* fastInstall */, cancellationToken);
+}
 
-            aptExitCode = ADUC_LaunchChildProcess(adushconst::adu_shell, args, aptOutput);
+/**
+ * @brief Returns the folder of the prefetched package archives of the step @p handle to install from,
+ * or empty to install from the system's APT archives.
+ */
+static std::string GetInstallArchivesFolder(ADUC_WorkflowHandle handle)
+{
+    if (!IsPrefetchEnabled(handle))
+    {
+        return std::string{};
+    }
 
-            if (!aptOutput.empty())
+    std::string archivesFolder = GetPrefetchArchivesFolder(handle);
+    if (archivesFolder.empty() || access(archivesFolder.c_str(), F_OK) != 0)
+    {
+        return std::string{};
+    }
+
+    return archivesFolder;
+}
+
+/**
+ * @brief Merges the packages of several APT manifests into one list, without duplicates.
+ *
+ * @param aptContents The APT manifests.
+ * @param packages Receives the packages.
+ * @return bool false if a package is listed with different versions, which one apt-get transaction can't satisfy.
+ */
+static bool
+MergeAptPackages(const std::vector<std::unique_ptr<AptContent>>& aptContents, std::list<std::string>* packages)
+{
+    std::unordered_map<std::string, std::string> packagesByName;
+
+    for (const std::unique_ptr<AptContent>& aptContent : aptContents)
+    {
+        for (const std::string& package : aptContent->Packages)
+        {
+            // A package is 'name' or 'name=version'.
+            const std::string name = package.substr(0, package.find('='));
+            const auto existing = packagesByName.find(name);
+
+            if (existing == packagesByName.end())
             {
-                Log_Info(aptOutput.c_str());
+                packagesByName.emplace(name, package);
+                packages->emplace_back(package);
+            }
+            else if (existing->second != package)
+            {
+                Log_Info(
+                    "Package %s is listed as both '%s' and '%s'.",
+                    name.c_str(),
+                    existing->second.c_str(),
+                    package.c_str());
+                return false;
             }
         }
-        catch (const std::exception& de)
-        {
-            Log_Error("Exception occurred during download. %s", de.what());
-            aptExitCode = -1;
-        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Gets the APT manifest of the step @p workflowData, downloading it first if @p download is true.
+ *
+ * @param workflowData The step's workflow data.
+ * @param download Whether to download the manifest, as opposed to using the already downloaded one.
+ * @param aptContent Receives the APT manifest.
+ * @return ADUC_Result
+ */
+ADUC_Result AptHandlerImpl::GetContent(
+    const tagADUC_WorkflowData* workflowData,
+    bool download,
+    std::unique_ptr<AptContent>& aptContent) // NOLINT(google-runtime-references)
+{
+    ADUC_Result result = { ADUC_Result_Failure };
+    std::stringstream aptManifestFilename;
+    ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
+    char* workFolder = nullptr;
+    char* workflowId = nullptr;
+    const ADUC_FileEntity* fileEntity = nullptr;
+
+    // For 'microsoft/apt:1', we're expecting 1 payload file.
+    int fileCount = workflow_get_update_files_count(handle);
+    if (download && fileCount != 1)
+    {
+        Log_Error("APT packages expecting one file. (%d)", fileCount);
+        return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_APT_HANDLER_PACKAGE_PREPARE_FAILURE_WRONG_FILECOUNT };
+    }
+
+    workFolder = workflow_get_workfolder(handle);
+    workflowId = workflow_get_id(handle);
+
+    if ((fileEntity = workflow_peek_update_file(handle, 0)) == nullptr)
+    {
+        result = { ADUC_Result_Failure, ADUC_ERC_APT_HANDLER_GET_FILEENTITY_FAILURE };
+        goto done;
+    }
 
-        if (aptExitCode != 0)
+    aptManifestFilename << workFolder << "/" << fileEntity->TargetFilename;
+
+    if (download)
+    {
+        // Download the APT manifest file.
+        result = ExtensionManager::Download(
+            fileEntity,
+            workflowId,
+            workFolder,
+            DO_RETRY_TIMEOUT_DEFAULT,
+            nullptr,
+            workflow_peek_cancellation_token(handle));
+        if (IsAducResultCodeFailure(result.ResultCode))
         {
-            result.ResultCode = ADUC_Result_Failure;
-            result.ExtendedResultCode = ADUC_ERC_APT_HANDLER_PACKAGE_DOWNLOAD_FAILURE;
-            Log_Error("APT packages download failed. (Exit code: %d)", aptExitCode);
             goto done;
         }
     }
 
-    result = { ADUC_Result_Download_Success };
+    result = ParseContent(aptManifestFilename.str(), aptContent);
 
 done:
     workflow_free_string(workflowId);
     workflow_free_string(workFolder);
-    workflow_free_file_entity(fileEntity);
 
     return result;
 }
 
 /**
- * @brief Install implementation for APT Handler.
+ * @brief Download implementation for APT handler.
  *
- * @return ADUC_Result The result of the install.
+ * @return ADUC_Result The result of the download.
  */
-ADUC_Result AptHandlerImpl::Install(const tagADUC_WorkflowData* workflowData)
+ADUC_Result AptHandlerImpl::Download(const tagADUC_WorkflowData* workflowData)
 {
-    std::string aptOutput;
+    std::unique_ptr<AptContent> aptContent{ nullptr };
     int aptExitCode = -1;
-    ADUC_Result result = { ADUC_Result_Download_Success };
-    ADUC_FileEntity* fileEntity = nullptr;
-    ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
-    char* workFolder = workflow_get_workfolder(handle);
-    char* workflowId = workflow_get_id(handle);
-    std::stringstream aptManifestFilename;
-    std::unique_ptr<AptContent> aptContent;
 
-    if (!workflow_get_update_file(handle, 0, &fileEntity))
+    ADUC_Result result = GetContent(workflowData, true /* download */, aptContent);
+    if (IsAducResultCodeFailure(result.ResultCode))
     {
-        result = { ADUC_Result_Failure, ADUC_ERC_APT_HANDLER_GET_FILEENTITY_FAILURE };
-        goto done;
+        return result;
     }
 
-    aptManifestFilename << workFolder << "/" << fileEntity->TargetFilename;
+    // Perform apt-get update to fetch latest packages catalog, unless an earlier step just did.
+    RefreshAptCatalog();
 
-    result = ParseContent(aptManifestFilename.str(), aptContent);
-    if (IsAducResultCodeFailure(result.ResultCode))
+    // Download packages.
+    aptExitCode = DownloadAptPackages(workflowData->WorkflowHandle, aptContent->Packages);
+    if (aptExitCode != 0
+        && ADUC_CancellationToken_IsCancelled(workflow_peek_cancellation_token(workflowData->WorkflowHandle)))
     {
-        goto done;
+        Log_Info("APT packages download was cancelled.");
+        return ADUC_Result{ ADUC_Result_Failure_Cancelled };
     }
 
-    try
+    if (aptExitCode != 0)
     {
-        std::vector<std::string> args = { adushconst::update_type_opt,
-                                          adushconst::update_type_microsoft_apt,
-                                          adushconst::update_action_opt,
-                                          adushconst::update_action_install };
-
-        //
-        // For public preview, we're passing following additional options to apt-get.
-        //
-        // '-y' (assumed yes)
-        //  -o Dpkg::Options::=--force-confdef -o Dpkg::Options::=--force-confold" (preserve existing config.yaml file by default)
-        //
-        args.emplace_back(adushconst::target_options_opt);
-        args.emplace_back("-o Dpkg::Options::=--force-confdef -o Dpkg::Options::=--force-confold");
-
-        // For microsoft/apt, target-data is a list of packages.
-        std::stringstream data;
-        for (const std::string& package : aptContent->Packages)
+        Log_Error("APT packages download failed. (Exit code: %d)", aptExitCode);
+        return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_APT_HANDLER_PACKAGE_DOWNLOAD_FAILURE };
+    }
+
+    return ADUC_Result{ ADUC_Result_Download_Success };
+}
+
+/**
+ * @brief Downloads the packages of several APT steps of a steps update with one catalog refresh and one
+ * apt-get download, resolving their dependencies together.
+ *
+ * @return bool false if the steps weren't downloaded together, e.g. on any failure; the steps handler then
+ * downloads each step on its own, which attributes the failure to its step.
+ */
+bool AptHandlerImpl::DownloadBatch(
+    const tagADUC_WorkflowData* const* stepWorkflows, size_t stepCount, ADUC_Result* results)
+{
+    std::vector<std::unique_ptr<AptContent>> aptContents(stepCount);
+    std::list<std::string> packages;
+
+    for (size_t i = 0; i < stepCount; i++)
+    {
+        if (IsAducResultCodeFailure(GetContent(stepWorkflows[i], true /* download */, aptContents[i]).ResultCode))
         {
-            data << package << " ";
+            return false;
         }
-        args.emplace_back(adushconst::target_data_opt);
-        args.emplace_back(data.str());
+    }
 
-        aptExitCode = ADUC_LaunchChildProcess(adushconst::adu_shell, args, aptOutput);
+    if (!MergeAptPackages(aptContents, &packages))
+    {
+        return false;
+    }
 
-        if (!aptOutput.empty())
+    RefreshAptCatalog();
+
+    Log_Info("Downloading the packages of %zu APT steps together.", stepCount);
+    const int aptExitCode = DownloadAptPackages(stepWorkflows[0]->WorkflowHandle, packages);
+    if (aptExitCode != 0)
+    {
+        Log_Warn("APT packages download of %zu steps failed. (Exit code: %d)", stepCount, aptExitCode);
+        return false;
+    }
+
+    for (size_t i = 0; i < stepCount; i++)
+    {
+        results[i] = { ADUC_Result_Download_Success };
+    }
+
+    return true;
+}
+
+/**
+ * @brief Install implementation for APT Handler.
+ *
+ * @return ADUC_Result The result of the install.
+ */
+ADUC_Result AptHandlerImpl::Install(const tagADUC_WorkflowData* workflowData)
+{
+    std::unique_ptr<AptContent> aptContent;
+
+    ADUC_Result result = GetContent(workflowData, false /* download */, aptContent);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        return result;
+    }
+
+    const int aptExitCode = LaunchAptAction(
+        adushconst::update_action_install,
+        aptContent->Packages,
+        GetInstallArchivesFolder(workflowData->WorkflowHandle),
+        IsFastInstallEnabled(workflowData->WorkflowHandle));
+    if (aptExitCode != 0)
+    {
+        Log_Error("APT packages install failed. (Exit code: %d)", aptExitCode);
+        return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_APT_HANDLER_PACKAGE_INSTALL_FAILURE };
+    }
+
+    return ADUC_Result{ ADUC_Result_Install_Success };
+}
+
+/**
+ * @brief Installs the packages of several APT steps of a steps update in one apt-get transaction,
+ * so that dpkg triggers run once.
+ *
+ * @return bool false if the steps weren't installed together, e.g. on any failure; the steps handler then
+ * installs each step on its own, which attributes the failure to its step.
+ */
+bool AptHandlerImpl::InstallBatch(
+    const tagADUC_WorkflowData* const* stepWorkflows, size_t stepCount, ADUC_Result* results)
+{
+    std::vector<std::unique_ptr<AptContent>> aptContents(stepCount);
+    std::list<std::string> packages;
+
+    for (size_t i = 0; i < stepCount; i++)
+    {
+        if (IsAducResultCodeFailure(GetContent(stepWorkflows[i], false /* download */, aptContents[i]).ResultCode))
         {
-            Log_Info(aptOutput.c_str());
+            return false;
         }
     }
-    catch (const std::exception& de)
+
+    if (!MergeAptPackages(aptContents, &packages))
     {
-        Log_Error("Exception occurred during install. %s", de.what());
-        aptExitCode = -1;
+        return false;
     }
 
+    // The transaction is fast only if all of its steps opted in.
+    bool fastInstall = true;
+    for (size_t i = 0; i < stepCount; i++)
+    {
+        fastInstall = fastInstall && IsFastInstallEnabled(stepWorkflows[i]->WorkflowHandle);
+    }
+
+    Log_Info("Installing the packages of %zu APT steps in one transaction.", stepCount);
+    const int aptExitCode = LaunchAptAction(
+        adushconst::update_action_install,
+        packages,
+        GetInstallArchivesFolder(stepWorkflows[0]->WorkflowHandle),
+        fastInstall);
     if (aptExitCode != 0)
     {
-        result.ResultCode = ADUC_Result_Failure;
-        result.ExtendedResultCode = ADUC_ERC_APT_HANDLER_PACKAGE_INSTALL_FAILURE;
-        Log_Error("APT packages install failed. (Exit code: %d)", aptExitCode);
+        Log_Warn("APT packages install of %zu steps failed. (Exit code: %d)", stepCount, aptExitCode);
+        return false;
     }
 
-    result = { ADUC_Result_Install_Success };
+    for (size_t i = 0; i < stepCount; i++)
+    {
+        results[i] = { ADUC_Result_Install_Success };
+    }
 
-done:
-    workflow_free_string(workflowId);
-    workflow_free_string(workFolder);
-    workflow_free_file_entity(fileEntity);
-    return result;
+    return true;
 }
 
 /**
@@ -333,7 +1001,7 @@ ADUC_Result AptHandlerImpl::Apply(const tagADUC_WorkflowData* workflowData)
     char* workFolder = workflow_get_workfolder(handle);
     std::unique_ptr<AptContent> aptContent{ nullptr };
     std::stringstream aptManifestFilename;
-    ADUC_FileEntity* entity = nullptr;
+    const ADUC_FileEntity* entity = nullptr;
 
     if (!PersistInstalledCriteria(ADUC_INSTALLEDCRITERIA_FILE_PATH, installedCriteria))
     {
@@ -342,7 +1010,7 @@ ADUC_Result AptHandlerImpl::Apply(const tagADUC_WorkflowData* workflowData)
         goto done;
     }
 
-    if (!workflow_get_update_file(handle, 0, &entity))
+    if ((entity = workflow_peek_update_file(handle, 0)) == nullptr)
     {
         result = { .ResultCode = ADUC_Result_Failure,
                    .ExtendedResultCode = ADUC_ERC_APT_HANDLER_GET_FILEENTITY_FAILURE };
@@ -374,7 +1042,6 @@ ADUC_Result AptHandlerImpl::Apply(const tagADUC_WorkflowData* workflowData)
 done:
     workflow_free_string(workFolder);
     workflow_free_string(installedCriteria);
-    workflow_free_file_entity(entity);
     return result;
 }
 
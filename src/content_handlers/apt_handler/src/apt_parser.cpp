@@ -9,6 +9,7 @@
 #include "aduc/apt_parser.hpp"
 #include <aduc/logging.h>
 #include <parson.h>
+#include <sstream>
 #include <string>
 
 struct JSONValueDeleter
@@ -142,3 +143,42 @@ std::unique_ptr<AptContent> AptParser::ParseAptContentFromString(const std::stri
 
     return GetAptContentFromRootValue(rootValue.get());
 }
+
+bool AptParser::ParsePrintUrisLine(const std::string& line, AptPackageUri* packageUri)
+{
+    // 'URI' FILENAME SIZE HASHTYPE:HASH
+    if (line.empty() || line[0] != '\'')
+    {
+        return false;
+    }
+
+    const size_t uriEnd = line.find('\'', 1);
+    if (uriEnd == std::string::npos || uriEnd == 1)
+    {
+        return false;
+    }
+
+    std::istringstream fields{ line.substr(uriEnd + 1) };
+    std::string fileName;
+    unsigned long long size = 0;
+    std::string hash;
+
+    if (!(fields >> fileName >> size >> hash))
+    {
+        return false;
+    }
+
+    const size_t hashSeparator = hash.find(':');
+    if (hashSeparator == std::string::npos || hashSeparator == 0 || hashSeparator + 1 == hash.size())
+    {
+        return false;
+    }
+
+    packageUri->Uri = line.substr(1, uriEnd - 1);
+    packageUri->FileName = fileName;
+    packageUri->Size = static_cast<size_t>(size);
+    packageUri->HashType = hash.substr(0, hashSeparator);
+    packageUri->HashHex = hash.substr(hashSeparator + 1);
+
+    return true;
+}
@@ -143,3 +143,31 @@ TEST_CASE("APT Parser AgentRestartRequired(du-agent package name) Test")
         AptParser::ParseAptContentFromString(aptContentWithAgentRestartRequiredUsingNameDuAgent);
     CHECK(aptContent->AgentRestartRequired);
 }
+
+TEST_CASE("APT Parser PrintUris Test")
+{
+    AptPackageUri packageUri;
+
+    SECTION("Package archive")
+    {
+        REQUIRE(AptParser::ParsePrintUrisLine(
+            "'http://deb.example.com/pool/main/m/moby-engine/moby-engine_1.0.0.0_amd64.deb' "
+            "moby-engine_1.0.0.0_amd64.deb 1234 SHA256:0123456789abcdef",
+            &packageUri));
+        CHECK_THAT(
+            packageUri.Uri, Equals("http://deb.example.com/pool/main/m/moby-engine/moby-engine_1.0.0.0_amd64.deb"));
+        CHECK_THAT(packageUri.FileName, Equals("moby-engine_1.0.0.0_amd64.deb"));
+        CHECK(packageUri.Size == 1234);
+        CHECK_THAT(packageUri.HashType, Equals("SHA256"));
+        CHECK_THAT(packageUri.HashHex, Equals("0123456789abcdef"));
+    }
+
+    SECTION("Not a package archive")
+    {
+        CHECK_FALSE(AptParser::ParsePrintUrisLine("", &packageUri));
+        CHECK_FALSE(AptParser::ParsePrintUrisLine("Reading package lists...", &packageUri));
+        CHECK_FALSE(AptParser::ParsePrintUrisLine("'http://deb.example.com/foo.deb' foo.deb", &packageUri));
+        CHECK_FALSE(AptParser::ParsePrintUrisLine("'http://deb.example.com/foo.deb' foo.deb 12 0123", &packageUri));
+        CHECK_FALSE(AptParser::ParsePrintUrisLine("'http://deb.example.com/foo.deb foo.deb 1 SHA256:01", &packageUri));
+    }
+}
@@ -12,15 +12,17 @@
 #include "aduc/result.h"
 #include "aduc/logging.h"
 
-#include <memory>
 #include <string>
-#include <unordered_map>
 
 // Forward declaration.
 class ContentHandler;
 
 typedef ContentHandler* (*UPDATE_CONTENT_HANDLER_CREATE_PROC)(ADUC_LOG_SEVERITY logLevel);
 
+/**
+ * @brief Loads the update content handlers through the ExtensionManager, which keeps the registry of the loaded
+ * handlers.
+ */
 class ContentHandlerFactory
 {
 public:
@@ -28,12 +30,6 @@ public:
     static void UnloadAllUpdateContentHandlers();
     static void UnloadAllExtensions();
     static void Uninit();
-
-private:
-    static ADUC_Result LoadExtensionLibrary(const std::string& updateType, void** libHandle);
-    static std::unordered_map<std::string, void*> _libs;
-    static std::unordered_map<std::string, ContentHandler*> _contentHandlers;
-    static pthread_mutex_t factoryMutex;
 };
 
 #endif // ADUC_CONTENT_HANDLER_FACTORY_HPP
@@ -0,0 +1,55 @@
+/**
+ * @file rawimage_handler.hpp
+ * @brief Defines RawImageHandlerImpl.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_RAWIMAGE_HANDLER_HPP
+#define ADUC_RAWIMAGE_HANDLER_HPP
+
+#include "aduc/content_handler.hpp"
+#include "aduc/logging.h"
+#include <aduc/result.h>
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Instantiates an Update Content Handler for 'microsoft/rawimage:1' update type.
+ * @return A pointer to an instantiated Update Content Handler object.
+ */
+ContentHandler* CreateUpdateContentHandlerExtension(ADUC_LOG_SEVERITY logLevel);
+
+EXTERN_C_END
+
+/**
+ * @class RawImageHandlerImpl
+ * @brief The raw block image specific implementation of ContentHandler interface.
+ */
+class RawImageHandlerImpl : public ContentHandler
+{
+public:
+    static ContentHandler* CreateContentHandler();
+
+    // Delete copy ctor, copy assignment, move ctor and move assignment operators.
+    RawImageHandlerImpl(const RawImageHandlerImpl&) = delete;
+    RawImageHandlerImpl& operator=(const RawImageHandlerImpl&) = delete;
+    RawImageHandlerImpl(RawImageHandlerImpl&&) = delete;
+    RawImageHandlerImpl& operator=(RawImageHandlerImpl&&) = delete;
+
+    ~RawImageHandlerImpl() override;
+
+    ADUC_Result Download(const tagADUC_WorkflowData* workflowData) override;
+    ADUC_Result Install(const tagADUC_WorkflowData* workflowData) override;
+    ADUC_Result Apply(const tagADUC_WorkflowData* workflowData) override;
+    ADUC_Result Cancel(const tagADUC_WorkflowData* workflowData) override;
+    ADUC_Result IsInstalled(const tagADUC_WorkflowData* workflowData) override;
+
+protected:
+    // Protected constructor, must call CreateContentHandler factory method.
+    RawImageHandlerImpl()
+    {
+    }
+};
+
+#endif // ADUC_RAWIMAGE_HANDLER_HPP
@@ -0,0 +1,487 @@
+/**
+ * @file rawimage_handler.cpp
+ * @brief Implementation of ContentHandler API for raw block images.
+ *
+ * Will call into adu-shell to write the image to a partition.
+ *
+ * microsoft/rawimage
+ * v1:
+ *   Description:
+ *   Initial revision.
+ *
+ *   Expected files:
+ *   The image to write to the partition 'targetDevice' of handlerProperties, e.g. /dev/mmcblk0p3. Either a raw
+ *   image, or an Android sparse image, whose "don't care" chunks are not written.
+ *
+ *   Optional bmap file: when handlerProperties names a 'bmapFileName', the files also include the bmap file of the
+ *   raw image, as generated by bmaptool, and only the blocks it maps are written.
+ *
+ *   Optional streaming: when handlerProperties has 'streamInstall' set to "true", and the content downloader
+ *   supports it, the image isn't downloaded to the work folder. Install downloads it into a pipe that adu-shell
+ *   writes the image from, so flashing overlaps the transfer and the image doesn't need to be staged.
+ *
+ *   adu-shell writes the image with O_DIRECT and validates its hash as it writes it, see raw_image_utils.h. An
+ *   invalid hash fails the install, so the update is never applied.
+ *
+ *   Apply requires an immediate reboot when handlerProperties has 'rebootRequired' set to "true". IsInstalled
+ *   compares the installedCriteria with the version in ADUC_VERSION_FILE, like microsoft/swupdate.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/rawimage_handler.hpp"
+
+#include "aduc/adushell_broker_utils.hpp"
+#include "aduc/extension_manager.hpp"
+#include "aduc/hash_utils.h"
+#include "aduc/logging.h"
+#include "aduc/string_c_utils.h"
+#include "aduc/string_utils.hpp"
+#include "aduc/system_utils.h"
+#include "aduc/types/update_content.h"
+#include "aduc/workflow_data_utils.h"
+#include "aduc/workflow_utils.h"
+#include "adushell_const.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace adushconst = Adu::Shell::Const;
+
+EXTERN_C_BEGIN
+#ifndef ADUC_BUILTIN_CONTENT_HANDLER
+
+/**
+ * @brief Instantiates an Update Content Handler for 'microsoft/rawimage:1' update type.
+ */
+ContentHandler* CreateUpdateContentHandlerExtension(ADUC_LOG_SEVERITY logLevel)
+{
+    ADUC_Logging_Init(logLevel, "rawimage-handler");
+    Log_Info("Instantiating an Update Content Handler for 'microsoft/rawimage:1'");
+    try
+    {
+        return RawImageHandlerImpl::CreateContentHandler();
+    }
+    catch (const std::exception& e)
+    {
+        const char* what = e.what();
+        Log_Error("Unhandled std exception: %s", what);
+    }
+    catch (...)
+    {
+        Log_Error("Unhandled exception");
+    }
+
+    return nullptr;
+}
+
+#endif // ADUC_BUILTIN_CONTENT_HANDLER
+EXTERN_C_END
+
+/**
+ * @brief Destructor for the RawImage Handler Impl class.
+ */
+RawImageHandlerImpl::~RawImageHandlerImpl() // override
+{
+#ifndef ADUC_BUILTIN_CONTENT_HANDLER
+    ADUC_Logging_Uninit();
+#endif
+}
+
+/**
+ * @brief Creates a new RawImageHandlerImpl object and casts to a ContentHandler.
+ * Note that there is no way to create a RawImageHandlerImpl directly.
+ *
+ * @return ContentHandler* RawImageHandlerImpl object as a ContentHandler.
+ */
+ContentHandler* RawImageHandlerImpl::CreateContentHandler()
+{
+    return new RawImageHandlerImpl();
+}
+
+/**
+ * @brief Gets the file entity named @p fileName, or the image file entity, which is the file that isn't the bmap file.
+ *
+ * @param workflowHandle The workflow handle.
+ * @param fileName The target file name of the entity, or nullptr for the image.
+ * @param entity The output file entity, owned by the workflow, see workflow_peek_update_file().
+ * @return bool True if found.
+ */
+static bool GetFileEntity(ADUC_WorkflowHandle workflowHandle, const char* fileName, const ADUC_FileEntity** entity)
+{
+    const char* bmapFileName = workflow_peek_update_manifest_handler_properties_string(workflowHandle, "bmapFileName");
+    const size_t fileCount = workflow_get_update_files_count(workflowHandle);
+
+    for (size_t i = 0; i < fileCount; i++)
+    {
+        const ADUC_FileEntity* file = workflow_peek_update_file(workflowHandle, i);
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        const bool isBmap = !IsNullOrEmpty(bmapFileName) && strcmp(file->TargetFilename, bmapFileName) == 0;
+        if ((fileName == nullptr) ? !isBmap : strcmp(file->TargetFilename, fileName) == 0)
+        {
+            *entity = file;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Returns whether the image is to be streamed into adu-shell during install instead of downloaded.
+ *
+ * @param workflowHandle The workflow handle.
+ * @return bool True if handlerProperties ask for it, and the content downloader can download to a stream.
+ */
+static bool IsStreamInstallEnabled(ADUC_WorkflowHandle workflowHandle)
+{
+    const char* streamInstall =
+        workflow_peek_update_manifest_handler_properties_string(workflowHandle, "streamInstall");
+
+    return streamInstall != nullptr && strcmp(streamInstall, "true") == 0
+        && ExtensionManager::IsDownloadToStreamSupported();
+}
+
+/**
+ * @brief Downloads the image into the pipe at @p pipePath as it arrives, once adu-shell opened it for reading.
+ * Must run on its own thread, since it blocks SIGPIPE for the calling thread.
+ *
+ * @param entity The image file entity.
+ * @param workflowId The workflow id.
+ * @param pipePath The path of the pipe adu-shell writes the image from.
+ * @param installDone Set once adu-shell exited, so that this doesn't wait for a reader that will never come.
+ * @return ADUC_Result The result of the download.
+ */
+static ADUC_Result StreamImage(
+    const ADUC_FileEntity* entity, const char* workflowId, const char* pipePath, const std::atomic_bool& installDone)
+{
+    ADUC_Result result = { ADUC_Result_Failure, ADUC_ERC_RAWIMAGE_HANDLER_INSTALL_FAILURE_STREAM_NOT_READ };
+    const struct timespec noWait = {};
+    sigset_t sigpipe;
+    int fd = -1;
+
+    // A reader that goes away fails the writes with EPIPE, instead of terminating the agent.
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+    // Opening the write end of a pipe blocks until there's a reader. Poll instead, in case adu-shell fails
+    // before opening it, e.g. on an invalid target device.
+    while (!installDone)
+    {
+        fd = open(pipePath, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd != -1 || errno != ENXIO)
+        {
+            break;
+        }
+
+        usleep(100 * 1000);
+    }
+
+    if (fd == -1)
+    {
+        Log_Error("adu-shell didn't read the image stream %s, errno %d", pipePath, errno);
+        return result;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    result = ExtensionManager::DownloadToStream(entity, workflowId, DO_RETRY_TIMEOUT_DEFAULT, nullptr, fd);
+
+    // End of the stream.
+    close(fd);
+
+    // Discard a SIGPIPE raised by a write after the reader went away.
+    while (sigtimedwait(&sigpipe, nullptr, &noWait) == SIGPIPE)
+    {
+    }
+
+    return result;
+}
+
+/**
+ * @brief Performs 'Download' task.
+ * Downloads the image, unless it's streamed during install, and the bmap file, if any.
+ *
+ * @return ADUC_Result The result of the download.
+ */
+ADUC_Result RawImageHandlerImpl::Download(const tagADUC_WorkflowData* workflowData)
+{
+    ADUC_Result result = { ADUC_Result_Failure };
+    const ADUC_FileEntity* entity = nullptr;
+    const ADUC_FileEntity* bmapEntity = nullptr;
+    ADUC_WorkflowHandle workflowHandle = workflowData->WorkflowHandle;
+    const char* workflowId = workflow_peek_id(workflowHandle);
+    const char* workFolder = workflow_peek_workfolder(workflowHandle);
+    const char* bmapFileName = workflow_peek_update_manifest_handler_properties_string(workflowHandle, "bmapFileName");
+    const size_t expectedFileCount = IsNullOrEmpty(bmapFileName) ? 1 : 2;
+    size_t fileCount = 0;
+
+    if (IsNullOrEmpty(workflow_peek_update_manifest_handler_properties_string(workflowHandle, "targetDevice")))
+    {
+        Log_Error("handlerProperties has no targetDevice.");
+        result.ExtendedResultCode = ADUC_ERC_RAWIMAGE_HANDLER_MISSING_TARGET_DEVICE_PROPERTY;
+        goto done;
+    }
+
+    // For 'microsoft/rawimage:1', we're expecting 1 image file, plus an optional bmap file.
+    fileCount = workflow_get_update_files_count(workflowHandle);
+    if (fileCount != expectedFileCount)
+    {
+        Log_Error("RawImage expecting %zu file(s). (%zu)", expectedFileCount, fileCount);
+        result.ExtendedResultCode = ADUC_ERC_RAWIMAGE_HANDLER_DOWNLOAD_FAILURE_WRONG_FILECOUNT;
+        goto done;
+    }
+
+    if (!GetFileEntity(workflowHandle, nullptr, &entity)
+        || (expectedFileCount == 2 && !GetFileEntity(workflowHandle, bmapFileName, &bmapEntity)))
+    {
+        result.ExtendedResultCode = ADUC_ERC_RAWIMAGE_HANDLER_DOWNLOAD_FAILURE_BAD_FILE_ENTITY;
+        goto done;
+    }
+
+    if (bmapEntity != nullptr)
+    {
+        result = ExtensionManager::Download(
+            bmapEntity,
+            workflowId,
+            workFolder,
+            DO_RETRY_TIMEOUT_DEFAULT,
+            nullptr,
+            workflow_peek_cancellation_token(workflowHandle));
+        if (IsAducResultCodeFailure(result.ResultCode))
+        {
+            goto done;
+        }
+    }
+
+    if (IsStreamInstallEnabled(workflowHandle))
+    {
+        Log_Info("%s will be streamed to the target device during install, not downloaded.", entity->TargetFilename);
+        result = { ADUC_Result_Download_Success };
+        goto done;
+    }
+
+    result = ExtensionManager::Download(
+        entity,
+        workflowId,
+        workFolder,
+        DO_RETRY_TIMEOUT_DEFAULT,
+        nullptr,
+        workflow_peek_cancellation_token(workflowHandle));
+
+done:
+    return result;
+}
+
+/**
+ * @brief Install implementation for raw images.
+ * Calls into adu-shell to write the image to the target device.
+ *
+ * @return ADUC_Result The result of the install.
+ */
+ADUC_Result RawImageHandlerImpl::Install(const tagADUC_WorkflowData* workflowData)
+{
+    ADUC_Result result = { ADUC_Result_Failure };
+    const ADUC_FileEntity* entity = nullptr;
+    ADUC_WorkflowHandle workflowHandle = workflowData->WorkflowHandle;
+    const char* workFolder = workflow_peek_workfolder(workflowHandle);
+    const char* targetDevice = workflow_peek_update_manifest_handler_properties_string(workflowHandle, "targetDevice");
+    const char* bmapFileName = workflow_peek_update_manifest_handler_properties_string(workflowHandle, "bmapFileName");
+
+    if (IsNullOrEmpty(targetDevice))
+    {
+        result.ExtendedResultCode = ADUC_ERC_RAWIMAGE_HANDLER_MISSING_TARGET_DEVICE_PROPERTY;
+        goto done;
+    }
+
+    if (!GetFileEntity(workflowHandle, nullptr, &entity))
+    {
+        result.ExtendedResultCode = ADUC_ERC_RAWIMAGE_HANDLER_INSTALL_FAILURE_BAD_FILE_ENTITY;
+        goto done;
+    }
+
+    // adu-shell validates the hash as it writes the image, which must be the image that was downloaded.
+    if (entity->HashCount == 0)
+    {
+        Log_Error("%s has no hash.", entity->TargetFilename);
+        result.ExtendedResultCode = ADUC_ERC_RAWIMAGE_HANDLER_INSTALL_FAILURE_NO_IMAGE_HASH;
+        goto done;
+    }
+
+    {
+        std::string command = adushconst::adu_shell;
+        std::vector<std::string> args{ adushconst::update_type_opt,
+                                       adushconst::update_type_microsoft_rawimage,
+                                       adushconst::update_action_opt,
+                                       adushconst::update_action_install };
+
+        std::stringstream data;
+        data << workFolder << "/" << entity->TargetFilename;
+
+        // The image wasn't downloaded, adu-shell reads it from a pipe while it's downloaded.
+        const bool streamImage = access(data.str().c_str(), F_OK) != 0 && IsStreamInstallEnabled(workflowHandle);
+        std::string pipePath;
+        std::atomic_bool installDone{ false };
+        ADUC_Result streamResult = { ADUC_Result_Failure };
+        std::thread streamThread;
+
+        if (streamImage)
+        {
+            pipePath = data.str() + ".stream";
+            remove(pipePath.c_str());
+
+            if (mkfifo(pipePath.c_str(), S_IRUSR | S_IWUSR) != 0)
+            {
+                Log_Error("Cannot create image stream %s, errno = %d", pipePath.c_str(), errno);
+                result.ExtendedResultCode = ADUC_ERC_RAWIMAGE_HANDLER_INSTALL_FAILURE_CANNOT_CREATE_STREAM;
+                goto done;
+            }
+
+            Log_Info("Streaming %s to %s", entity->TargetFilename, targetDevice);
+            args.emplace_back(adushconst::target_data_opt);
+            args.emplace_back(pipePath);
+
+            streamThread = std::thread{ [&streamResult, entity, &pipePath, &installDone, workflowData]() {
+                const char* workflowId = workflow_peek_id(workflowData->WorkflowHandle);
+                streamResult = StreamImage(entity, workflowId, pipePath.c_str(), installDone);
+            } };
+        }
+        else
+        {
+            args.emplace_back(adushconst::target_data_opt);
+            args.emplace_back(data.str());
+        }
+
+        args.emplace_back(adushconst::target_options_opt);
+        args.emplace_back(std::string("device=") + targetDevice);
+
+        if (!IsNullOrEmpty(bmapFileName))
+        {
+            args.emplace_back(adushconst::target_options_opt);
+            args.emplace_back(std::string("bmap=") + workFolder + "/" + bmapFileName);
+        }
+
+        args.emplace_back(adushconst::target_options_opt);
+        args.emplace_back(std::string("hash=") + entity->Hash[0].value);
+        args.emplace_back(adushconst::target_options_opt);
+        args.emplace_back(std::string("hashType=") + entity->Hash[0].type);
+
+        args.emplace_back(adushconst::target_log_folder_opt);
+        args.emplace_back(ADUC_LOG_FOLDER);
+
+        std::string output;
+        const int exitCode = ADUC_LaunchAduShell(command, args, output);
+
+        installDone = true;
+
+        if (streamImage)
+        {
+            streamThread.join();
+            remove(pipePath.c_str());
+        }
+
+        if (exitCode != 0)
+        {
+            Log_Error("Install failed, exitCode = %d", exitCode);
+            result = { .ResultCode = ADUC_Result_Failure,
+                       .ExtendedResultCode = ADUC_ERC_RAWIMAGE_HANDLER_CHILD_PROCESS_FAILURE_EXITCODE(exitCode) };
+            goto done;
+        }
+
+        if (streamImage && IsAducResultCodeFailure(streamResult.ResultCode))
+        {
+            Log_Error("Image stream failed, extendedResultCode = 0x%X", streamResult.ExtendedResultCode);
+            result = streamResult;
+            goto done;
+        }
+    }
+
+    Log_Info("Install succeeded");
+    result.ResultCode = ADUC_Result_Install_Success;
+
+done:
+    return result;
+}
+
+/**
+ * @brief Apply implementation for raw images.
+ * The image is already on the target device; only reboots into it if handlerProperties ask for it.
+ *
+ * @return ADUC_Result The result of the apply.
+ */
+ADUC_Result RawImageHandlerImpl::Apply(const tagADUC_WorkflowData* workflowData)
+{
+    const char* rebootRequired =
+        workflow_peek_update_manifest_handler_properties_string(workflowData->WorkflowHandle, "rebootRequired");
+
+    if (rebootRequired != nullptr && strcmp(rebootRequired, "true") == 0)
+    {
+        return ADUC_Result{ ADUC_Result_Apply_RequiredImmediateReboot };
+    }
+
+    return ADUC_Result{ ADUC_Result_Apply_Success };
+}
+
+/**
+ * @brief Cancel implementation for raw images.
+ * A partially written image can't be undone, so cancel is a no-op.
+ *
+ * @return ADUC_Result The result of the cancel.
+ */
+ADUC_Result RawImageHandlerImpl::Cancel(const tagADUC_WorkflowData* workflowData)
+{
+    UNREFERENCED_PARAMETER(workflowData);
+    return ADUC_Result{ ADUC_Result_Cancel_Success };
+}
+
+/**
+ * @brief Checks if the installed content matches the installed criteria, the version in ADUC_VERSION_FILE.
+ *
+ * @return ADUC_Result
+ */
+ADUC_Result RawImageHandlerImpl::IsInstalled(const tagADUC_WorkflowData* workflowData)
+{
+    char* installedCriteria = ADUC_WorkflowData_GetInstalledCriteria(workflowData);
+    ADUC_Result result;
+    std::string version;
+    std::ifstream versionFile{ ADUC_VERSION_FILE };
+
+    std::getline(versionFile, version);
+    ADUC::StringUtils::Trim(version);
+    if (version.empty())
+    {
+        Log_Error("Version file %s did not contain a version or could not be read.", ADUC_VERSION_FILE);
+        result = { ADUC_Result_Failure };
+        goto done;
+    }
+
+    if (installedCriteria != nullptr && version == installedCriteria)
+    {
+        Log_Info("Installed criteria %s was installed.", installedCriteria);
+        result = { ADUC_Result_IsInstalled_Installed };
+        goto done;
+    }
+
+    Log_Info("Installed criteria %s was not installed, the current version is %s", installedCriteria, version.c_str());
+
+    result = { ADUC_Result_IsInstalled_NotInstalled };
+
+done:
+    workflow_free_string(installedCriteria);
+    return result;
+}
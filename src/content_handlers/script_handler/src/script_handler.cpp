@@ -8,6 +8,7 @@
 #include "aduc/script_handler.hpp"
 
 #include "aduc/adu_core_exports.h"
+#include "aduc/adushell_broker_utils.hpp"
 #include "aduc/extension_manager.hpp"
 #include "aduc/logging.h"
 #include "aduc/process_utils.hpp"
@@ -35,6 +36,8 @@ namespace adushconst = Adu::Shell::Const;
 
 EXTERN_C_BEGIN
 
+#ifndef ADUC_BUILTIN_CONTENT_HANDLER
+
 /**
  * @brief Instantiates an Update Content Handler for 'microsoft/bundle:1' update type.
  */
@@ -44,6 +47,8 @@ ContentHandler* CreateUpdateContentHandlerExtension()
     return ScriptHandlerImpl::CreateContentHandler();
 }
 
+#endif // ADUC_BUILTIN_CONTENT_HANDLER
+
 EXTERN_C_END
 
 // Forward declarations.
@@ -60,12 +65,19 @@ ContentHandler* ScriptHandlerImpl::CreateContentHandler()
     return new ScriptHandlerImpl();
 }
 
+/**
+ * @brief Downloads the main script file into the work folder, unless another instance of the step, on another selected
+ * component, already did.
+ *
+ * @param handle The workflow handle.
+ * @return ADUC_Result The result.
+ */
 static ADUC_Result Script_Handler_DownloadPrimaryScriptFile(const ADUC_WorkflowHandle handle)
 {
     ADUC_Result result = { ADUC_Result_Failure };
     const char* workflowId = nullptr;
     char* workFolder = nullptr;
-    ADUC_FileEntity* entity = nullptr;
+    const ADUC_FileEntity* entity = nullptr;
     int fileCount = workflow_get_update_files_count(handle);
     int createResult = 0;
 
@@ -75,8 +87,14 @@ static ADUC_Result Script_Handler_DownloadPrimaryScriptFile(const ADUC_WorkflowH
         goto done;
     }
 
+    if (workflow_get_resolved_files_count(handle) > 0)
+    {
+        result = { ADUC_Result_Download_Success };
+        goto done;
+    }
+
     // Download the main script file.
-    if (!workflow_get_update_file(handle, 0, &entity))
+    if ((entity = workflow_peek_update_file(handle, 0)) == nullptr)
     {
         result.ExtendedResultCode = ADUC_ERC_SCRIPT_HANDLER_DOWNLOAD_FAILURE_GET_PRIMARY_FILE_ENTITY;
         goto done;
@@ -95,15 +113,23 @@ static ADUC_Result Script_Handler_DownloadPrimaryScriptFile(const ADUC_WorkflowH
 
     try
     {
-        result = ExtensionManager::Download(entity, workflowId, workFolder, DO_RETRY_TIMEOUT_DEFAULT, nullptr);
+        result = ExtensionManager::Download(
+            entity,
+            workflowId,
+            workFolder,
+            DO_RETRY_TIMEOUT_DEFAULT,
+            nullptr,
+            workflow_peek_cancellation_token(handle));
     }
     catch (...)
     {
         result.ExtendedResultCode = ADUC_ERC_SCRIPT_HANDLER_DOWNLOAD_PRIMARY_FILE_FAILURE_UNKNOWNEXCEPTION;
     }
 
-    workflow_free_file_entity(entity);
-    entity = nullptr;
+    if (IsAducResultCodeSuccess(result.ResultCode) && workflow_get_resolved_files_count(handle) == 0)
+    {
+        workflow_set_resolved_files_count(handle, 1);
+    }
 
 done:
     workflow_free_string(workFolder);
@@ -135,9 +161,18 @@ ADUC_Result ScriptHandlerImpl::Download(const tagADUC_WorkflowData* workflowData
     char* installedCriteria = nullptr;
     const char* workflowId = workflow_peek_id(workflowHandle);
     char* workFolder = workflow_get_workfolder(workflowData->WorkflowHandle);
-    ADUC_FileEntity* entity = nullptr;
+    std::vector<const ADUC_FileEntity*> entities;
     int fileCount = workflow_get_update_files_count(workflowHandle);
 
+    // The instances of a step on the selected components share its files, so only the first one resolves them; the
+    // steps handler finds out whether each instance is installed before downloading it.
+    if (fileCount > 0 && workflow_get_resolved_files_count(workflowHandle) >= static_cast<size_t>(fileCount))
+    {
+        Log_Info("The %d file(s) of the step are already downloaded and verified.", fileCount);
+        result = { ADUC_Result_Download_Success };
+        goto done;
+    }
+
     result = Script_Handler_DownloadPrimaryScriptFile(workflowHandle);
 
     if (IsAducResultCodeFailure(result.ResultCode))
@@ -155,42 +190,48 @@ ADUC_Result ScriptHandlerImpl::Download(const tagADUC_WorkflowData* workflowData
         goto done;
     }
 
-    result = { ADUC_Result_Download_Success };
-
     for (int i = 0; i < fileCount; i++)
     {
-        Log_Info("Downloading file #%d", i);
-
-        if (!workflow_get_update_file(workflowHandle, i, &entity))
+        const ADUC_FileEntity* entity = workflow_peek_update_file(workflowHandle, i);
+        if (entity == nullptr)
         {
             result = { .ResultCode = ADUC_Result_Failure,
                        .ExtendedResultCode = ADUC_ERC_SCRIPT_HANDLER_DOWNLOAD_FAILURE_GET_PAYLOAD_FILE_ENTITY };
             goto done;
         }
 
-        try
-        {
-            result = ExtensionManager::Download(entity, workflowId, workFolder, DO_RETRY_TIMEOUT_DEFAULT, nullptr);
-        }
-        catch (...)
-        {
-            result = { .ResultCode = ADUC_Result_Failure,
-                       .ExtendedResultCode = ADUC_ERC_SCRIPT_HANDLER_DOWNLOAD_PAYLOAD_FILE_FAILURE_UNKNOWNEXCEPTION };
-        }
+        entities.push_back(entity);
+    }
 
-        workflow_free_file_entity(entity);
-        entity = nullptr;
+    Log_Info("Downloading %d file(s)", fileCount);
 
-        if (IsAducResultCodeFailure(result.ResultCode))
-        {
-            Log_Error("Cannot download script payload file#%d. (0x%X)", i, result.ExtendedResultCode);
-            goto done;
-        }
+    try
+    {
+        result = ExtensionManager::DownloadFiles(
+            entities,
+            workflowId,
+            workFolder,
+            DO_RETRY_TIMEOUT_DEFAULT,
+            nullptr,
+            workflow_peek_cancellation_token(workflowHandle));
+    }
+    catch (...)
+    {
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_SCRIPT_HANDLER_DOWNLOAD_PAYLOAD_FILE_FAILURE_UNKNOWNEXCEPTION };
+    }
+
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        Log_Error("Cannot download script payload file(s). (0x%X)", result.ExtendedResultCode);
+        goto done;
     }
 
+    workflow_set_resolved_files_count(workflowHandle, static_cast<size_t>(fileCount));
+    result = { ADUC_Result_Download_Success };
+
 done:
     workflow_free_string(workFolder);
-    workflow_free_file_entity(entity);
     workflow_free_string(installedCriteria);
     Log_Info("Script_Handler download task end.");
     return result;
@@ -445,6 +486,27 @@ ADUC_Result ScriptHandlerImpl::Install(const tagADUC_WorkflowData* workflowData)
     return result;
 }
 
+/**
+ * @brief Handles a line the script wrote to its result channel: a JSON object with a "resultCode" is the result of
+ * the action, which replaces any previous one; other lines, e.g. progress, are logged.
+ *
+ * @param line The line.
+ * @param actionResultValue The result of the action so far, or nullptr.
+ */
+static void ScriptHandler_HandleResultLine(const std::string& line, JSON_Value** actionResultValue)
+{
+    JSON_Value* lineValue = json_parse_string(line.c_str());
+    if (lineValue != nullptr && json_object_has_value_of_type(json_object(lineValue), "resultCode", JSONNumber))
+    {
+        json_value_free(*actionResultValue);
+        *actionResultValue = lineValue;
+        return;
+    }
+
+    json_value_free(lineValue);
+    Log_Info("Script: %s", line.c_str());
+}
+
 static ADUC_Result ScriptHandler_PerformAction(const std::string& action, const tagADUC_WorkflowData* workflowData)
 {
     Log_Info("Action (%s) beging", action.c_str());
@@ -455,6 +517,7 @@ static ADUC_Result ScriptHandler_PerformAction(const std::string& action, const
     std::vector<std::string> args;
     std::string scriptOutput;
     int exitCode = 0;
+    const ADUC_CancellationToken* cancellationToken = nullptr;
 
     if (workflowData == nullptr || workflowData->WorkflowHandle == nullptr)
     {
@@ -511,7 +574,26 @@ static ADUC_Result ScriptHandler_PerformAction(const std::string& action, const
     Log_Debug("##########\n# ADU-SHELL ARGS:\n##########\n %s", ss.str().c_str());
     #endif
 
-    exitCode = ADUC_LaunchChildProcess(adushconst::adu_shell, aduShellArgs, scriptOutput);
+    // Only the install is interrupted; the other actions are short, and the cancel action runs once cancelled.
+    if (action == "--action-install")
+    {
+        cancellationToken = workflow_peek_cancellation_token(workflowData->WorkflowHandle);
+    }
+
+    // The script streams its result over the result channel; scripts that don't know about it write the result file.
+    exitCode = ADUC_LaunchAduShellWithResultChannel(
+        adushconst::adu_shell,
+        aduShellArgs,
+        scriptOutput,
+        [&actionResultValue](const std::string& line) { ScriptHandler_HandleResultLine(line, &actionResultValue); },
+        cancellationToken);
+    if (exitCode != 0 && ADUC_CancellationToken_IsCancelled(cancellationToken))
+    {
+        Log_Info("Install was cancelled (exitCode:%d)", exitCode);
+        result = { ADUC_Result_Failure_Cancelled };
+        goto done;
+    }
+
     if (exitCode != 0)
     {
         int extendedCode = ADUC_ERC_SCRIPT_HANDLER_CHILD_PROCESS_FAILURE_EXITCODE(exitCode);
@@ -524,15 +606,19 @@ static ADUC_Result ScriptHandler_PerformAction(const std::string& action, const
         Log_Info(scriptOutput.c_str());
     }
 
-    // Parse result file.
-    actionResultValue = json_parse_file(scriptResultFile.c_str());
+    if (actionResultValue == nullptr)
+    {
+        // Parse result file.
+        actionResultValue = json_parse_file(scriptResultFile.c_str());
+    }
+
     if (actionResultValue == nullptr)
     {
         result = { .ResultCode = ADUC_Result_Failure,
                    .ExtendedResultCode = ADUC_ERC_SCRIPT_HANDLER_INSTALL_FAILURE_PARSE_RESULT_FILE };
         workflow_set_result_details(
             workflowData->WorkflowHandle,
-            "The install script doesn't create a result file '%s'.",
+            "The install script doesn't report a result, nor create a result file '%s'.",
             scriptResultFile.c_str());
         goto done;
     }
@@ -7,6 +7,7 @@
  */
 #include "aduc/simulator_handler.hpp"
 #include "aduc/logging.h"
+#include "aduc/simulation_utils.hpp"
 #include "aduc/workflow_utils.h"
 #include "parson.h"
 #include <stdarg.h> // for va_*
@@ -101,6 +102,8 @@ char* _StringFormat(const char* fmt, ...)
     return outputStr;
 }
 
+#ifndef ADUC_BUILTIN_CONTENT_HANDLER
+
 /**
  * @brief Instantiates an Simulator Update Content Handler
  */
@@ -125,6 +128,8 @@ ContentHandler* CreateUpdateContentHandlerExtension(ADUC_LOG_SEVERITY logLevel)
     return nullptr;
 }
 
+#endif // ADUC_BUILTIN_CONTENT_HANDLER
+
 EXTERN_C_END
 
 /**
@@ -132,7 +137,9 @@ EXTERN_C_END
  */
 SimulatorHandlerImpl::~SimulatorHandlerImpl() // override
 {
+#ifndef ADUC_BUILTIN_CONTENT_HANDLER
     ADUC_Logging_Uninit();
+#endif
 }
 
 // Forward declarations.
@@ -181,6 +188,42 @@ done:
     return json_value_get_object(root_value);
 }
 
+/**
+ * @brief Runs the simulated behavior of @p phase, from the "behavior" section of the data file, if any.
+ *        Its latency applies to any result, but an injected failure only replaces a successful one.
+ *
+ * @param data The simulator data.
+ * @param phase The name of the phase, e.g. "download".
+ * @param bytes The bytes that the phase transfers, e.g. the size of a downloaded file.
+ * @param handle The workflow handle.
+ * @param result The result from the simulator data file.
+ * @return ADUC_Result The injected failure, or @p result.
+ */
+static ADUC_Result SimulateBehavior(
+    const JSON_Object* data, const char* phase, uint64_t bytes, ADUC_WorkflowHandle handle, ADUC_Result result)
+{
+    ADUC::SimulationUtils::PhaseBehavior behavior;
+    if (!ADUC::SimulationUtils::GetPhaseBehavior(json_object_get_object(data, "behavior"), phase, &behavior))
+    {
+        return result;
+    }
+
+    const bool failed =
+        ADUC::SimulationUtils::SimulatePhase(behavior, bytes, workflow_peek_cancellation_token(handle));
+    if (!failed || IsAducResultCodeFailure(result.ResultCode))
+    {
+        return result;
+    }
+
+    Log_Info("Simulating a '%s' failure.", phase);
+    if (handle != nullptr)
+    {
+        workflow_set_result_details(handle, behavior.FailureResultDetails.c_str());
+    }
+
+    return behavior.FailureResult;
+}
+
 /**
  * @brief Mock implementation of download action.
  * @return ADUC_Result Return result from simulator data file if specified.
@@ -240,6 +283,7 @@ ADUC_Result SimulatorHandlerImpl::Download(const tagADUC_WorkflowData* workflowD
             resultForFile = json_value_get_object(json_object_get_value(downloadResult, "*"));
         }
 
+        const uint64_t sizeInBytes = entity->SizeInBytes;
         workflow_free_file_entity(entity);
         entity = nullptr;
 
@@ -254,6 +298,8 @@ ADUC_Result SimulatorHandlerImpl::Download(const tagADUC_WorkflowData* workflowD
             result = { .ResultCode = ADUC_Result_Download_Success };
         }
 
+        result = SimulateBehavior(data, "download", sizeInBytes, handle, result);
+
         if (IsAducResultCodeFailure(result.ResultCode))
         {
             goto done;
@@ -318,6 +364,8 @@ ADUC_Result SimulatorActionHelper(
         }
     }
 
+    result = SimulateBehavior(data, action, 0, handle, result);
+
     // For 'microsoft/bundle:1' implementation, abort download task as soon as an error occurs.
     if (IsAducResultCodeFailure(result.ResultCode))
     {
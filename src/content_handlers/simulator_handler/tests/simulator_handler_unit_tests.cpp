@@ -12,6 +12,7 @@
 #include <catch2/catch.hpp>
 using Catch::Matchers::Equals;
 
+#include <chrono>
 #include <fstream>
 #include <memory>
 #include <string.h>
@@ -124,6 +125,27 @@ const char* installFailed33333 =
     R"(  })"
     R"(})";
 
+const char* installFlaky66666 =
+    R"({)"
+    R"(  "install" : {)"
+    R"(    "resultCode" : 600,)"
+    R"(    "extendedResultCode" : 0,)"
+    R"(    "resultDetails" : "")"
+    R"(  },)"
+    R"(  "behavior" : {)"
+    R"(    "seed" : 42,)"
+    R"(    "install" : {)"
+    R"(      "latencyMs" : 50,)"
+    R"(      "failureRate" : 1,)"
+    R"(      "failureResult" : {)"
+    R"(        "resultCode" : 0,)"
+    R"(        "extendedResultCode" : 66666,)"
+    R"(        "resultDetails" : "Mock slow flash - 66666")"
+    R"(      })"
+    R"(    })"
+    R"(  })"
+    R"(})";
+
 const char* applySucceed710 =
     R"({)"
     R"(  "apply" : {)"
@@ -316,6 +338,32 @@ TEST_CASE("Install Failed 333333")
     workflow_free(handle);
 }
 
+TEST_CASE("Install - Simulated behavior - Failed 66666")
+{
+    SimulatorHandlerDataFile simData(installFlaky66666);
+
+    ADUC_WorkflowHandle handle = nullptr;
+    ADUC_Result result = workflow_init(action_process_deployment, false, &handle);
+    CHECK(result.ResultCode != 0);
+    CHECK(result.ExtendedResultCode == 0);
+
+    ADUC_WorkflowData testWorkflow{};
+    testWorkflow.WorkflowHandle = handle;
+
+    std::unique_ptr<ContentHandler> simHandler{ CreateUpdateContentHandlerExtension(ADUC_LOG_DEBUG) };
+
+    const auto start = std::chrono::steady_clock::now();
+    result = simHandler->Install(&testWorkflow);
+    testWorkflow.WorkflowHandle = nullptr;
+
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+    CHECK(result.ResultCode == 0);
+    CHECK(result.ExtendedResultCode == 66666);
+    CHECK_THAT(workflow_peek_result_details(handle), Equals("Mock slow flash - 66666"));
+
+    workflow_free(handle);
+}
+
 TEST_CASE("Install - No Results - Succeeded 600")
 {
     SimulatorHandlerDataFile simData(noResultsSpecified);
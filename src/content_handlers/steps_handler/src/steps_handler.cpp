@@ -8,27 +8,45 @@
 #include "aduc/steps_handler.hpp"
 
 #include "aduc/component_enumerator_extension.hpp"
+#include "aduc/config_utils.h"
 #include "aduc/extension_manager.hpp"
 #include "aduc/extension_utils.h"
 #include "aduc/logging.h"
+#include "aduc/progress_telemetry.h"
+#include "aduc/state_journal.h"
+#include "aduc/string_c_utils.h" // for atoui
 #include "aduc/string_utils.hpp"
 #include "aduc/system_utils.h"
+#include "aduc/thermal_utils.h"
+#include "aduc/timing_utils.h"
 #include "aduc/workflow_utils.h"
 
 #include "parson.h"
 
 #include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstdarg>
 #include <fstream>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <azure_c_shared_utility/crt_abstractions.h> // mallocAndStrcpy
 #include <azure_c_shared_utility/strings.h> // STRING_*
 
 #include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // Note: this requires ${CMAKE_DL_LIBS}
 #include <dlfcn.h>
@@ -37,6 +55,8 @@
 
 EXTERN_C_BEGIN
 
+#ifndef ADUC_BUILTIN_CONTENT_HANDLER
+
 /**
  * @brief Instantiates a special handler that performs multi-steps ordered execution.
  */
@@ -60,6 +80,8 @@ ContentHandler* CreateUpdateContentHandlerExtension(ADUC_LOG_SEVERITY logLevel)
     return nullptr;
 }
 
+#endif // ADUC_BUILTIN_CONTENT_HANDLER
+
 EXTERN_C_END
 
 /**
@@ -67,551 +89,2637 @@ EXTERN_C_END
  */
 StepsHandlerImpl::~StepsHandlerImpl() // override
 {
+#ifndef ADUC_BUILTIN_CONTENT_HANDLER
     ADUC_Logging_Uninit();
+#endif
 }
 
 /**
- * @brief Make sure that all step workflows are created.
+ * @brief Downloads the detached update manifest files of all reference steps at the same time, ahead of
+ * creating the step workflows. Each step still downloads its manifest in order afterwards, which is then
+ * satisfied from the already verified file, and reports any error.
  *
  * @param handle A workflow data object handle.
- * @return ADUC_Result
+ * @param stepCount The number of steps.
+ * @param workflowId The workflow id.
+ * @param workFolder The work folder.
  */
-ADUC_Result EnsureStepsWorkflowsCreated(const ADUC_WorkflowHandle handle)
+static void PrefetchDetachedManifestFiles(
+    const ADUC_WorkflowHandle handle, unsigned int stepCount, const char* workflowId, const char* workFolder)
 {
-    ADUC_Result result{ ADUC_Result_Failure };
-    ADUC_WorkflowHandle childHandle = nullptr;
-
-    auto stepCount = static_cast<unsigned int>(workflow_get_instructions_steps_count(handle));
-    const char* workflowId = workflow_peek_id(handle);
-    char* workFolder = workflow_get_workfolder(handle);
-    unsigned int childWorkflowCount = workflow_get_children_count(handle);
-    ADUC_FileEntity* entity = nullptr;
-    int workflowLevel = workflow_get_level(handle);
-
-    int createResult = ADUC_SystemUtils_MkSandboxDirRecursive(workFolder);
-    if (createResult != 0)
-    {
-        Log_Error("Unable to create folder %s, error %d", workFolder, createResult);
-        result = { ADUC_Result_Failure, ADUC_ERC_STEPS_HANDLER_CREATE_SANDBOX_FAILURE };
-        goto done;
-    }
+    std::vector<ADUC_FileEntity*> entities;
 
-    // Child workflow should be either 0 (resuming install phase after agent restarted),
-    // or equal to fileCount (already created children during download phase)
-    if (childWorkflowCount != stepCount)
+    try
     {
-        // Remove existing child workflow handle(s)
-        while (workflow_get_children_count(handle) > 0)
-        {
-            ADUC_WorkflowHandle child = workflow_remove_child(handle, 0);
-            workflow_free(child);
-        }
-
-        Log_Debug("Creating workflow for %d step(s). Parent's level: %d", stepCount, workflowLevel);
         for (unsigned int i = 0; i < stepCount; i++)
         {
-            STRING_HANDLE childId = nullptr;
             ADUC_FileEntity* entity = nullptr;
-
-            if (workflow_is_inline_step(handle, i))
-            {
-                const char* selectedComponents = workflow_peek_selected_components(handle);
-
-                Log_Debug("Creating workflow for level#%d step#%d. Selected components:\n=====\n%s\n=====", workflowLevel, i, selectedComponents);
-
-                // Create child workflow using inline step data.
-                result = workflow_create_from_inline_step(handle, i, &childHandle);
-
-                if (IsAducResultCodeSuccess(result.ResultCode))
-                {
-                    // Inherit parent's selected components.
-                    workflow_set_selected_components(childHandle, workflow_peek_selected_components(handle));
-                }
-            }
-            else
-            {
-                // Download detached update manifest file.
-                if (!workflow_get_step_detached_manifest_file(handle, i, &entity))
-                {
-                    result = { .ResultCode = ADUC_Result_Failure,
-                            .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_GET_FILE_ENTITY_FAILURE };
-                    Log_Error("Cannot get a detached Update manifest file entity for level#%d step#%d", workflowLevel, i);
-                    goto done;
-                }
-
-                Log_Info("Downloading a detached Update manifest file for level#%d step#%d (file id:%s).", workflowLevel, i, entity->FileId);
-
-                try
-                {
-                    result = ExtensionManager::Download(entity, workflowId, workFolder, DO_RETRY_TIMEOUT_DEFAULT, nullptr);
-                }
-                catch (...)
-                {
-                    Log_Error("Exception occured while downloading a detached Update Manifest file for level#%d step#%d (file id:%s).", workflowLevel, i, entity->FileId);
-                    result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_DOWNLOAD_FAILURE_UNKNOWNEXCEPTION;
-                }
-
-                std::stringstream childManifestFile;
-                childManifestFile << workFolder << "/" << entity->TargetFilename;
-
-                workflow_free_file_entity(entity);
-                entity = nullptr;
-
-                // For 'microsoft/steps:1' implementation, abort download task as soon as an error occurs.
-                if (IsAducResultCodeFailure(result.ResultCode))
-                {
-                    Log_Error("An error occured while downloading manifest file for step#%d (erc:%d)",i, result.ExtendedResultCode);
-                    goto done;
-                }
-
-                // Create child workflow from file.
-                result = workflow_init_from_file(childManifestFile.str().c_str(), false, &childHandle);
-
-                if (IsAducResultCodeSuccess(result.ResultCode))
-                {
-                    // Select components based on the first pair of compatibility properties.
-                    char* compatibilityString = workflow_get_update_manifest_compatibility(childHandle, 0);
-                    JSON_Value* compsValue = nullptr;
-                    if (compatibilityString == nullptr)
-                    {
-                        Log_Error("Cannot get compatibility info for components-update #%d", i);
-                        result = { .ResultCode = ADUC_Result_Failure,
-                                .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_GET_REF_STEP_COMPATIBILITY_FAILED };
-                        goto done;
-                    }
-
-                    std::string output;
-                    result = ExtensionManager::SelectComponents(compatibilityString, output);
-
-                    if (IsAducResultCodeFailure(result.ResultCode))
-                    {
-                        Log_Error("Cannot select components for components-update #%d", i);
-                        goto done;
-                    }
-
-                    compsValue = json_parse_string(output.c_str());
-                    json_value_free(compsValue);
-
-                    if (!workflow_set_selected_components(childHandle, output.c_str()))
-                    {
-                        result.ResultCode = ADUC_Result_Failure;
-                        result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_SET_SELECTED_COMPONENTS_FAILURE;
-                    }
-
-                    Log_Debug("Set child handle's selected components: %s", workflow_peek_selected_components(childHandle));
-                }
-            }
-
-            if (IsAducResultCodeFailure(result.ResultCode))
-            {
-                Log_Error("ERROR: failed to create workflow for level:%d step#%d.", workflowLevel, i);
-                goto done;
-            }
-            else
+            if (!workflow_is_inline_step(handle, i) && workflow_get_step_detached_manifest_file(handle, i, &entity))
             {
-                childId = STRING_construct_sprintf("%d", i);
-                workflow_set_id(childHandle, STRING_c_str(childId));
-                STRING_delete(childId);
-                childId = nullptr;
-#if _ADU_DEBUG
-                char* childManifest = workflow_get_serialized_update_manifest(childHandle, true);
-                Log_Debug("##########\n# Successfully created workflow object for child#%s\n# Handle:0x%x\n# Manifest:\n%s\n", workflow_peek_id(childHandle),
-                childHandle,
-                childManifest);
-                workflow_free_string(childManifest);
-#endif
+                entities.push_back(entity);
             }
+        }
 
-            if (!workflow_insert_child(handle, -1, childHandle))
-            {
-                result = { .ResultCode = ADUC_Result_Failure,
-                           .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_CHILD_WORKFLOW_INSERT_FAILED };
-                goto done;
-            }
+        if (entities.size() > 1)
+        {
+            Log_Info("Downloading %zu detached Update manifest file(s).", entities.size());
+            ExtensionManager::DownloadFiles(
+                { entities.begin(), entities.end() },
+                workflowId,
+                workFolder,
+                DO_RETRY_TIMEOUT_DEFAULT,
+                nullptr,
+                workflow_peek_cancellation_token(handle));
         }
     }
-
-    result = { ADUC_Result_Success };
-
-done:
-    if (IsAducResultCodeFailure(result.ResultCode))
+    catch (...)
     {
-        workflow_free(childHandle);
+        Log_Warn("Exception occured while downloading detached Update manifest files.");
     }
 
-    workflow_free_string(workFolder);
-    workflow_free_file_entity(entity);
-    return result;
+    for (ADUC_FileEntity* entity : entities)
+    {
+        workflow_free_file_entity(entity);
+    }
 }
 
 /**
- * @brief Creates a new StepsHandlerImpl object and casts to a ContentHandler.
- * Note that there is no way to create a StepsHandlerImpl directly.
+ * @brief Gets the IsInstalled result of the step @p stepHandle remembered by CacheStepIsInstalled, if any.
  *
- * @return ContentHandler* StepsHandlerImpl object as a ContentHandler.
+ * @param stepHandle The step's (child) workflow handle.
+ * @param componentJson The component the step is processed for. NULL for the host device.
+ * @param result Receives the remembered result.
+ * @return bool true if a result was remembered.
  */
-ContentHandler* StepsHandlerImpl::CreateContentHandler()
+static bool GetCachedStepIsInstalled(ADUC_WorkflowHandle stepHandle, const char* componentJson, ADUC_Result* result)
 {
-    return new StepsHandlerImpl();
+    if (!workflow_get_cached_is_installed(stepHandle, componentJson, &result->ResultCode))
+    {
+        return false;
+    }
+
+    Log_Debug("Reusing the IsInstalled result of the step (%d).", result->ResultCode);
+    result->ExtendedResultCode = 0;
+    return true;
 }
 
 /**
- * @brief Return a json string containing a 'components' array with one component.
- *
- * @param components The source components array.
- * @param index Index of the component to be returned.
- * @return char* Returns a json string containing serialized 'components' data.
+ * @brief Remembers the IsInstalled result @p result of the step @p stepHandle in the step's workflow, if it tells
+ * whether the step is installed.
  */
-static char* CreateComponentSerializedString(JSON_Array* components, size_t index)
+static void CacheStepIsInstalled(ADUC_WorkflowHandle stepHandle, const char* componentJson, ADUC_Result result)
 {
-    JSON_Value* root = json_value_init_object();
-    JSON_Value* componentClone = json_value_deep_copy(json_array_get_value(components, index));
-    JSON_Array* array = json_array(json_value_init_array());
-    json_array_append_value(array, componentClone);
-    json_object_set_value(json_object(root), "components", json_array_get_wrapping_value(array));
-    return json_serialize_to_string_pretty(root);
+    if (result.ResultCode == ADUC_Result_IsInstalled_Installed
+        || result.ResultCode == ADUC_Result_IsInstalled_NotInstalled)
+    {
+        workflow_set_cached_is_installed(stepHandle, componentJson, result.ResultCode);
+    }
 }
 
 /**
- * @brief Get a list of selected components for specified workflow.
+ * @brief Returns whether the step @p stepWorkflow is installed on its selected components, remembering the
+ * result in the step's workflow so that the following phases needn't evaluate it again.
+ * The remembered results are forgotten once anything gets installed, see workflow_clear_cached_is_installed.
  *
- * @param handle A workflow data object handle.
- * @param componentsArray Array of selected components.
- * @return ADUC_Result Returns ADUC_Result_Success is succeeded.
- *         Otherwise, returns ADUC_ERC_STEPS_HANDLER_INVALID_COMPONENTS_DATA.
+ * @param contentHandler The step's handler.
+ * @param stepWorkflow The step's workflow.
+ * @param componentJson The component the step is processed for. NULL for the host device.
+ * @return ADUC_Result The result of the step handler's IsInstalled.
  */
-static ADUC_Result GetSelectedComponentsArray(const ADUC_WorkflowHandle handle, JSON_Array** componentsArray)
+static ADUC_Result
+StepIsInstalled(ContentHandler* contentHandler, ADUC_WorkflowData* stepWorkflow, const char* componentJson)
 {
-    ADUC_Result result = { ADUC_Result_Failure };
-    JSON_Value* rootValue = nullptr;
-    JSON_Object* rootObject = nullptr;
+    ADUC_Result result{ ADUC_Result_Failure };
+    ADUC_WorkflowHandle stepHandle = stepWorkflow->WorkflowHandle;
 
-    if (componentsArray == nullptr)
+    if (GetCachedStepIsInstalled(stepHandle, componentJson, &result))
     {
-        workflow_set_result_details(handle, "Invalid parameter - componentsArray");
         return result;
     }
 
-    *componentsArray = nullptr;
-
-    // Parse componenets list. If the list is empty, nothing to install.
-    const char* selectedComponents = workflow_peek_selected_components(handle);
-    if (selectedComponents == nullptr)
+    try
     {
-        result = { .ResultCode = ADUC_Result_Failure };
-        goto done;
+        result = contentHandler->IsInstalled(stepWorkflow);
     }
+    catch (...)
+    {
+        // Cannot determine whether the step has been applied, so, we'll try to process the step.
+        return { .ResultCode = ADUC_Result_IsInstalled_NotInstalled, .ExtendedResultCode = 0 };
+    }
+
+    CacheStepIsInstalled(stepHandle, componentJson, result);
+    return result;
+}
+
+/**
+ * @brief Records the timing span @p name of step #@p stepIndex, see timing_utils.h.
+ *
+ * @param name The name of the span. Must be a string literal.
+ * @param stepIndex The index of the step.
+ * @param startTime The start of the span, from ADUC_Timing_Now.
+ */
+static void EndStepSpan(const char* name, int stepIndex, int64_t startTime)
+{
+    char detail[32];
+    snprintf(detail, sizeof(detail), "step #%d", stepIndex);
+    ADUC_Timing_EndSpan(name, detail, startTime);
+}
 
-    rootValue = json_parse_string(selectedComponents);
-    if (rootValue == nullptr)
+// The deadlines of the steps in progress, of all the components installed concurrently. The earliest is the step
+// deadline of the workflow, which the agent's watchdog enforces.
+static std::mutex s_stepDeadlinesMutex;
+static std::multiset<int64_t> s_stepDeadlines;
+
+/**
+ * @brief Bounds the install or apply of a step by its timeout, see workflow_get_operation_timeout, while in scope.
+ */
+class StepDeadline
+{
+public:
+    StepDeadline(ADUC_WorkflowHandle handle, ADUC_WorkflowHandle stepHandle, ADUCITF_WorkflowStep phase)
+        : _handle(handle)
     {
+        const unsigned int timeoutSeconds = workflow_get_operation_timeout(stepHandle, phase);
+        if (timeoutSeconds == 0)
+        {
+            return;
+        }
 
-        result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INVALID_COMPONENTS_DATA;
-        goto done;
+        std::lock_guard<std::mutex> lock(s_stepDeadlinesMutex);
+        _deadline = s_stepDeadlines.insert(ADUC_Timing_Now() + static_cast<int64_t>(timeoutSeconds) * 1000000000);
+        _active = true;
+        workflow_set_step_deadline(_handle, *s_stepDeadlines.begin());
     }
 
-    rootObject = json_object(rootValue);
-    *componentsArray = json_object_get_array(rootObject, "components");
-    if (*componentsArray == nullptr)
+    ~StepDeadline()
     {
-        result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INVALID_COMPONENTS_DATA;
-        goto done;
+        if (!_active)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(s_stepDeadlinesMutex);
+        s_stepDeadlines.erase(_deadline);
+        workflow_set_step_deadline(_handle, s_stepDeadlines.empty() ? 0 : *s_stepDeadlines.begin());
     }
 
-    result = { .ResultCode = ADUC_Result_Success,
-               .ExtendedResultCode = 0 };
+    StepDeadline(const StepDeadline&) = delete;
+    StepDeadline& operator=(const StepDeadline&) = delete;
 
-done:
-    return result;
+private:
+    ADUC_WorkflowHandle _handle;
+    std::multiset<int64_t>::iterator _deadline;
+    bool _active = false;
+};
+
+/**
+ * @brief Records the result of a phase of a step for the progress telemetry, see progress_telemetry.h.
+ *
+ * @param stepHandle The step's (child) workflow handle.
+ * @param stepIndex The index of the step.
+ * @param phase The phase, e.g. "download".
+ * @param result The result of the phase.
+ */
+static void RecordStepProgress(ADUC_WorkflowHandle stepHandle, int stepIndex, const char* phase, ADUC_Result result)
+{
+    ADUC_ProgressTelemetry_RecordStep(
+        workflow_peek_id(workflow_get_root(stepHandle)),
+        stepIndex,
+        phase,
+        result.ResultCode,
+        result.ExtendedResultCode);
 }
 
 /**
- * @brief Perform download phase for specified step.
+ * @brief Requests the reboot or agent restart that a step's install or apply result requires, and records the step
+ * as its reason. The requests that aren't immediate are deferred to the end of the whole workflow, see
+ * ApplyRestartBarrier, so that several steps requiring them cause a single reboot or restart.
  *
- * @param workflowData A workflow data object.
- * @param stepIndex A step index.
- * @return ADUC_Result
+ * @param handle The workflow handle of the steps.
+ * @param stepIndex The index of the step.
+ * @param immediate Whether the reboot or restart must happen before the next step.
+ * @param reboot Whether a reboot is required, rather than an agent restart.
+ * @param handleMutex Serializes the requests of the components installed at the same time.
  */
-static ADUC_Result ProcessStepDownloadPhase(const tagADUC_WorkflowData* workflowData, int stepIndex)
+static void RequestRestartForStep(
+    ADUC_WorkflowHandle handle, int stepIndex, bool immediate, bool reboot, std::mutex* handleMutex)
 {
-    Log_Info("Step's download phase begin.");
-    ADUC_Result result = { ADUC_Result_Failure };
-    ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
-    ContentHandler* contentHandler = nullptr;
-    ADUC_WorkflowHandle childHandler = workflow_get_child(handle, stepIndex);
-    ADUC_WorkflowData childWorkflow {
-        .WorkflowHandle = childHandler
-    };
+    char reason[128];
+    snprintf(
+        reason,
+        sizeof(reason),
+        "level %d step #%d: %s%s",
+        workflow_get_level(handle),
+        stepIndex,
+        immediate ? "immediate " : "",
+        reboot ? "reboot" : "agent restart");
 
-    const char* stepHandlerName = workflow_is_inline_step(handle, stepIndex) ?
-                                    workflow_peek_update_manifest_step_handler(handle, stepIndex):
-                                    DEFAULT_REF_STEP_HANDLER;
+    Log_Info("Step requires a restart (%s).", reason);
 
-    Log_Info("Loading handler for step #%d ('%s')", stepIndex, stepHandlerName);
+    std::lock_guard<std::mutex> lock(*handleMutex);
 
-    char* workFolder = workflow_get_workfolder(childHandler);
-    int createResult = ADUC_SystemUtils_MkSandboxDirRecursive(workFolder);
-    if (createResult != 0)
+    if (reboot && immediate)
     {
-        Log_Error("Unable to create folder %s, error %d", workFolder, createResult);
-        result = { ADUC_Result_Failure, ADUC_ERC_STEPS_HANDLER_CREATE_SANDBOX_FAILURE };
-        goto done;
+        workflow_request_immediate_reboot(handle);
     }
-
-    result = ExtensionManager::LoadUpdateContentHandlerExtension(stepHandlerName, &contentHandler);
-
-    if (IsAducResultCodeFailure(result.ResultCode))
+    else if (reboot)
     {
-        Log_Error("Cannot load the step handler for step #%d", stepIndex);
+        workflow_request_reboot(handle);
+    }
+    else if (immediate)
+    {
+        workflow_request_immediate_agent_restart(handle);
     }
     else
     {
-        // Step is completed, no files required.
-        result = contentHandler->Download(&childWorkflow);
+        workflow_request_agent_restart(handle);
     }
 
-done:
-    workflow_set_result(childHandler, result);
-
-    workflow_set_state(
-        handle, IsAducResultCodeSuccess(result.ResultCode) ? ADUCITF_State_DownloadSucceeded : ADUCITF_State_Failed);
-
-
-    workflow_free_string(workFolder);
-    return result;
+    workflow_add_restart_reason(handle, reason);
 }
 
 /**
- * @brief Performs 'Download' task by iterating through all steps and invoke each step's handler
- * to download file(s), if needed.
- *
- * It is a step's handler's responsibility to determine whether
- * files are needed for 'install' and 'apply' phases.
- *
- * @param workflowData A workflow data object.
+ * @brief Turns the reboot and agent restart requests of the steps of a top-level workflow into its install result,
+ * once every step is installed: the deferred requests are coalesced into a single reboot, or a single agent restart
+ * if no step requires a reboot, since a reboot restarts the agent too. An immediate agent restart becomes an
+ * immediate reboot if a reboot is pending, so that the device doesn't restart twice.
  *
- * @return ADUC_Result The result.
+ * @param handle The top-level workflow handle.
+ * @param result The install result, updated.
  */
-static ADUC_Result StepsHandler_Download(const tagADUC_WorkflowData* workflowData)
+static void ApplyRestartBarrier(ADUC_WorkflowHandle handle, ADUC_Result* result)
 {
-    ADUC_Result result{ ADUC_Result_Failure };
-    ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
-    ADUC_WorkflowHandle stepHandle = nullptr;
+    const bool rebootRequested = workflow_is_reboot_requested(handle) || workflow_is_immediate_reboot_requested(handle);
 
-    char* workflowId = workflow_get_id(handle);
-    char* workingFolder = workflow_get_workfolder(handle);
-    char* compatibilityString = nullptr;
-    JSON_Array* selectedComponentsArray = nullptr;
-    char* currentComponent;
-    int workflowLevel = workflow_get_level(handle);
+    if (result->ResultCode == ADUC_Result_Install_RequiredImmediateAgentRestart && rebootRequested)
+    {
+        result->ResultCode = ADUC_Result_Install_RequiredImmediateReboot;
+    }
+    else if (result->ResultCode == ADUC_Result_Install_Success)
+    {
+        if (rebootRequested)
+        {
+            result->ResultCode = ADUC_Result_Install_RequiredReboot;
+        }
+        else if (workflow_is_agent_restart_requested(handle))
+        {
+            result->ResultCode = ADUC_Result_Install_RequiredAgentRestart;
+        }
+    }
+
+    const char* reasons = workflow_peek_restart_reasons(handle);
+    if (reasons != nullptr
+        && (result->ResultCode == ADUC_Result_Install_RequiredReboot
+            || result->ResultCode == ADUC_Result_Install_RequiredImmediateReboot
+            || result->ResultCode == ADUC_Result_Install_RequiredAgentRestart
+            || result->ResultCode == ADUC_Result_Install_RequiredImmediateAgentRestart))
+    {
+        Log_Info("Restarting once for: %s", reasons);
+        workflow_set_result_details(handle, "Restart required by %s", reasons);
+    }
+}
+
+// The file name of the step journal, in the work folder of the steps workflow.
+#define STEP_JOURNAL_FILE_NAME ".steps.journal"
+
+/**
+ * @brief The journal of the steps completed by the install of a steps workflow, so that an install interrupted by a
+ * crash or a power loss resumes from the first incomplete step, instead of evaluating every step again with
+ * IsInstalled, which may be slow or unreliable, e.g. for script steps.
+ *
+ * The journal is a state journal, see state_journal.h, in the work folder of the steps workflow. Its first record is
+ * the key of the workflow, see GetStepJournalKey; each following one is a step completed on a component, with the
+ * reboot or agent restart it deferred to the end of the workflow, which is requested again when the install resumes.
+ * A step that requires an immediate reboot or agent restart isn't recorded: it is evaluated with IsInstalled once the
+ * device or the agent is back, as before.
+ */
+struct StepJournal
+{
+    std::string path; //!< The path of the journal. Empty if it can't be written.
+    std::string key; //!< The key record of the steps workflow.
+    bool valid = false; //!< Whether the journal on disk was written for the same steps workflow.
+    std::mutex mutex; //!< Serializes the records of the components installed at the same time.
+    std::map<std::pair<int, std::string>, std::string> completedSteps; //!< The deferred restart of each step
+                                                                        //!< completed, by index and component.
+};
+
+/**
+ * @brief Returns the key record of the step journal of @p handle: a journal written for another deployment, update
+ * or steps workflow is ignored.
+ */
+static std::string GetStepJournalKey(ADUC_WorkflowHandle handle)
+{
+    std::string key;
+    char* updateId = workflow_get_expected_update_id_string(handle);
+    JSON_Value* keyValue = json_value_init_object();
+    JSON_Object* keyObject = json_value_get_object(keyValue);
+    char* serialized = nullptr;
+
+    if (keyObject != nullptr && json_object_set_string(keyObject, "workflowId", workflow_peek_id(handle)) == JSONSuccess
+        && json_object_set_string(keyObject, "updateId", updateId == nullptr ? "" : updateId) == JSONSuccess
+        && json_object_set_number(keyObject, "level", workflow_get_level(handle)) == JSONSuccess)
+    {
+        serialized = json_serialize_to_string(keyValue);
+    }
+
+    if (serialized != nullptr)
+    {
+        key = serialized;
+    }
+
+    json_free_serialized_string(serialized);
+    json_value_free(keyValue);
+    workflow_free_string(updateId);
+
+    return key;
+}
+
+/**
+ * @brief The loading of a step journal, see ApplyStepJournalRecord.
+ */
+struct StepJournalLoad
+{
+    StepJournal* journal; //!< The journal loaded.
+    bool keyRead; //!< Whether the key record was read.
+};
+
+/**
+ * @brief Applies a record of a step journal to the StepJournalLoad @p context, see ADUC_StateJournal_ForEach.
+ */
+static void ApplyStepJournalRecord(const char* record, void* context)
+{
+    StepJournalLoad* load = static_cast<StepJournalLoad*>(context);
+    StepJournal* journal = load->journal;
+
+    // The first record tells whether the others are for this steps workflow.
+    if (!load->keyRead)
+    {
+        load->keyRead = true;
+        journal->valid = !journal->key.empty() && journal->key == record;
+        return;
+    }
+
+    if (!journal->valid)
+    {
+        return;
+    }
+
+    JSON_Value* recordValue = json_parse_string(record);
+    JSON_Object* recordObject = json_value_get_object(recordValue);
+
+    if (recordObject != nullptr && json_object_has_value_of_type(recordObject, "step", JSONNumber))
+    {
+        const int stepIndex = static_cast<int>(json_object_get_number(recordObject, "step"));
+        const char* component = json_object_get_string(recordObject, "component");
+        const char* restart = json_object_get_string(recordObject, "restart");
+
+        journal->completedSteps.emplace(
+            std::make_pair(stepIndex, std::string(component == nullptr ? "" : component)),
+            restart == nullptr ? "" : restart);
+    }
+
+    json_value_free(recordValue);
+}
+
+/**
+ * @brief Loads the step journal of the steps workflow @p handle, if the agent wrote it for the same workflow.
+ *
+ * @param handle The steps workflow handle.
+ * @param journal The journal, loaded.
+ */
+static void LoadStepJournal(ADUC_WorkflowHandle handle, StepJournal* journal)
+{
+    struct stat st;
+    const char* workFolder = workflow_peek_workfolder(handle);
+
+    if (workFolder == nullptr)
+    {
+        return;
+    }
+
+    journal->path = std::string(workFolder) + "/" STEP_JOURNAL_FILE_NAME;
+    journal->key = GetStepJournalKey(handle);
+
+    if (lstat(journal->path.c_str(), &st) != 0)
+    {
+        return;
+    }
+
+    // Only a journal the agent wrote itself is trusted to skip steps.
+    if (!S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+    {
+        Log_Warn("Ignoring step journal %s not written by the agent.", journal->path.c_str());
+        return;
+    }
+
+    StepJournalLoad load = { journal, false };
+    const int err = ADUC_StateJournal_ForEach(journal->path.c_str(), ApplyStepJournalRecord, &load, nullptr);
+    if (err != 0)
+    {
+        Log_Warn("Cannot read step journal %s, errno %d", journal->path.c_str(), err);
+    }
+
+    if (err != 0 || !journal->valid)
+    {
+        journal->valid = false;
+        journal->completedSteps.clear();
+        return;
+    }
+
+    if (!journal->completedSteps.empty())
+    {
+        Log_Info("Resuming after %zu step(s) recorded in the step journal.", journal->completedSteps.size());
+    }
+}
+
+/**
+ * @brief Starts the step journal of an install over, unless it was written for the same steps workflow.
+ *
+ * @param handle The steps workflow handle.
+ * @param journal The journal, loaded. Its path is cleared if it can't be written.
+ */
+static void OpenStepJournal(ADUC_WorkflowHandle handle, StepJournal* journal)
+{
+    LoadStepJournal(handle, journal);
+
+    if (journal->valid || journal->path.empty())
+    {
+        return;
+    }
+
+    const int err =
+        journal->key.empty() ? ENOMEM : ADUC_StateJournal_Compact(journal->path.c_str(), journal->key.c_str());
+    if (err != 0)
+    {
+        Log_Warn("Cannot start step journal %s, errno %d", journal->path.c_str(), err);
+        journal->path.clear();
+    }
+}
+
+/**
+ * @brief Returns whether step #@p stepIndex was completed on the component @p componentJson, according to @p journal.
+ *
+ * @param journal The journal, or NULL.
+ * @param stepIndex The index of the step.
+ * @param componentJson The component. NULL for the host device.
+ * @param restart Receives the restart the step deferred, "reboot", "agent" or empty, if not NULL.
+ */
+static bool IsStepJournaled(StepJournal* journal, int stepIndex, const char* componentJson, std::string* restart)
+{
+    if (journal == nullptr)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(journal->mutex);
+
+    const auto entry = journal->completedSteps.find(
+        std::make_pair(stepIndex, std::string(componentJson == nullptr ? "" : componentJson)));
+    if (entry == journal->completedSteps.end())
+    {
+        return false;
+    }
+
+    if (restart != nullptr)
+    {
+        *restart = entry->second;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Records in @p journal that step #@p stepIndex was completed on the component @p componentJson, and syncs it.
+ *
+ * @param journal The journal, or NULL.
+ * @param stepIndex The index of the step.
+ * @param componentJson The component. NULL for the host device.
+ * @param restart The restart the step deferred, "reboot" or "agent"; NULL if none.
+ */
+static void JournalStepCompleted(StepJournal* journal, int stepIndex, const char* componentJson, const char* restart)
+{
+    if (journal == nullptr || journal->path.empty())
+    {
+        return;
+    }
+
+    JSON_Value* recordValue = json_value_init_object();
+    JSON_Object* recordObject = json_value_get_object(recordValue);
+    char* record = nullptr;
+
+    if (recordObject != nullptr && json_object_set_number(recordObject, "step", stepIndex) == JSONSuccess
+        && (componentJson == nullptr || json_object_set_string(recordObject, "component", componentJson) == JSONSuccess)
+        && (restart == nullptr || json_object_set_string(recordObject, "restart", restart) == JSONSuccess))
+    {
+        // Compact serialization escapes newlines, so each record takes exactly one line.
+        record = json_serialize_to_string(recordValue);
+    }
+
+    if (record != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(journal->mutex);
+
+        const int err = ADUC_StateJournal_Append(journal->path.c_str(), record);
+        if (err != 0)
+        {
+            Log_Warn("Cannot write step journal %s, errno %d", journal->path.c_str(), err);
+        }
+    }
+
+    json_free_serialized_string(record);
+    json_value_free(recordValue);
+}
+
+/**
+ * @brief Removes the step journal once the install is over, unless it stopped for an immediate reboot or agent
+ * restart, after which it resumes.
+ *
+ * @param journal The journal.
+ * @param result The install result.
+ */
+static void CloseStepJournal(StepJournal* journal, ADUC_Result result)
+{
+    if (journal->path.empty() || result.ResultCode == ADUC_Result_Install_RequiredImmediateReboot
+        || result.ResultCode == ADUC_Result_Install_RequiredImmediateAgentRestart)
+    {
+        return;
+    }
+
+    const int err = ADUC_StateJournal_Compact(journal->path.c_str(), nullptr /* record */);
+    if (err != 0)
+    {
+        Log_Warn("Cannot remove step journal %s, errno %d", journal->path.c_str(), err);
+    }
+}
+
+/**
+ * @brief Bounds the number of step operations in flight, whether they are done on the thread that starts them or
+ * later, through a ContentHandlerCompletionCallback, see ContentHandler::SupportsAsyncOperations.
+ */
+class StepOperationSlots
+{
+public:
+    explicit StepOperationSlots(size_t count) : _count(count), _free(count)
+    {
+    }
+
+    StepOperationSlots(const StepOperationSlots&) = delete;
+    StepOperationSlots& operator=(const StepOperationSlots&) = delete;
+
+    /**
+     * @brief Takes a slot for an operation, waiting for one to be free.
+     */
+    void Acquire()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _freeChanged.wait(lock, [this] { return _free > 0; });
+        _free--;
+    }
+
+    /**
+     * @brief Frees the slot of an operation that is done. May be called on any thread.
+     */
+    void Release()
+    {
+        // Notified with the lock held, as WaitForAll lets the caller destroy the slots right away.
+        std::lock_guard<std::mutex> lock(_mutex);
+        _free++;
+        _freeChanged.notify_all();
+    }
+
+    /**
+     * @brief Waits for all the operations in flight to be done.
+     */
+    void WaitForAll()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _freeChanged.wait(lock, [this] { return _free == _count; });
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _freeChanged;
+    const size_t _count;
+    size_t _free;
+};
+
+/**
+ * @brief A step whose content is to be downloaded by its handler.
+ */
+struct StepDownload
+{
+    int index; //!< The index of the step.
+    ADUC_WorkflowHandle stepHandle; //!< The step's (child) workflow handle.
+    ContentHandler* contentHandler; //!< The step's handler.
+    ADUC_Result result; //!< The result of the step's download.
+    bool started; //!< Whether the step's download was started.
+
+    // Set by StartStepDownload, for the completion of the step handler's DownloadAsync.
+    ADUC_WorkflowData workflow; //!< The step's workflow data, used by the handler until the download is done.
+    int64_t startTime; //!< The start of the download, from ADUC_Timing_Now.
+    StepOperationSlots* slots; //!< The slots, one of which the download takes until it's done.
+    std::atomic<bool>* failed; //!< Set once a step download fails.
+};
+
+/**
+ * @brief Returns the maximum number of steps downloaded at the same time, from the configuration file.
+ */
+static unsigned int GetMaxConcurrentSteps()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    const unsigned int maxConcurrentSteps = config == nullptr ? 0 : config->maxConcurrentSteps;
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+
+    return std::max(maxConcurrentSteps, 1u);
+}
+
+/**
+ * @brief Returns the number of steps downloaded ahead of the step being installed, from the configuration file.
+ * 0 if all the steps are downloaded before the first one is installed.
+ */
+static unsigned int GetStepDownloadLookAhead()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    const unsigned int stepDownloadLookAhead = config == nullptr ? 0 : config->stepDownloadLookAhead;
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+
+    return stepDownloadLookAhead;
+}
+
+/**
+ * @brief Returns the number of step workflows kept in memory from the step being installed on, from the configuration
+ * file. Never fewer than the steps downloaded ahead and the step itself. 0 if all the step workflows stay in memory.
+ */
+static unsigned int GetMaxResidentSteps()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    const unsigned int maxResidentSteps = config == nullptr ? 0 : config->maxResidentSteps;
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+
+    return maxResidentSteps == 0 ? 0 : std::max(maxResidentSteps, GetStepDownloadLookAhead() + 1);
+}
+
+/**
+ * @brief Spills the step workflows of @p handle outside of the @p residentCount steps from @p firstStep to disk, see
+ * workflow_spill. They are read back when used again. Steps with steps of their own stay in memory.
+ *
+ * @param handle The steps workflow handle.
+ * @param firstStep The first step kept in memory.
+ * @param residentCount The number of steps kept in memory, 0 to keep them all.
+ * @param downloadThreads The threads downloading the steps, by index, or nullptr. A step with a thread stays in memory.
+ */
+static void SpillSteps(
+    ADUC_WorkflowHandle handle,
+    int firstStep,
+    unsigned int residentCount,
+    const std::vector<std::thread>* downloadThreads)
+{
+    if (residentCount == 0)
+    {
+        return;
+    }
+
+    const int childCount = workflow_get_children_count(handle);
+    for (int i = 0; i < childCount; i++)
+    {
+        if ((i >= firstStep && static_cast<unsigned int>(i - firstStep) < residentCount)
+            || (downloadThreads != nullptr && (*downloadThreads)[i].joinable()))
+        {
+            continue;
+        }
+
+        ADUC_WorkflowHandle stepHandle = workflow_get_child(handle, i);
+        if (stepHandle != nullptr && !workflow_is_spilled(stepHandle) && workflow_get_children_count(stepHandle) == 0)
+        {
+            if (!workflow_spill(stepHandle))
+            {
+                Log_Debug("Step #%d stays in memory.", i);
+            }
+        }
+    }
+}
+
+/**
+ * @brief A step whose handler is asked whether the step is installed.
+ */
+struct StepInstalledProbe
+{
+    int index; //!< The index of the step.
+    ADUC_WorkflowHandle stepHandle; //!< The step's (child) workflow handle.
+    ContentHandler* contentHandler; //!< The step's handler.
+    ADUC_Result result; //!< The result of the step handler's IsInstalled.
+    bool probed; //!< Whether the step handler's IsInstalled was evaluated.
+
+    // Set by StartStepProbe, for the completion of the step handler's IsInstalledAsync.
+    size_t position; //!< The position of the probe in the probes.
+    ADUC_WorkflowData workflow; //!< The step's workflow data, used by the handler until the probe is done.
+    const char* componentJson; //!< The component the step is evaluated for. NULL for the host device.
+    bool stopAtNotInstalled; //!< Whether a step that isn't installed, or fails, lowers firstNotInstalled.
+    std::atomic<size_t>* firstNotInstalled; //!< The index of the first probe that isn't installed, or fails.
+    StepOperationSlots* slots; //!< The slots, one of which the probe takes until it's done.
+};
+
+/**
+ * @brief Records the result of @p probe, and frees its slot.
+ */
+static void FinishStepProbe(StepInstalledProbe* probe, ADUC_Result result)
+{
+    probe->result = result;
+    probe->probed = true;
+
+    if (probe->stopAtNotInstalled
+        && (IsAducResultCodeFailure(result.ResultCode) || result.ResultCode == ADUC_Result_IsInstalled_NotInstalled))
+    {
+        size_t current = *probe->firstNotInstalled;
+        while (probe->position < current && !probe->firstNotInstalled->compare_exchange_weak(current, probe->position))
+        {
+        }
+    }
+
+    probe->slots->Release();
+}
+
+/**
+ * @brief The ContentHandlerCompletionCallback of the IsInstalledAsync of a probe, whose context is the probe.
+ */
+static void OnStepProbed(void* context, ADUC_Result result)
+{
+    StepInstalledProbe* probe = static_cast<StepInstalledProbe*>(context);
+
+    CacheStepIsInstalled(probe->stepHandle, probe->componentJson, result);
+    FinishStepProbe(probe, result);
+}
+
+/**
+ * @brief Starts evaluating whether the step of @p probe is installed, as StepIsInstalled does, with the step
+ * handler's IsInstalledAsync. The caller has taken a slot of probe->slots, which is freed once the probe is done.
+ */
+static void StartStepProbe(StepInstalledProbe* probe)
+{
+    ADUC_Result result{ ADUC_Result_Failure };
+
+    if (GetCachedStepIsInstalled(probe->stepHandle, probe->componentJson, &result))
+    {
+        FinishStepProbe(probe, result);
+        return;
+    }
+
+    probe->workflow = {};
+    probe->workflow.WorkflowHandle = probe->stepHandle;
+
+    try
+    {
+        result = probe->contentHandler->IsInstalledAsync(&probe->workflow, OnStepProbed, probe);
+    }
+    catch (...)
+    {
+        // Cannot determine whether the step has been applied, so, we'll try to process the step.
+        FinishStepProbe(probe, { .ResultCode = ADUC_Result_IsInstalled_NotInstalled, .ExtendedResultCode = 0 });
+        return;
+    }
+
+    if (result.ResultCode != ADUC_Result_IsInstalled_InProgress)
+    {
+        CacheStepIsInstalled(probe->stepHandle, probe->componentJson, result);
+        FinishStepProbe(probe, result);
+    }
+}
+
+/**
+ * @brief Evaluates whether each step is installed on one component, running up to maxConcurrentSteps steps at the
+ * same time, so that the steps whose IsInstalled is slow, e.g. a script querying a device over a bus, take the time of
+ * the slowest one rather than the sum of all of them.
+ *
+ * A step only touches its own (child) workflow, so the order in which steps are evaluated doesn't matter; the callers
+ * read the results in steps order. Handlers that support asynchronous operations are all kept in flight by the calling
+ * thread, the others each take a thread.
+ *
+ * @param probes The steps. Receives the result of each step.
+ * @param componentJson The component the steps are evaluated for. NULL for the host device.
+ * @param stopAtNotInstalled Whether the steps after the first one that isn't installed, or fails, may be skipped.
+ * Steps before it are always evaluated.
+ */
+static void ProbeStepsInstalled(
+    std::vector<StepInstalledProbe>& probes, // NOLINT(google-runtime-references)
+    const char* componentJson,
+    bool stopAtNotInstalled)
+{
+    const size_t probeCount = probes.size();
+    const size_t maxInFlight = std::min<size_t>(GetMaxConcurrentSteps(), probeCount);
+    std::atomic<size_t> nextProbe{ 0 };
+    std::atomic<size_t> firstNotInstalled{ probeCount };
+    StepOperationSlots slots{ maxInFlight };
+
+    auto worker = [&]() {
+        // Steps are handed out in order, so each step before the first one that isn't installed is evaluated.
+        for (size_t i = nextProbe++; i < probeCount && i < firstNotInstalled; i = nextProbe++)
+        {
+            slots.Acquire();
+            if (i >= firstNotInstalled)
+            {
+                slots.Release();
+                break;
+            }
+
+            probes[i].position = i;
+            probes[i].componentJson = componentJson;
+            probes[i].stopAtNotInstalled = stopAtNotInstalled;
+            probes[i].firstNotInstalled = &firstNotInstalled;
+            probes[i].slots = &slots;
+            StartStepProbe(&probes[i]);
+        }
+    };
+
+    // The work folders of the steps, and of their parent, are resolved lazily and cached on first use; resolve them
+    // here, before the probes use them on several threads.
+    for (const StepInstalledProbe& probe : probes)
+    {
+        (void)workflow_peek_workfolder(probe.stepHandle);
+    }
+
+    const bool async = std::all_of(probes.begin(), probes.end(), [](const StepInstalledProbe& probe) {
+        return probe.contentHandler->SupportsAsyncOperations();
+    });
+    const size_t workerCount = async ? 1 : maxInFlight;
+    std::vector<std::thread> workers;
+
+    // The calling thread is a worker too, so steps are evaluated in order unless maxConcurrentSteps is set.
+    for (size_t i = 1; i < workerCount; i++)
+    {
+        try
+        {
+            workers.emplace_back(worker);
+        }
+        catch (...)
+        {
+            Log_Warn("Cannot start step IsInstalled thread #%zu, continuing with %zu.", i, i);
+            break;
+        }
+    }
+
+    if (maxInFlight > 1)
+    {
+        Log_Info(
+            "Evaluating whether %zu step(s) are installed, %zu at a time.",
+            probeCount,
+            async ? maxInFlight : workers.size() + 1);
+    }
+
+    worker();
+
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+
+    slots.WaitForAll();
+}
+
+/**
+ * @brief Invokes the step's handler's Download, and records its result.
+ *
+ * @param step The step to download. Receives the result.
+ */
+static void DownloadStep(StepDownload* step)
+{
+    ADUC_WorkflowData stepWorkflow = {};
+    stepWorkflow.WorkflowHandle = step->stepHandle;
+    step->started = true;
+    const int64_t startTime = ADUC_Timing_Now();
+
+    try
+    {
+        step->result = step->contentHandler->Download(&stepWorkflow);
+    }
+    catch (...)
+    {
+        step->result = { .ResultCode = ADUC_Result_Failure,
+                         .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_DOWNLOAD_UNKNOWN_EXCEPTION_DOWNLOAD_CONTENT };
+    }
+
+    EndStepSpan("step_download", step->index, startTime);
+    RecordStepProgress(step->stepHandle, step->index, "download", step->result);
+}
+
+/**
+ * @brief The ContentHandlerCompletionCallback of the DownloadAsync of a step, whose context is the step. Records the
+ * result, as DownloadStep does, and frees the step's slot.
+ */
+static void OnStepDownloaded(void* context, ADUC_Result result)
+{
+    StepDownload* step = static_cast<StepDownload*>(context);
+
+    step->result = result;
+    EndStepSpan("step_download", step->index, step->startTime);
+    RecordStepProgress(step->stepHandle, step->index, "download", step->result);
+
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        *step->failed = true;
+    }
+
+    step->slots->Release();
+}
+
+/**
+ * @brief Starts the download of a step with the step handler's DownloadAsync. The caller has taken a slot of
+ * @p slots, which is freed once the download is done.
+ *
+ * @param step The step to download. Receives the result.
+ * @param slots The slots of the downloads in flight.
+ * @param failed Set if the download fails.
+ */
+static void StartStepDownload(StepDownload* step, StepOperationSlots* slots, std::atomic<bool>* failed)
+{
+    ADUC_Result result{ ADUC_Result_Failure };
+
+    step->workflow = {};
+    step->workflow.WorkflowHandle = step->stepHandle;
+    step->slots = slots;
+    step->failed = failed;
+    step->started = true;
+    step->startTime = ADUC_Timing_Now();
+
+    try
+    {
+        result = step->contentHandler->DownloadAsync(&step->workflow, OnStepDownloaded, step);
+    }
+    catch (...)
+    {
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_DOWNLOAD_UNKNOWN_EXCEPTION_DOWNLOAD_CONTENT };
+    }
+
+    if (result.ResultCode != ADUC_Result_Download_InProgress)
+    {
+        OnStepDownloaded(step, result);
+    }
+}
+
+/**
+ * @brief Invokes each step handler's Download, running up to maxConcurrentSteps steps at the same time.
+ * Once a step fails, no new steps are started.
+ *
+ * A step only touches its own (child) workflow, and none is installed before all of them are downloaded,
+ * so the order in which steps download doesn't matter. Steps that download no file run in no time anyway.
+ * Handlers that support asynchronous operations are all kept in flight by the calling thread, the others each take a
+ * thread.
+ *
+ * @param steps The steps to download. Receives the result of each step.
+ */
+static void DownloadSteps(std::vector<StepDownload>& steps) // NOLINT(google-runtime-references)
+{
+    const size_t stepCount = steps.size();
+    const size_t maxInFlight = std::min<size_t>(GetMaxConcurrentSteps(), stepCount);
+    std::atomic<size_t> nextStep{ 0 };
+    std::atomic<bool> failed{ false };
+    StepOperationSlots slots{ maxInFlight };
+
+    auto worker = [&]() {
+        for (size_t i = nextStep++; i < stepCount && !failed; i = nextStep++)
+        {
+            if (steps[i].started)
+            {
+                // Already downloaded as part of a batch, see DownloadStepsBatches.
+                continue;
+            }
+
+            slots.Acquire();
+            if (failed)
+            {
+                slots.Release();
+                break;
+            }
+
+            StartStepDownload(&steps[i], &slots, &failed);
+        }
+    };
+
+    const bool async = std::all_of(steps.begin(), steps.end(), [](const StepDownload& step) {
+        return step.started || step.contentHandler->SupportsAsyncOperations();
+    });
+    const size_t workerCount = async ? 1 : maxInFlight;
+    std::vector<std::thread> workers;
+
+    // The calling thread is a worker too, so steps download in order unless maxConcurrentSteps is set.
+    for (size_t i = 1; i < workerCount; i++)
+    {
+        try
+        {
+            workers.emplace_back(worker);
+        }
+        catch (...)
+        {
+            Log_Warn("Cannot start step download thread #%zu, continuing with %zu.", i, i);
+            break;
+        }
+    }
+
+    if (maxInFlight > 1)
+    {
+        Log_Info("Downloading %zu step(s), %zu at a time.", stepCount, async ? maxInFlight : workers.size() + 1);
+    }
+
+    worker();
+
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+
+    slots.WaitForAll();
+}
+
+/**
+ * @brief Downloads runs of consecutive inline steps that use the same handler with one call to the handler's
+ * DownloadBatch, for the handlers that support it. The steps of a run that the handler doesn't process as one
+ * operation are left to DownloadSteps, which then downloads them one at a time.
+ *
+ * @param handle The steps workflow handle.
+ * @param steps The steps to download. Receives the result of each batched step.
+ */
+static void DownloadStepsBatches(
+    ADUC_WorkflowHandle handle, std::vector<StepDownload>& steps) // NOLINT(google-runtime-references)
+{
+    size_t first = 0;
+
+    while (first < steps.size())
+    {
+        size_t end = first + 1;
+
+        if (workflow_is_inline_step(handle, steps[first].index))
+        {
+            while (end < steps.size() && steps[end].contentHandler == steps[first].contentHandler
+                   && workflow_is_inline_step(handle, steps[end].index))
+            {
+                end++;
+            }
+        }
+
+        const size_t count = end - first;
+
+        if (count > 1)
+        {
+            std::vector<ADUC_WorkflowData> stepWorkflows(count);
+            std::vector<const tagADUC_WorkflowData*> stepWorkflowPtrs(count);
+            std::vector<ADUC_Result> results(count, ADUC_Result{ ADUC_Result_Failure });
+            bool batched = false;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                stepWorkflows[i].WorkflowHandle = steps[first + i].stepHandle;
+                stepWorkflowPtrs[i] = &stepWorkflows[i];
+            }
+
+            const int64_t startTime = ADUC_Timing_Now();
+
+            try
+            {
+                batched = steps[first].contentHandler->DownloadBatch(stepWorkflowPtrs.data(), count, results.data());
+            }
+            catch (...)
+            {
+                batched = false;
+            }
+
+            EndStepSpan("step_download_batch", steps[first].index, startTime);
+
+            if (batched)
+            {
+                Log_Info("Downloaded steps #%d to #%d as one batch.", steps[first].index, steps[end - 1].index);
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    steps[first + i].result = results[i];
+                    steps[first + i].started = true;
+                    RecordStepProgress(steps[first + i].stepHandle, steps[first + i].index, "download", results[i]);
+                }
+            }
+        }
+
+        first = end;
+    }
+}
+
+/**
+ * @brief Leaves the download of all but the first of @p steps to the install phase, if a step download look-ahead
+ * is configured, so that the install can start as soon as the first step is downloaded.
+ * See StepDownloadPipeline.
+ *
+ * @param steps The steps to download. Only the steps to download now are kept.
+ */
+static void DeferStepDownloads(std::vector<StepDownload>& steps) // NOLINT(google-runtime-references)
+{
+    const bool defer = steps.size() > 1 && GetStepDownloadLookAhead() > 0;
+
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+        workflow_set_download_deferred(steps[i].stepHandle, defer && i > 0);
+    }
+
+    if (defer)
+    {
+        Log_Info("Deferring the download of %zu step(s) to the install phase.", steps.size() - 1);
+        steps.resize(1);
+    }
+}
+
+/**
+ * @brief Make sure that all step workflows are created.
+ *
+ * @param handle A workflow data object handle.
+ * @return ADUC_Result
+ */
+ADUC_Result EnsureStepsWorkflowsCreated(const ADUC_WorkflowHandle handle)
+{
+    ADUC_Result result{ ADUC_Result_Failure };
+    ADUC_WorkflowHandle childHandle = nullptr;
+
+    auto stepCount = static_cast<unsigned int>(workflow_get_instructions_steps_count(handle));
+    const char* workflowId = workflow_peek_id(handle);
+    const char* workFolder = workflow_peek_workfolder(handle);
+    unsigned int childWorkflowCount = workflow_get_children_count(handle);
+    ADUC_FileEntity* entity = nullptr;
+    int workflowLevel = workflow_get_level(handle);
+    std::vector<ADUC_WorkflowHandle> childHandles;
+    std::vector<std::string> selectors;
+    std::vector<unsigned int> selectorSteps;
+    std::vector<std::string> selectedComponents;
+
+    int createResult = ADUC_SystemUtils_MkSandboxDirRecursive(workFolder);
+    if (createResult != 0)
+    {
+        Log_Error("Unable to create folder %s, error %d", workFolder, createResult);
+        result = { ADUC_Result_Failure, ADUC_ERC_STEPS_HANDLER_CREATE_SANDBOX_FAILURE };
+        goto done;
+    }
+
+    // Child workflow should be either 0 (resuming install phase after agent restarted),
+    // or equal to fileCount (already created children during download phase)
+    if (childWorkflowCount != stepCount)
+    {
+        // Remove existing child workflow handle(s)
+        while (workflow_get_children_count(handle) > 0)
+        {
+            ADUC_WorkflowHandle child = workflow_remove_child(handle, 0);
+            workflow_free(child);
+        }
+
+        // Resuming after a reboot or restart: the steps were already read, verified and had their components
+        // selected for this very workflow.
+        if (workflowLevel == 0 && workflow_restore_children_snapshot(handle))
+        {
+            if (static_cast<unsigned int>(workflow_get_children_count(handle)) == stepCount)
+            {
+                Log_Info("Restored %u step workflow(s) from the snapshot.", stepCount);
+                result = { ADUC_Result_Success };
+                goto done;
+            }
+
+            while (workflow_get_children_count(handle) > 0)
+            {
+                workflow_free(workflow_remove_child(handle, -1));
+            }
+        }
+
+        PrefetchDetachedManifestFiles(handle, stepCount, workflowId, workFolder);
+
+        Log_Debug("Creating workflow for %d step(s). Parent's level: %d", stepCount, workflowLevel);
+        for (unsigned int i = 0; i < stepCount; i++)
+        {
+            STRING_HANDLE childId = nullptr;
+            ADUC_FileEntity* entity = nullptr;
+
+            if (workflow_is_inline_step(handle, i))
+            {
+                const char* selectedComponents = workflow_peek_selected_components(handle);
+
+                Log_Debug("Creating workflow for level#%d step#%d. Selected components:\n=====\n%s\n=====", workflowLevel, i, selectedComponents);
+
+                // Create child workflow using inline step data.
+                result = workflow_create_from_inline_step(handle, i, &childHandle);
+
+                if (IsAducResultCodeSuccess(result.ResultCode))
+                {
+                    // Inherit parent's selected components.
+                    workflow_set_selected_components(childHandle, workflow_peek_selected_components(handle));
+                }
+            }
+            else
+            {
+                // Download detached update manifest file.
+                if (!workflow_get_step_detached_manifest_file(handle, i, &entity))
+                {
+                    result = { .ResultCode = ADUC_Result_Failure,
+                            .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_GET_FILE_ENTITY_FAILURE };
+                    Log_Error("Cannot get a detached Update manifest file entity for level#%d step#%d", workflowLevel, i);
+                    goto done;
+                }
+
+                Log_Info("Downloading a detached Update manifest file for level#%d step#%d (file id:%s).", workflowLevel, i, entity->FileId);
+
+                try
+                {
+                    result = ExtensionManager::Download(
+                        entity,
+                        workflowId,
+                        workFolder,
+                        DO_RETRY_TIMEOUT_DEFAULT,
+                        nullptr,
+                        workflow_peek_cancellation_token(handle));
+                }
+                catch (...)
+                {
+                    Log_Error("Exception occured while downloading a detached Update Manifest file for level#%d step#%d (file id:%s).", workflowLevel, i, entity->FileId);
+                    result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_DOWNLOAD_FAILURE_UNKNOWNEXCEPTION;
+                }
+
+                std::stringstream childManifestFile;
+                childManifestFile << workFolder << "/" << entity->TargetFilename;
+
+                workflow_free_file_entity(entity);
+                entity = nullptr;
+
+                // For 'microsoft/steps:1' implementation, abort download task as soon as an error occurs.
+                if (IsAducResultCodeFailure(result.ResultCode))
+                {
+                    Log_Error("An error occured while downloading manifest file for step#%d (erc:%d)",i, result.ExtendedResultCode);
+                    goto done;
+                }
+
+                // Create child workflow from file.
+                result = workflow_init_from_file(childManifestFile.str().c_str(), false, &childHandle);
+
+                if (IsAducResultCodeSuccess(result.ResultCode))
+                {
+                    // Select components based on the first pair of compatibility properties.
+                    // The components of all reference steps are selected at once, below.
+                    char* compatibilityString = workflow_get_update_manifest_compatibility(childHandle, 0);
+                    if (compatibilityString == nullptr)
+                    {
+                        Log_Error("Cannot get compatibility info for components-update #%d", i);
+                        result = { .ResultCode = ADUC_Result_Failure,
+                                .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_GET_REF_STEP_COMPATIBILITY_FAILED };
+                        goto done;
+                    }
+
+                    selectors.emplace_back(compatibilityString);
+                    selectorSteps.push_back(i);
+                    workflow_free_string(compatibilityString);
+                }
+            }
+
+            if (IsAducResultCodeFailure(result.ResultCode))
+            {
+                Log_Error("ERROR: failed to create workflow for level:%d step#%d.", workflowLevel, i);
+                goto done;
+            }
+            else
+            {
+                childId = STRING_construct_sprintf("%d", i);
+                workflow_set_id(childHandle, STRING_c_str(childId));
+                STRING_delete(childId);
+                childId = nullptr;
+#if _ADU_DEBUG
+                char* childManifest = workflow_get_serialized_update_manifest(childHandle, true);
+                Log_Debug("##########\n# Successfully created workflow object for child#%s\n# Handle:0x%x\n# Manifest:\n%s\n", workflow_peek_id(childHandle),
+                childHandle,
+                childManifest);
+                workflow_free_string(childManifest);
+#endif
+            }
+
+            childHandles.push_back(childHandle);
+            childHandle = nullptr;
+        }
+
+        if (!selectors.empty())
+        {
+            result = ExtensionManager::SelectComponents(selectors, selectedComponents);
+            if (IsAducResultCodeFailure(result.ResultCode))
+            {
+                Log_Error("Cannot select components for %d components-update(s)", static_cast<int>(selectors.size()));
+                goto done;
+            }
+
+            for (size_t s = 0; s < selectors.size(); s++)
+            {
+                ADUC_WorkflowHandle stepHandle = childHandles[selectorSteps[s]];
+                if (!workflow_set_selected_components(stepHandle, selectedComponents[s].c_str()))
+                {
+                    result = { .ResultCode = ADUC_Result_Failure,
+                               .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_SET_SELECTED_COMPONENTS_FAILURE };
+                    Log_Error("ERROR: failed to create workflow for level:%d step#%d.", workflowLevel, selectorSteps[s]);
+                    goto done;
+                }
+
+                Log_Debug("Set child handle's selected components: %s", workflow_peek_selected_components(stepHandle));
+            }
+        }
+
+        if (!workflow_reserve_children(handle, childHandles.size()))
+        {
+            result = { .ResultCode = ADUC_Result_Failure,
+                       .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_CHILD_WORKFLOW_INSERT_FAILED };
+            goto done;
+        }
+
+        for (size_t c = 0; c < childHandles.size(); c++)
+        {
+            if (!workflow_insert_child(handle, -1, childHandles[c]))
+            {
+                result = { .ResultCode = ADUC_Result_Failure,
+                           .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_CHILD_WORKFLOW_INSERT_FAILED };
+                goto done;
+            }
+
+            childHandles[c] = nullptr;
+        }
+
+        if (workflowLevel == 0 && !workflow_save_children_snapshot(handle))
+        {
+            Log_Debug("Cannot save the step workflows snapshot.");
+        }
+    }
+
+    result = { ADUC_Result_Success };
+
+done:
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        workflow_free(childHandle);
+
+        for (ADUC_WorkflowHandle stepHandle : childHandles)
+        {
+            workflow_free(stepHandle);
+        }
+    }
+
+    workflow_free_file_entity(entity);
+    return result;
+}
+
+/**
+ * @brief Verifies the hashes of the detached update manifest files and of the steps' files, all at the same time,
+ * before any step is installed. Stops at the first invalid file.
+ *
+ * Files verified during the download phase that haven't changed since aren't hashed again,
+ * so this mostly hashes files downloaded before the agent restarted.
+ *
+ * @param handle A workflow data object handle, whose step workflows are created.
+ * @return ADUC_Result The result.
+ */
+static ADUC_Result VerifyStepsFiles(const ADUC_WorkflowHandle handle)
+{
+    ADUC_Result result{ ADUC_Result_Failure };
+    const size_t childCount = workflow_get_children_count(handle);
+    const char* workFolder = workflow_peek_workfolder(handle);
+    std::vector<ADUC_FileEntity*> entities;
+    std::vector<std::pair<std::string, const ADUC_FileEntity*>> files;
+
+    try
+    {
+        for (size_t i = 0; i < childCount; i++)
+        {
+            ADUC_FileEntity* entity = nullptr;
+            if (!workflow_is_inline_step(handle, i) && workflow_get_step_detached_manifest_file(handle, i, &entity))
+            {
+                entities.push_back(entity);
+                files.emplace_back(std::string(workFolder) + "/" + entity->TargetFilename, entity);
+            }
+
+            ADUC_WorkflowHandle stepHandle = workflow_get_child(handle, static_cast<int>(i));
+            const char* stepWorkFolder = workflow_peek_workfolder(stepHandle);
+            const size_t fileCount = workflow_get_update_files_count(stepHandle);
+
+            if (workflow_is_download_deferred(stepHandle))
+            {
+                // Not downloaded yet; the step's own download verifies its files.
+                continue;
+            }
+
+            for (size_t j = 0; stepWorkFolder != nullptr && j < fileCount; j++)
+            {
+                const ADUC_FileEntity* stepEntity = workflow_peek_update_file(stepHandle, j);
+                if (stepEntity != nullptr)
+                {
+                    files.emplace_back(std::string(stepWorkFolder) + "/" + stepEntity->TargetFilename, stepEntity);
+                }
+            }
+        }
+
+        result = ExtensionManager::VerifyFiles(files);
+    }
+    catch (...)
+    {
+        Log_Error("Exception occured while verifying the steps' files.");
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_UNKNOWN_EXCEPTION_INSTALL_CHILD_STEP };
+    }
+
+    for (ADUC_FileEntity* entity : entities)
+    {
+        workflow_free_file_entity(entity);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Creates a new StepsHandlerImpl object and casts to a ContentHandler.
+ * Note that there is no way to create a StepsHandlerImpl directly.
+ *
+ * @return ContentHandler* StepsHandlerImpl object as a ContentHandler.
+ */
+ContentHandler* StepsHandlerImpl::CreateContentHandler()
+{
+    return new StepsHandlerImpl();
+}
+
+/**
+ * @brief Gets the count of selected components for specified workflow. They're parsed once per workflow, and shared
+ * with the steps, see SelectStepComponent.
+ *
+ * @param handle A workflow data object handle.
+ * @param count Receives the count of selected components.
+ * @return ADUC_Result Returns ADUC_Result_Success is succeeded.
+ *         Otherwise, returns ADUC_ERC_STEPS_HANDLER_INVALID_COMPONENTS_DATA.
+ */
+static ADUC_Result GetSelectedComponentsCount(const ADUC_WorkflowHandle handle, int* count)
+{
+    ADUC_Result result = { ADUC_Result_Failure };
+    size_t selectedComponentsCount = 0;
+
+    *count = 0;
+
+    // Parse componenets list. If the list is empty, nothing to install.
+    if (workflow_peek_selected_components(handle) == nullptr)
+    {
+        goto done;
+    }
+
+    if (!workflow_get_selected_components_count(handle, &selectedComponentsCount))
+    {
+        result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INVALID_COMPONENTS_DATA;
+        goto done;
+    }
+
+    *count = static_cast<int>(selectedComponentsCount);
+    result = { .ResultCode = ADUC_Result_Success,
+               .ExtendedResultCode = 0 };
+
+done:
+    return result;
+}
+
+/**
+ * @brief Sets the selected components of an inline step to one of the selected components of the steps workflow, or
+ * clears them for the host device. The step shares the parsed component; its JSON is only serialized if the step's
+ * handler asks for it.
+ *
+ * @param handle The steps workflow handle.
+ * @param stepHandle The step workflow handle.
+ * @param componentIndex The index of the component in the selected components of @p handle, or -1 for the host device.
+ * @return true if succeeded.
+ */
+static bool SelectStepComponent(ADUC_WorkflowHandle handle, ADUC_WorkflowHandle stepHandle, int componentIndex)
+{
+    return componentIndex < 0 ? workflow_set_selected_components(stepHandle, nullptr)
+                              : workflow_select_component(stepHandle, handle, static_cast<size_t>(componentIndex));
+}
+
+/**
+ * @brief Perform download phase for specified step.
+ *
+ * @param workflowData A workflow data object.
+ * @param stepIndex A step index.
+ * @return ADUC_Result
+ */
+static ADUC_Result ProcessStepDownloadPhase(const tagADUC_WorkflowData* workflowData, int stepIndex)
+{
+    Log_Info("Step's download phase begin.");
+    ADUC_Result result = { ADUC_Result_Failure };
+    ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
+    ContentHandler* contentHandler = nullptr;
+    ADUC_WorkflowHandle childHandler = workflow_get_child(handle, stepIndex);
+    ADUC_WorkflowData childWorkflow {
+        .WorkflowHandle = childHandler
+    };
+
+    const char* stepHandlerName = workflow_is_inline_step(handle, stepIndex) ?
+                                    workflow_peek_update_manifest_step_handler(handle, stepIndex):
+                                    DEFAULT_REF_STEP_HANDLER;
+
+    Log_Info("Loading handler for step #%d ('%s')", stepIndex, stepHandlerName);
+
+    const char* workFolder = workflow_peek_workfolder(childHandler);
+    int createResult = ADUC_SystemUtils_MkSandboxDirRecursive(workFolder);
+    if (createResult != 0)
+    {
+        Log_Error("Unable to create folder %s, error %d", workFolder, createResult);
+        result = { ADUC_Result_Failure, ADUC_ERC_STEPS_HANDLER_CREATE_SANDBOX_FAILURE };
+        goto done;
+    }
+
+    result = ExtensionManager::LoadUpdateContentHandlerExtension(stepHandlerName, &contentHandler);
+
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        Log_Error("Cannot load the step handler for step #%d", stepIndex);
+    }
+    else
+    {
+        // Step is completed, no files required.
+        result = contentHandler->Download(&childWorkflow);
+    }
+
+done:
+    workflow_set_result(childHandler, result);
+
+    workflow_set_state(
+        handle, IsAducResultCodeSuccess(result.ResultCode) ? ADUCITF_State_DownloadSucceeded : ADUCITF_State_Failed);
+
+
+    return result;
+}
+
+/**
+ * @brief Performs 'Download' task by iterating through all steps and invoke each step's handler
+ * to download file(s), if needed.
+ *
+ * It is a step's handler's responsibility to determine whether
+ * files are needed for 'install' and 'apply' phases.
+ *
+ * @param workflowData A workflow data object.
+ *
+ * @return ADUC_Result The result.
+ */
+static ADUC_Result StepsHandler_Download(const tagADUC_WorkflowData* workflowData)
+{
+    ADUC_Result result{ ADUC_Result_Failure };
+    ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
+    ADUC_WorkflowHandle stepHandle = nullptr;
+
+    const char* workflowId = workflow_peek_id(handle);
+    char* compatibilityString = nullptr;
+    char* currentComponent;
+    int workflowLevel = workflow_get_level(handle);
     int selectedComponentsCount = 0;
+    StepJournal journal;
+
+    Log_Debug("\n##########\n#\n# Steps_Handler Download begin (level %d, id: %d, addr:0x%x\n#\n##########\n", workflowLevel, workflowId, handle);
+
+    result = EnsureStepsWorkflowsCreated(handle);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        workflow_set_result_details(handle, "Invalid steps workflow collection.");
+        goto done;
+    }
+
+    // The steps an interrupted install completed needn't be downloaded again.
+    LoadStepJournal(handle, &journal);
+
+    // The step workflows exist now, so their files count too.
+    if (workflowLevel == 0)
+    {
+        result = workflow_check_disk_space(handle);
+        if (IsAducResultCodeFailure(result.ResultCode))
+        {
+            workflow_set_result_details(handle, "Not enough disk space for the update.");
+            goto done;
+        }
+    }
+
+    if (workflowLevel > 0)
+    {
+        // If this is not a top level workflow, selected component array must exists (okay to be empty).
+        result = GetSelectedComponentsCount(handle, &selectedComponentsCount);
+        if (IsAducResultCodeFailure(result.ResultCode))
+        {
+            Log_Error("Missing selected components. workflow level #%d", workflowLevel);
+            workflow_set_result_details(handle, "Cannot select target components.");
+            goto done;
+        }
+    }
+    else
+    {
+        // Process all steps once.
+        selectedComponentsCount = 1;
+    }
+
+    // If any of the targetted components is not up-to-date, download the update payloads.
+    for (int iCom = 0; iCom < selectedComponentsCount; iCom++)
+    {
+        const char* componentJson = nullptr;
+        int childCount = workflow_get_children_count(handle);
+        std::vector<StepInstalledProbe> probes;
+        std::vector<StepDownload> pendingSteps;
+
+        if (workflowLevel > 0)
+        {
+            componentJson = workflow_peek_selected_component(handle, iCom);
+            Log_Debug(
+                "Processing %d step(s) for component #%d.\nComponent Json Data:%s\n",
+                iCom,
+                childCount,
+                componentJson);
+        }
+        else
+        {
+            Log_Debug("Processing %d step(s) on host device.", childCount);
+        }
+
+        //
+        // For each step (child workflow), find out whether it's already installed.
+        //
+        for (int i = 0; i < childCount; i++)
+        {
+            Log_Info("Processing step #%d on component #%d.", i, iCom);
+
+            stepHandle = workflow_get_child(handle, i);
+            if (stepHandle == nullptr)
+            {
+                const char* errorFmt = "Cannot process step #%d due to missing (child) workflow data.";
+                Log_Error(errorFmt, i);
+                result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_DOWNLOAD_FAILURE_MISSING_CHILD_WORKFLOW;
+                workflow_set_result_details(handle, errorFmt, i);
+                goto componentDone;
+            }
+
+            if (IsStepJournaled(&journal, i, componentJson, nullptr /* restart */))
+            {
+                Log_Info("Step #%d on component #%d was completed before the restart.", i, iCom);
+                continue;
+            }
+
+            // For inline step - set current component info on the workflow.
+            if (workflow_is_inline_step(handle, i))
+            {
+                if (!SelectStepComponent(handle, stepHandle, componentJson == nullptr ? -1 : iCom))
+                {
+                    result.ResultCode = ADUC_Result_Failure;
+                    result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_SET_SELECTED_COMPONENTS_FAILURE;
+                    workflow_set_result_details(handle, "Cannot select target component(s) for step #%d", i);
+                    goto componentDone;
+                }
+            }
+
+            ContentHandler* contentHandler = nullptr;
+            const char* stepUpdateType = workflow_is_inline_step(handle, i) ?
+                                workflow_peek_update_manifest_step_handler(handle, i):
+                                DEFAULT_REF_STEP_HANDLER;
+
+            Log_Info("Loading handler for step #%d (handler: '%s')", i, stepUpdateType);
+
+            result = ExtensionManager::LoadUpdateContentHandlerExtension(stepUpdateType, &contentHandler);
+
+            if (IsAducResultCodeFailure(result.ResultCode))
+            {
+                const char* errorFmt = "Cannot load a handler for step #%d (handler :%s)";
+                Log_Error(errorFmt, i, stepUpdateType);
+                workflow_set_result_details(handle, errorFmt, i, stepUpdateType == nullptr ? "NULL" : stepUpdateType);
+                goto componentDone;
+            }
+
+            probes.push_back({ i, stepHandle, contentHandler, { ADUC_Result_Failure }, false });
+
+            stepHandle = nullptr;
+        } // instances loop
+
+        // Steps that are already installed are skipped.
+        ProbeStepsInstalled(probes, componentJson, false /* stopAtNotInstalled */);
+
+        for (const StepInstalledProbe& probe : probes)
+        {
+            if (IsAducResultCodeSuccess(probe.result.ResultCode)
+                && probe.result.ResultCode == ADUC_Result_IsInstalled_Installed)
+            {
+                // The current instance is already up-to-date, continue checking the next instance.
+                Log_Info("Step #%d on component #%d is already installed.", probe.index, iCom);
+            }
+            else
+            {
+                pendingSteps.push_back(
+                    { probe.index, probe.stepHandle, probe.contentHandler, { ADUC_Result_Failure }, false });
+            }
+        }
+
+        //
+        // Download content for the steps that aren't installed yet.
+        //
+        if (selectedComponentsCount == 1)
+        {
+            // The steps are installed in order on one component or the host device only, see StepDownloadPipeline.
+            DeferStepDownloads(pendingSteps);
+        }
+
+        DownloadStepsBatches(handle, pendingSteps);
+        DownloadSteps(pendingSteps);
+
+        result = { ADUC_Result_Download_Success };
+
+        // Report the first failed step, in steps order. Steps that were never started are skipped.
+        for (const StepDownload& step : pendingSteps)
+        {
+            if (step.started && IsAducResultCodeFailure(step.result.ResultCode))
+            {
+                result = step.result;
+
+                // Propagate item's resultDetails to parent.
+                workflow_set_result_details(handle, workflow_peek_result_details(step.stepHandle));
+                break;
+            }
+        }
+
+    componentDone:
+        if (IsAducResultCodeFailure(result.ResultCode))
+        {
+            goto done;
+        }
+
+        // Set step's result.
+    }
+
+    result = { ADUC_Result_Download_Success };
+
+done:
+
+    // NOTE: Do not free child workflow here, so that it can be reused in the next phase.
+    // Only free child handle when the workflow is done. The steps not needed first are spilled to disk
+    // meanwhile, if the configuration limits the resident steps, and read back when needed in the next phase.
+    SpillSteps(handle, 0, GetMaxResidentSteps(), nullptr);
+
+    workflow_set_result(handle, result);
+
+    if (IsAducResultCodeSuccess(result.ResultCode))
+    {
+        workflow_set_state(handle, ADUCITF_State_DownloadSucceeded);
+    }
+    else
+    {
+        workflow_set_state(handle, ADUCITF_State_Failed);
+    }
+
+    workflow_free_string(compatibilityString);
+
+    Log_Debug("Steps_Handler Download end (level %d).", workflowLevel);
+    return result;
+}
+
+/**
+ * @brief Performs 'Download' task by iterating through all steps and invoke each step's handler
+ * to download file(s), if needed.
+ *
+ * It is a step's handler's responsibility to determine whether
+ * any files is needed for 'install' and 'apply' phases.
+ *
+ * @param workflowData A workflow data object.
+ *
+ * @return ADUC_Result The result.
+ */
+ADUC_Result StepsHandlerImpl::Download(const tagADUC_WorkflowData* workflowData)
+{
+    return StepsHandler_Download(workflowData);
+}
+
+
+/**
+ * @brief The downloads of the steps that were left to the install phase, see DeferStepDownloads. While a step
+ * installs, up to lookAhead steps after it download in the background, so that the network and the install overlap.
+ */
+struct StepDownloadPipeline
+{
+    ADUC_WorkflowHandle handle = nullptr; //!< The steps workflow handle.
+    unsigned int lookAhead = 0; //!< The number of steps downloaded ahead of the step being installed.
+    unsigned int residentCount = 0; //!< The number of step workflows kept in memory, see GetMaxResidentSteps.
+    std::vector<StepDownload> downloads; //!< The download of each step, by index.
+    std::vector<std::thread> threads; //!< The thread downloading each step, by index, if any.
+
+    StepDownloadPipeline() = default;
+    StepDownloadPipeline(const StepDownloadPipeline&) = delete;
+    StepDownloadPipeline& operator=(const StepDownloadPipeline&) = delete;
+
+    ~StepDownloadPipeline()
+    {
+        // The downloads still running when the install stops, e.g. on failure, touch the step workflows.
+        for (auto& thread : threads)
+        {
+            if (thread.joinable())
+            {
+                thread.join();
+            }
+        }
+    }
+};
+
+/**
+ * @brief Starts the deferred downloads of step #@p firstStep and of the lookAhead steps after it, in the background.
+ *
+ * @param pipeline The pipeline.
+ * @param firstStep The index of the step about to be installed.
+ */
+static void StartStepDownloads(StepDownloadPipeline* pipeline, int firstStep)
+{
+    const int childCount = static_cast<int>(pipeline->downloads.size());
+    const int lastStep = std::min(firstStep + static_cast<int>(pipeline->lookAhead), childCount - 1);
+
+    for (int i = firstStep; i <= lastStep; i++)
+    {
+        StepDownload& download = pipeline->downloads[i];
+        ADUC_WorkflowHandle stepHandle = workflow_get_child(pipeline->handle, i);
+
+        if (download.started || stepHandle == nullptr || !workflow_is_download_deferred(stepHandle))
+        {
+            continue;
+        }
+
+        const char* stepUpdateType = workflow_is_inline_step(pipeline->handle, i)
+            ? workflow_peek_update_manifest_step_handler(pipeline->handle, i)
+            : DEFAULT_REF_STEP_HANDLER;
+
+        download = { i, stepHandle, nullptr, { ADUC_Result_Failure }, true };
+        download.result = ExtensionManager::LoadUpdateContentHandlerExtension(stepUpdateType, &download.contentHandler);
+
+        if (IsAducResultCodeFailure(download.result.ResultCode))
+        {
+            Log_Error("Cannot load a handler for step #%d (handler :%s)", i, stepUpdateType);
+            continue;
+        }
+
+        Log_Info("Downloading step #%d while the steps before it install.", i);
+
+        try
+        {
+            pipeline->threads[i] = std::thread(DownloadStep, &download);
+        }
+        catch (...)
+        {
+            Log_Warn("Cannot start the download thread of step #%d, downloading it now.", i);
+            DownloadStep(&download);
+        }
+    }
+}
+
+/**
+ * @brief Waits for the deferred download of step #@p stepIndex, started by StartStepDownloads.
+ *
+ * @param pipeline The pipeline.
+ * @param stepIndex The index of the step about to be installed.
+ * @return ADUC_Result The result of the step's download; success if it was downloaded during the download phase.
+ */
+static ADUC_Result WaitForStepDownload(StepDownloadPipeline* pipeline, int stepIndex)
+{
+    StepDownload& download = pipeline->downloads[stepIndex];
+
+    if (!download.started)
+    {
+        return { ADUC_Result_Download_Success };
+    }
+
+    if (pipeline->threads[stepIndex].joinable())
+    {
+        pipeline->threads[stepIndex].join();
+    }
+
+    if (IsAducResultCodeSuccess(download.result.ResultCode))
+    {
+        workflow_set_download_deferred(download.stepHandle, false);
+    }
+
+    return download.result;
+}
+
+/**
+ * @brief Installs step #@p firstStep and the consecutive inline steps after it that use the same handler and
+ * aren't installed yet, with one call to the handler's InstallBatch, if the handler supports it.
+ *
+ * @param handle The steps workflow handle.
+ * @param stepHandles The workflows of the steps, as installed for the component.
+ * @param firstStep The index of the first step of the run; an inline step that isn't installed yet.
+ * @param contentHandler The handler of step #@p firstStep.
+ * @param componentJson The component the steps are installed for. NULL for the host device.
+ * @param componentIndex The index of the component in the selected components of @p handle, or -1 for the host device.
+ * @param batchResults Receives the install result of each step of the run, if it was installed as one batch.
+ */
+static void InstallStepsBatch(
+    ADUC_WorkflowHandle handle,
+    const std::vector<ADUC_WorkflowHandle>& stepHandles,
+    int firstStep,
+    ContentHandler* contentHandler,
+    const char* componentJson,
+    int componentIndex,
+    std::unordered_map<int, ADUC_Result>* batchResults)
+{
+    const int childCount = static_cast<int>(stepHandles.size());
+    std::vector<ADUC_WorkflowData> stepWorkflows(1);
+    stepWorkflows[0].WorkflowHandle = stepHandles[firstStep];
+
+    for (int i = firstStep + 1; i < childCount && workflow_is_inline_step(handle, i); i++)
+    {
+        ContentHandler* stepHandler = nullptr;
+        ADUC_WorkflowData stepWorkflow = {};
+        stepWorkflow.WorkflowHandle = stepHandles[i];
+
+        if (stepWorkflow.WorkflowHandle == nullptr
+            || IsAducResultCodeFailure(ExtensionManager::LoadUpdateContentHandlerExtension(
+                                           workflow_peek_update_manifest_step_handler(handle, i), &stepHandler)
+                                           .ResultCode)
+            || stepHandler != contentHandler || workflow_is_download_deferred(stepWorkflow.WorkflowHandle)
+            || !SelectStepComponent(handle, stepWorkflow.WorkflowHandle, componentIndex)
+            || StepIsInstalled(contentHandler, &stepWorkflow, componentJson).ResultCode
+                == ADUC_Result_IsInstalled_Installed)
+        {
+            break;
+        }
+
+        stepWorkflows.push_back(stepWorkflow);
+    }
+
+    const size_t count = stepWorkflows.size();
+    if (count < 2)
+    {
+        return;
+    }
+
+    std::vector<const tagADUC_WorkflowData*> stepWorkflowPtrs(count);
+    std::vector<ADUC_Result> results(count, ADUC_Result{ ADUC_Result_Failure });
+    bool batched = false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        stepWorkflowPtrs[i] = &stepWorkflows[i];
+    }
+
+    // Installing the steps may change whether any step is installed.
+    for (const ADUC_WorkflowData& stepWorkflow : stepWorkflows)
+    {
+        workflow_clear_cached_is_installed(stepWorkflow.WorkflowHandle);
+    }
+
+    const int64_t startTime = ADUC_Timing_Now();
+
+    try
+    {
+        batched = contentHandler->InstallBatch(stepWorkflowPtrs.data(), count, results.data());
+    }
+    catch (...)
+    {
+        batched = false;
+    }
+
+    EndStepSpan("step_install_batch", firstStep, startTime);
+
+    if (batched)
+    {
+        Log_Info("Installed steps #%d to #%d as one batch.", firstStep, firstStep + static_cast<int>(count) - 1);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            batchResults->emplace(firstStep + static_cast<int>(i), results[i]);
+        }
+    }
+}
+
+/**
+ * @brief The install of a workflow's steps on one of its selected components, see InstallComponentSteps.
+ */
+struct ComponentInstall
+{
+    int index = 0; //!< The index of the component in the selected components.
+    const char* componentJson = nullptr; //!< The component, serialized, owned by the steps workflow. NULL for the host.
+    std::vector<ADUC_WorkflowHandle> stepHandles; //!< The workflows of the steps, as installed for the component.
+    std::vector<std::string> workFolders; //!< The work folders of the steps, as installed for the component.
+    bool started = false; //!< Whether the install was started.
+    ADUC_Result result = { ADUC_Result_Failure }; //!< The result of the install.
+    std::string resultDetails; //!< The result details of the install, if it set any.
+    bool stopInstall = false; //!< Whether no more components are to be installed, e.g. an immediate reboot is required.
+    StepJournal* journal = nullptr; //!< The journal of the steps completed, or NULL.
+};
+
+/**
+ * @brief Sets the result details of @p component, from a printf-style @p format.
+ */
+static void SetComponentResultDetails(ComponentInstall* component, const char* format, ...)
+{
+    char details[1024];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(details, sizeof(details), format, args);
+    va_end(args);
+
+    component->resultDetails = details;
+}
+
+/**
+ * @brief Performs the 'install' and 'apply' actions of each step on @p component, in order.
+ *
+ * Components may be installed at the same time, see InstallComponentsConcurrently, so the steps workflow
+ * @p handle is only changed with @p handleMutex held, and the result details go to @p component.
+ *
+ * @param handle The steps workflow handle.
+ * @param component The component to install the steps on. Receives the result.
+ * @param isLastComponent Whether this is the last selected component, whose results are kept by the steps.
+ * @param handleMutex The mutex guarding @p handle.
+ * @param pipeline The downloads of the steps left to the install phase, or NULL if there are none.
+ */
+static void InstallComponentSteps(
+    ADUC_WorkflowHandle handle,
+    ComponentInstall* component,
+    bool isLastComponent,
+    std::mutex* handleMutex,
+    StepDownloadPipeline* pipeline)
+{
+    ADUC_Result result{ ADUC_Result_Success };
+    const int childCount = static_cast<int>(component->stepHandles.size());
+    const char* componentJson = component->componentJson;
+    const int iCom = component->index;
+    std::unordered_map<int, ADUC_Result> batchResults;
+    std::string journaledRestart;
 
-    Log_Debug("\n##########\n#\n# Steps_Handler Download begin (level %d, id: %d, addr:0x%x\n#\n##########\n", workflowLevel, workflowId, handle);
+    component->started = true;
 
-    result = EnsureStepsWorkflowsCreated(handle);
-    if (IsAducResultCodeFailure(result.ResultCode))
+    //
+    // For each step (child workflow), invoke install and apply actions.
+    //
+    for (int i = 0; i < childCount; i++)
     {
-        workflow_set_result_details(handle, "Invalid steps workflow collection.");
-        goto done;
-    }
+        Log_Info("Processing step #%d on component #%d.", i, iCom);
+
+        // Dummy workflow to hold a childHandle.
+        ADUC_WorkflowData stepWorkflow = {};
+        ADUC_WorkflowHandle stepHandle = component->stepHandles[i];
+        ContentHandler* contentHandler = nullptr;
+        const char* stepUpdateType = nullptr;
+        const char* deferredRestart = nullptr;
+
+        if (stepHandle == nullptr)
+        {
+            const char* errorFmt = "Cannot process step #%d due to missing (child) workflow data.";
+            Log_Error(errorFmt, i);
+            result = { .ResultCode = ADUC_Result_Failure,
+                       .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_FAILURE_MISSING_CHILD_WORKFLOW };
+            SetComponentResultDetails(component, errorFmt, i);
+            goto done;
+        }
+
+        if (pipeline != nullptr)
+        {
+            // The steps installed before this one, and those not due for download yet, needn't stay in memory.
+            SpillSteps(handle, i, pipeline->residentCount, &pipeline->threads);
+            StartStepDownloads(pipeline, i);
+        }
+
+        // A step completed before the agent restarted is skipped, and the restart it deferred is requested again.
+        if (IsStepJournaled(component->journal, i, componentJson, &journaledRestart))
+        {
+            Log_Info("Step #%d on component #%d was completed before the restart.", i, iCom);
+
+            if (!journaledRestart.empty())
+            {
+                RequestRestartForStep(
+                    handle, i, false /* immediate */, journaledRestart == "reboot" /* reboot */, handleMutex);
+            }
+
+            result = { .ResultCode = ADUC_Result_Install_Skipped_UpdateAlreadyInstalled, .ExtendedResultCode = 0 };
+            continue;
+        }
+
+        // For inline step - set current component info on the workflow.
+        if (workflow_is_inline_step(handle, i))
+        {
+            if (!SelectStepComponent(handle, stepHandle, componentJson == nullptr ? -1 : iCom))
+            {
+                result.ResultCode = ADUC_Result_Failure;
+                result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_SET_SELECTED_COMPONENTS_FAILURE;
+                SetComponentResultDetails(component, "Cannot select target component(s) for step #%d", i);
+                goto done;
+            }
+        }
+
+        // Using same core functions.
+        stepWorkflow.WorkflowHandle = stepHandle;
+
+        stepUpdateType = workflow_is_inline_step(handle, i) ? workflow_peek_update_manifest_step_handler(handle, i)
+                                                            : DEFAULT_REF_STEP_HANDLER;
+
+        Log_Info("Loading handler for step #%d (handler: '%s')", i, stepUpdateType);
+
+        result = ExtensionManager::LoadUpdateContentHandlerExtension(stepUpdateType, &contentHandler);
 
-    if (workflowLevel > 0)
-    {
-        // If this is not a top level workflow, selected component array must exists (okay to be empty).
-        result = GetSelectedComponentsArray(handle, &selectedComponentsArray);
         if (IsAducResultCodeFailure(result.ResultCode))
         {
-            Log_Error("Missing selected components. workflow level #%d", workflowLevel);
-            workflow_set_result_details(handle, "Cannot select target components.");
+            const char* errorFmt = "Cannot load a handler for step #%d (handler :%s)";
+            Log_Error(errorFmt, i, stepUpdateType);
+            SetComponentResultDetails(component, errorFmt, i, stepUpdateType == nullptr ? "NULL" : stepUpdateType);
             goto done;
         }
 
-        selectedComponentsCount = json_array_get_count(selectedComponentsArray);
-    }
-    else
-    {
-        // Process all steps once.
-        selectedComponentsCount = 1;
-    }
+        // If this item is already installed, skip to the next one.
+        result = StepIsInstalled(contentHandler, &stepWorkflow, componentJson);
 
-    // If any of the targetted components is not up-to-date, download the update payloads.
-    for (int iCom = 0; iCom < selectedComponentsCount; iCom++)
-    {
-        char* componentJson = nullptr;
-        int childCount = workflow_get_children_count(handle);
+        if (IsAducResultCodeSuccess(result.ResultCode) && result.ResultCode == ADUC_Result_IsInstalled_Installed)
+        {
+            result.ResultCode = ADUC_Result_Install_Skipped_UpdateAlreadyInstalled;
+            result.ExtendedResultCode = 0;
+            JournalStepCompleted(component->journal, i, componentJson, nullptr /* restart */);
+            // Skipping 'install' and 'apply'.
+            continue;
+        }
 
-        if (workflowLevel > 0)
+        if (pipeline != nullptr)
         {
-            componentJson = CreateComponentSerializedString(selectedComponentsArray, iCom);
-            Log_Debug(
-                "Processing %d step(s) for component #%d.\nComponent Json Data:%s\n",
-                iCom,
-                childCount,
-                componentJson);
+            result = WaitForStepDownload(pipeline, i);
+            if (IsAducResultCodeFailure(result.ResultCode))
+            {
+                const char* stepResultDetails = workflow_peek_result_details(stepHandle);
+                SetComponentResultDetails(component, "%s", stepResultDetails == nullptr ? "" : stepResultDetails);
+                goto done;
+            }
         }
-        else
+
+        // A step may flash or decompress an image; an overheated or low-battery device waits between steps too.
+        if (!ADUC_Thermal_WaitForHeadroom(workflow_peek_cancellation_token(handle)))
         {
-            Log_Debug("Processing %d step(s) on host device.", childCount);
+            result = { .ResultCode = ADUC_Result_Failure_Cancelled, .ExtendedResultCode = 0 };
+            goto done;
         }
 
         //
-        // For each step (child workflow), invoke download actions, if not already installed.
+        // Perform 'install' action.
         //
-        for (int i = 0; i < childCount; i++)
+        if (batchResults.find(i) == batchResults.end() && workflow_is_inline_step(handle, i))
         {
-            Log_Info("Processing step #%d on component #%d.", i, iCom);
+            InstallStepsBatch(
+                handle,
+                component->stepHandles,
+                i,
+                contentHandler,
+                componentJson,
+                componentJson == nullptr ? -1 : iCom,
+                &batchResults);
+        }
 
-            // Dummy workflow to hold a childHandle.
-            ADUC_WorkflowData stepWorkflow = {};
-            std::string selectedComponentsJson;
+        // Installing a step may change whether any step is installed.
+        workflow_clear_cached_is_installed(stepHandle);
+        {
+            std::lock_guard<std::mutex> lock(*handleMutex);
+            workflow_clear_cached_is_installed(handle);
+        }
 
-            stepHandle = workflow_get_child(handle, i);
-            if (stepHandle == nullptr)
+        if (batchResults.find(i) != batchResults.end())
+        {
+            // Installed together with the steps around it; Apply still runs for each step, in order.
+            result = batchResults[i];
+        }
+        else
+        {
+            const int64_t startTime = ADUC_Timing_Now();
+            const StepDeadline deadline(handle, stepHandle, ADUCITF_WorkflowStep_Install);
+
+            try
             {
-                const char* errorFmt = "Cannot process step #%d due to missing (child) workflow data.";
-                Log_Error(errorFmt, i);
-                result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_DOWNLOAD_FAILURE_MISSING_CHILD_WORKFLOW;
-                workflow_set_result_details(handle, errorFmt, i);
-                goto done;
+                result = contentHandler->Install(&stepWorkflow);
             }
-
-            // For inline step - set current component info on the workflow.
-            if (workflow_is_inline_step(handle, i))
+            catch (...)
             {
-                if (!workflow_set_selected_components(stepHandle, componentJson))
-                {
-                    result.ResultCode = ADUC_Result_Failure;
-                    result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_SET_SELECTED_COMPONENTS_FAILURE;
-                    workflow_set_result_details(handle, "Cannot select target component(s) for step #%d", i);
-                    goto done;
-                }
+                result = { .ResultCode = ADUC_Result_Failure,
+                           .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_UNKNOWN_EXCEPTION_INSTALL_CHILD_STEP };
+                goto done;
             }
 
-            // Using same core functions.
-            stepWorkflow.WorkflowHandle = stepHandle;
+            EndStepSpan("step_install", i, startTime);
+        }
 
-            ContentHandler* contentHandler = nullptr;
-            const char* stepUpdateType = workflow_is_inline_step(handle, i) ?
-                                workflow_peek_update_manifest_step_handler(handle, i):
-                                DEFAULT_REF_STEP_HANDLER;
+        RecordStepProgress(stepHandle, i, "install", result);
 
-            Log_Info("Loading handler for step #%d (handler: '%s')", i, stepUpdateType);
+        switch (result.ResultCode)
+        {
+        case ADUC_Result_Install_RequiredImmediateReboot:
+            RequestRestartForStep(handle, i, true /* immediate */, true /* reboot */, handleMutex);
+            // We can skip another instances.
+            component->stopInstall = true;
+            goto done;
 
-            result = ExtensionManager::LoadUpdateContentHandlerExtension(stepUpdateType, &contentHandler);
+        case ADUC_Result_Install_RequiredReboot:
+            RequestRestartForStep(handle, i, false /* immediate */, true /* reboot */, handleMutex);
+            deferredRestart = "reboot";
+            break;
 
-            if (IsAducResultCodeFailure(result.ResultCode))
-            {
-                const char* errorFmt = "Cannot load a handler for step #%d (handler :%s)";
-                Log_Error(errorFmt, i, stepUpdateType);
-                workflow_set_result_details(handle, errorFmt, i, stepUpdateType == nullptr ? "NULL" : stepUpdateType);
-                goto done;
-            }
+        case ADUC_Result_Install_RequiredImmediateAgentRestart:
+            RequestRestartForStep(handle, i, true /* immediate */, false /* reboot */, handleMutex);
+            component->stopInstall = true;
+            goto done;
+
+        case ADUC_Result_Install_RequiredAgentRestart:
+            RequestRestartForStep(handle, i, false /* immediate */, false /* reboot */, handleMutex);
+            deferredRestart = "agent";
+            break;
+
+        // If any install-item reported that the update is already installed on the
+        // selected component, we will skip the 'apply' phase, and then skip the
+        // remaining install-item(s).
+        case ADUC_Result_Install_Skipped_UpdateAlreadyInstalled:
+        case ADUC_Result_Install_Skipped_NoMatchingComponents:
+            JournalStepCompleted(component->journal, i, componentJson, nullptr /* restart */);
+            continue;
+        }
+
+        if (IsAducResultCodeFailure(result.ResultCode))
+        {
+            // Propagate item's resultDetails to parent.
+            const char* stepResultDetails = workflow_peek_result_details(stepHandle);
+            SetComponentResultDetails(component, "%s", stepResultDetails == nullptr ? "" : stepResultDetails);
+            goto done;
+        }
+
+        //
+        // Perform 'apply' action.
+        //
+        {
+            const int64_t startTime = ADUC_Timing_Now();
+            const StepDeadline deadline(handle, stepHandle, ADUCITF_WorkflowStep_Apply);
 
-            // If this item is already installed, skip to the next one.
             try
             {
-                result = contentHandler->IsInstalled(&stepWorkflow);
+                result = contentHandler->Apply(&stepWorkflow);
             }
             catch (...)
             {
-                // Cannot determine whether the step has been applied, so, we'll try to process the step.
-                result = { .ResultCode = ADUC_Result_IsInstalled_NotInstalled,
-                           .ExtendedResultCode = 0 };
+                result = { .ResultCode = ADUC_Result_Failure,
+                           .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_UNKNOWN_EXCEPTION_APPLY_CHILD_STEP };
+                goto done;
             }
 
-            if (IsAducResultCodeSuccess(result.ResultCode) && result.ResultCode == ADUC_Result_IsInstalled_Installed)
+            EndStepSpan("step_apply", i, startTime);
+            RecordStepProgress(stepHandle, i, "apply", result);
+        }
+
+        if (isLastComponent)
+        {
+            // This is the last instance of the selected component.
+            if (!IsAducResultCodeFailure(result.ResultCode))
             {
-                result.ResultCode = ADUC_Result_Install_Skipped_UpdateAlreadyInstalled;
-                result.ExtendedResultCode = 0;
-                // The current instance is already up-to-date, continue checking the next instance.
-                goto instanceDone;
+                workflow_set_result(stepHandle, result);
+                workflow_set_result_details(stepHandle, "");
+            }
+        }
+
+        switch (result.ResultCode)
+        {
+        case ADUC_Result_Apply_RequiredImmediateReboot:
+            RequestRestartForStep(handle, i, true /* immediate */, true /* reboot */, handleMutex);
+            // Translate into components-level result.
+            result.ResultCode = ADUC_Result_Install_RequiredImmediateReboot;
+            // We can skip another instances.
+            component->stopInstall = true;
+            goto done;
+
+        case ADUC_Result_Apply_RequiredReboot:
+            RequestRestartForStep(handle, i, false /* immediate */, true /* reboot */, handleMutex);
+            // Translate into 'install' result.
+            result.ResultCode = ADUC_Result_Install_RequiredReboot;
+            deferredRestart = "reboot";
+            break;
+
+        case ADUC_Result_Apply_RequiredImmediateAgentRestart:
+            RequestRestartForStep(handle, i, true /* immediate */, false /* reboot */, handleMutex);
+            // Translate into components-level result.
+            result.ResultCode = ADUC_Result_Install_RequiredImmediateAgentRestart;
+            component->stopInstall = true;
+            goto done;
+
+        case ADUC_Result_Apply_RequiredAgentRestart:
+            RequestRestartForStep(handle, i, false /* immediate */, false /* reboot */, handleMutex);
+            // Translate into components-level result.
+            result.ResultCode = ADUC_Result_Install_RequiredAgentRestart;
+            if (deferredRestart == nullptr)
+            {
+                deferredRestart = "agent";
             }
+            break;
+        }
+
+        if (IsAducResultCodeFailure(result.ResultCode))
+        {
+            // Propagate item's resultDetails to parent.
+            const char* stepResultDetails = workflow_peek_result_details(stepHandle);
+            SetComponentResultDetails(component, "%s", stepResultDetails == nullptr ? "" : stepResultDetails);
+            goto done;
+        }
+
+        JournalStepCompleted(component->journal, i, componentJson, deferredRestart);
+    } // installItems loop
+
+done:
+    component->result = result;
+}
+
+/**
+ * @brief Returns the number of selected components whose steps may be installed at the same time: the smallest
+ * 'maxConcurrentComponents' handler property of the steps. A step that doesn't set it is installed on one component
+ * at a time, so is every step.
+ *
+ * @param handle The steps workflow handle.
+ */
+static unsigned int GetMaxConcurrentComponents(ADUC_WorkflowHandle handle)
+{
+    const int childCount = workflow_get_children_count(handle);
+    unsigned int maxConcurrentComponents = UINT_MAX;
+
+    for (int i = 0; i < childCount; i++)
+    {
+        // Each component gets its own copy of the steps, see CreateComponentStepWorkflows.
+        if (!workflow_is_inline_step(handle, i))
+        {
+            return 1;
+        }
+
+        const char* value = workflow_peek_update_manifest_handler_properties_string(
+            workflow_get_child(handle, i), "maxConcurrentComponents");
+        unsigned int stepMaxConcurrentComponents = 0;
+
+        if (value == nullptr || !atoui(value, &stepMaxConcurrentComponents) || stepMaxConcurrentComponents < 2)
+        {
+            return 1;
+        }
+
+        maxConcurrentComponents = std::min(maxConcurrentComponents, stepMaxConcurrentComponents);
+    }
+
+    return childCount == 0 ? 1 : maxConcurrentComponents;
+}
+
+/**
+ * @brief Creates the work folder @p componentWorkFolder of a step for one component, with links to the files
+ * downloaded to the step's work folder @p stepWorkFolder, so that components installed at the same time don't write
+ * their step's output, e.g. a script's result file, to the same folder.
+ *
+ * @return true on success.
+ */
+static bool CreateComponentWorkFolder(const char* stepWorkFolder, const std::string& componentWorkFolder)
+{
+    bool created = false;
+    DIR* dir = nullptr;
+    const struct dirent* entry = nullptr;
+    struct stat st = {};
+
+    const int createResult = ADUC_SystemUtils_MkSandboxDirRecursive(componentWorkFolder.c_str());
+    if (createResult != 0)
+    {
+        Log_Error("Unable to create folder %s, error %d", componentWorkFolder.c_str(), createResult);
+        return false;
+    }
+
+    dir = opendir(stepWorkFolder);
+    if (dir == nullptr)
+    {
+        Log_Error("Cannot open folder %s, errno: %d", stepWorkFolder, errno);
+        return false;
+    }
+
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        const std::string filePath = std::string(stepWorkFolder) + "/" + entry->d_name;
+        const std::string linkPath = componentWorkFolder + "/" + entry->d_name;
+
+        // The component work folders, and any other folder, aren't files of the step.
+        if (stat(filePath.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+
+        // A link costs no space; a copy is made if the sandbox doesn't support them.
+        if (link(filePath.c_str(), linkPath.c_str()) != 0 && errno != EEXIST
+            && ADUC_SystemUtils_CopyFileToDir(filePath.c_str(), componentWorkFolder.c_str(), true /* overwrite */) != 0)
+        {
+            Log_Error("Cannot link %s into %s, errno: %d", filePath.c_str(), componentWorkFolder.c_str(), errno);
+            goto done;
+        }
+    }
+
+    created = true;
+
+done:
+    closedir(dir);
+    return created;
+}
+
+/**
+ * @brief Creates the workflows of the steps of @p handle for @p component, so that each component's steps can be
+ * installed without touching another component's. Each gets its own work folder, in the step's work folder, see
+ * CreateComponentWorkFolder.
+ *
+ * @param handle The steps workflow handle.
+ * @param component The component. Receives the step workflows, which the caller frees.
+ * @return true on success.
+ */
+static bool CreateComponentStepWorkflows(ADUC_WorkflowHandle handle, ComponentInstall* component)
+{
+    const int childCount = workflow_get_children_count(handle);
+
+    for (int i = 0; i < childCount; i++)
+    {
+        ADUC_WorkflowHandle step = workflow_get_child(handle, i);
+        ADUC_WorkflowHandle stepHandle = nullptr;
+        bool created = false;
+
+        if (IsAducResultCodeFailure(workflow_create_from_inline_step(handle, i, &stepHandle).ResultCode))
+        {
+            return false;
+        }
+
+        component->stepHandles.push_back(stepHandle);
+
+        const char* stepWorkFolder = workflow_peek_workfolder(step);
+        if (stepWorkFolder == nullptr)
+        {
+            return false;
+        }
+
+        const std::string componentWorkFolder =
+            std::string(stepWorkFolder) + "/component-" + std::to_string(component->index);
+        component->workFolders.push_back(componentWorkFolder);
+        created = CreateComponentWorkFolder(stepWorkFolder, componentWorkFolder)
+            && workflow_set_id(stepHandle, workflow_peek_id(step))
+            && workflow_set_workfolder(stepHandle, "%s", componentWorkFolder.c_str());
+
+        if (!created)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Installs the steps on the @p componentCount selected components, up to @p maxConcurrentComponents
+ * components at the same time, e.g. identical devices on different buses. Each component is installed with its own
+ * copy of the step workflows, and its own work folders, see CreateComponentStepWorkflows; they're all created before
+ * any component is installed, as creating them reads and caches state of @p handle. Once a component fails, or
+ * requires an immediate reboot or agent restart, no new components are started.
+ *
+ * @param handle The steps workflow handle.
+ * @param componentCount The number of selected components.
+ * @param maxConcurrentComponents The maximum number of components installed at the same time.
+ * @param journal The journal of the steps completed, or NULL.
+ * @return ADUC_Result The result of the first failed component, in selected components order, or of the component
+ * that stopped the install, or success. The result details list the result details of each failed component.
+ */
+static ADUC_Result InstallComponentsConcurrently(
+    ADUC_WorkflowHandle handle,
+    int componentCount,
+    unsigned int maxConcurrentComponents,
+    StepJournal* journal)
+{
+    ADUC_Result result{ ADUC_Result_Install_Success };
+    std::vector<ComponentInstall> components(componentCount);
+    std::atomic<int> nextComponent{ 0 };
+    std::atomic<bool> stopped{ false };
+    std::mutex handleMutex;
+    std::stringstream resultDetails;
+
+    for (int iCom = 0; iCom < componentCount && !stopped; iCom++)
+    {
+        ComponentInstall& component = components[iCom];
+        component.index = iCom;
+        component.journal = journal;
+        component.componentJson = workflow_peek_selected_component(handle, iCom);
+
+        if (!CreateComponentStepWorkflows(handle, &component))
+        {
+            component.started = true;
+            component.result = { .ResultCode = ADUC_Result_Failure,
+                                 .ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_FAILURE_MISSING_CHILD_WORKFLOW };
+            SetComponentResultDetails(&component, "Cannot create the step workflows of component #%d", iCom);
+            stopped = true;
+        }
+    }
+
+    auto worker = [&]() {
+        for (int iCom = nextComponent++; iCom < componentCount && !stopped; iCom = nextComponent++)
+        {
+            ComponentInstall& component = components[iCom];
 
-            // Try to download content for current instance and step.
             try
             {
-                result = contentHandler->Download(&stepWorkflow);
+                InstallComponentSteps(
+                    handle, &component, true /* isLastComponent */, &handleMutex, nullptr /* pipeline */);
             }
             catch (...)
             {
-                result = { .ResultCode = ADUC_Result_Failure,
-                           .ExtendedResultCode =
-                               ADUC_ERC_STEPS_HANDLER_DOWNLOAD_UNKNOWN_EXCEPTION_DOWNLOAD_CONTENT };
-                goto done;
+                component.started = true;
+                component.result = { .ResultCode = ADUC_Result_Failure,
+                                     .ExtendedResultCode =
+                                         ADUC_ERC_STEPS_HANDLER_INSTALL_UNKNOWN_EXCEPTION_INSTALL_CHILD_STEP };
             }
 
-            if (IsAducResultCodeFailure(result.ResultCode))
+            if (IsAducResultCodeFailure(component.result.ResultCode) || component.stopInstall)
+            {
+                stopped = true;
+            }
+        }
+    };
+
+    const size_t workerCount = std::min<size_t>(maxConcurrentComponents, componentCount);
+    std::vector<std::thread> workers;
+
+    // The calling thread is a worker too.
+    for (size_t i = 1; i < workerCount; i++)
+    {
+        try
+        {
+            workers.emplace_back(worker);
+        }
+        catch (...)
+        {
+            Log_Warn("Cannot start component install thread #%zu, continuing with %zu.", i, i);
+            break;
+        }
+    }
+
+    Log_Info("Installing %d component(s), %zu at a time.", componentCount, workers.size() + 1);
+
+    worker();
+
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+
+    for (const ComponentInstall& component : components)
+    {
+        if (!component.started)
+        {
+            continue;
+        }
+
+        if (IsAducResultCodeFailure(component.result.ResultCode))
+        {
+            Log_Error(
+                "Install failed on component #%d (erc: 0x%X): %s",
+                component.index,
+                component.result.ExtendedResultCode,
+                component.resultDetails.c_str());
+
+            if (IsAducResultCodeSuccess(result.ResultCode))
             {
-                // Propagate item's resultDetails to parent.
-                workflow_set_result_details(handle, workflow_peek_result_details(stepHandle));
+                result = component.result;
             }
-
-        instanceDone:
-            stepHandle = nullptr;
-
-            if (IsAducResultCodeFailure(result.ResultCode))
+            else
             {
-                goto componentDone;
+                resultDetails << "; ";
             }
-        } // instances loop
-
-    componentDone:
-        json_free_serialized_string(componentJson);
-        componentJson = nullptr;
 
-        if (IsAducResultCodeFailure(result.ResultCode))
+            resultDetails << "component #" << component.index << ": " << component.resultDetails;
+        }
+        else if (component.stopInstall && result.ResultCode == ADUC_Result_Install_Success)
         {
-            goto done;
+            result = component.result;
         }
-
-        // Set step's result.
     }
 
-    result = { ADUC_Result_Download_Success };
-
-done:
-
-    // NOTE: Do not free child workflow here, so that it can be reused in the next phase.
-    // Only free child handle when the workflow is done.
-    //
-    // Alternatively, we can persist child workflow state, to free up some memory, and
-    // load the state when needed in the next phase
-
-    workflow_set_result(handle, result);
-
-    if (IsAducResultCodeSuccess(result.ResultCode))
+    if (IsAducResultCodeFailure(result.ResultCode))
     {
-        workflow_set_state(handle, ADUCITF_State_DownloadSucceeded);
+        workflow_set_result_details(handle, "%s", resultDetails.str().c_str());
     }
-    else
+    else if (components.back().started && !components.back().stopInstall)
     {
-        workflow_set_state(handle, ADUCITF_State_Failed);
+        // Like the serial install, the steps keep the results of the last component.
+        for (size_t i = 0; i < components.back().stepHandles.size(); i++)
+        {
+            const ADUC_Result stepResult = workflow_get_result(components.back().stepHandles[i]);
+            if (IsAducResultCodeSuccess(stepResult.ResultCode))
+            {
+                ADUC_WorkflowHandle stepHandle = workflow_get_child(handle, static_cast<int>(i));
+                workflow_set_result(stepHandle, stepResult);
+                workflow_set_result_details(stepHandle, "");
+            }
+        }
     }
 
-    workflow_free_string(workflowId);
-    workflow_free_string(workingFolder);
-    workflow_free_string(compatibilityString);
+    // Installing the components may change whether any step is installed.
+    workflow_clear_cached_is_installed(handle);
 
-    Log_Debug("Steps_Handler Download end (level %d).", workflowLevel);
-    return result;
-}
+    for (ComponentInstall& component : components)
+    {
+        for (ADUC_WorkflowHandle stepHandle : component.stepHandles)
+        {
+            workflow_free(stepHandle);
+        }
 
-/**
- * @brief Performs 'Download' task by iterating through all steps and invoke each step's handler
- * to download file(s), if needed.
- *
- * It is a step's handler's responsibility to determine whether
- * any files is needed for 'install' and 'apply' phases.
- *
- * @param workflowData A workflow data object.
- *
- * @return ADUC_Result The result.
- */
-ADUC_Result StepsHandlerImpl::Download(const tagADUC_WorkflowData* workflowData)
-{
-    return StepsHandler_Download(workflowData);
-}
+        for (const std::string& workFolder : component.workFolders)
+        {
+            ADUC_SystemUtils_RmDirRecursive(workFolder.c_str());
+        }
+    }
 
+    return result;
+}
 
 /**
  * @brief Performs 'Install' phase.
@@ -626,15 +2734,14 @@ static ADUC_Result StepsHandler_Install(const tagADUC_WorkflowData* workflowData
     ADUC_Result result{ ADUC_Result_Failure };
 
     ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
-    ADUC_WorkflowHandle stepHandle = nullptr;
 
-    char* workflowId = workflow_get_id(handle);
-    char* workingFolder = workflow_get_workfolder(handle);
+    const char* workflowId = workflow_peek_id(handle);
     char* compatibilityString = nullptr;
-    JSON_Array* selectedComponentsArray = nullptr;
-    char* currentComponent;
     int workflowLevel = workflow_get_level(handle);
     int selectedComponentsCount = 0;
+    std::mutex handleMutex;
+    StepDownloadPipeline pipeline;
+    StepJournal journal;
 
     Log_Debug("\n##########\n#\n# Steps_Handler Install begin (level %d, id: %s, addr:0x%x\n#\n##########\n", workflowLevel, workflowId, handle);
 
@@ -645,18 +2752,25 @@ static ADUC_Result StepsHandler_Install(const tagADUC_WorkflowData* workflowData
         goto done;
     }
 
+    result = VerifyStepsFiles(handle);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        workflow_set_result_details(handle, "Invalid step file hash (0x%X).", result.ExtendedResultCode);
+        goto done;
+    }
+
+    OpenStepJournal(handle, &journal);
+
     if (workflowLevel > 0)
     {
         // If this is not a top level workflow, selected component array must exists (okay to be empty).
-        result = GetSelectedComponentsArray(handle, &selectedComponentsArray);
+        result = GetSelectedComponentsCount(handle, &selectedComponentsCount);
         if (IsAducResultCodeFailure(result.ResultCode))
         {
             Log_Error("Missing selected components. workflow level #%d", workflowLevel);
             workflow_set_result_details(handle, "Cannot select target components.");
             goto done;
         }
-
-        selectedComponentsCount = json_array_get_count(selectedComponentsArray);
     }
     else
     {
@@ -664,234 +2778,85 @@ static ADUC_Result StepsHandler_Install(const tagADUC_WorkflowData* workflowData
         selectedComponentsCount = 1;
     }
 
+    if (workflowLevel > 0 && selectedComponentsCount > 1)
+    {
+        const unsigned int maxConcurrentComponents = GetMaxConcurrentComponents(handle);
+        if (maxConcurrentComponents > 1)
+        {
+            result = InstallComponentsConcurrently(
+                handle, selectedComponentsCount, maxConcurrentComponents, journal.path.empty() ? nullptr : &journal);
+            goto done;
+        }
+    }
+
+    // Steps left to the install phase are only deferred for one component, see DeferStepDownloads.
+    if (selectedComponentsCount == 1)
+    {
+        const int childCount = workflow_get_children_count(handle);
+
+        pipeline.handle = handle;
+        pipeline.lookAhead = GetStepDownloadLookAhead();
+        pipeline.residentCount = GetMaxResidentSteps();
+        pipeline.downloads.resize(childCount, StepDownload{ 0, nullptr, nullptr, { ADUC_Result_Failure }, false });
+        pipeline.threads.resize(childCount);
+    }
+
     // For each targetted component, perform step's install & apply phase, in order.
     for (int iCom = 0; iCom < selectedComponentsCount; iCom++)
     {
-        char* componentJson = nullptr;
-        bool skipRemainingSteps = false;
-        int childCount = workflow_get_children_count(handle);
+        ComponentInstall component;
+        const int childCount = workflow_get_children_count(handle);
+
+        component.index = iCom;
+        component.journal = journal.path.empty() ? nullptr : &journal;
+        for (int i = 0; i < childCount; i++)
+        {
+            component.stepHandles.push_back(workflow_get_child(handle, i));
+        }
 
         if (workflowLevel > 0)
         {
-            componentJson = CreateComponentSerializedString(selectedComponentsArray, iCom);
+            component.componentJson = workflow_peek_selected_component(handle, iCom);
             Log_Debug(
                 "Processing %d step(s) for component #%d.\nComponent Json Data:%s\n",
-                iCom,
                 childCount,
-                componentJson);
+                iCom,
+                component.componentJson);
         }
         else
         {
-            Log_Debug("Processing %d step(s) on host device.", workflow_get_children_count(handle));
+            Log_Debug("Processing %d step(s) on host device.", childCount);
         }
 
-        //
-        // For each step (child workflow), invoke install and apply actions.
-        //
-        for (int i = 0; i < childCount && !skipRemainingSteps; i++)
-        {
-            Log_Info("Processing step #%d on component #%d.", i, iCom);
-
-            // Dummy workflow to hold a childHandle.
-            ADUC_WorkflowData stepWorkflow = {};
-            std::string selectedComponentsJson;
-
-            stepHandle = workflow_get_child(handle, i);
-            if (stepHandle == nullptr)
-            {
-                const char* errorFmt = "Cannot process step #%d due to missing (child) workflow data.";
-                Log_Error(errorFmt, i);
-                result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_INSTALL_FAILURE_MISSING_CHILD_WORKFLOW;
-                workflow_set_result_details(handle, errorFmt, i);
-                goto done;
-            }
-
-            // For inline step - set current component info on the workflow.
-            if (workflow_is_inline_step(handle, i))
-            {
-                if (!workflow_set_selected_components(stepHandle, componentJson))
-                {
-                    result.ResultCode = ADUC_Result_Failure;
-                    result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_SET_SELECTED_COMPONENTS_FAILURE;
-                    workflow_set_result_details(handle, "Cannot select target component(s) for step #%d", i);
-                    goto done;
-                }
-            }
-
-            // Using same core functions.
-            stepWorkflow.WorkflowHandle = stepHandle;
-
-            ContentHandler* contentHandler = nullptr;
-            const char* stepUpdateType = workflow_is_inline_step(handle, i) ?
-                                workflow_peek_update_manifest_step_handler(handle, i):
-                                DEFAULT_REF_STEP_HANDLER;
-
-            Log_Info("Loading handler for step #%d (handler: '%s')", i, stepUpdateType);
-
-            result = ExtensionManager::LoadUpdateContentHandlerExtension(stepUpdateType, &contentHandler);
-
-            if (IsAducResultCodeFailure(result.ResultCode))
-            {
-                const char* errorFmt = "Cannot load a handler for step #%d (handler :%s)";
-                Log_Error(errorFmt, i, stepUpdateType);
-                workflow_set_result_details(handle, errorFmt, i, stepUpdateType == nullptr ? "NULL" : stepUpdateType);
-                goto done;
-            }
-
-            // If this item is already installed, skip to the next one.
-            try
-            {
-                result = contentHandler->IsInstalled(&stepWorkflow);
-            }
-            catch (...)
-            {
-                // Cannot determine whether the step has been applied, so, we'll try to process the step.
-                result = { .ResultCode = ADUC_Result_IsInstalled_NotInstalled,
-                           .ExtendedResultCode = 0 };
-            }
-
-            if (IsAducResultCodeSuccess(result.ResultCode) && result.ResultCode == ADUC_Result_IsInstalled_Installed)
-            {
-                result.ResultCode = ADUC_Result_Install_Skipped_UpdateAlreadyInstalled;
-                result.ExtendedResultCode = 0;
-                // Skipping 'install' and 'apply'.
-                goto instanceDone;
-            }
-
-            //
-            // Perform 'install' action.
-            //
-            try
-            {
-                result = contentHandler->Install(&stepWorkflow);
-            }
-            catch (...)
-            {
-                result = { .ResultCode = ADUC_Result_Failure,
-                           .ExtendedResultCode =
-                               ADUC_ERC_STEPS_HANDLER_INSTALL_UNKNOWN_EXCEPTION_INSTALL_CHILD_STEP };
-                goto done;
-            }
-
-            switch (result.ResultCode)
-            {
-            case ADUC_Result_Install_RequiredImmediateReboot:
-                workflow_request_immediate_reboot(handle);
-                // We can skip another instances.
-                goto done;
-
-            case ADUC_Result_Install_RequiredReboot:
-                workflow_request_reboot(handle);
-                break;
-
-            case ADUC_Result_Install_RequiredImmediateAgentRestart:
-                workflow_request_immediate_agent_restart(handle);
-                goto done;
-
-            case ADUC_Result_Install_RequiredAgentRestart:
-                workflow_request_agent_restart(handle);
-                break;
-
-            // If any install-item reported that the update is already installed on the
-            // selected component, we will skip the 'apply' phase, and then skip the
-            // remaining install-item(s).
-            case ADUC_Result_Install_Skipped_UpdateAlreadyInstalled:
-            case ADUC_Result_Install_Skipped_NoMatchingComponents:
-                goto instanceDone;
-            }
-
-            if (IsAducResultCodeFailure(result.ResultCode))
-            {
-                // Propagate item's resultDetails to parent.
-                workflow_set_result_details(
-                    handle, workflow_peek_result_details(stepHandle));
-
-                goto done;
-            }
-
-            //
-            // Perform 'apply' action.
-            //
-            try
-            {
-                result = contentHandler->Apply(&stepWorkflow);
-            }
-            catch (...)
-            {
-                result = { .ResultCode = ADUC_Result_Failure,
-                           .ExtendedResultCode =
-                               ADUC_ERC_STEPS_HANDLER_INSTALL_UNKNOWN_EXCEPTION_APPLY_CHILD_STEP };
-                goto done;
-            }
-
-            if (iCom == (selectedComponentsCount - 1))
-            {
-                // This is the last instance of the selected component.
-                if (!IsAducResultCodeFailure(result.ResultCode))
-                {
-                    workflow_set_result(stepHandle, result);
-                    workflow_set_result_details(stepHandle, "");
-                }
-            }
-
-            switch (result.ResultCode)
-            {
-            case ADUC_Result_Apply_RequiredImmediateReboot:
-                workflow_request_immediate_reboot(handle);
-                // Translate into components-level result.
-                result.ResultCode = ADUC_Result_Install_RequiredImmediateReboot;
-                // We can skip another instances.
-                goto done;
-
-            case ADUC_Result_Apply_RequiredReboot:
-                workflow_request_reboot(handle);
-                // Translate into 'install' result.
-                result.ResultCode = ADUC_Result_Install_RequiredReboot;
-                break;
-
-            case ADUC_Result_Apply_RequiredImmediateAgentRestart:
-                workflow_request_immediate_agent_restart(handle);
-                // Translate into components-level result.
-                result.ResultCode = ADUC_Result_Install_RequiredImmediateAgentRestart;
-                goto done;
-
-            case ADUC_Result_Apply_RequiredAgentRestart:
-                workflow_request_agent_restart(handle);
-                // Translate into components-level result.
-                result.ResultCode = ADUC_Result_Install_RequiredAgentRestart;
-                break;
-            }
-
-            if (IsAducResultCodeFailure(result.ResultCode))
-            {
-                // Propagate item's resultDetails to parent.
-                workflow_set_result_details(handle, workflow_peek_result_details(stepHandle));
-            }
-
-        instanceDone:
-            stepHandle = nullptr;
-
-            if (IsAducResultCodeFailure(result.ResultCode))
-            {
-                goto componentDone;
-            }
-        } // installItems loop
+        InstallComponentSteps(
+            handle,
+            &component,
+            iCom == (selectedComponentsCount - 1),
+            &handleMutex,
+            pipeline.handle == nullptr ? nullptr : &pipeline);
 
-    componentDone:
-        json_free_serialized_string(componentJson);
-        componentJson = nullptr;
+        result = component.result;
+        if (!component.resultDetails.empty())
+        {
+            workflow_set_result_details(handle, "%s", component.resultDetails.c_str());
+        }
 
-        if (IsAducResultCodeFailure(result.ResultCode))
+        if (IsAducResultCodeFailure(result.ResultCode) || component.stopInstall)
         {
             goto done;
         }
-
-        // Set step's result.
     }
 
     result = { ADUC_Result_Install_Success };
 
 done:
+    // The nested steps workflows leave their requests to the top-level one.
+    if (workflowLevel == 0)
+    {
+        ApplyRestartBarrier(handle, &result);
+    }
+
+    CloseStepJournal(&journal, result);
 
     // NOTE: Do not free child workflow here, so that it can be reused in the next phase.
     // Only free child handle when the workflow is done.
@@ -910,8 +2875,6 @@ done:
         workflow_set_state(handle, ADUCITF_State_Failed);
     }
 
-    workflow_free_string(workflowId);
-    workflow_free_string(workingFolder);
     workflow_free_string(compatibilityString);
 
     Log_Debug("Steps_Handler Install end (level %d).", workflowLevel);
@@ -979,10 +2942,7 @@ static ADUC_Result StepsHandler_IsInstalled(const tagADUC_WorkflowData* workflow
     ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
     ADUC_WorkflowHandle stepHandle = nullptr;
 
-    char* workflowId = workflow_get_id(handle);
-    char* workingFolder = workflow_get_workfolder(handle);
     char* compatibilityString = nullptr;
-    JSON_Array* selectedComponentsArray = nullptr;
     char* currentComponent;
     int workflowLevel = workflow_get_level(handle);
     int selectedComponentsCount = 0;
@@ -999,15 +2959,13 @@ static ADUC_Result StepsHandler_IsInstalled(const tagADUC_WorkflowData* workflow
     if (workflowLevel > 0)
     {
         // If this is not a top level workflow, selected component array must exists (okay to be empty).
-        result = GetSelectedComponentsArray(handle, &selectedComponentsArray);
+        result = GetSelectedComponentsCount(handle, &selectedComponentsCount);
         if (IsAducResultCodeFailure(result.ResultCode))
         {
             Log_Error("Missing selected components. workflow level #%d", workflowLevel);
             workflow_set_result_details(handle, "Cannot select target components.");
             goto done;
         }
-
-        selectedComponentsCount = json_array_get_count(selectedComponentsArray);
     }
     else
     {
@@ -1018,13 +2976,14 @@ static ADUC_Result StepsHandler_IsInstalled(const tagADUC_WorkflowData* workflow
     // For each targetted component, perform step's install & apply phase, in order.
     for (int iCom = 0; iCom < selectedComponentsCount; iCom++)
     {
-        char* componentJson = nullptr;
+        const char* componentJson = nullptr;
         bool skipRemainingSteps = false;
         int childCount = workflow_get_children_count(handle);
+        std::vector<StepInstalledProbe> probes;
 
         if (workflowLevel > 0)
         {
-            componentJson = CreateComponentSerializedString(selectedComponentsArray, iCom);
+            componentJson = workflow_peek_selected_component(handle, iCom);
             Log_Debug(
                 "Processing %d step(s) for component #%d.\nComponent Json Data:%s\n",
                 iCom,
@@ -1043,10 +3002,6 @@ static ADUC_Result StepsHandler_IsInstalled(const tagADUC_WorkflowData* workflow
         {
             Log_Info("Processing step #%d on component #%d.\n#### Component ####\n%s\n###################\n", i, iCom, componentJson);
 
-            // Dummy workflow to hold a childHandle.
-            ADUC_WorkflowData stepWorkflow = {};
-            std::string selectedComponentsJson;
-
             stepHandle = workflow_get_child(handle, i);
             if (stepHandle == nullptr)
             {
@@ -1060,7 +3015,7 @@ static ADUC_Result StepsHandler_IsInstalled(const tagADUC_WorkflowData* workflow
             // For inline step - set current component info on the workflow.
             if (workflow_is_inline_step(handle, i))
             {
-                if (!workflow_set_selected_components(stepHandle, componentJson))
+                if (!SelectStepComponent(handle, stepHandle, componentJson == nullptr ? -1 : iCom))
                 {
                     result.ResultCode = ADUC_Result_Failure;
                     result.ExtendedResultCode = ADUC_ERC_STEPS_HANDLER_SET_SELECTED_COMPONENTS_FAILURE;
@@ -1069,9 +3024,6 @@ static ADUC_Result StepsHandler_IsInstalled(const tagADUC_WorkflowData* workflow
                 }
             }
 
-            // Using same core functions.
-            stepWorkflow.WorkflowHandle = stepHandle;
-
             ContentHandler* contentHandler = nullptr;
             const char* stepUpdateType = workflow_is_inline_step(handle, i) ?
                                 workflow_peek_update_manifest_step_handler(handle, i):
@@ -1089,43 +3041,30 @@ static ADUC_Result StepsHandler_IsInstalled(const tagADUC_WorkflowData* workflow
                 goto done;
             }
 
-            // If this item is already installed, skip to the next one.
-            try
-            {
-                result = contentHandler->IsInstalled(&stepWorkflow);
-            }
-            catch (...)
-            {
-                // Cannot determine whether the step has been applied, so, we'll try to process the step.
-                result = { .ResultCode = ADUC_Result_IsInstalled_NotInstalled,
-                           .ExtendedResultCode = 0 };
-            }
+            probes.push_back({ i, stepHandle, contentHandler, { ADUC_Result_Failure }, false });
 
-            if (IsAducResultCodeFailure(result.ResultCode) ||
-                result.ResultCode == ADUC_Result_IsInstalled_NotInstalled)
-            {
-                Log_Info("Step #%d is not installed.", i);
-                goto done;
-            }
+            stepHandle = nullptr;
+        } // installItems loop
 
-            if (IsAducResultCodeFailure(result.ResultCode))
+        // The component is up-to-date if every step is installed; the first one that isn't decides.
+        ProbeStepsInstalled(probes, componentJson, true /* stopAtNotInstalled */);
+
+        for (const StepInstalledProbe& probe : probes)
+        {
+            if (!probe.probed)
             {
-                // Propagate item's resultDetails to parent.
-                workflow_set_result_details(handle, workflow_peek_result_details(stepHandle));
+                break;
             }
 
-        instanceDone:
-            stepHandle = nullptr;
+            result = probe.result;
 
-            if (IsAducResultCodeFailure(result.ResultCode))
+            if (IsAducResultCodeFailure(result.ResultCode) ||
+                result.ResultCode == ADUC_Result_IsInstalled_NotInstalled)
             {
-                goto componentDone;
+                Log_Info("Step #%d is not installed.", probe.index);
+                goto done;
             }
-        } // installItems loop
-
-    componentDone:
-        json_free_serialized_string(componentJson);
-        componentJson = nullptr;
+        }
 
         if (IsAducResultCodeFailure(result.ResultCode))
         {
@@ -1139,8 +3078,6 @@ static ADUC_Result StepsHandler_IsInstalled(const tagADUC_WorkflowData* workflow
 
 done:
 
-    workflow_free_string(workflowId);
-    workflow_free_string(workingFolder);
     workflow_free_string(compatibilityString);
 
     Log_Debug("Steps_Handler IsInstall end (level %d).", workflowLevel);
@@ -12,15 +12,41 @@
  *   Expected files:
  *   .swu - contains swupdate image.
  *
+ *   Optional delta: when handlerProperties names a 'deltaFileName', a 'deltaSourcePath' and a
+ *   'deltaSourceHash', the files also include a delta file. The handler then downloads the delta
+ *   and reconstructs the .swu image from the local source image, for example the inactive
+ *   partition. If that fails, the full .swu image is downloaded instead.
+ *
+ *   Optional streaming: when handlerProperties has 'streamInstall' set to "true", and the content
+ *   downloader supports it, the .swu image isn't downloaded to the work folder. Install downloads it
+ *   into a pipe that swupdate reads the image from, so flashing overlaps the transfer and the image
+ *   doesn't need to be staged. The image hash is validated as it streams; an invalid hash fails the
+ *   install, so the update is never applied. Not used with a delta file.
+ *
+ *   Install progress: during install, the handler reads swupdate's progress socket, 'progressSocketPath'
+ *   in handlerProperties or /tmp/swupdateprog, and records the install steps and their percentage as
+ *   progress telemetry of the image file. When 'installStallTimeoutSeconds' is set, an install that
+ *   reports no progress for that long is terminated and fails as stalled.
+ *
+ *   Optional post-install verification: when handlerProperties names an 'installedImagePath', e.g. the
+ *   inactive partition, with the 'installedImageSize', 'installedImageChunkSize' and base64 SHA-256
+ *   'installedImageRootHash' of the image swupdate writes there, Install verifies what was written by
+ *   hashing its chunks in parallel, see ADUC_HashUtils_IsValidChunkRootHash, before the update is applied.
+ *
  * @copyright Copyright (c) Microsoft Corporation.
  * Licensed under the MIT License.
  */
 #include "aduc/swupdate_handler.hpp"
 
 #include "aduc/adu_core_exports.h"
+#include "aduc/adushell_broker_utils.hpp"
+#include "aduc/cancellation_token.h"
+#include "aduc/delta_utils.h"
 #include "aduc/extension_manager.hpp"
+#include "aduc/hash_utils.h"
 #include "aduc/logging.h"
 #include "aduc/process_utils.hpp"
+#include "aduc/progress_telemetry.h"
 #include "aduc/string_c_utils.h"
 #include "aduc/string_utils.hpp"
 #include "aduc/system_utils.h"
@@ -30,17 +56,30 @@
 #include "adushell_const.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <functional>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 namespace adushconst = Adu::Shell::Const;
 
 EXTERN_C_BEGIN
+#ifndef ADUC_BUILTIN_CONTENT_HANDLER
+
 /**
  * @brief Instantiates an Update Content Handler for 'microsoft/swupdate:1' update type.
  */
@@ -64,6 +103,8 @@ ContentHandler* CreateUpdateContentHandlerExtension(ADUC_LOG_SEVERITY logLevel)
 
     return nullptr;
 }
+
+#endif // ADUC_BUILTIN_CONTENT_HANDLER
 EXTERN_C_END
 
 /**
@@ -71,7 +112,9 @@ EXTERN_C_END
  */
 SWUpdateHandlerImpl::~SWUpdateHandlerImpl() // override
 {
+#ifndef ADUC_BUILTIN_CONTENT_HANDLER
     ADUC_Logging_Uninit();
+#endif
 }
 
 // Forward declarations.
@@ -88,6 +131,418 @@ ContentHandler* SWUpdateHandlerImpl::CreateContentHandler()
     return new SWUpdateHandlerImpl();
 }
 
+/**
+ * @brief Gets the .swu image file entity, which is the update file that isn't the delta file.
+ *
+ * @param workflowHandle The workflow handle.
+ * @param entity The output file entity, owned by the workflow, see workflow_peek_update_file().
+ * @return bool True if found.
+ */
+static bool GetImageFileEntity(ADUC_WorkflowHandle workflowHandle, const ADUC_FileEntity** entity)
+{
+    const char* deltaFileName = workflow_peek_update_manifest_handler_properties_string(workflowHandle, "deltaFileName");
+    const size_t fileCount = workflow_get_update_files_count(workflowHandle);
+
+    for (size_t i = 0; i < fileCount; i++)
+    {
+        const ADUC_FileEntity* file = workflow_peek_update_file(workflowHandle, i);
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        if (IsNullOrEmpty(deltaFileName) || strcmp(file->TargetFilename, deltaFileName) != 0)
+        {
+            *entity = file;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Reconstructs the .swu image from the delta file named in handlerProperties and the local source image.
+ * The caller still downloads the image through the extension manager, which verifies the reconstructed file
+ * and downloads the full image if it's missing or invalid.
+ *
+ * @param workflowHandle The workflow handle.
+ * @param imageEntity The .swu image file entity.
+ * @param workflowId The workflow id.
+ * @param workFolder The work folder.
+ * @return bool True if the image was reconstructed.
+ */
+static bool ReconstructImageFromDelta(
+    ADUC_WorkflowHandle workflowHandle, const ADUC_FileEntity* imageEntity, const char* workflowId, const char* workFolder)
+{
+    bool succeeded = false;
+    const ADUC_FileEntity* deltaEntity = nullptr;
+    ADUC_Result result = { ADUC_Result_Failure };
+    std::stringstream imageFilePath;
+    std::stringstream deltaFilePath;
+    const char* deltaFileName = workflow_peek_update_manifest_handler_properties_string(workflowHandle, "deltaFileName");
+    const char* sourcePath = workflow_peek_update_manifest_handler_properties_string(workflowHandle, "deltaSourcePath");
+    const char* sourceHash = workflow_peek_update_manifest_handler_properties_string(workflowHandle, "deltaSourceHash");
+    const size_t fileCount = workflow_get_update_files_count(workflowHandle);
+
+    if (IsNullOrEmpty(deltaFileName) || IsNullOrEmpty(sourcePath) || IsNullOrEmpty(sourceHash))
+    {
+        goto done;
+    }
+
+    imageFilePath << workFolder << "/" << imageEntity->TargetFilename;
+    if (access(imageFilePath.str().c_str(), F_OK) == 0)
+    {
+        // Possibly reconstructed or downloaded by an earlier attempt; the extension manager verifies it.
+        goto done;
+    }
+
+    for (size_t i = 0; i < fileCount && deltaEntity == nullptr; i++)
+    {
+        const ADUC_FileEntity* file = workflow_peek_update_file(workflowHandle, i);
+        if (file != nullptr && strcmp(file->TargetFilename, deltaFileName) == 0)
+        {
+            deltaEntity = file;
+        }
+    }
+
+    if (deltaEntity == nullptr)
+    {
+        Log_Warn("Delta file %s is not in the update files.", deltaFileName);
+        goto done;
+    }
+
+    result = ExtensionManager::Download(
+        deltaEntity,
+        workflowId,
+        workFolder,
+        DO_RETRY_TIMEOUT_DEFAULT,
+        nullptr,
+        workflow_peek_cancellation_token(workflowHandle));
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        Log_Warn("Cannot download delta file %s. (0x%X)", deltaFileName, result.ExtendedResultCode);
+        goto done;
+    }
+
+    deltaFilePath << workFolder << "/" << deltaEntity->TargetFilename;
+
+    Log_Info("Reconstructing %s from %s", imageFilePath.str().c_str(), sourcePath);
+    succeeded = ADUC_DeltaUtils_ApplyDelta(
+        sourcePath, sourceHash, SHA256, deltaFilePath.str().c_str(), imageFilePath.str().c_str());
+
+    // The delta isn't needed anymore, and may be almost as big as the image.
+    if (ADUC_SystemUtils_RemoveFile(deltaFilePath.str().c_str()) != 0)
+    {
+        Log_Warn("Cannot remove delta file %s", deltaFilePath.str().c_str());
+    }
+
+done:
+    return succeeded;
+}
+
+/**
+ * @brief Returns whether the .swu image is to be streamed into swupdate during install instead of downloaded.
+ *
+ * @param workflowHandle The workflow handle.
+ * @return bool True if handlerProperties ask for it, and the content downloader can download to a stream.
+ */
+static bool IsStreamInstallEnabled(ADUC_WorkflowHandle workflowHandle)
+{
+    const char* streamInstall =
+        workflow_peek_update_manifest_handler_properties_string(workflowHandle, "streamInstall");
+
+    // A delta update reconstructs the image into a file, so there's nothing to stream.
+    return streamInstall != nullptr && strcmp(streamInstall, "true") == 0
+        && IsNullOrEmpty(workflow_peek_update_manifest_handler_properties_string(workflowHandle, "deltaFileName"))
+        && ExtensionManager::IsDownloadToStreamSupported();
+}
+
+/**
+ * @brief Downloads the .swu image into the pipe at @p pipePath as it arrives, once adu-shell opened it for reading.
+ * Must run on its own thread, since it blocks SIGPIPE for the calling thread.
+ *
+ * @param entity The .swu image file entity.
+ * @param workflowId The workflow id.
+ * @param pipePath The path of the pipe adu-shell installs the image from.
+ * @param installDone Set once adu-shell exited, so that this doesn't wait for a reader that will never come.
+ * @return ADUC_Result The result of the download.
+ */
+static ADUC_Result StreamImage(
+    const ADUC_FileEntity* entity, const char* workflowId, const char* pipePath, const std::atomic_bool& installDone)
+{
+    ADUC_Result result = { ADUC_Result_Failure, ADUC_ERC_SWUPDATE_HANDLER_INSTALL_FAILURE_STREAM_NOT_READ };
+    const struct timespec noWait = {};
+    sigset_t sigpipe;
+    int fd = -1;
+
+    // A reader that goes away fails the writes with EPIPE, instead of terminating the agent.
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+    // Opening the write end of a pipe blocks until there's a reader. Poll instead, in case adu-shell fails
+    // before opening it.
+    while (!installDone)
+    {
+        fd = open(pipePath, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd != -1 || errno != ENXIO)
+        {
+            break;
+        }
+
+        usleep(100 * 1000);
+    }
+
+    if (fd == -1)
+    {
+        Log_Error("swupdate didn't read the image stream %s, errno %d", pipePath, errno);
+        return result;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    result = ExtensionManager::DownloadToStream(entity, workflowId, DO_RETRY_TIMEOUT_DEFAULT, nullptr, fd);
+
+    // End of the stream.
+    close(fd);
+
+    // Discard a SIGPIPE raised by a write after the reader went away.
+    while (sigtimedwait(&sigpipe, nullptr, &noWait) == SIGPIPE)
+    {
+    }
+
+    return result;
+}
+
+/**
+ * @brief The path of swupdate's progress socket, when handlerProperties has no 'progressSocketPath'.
+ */
+static const char* const c_defaultProgressSocketPath = "/tmp/swupdateprog";
+
+/**
+ * @brief The status of an update, as in swupdate's swupdate_status.h.
+ */
+enum SWUpdateStatus
+{
+    SWUpdateStatus_Idle,
+    SWUpdateStatus_Start,
+    SWUpdateStatus_Run,
+    SWUpdateStatus_Success,
+    SWUpdateStatus_Failure,
+    SWUpdateStatus_Download,
+    SWUpdateStatus_Done,
+    SWUpdateStatus_Subprocess,
+    SWUpdateStatus_Progress,
+};
+
+/**
+ * @brief A message of swupdate's progress socket, as struct progress_msg of swupdate's progress_ipc.h.
+ * swupdate writes it as is, so the layout must match the swupdate version on the device.
+ */
+struct SWUpdateProgressMessage
+{
+    unsigned int magic; //!< The progress API version, 0 before swupdate 2022.05.
+    int status; //!< The SWUpdateStatus.
+    unsigned int dwl_percent; //!< The percentage of the image downloaded, when swupdate downloads it.
+    unsigned long long dwl_bytes; //!< The size of the image downloaded.
+    unsigned int nsteps; //!< The number of install steps, i.e. images to install.
+    unsigned int cur_step; //!< The current install step, from 1.
+    unsigned int cur_percent; //!< The percentage of the current install step.
+    char cur_image[256]; //!< The name of the image being installed.
+    char hnd_name[64]; //!< The name of the swupdate handler installing it.
+    int source; //!< The interface that started the update.
+    unsigned int infolen; //!< The length of info.
+    char info[2048]; //!< Additional information.
+};
+
+/**
+ * @brief Returns the install state of the progress telemetry for @p status, e.g. "Installing".
+ */
+static const char* SWUpdateStatusToInstallState(int status)
+{
+    switch (status)
+    {
+    case SWUpdateStatus_Success:
+        return "InstallSucceeded";
+    case SWUpdateStatus_Failure:
+        return "InstallFailed";
+    case SWUpdateStatus_Done:
+        return "InstallDone";
+    default:
+        return "Installing";
+    }
+}
+
+/**
+ * @brief Connects to swupdate's progress socket.
+ *
+ * @param socketPath The path of the socket.
+ * @return int The connected socket, or -1 if swupdate isn't listening (yet).
+ */
+static int ConnectProgressSocket(const std::string& socketPath)
+{
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        return -1;
+    }
+
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    if (connect(fd, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief Records the install progress swupdate reports on its progress socket until adu-shell exits, and cancels
+ * @p installToken if there's no progress for @p stallTimeoutSeconds.
+ * swupdate only listens while adu-shell runs it, so this connects, and reconnects, as it can.
+ *
+ * @param workflowId The workflow id.
+ * @param fileId The file id of the .swu image.
+ * @param socketPath The path of swupdate's progress socket.
+ * @param stallTimeoutSeconds The time without progress after which the install stalled, 0 to never stall.
+ * @param installToken Cancelled once the install stalled, terminating adu-shell.
+ * @param installDone Set once adu-shell exited.
+ * @return bool True if the install stalled.
+ */
+static bool MonitorInstallProgress(
+    const char* workflowId,
+    const char* fileId,
+    const std::string& socketPath,
+    unsigned int stallTimeoutSeconds,
+    ADUC_CancellationToken* installToken,
+    const std::atomic_bool& installDone)
+{
+    SWUpdateProgressMessage message = {};
+    size_t receivedSize = 0;
+    unsigned int step = 0;
+    unsigned int percent = 0;
+    int status = -1;
+    int fd = -1;
+    bool stalled = false;
+
+    // The install makes progress once swupdate starts, so a swupdate that never starts stalls too.
+    auto lastProgress = std::chrono::steady_clock::now();
+
+    while (!installDone)
+    {
+        if (fd == -1)
+        {
+            fd = ConnectProgressSocket(socketPath);
+            if (fd != -1)
+            {
+                Log_Info("Connected to swupdate progress socket %s", socketPath.c_str());
+                lastProgress = std::chrono::steady_clock::now();
+            }
+        }
+
+        struct pollfd pollFd = { fd, POLLIN, 0 };
+        const int ready = fd == -1 ? poll(nullptr, 0, 200) : poll(&pollFd, 1, 200);
+        if (ready > 0)
+        {
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+            char* buffer = reinterpret_cast<char*>(&message) + receivedSize;
+            const ssize_t readSize = read(fd, buffer, sizeof(message) - receivedSize);
+            if (readSize <= 0)
+            {
+                // swupdate exited. A later swupdate, e.g. of the next image, listens again.
+                close(fd);
+                fd = -1;
+                receivedSize = 0;
+            }
+            else if ((receivedSize += static_cast<size_t>(readSize)) == sizeof(message))
+            {
+                receivedSize = 0;
+
+                if (message.cur_step != step || message.cur_percent != percent || message.status != status)
+                {
+                    step = message.cur_step;
+                    percent = message.cur_percent;
+                    status = message.status;
+                    lastProgress = std::chrono::steady_clock::now();
+
+                    Log_Debug("swupdate status %d, step %u/%u, %u%%", status, step, message.nsteps, percent);
+                    ADUC_ProgressTelemetry_RecordInstall(
+                        workflowId, fileId, SWUpdateStatusToInstallState(status), step, message.nsteps, percent);
+                }
+            }
+        }
+
+        if (stallTimeoutSeconds != 0
+            && std::chrono::steady_clock::now() - lastProgress > std::chrono::seconds(stallTimeoutSeconds))
+        {
+            Log_Error("swupdate made no progress for %u seconds, terminating the install.", stallTimeoutSeconds);
+            stalled = true;
+            ADUC_CancellationToken_Cancel(installToken);
+            break;
+        }
+    }
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    return stalled;
+}
+
+/**
+ * @brief Verifies the image swupdate installed against the root hash of its chunks in handlerProperties, if any.
+ *
+ * @param workflowHandle The workflow handle.
+ * @return bool True if verified, or if handlerProperties have no 'installedImagePath'.
+ */
+static bool VerifyInstalledImage(ADUC_WorkflowHandle workflowHandle)
+{
+    const char* imagePath =
+        workflow_peek_update_manifest_handler_properties_string(workflowHandle, "installedImagePath");
+    if (IsNullOrEmpty(imagePath))
+    {
+        return true;
+    }
+
+    const char* imageSize =
+        workflow_peek_update_manifest_handler_properties_string(workflowHandle, "installedImageSize");
+    const char* chunkSize =
+        workflow_peek_update_manifest_handler_properties_string(workflowHandle, "installedImageChunkSize");
+    const char* rootHash =
+        workflow_peek_update_manifest_handler_properties_string(workflowHandle, "installedImageRootHash");
+    unsigned long size = 0;
+    unsigned long chunkSizeInBytes = 0;
+
+    if (IsNullOrEmpty(imageSize) || IsNullOrEmpty(chunkSize) || IsNullOrEmpty(rootHash) || !atoul(imageSize, &size)
+        || !atoul(chunkSize, &chunkSizeInBytes))
+    {
+        Log_Error(
+            "installedImagePath needs a valid installedImageSize, installedImageChunkSize and installedImageRootHash");
+        return false;
+    }
+
+    Log_Info("Verifying the installed image %s", imagePath);
+    if (!ADUC_HashUtils_IsValidChunkRootHash(imagePath, size, chunkSizeInBytes, rootHash, SHA256, 0))
+    {
+        Log_Error("The installed image %s doesn't match installedImageRootHash", imagePath);
+        return false;
+    }
+
+    return true;
+}
+
 /**
  * @brief Performs 'Download' task.
  *
@@ -97,13 +552,14 @@ ADUC_Result SWUpdateHandlerImpl::Download(const tagADUC_WorkflowData* workflowDa
 {
     std::stringstream updateFilename;
     ADUC_Result result = { ADUC_Result_Failure };
-    ADUC_FileEntity* entity = nullptr;
+    const ADUC_FileEntity* entity = nullptr;
     ADUC_WorkflowHandle workflowHandle = workflowData->WorkflowHandle;
-    char* workflowId = workflow_get_id(workflowHandle);
-    char* workFolder = workflow_get_workfolder(workflowHandle);
+    const char* workflowId = workflow_peek_id(workflowHandle);
+    const char* workFolder = workflow_peek_workfolder(workflowHandle);
     int fileCount = 0;
+    int expectedFileCount = 1;
 
-    char* updateType = workflow_get_update_type(workflowHandle);
+    const char* updateType = workflow_peek_update_type(workflowHandle);
     char* updateName = nullptr;
     unsigned int updateTypeVersion = 0;
     bool updateTypeOk = ADUC_ParseUpdateType(updateType, &updateName, &updateTypeVersion);
@@ -122,30 +578,48 @@ ADUC_Result SWUpdateHandlerImpl::Download(const tagADUC_WorkflowData* workflowDa
         goto done;
     }
 
-    // For 'microsoft/swupdate:1', we're expecting 1 payload file.
+    // For 'microsoft/swupdate:1', we're expecting 1 payload file, plus an optional delta file.
     fileCount = workflow_get_update_files_count(workflowHandle);
-    if (fileCount != 1)
+    expectedFileCount =
+        IsNullOrEmpty(workflow_peek_update_manifest_handler_properties_string(workflowHandle, "deltaFileName")) ? 1
+                                                                                                                : 2;
+    if (fileCount != expectedFileCount)
     {
-        Log_Error("SWUpdate expecting one file. (%d)", fileCount);
+        Log_Error("SWUpdate expecting %d file(s). (%d)", expectedFileCount, fileCount);
         result.ExtendedResultCode = ADUC_ERC_SWUPDATE_HANDLER_DOWNLOAD_FAILURE_WRONG_FILECOUNT;
         goto done;
     }
 
-    if (!workflow_get_update_file(workflowHandle, 0, &entity))
+    if (!GetImageFileEntity(workflowHandle, &entity))
     {
         result.ExtendedResultCode = ADUC_ERC_SWUPDATE_HANDLER_DOWNLOADE_BAD_FILE_ENTITY;
         goto done;
     }
 
+    if (IsStreamInstallEnabled(workflowHandle))
+    {
+        Log_Info("%s will be streamed to swupdate during install, not downloaded.", entity->TargetFilename);
+        result = { ADUC_Result_Download_Success };
+        goto done;
+    }
+
     updateFilename << workFolder << "/" << entity->TargetFilename;
 
-    result = ExtensionManager::Download(entity, workflowId, workFolder, DO_RETRY_TIMEOUT_DEFAULT, nullptr);
+    if (expectedFileCount == 2 && !ReconstructImageFromDelta(workflowHandle, entity, workflowId, workFolder))
+    {
+        Log_Info("Delta update not applied, downloading the full image.");
+    }
+
+    // Verifies a reconstructed image, or downloads the full image.
+    result = ExtensionManager::Download(
+        entity,
+        workflowId,
+        workFolder,
+        DO_RETRY_TIMEOUT_DEFAULT,
+        nullptr,
+        workflow_peek_cancellation_token(workflowHandle));
 
 done:
-    workflow_free_string(workflowId);
-    workflow_free_string(workFolder);
-    workflow_free_file_entity(entity);
-
     return result;
 }
 
@@ -158,9 +632,9 @@ done:
 ADUC_Result SWUpdateHandlerImpl::Install(const tagADUC_WorkflowData* workflowData)
 {
     ADUC_Result result = { ADUC_Result_Failure };
-    ADUC_FileEntity* entity = nullptr;
+    const ADUC_FileEntity* entity = nullptr;
     ADUC_WorkflowHandle workflowHandle = workflowData->WorkflowHandle;
-    char* workFolder = workflow_get_workfolder(workflowHandle);
+    const char* workFolder = workflow_peek_workfolder(workflowHandle);
 
     Log_Info("Installing from %s", workFolder);
     std::unique_ptr<DIR, std::function<int(DIR*)>> directory(
@@ -174,7 +648,7 @@ ADUC_Result SWUpdateHandlerImpl::Install(const tagADUC_WorkflowData* workflowDat
         goto done;
     }
 
-    if (!workflow_get_update_file(workflowHandle, 0, &entity))
+    if (!GetImageFileEntity(workflowHandle, &entity))
     {
         result.ExtendedResultCode = ADUC_ERC_SWUPDATE_HANDLER_INSTALL_FAILURE_BAD_FILE_ENTITY;
         goto done;
@@ -196,8 +670,40 @@ ADUC_Result SWUpdateHandlerImpl::Install(const tagADUC_WorkflowData* workflowDat
 
         std::stringstream data;
         data << workFolder << "/" << entity->TargetFilename;
-        args.emplace_back(adushconst::target_data_opt);
-        args.emplace_back(data.str().c_str());
+
+        // The image wasn't downloaded, swupdate reads it from a pipe while it's downloaded.
+        const bool streamImage = access(data.str().c_str(), F_OK) != 0 && IsStreamInstallEnabled(workflowHandle);
+        std::string pipePath;
+        std::atomic_bool installDone{ false };
+        ADUC_Result streamResult = { ADUC_Result_Failure };
+        std::thread streamThread;
+
+        if (streamImage)
+        {
+            pipePath = data.str() + ".stream";
+            remove(pipePath.c_str());
+
+            if (mkfifo(pipePath.c_str(), S_IRUSR | S_IWUSR) != 0)
+            {
+                Log_Error("Cannot create image stream %s, errno = %d", pipePath.c_str(), errno);
+                result.ExtendedResultCode = ADUC_ERC_SWUPDATE_HANDLER_INSTALL_FAILURE_CANNOT_CREATE_STREAM;
+                goto done;
+            }
+
+            Log_Info("Streaming %s to swupdate", entity->TargetFilename);
+            args.emplace_back(adushconst::target_data_opt);
+            args.emplace_back(pipePath);
+
+            streamThread = std::thread{ [&streamResult, entity, &pipePath, &installDone, workflowData]() {
+                const char* workflowId = workflow_peek_id(workflowData->WorkflowHandle);
+                streamResult = StreamImage(entity, workflowId, pipePath.c_str(), installDone);
+            } };
+        }
+        else
+        {
+            args.emplace_back(adushconst::target_data_opt);
+            args.emplace_back(data.str().c_str());
+        }
 
         args.emplace_back(adushconst::target_log_folder_opt);
         
@@ -205,8 +711,58 @@ ADUC_Result SWUpdateHandlerImpl::Install(const tagADUC_WorkflowData* workflowDat
         // For GA, we should make this configurable in du-config.json. 
         args.emplace_back(ADUC_LOG_FOLDER);
 
+        // A stall timeout terminates adu-shell through a cancellation token, which runs it outside of the broker.
+        const char* stallTimeout =
+            workflow_peek_update_manifest_handler_properties_string(workflowHandle, "installStallTimeoutSeconds");
+        unsigned int stallTimeoutSeconds = 0;
+        if (!IsNullOrEmpty(stallTimeout) && !atoui(stallTimeout, &stallTimeoutSeconds))
+        {
+            Log_Warn("Ignoring invalid installStallTimeoutSeconds '%s'", stallTimeout);
+        }
+
+        std::unique_ptr<ADUC_CancellationToken, void (*)(ADUC_CancellationToken*)> installToken{
+            stallTimeoutSeconds != 0 ? ADUC_CancellationToken_Create() : nullptr, ADUC_CancellationToken_Destroy
+        };
+        if (stallTimeoutSeconds != 0 && installToken == nullptr)
+        {
+            Log_Warn("Out of memory, not detecting install stalls");
+            stallTimeoutSeconds = 0;
+        }
+
+        const char* progressSocketPath =
+            workflow_peek_update_manifest_handler_properties_string(workflowHandle, "progressSocketPath");
+        const std::string socketPath{ IsNullOrEmpty(progressSocketPath) ? c_defaultProgressSocketPath
+                                                                        : progressSocketPath };
+        bool stalled = false;
+        std::thread progressThread{ [&stalled, entity, &socketPath, stallTimeoutSeconds, &installToken, &installDone,
+                                     workflowData]() {
+            stalled = MonitorInstallProgress(
+                workflow_peek_id(workflowData->WorkflowHandle),
+                entity->FileId,
+                socketPath,
+                stallTimeoutSeconds,
+                installToken.get(),
+                installDone);
+        } };
+
         std::string output;
-        const int exitCode = ADUC_LaunchChildProcess(command, args, output);
+        const int exitCode = ADUC_LaunchAduShell(command, args, output, installToken.get());
+
+        installDone = true;
+        progressThread.join();
+
+        if (streamImage)
+        {
+            streamThread.join();
+            remove(pipePath.c_str());
+        }
+
+        if (stalled)
+        {
+            result = { .ResultCode = ADUC_Result_Failure,
+                       .ExtendedResultCode = ADUC_ERC_SWUPDATE_HANDLER_INSTALL_FAILURE_STALLED };
+            goto done;
+        }
 
         if (exitCode != 0)
         {
@@ -214,14 +770,26 @@ ADUC_Result SWUpdateHandlerImpl::Install(const tagADUC_WorkflowData* workflowDat
             result = { .ResultCode = ADUC_Result_Failure, .ExtendedResultCode = exitCode };
             goto done;
         }
+
+        // swupdate verifies the image it installs, but the update is only applied if it's the expected one.
+        if (streamImage && IsAducResultCodeFailure(streamResult.ResultCode))
+        {
+            Log_Error("Image stream failed, extendedResultCode = 0x%X", streamResult.ExtendedResultCode);
+            result = streamResult;
+            goto done;
+        }
+    }
+
+    if (!VerifyInstalledImage(workflowHandle))
+    {
+        result.ExtendedResultCode = ADUC_ERC_SWUPDATE_HANDLER_INSTALL_FAILURE_IMAGE_NOT_VERIFIED;
+        goto done;
     }
 
     Log_Info("Install succeeded");
     result.ResultCode = ADUC_Result_Install_Success;
 
 done:
-    workflow_free_string(workFolder);
-    workflow_free_file_entity(entity);
     return result;
 }
 
@@ -235,7 +803,7 @@ done:
 ADUC_Result SWUpdateHandlerImpl::Apply(const tagADUC_WorkflowData* workflowData)
 {
     ADUC_Result result = { ADUC_Result_Failure };
-    char* workFolder = workflow_get_workfolder(workflowData->WorkflowHandle);
+    const char* workFolder = workflow_peek_workfolder(workflowData->WorkflowHandle);
     Log_Info("Applying data from %s", workFolder);
 
     // Execute the install command with  "-a" to apply the install by telling
@@ -257,7 +825,7 @@ ADUC_Result SWUpdateHandlerImpl::Apply(const tagADUC_WorkflowData* workflowData)
 
     std::string output;
 
-    const int exitCode = ADUC_LaunchChildProcess(command, args, output);
+    const int exitCode = ADUC_LaunchAduShell(command, args, output);
 
     if (exitCode != 0)
     {
@@ -275,7 +843,6 @@ ADUC_Result SWUpdateHandlerImpl::Apply(const tagADUC_WorkflowData* workflowData)
     }
 
 done:
-    workflow_free_string(workFolder);
 
     // Always require a reboot after successful apply
     result = { ADUC_Result_Apply_RequiredImmediateReboot };
@@ -395,7 +962,7 @@ static ADUC_Result CancelApply(const char* logFolder)
 
     std::string output;
 
-    const int exitCode = ADUC_LaunchChildProcess(command, args, output);
+    const int exitCode = ADUC_LaunchAduShell(command, args, output);
     if (exitCode != 0)
     {
         // If failed to cancel apply, apply should return SuccessRebootRequired.
@@ -11,20 +11,87 @@
 #include <aduc/logging.h>
 #include <aduc/string_handle_wrapper.hpp>
 #include <azure_c_shared_utility/strings.h>
+#include <condition_variable>
+#include <deque>
+#include <diagnostics_interface.h>
 #include <diagnostics_workflow.h>
 #include <mutex>
 #include <operation_id_utils.h>
+#include <string>
 #include <thread>
 #include <vector>
 
 /**
- * @brief Wraps the DiagnosticsWorkflow to work asynchronously
- * @details Only allows one DiagnosticsWorkflow at a time, will block until the old thread has finished otherwise
+ * @brief Runs the DiagnosticsWorkflow requests one at a time on a worker thread
+ * @details Requests are queued and the caller returns immediately, so a request arriving during a slow upload doesn't
+ * block the main loop. A request for an operation-id that is already queued or running is dropped.
  */
 class DiagnosticsWorkflowManager
 {
 private:
-    std::thread worker; //!< current thread doing work
+    /**
+     * @brief A queued DiagnosticsWorkflow request
+     */
+    struct Request
+    {
+        const DiagnosticsWorkflowData* workflowData; //!< configuration for the DiagnosticsWorkflow
+        std::string operationId; //!< operation-id of the request, empty if it has none
+        std::string jsonString; //!< the message from the PnP interface
+    };
+
+    std::mutex mutex; //!< guards the members below
+    std::condition_variable queueChanged; //!< signaled when a request is queued or the manager is stopping
+    std::deque<Request> queue; //!< requests waiting for the current one
+    std::string runningOperationId; //!< operation-id of the request being run
+    bool stopping = false; //!< whether the worker thread must exit
+    std::thread worker; //!< thread running the requests, started by the first one
+
+    /**
+     * @brief Runs the queued requests until the manager is stopping
+     */
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock{ mutex };
+
+        for (;;)
+        {
+            queueChanged.wait(lock, [this] { return stopping || !queue.empty(); });
+
+            if (stopping)
+            {
+                return;
+            }
+
+            Request request = std::move(queue.front());
+            queue.pop_front();
+            runningOperationId = request.operationId;
+
+            lock.unlock();
+
+            try
+            {
+                //
+                // Required to prevent duplicate requests coming down from the service after
+                // restart or a connection refresh
+                //
+                if (!OperationIdUtils_OperationIsComplete(request.jsonString.c_str()))
+                {
+                    DiagnosticsWorkflow_DiscoverAndUploadLogs(request.workflowData, request.jsonString.c_str());
+                }
+            }
+            catch (const std::exception& e)
+            {
+                Log_Error("DiagnosticsWorkflowManager worker thread failed with exception: %s", e.what());
+            }
+            catch (...)
+            {
+                Log_Error("DiagnosticsWorkflowManager worker thread failed with unknown exception");
+            }
+
+            lock.lock();
+            runningOperationId.clear();
+        }
+    }
 
 public:
     explicit DiagnosticsWorkflowManager() = default;
@@ -34,67 +101,77 @@ public:
     DiagnosticsWorkflowManager& operator=(DiagnosticsWorkflowManager&&) = delete;
 
     /**
-     *@brief Joins the old worker thread if it is still working and then starts a new diagnostics workflow using the parameters passed
+     * @brief Queues a new diagnostics workflow using the parameters passed, and returns without waiting for it
+     * @details When the configuration says so, the requests still waiting are dropped and reported as superseded.
      * @param diagnosticsWorkflowData workflowData struct that describes the configuration for the DiagnosticsWorkflow
-     * @param jsonStringHandle the message from the PnP interface to be parsed for the operation-id and sas-credential
+     * @param jsonString the message from the PnP interface to be parsed for the operation-id and sas-credential
      */
-    void
-    StartDiagnosticsWorkflow(const DiagnosticsWorkflowData* diagnosticsWorkflowData, STRING_HANDLE jsonStringHandle)
+    void StartDiagnosticsWorkflow(const DiagnosticsWorkflowData* diagnosticsWorkflowData, const char* jsonString)
     {
-        try
-        {
-            if (worker.joinable())
-            {
-                worker.join();
-            }
+        ADUC::StringUtils::STRING_HANDLE_wrapper operationIdHandle{ OperationIdUtils_GetOperationId(jsonString) };
+        std::string operationId = operationIdHandle.is_null() ? std::string{} : operationIdHandle.c_str();
 
-            //
-            // Required to prevent duplicate requests coming down from the service after
-            // restart or a connection refresh
-            //
-            if (OperationIdUtils_OperationIsComplete(STRING_c_str(jsonStringHandle)))
-            {
-                return;
-            }
+        std::vector<std::string> supersededOperationIds;
 
-            STRING_HANDLE jsonStringHandleClone = STRING_clone(jsonStringHandle);
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
 
-            std::thread newWorker{ [diagnosticsWorkflowData, jsonStringHandleClone] {
-                ADUC::StringUtils::STRING_HANDLE_wrapper cloneWrapper(jsonStringHandleClone);
+            if (!operationId.empty())
+            {
+                bool duplicate = operationId == runningOperationId;
 
-                try
+                for (const Request& queued : queue)
                 {
-                    DiagnosticsWorkflow_DiscoverAndUploadLogs(diagnosticsWorkflowData, cloneWrapper.c_str());
+                    duplicate = duplicate || operationId == queued.operationId;
                 }
-                catch (const std::exception& e)
+
+                if (duplicate)
                 {
-                    Log_Error("StartNewDiagnosticsWorkflowThread worker thread failed with exception: %s", e.what());
+                    Log_Info("Diagnostics operation-id %s is already queued or running", operationId.c_str());
+                    return;
                 }
-                catch (...)
+            }
+
+            if (diagnosticsWorkflowData != nullptr && diagnosticsWorkflowData->supersedeQueuedRequests)
+            {
+                for (const Request& queued : queue)
                 {
-                    Log_Error("StartNewDiagnosticsWorkflowThread worker thread failed with unknown exception");
+                    supersededOperationIds.push_back(queued.operationId);
                 }
-            } };
 
-            worker = std::move(newWorker);
-        }
-        catch (const std::exception& e)
-        {
-            Log_Error("StartNewDiagnosticsWorkflowThread worker thread failed with exception: %s", e.what());
+                queue.clear();
+            }
+
+            queue.push_back(Request{ diagnosticsWorkflowData, std::move(operationId), jsonString });
+
+            if (!worker.joinable())
+            {
+                worker = std::thread{ [this] { Run(); } };
+            }
         }
-        catch (...)
+
+        queueChanged.notify_one();
+
+        for (const std::string& supersededOperationId : supersededOperationIds)
         {
-            Log_Error("StartNewDiagnosticsWorkflowThread failed with unknown exception");
+            Log_Info("Diagnostics operation-id %s superseded", supersededOperationId.c_str());
+            DiagnosticsInterface_ReportStateAndResultAsync(Diagnostics_Result_Superseded, supersededOperationId.c_str());
         }
-
-        STRING_delete(jsonStringHandle);
     }
 
     /**
-     * @brief Destructor assures that the worker thread will have been joined before exiting
+     * @brief Destructor assures that the worker thread will have finished the current request and been joined before
+     * exiting; the requests still queued are dropped
     */
     ~DiagnosticsWorkflowManager()
     {
+        {
+            std::lock_guard<std::mutex> lock{ mutex };
+            stopping = true;
+        }
+
+        queueChanged.notify_one();
+
         if (worker.joinable())
         {
             worker.join();
@@ -106,18 +183,21 @@ static DiagnosticsWorkflowManager s_DiagnosticsManager;
 
 /**
  * @brief Asynchronously begins the Diagnosticss workflow for discovering and uploading logs
- * @details Only asynchronous when there is not already a thread running a workflow.
+ * @details Returns once the request is queued; requests run one at a time, in order.
  * @param[in] workflowData struct containing the configuration information for the diagnostics component
  * @param[in] jsonString json string from the service contianing the operation-id and sas url
  */
 void DiagnosticsWorkflow_DiscoverAndUploadLogsAsync(
     const DiagnosticsWorkflowData* workflowData, const char* jsonString)
 {
-    try
+    if (jsonString == NULL)
     {
-        STRING_HANDLE jsonStringHandle = STRING_construct(jsonString);
+        return;
+    }
 
-        s_DiagnosticsManager.StartDiagnosticsWorkflow(workflowData, jsonStringHandle);
+    try
+    {
+        s_DiagnosticsManager.StartDiagnosticsWorkflow(workflowData, jsonString);
     }
     catch (const std::exception& e)
     {
@@ -33,12 +33,23 @@ static const char g_diagnosticsPnPComponentOrchestratorPropertyName[] = "service
  */
 ADUC_ClientHandle g_iotHubClientHandleForDiagnosticsComponent = NULL;
 
+/**
+ * @brief The context of the Diagnostics component. Most devices never get a diagnostics request, so the workflow data
+ * is only read from the diagnostics configuration file when the first one arrives.
+ */
+typedef struct tagDiagnosticsInterfaceContext
+{
+    DiagnosticsWorkflowData* workflowData; //!< The workflow data, NULL until the first request.
+} DiagnosticsInterfaceContext;
+
 //
 // DiagnosticsInterface methods
 //
 
 /**
  * @brief Create a DeviceInfoInterface object.
+ * The diagnostics configuration file is read when the first diagnostics request arrives, see
+ * DiagnosticsInterface_GetWorkflowData.
  *
  * @param componentContext Context object to use for related calls.
  * @param argc Count of arguments in @p argv
@@ -50,37 +61,44 @@ _Bool DiagnosticsInterface_Create(void** componentContext, int argc, char** argv
     UNREFERENCED_PARAMETER(argc);
     UNREFERENCED_PARAMETER(argv);
 
-    _Bool succeeded = false;
+    *componentContext = calloc(1, sizeof(DiagnosticsInterfaceContext));
 
-    *componentContext = NULL;
+    return *componentContext != NULL;
+}
+
+/**
+ * @brief Returns the workflow data of @p context, initializing it from the diagnostics configuration file on first
+ * use.
+ *
+ * @param context Context object from Create.
+ * @return DiagnosticsWorkflowData* The workflow data, or NULL if the configuration file can't be read. It is read
+ * again on the next request then.
+ */
+static const DiagnosticsWorkflowData* DiagnosticsInterface_GetWorkflowData(DiagnosticsInterfaceContext* context)
+{
+    if (context->workflowData != NULL)
+    {
+        return context->workflowData;
+    }
 
     DiagnosticsWorkflowData* workflowData = calloc(1, sizeof(DiagnosticsWorkflowData));
 
     if (workflowData == NULL)
     {
-        goto done;
+        return NULL;
     }
 
     if (!DiagnosticsWorkflow_InitFromFile(workflowData, DIAGNOSTICS_CONFIG_FILE_PATH))
     {
         Log_Error("Unable to initialize the diagnostic workflow data.");
-        goto done;
-    }
-
-    succeeded = true;
-
-done:
-
-    if (!succeeded)
-    {
         DiagnosticsWorkflow_UnInit(workflowData);
         free(workflowData);
-        workflowData = NULL;
+        return NULL;
     }
 
-    *componentContext = workflowData;
+    context->workflowData = workflowData;
 
-    return succeeded;
+    return workflowData;
 }
 
 /**
@@ -103,10 +121,15 @@ void DiagnosticsInterface_Destroy(void** componentContext)
         return;
     }
 
-    DiagnosticsWorkflowData* workflowData = (DiagnosticsWorkflowData*)*componentContext;
+    DiagnosticsInterfaceContext* context = (DiagnosticsInterfaceContext*)*componentContext;
+
+    if (context != NULL)
+    {
+        DiagnosticsWorkflow_UnInit(context->workflowData);
+        free(context->workflowData);
+        free(context);
+    }
 
-    DiagnosticsWorkflow_UnInit(workflowData);
-    free(workflowData);
     *componentContext = NULL;
 }
 
@@ -254,11 +277,19 @@ void DiagnosticsOrchestratorUpdateCallback(
         goto done;
     }
 
-    DiagnosticsWorkflow_DiscoverAndUploadLogsAsync(context, jsonString);
+    const DiagnosticsWorkflowData* workflowData = DiagnosticsInterface_GetWorkflowData(context);
+
+    if (workflowData != NULL)
+    {
+        DiagnosticsWorkflow_DiscoverAndUploadLogsAsync(workflowData, jsonString);
+    }
 
     // Ack the request
-    IOTHUB_CLIENT_RESULT iothubClientResult =
-        SendPnPMessageToIotHubWithStatus(clientHandle, jsonString, PNP_STATUS_SUCCESS, propertyVersion);
+    IOTHUB_CLIENT_RESULT iothubClientResult = SendPnPMessageToIotHubWithStatus(
+        clientHandle,
+        jsonString,
+        workflowData != NULL ? PNP_STATUS_SUCCESS : PNP_STATUS_INTERNAL_ERROR,
+        propertyVersion);
 
     if (iothubClientResult != IOTHUB_CLIENT_OK)
     {
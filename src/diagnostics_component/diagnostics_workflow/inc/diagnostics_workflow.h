@@ -30,6 +30,7 @@ typedef struct tagDiagnosticLogComponent
 {
     STRING_HANDLE componentName; //!< Name of the component for which to collect logs
     STRING_HANDLE logPath; //!< Absolute path to the directory where the logs are stored
+    STRING_HANDLE logFileName; //!< The one file of logPath to upload rather than its newest files; NULL for those
 } DiagnosticsLogComponent;
 
 /**
@@ -39,6 +40,11 @@ typedef struct tagDiagnosticWorkflowData
 {
     VECTOR_HANDLE components; //!< Vector of DiagnosticLogComponent pointers for which to collect logs
     unsigned int maxBytesToUploadPerLogPath; //!< The maximum number of bytes to upload per log file path
+    unsigned int maxConcurrentComponentUploads; //!< The maximum number of components whose logs are uploaded at once
+    unsigned int maxConcurrencyPerUpload; //!< The maximum number of blocks of a file uploaded at once
+    _Bool compressLogs; //!< Whether each component's logs are uploaded as a single compressed archive
+    _Bool incrementalUploads; //!< Whether only the bytes appended to logs since the previous upload are uploaded
+    _Bool supersedeQueuedRequests; //!< Whether a new request drops the requests still waiting for the current upload
 } DiagnosticsWorkflowData;
 
 /**
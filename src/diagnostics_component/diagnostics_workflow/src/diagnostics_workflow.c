@@ -15,10 +15,15 @@
 #include <diagnostics_devicename.h>
 #include <diagnostics_interface.h>
 #include <file_info_utils.h>
+#include <log_archive_utils.h>
 #include <operation_id_utils.h>
 #include <parson_json_utils.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h> // for strchr
+#include <sys/stat.h>
+#include <upload_manifest_utils.h>
 
 /**
  * Expected Diagnostics Config file format:
@@ -32,9 +37,19 @@
                 "componentName":"DO",
                 "logPath":"/var/cache/do/"
             },
+            {
+                "componentName":"DU-workflow",
+                "logPath":"/var/logs/adu/",
+                "logFileName":"du-workflow.log.gz"      (optional)
+            },
             ...
         ],
-        "maxKilobytesToUploadPerLogPath":5
+        "maxKilobytesToUploadPerLogPath":5,
+        "maxConcurrentComponentUploads":4,      (optional)
+        "maxConcurrencyPerUpload":4,            (optional)
+        "compressLogs":false,                   (optional)
+        "incrementalUploads":false,             (optional)
+        "supersedeQueuedRequests":false         (optional)
     }
  */
 
@@ -53,16 +68,61 @@
  */
 #define DIAGNOSTICS_CONFIG_FILE_COMPONENT_FIELDNAME_LOGPATH "logPath"
 
+/**
+ * @brief Fieldname for the one file of the log path to upload for a component, rather than its newest files
+ */
+#define DIAGNOSTICS_CONFIG_FILE_COMPONENT_FIELDNAME_LOGFILENAME "logFileName"
+
 /**
  * @brief Fieldname for the maximum number of bytes to upload per diagnostics workflow
  */
 #define DIAGNOSTICS_CONFIG_FILE_FIELDNAME_MAXKILOBYTESTOUPLOADPERLOGPATH "maxKilobytesToUploadPerLogPath"
 
+/**
+ * @brief Fieldname for the maximum number of components whose logs are uploaded at once
+ */
+#define DIAGNOSTICS_CONFIG_FILE_FIELDNAME_MAXCONCURRENTCOMPONENTUPLOADS "maxConcurrentComponentUploads"
+
+/**
+ * @brief Fieldname for the maximum number of blocks of a file uploaded at once
+ */
+#define DIAGNOSTICS_CONFIG_FILE_FIELDNAME_MAXCONCURRENCYPERUPLOAD "maxConcurrencyPerUpload"
+
+/**
+ * @brief Fieldname for whether each component's logs are uploaded as a single compressed archive
+ */
+#define DIAGNOSTICS_CONFIG_FILE_FIELDNAME_COMPRESSLOGS "compressLogs"
+
+/**
+ * @brief Fieldname for whether only the bytes appended to logs since the previous upload are uploaded
+ */
+#define DIAGNOSTICS_CONFIG_FILE_FIELDNAME_INCREMENTALUPLOADS "incrementalUploads"
+
+/**
+ * @brief Fieldname for whether a new request drops the requests still waiting for the current upload
+ */
+#define DIAGNOSTICS_CONFIG_FILE_FIELDNAME_SUPERSEDEQUEUEDREQUESTS "supersedeQueuedRequests"
+
 /**
  * @brief Maximum number of kilobytes allowed to be uploaded per log path
  */
 #define DIAGNOSTICS_MAX_KILOBYTES_PER_LOG_PATH 100000 /* 1000 KB or 100 MB */
 
+/**
+ * @brief Number of components whose logs are uploaded at once when the config doesn't say
+ */
+#define DIAGNOSTICS_DEFAULT_CONCURRENT_COMPONENT_UPLOADS 4
+
+/**
+ * @brief Number of blocks of a file uploaded at once when the config doesn't say
+ */
+#define DIAGNOSTICS_DEFAULT_CONCURRENCY_PER_UPLOAD 4
+
+/**
+ * @brief Upper bound for both maxConcurrentComponentUploads and maxConcurrencyPerUpload
+ */
+#define DIAGNOSTICS_MAX_CONCURRENCY 16
+
 /**
  * @brief Returns the DiagnosticsLogComponent object @p index within @p workflowData
  * @param workflowData the DiagnosticsWorkflowData vector from which to get the DiagnosticsComponent
@@ -95,6 +155,9 @@ void DiagnosticsWorkflow_LogComponentUninit(DiagnosticsLogComponent* logComponen
 
     STRING_delete(logComponent->logPath);
     logComponent->logPath = NULL;
+
+    STRING_delete(logComponent->logFileName);
+    logComponent->logFileName = NULL;
 }
 
 /**
@@ -173,6 +236,7 @@ _Bool DiagnosticsComponent_LogComponentInitFromObj(DiagnosticsLogComponent* comp
     _Bool succeeded = false;
     char* componentName = NULL;
     char* logPath = NULL;
+    char* logFileName = NULL;
 
     if (!ADUC_JSON_GetStringFieldFromObj(
             componentObj, DIAGNOSTICS_CONFIG_FILE_COMPONENT_FIELDNAME_COMPONENTNAME, &componentName))
@@ -199,6 +263,24 @@ _Bool DiagnosticsComponent_LogComponentInitFromObj(DiagnosticsLogComponent* comp
         goto done;
     }
 
+    // Optional.
+    if (ADUC_JSON_GetStringFieldFromObj(
+            componentObj, DIAGNOSTICS_CONFIG_FILE_COMPONENT_FIELDNAME_LOGFILENAME, &logFileName))
+    {
+        if (logFileName[0] == '\0' || strchr(logFileName, '/') != NULL)
+        {
+            Log_Warn("DiagnosticsComponent_LogComponentInitFromObj invalid logFileName: %s", logFileName);
+            goto done;
+        }
+
+        component->logFileName = STRING_construct(logFileName);
+
+        if (component->logFileName == NULL)
+        {
+            goto done;
+        }
+    }
+
     succeeded = true;
 
 done:
@@ -210,6 +292,7 @@ done:
 
     free(componentName);
     free(logPath);
+    free(logFileName);
 
     return succeeded;
 }
@@ -243,6 +326,26 @@ _Bool DiagnosticsWorkflow_InitFromFile(DiagnosticsWorkflowData* workflowData, co
     return succeeded;
 }
 
+/**
+ * @brief Reads the optional concurrency setting @p fieldName from the diagnostics config
+ * @param fileJsonValue a JSON_Value representation of a diagnostics-config.json file
+ * @param fieldName name of the field to read
+ * @param defaultValue value to use when the field is absent or invalid
+ * @returns the setting, between 1 and DIAGNOSTICS_MAX_CONCURRENCY
+ */
+static unsigned int
+DiagnosticsWorkflow_GetConcurrencyField(const JSON_Value* fileJsonValue, const char* fieldName, unsigned int defaultValue)
+{
+    unsigned int value = 0;
+
+    if (!ADUC_JSON_GetUnsignedIntegerField(fileJsonValue, fieldName, &value) || value < 1)
+    {
+        return defaultValue;
+    }
+
+    return (value > DIAGNOSTICS_MAX_CONCURRENCY) ? DIAGNOSTICS_MAX_CONCURRENCY : value;
+}
+
 /**
  * @brief Initializes @p workflowData with the contents of @p fileJsonValue
  * @param workflowData the structure to be initialized
@@ -293,6 +396,23 @@ _Bool DiagnosticsWorkflow_InitFromJSON(DiagnosticsWorkflowData* workflowData, JS
 
     workflowData->maxBytesToUploadPerLogPath = maxKilobytesToUploadPerLogPath * 1024;
 
+    workflowData->maxConcurrentComponentUploads = DiagnosticsWorkflow_GetConcurrencyField(
+        fileJsonValue,
+        DIAGNOSTICS_CONFIG_FILE_FIELDNAME_MAXCONCURRENTCOMPONENTUPLOADS,
+        DIAGNOSTICS_DEFAULT_CONCURRENT_COMPONENT_UPLOADS);
+
+    workflowData->maxConcurrencyPerUpload = DiagnosticsWorkflow_GetConcurrencyField(
+        fileJsonValue, DIAGNOSTICS_CONFIG_FILE_FIELDNAME_MAXCONCURRENCYPERUPLOAD, DIAGNOSTICS_DEFAULT_CONCURRENCY_PER_UPLOAD);
+
+    workflowData->compressLogs =
+        ADUC_JSON_GetBooleanField(fileJsonValue, DIAGNOSTICS_CONFIG_FILE_FIELDNAME_COMPRESSLOGS);
+
+    workflowData->incrementalUploads =
+        ADUC_JSON_GetBooleanField(fileJsonValue, DIAGNOSTICS_CONFIG_FILE_FIELDNAME_INCREMENTALUPLOADS);
+
+    workflowData->supersedeQueuedRequests =
+        ADUC_JSON_GetBooleanField(fileJsonValue, DIAGNOSTICS_CONFIG_FILE_FIELDNAME_SUPERSEDEQUEUEDREQUESTS);
+
     JSON_Array* componentArray = json_object_get_array(fileJsonObj, DIAGNOSTICS_CONFIG_FILE_LOG_COMPONENTS_FIELDNAME);
 
     if (componentArray == NULL)
@@ -372,8 +492,66 @@ void DiagnosticsWorkflow_UnInit(DiagnosticsWorkflowData* workflowData)
     memset(workflowData, 0, sizeof(*workflowData));
 }
 
+/**
+ * @brief Stores the one file of @p logComponent in @p fileNames, without scanning its log path
+ * @param fileNames vector to be filled with the file, if it exists and isn't empty
+ * @param logComponent descriptor for the component, whose logFileName is set
+ * @param maxUploadSize maximum number of bytes of logs allowed to be uploaded
+ * @returns true if the file is to be uploaded; false otherwise
+ */
+static _Bool DiagnosticsWorkflow_GetLogFileForComponent(
+    VECTOR_HANDLE* fileNames, const DiagnosticsLogComponent* logComponent, const unsigned int maxUploadSize)
+{
+    _Bool succeeded = false;
+    VECTOR_HANDLE fileVector = NULL;
+    STRING_HANDLE fileName = NULL;
+    STRING_HANDLE filePath = STRING_construct_sprintf(
+        "%s/%s", STRING_c_str(logComponent->logPath), STRING_c_str(logComponent->logFileName));
+    struct stat st;
+
+    if (filePath == NULL || stat(STRING_c_str(filePath), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        goto done;
+    }
+
+    if ((unsigned long long)st.st_size > maxUploadSize)
+    {
+        Log_Warn(
+            "%s is larger than the upload limit of %u bytes, not uploading it", STRING_c_str(filePath), maxUploadSize);
+        goto done;
+    }
+
+    fileVector = VECTOR_create(sizeof(STRING_HANDLE));
+    fileName = STRING_clone(logComponent->logFileName);
+
+    if (fileVector == NULL || fileName == NULL || VECTOR_push_back(fileVector, &fileName, 1) != 0)
+    {
+        goto done;
+    }
+
+    fileName = NULL;
+    succeeded = true;
+
+done:
+
+    if (!succeeded)
+    {
+        VECTOR_destroy(fileVector);
+        fileVector = NULL;
+    }
+
+    STRING_delete(fileName);
+    STRING_delete(filePath);
+
+    *fileNames = fileVector;
+
+    return succeeded;
+}
+
 /**
  * @brief Discovers the logs described by @p logComponent and stores them in @p fileNames
+ * @details A component with a logFileName uploads just that file, e.g. the log the agent keeps of the last update
+ * workflow, rather than the newest files of its log path.
  * @param fileNames vector to be filled with the files to be uploaded for @p logComponent
  * @param logComponent descriptor for the component for which we're going to discover logs
  * @param maxUploadSize maximum number of bytes of logs allowed to be discovered for upload
@@ -389,7 +567,11 @@ Diagnostics_Result DiagnosticsWorkflow_GetFilesForComponent(
 
     Diagnostics_Result result = Diagnostics_Result_Failure;
 
-    if (!FileInfoUtils_GetNewestFilesInDirUnderSize(fileNames, STRING_c_str(logComponent->logPath), maxUploadSize))
+    const _Bool found = (logComponent->logFileName != NULL)
+        ? DiagnosticsWorkflow_GetLogFileForComponent(fileNames, logComponent, maxUploadSize)
+        : FileInfoUtils_GetNewestFilesInDirUnderSize(fileNames, STRING_c_str(logComponent->logPath), maxUploadSize);
+
+    if (!found)
     {
         result = Diagnostics_Result_NoLogsFound;
         Log_Debug(
@@ -405,6 +587,170 @@ done:
     return result;
 }
 
+/**
+ * @brief Sets @p filePath to the path of the file @p fileName within @p logPath
+ * @returns true on success; false on failures
+ */
+static _Bool DiagnosticsWorkflow_SetLogFilePath(STRING_HANDLE filePath, const char* logPath, STRING_HANDLE fileName)
+{
+    // STRING_sprintf appends, so the previous path is cleared first.
+    return STRING_empty(filePath) == 0 && STRING_sprintf(filePath, "%s/%s", logPath, STRING_c_str(fileName)) == 0;
+}
+
+/**
+ * @brief Uploads the bytes of the files in @p fileNames that @p manifest doesn't record as uploaded yet
+ * @details Each file's tail is uploaded as a blob named after the file, or as an entry of the component's
+ * archive when @p archiveBlobName is set. @p manifest is updated once all of them are uploaded.
+ * @param fileNames vector of files to be uploaded for @p logComponent
+ * @param logComponent descriptor for the component for which we're going to upload logs
+ * @param blobInfo the storage credential and the virtual directory to upload the files to
+ * @param archiveBlobName name of the archive blob when the logs are compressed; NULL otherwise
+ * @param manifest the manifest of the bytes already uploaded
+ * @returns a value of Diagnostics_Result indicating the status of this component's upload
+ */
+static Diagnostics_Result DiagnosticsWorkflow_UploadNewBytesForComponent(
+    VECTOR_HANDLE fileNames,
+    const DiagnosticsLogComponent* logComponent,
+    const BlobStorageInfo* blobInfo,
+    const char* archiveBlobName,
+    UploadManifest* manifest)
+{
+    Diagnostics_Result result = Diagnostics_Result_Failure;
+    const char* logPath = STRING_c_str(logComponent->logPath);
+    STRING_HANDLE filePath = STRING_new();
+    STRING_HANDLE blobName = STRING_new();
+    VECTOR_HANDLE ranges = VECTOR_create(sizeof(LogArchiveUtils_FileRange));
+    VECTOR_HANDLE inodes = VECTOR_create(sizeof(unsigned long long));
+
+    if (filePath == NULL || blobName == NULL || ranges == NULL || inodes == NULL)
+    {
+        goto done;
+    }
+
+    const size_t fileCount = VECTOR_size(fileNames);
+    for (size_t i = 0; i < fileCount; ++i)
+    {
+        const STRING_HANDLE* fileName = VECTOR_element(fileNames, i);
+        struct stat st;
+
+        if (!DiagnosticsWorkflow_SetLogFilePath(filePath, logPath, *fileName))
+        {
+            goto done;
+        }
+
+        if (stat(STRING_c_str(filePath), &st) != 0)
+        {
+            continue;
+        }
+
+        const unsigned long long inode = (unsigned long long)st.st_ino;
+        LogArchiveUtils_FileRange range = {
+            .offset = UploadManifest_GetUploadOffset(manifest, STRING_c_str(filePath), inode, (long long)st.st_size),
+        };
+
+        range.length = (long long)st.st_size - range.offset;
+        if (range.length == 0)
+        {
+            continue;
+        }
+
+        range.fileName = STRING_clone(*fileName);
+        if (range.fileName == NULL)
+        {
+            goto done;
+        }
+
+        if (VECTOR_push_back(ranges, &range, 1) != 0)
+        {
+            STRING_delete(range.fileName);
+            goto done;
+        }
+
+        if (VECTOR_push_back(inodes, &inode, 1) != 0)
+        {
+            goto done;
+        }
+    }
+
+    const size_t rangeCount = VECTOR_size(ranges);
+    if (rangeCount == 0)
+    {
+        Log_Info("No new logs to upload for logComponent: %s", STRING_c_str(logComponent->componentName));
+        result = Diagnostics_Result_Success;
+        goto done;
+    }
+
+    if (archiveBlobName != NULL)
+    {
+        if (!LogArchiveUtils_UploadRangesAsArchive(
+                STRING_c_str(blobInfo->storageSasCredential), archiveBlobName, ranges, logPath))
+        {
+            result = Diagnostics_Result_UploadFailed;
+            goto done;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < rangeCount; ++i)
+        {
+            const LogArchiveUtils_FileRange* range = VECTOR_element(ranges, i);
+
+            if (!DiagnosticsWorkflow_SetLogFilePath(filePath, logPath, range->fileName)
+                || STRING_copy(blobName, STRING_c_str(blobInfo->virtualDirectoryPath)) != 0
+                || STRING_concat_with_STRING(blobName, range->fileName) != 0)
+            {
+                goto done;
+            }
+
+            if (!LogArchiveUtils_UploadFileRange(
+                    STRING_c_str(blobInfo->storageSasCredential),
+                    STRING_c_str(blobName),
+                    STRING_c_str(filePath),
+                    range->offset,
+                    range->length))
+            {
+                result = Diagnostics_Result_UploadFailed;
+                goto done;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < rangeCount; ++i)
+    {
+        const LogArchiveUtils_FileRange* range = VECTOR_element(ranges, i);
+        const unsigned long long* inode = VECTOR_element(inodes, i);
+
+        if (!DiagnosticsWorkflow_SetLogFilePath(filePath, logPath, range->fileName)
+            || !UploadManifest_SetUploadOffset(
+                manifest, STRING_c_str(filePath), *inode, range->offset + range->length))
+        {
+            Log_Warn("Unable to record the upload of %s", STRING_c_str(range->fileName));
+        }
+    }
+
+    result = Diagnostics_Result_Success;
+
+done:
+    if (ranges != NULL)
+    {
+        for (size_t i = 0; i < VECTOR_size(ranges); ++i)
+        {
+            LogArchiveUtils_FileRange* range = VECTOR_element(ranges, i);
+
+            STRING_delete(range->fileName);
+        }
+
+        VECTOR_destroy(ranges);
+    }
+
+    VECTOR_destroy(inodes);
+
+    STRING_delete(blobName);
+    STRING_delete(filePath);
+
+    return result;
+}
+
 /**
  * @brief Uploads the logs held within @p fileNames described by @p logComponent
  * @param fileNames vector of files to be uploaded for @p logComponent
@@ -412,6 +758,9 @@ done:
  * @param deviceName name of the device the DiagnosticsWorkflow is running on
  * @param operationId the id associated with this upload request sent down by Diagnostics Service
  * @param storageSasUrl credential to be used for the Azure Blob Storage upload
+ * @param maxConcurrency maximum number of blocks of a file uploaded at once
+ * @param compressLogs whether to upload the files as a single <component-name>.tar.gz archive
+ * @param manifest when not NULL, only the bytes it doesn't record as uploaded are uploaded, and it is updated
  * @returns a value of Diagnostics_Result indicating the status of this component's upload
  */
 Diagnostics_Result DiagnosticsWorkflow_UploadFilesForComponent(
@@ -419,7 +768,10 @@ Diagnostics_Result DiagnosticsWorkflow_UploadFilesForComponent(
     const DiagnosticsLogComponent* logComponent,
     const char* deviceName,
     const char* operationId,
-    const char* storageSasUrl)
+    const char* storageSasUrl,
+    unsigned int maxConcurrency,
+    _Bool compressLogs,
+    UploadManifest* manifest)
 {
     if (fileNames == NULL || logComponent == NULL || deviceName == NULL || operationId == NULL
         || storageSasUrl == NULL)
@@ -431,6 +783,7 @@ Diagnostics_Result DiagnosticsWorkflow_UploadFilesForComponent(
     Diagnostics_Result result = Diagnostics_Result_Failure;
 
     BlobStorageInfo blobInfo = {};
+    STRING_HANDLE archiveBlobName = NULL;
 
     if (logComponent->componentName == NULL || logComponent->logPath == NULL)
     {
@@ -459,8 +812,49 @@ Diagnostics_Result DiagnosticsWorkflow_UploadFilesForComponent(
         goto done;
     }
 
-    if (!AzureBlobStorageFileUploadUtility_UploadFilesToContainer(
-            &blobInfo, 1, fileNames, STRING_c_str(logComponent->logPath)))
+    if (compressLogs)
+    {
+        // Archive blob name: <device-name>/<operation-id>/<component-name>/<component-name>.tar.gz
+        archiveBlobName = STRING_construct_sprintf(
+            "%s%s.tar.gz", STRING_c_str(blobInfo.virtualDirectoryPath), STRING_c_str(logComponent->componentName));
+
+        if (archiveBlobName == NULL)
+        {
+            goto done;
+        }
+    }
+
+    if (manifest != NULL)
+    {
+        result = DiagnosticsWorkflow_UploadNewBytesForComponent(
+            fileNames, logComponent, &blobInfo, STRING_c_str(archiveBlobName), manifest);
+
+        if (result != Diagnostics_Result_Success)
+        {
+            Log_Warn(
+                "DiagnosticsWorkflow_UploadFilesForComponent Incremental upload failed for logComponent: %s",
+                STRING_c_str(logComponent->componentName));
+        }
+        goto done;
+    }
+
+    if (compressLogs)
+    {
+        if (!LogArchiveUtils_UploadFilesAsArchive(
+                STRING_c_str(blobInfo.storageSasCredential),
+                STRING_c_str(archiveBlobName),
+                fileNames,
+                STRING_c_str(logComponent->logPath)))
+        {
+            result = Diagnostics_Result_UploadFailed;
+            Log_Warn(
+                "DiagnosticsWorkflow_UploadFilesForComponent Archive upload failed for logComponent: %s",
+                STRING_c_str(logComponent->componentName));
+            goto done;
+        }
+    }
+    else if (!AzureBlobStorageFileUploadUtility_UploadFilesToContainer(
+                 &blobInfo, (int)maxConcurrency, fileNames, STRING_c_str(logComponent->logPath)))
     {
         result = Diagnostics_Result_UploadFailed;
         Log_Warn(
@@ -472,6 +866,8 @@ Diagnostics_Result DiagnosticsWorkflow_UploadFilesForComponent(
     result = Diagnostics_Result_Success;
 done:
 
+    STRING_delete(archiveBlobName);
+
     STRING_delete(blobInfo.virtualDirectoryPath);
     blobInfo.virtualDirectoryPath = NULL;
 
@@ -511,6 +907,131 @@ void DiagnosticsWorkflow_UnInitLogComponentFileNames(VECTOR_HANDLE logComponentF
     }
 }
 
+/**
+ * @brief State shared by the threads uploading the logs of the components of a workflow
+ */
+typedef struct tagDiagnosticsWorkflow_UploadContext
+{
+    const DiagnosticsWorkflowData* workflowData; //!< The log components
+    VECTOR_HANDLE logComponentFileNames; //!< The files to upload for each component
+    const char* deviceName; //!< Name of the device
+    const char* operationId; //!< The id of this upload request
+    const char* storageSasUrl; //!< Credential for the Azure Blob Storage upload
+    UploadManifest* manifest; //!< The bytes already uploaded when uploads are incremental; NULL otherwise
+    pthread_mutex_t mutex; //!< Protects the members below
+    size_t nextComponent; //!< Index of the next component to upload
+    Diagnostics_Result result; //!< Diagnostics_Result_Success, or the result of the first failed upload
+} DiagnosticsWorkflow_UploadContext;
+
+/**
+ * @brief Uploads the logs of the components of @p context until none is left or an upload fails
+ * @param context the DiagnosticsWorkflow_UploadContext shared with the other upload threads
+ * @returns NULL
+ */
+static void* DiagnosticsWorkflow_UploadWorker(void* context)
+{
+    DiagnosticsWorkflow_UploadContext* uploadContext = (DiagnosticsWorkflow_UploadContext*)context;
+    const size_t numComponents = VECTOR_size(uploadContext->workflowData->components);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&uploadContext->mutex);
+
+        // Stop at the first failure, as the workflow reports only one result.
+        const size_t index = uploadContext->nextComponent;
+        const _Bool done = uploadContext->result != Diagnostics_Result_Success || index >= numComponents;
+        if (!done)
+        {
+            ++uploadContext->nextComponent;
+        }
+
+        pthread_mutex_unlock(&uploadContext->mutex);
+
+        if (done)
+        {
+            break;
+        }
+
+        Diagnostics_Result result = Diagnostics_Result_Failure;
+        const DiagnosticsLogComponent* logComponent =
+            DiagnosticsWorkflow_GetLogComponentElem(uploadContext->workflowData, index);
+        const VECTOR_HANDLE* discoveredLogFileNames = VECTOR_element(uploadContext->logComponentFileNames, index);
+
+        if (logComponent != NULL && discoveredLogFileNames != NULL)
+        {
+            result = DiagnosticsWorkflow_UploadFilesForComponent(
+                *discoveredLogFileNames,
+                logComponent,
+                uploadContext->deviceName,
+                uploadContext->operationId,
+                uploadContext->storageSasUrl,
+                uploadContext->workflowData->maxConcurrencyPerUpload,
+                uploadContext->workflowData->compressLogs,
+                uploadContext->manifest);
+        }
+
+        if (result != Diagnostics_Result_Success)
+        {
+            pthread_mutex_lock(&uploadContext->mutex);
+            if (uploadContext->result == Diagnostics_Result_Success)
+            {
+                uploadContext->result = result;
+            }
+            pthread_mutex_unlock(&uploadContext->mutex);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Uploads the logs of all components of @p uploadContext with up to maxConcurrentComponentUploads threads
+ * @param uploadContext the upload state, whose mutex is initialized here
+ * @returns Diagnostics_Result_Success, or the result of the first failed upload
+ */
+static Diagnostics_Result DiagnosticsWorkflow_UploadAllComponents(DiagnosticsWorkflow_UploadContext* uploadContext)
+{
+    pthread_t workers[DIAGNOSTICS_MAX_CONCURRENCY];
+    size_t numWorkers = VECTOR_size(uploadContext->workflowData->components);
+
+    if (numWorkers > uploadContext->workflowData->maxConcurrentComponentUploads)
+    {
+        numWorkers = uploadContext->workflowData->maxConcurrentComponentUploads;
+    }
+
+    if (numWorkers > DIAGNOSTICS_MAX_CONCURRENCY)
+    {
+        numWorkers = DIAGNOSTICS_MAX_CONCURRENCY;
+    }
+
+    if (pthread_mutex_init(&uploadContext->mutex, NULL) != 0)
+    {
+        return Diagnostics_Result_Failure;
+    }
+
+    uploadContext->nextComponent = 0;
+    uploadContext->result = Diagnostics_Result_Success;
+
+    // The calling thread is one of the workers; when a thread can't be created, the others pick up its share.
+    size_t numStarted = 0;
+    while (numStarted + 1 < numWorkers
+           && pthread_create(&workers[numStarted], NULL, DiagnosticsWorkflow_UploadWorker, uploadContext) == 0)
+    {
+        ++numStarted;
+    }
+
+    DiagnosticsWorkflow_UploadWorker(uploadContext);
+
+    for (size_t i = 0; i < numStarted; ++i)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&uploadContext->mutex);
+
+    return uploadContext->result;
+}
+
 /**
  * @brief Uploads the diagnostic logs described by @p workflowData
  * @param workflowData the workflowData structure describing the log components
@@ -531,6 +1052,8 @@ void DiagnosticsWorkflow_DiscoverAndUploadLogs(const DiagnosticsWorkflowData* wo
 
     VECTOR_HANDLE logComponentFileNames = NULL;
 
+    UploadManifest* manifest = NULL;
+
     if (jsonString == NULL)
     {
         goto done;
@@ -628,40 +1151,35 @@ void DiagnosticsWorkflow_DiscoverAndUploadLogs(const DiagnosticsWorkflowData* wo
         }
     }
 
-    //
-    // Perform Upload
-    //
-    for (size_t i = 0; i < numComponents; ++i)
+    if (workflowData->incrementalUploads)
     {
-        const DiagnosticsLogComponent* logComponent = DiagnosticsWorkflow_GetLogComponentElem(workflowData, i);
-
-        if (logComponent == NULL || logComponent->componentName == NULL || logComponent->logPath == NULL)
-        {
-            Log_Error("DiagnosticsWorkflow_UploadLogs WorkflowData has uninitialized components");
-            goto done;
-        }
-
-        const VECTOR_HANDLE* discoveredLogFileNames = VECTOR_element(logComponentFileNames, i);
+        manifest = UploadManifest_Load(DIAGNOSTICS_UPLOAD_MANIFEST_FILE_PATH);
 
-        if (discoveredLogFileNames == NULL)
-        {
-            goto done;
-        }
-
-        result = DiagnosticsWorkflow_UploadFilesForComponent(
-            *discoveredLogFileNames,
-            logComponent,
-            deviceName,
-            STRING_c_str(operationId),
-            STRING_c_str(storageSasCredential));
-
-        if (result != Diagnostics_Result_Success)
+        if (manifest == NULL)
         {
             goto done;
         }
     }
 
-    result = Diagnostics_Result_Success;
+    //
+    // Perform Upload
+    //
+    DiagnosticsWorkflow_UploadContext uploadContext = {
+        .workflowData = workflowData,
+        .logComponentFileNames = logComponentFileNames,
+        .deviceName = deviceName,
+        .operationId = STRING_c_str(operationId),
+        .storageSasUrl = STRING_c_str(storageSasCredential),
+        .manifest = manifest,
+    };
+
+    result = DiagnosticsWorkflow_UploadAllComponents(&uploadContext);
+
+    // Components uploaded before a failure are recorded too, so they aren't uploaded again.
+    if (manifest != NULL && !UploadManifest_Save(manifest, DIAGNOSTICS_UPLOAD_MANIFEST_FILE_PATH))
+    {
+        Log_Warn("Unable to store the diagnostics upload manifest");
+    }
 
 done:
 
@@ -692,6 +1210,8 @@ done:
         VECTOR_destroy(logComponentFileNames);
     }
 
+    UploadManifest_Free(manifest);
+
     free(deviceName);
 
     STRING_delete(operationId);
@@ -81,6 +81,7 @@ TEST_CASE("DiagnosticsWorkflow_Init")
         CHECK(firstLogComponent != nullptr);
         CHECK(strcmp(STRING_c_str(firstLogComponent->componentName), "DU") == 0);
         CHECK(strcmp(STRING_c_str(firstLogComponent->logPath), ADUC_LOG_FOLDER) == 0);
+        CHECK(firstLogComponent->logFileName == nullptr);
 
         const DiagnosticsLogComponent* secondLogComponent =
             DiagnosticsWorkflow_GetLogComponentElem(&testHelper.workflowData, 1);
@@ -90,6 +91,99 @@ TEST_CASE("DiagnosticsWorkflow_Init")
         CHECK(strcmp(STRING_c_str(secondLogComponent->logPath), "/var/cache/do/") == 0);
 
         CHECK(testHelper.workflowData.maxBytesToUploadPerLogPath == (maxKilobytesToUploadPerLogPath * 1024));
+
+        // Defaults, as the config doesn't set them.
+        CHECK(testHelper.workflowData.maxConcurrentComponentUploads == 4);
+        CHECK(testHelper.workflowData.maxConcurrencyPerUpload == 4);
+        CHECK_FALSE(testHelper.workflowData.compressLogs);
+        CHECK_FALSE(testHelper.workflowData.incrementalUploads);
+        CHECK_FALSE(testHelper.workflowData.supersedeQueuedRequests);
+    }
+
+    SECTION("DiagnosticsWorkflow_Init- Upload Concurrency")
+    {
+        // clang-format off
+        std::string concurrency = R"({)"
+                                        R"("logComponents":[)"
+                                            R"({)"
+                                                R"("componentName":"DU",)"
+                                                R"("logPath":"/var/logs/adu/")"
+                                            R"(})"
+                                        R"(],)"
+                                        R"("maxKilobytesToUploadPerLogPath":5,)"
+                                        R"("maxConcurrentComponentUploads":2,)"
+                                        R"("maxConcurrencyPerUpload":100)"
+                                    R"(})";
+        // clang-format on
+
+        DiagnosticWorkflowUnitTestHelper testHelper(concurrency.c_str());
+
+        CHECK(DiagnosticsWorkflow_InitFromJSON(&testHelper.workflowData, testHelper.jsonValue));
+
+        CHECK(testHelper.workflowData.maxConcurrentComponentUploads == 2);
+
+        // Capped
+        CHECK(testHelper.workflowData.maxConcurrencyPerUpload == 16);
+    }
+
+    SECTION("DiagnosticsWorkflow_Init- Compressed Incremental Uploads")
+    {
+        // clang-format off
+        std::string compress = R"({)"
+                                    R"("logComponents":[)"
+                                        R"({)"
+                                            R"("componentName":"DU",)"
+                                            R"("logPath":"/var/logs/adu/")"
+                                        R"(})"
+                                    R"(],)"
+                                    R"("maxKilobytesToUploadPerLogPath":5,)"
+                                    R"("compressLogs":true,)"
+                                    R"("incrementalUploads":true,)"
+                                    R"("supersedeQueuedRequests":true)"
+                                R"(})";
+        // clang-format on
+
+        DiagnosticWorkflowUnitTestHelper testHelper(compress.c_str());
+
+        CHECK(DiagnosticsWorkflow_InitFromJSON(&testHelper.workflowData, testHelper.jsonValue));
+
+        CHECK(testHelper.workflowData.compressLogs);
+        CHECK(testHelper.workflowData.incrementalUploads);
+        CHECK(testHelper.workflowData.supersedeQueuedRequests);
+    }
+
+    SECTION("DiagnosticsWorkflow_Init- Log File Name")
+    {
+        // clang-format off
+        std::string logFileName = R"({)"
+                                        R"("logComponents":[)"
+                                            R"({)"
+                                                R"("componentName":"DU-workflow",)"
+                                                R"("logPath":"/var/logs/adu/",)"
+                                                R"("logFileName":"du-workflow.log.gz")"
+                                            R"(})"
+                                        R"(],)"
+                                        R"("maxKilobytesToUploadPerLogPath":5)"
+                                    R"(})";
+        // clang-format on
+
+        DiagnosticWorkflowUnitTestHelper testHelper(logFileName.c_str());
+
+        CHECK(DiagnosticsWorkflow_InitFromJSON(&testHelper.workflowData, testHelper.jsonValue));
+
+        const DiagnosticsLogComponent* logComponent =
+            DiagnosticsWorkflow_GetLogComponentElem(&testHelper.workflowData, 0);
+
+        REQUIRE(logComponent != nullptr);
+        REQUIRE(logComponent->logFileName != nullptr);
+        CHECK(strcmp(STRING_c_str(logComponent->logFileName), "du-workflow.log.gz") == 0);
+
+        // The file must be in the log path.
+        DiagnosticWorkflowUnitTestHelper otherFolderHelper(
+            R"({"logComponents":[{"componentName":"DU","logPath":"/var/logs/adu/","logFileName":"../du.log"}],)"
+            R"("maxKilobytesToUploadPerLogPath":5})");
+
+        CHECK_FALSE(DiagnosticsWorkflow_InitFromJSON(&otherFolderHelper.workflowData, otherFolderHelper.jsonValue));
     }
 
     SECTION("DiagnosticsWorkflow_Init- No logComponents")
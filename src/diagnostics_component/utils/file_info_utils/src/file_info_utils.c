@@ -13,8 +13,10 @@
 #include <azure_c_shared_utility/crt_abstractions.h>
 #include <azure_c_shared_utility/strings.h>
 #include <dirent.h>
+#include <fcntl.h> // for AT_SYMLINK_NOFOLLOW
 #include <math.h>
 #include <stdlib.h>
+#include <string.h> // for memset
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -22,8 +24,9 @@
 /**
  * @brief Maximum amount of files to scan before we quit
  * @details this is to prevent a denial of service attack by some malicious attacker filling the directory with garbage to prevent the diagnostics component from running.
+ * A scanned file costs one fstatat and, only when it is among the newest so far, one heap insertion.
  */
-#define MAX_FILES_TO_SCAN 100
+#define MAX_FILES_TO_SCAN 5000
 
 /**
  * @brief this is the absolute max amount of files we will upload per component non-dependent on size
@@ -85,9 +88,118 @@ bool FileInfoUtils_InsertFileInfoIntoArray(
     return false;
 }
 
+/**
+ * @brief Restores the min-heap order of @p heap, oldest file first, below @p index
+ * @param heap the heap
+ * @param count the number of files in @p heap
+ * @param index the index of the file that may be newer than its children
+ */
+static void FileInfoHeap_SiftDown(FileInfo* heap, size_t count, size_t index)
+{
+    for (;;)
+    {
+        size_t oldest = index;
+        const size_t left = 2 * index + 1;
+        const size_t right = left + 1;
+
+        if (left < count && heap[left].lastWrite < heap[oldest].lastWrite)
+        {
+            oldest = left;
+        }
+
+        if (right < count && heap[right].lastWrite < heap[oldest].lastWrite)
+        {
+            oldest = right;
+        }
+
+        if (oldest == index)
+        {
+            return;
+        }
+
+        const FileInfo tmp = heap[index];
+        heap[index] = heap[oldest];
+        heap[oldest] = tmp;
+        index = oldest;
+    }
+}
+
+/**
+ * @brief Restores the min-heap order of @p heap, oldest file first, above @p index
+ * @param heap the heap
+ * @param index the index of the file that may be older than its parents
+ */
+static void FileInfoHeap_SiftUp(FileInfo* heap, size_t index)
+{
+    while (index > 0)
+    {
+        const size_t parent = (index - 1) / 2;
+
+        if (heap[parent].lastWrite <= heap[index].lastWrite)
+        {
+            return;
+        }
+
+        const FileInfo tmp = heap[index];
+        heap[index] = heap[parent];
+        heap[parent] = tmp;
+        index = parent;
+    }
+}
+
+/**
+ * @brief Keeps the candidate in the min-heap @p heap of the @p heapCapacity newest files
+ * @details Once the heap is full, a candidate replaces the oldest file only when it is strictly newer
+ * @param heap the heap
+ * @param heapCapacity the size of @p heap
+ * @param heapCount the number of files in @p heap, updated on insertion
+ * @param candidateFileName the name of the candidate file
+ * @param sizeOfCandidateFile the size of the candidate file
+ * @param candidateLastWrite the lastWrite time of the candidate file
+ * @returns false if out of memory
+ */
+static _Bool FileInfoHeap_Offer(
+    FileInfo* heap,
+    size_t heapCapacity,
+    size_t* heapCount,
+    const char* candidateFileName,
+    unsigned long sizeOfCandidateFile,
+    time_t candidateLastWrite)
+{
+    if (*heapCount == heapCapacity && heap[0].lastWrite >= candidateLastWrite)
+    {
+        return true;
+    }
+
+    char* fileName = NULL;
+
+    if (mallocAndStrcpy_s(&fileName, candidateFileName) != 0)
+    {
+        return false;
+    }
+
+    const FileInfo candidate = { sizeOfCandidateFile, fileName, candidateLastWrite };
+
+    if (*heapCount < heapCapacity)
+    {
+        heap[*heapCount] = candidate;
+        FileInfoHeap_SiftUp(heap, *heapCount);
+        ++(*heapCount);
+    }
+    else
+    {
+        free(heap[0].fileName);
+        heap[0] = candidate;
+        FileInfoHeap_SiftDown(heap, *heapCount, 0);
+    }
+
+    return true;
+}
+
 /**
  * @brief Fills @p logFiles with up to @p logFileSize newest files found in the directory at @p directoryPath
- * @details No spelunking, not recursively searching
+ * @details No spelunking, not recursively searching. Directories, symbolic links, and empty files are skipped.
+ * The newest files are kept in a min-heap while scanning, and @p logFiles is sorted newest to oldest at the end.
  * @param[out] logFiles the array of FileInfo structs that will hold the newest files
  * @param[in] logFileSize the size of @p logFiles
  * @param[in] directoryPath the directory to scan for the newest files
@@ -104,6 +216,7 @@ _Bool FileInfoUtils_FillFileInfoWithNewestFilesInDir(FileInfo* logFiles, size_t
 
     memset(logFiles, 0, sizeof(FileInfo) * logFileSize);
 
+    size_t heapCount = 0;
     unsigned int totalFilesRead = 0;
     DIR* dp = opendir(directoryPath);
 
@@ -112,67 +225,70 @@ _Bool FileInfoUtils_FillFileInfoWithNewestFilesInDir(FileInfo* logFiles, size_t
         goto done;
     }
 
+    const int dirFd = dirfd(dp);
+
     // Walk through each file and find each top level file
-    do
+    while (totalFilesRead < MAX_FILES_TO_SCAN)
     {
         struct dirent* entry = readdir(dp); //Note: No need to free according to man readdir is static
         struct stat statbuf;
 
-        STRING_HANDLE filePath = STRING_new();
-
-        if (filePath == NULL)
-        {
-            goto done;
-        }
-
         if (entry == NULL)
         {
             break;
         }
 
-        if (STRING_sprintf(filePath, "%s/%s", directoryPath, entry->d_name) != 0)
+        // Note: Only care about the first level files that are not symbolic.
+        // d_type lets us skip those without a stat; some file systems report DT_UNKNOWN, which fstatat sorts out.
+        if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN)
         {
             continue;
         }
 
-        if (stat(STRING_c_str(filePath), &statbuf) == -1)
+        if (fstatat(dirFd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1)
         {
-            STRING_delete(filePath);
             continue;
         }
 
-        // Note: Only care about the first level files that are not symbolic
-        if (S_ISDIR(statbuf.st_mode) || S_ISLNK(statbuf.st_mode) || statbuf.st_size == 0)
+        if (!S_ISREG(statbuf.st_mode) || statbuf.st_size == 0)
         {
-            STRING_delete(filePath);
             continue;
         }
 
-        FileInfoUtils_InsertFileInfoIntoArray(logFiles, logFileSize, entry->d_name, statbuf.st_size, statbuf.st_mtime);
+        if (!FileInfoHeap_Offer(
+                logFiles, logFileSize, &heapCount, entry->d_name, statbuf.st_size, statbuf.st_mtime))
+        {
+            goto done;
+        }
 
-        STRING_delete(filePath);
         ++totalFilesRead;
+    }
 
-    } while (totalFilesRead < MAX_FILES_TO_SCAN);
-
-    if (logFiles[0].fileName == NULL)
+    if (heapCount == 0)
     {
         goto done;
     }
 
+    // Sort newest to oldest: move the oldest file of the heap to the end until it is empty.
+    for (size_t remaining = heapCount - 1; remaining > 0; --remaining)
+    {
+        const FileInfo oldest = logFiles[0];
+        logFiles[0] = logFiles[remaining];
+        logFiles[remaining] = oldest;
+        FileInfoHeap_SiftDown(logFiles, remaining, 0);
+    }
+
     succeeded = true;
 
 done:
 
     if (!succeeded)
     {
-        for (int i = 0; i < logFileSize; ++i)
+        for (size_t i = 0; i < logFileSize; ++i)
         {
-            FileInfo logFileEntry = logFiles[i];
-
-            free(logFileEntry.fileName);
+            free(logFiles[i].fileName);
 
-            memset(&logFileEntry, 0, sizeof(FileInfo));
+            memset(&logFiles[i], 0, sizeof(FileInfo));
         }
     }
 
@@ -8,9 +8,15 @@
 #include "file_info_utils.h"
 
 #include <aduc/c_utils.h>
+#include <aduc/system_utils.h>
 #include <catch2/catch.hpp>
 #include <ctime>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h> // for symlink
+#include <utime.h>
 #include <umock_c/umock_c.h>
 
 TEST_CASE("FileInfoUtils_FillFileInfoWithNewestFilesInDir")
@@ -112,3 +118,75 @@ TEST_CASE("FileInfoUtils_FillFileInfoWithNewestFilesInDir")
         CHECK(sortedLogFileArray[0].fileSize == newerFileSize);
     }
 }
+
+static void CreateFileWithLastWrite(const std::string& path, const char* content, time_t lastWrite)
+{
+    {
+        std::ofstream file{ path };
+        file << content;
+    }
+
+    struct utimbuf times = { lastWrite, lastWrite };
+    REQUIRE(utime(path.c_str(), &times) == 0);
+}
+
+TEST_CASE("FileInfoUtils_FillFileInfoWithNewestFilesInDir scans a directory")
+{
+    const std::string testDir{ std::string{ ADUC_SystemUtils_GetTemporaryPathName() } + "/file_info_utils_ut" };
+    (void)ADUC_SystemUtils_RmDirRecursive(testDir.c_str());
+    REQUIRE(ADUC_SystemUtils_MkDirRecursiveDefault(testDir.c_str()) == 0);
+
+    const time_t now = time(nullptr);
+    for (int i = 0; i < 10; ++i)
+    {
+        CreateFileWithLastWrite(testDir + "/file" + std::to_string(i) + ".log", "content", now - 100 + i);
+    }
+
+    // Newer than all the files, but not regular files or empty.
+    CreateFileWithLastWrite(testDir + "/empty.log", "", now);
+    REQUIRE(mkdir((testDir + "/dir").c_str(), S_IRWXU) == 0);
+    REQUIRE(symlink((testDir + "/file0.log").c_str(), (testDir + "/link.log").c_str()) == 0);
+
+    SECTION("Keeps the newest files, newest first")
+    {
+        FileInfo logFiles[3];
+        REQUIRE(FileInfoUtils_FillFileInfoWithNewestFilesInDir(logFiles, 3, testDir.c_str()));
+
+        CHECK(std::string{ logFiles[0].fileName } == "file9.log");
+        CHECK(std::string{ logFiles[1].fileName } == "file8.log");
+        CHECK(std::string{ logFiles[2].fileName } == "file7.log");
+        CHECK(logFiles[0].lastWrite == now - 91);
+        CHECK(logFiles[0].fileSize == 7);
+
+        for (FileInfo& logFile : logFiles)
+        {
+            free(logFile.fileName);
+        }
+    }
+
+    SECTION("Fewer files than requested")
+    {
+        FileInfo logFiles[20];
+        REQUIRE(FileInfoUtils_FillFileInfoWithNewestFilesInDir(logFiles, 20, testDir.c_str()));
+
+        for (int i = 0; i < 10; ++i)
+        {
+            CHECK(std::string{ logFiles[i].fileName } == "file" + std::to_string(9 - i) + ".log");
+        }
+        CHECK(logFiles[10].fileName == nullptr);
+
+        for (FileInfo& logFile : logFiles)
+        {
+            free(logFile.fileName);
+        }
+    }
+
+    SECTION("Missing directory")
+    {
+        FileInfo logFiles[3];
+        CHECK_FALSE(FileInfoUtils_FillFileInfoWithNewestFilesInDir(logFiles, 3, (testDir + "/missing").c_str()));
+        CHECK(logFiles[0].fileName == nullptr);
+    }
+
+    (void)ADUC_SystemUtils_RmDirRecursive(testDir.c_str());
+}
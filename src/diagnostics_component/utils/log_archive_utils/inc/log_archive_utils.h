@@ -0,0 +1,102 @@
+/**
+ * @file log_archive_utils.h
+ * @brief Header file for utilities streaming log files as a compressed tar archive
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <aduc/c_utils.h>
+#include <azure_c_shared_utility/strings.h>
+#include <azure_c_shared_utility/vector.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifndef LOG_ARCHIVE_UTILS_H
+#    define LOG_ARCHIVE_UTILS_H
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief A range of bytes of a log file
+ */
+typedef struct tagLogArchiveUtils_FileRange
+{
+    STRING_HANDLE fileName; //!< Name of the file within the log directory
+    long long offset; //!< Offset of the first byte of the range
+    long long length; //!< Number of bytes in the range
+} LogArchiveUtils_FileRange;
+
+/**
+ * @brief Receives the next @p size bytes of a compressed archive
+ * @param context the context passed to LogArchiveUtils_WriteTarGz
+ * @param data the compressed bytes
+ * @param size the number of bytes in @p data
+ * @returns true on success; false to abort writing the archive
+ */
+typedef _Bool (*LogArchiveUtils_WriteCallback)(void* context, const void* data, size_t size);
+
+/**
+ * @brief Streams the files named in @p fileNames as a gzip compressed tar archive to @p writeCallback
+ * @details Files are read in chunks and compressed on the fly, no copy of the archive is staged on disk.
+ * A file that grows while it is read is cut at the size it had when its entry was started.
+ * @param fileNames vector of STRING_HANDLEs with the names of the files within @p directoryPath
+ * @param directoryPath the directory holding the files
+ * @param writeCallback called with each chunk of the compressed archive
+ * @param context passed to @p writeCallback
+ * @returns true on success; false on failures
+ */
+_Bool LogArchiveUtils_WriteTarGz(
+    VECTOR_HANDLE fileNames, const char* directoryPath, LogArchiveUtils_WriteCallback writeCallback, void* context);
+
+/**
+ * @brief Streams the byte ranges of files described by @p fileRanges as a gzip compressed tar archive to @p writeCallback
+ * @details Each range becomes an entry named after its file, holding exactly the range's length; a file
+ * that is shorter than its range is zero padded.
+ * @param fileRanges vector of LogArchiveUtils_FileRanges of files within @p directoryPath
+ * @param directoryPath the directory holding the files
+ * @param writeCallback called with each chunk of the compressed archive
+ * @param context passed to @p writeCallback
+ * @returns true on success; false on failures
+ */
+_Bool LogArchiveUtils_WriteTarGzRanges(
+    VECTOR_HANDLE fileRanges, const char* directoryPath, LogArchiveUtils_WriteCallback writeCallback, void* context);
+
+/**
+ * @brief Uploads the files named in @p fileNames as a single gzip compressed tar archive to a block blob
+ * @details The archive is staged in blocks as it is produced, so at most one block is held in memory.
+ * @param storageSasUrl SAS URL of the Azure Blob Storage container
+ * @param blobName name of the blob within the container, e.g. <device-name>/<operation-id>/<component-name>.tar.gz
+ * @param fileNames vector of STRING_HANDLEs with the names of the files within @p directoryPath
+ * @param directoryPath the directory holding the files
+ * @returns true on success; false on failures
+ */
+_Bool LogArchiveUtils_UploadFilesAsArchive(
+    const char* storageSasUrl, const char* blobName, VECTOR_HANDLE fileNames, const char* directoryPath);
+
+/**
+ * @brief Uploads the byte ranges of files described by @p fileRanges as a single gzip compressed tar archive to a block blob
+ * @param storageSasUrl SAS URL of the Azure Blob Storage container
+ * @param blobName name of the blob within the container
+ * @param fileRanges vector of LogArchiveUtils_FileRanges of files within @p directoryPath
+ * @param directoryPath the directory holding the files
+ * @returns true on success; false on failures
+ */
+_Bool LogArchiveUtils_UploadRangesAsArchive(
+    const char* storageSasUrl, const char* blobName, VECTOR_HANDLE fileRanges, const char* directoryPath);
+
+/**
+ * @brief Uploads @p length bytes of the file @p filePath, starting at @p offset, to a block blob
+ * @details Uploading stops early if the file is shorter than the range.
+ * @param storageSasUrl SAS URL of the Azure Blob Storage container
+ * @param blobName name of the blob within the container
+ * @param filePath path to the file
+ * @param offset offset of the first byte to upload
+ * @param length number of bytes to upload
+ * @returns true on success; false on failures
+ */
+_Bool LogArchiveUtils_UploadFileRange(
+    const char* storageSasUrl, const char* blobName, const char* filePath, long long offset, long long length);
+
+EXTERN_C_END
+
+#endif // LOG_ARCHIVE_UTILS_H
@@ -0,0 +1,277 @@
+/**
+ * @file log_archive_upload.cpp
+ * @brief Implementation file for uploading a compressed archive of log files to Azure Blob Storage
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#include "log_archive_utils.h"
+
+#include <aduc/download_throttle.h>
+#include <aduc/logging.h>
+#include <algorithm>
+#include <azure/core/base64.hpp>
+#include <azure/core/io/body_stream.hpp>
+#include <azure/storage/blobs.hpp>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Size of the blocks the archive is staged in
+ */
+#define LOG_ARCHIVE_BLOCK_SIZE (4 * 1024 * 1024)
+
+/**
+ * @brief Stages the archive produced by LogArchiveUtils_WriteTarGz in blocks of a block blob
+ */
+class LogArchiveBlockUploader
+{
+private:
+    Azure::Storage::Blobs::BlockBlobClient blobClient; //!< Client for the archive's blob
+    std::vector<uint8_t> block; //!< The block being filled
+    std::vector<std::string> blockIds; //!< Ids of the blocks staged so far, in order
+    ADUC_TransferPriority previousPriority; //!< The transfer priority of the thread before the upload
+
+public:
+    LogArchiveBlockUploader(const std::string& storageSasUrl, const std::string& blobName) :
+        blobClient(Azure::Storage::Blobs::BlobContainerClient(storageSasUrl).GetBlockBlobClient(blobName)),
+        previousPriority(ADUC_DownloadThrottle_GetThreadPriority())
+    {
+        block.reserve(LOG_ARCHIVE_BLOCK_SIZE);
+
+        // Uploads share the link with the update downloads, and yield to them.
+        ADUC_DownloadThrottle_SetThreadPriority(ADUC_TransferPriority_Background);
+    }
+
+    ~LogArchiveBlockUploader()
+    {
+        ADUC_DownloadThrottle_SetThreadPriority(previousPriority);
+    }
+
+    LogArchiveBlockUploader(const LogArchiveBlockUploader&) = delete;
+    LogArchiveBlockUploader& operator=(const LogArchiveBlockUploader&) = delete;
+
+    /**
+     * @brief Appends @p size bytes of @p data to the archive, staging each block once it is full
+     */
+    void Write(const uint8_t* data, size_t size)
+    {
+        while (size > 0)
+        {
+            const size_t chunkSize = std::min(size, static_cast<size_t>(LOG_ARCHIVE_BLOCK_SIZE) - block.size());
+
+            block.insert(block.end(), data, data + chunkSize);
+            data += chunkSize;
+            size -= chunkSize;
+
+            if (block.size() == LOG_ARCHIVE_BLOCK_SIZE)
+            {
+                StageBlock();
+            }
+        }
+    }
+
+    /**
+     * @brief Stages the last block and commits the block list
+     */
+    void Commit()
+    {
+        if (!block.empty() || blockIds.empty())
+        {
+            StageBlock();
+        }
+
+        blobClient.CommitBlockList(blockIds);
+    }
+
+private:
+    void StageBlock()
+    {
+        // All block ids of a blob must have the same length.
+        char blockId[16];
+        snprintf(blockId, sizeof(blockId), "%08zu", blockIds.size());
+
+        const std::string encodedBlockId =
+            Azure::Core::Convert::Base64Encode(std::vector<uint8_t>(blockId, blockId + strlen(blockId)));
+
+        ADUC_DownloadThrottle_Consume(block.size());
+
+        Azure::Core::IO::MemoryBodyStream stream(block.data(), block.size());
+        blobClient.StageBlock(encodedBlockId, stream);
+
+        blockIds.push_back(encodedBlockId);
+        block.clear();
+    }
+};
+
+/**
+ * @brief LogArchiveUtils_WriteCallback handing the archive to a LogArchiveBlockUploader
+ */
+static _Bool LogArchiveUtils_StageArchiveData(void* context, const void* data, size_t size)
+{
+    try
+    {
+        static_cast<LogArchiveBlockUploader*>(context)->Write(static_cast<const uint8_t*>(data), size);
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        Log_Error("Staging the log archive failed with exception: %s", e.what());
+    }
+    catch (...)
+    {
+        Log_Error("Staging the log archive failed with unknown exception");
+    }
+
+    return false;
+}
+
+/**
+ * @brief Uploads the archive written by @p writeArchive to @p blobName
+ * @param storageSasUrl SAS URL of the Azure Blob Storage container
+ * @param blobName name of the blob within the container
+ * @param writeArchive LogArchiveUtils_WriteTarGz or LogArchiveUtils_WriteTarGzRanges
+ * @param entries the files to archive
+ * @param directoryPath the directory holding the files
+ * @returns true on success; false on failures
+ */
+static _Bool LogArchiveUtils_UploadArchive(
+    const char* storageSasUrl,
+    const char* blobName,
+    _Bool (*writeArchive)(VECTOR_HANDLE, const char*, LogArchiveUtils_WriteCallback, void*),
+    VECTOR_HANDLE entries,
+    const char* directoryPath)
+{
+    if (storageSasUrl == nullptr || blobName == nullptr || entries == nullptr || directoryPath == nullptr)
+    {
+        return false;
+    }
+
+    try
+    {
+        LogArchiveBlockUploader uploader(storageSasUrl, blobName);
+
+        if (!writeArchive(entries, directoryPath, LogArchiveUtils_StageArchiveData, &uploader))
+        {
+            Log_Error("Creating the log archive %s failed", blobName);
+            return false;
+        }
+
+        uploader.Commit();
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        Log_Error("Uploading the log archive %s failed with exception: %s", blobName, e.what());
+    }
+    catch (...)
+    {
+        Log_Error("Uploading the log archive %s failed with unknown exception", blobName);
+    }
+
+    return false;
+}
+
+/**
+ * @brief Uploads the files named in @p fileNames as a single gzip compressed tar archive to a block blob
+ * @details The archive is staged in blocks as it is produced, so at most one block is held in memory.
+ * @param storageSasUrl SAS URL of the Azure Blob Storage container
+ * @param blobName name of the blob within the container, e.g. <device-name>/<operation-id>/<component-name>.tar.gz
+ * @param fileNames vector of STRING_HANDLEs with the names of the files within @p directoryPath
+ * @param directoryPath the directory holding the files
+ * @returns true on success; false on failures
+ */
+_Bool LogArchiveUtils_UploadFilesAsArchive(
+    const char* storageSasUrl, const char* blobName, VECTOR_HANDLE fileNames, const char* directoryPath)
+{
+    return LogArchiveUtils_UploadArchive(storageSasUrl, blobName, LogArchiveUtils_WriteTarGz, fileNames, directoryPath);
+}
+
+/**
+ * @brief Uploads the byte ranges of files described by @p fileRanges as a single gzip compressed tar archive to a block blob
+ * @param storageSasUrl SAS URL of the Azure Blob Storage container
+ * @param blobName name of the blob within the container
+ * @param fileRanges vector of LogArchiveUtils_FileRanges of files within @p directoryPath
+ * @param directoryPath the directory holding the files
+ * @returns true on success; false on failures
+ */
+_Bool LogArchiveUtils_UploadRangesAsArchive(
+    const char* storageSasUrl, const char* blobName, VECTOR_HANDLE fileRanges, const char* directoryPath)
+{
+    return LogArchiveUtils_UploadArchive(
+        storageSasUrl, blobName, LogArchiveUtils_WriteTarGzRanges, fileRanges, directoryPath);
+}
+
+/**
+ * @brief Uploads @p length bytes of the file @p filePath, starting at @p offset, to a block blob
+ * @details Uploading stops early if the file is shorter than the range.
+ * @param storageSasUrl SAS URL of the Azure Blob Storage container
+ * @param blobName name of the blob within the container
+ * @param filePath path to the file
+ * @param offset offset of the first byte to upload
+ * @param length number of bytes to upload
+ * @returns true on success; false on failures
+ */
+_Bool LogArchiveUtils_UploadFileRange(
+    const char* storageSasUrl, const char* blobName, const char* filePath, long long offset, long long length)
+{
+    if (storageSasUrl == nullptr || blobName == nullptr || filePath == nullptr || offset < 0 || length < 0)
+    {
+        return false;
+    }
+
+    _Bool succeeded = false;
+    FILE* file = nullptr;
+
+    try
+    {
+        file = fopen(filePath, "rbe");
+        if (file == nullptr || fseeko(file, static_cast<off_t>(offset), SEEK_SET) != 0)
+        {
+            Log_Error("Cannot read %s, errno: %d", filePath, errno);
+        }
+        else
+        {
+            LogArchiveBlockUploader uploader(storageSasUrl, blobName);
+            std::vector<uint8_t> buffer(64 * 1024);
+
+            while (length > 0)
+            {
+                const size_t chunkSize = static_cast<size_t>(std::min<long long>(length, buffer.size()));
+                const size_t readSize = fread(buffer.data(), 1, chunkSize, file);
+
+                if (readSize == 0)
+                {
+                    break;
+                }
+
+                uploader.Write(buffer.data(), readSize);
+                length -= static_cast<long long>(readSize);
+            }
+
+            uploader.Commit();
+            succeeded = true;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        Log_Error("Uploading %s failed with exception: %s", blobName, e.what());
+    }
+    catch (...)
+    {
+        Log_Error("Uploading %s failed with unknown exception", blobName);
+    }
+
+    if (file != nullptr)
+    {
+        fclose(file);
+    }
+
+    return succeeded;
+}
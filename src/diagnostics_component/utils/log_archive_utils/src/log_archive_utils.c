@@ -0,0 +1,378 @@
+/**
+ * @file log_archive_utils.c
+ * @brief Implementation file for utilities streaming log files as a compressed tar archive
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#include "log_archive_utils.h"
+
+#include <aduc/logging.h>
+#include <azure_c_shared_utility/strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/**
+ * @brief Size of a tar header and of the blocks the file contents are padded to
+ */
+#define TAR_BLOCK_SIZE 512
+
+/**
+ * @brief Maximum length of a file name in a ustar header without using the prefix field
+ */
+#define TAR_MAX_NAME_LENGTH 100
+
+/**
+ * @brief Largest file size that fits the 11 octal digits of a ustar header
+ */
+#define TAR_MAX_FILE_SIZE 077777777777LL
+
+/**
+ * @brief Size of the buffers used to read files and to hold compressed output
+ */
+#define LOG_ARCHIVE_BUFFER_SIZE (64 * 1024)
+
+/**
+ * @brief gzip window bits; 16 is added to 15, the default, to get a gzip rather than a zlib wrapper
+ */
+#define LOG_ARCHIVE_GZIP_WINDOW_BITS (15 + 16)
+
+/**
+ * @brief State of an archive being written
+ */
+typedef struct tagLogArchiveWriter
+{
+    z_stream stream; //!< The deflate stream
+    uint8_t* output; //!< Buffer of LOG_ARCHIVE_BUFFER_SIZE bytes receiving compressed data
+    LogArchiveUtils_WriteCallback writeCallback; //!< Receives the compressed data
+    void* context; //!< Passed to writeCallback
+} LogArchiveWriter;
+
+/**
+ * @brief Compresses @p size bytes of @p data and hands the output to the writer's callback
+ * @param writer the archive writer
+ * @param data the data to compress, may be NULL when @p size is 0
+ * @param size the number of bytes in @p data
+ * @param flush Z_NO_FLUSH, or Z_FINISH to end the gzip stream
+ * @returns true on success; false on failures
+ */
+static _Bool LogArchiveWriter_Deflate(LogArchiveWriter* writer, const void* data, size_t size, int flush)
+{
+    writer->stream.next_in = (Bytef*)data;
+    writer->stream.avail_in = (uInt)size;
+
+    for (;;)
+    {
+        writer->stream.next_out = writer->output;
+        writer->stream.avail_out = LOG_ARCHIVE_BUFFER_SIZE;
+
+        const int status = deflate(&writer->stream, flush);
+        if (status == Z_STREAM_ERROR)
+        {
+            Log_Error("deflate failed");
+            return false;
+        }
+
+        const size_t produced = LOG_ARCHIVE_BUFFER_SIZE - writer->stream.avail_out;
+        if (produced > 0 && !writer->writeCallback(writer->context, writer->output, produced))
+        {
+            return false;
+        }
+
+        // deflate fills the whole output buffer whenever it has more to give.
+        if (flush == Z_FINISH ? status == Z_STREAM_END : writer->stream.avail_out != 0)
+        {
+            return true;
+        }
+    }
+}
+
+/**
+ * @brief Writes @p value as a zero-padded, null-terminated octal number filling @p fieldSize bytes of @p field
+ */
+static void LogArchiveWriter_SetOctalField(char* field, size_t fieldSize, unsigned long long value)
+{
+    snprintf(field, fieldSize, "%0*llo", (int)(fieldSize - 1), value);
+}
+
+/**
+ * @brief Writes the ustar header of a regular file named @p fileName
+ * @param writer the archive writer
+ * @param fileName the name of the file within the archive
+ * @param st the status of the file
+ * @returns true on success; false on failures
+ */
+static _Bool LogArchiveWriter_WriteHeader(LogArchiveWriter* writer, const char* fileName, const struct stat* st)
+{
+    char header[TAR_BLOCK_SIZE] = { 0 };
+    unsigned int checksum = 0;
+
+    memcpy(header, fileName, strlen(fileName));
+    LogArchiveWriter_SetOctalField(header + 100, 8, (unsigned long long)(st->st_mode & 07777));
+    LogArchiveWriter_SetOctalField(header + 108, 8, 0);
+    LogArchiveWriter_SetOctalField(header + 116, 8, 0);
+    LogArchiveWriter_SetOctalField(header + 124, 12, (unsigned long long)st->st_size);
+    LogArchiveWriter_SetOctalField(
+        header + 136, 12, (unsigned long long)(st->st_mtime > 0 ? st->st_mtime : 0));
+    header[156] = '0';
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    // The checksum is computed with the checksum field itself set to spaces.
+    memset(header + 148, ' ', 8);
+    for (size_t i = 0; i < sizeof(header); ++i)
+    {
+        checksum += (unsigned char)header[i];
+    }
+    snprintf(header + 148, 8, "%06o", checksum);
+
+    return LogArchiveWriter_Deflate(writer, header, sizeof(header), Z_NO_FLUSH);
+}
+
+/**
+ * @brief Writes the entry of the file @p fileName within @p directoryPath
+ * @param writer the archive writer
+ * @param directoryPath the directory holding the file
+ * @param fileName the name of the file
+ * @param offset offset of the first byte of the file to archive
+ * @param length number of bytes to archive, or -1 for the rest of the file
+ * @param buffer buffer of LOG_ARCHIVE_BUFFER_SIZE bytes used to read the file
+ * @returns true on success, including when the file is skipped; false when the archive can't be written
+ */
+static _Bool LogArchiveWriter_WriteFile(
+    LogArchiveWriter* writer,
+    const char* directoryPath,
+    const char* fileName,
+    long long offset,
+    long long length,
+    uint8_t* buffer)
+{
+    _Bool succeeded = false;
+    int fd = -1;
+    struct stat st;
+    off_t remaining = 0;
+    STRING_HANDLE filePath = NULL;
+
+    if (strlen(fileName) >= TAR_MAX_NAME_LENGTH)
+    {
+        Log_Warn("Skipping %s, its name is too long for the archive", fileName);
+        succeeded = true;
+        goto done;
+    }
+
+    filePath = STRING_construct_sprintf("%s/%s", directoryPath, fileName);
+    if (filePath == NULL)
+    {
+        goto done;
+    }
+
+    fd = open(STRING_c_str(filePath), O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || offset < 0
+        || (offset > 0 && lseek(fd, (off_t)offset, SEEK_SET) != (off_t)offset))
+    {
+        Log_Warn("Skipping %s, it cannot be archived, errno: %d", STRING_c_str(filePath), errno);
+        succeeded = true;
+        goto done;
+    }
+
+    // The header takes its size from st_size, so it's replaced with the size of the entry.
+    st.st_size = (length < 0) ? ((st.st_size > offset) ? st.st_size - (off_t)offset : 0) : (off_t)length;
+    if (st.st_size > TAR_MAX_FILE_SIZE)
+    {
+        Log_Warn("Skipping %s, it is too large for the archive", STRING_c_str(filePath));
+        succeeded = true;
+        goto done;
+    }
+
+    if (!LogArchiveWriter_WriteHeader(writer, fileName, &st))
+    {
+        goto done;
+    }
+
+    // Logs may be appended to while they're read; the entry holds exactly the size recorded in its header.
+    remaining = st.st_size;
+    while (remaining > 0)
+    {
+        const size_t chunkSize =
+            (remaining < LOG_ARCHIVE_BUFFER_SIZE) ? (size_t)remaining : LOG_ARCHIVE_BUFFER_SIZE;
+
+        ssize_t readSize = read(fd, buffer, chunkSize);
+        if (readSize < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (readSize < 0)
+        {
+            Log_Error("Cannot read %s, errno: %d", STRING_c_str(filePath), errno);
+            goto done;
+        }
+
+        if (readSize == 0)
+        {
+            // The file was truncated, pad the entry to the size in its header.
+            memset(buffer, 0, chunkSize);
+            readSize = (ssize_t)chunkSize;
+        }
+
+        if (!LogArchiveWriter_Deflate(writer, buffer, (size_t)readSize, Z_NO_FLUSH))
+        {
+            goto done;
+        }
+
+        remaining -= readSize;
+    }
+
+    if (st.st_size % TAR_BLOCK_SIZE != 0)
+    {
+        memset(buffer, 0, TAR_BLOCK_SIZE);
+        if (!LogArchiveWriter_Deflate(
+                writer, buffer, TAR_BLOCK_SIZE - (size_t)(st.st_size % TAR_BLOCK_SIZE), Z_NO_FLUSH))
+        {
+            goto done;
+        }
+    }
+
+    succeeded = true;
+
+done:
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    STRING_delete(filePath);
+
+    return succeeded;
+}
+
+/**
+ * @brief Streams the files of @p entries as a gzip compressed tar archive to @p writeCallback
+ * @param entries vector of STRING_HANDLEs, or of LogArchiveUtils_FileRanges when @p entriesAreRanges is true
+ * @param entriesAreRanges whether @p entries holds LogArchiveUtils_FileRanges
+ * @param directoryPath the directory holding the files
+ * @param writeCallback called with each chunk of the compressed archive
+ * @param context passed to @p writeCallback
+ * @returns true on success; false on failures
+ */
+static _Bool LogArchiveUtils_WriteEntries(
+    VECTOR_HANDLE entries,
+    _Bool entriesAreRanges,
+    const char* directoryPath,
+    LogArchiveUtils_WriteCallback writeCallback,
+    void* context)
+{
+    if (entries == NULL || directoryPath == NULL || writeCallback == NULL)
+    {
+        return false;
+    }
+
+    _Bool succeeded = false;
+    _Bool streamInitialized = false;
+    uint8_t* input = NULL;
+    LogArchiveWriter writer;
+
+    memset(&writer, 0, sizeof(writer));
+    writer.writeCallback = writeCallback;
+    writer.context = context;
+
+    input = malloc(LOG_ARCHIVE_BUFFER_SIZE);
+    writer.output = malloc(LOG_ARCHIVE_BUFFER_SIZE);
+    if (input == NULL || writer.output == NULL)
+    {
+        goto done;
+    }
+
+    if (deflateInit2(
+            &writer.stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, LOG_ARCHIVE_GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY)
+        != Z_OK)
+    {
+        Log_Error("deflateInit2 failed");
+        goto done;
+    }
+    streamInitialized = true;
+
+    const size_t entryCount = VECTOR_size(entries);
+    for (size_t i = 0; i < entryCount; ++i)
+    {
+        _Bool written = false;
+
+        if (entriesAreRanges)
+        {
+            const LogArchiveUtils_FileRange* range = VECTOR_element(entries, i);
+
+            written = LogArchiveWriter_WriteFile(
+                &writer, directoryPath, STRING_c_str(range->fileName), range->offset, range->length, input);
+        }
+        else
+        {
+            const STRING_HANDLE* fileName = VECTOR_element(entries, i);
+
+            written = LogArchiveWriter_WriteFile(&writer, directoryPath, STRING_c_str(*fileName), 0, -1, input);
+        }
+
+        if (!written)
+        {
+            goto done;
+        }
+    }
+
+    // A tar archive ends with two zero blocks.
+    memset(input, 0, 2 * TAR_BLOCK_SIZE);
+    if (!LogArchiveWriter_Deflate(&writer, input, 2 * TAR_BLOCK_SIZE, Z_FINISH))
+    {
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    if (streamInitialized)
+    {
+        deflateEnd(&writer.stream);
+    }
+
+    free(writer.output);
+    free(input);
+
+    return succeeded;
+}
+
+/**
+ * @brief Streams the files named in @p fileNames as a gzip compressed tar archive to @p writeCallback
+ * @details Files are read in chunks and compressed on the fly, no copy of the archive is staged on disk.
+ * A file that grows while it is read is cut at the size it had when its entry was started.
+ * @param fileNames vector of STRING_HANDLEs with the names of the files within @p directoryPath
+ * @param directoryPath the directory holding the files
+ * @param writeCallback called with each chunk of the compressed archive
+ * @param context passed to @p writeCallback
+ * @returns true on success; false on failures
+ */
+_Bool LogArchiveUtils_WriteTarGz(
+    VECTOR_HANDLE fileNames, const char* directoryPath, LogArchiveUtils_WriteCallback writeCallback, void* context)
+{
+    return LogArchiveUtils_WriteEntries(fileNames, false, directoryPath, writeCallback, context);
+}
+
+/**
+ * @brief Streams the byte ranges of files described by @p fileRanges as a gzip compressed tar archive to @p writeCallback
+ * @details Each range becomes an entry named after its file, holding exactly the range's length; a file
+ * that is shorter than its range is zero padded.
+ * @param fileRanges vector of LogArchiveUtils_FileRanges of files within @p directoryPath
+ * @param directoryPath the directory holding the files
+ * @param writeCallback called with each chunk of the compressed archive
+ * @param context passed to @p writeCallback
+ * @returns true on success; false on failures
+ */
+_Bool LogArchiveUtils_WriteTarGzRanges(
+    VECTOR_HANDLE fileRanges, const char* directoryPath, LogArchiveUtils_WriteCallback writeCallback, void* context)
+{
+    return LogArchiveUtils_WriteEntries(fileRanges, true, directoryPath, writeCallback, context);
+}
@@ -0,0 +1,201 @@
+/**
+ * @file log_archive_utils_ut.cpp
+ * @brief Unit Tests for log_archive_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "log_archive_utils.h"
+
+#include <aduc/system_utils.h>
+#include <azure_c_shared_utility/strings.h>
+#include <catch2/catch.hpp>
+#include <cstdlib>
+#include <string>
+#include <zlib.h>
+
+static _Bool AppendToString(void* context, const void* data, size_t size)
+{
+    static_cast<std::string*>(context)->append(static_cast<const char*>(data), size);
+    return true;
+}
+
+static _Bool FailWrite(void* /* context */, const void* /* data */, size_t /* size */)
+{
+    return false;
+}
+
+static std::string Gunzip(const std::string& compressed)
+{
+    std::string output;
+    z_stream stream = {};
+    char buffer[4096];
+
+    REQUIRE(inflateInit2(&stream, 15 + 16) == Z_OK);
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+    stream.avail_in = static_cast<uInt>(compressed.size());
+
+    int status = Z_OK;
+    while (status == Z_OK)
+    {
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = sizeof(buffer);
+        status = inflate(&stream, Z_NO_FLUSH);
+        output.append(buffer, sizeof(buffer) - stream.avail_out);
+    }
+
+    inflateEnd(&stream);
+    CHECK(status == Z_STREAM_END);
+    return output;
+}
+
+class ArchiveTestDir
+{
+public:
+    ArchiveTestDir()
+    {
+        path = std::string(ADUC_SystemUtils_GetTemporaryPathName()) + "/log_archive_utils_ut";
+        ADUC_SystemUtils_RmDirRecursive(path.c_str());
+        REQUIRE(ADUC_SystemUtils_MkDirRecursiveDefault(path.c_str()) == 0);
+
+        fileNames = VECTOR_create(sizeof(STRING_HANDLE));
+        REQUIRE(fileNames != nullptr);
+    }
+
+    ArchiveTestDir(const ArchiveTestDir&) = delete;
+    ArchiveTestDir& operator=(const ArchiveTestDir&) = delete;
+
+    ~ArchiveTestDir()
+    {
+        for (size_t i = 0; i < VECTOR_size(fileNames); ++i)
+        {
+            STRING_delete(*static_cast<STRING_HANDLE*>(VECTOR_element(fileNames, i)));
+        }
+        VECTOR_destroy(fileNames);
+
+        ADUC_SystemUtils_RmDirRecursive(path.c_str());
+    }
+
+    void AddFile(const char* name, const std::string& content)
+    {
+        REQUIRE(ADUC_SystemUtils_WriteStringToFile((path + "/" + name).c_str(), content.c_str()) == 0);
+        AddName(name);
+    }
+
+    void AddName(const char* name)
+    {
+        STRING_HANDLE fileName = STRING_construct(name);
+        REQUIRE(VECTOR_push_back(fileNames, &fileName, 1) == 0);
+    }
+
+    std::string path;
+    VECTOR_HANDLE fileNames = nullptr;
+};
+
+TEST_CASE("LogArchiveUtils_WriteTarGz")
+{
+    SECTION("Parameter validation")
+    {
+        ArchiveTestDir dir;
+        std::string archive;
+
+        CHECK_FALSE(LogArchiveUtils_WriteTarGz(nullptr, dir.path.c_str(), AppendToString, &archive));
+        CHECK_FALSE(LogArchiveUtils_WriteTarGz(dir.fileNames, nullptr, AppendToString, &archive));
+        CHECK_FALSE(LogArchiveUtils_WriteTarGz(dir.fileNames, dir.path.c_str(), nullptr, &archive));
+    }
+
+    SECTION("Archives files as ustar entries")
+    {
+        ArchiveTestDir dir;
+        const std::string first = "first log line\n";
+        const std::string second(1500, 'x');
+
+        dir.AddFile("a.log", first);
+        dir.AddFile("b.log", second);
+
+        std::string archive;
+        REQUIRE(LogArchiveUtils_WriteTarGz(dir.fileNames, dir.path.c_str(), AppendToString, &archive));
+        REQUIRE(archive.size() < second.size());
+
+        const std::string tar = Gunzip(archive);
+
+        // Header, 1 block of data, header, 3 blocks of data, 2 end blocks.
+        REQUIRE(tar.size() == 512 * 8);
+
+        CHECK(std::string(tar.c_str()) == "a.log");
+        CHECK(tar.compare(257, 5, "ustar") == 0);
+        CHECK(strtoul(tar.substr(124, 12).c_str(), nullptr, 8) == first.size());
+        CHECK(tar.compare(512, first.size(), first) == 0);
+
+        CHECK(std::string(tar.c_str() + 1024) == "b.log");
+        CHECK(strtoul(tar.substr(1024 + 124, 12).c_str(), nullptr, 8) == second.size());
+        CHECK(tar.compare(1536, second.size(), second) == 0);
+
+        CHECK(tar.substr(512 * 6) == std::string(1024, '\0'));
+
+        unsigned int checksum = 0;
+        for (size_t i = 0; i < 512; ++i)
+        {
+            checksum += (i >= 148 && i < 156) ? ' ' : static_cast<unsigned char>(tar[i]);
+        }
+        CHECK(strtoul(tar.substr(148, 8).c_str(), nullptr, 8) == checksum);
+    }
+
+    SECTION("Skips files that cannot be read")
+    {
+        ArchiveTestDir dir;
+
+        dir.AddName("missing.log");
+        dir.AddFile("present.log", "content");
+
+        std::string archive;
+        REQUIRE(LogArchiveUtils_WriteTarGz(dir.fileNames, dir.path.c_str(), AppendToString, &archive));
+
+        const std::string tar = Gunzip(archive);
+        REQUIRE(tar.size() == 512 * 4);
+        CHECK(std::string(tar.c_str()) == "present.log");
+    }
+
+    SECTION("Write failure aborts the archive")
+    {
+        ArchiveTestDir dir;
+
+        dir.AddFile("a.log", "content");
+
+        CHECK_FALSE(LogArchiveUtils_WriteTarGz(dir.fileNames, dir.path.c_str(), FailWrite, nullptr));
+    }
+}
+
+TEST_CASE("LogArchiveUtils_WriteTarGzRanges")
+{
+    SECTION("Archives the bytes of each range")
+    {
+        ArchiveTestDir dir;
+
+        dir.AddFile("a.log", "old lines\nnew lines\n");
+
+        VECTOR_HANDLE ranges = VECTOR_create(sizeof(LogArchiveUtils_FileRange));
+        REQUIRE(ranges != nullptr);
+
+        LogArchiveUtils_FileRange range = {};
+        range.fileName = STRING_construct("a.log");
+        range.offset = 10;
+        range.length = 10;
+        REQUIRE(VECTOR_push_back(ranges, &range, 1) == 0);
+
+        std::string archive;
+        const bool written = LogArchiveUtils_WriteTarGzRanges(ranges, dir.path.c_str(), AppendToString, &archive);
+
+        STRING_delete(range.fileName);
+        VECTOR_destroy(ranges);
+
+        REQUIRE(written);
+
+        const std::string tar = Gunzip(archive);
+        REQUIRE(tar.size() == 512 * 4);
+        CHECK(std::string(tar.c_str()) == "a.log");
+        CHECK(strtoul(tar.substr(124, 12).c_str(), nullptr, 8) == 10);
+        CHECK(tar.compare(512, 11, std::string("new lines\n\0", 11)) == 0);
+    }
+}
@@ -17,6 +17,8 @@ EXTERN_C_BEGIN
 
 _Bool OperationIdUtils_OperationIsComplete(const char* serviceMsg);
 
+STRING_HANDLE OperationIdUtils_GetOperationId(const char* serviceMsg);
+
 _Bool OperationIdUtils_StoreCompletedOperationId(const char* operationId);
 
 EXTERN_C_END
@@ -81,6 +81,39 @@ done:
     return alreadyCompleted;
 }
 
+/**
+ * @brief Gets the operation-id within @p serviceMsg
+ * @param serviceMsg the message from the service that contains the operation-id
+ * @return the operation-id, or NULL if @p serviceMsg has none; the caller must free it with STRING_delete
+ */
+STRING_HANDLE OperationIdUtils_GetOperationId(const char* serviceMsg)
+{
+    STRING_HANDLE operationId = NULL;
+
+    JSON_Value* serviceMsgJsonValue = json_parse_string(serviceMsg);
+
+    if (serviceMsgJsonValue == NULL)
+    {
+        goto done;
+    }
+
+    const char* requestOperationId =
+        json_object_get_string(json_value_get_object(serviceMsgJsonValue), DIAGNOSTICSITF_FIELDNAME_OPERATIONID);
+
+    if (requestOperationId == NULL)
+    {
+        goto done;
+    }
+
+    operationId = STRING_construct(requestOperationId);
+
+done:
+
+    json_value_free(serviceMsgJsonValue);
+
+    return operationId;
+}
+
 /**
  * @brief Stores @p operationId in DIAGNOSTICS_COMPLETED_OPERATION_FILE_PATH so it can be checked later on
  * @details This function is NOT thread safe.
@@ -0,0 +1,73 @@
+/**
+ * @file upload_manifest_utils.h
+ * @brief Header file for the manifest of log file bytes already uploaded by the diagnostics workflow
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <aduc/c_utils.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifndef UPLOAD_MANIFEST_UTILS_H
+#    define UPLOAD_MANIFEST_UTILS_H
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Records, for each log file, its inode and how many of its bytes were uploaded
+ * @details All functions taking an UploadManifest are thread safe.
+ */
+typedef struct tagUploadManifest UploadManifest;
+
+/**
+ * @brief Loads the manifest stored at @p manifestPath
+ * @details A missing or unreadable manifest yields an empty one, so that everything gets uploaded.
+ * @param manifestPath path to the manifest file
+ * @returns the manifest, to be freed with UploadManifest_Free; NULL on allocation failure
+ */
+UploadManifest* UploadManifest_Load(const char* manifestPath);
+
+/**
+ * @brief Frees @p manifest
+ * @param manifest the manifest to be freed, may be NULL
+ */
+void UploadManifest_Free(UploadManifest* manifest);
+
+/**
+ * @brief Returns the offset from which the file @p filePath has yet to be uploaded
+ * @details The file is uploaded from the start again when its inode changed or it is shorter than
+ * what was uploaded, i.e. it was rotated or truncated.
+ * @param manifest the manifest
+ * @param filePath absolute path to the file
+ * @param inode the current inode of the file
+ * @param size the current size of the file
+ * @returns the offset, between 0 and @p size
+ */
+long long UploadManifest_GetUploadOffset(
+    UploadManifest* manifest, const char* filePath, unsigned long long inode, long long size);
+
+/**
+ * @brief Records that the first @p uploadedSize bytes of the file @p filePath were uploaded
+ * @param manifest the manifest
+ * @param filePath absolute path to the file
+ * @param inode the inode of the file
+ * @param uploadedSize the number of bytes from the start of the file that were uploaded
+ * @returns true on success; false on failures
+ */
+_Bool UploadManifest_SetUploadOffset(
+    UploadManifest* manifest, const char* filePath, unsigned long long inode, long long uploadedSize);
+
+/**
+ * @brief Stores @p manifest at @p manifestPath
+ * @details Entries of files that no longer exist, or were replaced, are dropped first. The manifest is
+ * written to a temporary file that is renamed over @p manifestPath, so a crash never leaves it half written.
+ * @param manifest the manifest
+ * @param manifestPath path to the manifest file
+ * @returns true on success; false on failures
+ */
+_Bool UploadManifest_Save(UploadManifest* manifest, const char* manifestPath);
+
+EXTERN_C_END
+
+#endif // UPLOAD_MANIFEST_UTILS_H
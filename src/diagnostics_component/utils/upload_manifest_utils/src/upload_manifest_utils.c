@@ -0,0 +1,295 @@
+/**
+ * @file upload_manifest_utils.c
+ * @brief Implementation file for the manifest of log file bytes already uploaded by the diagnostics workflow
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#include "upload_manifest_utils.h"
+
+#include <aduc/logging.h>
+#include <azure_c_shared_utility/strings.h>
+#include <errno.h>
+#include <parson.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+/**
+ * Manifest file format:
+ * {
+        "files":{
+            "/var/log/adu/du-agent.20221013-100000.log":{
+                "inode":1234,
+                "offset":56789
+            },
+            ...
+        }
+    }
+ */
+
+/**
+ * @brief Fieldname for the object holding an entry per uploaded file, keyed by the file's path
+ */
+#define UPLOAD_MANIFEST_FILES_FIELDNAME "files"
+
+/**
+ * @brief Fieldname for the inode of an uploaded file
+ */
+#define UPLOAD_MANIFEST_INODE_FIELDNAME "inode"
+
+/**
+ * @brief Fieldname for the number of bytes of an uploaded file that were uploaded
+ */
+#define UPLOAD_MANIFEST_OFFSET_FIELDNAME "offset"
+
+/**
+ * @brief The manifest, held as the parsed manifest file
+ */
+struct tagUploadManifest
+{
+    pthread_mutex_t mutex; //!< Protects root
+    JSON_Value* root; //!< The manifest's JSON object
+};
+
+/**
+ * @brief Returns the object holding the entries of @p manifest, adding it if need be
+ * @param manifest the manifest
+ * @returns the object; NULL on failures
+ */
+static JSON_Object* UploadManifest_GetFiles(UploadManifest* manifest)
+{
+    JSON_Object* rootObj = json_value_get_object(manifest->root);
+    JSON_Object* files = json_object_get_object(rootObj, UPLOAD_MANIFEST_FILES_FIELDNAME);
+
+    if (files == NULL && rootObj != NULL)
+    {
+        JSON_Value* filesValue = json_value_init_object();
+
+        if (filesValue == NULL
+            || json_object_set_value(rootObj, UPLOAD_MANIFEST_FILES_FIELDNAME, filesValue) != JSONSuccess)
+        {
+            json_value_free(filesValue);
+            return NULL;
+        }
+
+        files = json_value_get_object(filesValue);
+    }
+
+    return files;
+}
+
+/**
+ * @brief Loads the manifest stored at @p manifestPath
+ * @details A missing or unreadable manifest yields an empty one, so that everything gets uploaded.
+ * @param manifestPath path to the manifest file
+ * @returns the manifest, to be freed with UploadManifest_Free; NULL on allocation failure
+ */
+UploadManifest* UploadManifest_Load(const char* manifestPath)
+{
+    UploadManifest* manifest = calloc(1, sizeof(*manifest));
+
+    if (manifest == NULL)
+    {
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&manifest->mutex, NULL) != 0)
+    {
+        free(manifest);
+        return NULL;
+    }
+
+    if (manifestPath != NULL)
+    {
+        manifest->root = json_parse_file(manifestPath);
+    }
+
+    if (manifest->root != NULL && json_value_get_object(manifest->root) == NULL)
+    {
+        Log_Warn("Ignoring malformed upload manifest %s", manifestPath);
+        json_value_free(manifest->root);
+        manifest->root = NULL;
+    }
+
+    if (manifest->root == NULL)
+    {
+        manifest->root = json_value_init_object();
+    }
+
+    if (manifest->root == NULL)
+    {
+        UploadManifest_Free(manifest);
+        return NULL;
+    }
+
+    return manifest;
+}
+
+/**
+ * @brief Frees @p manifest
+ * @param manifest the manifest to be freed, may be NULL
+ */
+void UploadManifest_Free(UploadManifest* manifest)
+{
+    if (manifest == NULL)
+    {
+        return;
+    }
+
+    json_value_free(manifest->root);
+    pthread_mutex_destroy(&manifest->mutex);
+    free(manifest);
+}
+
+/**
+ * @brief Returns the offset from which the file @p filePath has yet to be uploaded
+ * @details The file is uploaded from the start again when its inode changed or it is shorter than
+ * what was uploaded, i.e. it was rotated or truncated.
+ * @param manifest the manifest
+ * @param filePath absolute path to the file
+ * @param inode the current inode of the file
+ * @param size the current size of the file
+ * @returns the offset, between 0 and @p size
+ */
+long long UploadManifest_GetUploadOffset(
+    UploadManifest* manifest, const char* filePath, unsigned long long inode, long long size)
+{
+    long long offset = 0;
+
+    if (manifest == NULL || filePath == NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&manifest->mutex);
+
+    JSON_Object* files =
+        json_object_get_object(json_value_get_object(manifest->root), UPLOAD_MANIFEST_FILES_FIELDNAME);
+    JSON_Object* entry = json_object_get_object(files, filePath);
+
+    if (entry != NULL
+        && (unsigned long long)json_object_get_number(entry, UPLOAD_MANIFEST_INODE_FIELDNAME) == inode)
+    {
+        offset = (long long)json_object_get_number(entry, UPLOAD_MANIFEST_OFFSET_FIELDNAME);
+    }
+
+    pthread_mutex_unlock(&manifest->mutex);
+
+    return (offset < 0 || offset > size) ? 0 : offset;
+}
+
+/**
+ * @brief Records that the first @p uploadedSize bytes of the file @p filePath were uploaded
+ * @param manifest the manifest
+ * @param filePath absolute path to the file
+ * @param inode the inode of the file
+ * @param uploadedSize the number of bytes from the start of the file that were uploaded
+ * @returns true on success; false on failures
+ */
+_Bool UploadManifest_SetUploadOffset(
+    UploadManifest* manifest, const char* filePath, unsigned long long inode, long long uploadedSize)
+{
+    if (manifest == NULL || filePath == NULL || uploadedSize < 0)
+    {
+        return false;
+    }
+
+    _Bool succeeded = false;
+    JSON_Value* entryValue = json_value_init_object();
+    JSON_Object* entry = json_value_get_object(entryValue);
+
+    if (entry == NULL || json_object_set_number(entry, UPLOAD_MANIFEST_INODE_FIELDNAME, (double)inode) != JSONSuccess
+        || json_object_set_number(entry, UPLOAD_MANIFEST_OFFSET_FIELDNAME, (double)uploadedSize) != JSONSuccess)
+    {
+        goto done;
+    }
+
+    pthread_mutex_lock(&manifest->mutex);
+
+    JSON_Object* files = UploadManifest_GetFiles(manifest);
+
+    if (files != NULL && json_object_set_value(files, filePath, entryValue) == JSONSuccess)
+    {
+        entryValue = NULL; // Owned by the manifest now.
+        succeeded = true;
+    }
+
+    pthread_mutex_unlock(&manifest->mutex);
+
+done:
+    json_value_free(entryValue);
+
+    return succeeded;
+}
+
+/**
+ * @brief Stores @p manifest at @p manifestPath
+ * @details Entries of files that no longer exist, or were replaced, are dropped first. The manifest is
+ * written to a temporary file that is renamed over @p manifestPath, so a crash never leaves it half written.
+ * @param manifest the manifest
+ * @param manifestPath path to the manifest file
+ * @returns true on success; false on failures
+ */
+_Bool UploadManifest_Save(UploadManifest* manifest, const char* manifestPath)
+{
+    if (manifest == NULL || manifestPath == NULL)
+    {
+        return false;
+    }
+
+    _Bool succeeded = false;
+    STRING_HANDLE tempPath = STRING_construct_sprintf("%s.tmp", manifestPath);
+
+    if (tempPath == NULL)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&manifest->mutex);
+
+    JSON_Object* files = UploadManifest_GetFiles(manifest);
+
+    if (files == NULL)
+    {
+        goto done;
+    }
+
+    // Walk backwards, as removing an entry moves the ones after it.
+    for (size_t i = json_object_get_count(files); i > 0; --i)
+    {
+        const char* filePath = json_object_get_name(files, i - 1);
+        JSON_Object* entry = json_value_get_object(json_object_get_value_at(files, i - 1));
+        struct stat st;
+
+        if (entry == NULL || stat(filePath, &st) != 0
+            || (unsigned long long)st.st_ino
+                != (unsigned long long)json_object_get_number(entry, UPLOAD_MANIFEST_INODE_FIELDNAME))
+        {
+            json_object_remove(files, filePath);
+        }
+    }
+
+    if (json_serialize_to_file(manifest->root, STRING_c_str(tempPath)) != JSONSuccess)
+    {
+        Log_Error("Cannot write upload manifest %s", STRING_c_str(tempPath));
+        goto done;
+    }
+
+    if (rename(STRING_c_str(tempPath), manifestPath) != 0)
+    {
+        Log_Error("Cannot replace upload manifest %s, errno: %d", manifestPath, errno);
+        remove(STRING_c_str(tempPath));
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    pthread_mutex_unlock(&manifest->mutex);
+
+    STRING_delete(tempPath);
+
+    return succeeded;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file upload_manifest_utils_ut.cpp
+ * @brief Unit Tests for upload_manifest_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "upload_manifest_utils.h"
+
+#include <aduc/system_utils.h>
+#include <catch2/catch.hpp>
+#include <string>
+#include <sys/stat.h>
+
+class ManifestTestDir
+{
+public:
+    ManifestTestDir()
+    {
+        path = std::string(ADUC_SystemUtils_GetTemporaryPathName()) + "/upload_manifest_utils_ut";
+        ADUC_SystemUtils_RmDirRecursive(path.c_str());
+        REQUIRE(ADUC_SystemUtils_MkDirRecursiveDefault(path.c_str()) == 0);
+
+        manifestPath = path + "/manifest.json";
+    }
+
+    ManifestTestDir(const ManifestTestDir&) = delete;
+    ManifestTestDir& operator=(const ManifestTestDir&) = delete;
+
+    ~ManifestTestDir()
+    {
+        ADUC_SystemUtils_RmDirRecursive(path.c_str());
+    }
+
+    std::string AddFile(const char* name, const char* content, unsigned long long* inode)
+    {
+        const std::string filePath = path + "/" + name;
+        struct stat st;
+
+        REQUIRE(ADUC_SystemUtils_WriteStringToFile(filePath.c_str(), content) == 0);
+        REQUIRE(stat(filePath.c_str(), &st) == 0);
+
+        *inode = st.st_ino;
+        return filePath;
+    }
+
+    std::string path;
+    std::string manifestPath;
+};
+
+TEST_CASE("UploadManifest_GetUploadOffset")
+{
+    SECTION("Missing manifest uploads everything")
+    {
+        ManifestTestDir dir;
+
+        UploadManifest* manifest = UploadManifest_Load(dir.manifestPath.c_str());
+        REQUIRE(manifest != nullptr);
+
+        CHECK(UploadManifest_GetUploadOffset(manifest, "/var/log/adu/a.log", 1, 100) == 0);
+
+        UploadManifest_Free(manifest);
+    }
+
+    SECTION("Resumes after the uploaded bytes of the same file")
+    {
+        UploadManifest* manifest = UploadManifest_Load(nullptr);
+        REQUIRE(manifest != nullptr);
+
+        REQUIRE(UploadManifest_SetUploadOffset(manifest, "/var/log/adu/a.log", 42, 80));
+
+        CHECK(UploadManifest_GetUploadOffset(manifest, "/var/log/adu/a.log", 42, 100) == 80);
+        CHECK(UploadManifest_GetUploadOffset(manifest, "/var/log/adu/a.log", 42, 80) == 80);
+
+        // Rotated: another file took its name.
+        CHECK(UploadManifest_GetUploadOffset(manifest, "/var/log/adu/a.log", 43, 100) == 0);
+
+        // Truncated
+        CHECK(UploadManifest_GetUploadOffset(manifest, "/var/log/adu/a.log", 42, 50) == 0);
+
+        CHECK(UploadManifest_GetUploadOffset(manifest, "/var/log/adu/b.log", 42, 100) == 0);
+
+        UploadManifest_Free(manifest);
+    }
+}
+
+TEST_CASE("UploadManifest_Save")
+{
+    SECTION("Round trip keeps the entries of existing files only")
+    {
+        ManifestTestDir dir;
+        unsigned long long keptInode = 0;
+        unsigned long long removedInode = 0;
+
+        const std::string keptPath = dir.AddFile("kept.log", "0123456789", &keptInode);
+        const std::string removedPath = dir.AddFile("removed.log", "0123456789", &removedInode);
+
+        UploadManifest* manifest = UploadManifest_Load(dir.manifestPath.c_str());
+        REQUIRE(manifest != nullptr);
+
+        REQUIRE(UploadManifest_SetUploadOffset(manifest, keptPath.c_str(), keptInode, 10));
+        REQUIRE(UploadManifest_SetUploadOffset(manifest, removedPath.c_str(), removedInode, 10));
+
+        REQUIRE(remove(removedPath.c_str()) == 0);
+
+        CHECK(UploadManifest_Save(manifest, dir.manifestPath.c_str()));
+        UploadManifest_Free(manifest);
+
+        manifest = UploadManifest_Load(dir.manifestPath.c_str());
+        REQUIRE(manifest != nullptr);
+
+        CHECK(UploadManifest_GetUploadOffset(manifest, keptPath.c_str(), keptInode, 20) == 10);
+        CHECK(UploadManifest_GetUploadOffset(manifest, removedPath.c_str(), removedInode, 20) == 0);
+
+        UploadManifest_Free(manifest);
+    }
+
+    SECTION("Malformed manifest is ignored")
+    {
+        ManifestTestDir dir;
+
+        REQUIRE(ADUC_SystemUtils_WriteStringToFile(dir.manifestPath.c_str(), "[1, 2]") == 0);
+
+        UploadManifest* manifest = UploadManifest_Load(dir.manifestPath.c_str());
+        REQUIRE(manifest != nullptr);
+
+        CHECK(UploadManifest_GetUploadOffset(manifest, "/var/log/adu/a.log", 1, 100) == 0);
+        CHECK(UploadManifest_SetUploadOffset(manifest, "/var/log/adu/a.log", 1, 100));
+
+        UploadManifest_Free(manifest);
+    }
+}
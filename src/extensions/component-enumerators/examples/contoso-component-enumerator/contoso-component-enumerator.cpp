@@ -6,9 +6,12 @@
  * Licensed under the MIT License.
  */
 #include "aduc/component_enumerator_extension.hpp"
+#include "aduc/component_inventory_file.h"
 #include "parson.h"
 #include <algorithm>
 #include <sstream>
+#include <stdlib.h>
+#include <string>
 #include <string.h>
 
 /*
@@ -43,6 +46,84 @@
 //
 const char* g_contosoComponentInventoryFilePath = "/usr/local/contoso-devices/components-inventory.json";
 
+//
+// The component inventory file compiled from the file above, if any, e.g. with
+//   aduc_compile_component_inventory components-inventory.json components-inventory.bin
+// Components are selected from it, and only the selected ones read their firmware data file.
+// It's only used while the JSON file is unchanged since it was compiled; recompile it when the JSON file changes.
+//
+const char* g_contosoCompiledComponentInventoryFilePath = "/usr/local/contoso-devices/components-inventory.bin";
+
+/**
+ * @brief Populates the properties of @p component from its (mock) firmware data file.
+ *
+ * @param component The component.
+ * @param i The index of the component, for messages.
+ */
+static void _PopulateComponentProperties(JSON_Object* component, size_t i)
+{
+    JSON_Object* properties = json_object_get_object(component, "properties");
+    if (properties == nullptr)
+    {
+        return;
+    }
+
+    // Populate 'properties.status'
+    //    'unknown' : 'firmwareDataFile' file is missing
+    //    'ok'     : 'firmwareDataFile' file exists
+    const char* path = json_object_get_string(properties, "path");
+    const char* firmwareDataFile = json_object_get_string(properties, "firmwareDataFile");
+
+    // Note: for demonstration purposes, we will populate 'properties' object with all
+    // data (name-value pairs) from specified (mock) firmware data file.
+    // And set component's status to 'ok'.
+    if (path == nullptr || firmwareDataFile == nullptr)
+    {
+        return;
+    }
+
+    std::stringstream propsFile;
+    propsFile << path << "/" << firmwareDataFile;
+
+    // Read properties from firmware data file.
+    JSON_Value* propsValues = json_parse_file(propsFile.str().c_str());
+    if (propsValues == nullptr)
+    {
+        // Simulator: cannot communicate with the component.
+        // Set 'status' to 'unknown'.
+        if (JSONFailure == json_object_set_string(properties, "status", "unknown"))
+        {
+            printf("Cannot add 'status (unknown)' property to component #%d\n", static_cast<int>(i));
+        }
+        return;
+    }
+
+    if (JSONFailure == json_object_set_string(properties, "status", "ok"))
+    {
+        printf("Cannot add 'status (ok)' property to component #%d\n", static_cast<int>(i));
+    }
+
+    JSON_Object* props = json_object(propsValues);
+    for (size_t pv = 0; pv < json_object_get_count(props); pv++)
+    {
+        const char* key = json_object_get_name(props, pv);
+        if (strcmp(key, "properties") != 0)
+        {
+            JSON_Value* val = json_value_deep_copy(json_object_get_value_at(props, pv));
+            if (val != nullptr)
+            {
+                if (JSONFailure == json_object_set_value(component, key, val))
+                {
+                    json_value_free(val);
+                    printf("Cannot set value '%s' from firmware data file '%s'", key, propsFile.str().c_str());
+                }
+            }
+        }
+    }
+
+    json_value_free(propsValues);
+}
+
 JSON_Value* _GetAllComponentsFromFile(const char* configFilepath)
 {
     // Read config file.
@@ -65,70 +146,9 @@ JSON_Value* _GetAllComponentsFromFile(const char* configFilepath)
     }
 
     // Populate each components' properties.
-    for (size_t i = 0; i < json_array_get_count(components);)
-    {
-        JSON_Object* component = json_array_get_object(components, i);
-        JSON_Object* properties = json_object_get_object(component, "properties");
-        if (properties != nullptr)
-        {
-            // Populate 'properties.status'
-            //    'unknown' : 'firmwareDataFile' file is missing
-            //    'ok'     : 'firmwareDataFile' file exists
-            const char* path = json_object_get_string(properties, "path");
-            const char* firmwareDataFile = json_object_get_string(properties, "firmwareDataFile");
-
-            // Note: for demonstration purposes, we will populate 'properties' object with all
-            // data (name-value pairs) from specified (mock) firmware data file.
-            // And set component's status to 'ok'.
-            if (path != nullptr && firmwareDataFile != nullptr)
-            {
-                std::stringstream propsFile;
-                propsFile << path << "/" << firmwareDataFile;
-
-                // Read properties from firmware data file.
-                JSON_Value* propsValues = json_parse_file(propsFile.str().c_str());
-                if (propsValues == nullptr)
-                {
-                    // Simulator: cannot communicate with the component.
-                    // Set 'status' to 'unknown'.
-                    if (JSONFailure == json_object_set_string(properties, "status", "unknown"))
-                    {
-                        printf("Cannot add 'status (unknown)' property to component #%d\n", static_cast<int>(i));
-                    }
-                    i++;
-                    continue;
-                }
-
-                if (JSONFailure == json_object_set_string(properties, "status", "ok"))
-                {
-                    printf("Cannot add 'status (ok)' property to component #%d\n", static_cast<int>(i));
-                }
-
-                JSON_Object* props = json_object(propsValues);
-                for (size_t pv = 0; pv < json_object_get_count(props); pv++)
-                {
-                    const char* key = json_object_get_name(props, pv);
-                    if (strcmp(key, "properties") != 0)
-                    {
-                        JSON_Value* val = json_value_deep_copy(json_object_get_value_at(props, pv));
-                        if (val != nullptr)
-                        {
-                            if (JSONFailure == json_object_set_value(component, key, val))
-                            {
-                                json_value_free(val);
-                                printf(
-                                    "Cannot set value '%s' from firmware data file '%s'",
-                                    key,
-                                    propsFile.str().c_str());
-                            }
-                        }
-                    }
-                }
-
-                json_value_free(propsValues);
-            }
-        }
-        i++;
+    for (size_t i = 0; i < json_array_get_count(components); i++)
+    {
+        _PopulateComponentProperties(json_array_get_object(components, i), i);
     }
 
     return rootValue;
@@ -149,27 +169,14 @@ extern "C"
     }
 
     /**
-     * @brief Select component(s) that contain property or properties matching specified in @p selectorJson string.
-     *
-     * Example input json:
-     *      - Select all components belong to a 'Motors' group
-     *              "{\"group\":\"Motors\"}"
-     *
-     *      - Select a component with name equals 'left-motor'
-     *              "{\"name\":\"left-motor\"}"
-     *
-     *      - Select components matching specified class (manufature/model)
-     *              "{\"manufacturer\":\"Contoso\",\"model\":\"USB-Motor-0001\"}"
-     *
-     * @param selectorJson A stringified json containing one or more properties use for components selection.
-     * @return Returns a serialized json data containing components information.
-     * Caller must call FreeString function when done with the returned string.
+     * @brief Returns the serialized components of @p allComponentsValue that contain all properties (name & value)
+     * specified in @p selectorJson.
      */
-    char* SelectComponents(const char* selectorJson)
+    static char* _SelectComponents(const JSON_Value* allComponentsValue, const char* selectorJson)
     {
         char* outputString = nullptr;
 
-        JSON_Value* allComponentsValue = nullptr;
+        JSON_Value* selectedValue = nullptr;
         JSON_Array* componentsArray = nullptr;
 
         JSON_Value* selectorValue = json_parse_string(selectorJson);
@@ -179,10 +186,8 @@ extern "C"
             goto done;
         }
 
-        // NOTE: For demonstration purposes, we're popoulating components data by reading from
-        // the specified 'component inventory' file.
-        allComponentsValue = _GetAllComponentsFromFile(g_contosoComponentInventoryFilePath);
-        componentsArray = json_object_get_array(json_object(allComponentsValue), "components");
+        selectedValue = json_value_deep_copy(allComponentsValue);
+        componentsArray = json_object_get_array(json_object(selectedValue), "components");
         if (componentsArray == nullptr)
         {
             goto done;
@@ -199,19 +204,218 @@ extern "C"
                 if (!matched)
                 {
                     json_array_remove(componentsArray, (size_t)i);
+                    break;
                 }
             }
         }
 
-        outputString = json_serialize_to_string_pretty(allComponentsValue);
+        outputString = json_serialize_to_string_pretty(selectedValue);
 
     done:
         json_value_free(selectorValue);
-        json_value_free(allComponentsValue);
+        json_value_free(selectedValue);
 
         return outputString;
     }
 
+    /**
+     * @brief Maps the compiled component inventory, if it's compiled from the JSON inventory as it is now.
+     *
+     * @param[out] file The mapped file. Close it with ADUC_ComponentInventoryFile_Close.
+     * @returns False if there's no compiled inventory, or it's stale, so that the JSON inventory must be read.
+     */
+    static bool _OpenCompiledInventoryFile(ADUC_ComponentInventoryFile* file)
+    {
+        if (!ADUC_ComponentInventoryFile_Open(g_contosoCompiledComponentInventoryFilePath, file))
+        {
+            return false;
+        }
+
+        if (!ADUC_ComponentInventoryFile_IsCompiledFrom(file, g_contosoComponentInventoryFilePath))
+        {
+            ADUC_ComponentInventoryFile_Close(file);
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Returns the serialized components of the compiled inventory @p file that contain all properties
+     * (name & value) specified in @p selectorJson.
+     *
+     * @param file The mapped component inventory file.
+     * @param selectorJson The stringified json selector.
+     * @param[out] supported Set to false if the selector has more properties than a query, so that it must be
+     * matched against the JSON inventory.
+     */
+    static char* _SelectComponentsFromInventoryFile(
+        const ADUC_ComponentInventoryFile* file, const char* selectorJson, bool* supported)
+    {
+        char* outputString = nullptr;
+        ADUC_ComponentInventoryQuery query;
+        size_t componentIndex = 0;
+
+        JSON_Value* selectedValue = nullptr;
+        JSON_Array* componentsArray = nullptr;
+
+        JSON_Value* selectorValue = json_parse_string(selectorJson);
+        JSON_Object* selector = json_object(selectorValue);
+
+        *supported = true;
+
+        if (selector == nullptr)
+        {
+            goto done;
+        }
+
+        // A property that isn't a string matches nothing, like an empty one.
+        ADUC_ComponentInventoryFile_BeginQuery(file, &query);
+        for (size_t s = 0; s < json_object_get_count(selector); s++)
+        {
+            const char* value = json_string(json_object_get_value_at(selector, s));
+            if (!ADUC_ComponentInventoryFile_AddQueryTerm(
+                    file, &query, json_object_get_name(selector, s), value == nullptr ? "" : value))
+            {
+                *supported = false;
+                goto done;
+            }
+        }
+
+        selectedValue = json_value_init_object();
+        if (json_object_set_value(json_object(selectedValue), "components", json_value_init_array()) != JSONSuccess)
+        {
+            goto done;
+        }
+
+        componentsArray = json_object_get_array(json_object(selectedValue), "components");
+        while (ADUC_ComponentInventoryFile_NextMatch(file, &query, &componentIndex))
+        {
+            JSON_Value* componentValue =
+                json_parse_string(ADUC_ComponentInventoryFile_GetComponentJson(file, componentIndex));
+            _PopulateComponentProperties(json_object(componentValue), componentIndex);
+            if (json_array_append_value(componentsArray, componentValue) != JSONSuccess)
+            {
+                json_value_free(componentValue);
+                goto done;
+            }
+        }
+
+        outputString = json_serialize_to_string_pretty(selectedValue);
+
+    done:
+        json_value_free(selectorValue);
+        json_value_free(selectedValue);
+
+        return outputString;
+    }
+
+    /**
+     * @brief Select component(s) that contain property or properties matching specified in @p selectorJson string.
+     *
+     * Example input json:
+     *      - Select all components belong to a 'Motors' group
+     *              "{\"group\":\"Motors\"}"
+     *
+     *      - Select a component with name equals 'left-motor'
+     *              "{\"name\":\"left-motor\"}"
+     *
+     *      - Select components matching specified class (manufature/model)
+     *              "{\"manufacturer\":\"Contoso\",\"model\":\"USB-Motor-0001\"}"
+     *
+     * @param selectorJson A stringified json containing one or more properties use for components selection.
+     * @return Returns a serialized json data containing components information.
+     * Caller must call FreeString function when done with the returned string.
+     */
+    char* SelectComponents(const char* selectorJson)
+    {
+        ADUC_ComponentInventoryFile file;
+        if (_OpenCompiledInventoryFile(&file))
+        {
+            bool supported = false;
+            char* outputString = _SelectComponentsFromInventoryFile(&file, selectorJson, &supported);
+            ADUC_ComponentInventoryFile_Close(&file);
+            if (supported)
+            {
+                return outputString;
+            }
+        }
+
+        // NOTE: For demonstration purposes, we're popoulating components data by reading from
+        // the specified 'component inventory' file.
+        JSON_Value* allComponentsValue = _GetAllComponentsFromFile(g_contosoComponentInventoryFilePath);
+        char* outputString = _SelectComponents(allComponentsValue, selectorJson);
+        json_value_free(allComponentsValue);
+        return outputString;
+    }
+
+    /**
+     * @brief Selects the components matching each of @p selectors, reading the component inventory file at most once.
+     *
+     * @param selectors The stringified json selectors.
+     * @param selectorCount The number of @p selectors.
+     * @param[out] resultOffsets The offset of each selector's result in the returned buffer.
+     * @return Returns the results of all @p selectors, one after the other, each null-terminated.
+     * Caller must call FreeComponentsDataString function when done with the returned buffer.
+     */
+    char* SelectComponentsBatch(const char* const* selectors, size_t selectorCount, size_t* resultOffsets)
+    {
+        std::string results;
+        char* buffer = nullptr;
+        ADUC_ComponentInventoryFile file;
+        const bool hasFile = _OpenCompiledInventoryFile(&file);
+        JSON_Value* allComponentsValue = nullptr;
+
+        for (size_t i = 0; i < selectorCount; i++)
+        {
+            bool supported = false;
+            char* outputString =
+                hasFile ? _SelectComponentsFromInventoryFile(&file, selectors[i], &supported) : nullptr;
+            if (!supported)
+            {
+                // The JSON inventory is read once, and only if the compiled one can't answer.
+                if (allComponentsValue == nullptr)
+                {
+                    allComponentsValue = _GetAllComponentsFromFile(g_contosoComponentInventoryFilePath);
+                    if (allComponentsValue == nullptr)
+                    {
+                        ADUC_ComponentInventoryFile_Close(&file);
+                        return nullptr;
+                    }
+                }
+
+                outputString = _SelectComponents(allComponentsValue, selectors[i]);
+            }
+
+            resultOffsets[i] = results.size();
+            if (outputString != nullptr)
+            {
+                results.append(outputString);
+                json_free_serialized_string(outputString);
+            }
+            results.push_back('\0');
+        }
+
+        json_value_free(allComponentsValue);
+        ADUC_ComponentInventoryFile_Close(&file);
+
+        buffer = static_cast<char*>(malloc(results.size()));
+        if (buffer != nullptr)
+        {
+            memcpy(buffer, results.data(), results.size());
+        }
+
+        return buffer;
+    }
+
+    /**
+     * @brief Components are selected by their string fields, so the agent may answer selections from its cache.
+     */
+    bool SelectsByStringFields()
+    {
+        return true;
+    }
+
     /**
      * @brief Returns all components information in JSON format.
      * @param includeProperties Indicates whether to include optional component's properties in the output string.
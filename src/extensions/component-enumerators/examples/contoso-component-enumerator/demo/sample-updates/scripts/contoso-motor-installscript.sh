@@ -160,7 +160,10 @@ output(){
 
 result(){
     # NOTE: dont' insert timestamp in result file. 
-    if [ -z $result_file ]; then
+    if [ -n "$ADUC_RESULT_FD" ]; then
+        # The agent reads the result, a single line of JSON, from this file descriptor.
+        echo "$@" >&"$ADUC_RESULT_FD"
+    elif [ -z $result_file ]; then
         echo "$@" >&1
     else
         echo "$@" > "$result_file"
@@ -1,23 +1,1503 @@
 /**
  * @file curl_content_downloader.cpp
- * @brief Content Downloader Extension using curl command.
+ * @brief Content Downloader Extension using libcurl.
  *
  * @copyright Copyright (c) Microsoft Corporation.
  * Licensed under the MIT License.
  */
+#include "aduc/connection_string_utils.h"
 #include "aduc/content_downloader_extension.hpp"
+#include "aduc/content_encoding_utils.h"
+#include "aduc/download_throttle.h"
 #include "aduc/hash_utils.h"
 #include "aduc/logging.h"
-#include "aduc/process_utils.hpp"
+#include "aduc/system_utils.h"
 
-#include <atomic>
+#include <algorithm> // for std::min
+#include <chrono>
+#include <curl/curl.h>
+#include <errno.h>
+#include <fcntl.h> // for open, sync_file_range, posix_fadvise
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new> // for std::nothrow
 #include <sstream>
 #include <stdio.h> // for FILE
-#include <stdlib.h> // for calloc
+#include <stdlib.h> // for calloc, free
+#include <string.h> // for memcpy
 #include <strings.h> // for strcasecmp
 #include <sys/stat.h> // for stat
+#include <unistd.h> // for access, fdatasync, ftruncate, pwrite
 #include <vector>
 
+namespace
+{
+/**
+ * @brief The minimum interval between two InProgress download progress reports.
+ */
+constexpr std::chrono::seconds c_progressReportInterval{ 1 };
+
+/**
+ * @brief The maximum number of redirects to follow for a download.
+ */
+constexpr long c_maxRedirects = 10;
+
+/**
+ * @brief How long to wait for a LAN cache host to accept the connection before trying the next source, in seconds.
+ */
+constexpr long c_cacheHostConnectTimeoutSecs = 3;
+
+/**
+ * @brief How long a cache host that couldn't be reached is skipped.
+ */
+constexpr std::chrono::minutes c_cacheHostRetryInterval{ 10 };
+
+/**
+ * @brief How much content is written to the target file before it's submitted for writeback.
+ */
+constexpr off_t c_writebackWindowBytes = 8 * 1024 * 1024;
+
+/**
+ * @brief The smallest file downloaded over several connections at once, see DownloadSegments.
+ */
+constexpr uint64_t c_segmentedDownloadMinBytes = 64 * 1024 * 1024;
+
+/**
+ * @brief The smallest range of a file downloaded over a connection of its own.
+ */
+constexpr uint64_t c_minSegmentBytes = 16 * 1024 * 1024;
+
+/**
+ * @brief The maximum number of connections a file is downloaded over at once.
+ */
+constexpr uint64_t c_maxSegments = 4;
+
+/**
+ * @brief How much of the content the probe of a source downloads, see RankSources.
+ */
+constexpr curl_off_t c_probeBytes = 256 * 1024;
+
+/**
+ * @brief How long the probes of the sources of a file may take, in milliseconds.
+ */
+constexpr long c_probeTimeoutMs = 5000;
+
+/**
+ * @brief How long a transfer may go without receiving content before it continues from the next source, if any.
+ */
+constexpr std::chrono::seconds c_sourceStallTimeout{ 20 };
+
+/**
+ * @brief The transfer speed, in bytes per second, below which a transfer counts as stalled, see c_lowSpeedTimeSecs.
+ */
+constexpr long c_lowSpeedLimitBytesPerSec = 1;
+
+/**
+ * @brief How long a transfer may stay below c_lowSpeedLimitBytesPerSec before it fails, in seconds.
+ */
+constexpr long c_lowSpeedTimeSecs = 60;
+
+/**
+ * @brief A LAN cache host, e.g. a Connected Cache server.
+ */
+struct CacheHost
+{
+    std::string host; /**< The host name or address, optionally with a port. */
+    std::chrono::steady_clock::time_point retryAfter; /**< When the host may be tried again, after it was unreachable. */
+};
+
+/**
+ * @brief The cache hosts set with SetCacheHosts, in order, then the nested edge gateway, if any.
+ * Guarded by s_cacheHostsMutex.
+ */
+std::vector<CacheHost> s_configuredCacheHosts;
+std::vector<CacheHost> s_gatewayCacheHosts;
+std::mutex s_cacheHostsMutex;
+
+/**
+ * @brief libcurl share handle used by all downloads, so that connections, DNS lookups and TLS sessions
+ * are reused across the files of a workflow instead of being set up again for every file.
+ */
+CURLSH* s_curlShare = nullptr;
+
+/**
+ * @brief Locks protecting the data in s_curlShare, indexed by curl_lock_data.
+ */
+std::mutex s_curlShareLocks[CURL_LOCK_DATA_LAST];
+
+std::once_flag s_curlInitOnce;
+
+void CurlShareLock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr)
+{
+    UNREFERENCED_PARAMETER(handle);
+    UNREFERENCED_PARAMETER(access);
+    UNREFERENCED_PARAMETER(userptr);
+    s_curlShareLocks[data].lock();
+}
+
+void CurlShareUnlock(CURL* handle, curl_lock_data data, void* userptr)
+{
+    UNREFERENCED_PARAMETER(handle);
+    UNREFERENCED_PARAMETER(userptr);
+    s_curlShareLocks[data].unlock();
+}
+
+/**
+ * @brief Initializes libcurl and the share handle, once per process.
+ * @returns true if libcurl is ready to use.
+ */
+bool InitializeCurl()
+{
+    std::call_once(s_curlInitOnce, []() {
+        const CURLcode code = curl_global_init(CURL_GLOBAL_DEFAULT);
+        if (code != CURLE_OK)
+        {
+            Log_Error("curl_global_init failed: %s", curl_easy_strerror(code));
+            return;
+        }
+
+        CURLSH* share = curl_share_init();
+        if (share == nullptr)
+        {
+            Log_Error("curl_share_init failed");
+            return;
+        }
+
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, CurlShareLock);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, CurlShareUnlock);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+        // Sharing the connection cache was added in libcurl 7.57.0. Without it each download
+        // still works, it just can't reuse the previous download's connection.
+        if (curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT) != CURLSHE_OK)
+        {
+            Log_Warn("libcurl cannot share connections, each file will use a new connection.");
+        }
+
+        s_curlShare = share;
+    });
+
+    return s_curlShare != nullptr;
+}
+
+/**
+ * @brief State of a single file download, passed to the libcurl callbacks.
+ */
+struct CurlDownloadContext
+{
+    FILE* file = nullptr; /**< The target file. */
+    int outputFd = -1; /**< The target stream, when there's no target file. */
+    ADUC_HashUtils_Context* hashContext = nullptr; /**< The hash of the content received so far. */
+    bool hashFailed = false; /**< Whether hashing the content failed. */
+    bool writeFailed = false; /**< Whether writing the content to the file failed. */
+    const char* workflowId = nullptr; /**< The workflow id, for progress reports. */
+    const char* fileId = nullptr; /**< The file id, for progress reports. */
+    uint64_t bytesTotal = 0; /**< The expected file size, for progress reports. */
+    ADUC_DownloadProgressCallback progressCallback = nullptr; /**< The progress callback. */
+    std::chrono::steady_clock::time_point lastProgressReport; /**< When progress was last reported. */
+    curl_off_t resumeFrom = 0; /**< The size of the partial content the download resumes from. */
+    bool throttled = true; /**< Whether the content comes over the uplink, and counts against the download throttle. */
+    off_t fileOffset = 0; /**< The size of the content written to the target file or stream. */
+    off_t writebackOffset = 0; /**< Where the content not submitted for writeback yet starts. */
+    off_t previousWritebackOffset = 0; /**< Where the content submitted for writeback, not yet written, starts. */
+    const ADUC_CancellationToken* cancellationToken = nullptr; /**< Aborts the transfer once cancelled, or nullptr. */
+    ADUC_ContentDecoder* decoder = nullptr; /**< Decodes the transport encoding of the content, or nullptr. */
+    ADUC_HashUtils_Context* transportHashContext = nullptr; /**< The hash of the encoded content, or nullptr. */
+    bool decodeFailed = false; /**< Whether the content received isn't validly encoded. */
+    uint64_t maxDecodedSize = 0; /**< The most content decoded, past which the content isn't validly encoded. */
+    const char* sourceUrl = nullptr; /**< The URL the content comes from, or nullptr for the download URI. */
+    bool abortOnStall = false; /**< Whether a stalled transfer is aborted, to continue from another source. */
+    bool stalled = false; /**< Whether the transfer was aborted as no content arrived for c_sourceStallTimeout. */
+    std::chrono::steady_clock::time_point lastContentTime; /**< When content last arrived, or the transfer started. */
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::time_point::max(); /**< When the download times out, see SetDeadline. */
+};
+
+/**
+ * @brief Sets the deadline of the download of @p context to @p timeoutSecs from now; 0 for none.
+ */
+void SetDeadline(CurlDownloadContext* context, unsigned int timeoutSecs)
+{
+    context->deadline = (timeoutSecs == 0) ? std::chrono::steady_clock::time_point::max()
+                                           : std::chrono::steady_clock::now() + std::chrono::seconds{ timeoutSecs };
+}
+
+/**
+ * @brief Checks whether the deadline of the download of @p context has passed.
+ */
+bool IsPastDeadline(const CurlDownloadContext* context)
+{
+    return std::chrono::steady_clock::now() >= context->deadline;
+}
+
+/**
+ * @brief Limits the next transfer of @p curl to the time left until the deadline of @p context, if any.
+ */
+void SetTransferTimeout(CURL* curl, const CurlDownloadContext* context)
+{
+    long timeoutMs = 0;
+    if (context->deadline != std::chrono::steady_clock::time_point::max())
+    {
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            context->deadline - std::chrono::steady_clock::now());
+
+        // 0 means no timeout to libcurl, so a deadline already past times out right away instead.
+        timeoutMs = static_cast<long>(std::max<std::chrono::milliseconds::rep>(remaining.count(), 1));
+    }
+
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeoutMs);
+}
+
+/**
+ * @brief Submits the last window of the target file for writeback, waits for the window before it to be written, and
+ * drops that one from the page cache.
+ *
+ * Large payloads are written once and read back at most once, so keeping them cached only evicts the working set of
+ * the agent, and leaving the writeback to the kernel ends in a burst that stalls the eMMC. Writing back as the content
+ * arrives keeps the dirty pages to two windows. Best effort: failures only lose the hint.
+ */
+void WritebackTargetFile(CurlDownloadContext* context)
+{
+    if (fflush(context->file) != 0)
+    {
+        return;
+    }
+
+    const int fd = fileno(context->file);
+
+    sync_file_range(fd, context->writebackOffset, context->fileOffset - context->writebackOffset, SYNC_FILE_RANGE_WRITE);
+
+    if (context->writebackOffset > context->previousWritebackOffset)
+    {
+        const off_t length = context->writebackOffset - context->previousWritebackOffset;
+        sync_file_range(
+            fd,
+            context->previousWritebackOffset,
+            length,
+            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, context->previousWritebackOffset, length, POSIX_FADV_DONTNEED);
+    }
+
+    context->previousWritebackOffset = context->writebackOffset;
+    context->writebackOffset = context->fileOffset;
+}
+
+/**
+ * @brief Closes the target file, first flushing its content to the disk with a single fdatasync, so that the file
+ * that's validated and renamed is the one that survives a power loss.
+ *
+ * @returns false if the content could not be written.
+ */
+bool CloseTargetFile(CurlDownloadContext* context)
+{
+    bool succeeded = fflush(context->file) == 0 && fdatasync(fileno(context->file)) == 0;
+
+    if (fclose(context->file) != 0)
+    {
+        succeeded = false;
+    }
+
+    context->file = nullptr;
+    return succeeded;
+}
+
+/**
+ * @brief Writes content of the file to the target file or stream, and hashes it, so that the file doesn't need to be
+ * read back for validation.
+ * @returns false if the content could not be hashed or written.
+ */
+bool WriteContent(CurlDownloadContext* context, const uint8_t* data, size_t dataSize)
+{
+    if (!ADUC_HashUtils_ContextInput(context->hashContext, data, dataSize))
+    {
+        context->hashFailed = true;
+        return false;
+    }
+
+    if (context->file != nullptr)
+    {
+        if (fwrite(data, 1, dataSize, context->file) != dataSize)
+        {
+            context->writeFailed = true;
+            return false;
+        }
+
+        context->fileOffset += static_cast<off_t>(dataSize);
+        if (context->fileOffset - context->writebackOffset >= c_writebackWindowBytes)
+        {
+            WritebackTargetFile(context);
+        }
+
+        return true;
+    }
+
+    for (size_t written = 0; written < dataSize;)
+    {
+        const ssize_t count = write(context->outputFd, data + written, dataSize - written);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            context->writeFailed = true;
+            return false;
+        }
+
+        written += static_cast<size_t>(count);
+    }
+
+    context->fileOffset += static_cast<off_t>(dataSize);
+    return true;
+}
+
+/**
+ * @brief ADUC_ContentDecoder_OutputFunc that writes the decoded content, see WriteContent.
+ */
+bool WriteDecodedContent(const uint8_t* data, size_t size, void* context)
+{
+    auto* downloadContext = static_cast<CurlDownloadContext*>(context);
+
+    // Content that decodes to more than expected, e.g. a decompression bomb, mustn't fill the disk before its hash
+    // can be checked.
+    if (size > downloadContext->maxDecodedSize - static_cast<uint64_t>(downloadContext->fileOffset))
+    {
+        Log_Error(
+            "Decoded content exceeds %llu bytes, aborting",
+            static_cast<unsigned long long>(downloadContext->maxDecodedSize));
+        return false;
+    }
+
+    return WriteContent(downloadContext, data, size);
+}
+
+/**
+ * @brief libcurl write callback. Writes the content as it arrives, decoding its transport encoding first, if any.
+ * @returns The number of bytes handled. Anything other than size * nmemb aborts the transfer.
+ */
+size_t CurlWriteCallback(char* data, size_t size, size_t nmemb, void* userdata)
+{
+    auto* context = static_cast<CurlDownloadContext*>(userdata);
+    const size_t dataSize = size * nmemb;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    const auto* bytes = reinterpret_cast<const uint8_t*>(data);
+
+    // Take the received bytes from the agent's bandwidth budget. While this waits, libcurl stops reading from the
+    // socket, so TCP flow control slows the sender down.
+    if (context->throttled)
+    {
+        ADUC_DownloadThrottle_Consume(dataSize);
+    }
+
+    // After the throttle, so that waiting for the bandwidth budget doesn't count as a stall.
+    context->lastContentTime = std::chrono::steady_clock::now();
+
+    if (context->decoder == nullptr)
+    {
+        return WriteContent(context, bytes, dataSize) ? dataSize : 0;
+    }
+
+    if (context->transportHashContext != nullptr
+        && !ADUC_HashUtils_ContextInput(context->transportHashContext, bytes, dataSize))
+    {
+        context->hashFailed = true;
+        return 0;
+    }
+
+    if (!ADUC_ContentDecoder_Input(context->decoder, bytes, dataSize, WriteDecodedContent, context))
+    {
+        // Unless the decoded content couldn't be hashed or written, the content received isn't validly encoded.
+        context->decodeFailed = !context->hashFailed && !context->writeFailed;
+        return 0;
+    }
+
+    return dataSize;
+}
+
+/**
+ * @brief Sets up @p context to decode the transport encoding of @p entity, if it has one, and to hash the encoded
+ * content with @p transportHashContext, if @p entity has transport hashes.
+ * @returns 0 on success, or the extended result code of the failure.
+ */
+ADUC_Result_t StartTransportDecoding(
+    const ADUC_FileEntity* entity, CurlDownloadContext* context, ADUC_HashUtils_Context* transportHashContext)
+{
+    if (entity->TransportEncoding == nullptr)
+    {
+        return 0;
+    }
+
+    context->decoder = ADUC_ContentDecoder_Create(entity->TransportEncoding);
+    if (context->decoder == nullptr)
+    {
+        Log_Error("Transport encoding '%s' of %s is not supported", entity->TransportEncoding, entity->TargetFilename);
+        return ADUC_ERC_CONTENT_DOWNLOADER_TRANSPORT_ENCODING_NOT_SUPPORTED;
+    }
+
+    context->maxDecodedSize =
+        entity->SizeInBytes != 0 ? static_cast<uint64_t>(entity->SizeInBytes) : ADUC_CONTENT_ENCODING_MAX_DECODED_SIZE;
+
+    if (entity->TransportHashCount == 0)
+    {
+        return 0;
+    }
+
+    SHAversion algorithm;
+    if (!ADUC_HashUtils_GetShaVersionForTypeString(
+            ADUC_HashUtils_GetHashType(entity->TransportHashes, entity->TransportHashCount, 0), &algorithm)
+        || !ADUC_HashUtils_ContextReset(transportHashContext, algorithm))
+    {
+        Log_Error("Transport hash type of %s is not supported", entity->TargetFilename);
+        return ADUC_ERC_VALIDATION_FILE_HASH_TYPE_NOT_SUPPORTED;
+    }
+
+    context->transportHashContext = transportHashContext;
+    return 0;
+}
+
+/**
+ * @brief Checks that the content received for @p context, if it has a transport encoding, is the complete encoded
+ * stream, and that its transport hash is valid.
+ * @returns 0 if it is, or the extended result code of the failure.
+ */
+ADUC_Result_t FinishTransportDecoding(const ADUC_FileEntity* entity, const CurlDownloadContext* context)
+{
+    if (context->decoder == nullptr)
+    {
+        return 0;
+    }
+
+    if (!ADUC_ContentDecoder_IsFinished(context->decoder))
+    {
+        Log_Error("The %s content of %s is incomplete", entity->TransportEncoding, entity->TargetFilename);
+        return ADUC_ERC_CONTENT_DOWNLOADER_TRANSPORT_DECODING_FAILURE;
+    }
+
+    if (context->transportHashContext != nullptr
+        && !ADUC_HashUtils_ContextResultHash(context->transportHashContext, entity->TransportHashes))
+    {
+        Log_Error("Transport hash for %s is not valid", entity->TargetFilename);
+        return ADUC_ERC_CONTENT_DOWNLOADER_INVALID_TRANSPORT_HASH;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Gets the size of the content transferred for @p entity, for progress reports: that of the encoded content if
+ * it has a transport encoding, 0 if that's unknown.
+ */
+uint64_t GetTransferSize(const ADUC_FileEntity* entity)
+{
+    return (entity->TransportEncoding != nullptr) ? entity->TransportSizeInBytes : entity->SizeInBytes;
+}
+
+/**
+ * @brief libcurl transfer info callback. Reports the bytes received, at most once per c_progressReportInterval.
+ * libcurl calls it at least once a second, even while no data arrives, so it also aborts cancelled transfers, and
+ * stalled ones that can continue from another source.
+ * @returns 0 to continue the transfer, 1 to abort it with CURLE_ABORTED_BY_CALLBACK.
+ */
+int CurlProgressCallback(
+    void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    UNREFERENCED_PARAMETER(ultotal);
+    UNREFERENCED_PARAMETER(ulnow);
+
+    auto* context = static_cast<CurlDownloadContext*>(clientp);
+    if (ADUC_CancellationToken_IsCancelled(context->cancellationToken))
+    {
+        return 1;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (context->abortOnStall && now - context->lastContentTime >= c_sourceStallTimeout)
+    {
+        context->stalled = true;
+        return 1;
+    }
+
+    if (context->progressCallback == nullptr || dlnow == 0)
+    {
+        return 0;
+    }
+
+    if (now - context->lastProgressReport < c_progressReportInterval)
+    {
+        return 0;
+    }
+
+    context->lastProgressReport = now;
+    context->progressCallback(
+        context->workflowId,
+        context->fileId,
+        ADUC_DownloadProgressState_InProgress,
+        static_cast<uint64_t>(context->resumeFrom + dlnow),
+        (context->bytesTotal != 0) ? context->bytesTotal : static_cast<uint64_t>(context->resumeFrom + dltotal));
+
+    return 0;
+}
+
+/**
+ * @brief Splits the comma-separated @p hosts, ignoring whitespace and empty entries.
+ */
+std::vector<CacheHost> ParseCacheHosts(const char* hosts)
+{
+    std::vector<CacheHost> cacheHosts;
+    if (hosts == nullptr)
+    {
+        return cacheHosts;
+    }
+
+    std::stringstream stream{ hosts };
+    std::string host;
+    while (std::getline(stream, host, ','))
+    {
+        const size_t first = host.find_first_not_of(" \t");
+        if (first != std::string::npos)
+        {
+            const size_t last = host.find_last_not_of(" \t");
+            cacheHosts.push_back({ host.substr(first, last - first + 1), {} });
+        }
+    }
+
+    return cacheHosts;
+}
+
+/**
+ * @brief Returns the cache hosts to ask for content, in order, skipping the ones recently unreachable.
+ */
+std::vector<std::string> GetAvailableCacheHosts()
+{
+    std::vector<std::string> hosts;
+    const auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(s_cacheHostsMutex);
+    for (const auto* cacheHosts : { &s_configuredCacheHosts, &s_gatewayCacheHosts })
+    {
+        for (const CacheHost& cacheHost : *cacheHosts)
+        {
+            if (cacheHost.retryAfter <= now)
+            {
+                hosts.push_back(cacheHost.host);
+            }
+        }
+    }
+
+    return hosts;
+}
+
+/**
+ * @brief Skips @p host for c_cacheHostRetryInterval.
+ */
+void SetCacheHostUnreachable(const std::string& host)
+{
+    const auto retryAfter = std::chrono::steady_clock::now() + c_cacheHostRetryInterval;
+
+    std::lock_guard<std::mutex> lock(s_cacheHostsMutex);
+    for (auto* cacheHosts : { &s_configuredCacheHosts, &s_gatewayCacheHosts })
+    {
+        for (CacheHost& cacheHost : *cacheHosts)
+        {
+            if (cacheHost.host == host)
+            {
+                cacheHost.retryAfter = retryAfter;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Gets the URL of the content of @p originUrl on the cache host @p host, in the form Connected Cache servers
+ * expect: the origin's path and query, with the origin host in the cacheHostOrigin parameter.
+ * e.g. http://cache/path/file?cacheHostOrigin=contoso.blob.core.windows.net
+ * @returns The URL, or an empty string if @p originUrl isn't an absolute URL.
+ */
+std::string GetCacheUrl(const std::string& host, const std::string& originUrl)
+{
+    const size_t schemeEnd = originUrl.find("://");
+    if (schemeEnd == std::string::npos)
+    {
+        return {};
+    }
+
+    const size_t authorityStart = schemeEnd + 3;
+    const size_t authorityEnd = originUrl.find_first_of("/?#", authorityStart);
+    const std::string authority = originUrl.substr(authorityStart, authorityEnd - authorityStart);
+    if (authority.empty())
+    {
+        return {};
+    }
+
+    std::string pathAndQuery =
+        (authorityEnd == std::string::npos) ? "/" : originUrl.substr(authorityEnd, originUrl.find('#', authorityEnd) - authorityEnd);
+    if (pathAndQuery[0] == '?')
+    {
+        pathAndQuery.insert(0, "/");
+    }
+
+    return "http://" + host + pathAndQuery + (pathAndQuery.find('?') == std::string::npos ? "?" : "&")
+        + "cacheHostOrigin=" + authority;
+}
+
+/**
+ * @brief Gets the path of the file that holds the content downloaded so far.
+ * The content is only moved to the target file once it's complete and its hash is valid.
+ */
+std::string GetPartialFilePath(const std::string& filePath)
+{
+    return filePath + ".partial";
+}
+
+/**
+ * @brief Gets the path of the journal that records what content the partial file belongs to.
+ */
+std::string GetJournalFilePath(const std::string& filePath)
+{
+    return filePath + ".partial.journal";
+}
+
+/**
+ * @brief Gets the journal content identifying @p entity. The URL isn't part of it, since it may carry
+ * short-lived tokens; the hash and size identify the content.
+ */
+std::string GetJournalContent(const ADUC_FileEntity* entity)
+{
+    std::stringstream content;
+    content << "hashType=" << ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0) << "\n"
+            << "hash=" << ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0) << "\n"
+            << "size=" << entity->SizeInBytes << "\n";
+    return content.str();
+}
+
+/**
+ * @brief Checks whether the journal at @p journalPath was written for @p entity.
+ */
+bool IsJournalForEntity(const std::string& journalPath, const ADUC_FileEntity* entity)
+{
+    std::ifstream journal(journalPath);
+    if (!journal)
+    {
+        return false;
+    }
+
+    std::stringstream content;
+    content << journal.rdbuf();
+    return content.str() == GetJournalContent(entity);
+}
+
+/**
+ * @brief Writes the journal for @p entity.
+ * @returns true on success.
+ */
+bool WriteJournal(const std::string& journalPath, const ADUC_FileEntity* entity)
+{
+    std::ofstream journal(journalPath, std::ios::trunc);
+    journal << GetJournalContent(entity);
+    journal.close();
+    return !journal.fail();
+}
+
+/**
+ * @brief Discards the partial content, so that the download starts over from the first byte.
+ * @returns true on success.
+ */
+bool RestartPartialFile(CurlDownloadContext* context)
+{
+    ADUC_HashUtils_ContextUnInit(context->hashContext);
+    context->resumeFrom = 0;
+    context->fileOffset = 0;
+    context->writebackOffset = 0;
+    context->previousWritebackOffset = 0;
+
+    return fflush(context->file) == 0 && ftruncate(fileno(context->file), 0) == 0
+        && ADUC_HashUtils_ContextReset(context->hashContext, context->hashContext->algorithm);
+}
+
+/**
+ * @brief Sets the libcurl options common to all downloads of @p entity to @p context, from its source URL. A transfer
+ * fails once it stalls for c_lowSpeedTimeSecs, or at the deadline of @p context.
+ */
+void SetDownloadOptions(CURL* curl, const ADUC_FileEntity* entity, CurlDownloadContext* context, char* curlError)
+{
+    curl_easy_setopt(curl, CURLOPT_URL, (context->sourceUrl != nullptr) ? context->sourceUrl : entity->DownloadUri);
+    curl_easy_setopt(curl, CURLOPT_SHARE, s_curlShare);
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, curlError);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, c_maxRedirects);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    // Prefer HTTP/2 over TLS, and wait for an existing connection to multiplex on rather than opening a new one.
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlWriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, context);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, CurlProgressCallback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, context);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, c_lowSpeedLimitBytesPerSec);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, c_lowSpeedTimeSecs);
+    SetTransferTimeout(curl, context);
+
+    const uint64_t perDownloadLimit = ADUC_DownloadThrottle_GetPerDownloadLimit();
+    if (perDownloadLimit != 0)
+    {
+        curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, static_cast<curl_off_t>(perDownloadLimit));
+    }
+}
+
+/**
+ * @brief Gets the extended result code of a failed transfer: the HTTP status if the server refused the request, so
+ * that the retry policy of the extension manager tells e.g. a 404 from a 503, or else the curl code.
+ */
+ADUC_Result_t GetTransferFailureCode(CURL* curl, CURLcode curlCode)
+{
+    long httpStatus = 0;
+    if (curlCode == CURLE_HTTP_RETURNED_ERROR
+        && curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpStatus) == CURLE_OK && httpStatus >= 400
+        && httpStatus <= 599)
+    {
+        return ADUC_ERROR_CURL_DOWNLOADER_HTTP_FAILURE(static_cast<int>(httpStatus));
+    }
+
+    return ADUC_ERROR_CURL_DOWNLOADER_EXTERNAL_FAILURE(curlCode);
+}
+
+/**
+ * @brief Gets the URIs the content of @p entity can be downloaded from: its download URI, then its alternate URIs.
+ */
+std::vector<std::string> GetSources(const ADUC_FileEntity* entity)
+{
+    std::vector<std::string> sources{ entity->DownloadUri };
+    for (size_t index = 0; index < entity->AlternateUriCount; ++index)
+    {
+        sources.emplace_back(entity->AlternateUris[index]);
+    }
+
+    return sources;
+}
+
+/**
+ * @brief The probe of a source, see RankSources.
+ */
+struct Probe
+{
+    CURL* curl = nullptr; /**< The transfer of the start of the content. */
+    curl_off_t size = 0; /**< The bytes the probe downloads. */
+    curl_off_t received = 0; /**< The bytes received so far. */
+    bool completed = false; /**< Whether all the bytes of the probe were received. */
+};
+
+/**
+ * @brief libcurl write callback of a probe. Discards the content, and ends the transfer once it gets more than it
+ * asked for, e.g. from a server that ignores the range and sends the whole file.
+ */
+size_t ProbeWriteCallback(char* data, size_t size, size_t nmemb, void* userdata)
+{
+    UNREFERENCED_PARAMETER(data);
+    auto* probe = static_cast<Probe*>(userdata);
+
+    probe->received += static_cast<curl_off_t>(size * nmemb);
+    return (probe->received <= probe->size) ? size * nmemb : 0;
+}
+
+/**
+ * @brief Races probes of the first c_probeBytes of the content of @p entity from each of @p sources, and orders the
+ * sources by how fast their probes completed. The race ends at c_probeTimeoutMs, or once the probes still running
+ * took twice as long as the fastest one; their sources, and those whose probe failed, follow in their original order,
+ * to fail over to. The probes go through the share handle, so the download then reuses the connection they opened.
+ *
+ * @returns The sources, fastest first.
+ */
+std::vector<std::string> RankSources(
+    const ADUC_FileEntity* entity,
+    const std::vector<std::string>& sources,
+    const ADUC_CancellationToken* cancellationToken)
+{
+    const curl_off_t probeSize = (entity->SizeInBytes != 0)
+        ? std::min<curl_off_t>(c_probeBytes, static_cast<curl_off_t>(entity->SizeInBytes))
+        : c_probeBytes;
+    const std::string range = "0-" + std::to_string(probeSize - 1);
+    const auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::milliseconds{ c_probeTimeoutMs };
+    std::vector<Probe> probes(sources.size());
+    std::vector<std::string> ranked;
+    int running = 0;
+
+    CURLM* multi = curl_multi_init();
+    if (multi == nullptr)
+    {
+        return sources;
+    }
+
+    for (size_t index = 0; index < sources.size(); ++index)
+    {
+        Probe& probe = probes[index];
+
+        probe.size = probeSize;
+        probe.curl = curl_easy_init();
+        if (probe.curl == nullptr)
+        {
+            continue;
+        }
+
+        curl_easy_setopt(probe.curl, CURLOPT_URL, sources[index].c_str());
+        curl_easy_setopt(probe.curl, CURLOPT_SHARE, s_curlShare);
+        curl_easy_setopt(probe.curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(probe.curl, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(probe.curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(probe.curl, CURLOPT_MAXREDIRS, c_maxRedirects);
+        curl_easy_setopt(probe.curl, CURLOPT_TIMEOUT_MS, c_probeTimeoutMs);
+        curl_easy_setopt(probe.curl, CURLOPT_RANGE, range.c_str());
+        curl_easy_setopt(probe.curl, CURLOPT_WRITEFUNCTION, ProbeWriteCallback);
+        curl_easy_setopt(probe.curl, CURLOPT_WRITEDATA, &probe);
+
+        curl_multi_add_handle(multi, probe.curl);
+    }
+
+    do
+    {
+        if (curl_multi_perform(multi, &running) != CURLM_OK)
+        {
+            break;
+        }
+
+        int queued = 0;
+        for (CURLMsg* message = curl_multi_info_read(multi, &queued); message != nullptr;
+             message = curl_multi_info_read(multi, &queued))
+        {
+            for (size_t index = 0; index < probes.size() && message->msg == CURLMSG_DONE; ++index)
+            {
+                Probe& probe = probes[index];
+                if (probe.curl != message->easy_handle
+                    || (message->data.result != CURLE_OK && probe.received <= probe.size))
+                {
+                    continue;
+                }
+
+                const auto now = std::chrono::steady_clock::now();
+                if (ranked.empty())
+                {
+                    deadline = std::min(deadline, now + (now - start));
+                }
+
+                probe.completed = true;
+                ranked.push_back(sources[index]);
+            }
+        }
+
+        if (running > 0 && !ADUC_CancellationToken_IsCancelled(cancellationToken))
+        {
+            curl_multi_wait(multi, nullptr, 0, 100, nullptr);
+        }
+    } while (running > 0 && std::chrono::steady_clock::now() < deadline
+             && !ADUC_CancellationToken_IsCancelled(cancellationToken));
+
+    const bool anyCompleted = !ranked.empty();
+
+    for (size_t index = 0; index < probes.size(); ++index)
+    {
+        if (!probes[index].completed)
+        {
+            ranked.push_back(sources[index]);
+        }
+
+        if (probes[index].curl != nullptr)
+        {
+            curl_multi_remove_handle(multi, probes[index].curl);
+            curl_easy_cleanup(probes[index].curl);
+        }
+    }
+
+    curl_multi_cleanup(multi);
+
+    if (anyCompleted)
+    {
+        Log_Info(
+            "Downloading %s from %s, the fastest of %zu sources.",
+            entity->TargetFilename,
+            ranked.front().c_str(),
+            sources.size());
+    }
+    else
+    {
+        Log_Warn("No source of %s answered its probe, trying them in order.", entity->TargetFilename);
+    }
+
+    return ranked;
+}
+
+/**
+ * @brief Returns whether the failed transfer of @p context can continue from another source: it failed in transit or
+ * stalled, rather than on the target or by cancellation, its content isn't encoded, so that a Range request picks
+ * it up where it stopped, and the download has time left.
+ */
+bool CanContinueFromNextSource(CURLcode curlCode, const CurlDownloadContext* context)
+{
+    if (curlCode == CURLE_OK || context->writeFailed || context->hashFailed || context->decodeFailed
+        || context->decoder != nullptr || IsPastDeadline(context))
+    {
+        return false;
+    }
+
+    return curlCode != CURLE_ABORTED_BY_CALLBACK || context->stalled;
+}
+
+/**
+ * @brief Performs the transfer of @p curl, set up with SetDownloadOptions for @p context, and whenever it fails in
+ * transit or stalls, continues it from the next of @p sources with a Range request from where it stopped. The content
+ * is hashed as it arrives, whichever source it comes from.
+ *
+ * @param curl The transfer.
+ * @param context The download context, from the source at @p sourceIndex.
+ * @param sources The sources of the content, in the order to try them.
+ * @param sourceIndex The index in @p sources of the source of @p context. Receives that of the last source tried.
+ * @returns The result of the last transfer.
+ */
+CURLcode PerformWithFailover(
+    CURL* curl, CurlDownloadContext* context, const std::vector<std::string>& sources, size_t* sourceIndex)
+{
+    for (;;)
+    {
+        context->abortOnStall = *sourceIndex + 1 < sources.size();
+        context->stalled = false;
+        context->lastContentTime = std::chrono::steady_clock::now();
+        SetTransferTimeout(curl, context);
+
+        const CURLcode curlCode = curl_easy_perform(curl);
+        if (!context->abortOnStall || !CanContinueFromNextSource(curlCode, context))
+        {
+            return curlCode;
+        }
+
+        Log_Warn(
+            "Transfer from %s %s (curl code: %d), continuing from %s at byte %lld.",
+            sources[*sourceIndex].c_str(),
+            context->stalled ? "stalled" : "failed",
+            curlCode,
+            sources[*sourceIndex + 1].c_str(),
+            static_cast<long long>(context->fileOffset));
+
+        ++*sourceIndex;
+        context->sourceUrl = sources[*sourceIndex].c_str();
+        context->resumeFrom = context->fileOffset;
+        curl_easy_setopt(curl, CURLOPT_URL, context->sourceUrl);
+        curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, static_cast<curl_off_t>(context->resumeFrom));
+    }
+}
+
+/**
+ * @brief Checks whether the file at @p filePath was verified against the first hash of @p entity before, and hasn't
+ * changed since, see ADUC_DownloadVerifiedFile_Persist. Only the agent's own verified file store can vouch for it.
+ *
+ * @param filePath The full path to the file.
+ * @param entity The file entity.
+ * @return true if the file doesn't need to be hashed again.
+ */
+bool IsPersistedVerifiedFile(const std::string& filePath, const ADUC_FileEntity* entity)
+{
+    ADUC_DownloadVerifiedFile verifiedFile = {};
+
+    const bool verified = ADUC_DownloadVerifiedFile_InitFromPersisted(
+        &verifiedFile,
+        filePath.c_str(),
+        ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0),
+        ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0));
+
+    ADUC_DownloadVerifiedFile_UnInit(&verifiedFile);
+    return verified;
+}
+
+/**
+ * @brief Downloads the content of @p entity to @p filePath from the first cache host that has it with a valid hash.
+ * @returns true on success; false to download the content from its origin.
+ */
+bool DownloadFromCacheHosts(
+    const ADUC_FileEntity* entity,
+    const std::string& filePath,
+    SHAversion algVersion,
+    const char* workflowId,
+    ADUC_DownloadProgressCallback downloadProgressCallback,
+    const ADUC_CancellationToken* cancellationToken,
+    std::chrono::steady_clock::time_point deadline)
+{
+    // A file of its own, so that a partial download from the origin is kept to resume from.
+    const std::string cacheFilePath = filePath + ".cache";
+
+    for (const std::string& host : GetAvailableCacheHosts())
+    {
+        const std::string url = GetCacheUrl(host, entity->DownloadUri);
+        if (url.empty())
+        {
+            return false;
+        }
+
+        CURL* curl = curl_easy_init();
+        if (curl == nullptr)
+        {
+            return false;
+        }
+
+        char curlError[CURL_ERROR_SIZE] = {};
+        ADUC_HashUtils_Context hashContext = {};
+        ADUC_HashUtils_Context transportHashContext = {};
+        CurlDownloadContext context;
+        CURLcode curlCode = CURLE_FAILED_INIT;
+        bool isValid = false;
+
+        context.file = fopen(cacheFilePath.c_str(), "wb");
+        context.hashContext = &hashContext;
+        context.workflowId = workflowId;
+        context.fileId = entity->FileId;
+        context.bytesTotal = GetTransferSize(entity);
+        context.progressCallback = downloadProgressCallback;
+        context.throttled = false;
+        context.cancellationToken = cancellationToken;
+        context.deadline = deadline;
+
+        // Preallocated, the file is laid out in one extent rather than in the order the blocks were written.
+        if (context.file != nullptr
+            && ADUC_SystemUtils_ReserveFileSpace(fileno(context.file), 0, static_cast<off_t>(entity->SizeInBytes)) == 0
+            && ADUC_HashUtils_ContextReset(&hashContext, algVersion)
+            && StartTransportDecoding(entity, &context, &transportHashContext) == 0)
+        {
+            SetDownloadOptions(curl, entity, &context, curlError);
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, c_cacheHostConnectTimeoutSecs);
+            curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, static_cast<curl_off_t>(0));
+
+            curlCode = curl_easy_perform(curl);
+
+            if (!CloseTargetFile(&context))
+            {
+                context.writeFailed = true;
+            }
+
+            isValid = curlCode == CURLE_OK && !context.hashFailed && !context.writeFailed
+                && FinishTransportDecoding(entity, &context) == 0
+                && ADUC_HashUtils_ContextResultHash(&hashContext, entity->Hash);
+        }
+
+        if (context.file != nullptr)
+        {
+            fclose(context.file);
+        }
+
+        ADUC_ContentDecoder_Free(context.decoder);
+        ADUC_HashUtils_ContextUnInit(&transportHashContext);
+        ADUC_HashUtils_ContextUnInit(&hashContext);
+        curl_easy_cleanup(curl);
+
+        if (isValid && rename(cacheFilePath.c_str(), filePath.c_str()) == 0)
+        {
+            Log_Info("Downloaded '%s' from cache host %s", entity->TargetFilename, host.c_str());
+            return true;
+        }
+
+        remove(cacheFilePath.c_str());
+
+        if (curlCode == CURLE_ABORTED_BY_CALLBACK)
+        {
+            return false;
+        }
+
+        if (curlCode == CURLE_COULDNT_RESOLVE_HOST || curlCode == CURLE_COULDNT_CONNECT
+            || curlCode == CURLE_OPERATION_TIMEDOUT)
+        {
+            SetCacheHostUnreachable(host);
+        }
+
+        Log_Warn(
+            "Cannot download '%s' from cache host %s (curl code: %d, error: %s), trying the next source.",
+            entity->TargetFilename,
+            host.c_str(),
+            curlCode,
+            (curlCode == CURLE_OK) ? "invalid content" : curlError);
+    }
+
+    return false;
+}
+
+/**
+ * @brief State of the download of a range of the target file, passed to RangeWriteCallback.
+ */
+struct RangeWriteContext
+{
+    int fd = -1; /**< The target file. */
+    off_t offset = 0; /**< Where the next content received goes. */
+    off_t end = 0; /**< Where the range ends, exclusive. */
+    bool writeFailed = false; /**< Whether writing the content to the file failed. */
+    CURL* curl = nullptr; /**< The transfer, if its content must be partial content from the first byte. */
+};
+
+/**
+ * @brief libcurl write callback for RepairCorruptedChunks and DownloadSegments. Writes the content in place in the
+ * target file.
+ * @returns The number of bytes handled. Anything other than size * nmemb aborts the transfer, e.g. if the server
+ * ignores the range and sends more.
+ */
+size_t RangeWriteCallback(char* data, size_t size, size_t nmemb, void* userdata)
+{
+    auto* context = static_cast<RangeWriteContext*>(userdata);
+    const size_t dataSize = size * nmemb;
+    long responseCode = 0;
+
+    if (static_cast<off_t>(dataSize) > context->end - context->offset)
+    {
+        context->writeFailed = true;
+        return 0;
+    }
+
+    // A server that ignores the range sends the whole file; stop before its start is written in the wrong place.
+    if (context->curl != nullptr && curl_easy_getinfo(context->curl, CURLINFO_RESPONSE_CODE, &responseCode) == CURLE_OK
+        && responseCode != 206)
+    {
+        context->writeFailed = true;
+        return 0;
+    }
+
+    ADUC_DownloadThrottle_Consume(dataSize);
+
+    for (size_t written = 0; written < dataSize;)
+    {
+        const ssize_t count = pwrite(context->fd, data + written, dataSize - written, context->offset);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            context->writeFailed = true;
+            return 0;
+        }
+
+        written += static_cast<size_t>(count);
+        context->offset += count;
+    }
+
+    return dataSize;
+}
+
+/**
+ * @brief Downloads again only the chunks of the downloaded file whose chunk hashes don't match, e.g. after the content
+ * was corrupted in transit, rather than the whole file.
+ *
+ * @param curl The handle of the download, with its options set.
+ * @param entity The file entity. Nothing is repaired if it has no chunk hashes.
+ * @param partialFilePath The downloaded file.
+ * @param algVersion The hash algorithm of the first hash of @p entity.
+ * @returns true if the file is now valid.
+ */
+bool RepairCorruptedChunks(
+    CURL* curl, const ADUC_FileEntity* entity, const std::string& partialFilePath, SHAversion algVersion)
+{
+    const size_t chunkCount = entity->ChunkHashCount;
+    const size_t chunkSize = entity->ChunkSizeInBytes;
+    RangeWriteContext context;
+    bool succeeded = false;
+    size_t repairedCount = 0;
+
+    if (chunkCount == 0)
+    {
+        return false;
+    }
+
+    std::unique_ptr<bool[]> chunkValid{ new (std::nothrow) bool[chunkCount]{} };
+    if (chunkValid == nullptr)
+    {
+        return false;
+    }
+
+    // Chunks cut short or past the end of the file are invalid, and downloaded again.
+    if (truncate(partialFilePath.c_str(), static_cast<off_t>(entity->SizeInBytes)) != 0)
+    {
+        return false;
+    }
+
+    if (ADUC_HashUtils_VerifyFileChunks(
+            partialFilePath.c_str(), chunkSize, entity->ChunkHashes, chunkCount, 0 /* threadCount */, chunkValid.get()))
+    {
+        // The chunks don't agree with the whole-file hash; the manifest is wrong, not the content.
+        Log_Error("Chunk hashes of %s are valid, but its hash isn't.", entity->TargetFilename);
+        return false;
+    }
+
+    context.fd = open(partialFilePath.c_str(), O_WRONLY | O_CLOEXEC);
+    if (context.fd == -1)
+    {
+        Log_Error("Cannot open %s for writing, errno %d", partialFilePath.c_str(), errno);
+        return false;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, static_cast<curl_off_t>(0));
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, RangeWriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &context);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        if (chunkValid[chunk])
+        {
+            continue;
+        }
+
+        const uint64_t start = static_cast<uint64_t>(chunk) * chunkSize;
+        const uint64_t end = std::min<uint64_t>(start + chunkSize, entity->SizeInBytes);
+        const std::string range = std::to_string(start) + "-" + std::to_string(end - 1);
+
+        context.offset = static_cast<off_t>(start);
+        context.end = static_cast<off_t>(end);
+
+        curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+        const CURLcode curlCode = curl_easy_perform(curl);
+        if (curlCode != CURLE_OK || context.writeFailed || context.offset != context.end)
+        {
+            Log_Error(
+                "Cannot download bytes %s of %s again (curl code: %d)",
+                range.c_str(),
+                entity->TargetFilename,
+                curlCode);
+            goto done;
+        }
+
+        ++repairedCount;
+    }
+
+    Log_Info("Downloaded %zu corrupted chunks of %s again.", repairedCount, entity->TargetFilename);
+
+    if (fdatasync(context.fd) != 0)
+    {
+        goto done;
+    }
+
+    succeeded = ADUC_HashUtils_IsValidFileHash(
+        partialFilePath.c_str(), ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0), algVersion);
+
+done:
+    curl_easy_setopt(curl, CURLOPT_RANGE, nullptr);
+    close(context.fd);
+
+    return succeeded;
+}
+
+/**
+ * @brief A range of the target file, downloaded over a connection of its own by DownloadSegments.
+ */
+struct Segment
+{
+    CURL* curl = nullptr; /**< The transfer of the range. */
+    off_t start = 0; /**< Where the range starts. */
+    RangeWriteContext write; /**< Where the content received goes. */
+    std::string range; /**< The range, in CURLOPT_RANGE form. */
+    char curlError[CURL_ERROR_SIZE] = {}; /**< The error message of the transfer. */
+};
+
+/**
+ * @brief Returns whether @p entity is downloaded over several connections at once: its content is large, isn't
+ * transport-encoded, and no previous attempt left partial content to resume from.
+ */
+bool IsSegmentedDownload(const ADUC_FileEntity* entity, const CurlDownloadContext* context)
+{
+    return entity->SizeInBytes >= c_segmentedDownloadMinBytes && context->decoder == nullptr
+        && context->resumeFrom == 0;
+}
+
+/**
+ * @brief Downloads the content of @p entity to the target file of @p context over several connections at once, each
+ * getting a range of the file with a Range request and writing it in place. A single connection can't carry more than
+ * its TCP window per round trip, which caps large downloads on high-latency links.
+ *
+ * The content arrives out of order, so it isn't hashed as it arrives; the caller hashes the file once it's complete.
+ *
+ * @param entity The file entity.
+ * @param context The download context, with the target file open. Its source, progress callback, cancellation token
+ * and abortOnStall apply; a stall fails the download with CURLE_OPERATION_TIMEDOUT.
+ * @param curlError Receives the error message of the first failed transfer.
+ * @param failureCode Receives the extended result code of the first failed transfer, see GetTransferFailureCode.
+ * @returns CURLE_OK on success; CURLE_RANGE_ERROR if the server doesn't serve ranges; CURLE_ABORTED_BY_CALLBACK if the
+ * download was cancelled.
+ */
+CURLcode DownloadSegments(
+    const ADUC_FileEntity* entity, CurlDownloadContext* context, char* curlError, ADUC_Result_t* failureCode)
+{
+    const uint64_t size = entity->SizeInBytes;
+    const uint64_t segmentCount = std::min(c_maxSegments, size / c_minSegmentBytes);
+    const uint64_t perDownloadLimit = ADUC_DownloadThrottle_GetPerDownloadLimit();
+    std::vector<Segment> segments(segmentCount);
+    CURLcode curlCode = CURLE_OK;
+    CURL* failedCurl = nullptr;
+    int running = 0;
+    uint64_t lastBytesReceived = 0;
+
+    CURLM* multi = curl_multi_init();
+    if (multi == nullptr)
+    {
+        return CURLE_OUT_OF_MEMORY;
+    }
+
+    Log_Info(
+        "Downloading %s over %llu connections.",
+        entity->TargetFilename,
+        static_cast<unsigned long long>(segmentCount));
+
+    context->stalled = false;
+    context->lastContentTime = std::chrono::steady_clock::now();
+
+    for (uint64_t i = 0; i < segmentCount; ++i)
+    {
+        Segment& segment = segments[i];
+        const uint64_t start = size / segmentCount * i;
+        const uint64_t end = (i == segmentCount - 1) ? size : size / segmentCount * (i + 1);
+
+        segment.curl = curl_easy_init();
+        if (segment.curl == nullptr)
+        {
+            curlCode = CURLE_OUT_OF_MEMORY;
+            goto done;
+        }
+
+        segment.start = static_cast<off_t>(start);
+        segment.write.fd = fileno(context->file);
+        segment.write.offset = segment.start;
+        segment.write.end = static_cast<off_t>(end);
+        segment.write.curl = segment.curl;
+        segment.range = std::to_string(start) + "-" + std::to_string(end - 1);
+
+        SetDownloadOptions(segment.curl, entity, context, segment.curlError);
+
+        // A connection of its own per range: multiplexed on one HTTP/2 connection, they'd share its window.
+        curl_easy_setopt(segment.curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+        curl_easy_setopt(segment.curl, CURLOPT_PIPEWAIT, 0L);
+        curl_easy_setopt(segment.curl, CURLOPT_RANGE, segment.range.c_str());
+        curl_easy_setopt(segment.curl, CURLOPT_WRITEFUNCTION, RangeWriteCallback);
+        curl_easy_setopt(segment.curl, CURLOPT_WRITEDATA, &segment.write);
+        curl_easy_setopt(segment.curl, CURLOPT_NOPROGRESS, 1L);
+
+        if (perDownloadLimit != 0)
+        {
+            curl_easy_setopt(
+                segment.curl,
+                CURLOPT_MAX_RECV_SPEED_LARGE,
+                static_cast<curl_off_t>(std::max<uint64_t>(perDownloadLimit / segmentCount, 1)));
+        }
+
+        curl_multi_add_handle(multi, segment.curl);
+    }
+
+    do
+    {
+        if (curl_multi_perform(multi, &running) != CURLM_OK)
+        {
+            curlCode = CURLE_FAILED_INIT;
+            break;
+        }
+
+        int queued = 0;
+        for (CURLMsg* message = curl_multi_info_read(multi, &queued); message != nullptr;
+             message = curl_multi_info_read(multi, &queued))
+        {
+            if (message->msg == CURLMSG_DONE && message->data.result != CURLE_OK && curlCode == CURLE_OK)
+            {
+                curlCode = message->data.result;
+                failedCurl = message->easy_handle;
+            }
+        }
+
+        if (ADUC_CancellationToken_IsCancelled(context->cancellationToken))
+        {
+            curlCode = CURLE_ABORTED_BY_CALLBACK;
+        }
+
+        uint64_t bytesReceived = 0;
+        for (const Segment& segment : segments)
+        {
+            bytesReceived += static_cast<uint64_t>(segment.write.offset - segment.start);
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (bytesReceived != lastBytesReceived)
+        {
+            lastBytesReceived = bytesReceived;
+            context->lastContentTime = now;
+        }
+        else if (
+            context->abortOnStall && curlCode == CURLE_OK && now - context->lastContentTime >= c_sourceStallTimeout)
+        {
+            context->stalled = true;
+            curlCode = CURLE_OPERATION_TIMEDOUT;
+        }
+
+        if (context->progressCallback != nullptr && now - context->lastProgressReport >= c_progressReportInterval)
+        {
+            context->lastProgressReport = now;
+            context->progressCallback(
+                context->workflowId, context->fileId, ADUC_DownloadProgressState_InProgress, bytesReceived, size);
+        }
+
+        // Wakes up at least once a second, to report progress and notice cancellation while no data arrives.
+        if (running > 0 && curlCode == CURLE_OK)
+        {
+            curl_multi_wait(multi, nullptr, 0, 1000, nullptr);
+        }
+    } while (running > 0 && curlCode == CURLE_OK);
+
+    for (const Segment& segment : segments)
+    {
+        if (curlCode != CURLE_OK)
+        {
+            break;
+        }
+
+        if (segment.write.writeFailed || segment.write.offset != segment.write.end)
+        {
+            curlCode = CURLE_WRITE_ERROR;
+            failedCurl = segment.curl;
+        }
+    }
+
+    if (failedCurl != nullptr)
+    {
+        // A server that ignores the range sends the whole file, which overflows the range.
+        long responseCode = 0;
+        curl_easy_getinfo(failedCurl, CURLINFO_RESPONSE_CODE, &responseCode);
+        if (responseCode == 200)
+        {
+            curlCode = CURLE_RANGE_ERROR;
+        }
+
+        for (const Segment& segment : segments)
+        {
+            if (segment.curl == failedCurl)
+            {
+                memcpy(curlError, segment.curlError, CURL_ERROR_SIZE);
+            }
+        }
+
+        *failureCode = GetTransferFailureCode(failedCurl, curlCode);
+    }
+
+done:
+    for (Segment& segment : segments)
+    {
+        if (segment.curl != nullptr)
+        {
+            curl_multi_remove_handle(multi, segment.curl);
+            curl_easy_cleanup(segment.curl);
+        }
+    }
+
+    curl_multi_cleanup(multi);
+
+    return curlCode;
+}
+
+} // namespace
+
 EXTERN_C_BEGIN
 
 ADUC_Result Download_curl(
@@ -25,17 +1505,32 @@ ADUC_Result Download_curl(
     const char* workflowId,
     const char* workFolder,
     unsigned int retryTimeout,
-    ADUC_DownloadProgressCallback downloadProgressCallback)
+    ADUC_DownloadProgressCallback downloadProgressCallback,
+    ADUC_DownloadVerifiedFile* verifiedFile,
+    const ADUC_CancellationToken* cancellationToken)
 {
-    UNREFERENCED_PARAMETER(retryTimeout);
     ADUC_Result result = { ADUC_Result_Failure };
     SHAversion algVersion;
-    std::vector<std::string> args;
-    std::string output;
-    int exitCode = 1;
+    CURL* curl = nullptr;
+    CURLcode curlCode = CURLE_OK;
+    char curlError[CURL_ERROR_SIZE] = {};
     std::stringstream fullFilePath;
     bool isValidHash;
     bool reportProgress = false;
+    ADUC_HashUtils_Context hashContext = {};
+    ADUC_HashUtils_Context transportHashContext = {};
+    CurlDownloadContext downloadContext;
+    ADUC_Result_t transportResult = 0;
+    std::string partialFilePath;
+    std::string journalFilePath;
+    struct stat partialStat = {};
+    struct stat targetStat = {};
+    long responseCode = 0;
+    bool keepPartialFile = false;
+    bool segmented = false;
+    ADUC_Result_t transferFailureCode = 0;
+    std::vector<std::string> sources;
+    size_t sourceIndex = 0;
 
     if (entity == nullptr)
     {
@@ -88,10 +1583,24 @@ ADUC_Result Download_curl(
         goto done;
     }
 
+    if (entity->TransportEncoding != nullptr && !ADUC_ContentEncoding_IsSupported(entity->TransportEncoding))
+    {
+        Log_Error("Transport encoding '%s' of %s is not supported", entity->TransportEncoding, entity->TargetFilename);
+        result.ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_TRANSPORT_ENCODING_NOT_SUPPORTED;
+        reportProgress = true;
+        goto done;
+    }
+
     // If target file exists, validate file hash.
     // If file is valid, then skip the download.
-    isValidHash = ADUC_HashUtils_IsValidFileHash(
-        fullFilePath.str().c_str(), ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0), algVersion);
+    // Note: the extension manager already removes a stale file before calling into the downloader,
+    // so only hash here when there's actually something to validate.
+    // A file of another size can't have the hash, and one verified before the agent restarted, and unchanged since,
+    // isn't hashed again.
+    isValidHash = (stat(fullFilePath.str().c_str(), &targetStat) == 0)
+        && (entity->SizeInBytes == 0 || static_cast<uint64_t>(targetStat.st_size) == entity->SizeInBytes)
+        && (IsPersistedVerifiedFile(fullFilePath.str(), entity)
+            || ADUC_HashUtils_IsValidFileHashes(fullFilePath.str().c_str(), entity->Hash, entity->HashCount));
 
     if (isValidHash)
     {
@@ -106,27 +1615,273 @@ ADUC_Result Download_curl(
         entity->DownloadUri,
         fullFilePath.str().c_str());
 
-    args.emplace_back("-o");
-    args.emplace_back(fullFilePath.str().c_str());
-    args.emplace_back("-O");
-    args.emplace_back(entity->DownloadUri);
+    // The time left is for the whole download, from the caches or the origin.
+    SetDeadline(&downloadContext, retryTimeout);
+
+    // Ask the LAN caches first. Their content is only used if its hash is valid, otherwise it comes from the origin.
+    if (InitializeCurl()
+        && DownloadFromCacheHosts(
+            entity,
+            fullFilePath.str(),
+            algVersion,
+            workflowId,
+            downloadProgressCallback,
+            cancellationToken,
+            downloadContext.deadline))
+    {
+        remove(GetPartialFilePath(fullFilePath.str()).c_str());
+        remove(GetJournalFilePath(fullFilePath.str()).c_str());
+        result = { ADUC_Result_Download_Success };
+        goto done;
+    }
+
+    if (ADUC_CancellationToken_IsCancelled(cancellationToken))
+    {
+        result = { .ResultCode = ADUC_Result_Failure_Cancelled, .ExtendedResultCode = 0 };
+        reportProgress = true;
+        goto done;
+    }
+
+    curl = InitializeCurl() ? curl_easy_init() : nullptr;
+    if (curl == nullptr)
+    {
+        Log_Error("Cannot initialize libcurl");
+        result = { .ResultCode = ADUC_Result_Failure, .ExtendedResultCode = ADUC_ERROR_CURL_DOWNLOADER_INIT_FAILURE };
+        reportProgress = true;
+        goto done;
+    }
+
+    // With several sources, e.g. mirrors, start from the fastest; the others are there to fail over to.
+    sources = GetSources(entity);
+    if (sources.size() > 1)
+    {
+        sources = RankSources(entity, sources, cancellationToken);
+    }
+
+    if (!ADUC_HashUtils_ContextReset(&hashContext, algVersion))
+    {
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_VALIDATION_FILE_HASH_TYPE_NOT_SUPPORTED };
+        reportProgress = true;
+        goto done;
+    }
+
+    transportResult = StartTransportDecoding(entity, &downloadContext, &transportHashContext);
+    if (transportResult != 0)
+    {
+        result = { .ResultCode = ADUC_Result_Failure, .ExtendedResultCode = transportResult };
+        reportProgress = true;
+        goto done;
+    }
+
+    partialFilePath = GetPartialFilePath(fullFilePath.str());
+    journalFilePath = GetJournalFilePath(fullFilePath.str());
+
+    // Resume from the content downloaded by a previous, interrupted attempt, if it's for the same content.
+    // Hash the partial content again rather than persisting the hash state; reading it back is far cheaper
+    // than downloading it again. Encoded content always starts over, since the decoded content doesn't tell where
+    // in the encoded stream it ended.
+    if (downloadContext.decoder == nullptr && IsJournalForEntity(journalFilePath, entity)
+        && stat(partialFilePath.c_str(), &partialStat) == 0
+        && partialStat.st_size > 0
+        && (entity->SizeInBytes == 0 || static_cast<uint64_t>(partialStat.st_size) <= entity->SizeInBytes))
+    {
+        if (ADUC_HashUtils_ContextInputFile(&hashContext, partialFilePath.c_str()))
+        {
+            downloadContext.resumeFrom = partialStat.st_size;
+            Log_Info("Resuming download of %s from byte %lld", partialFilePath.c_str(), static_cast<long long>(downloadContext.resumeFrom));
+        }
+        else
+        {
+            ADUC_HashUtils_ContextUnInit(&hashContext);
+            if (!ADUC_HashUtils_ContextReset(&hashContext, algVersion))
+            {
+                result = { .ResultCode = ADUC_Result_Failure,
+                           .ExtendedResultCode = ADUC_ERC_VALIDATION_FILE_HASH_TYPE_NOT_SUPPORTED };
+                reportProgress = true;
+                goto done;
+            }
+        }
+    }
+
+    if (downloadContext.resumeFrom == 0 && downloadContext.decoder == nullptr && !WriteJournal(journalFilePath, entity))
+    {
+        Log_Warn("Cannot write download journal %s, the download won't be resumable.", journalFilePath.c_str());
+    }
+
+    downloadContext.file = fopen(partialFilePath.c_str(), (downloadContext.resumeFrom > 0) ? "ab" : "wb");
+    if (downloadContext.file == nullptr)
+    {
+        Log_Error("Cannot open %s for writing, errno %d", partialFilePath.c_str(), errno);
+        result = { .ResultCode = ADUC_Result_Failure, .ExtendedResultCode = MAKE_ADUC_ERRNO_EXTENDEDRESULTCODE(errno) };
+        reportProgress = true;
+        goto done;
+    }
+
+    // Reserve the rest of the file, so that a full disk fails the download now rather than once it's mostly done, and
+    // so that the file is laid out in one extent rather than in the order the blocks were written.
+    if (entity->SizeInBytes > static_cast<uint64_t>(downloadContext.resumeFrom))
+    {
+        const int reserveError = ADUC_SystemUtils_ReserveFileSpace(
+            fileno(downloadContext.file),
+            static_cast<off_t>(downloadContext.resumeFrom),
+            static_cast<off_t>(entity->SizeInBytes - downloadContext.resumeFrom));
+        if (reserveError == ENOSPC)
+        {
+            Log_Error("Not enough disk space for %s (%zu bytes).", partialFilePath.c_str(), entity->SizeInBytes);
+            fclose(downloadContext.file);
+            downloadContext.file = nullptr;
+            result = { .ResultCode = ADUC_Result_Failure,
+                       .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_INSUFFICIENT_DISK_SPACE };
+            reportProgress = true;
+            keepPartialFile = downloadContext.resumeFrom > 0;
+            goto done;
+        }
+
+        if (reserveError != 0)
+        {
+            Log_Warn("Cannot reserve disk space for %s, errno %d", partialFilePath.c_str(), reserveError);
+        }
+    }
+
+    downloadContext.fileOffset = static_cast<off_t>(downloadContext.resumeFrom);
+    downloadContext.writebackOffset = downloadContext.fileOffset;
+    downloadContext.previousWritebackOffset = downloadContext.fileOffset;
+    downloadContext.hashContext = &hashContext;
+    downloadContext.workflowId = workflowId;
+    downloadContext.fileId = entity->FileId;
+    downloadContext.bytesTotal = GetTransferSize(entity);
+    downloadContext.progressCallback = downloadProgressCallback;
+    downloadContext.cancellationToken = cancellationToken;
+    downloadContext.sourceUrl = sources[sourceIndex].c_str();
+
+    SetDownloadOptions(curl, entity, &downloadContext, curlError);
+    curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, downloadContext.resumeFrom);
+
+    segmented = IsSegmentedDownload(entity, &downloadContext);
+    if (segmented)
+    {
+        downloadContext.abortOnStall = sources.size() > 1;
+        curlCode = DownloadSegments(entity, &downloadContext, curlError, &transferFailureCode);
+
+        // The ranges don't end where the partial file does, so the download starts over from the next source.
+        while (curlCode != CURLE_OK && curlCode != CURLE_RANGE_ERROR && curlCode != CURLE_ABORTED_BY_CALLBACK
+               && sourceIndex + 1 < sources.size())
+        {
+            ++sourceIndex;
+            Log_Warn(
+                "Segmented download of %s %s (curl code: %d), starting over from %s.",
+                entity->TargetFilename,
+                downloadContext.stalled ? "stalled" : "failed",
+                curlCode,
+                sources[sourceIndex].c_str());
+
+            downloadContext.sourceUrl = sources[sourceIndex].c_str();
+            downloadContext.abortOnStall = sourceIndex + 1 < sources.size();
+            curl_easy_setopt(curl, CURLOPT_URL, downloadContext.sourceUrl);
+            transferFailureCode = 0;
+            curlCode = DownloadSegments(entity, &downloadContext, curlError, &transferFailureCode);
+        }
+
+        if (curlCode == CURLE_RANGE_ERROR)
+        {
+            Log_Warn(
+                "The server doesn't serve ranges of %s, downloading it over one connection.", entity->TargetFilename);
+
+            segmented = false;
+            transferFailureCode = 0;
+            if (!RestartPartialFile(&downloadContext))
+            {
+                downloadContext.writeFailed = true;
+            }
+            else
+            {
+                curlCode = PerformWithFailover(curl, &downloadContext, sources, &sourceIndex);
+            }
+        }
+        else if (curlCode == CURLE_OK && !ADUC_HashUtils_ContextInputFile(&hashContext, partialFilePath.c_str()))
+        {
+            downloadContext.hashFailed = true;
+        }
+    }
+    // Nothing left to download if the previous attempt got all the content, it only needs validating.
+    else if (entity->SizeInBytes == 0 || static_cast<uint64_t>(downloadContext.resumeFrom) < entity->SizeInBytes)
+    {
+        curlCode = PerformWithFailover(curl, &downloadContext, sources, &sourceIndex);
+    }
+
+    if (downloadContext.resumeFrom > 0 && curlCode != CURLE_OK)
+    {
+        // CURLE_RANGE_ERROR: the server doesn't support ranges. 416: the partial content is longer than the file.
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode);
+        if (curlCode == CURLE_RANGE_ERROR || responseCode == 416)
+        {
+            Log_Warn("Cannot resume download (curl code: %d, HTTP status: %ld), starting over.", curlCode, responseCode);
+
+            if (!RestartPartialFile(&downloadContext))
+            {
+                downloadContext.writeFailed = true;
+            }
+            else
+            {
+                curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, static_cast<curl_off_t>(0));
+                curlCode = PerformWithFailover(curl, &downloadContext, sources, &sourceIndex);
+            }
+        }
+    }
+
+    if (!CloseTargetFile(&downloadContext))
+    {
+        downloadContext.writeFailed = true;
+    }
+
+    if (downloadContext.writeFailed)
+    {
+        Log_Error("Cannot write to %s", partialFilePath.c_str());
+        result = { .ResultCode = ADUC_Result_Failure, .ExtendedResultCode = ADUC_ERROR_CURL_DOWNLOADER_WRITE_FAILURE };
+        reportProgress = true;
+        goto done;
+    }
 
-    exitCode = ADUC_LaunchChildProcess("/usr/bin/curl", args, output);
+    if (downloadContext.decodeFailed)
+    {
+        Log_Error("Cannot decode the %s content of %s", entity->TransportEncoding, entity->TargetFilename);
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_TRANSPORT_DECODING_FAILURE };
+        reportProgress = true;
+        goto done;
+    }
 
-    if (exitCode == 0)
+    if (curlCode == CURLE_OK && !downloadContext.hashFailed)
     {
         result = { ADUC_Result_Download_Success };
     }
+    else if (curlCode == CURLE_ABORTED_BY_CALLBACK && ADUC_CancellationToken_IsCancelled(cancellationToken))
+    {
+        Log_Info("Download of %s cancelled.", entity->TargetFilename);
+        result = { .ResultCode = ADUC_Result_Failure_Cancelled, .ExtendedResultCode = 0 };
+        reportProgress = true;
+        // A later deployment of the same content resumes from it. The ranges of a segmented download don't end where
+        // the partial file does, so it starts over.
+        keepPartialFile = downloadContext.decoder == nullptr && !segmented;
+        goto done;
+    }
     else
     {
+        Log_Error(
+            "Download failed, curl code: %d (%s), error: %s",
+            curlCode,
+            curl_easy_strerror(curlCode),
+            curlError);
         result = { .ResultCode = ADUC_Result_Failure,
-                   .ExtendedResultCode = ADUC_ERROR_CURL_DOWNLOADER_EXTERNAL_FAILURE(exitCode) };
+                   .ExtendedResultCode =
+                       (transferFailureCode != 0) ? transferFailureCode : GetTransferFailureCode(curl, curlCode) };
         reportProgress = true;
+        // Keep the content received so far, so that the next attempt can resume from it.
+        keepPartialFile = !downloadContext.hashFailed && downloadContext.decoder == nullptr && !segmented;
         goto done;
     }
 
-    Log_Info("Download output:: \n%s", output.c_str());
-
     // If we downloaded successfully, validate the file hash.
     if (IsAducResultCodeSuccess(result.ResultCode))
     {
@@ -134,21 +1889,80 @@ ADUC_Result Download_curl(
         // support for multiple hashes is already built in.
         Log_Info("Validating file hash");
 
-        const bool isValid = ADUC_HashUtils_IsValidFileHash(
-            fullFilePath.str().c_str(), ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0), algVersion);
+        transportResult = FinishTransportDecoding(entity, &downloadContext);
+        if (transportResult != 0)
+        {
+            result = { .ResultCode = ADUC_Result_Failure, .ExtendedResultCode = transportResult };
+            reportProgress = true;
+            goto done;
+        }
+
+        const bool isValid = ADUC_HashUtils_ContextResultHash(&hashContext, entity->Hash);
         if (!isValid)
         {
             Log_Error("Hash for %s is not valid", entity->TargetFilename);
 
+            // With chunk hashes, only the corrupted chunks need to be downloaded again. Ranges of encoded content
+            // don't map to chunks of the file, so it's downloaded again whole.
+            SetTransferTimeout(curl, &downloadContext);
+            if (downloadContext.decoder != nullptr || !RepairCorruptedChunks(curl, entity, partialFilePath, algVersion))
+            {
+                result = { .ResultCode = ADUC_Result_Failure,
+                           .ExtendedResultCode = ADUC_ERC_VALIDATION_FILE_HASH_INVALID_HASH };
+                reportProgress = true;
+                goto done;
+            }
+        }
+
+        // The content is complete and valid, move it in place.
+        if (rename(partialFilePath.c_str(), fullFilePath.str().c_str()) != 0)
+        {
+            Log_Error("Cannot rename %s, errno %d", partialFilePath.c_str(), errno);
             result = { .ResultCode = ADUC_Result_Failure,
-                       .ExtendedResultCode = ADUC_ERC_VALIDATION_FILE_HASH_INVALID_HASH };
+                       .ExtendedResultCode = MAKE_ADUC_ERRNO_EXTENDEDRESULTCODE(errno) };
             reportProgress = true;
             goto done;
         }
+
+        remove(journalFilePath.c_str());
     }
 
 done:
 
+    ADUC_HashUtils_ContextUnInit(&hashContext);
+    ADUC_HashUtils_ContextUnInit(&transportHashContext);
+    ADUC_ContentDecoder_Free(downloadContext.decoder);
+
+    if (downloadContext.file != nullptr)
+    {
+        fclose(downloadContext.file);
+    }
+
+    if (curl != nullptr)
+    {
+        curl_easy_cleanup(curl);
+    }
+
+    // Don't leave corrupted content behind. Content from an interrupted transfer is kept, to resume from.
+    if (IsAducResultCodeFailure(result.ResultCode) && !keepPartialFile && !partialFilePath.empty())
+    {
+        remove(partialFilePath.c_str());
+        remove(journalFilePath.c_str());
+    }
+
+    if (IsAducResultCodeSuccess(result.ResultCode) && verifiedFile != nullptr)
+    {
+        // Let the caller know this file doesn't need to be hashed again.
+        if (!ADUC_DownloadVerifiedFile_Init(
+                verifiedFile,
+                fullFilePath.str().c_str(),
+                ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0),
+                ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0)))
+        {
+            Log_Warn("Cannot record verified file info for %s", fullFilePath.str().c_str());
+        }
+    }
+
     if (reportProgress && (downloadProgressCallback != nullptr))
     {
         if (IsAducResultCodeSuccess(result.ResultCode))
@@ -187,13 +2001,222 @@ ADUC_Result Download(
     unsigned int retryTimeout,
     ADUC_DownloadProgressCallback downloadProgressCallback)
 {
-    return Download_curl(entity, workflowId, workFolder, retryTimeout, downloadProgressCallback);
+    return Download_curl(entity, workflowId, workFolder, retryTimeout, downloadProgressCallback, nullptr, nullptr);
+}
+
+ADUC_Result DownloadAndVerify(
+    const ADUC_FileEntity* entity,
+    const char* workflowId,
+    const char* workFolder,
+    unsigned int retryTimeout,
+    ADUC_DownloadProgressCallback downloadProgressCallback,
+    ADUC_DownloadVerifiedFile* verifiedFile)
+{
+    return Download_curl(entity, workflowId, workFolder, retryTimeout, downloadProgressCallback, verifiedFile, nullptr);
+}
+
+ADUC_Result DownloadWithCancellation(
+    const ADUC_FileEntity* entity,
+    const char* workflowId,
+    const char* workFolder,
+    unsigned int retryTimeout,
+    ADUC_DownloadProgressCallback downloadProgressCallback,
+    ADUC_DownloadVerifiedFile* verifiedFile,
+    const ADUC_CancellationToken* cancellationToken)
+{
+    return Download_curl(
+        entity, workflowId, workFolder, retryTimeout, downloadProgressCallback, verifiedFile, cancellationToken);
+}
+
+ADUC_Result DownloadToStream(
+    const ADUC_FileEntity* entity,
+    const char* workflowId,
+    unsigned int retryTimeout,
+    ADUC_DownloadProgressCallback downloadProgressCallback,
+    int outputFd)
+{
+    ADUC_Result result = { ADUC_Result_Failure };
+    SHAversion algVersion;
+    CURL* curl = nullptr;
+    CURLcode curlCode = CURLE_OK;
+    char curlError[CURL_ERROR_SIZE] = {};
+    ADUC_HashUtils_Context hashContext = {};
+    ADUC_HashUtils_Context transportHashContext = {};
+    CurlDownloadContext downloadContext;
+    ADUC_Result_t transportResult = 0;
+    std::vector<std::string> sources;
+    size_t sourceIndex = 0;
+
+    if (entity == nullptr)
+    {
+        result.ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_INVALID_FILE_ENTITY;
+        goto done;
+    }
+
+    if (entity->DownloadUri == nullptr || *entity->DownloadUri == 0)
+    {
+        result.ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_INVALID_DOWNLOAD_URI;
+        goto done;
+    }
+
+    if (entity->HashCount == 0)
+    {
+        Log_Error("File entity does not contain a file hash! Cannot validate the streamed content.");
+        result.ExtendedResultCode = ADUC_ERC_VALIDATION_FILE_HASH_IS_EMPTY;
+        goto done;
+    }
+
+    if (!ADUC_HashUtils_GetShaVersionForTypeString(
+            ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0), &algVersion)
+        || !ADUC_HashUtils_ContextReset(&hashContext, algVersion))
+    {
+        Log_Error(
+            "FileEntity for %s has unsupported hash type %s",
+            entity->TargetFilename,
+            ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0));
+        result.ExtendedResultCode = ADUC_ERC_VALIDATION_FILE_HASH_TYPE_NOT_SUPPORTED;
+        goto done;
+    }
+
+    transportResult = StartTransportDecoding(entity, &downloadContext, &transportHashContext);
+    if (transportResult != 0)
+    {
+        result.ExtendedResultCode = transportResult;
+        goto done;
+    }
+
+    Log_Info("Streaming File '%s' from '%s'", entity->TargetFilename, entity->DownloadUri);
+
+    curl = InitializeCurl() ? curl_easy_init() : nullptr;
+    if (curl == nullptr)
+    {
+        Log_Error("Cannot initialize libcurl");
+        result = { .ResultCode = ADUC_Result_Failure, .ExtendedResultCode = ADUC_ERROR_CURL_DOWNLOADER_INIT_FAILURE };
+        goto done;
+    }
+
+    downloadContext.outputFd = outputFd;
+    downloadContext.hashContext = &hashContext;
+    downloadContext.workflowId = workflowId;
+    downloadContext.fileId = entity->FileId;
+    downloadContext.bytesTotal = GetTransferSize(entity);
+    downloadContext.progressCallback = downloadProgressCallback;
+
+    sources = GetSources(entity);
+    if (sources.size() > 1)
+    {
+        sources = RankSources(entity, sources, nullptr);
+    }
+
+    downloadContext.sourceUrl = sources[sourceIndex].c_str();
+    SetDeadline(&downloadContext, retryTimeout);
+    SetDownloadOptions(curl, entity, &downloadContext, curlError);
+
+    curlCode = PerformWithFailover(curl, &downloadContext, sources, &sourceIndex);
+
+    if (downloadContext.writeFailed)
+    {
+        Log_Error("Cannot write to the output stream of %s, errno %d", entity->TargetFilename, errno);
+        result = { .ResultCode = ADUC_Result_Failure, .ExtendedResultCode = ADUC_ERROR_CURL_DOWNLOADER_WRITE_FAILURE };
+        goto done;
+    }
+
+    if (downloadContext.decodeFailed)
+    {
+        Log_Error("Cannot decode the %s content of %s", entity->TransportEncoding, entity->TargetFilename);
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_TRANSPORT_DECODING_FAILURE };
+        goto done;
+    }
+
+    if (curlCode != CURLE_OK || downloadContext.hashFailed)
+    {
+        Log_Error(
+            "Download failed, curl code: %d (%s), error: %s",
+            curlCode,
+            curl_easy_strerror(curlCode),
+            curlError);
+        result = { .ResultCode = ADUC_Result_Failure, .ExtendedResultCode = GetTransferFailureCode(curl, curlCode) };
+        goto done;
+    }
+
+    transportResult = FinishTransportDecoding(entity, &downloadContext);
+    if (transportResult != 0)
+    {
+        result = { .ResultCode = ADUC_Result_Failure, .ExtendedResultCode = transportResult };
+        goto done;
+    }
+
+    if (!ADUC_HashUtils_ContextResultHash(&hashContext, entity->Hash))
+    {
+        Log_Error("Hash for streamed %s is not valid", entity->TargetFilename);
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_VALIDATION_FILE_HASH_INVALID_HASH };
+        goto done;
+    }
+
+    result = { ADUC_Result_Download_Success };
+
+done:
+
+    ADUC_HashUtils_ContextUnInit(&hashContext);
+    ADUC_HashUtils_ContextUnInit(&transportHashContext);
+    ADUC_ContentDecoder_Free(downloadContext.decoder);
+
+    if (curl != nullptr)
+    {
+        curl_easy_cleanup(curl);
+    }
+
+    if (downloadProgressCallback != nullptr && entity != nullptr)
+    {
+        downloadProgressCallback(
+            workflowId,
+            entity->FileId,
+            IsAducResultCodeSuccess(result.ResultCode) ? ADUC_DownloadProgressState_Completed
+                                                       : ADUC_DownloadProgressState_Error,
+            IsAducResultCodeSuccess(result.ResultCode) ? entity->SizeInBytes : 0,
+            entity->SizeInBytes);
+    }
+
+    Log_Info(
+        "Stream download task end. resultCode: %d, extendedCode: %d (0x%X)",
+        result.ResultCode,
+        result.ExtendedResultCode,
+        result.ExtendedResultCode);
+    return result;
 }
 
 ADUC_Result Initialize(const char* initializeData)
 {
-    UNREFERENCED_PARAMETER(initializeData);
+    if (!InitializeCurl())
+    {
+        return { .ResultCode = ADUC_GeneralResult_Failure,
+                 .ExtendedResultCode = ADUC_ERROR_CURL_DOWNLOADER_INIT_FAILURE };
+    }
+
+    // In a nested edge setup, the gateway's Connected Cache is the nearest cache.
+    char* gatewayHostName = nullptr;
+    if (initializeData != nullptr && ConnectionStringUtils_IsNestedEdge(initializeData)
+        && ConnectionStringUtils_GetValue(initializeData, "GatewayHostName", &gatewayHostName))
+    {
+        Log_Info("Using the gateway %s as download cache host.", gatewayHostName);
+
+        std::lock_guard<std::mutex> lock(s_cacheHostsMutex);
+        s_gatewayCacheHosts = ParseCacheHosts(gatewayHostName);
+    }
+
+    free(gatewayHostName);
+
     return { ADUC_GeneralResult_Success };
 }
 
+void SetCacheHosts(const char* cacheHosts)
+{
+    std::vector<CacheHost> hosts = ParseCacheHosts(cacheHosts);
+
+    std::lock_guard<std::mutex> lock(s_cacheHostsMutex);
+    s_configuredCacheHosts = std::move(hosts);
+}
+
 EXTERN_C_END
@@ -7,16 +7,21 @@
  */
 #include "aduc/connection_string_utils.h"
 #include "aduc/content_downloader_extension.hpp"
+#include "aduc/content_encoding_utils.h"
+#include "aduc/download_throttle.h"
 #include "aduc/hash_utils.h"
 #include "aduc/logging.h"
 #include "aduc/process_utils.hpp"
 
 #include <atomic>
+#include <chrono>
+#include <memory>
 #include <sstream>
-#include <stdio.h> // for FILE
+#include <stdio.h> // for FILE, remove
 #include <stdlib.h> // for calloc
 #include <strings.h> // for strcasecmp
 #include <sys/stat.h> // for stat
+#include <thread>
 #include <vector>
 
 #include <do_config.h>
@@ -25,14 +30,123 @@
 
 namespace MSDO = microsoft::deliveryoptimization;
 
+/**
+ * @brief How often the status of a download is polled, which bounds how late a cancellation is noticed.
+ */
+constexpr std::chrono::milliseconds c_statusPollInterval{ 250 };
+
+/**
+ * @brief The least time between two progress reports of a download.
+ */
+constexpr std::chrono::seconds c_progressReportInterval{ 1 };
+
+/**
+ * @brief Downloads the content of @p entity to @p filePath with a DO download object, and reports the bytes
+ * transferred while it runs. Downloads of other files, on other threads, run at the same time.
+ *
+ * @param entity The file entity.
+ * @param workflowId The workflow id, for the progress reports.
+ * @param filePath The path of the downloaded file.
+ * @param retryTimeout The longest time, in seconds, the download may make no progress.
+ * @param downloadProgressCallback The progress callback, may be nullptr.
+ * @param isCancelled The flag that aborts the download once set.
+ * @returns 0 on success, otherwise the DO error code, e.g. std::errc::operation_canceled once @p isCancelled is set.
+ * Throws MSDO::exception if the download can't be created or started.
+ */
+static int32_t DownloadWithProgress(
+    const ADUC_FileEntity* entity,
+    const char* workflowId,
+    const std::string& filePath,
+    unsigned int retryTimeout,
+    ADUC_DownloadProgressCallback downloadProgressCallback,
+    const std::atomic_bool& isCancelled)
+{
+    std::unique_ptr<MSDO::download> download = MSDO::download::make(entity->DownloadUri, filePath);
+
+    // The downloads of the current deployment are foreground, so that DO doesn't hold them back for idle bandwidth;
+    // prefetches are background.
+    download->set_property(
+        MSDO::download_property::foreground,
+        MSDO::download_property_value::make(
+            ADUC_DownloadThrottle_GetThreadPriority() == ADUC_TransferPriority_Foreground));
+    download->set_property(
+        MSDO::download_property::no_progress_timeout_seconds,
+        MSDO::download_property_value::make(static_cast<uint32_t>(retryTimeout)));
+
+    download->start();
+
+    uint64_t transferredBytes = 0;
+    auto lastProgress = std::chrono::steady_clock::now();
+    auto lastReport = lastProgress;
+
+    for (;;)
+    {
+        const MSDO::download_status status = download->get_status();
+        if (status.state() == MSDO::download_state::transferred)
+        {
+            download->finalize();
+            return 0;
+        }
+
+        // Transient errors, e.g. a lost connection, pause the download until DO resumes it.
+        if (status.state() == MSDO::download_state::paused && !status.is_transient_error())
+        {
+            download->abort();
+            return status.error_code();
+        }
+
+        if (isCancelled)
+        {
+            download->abort();
+            return static_cast<int32_t>(std::errc::operation_canceled);
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (status.bytes_transferred() != transferredBytes)
+        {
+            transferredBytes = status.bytes_transferred();
+            lastProgress = now;
+            if (downloadProgressCallback != nullptr && now - lastReport >= c_progressReportInterval)
+            {
+                lastReport = now;
+                downloadProgressCallback(
+                    workflowId,
+                    entity->FileId,
+                    ADUC_DownloadProgressState_InProgress,
+                    transferredBytes,
+                    status.bytes_total() != 0 ? status.bytes_total() : entity->SizeInBytes);
+            }
+        }
+        else if (now - lastProgress >= std::chrono::seconds(retryTimeout))
+        {
+            download->abort();
+            return static_cast<int32_t>(std::errc::timed_out);
+        }
+
+        std::this_thread::sleep_for(c_statusPollInterval);
+    }
+}
+
 EXTERN_C_BEGIN
 
+/**
+ * @brief Cancellation callback that sets the flag the DO SDK polls to abort the download.
+ *
+ * @param context The std::atomic_bool passed to DownloadWithProgress.
+ */
+static void SetDownloadCancelled(void* context)
+{
+    static_cast<std::atomic_bool*>(context)->store(true);
+}
+
 ADUC_Result do_download(
     const ADUC_FileEntity* entity,
     const char* workflowId,
     const char* workFolder,
     unsigned int retryTimeout,
-    ADUC_DownloadProgressCallback downloadProgressCallback)
+    ADUC_DownloadProgressCallback downloadProgressCallback,
+    ADUC_DownloadVerifiedFile* verifiedFile,
+    const ADUC_CancellationToken* cancellationToken)
 {
     ADUC_Result_t resultCode = ADUC_Result_Failure;
     ADUC_Result_t extendedResultCode = ADUC_ERC_NOTRECOVERABLE;
@@ -49,50 +163,60 @@ ADUC_Result do_download(
         return ADUC_Result{ resultCode, extendedResultCode };
     }
 
+    if (entity->TransportEncoding != nullptr && !ADUC_ContentEncoding_IsSupported(entity->TransportEncoding))
+    {
+        Log_Error("Transport encoding '%s' of %s is not supported", entity->TransportEncoding, entity->TargetFilename);
+        extendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_TRANSPORT_ENCODING_NOT_SUPPORTED;
+        if (downloadProgressCallback != nullptr)
+        {
+            downloadProgressCallback(workflowId, entity->FileId, ADUC_DownloadProgressState_Error, 0, 0);
+        }
+        return ADUC_Result{ resultCode, extendedResultCode };
+    }
+
     std::stringstream fullFilePath;
     fullFilePath << workFolder << "/" << entity->TargetFilename;
 
+    // DO can't decode the content as it downloads it, so encoded content is downloaded next to the target file, then
+    // decoded into it.
+    const std::string downloadFilePath =
+        (entity->TransportEncoding != nullptr) ? fullFilePath.str() + ".encoded" : fullFilePath.str();
+
     Log_Info(
         "Downloading File '%s' from '%s' to '%s'",
         entity->TargetFilename,
         entity->DownloadUri,
         fullFilePath.str().c_str());
 
-    try
+    // The download is aborted once the flag is set.
+    std::atomic_bool isCancelled{ false };
+    const bool isCancellable = ADUC_CancellationToken_Register(cancellationToken, SetDownloadCancelled, &isCancelled);
+    if (!isCancellable)
     {
-        MSDO::download::download_url_to_path(
-            entity->DownloadUri, fullFilePath.str(), false, std::chrono::seconds(retryTimeout));
-
-        resultCode = ADUC_Result_Download_Success;
+        Log_Warn("Cannot register for cancellation, the download of %s won't be aborted.", entity->TargetFilename);
     }
-    // Catch DO exception only to get extended result code. Other exceptions will be caught by CallResultMethodAndHandleExceptions
-    catch (const MSDO::exception& e)
-    {
-        const int32_t doErrorCode = e.error_code();
 
-        Log_Info("Caught DO exception, msg: %s, code: %d (%#08x)", e.what(), doErrorCode, doErrorCode);
+    int32_t doErrorCode = 0;
 
-        if (doErrorCode == static_cast<int32_t>(std::errc::operation_canceled))
+    try
+    {
+        doErrorCode = DownloadWithProgress(
+            entity, workflowId, downloadFilePath, retryTimeout, downloadProgressCallback, isCancelled);
+        if (doErrorCode == 0)
         {
-            Log_Info("Download was cancelled");
-            if (downloadProgressCallback != nullptr)
-            {
-                downloadProgressCallback(workflowId, entity->FileId, ADUC_DownloadProgressState_Cancelled, 0, 0);
-            }
-
-            resultCode = ADUC_Result_Failure_Cancelled;
+            resultCode = ADUC_Result_Download_Success;
         }
         else
         {
-            if (doErrorCode == static_cast<int32_t>(std::errc::timed_out))
-            {
-                Log_Error("Download failed due to DO timeout");
-            }
-
-            resultCode = ADUC_Result_Failure;
+            Log_Info("DO download failed, code: %d (%#08x)", doErrorCode, doErrorCode);
         }
+    }
+    // Catch DO exception only to get extended result code. Other exceptions will be caught by CallResultMethodAndHandleExceptions
+    catch (const MSDO::exception& e)
+    {
+        doErrorCode = e.error_code();
 
-        extendedResultCode = MAKE_ADUC_DELIVERY_OPTIMIZATION_EXTENDEDRESULTCODE(doErrorCode);
+        Log_Info("Caught DO exception, msg: %s, code: %d (%#08x)", e.what(), doErrorCode, doErrorCode);
     }
     catch (const std::exception& e)
     {
@@ -124,6 +248,62 @@ ADUC_Result do_download(
         }
     }
 
+    if (doErrorCode != 0)
+    {
+        if (doErrorCode == static_cast<int32_t>(std::errc::operation_canceled))
+        {
+            Log_Info("Download was cancelled");
+            if (downloadProgressCallback != nullptr)
+            {
+                downloadProgressCallback(workflowId, entity->FileId, ADUC_DownloadProgressState_Cancelled, 0, 0);
+            }
+
+            resultCode = ADUC_Result_Failure_Cancelled;
+        }
+        else
+        {
+            if (doErrorCode == static_cast<int32_t>(std::errc::timed_out))
+            {
+                Log_Error("Download failed due to DO timeout");
+            }
+
+            resultCode = ADUC_Result_Failure;
+        }
+
+        extendedResultCode = MAKE_ADUC_DELIVERY_OPTIMIZATION_EXTENDEDRESULTCODE(doErrorCode);
+    }
+
+    if (isCancellable)
+    {
+        ADUC_CancellationToken_Unregister(cancellationToken, SetDownloadCancelled, &isCancelled);
+    }
+
+    if (entity->TransportEncoding != nullptr)
+    {
+        if (resultCode == ADUC_Result_Download_Success && entity->TransportHashCount != 0
+            && !ADUC_HashUtils_IsValidFileHashes(
+                downloadFilePath.c_str(), entity->TransportHashes, entity->TransportHashCount))
+        {
+            Log_Error("Transport hash for %s is not valid", entity->TargetFilename);
+            resultCode = ADUC_Result_Failure;
+            extendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_INVALID_TRANSPORT_HASH;
+        }
+        else if (
+            resultCode == ADUC_Result_Download_Success
+            && !ADUC_ContentEncoding_DecodeFile(
+                entity->TransportEncoding,
+                downloadFilePath.c_str(),
+                fullFilePath.str().c_str(),
+                entity->SizeInBytes))
+        {
+            Log_Error("Cannot decode the %s content of %s", entity->TransportEncoding, entity->TargetFilename);
+            resultCode = ADUC_Result_Failure;
+            extendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_TRANSPORT_DECODING_FAILURE;
+        }
+
+        remove(downloadFilePath.c_str());
+    }
+
     // If we downloaded successfully, validate the file hash.
     if (resultCode == ADUC_Result_Download_Success)
     {
@@ -148,8 +328,9 @@ ADUC_Result do_download(
             return ADUC_Result{ resultCode, extendedResultCode };
         }
 
-        const bool isValid = ADUC_HashUtils_IsValidFileHash(
-            fullFilePath.str().c_str(), ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0), algVersion);
+        // All the hashes of the entity, in a single read of the file.
+        const bool isValid =
+            ADUC_HashUtils_IsValidFileHashes(fullFilePath.str().c_str(), entity->Hash, entity->HashCount);
         if (!isValid)
         {
             Log_Error("Hash for %s is not valid", entity->TargetFilename);
@@ -164,6 +345,17 @@ ADUC_Result do_download(
             }
             return ADUC_Result{ resultCode, extendedResultCode };
         }
+
+        // Let the caller know this file doesn't need to be hashed again.
+        if (verifiedFile != nullptr
+            && !ADUC_DownloadVerifiedFile_Init(
+                verifiedFile,
+                fullFilePath.str().c_str(),
+                ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0),
+                ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0)))
+        {
+            Log_Warn("Cannot record verified file info for %s", fullFilePath.str().c_str());
+        }
     }
 
     // Report progress.
@@ -202,7 +394,31 @@ ADUC_Result Download(
     unsigned int retryTimeout,
     ADUC_DownloadProgressCallback downloadProgressCallback)
 {
-    return do_download(entity, workflowId, workFolder, retryTimeout, downloadProgressCallback);
+    return do_download(entity, workflowId, workFolder, retryTimeout, downloadProgressCallback, nullptr, nullptr);
+}
+
+ADUC_Result DownloadAndVerify(
+    const ADUC_FileEntity* entity,
+    const char* workflowId,
+    const char* workFolder,
+    unsigned int retryTimeout,
+    ADUC_DownloadProgressCallback downloadProgressCallback,
+    ADUC_DownloadVerifiedFile* verifiedFile)
+{
+    return do_download(entity, workflowId, workFolder, retryTimeout, downloadProgressCallback, verifiedFile, nullptr);
+}
+
+ADUC_Result DownloadWithCancellation(
+    const ADUC_FileEntity* entity,
+    const char* workflowId,
+    const char* workFolder,
+    unsigned int retryTimeout,
+    ADUC_DownloadProgressCallback downloadProgressCallback,
+    ADUC_DownloadVerifiedFile* verifiedFile,
+    const ADUC_CancellationToken* cancellationToken)
+{
+    return do_download(
+        entity, workflowId, workFolder, retryTimeout, downloadProgressCallback, verifiedFile, cancellationToken);
 }
 
 ADUC_Result Initialize(const char* initializeData)
@@ -0,0 +1,45 @@
+/**
+ * @file builtin_content_handlers.hpp
+ * @brief The registry of the update content handlers compiled into the agent, see ADUC_BUILTIN_CONTENT_HANDLERS.
+ *
+ * The agent defines and exports ADUC_BuiltinContentHandlers_Find, listed in builtin_content_handlers.dynamic-list, so
+ * that the copies of the extension manager linked into extensions, e.g. the steps handler, find the handlers too.
+ * It's weak, so that it's NULL in the binaries without built-in handlers.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ADUC_BUILTIN_CONTENT_HANDLERS_HPP
+#define ADUC_BUILTIN_CONTENT_HANDLERS_HPP
+
+#include <aduc/c_utils.h> // for EXTERN_C_BEGIN, EXTERN_C_END
+#include <aduc/content_handler.hpp>
+
+/**
+ * @brief Creates a content handler, e.g. the CreateContentHandler of its implementation.
+ */
+using ADUC_ContentHandlerFactory = ContentHandler* (*)();
+
+/**
+ * @brief A content handler compiled into the agent.
+ */
+struct ADUC_BuiltinContentHandler
+{
+    const char* UpdateType; /**< The update type it handles. */
+    ADUC_ContentHandlerFactory Create; /**< Creates the handler. */
+};
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Finds the content handler compiled into the agent for @p updateType.
+ *
+ * @param updateType The update type.
+ * @return ADUC_ContentHandlerFactory The factory of the handler, or nullptr if it's not built in.
+ */
+ADUC_ContentHandlerFactory ADUC_BuiltinContentHandlers_Find(const char* updateType) __attribute__((weak));
+
+EXTERN_C_END
+
+#endif // ADUC_BUILTIN_CONTENT_HANDLERS_HPP
@@ -0,0 +1,115 @@
+/**
+ * @file component_inventory.hpp
+ * @brief An index of the components a component enumerator reports, to select components without asking the
+ * enumerator again.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ADUC_COMPONENT_INVENTORY_HPP
+#define ADUC_COMPONENT_INVENTORY_HPP
+
+#include <parson.h>
+#include <parson_json_utils.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ADUC
+{
+/**
+ * @brief The components of a GetAllComponents result, with their string fields interned and indexed.
+ *
+ * A component matches a selector, e.g. { "group": "motors", "model": "USB-Motor-0001" }, when it has each of the
+ * selector's name-value pairs as a string field, like the example enumerators match them. A selector is compiled
+ * into the ids of its names and values once, and then matched with integer comparisons.
+ */
+class ComponentInventory
+{
+public:
+    ComponentInventory() = default;
+    ~ComponentInventory();
+
+    ComponentInventory(const ComponentInventory&) = delete;
+    ComponentInventory& operator=(const ComponentInventory&) = delete;
+    ComponentInventory(ComponentInventory&&) = delete;
+    ComponentInventory& operator=(ComponentInventory&&) = delete;
+
+    /**
+     * @brief Replaces the inventory with the components of @p componentsJson, and indexes them.
+     *
+     * @param componentsJson The result of GetAllComponents, e.g. { "components": [ { "group": "motors", ... } ] }.
+     * @returns True on success. On failure, the inventory is empty.
+     */
+    bool Load(const std::string& componentsJson);
+
+    /**
+     * @brief Empties the inventory.
+     */
+    void Clear();
+
+    /**
+     * @brief Returns whether Load succeeded since the last Clear.
+     */
+    bool IsLoaded() const
+    {
+        return _document != nullptr;
+    }
+
+    /**
+     * @brief Selects the components matching @p selectorJson. Results are remembered per selector until Clear.
+     *
+     * @param selectorJson A JSON object of name-value pairs, e.g. { "group": "motors" }.
+     * @param[out] outputComponentsData The matching components, in the format of GetAllComponents.
+     * @returns True on success. False when the inventory isn't loaded, or the selector isn't a JSON object of string
+     * values, which the enumerator must answer itself.
+     */
+    bool Select(const std::string& selectorJson, std::string& outputComponentsData);
+
+private:
+    /**
+     * @brief A selector, compiled against the interned names and values of the inventory.
+     */
+    struct CompiledSelector
+    {
+        //! (Attribute column, value id) pairs a component must all have.
+        std::vector<std::pair<uint32_t, uint32_t>> Terms;
+
+        //! Whether the selector names a value no component has, so nothing matches.
+        bool MatchesNone = false;
+    };
+
+    bool Compile(const std::string& selectorJson, CompiledSelector& compiled) const;
+
+    static uint64_t PostingKey(uint32_t column, uint32_t valueId)
+    {
+        return (static_cast<uint64_t>(column) << 32) | valueId;
+    }
+
+    //! The components are only read, and a large inventory takes a single arena rather than an allocation per value.
+    ADUC_JSON_ReadOnlyDocument* _document = nullptr;
+    JSON_Array* _components = nullptr;
+
+    //! Attribute name -> column in _values.
+    std::unordered_map<std::string, uint32_t> _columns;
+
+    //! Attribute value -> value id. Id 0 is the absence of a string field.
+    std::unordered_map<std::string, uint32_t> _valueIds;
+
+    //! The value id of each attribute of each component, a row of _columns.size() ids per component.
+    std::vector<uint32_t> _values;
+
+    //! PostingKey(column, value id) -> indexes of the components in _components.
+    std::unordered_map<uint64_t, std::vector<size_t>> _postings;
+
+    //! Selector -> selected components.
+    std::unordered_map<std::string, std::string> _selections;
+};
+
+} // namespace ADUC
+
+#endif // ADUC_COMPONENT_INVENTORY_HPP
@@ -0,0 +1,49 @@
+/**
+ * @file component_inventory_cache.h
+ * @brief The agent's cache of the component inventory, see component_inventory.hpp.
+ *
+ * The agent exports these functions, listed in component_inventory_cache.dynamic-list, so that the copies linked into
+ * extensions, e.g. the steps handler, use the agent's cache.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ADUC_COMPONENT_INVENTORY_CACHE_H
+#define ADUC_COMPONENT_INVENTORY_CACHE_H
+
+#include <aduc/c_utils.h> // for EXTERN_C_BEGIN, EXTERN_C_END
+#include <stdbool.h>
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Replaces the cached inventory.
+ *
+ * @param allComponents The result of the component enumerator's GetAllComponents.
+ * @return true on success.
+ */
+bool ADUC_ComponentInventory_Load(const char* allComponents);
+
+/**
+ * @brief Returns whether the inventory is cached.
+ */
+bool ADUC_ComponentInventory_IsLoaded();
+
+/**
+ * @brief Selects the components matching @p selector from the cached inventory.
+ *
+ * @param selector A JSON object of name-value pairs used for selecting components.
+ * @return The selected components, in the format of GetAllComponents, which the caller must free(). NULL if the cache
+ * can't answer, in which case the caller asks the component enumerator's SelectComponents.
+ */
+char* ADUC_ComponentInventory_Select(const char* selector);
+
+/**
+ * @brief Discards the cached inventory, e.g. when the components may have changed.
+ */
+void ADUC_ComponentInventory_Invalidate();
+
+EXTERN_C_END
+
+#endif // ADUC_COMPONENT_INVENTORY_CACHE_H
@@ -0,0 +1,145 @@
+/**
+ * @file download_progress.hpp
+ * @brief The rate contract the extension manager applies to the progress callbacks of the content downloaders.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ADUC_DOWNLOAD_PROGRESS_HPP
+#define ADUC_DOWNLOAD_PROGRESS_HPP
+
+#include "aduc/types/download.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace ADUC
+{
+/**
+ * @brief Decides which progress callbacks of a download are passed on: the first one, every change of state, and
+ * then at most one per interval or per percent step of the file, whichever comes first. Computes the throughput and
+ * the estimated time left of the download as it goes.
+ *
+ * A downloader may call the progress callback per received chunk; the callback logs, and records telemetry. Not
+ * thread-safe; each download has an aggregator of its own.
+ */
+class DownloadProgressAggregator
+{
+public:
+    //! The interval of the progress callbacks passed on, when not configured.
+    static constexpr std::chrono::milliseconds DefaultInterval{ 1000 };
+
+    //! The percent step of the progress callbacks passed on, when not configured.
+    static constexpr unsigned int DefaultPercentStep = 5;
+
+    /**
+     * @brief Constructor.
+     *
+     * @param interval The least time between two progress callbacks passed on. 0 to pass on each one.
+     * @param percentStep The progress, in percent of the file, after which a callback is passed on anyway. 0 for none.
+     * @param start When the download started.
+     */
+    DownloadProgressAggregator(
+        std::chrono::milliseconds interval, unsigned int percentStep, std::chrono::steady_clock::time_point start);
+
+    /**
+     * @brief Records a progress callback, and returns whether to pass it on.
+     *
+     * @param state The download state.
+     * @param bytesTransferred The bytes downloaded so far. Fewer than before when a retry starts over.
+     * @param bytesTotal The size of the file, 0 if unknown.
+     * @param now The current time.
+     * @returns true to pass the callback on, in which case the throughput and the ETA are updated.
+     */
+    bool Update(
+        ADUC_DownloadProgressState state,
+        uint64_t bytesTransferred,
+        uint64_t bytesTotal,
+        std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Returns the throughput between the last two callbacks passed on, in bytes per second.
+     */
+    double GetBytesPerSecond() const
+    {
+        return _bytesPerSecond;
+    }
+
+    /**
+     * @brief Returns the throughput since the download started, or last started over, in bytes per second.
+     */
+    double GetAverageBytesPerSecond() const
+    {
+        return _averageBytesPerSecond;
+    }
+
+    /**
+     * @brief Returns the estimated seconds until the download completes at the average throughput, or -1 if unknown.
+     */
+    int64_t GetEtaSeconds() const
+    {
+        return _etaSeconds;
+    }
+
+private:
+    std::chrono::milliseconds _interval;
+    unsigned int _percentStep;
+    std::chrono::steady_clock::time_point _start;
+    uint64_t _startBytes = 0;
+    bool _passedOn = false;
+    ADUC_DownloadProgressState _state = ADUC_DownloadProgressState_NotStarted;
+    std::chrono::steady_clock::time_point _lastTime;
+    uint64_t _lastBytes = 0;
+    unsigned int _lastPercent = 0;
+    double _bytesPerSecond = 0;
+    double _averageBytesPerSecond = 0;
+    int64_t _etaSeconds = -1;
+};
+
+/**
+ * @brief Sets the interval and percent step of the aggregators of the downloads started from now on.
+ *
+ * @param interval The interval. 0 for DownloadProgressAggregator::DefaultInterval.
+ * @param percentStep The percent step. 0 for DownloadProgressAggregator::DefaultPercentStep.
+ */
+void SetDownloadProgressInterval(std::chrono::milliseconds interval, unsigned int percentStep);
+
+/**
+ * @brief Routes the progress callbacks of the download of a file through an aggregator while in scope. The
+ * callbacks passed on also log the throughput and record it in the progress telemetry.
+ *
+ * Downloads of the same file of the same workflow in progress at the same time share the aggregator.
+ */
+class AggregatedDownloadProgress
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param workflowId The workflow id the downloader passes to the callback.
+     * @param fileId The file id the downloader passes to the callback.
+     * @param callback The callback to pass the progress on to. May be nullptr.
+     */
+    AggregatedDownloadProgress(const char* workflowId, const char* fileId, ADUC_DownloadProgressCallback callback);
+
+    ~AggregatedDownloadProgress();
+
+    AggregatedDownloadProgress(const AggregatedDownloadProgress&) = delete;
+    AggregatedDownloadProgress& operator=(const AggregatedDownloadProgress&) = delete;
+
+    /**
+     * @brief Returns the callback to pass to the downloader, or nullptr if there's no callback to pass the progress on
+     * to.
+     */
+    ADUC_DownloadProgressCallback GetCallback() const;
+
+private:
+    std::string _key;
+    bool _registered = false;
+};
+
+} // namespace ADUC
+
+#endif // ADUC_DOWNLOAD_PROGRESS_HPP
@@ -0,0 +1,79 @@
+/**
+ * @file download_retry.hpp
+ * @brief The retry policy the extension manager applies to the downloads of the content downloaders.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ADUC_DOWNLOAD_RETRY_HPP
+#define ADUC_DOWNLOAD_RETRY_HPP
+
+#include "aduc/result.h"
+
+#include <chrono>
+
+namespace ADUC
+{
+/**
+ * @brief Decides whether, and when, a failed download is retried: transient failures only, with exponential backoff
+ * and full jitter, until the retry timeout of the download.
+ *
+ * The jitter spreads the retries of the devices that failed at the same time, e.g. during a CDN outage, instead of
+ * sending them back in synchronized waves. Not thread-safe; each download has a policy of its own.
+ */
+class DownloadRetryPolicy
+{
+public:
+    //! The most attempts of a download, including the first one.
+    static constexpr unsigned int MaxAttempts = 5;
+
+    //! The backoff before the first retry, doubled for each retry after it.
+    static constexpr std::chrono::milliseconds BaseDelay{ 2000 };
+
+    //! The longest backoff.
+    static constexpr std::chrono::milliseconds MaxDelay{ 5 * 60 * 1000 };
+
+    /**
+     * @brief Constructor.
+     *
+     * @param timeout How long the download may take, retries included. 0 for no retries.
+     * @param start When the download started.
+     */
+    DownloadRetryPolicy(std::chrono::seconds timeout, std::chrono::steady_clock::time_point start);
+
+    /**
+     * @brief Returns whether @p result is a failure that another attempt may not hit, e.g. a connection failure or
+     * an HTTP 503, rather than e.g. an HTTP 404, an invalid hash or a cancellation.
+     */
+    static bool IsTransientFailure(const ADUC_Result& result);
+
+    /**
+     * @brief Records an attempt that ended with @p result, and returns whether to retry it.
+     *
+     * @param result The result of the attempt.
+     * @param now The current time.
+     * @param jitter A random number from [0, 1), the fraction of the backoff to wait.
+     * @param[out] delay Receives how long to wait before the retry.
+     * @returns true to retry: the failure is transient, attempts are left, and the retry starts before the deadline.
+     */
+    bool ShouldRetry(
+        const ADUC_Result& result,
+        std::chrono::steady_clock::time_point now,
+        double jitter,
+        std::chrono::milliseconds* delay);
+
+    /**
+     * @brief Returns the seconds left until the deadline, at least 1; 0 if the download has no timeout.
+     */
+    unsigned int GetRemainingSeconds(std::chrono::steady_clock::time_point now) const;
+
+private:
+    std::chrono::seconds _timeout;
+    std::chrono::steady_clock::time_point _deadline;
+    unsigned int _attempts = 0;
+};
+
+} // namespace ADUC
+
+#endif // ADUC_DOWNLOAD_RETRY_HPP
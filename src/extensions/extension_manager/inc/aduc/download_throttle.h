@@ -0,0 +1,107 @@
+/**
+ * @file download_throttle.h
+ * @brief Limits the bandwidth of the downloads, and the times of day they may start at, so that the devices of a site
+ * share its uplink instead of congesting it.
+ *
+ * The extension manager waits for a download window before calling the content downloader. Downloaders that receive
+ * the content themselves, e.g. the curl downloader, consume the bytes they receive from the shared bucket, and apply
+ * the per download limit. The agent exports these functions, listed in download_throttle.dynamic-list, so that the
+ * copies linked into downloaders use the agent's bucket.
+ *
+ * Transfers have a priority class. IoT Hub messaging isn't throttled at all. Foreground transfers, i.e. the downloads
+ * of the current deployment, come next. Background transfers, e.g. prefetches and diagnostics uploads, pause while a
+ * foreground transfer is in progress.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ADUC_DOWNLOAD_THROTTLE_H
+#define ADUC_DOWNLOAD_THROTTLE_H
+
+#include <aduc/c_utils.h> // for EXTERN_C_BEGIN, EXTERN_C_END
+#include <aduc/cancellation_token.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The longest wait, in seconds, before checking the download windows again, so that a configuration reload
+ * takes effect.
+ */
+#define ADUC_DOWNLOAD_THROTTLE_WINDOW_POLL_SECS 60
+
+/**
+ * @brief The longest a background transfer pauses for a foreground one, in seconds, before it takes one more block.
+ * This keeps its connection from timing out, at a trickle that doesn't compete with the foreground transfer.
+ */
+#define ADUC_DOWNLOAD_THROTTLE_BACKGROUND_PAUSE_SECS 30
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief The priority classes of the transfers.
+ */
+typedef enum tagADUC_TransferPriority
+{
+    ADUC_TransferPriority_Foreground = 0, /**< The downloads of the current deployment. The default. */
+    ADUC_TransferPriority_Background, /**< Prefetches and uploads. They pause while a foreground transfer runs. */
+} ADUC_TransferPriority;
+
+/**
+ * @brief Sets the bandwidth limits and the download windows.
+ *
+ * @param bytesPerSecond The limit of all downloads together, in bytes per second. 0 for no limit.
+ * @param perDownloadBytesPerSecond The limit of each download, in bytes per second. 0 for no limit.
+ * @param windows Comma-separated "HH:MM-HH:MM" times of day, in local time, downloads may start at, e.g.
+ * "22:00-06:00". NULL or empty to allow downloads at any time.
+ * @return true on success. false if @p windows is invalid, in which case the previous windows are kept.
+ */
+bool ADUC_DownloadThrottle_Configure(uint64_t bytesPerSecond, uint64_t perDownloadBytesPerSecond, const char* windows);
+
+/**
+ * @brief Returns the limit of each download, in bytes per second; 0 for no limit.
+ */
+uint64_t ADUC_DownloadThrottle_GetPerDownloadLimit();
+
+/**
+ * @brief Sets the priority of the transfers of the calling thread.
+ *
+ * @param priority The priority.
+ */
+void ADUC_DownloadThrottle_SetThreadPriority(ADUC_TransferPriority priority);
+
+/**
+ * @brief Returns the priority of the transfers of the calling thread.
+ */
+ADUC_TransferPriority ADUC_DownloadThrottle_GetThreadPriority();
+
+/**
+ * @brief Marks the start of a transfer of the calling thread. Background transfers pause until a foreground one ends
+ * with ADUC_DownloadThrottle_EndTransfer. Thread-safe.
+ */
+void ADUC_DownloadThrottle_BeginTransfer();
+
+/**
+ * @brief Marks the end of a transfer started with ADUC_DownloadThrottle_BeginTransfer, on the same thread.
+ */
+void ADUC_DownloadThrottle_EndTransfer();
+
+/**
+ * @brief Takes @p bytes transferred from the shared bucket, waiting if the bucket is empty. A background transfer
+ * first waits for the foreground transfers to end, see ADUC_DOWNLOAD_THROTTLE_BACKGROUND_PAUSE_SECS. Thread-safe.
+ *
+ * @param bytes The number of bytes transferred.
+ */
+void ADUC_DownloadThrottle_Consume(uint64_t bytes);
+
+/**
+ * @brief Waits until a download window is open. Returns right away if there are no windows. Thread-safe.
+ *
+ * @param cancellationToken Stops the wait once cancelled, or NULL.
+ * @return true once a window is open; false if @p cancellationToken was cancelled first.
+ */
+bool ADUC_DownloadThrottle_WaitForWindow(const ADUC_CancellationToken* cancellationToken);
+
+EXTERN_C_END
+
+#endif // ADUC_DOWNLOAD_THROTTLE_H
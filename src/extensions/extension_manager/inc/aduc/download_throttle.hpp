@@ -0,0 +1,99 @@
+/**
+ * @file download_throttle.hpp
+ * @brief The token bucket and the time-of-day windows the download throttle enforces, see download_throttle.h.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ADUC_DOWNLOAD_THROTTLE_HPP
+#define ADUC_DOWNLOAD_THROTTLE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace ADUC
+{
+/**
+ * @brief A token bucket of bytes, refilled at a fixed rate, that holds at most one second of tokens.
+ *
+ * Consumers take the bytes they received, and wait for the returned duration before receiving more, so that one
+ * large chunk borrows from the next second rather than being refused. Not thread-safe.
+ */
+class TokenBucket
+{
+public:
+    /**
+     * @brief Sets the rate of the bucket, and fills it.
+     *
+     * @param bytesPerSecond The rate, in bytes per second. 0 removes the limit.
+     * @param now The current time.
+     */
+    void SetRate(uint64_t bytesPerSecond, std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Returns the rate of the bucket, in bytes per second; 0 if unlimited.
+     */
+    uint64_t GetRate() const
+    {
+        return _rate;
+    }
+
+    /**
+     * @brief Takes @p bytes from the bucket.
+     *
+     * @param bytes The number of bytes.
+     * @param now The current time.
+     * @returns How long the consumer must wait before taking more; 0 if the bucket had enough tokens.
+     */
+    std::chrono::microseconds Consume(uint64_t bytes, std::chrono::steady_clock::time_point now);
+
+private:
+    uint64_t _rate = 0;
+    double _tokens = 0;
+    std::chrono::steady_clock::time_point _lastRefill;
+};
+
+/**
+ * @brief The times of day downloads are allowed at, e.g. "22:00-06:00,12:00-13:00", in local time.
+ *
+ * A window ending before it starts spans midnight. A window ending when it starts spans the whole day. No windows
+ * allows downloads at any time.
+ */
+class DownloadWindows
+{
+public:
+    /**
+     * @brief Replaces the windows with the ones of @p windows.
+     *
+     * @param windows Comma-separated "HH:MM-HH:MM" windows. NULL or empty for no windows.
+     * @returns True on success. On failure, the windows are left unchanged.
+     */
+    bool Parse(const char* windows);
+
+    /**
+     * @brief Returns whether there are no windows, so that downloads are allowed at any time.
+     */
+    bool IsEmpty() const
+    {
+        return _windows.empty();
+    }
+
+    /**
+     * @brief Returns the minutes until a window opens, from the minute of the day @p minuteOfDay.
+     *
+     * @param minuteOfDay The minutes since midnight, from 0 to 1439.
+     * @returns 0 if a window is open, or there are no windows.
+     */
+    unsigned int GetMinutesUntilOpen(unsigned int minuteOfDay) const;
+
+private:
+    //! The start and end of the windows, in minutes since midnight.
+    std::vector<std::pair<unsigned int, unsigned int>> _windows;
+};
+
+} // namespace ADUC
+
+#endif // ADUC_DOWNLOAD_THROTTLE_HPP
@@ -9,6 +9,9 @@
 #ifndef ADUC_EXTENSION_MANAGER_H
 #define ADUC_EXTENSION_MANAGER_H
 
+#include <stdbool.h>
+#include <stdint.h> // for uint64_t
+
 EXTERN_C_BEGIN
 
 /**
@@ -31,6 +34,89 @@ ADUC_Result ExtensionManager_InitializeContentDownloader(const char* initializeD
  */
 ADUC_Result ExtensionManager_Download(const ADUC_FileEntity* entity, const char* workflowId, const char* workFolder, unsigned int retryTimeout, ADUC_DownloadProgressCallback downloadProgressCallback);
 
+/**
+ * @brief Sets the maximum number of files the extension manager downloads at the same time.
+ *
+ * @param maxConcurrentDownloads The maximum number of downloads. 0 restores the default.
+ */
+void ExtensionManager_SetMaxConcurrentDownloads(unsigned int maxConcurrentDownloads);
+
+/**
+ * @brief Sets the maximum total size of the download cache, which keeps downloaded files across workflows.
+ *
+ * @param sizeLimitInBytes The maximum size of the cache. 0 disables the cache.
+ */
+void ExtensionManager_SetDownloadCacheSizeLimit(uint64_t sizeLimitInBytes);
+
+/**
+ * @brief Checks whether the download cache has the content of @p entity on the file system of @p workFolder, so that
+ * downloading it takes no disk space.
+ *
+ * @param entity The file entity.
+ * @param workFolder The work folder sandbox.
+ * @return true if the file would be hard linked from the download cache.
+ */
+bool ExtensionManager_IsDownloadCacheLinkable(const ADUC_FileEntity* entity, const char* workFolder);
+
+/**
+ * @brief Sets the bandwidth limits and the times of day of the downloads, see download_throttle.h.
+ *
+ * @param bytesPerSecond The limit of all downloads together, in bytes per second. 0 for no limit.
+ * @param perDownloadBytesPerSecond The limit of each download, in bytes per second. 0 for no limit.
+ * @param windows Comma-separated "HH:MM-HH:MM" times of day, in local time, downloads may start at. NULL for any time.
+ */
+void ExtensionManager_SetDownloadThrottle(uint64_t bytesPerSecond, uint64_t perDownloadBytesPerSecond, const char* windows);
+
+/**
+ * @brief Sets the LAN cache hosts, e.g. Connected Cache servers, the content downloader asks for the content before
+ * its origin, if it supports them.
+ *
+ * @param cacheHosts Comma-separated host names or addresses, optionally with a port. NULL for none.
+ */
+void ExtensionManager_SetDownloadCacheHosts(const char* cacheHosts);
+
+/**
+ * @brief Sets how often the progress of a download is passed on to the download progress callback: at most once per
+ * @p intervalMs, or per @p percentStep percent of the file, and on every change of state.
+ *
+ * @param intervalMs The least milliseconds between two progress callbacks. 0 for the default, 1000.
+ * @param percentStep The percent of the file after which progress is passed on anyway. 0 for the default, 5.
+ */
+void ExtensionManager_SetDownloadProgressInterval(unsigned int intervalMs, unsigned int percentStep);
+
+/**
+ * @brief Loads the registered update content handlers on a background thread,
+ * so that the first workflow doesn't wait for them. ExtensionManager_Uninit waits for it.
+ */
+void ExtensionManager_PreloadUpdateContentHandlers();
+
+/**
+ * @brief Unloads the update content handlers and their libraries, so that the next workflow verifies and loads the
+ * libraries registered then, e.g. after an update of a handler. No workflow may be in progress.
+ */
+void ExtensionManager_ReloadUpdateContentHandlers();
+
+/**
+ * @brief Sets how long an update content handler or the content downloader stays loaded once it was last used.
+ *
+ * @param idleUnloadSeconds The idle time, in seconds. 0 keeps the extensions loaded.
+ */
+void ExtensionManager_SetIdleUnloadTimeout(unsigned int idleUnloadSeconds);
+
+/**
+ * @brief Sets how long the enumeration of the components waits for each component enumerator, when additional ones
+ * are registered. An enumerator that doesn't answer in time contributes its last components.
+ *
+ * @param timeoutMs The time, in milliseconds. 0 waits for all of them.
+ */
+void ExtensionManager_SetComponentEnumeratorTimeout(unsigned int timeoutMs);
+
+/**
+ * @brief Unloads the update content handlers and the content downloader that weren't used for the idle unload
+ * timeout, to free their memory between deployments. They are loaded again when used. No workflow may be in progress.
+ */
+void ExtensionManager_UnloadIdleExtensions();
+
 /**
  * @brief Uninitializes the extension manager.
  */
@@ -9,13 +9,21 @@
 #ifndef ADUC_EXTENSION_MANAGER_HPP
 #define ADUC_EXTENSION_MANAGER_HPP
 
+#include "aduc/cancellation_token.h"
 #include "aduc/component_enumerator_extension.hpp"
 #include "aduc/extension_utils.h"
 #include "aduc/result.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <pthread.h>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 typedef enum tagADUC_ExtensionType
 {
@@ -27,6 +35,12 @@ typedef enum tagADUC_ExtensionType
 // Default DO retry timeout is 24 hours.
 #define DO_RETRY_TIMEOUT_DEFAULT (60 * 60 * 24)
 
+// Default maximum number of files downloaded at the same time by ExtensionManager::DownloadFiles.
+#define ADUC_DEFAULT_MAX_CONCURRENT_DOWNLOADS 4
+
+// Default time ExtensionManager::GetAllComponents waits for each of several component enumerators, in milliseconds.
+#define ADUC_DEFAULT_COMPONENT_ENUMERATOR_TIMEOUT_MS 5000
+
 // Forward declaration.
 class ContentHandler;
 
@@ -42,12 +56,61 @@ public:
 
     static void Uninit();
 
+    /**
+     * @brief Loads the update content handler of each registered update type on a background thread.
+     * Uninit waits for it.
+     */
+    static void PreloadUpdateContentHandlers();
+
+    /**
+     * @brief Unloads the update content handlers and their libraries, so that the next load verifies and loads the
+     * libraries registered then, e.g. updated ones. The other extensions stay loaded.
+     * No workflow may be using a handler.
+     */
+    static void ReloadUpdateContentHandlers();
+
+    /**
+     * @brief Sets how long an update content handler or the content downloader stays loaded once it was last used.
+     * @param idleUnloadSeconds The idle time, in seconds. 0 keeps the extensions loaded.
+     */
+    static void SetIdleUnloadTimeout(unsigned int idleUnloadSeconds);
+
+    /**
+     * @brief Unloads the update content handlers, and the content downloader, that weren't used for the idle unload
+     * timeout, and their libraries. They are loaded again, without hashing the unchanged libraries again, when used.
+     * No workflow may be using them.
+     */
+    static void UnloadIdleExtensions();
+
+    /**
+     * @brief Sets how long GetAllComponents waits for each component enumerator, when there are several.
+     * @param timeoutMs The time, in milliseconds. 0 waits for all of them.
+     */
+    static void SetComponentEnumeratorTimeout(unsigned int timeoutMs);
+
     /**
      * @brief Returns all components information in JSON format.
+     * With additional component enumerators, each enumerates its components on its own thread, and their components
+     * are merged; an enumerator that doesn't answer within the component enumerator timeout contributes its last
+     * components.
      * @param[out] outputComponentsData An output string containing components data.
      */
     static ADUC_Result GetAllComponents(std::string& outputComponentsData);
 
+    /**
+     * @brief Returns a 64-bit digest of all components information, without copying it.
+     * @param[out] outputDigest The digest of the components data, 0 if the component enumerator returned none.
+     */
+    static ADUC_Result GetAllComponentsDigest(uint64_t* outputDigest);
+
+    /**
+     * @brief Returns the generation of the components collection, if the component enumerator exports
+     * GetComponentsGeneration.
+     * @param[out] outputGeneration The generation of the components collection.
+     * @return ADUC_ERC_COMPONENT_ENUMERATOR_GETCOMPONENTSGENERATION_NOTIMP if the enumerator doesn't export it.
+     */
+    static ADUC_Result GetComponentsGeneration(uint64_t* outputGeneration);
+
     /**
      * @brief Selects component(s) matching specified @p selector.
      * @param selector A JSON string contains name-value pairs used for selecting components.
@@ -55,6 +118,15 @@ public:
      */
     static ADUC_Result SelectComponents(const std::string& selector, std::string& outputComponentsData);
 
+    /**
+     * @brief Selects the component(s) matching each of @p selectors. Selectors the component inventory cache can't
+     * answer are passed to the component enumerator in one call, if it supports SelectComponentsBatch.
+     * @param selectors JSON strings containing name-value pairs used for selecting components.
+     * @param[out] outputComponentsData The components data of each selector, in @p selectors order.
+     */
+    static ADUC_Result
+    SelectComponents(const std::vector<std::string>& selectors, std::vector<std::string>& outputComponentsData);
+
     /**
      * @brief Initialize Content Downloader extension.
      * @param[in] initializeData A string contains downloader initialization data.
@@ -70,20 +142,147 @@ public:
      * @param workFolder A full path to target directory (sandbox).
      * @param retryTimeout A download retry timeout (in seconds).
      * @param downloadProgressCallback A download progress reporting callback.
-     * @return ADUC_Result
+     * @param cancellationToken Aborts the download, and its retries, once cancelled. nullptr for none.
+     * @return ADUC_Result ADUC_Result_Failure_Cancelled if the token was cancelled.
      */
     static ADUC_Result Download(
         const ADUC_FileEntity* entity,
         const char* workflowId,
         const char* workFolder,
         unsigned int retryTimeout,
-        ADUC_DownloadProgressCallback downloadProgressCallback);
+        ADUC_DownloadProgressCallback downloadProgressCallback,
+        const ADUC_CancellationToken* cancellationToken = nullptr);
+
+    /**
+     * @brief Returns whether the content downloader can download to a stream, see DownloadToStream.
+     */
+    static bool IsDownloadToStreamSupported();
+
+    /**
+     * @brief Downloads the content of @p entity and writes it to @p outputFd as it arrives, instead of to a file.
+     * The content is hashed as it's written; the result is a failure if the hash of all of it isn't valid.
+     *
+     * @param entity An #ADUC_FileEntity object with information of the file to be downloaded.
+     * @param workflowId A workflow identifier.
+     * @param retryTimeout A download retry timeout (in seconds).
+     * @param downloadProgressCallback A download progress reporting callback.
+     * @param outputFd The file descriptor to write the content to, e.g. a pipe. The caller closes it.
+     * @param cancellationToken The download isn't started if it's cancelled. nullptr for none.
+     * @return ADUC_Result
+     */
+    static ADUC_Result DownloadToStream(
+        const ADUC_FileEntity* entity,
+        const char* workflowId,
+        unsigned int retryTimeout,
+        ADUC_DownloadProgressCallback downloadProgressCallback,
+        int outputFd,
+        const ADUC_CancellationToken* cancellationToken = nullptr);
+
+    /**
+     * @brief Downloads @p entities, running up to the configured maximum number of downloads at the same time.
+     * Once a download fails, no new downloads are started.
+     *
+     * @param entities The file entities to download.
+     * @param workflowId A workflow identifier.
+     * @param workFolder A full path to target directory (sandbox).
+     * @param retryTimeout A download retry timeout (in seconds).
+     * @param downloadProgressCallback A download progress reporting callback. It may be called from several threads.
+     * @param cancellationToken Aborts the downloads in progress, and starts no new ones, once cancelled.
+     * nullptr for none.
+     * @return ADUC_Result The result of the first failed download, in @p entities order, or success.
+     */
+    static ADUC_Result DownloadFiles(
+        const std::vector<const ADUC_FileEntity*>& entities,
+        const char* workflowId,
+        const char* workFolder,
+        unsigned int retryTimeout,
+        ADUC_DownloadProgressCallback downloadProgressCallback,
+        const ADUC_CancellationToken* cancellationToken = nullptr);
+
+    /**
+     * @brief Verifies the hashes of the already downloaded @p files, one file per processor core at the same time.
+     * Files that were verified earlier in the workflow, and haven't changed since, aren't hashed again,
+     * and files that don't exist are skipped. Once a file is found invalid, no new files are hashed.
+     *
+     * @param files The full path and file entity of each file.
+     * @return ADUC_Result The result of the first invalid file, in @p files order, or success.
+     */
+    static ADUC_Result VerifyFiles(const std::vector<std::pair<std::string, const ADUC_FileEntity*>>& files);
+
+    /**
+     * @brief Sets the maximum number of files DownloadFiles downloads at the same time.
+     * @param maxConcurrentDownloads The maximum number of downloads. 0 restores the default.
+     */
+    static void SetMaxConcurrentDownloads(unsigned int maxConcurrentDownloads);
+
+    /**
+     * @brief Sets the maximum total size of the download cache, which keeps downloaded files across workflows.
+     * @param sizeLimitInBytes The maximum size of the cache. 0 disables the cache.
+     */
+    static void SetDownloadCacheSizeLimit(uint64_t sizeLimitInBytes);
+
+    /**
+     * @brief Checks whether the download cache has the content of @p entity on the file system of @p workFolder, so
+     * that it's placed there with a hard link instead of downloaded.
+     * @param entity The file entity.
+     * @param workFolder The work folder.
+     * @return true if the file takes no disk space to download.
+     */
+    static bool IsDownloadCacheLinkable(const ADUC_FileEntity* entity, const char* workFolder);
+
+    /**
+     * @brief Sets the bandwidth limits and the times of day of the downloads, see download_throttle.h.
+     * @param bytesPerSecond The limit of all downloads together, in bytes per second. 0 for no limit.
+     * @param perDownloadBytesPerSecond The limit of each download, in bytes per second. 0 for no limit.
+     * @param windows Comma-separated "HH:MM-HH:MM" times of day downloads may start at. NULL for any time.
+     */
+    static void SetDownloadThrottle(uint64_t bytesPerSecond, uint64_t perDownloadBytesPerSecond, const char* windows);
+
+    /**
+     * @brief Sets the LAN cache hosts of the content downloader, if it supports them, see SetCacheHostsProc.
+     * @param cacheHosts Comma-separated cache hosts. NULL for none.
+     */
+    static void SetDownloadCacheHosts(const char* cacheHosts);
+
+    /**
+     * @brief Sets how often the progress of a download is passed on to its progress callback, see
+     * download_progress.hpp.
+     * @param intervalMs The least milliseconds between two progress callbacks. 0 for the default.
+     * @param percentStep The percent of the file after which progress is passed on anyway. 0 for the default.
+     */
+    static void SetDownloadProgressInterval(unsigned int intervalMs, unsigned int percentStep);
+
+    /**
+     * @brief Remembers a file whose hash has been verified, so it doesn't need to be hashed again.
+     * @param verifiedFile The verified file. Ownership of its members is transferred to the cache.
+     */
+    static void CacheVerifiedFile(ADUC_DownloadVerifiedFile* verifiedFile);
+
+    /**
+     * @brief Forgets all verified files, e.g. once a workflow completed and its sandbox is gone.
+     */
+    static void ClearVerifiedFileCache();
 
 private:
+    static bool IsVerifiedFileCached(const std::string& filePath, const ADUC_FileEntity* entity);
+
+    static bool AcquirePayload(
+        const ADUC_FileEntity* entity, const std::string& filePath, std::string* payloadKey, bool* owner);
+    static void ReleasePayload(const std::string& payloadKey, const std::string& filePath, bool downloaded);
+
+    static bool IsExtensionFileVerified(const char* filePath, const char* hashType, const char* hashValue);
+    static void AddVerifiedExtensionFile(const char* filePath, const char* hashType, const char* hashValue);
+
+    static ContentHandler* FindUpdateContentHandler(const std::string& updateType);
+    static void RestoreContentDownloaderSettings(void* contentDownloaderLibrary);
     static void UnloadAllUpdateContentHandlers();
     static void UnloadAllExtensions();
 
     static void _FreeComponentsDataString(char* componentsJson);
+    static bool SelectCachedComponents(const std::string& selector, std::string& outputComponentsData);
+    static void LoadAdditionalComponentEnumeratorLibraries(std::vector<std::pair<std::string, void*>>& enumerators);
+    static ADUC_Result GetAllComponentsFromEnumerators(
+        const std::vector<std::pair<std::string, void*>>& enumerators, std::string& outputComponentsData);
 
     static ADUC_Result LoadExtensionLibrary(
         const char* extensionName,
@@ -97,9 +296,31 @@ private:
 
     static std::unordered_map<std::string, void*> _libs;
     static std::unordered_map<std::string, ContentHandler*> _contentHandlers;
+    static std::unordered_map<std::string, std::atomic<int64_t>> _contentHandlersLastUse;
     static void* _contentDownloader;
+    static int64_t _contentDownloaderLastUse;
+    static bool _contentDownloaderUnloaded;
+    static std::unique_ptr<std::string> _contentDownloaderInitializeData;
+    static std::unique_ptr<std::string> _downloadCacheHosts;
+    static std::atomic<unsigned int> _idleUnloadSeconds;
     static void* _componentEnumerator;
-    static pthread_mutex_t factoryMutex;
+    static std::vector<std::pair<std::string, void*>> _additionalComponentEnumerators;
+    static bool _additionalComponentEnumeratorsLoaded;
+    static std::mutex _componentEnumeratorsMutex;
+    static std::atomic<unsigned int> _componentEnumeratorTimeoutMs;
+    static std::unordered_map<std::string, ADUC_DownloadVerifiedFile> _verifiedFiles;
+    static std::mutex _verifiedFilesMutex;
+    static std::unordered_map<std::string, std::string> _payloads;
+    static std::mutex _payloadsMutex;
+    static std::condition_variable _payloadsChanged;
+    static std::mutex _contentDownloaderMutex;
+    static std::mutex _contentHandlersMutex;
+    static pthread_rwlock_t _contentHandlersLock;
+    static std::atomic<unsigned int> _maxConcurrentDownloads;
+    static std::atomic<uint64_t> _downloadCacheSizeLimit;
+    static std::mutex _libsMutex;
+    static std::mutex _extensionIndexMutex;
+    static std::thread _preloadThread;
 };
 
 #endif // ADUC_EXTENSION_MANAGER_HPP
@@ -0,0 +1,224 @@
+/**
+ * @file component_inventory.cpp
+ * @brief Implementation of ComponentInventory.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/component_inventory.hpp"
+
+namespace ADUC
+{
+ComponentInventory::~ComponentInventory()
+{
+    Clear();
+}
+
+void ComponentInventory::Clear()
+{
+    ADUC_JSON_ReadOnlyDocument_Free(_document);
+    _document = nullptr;
+    _components = nullptr;
+    _columns.clear();
+    _valueIds.clear();
+    _values.clear();
+    _postings.clear();
+    _selections.clear();
+}
+
+bool ComponentInventory::Load(const std::string& componentsJson)
+{
+    Clear();
+
+    ADUC_JSON_ReadOnlyDocument* document = ADUC_JSON_ParseReadOnly(componentsJson.c_str());
+    JSON_Array* components =
+        json_object_get_array(json_value_get_object(ADUC_JSON_ReadOnlyDocument_GetRoot(document)), "components");
+    if (components == nullptr)
+    {
+        ADUC_JSON_ReadOnlyDocument_Free(document);
+        return false;
+    }
+
+    _document = document;
+    _components = components;
+
+    // Intern the names of the string fields first, so that each component gets a row of the same width.
+    const size_t count = json_array_get_count(components);
+    for (size_t i = 0; i < count; i++)
+    {
+        const JSON_Object* component = json_array_get_object(components, i);
+        const size_t fieldCount = json_object_get_count(component);
+        for (size_t f = 0; f < fieldCount; f++)
+        {
+            if (json_value_get_type(json_object_get_value_at(component, f)) == JSONString)
+            {
+                _columns.emplace(json_object_get_name(component, f), static_cast<uint32_t>(_columns.size()));
+            }
+        }
+    }
+
+    const size_t columnCount = _columns.size();
+    _values.assign(count * columnCount, 0);
+    for (size_t i = 0; i < count; i++)
+    {
+        const JSON_Object* component = json_array_get_object(components, i);
+        const size_t fieldCount = json_object_get_count(component);
+        for (size_t f = 0; f < fieldCount; f++)
+        {
+            const char* value = json_value_get_string(json_object_get_value_at(component, f));
+            if (value == nullptr)
+            {
+                continue;
+            }
+
+            const uint32_t column = _columns.find(json_object_get_name(component, f))->second;
+            const uint32_t valueId =
+                _valueIds.emplace(value, static_cast<uint32_t>(_valueIds.size() + 1)).first->second;
+            _values[i * columnCount + column] = valueId;
+            _postings[PostingKey(column, valueId)].push_back(i);
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Compiles @p selectorJson into the interned ids of its names and values.
+ *
+ * @param selectorJson A JSON object of name-value pairs.
+ * @param[out] compiled The compiled selector.
+ * @returns False if the selector isn't a JSON object of string values.
+ */
+bool ComponentInventory::Compile(const std::string& selectorJson, CompiledSelector& compiled) const
+{
+    bool succeeded = false;
+    JSON_Value* selectorValue = json_parse_string(selectorJson.c_str());
+    const JSON_Object* selector = json_value_get_object(selectorValue);
+    const size_t selectorCount = json_object_get_count(selector);
+
+    compiled.Terms.clear();
+    compiled.MatchesNone = false;
+
+    if (selector == nullptr)
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < selectorCount; i++)
+    {
+        const char* name = json_object_get_name(selector, i);
+        const char* value = json_value_get_string(json_object_get_value_at(selector, i));
+        if (value == nullptr)
+        {
+            goto done;
+        }
+
+        // Like the example enumerators, empty names and values match nothing.
+        const auto column = _columns.find(name);
+        const auto valueId = _valueIds.find(value);
+        if (*name == '\0' || *value == '\0' || column == _columns.end() || valueId == _valueIds.end()
+            || _postings.count(PostingKey(column->second, valueId->second)) == 0)
+        {
+            compiled.MatchesNone = true;
+            continue;
+        }
+
+        compiled.Terms.emplace_back(column->second, valueId->second);
+    }
+
+    succeeded = true;
+
+done:
+    json_value_free(selectorValue);
+    return succeeded;
+}
+
+bool ComponentInventory::Select(const std::string& selectorJson, std::string& outputComponentsData)
+{
+    if (!IsLoaded())
+    {
+        return false;
+    }
+
+    const auto remembered = _selections.find(selectorJson);
+    if (remembered != _selections.end())
+    {
+        outputComponentsData = remembered->second;
+        return true;
+    }
+
+    bool succeeded = false;
+    CompiledSelector compiled;
+    JSON_Value* outputValue = nullptr;
+    JSON_Array* outputComponents = nullptr;
+    const std::vector<size_t>* candidates = nullptr;
+    const size_t columnCount = _columns.size();
+    char* serialized = nullptr;
+
+    if (!Compile(selectorJson, compiled))
+    {
+        goto done;
+    }
+
+    outputValue = json_value_init_object();
+    outputComponents = json_value_get_array(json_value_init_array());
+    if (json_object_set_value(json_value_get_object(outputValue), "components", json_array_get_wrapping_value(outputComponents))
+        != JSONSuccess)
+    {
+        json_value_free(json_array_get_wrapping_value(outputComponents));
+        goto done;
+    }
+
+    if (!compiled.MatchesNone)
+    {
+        // Start from the fewest candidates any term of the selector allows, then match all terms.
+        for (const auto& term : compiled.Terms)
+        {
+            const std::vector<size_t>& posting = _postings.find(PostingKey(term.first, term.second))->second;
+            if (candidates == nullptr || posting.size() < candidates->size())
+            {
+                candidates = &posting;
+            }
+        }
+
+        const size_t candidateCount =
+            candidates == nullptr ? json_array_get_count(_components) : candidates->size();
+        for (size_t c = 0; c < candidateCount; c++)
+        {
+            const size_t index = candidates == nullptr ? c : (*candidates)[c];
+            const uint32_t* row = _values.data() + index * columnCount;
+
+            bool matched = true;
+            for (size_t t = 0; t < compiled.Terms.size() && matched; t++)
+            {
+                matched = row[compiled.Terms[t].first] == compiled.Terms[t].second;
+            }
+
+            if (matched
+                && json_array_append_value(
+                       outputComponents, json_value_deep_copy(json_array_get_value(_components, index)))
+                    != JSONSuccess)
+            {
+                goto done;
+            }
+        }
+    }
+
+    serialized = json_serialize_to_string_pretty(outputValue);
+    if (serialized == nullptr)
+    {
+        goto done;
+    }
+
+    outputComponentsData = serialized;
+    _selections.emplace(selectorJson, outputComponentsData);
+    succeeded = true;
+
+done:
+    json_free_serialized_string(serialized);
+    json_value_free(outputValue);
+    return succeeded;
+}
+
+} // namespace ADUC
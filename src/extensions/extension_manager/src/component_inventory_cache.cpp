@@ -0,0 +1,67 @@
+/**
+ * @file component_inventory_cache.cpp
+ * @brief Implementation of the agent's component inventory cache.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/component_inventory_cache.h"
+#include "aduc/component_inventory.hpp"
+#include "aduc/logging.h"
+
+#include <cstring>
+#include <mutex>
+
+static std::mutex s_inventoryMutex;
+static ADUC::ComponentInventory s_inventory;
+
+EXTERN_C_BEGIN
+
+bool ADUC_ComponentInventory_Load(const char* allComponents)
+{
+    try
+    {
+        std::lock_guard<std::mutex> lock(s_inventoryMutex);
+        return s_inventory.Load(allComponents);
+    }
+    catch (const std::exception& ex)
+    {
+        Log_Warn("Cannot cache the component inventory: %s", ex.what());
+        return false;
+    }
+}
+
+bool ADUC_ComponentInventory_IsLoaded()
+{
+    std::lock_guard<std::mutex> lock(s_inventoryMutex);
+    return s_inventory.IsLoaded();
+}
+
+char* ADUC_ComponentInventory_Select(const char* selector)
+{
+    std::string components;
+
+    try
+    {
+        std::lock_guard<std::mutex> lock(s_inventoryMutex);
+        if (!s_inventory.Select(selector, components))
+        {
+            return nullptr;
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        Log_Warn("Cannot select components from the cached inventory: %s", ex.what());
+        return nullptr;
+    }
+
+    return strdup(components.c_str());
+}
+
+void ADUC_ComponentInventory_Invalidate()
+{
+    std::lock_guard<std::mutex> lock(s_inventoryMutex);
+    s_inventory.Clear();
+}
+
+EXTERN_C_END
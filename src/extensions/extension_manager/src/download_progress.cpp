@@ -0,0 +1,229 @@
+/**
+ * @file download_progress.cpp
+ * @brief Implementation of the aggregation of the download progress callbacks.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/download_progress.hpp"
+#include "aduc/logging.h"
+#include "aduc/progress_telemetry.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace ADUC
+{
+constexpr std::chrono::milliseconds DownloadProgressAggregator::DefaultInterval;
+constexpr unsigned int DownloadProgressAggregator::DefaultPercentStep;
+
+DownloadProgressAggregator::DownloadProgressAggregator(
+    std::chrono::milliseconds interval, unsigned int percentStep, std::chrono::steady_clock::time_point start) :
+    _interval(interval), _percentStep(percentStep), _start(start), _lastTime(start)
+{
+}
+
+bool DownloadProgressAggregator::Update(
+    ADUC_DownloadProgressState state,
+    uint64_t bytesTransferred,
+    uint64_t bytesTotal,
+    std::chrono::steady_clock::time_point now)
+{
+    // A retry that starts over restarts the throughput too, and is passed on.
+    const bool restarted = bytesTransferred < _lastBytes;
+    if (restarted)
+    {
+        _start = now;
+        _startBytes = bytesTransferred;
+        _lastTime = now;
+        _lastBytes = bytesTransferred;
+        _bytesPerSecond = 0;
+        _averageBytesPerSecond = 0;
+    }
+
+    const unsigned int percent = bytesTotal == 0
+        ? 0
+        : static_cast<unsigned int>(std::min<uint64_t>(bytesTransferred, bytesTotal) * 100 / bytesTotal);
+
+    const bool passOn = !_passedOn || restarted || state != _state || state != ADUC_DownloadProgressState_InProgress
+        || now - _lastTime >= _interval || (_percentStep != 0 && percent >= _lastPercent + _percentStep);
+    if (!passOn)
+    {
+        return false;
+    }
+
+    const double seconds = std::chrono::duration<double>(now - _lastTime).count();
+    if (seconds > 0)
+    {
+        _bytesPerSecond = static_cast<double>(bytesTransferred - _lastBytes) / seconds;
+    }
+
+    const double totalSeconds = std::chrono::duration<double>(now - _start).count();
+    if (totalSeconds > 0)
+    {
+        _averageBytesPerSecond = static_cast<double>(bytesTransferred - _startBytes) / totalSeconds;
+    }
+
+    _etaSeconds = -1;
+    if (state == ADUC_DownloadProgressState_Completed)
+    {
+        _etaSeconds = 0;
+    }
+    else if (bytesTotal >= bytesTransferred && _averageBytesPerSecond > 0)
+    {
+        _etaSeconds =
+            static_cast<int64_t>(static_cast<double>(bytesTotal - bytesTransferred) / _averageBytesPerSecond);
+    }
+
+    _passedOn = true;
+    _state = state;
+    _lastTime = now;
+    _lastBytes = bytesTransferred;
+    _lastPercent = percent;
+    return true;
+}
+
+/**
+ * @brief The interval of the aggregators, in milliseconds, see SetDownloadProgressInterval.
+ */
+static std::atomic<int64_t> s_intervalMs{ DownloadProgressAggregator::DefaultInterval.count() };
+
+/**
+ * @brief The percent step of the aggregators, see SetDownloadProgressInterval.
+ */
+static std::atomic<unsigned int> s_percentStep{ DownloadProgressAggregator::DefaultPercentStep };
+
+void SetDownloadProgressInterval(std::chrono::milliseconds interval, unsigned int percentStep)
+{
+    s_intervalMs = interval.count() == 0 ? DownloadProgressAggregator::DefaultInterval.count() : interval.count();
+    s_percentStep = percentStep == 0 ? DownloadProgressAggregator::DefaultPercentStep : percentStep;
+}
+
+/**
+ * @brief The aggregator of the downloads of a file, and the callback it passes the progress on to.
+ */
+struct AggregatedDownload
+{
+    AggregatedDownload(ADUC_DownloadProgressCallback callback, std::chrono::steady_clock::time_point start) :
+        Callback(callback),
+        Aggregator(std::chrono::milliseconds{ s_intervalMs.load() }, s_percentStep.load(), start)
+    {
+    }
+
+    ADUC_DownloadProgressCallback Callback;
+    DownloadProgressAggregator Aggregator;
+    unsigned int References = 1; //!< The AggregatedDownloadProgress objects of the file.
+};
+
+/**
+ * @brief The downloads in progress, by workflow id and file id. Guarded by s_downloadsMutex.
+ *
+ * The progress callback is a plain function, so the callback the downloaders get finds its aggregator here.
+ */
+static std::unordered_map<std::string, std::unique_ptr<AggregatedDownload>> s_downloads;
+static std::mutex s_downloadsMutex;
+
+/**
+ * @brief Returns the key of the file @p fileId of the workflow @p workflowId in s_downloads.
+ */
+static std::string GetDownloadKey(const char* workflowId, const char* fileId)
+{
+    std::string key{ workflowId == nullptr ? "" : workflowId };
+    key += '\n';
+    key += fileId == nullptr ? "" : fileId;
+    return key;
+}
+
+/**
+ * @brief The progress callback the downloaders get: passes the callbacks their aggregator lets through on.
+ */
+static void AggregatedDownloadProgressCallback(
+    const char* workflowId,
+    const char* fileId,
+    ADUC_DownloadProgressState state,
+    uint64_t bytesTransferred,
+    uint64_t bytesTotal)
+{
+    ADUC_DownloadProgressCallback callback = nullptr;
+    double bytesPerSecond = 0;
+    double averageBytesPerSecond = 0;
+    int64_t etaSeconds = -1;
+
+    {
+        std::lock_guard<std::mutex> lock(s_downloadsMutex);
+        const auto download = s_downloads.find(GetDownloadKey(workflowId, fileId));
+        if (download == s_downloads.end()
+            || !download->second->Aggregator.Update(
+                state, bytesTransferred, bytesTotal, std::chrono::steady_clock::now()))
+        {
+            return;
+        }
+
+        callback = download->second->Callback;
+        bytesPerSecond = download->second->Aggregator.GetBytesPerSecond();
+        averageBytesPerSecond = download->second->Aggregator.GetAverageBytesPerSecond();
+        etaSeconds = download->second->Aggregator.GetEtaSeconds();
+    }
+
+    if (state == ADUC_DownloadProgressState_InProgress)
+    {
+        Log_Info(
+            "Download of %s: %.1f KiB/s, average %.1f KiB/s, ETA %llds",
+            fileId == nullptr ? "" : fileId,
+            bytesPerSecond / 1024,
+            averageBytesPerSecond / 1024,
+            static_cast<long long>(etaSeconds));
+    }
+
+    ADUC_ProgressTelemetry_RecordFileThroughput(workflowId, fileId, bytesPerSecond, averageBytesPerSecond, etaSeconds);
+
+    callback(workflowId, fileId, state, bytesTransferred, bytesTotal);
+}
+
+AggregatedDownloadProgress::AggregatedDownloadProgress(
+    const char* workflowId, const char* fileId, ADUC_DownloadProgressCallback callback) :
+    _key(GetDownloadKey(workflowId, fileId))
+{
+    if (callback == nullptr)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(s_downloadsMutex);
+    auto& download = s_downloads[_key];
+    if (download == nullptr)
+    {
+        download.reset(new AggregatedDownload{ callback, std::chrono::steady_clock::now() });
+    }
+    else
+    {
+        download->References++;
+    }
+
+    _registered = true;
+}
+
+AggregatedDownloadProgress::~AggregatedDownloadProgress()
+{
+    if (!_registered)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(s_downloadsMutex);
+    const auto download = s_downloads.find(_key);
+    if (download != s_downloads.end() && --download->second->References == 0)
+    {
+        s_downloads.erase(download);
+    }
+}
+
+ADUC_DownloadProgressCallback AggregatedDownloadProgress::GetCallback() const
+{
+    return _registered ? AggregatedDownloadProgressCallback : nullptr;
+}
+
+} // namespace ADUC
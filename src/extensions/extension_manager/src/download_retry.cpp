@@ -0,0 +1,96 @@
+/**
+ * @file download_retry.cpp
+ * @brief Implementation of the download retry policy.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/download_retry.hpp"
+#include "aduc/types/adu_core.h" // for ADUC_Result_Failure_Cancelled
+
+#include <algorithm>
+#include <cmath>
+
+namespace ADUC
+{
+constexpr unsigned int DownloadRetryPolicy::MaxAttempts;
+constexpr std::chrono::milliseconds DownloadRetryPolicy::BaseDelay;
+constexpr std::chrono::milliseconds DownloadRetryPolicy::MaxDelay;
+
+/**
+ * @brief The curl codes of transient failures: the network or the server, rather than the request or the device.
+ */
+static const int TransientCurlCodes[] = {
+    6, // CURLE_COULDNT_RESOLVE_HOST
+    7, // CURLE_COULDNT_CONNECT
+    16, // CURLE_HTTP2
+    18, // CURLE_PARTIAL_FILE
+    28, // CURLE_OPERATION_TIMEDOUT
+    35, // CURLE_SSL_CONNECT_ERROR
+    52, // CURLE_GOT_NOTHING
+    55, // CURLE_SEND_ERROR
+    56, // CURLE_RECV_ERROR
+    92, // CURLE_HTTP2_STREAM
+};
+
+DownloadRetryPolicy::DownloadRetryPolicy(std::chrono::seconds timeout, std::chrono::steady_clock::time_point start) :
+    _timeout(timeout), _deadline(start + timeout)
+{
+}
+
+bool DownloadRetryPolicy::IsTransientFailure(const ADUC_Result& result)
+{
+    if (IsAducResultCodeSuccess(result.ResultCode) || result.ResultCode == ADUC_Result_Failure_Cancelled)
+    {
+        return false;
+    }
+
+    const ADUC_Result_t erc = result.ExtendedResultCode;
+
+    for (const int curlCode : TransientCurlCodes)
+    {
+        if (erc == ADUC_ERROR_CURL_DOWNLOADER_EXTERNAL_FAILURE(curlCode))
+        {
+            return true;
+        }
+    }
+
+    // Request timeout, too many requests, and server errors.
+    return erc == ADUC_ERROR_CURL_DOWNLOADER_HTTP_FAILURE(408) || erc == ADUC_ERROR_CURL_DOWNLOADER_HTTP_FAILURE(429)
+        || (erc >= ADUC_ERROR_CURL_DOWNLOADER_HTTP_FAILURE(500) && erc <= ADUC_ERROR_CURL_DOWNLOADER_HTTP_FAILURE(599));
+}
+
+bool DownloadRetryPolicy::ShouldRetry(
+    const ADUC_Result& result,
+    std::chrono::steady_clock::time_point now,
+    double jitter,
+    std::chrono::milliseconds* delay)
+{
+    ++_attempts;
+
+    if (_attempts >= MaxAttempts || _timeout.count() == 0 || !IsTransientFailure(result))
+    {
+        return false;
+    }
+
+    // BaseDelay, doubled for each retry so far, up to MaxDelay.
+    const std::chrono::milliseconds backoff = std::min<std::chrono::milliseconds>(
+        MaxDelay, std::chrono::milliseconds{ BaseDelay.count() << std::min(_attempts - 1, 20U) });
+
+    *delay = std::chrono::milliseconds{ std::llround(static_cast<double>(backoff.count()) * jitter) };
+
+    return now + *delay < _deadline;
+}
+
+unsigned int DownloadRetryPolicy::GetRemainingSeconds(std::chrono::steady_clock::time_point now) const
+{
+    if (_timeout.count() == 0)
+    {
+        return 0;
+    }
+
+    const auto remaining = std::chrono::duration_cast<std::chrono::seconds>(_deadline - now).count();
+    return static_cast<unsigned int>(std::max<decltype(remaining)>(remaining, 1));
+}
+
+} // namespace ADUC
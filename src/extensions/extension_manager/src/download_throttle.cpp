@@ -0,0 +1,275 @@
+/**
+ * @file download_throttle.cpp
+ * @brief Implementation of the download throttle.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/download_throttle.h"
+#include "aduc/download_throttle.hpp"
+#include "aduc/logging.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <poll.h> // for poll
+#include <string>
+#include <thread>
+
+namespace ADUC
+{
+/**
+ * @brief The minutes of a day.
+ */
+static const unsigned int MinutesPerDay = 24 * 60;
+
+void TokenBucket::SetRate(uint64_t bytesPerSecond, std::chrono::steady_clock::time_point now)
+{
+    _rate = bytesPerSecond;
+    _tokens = static_cast<double>(bytesPerSecond);
+    _lastRefill = now;
+}
+
+std::chrono::microseconds TokenBucket::Consume(uint64_t bytes, std::chrono::steady_clock::time_point now)
+{
+    if (_rate == 0)
+    {
+        return std::chrono::microseconds{ 0 };
+    }
+
+    const double elapsedSeconds = std::chrono::duration<double>(now - _lastRefill).count();
+    _lastRefill = now;
+
+    _tokens = std::min(_tokens + elapsedSeconds * static_cast<double>(_rate), static_cast<double>(_rate));
+    _tokens -= static_cast<double>(bytes);
+
+    if (_tokens >= 0)
+    {
+        return std::chrono::microseconds{ 0 };
+    }
+
+    return std::chrono::microseconds{ std::llround(-_tokens * 1000000 / static_cast<double>(_rate)) };
+}
+
+bool DownloadWindows::Parse(const char* windows)
+{
+    std::vector<std::pair<unsigned int, unsigned int>> parsed;
+
+    if (windows != nullptr)
+    {
+        const std::string spec{ windows };
+        size_t begin = 0;
+
+        while (begin < spec.size())
+        {
+            size_t end = spec.find(',', begin);
+            if (end == std::string::npos)
+            {
+                end = spec.size();
+            }
+
+            const std::string window = spec.substr(begin, end - begin);
+            unsigned int startHour = 0;
+            unsigned int startMinute = 0;
+            unsigned int endHour = 0;
+            unsigned int endMinute = 0;
+            int consumed = 0;
+
+            if (sscanf(window.c_str(), " %u:%u - %u:%u %n", &startHour, &startMinute, &endHour, &endMinute, &consumed)
+                    != 4
+                || static_cast<size_t>(consumed) != window.size() || startHour > 23 || endHour > 23 || startMinute > 59
+                || endMinute > 59)
+            {
+                return false;
+            }
+
+            parsed.emplace_back(startHour * 60 + startMinute, endHour * 60 + endMinute);
+            begin = end + 1;
+        }
+    }
+
+    _windows = std::move(parsed);
+    return true;
+}
+
+unsigned int DownloadWindows::GetMinutesUntilOpen(unsigned int minuteOfDay) const
+{
+    unsigned int minutesUntilOpen = MinutesPerDay;
+
+    for (const auto& window : _windows)
+    {
+        const unsigned int start = window.first;
+        const unsigned int end = window.second;
+
+        const bool open = (start == end) || (start < end && minuteOfDay >= start && minuteOfDay < end)
+            || (start > end && (minuteOfDay >= start || minuteOfDay < end));
+        if (open)
+        {
+            return 0;
+        }
+
+        minutesUntilOpen = std::min(minutesUntilOpen, (start + MinutesPerDay - minuteOfDay) % MinutesPerDay);
+    }
+
+    return _windows.empty() ? 0 : minutesUntilOpen;
+}
+
+} // namespace ADUC
+
+static std::mutex s_throttleMutex;
+static ADUC::TokenBucket s_bucket;
+static ADUC::DownloadWindows s_windows;
+static uint64_t s_perDownloadBytesPerSecond = 0;
+static unsigned int s_foregroundTransfers = 0;
+static std::condition_variable s_foregroundTransfersEnded;
+static thread_local ADUC_TransferPriority s_threadPriority = ADUC_TransferPriority_Foreground;
+
+EXTERN_C_BEGIN
+
+bool ADUC_DownloadThrottle_Configure(uint64_t bytesPerSecond, uint64_t perDownloadBytesPerSecond, const char* windows)
+{
+    std::lock_guard<std::mutex> lock(s_throttleMutex);
+
+    if (s_bucket.GetRate() != bytesPerSecond)
+    {
+        s_bucket.SetRate(bytesPerSecond, std::chrono::steady_clock::now());
+    }
+
+    s_perDownloadBytesPerSecond = perDownloadBytesPerSecond;
+
+    try
+    {
+        if (!s_windows.Parse(windows))
+        {
+            Log_Warn("Invalid download windows '%s', keeping the previous ones.", windows);
+            return false;
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        Log_Warn("Cannot set the download windows: %s", ex.what());
+        return false;
+    }
+
+    return true;
+}
+
+uint64_t ADUC_DownloadThrottle_GetPerDownloadLimit()
+{
+    std::lock_guard<std::mutex> lock(s_throttleMutex);
+    return s_perDownloadBytesPerSecond;
+}
+
+void ADUC_DownloadThrottle_SetThreadPriority(ADUC_TransferPriority priority)
+{
+    s_threadPriority = priority;
+}
+
+ADUC_TransferPriority ADUC_DownloadThrottle_GetThreadPriority()
+{
+    return s_threadPriority;
+}
+
+void ADUC_DownloadThrottle_BeginTransfer()
+{
+    if (s_threadPriority == ADUC_TransferPriority_Foreground)
+    {
+        std::lock_guard<std::mutex> lock(s_throttleMutex);
+        ++s_foregroundTransfers;
+    }
+}
+
+void ADUC_DownloadThrottle_EndTransfer()
+{
+    if (s_threadPriority == ADUC_TransferPriority_Foreground)
+    {
+        std::lock_guard<std::mutex> lock(s_throttleMutex);
+        if (s_foregroundTransfers > 0 && --s_foregroundTransfers == 0)
+        {
+            s_foregroundTransfersEnded.notify_all();
+        }
+    }
+}
+
+void ADUC_DownloadThrottle_Consume(uint64_t bytes)
+{
+    std::chrono::microseconds wait{ 0 };
+
+    {
+        std::unique_lock<std::mutex> lock(s_throttleMutex);
+
+        if (s_threadPriority == ADUC_TransferPriority_Background)
+        {
+            s_foregroundTransfersEnded.wait_for(
+                lock, std::chrono::seconds(ADUC_DOWNLOAD_THROTTLE_BACKGROUND_PAUSE_SECS), [] {
+                    return s_foregroundTransfers == 0;
+                });
+        }
+
+        wait = s_bucket.Consume(bytes, std::chrono::steady_clock::now());
+    }
+
+    // Waiting without the lock lets the other downloads take their share meanwhile.
+    if (wait.count() > 0)
+    {
+        std::this_thread::sleep_for(wait);
+    }
+}
+
+bool ADUC_DownloadThrottle_WaitForWindow(const ADUC_CancellationToken* cancellationToken)
+{
+    bool logged = false;
+
+    for (;;)
+    {
+        if (ADUC_CancellationToken_IsCancelled(cancellationToken))
+        {
+            return false;
+        }
+
+        unsigned int minutesUntilOpen = 0;
+
+        {
+            const time_t now = time(nullptr);
+            struct tm localNow = {};
+
+            std::lock_guard<std::mutex> lock(s_throttleMutex);
+            if (s_windows.IsEmpty() || localtime_r(&now, &localNow) == nullptr)
+            {
+                return true;
+            }
+
+            minutesUntilOpen =
+                s_windows.GetMinutesUntilOpen(static_cast<unsigned int>(localNow.tm_hour * 60 + localNow.tm_min));
+        }
+
+        if (minutesUntilOpen == 0)
+        {
+            return true;
+        }
+
+        if (!logged)
+        {
+            Log_Info("Outside of the download windows, waiting %u minute(s) for the next one.", minutesUntilOpen);
+            logged = true;
+        }
+
+        // Sleeps until the next check, unless the token is cancelled first. Without a token, poll() only sleeps.
+        struct pollfd cancelPollFd = { ADUC_CancellationToken_GetFd(cancellationToken), POLLIN, 0 };
+        if (poll(&cancelPollFd,
+                 1,
+                 static_cast<int>(
+                     std::min<unsigned int>(minutesUntilOpen * 60, ADUC_DOWNLOAD_THROTTLE_WINDOW_POLL_SECS) * 1000))
+            > 0)
+        {
+            Log_Info("Waiting for the download window cancelled.");
+            return false;
+        }
+    }
+}
+
+EXTERN_C_END
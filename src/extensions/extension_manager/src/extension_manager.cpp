@@ -9,33 +9,212 @@
 #include "aduc/content_downloader_extension.hpp"
 #include "aduc/content_handler.hpp"
 
+#include "aduc/builtin_content_handlers.hpp"
 #include "aduc/c_utils.h"
+#include "aduc/component_inventory_cache.h"
+#include "aduc/download_cache_utils.h"
+#include "aduc/download_progress.hpp"
+#include "aduc/download_retry.hpp"
+#include "aduc/download_throttle.h"
 #include "aduc/exceptions.hpp"
 #include "aduc/extension_manager.hpp"
 #include "aduc/extension_utils.h"
 #include "aduc/hash_utils.h" // for SHAversion
 #include "aduc/logging.h"
+#include "aduc/metrics_utils.h"
 #include "aduc/parser_utils.h"
 #include "aduc/result.h"
 #include "aduc/string_utils.hpp"
-
+#include "aduc/system_utils.h"
+#include "aduc/timing_utils.hpp"
+#include "aduc/tracepoints.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits> // for PATH_MAX
+#include <condition_variable>
 #include <cstring>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include <azure_c_shared_utility/azure_base64.h>
 #include <azure_c_shared_utility/buffer_.h>
 #include <azure_c_shared_utility/crt_abstractions.h> // for mallocAndStrcpy_s
+#include <parson.h>
 
 // Note: this requires ${CMAKE_DL_LIBS}
+#include <dirent.h>
 #include <dlfcn.h>
+#include <poll.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+/**
+ * @brief The index of the extension libraries whose hash was verified, so they aren't hashed again on each start.
+ *
+ * Format:
+ * {
+ *     "files":{
+ *         "/var/lib/adu/extensions/sources/libmicrosoft_swupdate_1.so":{
+ *             "hashType":"sha256",
+ *             "hash":"...",
+ *             "fileInfo":"2049:1234:56789:1650000000.0:1650000000.0"
+ *         },
+ *         ...
+ *     }
+ * }
+ */
+#define ADUC_EXTENSION_INDEX_FILE_PATH ADUC_EXTENSIONS_FOLDER "/extension_index.json"
+
+/**
+ * @brief Fieldname for the object holding an entry per verified library, keyed by the library's path.
+ */
+#define ADUC_EXTENSION_INDEX_FILES_FIELDNAME "files"
+
+/**
+ * @brief The name the content downloader library is cached under in the loaded libraries.
+ */
+#define ADUC_CONTENT_DOWNLOADER_EXTENSION_NAME "Content Downloader"
+
 // Static members.
 std::unordered_map<std::string, void*> ExtensionManager::_libs;
 std::unordered_map<std::string, ContentHandler*> ExtensionManager::_contentHandlers;
+std::unordered_map<std::string, std::atomic<int64_t>> ExtensionManager::_contentHandlersLastUse;
 void* ExtensionManager::_contentDownloader;
+int64_t ExtensionManager::_contentDownloaderLastUse;
+bool ExtensionManager::_contentDownloaderUnloaded;
+std::unique_ptr<std::string> ExtensionManager::_contentDownloaderInitializeData;
+std::unique_ptr<std::string> ExtensionManager::_downloadCacheHosts;
+std::atomic<unsigned int> ExtensionManager::_idleUnloadSeconds{ 0 };
 void* ExtensionManager::_componentEnumerator;
+std::vector<std::pair<std::string, void*>> ExtensionManager::_additionalComponentEnumerators;
+bool ExtensionManager::_additionalComponentEnumeratorsLoaded;
+std::mutex ExtensionManager::_componentEnumeratorsMutex;
+std::atomic<unsigned int> ExtensionManager::_componentEnumeratorTimeoutMs{
+    ADUC_DEFAULT_COMPONENT_ENUMERATOR_TIMEOUT_MS
+};
+std::unordered_map<std::string, ADUC_DownloadVerifiedFile> ExtensionManager::_verifiedFiles;
+std::mutex ExtensionManager::_verifiedFilesMutex;
+std::unordered_map<std::string, std::string> ExtensionManager::_payloads;
+std::mutex ExtensionManager::_payloadsMutex;
+std::condition_variable ExtensionManager::_payloadsChanged;
+std::mutex ExtensionManager::_contentDownloaderMutex;
+std::mutex ExtensionManager::_contentHandlersMutex;
+pthread_rwlock_t ExtensionManager::_contentHandlersLock = PTHREAD_RWLOCK_INITIALIZER;
+std::atomic<unsigned int> ExtensionManager::_maxConcurrentDownloads{ ADUC_DEFAULT_MAX_CONCURRENT_DOWNLOADS };
+std::atomic<uint64_t> ExtensionManager::_downloadCacheSizeLimit{ 0 };
+std::mutex ExtensionManager::_libsMutex;
+std::mutex ExtensionManager::_extensionIndexMutex;
+std::thread ExtensionManager::_preloadThread;
+
+/**
+ * @brief The enumerations of the components by one of several component enumerators, each on its own thread, see
+ * ExtensionManager::GetAllComponentsFromEnumerators.
+ */
+struct ComponentEnumeration
+{
+    std::mutex mutex;
+    std::condition_variable completed;
+    bool running = false; /**< True while an enumeration runs; a new one isn't started until it returns. */
+    uint64_t generation = 0; /**< Incremented each time an enumeration returns. */
+    bool succeeded = false; /**< Whether the last enumeration succeeded. */
+    bool hasComponents = false; /**< Whether an enumeration ever succeeded. */
+    std::string components; /**< The components data of the last enumeration that succeeded. */
+};
+
+/**
+ * @brief The enumerations of each component enumerator, by enumerator id, and the number of running enumerations.
+ */
+static std::mutex s_componentEnumerationsMutex;
+static std::condition_variable s_componentEnumerationsIdle;
+static std::unordered_map<std::string, std::shared_ptr<ComponentEnumeration>> s_componentEnumerations;
+static unsigned int s_runningComponentEnumerations = 0;
+
+/**
+ * @brief Enumerates the components of the component enumerator library @p lib into @p enumeration.
+ */
+static void RunComponentEnumeration(std::shared_ptr<ComponentEnumeration> enumeration, void* lib)
+{
+    std::string components;
+    bool succeeded = false;
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto getAllComponents = reinterpret_cast<GetAllComponentsProc>(dlsym(lib, "GetAllComponents"));
+    auto freeComponentsDataString =
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        reinterpret_cast<FreeComponentsDataStringProc>(dlsym(lib, "FreeComponentsDataString"));
+
+    try
+    {
+        char* data = getAllComponents();
+        if (data != nullptr)
+        {
+            components = data;
+            if (freeComponentsDataString != nullptr)
+            {
+                freeComponentsDataString(data);
+            }
+        }
+
+        succeeded = true;
+    }
+    catch (...)
+    {
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(enumeration->mutex);
+        enumeration->running = false;
+        enumeration->generation++;
+        enumeration->succeeded = succeeded;
+        if (succeeded)
+        {
+            enumeration->components.swap(components);
+            enumeration->hasComponents = true;
+        }
+    }
+    enumeration->completed.notify_all();
+
+    {
+        std::lock_guard<std::mutex> lock(s_componentEnumerationsMutex);
+        --s_runningComponentEnumerations;
+    }
+    s_componentEnumerationsIdle.notify_all();
+}
+
+/**
+ * @brief Waits until no enumeration of the components runs, e.g. before the component enumerators are unloaded.
+ */
+static void WaitForComponentEnumerations()
+{
+    std::unique_lock<std::mutex> lock(s_componentEnumerationsMutex);
+    s_componentEnumerationsIdle.wait(lock, []() { return s_runningComponentEnumerations == 0; });
+}
+
+/**
+ * @brief Appends the "components" of @p componentsData, the output of a GetAllComponents, to @p components.
+ */
+static void AppendComponents(JSON_Array* components, const std::string& componentsData)
+{
+    JSON_Value* value = json_parse_string(componentsData.c_str());
+    const JSON_Array* array = json_object_get_array(json_value_get_object(value), "components");
+
+    for (size_t i = 0; i < json_array_get_count(array); ++i)
+    {
+        JSON_Value* component = json_value_deep_copy(json_array_get_value(array, i));
+        if (component != nullptr && json_array_append_value(components, component) != JSONSuccess)
+        {
+            json_value_free(component);
+        }
+    }
+
+    json_value_free(value);
+}
 
 STRING_HANDLE FolderNameFromHandlerId(const char* handlerId)
 {
@@ -45,6 +224,106 @@ STRING_HANDLE FolderNameFromHandlerId(const char* handlerId)
     return name;
 }
 
+/**
+ * @brief Gets the device, inode, size, and modification and change times of @p filePath.
+ * @details An extension library isn't modified by the agent; any change to it updates its change time.
+ * @return std::string The file info, or empty if the file can't be stat'ed.
+ */
+static std::string GetExtensionFileInfo(const char* filePath)
+{
+    struct stat st = {};
+    if (stat(filePath, &st) != 0)
+    {
+        return std::string{};
+    }
+
+    std::stringstream info;
+    info << st.st_dev << ':' << st.st_ino << ':' << st.st_size << ':' << st.st_mtim.tv_sec << '.'
+         << st.st_mtim.tv_nsec << ':' << st.st_ctim.tv_sec << '.' << st.st_ctim.tv_nsec;
+    return info.str();
+}
+
+/**
+ * @brief Checks whether the extension library at @p filePath was verified against @p hashType and @p hashValue,
+ * on this start or a previous one, and hasn't changed since.
+ */
+bool ExtensionManager::IsExtensionFileVerified(const char* filePath, const char* hashType, const char* hashValue)
+{
+    const std::string fileInfo = GetExtensionFileInfo(filePath);
+    if (fileInfo.empty() || hashType == nullptr || hashValue == nullptr)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_extensionIndexMutex);
+
+    JSON_Value* index = json_parse_file(ADUC_EXTENSION_INDEX_FILE_PATH);
+    const JSON_Object* files =
+        json_object_get_object(json_value_get_object(index), ADUC_EXTENSION_INDEX_FILES_FIELDNAME);
+    const JSON_Object* entry = json_object_get_object(files, filePath);
+
+    const char* indexedHashType = json_object_get_string(entry, "hashType");
+    const char* indexedHash = json_object_get_string(entry, "hash");
+    const char* indexedFileInfo = json_object_get_string(entry, "fileInfo");
+
+    const bool verified = indexedHashType != nullptr && indexedHash != nullptr && indexedFileInfo != nullptr
+        && strcmp(indexedHashType, hashType) == 0 && strcmp(indexedHash, hashValue) == 0
+        && fileInfo == indexedFileInfo;
+
+    json_value_free(index);
+
+    return verified;
+}
+
+/**
+ * @brief Records in the extension index that the library at @p filePath matches @p hashType and @p hashValue.
+ */
+void ExtensionManager::AddVerifiedExtensionFile(const char* filePath, const char* hashType, const char* hashValue)
+{
+    const std::string fileInfo = GetExtensionFileInfo(filePath);
+    if (fileInfo.empty() || hashType == nullptr || hashValue == nullptr)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_extensionIndexMutex);
+
+    JSON_Value* index = json_parse_file(ADUC_EXTENSION_INDEX_FILE_PATH);
+    if (json_object_get_object(json_value_get_object(index), ADUC_EXTENSION_INDEX_FILES_FIELDNAME) == nullptr)
+    {
+        json_value_free(index);
+        index = json_value_init_object();
+        json_object_set_value(
+            json_value_get_object(index), ADUC_EXTENSION_INDEX_FILES_FIELDNAME, json_value_init_object());
+    }
+
+    JSON_Object* files = json_object_get_object(json_value_get_object(index), ADUC_EXTENSION_INDEX_FILES_FIELDNAME);
+    JSON_Value* entryValue = json_value_init_object();
+    JSON_Object* entry = json_value_get_object(entryValue);
+
+    if (entry == nullptr || json_object_set_string(entry, "hashType", hashType) != JSONSuccess
+        || json_object_set_string(entry, "hash", hashValue) != JSONSuccess
+        || json_object_set_string(entry, "fileInfo", fileInfo.c_str()) != JSONSuccess
+        || json_object_set_value(files, filePath, entryValue) != JSONSuccess)
+    {
+        json_value_free(entryValue);
+    }
+    else
+    {
+        const std::string tempPath = std::string{ ADUC_EXTENSION_INDEX_FILE_PATH } + ".tmp";
+
+        if (json_serialize_to_file_pretty(index, tempPath.c_str()) != JSONSuccess
+            || rename(tempPath.c_str(), ADUC_EXTENSION_INDEX_FILE_PATH) != 0)
+        {
+            // Not fatal, the library is just hashed again on the next start.
+            Log_Warn("Cannot update extension index %s", ADUC_EXTENSION_INDEX_FILE_PATH);
+            remove(tempPath.c_str());
+        }
+    }
+
+    json_value_free(index);
+}
+
 /**
  * @brief Loads extension shared library file.
  * @param extensionName An extension name.
@@ -70,6 +349,11 @@ ADUC_Result ExtensionManager::LoadExtensionLibrary(
     ADUC_Result result{ ADUC_GeneralResult_Failure };
     ADUC_FileEntity entity = {};
     SHAversion algVersion;
+    const char* hashType = nullptr;
+    const char* hashValue = nullptr;
+
+    // Extensions may be loaded by the preload thread and by workflows at the same time.
+    std::lock_guard<std::mutex> lock(_libsMutex);
 
     std::stringstream path;
     path << extensionPath << "/" << extensionSubfolder << "/" << extensionRegFileName;
@@ -112,24 +396,30 @@ ADUC_Result ExtensionManager::LoadExtensionLibrary(
     }
 
     // Validate file hash.
-    if (!ADUC_HashUtils_GetShaVersionForTypeString(
-            ADUC_HashUtils_GetHashType(entity.Hash, entity.HashCount, 0), &algVersion))
+    hashType = ADUC_HashUtils_GetHashType(entity.Hash, entity.HashCount, 0);
+    hashValue = ADUC_HashUtils_GetHashValue(entity.Hash, entity.HashCount, 0);
+
+    if (!ADUC_HashUtils_GetShaVersionForTypeString(hashType, &algVersion))
     {
-        Log_Error(
-            "FileEntity for %s has unsupported hash type %s",
-            entity.TargetFilename,
-            ADUC_HashUtils_GetHashType(entity.Hash, entity.HashCount, 0));
+        Log_Error("FileEntity for %s has unsupported hash type %s", entity.TargetFilename, hashType);
         result.ExtendedResultCode = ADUC_ERC_EXTENSION_CREATE_FAILURE_VALIDATE(facilityCode, componentCode);
         goto done;
     }
 
-    if (!ADUC_HashUtils_IsValidFileHash(
-            entity.TargetFilename, ADUC_HashUtils_GetHashValue(entity.Hash, entity.HashCount, 0), algVersion))
+    if (IsExtensionFileVerified(entity.TargetFilename, hashType, hashValue))
+    {
+        Log_Debug("%s is unchanged since its hash was verified", entity.TargetFilename);
+    }
+    else if (!ADUC_HashUtils_IsValidFileHash(entity.TargetFilename, hashValue, algVersion))
     {
         Log_Error("Hash for %s is not valid", entity.TargetFilename);
         result.ExtendedResultCode = ADUC_ERC_EXTENSION_CREATE_FAILURE_VALIDATE(facilityCode, componentCode);
         goto done;
     }
+    else
+    {
+        AddVerifiedExtensionFile(entity.TargetFilename, hashType, hashValue);
+    }
 
     *libHandle = dlopen(entity.TargetFilename, RTLD_LAZY);
 
@@ -189,41 +479,46 @@ ExtensionManager::LoadUpdateContentHandlerExtension(const std::string& updateTyp
     ADUC_Result result = { ADUC_Result_Failure };
 
     UPDATE_CONTENT_HANDLER_CREATE_PROC createUpdateContentHandlerExtension = nullptr;
+    ADUC_ContentHandlerFactory builtinContentHandlerFactory = nullptr;
     void* libHandle = nullptr;
     STRING_HANDLE folderName = nullptr;
     STRING_HANDLE path = nullptr;
 
-    Log_Info("Loading Update Content Handler for '%s'.", updateType.c_str());
-
     if (handler == nullptr)
     {
         Log_Error("Invalid argument(s).");
         result.ExtendedResultCode =
             ADUC_ERC_EXTENSION_CREATE_FAILURE_INVALID_ARG(ADUC_FACILITY_EXTENSION_UPDATE_CONTENT_HANDLER, 0);
-        goto done;
+        return result;
     }
 
-    // Try to find cached handler.
-    *handler = nullptr;
-    if (_contentHandlers.count(updateType) > 0)
+    // Steps processed on several threads at once look up their handlers concurrently.
+    *handler = FindUpdateContentHandler(updateType);
+    if (*handler != nullptr)
     {
-        try
-        {
-            *handler = _contentHandlers.at(updateType);
-        }
-        catch (const std::exception& ex)
-        {
-            Log_Debug("An exception occurred: %s", ex.what());
-        }
-        catch (...)
-        {
-            Log_Debug("Unknown exception occurred while try to reuse a handler for '%s'", updateType.c_str());
-        }
+        return { ADUC_GeneralResult_Success };
+    }
+
+    // Make sure a handler is only created once.
+    std::lock_guard<std::mutex> lock(_contentHandlersMutex);
+
+    *handler = FindUpdateContentHandler(updateType);
+    if (*handler != nullptr)
+    {
+        return { ADUC_GeneralResult_Success };
     }
 
-    if (IsAducResultCodeSuccess(result.ResultCode) && *handler != nullptr)
+    Log_Info("Loading Update Content Handler for '%s'.", updateType.c_str());
+
+    // A handler compiled into the agent has no extension library to load.
+    if (ADUC_BuiltinContentHandlers_Find != nullptr)
     {
-        goto done;
+        builtinContentHandlerFactory = ADUC_BuiltinContentHandlers_Find(updateType.c_str());
+        if (builtinContentHandlerFactory != nullptr)
+        {
+            Log_Debug("Using the built-in content handler for '%s'.", updateType.c_str());
+            goto create_handler;
+        }
     }
 
     folderName = FolderNameFromHandlerId(updateType.c_str());
@@ -257,9 +552,17 @@ ExtensionManager::LoadUpdateContentHandlerExtension(const std::string& updateTyp
         goto done;
     }
 
+create_handler:
     try
     {
-        *handler = createUpdateContentHandlerExtension(ADUC_Logging_GetLevel());
+        if (builtinContentHandlerFactory != nullptr)
+        {
+            *handler = builtinContentHandlerFactory();
+        }
+        else
+        {
+            *handler = createUpdateContentHandlerExtension(ADUC_Logging_GetLevel());
+        }
     }
     catch (const std::exception& ex)
     {
@@ -277,7 +580,10 @@ ExtensionManager::LoadUpdateContentHandlerExtension(const std::string& updateTyp
     }
 
     Log_Debug("Caching new content handler for '%s'.", updateType.c_str());
+    pthread_rwlock_wrlock(&_contentHandlersLock);
     _contentHandlers.emplace(updateType, *handler);
+    _contentHandlersLastUse[updateType].store(ADUC_Timing_Now());
+    pthread_rwlock_unlock(&_contentHandlersLock);
 
     result = { ADUC_GeneralResult_Success };
 
@@ -297,14 +603,47 @@ done:
     return result;
 }
 
+/**
+ * @brief Returns the loaded handler for @p updateType, or nullptr, and records its use, see UnloadIdleExtensions.
+ * Lookups run concurrently.
+ */
+ContentHandler* ExtensionManager::FindUpdateContentHandler(const std::string& updateType)
+{
+    ContentHandler* handler = nullptr;
+
+    pthread_rwlock_rdlock(&_contentHandlersLock);
+
+    auto entry = _contentHandlers.find(updateType);
+    if (entry != _contentHandlers.end())
+    {
+        handler = entry->second;
+
+        auto lastUse = _contentHandlersLastUse.find(updateType);
+        if (lastUse != _contentHandlersLastUse.end())
+        {
+            lastUse->second.store(ADUC_Timing_Now(), std::memory_order_relaxed);
+        }
+    }
+
+    pthread_rwlock_unlock(&_contentHandlersLock);
+
+    return handler;
+}
+
 void ExtensionManager::UnloadAllUpdateContentHandlers()
 {
+    std::lock_guard<std::mutex> handlersLock(_contentHandlersMutex);
+    pthread_rwlock_wrlock(&_contentHandlersLock);
+
     for (auto& contentHandler : _contentHandlers)
     {
         delete (contentHandler.second); // NOLINT(cppcoreguidelines-owning-memory)
     }
 
     _contentHandlers.clear();
+    _contentHandlersLastUse.clear();
+
+    pthread_rwlock_unlock(&_contentHandlersLock);
 }
 
 /**
@@ -316,17 +655,184 @@ void ExtensionManager::UnloadAllExtensions()
     // Make sure we unload every handlers first.
     UnloadAllUpdateContentHandlers();
 
+    // Enumerations of the components that timed out may still be running in their libraries.
+    WaitForComponentEnumerations();
+
     for (auto& lib : _libs)
     {
         dlclose(lib.second);
     }
 
     _libs.clear();
+
+    std::lock_guard<std::mutex> lock(_componentEnumeratorsMutex);
+    _componentEnumerator = nullptr;
+    _additionalComponentEnumerators.clear();
+    _additionalComponentEnumeratorsLoaded = false;
+}
+
+/**
+ * @brief Loads the update content handler of each registered update type, on a background thread,
+ * so that the first workflow after startup doesn't wait for them.
+ * @details Handlers that fail to load are loaded again, and their failure reported, when a workflow needs them.
+ */
+void ExtensionManager::PreloadUpdateContentHandlers()
+{
+    if (_preloadThread.joinable())
+    {
+        return;
+    }
+
+    try
+    {
+        _preloadThread = std::thread{ []() {
+            DIR* dir = opendir(ADUC_UPDATE_CONTENT_HANDLER_EXTENSION_DIR);
+            if (dir == nullptr)
+            {
+                return;
+            }
+
+            std::vector<std::string> handlerIds;
+            for (const dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+            {
+                const std::string regFilePath = std::string{ ADUC_UPDATE_CONTENT_HANDLER_EXTENSION_DIR } + "/"
+                    + entry->d_name + "/" + ADUC_UPDATE_CONTENT_HANDLER_REG_FILENAME;
+
+                JSON_Value* regFile = json_parse_file(regFilePath.c_str());
+                const char* handlerId = json_object_get_string(json_value_get_object(regFile), "handlerId");
+                if (handlerId != nullptr)
+                {
+                    handlerIds.emplace_back(handlerId);
+                }
+
+                json_value_free(regFile);
+            }
+
+            closedir(dir);
+
+            for (const std::string& handlerId : handlerIds)
+            {
+                ContentHandler* handler = nullptr;
+                ADUC_Result result = LoadUpdateContentHandlerExtension(handlerId, &handler);
+                Log_Info(
+                    "Preloading content handler for '%s' %s",
+                    handlerId.c_str(),
+                    IsAducResultCodeSuccess(result.ResultCode) ? "succeeded" : "failed");
+            }
+        } };
+    }
+    catch (const std::exception& ex)
+    {
+        Log_Warn("Cannot preload content handlers: %s", ex.what());
+    }
+}
+
+void ExtensionManager::ReloadUpdateContentHandlers()
+{
+    if (_preloadThread.joinable())
+    {
+        _preloadThread.join();
+    }
+
+    std::lock_guard<std::mutex> handlersLock(_contentHandlersMutex);
+    std::lock_guard<std::mutex> libsLock(_libsMutex);
+    pthread_rwlock_wrlock(&_contentHandlersLock);
+
+    // The library of a handler is cached under its update type, like the handler.
+    for (auto& contentHandler : _contentHandlers)
+    {
+        delete (contentHandler.second); // NOLINT(cppcoreguidelines-owning-memory)
+
+        auto lib = _libs.find(contentHandler.first);
+        if (lib != _libs.end())
+        {
+            dlclose(lib->second);
+            _libs.erase(lib);
+        }
+    }
+
+    Log_Info("Unloaded %zu update content handlers.", _contentHandlers.size());
+    _contentHandlers.clear();
+    _contentHandlersLastUse.clear();
+
+    pthread_rwlock_unlock(&_contentHandlersLock);
+}
+
+void ExtensionManager::SetIdleUnloadTimeout(unsigned int idleUnloadSeconds)
+{
+    _idleUnloadSeconds = idleUnloadSeconds;
+}
+
+void ExtensionManager::UnloadIdleExtensions()
+{
+    const unsigned int idleUnloadSeconds = _idleUnloadSeconds;
+    if (idleUnloadSeconds == 0)
+    {
+        return;
+    }
+
+    // Handlers the preload thread is loading meanwhile were just used, so they stay loaded.
+    const int64_t idleSince = ADUC_Timing_Now() - static_cast<int64_t>(idleUnloadSeconds) * 1000000000;
+
+    {
+        std::lock_guard<std::mutex> handlersLock(_contentHandlersMutex);
+        std::lock_guard<std::mutex> libsLock(_libsMutex);
+        pthread_rwlock_wrlock(&_contentHandlersLock);
+
+        for (auto contentHandler = _contentHandlers.begin(); contentHandler != _contentHandlers.end();)
+        {
+            auto lastUse = _contentHandlersLastUse.find(contentHandler->first);
+            if (lastUse != _contentHandlersLastUse.end() && lastUse->second.load() > idleSince)
+            {
+                ++contentHandler;
+                continue;
+            }
+
+            Log_Info("Unloading idle update content handler for '%s'.", contentHandler->first.c_str());
+            delete (contentHandler->second); // NOLINT(cppcoreguidelines-owning-memory)
+
+            // The library of a handler is cached under its update type, like the handler.
+            auto lib = _libs.find(contentHandler->first);
+            if (lib != _libs.end())
+            {
+                dlclose(lib->second);
+                _libs.erase(lib);
+            }
+
+            if (lastUse != _contentHandlersLastUse.end())
+            {
+                _contentHandlersLastUse.erase(lastUse);
+            }
+
+            contentHandler = _contentHandlers.erase(contentHandler);
+        }
+
+        pthread_rwlock_unlock(&_contentHandlersLock);
+    }
+
+    std::lock_guard<std::mutex> downloaderLock(_contentDownloaderMutex);
+    if (_contentDownloader != nullptr && _contentDownloaderLastUse <= idleSince)
+    {
+        Log_Info("Unloading the idle content downloader.");
+
+        std::lock_guard<std::mutex> libsLock(_libsMutex);
+        _libs.erase(ADUC_CONTENT_DOWNLOADER_EXTENSION_NAME);
+        dlclose(_contentDownloader);
+        _contentDownloader = nullptr;
+        _contentDownloaderUnloaded = true;
+    }
 }
 
 void ExtensionManager::Uninit()
 {
+    if (_preloadThread.joinable())
+    {
+        _preloadThread.join();
+    }
+
     ExtensionManager::UnloadAllExtensions();
+    ExtensionManager::ClearVerifiedFileCache();
+    ADUC_ComponentInventory_Invalidate();
 }
 
 ADUC_Result ExtensionManager::LoadContentDownloaderLibrary(void** contentDownloaderLibrary)
@@ -335,6 +841,11 @@ ADUC_Result ExtensionManager::LoadContentDownloaderLibrary(void** contentDownloa
     static const char* functionNames[] = { "Download", "Initialize" };
     void* extensionLib = nullptr;
 
+    // Downloads may run on several threads at once, make sure the library is only loaded once.
+    std::lock_guard<std::mutex> lock(_contentDownloaderMutex);
+
+    _contentDownloaderLastUse = ADUC_Timing_Now();
+
     if (_contentDownloader != nullptr)
     {
         *contentDownloaderLibrary = _contentDownloader;
@@ -343,7 +854,7 @@ ADUC_Result ExtensionManager::LoadContentDownloaderLibrary(void** contentDownloa
     }
 
     result = LoadExtensionLibrary(
-        "Content Downloader",
+        ADUC_CONTENT_DOWNLOADER_EXTENSION_NAME,
         ADUC_EXTENSIONS_FOLDER,
         ADUC_EXTENSIONS_SUBDIR_CONTENT_DOWNLOADER,
         ADUC_EXTENSION_REG_FILENAME,
@@ -371,6 +882,12 @@ ADUC_Result ExtensionManager::LoadContentDownloaderLibrary(void** contentDownloa
         }
     }
 
+    if (_contentDownloaderUnloaded)
+    {
+        RestoreContentDownloaderSettings(extensionLib);
+        _contentDownloaderUnloaded = false;
+    }
+
     *contentDownloaderLibrary = _contentDownloader = extensionLib;
 
     result = { ADUC_Result_Success };
@@ -379,23 +896,62 @@ done:
     return result;
 }
 
-ADUC_Result ExtensionManager::LoadComponentEnumeratorLibrary(void** componentEnumerator)
+/**
+ * @brief Initializes the content downloader @p contentDownloaderLibrary, loaded again after UnloadIdleExtensions, the
+ * way it was initialized before, and sets its download cache hosts again.
+ */
+void ExtensionManager::RestoreContentDownloaderSettings(void* contentDownloaderLibrary)
 {
-    ADUC_Result result = { ADUC_Result_Failure };
-    void* mainFunc = nullptr;
-    void* extensionLib = nullptr;
-    const char* requiredFunction = "GetAllComponents";
-
-    if (_componentEnumerator != nullptr)
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto initializeProc = reinterpret_cast<InitializeProc>(dlsym(contentDownloaderLibrary, "Initialize"));
+    if (initializeProc != nullptr && _contentDownloaderInitializeData != nullptr)
     {
-        *componentEnumerator = _componentEnumerator;
-        result = { ADUC_GeneralResult_Success };
-        goto done;
-    }
-
-    result = LoadExtensionLibrary(
-        "Component Enumerator",
-        ADUC_EXTENSIONS_FOLDER,
+        try
+        {
+            const ADUC_Result result = initializeProc(_contentDownloaderInitializeData->c_str());
+            if (IsAducResultCodeFailure(result.ResultCode))
+            {
+                Log_Warn("Cannot initialize the content downloader again, erc: 0x%08x", result.ExtendedResultCode);
+            }
+        }
+        catch (...)
+        {
+            Log_Warn("Cannot initialize the content downloader again.");
+        }
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto setCacheHostsProc = reinterpret_cast<SetCacheHostsProc>(dlsym(contentDownloaderLibrary, "SetCacheHosts"));
+    if (setCacheHostsProc != nullptr && _downloadCacheHosts != nullptr)
+    {
+        try
+        {
+            setCacheHostsProc(_downloadCacheHosts->c_str());
+        }
+        catch (...)
+        {
+            Log_Warn("Cannot set the download cache hosts.");
+        }
+    }
+}
+
+ADUC_Result ExtensionManager::LoadComponentEnumeratorLibrary(void** componentEnumerator)
+{
+    ADUC_Result result = { ADUC_Result_Failure };
+    void* mainFunc = nullptr;
+    void* extensionLib = nullptr;
+    const char* requiredFunction = "GetAllComponents";
+
+    if (_componentEnumerator != nullptr)
+    {
+        *componentEnumerator = _componentEnumerator;
+        result = { ADUC_GeneralResult_Success };
+        goto done;
+    }
+
+    result = LoadExtensionLibrary(
+        "Component Enumerator",
+        ADUC_EXTENSIONS_FOLDER,
         ADUC_EXTENSIONS_SUBDIR_COMPONENT_ENUMERATOR,
         ADUC_EXTENSION_REG_FILENAME,
         requiredFunction,
@@ -433,6 +989,206 @@ done:
     return result;
 }
 
+/**
+ * @brief Loads the additional component enumerators, registered each in a subfolder of the component enumerator
+ * extension folder named after its id, in the order of their ids. They are loaded once, until the extensions are
+ * unloaded.
+ * @param[out] enumerators The id and library of each additional component enumerator that loaded.
+ */
+void ExtensionManager::LoadAdditionalComponentEnumeratorLibraries(
+    std::vector<std::pair<std::string, void*>>& enumerators)
+{
+    std::lock_guard<std::mutex> lock(_componentEnumeratorsMutex);
+
+    if (!_additionalComponentEnumeratorsLoaded)
+    {
+        std::vector<std::string> ids;
+        DIR* dir = opendir(ADUC_COMPONENT_ENUMERATOR_EXTENSION_DIR);
+        struct dirent* entry = nullptr;
+
+        while (dir != nullptr && (entry = readdir(dir)) != nullptr)
+        {
+            const std::string regFilePath = std::string{ ADUC_COMPONENT_ENUMERATOR_EXTENSION_DIR } + "/"
+                + entry->d_name + "/" + ADUC_EXTENSION_REG_FILENAME;
+
+            if (entry->d_name[0] != '.' && access(regFilePath.c_str(), F_OK) == 0)
+            {
+                ids.emplace_back(entry->d_name);
+            }
+        }
+
+        if (dir != nullptr)
+        {
+            closedir(dir);
+        }
+
+        // The same order on each enumeration keeps the digest of the merged components stable.
+        std::sort(ids.begin(), ids.end());
+
+        for (const std::string& id : ids)
+        {
+            void* lib = nullptr;
+            const std::string name = "Component Enumerator '" + id + "'";
+            const std::string subfolder = std::string{ ADUC_EXTENSIONS_SUBDIR_COMPONENT_ENUMERATOR } + "/" + id;
+
+            ADUC_Result result = LoadExtensionLibrary(
+                name.c_str(),
+                ADUC_EXTENSIONS_FOLDER,
+                subfolder.c_str(),
+                ADUC_EXTENSION_REG_FILENAME,
+                "GetAllComponents",
+                ADUC_FACILITY_EXTENSION_COMPONENT_ENUMERATOR,
+                0,
+                &lib);
+
+            if (IsAducResultCodeFailure(result.ResultCode) || lib == nullptr
+                || dlsym(lib, "GetAllComponents") == nullptr)
+            {
+                Log_Warn("Cannot load the component enumerator '%s', its components aren't enumerated.", id.c_str());
+                continue;
+            }
+
+            _additionalComponentEnumerators.emplace_back(id, lib);
+        }
+
+        _additionalComponentEnumeratorsLoaded = true;
+    }
+
+    enumerators = _additionalComponentEnumerators;
+}
+
+/**
+ * @brief Enumerates the components of several component enumerators, each on its own thread, so that a slow
+ * enumerator, e.g. one probing a slow bus, delays none of the others, and merges their components.
+ * @details An enumerator that doesn't answer within the component enumerator timeout, or fails, contributes the
+ * components of its last enumeration that succeeded, if any. Its enumeration keeps running, and isn't started again
+ * until it returns.
+ * @param enumerators The id and library of each component enumerator.
+ * @param[out] outputComponentsData The merged components data.
+ */
+ADUC_Result ExtensionManager::GetAllComponentsFromEnumerators(
+    const std::vector<std::pair<std::string, void*>>& enumerators, std::string& outputComponentsData)
+{
+    const unsigned int timeoutMs = _componentEnumeratorTimeoutMs;
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{ timeoutMs };
+    std::vector<std::pair<std::shared_ptr<ComponentEnumeration>, uint64_t>> enumerations;
+    JSON_Value* mergedValue = json_value_init_object();
+    JSON_Value* componentsValue = json_value_init_array();
+    char* merged = nullptr;
+    ADUC_Result result = { .ResultCode = ADUC_Result_Failure,
+                           .ExtendedResultCode = ADUC_ERC_COMPONENT_ENUMERATOR_EXCEPTION_GETALLCOMPONENTS };
+
+    outputComponentsData = "";
+
+    // Start all the enumerations first, then wait for each.
+    for (const auto& enumerator : enumerators)
+    {
+        std::shared_ptr<ComponentEnumeration> enumeration;
+        {
+            std::lock_guard<std::mutex> lock(s_componentEnumerationsMutex);
+            std::shared_ptr<ComponentEnumeration>& entry = s_componentEnumerations[enumerator.first];
+            if (entry == nullptr)
+            {
+                entry = std::make_shared<ComponentEnumeration>();
+            }
+            enumeration = entry;
+        }
+
+        std::lock_guard<std::mutex> lock(enumeration->mutex);
+        if (!enumeration->running)
+        {
+            {
+                std::lock_guard<std::mutex> runningLock(s_componentEnumerationsMutex);
+                ++s_runningComponentEnumerations;
+            }
+
+            try
+            {
+                std::thread{ RunComponentEnumeration, enumeration, enumerator.second }.detach();
+                enumeration->running = true;
+            }
+            catch (const std::system_error& e)
+            {
+                Log_Error(
+                    "Cannot start the enumeration of the component enumerator '%s': %s",
+                    enumerator.first.c_str(),
+                    e.what());
+
+                std::lock_guard<std::mutex> runningLock(s_componentEnumerationsMutex);
+                --s_runningComponentEnumerations;
+            }
+        }
+
+        enumerations.emplace_back(enumeration, enumeration->running ? enumeration->generation : UINT64_MAX);
+    }
+
+    for (size_t i = 0; i < enumerations.size(); ++i)
+    {
+        const std::string name = enumerators[i].first.empty() ? std::string{ "The component enumerator" }
+                                                              : "Component enumerator '" + enumerators[i].first + "'";
+        ComponentEnumeration& enumeration = *enumerations[i].first;
+        const uint64_t startGeneration = enumerations[i].second;
+        const auto isCompleted = [&]() { return enumeration.generation != startGeneration; };
+
+        std::unique_lock<std::mutex> lock(enumeration.mutex);
+        if (startGeneration == UINT64_MAX)
+        {
+            Log_Warn("%s didn't enumerate its components.", name.c_str());
+        }
+        else if (timeoutMs == 0)
+        {
+            enumeration.completed.wait(lock, isCompleted);
+        }
+        else if (!enumeration.completed.wait_until(lock, deadline, isCompleted))
+        {
+            Log_Warn(
+                "%s didn't answer within %u ms%s.",
+                name.c_str(),
+                timeoutMs,
+                enumeration.hasComponents ? ", using its previous components" : "");
+        }
+
+        if (startGeneration != UINT64_MAX && isCompleted() && !enumeration.succeeded)
+        {
+            Log_Warn(
+                "%s failed%s.",
+                name.c_str(),
+                enumeration.hasComponents ? ", using its previous components" : "");
+        }
+
+        if (enumeration.hasComponents)
+        {
+            AppendComponents(json_value_get_array(componentsValue), enumeration.components);
+        }
+    }
+
+    if (json_object_set_value(json_value_get_object(mergedValue), "components", componentsValue) != JSONSuccess)
+    {
+        goto done;
+    }
+    componentsValue = nullptr;
+
+    merged = json_serialize_to_string(mergedValue);
+    if (merged == nullptr)
+    {
+        goto done;
+    }
+
+    outputComponentsData = merged;
+    result = { ADUC_GeneralResult_Success };
+
+done:
+    json_free_serialized_string(merged);
+    json_value_free(componentsValue);
+    json_value_free(mergedValue);
+    return result;
+}
+
+void ExtensionManager::SetComponentEnumeratorTimeout(unsigned int timeoutMs)
+{
+    _componentEnumeratorTimeoutMs = timeoutMs;
+}
+
 void ExtensionManager::_FreeComponentsDataString(char* componentsJson)
 {
     void* lib = nullptr;
@@ -488,6 +1244,20 @@ ADUC_Result ExtensionManager::GetAllComponents(std::string& outputComponentsData
 
     outputComponentsData = "";
 
+    {
+        std::vector<std::pair<std::string, void*>> enumerators;
+        LoadAdditionalComponentEnumeratorLibraries(enumerators);
+        if (!enumerators.empty())
+        {
+            if (IsAducResultCodeSuccess(ExtensionManager::LoadComponentEnumeratorLibrary(&lib).ResultCode))
+            {
+                enumerators.emplace(enumerators.begin(), "", lib);
+            }
+
+            return GetAllComponentsFromEnumerators(enumerators, outputComponentsData);
+        }
+    }
+
     ADUC_Result result = ExtensionManager::LoadComponentEnumeratorLibrary(&lib);
     if (IsAducResultCodeFailure(result.ResultCode))
     {
@@ -526,18 +1296,43 @@ done:
     return result;
 }
 
+// 64-bit FNV-1a, as used for the digest of reported properties.
+#define COMPONENTS_DIGEST_OFFSET_BASIS 14695981039346656037ULL
+#define COMPONENTS_DIGEST_PRIME 1099511628211ULL
+
 /**
- * @brief Returns all components information in JSON format.
- * @param selector A JSON string contains name-value pairs used for selecting components.
- * @param[out] outputComponentsData An output string containing components data.
+ * @brief Returns a 64-bit digest of all components information, without copying it.
+ * @param[out] outputDigest The digest of the components data, 0 if the component enumerator returned none.
  */
-ADUC_Result ExtensionManager::SelectComponents(const std::string& selector, std::string& outputComponentsData)
+ADUC_Result ExtensionManager::GetAllComponentsDigest(uint64_t* outputDigest)
 {
     void* lib = nullptr;
-    SelectComponentsProc _selectComponents = nullptr;
+    GetAllComponentsProc _getAllComponents = nullptr;
     char* components = nullptr;
 
-    outputComponentsData = "";
+    *outputDigest = 0;
+
+    {
+        std::vector<std::pair<std::string, void*>> enumerators;
+        LoadAdditionalComponentEnumeratorLibraries(enumerators);
+        if (!enumerators.empty())
+        {
+            std::string merged;
+            ADUC_Result mergedResult = GetAllComponents(merged);
+            if (IsAducResultCodeSuccess(mergedResult.ResultCode))
+            {
+                uint64_t digest = COMPONENTS_DIGEST_OFFSET_BASIS;
+                for (const char c : merged)
+                {
+                    digest = (digest ^ static_cast<unsigned char>(c)) * COMPONENTS_DIGEST_PRIME;
+                }
+
+                *outputDigest = digest;
+            }
+
+            return mergedResult;
+        }
+    }
 
     ADUC_Result result = ExtensionManager::LoadComponentEnumeratorLibrary(&lib);
     if (IsAducResultCodeFailure(result.ResultCode))
@@ -546,17 +1341,17 @@ ADUC_Result ExtensionManager::SelectComponents(const std::string& selector, std:
     }
 
     // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-    _selectComponents = reinterpret_cast<SelectComponentsProc>(dlsym(lib, "SelectComponents"));
-    if (_selectComponents == nullptr)
+    _getAllComponents = reinterpret_cast<GetAllComponentsProc>(dlsym(lib, "GetAllComponents"));
+    if (_getAllComponents == nullptr)
     {
         result = { .ResultCode = ADUC_Result_Failure,
-                   .ExtendedResultCode = ADUC_ERC_COMPONENT_ENUMERATOR_SELECTCOMPONENTS_NOTIMP };
+                   .ExtendedResultCode = ADUC_ERC_COMPONENT_ENUMERATOR_GETALLCOMPONENTS_NOTIMP };
         goto done;
     }
 
     try
     {
-        components = _selectComponents(selector.c_str());
+        components = _getAllComponents();
     }
     catch (...)
     {
@@ -567,163 +1362,1321 @@ ADUC_Result ExtensionManager::SelectComponents(const std::string& selector, std:
 
     if (components != nullptr)
     {
-        outputComponentsData = components;
+        uint64_t digest = COMPONENTS_DIGEST_OFFSET_BASIS;
+        for (const char* c = components; *c != '\0'; ++c)
+        {
+            digest = (digest ^ static_cast<unsigned char>(*c)) * COMPONENTS_DIGEST_PRIME;
+        }
+
+        *outputDigest = digest;
         _FreeComponentsDataString(components);
     }
 
+    result = { ADUC_GeneralResult_Success };
+
 done:
     return result;
 }
 
-ADUC_Result ExtensionManager::InitializeContentDownloader(const char* initializeData)
+/**
+ * @brief Returns the generation of the components collection, if the component enumerator exports
+ * GetComponentsGeneration.
+ * @param[out] outputGeneration The generation of the components collection.
+ * @return ADUC_ERC_COMPONENT_ENUMERATOR_GETCOMPONENTSGENERATION_NOTIMP if the enumerator doesn't export it.
+ */
+ADUC_Result ExtensionManager::GetComponentsGeneration(uint64_t* outputGeneration)
 {
     void* lib = nullptr;
-    InitializeProc _initialize = nullptr;
-    char* components = nullptr;
+    GetComponentsGenerationProc _getComponentsGeneration = nullptr;
 
-    ADUC_Result result = ExtensionManager::LoadContentDownloaderLibrary(&lib);
+    *outputGeneration = 0;
+
+    {
+        std::vector<std::pair<std::string, void*>> enumerators;
+        LoadAdditionalComponentEnumeratorLibraries(enumerators);
+        if (!enumerators.empty())
+        {
+            if (IsAducResultCodeSuccess(ExtensionManager::LoadComponentEnumeratorLibrary(&lib).ResultCode))
+            {
+                enumerators.emplace(enumerators.begin(), "", lib);
+            }
+
+            // The generations of all the enumerators are combined; without one of them, the components are
+            // enumerated periodically.
+            uint64_t generation = COMPONENTS_DIGEST_OFFSET_BASIS;
+            for (const auto& enumerator : enumerators)
+            {
+                // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+                _getComponentsGeneration =
+                    reinterpret_cast<GetComponentsGenerationProc>(dlsym(enumerator.second, "GetComponentsGeneration"));
+                if (_getComponentsGeneration == nullptr)
+                {
+                    return { .ResultCode = ADUC_Result_Failure,
+                             .ExtendedResultCode = ADUC_ERC_COMPONENT_ENUMERATOR_GETCOMPONENTSGENERATION_NOTIMP };
+                }
+
+                try
+                {
+                    generation = (generation ^ _getComponentsGeneration()) * COMPONENTS_DIGEST_PRIME;
+                }
+                catch (...)
+                {
+                    return { .ResultCode = ADUC_Result_Failure,
+                             .ExtendedResultCode = ADUC_ERC_COMPONENT_ENUMERATOR_EXCEPTION_GETCOMPONENTSGENERATION };
+                }
+            }
+
+            *outputGeneration = generation;
+            return { ADUC_GeneralResult_Success };
+        }
+    }
+
+    ADUC_Result result = ExtensionManager::LoadComponentEnumeratorLibrary(&lib);
     if (IsAducResultCodeFailure(result.ResultCode))
     {
         goto done;
     }
 
+    // Optional, the components are enumerated periodically without it.
     // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-    _initialize = reinterpret_cast<InitializeProc>(dlsym(lib, "Initialize"));
-    if (_initialize == nullptr)
+    _getComponentsGeneration = reinterpret_cast<GetComponentsGenerationProc>(dlsym(lib, "GetComponentsGeneration"));
+    if (_getComponentsGeneration == nullptr)
     {
         result = { .ResultCode = ADUC_Result_Failure,
-                   .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_INITIALIZEPROC_NOTIMP };
+                   .ExtendedResultCode = ADUC_ERC_COMPONENT_ENUMERATOR_GETCOMPONENTSGENERATION_NOTIMP };
         goto done;
     }
 
     try
     {
-        result = _initialize(initializeData);
+        *outputGeneration = _getComponentsGeneration();
     }
     catch (...)
     {
         result = { .ResultCode = ADUC_Result_Failure,
-                   .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_INITIALIZE_EXCEPTION };
+                   .ExtendedResultCode = ADUC_ERC_COMPONENT_ENUMERATOR_EXCEPTION_GETCOMPONENTSGENERATION };
         goto done;
     }
 
+    result = { ADUC_GeneralResult_Success };
+
 done:
     return result;
 }
 
-ADUC_Result ExtensionManager::Download(
-    const ADUC_FileEntity* entity,
-    const char* workflowId,
-    const char* workFolder,
-    unsigned int retryTimeout,
-    ADUC_DownloadProgressCallback downloadProgressCallback)
+/**
+ * @brief Checks whether the component enumerator @p lib opts in to the component inventory cache, see
+ * SelectsByStringFieldsProc.
+ */
+static bool SelectsByStringFields(void* lib)
 {
-    void* lib = nullptr;
-    DownloadProc downloadProc = nullptr;
-    char* components = nullptr;
-    SHAversion algVersion;
-    bool isFileExistsAndValidHash = false;
-
-    std::stringstream childManifestFile;
-    ADUC_Result result;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto _selectsByStringFields = reinterpret_cast<SelectsByStringFieldsProc>(dlsym(lib, "SelectsByStringFields"));
 
     try
     {
-        childManifestFile << workFolder << "/" << entity->TargetFilename;
+        return _selectsByStringFields != nullptr && _selectsByStringFields();
     }
     catch (...)
     {
-        Log_Error("Cannot construct child manifest file path.");
-        result = { .ResultCode = ADUC_Result_Failure,
-                   .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_BAD_CHILD_MANIFEST_FILE_PATH };
-        goto done;
+        return false;
     }
+}
 
-    result = ExtensionManager::LoadContentDownloaderLibrary(&lib);
-    if (IsAducResultCodeFailure(result.ResultCode))
-    {
-        goto done;
-    }
+/**
+ * @brief Selects the components matching @p selector from the component inventory cache, loading it first if needed.
+ * Most selections can be answered from the cache, without asking the component enumerator. The cache is only used if
+ * all component enumerators opt in, see SelectsByStringFieldsProc; otherwise the enumerator answers every selection.
+ * @param selector A JSON string contains name-value pairs used for selecting components.
+ * @param[out] outputComponentsData An output string containing components data.
+ * @return true if the cache answered.
+ */
+bool ExtensionManager::SelectCachedComponents(const std::string& selector, std::string& outputComponentsData)
+{
+    void* lib = nullptr;
+    std::vector<std::pair<std::string, void*>> enumerators;
 
-    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-    downloadProc = reinterpret_cast<DownloadProc>(dlsym(lib, "Download"));
-    if (downloadProc == nullptr)
+    if (IsAducResultCodeFailure(ExtensionManager::LoadComponentEnumeratorLibrary(&lib).ResultCode)
+        || !SelectsByStringFields(lib))
     {
-        result = { .ResultCode = ADUC_Result_Failure,
-                   .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_INITIALIZEPROC_NOTIMP };
-        goto done;
+        return false;
     }
 
-    if (!ADUC_HashUtils_GetShaVersionForTypeString(
-            ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0), &algVersion))
+    // The cache holds the components of the additional enumerators too, see GetAllComponents.
+    LoadAdditionalComponentEnumeratorLibraries(enumerators);
+    for (const auto& enumerator : enumerators)
     {
-        Log_Error(
-            "FileEntity for %s has unsupported hash type %s",
-            childManifestFile.str().c_str(),
-            ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0));
-        result.ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_FILE_HASH_TYPE_NOT_SUPPORTED;
-        goto done;
+        if (!SelectsByStringFields(enumerator.second))
+        {
+            return false;
+        }
     }
 
-    // If file exists and has a valid hash, then skip download.
-    // Otherwise, delete an existing file, then download.
-    if (access(childManifestFile.str().c_str(), F_OK) == 0)
+    char* components = ADUC_ComponentInventory_Select(selector.c_str());
+    if (components == nullptr && !ADUC_ComponentInventory_IsLoaded())
     {
-        // If target file exists, validate file hash.
-        // If file is valid, then skip the download.
-        isFileExistsAndValidHash = ADUC_HashUtils_IsValidFileHash(
-            childManifestFile.str().c_str(),
-            ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0),
-            algVersion);
-
-        if (!isFileExistsAndValidHash)
+        std::string allComponents;
+        ADUC_Result result = ExtensionManager::GetAllComponents(allComponents);
+        if (IsAducResultCodeSuccess(result.ResultCode) && ADUC_ComponentInventory_Load(allComponents.c_str()))
         {
-            // Delete existing file.
-            if (remove(childManifestFile.str().c_str()) != 0)
-            {
-                Log_Error("Cannot delete existing file that has invalid hash.");
-                result.ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_CANNOT_DELETE_EXISTING_FILE;
-                goto done;
-            }
+            components = ADUC_ComponentInventory_Select(selector.c_str());
         }
-
-        result = { .ResultCode = ADUC_Result_Success, .ExtendedResultCode = 0 };
-        goto done;
     }
 
-    if (!isFileExistsAndValidHash)
+    if (components == nullptr)
     {
-        try
-        {
-            result = downloadProc(entity, workflowId, workFolder, retryTimeout, downloadProgressCallback);
-        }
-        catch (...)
-        {
-            result = { .ResultCode = ADUC_Result_Failure,
-                       .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_DOWNLOAD_EXCEPTION };
-            goto done;
-        }
+        return false;
+    }
 
-        if (IsAducResultCodeSuccess(result.ResultCode))
+    outputComponentsData = components;
+    free(components);
+    return true;
+}
+
+/**
+ * @brief Returns all components information in JSON format.
+ * @param selector A JSON string contains name-value pairs used for selecting components.
+ * @param[out] outputComponentsData An output string containing components data.
+ */
+ADUC_Result ExtensionManager::SelectComponents(const std::string& selector, std::string& outputComponentsData)
+{
+    void* lib = nullptr;
+    SelectComponentsProc _selectComponents = nullptr;
+    char* components = nullptr;
+    ADUC_Result result = { ADUC_Result_Failure };
+
+    outputComponentsData = "";
+
+    if (ExtensionManager::SelectCachedComponents(selector, outputComponentsData))
+    {
+        return { ADUC_GeneralResult_Success };
+    }
+
+    result = ExtensionManager::LoadComponentEnumeratorLibrary(&lib);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        goto done;
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    _selectComponents = reinterpret_cast<SelectComponentsProc>(dlsym(lib, "SelectComponents"));
+    if (_selectComponents == nullptr)
+    {
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_COMPONENT_ENUMERATOR_SELECTCOMPONENTS_NOTIMP };
+        goto done;
+    }
+
+    try
+    {
+        components = _selectComponents(selector.c_str());
+    }
+    catch (...)
+    {
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_COMPONENT_ENUMERATOR_EXCEPTION_GETALLCOMPONENTS };
+        goto done;
+    }
+
+    if (components != nullptr)
+    {
+        outputComponentsData = components;
+        _FreeComponentsDataString(components);
+    }
+
+done:
+    return result;
+}
+
+/**
+ * @brief Selects the components matching each of @p selectors, asking the component enumerator once for all selectors
+ * the component inventory cache can't answer.
+ * @param selectors JSON strings containing name-value pairs used for selecting components.
+ * @param[out] outputComponentsData The components data of each selector, in @p selectors order.
+ */
+ADUC_Result ExtensionManager::SelectComponents(
+    const std::vector<std::string>& selectors, std::vector<std::string>& outputComponentsData)
+{
+    ADUC_Result result = { ADUC_GeneralResult_Success };
+    void* lib = nullptr;
+    SelectComponentsBatchProc _selectComponentsBatch = nullptr;
+    std::vector<size_t> uncached;
+    std::vector<const char*> uncachedSelectors;
+    std::vector<size_t> offsets;
+    char* components = nullptr;
+
+    outputComponentsData.assign(selectors.size(), "");
+
+    for (size_t i = 0; i < selectors.size(); i++)
+    {
+        if (!ExtensionManager::SelectCachedComponents(selectors[i], outputComponentsData[i]))
+        {
+            uncached.push_back(i);
+            uncachedSelectors.push_back(selectors[i].c_str());
+        }
+    }
+
+    if (uncached.empty())
+    {
+        goto done;
+    }
+
+    result = ExtensionManager::LoadComponentEnumeratorLibrary(&lib);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        goto done;
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    _selectComponentsBatch = reinterpret_cast<SelectComponentsBatchProc>(dlsym(lib, "SelectComponentsBatch"));
+    if (_selectComponentsBatch == nullptr)
+    {
+        // The enumerator doesn't support batches, select the components of each selector.
+        for (size_t i : uncached)
+        {
+            result = ExtensionManager::SelectComponents(selectors[i], outputComponentsData[i]);
+            if (IsAducResultCodeFailure(result.ResultCode))
+            {
+                goto done;
+            }
+        }
+
+        goto done;
+    }
+
+    offsets.resize(uncached.size());
+
+    try
+    {
+        components = _selectComponentsBatch(uncachedSelectors.data(), uncachedSelectors.size(), offsets.data());
+    }
+    catch (...)
+    {
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_COMPONENT_ENUMERATOR_EXCEPTION_GETALLCOMPONENTS };
+        goto done;
+    }
+
+    if (components != nullptr)
+    {
+        for (size_t u = 0; u < uncached.size(); u++)
+        {
+            outputComponentsData[uncached[u]] = components + offsets[u];
+        }
+
+        _FreeComponentsDataString(components);
+    }
+
+done:
+    return result;
+}
+
+ADUC_Result ExtensionManager::InitializeContentDownloader(const char* initializeData)
+{
+    void* lib = nullptr;
+    InitializeProc _initialize = nullptr;
+    char* components = nullptr;
+
+    ADUC_Result result = ExtensionManager::LoadContentDownloaderLibrary(&lib);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        goto done;
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    _initialize = reinterpret_cast<InitializeProc>(dlsym(lib, "Initialize"));
+    if (_initialize == nullptr)
+    {
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_INITIALIZEPROC_NOTIMP };
+        goto done;
+    }
+
+    try
+    {
+        result = _initialize(initializeData);
+    }
+    catch (...)
+    {
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_INITIALIZE_EXCEPTION };
+        goto done;
+    }
+
+    // The same initialization is repeated if the downloader is unloaded while idle, and loaded again.
+    {
+        std::lock_guard<std::mutex> lock(_contentDownloaderMutex);
+        _contentDownloaderInitializeData.reset(initializeData == nullptr ? nullptr : new std::string{ initializeData });
+    }
+
+done:
+    return result;
+}
+
+/**
+ * @brief Checks whether the file at @p filePath was already verified against the first hash of @p entity,
+ * and hasn't changed since.
+ *
+ * @param filePath The full path to the file.
+ * @param entity The file entity.
+ * @return true if the file doesn't need to be hashed again.
+ */
+bool ExtensionManager::IsVerifiedFileCached(const std::string& filePath, const ADUC_FileEntity* entity)
+{
+    std::lock_guard<std::mutex> lock(_verifiedFilesMutex);
+
+    auto it = _verifiedFiles.find(filePath);
+    if (it == _verifiedFiles.end())
+    {
+        return false;
+    }
+
+    if (ADUC_DownloadVerifiedFile_IsCurrent(
+            &it->second,
+            filePath.c_str(),
+            ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0),
+            ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0)))
+    {
+        return true;
+    }
+
+    // The file has changed (or is expected to have a different hash), forget about it.
+    ADUC_DownloadVerifiedFile_UnInit(&it->second);
+    _verifiedFiles.erase(it);
+    return false;
+}
+
+/**
+ * @brief Remembers a verified file, so that subsequent download requests for the same file can skip hashing.
+ *
+ * @param verifiedFile The verified file. This function takes ownership of its members.
+ */
+void ExtensionManager::CacheVerifiedFile(ADUC_DownloadVerifiedFile* verifiedFile)
+{
+    if (verifiedFile->FilePath == nullptr)
+    {
+        return;
+    }
+
+    // So that the file needn't be hashed again after the agent restarts either.
+    ADUC_DownloadVerifiedFile_Persist(verifiedFile);
+
+    std::lock_guard<std::mutex> lock(_verifiedFilesMutex);
+
+    try
+    {
+        auto it = _verifiedFiles.find(verifiedFile->FilePath);
+        if (it != _verifiedFiles.end())
+        {
+            ADUC_DownloadVerifiedFile_UnInit(&it->second);
+            it->second = *verifiedFile;
+        }
+        else
+        {
+            _verifiedFiles.emplace(verifiedFile->FilePath, *verifiedFile);
+        }
+
+        memset(verifiedFile, 0, sizeof(*verifiedFile));
+    }
+    catch (...)
+    {
+        Log_Warn("Cannot cache verified file info for %s", verifiedFile->FilePath);
+        ADUC_DownloadVerifiedFile_UnInit(verifiedFile);
+    }
+}
+
+/**
+ * @brief Forgets all verified files.
+ */
+void ExtensionManager::ClearVerifiedFileCache()
+{
+    std::lock_guard<std::mutex> lock(_verifiedFilesMutex);
+
+    for (auto& verifiedFile : _verifiedFiles)
+    {
+        ADUC_DownloadVerifiedFile_UnInit(&verifiedFile.second);
+    }
+
+    _verifiedFiles.clear();
+}
+
+/**
+ * @brief Checks whether the file at @p filePath has the size of @p entity, if it has one.
+ *
+ * @param filePath The full path to the file.
+ * @param entity The file entity.
+ * @return true if the size matches, or @p entity has no size.
+ */
+static bool HasEntitySize(const std::string& filePath, const ADUC_FileEntity* entity)
+{
+    struct stat st
+    {
+    };
+
+    if (entity->SizeInBytes == 0)
+    {
+        return true;
+    }
+
+    return stat(filePath.c_str(), &st) == 0 && static_cast<uint64_t>(st.st_size) == entity->SizeInBytes;
+}
+
+/**
+ * @brief Hashes the file at @p filePath once, for all the hashes of @p entity, and, if valid, remembers the result.
+ *
+ * @param filePath The full path to the file.
+ * @param entity The file entity.
+ * @return true if the file hashes are valid.
+ */
+static bool VerifyAndCacheFile(const std::string& filePath, const ADUC_FileEntity* entity)
+{
+    const char* hashType = ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0);
+    const char* hashValue = ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0);
+    ADUC_DownloadVerifiedFile verifiedFile = {};
+
+    // A file of another size, e.g. left over from an interrupted download, can't have the hash; don't read it.
+    if (!HasEntitySize(filePath, entity))
+    {
+        Log_Debug("File %s doesn't have the expected size, not hashing it.", filePath.c_str());
+        return false;
+    }
+
+    // Verified before the agent restarted, and unchanged since.
+    if (ADUC_DownloadVerifiedFile_InitFromPersisted(&verifiedFile, filePath.c_str(), hashType, hashValue))
+    {
+        ExtensionManager::CacheVerifiedFile(&verifiedFile);
+        return true;
+    }
+
+    // The chunk hashes of the manifest vouch for the whole file as well, and their chunks are hashed in parallel.
+    const bool valid = entity->ChunkHashCount > 0
+        ? ADUC_HashUtils_VerifyFileChunks(
+              filePath.c_str(),
+              entity->ChunkSizeInBytes,
+              entity->ChunkHashes,
+              entity->ChunkHashCount,
+              0 /* threadCount */,
+              nullptr /* chunkValid */)
+        : ADUC_HashUtils_IsValidFileHashes(filePath.c_str(), entity->Hash, entity->HashCount);
+
+    if (!valid)
+    {
+        return false;
+    }
+
+    if (ADUC_DownloadVerifiedFile_Init(&verifiedFile, filePath.c_str(), hashType, hashValue))
+    {
+        ExtensionManager::CacheVerifiedFile(&verifiedFile);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Gets the content of @p entity from the file another download of the same hash verified, or waits for that
+ * download if it is in progress. Otherwise, registers the caller as the one downloading it, so that concurrent
+ * downloads of the same content, e.g. a payload shared by several steps, wait for it rather than download it again.
+ *
+ * @param entity The file entity.
+ * @param filePath The full path to place the file at. Must not exist.
+ * @param payloadKey Receives the key of the content, for ReleasePayload.
+ * @param owner Set to true if the caller must download the file, then call ReleasePayload.
+ * @return true if the verified content is now at @p filePath.
+ */
+bool ExtensionManager::AcquirePayload(
+    const ADUC_FileEntity* entity, const std::string& filePath, std::string* payloadKey, bool* owner)
+{
+    const char* hashType = ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0);
+    const char* hashValue = ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0);
+    ADUC_DownloadVerifiedFile verifiedFile = {};
+    std::string sourcePath;
+
+    *owner = false;
+
+    try
+    {
+        *payloadKey = std::string{ hashType } + ":" + hashValue;
+
+        std::unique_lock<std::mutex> lock(_payloadsMutex);
+
+        // An empty path means the content is being downloaded.
+        _payloadsChanged.wait(lock, [&] {
+            auto it = _payloads.find(*payloadKey);
+            return it == _payloads.end() || !it->second.empty();
+        });
+
+        std::string& payloadPath = _payloads[*payloadKey];
+        if (payloadPath.empty() || !IsVerifiedFileCached(payloadPath, entity))
+        {
+            // None yet, or it has changed or been removed since, e.g. with its work folder.
+            payloadPath.clear();
+            *owner = true;
+            return false;
+        }
+
+        sourcePath = payloadPath;
+    }
+    catch (...)
+    {
+        return false;
+    }
+
+    if (!ADUC_DownloadCache_LinkOrCopyFile(sourcePath.c_str(), filePath.c_str()))
+    {
+        Log_Warn("Cannot link %s to %s, downloading it.", sourcePath.c_str(), filePath.c_str());
+        return false;
+    }
+
+    Log_Info("File %s has the same content as %s. Skipping download.", filePath.c_str(), sourcePath.c_str());
+
+    if (ADUC_DownloadVerifiedFile_Init(&verifiedFile, filePath.c_str(), hashType, hashValue))
+    {
+        CacheVerifiedFile(&verifiedFile);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Records the outcome of the download registered by AcquirePayload, and wakes up the downloads waiting for it.
+ *
+ * @param payloadKey The key of the content, from AcquirePayload.
+ * @param filePath The full path to the file.
+ * @param downloaded Whether the file was downloaded and verified.
+ */
+void ExtensionManager::ReleasePayload(const std::string& payloadKey, const std::string& filePath, bool downloaded)
+{
+    {
+        std::lock_guard<std::mutex> lock(_payloadsMutex);
+
+        auto it = _payloads.find(payloadKey);
+        if (it != _payloads.end())
+        {
+            try
+            {
+                if (downloaded)
+                {
+                    it->second = filePath;
+                }
+            }
+            catch (...)
+            {
+                downloaded = false;
+            }
+
+            if (!downloaded)
+            {
+                // The next waiting download takes over.
+                _payloads.erase(it);
+            }
+        }
+    }
+
+    _payloadsChanged.notify_all();
+}
+
+/**
+ * @brief Records the size and throughput of the download of @p entity, in the metrics.
+ *
+ * @param entity The downloaded file.
+ * @param startTime The start of the download, from ADUC_Timing_Now.
+ */
+static void RecordDownloadMetrics(const ADUC_FileEntity* entity, int64_t startTime)
+{
+    ADUC_Metrics_AddCounter(ADUC_MetricsCounter_Downloads, 1);
+    ADUC_Metrics_AddCounter(ADUC_MetricsCounter_DownloadedBytes, entity->SizeInBytes);
+    ADUC_Metrics_ObserveThroughput(ADUC_MetricsHistogram_DownloadThroughput, entity->SizeInBytes, startTime);
+}
+
+/**
+ * @brief Calls @p downloadAttempt until it succeeds, fails for good, or runs out of time, see DownloadRetryPolicy.
+ *
+ * @param entity The file entity, for logging.
+ * @param retryTimeout How long the download may take, retries included, in seconds.
+ * @param downloadAttempt Downloads the file, given the seconds left of @p retryTimeout.
+ * @param cancellationToken Stops the retries, including the wait before the next one, once cancelled.
+ * @return ADUC_Result The result of the last attempt, or ADUC_Result_Failure_Cancelled.
+ */
+static ADUC_Result DownloadWithRetries(
+    const ADUC_FileEntity* entity,
+    unsigned int retryTimeout,
+    const std::function<ADUC_Result(unsigned int)>& downloadAttempt,
+    const ADUC_CancellationToken* cancellationToken)
+{
+    thread_local std::mt19937 generator{ std::random_device{}() };
+    std::uniform_real_distribution<double> jitter{ 0.0, 1.0 };
+
+    ADUC::DownloadRetryPolicy retryPolicy{ std::chrono::seconds{ retryTimeout }, std::chrono::steady_clock::now() };
+
+    for (;;)
+    {
+        const ADUC_Result result = downloadAttempt(retryPolicy.GetRemainingSeconds(std::chrono::steady_clock::now()));
+
+        std::chrono::milliseconds delay{ 0 };
+        if (!retryPolicy.ShouldRetry(result, std::chrono::steady_clock::now(), jitter(generator), &delay))
+        {
+            return result;
+        }
+
+        Log_Warn(
+            "Download of %s failed, ERC %#08x. Retrying in %lld ms.",
+            entity->TargetFilename,
+            result.ExtendedResultCode,
+            static_cast<long long>(delay.count()));
+
+        // Sleeps for the delay, unless the token is cancelled first. Without a token, poll() only sleeps.
+        struct pollfd cancelPollFd = { ADUC_CancellationToken_GetFd(cancellationToken), POLLIN, 0 };
+        if (poll(&cancelPollFd, 1, static_cast<int>(delay.count())) > 0
+            || ADUC_CancellationToken_IsCancelled(cancellationToken))
+        {
+            return { .ResultCode = ADUC_Result_Failure_Cancelled, .ExtendedResultCode = 0 };
+        }
+
+        if (!ADUC_DownloadThrottle_WaitForWindow(cancellationToken))
+        {
+            return { .ResultCode = ADUC_Result_Failure_Cancelled, .ExtendedResultCode = 0 };
+        }
+    }
+}
+
+ADUC_Result ExtensionManager::Download(
+    const ADUC_FileEntity* entity,
+    const char* workflowId,
+    const char* workFolder,
+    unsigned int retryTimeout,
+    ADUC_DownloadProgressCallback downloadProgressCallback,
+    const ADUC_CancellationToken* cancellationToken)
+{
+    const ADUC::TimingSpan span{ "extension_download",
+                                 entity->TargetFilename != nullptr ? entity->TargetFilename : "" };
+    void* lib = nullptr;
+    DownloadProc downloadProc = nullptr;
+    DownloadAndVerifyProc downloadAndVerifyProc = nullptr;
+    DownloadWithCancellationProc downloadWithCancellationProc = nullptr;
+    SHAversion algVersion;
+    ADUC_DownloadVerifiedFile verifiedFile = {};
+    int64_t downloadStartTime = 0;
+    std::string payloadKey;
+    bool ownsPayload = false;
+    char stagingFolder[PATH_MAX];
+    bool ramStaged = false;
+    const char* downloadFolder = workFolder;
+    std::string stagedFile;
+    // Downloaders may report progress per received chunk; pass it on at the configured rate.
+    const ADUC::AggregatedDownloadProgress aggregatedProgress{ workflowId, entity->FileId, downloadProgressCallback };
+    const ADUC_DownloadProgressCallback progressCallback = aggregatedProgress.GetCallback();
+
+    std::stringstream childManifestFile;
+    ADUC_Result result = { ADUC_Result_Failure };
+
+    try
+    {
+        childManifestFile << workFolder << "/" << entity->TargetFilename;
+    }
+    catch (...)
+    {
+        Log_Error("Cannot construct child manifest file path.");
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_BAD_CHILD_MANIFEST_FILE_PATH };
+        goto done;
+    }
+
+    result = ExtensionManager::LoadContentDownloaderLibrary(&lib);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        goto done;
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    downloadProc = reinterpret_cast<DownloadProc>(dlsym(lib, "Download"));
+    if (downloadProc == nullptr)
+    {
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_INITIALIZEPROC_NOTIMP };
+        goto done;
+    }
+
+    // Optional. Downloaders that implement it report which files they already hash-validated.
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    downloadAndVerifyProc = reinterpret_cast<DownloadAndVerifyProc>(dlsym(lib, "DownloadAndVerify"));
+
+    // Optional. Downloaders that implement it abort the download as soon as it's cancelled; with the others,
+    // a cancellation only stops the retries.
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    downloadWithCancellationProc =
+        reinterpret_cast<DownloadWithCancellationProc>(dlsym(lib, "DownloadWithCancellation"));
+
+    if (!ADUC_HashUtils_GetShaVersionForTypeString(
+            ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0), &algVersion))
+    {
+        Log_Error(
+            "FileEntity for %s has unsupported hash type %s",
+            childManifestFile.str().c_str(),
+            ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0));
+        result.ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_FILE_HASH_TYPE_NOT_SUPPORTED;
+        goto done;
+    }
+
+    // The file was already verified earlier in this workflow and hasn't changed since.
+    if (IsVerifiedFileCached(childManifestFile.str(), entity))
+    {
+        Log_Debug("File %s was already verified. Skipping download.", childManifestFile.str().c_str());
+        result = { .ResultCode = ADUC_Result_Success, .ExtendedResultCode = 0 };
+        goto done;
+    }
+
+    // If file exists and has a valid hash, then skip download.
+    // Otherwise, delete an existing file, then download.
+    if (access(childManifestFile.str().c_str(), F_OK) == 0)
+    {
+        if (VerifyAndCacheFile(childManifestFile.str(), entity))
+        {
+            result = { .ResultCode = ADUC_Result_Success, .ExtendedResultCode = 0 };
+            goto done;
+        }
+
+        // Delete existing file.
+        if (remove(childManifestFile.str().c_str()) != 0)
+        {
+            Log_Error("Cannot delete existing file that has invalid hash.");
+            result.ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_CANNOT_DELETE_EXISTING_FILE;
+            goto done;
+        }
+    }
+
+    // Another step of this workflow may be downloading, or have downloaded, the same content.
+    if (AcquirePayload(entity, childManifestFile.str(), &payloadKey, &ownsPayload))
+    {
+        result = { .ResultCode = ADUC_Result_Success, .ExtendedResultCode = 0 };
+        goto done;
+    }
+
+    // A previous workflow may have downloaded the same content.
+    if (_downloadCacheSizeLimit != 0
+        && ADUC_DownloadCache_GetFile(
+            ADUC_DOWNLOAD_CACHE_FOLDER,
+            ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0),
+            ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0),
+            childManifestFile.str().c_str()))
+    {
+        if (VerifyAndCacheFile(childManifestFile.str(), entity))
+        {
+            result = { .ResultCode = ADUC_Result_Success, .ExtendedResultCode = 0 };
+            goto done;
+        }
+
+        Log_Warn("Cached file for %s has an invalid hash, downloading it.", childManifestFile.str().c_str());
+        ADUC_DownloadCache_RemoveFile(
+            ADUC_DOWNLOAD_CACHE_FOLDER,
+            ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0),
+            ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0));
+
+        if (remove(childManifestFile.str().c_str()) != 0)
+        {
+            Log_Error("Cannot delete file that has invalid hash.");
+            result.ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_CANNOT_DELETE_EXISTING_FILE;
+            goto done;
+        }
+    }
+
+    // Files already present, verified or cached above don't use the network, so only actual downloads wait.
+    if (!ADUC_DownloadThrottle_WaitForWindow(cancellationToken))
+    {
+        result = { .ResultCode = ADUC_Result_Failure_Cancelled, .ExtendedResultCode = 0 };
+        goto done;
+    }
+
+    // Small files, e.g. detached manifests and scripts, are downloaded to RAM and linked into the work folder, so
+    // that they aren't written to the storage.
+    ramStaged = ADUC_SystemUtils_BeginRamStaging(workFolder, entity->SizeInBytes, stagingFolder, sizeof(stagingFolder));
+    if (ramStaged)
+    {
+        downloadFolder = stagingFolder;
+    }
+
+    downloadStartTime = ADUC_Timing_Now();
+
+    // Background transfers pause until a foreground download is done, retries included.
+    ADUC_DownloadThrottle_BeginTransfer();
+    ADUC_TRACEPOINT2(download_start, entity->TargetFilename, static_cast<long long>(entity->SizeInBytes));
+
+    result = DownloadWithRetries(
+        entity,
+        retryTimeout,
+        [&](unsigned int remainingTimeout) -> ADUC_Result {
+            try
+            {
+                if (ADUC_CancellationToken_IsCancelled(cancellationToken))
+                {
+                    return { .ResultCode = ADUC_Result_Failure_Cancelled, .ExtendedResultCode = 0 };
+                }
+
+                if (downloadWithCancellationProc != nullptr)
+                {
+                    return downloadWithCancellationProc(
+                        entity,
+                        workflowId,
+                        downloadFolder,
+                        remainingTimeout,
+                        progressCallback,
+                        &verifiedFile,
+                        cancellationToken);
+                }
+
+                if (downloadAndVerifyProc != nullptr)
+                {
+                    return downloadAndVerifyProc(
+                        entity, workflowId, downloadFolder, remainingTimeout, progressCallback, &verifiedFile);
+                }
+
+                return downloadProc(entity, workflowId, downloadFolder, remainingTimeout, progressCallback);
+            }
+            catch (...)
+            {
+                return { .ResultCode = ADUC_Result_Failure,
+                         .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_DOWNLOAD_EXCEPTION };
+            }
+        },
+        cancellationToken);
+
+    ADUC_DownloadThrottle_EndTransfer();
+    ADUC_TRACEPOINT3(
+        download_end,
+        entity->TargetFilename,
+        static_cast<long long>(entity->SizeInBytes),
+        static_cast<int>(result.ResultCode));
+
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        goto done;
+    }
+
+    RecordDownloadMetrics(entity, downloadStartTime);
+
+    if (ramStaged)
+    {
+        try
+        {
+            stagedFile = std::string{ stagingFolder } + "/" + entity->TargetFilename;
+        }
+        catch (...)
+        {
+            result = { .ResultCode = ADUC_Result_Failure,
+                       .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_BAD_CHILD_MANIFEST_FILE_PATH };
+            goto done;
+        }
+
+        // A dangling link left by an earlier staging isn't seen by access() above.
+        (void)unlink(childManifestFile.str().c_str());
+        if (symlink(stagedFile.c_str(), childManifestFile.str().c_str()) != 0)
+        {
+            Log_Error("Cannot link staged file %s, errno %d", stagedFile.c_str(), errno);
+            result = { .ResultCode = ADUC_Result_Failure,
+                       .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_DOWNLOAD_EXCEPTION };
+            goto done;
+        }
+    }
+
+    // Only hash the file here if the downloader didn't already do so. The downloader checks the first hash only; the
+    // others must match too before the file is remembered, and persisted, as verified.
+    if (ADUC_DownloadVerifiedFile_IsCurrent(
+            &verifiedFile,
+            ramStaged ? stagedFile.c_str() : childManifestFile.str().c_str(),
+            ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0),
+            ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0)))
+    {
+        if (entity->HashCount > 1
+            && !ADUC_HashUtils_IsValidFileHashes(childManifestFile.str().c_str(), entity->Hash, entity->HashCount))
+        {
+            Log_Error("File %s doesn't match all of its hashes.", childManifestFile.str().c_str());
+            result = { .ResultCode = ADUC_Result_Failure,
+                       .ExtendedResultCode = ADUC_ERC_VALIDATION_FILE_HASH_INVALID_HASH };
+            goto done;
+        }
+
+        // Looked up by the path in the work folder, which links to the staged file, e.g. by the pre-install pass.
+        if (ramStaged)
         {
-            if (!ADUC_HashUtils_IsValidFileHash(
-                    childManifestFile.str().c_str(),
-                    ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0),
-                    algVersion))
+            free(verifiedFile.FilePath);
+            verifiedFile.FilePath = nullptr;
+            if (mallocAndStrcpy_s(&verifiedFile.FilePath, childManifestFile.str().c_str()) != 0)
             {
-                result = { .ResultCode = ADUC_Result_Failure,
-                           .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_DOWNLOAD_EXCEPTION };
-                goto done;
+                ADUC_DownloadVerifiedFile_UnInit(&verifiedFile);
             }
         }
+
+        CacheVerifiedFile(&verifiedFile);
+    }
+    else if (!VerifyAndCacheFile(childManifestFile.str(), entity))
+    {
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_DOWNLOAD_EXCEPTION };
+        goto done;
+    }
+
+    // Staged files aren't cached, as that would write them to the storage after all.
+    if (_downloadCacheSizeLimit != 0 && !ramStaged)
+    {
+        // Not fatal; the file is still in the work folder.
+        ADUC_DownloadCache_AddFile(
+            ADUC_DOWNLOAD_CACHE_FOLDER,
+            ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0),
+            ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0),
+            childManifestFile.str().c_str(),
+            _downloadCacheSizeLimit);
     }
 
     result = { .ResultCode = ADUC_Result_Success, .ExtendedResultCode = 0 };
 
 done:
+    if (ramStaged)
+    {
+        ADUC_SystemUtils_EndRamStaging(entity->SizeInBytes);
+    }
+
+    if (ownsPayload)
+    {
+        ReleasePayload(payloadKey, childManifestFile.str(), IsAducResultCodeSuccess(result.ResultCode));
+    }
+
+    ADUC_DownloadVerifiedFile_UnInit(&verifiedFile);
+    return result;
+}
+
+/**
+ * @brief Gets the optional DownloadToStream export of the content downloader.
+ *
+ * @param downloadToStreamProc Receives the export, or nullptr if the downloader doesn't implement it.
+ * @return ADUC_Result
+ */
+static ADUC_Result GetDownloadToStreamProc(DownloadToStreamProc* downloadToStreamProc)
+{
+    void* lib = nullptr;
+
+    *downloadToStreamProc = nullptr;
+
+    ADUC_Result result = ExtensionManager::LoadContentDownloaderLibrary(&lib);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        return result;
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    *downloadToStreamProc = reinterpret_cast<DownloadToStreamProc>(dlsym(lib, "DownloadToStream"));
+    if (*downloadToStreamProc == nullptr)
+    {
+        return { .ResultCode = ADUC_Result_Failure,
+                 .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_DOWNLOADTOSTREAMPROC_NOTIMP };
+    }
+
+    return { .ResultCode = ADUC_Result_Success, .ExtendedResultCode = 0 };
+}
+
+bool ExtensionManager::IsDownloadToStreamSupported()
+{
+    DownloadToStreamProc downloadToStreamProc = nullptr;
+    return IsAducResultCodeSuccess(GetDownloadToStreamProc(&downloadToStreamProc).ResultCode);
+}
+
+ADUC_Result ExtensionManager::DownloadToStream(
+    const ADUC_FileEntity* entity,
+    const char* workflowId,
+    unsigned int retryTimeout,
+    ADUC_DownloadProgressCallback downloadProgressCallback,
+    int outputFd,
+    const ADUC_CancellationToken* cancellationToken)
+{
+    DownloadToStreamProc downloadToStreamProc = nullptr;
+
+    if (ADUC_CancellationToken_IsCancelled(cancellationToken))
+    {
+        return { .ResultCode = ADUC_Result_Failure_Cancelled, .ExtendedResultCode = 0 };
+    }
+
+    ADUC_Result result = GetDownloadToStreamProc(&downloadToStreamProc);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        return result;
+    }
+
+    if (!ADUC_DownloadThrottle_WaitForWindow(cancellationToken))
+    {
+        return { .ResultCode = ADUC_Result_Failure_Cancelled, .ExtendedResultCode = 0 };
+    }
+
+    const int64_t startTime = ADUC_Timing_Now();
+    const ADUC::AggregatedDownloadProgress aggregatedProgress{ workflowId, entity->FileId, downloadProgressCallback };
+
+    ADUC_DownloadThrottle_BeginTransfer();
+    ADUC_TRACEPOINT2(download_start, entity->TargetFilename, static_cast<long long>(entity->SizeInBytes));
+
+    try
+    {
+        result = downloadToStreamProc(entity, workflowId, retryTimeout, aggregatedProgress.GetCallback(), outputFd);
+    }
+    catch (...)
+    {
+        result = { .ResultCode = ADUC_Result_Failure,
+                   .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_DOWNLOAD_EXCEPTION };
+    }
+
+    ADUC_DownloadThrottle_EndTransfer();
+    ADUC_TRACEPOINT3(
+        download_end,
+        entity->TargetFilename,
+        static_cast<long long>(entity->SizeInBytes),
+        static_cast<int>(result.ResultCode));
+
+    if (IsAducResultCodeSuccess(result.ResultCode))
+    {
+        RecordDownloadMetrics(entity, startTime);
+    }
+
     return result;
 }
 
+ADUC_Result ExtensionManager::DownloadFiles(
+    const std::vector<const ADUC_FileEntity*>& entities,
+    const char* workflowId,
+    const char* workFolder,
+    unsigned int retryTimeout,
+    ADUC_DownloadProgressCallback downloadProgressCallback,
+    const ADUC_CancellationToken* cancellationToken)
+{
+    const size_t fileCount = entities.size();
+    std::vector<ADUC_Result> results(fileCount, ADUC_Result{ ADUC_Result_Failure });
+    // Not std::vector<bool>, since its elements share bytes and can't be written from different threads.
+    std::vector<char> started(fileCount, 0);
+    std::atomic<size_t> nextFile{ 0 };
+    std::atomic<bool> failed{ false };
+    std::mutex progressMutex;
+    size_t filesDone = 0;
+    uint64_t bytesDone = 0;
+    uint64_t bytesTotal = 0;
+
+    for (const ADUC_FileEntity* entity : entities)
+    {
+        bytesTotal += entity->SizeInBytes;
+    }
+
+    auto worker = [&]() {
+        for (size_t i = nextFile++; i < fileCount && !failed; i = nextFile++)
+        {
+            started[i] = 1;
+            results[i] = ExtensionManager::Download(
+                entities[i], workflowId, workFolder, retryTimeout, downloadProgressCallback, cancellationToken);
+
+            if (IsAducResultCodeFailure(results[i].ResultCode))
+            {
+                failed = true;
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(progressMutex);
+            filesDone++;
+            bytesDone += entities[i]->SizeInBytes;
+            Log_Info(
+                "Downloaded %zu of %zu file(s), %llu of %llu bytes.",
+                filesDone,
+                fileCount,
+                static_cast<unsigned long long>(bytesDone),
+                static_cast<unsigned long long>(bytesTotal));
+        }
+    };
+
+    const size_t workerCount = std::min<size_t>(std::max(_maxConcurrentDownloads.load(), 1u), fileCount);
+    std::vector<std::thread> workers;
+
+    // The calling thread is a worker too, so a single download doesn't need a thread.
+    // If a thread can't be created, the remaining workers pick up its share.
+    for (size_t i = 1; i < workerCount; i++)
+    {
+        try
+        {
+            workers.emplace_back(worker);
+        }
+        catch (...)
+        {
+            Log_Warn("Cannot start download thread #%zu, continuing with %zu.", i, i);
+            break;
+        }
+    }
+
+    worker();
+
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+
+    // Files that were never started because another one failed are skipped, so the download
+    // that actually failed is reported.
+    for (size_t i = 0; i < fileCount; i++)
+    {
+        if (started[i] && IsAducResultCodeFailure(results[i].ResultCode))
+        {
+            Log_Error("Cannot download file #%zu. (0x%X)", i, results[i].ExtendedResultCode);
+            return results[i];
+        }
+    }
+
+    return { .ResultCode = ADUC_Result_Success, .ExtendedResultCode = 0 };
+}
+
+ADUC_Result
+ExtensionManager::VerifyFiles(const std::vector<std::pair<std::string, const ADUC_FileEntity*>>& files)
+{
+    const size_t fileCount = files.size();
+    std::vector<ADUC_Result> results(fileCount, ADUC_Result{ ADUC_Result_Success });
+    std::atomic<size_t> nextFile{ 0 };
+    std::atomic<bool> failed{ false };
+
+    auto worker = [&]() {
+        for (size_t i = nextFile++; i < fileCount && !failed; i = nextFile++)
+        {
+            const std::string& filePath = files[i].first;
+            const ADUC_FileEntity* entity = files[i].second;
+            SHAversion algVersion;
+
+            if (access(filePath.c_str(), F_OK) != 0 || IsVerifiedFileCached(filePath, entity))
+            {
+                continue;
+            }
+
+            if (!ADUC_HashUtils_GetShaVersionForTypeString(
+                    ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0), &algVersion))
+            {
+                Log_Error("FileEntity for %s has unsupported hash type", filePath.c_str());
+                results[i] = { .ResultCode = ADUC_Result_Failure,
+                               .ExtendedResultCode = ADUC_ERC_CONTENT_DOWNLOADER_FILE_HASH_TYPE_NOT_SUPPORTED };
+                failed = true;
+            }
+            else if (!VerifyAndCacheFile(filePath, entity))
+            {
+                Log_Error("Hash for %s is not valid", filePath.c_str());
+                results[i] = { .ResultCode = ADUC_Result_Failure,
+                               .ExtendedResultCode = ADUC_ERC_VALIDATION_FILE_HASH_INVALID_HASH };
+                failed = true;
+            }
+        }
+    };
+
+    // Hashing is bound by the processor (and storage), not by the network.
+    const size_t workerCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), fileCount);
+    std::vector<std::thread> workers;
+
+    for (size_t i = 1; i < workerCount; i++)
+    {
+        try
+        {
+            workers.emplace_back(worker);
+        }
+        catch (...)
+        {
+            Log_Warn("Cannot start verification thread #%zu, continuing with %zu.", i, i);
+            break;
+        }
+    }
+
+    worker();
+
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+
+    for (const ADUC_Result& result : results)
+    {
+        if (IsAducResultCodeFailure(result.ResultCode))
+        {
+            return result;
+        }
+    }
+
+    return { .ResultCode = ADUC_Result_Success, .ExtendedResultCode = 0 };
+}
+
+void ExtensionManager::SetMaxConcurrentDownloads(unsigned int maxConcurrentDownloads)
+{
+    _maxConcurrentDownloads =
+        (maxConcurrentDownloads == 0) ? ADUC_DEFAULT_MAX_CONCURRENT_DOWNLOADS : maxConcurrentDownloads;
+    Log_Info("Max concurrent downloads: %u", _maxConcurrentDownloads.load());
+}
+
+void ExtensionManager::SetDownloadCacheSizeLimit(uint64_t sizeLimitInBytes)
+{
+    _downloadCacheSizeLimit = sizeLimitInBytes;
+    Log_Info(
+        "Download cache size limit: %llu bytes", static_cast<unsigned long long>(_downloadCacheSizeLimit.load()));
+
+    // Apply a lowered limit right away.
+    ADUC_DownloadCache_Evict(ADUC_DOWNLOAD_CACHE_FOLDER, sizeLimitInBytes);
+}
+
+bool ExtensionManager::IsDownloadCacheLinkable(const ADUC_FileEntity* entity, const char* workFolder)
+{
+    return _downloadCacheSizeLimit != 0 && entity != nullptr && entity->HashCount != 0
+        && ADUC_DownloadCache_CanLinkFile(
+               ADUC_DOWNLOAD_CACHE_FOLDER,
+               ADUC_HashUtils_GetHashType(entity->Hash, entity->HashCount, 0),
+               ADUC_HashUtils_GetHashValue(entity->Hash, entity->HashCount, 0),
+               workFolder);
+}
+
+void ExtensionManager::SetDownloadThrottle(
+    uint64_t bytesPerSecond, uint64_t perDownloadBytesPerSecond, const char* windows)
+{
+    ADUC_DownloadThrottle_Configure(bytesPerSecond, perDownloadBytesPerSecond, windows);
+    Log_Info(
+        "Download bandwidth limit: %llu bytes/s, per download: %llu bytes/s, windows: '%s'",
+        static_cast<unsigned long long>(bytesPerSecond),
+        static_cast<unsigned long long>(perDownloadBytesPerSecond),
+        windows != nullptr ? windows : "");
+}
+
+void ExtensionManager::SetDownloadProgressInterval(unsigned int intervalMs, unsigned int percentStep)
+{
+    ADUC::SetDownloadProgressInterval(std::chrono::milliseconds{ intervalMs }, percentStep);
+}
+
+void ExtensionManager::SetDownloadCacheHosts(const char* cacheHosts)
+{
+    void* lib = nullptr;
+
+    ADUC_Result result = ExtensionManager::LoadContentDownloaderLibrary(&lib);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_contentDownloaderMutex);
+        _downloadCacheHosts.reset(cacheHosts == nullptr ? nullptr : new std::string{ cacheHosts });
+    }
+
+    // Optional. Downloaders without it, e.g. Delivery Optimization, find caches themselves.
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto setCacheHostsProc = reinterpret_cast<SetCacheHostsProc>(dlsym(lib, "SetCacheHosts"));
+    if (setCacheHostsProc == nullptr)
+    {
+        if (cacheHosts != nullptr && *cacheHosts != '\0')
+        {
+            Log_Warn("The content downloader doesn't support download cache hosts, ignoring them.");
+        }
+
+        return;
+    }
+
+    try
+    {
+        setCacheHostsProc(cacheHosts);
+    }
+    catch (...)
+    {
+        Log_Warn("Cannot set the download cache hosts.");
+    }
+}
+
 EXTERN_C_BEGIN
 
 ADUC_Result ExtensionManager_InitializeContentDownloader(const char* initializeData)
@@ -741,6 +2694,76 @@ ADUC_Result ExtensionManager_Download(
     return ExtensionManager::Download(entity, workflowId, workFolder, retryTimeout, downloadProgressCallback);
 }
 
+void ExtensionManager_SetMaxConcurrentDownloads(unsigned int maxConcurrentDownloads)
+{
+    ExtensionManager::SetMaxConcurrentDownloads(maxConcurrentDownloads);
+}
+
+void ExtensionManager_SetDownloadCacheSizeLimit(uint64_t sizeLimitInBytes)
+{
+    ExtensionManager::SetDownloadCacheSizeLimit(sizeLimitInBytes);
+}
+
+bool ExtensionManager_IsDownloadCacheLinkable(const ADUC_FileEntity* entity, const char* workFolder)
+{
+    return ExtensionManager::IsDownloadCacheLinkable(entity, workFolder);
+}
+
+void ExtensionManager_SetDownloadThrottle(uint64_t bytesPerSecond, uint64_t perDownloadBytesPerSecond, const char* windows)
+{
+    ExtensionManager::SetDownloadThrottle(bytesPerSecond, perDownloadBytesPerSecond, windows);
+}
+
+void ExtensionManager_SetDownloadCacheHosts(const char* cacheHosts)
+{
+    ExtensionManager::SetDownloadCacheHosts(cacheHosts);
+}
+
+void ExtensionManager_SetDownloadProgressInterval(unsigned int intervalMs, unsigned int percentStep)
+{
+    ExtensionManager::SetDownloadProgressInterval(intervalMs, percentStep);
+}
+
+/**
+ * @brief Loads the registered update content handlers in the background.
+ */
+void ExtensionManager_PreloadUpdateContentHandlers()
+{
+    ExtensionManager::PreloadUpdateContentHandlers();
+}
+
+/**
+ * @brief Unloads the update content handlers, so that the next workflow loads the ones registered then.
+ */
+void ExtensionManager_ReloadUpdateContentHandlers()
+{
+    ExtensionManager::ReloadUpdateContentHandlers();
+}
+
+/**
+ * @brief Sets how long an extension stays loaded once it was last used.
+ */
+void ExtensionManager_SetIdleUnloadTimeout(unsigned int idleUnloadSeconds)
+{
+    ExtensionManager::SetIdleUnloadTimeout(idleUnloadSeconds);
+}
+
+/**
+ * @brief Sets how long the enumeration of the components waits for each component enumerator.
+ */
+void ExtensionManager_SetComponentEnumeratorTimeout(unsigned int timeoutMs)
+{
+    ExtensionManager::SetComponentEnumeratorTimeout(timeoutMs);
+}
+
+/**
+ * @brief Unloads the extensions that weren't used for the idle unload timeout.
+ */
+void ExtensionManager_UnloadIdleExtensions()
+{
+    ExtensionManager::UnloadIdleExtensions();
+}
+
 /**
  * @brief Uninitializes the extension manager.
  */
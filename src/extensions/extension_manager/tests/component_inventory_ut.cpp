@@ -0,0 +1,117 @@
+/**
+ * @file component_inventory_ut.cpp
+ * @brief Unit tests for ComponentInventory.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/component_inventory.hpp"
+
+#include <catch2/catch.hpp>
+#include <parson.h>
+
+#include <string>
+#include <vector>
+
+using ADUC::ComponentInventory;
+
+static const char* const components = R"({
+    "components": [
+        { "id": "0", "name": "host-firmware", "group": "firmware", "manufacturer": "contoso", "model": "virtual-firmware" },
+        { "id": "1", "name": "front-motor", "group": "motors", "manufacturer": "contoso", "model": "virtual-motor" },
+        { "id": "2", "name": "rear-motor", "group": "motors", "manufacturer": "contoso", "model": "virtual-motor" },
+        { "id": "3", "name": "usb-camera", "group": "cameras", "manufacturer": "fabrikam", "model": "usb-cam",
+          "properties": { "path": "/dev/video0" } }
+    ]
+})";
+
+static std::vector<std::string> GetIds(const std::string& componentsJson)
+{
+    std::vector<std::string> ids;
+    JSON_Value* root = json_parse_string(componentsJson.c_str());
+    JSON_Array* array = json_object_get_array(json_value_get_object(root), "components");
+    REQUIRE(array != nullptr);
+    for (size_t i = 0; i < json_array_get_count(array); i++)
+    {
+        ids.emplace_back(json_object_get_string(json_array_get_object(array, i), "id"));
+    }
+    json_value_free(root);
+    return ids;
+}
+
+TEST_CASE("ComponentInventory selects by indexed attributes")
+{
+    ComponentInventory inventory;
+    REQUIRE(inventory.Load(components));
+
+    std::string output;
+    REQUIRE(inventory.Select(R"({ "group": "motors" })", output));
+    CHECK(GetIds(output) == std::vector<std::string>{ "1", "2" });
+
+    REQUIRE(inventory.Select(R"({ "manufacturer": "contoso", "model": "virtual-firmware" })", output));
+    CHECK(GetIds(output) == std::vector<std::string>{ "0" });
+
+    REQUIRE(inventory.Select(R"({ "group": "displays" })", output));
+    CHECK(GetIds(output).empty());
+}
+
+TEST_CASE("ComponentInventory selects by other attributes")
+{
+    ComponentInventory inventory;
+    REQUIRE(inventory.Load(components));
+
+    std::string output;
+    REQUIRE(inventory.Select(R"({ "group": "motors", "name": "rear-motor" })", output));
+    CHECK(GetIds(output) == std::vector<std::string>{ "2" });
+
+    REQUIRE(inventory.Select(R"({ "name": "usb-camera" })", output));
+    CHECK(GetIds(output) == std::vector<std::string>{ "3" });
+
+    // Matches like the example enumerators: all components for an empty selector, none for empty values.
+    REQUIRE(inventory.Select("{}", output));
+    CHECK(GetIds(output).size() == 4);
+
+    REQUIRE(inventory.Select(R"({ "group": "" })", output));
+    CHECK(GetIds(output).empty());
+}
+
+TEST_CASE("ComponentInventory matches values only under their own names")
+{
+    ComponentInventory inventory;
+    REQUIRE(inventory.Load(components));
+
+    std::string output;
+
+    // "contoso" and "motors" are known values, but not of these attributes.
+    REQUIRE(inventory.Select(R"({ "group": "contoso" })", output));
+    CHECK(GetIds(output).empty());
+
+    REQUIRE(inventory.Select(R"({ "manufacturer": "contoso", "model": "motors" })", output));
+    CHECK(GetIds(output).empty());
+
+    REQUIRE(inventory.Select(R"({ "color": "red" })", output));
+    CHECK(GetIds(output).empty());
+
+    REQUIRE(inventory.Select(R"({ "manufacturer": "contoso", "id": "1" })", output));
+    CHECK(GetIds(output) == std::vector<std::string>{ "1" });
+}
+
+TEST_CASE("ComponentInventory leaves unsupported selectors to the enumerator")
+{
+    ComponentInventory inventory;
+
+    std::string output;
+    CHECK_FALSE(inventory.Select(R"({ "group": "motors" })", output));
+
+    REQUIRE(inventory.Load(components));
+    CHECK_FALSE(inventory.Select("not json", output));
+    CHECK_FALSE(inventory.Select(R"({ "group": 1 })", output));
+    CHECK_FALSE(inventory.Select(R"({ "properties": { "path": "/dev/video0" } })", output));
+
+    inventory.Clear();
+    CHECK_FALSE(inventory.IsLoaded());
+    CHECK_FALSE(inventory.Select(R"({ "group": "motors" })", output));
+
+    CHECK_FALSE(inventory.Load(R"({ "devices": [] })"));
+    CHECK_FALSE(inventory.IsLoaded());
+}
@@ -0,0 +1,67 @@
+/**
+ * @file download_progress_ut.cpp
+ * @brief Unit tests for DownloadProgressAggregator.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/download_progress.hpp"
+
+#include <catch2/catch.hpp>
+
+#include <chrono>
+
+using ADUC::DownloadProgressAggregator;
+using std::chrono::milliseconds;
+
+static const ADUC_DownloadProgressState InProgress = ADUC_DownloadProgressState_InProgress;
+
+TEST_CASE("DownloadProgressAggregator passes progress on at most once per interval or percent step")
+{
+    const auto start = std::chrono::steady_clock::now();
+    DownloadProgressAggregator aggregator{ milliseconds{ 1000 }, 10, start };
+
+    // The first callback is passed on.
+    CHECK(aggregator.Update(InProgress, 0, 100000, start));
+
+    // Chunks in between are not.
+    CHECK_FALSE(aggregator.Update(InProgress, 1000, 100000, start + milliseconds{ 100 }));
+    CHECK_FALSE(aggregator.Update(InProgress, 9000, 100000, start + milliseconds{ 500 }));
+
+    // Every percent step.
+    CHECK(aggregator.Update(InProgress, 10000, 100000, start + milliseconds{ 500 }));
+    CHECK_FALSE(aggregator.Update(InProgress, 11000, 100000, start + milliseconds{ 600 }));
+
+    // Every interval.
+    CHECK(aggregator.Update(InProgress, 12000, 100000, start + milliseconds{ 1500 }));
+
+    // Every change of state.
+    CHECK(aggregator.Update(ADUC_DownloadProgressState_Completed, 100000, 100000, start + milliseconds{ 1600 }));
+    CHECK(aggregator.GetEtaSeconds() == 0);
+}
+
+TEST_CASE("DownloadProgressAggregator computes the throughput and the ETA")
+{
+    const auto start = std::chrono::steady_clock::now();
+    DownloadProgressAggregator aggregator{ milliseconds{ 1000 }, 0, start };
+
+    REQUIRE(aggregator.Update(InProgress, 0, 10000, start));
+    CHECK(aggregator.GetEtaSeconds() == -1);
+
+    REQUIRE(aggregator.Update(InProgress, 1000, 10000, start + milliseconds{ 1000 }));
+    CHECK(aggregator.GetBytesPerSecond() == Approx(1000));
+    CHECK(aggregator.GetAverageBytesPerSecond() == Approx(1000));
+    CHECK(aggregator.GetEtaSeconds() == 9);
+
+    REQUIRE(aggregator.Update(InProgress, 4000, 10000, start + milliseconds{ 2000 }));
+    CHECK(aggregator.GetBytesPerSecond() == Approx(3000));
+    CHECK(aggregator.GetAverageBytesPerSecond() == Approx(2000));
+    CHECK(aggregator.GetEtaSeconds() == 3);
+
+    // A retry that starts over restarts the throughput.
+    REQUIRE(aggregator.Update(InProgress, 0, 10000, start + milliseconds{ 3000 }));
+    REQUIRE(aggregator.Update(InProgress, 500, 10000, start + milliseconds{ 4000 }));
+    CHECK(aggregator.GetBytesPerSecond() == Approx(500));
+    CHECK(aggregator.GetAverageBytesPerSecond() == Approx(500));
+    CHECK(aggregator.GetEtaSeconds() == 19);
+}
@@ -0,0 +1,88 @@
+/**
+ * @file download_retry_ut.cpp
+ * @brief Unit tests for DownloadRetryPolicy.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/download_retry.hpp"
+#include "aduc/types/adu_core.h"
+
+#include <catch2/catch.hpp>
+
+#include <chrono>
+
+using ADUC::DownloadRetryPolicy;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+static const ADUC_Result CouldntConnect = { ADUC_Result_Failure, ADUC_ERROR_CURL_DOWNLOADER_EXTERNAL_FAILURE(7) };
+
+TEST_CASE("DownloadRetryPolicy failure classification")
+{
+    CHECK(DownloadRetryPolicy::IsTransientFailure(CouldntConnect));
+    CHECK(DownloadRetryPolicy::IsTransientFailure({ ADUC_Result_Failure, ADUC_ERROR_CURL_DOWNLOADER_HTTP_FAILURE(503) }));
+    CHECK(DownloadRetryPolicy::IsTransientFailure({ ADUC_Result_Failure, ADUC_ERROR_CURL_DOWNLOADER_HTTP_FAILURE(429) }));
+
+    CHECK_FALSE(DownloadRetryPolicy::IsTransientFailure({ ADUC_Result_Download_Success, 0 }));
+    CHECK_FALSE(
+        DownloadRetryPolicy::IsTransientFailure({ ADUC_Result_Failure, ADUC_ERROR_CURL_DOWNLOADER_HTTP_FAILURE(404) }));
+    CHECK_FALSE(DownloadRetryPolicy::IsTransientFailure({ ADUC_Result_Failure, ADUC_ERROR_CURL_DOWNLOADER_WRITE_FAILURE }));
+    CHECK_FALSE(DownloadRetryPolicy::IsTransientFailure({ ADUC_Result_Failure_Cancelled, CouldntConnect.ExtendedResultCode }));
+}
+
+TEST_CASE("DownloadRetryPolicy backoff")
+{
+    const auto start = std::chrono::steady_clock::now();
+    DownloadRetryPolicy policy{ seconds{ 24 * 60 * 60 }, start };
+    milliseconds delay{ 0 };
+
+    SECTION("The backoff doubles, and the jitter picks a fraction of it")
+    {
+        REQUIRE(policy.ShouldRetry(CouldntConnect, start, 1.0, &delay));
+        CHECK(delay == DownloadRetryPolicy::BaseDelay);
+        REQUIRE(policy.ShouldRetry(CouldntConnect, start, 1.0, &delay));
+        CHECK(delay == 2 * DownloadRetryPolicy::BaseDelay);
+        REQUIRE(policy.ShouldRetry(CouldntConnect, start, 0.5, &delay));
+        CHECK(delay == 2 * DownloadRetryPolicy::BaseDelay);
+        REQUIRE(policy.ShouldRetry(CouldntConnect, start, 0.0, &delay));
+        CHECK(delay == milliseconds{ 0 });
+    }
+
+    SECTION("Attempts are limited")
+    {
+        for (unsigned int i = 1; i < DownloadRetryPolicy::MaxAttempts; ++i)
+        {
+            CHECK(policy.ShouldRetry(CouldntConnect, start, 0.5, &delay));
+        }
+
+        CHECK_FALSE(policy.ShouldRetry(CouldntConnect, start, 0.5, &delay));
+    }
+
+    SECTION("Fatal failures aren't retried")
+    {
+        CHECK_FALSE(policy.ShouldRetry(
+            { ADUC_Result_Failure, ADUC_ERROR_CURL_DOWNLOADER_HTTP_FAILURE(403) }, start, 0.5, &delay));
+    }
+}
+
+TEST_CASE("DownloadRetryPolicy deadline")
+{
+    const auto start = std::chrono::steady_clock::now();
+    milliseconds delay{ 0 };
+
+    SECTION("No retry starts after the deadline")
+    {
+        DownloadRetryPolicy policy{ seconds{ 60 }, start };
+        CHECK(policy.GetRemainingSeconds(start + seconds{ 15 }) == 45);
+        CHECK(policy.GetRemainingSeconds(start + seconds{ 90 }) == 1);
+        CHECK_FALSE(policy.ShouldRetry(CouldntConnect, start + seconds{ 59 }, 1.0, &delay));
+    }
+
+    SECTION("No timeout means no retries")
+    {
+        DownloadRetryPolicy policy{ seconds{ 0 }, start };
+        CHECK(policy.GetRemainingSeconds(start) == 0);
+        CHECK_FALSE(policy.ShouldRetry(CouldntConnect, start, 0.0, &delay));
+    }
+}
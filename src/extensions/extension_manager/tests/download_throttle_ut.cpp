@@ -0,0 +1,180 @@
+/**
+ * @file download_throttle_ut.cpp
+ * @brief Unit tests for TokenBucket, DownloadWindows and the transfer priorities.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/download_throttle.h"
+#include "aduc/download_throttle.hpp"
+
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <future>
+#include <thread>
+
+using ADUC::DownloadWindows;
+using ADUC::TokenBucket;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+TEST_CASE("TokenBucket without a rate never waits")
+{
+    TokenBucket bucket;
+    const auto now = std::chrono::steady_clock::now();
+
+    CHECK(bucket.Consume(1024 * 1024 * 1024, now) == microseconds{ 0 });
+}
+
+TEST_CASE("TokenBucket limits the rate")
+{
+    TokenBucket bucket;
+    const auto start = std::chrono::steady_clock::now();
+    bucket.SetRate(1000, start);
+
+    SECTION("One second of tokens is available right away")
+    {
+        CHECK(bucket.Consume(1000, start) == microseconds{ 0 });
+        CHECK(bucket.Consume(500, start) == milliseconds{ 500 });
+    }
+
+    SECTION("A chunk larger than the bucket borrows from the next seconds")
+    {
+        CHECK(bucket.Consume(3000, start) == milliseconds{ 2000 });
+    }
+
+    SECTION("The bucket refills over time, but holds at most one second of tokens")
+    {
+        CHECK(bucket.Consume(1000, start) == microseconds{ 0 });
+        CHECK(bucket.Consume(250, start + milliseconds{ 250 }) == microseconds{ 0 });
+        CHECK(bucket.Consume(2000, start + milliseconds{ 10000 }) == milliseconds{ 1000 });
+    }
+}
+
+TEST_CASE("DownloadWindows parsing")
+{
+    DownloadWindows windows;
+
+    CHECK(windows.Parse(nullptr));
+    CHECK(windows.IsEmpty());
+    CHECK(windows.Parse(""));
+    CHECK(windows.IsEmpty());
+
+    CHECK(windows.Parse("22:00-06:00, 12:30 - 13:00"));
+    CHECK_FALSE(windows.IsEmpty());
+
+    // Invalid windows leave the previous ones in place.
+    CHECK_FALSE(windows.Parse("24:00-06:00"));
+    CHECK_FALSE(windows.Parse("22:00-06:60"));
+    CHECK_FALSE(windows.Parse("22:00"));
+    CHECK_FALSE(windows.Parse("22:00-06:00,,12:00-13:00"));
+    CHECK_FALSE(windows.Parse("22:00-06:00x"));
+    CHECK(windows.GetMinutesUntilOpen(12 * 60 + 45) == 0);
+}
+
+TEST_CASE("DownloadWindows open times")
+{
+    DownloadWindows windows;
+
+    SECTION("No windows are always open")
+    {
+        CHECK(windows.GetMinutesUntilOpen(0) == 0);
+        CHECK(windows.GetMinutesUntilOpen(23 * 60 + 59) == 0);
+    }
+
+    SECTION("A window spanning midnight")
+    {
+        REQUIRE(windows.Parse("22:00-06:00"));
+        CHECK(windows.GetMinutesUntilOpen(23 * 60) == 0);
+        CHECK(windows.GetMinutesUntilOpen(5 * 60 + 59) == 0);
+        CHECK(windows.GetMinutesUntilOpen(6 * 60) == 16 * 60);
+        CHECK(windows.GetMinutesUntilOpen(21 * 60 + 59) == 1);
+    }
+
+    SECTION("The nearest of several windows")
+    {
+        REQUIRE(windows.Parse("01:00-02:00,12:00-13:00"));
+        CHECK(windows.GetMinutesUntilOpen(1 * 60 + 30) == 0);
+        CHECK(windows.GetMinutesUntilOpen(13 * 60) == 12 * 60);
+        CHECK(windows.GetMinutesUntilOpen(11 * 60) == 60);
+    }
+
+    SECTION("A window ending when it starts spans the whole day")
+    {
+        REQUIRE(windows.Parse("03:00-03:00"));
+        CHECK(windows.GetMinutesUntilOpen(0) == 0);
+        CHECK(windows.GetMinutesUntilOpen(12 * 60) == 0);
+    }
+}
+
+TEST_CASE("Background transfers pause while a foreground transfer runs")
+{
+    REQUIRE(ADUC_DownloadThrottle_Configure(0, 0, nullptr));
+    CHECK(ADUC_DownloadThrottle_GetThreadPriority() == ADUC_TransferPriority_Foreground);
+
+    ADUC_DownloadThrottle_SetThreadPriority(ADUC_TransferPriority_Background);
+
+    // Nothing to yield to.
+    auto start = std::chrono::steady_clock::now();
+    ADUC_DownloadThrottle_Consume(1024);
+    CHECK(std::chrono::steady_clock::now() - start < milliseconds{ 100 });
+
+    std::promise<void> begun;
+    std::thread foreground{ [&begun]() {
+        ADUC_DownloadThrottle_BeginTransfer();
+        begun.set_value();
+        std::this_thread::sleep_for(milliseconds{ 300 });
+        ADUC_DownloadThrottle_EndTransfer();
+    } };
+
+    begun.get_future().wait();
+
+    start = std::chrono::steady_clock::now();
+    ADUC_DownloadThrottle_Consume(1024);
+    CHECK(std::chrono::steady_clock::now() - start >= milliseconds{ 200 });
+
+    foreground.join();
+
+    // Background transfers don't pause each other.
+    ADUC_DownloadThrottle_BeginTransfer();
+    start = std::chrono::steady_clock::now();
+    ADUC_DownloadThrottle_Consume(1024);
+    CHECK(std::chrono::steady_clock::now() - start < milliseconds{ 100 });
+    ADUC_DownloadThrottle_EndTransfer();
+
+    ADUC_DownloadThrottle_SetThreadPriority(ADUC_TransferPriority_Foreground);
+}
+
+TEST_CASE("Waiting for a download window stops once cancelled")
+{
+    ADUC_CancellationToken* token = ADUC_CancellationToken_Create();
+    REQUIRE(token != nullptr);
+
+    REQUIRE(ADUC_DownloadThrottle_Configure(0, 0, nullptr));
+    CHECK(ADUC_DownloadThrottle_WaitForWindow(token));
+
+    // A window that opens in two hours.
+    const time_t now = time(nullptr);
+    struct tm localNow = {};
+    REQUIRE(localtime_r(&now, &localNow) != nullptr);
+    char windows[32] = {};
+    snprintf(windows, sizeof(windows), "%02d:00-%02d:00", (localNow.tm_hour + 2) % 24, (localNow.tm_hour + 3) % 24);
+    REQUIRE(ADUC_DownloadThrottle_Configure(0, 0, windows));
+
+    std::thread canceller{ [token]() {
+        std::this_thread::sleep_for(milliseconds{ 100 });
+        ADUC_CancellationToken_Cancel(token);
+    } };
+
+    const auto start = std::chrono::steady_clock::now();
+    CHECK_FALSE(ADUC_DownloadThrottle_WaitForWindow(token));
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds{ 5 });
+
+    canceller.join();
+
+    REQUIRE(ADUC_DownloadThrottle_Configure(0, 0, nullptr));
+    ADUC_CancellationToken_Destroy(token);
+}
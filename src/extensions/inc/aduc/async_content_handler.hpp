@@ -0,0 +1,125 @@
+/**
+ * @file async_content_handler.hpp
+ * @brief Defines AsyncContentHandler, the base of the content handlers whose operations return in progress.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_ASYNC_CONTENT_HANDLER_HPP
+#define ADUC_ASYNC_CONTENT_HANDLER_HPP
+
+#include "aduc/content_handler.hpp"
+#include "aduc/types/adu_core.h"
+
+#include <condition_variable>
+#include <mutex>
+
+/**
+ * @class AsyncContentHandler
+ * @brief Base of the handlers that implement the asynchronous operations of ContentHandler, e.g. to wait for a child
+ * process with an eventfd rather than with a thread. Their synchronous operations start the asynchronous ones, and
+ * wait for them to be done.
+ */
+class AsyncContentHandler : public ContentHandler
+{
+public:
+    bool SupportsAsyncOperations() override
+    {
+        return true;
+    }
+
+    ADUC_Result DownloadAsync(
+        const tagADUC_WorkflowData* workflowData,
+        ContentHandlerCompletionCallback completionCallback,
+        void* context) override = 0;
+
+    ADUC_Result InstallAsync(
+        const tagADUC_WorkflowData* workflowData,
+        ContentHandlerCompletionCallback completionCallback,
+        void* context) override = 0;
+
+    ADUC_Result ApplyAsync(
+        const tagADUC_WorkflowData* workflowData,
+        ContentHandlerCompletionCallback completionCallback,
+        void* context) override = 0;
+
+    ADUC_Result IsInstalledAsync(
+        const tagADUC_WorkflowData* workflowData,
+        ContentHandlerCompletionCallback completionCallback,
+        void* context) override = 0;
+
+    ADUC_Result Download(const tagADUC_WorkflowData* workflowData) override
+    {
+        Completion completion;
+        return completion.Wait(
+            DownloadAsync(workflowData, Completion::OnDone, &completion), ADUC_Result_Download_InProgress);
+    }
+
+    ADUC_Result Install(const tagADUC_WorkflowData* workflowData) override
+    {
+        Completion completion;
+        return completion.Wait(
+            InstallAsync(workflowData, Completion::OnDone, &completion), ADUC_Result_Install_InProgress);
+    }
+
+    ADUC_Result Apply(const tagADUC_WorkflowData* workflowData) override
+    {
+        Completion completion;
+        return completion.Wait(ApplyAsync(workflowData, Completion::OnDone, &completion), ADUC_Result_Apply_InProgress);
+    }
+
+    ADUC_Result IsInstalled(const tagADUC_WorkflowData* workflowData) override
+    {
+        Completion completion;
+        return completion.Wait(
+            IsInstalledAsync(workflowData, Completion::OnDone, &completion), ADUC_Result_IsInstalled_InProgress);
+    }
+
+protected:
+    AsyncContentHandler() = default;
+
+private:
+    /**
+     * @brief The completion of an asynchronous operation, which a synchronous one waits for.
+     */
+    class Completion
+    {
+    public:
+        /**
+         * @brief The ContentHandlerCompletionCallback of the operation, whose context is the Completion.
+         */
+        static void OnDone(void* context, ADUC_Result result)
+        {
+            Completion* completion = static_cast<Completion*>(context);
+
+            // Notified with the lock held, as the waiter destroys the Completion as soon as it sees it done.
+            std::lock_guard<std::mutex> lock(completion->_mutex);
+            completion->_result = result;
+            completion->_done = true;
+            completion->_doneChanged.notify_all();
+        }
+
+        /**
+         * @brief Returns the result of the operation, waiting for it if @p startResult is @p inProgressCode.
+         */
+        ADUC_Result Wait(ADUC_Result startResult, ADUC_Result_t inProgressCode)
+        {
+            if (startResult.ResultCode != inProgressCode)
+            {
+                return startResult;
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _doneChanged.wait(lock, [this] { return _done; });
+            return _result;
+        }
+
+    private:
+        std::mutex _mutex;
+        std::condition_variable _doneChanged;
+        bool _done = false;
+        ADUC_Result _result{ ADUC_Result_Failure };
+    };
+};
+
+#endif // ADUC_ASYNC_CONTENT_HANDLER_HPP
@@ -9,6 +9,8 @@
 #ifndef _COMPONENT_ENUMERATOR_EXTENSION_HPP_
 #define _COMPONENT_ENUMERATOR_EXTENSION_HPP_
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -77,6 +79,21 @@ extern "C" {
  */
 typedef char* (*SelectComponentsProc)(const char* selector);
 
+/**
+ * @brief Optional. Selects the components matching each of @p selectors in one call, see SelectComponentsProc.
+ *
+ * The results are returned in one buffer, one after the other, each a null-terminated string in the format of
+ * SelectComponents' output. The caller reads them in place, at @p resultOffsets, without copying them.
+ *
+ * @param selectors The stringified json selectors.
+ * @param selectorCount The number of @p selectors.
+ * @param[out] resultOffsets An array of @p selectorCount elements, set to the offset of each selector's result in the
+ * returned buffer.
+ * @return Returns the buffer with the results of all @p selectors, or nullptr on failure.
+ * Caller must call FreeComponentsDataString function when done with the returned buffer.
+ */
+typedef char* (*SelectComponentsBatchProc)(const char* const* selectors, size_t selectorCount, size_t* resultOffsets);
+
 /**
  * @brief Returns all components information in JSON format.
  * @return Returns a serialized json data containing components information.
@@ -128,6 +145,28 @@ typedef char* (*SelectComponentsProc)(const char* selector);
  */
 typedef char* (*GetAllComponentsProc)();
 
+/**
+ * @brief Optional. Returns the generation of the components collection, a counter the enumerator changes whenever
+ * the output of GetAllComponents may have changed, e.g. from a udev or inotify watch on the components.
+ *
+ * The agent calls it often, so it must be cheap and must not enumerate the components. When it's exported, the agent
+ * enumerates the components only after the generation changes. Otherwise, the agent enumerates them periodically.
+ *
+ * @return Returns the generation of the components collection.
+ */
+typedef uint64_t (*GetComponentsGenerationProc)();
+
+/**
+ * @brief Optional. Returns whether SelectComponents selects exactly the components of GetAllComponents that have each
+ * name-value pair of the selector as a string field, and no others.
+ *
+ * When it's exported and returns true, the agent answers selections from its cache of GetAllComponents, see
+ * component_inventory.hpp, without calling SelectComponents. Otherwise, every selection goes to SelectComponents.
+ *
+ * @return Returns true if the agent may select the components itself.
+ */
+typedef bool (*SelectsByStringFieldsProc)();
+
 /**
  * @brief Free string buffer previously returned by Component Enumerator APIs.
  * @param string A pointer to string to be freed.
@@ -9,6 +9,7 @@
 #define ADUC_CONTENT_DOWNLOADER_EXTENSION_HPP
 
 #include "aduc/adu_core_exports.h"
+#include "aduc/cancellation_token.h"
 
 extern "C" {
 
@@ -16,6 +17,43 @@ typedef ADUC_Result (*InitializeProc)(const char* initializeData);
 
 typedef ADUC_Result (*DownloadProc)(const ADUC_FileEntity* entity, const char* workflowId, const char* workFolder, unsigned int retryTimeout, ADUC_DownloadProgressCallback downloadProgressCallback);
 
+/**
+ * @brief Optional downloader export. Same as DownloadProc, but also returns information about the
+ * downloaded file whose hash was already validated by the downloader, so that the caller doesn't
+ * need to hash the file again.
+ *
+ * @param verifiedFile [out] On success, filled in if the file hash was validated. Otherwise, left zeroed.
+ * Caller must call ADUC_DownloadVerifiedFile_UnInit() when done.
+ */
+typedef ADUC_Result (*DownloadAndVerifyProc)(const ADUC_FileEntity* entity, const char* workflowId, const char* workFolder, unsigned int retryTimeout, ADUC_DownloadProgressCallback downloadProgressCallback, ADUC_DownloadVerifiedFile* verifiedFile);
+
+/**
+ * @brief Optional downloader export. Same as DownloadAndVerifyProc, but the download is aborted, and the result is
+ * ADUC_Result_Failure_Cancelled, as soon as @p cancellationToken is cancelled.
+ *
+ * @param cancellationToken [in] The token, or NULL. Not kept past the call.
+ */
+typedef ADUC_Result (*DownloadWithCancellationProc)(const ADUC_FileEntity* entity, const char* workflowId, const char* workFolder, unsigned int retryTimeout, ADUC_DownloadProgressCallback downloadProgressCallback, ADUC_DownloadVerifiedFile* verifiedFile, const ADUC_CancellationToken* cancellationToken);
+
+/**
+ * @brief Optional downloader export. Downloads the content of @p entity and writes it to @p outputFd as it arrives,
+ * instead of to a file in the work folder, for consumers that process the content as a stream.
+ * The content is hashed as it's written; the result is a failure if the hash isn't valid once all of it was written.
+ * A stream can't be rewound, so the download isn't resumed after a failure.
+ *
+ * @param outputFd [in] The file descriptor to write the content to, e.g. a pipe. Not closed by the downloader.
+ */
+typedef ADUC_Result (*DownloadToStreamProc)(const ADUC_FileEntity* entity, const char* workflowId, unsigned int retryTimeout, ADUC_DownloadProgressCallback downloadProgressCallback, int outputFd);
+
+/**
+ * @brief Optional downloader export. Sets the hosts of LAN caches, e.g. Connected Cache servers, that the downloader
+ * asks for the content before its origin. Content from a cache is verified by its hash like any other; the
+ * downloader falls back to the origin if no cache has valid content.
+ *
+ * @param cacheHosts [in] Comma-separated host names or addresses, optionally with a port. NULL or empty for none.
+ */
+typedef void (*SetCacheHostsProc)(const char* cacheHosts);
+
 }
 
 #endif // ADUC_CONTENT_DOWNLOADER_EXTENSION_HPP
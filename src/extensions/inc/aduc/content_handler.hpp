@@ -20,9 +20,19 @@
 
 #include "aduc/result.h"
 
+#include <stddef.h>
+
 // Forward declation.
 struct tagADUC_WorkflowData;
 
+/**
+ * @brief Called by a handler, on any thread, once an operation that it returned in progress is done.
+ *
+ * @param context The context the operation was started with.
+ * @param result The result of the operation.
+ */
+typedef void (*ContentHandlerCompletionCallback)(void* context, ADUC_Result result);
+
 /**
  * @interface ContentHandler
  * @brief Interface for content specific handler implementations.
@@ -46,6 +56,96 @@ public:
     {
     }
 
+    //
+    // Optional methods. These come after all the original virtual methods, including the destructor, so that
+    // the vtable layout that existing handler libraries were built against is unchanged.
+    //
+
+    /**
+     * @brief Optional. Downloads the content of several steps of a steps update as one operation, e.g. to resolve
+     * their packages together. The steps handler calls it for consecutive inline steps that use this handler.
+     *
+     * @param stepWorkflows The workflows of the steps, in steps order.
+     * @param stepCount The number of steps.
+     * @param results Receives the result of each step, in steps order.
+     * @return bool false if the steps weren't processed as one operation; they are then downloaded one at a time,
+     * which also attributes a failure to the step that caused it.
+     */
+    virtual bool DownloadBatch(
+        const tagADUC_WorkflowData* const* /*stepWorkflows*/, size_t /*stepCount*/, ADUC_Result* /*results*/)
+    {
+        return false;
+    }
+
+    /**
+     * @brief Optional. Same as DownloadBatch, for Install. Apply is still called for each step afterwards, in order.
+     */
+    virtual bool InstallBatch(
+        const tagADUC_WorkflowData* const* /*stepWorkflows*/, size_t /*stepCount*/, ADUC_Result* /*results*/)
+    {
+        return false;
+    }
+
+    /**
+     * @brief Optional. Whether the handler's asynchronous operations, e.g. DownloadAsync, return in progress rather
+     * than block until they're done, see AsyncContentHandler. Callers then needn't give each operation in flight a
+     * thread of its own.
+     */
+    virtual bool SupportsAsyncOperations()
+    {
+        return false;
+    }
+
+    /**
+     * @brief Starts Download, see SupportsAsyncOperations. By default, calls Download, which is done on return.
+     *
+     * @param workflowData The workflow data, which must stay valid until the operation is done.
+     * @param completionCallback Called once with the result of the operation, if it goes on after the call.
+     * @param context Passed to @p completionCallback.
+     * @return ADUC_Result ADUC_Result_Download_InProgress if the operation goes on; otherwise the result of the
+     * operation, and @p completionCallback isn't called.
+     */
+    virtual ADUC_Result DownloadAsync(
+        const tagADUC_WorkflowData* workflowData,
+        ContentHandlerCompletionCallback /*completionCallback*/,
+        void* /*context*/)
+    {
+        return Download(workflowData);
+    }
+
+    /**
+     * @brief Same as DownloadAsync, for Install, with ADUC_Result_Install_InProgress.
+     */
+    virtual ADUC_Result InstallAsync(
+        const tagADUC_WorkflowData* workflowData,
+        ContentHandlerCompletionCallback /*completionCallback*/,
+        void* /*context*/)
+    {
+        return Install(workflowData);
+    }
+
+    /**
+     * @brief Same as DownloadAsync, for Apply, with ADUC_Result_Apply_InProgress.
+     */
+    virtual ADUC_Result ApplyAsync(
+        const tagADUC_WorkflowData* workflowData,
+        ContentHandlerCompletionCallback /*completionCallback*/,
+        void* /*context*/)
+    {
+        return Apply(workflowData);
+    }
+
+    /**
+     * @brief Same as DownloadAsync, for IsInstalled, with ADUC_Result_IsInstalled_InProgress.
+     */
+    virtual ADUC_Result IsInstalledAsync(
+        const tagADUC_WorkflowData* workflowData,
+        ContentHandlerCompletionCallback /*completionCallback*/,
+        void* /*context*/)
+    {
+        return IsInstalled(workflowData);
+    }
+
 protected:
     ContentHandler() = default;
 };
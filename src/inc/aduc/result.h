@@ -148,6 +148,9 @@ typedef enum tagADUC_Content_Handler
     /*indicates errors from Script Update Handler. */
     ADUC_CONTENT_HANDLER_SCRIPT = 0x05,
 
+    /*indicates errors from Raw Image Update Handler. */
+    ADUC_CONTENT_HANDLER_RAWIMAGE = 0x06,
+
     /*indicates errors from Custom Update handlers. */
     ADUC_CONTENT_HANDLER_EXTERNAL = 0x20,
 } ADUC_Content_Handler;
@@ -203,6 +206,25 @@ MAKE_ADUC_EXTENDEDRESULTCODE(const unsigned int facility, const unsigned int com
     return ((facility & 0xF) << 0x1C) | ((component & 0xFF) << 0x14) | (value & 0xFFFFF);
 }
 
+/**
+ * @brief Gets the facility code, an ADUC_Facility, of an extended result code made by MAKE_ADUC_EXTENDEDRESULTCODE.
+ */
+static inline unsigned int ADUC_EXTENDEDRESULTCODE_FACILITY(const ADUC_Result_t extendedResultCode)
+{
+    return ((uint32_t)extendedResultCode >> 0x1C) & 0xF;
+}
+
+/**
+ * @brief Gets the component or area code of an extended result code made by MAKE_ADUC_EXTENDEDRESULTCODE.
+ * Delivery Optimization codes have no component, see MAKE_ADUC_DELIVERY_OPTIMIZATION_EXTENDEDRESULTCODE.
+ */
+static inline unsigned int ADUC_EXTENDEDRESULTCODE_COMPONENT(const ADUC_Result_t extendedResultCode)
+{
+    return ADUC_EXTENDEDRESULTCODE_FACILITY(extendedResultCode) == ADUC_FACILITY_DELIVERY_OPTIMIZATION
+        ? 0
+        : ((uint32_t)extendedResultCode >> 0x14) & 0xFF;
+}
+
 /**
  * @brief Macros to convert Content Handler results to extended result code values.
  * Extended error codes begin with 0x3#######
@@ -374,6 +396,16 @@ static inline ADUC_Result_t MAKE_ADUC_SWUPDATE_HANDLER_EXTENDEDRESULTCODE(const
 
 #define ADUC_ERC_SWUPDATE_HANDLER_INSTALL_FAILURE_BAD_FILE_ENTITY MAKE_ADUC_SWUPDATE_HANDLER_EXTENDEDRESULTCODE(0x202)
 
+#define ADUC_ERC_SWUPDATE_HANDLER_INSTALL_FAILURE_CANNOT_CREATE_STREAM \
+    MAKE_ADUC_SWUPDATE_HANDLER_EXTENDEDRESULTCODE(0x203)
+
+#define ADUC_ERC_SWUPDATE_HANDLER_INSTALL_FAILURE_STREAM_NOT_READ MAKE_ADUC_SWUPDATE_HANDLER_EXTENDEDRESULTCODE(0x204)
+
+#define ADUC_ERC_SWUPDATE_HANDLER_INSTALL_FAILURE_STALLED MAKE_ADUC_SWUPDATE_HANDLER_EXTENDEDRESULTCODE(0x205)
+
+#define ADUC_ERC_SWUPDATE_HANDLER_INSTALL_FAILURE_IMAGE_NOT_VERIFIED \
+    MAKE_ADUC_SWUPDATE_HANDLER_EXTENDEDRESULTCODE(0x206)
+
 // Apply related errors (0x300 - 0x3FF)
 
 // Cancel related errors (0x400 - 0x4FF)
@@ -546,6 +578,42 @@ static inline ADUC_Result_t MAKE_ADUC_SCRIPT_HANDLER_EXTENDEDRESULTCODE(const in
 #define ADUC_ERC_SCRIPT_HANDLER_CHILD_PROCESS_FAILURE_EXITCODE(exitCode) \
     MAKE_ADUC_SCRIPT_HANDLER_EXTENDEDRESULTCODE((0x1000 + exitCode))
 
+//
+// Raw Image Handler errors.
+// (Begins with 0x306#####)
+//
+
+/**
+ * @brief Macros to convert Raw Image Handler results to extended result code values.
+ * Extended error codes begin with 0x306#####
+ */
+static inline ADUC_Result_t MAKE_ADUC_RAWIMAGE_HANDLER_EXTENDEDRESULTCODE(const int32_t value)
+{
+    return MAKE_ADUC_CONTENT_HANDLER_EXTENDEDRESULTCODE(ADUC_CONTENT_HANDLER_RAWIMAGE, value);
+}
+
+// General errors. (0x30600000 - 0FF)
+#define ADUC_ERC_RAWIMAGE_HANDLER_MISSING_TARGET_DEVICE_PROPERTY MAKE_ADUC_RAWIMAGE_HANDLER_EXTENDEDRESULTCODE(1)
+
+// Download errors. (0x30600100 - 1FF)
+#define ADUC_ERC_RAWIMAGE_HANDLER_DOWNLOAD_FAILURE_WRONG_FILECOUNT MAKE_ADUC_RAWIMAGE_HANDLER_EXTENDEDRESULTCODE(0x101)
+
+#define ADUC_ERC_RAWIMAGE_HANDLER_DOWNLOAD_FAILURE_BAD_FILE_ENTITY MAKE_ADUC_RAWIMAGE_HANDLER_EXTENDEDRESULTCODE(0x102)
+
+// Install errors. (0x30600200 - 2FF)
+#define ADUC_ERC_RAWIMAGE_HANDLER_INSTALL_FAILURE_BAD_FILE_ENTITY MAKE_ADUC_RAWIMAGE_HANDLER_EXTENDEDRESULTCODE(0x201)
+
+#define ADUC_ERC_RAWIMAGE_HANDLER_INSTALL_FAILURE_CANNOT_CREATE_STREAM \
+    MAKE_ADUC_RAWIMAGE_HANDLER_EXTENDEDRESULTCODE(0x202)
+
+#define ADUC_ERC_RAWIMAGE_HANDLER_INSTALL_FAILURE_STREAM_NOT_READ MAKE_ADUC_RAWIMAGE_HANDLER_EXTENDEDRESULTCODE(0x203)
+
+#define ADUC_ERC_RAWIMAGE_HANDLER_INSTALL_FAILURE_NO_IMAGE_HASH MAKE_ADUC_RAWIMAGE_HANDLER_EXTENDEDRESULTCODE(0x204)
+
+// Exit code from adu-shell. (0x30601000 + exitCode)
+#define ADUC_ERC_RAWIMAGE_HANDLER_CHILD_PROCESS_FAILURE_EXITCODE(exitCode) \
+    MAKE_ADUC_RAWIMAGE_HANDLER_EXTENDEDRESULTCODE((0x1000 + exitCode))
+
 /**
  * @brief Macros to convert a Downloader Extension results to extended result code values.\n
  * The facility code for these errors is ADUC_FACILITY_EXTENSION_CONTENT_DOWNLOADER.
@@ -596,13 +664,37 @@ MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(const ADUC_Content_Downlo
 #define ADUC_ERC_CONTENT_DOWNLOADER_CANNOT_DELETE_EXISTING_FILE \
     MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(ADUC_CONTENT_DOWNLOADER_COMMON, 10)
 
+#define ADUC_ERC_CONTENT_DOWNLOADER_DOWNLOADTOSTREAMPROC_NOTIMP \
+    MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(ADUC_CONTENT_DOWNLOADER_COMMON, 11)
+
+#define ADUC_ERC_CONTENT_DOWNLOADER_INSUFFICIENT_DISK_SPACE \
+    MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(ADUC_CONTENT_DOWNLOADER_COMMON, 12)
+
+#define ADUC_ERC_CONTENT_DOWNLOADER_TRANSPORT_ENCODING_NOT_SUPPORTED \
+    MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(ADUC_CONTENT_DOWNLOADER_COMMON, 13)
+
+#define ADUC_ERC_CONTENT_DOWNLOADER_TRANSPORT_DECODING_FAILURE \
+    MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(ADUC_CONTENT_DOWNLOADER_COMMON, 14)
+
+#define ADUC_ERC_CONTENT_DOWNLOADER_INVALID_TRANSPORT_HASH \
+    MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(ADUC_CONTENT_DOWNLOADER_COMMON, 15)
+
 // Curl Downloader.
 #define ADUC_ERROR_CURL_DOWNLOADER_INVALID_FILE_HASH \
     MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(ADUC_CONTENT_DOWNLOADER_CURL_DOWNLOADER, 1)
 
+#define ADUC_ERROR_CURL_DOWNLOADER_WRITE_FAILURE \
+    MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(ADUC_CONTENT_DOWNLOADER_CURL_DOWNLOADER, 2)
+
+#define ADUC_ERROR_CURL_DOWNLOADER_INIT_FAILURE \
+    MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(ADUC_CONTENT_DOWNLOADER_CURL_DOWNLOADER, 3)
+
 #define ADUC_ERROR_CURL_DOWNLOADER_EXTERNAL_FAILURE(exitCode) \
     MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(ADUC_CONTENT_DOWNLOADER_CURL_DOWNLOADER, (1000 + exitCode))
 
+#define ADUC_ERROR_CURL_DOWNLOADER_HTTP_FAILURE(httpStatus) \
+    MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(ADUC_CONTENT_DOWNLOADER_CURL_DOWNLOADER, (2000 + httpStatus))
+
 // Delivery Optimization Downloader.
 #define ADUC_ERROR_DELIVERY_OPTIMIZATION_DOWNLOADER_NOT_INITIALIZE \
     MAKE_ADUC_UPDATE_CONTENT_DOWNLOADER_EXTENDEDRESULTCODE(ADUC_CONTENT_DOWNLOADER_DELIVERY_OPTIMIZATION, 1)
@@ -647,6 +739,12 @@ static inline ADUC_Result_t MAKE_ADUC_COMPONENT_ENUMERATOR_EXTENDEDRESULTCODE(co
 #define ADUC_ERC_COMPONENT_ENUMERATOR_EXCEPTION_FREECOMPONENTSDATASTRING \
     MAKE_ADUC_COMPONENT_ENUMERATOR_EXTENDEDRESULTCODE(6)
 
+#define ADUC_ERC_COMPONENT_ENUMERATOR_GETCOMPONENTSGENERATION_NOTIMP \
+    MAKE_ADUC_COMPONENT_ENUMERATOR_EXTENDEDRESULTCODE(7)
+
+#define ADUC_ERC_COMPONENT_ENUMERATOR_EXCEPTION_GETCOMPONENTSGENERATION \
+    MAKE_ADUC_COMPONENT_ENUMERATOR_EXTENDEDRESULTCODE(8)
+
 //
 // Error raised from shared libraries or utilities.
 //
@@ -738,6 +836,15 @@ static inline ADUC_Result_t MAKE_ADUC_COMPONENT_ENUMERATOR_EXTENDEDRESULTCODE(co
 #define ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_COPY_HANDLER_PROPERTIES_FAILED \
     MAKE_ADUC_UTILITIES_EXTENDEDRESULTCODE(ADUC_COMPONENT_WORKFLOW_UTIL, 0xD)
 
+#define ADUC_ERC_UTILITIES_WORKFLOW_UTIL_MEMORY_BUDGET_EXCEEDED \
+    MAKE_ADUC_UTILITIES_EXTENDEDRESULTCODE(ADUC_COMPONENT_WORKFLOW_UTIL, 0xE)
+
+#define ADUC_ERC_UTILITIES_WORKFLOW_UTIL_INSUFFICIENT_DISK_SPACE \
+    MAKE_ADUC_UTILITIES_EXTENDEDRESULTCODE(ADUC_COMPONENT_WORKFLOW_UTIL, 0xF)
+
+#define ADUC_ERC_UTILITIES_WORKFLOW_UTIL_OPERATION_TIMED_OUT \
+    MAKE_ADUC_UTILITIES_EXTENDEDRESULTCODE(ADUC_COMPONENT_WORKFLOW_UTIL, 0x10)
+
 //
 // DU Agent - Lower Layer errors.
 //
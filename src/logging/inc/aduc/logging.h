@@ -32,6 +32,26 @@ typedef enum tagADUC_LOG_SEVERITY
     ADUC_LOG_ERROR
 } ADUC_LOG_SEVERITY;
 
+/**
+ * @brief The lowest ADUC_LOG_SEVERITY value whose log calls are compiled in, e.g. 1 removes all Log_Debug calls.
+ * Set with the ADUC_MIN_COMPILED_LOG_LEVEL CMake cache variable.
+ */
+#ifndef ADUC_LOG_MIN_COMPILED_LEVEL
+#    define ADUC_LOG_MIN_COMPILED_LEVEL 0
+#endif
+
+/**
+ * @brief Compiles out a log call, keeping it in a dead branch so that its arguments are still checked and used.
+ */
+#define ADUC_LOG_COMPILED_OUT(logger, ...) \
+    do                                     \
+    {                                      \
+        if (0)                             \
+        {                                  \
+            logger(__VA_ARGS__);           \
+        }                                  \
+    } while (0)
+
 #if ADUC_USE_ZLOGGING
 
 #    include "zlog.h"
@@ -45,17 +65,29 @@ ADUC_LOG_SEVERITY ADUC_Logging_GetLevel();
 /**
  * @brief Detailed informational events that are useful to debug an application.
  */
-#    define Log_Debug log_debug
+#    if ADUC_LOG_MIN_COMPILED_LEVEL > 0
+#        define Log_Debug(...) ADUC_LOG_COMPILED_OUT(log_debug, __VA_ARGS__)
+#    else
+#        define Log_Debug log_debug
+#    endif
 
 /**
  * @brief Informational events that report the general progress of the application.
  */
-#    define Log_Info log_info
+#    if ADUC_LOG_MIN_COMPILED_LEVEL > 1
+#        define Log_Info(...) ADUC_LOG_COMPILED_OUT(log_info, __VA_ARGS__)
+#    else
+#        define Log_Info log_info
+#    endif
 
 /**
  * @brief Informational events about potentially harmful situations.
  */
-#    define Log_Warn log_warn
+#    if ADUC_LOG_MIN_COMPILED_LEVEL > 2
+#        define Log_Warn(...) ADUC_LOG_COMPILED_OUT(log_warn, __VA_ARGS__)
+#    else
+#        define Log_Warn log_warn
+#    endif
 
 /**
  * @brief Error events.
@@ -67,6 +99,31 @@ ADUC_LOG_SEVERITY ADUC_Logging_GetLevel();
  */
 #    define Log_RequestFlush zlog_request_flush_buffer
 
+/*
+ * @brief The number of times a log line waited for room in the full log buffer.
+ */
+#    define Log_GetRingFullWaitCount zlog_get_ring_full_wait_count
+
+/*
+ * @brief The number of log lines dropped by the rate limits of their call site, or collapsed as repeats.
+ */
+#    define Log_GetSuppressedLineCount zlog_get_suppressed_line_count
+
+/*
+ * @brief Sets the workflow id and step of the lines logged from now on, NULL to clear them.
+ */
+#    define Log_SetContext zlog_set_context
+
+/*
+ * @brief Also writes the lines of a workflow to a bounded gzip file, returning 0 on success; see zlog_start_capture.
+ */
+#    define Log_StartCapture zlog_start_capture
+
+/*
+ * @brief Stops the capture of Log_StartCapture.
+ */
+#    define Log_StopCapture zlog_stop_capture
+
 #elif ADUC_USE_XLOGGING
 
 #    include <azure_c_shared_utility/xlogging.h>
@@ -82,18 +139,30 @@ ADUC_LOG_SEVERITY ADUC_Logging_GetLevel();
  * @remark Since XLogging doesn't implement debug category for logging, this will
  *         be mapped to LogInfo.
  */
-#    define Log_Debug LogInfo
+#    if ADUC_LOG_MIN_COMPILED_LEVEL > 0
+#        define Log_Debug(...) ADUC_LOG_COMPILED_OUT(LogInfo, __VA_ARGS__)
+#    else
+#        define Log_Debug LogInfo
+#    endif
 
 /**
  * @brief Informational events that report the general progress of the application.
  */
-#    define Log_Info LogInfo
+#    if ADUC_LOG_MIN_COMPILED_LEVEL > 1
+#        define Log_Info(...) ADUC_LOG_COMPILED_OUT(LogInfo, __VA_ARGS__)
+#    else
+#        define Log_Info LogInfo
+#    endif
 
 /**
  * @brief Informational events about potentially harmful situations.
  * XLogging doesn't have a warn level, so use info instead.
  */
-#    define Log_Warn LogInfo
+#    if ADUC_LOG_MIN_COMPILED_LEVEL > 2
+#        define Log_Warn(...) ADUC_LOG_COMPILED_OUT(LogInfo, __VA_ARGS__)
+#    else
+#        define Log_Warn LogInfo
+#    endif
 
 /**
  * @brief Error events.
@@ -105,6 +174,31 @@ ADUC_LOG_SEVERITY ADUC_Logging_GetLevel();
  */
 #    define Log_RequestFlush(...)
 
+/*
+ * @brief The number of times a log line waited for room in the full log buffer.
+ */
+#    define Log_GetRingFullWaitCount() (0)
+
+/*
+ * @brief The number of log lines dropped by the rate limits of their call site, or collapsed as repeats.
+ */
+#    define Log_GetSuppressedLineCount() (0)
+
+/*
+ * @brief Sets the workflow id and step of the lines logged from now on, NULL to clear them.
+ */
+#    define Log_SetContext(...)
+
+/*
+ * @brief Also writes the lines of a workflow to a bounded gzip file, returning 0 on success.
+ */
+#    define Log_StartCapture(...) (-1)
+
+/*
+ * @brief Stops the capture of Log_StartCapture.
+ */
+#    define Log_StopCapture(...)
+
 #else
 
 #    error "Unknown logger or logging type specified."
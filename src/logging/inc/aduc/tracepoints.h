@@ -0,0 +1,51 @@
+/**
+ * @file tracepoints.h
+ * @brief Static tracepoints (USDT probes) on the hot paths of the agent, for perf, bpftrace and LTTng.
+ *
+ * The tracepoints are compiled out unless the agent is built with -DADUC_ENABLE_TRACEPOINTS=ON, which requires
+ * sys/sdt.h, e.g. from systemtap-sdt-dev. Once compiled in, a tracepoint is a nop until a tracer attaches to it.
+ * Their arguments aren't evaluated when compiled out, so they must not have side effects.
+ *
+ * The tracepoints are in the "aduc" provider:
+ *   workflow_state(int previousState, int newState, const char* workflowId)
+ *   download_start(const char* fileName, long long sizeBytes)
+ *   download_end(const char* fileName, long long sizeBytes, int resultCode)
+ *   hash_start(const char* path)
+ *   hash_end(const char* path, int succeeded)
+ *   process_spawn(const char* command, int pid)
+ *   process_exit(int pid, int exitStatus)
+ *   twin_report_send(size_t sizeBytes)
+ *   twin_report_ack(int statusCode)
+ *   log_flush(size_t sizeBytes)
+ *
+ * e.g.
+ *   bpftrace -e 'usdt:/usr/bin/AducIotAgent:aduc:download_end { printf("%s %d\n", str(arg0), arg1); }'
+ *   perf buildid-cache --add /usr/bin/AducIotAgent && perf record -e sdt_aduc:workflow_state -a
+ *   lttng enable-event --userspace-probe=sdt:/usr/bin/AducIotAgent:aduc:hash_end hash_end
+ * Tracepoints in handler and downloader extensions are in the extension's shared library.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_TRACEPOINTS_H
+#define ADUC_TRACEPOINTS_H
+
+#ifdef ADUC_ENABLE_TRACEPOINTS
+
+#    include <sys/sdt.h>
+
+#    define ADUC_TRACEPOINT0(name) DTRACE_PROBE(aduc, name)
+#    define ADUC_TRACEPOINT1(name, arg1) DTRACE_PROBE1(aduc, name, arg1)
+#    define ADUC_TRACEPOINT2(name, arg1, arg2) DTRACE_PROBE2(aduc, name, arg1, arg2)
+#    define ADUC_TRACEPOINT3(name, arg1, arg2, arg3) DTRACE_PROBE3(aduc, name, arg1, arg2, arg3)
+
+#else
+
+#    define ADUC_TRACEPOINT0(name) ((void)0)
+#    define ADUC_TRACEPOINT1(name, arg1) ((void)0)
+#    define ADUC_TRACEPOINT2(name, arg1, arg2) ((void)0)
+#    define ADUC_TRACEPOINT3(name, arg1, arg2, arg3) ((void)0)
+
+#endif // ADUC_ENABLE_TRACEPOINTS
+
+#endif // ADUC_TRACEPOINTS_H
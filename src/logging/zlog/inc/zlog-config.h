@@ -15,18 +15,54 @@
 // enabling this will slow down the log
 // #define ZLOG_FORCE_FLUSH_BUFFER
 
+// Lines that only go to the log file are added to the buffer as their arguments, and formatted by the flush thread.
+// Set with the ZLOG_DEFERRED_FORMATTING CMake option.
+// #define ZLOG_DEFERRED_FORMATTING
+
+// Maximum length of a log line, including the timestamp and function name.
 #define ZLOG_BUFFER_LINE_MAXCHARS 3000
-#define ZLOG_BUFFER_MAXLINES 1024
 
+// Default size in bytes of the ring buffer holding log lines until they're written to the file,
+// when zlog_init is passed 0. Lines logged while it is full wait for the flush thread to make room.
+#ifndef ZLOG_BUFFER_SIZE_BYTES
+#    define ZLOG_BUFFER_SIZE_BYTES (64 * 1024)
+#endif
+
+// Buffered lines are flushed at most this many seconds after they're logged.
 #define ZLOG_FLUSH_INTERVAL_SEC 30
-#define ZLOG_SLEEP_TIME_SEC 10
-// In practice: flush size < .8 * BUFFER_SIZE
-#define ZLOG_BUFFER_FLUSH_MAXLINES (0.8 * ZLOG_BUFFER_MAXLINES)
+// The flush thread is woken up once the buffer is this full.
+#define ZLOG_BUFFER_FLUSH_PERCENT 80
 
-// Maximum number of log files to keep
-#define ZLOG_MAX_FILE_COUNT 3
+// Maximum size in KB of all log files together, most of which are gzip-compressed.
+// The oldest compressed files are deleted to stay within it.
+#ifndef ZLOG_MAX_TOTAL_SIZE_KB
+#    define ZLOG_MAX_TOTAL_SIZE_KB 150
+#endif
 
 // Maximum size in KB per logfile.
 #define ZLOG_FILE_MAX_SIZE_KB 50
 
+// Default lines each call site may log per ZLOG_RATE_LIMIT_INTERVAL_SEC at each level, 0 for no limit.
+// The lines over it are dropped, and their number logged once the site may log again. See zlog_set_rate_limit.
+#define ZLOG_RATE_LIMIT_INTERVAL_SEC 60
+#define ZLOG_RATE_LIMIT_LINES_DEBUG 200
+#define ZLOG_RATE_LIMIT_LINES_INFO 100
+#define ZLOG_RATE_LIMIT_LINES_WARN 50
+#define ZLOG_RATE_LIMIT_LINES_ERROR 50
+
+// Number of call sites whose rate is tracked at once; sites sharing a slot take turns, which resets their counts.
+#define ZLOG_RATE_LIMIT_CALL_SITES 128
+
+// While a line keeps being repeated, the number of repeats is logged at most this often.
+#define ZLOG_REPEAT_REPORT_INTERVAL_SEC 30
+
+// With ZLOG_JOURNALD, lines go to the journal instead of log files when its socket is writable.
+// Set with the ZLOG_JOURNALD CMake option.
+// #define ZLOG_JOURNALD
+#define ZLOG_JOURNAL_SOCKET_PATH "/run/systemd/journal/socket"
+
+// Maximum length of the workflow id and step fields of journal entries, and of the workflow id of the capture,
+// including the terminating null.
+#define ZLOG_CONTEXT_FIELD_MAXCHARS 128
+
 #endif // ZLOG_CONFIG_H
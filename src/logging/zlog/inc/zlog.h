@@ -11,6 +11,8 @@
 #ifndef ZLOG_H
 #define ZLOG_H
 
+#include <stddef.h> // for size_t
+
 #define ZLOG_ENABLED 0
 #define ZLOG_DISABLED 1
 
@@ -24,11 +26,13 @@ enum ZLOG_SEVERITY
 };
 
 // Start API
+// The level is checked before the arguments are evaluated, so filtered out calls cost a compare.
 // clang-format off
-#define log_debug(...) zlog_log(ZLOG_DEBUG, __FUNCTION__, __VA_ARGS__) // NOLINT(misc-lambda-function-name)
-#define log_info(...)  zlog_log(ZLOG_INFO, __FUNCTION__, __VA_ARGS__) // NOLINT(misc-lambda-function-name)
-#define log_warn(...)  zlog_log(ZLOG_WARN, __FUNCTION__, __VA_ARGS__) // NOLINT(misc-lambda-function-name)
-#define log_error(...) zlog_log(ZLOG_ERROR, __FUNCTION__, __VA_ARGS__) // NOLINT(misc-lambda-function-name)
+#define ZLOG_LOG_IF_ENABLED(level, ...) (((level) >= zlog_min_level) ? zlog_log((level), __FUNCTION__, __VA_ARGS__) : (void)0) // NOLINT(misc-lambda-function-name)
+#define log_debug(...) ZLOG_LOG_IF_ENABLED(ZLOG_DEBUG, __VA_ARGS__)
+#define log_info(...)  ZLOG_LOG_IF_ENABLED(ZLOG_INFO, __VA_ARGS__)
+#define log_warn(...)  ZLOG_LOG_IF_ENABLED(ZLOG_WARN, __VA_ARGS__)
+#define log_error(...) ZLOG_LOG_IF_ENABLED(ZLOG_ERROR, __VA_ARGS__)
 // clang-format on
 
 #ifdef __cplusplus
@@ -43,22 +47,50 @@ enum ZLOG_SEVERITY
 
 EXTERN_C_BEGIN
 
+// lowest severity that goes to the console or the file, set by zlog_init
+extern int zlog_min_level;
+
 // initialize zlog log settings
+// buffer_size is the size in bytes of the file log buffer, or 0 for ZLOG_BUFFER_SIZE_BYTES, rounded up to a power
+// of two; it's allocated by the first call that enables file logging, and later calls reuse it
 int zlog_init(
     const char* log_dir,
     const char* log_file,
     int console_enable,
     int file_enable,
     enum ZLOG_SEVERITY console_level,
-    enum ZLOG_SEVERITY file_level);
+    enum ZLOG_SEVERITY file_level,
+    size_t buffer_size);
 // finish using the zlog; clean up
 void zlog_finish(void);
 // explicitly flush the buffer in memory
 void zlog_flush_buffer(void);
 // request to flush the buffer.
 void zlog_request_flush_buffer(void);
+// the number of times a log line waited for the flush thread to make room in the full buffer.
+// lines are never dropped, they wait instead.
+unsigned long long zlog_get_ring_full_wait_count(void);
 // log an entry with the function scope and timestamp
+// each call site, i.e. fmt, may log a number of lines per interval, see zlog_set_rate_limit;
+// consecutive repeats of a line are collapsed into a "Last message repeated N times" line
 void zlog_log(enum ZLOG_SEVERITY msg_level, const char* func, const char* fmt, ...);
+// limits each call site to lines per interval_sec seconds at level, 0 lines for no limit
+// defaults to ZLOG_RATE_LIMIT_LINES_* per ZLOG_RATE_LIMIT_INTERVAL_SEC, see zlog-config.h
+void zlog_set_rate_limit(enum ZLOG_SEVERITY level, unsigned int lines, unsigned int interval_sec);
+// whether consecutive repeats of a line at level are collapsed, the default
+void zlog_set_collapse_repeats(enum ZLOG_SEVERITY level, int enable);
+// the number of lines dropped by the rate limits or collapsed as repeats
+unsigned long long zlog_get_suppressed_line_count(void);
+// sets the workflow id and step of the lines logged from now on, NULL to clear them
+// they're the ADUC_WORKFLOW_ID and ADUC_STEP fields of journal entries, see ZLOG_JOURNALD
+void zlog_set_context(const char* workflow_id, const char* step);
+// also writes the lines of the workflow workflow_id, i.e. logged while zlog_set_context sets it, at the level of the
+// log file to the gzip file filepath, until it holds about max_bytes; a file left by a previous run is appended to.
+// replaces the capture of another workflow or file, and does nothing if this one is already captured
+// returns 0 on success
+int zlog_start_capture(const char* workflow_id, const char* filepath, size_t max_bytes);
+// stops the capture, and closes its file
+void zlog_stop_capture(void);
 
 // End API
 
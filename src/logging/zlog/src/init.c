@@ -69,13 +69,23 @@ void ADUC_Logging_Init(ADUC_LOG_SEVERITY logLevel, const char* filePrefix)
     // If it can't be created, zlogging will send output to console.
     (void)mkdir(ADUC_LOG_FOLDER, S_IRWXU);
 
+    enum ZLOG_SEVERITY consoleLevel = AducLogSeverityToZLogLevel(logLevel);
+#ifdef ZLOG_DEFERRED_FORMATTING
+    // Leave debug lines to the file only, where their formatting is deferred to the flush thread.
+    if (consoleLevel < ZLOG_INFO)
+    {
+        consoleLevel = ZLOG_INFO;
+    }
+#endif
+
     if (zlog_init(
             ADUC_LOG_FOLDER,
             filePrefix == NULL ? "aduc" : filePrefix,
             ZLOG_ENABLED /* enable console logging*/,
             ZLOG_ENABLED /* enable file logging*/,
-            AducLogSeverityToZLogLevel(logLevel) /* set console log level*/,
-            AducLogSeverityToZLogLevel(logLevel) /* set file log level*/
+            consoleLevel /* set console log level*/,
+            AducLogSeverityToZLogLevel(logLevel) /* set file log level*/,
+            0 /* default file log buffer size */
             )
         != 0)
     {
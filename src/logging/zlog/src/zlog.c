@@ -13,6 +13,7 @@
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> // for strcmp, memset, strlen, etc.
@@ -21,9 +22,18 @@
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h> // isatty
+#include <zlib.h>
 
+#ifdef ZLOG_JOURNALD
+#    include <sys/uio.h> // for struct iovec
+#    include <systemd/sd-journal.h>
+#endif
+
+#include "aduc/cpu_affinity_utils.h"
+#include "aduc/tracepoints.h"
 #include "zlog-config.h"
 #include "zlog.h"
+#include "zlog_args.h"
 
 typedef enum tagCONSOLE_LOGGING_MODE
 {
@@ -44,16 +54,124 @@ static struct
 
 static const char level_names[] = { 'D', 'I', 'W', 'E' }; // Must align with ZLOG_SEVERITY enum in zlog.h
 
+int zlog_min_level = ZLOG_DEBUG;
+
 static FILE* zlog_fout = NULL;
 static char* zlog_file_log_dir = NULL;
 static char* zlog_file_log_prefix = NULL;
 
-char _zlog_buffer[ZLOG_BUFFER_MAXLINES][ZLOG_BUFFER_LINE_MAXCHARS];
-static int _zlog_buffer_count = 0;
+// Log lines wait for the flush thread in a multi-producer, single-consumer ring of variable-length records.
+// Each record is a 4-byte header, holding the line length and ZLOG_RECORD_COMMITTED once the line is written,
+// followed by the line, padded to 8 bytes. Positions only grow, wrapping around at SIZE_MAX; _zlog_ring_size is a
+// power of two, so that masking a position with _zlog_ring_mask gives its ring offset even after it wrapped.
+// Producers reserve records with a CAS on _zlog_ring_head without taking a lock; only when the ring is full do they
+// wait on _zlog_space_cond for the flush thread to make room, so that lines are never dropped.
+// The consumer holds _zlog_buffer_mutex, writes committed records in order, zeroes them so that stale bytes are
+// never mistaken for a header, and then releases the space by advancing _zlog_ring_tail.
+// With ZLOG_DEFERRED_FORMATTING, records flagged ZLOG_RECORD_DEFERRED hold what the consumer needs to format the
+// line itself instead: the time, the level, the function and the arguments captured by zlog_args_capture.
+#define ZLOG_RECORD_HEADER_SIZE sizeof(uint32_t)
+#define ZLOG_RECORD_COMMITTED 0x80000000u
+#define ZLOG_RECORD_DEFERRED 0x40000000u
+#define ZLOG_RECORD_LENGTH_MASK 0x3fffffffu
+#define ZLOG_RECORD_SIZE(line_len) ((ZLOG_RECORD_HEADER_SIZE + (line_len) + 7) & ~(size_t)7)
+
+// Allocated by the first zlog_init that enables file logging, and kept for the life of the process
+// since other threads may still be logging when zlog_finish is called.
+static char* _zlog_ring = NULL;
+static size_t _zlog_ring_size = 0;
+static size_t _zlog_ring_mask = 0; // _zlog_ring_size - 1
+static size_t _zlog_ring_head = 0;
+static size_t _zlog_ring_tail = 0;
 static pthread_mutex_t _zlog_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_t _zlog_flush_thread;
 static _Bool _is_flush_thread_initialized = false;
 
+// The flush thread sleeps on _zlog_flush_cond; producers signal it when the buffer goes from empty to non-empty,
+// crosses the flush size or is full, and when a flush is requested. Everything below is protected by
+// _zlog_flush_mutex, which is never held while writing to the file.
+static pthread_mutex_t _zlog_flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _zlog_flush_cond; // Initialized by the first zlog_init_flush_thread, and never destroyed
+static _Bool _zlog_flush_cond_initialized = false;
+static pthread_cond_t _zlog_space_cond = PTHREAD_COND_INITIALIZER;
+static _Bool _zlog_flush_requested = false;
+static _Bool _zlog_flush_thread_stop = false;
+static unsigned int _zlog_flush_count = 0; // Incremented after each flush by the flush thread
+static unsigned long long _zlog_ring_full_wait_count = 0; // Incremented atomically by zlog_wait_for_space
+
+// Log files closed by a rollover are gzip-compressed on their own thread, which then deletes the oldest compressed
+// files until all log files fit in ZLOG_MAX_TOTAL_SIZE_KB. Everything below is protected by _zlog_compress_mutex.
+static pthread_mutex_t _zlog_compress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _zlog_compress_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t _zlog_compress_thread;
+static _Bool _is_compress_thread_initialized = false;
+static _Bool _zlog_compress_requested = false;
+static _Bool _zlog_compress_thread_stop = false;
+static char _zlog_current_log_name[256]; // File name of zlog_fout, which is never compressed nor deleted
+
+// Each call site, i.e. format string, may log ZLOG_SEVERITY-dependent lines per interval; the lines over it are
+// dropped and counted. Consecutive repeats of a line are dropped and counted too.
+// Everything below is protected by _zlog_limit_mutex.
+typedef struct tagZLOG_RATE_LIMIT
+{
+    unsigned int lines; // Lines per interval of each call site, or 0 for no limit
+    unsigned int interval_sec;
+    _Bool collapse_repeats;
+} ZLOG_RATE_LIMIT;
+
+typedef struct tagZLOG_CALL_SITE
+{
+    const char* fmt; // The format string of the call site, NULL for a free slot
+    const char* func;
+    enum ZLOG_SEVERITY level;
+    time_t window_start; // Monotonic seconds the current interval started at
+    unsigned int lines; // Lines logged in the current interval
+    unsigned int suppressed; // Lines dropped in the current interval
+} ZLOG_CALL_SITE;
+
+static pthread_mutex_t _zlog_limit_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Must align with ZLOG_SEVERITY enum in zlog.h
+static ZLOG_RATE_LIMIT _zlog_rate_limits[] = {
+    { ZLOG_RATE_LIMIT_LINES_DEBUG, ZLOG_RATE_LIMIT_INTERVAL_SEC, true },
+    { ZLOG_RATE_LIMIT_LINES_INFO, ZLOG_RATE_LIMIT_INTERVAL_SEC, true },
+    { ZLOG_RATE_LIMIT_LINES_WARN, ZLOG_RATE_LIMIT_INTERVAL_SEC, true },
+    { ZLOG_RATE_LIMIT_LINES_ERROR, ZLOG_RATE_LIMIT_INTERVAL_SEC, true },
+};
+static ZLOG_CALL_SITE _zlog_call_sites[ZLOG_RATE_LIMIT_CALL_SITES];
+static struct
+{
+    const char* fmt;
+    const char* func;
+    enum ZLOG_SEVERITY level;
+    uint64_t hash; // Of the formatted line, or of its captured arguments when its formatting is deferred
+    unsigned int repeats; // Repeats dropped since the line, or the last note about its repeats, was written
+    time_t reported_time;
+} _zlog_last_line;
+static unsigned long long _zlog_suppressed_line_count = 0;
+
+#ifdef ZLOG_JOURNALD
+// Set by zlog_init when lines go to the journal instead of the log file.
+static _Bool _zlog_journal_enabled = false;
+static char _zlog_journal_identifier[64]; // SYSLOG_IDENTIFIER of the entries, the log file prefix
+
+// The workflow and step lines are logged for, added to the journal entries as fields.
+// Protected by _zlog_context_mutex.
+static pthread_mutex_t _zlog_context_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char _zlog_context_workflow_id[ZLOG_CONTEXT_FIELD_MAXCHARS];
+static char _zlog_context_step[ZLOG_CONTEXT_FIELD_MAXCHARS];
+#endif
+
+// The lines logged for one workflow, i.e. while zlog_set_context sets its id, are also written to a gzip file, the
+// capture, until it holds about the size given to zlog_start_capture.
+// Protected by _zlog_capture_mutex; _zlog_capture_tagged is also read without it, to skip the lock for other lines.
+static pthread_mutex_t _zlog_capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+static gzFile _zlog_capture_file = NULL;
+static char _zlog_capture_filepath[512];
+static char _zlog_capture_workflow_id[ZLOG_CONTEXT_FIELD_MAXCHARS]; // The workflow of the capture
+static char _zlog_capture_context_id[ZLOG_CONTEXT_FIELD_MAXCHARS]; // The workflow of the lines logged now
+static size_t _zlog_capture_bytes_left = 0;
+static _Bool _zlog_capture_tagged = false; // Whether the lines logged now go to the capture
+
 void zlog_init_flush_thread(void);
 void zlog_stop_flush_thread(void);
 struct tm* get_current_utctime();
@@ -61,15 +179,38 @@ _Bool get_current_utctime_filename(char* fullpath, size_t fullpath_len);
 static inline void _zlog_buffer_lock(void);
 static inline void _zlog_buffer_unlock(void);
 static void _zlog_flush_buffer(void);
-static inline char* zlog_lock_and_get_buffer(void);
-static inline void zlog_finish_buffer_and_unlock(void);
-void zlog_ensure_at_most_n_logfiles(int max_num);
+static _Bool zlog_buffer_init(size_t buffer_size);
+static size_t zlog_buffer_flush_size(void);
+static void zlog_buffer_append(const char* line, size_t line_len, uint32_t flags);
+static void zlog_wake_flush_thread(_Bool flush_now);
+static void zlog_wait_for_space(void);
+static void zlog_init_compress_thread(void);
+static void zlog_stop_compress_thread(void);
+static void zlog_set_current_log_file(const char* fullpath);
+static void zlog_compress_log_files(const char* current_log_name);
+static void zlog_write_pending_notes(void);
+static void zlog_capture_append(const char* line, size_t line_len);
+static void zlog_capture_flush(void);
 
 static _Bool zlog_is_file_log_open()
 {
     return zlog_fout != NULL;
 }
 
+static _Bool zlog_is_journal_enabled()
+{
+#ifdef ZLOG_JOURNALD
+    return _zlog_journal_enabled;
+#else
+    return false;
+#endif
+}
+
+static _Bool zlog_is_capture_tagged()
+{
+    return __atomic_load_n(&_zlog_capture_tagged, __ATOMIC_RELAXED);
+}
+
 static void zlog_close_file_log()
 {
     if (zlog_is_file_log_open())
@@ -122,7 +263,8 @@ int zlog_init(
     int console_enable,
     int file_enable,
     enum ZLOG_SEVERITY console_level,
-    enum ZLOG_SEVERITY file_level)
+    enum ZLOG_SEVERITY file_level,
+    size_t buffer_size)
 {
     memset(&log_setting, 0, sizeof(log_setting));
     log_setting.console_level = console_level;
@@ -146,9 +288,36 @@ int zlog_init(
         }
     }
 
+#ifdef ZLOG_JOURNALD
+    // On systemd devices, lines go to the journal rather than to log files: it stores, rotates and rate limits them
+    // out of the process, and can query them by their fields, e.g. ADUC_WORKFLOW_ID.
+    _zlog_journal_enabled = file_enable == ZLOG_ENABLED && access(ZLOG_JOURNAL_SOCKET_PATH, W_OK) == 0;
+    if (_zlog_journal_enabled)
+    {
+        snprintf(_zlog_journal_identifier, sizeof(_zlog_journal_identifier), "%s", log_file);
+
+        // A service's stdout goes to the journal too, so only keep the console when it's a terminal.
+        if (console_logging_mode == ZLOG_CLM_ENABLED)
+        {
+            console_logging_mode = ZLOG_CLM_DISABLED;
+        }
+    }
+#endif
+
     log_setting.console_logging_mode = console_logging_mode;
 
-    if (file_enable == ZLOG_ENABLED)
+    // Lets the log_* macros skip lines that neither the console nor the file want.
+    zlog_min_level = ZLOG_ERROR + 1;
+    if (console_logging_mode != ZLOG_CLM_DISABLED && console_level < zlog_min_level)
+    {
+        zlog_min_level = console_level;
+    }
+    if (file_enable == ZLOG_ENABLED && file_level < zlog_min_level)
+    {
+        zlog_min_level = file_level;
+    }
+
+    if (file_enable == ZLOG_ENABLED && !zlog_is_journal_enabled())
     {
         zlog_file_log_dir = (char*)malloc(strlen(log_dir) + 1);
         if (zlog_file_log_dir == NULL)
@@ -173,6 +342,11 @@ int zlog_init(
             return -1;
         }
 
+        if (!zlog_buffer_init(buffer_size))
+        {
+            return -1;
+        }
+
         zlog_fout = fopen(zlog_file_log_fullpath, "a+");
         if (zlog_fout == NULL)
         {
@@ -180,7 +354,9 @@ int zlog_init(
         }
         log_debug("Log file created: %s", zlog_file_log_fullpath);
 
-        zlog_ensure_at_most_n_logfiles(ZLOG_MAX_FILE_COUNT);
+        // Compresses the files left by previous runs, and keeps the log folder within budget.
+        zlog_init_compress_thread();
+        zlog_set_current_log_file(zlog_file_log_fullpath);
 
 #ifndef ZLOG_FORCE_FLUSH_BUFFER
         zlog_init_flush_thread();
@@ -195,326 +371,1384 @@ void zlog_flush_buffer(void)
     _zlog_buffer_lock();
     _zlog_flush_buffer();
     _zlog_buffer_unlock();
+
+    zlog_capture_flush();
 }
 
 // Caller should NOT hold the lock
 void zlog_finish(void)
 {
+    zlog_write_pending_notes();
+
 #ifndef ZLOG_FORCE_FLUSH_BUFFER
     zlog_stop_flush_thread();
 #endif
     zlog_flush_buffer();
 
     zlog_close_file_log();
+    zlog_stop_capture();
+
+    // The current log file is compressed by the next zlog_init.
+    zlog_stop_compress_thread();
 
     free(zlog_file_log_dir);
     free(zlog_file_log_prefix);
 }
 
-void zlog_log(enum ZLOG_SEVERITY msg_level, const char* func, const char* fmt, ...)
+// The "2020-07-01T18:21:26." part of the time of the thread's last log line, which only changes once a second.
+#define ZLOG_TIME_PREFIX_LEN (sizeof("2020-07-01T18:21:26.") - 1)
+static __thread time_t _zlog_time_prefix_seconds = (time_t)-1;
+static __thread char _zlog_time_prefix[ZLOG_TIME_PREFIX_LEN + 1];
+
+// Formats a time, e.g. 2020-07-01T18:21:26.1234Z
+// Returns false on failure
+static _Bool zlog_format_time(const struct timespec* curtime, char* time_buffer, size_t time_buffer_len)
 {
-    const _Bool console_log_needed =
-        (log_setting.console_logging_mode != ZLOG_CLM_DISABLED) && (msg_level >= log_setting.console_level);
-    const _Bool file_log_needed = zlog_is_file_log_open() && (msg_level >= log_setting.file_level);
+    time_buffer[0] = '\0';
 
-    if (!console_log_needed && !file_log_needed)
+    if (time_buffer_len < sizeof("2020-07-01T18:21:26.1234Z"))
     {
-        // If we're not logging to console or file, there's nothing to do.
-        return;
+        return false;
     }
 
-    char time_buffer[sizeof("2020-07-01T18:21:26.1234Z")];
-    time_buffer[0] = '\0';
-
-    struct timespec curtime;
-    clock_gettime(CLOCK_REALTIME, &curtime);
+    const time_t seconds = curtime->tv_sec;
 
-    const time_t seconds = curtime.tv_sec;
+    if (seconds != _zlog_time_prefix_seconds)
+    {
+        struct tm gmtval;
+        struct tm* tmval = gmtime_r(&seconds, &gmtval);
 
-    struct tm gmtval;
-    struct tm* tmval = gmtime_r(&seconds, &gmtval);
+        if (tmval == NULL)
+        {
+            return true;
+        }
 
-    if (tmval != NULL)
-    {
         // % 100 below to ensure the values fit in 2-digits template.
         int ret = snprintf(
-            time_buffer,
-            sizeof(time_buffer),
-            "%04d-%02d-%02dT%02d:%02d:%02d.%04dZ",
+            _zlog_time_prefix,
+            sizeof(_zlog_time_prefix),
+            "%04d-%02d-%02dT%02d:%02d:%02d.",
             tmval->tm_year + 1900,
             tmval->tm_mon + 1,
             tmval->tm_mday % 100,
             tmval->tm_hour % 100,
             tmval->tm_min % 100,
-            tmval->tm_sec % 100,
-            (int)(curtime.tv_nsec / 100000));
+            tmval->tm_sec % 100);
 
-        if (ret < 0)
+        if (ret != ZLOG_TIME_PREFIX_LEN)
         {
-            return;
+            _zlog_time_prefix_seconds = (time_t)-1;
+            return false;
         }
+
+        _zlog_time_prefix_seconds = seconds;
     }
 
-    char va_buffer[ZLOG_BUFFER_LINE_MAXCHARS];
-    va_list va;
-    va_start(va, fmt);
-    vsnprintf(va_buffer, sizeof(va_buffer) / sizeof(va_buffer[0]), fmt, va);
-    va_end(va);
+    // Only the sub-second digits change from one line to the next.
+    int fraction = (int)(curtime->tv_nsec / 100000);
+    char* p = time_buffer + ZLOG_TIME_PREFIX_LEN;
 
-    if (console_log_needed)
-    {
-        // Output to console
+    memcpy(time_buffer, _zlog_time_prefix, ZLOG_TIME_PREFIX_LEN);
+    p[3] = (char)('0' + fraction % 10);
+    fraction /= 10;
+    p[2] = (char)('0' + fraction % 10);
+    fraction /= 10;
+    p[1] = (char)('0' + fraction % 10);
+    p[0] = (char)('0' + fraction / 10);
+    p[4] = 'Z';
+    p[5] = '\0';
 
-        const char* color_prefix;
-        const char* color_suffix;
+    return true;
+}
 
-        if (log_setting.console_logging_mode != ZLOG_CLM_ENABLED_TTYCOLOR)
-        {
-            color_prefix = "";
-            color_suffix = "";
-        }
-        else
-        {
-            // Use Bold Red for error, Bold Yellow for warn.
-            color_prefix = (msg_level == ZLOG_ERROR) ? "\033[1;31m" : (msg_level == ZLOG_WARN) ? "\033[1;33m" : "";
-            color_suffix = "\033[m";
-        }
+// Formats the current time, e.g. 2020-07-01T18:21:26.1234Z
+// Returns false on failure
+static _Bool zlog_format_current_time(char* time_buffer, size_t time_buffer_len)
+{
+    struct timespec curtime;
+    clock_gettime(CLOCK_REALTIME, &curtime);
 
-        fprintf(
-            msg_level == ZLOG_ERROR ? stderr : stdout,
-            "%s %s[%c]%s %s [%s]\n",
-            time_buffer,
-            color_prefix,
-            level_names[msg_level],
-            color_suffix,
-            va_buffer,
-            func);
+    return zlog_format_time(&curtime, time_buffer, time_buffer_len);
+}
+
+// "%.400s" avoids error: '%s' directive output may be truncated writing up to 511 bytes into
+// a region of size between 444 and 507 [-Werror=format-truncation=]
+#define ZLOG_FILE_LINE_FORMAT "%s [%c] %.400s [%s]\n"
+
+#ifdef ZLOG_DEFERRED_FORMATTING
+// Captures a line into record as its time, level, function and a copy of its arguments,
+// for the flush thread to format it
+// Sets *args_offset to the offset of the arguments, which are the same for the same line, in record
+// Returns the length of the record, or 0 if fmt can't be deferred, in which case the caller formats the line
+static size_t zlog_capture_deferred(
+    char* record,
+    size_t record_size,
+    size_t* args_offset,
+    enum ZLOG_SEVERITY msg_level,
+    const char* func,
+    const char* fmt,
+    va_list va)
+{
+    struct timespec curtime;
+    const size_t func_size = strlen(func) + 1;
+    const size_t prefix_len = sizeof(curtime) + 1 + func_size;
+
+    if (prefix_len >= record_size)
+    {
+        return 0;
     }
 
-    if (file_log_needed)
+    clock_gettime(CLOCK_REALTIME, &curtime);
+    memcpy(record, &curtime, sizeof(curtime));
+    record[sizeof(curtime)] = (char)msg_level;
+    memcpy(record + sizeof(curtime) + 1, func, func_size);
+
+    const size_t args_len = zlog_args_capture(record + prefix_len, record_size - prefix_len, fmt, va);
+    if (args_len == 0)
     {
-        // Add to zlog buffer.
-        char* buffer = zlog_lock_and_get_buffer();
+        return 0;
+    }
 
-        // "%.400s" avoids error: '%s' directive output may be truncated writing up to 511 bytes into
-        // a region of size between 444 and 507 [-Werror=format-truncation=]
-        (void)snprintf(
-            buffer,
-            ZLOG_BUFFER_LINE_MAXCHARS,
-            "%s [%c] %.400s [%s]\n",
-            time_buffer,
-            level_names[msg_level],
-            va_buffer,
-            func);
+    *args_offset = prefix_len;
+    return prefix_len + args_len;
+}
+
+// Formats the line of a record captured by zlog_capture_deferred
+// Returns the length of the line, or 0 if the record is malformed
+static size_t zlog_format_deferred_line(char* line, size_t line_size, const char* record, size_t record_len)
+{
+    struct timespec curtime;
+    char time_buffer[sizeof("2020-07-01T18:21:26.1234Z")];
+    char va_buffer[ZLOG_BUFFER_LINE_MAXCHARS];
+
+    if (record_len <= sizeof(curtime) + 1)
+    {
+        return 0;
+    }
 
-        zlog_finish_buffer_and_unlock();
+    memcpy(&curtime, record, sizeof(curtime));
+    const unsigned char msg_level = (unsigned char)record[sizeof(curtime)];
+    const char* func = record + sizeof(curtime) + 1;
+    const char* func_end = memchr(func, '\0', record_len - (sizeof(curtime) + 1));
+
+    if (msg_level >= sizeof(level_names) || func_end == NULL || !zlog_format_time(&curtime, time_buffer, sizeof(time_buffer)))
+    {
+        return 0;
     }
 
-    if (msg_level == ZLOG_ERROR)
+    zlog_args_format(va_buffer, sizeof(va_buffer), func_end + 1, (size_t)(record + record_len - (func_end + 1)));
+
+    const int line_len = snprintf(line, line_size, ZLOG_FILE_LINE_FORMAT, time_buffer, level_names[msg_level], va_buffer, func);
+    if (line_len <= 0)
     {
-        zlog_request_flush_buffer();
+        return 0;
     }
 
+    return ((size_t)line_len < line_size) ? (size_t)line_len : line_size - 1;
 }
+#endif
 
-bool g_flushRequested = false;
-
-void zlog_request_flush_buffer(void)
+// Returns the seconds of the monotonic clock, for the rate limits
+static time_t zlog_monotonic_seconds(void)
 {
-    g_flushRequested = true;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
 }
 
-// Buffer flushing thread
-// Flush the thread every ZLOG_FLUSH_INTERVAL_SEC seconds
-// or when buffer is 80% full
-// or when g_flushRequested is true
-//
-// Caller should NOT hold the lock
-static void* zlog_buffer_flush_thread()
+// FNV-1a hash of a line, to recognize its repeats
+static uint64_t zlog_hash(const char* data, size_t len)
 {
-    struct timeval tv;
-    time_t lasttime;
+    uint64_t hash = 0xcbf29ce484222325ull;
 
-    gettimeofday(&tv, NULL);
-    lasttime = tv.tv_sec;
-
-    do
+    for (size_t i = 0; i < len; ++i)
     {
-        time_t curtime;
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ull;
+    }
 
-        sleep(ZLOG_SLEEP_TIME_SEC);
-        gettimeofday(&tv, NULL);
-        curtime = tv.tv_sec;
-        if (g_flushRequested || ((curtime - lasttime) >= ZLOG_FLUSH_INTERVAL_SEC))
-        {
-            g_flushRequested = false;
-            zlog_flush_buffer();
-            lasttime = curtime;
-        }
-        else
-        {
-            _zlog_buffer_lock();
-            if (_zlog_buffer_count >= ZLOG_BUFFER_FLUSH_MAXLINES)
-            {
-                _zlog_flush_buffer();
-            }
-            _zlog_buffer_unlock();
-        }
-    } while (1);
-    return NULL;
+    return hash;
 }
 
-void zlog_init_flush_thread(void)
+static void zlog_write(enum ZLOG_SEVERITY msg_level, const char* func, const char* fmt, _Bool collapse, va_list va);
+
+#ifdef ZLOG_JOURNALD
+// Syslog priorities of the levels. Must align with ZLOG_SEVERITY enum in zlog.h
+static const char* const journal_priorities[] = { "PRIORITY=7", "PRIORITY=6", "PRIORITY=4", "PRIORITY=3" };
+
+// Formats the field name=value into buffer, truncated to fit, and adds it to fields
+static void zlog_journal_add_field(
+    struct iovec* fields, int* field_count, char* buffer, size_t buffer_size, const char* name, const char* value)
 {
-    if (pthread_create(&_zlog_flush_thread, NULL, zlog_buffer_flush_thread, NULL) == 0)
+    const int len = snprintf(buffer, buffer_size, "%s=%s", name, value);
+    if (len <= 0)
     {
-        _is_flush_thread_initialized = true;
+        return;
     }
+
+    fields[*field_count].iov_base = buffer;
+    fields[*field_count].iov_len = ((size_t)len < buffer_size) ? (size_t)len : buffer_size - 1;
+    ++*field_count;
 }
 
-// Caller should NOT hold the lock
-void zlog_stop_flush_thread(void)
+// Sends a line to the journal, with the function, and the workflow and step set by zlog_set_context
+static void zlog_journal_send(enum ZLOG_SEVERITY msg_level, const char* func, const char* message)
 {
-    // To prevent deadlock if flush thread calls zlog_flush_buffer but
-    // gets terminated before calling unlock
-    _zlog_buffer_lock();
-    if (_is_flush_thread_initialized)
+    char message_field[ZLOG_BUFFER_LINE_MAXCHARS + sizeof("MESSAGE=")];
+    char identifier_field[sizeof(_zlog_journal_identifier) + sizeof("SYSLOG_IDENTIFIER=")];
+    char func_field[128];
+    char workflow_id_field[ZLOG_CONTEXT_FIELD_MAXCHARS + sizeof("ADUC_WORKFLOW_ID=")];
+    char step_field[ZLOG_CONTEXT_FIELD_MAXCHARS + sizeof("ADUC_STEP=")];
+    struct iovec fields[6];
+    int field_count = 0;
+
+    zlog_journal_add_field(fields, &field_count, message_field, sizeof(message_field), "MESSAGE", message);
+
+    fields[field_count].iov_base = (void*)journal_priorities[msg_level];
+    fields[field_count].iov_len = strlen(journal_priorities[msg_level]);
+    ++field_count;
+
+    zlog_journal_add_field(
+        fields,
+        &field_count,
+        identifier_field,
+        sizeof(identifier_field),
+        "SYSLOG_IDENTIFIER",
+        _zlog_journal_identifier);
+    zlog_journal_add_field(fields, &field_count, func_field, sizeof(func_field), "CODE_FUNC", func);
+
+    pthread_mutex_lock(&_zlog_context_mutex);
+    if (_zlog_context_workflow_id[0] != '\0')
     {
-        pthread_cancel(_zlog_flush_thread);
-        pthread_join(_zlog_flush_thread, NULL);
-        _is_flush_thread_initialized = false;
+        zlog_journal_add_field(
+            fields,
+            &field_count,
+            workflow_id_field,
+            sizeof(workflow_id_field),
+            "ADUC_WORKFLOW_ID",
+            _zlog_context_workflow_id);
     }
-    _zlog_buffer_unlock();
-}
+    if (_zlog_context_step[0] != '\0')
+    {
+        zlog_journal_add_field(fields, &field_count, step_field, sizeof(step_field), "ADUC_STEP", _zlog_context_step);
+    }
+    pthread_mutex_unlock(&_zlog_context_mutex);
 
-// ------------------------- Helper Functions ---------------------------
-static int file_select(const struct dirent* logfile)
-{
-    // Filter: 1. File and 2. filename contains the log file pattern
-    return (logfile->d_type == DT_REG && strstr(logfile->d_name, zlog_file_log_prefix) != NULL);
+    (void)sd_journal_sendv(fields, field_count);
 }
+#endif
 
-static inline void _zlog_buffer_lock(void)
+void zlog_set_context(const char* workflow_id, const char* step)
 {
-    pthread_mutex_lock(&_zlog_buffer_mutex);
-}
+#ifdef ZLOG_JOURNALD
+    pthread_mutex_lock(&_zlog_context_mutex);
+    snprintf(
+        _zlog_context_workflow_id, sizeof(_zlog_context_workflow_id), "%s", workflow_id != NULL ? workflow_id : "");
+    snprintf(_zlog_context_step, sizeof(_zlog_context_step), "%s", step != NULL ? step : "");
+    pthread_mutex_unlock(&_zlog_context_mutex);
+#else
+    (void)step;
+#endif
 
-static inline void _zlog_buffer_unlock(void)
-{
-    pthread_mutex_unlock(&_zlog_buffer_mutex);
+    pthread_mutex_lock(&_zlog_capture_mutex);
+    snprintf(
+        _zlog_capture_context_id, sizeof(_zlog_capture_context_id), "%s", workflow_id != NULL ? workflow_id : "");
+    __atomic_store_n(
+        &_zlog_capture_tagged,
+        _zlog_capture_file != NULL && strcmp(_zlog_capture_context_id, _zlog_capture_workflow_id) == 0,
+        __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&_zlog_capture_mutex);
 }
 
-_Bool get_current_utctime_filename(char* fullpath, size_t fullpath_len)
+int zlog_start_capture(const char* workflow_id, const char* filepath, size_t max_bytes)
 {
-    // Timestamp the log file
-    char timebuf[sizeof("20200819-19181597864683")];
-    const time_t current_time = time(NULL);
-    const struct tm* tm = gmtime(&current_time);
+    int result = -1;
+    struct stat st;
 
-    strftime(timebuf, sizeof(timebuf), "%Y%m%d-%H%M%S", tm);
-    int res = snprintf(fullpath, fullpath_len, "%s/%s%s.log", zlog_file_log_dir, zlog_file_log_prefix, timebuf);
-    if (res < 0 || res >= fullpath_len)
+    if (workflow_id == NULL || *workflow_id == '\0' || filepath == NULL
+        || strlen(filepath) >= sizeof(_zlog_capture_filepath))
     {
-        // When error occurs to snprintf filepath, return false
-        return false;
+        return -1;
     }
-    return true;
-}
 
-// Caller should hold the lock
-static void _zlog_flush_buffer()
-{
-    if (!zlog_is_file_log_open())
+    pthread_mutex_lock(&_zlog_capture_mutex);
+
+    if (_zlog_capture_file != NULL && strcmp(_zlog_capture_workflow_id, workflow_id) == 0
+        && strcmp(_zlog_capture_filepath, filepath) == 0)
     {
-        return;
+        // Already capturing this workflow.
+        result = 0;
+        goto done;
     }
 
-    // Flush buffer to file
-    int i = 0;
-    for (i = 0; i < _zlog_buffer_count; i++)
+    if (_zlog_capture_file != NULL)
     {
-        fputs(_zlog_buffer[i], zlog_fout);
+        gzclose(_zlog_capture_file);
+        _zlog_capture_file = NULL;
     }
-    fflush(zlog_fout);
 
-    _zlog_buffer_count = 0;
+    // Appends a gzip member to the capture of a previous run, e.g. before the reboot of the apply; gzip tools read
+    // the members as one stream. What the file already holds counts against max_bytes.
+    const size_t existing_bytes = (stat(filepath, &st) == 0) ? (size_t)st.st_size : 0;
 
-    // Roll over to new log file once the current file size exceeds the limit
-    if (ftell(zlog_fout) > (ZLOG_FILE_MAX_SIZE_KB * 1024))
+    _zlog_capture_file = gzopen(filepath, "ab");
+    if (_zlog_capture_file == NULL)
     {
-        zlog_close_file_log();
+        goto done;
+    }
 
-        // Clean up the log folder
-        zlog_ensure_at_most_n_logfiles(ZLOG_MAX_FILE_COUNT);
+    snprintf(_zlog_capture_filepath, sizeof(_zlog_capture_filepath), "%s", filepath);
+    snprintf(_zlog_capture_workflow_id, sizeof(_zlog_capture_workflow_id), "%s", workflow_id);
+    _zlog_capture_bytes_left = (existing_bytes < max_bytes) ? max_bytes - existing_bytes : 0;
+    result = 0;
+
+done:
+    __atomic_store_n(
+        &_zlog_capture_tagged,
+        _zlog_capture_file != NULL && strcmp(_zlog_capture_context_id, _zlog_capture_workflow_id) == 0,
+        __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&_zlog_capture_mutex);
+    return result;
+}
 
-        // Timestamp the new log file
-        char zlog_file_log_fullpath[512];
-        if (!get_current_utctime_filename(zlog_file_log_fullpath, sizeof(zlog_file_log_fullpath)))
+void zlog_stop_capture(void)
+{
+    pthread_mutex_lock(&_zlog_capture_mutex);
+    __atomic_store_n(&_zlog_capture_tagged, false, __ATOMIC_RELAXED);
+    if (_zlog_capture_file != NULL)
+    {
+        gzclose(_zlog_capture_file);
+        _zlog_capture_file = NULL;
+    }
+    _zlog_capture_filepath[0] = '\0';
+    _zlog_capture_workflow_id[0] = '\0';
+    pthread_mutex_unlock(&_zlog_capture_mutex);
+}
+
+// Writes a line to the capture, if it's tagged with the workflow of the capture and the capture has room
+static void zlog_capture_append(const char* line, size_t line_len)
+{
+    static const char limit_note[] = "Capture stopped: size limit reached\n";
+
+    pthread_mutex_lock(&_zlog_capture_mutex);
+
+    if (_zlog_capture_file != NULL && _zlog_capture_tagged && _zlog_capture_bytes_left != 0)
+    {
+        // gzip only shrinks text, so counting the uncompressed bytes keeps the file within its limit.
+        if (line_len + sizeof(limit_note) <= _zlog_capture_bytes_left)
         {
-            return;
+            (void)gzwrite(_zlog_capture_file, line, (unsigned int)line_len);
+            _zlog_capture_bytes_left -= line_len;
+        }
+        else
+        {
+            (void)gzwrite(_zlog_capture_file, limit_note, (unsigned int)(sizeof(limit_note) - 1));
+            _zlog_capture_bytes_left = 0;
         }
-
-        // INVARIANT: zlog_fout == NULL due to zlog_close_file_log() call above.
-        zlog_fout = fopen(zlog_file_log_fullpath, "a");
     }
+
+    pthread_mutex_unlock(&_zlog_capture_mutex);
 }
 
-// Caller should NOT hold the lock
-static inline char* zlog_lock_and_get_buffer(void)
+// Writes the lines zlib holds to the capture file, so that it can be read while the workflow runs
+static void zlog_capture_flush(void)
 {
-    _zlog_buffer_lock();
-    // Flush the buffer if it is full
-    if (_zlog_buffer_count == ZLOG_BUFFER_MAXLINES)
+    pthread_mutex_lock(&_zlog_capture_mutex);
+    if (_zlog_capture_file != NULL)
     {
-        _zlog_flush_buffer();
+        (void)gzflush(_zlog_capture_file, Z_SYNC_FLUSH);
     }
-
-    // allocate buffer
-    _zlog_buffer_count++;
-    return _zlog_buffer[_zlog_buffer_count - 1];
+    pthread_mutex_unlock(&_zlog_capture_mutex);
 }
 
-// Caller should hold the lock
-static inline void zlog_finish_buffer_and_unlock()
+// Writes a line about dropped lines, which is neither rate limited nor collapsed
+static void zlog_write_note(enum ZLOG_SEVERITY msg_level, const char* func, const char* fmt, ...)
 {
-#ifdef ZLOG_FORCE_FLUSH_BUFFER
-    _zlog_flush_buffer();
-#endif
-    _zlog_buffer_unlock();
+    va_list va;
+    va_start(va, fmt);
+    zlog_write(msg_level, func, fmt, false /* collapse */, va);
+    va_end(va);
 }
 
-// Clean up until max of num old log files left
-// Caller should hold the lock
-void zlog_ensure_at_most_n_logfiles(int max_num)
+// Returns false if the call site of fmt already logged its lines of the current interval, in which case the line is
+// dropped. The first line of the site once the interval is over is preceded by the number of lines dropped.
+static _Bool zlog_rate_limit(enum ZLOG_SEVERITY msg_level, const char* func, const char* fmt)
 {
-    struct dirent** logfiles;
+    // A string literal per call site; sites whose formats share a slot take turns.
+    ZLOG_CALL_SITE* site =
+        &_zlog_call_sites[(((uint64_t)(uintptr_t)fmt * 0x9e3779b97f4a7c15ull) >> 32) % ZLOG_RATE_LIMIT_CALL_SITES];
+    ZLOG_CALL_SITE evicted = { NULL, NULL, ZLOG_DEBUG, 0, 0, 0 };
+    unsigned int suppressed = 0;
+    _Bool allowed = true;
 
-    // List the files specified by file_select in alphabetical order
-    const int total = scandir(zlog_file_log_dir, &logfiles, file_select, alphasort);
-    if (total == -1)
-    {
-        return;
-    }
+    pthread_mutex_lock(&_zlog_limit_mutex);
+
+    const ZLOG_RATE_LIMIT limit = _zlog_rate_limits[msg_level];
 
-    if (total > max_num)
+    if (limit.lines != 0)
     {
-        // Delete until only max_num of files left
-        for (int i = 0; i < total - max_num; ++i)
+        const time_t now = zlog_monotonic_seconds();
+
+        if (site->fmt != fmt)
         {
-            char filepath[512];
-            const unsigned int max_filepath = sizeof(filepath) / sizeof(filepath[0]);
-            int res = snprintf(filepath, max_filepath, "%s/%s", zlog_file_log_dir, logfiles[i]->d_name);
-            if (res > 0 && res < max_filepath)
-            {
-                remove(filepath);
-            }
+            evicted = *site;
+            site->fmt = fmt;
+            site->func = func;
+            site->level = msg_level;
+            site->window_start = now;
+            site->lines = 0;
+            site->suppressed = 0;
+        }
+        else if (now - site->window_start >= (time_t)limit.interval_sec)
+        {
+            suppressed = site->suppressed;
+            site->window_start = now;
+            site->lines = 0;
+            site->suppressed = 0;
+        }
+
+        if (site->lines < limit.lines)
+        {
+            site->lines++;
+        }
+        else
+        {
+            site->suppressed++;
+            _zlog_suppressed_line_count++;
+            allowed = false;
         }
     }
 
-    // Free memory allocated by scandir.
-    for (int i = 0; i < total; ++i)
+    pthread_mutex_unlock(&_zlog_limit_mutex);
+
+    if (evicted.suppressed != 0)
     {
-        free(logfiles[i]);
+        zlog_write_note(evicted.level, evicted.func, "Suppressed %u similar lines", evicted.suppressed);
+    }
+
+    if (suppressed != 0)
+    {
+        zlog_write_note(msg_level, func, "Suppressed %u similar lines", suppressed);
+    }
+
+    return allowed;
+}
+
+// Returns true if the line repeats the last line written, in which case it is dropped.
+// The number of repeats is written once a different line is, and every ZLOG_REPEAT_REPORT_INTERVAL_SEC meanwhile.
+static _Bool zlog_collapse_repeat(enum ZLOG_SEVERITY msg_level, const char* func, const char* fmt, uint64_t hash)
+{
+    const time_t now = zlog_monotonic_seconds();
+    enum ZLOG_SEVERITY repeat_level;
+    const char* repeat_func;
+    unsigned int repeats = 0;
+    _Bool repeated = false;
+
+    pthread_mutex_lock(&_zlog_limit_mutex);
+
+    repeat_level = _zlog_last_line.level;
+    repeat_func = _zlog_last_line.func;
+
+    if (_zlog_rate_limits[msg_level].collapse_repeats && fmt == _zlog_last_line.fmt
+        && msg_level == _zlog_last_line.level && hash == _zlog_last_line.hash)
+    {
+        repeated = true;
+        _zlog_last_line.repeats++;
+        _zlog_suppressed_line_count++;
+
+        if (now - _zlog_last_line.reported_time >= ZLOG_REPEAT_REPORT_INTERVAL_SEC)
+        {
+            repeats = _zlog_last_line.repeats;
+            _zlog_last_line.repeats = 0;
+            _zlog_last_line.reported_time = now;
+        }
+    }
+    else
+    {
+        repeats = _zlog_last_line.repeats;
+        _zlog_last_line.fmt = fmt;
+        _zlog_last_line.func = func;
+        _zlog_last_line.level = msg_level;
+        _zlog_last_line.hash = hash;
+        _zlog_last_line.repeats = 0;
+        _zlog_last_line.reported_time = now;
+    }
+
+    pthread_mutex_unlock(&_zlog_limit_mutex);
+
+    if (repeats != 0)
+    {
+        zlog_write_note(repeat_level, repeat_func, "Last message repeated %u times", repeats);
+    }
+
+    return repeated;
+}
+
+// Writes the numbers of lines dropped that weren't written yet, e.g. before the log is closed
+static void zlog_write_pending_notes(void)
+{
+    ZLOG_CALL_SITE sites[ZLOG_RATE_LIMIT_CALL_SITES];
+    size_t site_count = 0;
+    enum ZLOG_SEVERITY repeat_level;
+    const char* repeat_func;
+    unsigned int repeats;
+
+    pthread_mutex_lock(&_zlog_limit_mutex);
+
+    repeat_level = _zlog_last_line.level;
+    repeat_func = _zlog_last_line.func;
+    repeats = _zlog_last_line.repeats;
+    _zlog_last_line.repeats = 0;
+
+    for (size_t i = 0; i < ZLOG_RATE_LIMIT_CALL_SITES; ++i)
+    {
+        if (_zlog_call_sites[i].suppressed != 0)
+        {
+            sites[site_count++] = _zlog_call_sites[i];
+            _zlog_call_sites[i].suppressed = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&_zlog_limit_mutex);
+
+    if (repeats != 0)
+    {
+        zlog_write_note(repeat_level, repeat_func, "Last message repeated %u times", repeats);
+    }
+
+    for (size_t i = 0; i < site_count; ++i)
+    {
+        zlog_write_note(sites[i].level, sites[i].func, "Suppressed %u similar lines", sites[i].suppressed);
+    }
+}
+
+// Writes a line to the console and the file, as their levels want.
+// Unless collapse is false, the line is dropped if it repeats the last line, see zlog_collapse_repeat.
+static void zlog_write(enum ZLOG_SEVERITY msg_level, const char* func, const char* fmt, _Bool collapse, va_list va)
+{
+    const _Bool console_log_needed =
+        (log_setting.console_logging_mode != ZLOG_CLM_DISABLED) && (msg_level >= log_setting.console_level);
+    const _Bool file_log_needed = zlog_is_file_log_open() && (msg_level >= log_setting.file_level);
+    const _Bool journal_log_needed = zlog_is_journal_enabled() && (msg_level >= log_setting.file_level);
+    const _Bool capture_log_needed = zlog_is_capture_tagged() && (msg_level >= log_setting.file_level);
+    va_list args;
+
+    if (!console_log_needed && !file_log_needed && !journal_log_needed && !capture_log_needed)
+    {
+        // If we're not logging to console, file, journal or capture, there's nothing to do.
+        return;
+    }
+
+#ifdef ZLOG_DEFERRED_FORMATTING
+    if (file_log_needed && !console_log_needed && !capture_log_needed)
+    {
+        // Only the file wants this line, so the flush thread can format it.
+        char record[ZLOG_BUFFER_LINE_MAXCHARS];
+        size_t args_offset = 0;
+
+        va_copy(args, va);
+        const size_t record_len =
+            zlog_capture_deferred(record, sizeof(record), &args_offset, msg_level, func, fmt, args);
+        va_end(args);
+
+        if (record_len != 0)
+        {
+            if (collapse
+                && zlog_collapse_repeat(
+                    msg_level, func, fmt, zlog_hash(record + args_offset, record_len - args_offset)))
+            {
+                return;
+            }
+
+            zlog_buffer_append(record, record_len, ZLOG_RECORD_DEFERRED);
+#    ifdef ZLOG_FORCE_FLUSH_BUFFER
+            zlog_flush_buffer();
+#    endif
+            if (msg_level == ZLOG_ERROR)
+            {
+                zlog_request_flush_buffer();
+            }
+            return;
+        }
+    }
+#endif
+
+    char va_buffer[ZLOG_BUFFER_LINE_MAXCHARS];
+    va_copy(args, va);
+    const int va_len = vsnprintf(va_buffer, sizeof(va_buffer) / sizeof(va_buffer[0]), fmt, args);
+    va_end(args);
+
+    if (collapse && va_len >= 0
+        && zlog_collapse_repeat(
+            msg_level,
+            func,
+            fmt,
+            zlog_hash(va_buffer, (size_t)va_len < sizeof(va_buffer) ? (size_t)va_len : sizeof(va_buffer) - 1)))
+    {
+        return;
+    }
+
+#ifdef ZLOG_JOURNALD
+    if (journal_log_needed)
+    {
+        // The journal timestamps the entry itself.
+        zlog_journal_send(msg_level, func, va_buffer);
+    }
+#endif
+
+    char time_buffer[sizeof("2020-07-01T18:21:26.1234Z")];
+    if (!zlog_format_current_time(time_buffer, sizeof(time_buffer)))
+    {
+        return;
+    }
+
+    if (console_log_needed)
+    {
+        // Output to console
+
+        const char* color_prefix;
+        const char* color_suffix;
+
+        if (log_setting.console_logging_mode != ZLOG_CLM_ENABLED_TTYCOLOR)
+        {
+            color_prefix = "";
+            color_suffix = "";
+        }
+        else
+        {
+            // Use Bold Red for error, Bold Yellow for warn.
+            color_prefix = (msg_level == ZLOG_ERROR) ? "\033[1;31m" : (msg_level == ZLOG_WARN) ? "\033[1;33m" : "";
+            color_suffix = "\033[m";
+        }
+
+        fprintf(
+            msg_level == ZLOG_ERROR ? stderr : stdout,
+            "%s %s[%c]%s %s [%s]\n",
+            time_buffer,
+            color_prefix,
+            level_names[msg_level],
+            color_suffix,
+            va_buffer,
+            func);
+    }
+
+    if (file_log_needed || capture_log_needed)
+    {
+        char line[ZLOG_BUFFER_LINE_MAXCHARS];
+
+        const int line_len = snprintf(
+            line, sizeof(line), ZLOG_FILE_LINE_FORMAT, time_buffer, level_names[msg_level], va_buffer, func);
+
+        if (line_len > 0)
+        {
+            const size_t len = ((size_t)line_len < sizeof(line)) ? (size_t)line_len : sizeof(line) - 1;
+
+            if (file_log_needed)
+            {
+                // Add to zlog buffer.
+                zlog_buffer_append(line, len, 0);
+            }
+
+            if (capture_log_needed)
+            {
+                zlog_capture_append(line, len);
+            }
+        }
+
+#ifdef ZLOG_FORCE_FLUSH_BUFFER
+        zlog_flush_buffer();
+#endif
+    }
+
+    if (msg_level == ZLOG_ERROR)
+    {
+        zlog_request_flush_buffer();
+    }
+}
+
+
+void zlog_log(enum ZLOG_SEVERITY msg_level, const char* func, const char* fmt, ...)
+{
+    const _Bool console_log_needed =
+        (log_setting.console_logging_mode != ZLOG_CLM_DISABLED) && (msg_level >= log_setting.console_level);
+    const _Bool file_log_needed = (zlog_is_file_log_open() || zlog_is_journal_enabled() || zlog_is_capture_tagged())
+        && (msg_level >= log_setting.file_level);
+
+    // Checked before the rate limit, so that lines nobody wants don't use up the lines of their call site.
+    if ((!console_log_needed && !file_log_needed) || !zlog_rate_limit(msg_level, func, fmt))
+    {
+        return;
+    }
+
+    va_list va;
+    va_start(va, fmt);
+    zlog_write(msg_level, func, fmt, true /* collapse */, va);
+    va_end(va);
+}
+
+void zlog_set_rate_limit(enum ZLOG_SEVERITY level, unsigned int lines, unsigned int interval_sec)
+{
+    if ((size_t)level >= sizeof(_zlog_rate_limits) / sizeof(_zlog_rate_limits[0]))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&_zlog_limit_mutex);
+    _zlog_rate_limits[level].lines = lines;
+    _zlog_rate_limits[level].interval_sec = interval_sec;
+    pthread_mutex_unlock(&_zlog_limit_mutex);
+}
+
+void zlog_set_collapse_repeats(enum ZLOG_SEVERITY level, int enable)
+{
+    if ((size_t)level >= sizeof(_zlog_rate_limits) / sizeof(_zlog_rate_limits[0]))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&_zlog_limit_mutex);
+    _zlog_rate_limits[level].collapse_repeats = enable != 0;
+    pthread_mutex_unlock(&_zlog_limit_mutex);
+}
+
+unsigned long long zlog_get_suppressed_line_count(void)
+{
+    pthread_mutex_lock(&_zlog_limit_mutex);
+    const unsigned long long count = _zlog_suppressed_line_count;
+    pthread_mutex_unlock(&_zlog_limit_mutex);
+
+    return count;
+}
+
+void zlog_request_flush_buffer(void)
+{
+    zlog_wake_flush_thread(true /* flush_now */);
+}
+
+unsigned long long zlog_get_ring_full_wait_count(void)
+{
+    return __atomic_load_n(&_zlog_ring_full_wait_count, __ATOMIC_RELAXED);
+}
+
+// Wakes up the flush thread, if any, so it flushes right away when flush_now is true,
+// or otherwise re-arms its flush interval timer.
+static void zlog_wake_flush_thread(_Bool flush_now)
+{
+    if (!__atomic_load_n(&_is_flush_thread_initialized, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&_zlog_flush_mutex);
+    if (flush_now)
+    {
+        _zlog_flush_requested = true;
+    }
+    pthread_cond_signal(&_zlog_flush_cond);
+    pthread_mutex_unlock(&_zlog_flush_mutex);
+}
+
+// Blocks until the flush thread made room in the ring, or for at most a second, after which the caller retries.
+// Flushes on the calling thread instead when there is no flush thread.
+// Caller should NOT hold the lock
+static void zlog_wait_for_space(void)
+{
+    __atomic_fetch_add(&_zlog_ring_full_wait_count, 1, __ATOMIC_RELAXED);
+
+    if (!__atomic_load_n(&_is_flush_thread_initialized, __ATOMIC_ACQUIRE))
+    {
+        zlog_flush_buffer();
+        return;
+    }
+
+    pthread_mutex_lock(&_zlog_flush_mutex);
+
+    const unsigned int flush_count = _zlog_flush_count;
+    _zlog_flush_requested = true;
+    pthread_cond_signal(&_zlog_flush_cond);
+
+    // CLOCK_REALTIME, as the default for a statically initialized condition variable.
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+
+    while (flush_count == _zlog_flush_count && !_zlog_flush_thread_stop)
+    {
+        if (pthread_cond_timedwait(&_zlog_space_cond, &_zlog_flush_mutex, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&_zlog_flush_mutex);
+}
+
+// Buffer flushing thread
+// Flush the thread every ZLOG_FLUSH_INTERVAL_SEC seconds while the buffer isn't empty
+// or when the buffer is ZLOG_BUFFER_FLUSH_PERCENT full
+// or when a flush is requested.
+// Sleeps without a timeout while the buffer is empty.
+//
+// Caller should NOT hold the lock
+static void* zlog_buffer_flush_thread()
+{
+    struct timespec lasttime;
+
+    clock_gettime(CLOCK_MONOTONIC, &lasttime);
+
+    pthread_mutex_lock(&_zlog_flush_mutex);
+
+    while (!_zlog_flush_thread_stop)
+    {
+        const size_t buffered =
+            __atomic_load_n(&_zlog_ring_head, __ATOMIC_RELAXED) - __atomic_load_n(&_zlog_ring_tail, __ATOMIC_RELAXED);
+        struct timespec curtime;
+
+        clock_gettime(CLOCK_MONOTONIC, &curtime);
+
+        if (_zlog_flush_requested || buffered >= zlog_buffer_flush_size()
+            || (buffered != 0 && curtime.tv_sec - lasttime.tv_sec >= ZLOG_FLUSH_INTERVAL_SEC))
+        {
+            _zlog_flush_requested = false;
+            pthread_mutex_unlock(&_zlog_flush_mutex);
+
+            // Flushes wait on storage, they run on the CPUs of I/O threads, e.g. the LITTLE cores.
+            (void)ADUC_CpuAffinity_ApplyToCurrentThread(ADUC_ThreadClass_IO);
+
+            zlog_flush_buffer();
+            lasttime = curtime;
+
+            pthread_mutex_lock(&_zlog_flush_mutex);
+            ++_zlog_flush_count;
+            pthread_cond_broadcast(&_zlog_space_cond);
+        }
+        else if (buffered == 0)
+        {
+            // Producers signal us once they add the first line, which is then flushed at most
+            // ZLOG_FLUSH_INTERVAL_SEC seconds later.
+            pthread_cond_wait(&_zlog_flush_cond, &_zlog_flush_mutex);
+            clock_gettime(CLOCK_MONOTONIC, &lasttime);
+        }
+        else
+        {
+            struct timespec deadline = lasttime;
+            deadline.tv_sec += ZLOG_FLUSH_INTERVAL_SEC;
+            (void)pthread_cond_timedwait(&_zlog_flush_cond, &_zlog_flush_mutex, &deadline);
+        }
+    }
+
+    pthread_mutex_unlock(&_zlog_flush_mutex);
+
+    return NULL;
+}
+
+void zlog_init_flush_thread(void)
+{
+    if (!_zlog_flush_cond_initialized)
+    {
+        pthread_condattr_t attr;
+
+        // Time the flush interval on the monotonic clock, so wall clock changes don't delay or hurry flushes.
+        if (pthread_condattr_init(&attr) != 0)
+        {
+            return;
+        }
+
+        const int err = (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0)
+            ? pthread_cond_init(&_zlog_flush_cond, &attr)
+            : -1;
+        pthread_condattr_destroy(&attr);
+        if (err != 0)
+        {
+            return;
+        }
+
+        _zlog_flush_cond_initialized = true;
+    }
+
+    _zlog_flush_requested = false;
+    _zlog_flush_thread_stop = false;
+
+    if (pthread_create(&_zlog_flush_thread, NULL, zlog_buffer_flush_thread, NULL) == 0)
+    {
+        __atomic_store_n(&_is_flush_thread_initialized, true, __ATOMIC_RELEASE);
+    }
+}
+
+// Caller should NOT hold the lock
+void zlog_stop_flush_thread(void)
+{
+    if (_is_flush_thread_initialized)
+    {
+        // Let the thread finish its current flush, rather than cancelling it while it holds the lock.
+        pthread_mutex_lock(&_zlog_flush_mutex);
+        _zlog_flush_thread_stop = true;
+        pthread_cond_signal(&_zlog_flush_cond);
+        pthread_cond_broadcast(&_zlog_space_cond);
+        pthread_mutex_unlock(&_zlog_flush_mutex);
+
+        pthread_join(_zlog_flush_thread, NULL);
+
+        // Producers still waiting for space flush on their own thread from now on.
+        __atomic_store_n(&_is_flush_thread_initialized, false, __ATOMIC_RELEASE);
+    }
+}
+
+// ------------------------- Helper Functions ---------------------------
+static int file_select(const struct dirent* logfile)
+{
+    // Filter: 1. File and 2. filename contains the log file pattern
+    return (logfile->d_type == DT_REG && strstr(logfile->d_name, zlog_file_log_prefix) != NULL);
+}
+
+static inline void _zlog_buffer_lock(void)
+{
+    pthread_mutex_lock(&_zlog_buffer_mutex);
+}
+
+static inline void _zlog_buffer_unlock(void)
+{
+    pthread_mutex_unlock(&_zlog_buffer_mutex);
+}
+
+_Bool get_current_utctime_filename(char* fullpath, size_t fullpath_len)
+{
+    // Timestamp the log file
+    char timebuf[sizeof("20200819-19181597864683")];
+    const time_t current_time = time(NULL);
+    const struct tm* tm = gmtime(&current_time);
+
+    strftime(timebuf, sizeof(timebuf), "%Y%m%d-%H%M%S", tm);
+    int res = snprintf(fullpath, fullpath_len, "%s/%s%s.log", zlog_file_log_dir, zlog_file_log_prefix, timebuf);
+    if (res < 0 || res >= fullpath_len)
+    {
+        // When error occurs to snprintf filepath, return false
+        return false;
+    }
+    return true;
+}
+
+// Returns the number of buffered bytes at which the flush thread is woken up
+static size_t zlog_buffer_flush_size(void)
+{
+    return _zlog_ring_size / 100 * ZLOG_BUFFER_FLUSH_PERCENT;
+}
+
+// Allocates the ring buffer, unless a previous zlog_init already did
+// Returns false on failure
+static _Bool zlog_buffer_init(size_t buffer_size)
+{
+    if (_zlog_ring != NULL)
+    {
+        return true;
+    }
+
+    // Round up to a power of two, which also makes it a multiple of 8 so that headers never wrap around the end
+    // of the ring, and make room for at least one line.
+    buffer_size = (buffer_size == 0) ? ZLOG_BUFFER_SIZE_BYTES : buffer_size;
+    if (buffer_size < ZLOG_RECORD_SIZE(ZLOG_BUFFER_LINE_MAXCHARS))
+    {
+        buffer_size = ZLOG_RECORD_SIZE(ZLOG_BUFFER_LINE_MAXCHARS);
+    }
+
+    size_t ring_size = 8;
+    while (ring_size < buffer_size)
+    {
+        ring_size <<= 1;
+    }
+    buffer_size = ring_size;
+
+    // calloc, since the consumer relies on unused space being zero.
+    _zlog_ring = (char*)calloc(1, buffer_size);
+    if (_zlog_ring == NULL)
+    {
+        return false;
+    }
+
+    _zlog_ring_size = buffer_size;
+    _zlog_ring_mask = buffer_size - 1;
+    return true;
+}
+
+// Copies len bytes from the ring at position pos, wrapping around its end
+static void zlog_ring_read(size_t pos, char* line, size_t len)
+{
+    const size_t offset = pos & _zlog_ring_mask;
+    const size_t first = (len < _zlog_ring_size - offset) ? len : _zlog_ring_size - offset;
+
+    memcpy(line, _zlog_ring + offset, first);
+    memcpy(line + first, _zlog_ring, len - first);
+}
+
+// Copies len bytes into the ring at position pos, wrapping around its end
+static void zlog_ring_write(size_t pos, const char* line, size_t len)
+{
+    const size_t offset = pos & _zlog_ring_mask;
+    const size_t first = (len < _zlog_ring_size - offset) ? len : _zlog_ring_size - offset;
+
+    memcpy(_zlog_ring + offset, line, first);
+    memcpy(_zlog_ring, line + first, len - first);
+}
+
+// Zeroes len bytes of the ring at position pos, wrapping around its end
+static void zlog_ring_zero(size_t pos, size_t len)
+{
+    const size_t offset = pos & _zlog_ring_mask;
+    const size_t first = (len < _zlog_ring_size - offset) ? len : _zlog_ring_size - offset;
+
+    memset(_zlog_ring + offset, 0, first);
+    memset(_zlog_ring, 0, len - first);
+}
+
+// Adds a line to the ring buffer, waiting for the flush thread to make room if the ring is full
+// Lock-free unless the ring is full; caller should NOT hold the lock
+static void zlog_buffer_append(const char* line, size_t line_len, uint32_t flags)
+{
+    const size_t record_size = ZLOG_RECORD_SIZE(line_len);
+    size_t head = __atomic_load_n(&_zlog_ring_head, __ATOMIC_RELAXED);
+    size_t buffered = 0;
+
+    for (;;)
+    {
+        // Acquire, so the consumer's zeroing of the released space happens before we write to it.
+        buffered = head - __atomic_load_n(&_zlog_ring_tail, __ATOMIC_ACQUIRE);
+        if (record_size > _zlog_ring_size - buffered)
+        {
+            zlog_wait_for_space();
+            head = __atomic_load_n(&_zlog_ring_head, __ATOMIC_RELAXED);
+        }
+        else if (__atomic_compare_exchange_n(
+                     &_zlog_ring_head, &head, head + record_size, true /* weak */, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+    }
+
+    zlog_ring_write(head + ZLOG_RECORD_HEADER_SIZE, line, line_len);
+
+    // Headers are 8-byte aligned, so they never wrap around the end of the ring.
+    uint32_t* header = (uint32_t*)(void*)(_zlog_ring + (head & _zlog_ring_mask));
+    __atomic_store_n(header, (uint32_t)line_len | flags | ZLOG_RECORD_COMMITTED, __ATOMIC_RELEASE);
+
+    // Only the first line after a flush and the line crossing the flush size wake up the flush thread.
+    const size_t flush_size = zlog_buffer_flush_size();
+    if (buffered == 0)
+    {
+        zlog_wake_flush_thread(false /* flush_now */);
+    }
+    else if (buffered < flush_size && buffered + record_size >= flush_size)
+    {
+        zlog_wake_flush_thread(true /* flush_now */);
+    }
+}
+
+// Caller should hold the lock
+static void _zlog_flush_buffer()
+{
+    char line[ZLOG_BUFFER_LINE_MAXCHARS];
+#ifdef ZLOG_DEFERRED_FORMATTING
+    char record[ZLOG_BUFFER_LINE_MAXCHARS];
+#endif
+    const size_t first_tail = _zlog_ring_tail;
+    size_t tail = first_tail;
+    const size_t head = __atomic_load_n(&_zlog_ring_head, __ATOMIC_ACQUIRE);
+
+    // Write the committed records in order, up to the first one still being written.
+    // Records are consumed even when the file isn't open, so the ring never stays full.
+    while (tail != head)
+    {
+        const uint32_t* header = (const uint32_t*)(const void*)(_zlog_ring + (tail & _zlog_ring_mask));
+        const uint32_t header_value = __atomic_load_n(header, __ATOMIC_ACQUIRE);
+        if ((header_value & ZLOG_RECORD_COMMITTED) == 0)
+        {
+            break;
+        }
+
+        const size_t line_len = header_value & ZLOG_RECORD_LENGTH_MASK;
+        const size_t record_size = ZLOG_RECORD_SIZE(line_len);
+
+        if (zlog_is_file_log_open())
+        {
+#ifdef ZLOG_DEFERRED_FORMATTING
+            if ((header_value & ZLOG_RECORD_DEFERRED) != 0)
+            {
+                zlog_ring_read(tail + ZLOG_RECORD_HEADER_SIZE, record, line_len);
+                fwrite(line, 1, zlog_format_deferred_line(line, sizeof(line), record, line_len), zlog_fout);
+            }
+            else
+#endif
+            {
+                zlog_ring_read(tail + ZLOG_RECORD_HEADER_SIZE, line, line_len);
+                fwrite(line, 1, line_len, zlog_fout);
+            }
+        }
+
+        zlog_ring_zero(tail, record_size);
+        tail += record_size;
+        __atomic_store_n(&_zlog_ring_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    ADUC_TRACEPOINT1(log_flush, tail - first_tail);
+
+    if (!zlog_is_file_log_open())
+    {
+        return;
+    }
+
+    fflush(zlog_fout);
+
+    // Roll over to new log file once the current file size exceeds the limit
+    if (ftell(zlog_fout) > (ZLOG_FILE_MAX_SIZE_KB * 1024))
+    {
+        zlog_close_file_log();
+
+        // Timestamp the new log file
+        char zlog_file_log_fullpath[512];
+        if (!get_current_utctime_filename(zlog_file_log_fullpath, sizeof(zlog_file_log_fullpath)))
+        {
+            return;
+        }
+
+        // INVARIANT: zlog_fout == NULL due to zlog_close_file_log() call above.
+        zlog_fout = fopen(zlog_file_log_fullpath, "a");
+
+        // Compress the file just closed, and clean up the log folder
+        zlog_set_current_log_file(zlog_file_log_fullpath);
+    }
+}
+
+// Returns true if name ends with suffix
+static _Bool zlog_has_suffix(const char* name, const char* suffix)
+{
+    const size_t name_len = strlen(name);
+    const size_t suffix_len = strlen(suffix);
+
+    return name_len >= suffix_len && strcmp(name + name_len - suffix_len, suffix) == 0;
+}
+
+// Compresses filepath into filepath.gz, and removes filepath on success
+// Returns false on failure
+static _Bool zlog_compress_file(const char* filepath)
+{
+    _Bool succeeded = false;
+    char gz_filepath[512];
+    char tmp_filepath[512];
+    char buffer[16 * 1024];
+    FILE* file = NULL;
+    gzFile gz_file = NULL;
+    size_t read_size;
+    int close_result;
+
+    if (snprintf(gz_filepath, sizeof(gz_filepath), "%s.gz", filepath) >= (int)sizeof(gz_filepath)
+        || snprintf(tmp_filepath, sizeof(tmp_filepath), "%s.gz.tmp", filepath) >= (int)sizeof(tmp_filepath))
+    {
+        return false;
+    }
+
+    file = fopen(filepath, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    // Write to a temporary file, so that a power loss never leaves a truncated .gz file behind.
+    gz_file = gzopen(tmp_filepath, "wb");
+    if (gz_file == NULL)
+    {
+        goto done;
+    }
+
+    while ((read_size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        if (gzwrite(gz_file, buffer, (unsigned int)read_size) != (int)read_size)
+        {
+            goto done;
+        }
+    }
+
+    if (ferror(file))
+    {
+        goto done;
+    }
+
+    close_result = gzclose(gz_file);
+    gz_file = NULL;
+    if (close_result != Z_OK || rename(tmp_filepath, gz_filepath) != 0)
+    {
+        goto done;
+    }
+
+    succeeded = true;
+    remove(filepath);
+
+done:
+    if (gz_file != NULL)
+    {
+        gzclose(gz_file);
+    }
+
+    if (!succeeded)
+    {
+        remove(tmp_filepath);
+    }
+
+    fclose(file);
+    return succeeded;
+}
+
+// Compresses the log files other than current_log_name, then deletes the oldest compressed files
+// until all log files take at most ZLOG_MAX_TOTAL_SIZE_KB
+// Caller should NOT hold the lock
+static void zlog_compress_log_files(const char* current_log_name)
+{
+    struct dirent** logfiles;
+    char filepath[512];
+    const int max_filepath = sizeof(filepath) / sizeof(filepath[0]);
+
+    // List the files specified by file_select in alphabetical order, i.e. oldest first.
+    int total = scandir(zlog_file_log_dir, &logfiles, file_select, alphasort);
+    if (total == -1)
+    {
+        return;
+    }
+
+    for (int i = 0; i < total; ++i)
+    {
+        const char* name = logfiles[i]->d_name;
+        int res = snprintf(filepath, max_filepath, "%s/%s", zlog_file_log_dir, name);
+        if (res <= 0 || res >= max_filepath || strcmp(name, current_log_name) == 0)
+        {
+            continue;
+        }
+
+        if (zlog_has_suffix(name, ".log"))
+        {
+            zlog_compress_file(filepath);
+        }
+        else if (zlog_has_suffix(name, ".gz.tmp"))
+        {
+            // Left behind by a compression that was interrupted.
+            remove(filepath);
+        }
+    }
+
+    for (int i = 0; i < total; ++i)
+    {
+        free(logfiles[i]);
+    }
+    free(logfiles);
+
+    // Now that the files are compressed, see how much room they take.
+    total = scandir(zlog_file_log_dir, &logfiles, file_select, alphasort);
+    if (total == -1)
+    {
+        return;
+    }
+
+    long long total_size = 0;
+    for (int i = 0; i < total; ++i)
+    {
+        struct stat st;
+        int res = snprintf(filepath, max_filepath, "%s/%s", zlog_file_log_dir, logfiles[i]->d_name);
+        if (res > 0 && res < max_filepath && stat(filepath, &st) == 0)
+        {
+            total_size += st.st_size;
+        }
+    }
+
+    // Delete the oldest compressed files until the log files fit in the budget
+    for (int i = 0; i < total && total_size > (long long)ZLOG_MAX_TOTAL_SIZE_KB * 1024; ++i)
+    {
+        struct stat st;
+        int res = snprintf(filepath, max_filepath, "%s/%s", zlog_file_log_dir, logfiles[i]->d_name);
+        if (res > 0 && res < max_filepath && zlog_has_suffix(logfiles[i]->d_name, ".gz") && stat(filepath, &st) == 0
+            && remove(filepath) == 0)
+        {
+            total_size -= st.st_size;
+        }
+    }
+
+    // Free memory allocated by scandir.
+    for (int i = 0; i < total; ++i)
+    {
+        free(logfiles[i]);
+    }
+    free(logfiles);
+}
+
+// Log file compression thread
+// Compresses and cleans up the log files each time zlog_set_current_log_file is called
+static void* zlog_compress_thread()
+{
+    char current_log_name[sizeof(_zlog_current_log_name)];
+
+    pthread_mutex_lock(&_zlog_compress_mutex);
+
+    while (!_zlog_compress_thread_stop)
+    {
+        if (!_zlog_compress_requested)
+        {
+            pthread_cond_wait(&_zlog_compress_cond, &_zlog_compress_mutex);
+            continue;
+        }
+
+        _zlog_compress_requested = false;
+        memcpy(current_log_name, _zlog_current_log_name, sizeof(current_log_name));
+        pthread_mutex_unlock(&_zlog_compress_mutex);
+
+        // Compressing old logs is background work, kept off the CPUs of the compute threads.
+        (void)ADUC_CpuAffinity_ApplyToCurrentThread(ADUC_ThreadClass_IO);
+
+        zlog_compress_log_files(current_log_name);
+
+        pthread_mutex_lock(&_zlog_compress_mutex);
+    }
+
+    pthread_mutex_unlock(&_zlog_compress_mutex);
+
+    return NULL;
+}
+
+static void zlog_init_compress_thread(void)
+{
+    _zlog_compress_requested = false;
+    _zlog_compress_thread_stop = false;
+
+    if (pthread_create(&_zlog_compress_thread, NULL, zlog_compress_thread, NULL) == 0)
+    {
+        _is_compress_thread_initialized = true;
+    }
+}
+
+static void zlog_stop_compress_thread(void)
+{
+    if (_is_compress_thread_initialized)
+    {
+        pthread_mutex_lock(&_zlog_compress_mutex);
+        _zlog_compress_thread_stop = true;
+        pthread_cond_signal(&_zlog_compress_cond);
+        pthread_mutex_unlock(&_zlog_compress_mutex);
+
+        pthread_join(_zlog_compress_thread, NULL);
+        _is_compress_thread_initialized = false;
+    }
+}
+
+// Records the file zlog_fout now writes to, and compresses and cleans up the others
+// Compresses on the calling thread when there is no compression thread.
+static void zlog_set_current_log_file(const char* fullpath)
+{
+    const char* name = strrchr(fullpath, '/');
+    name = (name == NULL) ? fullpath : name + 1;
+
+    pthread_mutex_lock(&_zlog_compress_mutex);
+    snprintf(_zlog_current_log_name, sizeof(_zlog_current_log_name), "%s", name);
+    _zlog_compress_requested = true;
+    pthread_cond_signal(&_zlog_compress_cond);
+    pthread_mutex_unlock(&_zlog_compress_mutex);
+
+    if (!_is_compress_thread_initialized)
+    {
+        zlog_compress_log_files(name);
     }
-    free(logfiles);
 }
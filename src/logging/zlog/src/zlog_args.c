@@ -0,0 +1,654 @@
+/**
+ * @file zlog_args.c
+ * @brief Captures printf-style arguments, so that they can be formatted later on another thread.
+ *
+ * A record holds the format string, followed by the value of each argument in the order fmt uses them:
+ * the int of each '*' width or precision, then the value itself, widened to intmax_t, uintmax_t, double,
+ * long double or void*, or, for %s, a uint32_t length (ZLOG_ARGS_NULL_STRING for NULL) and the characters.
+ * Values are copied with memcpy, so the record needs no alignment.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#include "zlog_args.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ZLOG_ARGS_NULL_STRING UINT32_MAX
+
+// Conversion specifications longer than this, e.g. "%-+ #0123456789.123456789jd", aren't captured.
+#define ZLOG_ARGS_MAX_SPEC 32
+
+typedef enum tagZLOG_ARG_LENGTH
+{
+    ZLOG_ARG_LENGTH_NONE,
+    ZLOG_ARG_LENGTH_HH,
+    ZLOG_ARG_LENGTH_H,
+    ZLOG_ARG_LENGTH_L,
+    ZLOG_ARG_LENGTH_LL,
+    ZLOG_ARG_LENGTH_J,
+    ZLOG_ARG_LENGTH_Z,
+    ZLOG_ARG_LENGTH_T,
+    ZLOG_ARG_LENGTH_LONG_DOUBLE,
+} ZLOG_ARG_LENGTH;
+
+typedef struct tagZLOG_ARG_SPEC
+{
+    char flags[8];
+    size_t flags_len;
+    _Bool width_star;
+    int width; // -1 if none
+    _Bool precision_star;
+    int precision; // -1 if none
+    ZLOG_ARG_LENGTH length;
+    char conversion;
+} ZLOG_ARG_SPEC;
+
+// Parses the conversion specification that follows a '%'
+// Returns a pointer to the character after it, or NULL if it isn't supported
+static const char* zlog_args_parse_spec(const char* fmt, ZLOG_ARG_SPEC* spec)
+{
+    memset(spec, 0, sizeof(*spec));
+    spec->width = -1;
+    spec->precision = -1;
+
+    while (*fmt != '\0' && strchr("-+ #0'", *fmt) != NULL)
+    {
+        if (spec->flags_len == sizeof(spec->flags) - 1)
+        {
+            return NULL;
+        }
+        spec->flags[spec->flags_len++] = *fmt++;
+    }
+
+    if (*fmt == '*')
+    {
+        spec->width_star = true;
+        ++fmt;
+    }
+    else if (*fmt >= '0' && *fmt <= '9')
+    {
+        spec->width = 0;
+        while (*fmt >= '0' && *fmt <= '9')
+        {
+            spec->width = spec->width * 10 + (*fmt++ - '0');
+            if (spec->width > 9999)
+            {
+                return NULL;
+            }
+        }
+
+        if (*fmt == '$')
+        {
+            // Positional arguments
+            return NULL;
+        }
+    }
+
+    if (*fmt == '.')
+    {
+        ++fmt;
+        spec->precision = 0;
+        if (*fmt == '*')
+        {
+            spec->precision_star = true;
+            ++fmt;
+        }
+        else
+        {
+            while (*fmt >= '0' && *fmt <= '9')
+            {
+                spec->precision = spec->precision * 10 + (*fmt++ - '0');
+                if (spec->precision > 9999)
+                {
+                    return NULL;
+                }
+            }
+        }
+    }
+
+    switch (*fmt)
+    {
+    case 'h':
+        ++fmt;
+        spec->length = (*fmt == 'h') ? ZLOG_ARG_LENGTH_HH : ZLOG_ARG_LENGTH_H;
+        fmt += (spec->length == ZLOG_ARG_LENGTH_HH) ? 1 : 0;
+        break;
+    case 'l':
+        ++fmt;
+        spec->length = (*fmt == 'l') ? ZLOG_ARG_LENGTH_LL : ZLOG_ARG_LENGTH_L;
+        fmt += (spec->length == ZLOG_ARG_LENGTH_LL) ? 1 : 0;
+        break;
+    case 'q':
+        ++fmt;
+        spec->length = ZLOG_ARG_LENGTH_LL;
+        break;
+    case 'j':
+        ++fmt;
+        spec->length = ZLOG_ARG_LENGTH_J;
+        break;
+    case 'z':
+        ++fmt;
+        spec->length = ZLOG_ARG_LENGTH_Z;
+        break;
+    case 't':
+        ++fmt;
+        spec->length = ZLOG_ARG_LENGTH_T;
+        break;
+    case 'L':
+        ++fmt;
+        spec->length = ZLOG_ARG_LENGTH_LONG_DOUBLE;
+        break;
+    default:
+        break;
+    }
+
+    spec->conversion = *fmt;
+    switch (spec->conversion)
+    {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+    case 'p':
+    case '%':
+        break;
+    case 'c':
+    case 's':
+        // Wide characters and strings aren't supported.
+        if (spec->length != ZLOG_ARG_LENGTH_NONE)
+        {
+            return NULL;
+        }
+        break;
+    default:
+        // %n, %m and anything unknown.
+        return NULL;
+    }
+
+    return fmt + 1;
+}
+
+// ------------------------- Record writing ---------------------------
+
+typedef struct tagZLOG_ARGS_WRITER
+{
+    char* record;
+    size_t record_size;
+    size_t len;
+} ZLOG_ARGS_WRITER;
+
+static _Bool zlog_args_write(ZLOG_ARGS_WRITER* writer, const void* data, size_t size)
+{
+    if (size > writer->record_size - writer->len)
+    {
+        return false;
+    }
+
+    memcpy(writer->record + writer->len, data, size);
+    writer->len += size;
+    return true;
+}
+
+// Captures the value of one conversion, whose precision is -1 if none
+static _Bool zlog_args_capture_value(ZLOG_ARGS_WRITER* writer, const ZLOG_ARG_SPEC* spec, int precision, va_list* va)
+{
+    switch (spec->conversion)
+    {
+    case 'd':
+    case 'i':
+    {
+        intmax_t value;
+        switch (spec->length)
+        {
+        case ZLOG_ARG_LENGTH_HH:
+            value = (signed char)va_arg(*va, int);
+            break;
+        case ZLOG_ARG_LENGTH_H:
+            value = (short)va_arg(*va, int);
+            break;
+        case ZLOG_ARG_LENGTH_L:
+            value = va_arg(*va, long);
+            break;
+        case ZLOG_ARG_LENGTH_LL:
+            value = va_arg(*va, long long);
+            break;
+        case ZLOG_ARG_LENGTH_J:
+            value = va_arg(*va, intmax_t);
+            break;
+        case ZLOG_ARG_LENGTH_Z:
+            value = (intmax_t)va_arg(*va, size_t);
+            break;
+        case ZLOG_ARG_LENGTH_T:
+            value = va_arg(*va, ptrdiff_t);
+            break;
+        default:
+            value = va_arg(*va, int);
+            break;
+        }
+        return zlog_args_write(writer, &value, sizeof(value));
+    }
+
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    {
+        uintmax_t value;
+        switch (spec->length)
+        {
+        case ZLOG_ARG_LENGTH_HH:
+            value = (unsigned char)va_arg(*va, unsigned int);
+            break;
+        case ZLOG_ARG_LENGTH_H:
+            value = (unsigned short)va_arg(*va, unsigned int);
+            break;
+        case ZLOG_ARG_LENGTH_L:
+            value = va_arg(*va, unsigned long);
+            break;
+        case ZLOG_ARG_LENGTH_LL:
+            value = va_arg(*va, unsigned long long);
+            break;
+        case ZLOG_ARG_LENGTH_J:
+            value = va_arg(*va, uintmax_t);
+            break;
+        case ZLOG_ARG_LENGTH_Z:
+            value = va_arg(*va, size_t);
+            break;
+        case ZLOG_ARG_LENGTH_T:
+            value = (size_t)va_arg(*va, ptrdiff_t);
+            break;
+        default:
+            value = va_arg(*va, unsigned int);
+            break;
+        }
+        return zlog_args_write(writer, &value, sizeof(value));
+    }
+
+    case 'c':
+    {
+        const intmax_t value = va_arg(*va, int);
+        return zlog_args_write(writer, &value, sizeof(value));
+    }
+
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        if (spec->length == ZLOG_ARG_LENGTH_LONG_DOUBLE)
+        {
+            const long double value = va_arg(*va, long double);
+            return zlog_args_write(writer, &value, sizeof(value));
+        }
+        else
+        {
+            const double value = va_arg(*va, double);
+            return zlog_args_write(writer, &value, sizeof(value));
+        }
+
+    case 'p':
+    {
+        const void* value = va_arg(*va, void*);
+        return zlog_args_write(writer, &value, sizeof(value));
+    }
+
+    case 's':
+    {
+        const char* value = va_arg(*va, const char*);
+        if (value == NULL)
+        {
+            const uint32_t len = ZLOG_ARGS_NULL_STRING;
+            return zlog_args_write(writer, &len, sizeof(len));
+        }
+
+        if (writer->record_size - writer->len < sizeof(uint32_t))
+        {
+            return false;
+        }
+
+        // Only the characters the precision lets through are needed.
+        const size_t room = writer->record_size - writer->len - sizeof(uint32_t);
+        const _Bool precision_fits = precision >= 0 && (size_t)precision <= room;
+        const size_t max_len = precision_fits ? (size_t)precision : room;
+
+        const char* end = memchr(value, '\0', max_len);
+        if (end == NULL && !precision_fits)
+        {
+            // Wouldn't fit.
+            return false;
+        }
+
+        const uint32_t len = (uint32_t)((end == NULL) ? max_len : (size_t)(end - value));
+        return zlog_args_write(writer, &len, sizeof(len)) && zlog_args_write(writer, value, len);
+    }
+
+    default:
+        return true;
+    }
+}
+
+size_t zlog_args_capture(char* record, size_t record_size, const char* fmt, va_list va)
+{
+    ZLOG_ARGS_WRITER writer = { record, record_size, 0 };
+    const size_t fmt_len = strlen(fmt);
+    va_list args;
+    size_t captured_len = 0;
+
+    va_copy(args, va);
+
+    // The format string, null-terminated.
+    if (!zlog_args_write(&writer, fmt, fmt_len + 1))
+    {
+        goto done;
+    }
+
+    for (const char* p = strchr(fmt, '%'); p != NULL; p = strchr(p, '%'))
+    {
+        ZLOG_ARG_SPEC spec;
+
+        p = zlog_args_parse_spec(p + 1, &spec);
+        if (p == NULL)
+        {
+            goto done;
+        }
+
+        if (spec.width_star)
+        {
+            const int width = va_arg(args, int);
+            if (!zlog_args_write(&writer, &width, sizeof(width)))
+            {
+                goto done;
+            }
+        }
+
+        int precision = spec.precision;
+        if (spec.precision_star)
+        {
+            precision = va_arg(args, int);
+            if (!zlog_args_write(&writer, &precision, sizeof(precision)))
+            {
+                goto done;
+            }
+        }
+
+        if (!zlog_args_capture_value(&writer, &spec, precision, &args))
+        {
+            goto done;
+        }
+    }
+
+    captured_len = writer.len;
+
+done:
+    va_end(args);
+    return captured_len;
+}
+
+// ------------------------- Record formatting ---------------------------
+
+typedef struct tagZLOG_ARGS_READER
+{
+    const char* record;
+    size_t record_len;
+    size_t pos;
+} ZLOG_ARGS_READER;
+
+static _Bool zlog_args_read(ZLOG_ARGS_READER* reader, void* data, size_t size)
+{
+    if (size > reader->record_len - reader->pos)
+    {
+        return false;
+    }
+
+    memcpy(data, reader->record + reader->pos, size);
+    reader->pos += size;
+    return true;
+}
+
+// Appends up to len characters to buffer, keeping room for the null terminator
+static void zlog_args_append(char* buffer, size_t buffer_size, size_t* buffer_len, const char* str, size_t len)
+{
+    const size_t room = buffer_size - 1 - *buffer_len;
+    if (len > room)
+    {
+        len = room;
+    }
+
+    memcpy(buffer + *buffer_len, str, len);
+    *buffer_len += len;
+    buffer[*buffer_len] = '\0';
+}
+
+// Formats the value of one conversion at the end of buffer
+// Returns false if the record is malformed
+static _Bool zlog_args_format_value(
+    char* buffer, size_t buffer_size, size_t* buffer_len, const ZLOG_ARG_SPEC* spec, ZLOG_ARGS_READER* reader)
+{
+    char conversion[ZLOG_ARGS_MAX_SPEC];
+    int width = spec->width;
+    int precision = spec->precision;
+
+    if (spec->width_star && !zlog_args_read(reader, &width, sizeof(width)))
+    {
+        return false;
+    }
+
+    if (spec->precision_star && !zlog_args_read(reader, &precision, sizeof(precision)))
+    {
+        return false;
+    }
+
+    // Rebuild the conversion with the '*' filled in, and the length modifier of the captured type.
+    // A negative '*' width means left-justified, which "%-5d" says as well as "%*d" with -5.
+    const char* length = "";
+    if (strchr("diuoxXc", spec->conversion) != NULL)
+    {
+        length = (spec->conversion == 'c') ? "" : "j";
+    }
+    else if (spec->length == ZLOG_ARG_LENGTH_LONG_DOUBLE)
+    {
+        length = "L";
+    }
+
+    int res = snprintf(conversion, sizeof(conversion), "%%%s", spec->flags);
+    if (spec->width_star || width >= 0)
+    {
+        res += snprintf(conversion + res, sizeof(conversion) - res, "%d", width);
+    }
+    if (precision >= 0)
+    {
+        res += snprintf(conversion + res, sizeof(conversion) - res, ".%d", precision);
+    }
+    res += snprintf(conversion + res, sizeof(conversion) - res, "%s%c", length, spec->conversion);
+    if (res >= (int)sizeof(conversion))
+    {
+        return false;
+    }
+
+    char* out = buffer + *buffer_len;
+    const size_t room = buffer_size - *buffer_len;
+    int out_len = 0;
+
+    switch (spec->conversion)
+    {
+    case 'd':
+    case 'i':
+    case 'c':
+    {
+        intmax_t value;
+        if (!zlog_args_read(reader, &value, sizeof(value)))
+        {
+            return false;
+        }
+        out_len = (spec->conversion == 'c') ? snprintf(out, room, conversion, (int)value)
+                                            : snprintf(out, room, conversion, value);
+        break;
+    }
+
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    {
+        uintmax_t value;
+        if (!zlog_args_read(reader, &value, sizeof(value)))
+        {
+            return false;
+        }
+        out_len = snprintf(out, room, conversion, value);
+        break;
+    }
+
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        if (spec->length == ZLOG_ARG_LENGTH_LONG_DOUBLE)
+        {
+            long double value;
+            if (!zlog_args_read(reader, &value, sizeof(value)))
+            {
+                return false;
+            }
+            out_len = snprintf(out, room, conversion, value);
+        }
+        else
+        {
+            double value;
+            if (!zlog_args_read(reader, &value, sizeof(value)))
+            {
+                return false;
+            }
+            out_len = snprintf(out, room, conversion, value);
+        }
+        break;
+
+    case 'p':
+    {
+        void* value;
+        if (!zlog_args_read(reader, &value, sizeof(value)))
+        {
+            return false;
+        }
+        out_len = snprintf(out, room, conversion, value);
+        break;
+    }
+
+    case 's':
+    {
+        uint32_t len;
+        if (!zlog_args_read(reader, &len, sizeof(len)))
+        {
+            return false;
+        }
+
+        if (len == ZLOG_ARGS_NULL_STRING)
+        {
+            out_len = snprintf(out, room, conversion, (const char*)NULL);
+            break;
+        }
+
+        if (len > reader->record_len - reader->pos)
+        {
+            return false;
+        }
+
+        // The captured characters aren't null-terminated, so bound them with the precision.
+        const char* value = reader->record + reader->pos;
+        reader->pos += len;
+        if (precision < 0 || (uint32_t)precision > len)
+        {
+            res = snprintf(conversion, sizeof(conversion), "%%%s", spec->flags);
+            if (spec->width_star || width >= 0)
+            {
+                res += snprintf(conversion + res, sizeof(conversion) - res, "%d", width);
+            }
+            res += snprintf(conversion + res, sizeof(conversion) - res, ".%us", (unsigned int)len);
+            if (res >= (int)sizeof(conversion))
+            {
+                return false;
+            }
+        }
+        out_len = snprintf(out, room, conversion, value);
+        break;
+    }
+
+    case '%':
+        zlog_args_append(buffer, buffer_size, buffer_len, "%", 1);
+        return true;
+
+    default:
+        return false;
+    }
+
+    if (out_len > 0)
+    {
+        *buffer_len += ((size_t)out_len < room) ? (size_t)out_len : room - 1;
+    }
+
+    return true;
+}
+
+void zlog_args_format(char* buffer, size_t buffer_size, const char* record, size_t record_len)
+{
+    ZLOG_ARGS_READER reader = { record, record_len, 0 };
+    size_t buffer_len = 0;
+
+    if (buffer_size == 0)
+    {
+        return;
+    }
+
+    buffer[0] = '\0';
+
+    const char* fmt_end = memchr(record, '\0', record_len);
+    if (fmt_end == NULL)
+    {
+        return;
+    }
+
+    const char* fmt = record;
+    reader.pos = (size_t)(fmt_end - record) + 1;
+
+    while (*fmt != '\0' && buffer_len < buffer_size - 1)
+    {
+        const char* percent = strchr(fmt, '%');
+        const size_t literal_len = (percent == NULL) ? strlen(fmt) : (size_t)(percent - fmt);
+        ZLOG_ARG_SPEC spec;
+
+        zlog_args_append(buffer, buffer_size, &buffer_len, fmt, literal_len);
+        if (percent == NULL)
+        {
+            break;
+        }
+
+        fmt = zlog_args_parse_spec(percent + 1, &spec);
+        if (fmt == NULL || !zlog_args_format_value(buffer, buffer_size, &buffer_len, &spec, &reader))
+        {
+            // Only records that zlog_args_capture accepted are formatted, so this is a corrupted record.
+            break;
+        }
+    }
+}
@@ -0,0 +1,23 @@
+/**
+ * @file zlog_args.h
+ * @brief Captures printf-style arguments, so that they can be formatted later on another thread.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ZLOG_ARGS_H
+#define ZLOG_ARGS_H
+
+#include <stdarg.h>
+#include <stddef.h>
+
+// Copies fmt and the arguments it refers to (including the strings %s points to) into record.
+// Returns the length of the record, or 0 if it doesn't fit in record_size bytes or fmt uses a conversion
+// that can't be captured, e.g. %n, %m, %ls or positional arguments; the caller then formats right away.
+size_t zlog_args_capture(char* record, size_t record_size, const char* fmt, va_list va);
+
+// Formats a record of record_len bytes captured by zlog_args_capture into buffer, like vsnprintf would have.
+// buffer is always null-terminated, and truncated to buffer_size - 1 characters if need be.
+void zlog_args_format(char* buffer, size_t buffer_size, const char* record, size_t record_len);
+
+#endif // ZLOG_ARGS_H
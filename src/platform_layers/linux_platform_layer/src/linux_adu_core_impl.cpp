@@ -8,19 +8,27 @@
 #include "linux_adu_core_impl.hpp"
 #include "aduc/agent_workflow.h"
 #include "aduc/calloc_wrapper.hpp"
+#include "aduc/config_utils.h"
 #include "aduc/content_handler.hpp"
+#include "aduc/cpu_affinity_utils.h"
+#include "aduc/download_throttle.h"
 #include "aduc/extension_manager.hpp"
 #include "aduc/hash_utils.h"
+#include "aduc/process_utils.hpp"
 #include "aduc/string_c_utils.h"
 #include "aduc/string_utils.hpp"
 #include "aduc/system_utils.h"
+#include "aduc/thermal_utils.h"
 #include "aduc/types/workflow.h"
 #include "aduc/workflow_data_utils.h"
 #include "aduc/workflow_internal.h"
 #include "aduc/workflow_utils.h"
 
+#include <algorithm>
+#include <climits> // for INT_MAX
 #include <cstring>
 #include <grp.h> // for getgrnam
+#include <poll.h>
 #include <pwd.h> // for getpwnam
 #include <sys/stat.h>
 #include <unistd.h>
@@ -28,6 +36,7 @@
 #include <memory>
 #include <sstream>
 #include <system_error>
+#include <thread>
 #include <vector>
 
 using ADUC::LinuxPlatformLayer;
@@ -35,8 +44,16 @@ using ADUC::StringUtils::cstr_wrapper;
 
 #define UPDATE_MANIFEST_V4_DEFAULT_HANDLER "microsoft/update-manifest"
 #define COMPONENT_CHANGED_DETECTION_INTERVAL_SECONDS 600
+// The interval of the checks when the component enumerator exports GetComponentsGeneration, which is cheap.
+#define COMPONENT_GENERATION_CHECK_INTERVAL_SECONDS 5
 
-std::string LinuxPlatformLayer::g_componentsInfo;
+// The sandbox of prefetched files; not a workflow id, so it can't clash with the sandbox of a workflow.
+#define PREFETCH_WORK_FOLDER ADUC_DOWNLOADS_FOLDER "/.prefetch"
+
+uint64_t LinuxPlatformLayer::g_componentsDigest;
+bool LinuxPlatformLayer::g_hasComponentsDigest;
+uint64_t LinuxPlatformLayer::g_componentsGeneration;
+bool LinuxPlatformLayer::g_hasComponentsGeneration;
 time_t LinuxPlatformLayer::g_lastComponentsCheckTime;
 
 /**
@@ -52,6 +69,11 @@ std::unique_ptr<LinuxPlatformLayer> LinuxPlatformLayer::Create()
     return std::unique_ptr<LinuxPlatformLayer>{ new LinuxPlatformLayer() };
 }
 
+LinuxPlatformLayer::~LinuxPlatformLayer()
+{
+    StopPrefetch();
+}
+
 /**
  * @brief Set the ADUC_UpdateActionCallbacks object
  *
@@ -74,6 +96,8 @@ ADUC_Result LinuxPlatformLayer::SetUpdateActionCallbacks(ADUC_UpdateActionCallba
 
     data->DoWorkCallback = DoWorkCallback;
 
+    data->PrefetchCallback = PrefetchCallback;
+
     // Opaque token, passed to callbacks.
 
     data->PlatformLayerHandle = this;
@@ -88,6 +112,15 @@ void LinuxPlatformLayer::Idle(const char* workflowId)
 {
     Log_Info("Now idle. workflowId: %s", workflowId);
     _IsCancellationRequested = false;
+
+    // The workflow that the files were prefetched for has completed, or was dropped.
+    if (StopPrefetch())
+    {
+        SandboxDestroy("prefetch", PREFETCH_WORK_FOLDER);
+    }
+
+    // The files of the workflow are gone with its sandbox, so are the reasons to keep their records in memory.
+    ExtensionManager::ClearVerifiedFileCache();
 }
 
 static ContentHandler* GetContentTypeHandler(const ADUC_WorkflowData* workflowData, ADUC_Result* result)
@@ -132,9 +165,8 @@ static ContentHandler* GetContentTypeHandler(const ADUC_WorkflowData* workflowDa
         }
         else
         {
-            char* updateType = workflow_get_update_type(workflowData->WorkflowHandle);
+            const char* updateType = workflow_peek_update_type(workflowData->WorkflowHandle);
             loadResult = ExtensionManager::LoadUpdateContentHandlerExtension(updateType, &contentHandler);
-            workflow_free_string(updateType);
         }
 
         if (IsAducResultCodeFailure(loadResult.ResultCode))
@@ -147,6 +179,43 @@ static ContentHandler* GetContentTypeHandler(const ADUC_WorkflowData* workflowDa
     return contentHandler;
 }
 
+/**
+ * @brief Returns whether downloads run with idle CPU and I/O priority, see downloadIdlePriority in the configuration
+ * file.
+ */
+static bool IsDownloadIdlePriorityEnabled()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    const bool enabled = config != nullptr && config->downloadIdlePriority;
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+
+    return enabled;
+}
+
+/**
+ * @brief Waits for the download start delay of the device, see downloadStartJitterSeconds in the configuration file,
+ * so that the devices of a large rollout don't all start downloading at the same moment.
+ * @return false if the workflow was cancelled meanwhile.
+ */
+static bool WaitForDownloadStart(const ADUC_WorkflowData* workflowData)
+{
+    const unsigned int delaySeconds = workflow_get_download_start_delay(workflowData->WorkflowHandle);
+    if (delaySeconds == 0)
+    {
+        return true;
+    }
+
+    Log_Info("Waiting %u s before downloading, to spread the downloads of the rollout.", delaySeconds);
+
+    // Without a file descriptor, poll() just waits.
+    const ADUC_CancellationToken* token = workflow_peek_cancellation_token(workflowData->WorkflowHandle);
+    struct pollfd cancelPollFd = { ADUC_CancellationToken_GetFd(token), POLLIN, 0 };
+    const int timeoutMs = static_cast<int>(std::min<unsigned int>(delaySeconds, INT_MAX / 1000) * 1000);
+
+    return poll(&cancelPollFd, 1, timeoutMs) <= 0 && !ADUC_CancellationToken_IsCancelled(token);
+}
+
 /**
  * @brief Class implementation of Download method.
  * @return ADUC_Result
@@ -161,7 +230,27 @@ ADUC_Result LinuxPlatformLayer::Download(const ADUC_WorkflowData* workflowData)
         goto done;
     }
 
-    result = contentHandler->Download(workflowData);
+    if (!WaitForDownloadStart(workflowData))
+    {
+        result = ADUC_Result{ ADUC_Result_Failure_Cancelled };
+    }
+    else if (IsDownloadIdlePriorityEnabled())
+    {
+        // The threads the download starts, e.g. to hash files, inherit the idle priority of this one, which is
+        // short-lived since an unprivileged thread can't get its priority back.
+        std::thread downloadThread{ [contentHandler, workflowData, &result]() {
+            ADUC_SetCurrentThreadIdlePriority();
+            result = ADUC::ExceptionUtils::CallResultMethodAndHandleExceptions(
+                ADUC_Result_Failure,
+                [contentHandler, workflowData]() -> ADUC_Result { return contentHandler->Download(workflowData); });
+        } };
+        downloadThread.join();
+    }
+    else
+    {
+        result = contentHandler->Download(workflowData);
+    }
+
     if (_IsCancellationRequested)
     {
         result = ADUC_Result{ ADUC_Result_Failure_Cancelled };
@@ -179,7 +268,6 @@ done:
 ADUC_Result LinuxPlatformLayer::Install(const ADUC_WorkflowData* workflowData)
 {
     ADUC_Result result{ ADUC_Result_Failure };
-    char* workflowId = workflow_get_id(workflowData->WorkflowHandle);
 
     ContentHandler* contentHandler = GetContentTypeHandler(workflowData, &result);
     if (contentHandler == nullptr)
@@ -187,7 +275,16 @@ ADUC_Result LinuxPlatformLayer::Install(const ADUC_WorkflowData* workflowData)
         goto done;
     }
 
-    result = contentHandler->Install(workflowData);
+    // Installs, e.g. flashing an image, keep the CPU busy; an overheated or low-battery device waits first.
+    if (ADUC_Thermal_WaitForHeadroom(workflow_peek_cancellation_token(workflowData->WorkflowHandle)))
+    {
+        result = contentHandler->Install(workflowData);
+    }
+    else
+    {
+        result = ADUC_Result{ ADUC_Result_Failure_Cancelled };
+    }
+
     if (_IsCancellationRequested)
     {
         result = ADUC_Result{ ADUC_Result_Failure_Cancelled };
@@ -195,7 +292,6 @@ ADUC_Result LinuxPlatformLayer::Install(const ADUC_WorkflowData* workflowData)
     }
 
 done:
-    workflow_free_string(workflowId);
     return result;
 }
 
@@ -207,15 +303,22 @@ ADUC_Result LinuxPlatformLayer::Apply(const ADUC_WorkflowData* workflowData)
 {
     ADUC_Result result{ ADUC_Result_Failure };
 
-    char* workflowId = workflow_get_id(workflowData->WorkflowHandle);
-
     ContentHandler* contentHandler = GetContentTypeHandler(workflowData, &result);
     if (contentHandler == nullptr)
     {
         goto done;
     }
 
-    result = contentHandler->Apply(workflowData);
+    // As for Install.
+    if (ADUC_Thermal_WaitForHeadroom(workflow_peek_cancellation_token(workflowData->WorkflowHandle)))
+    {
+        result = contentHandler->Apply(workflowData);
+    }
+    else
+    {
+        result = ADUC_Result{ ADUC_Result_Failure_Cancelled };
+    }
+
     if (_IsCancellationRequested)
     {
         result = ADUC_Result{ ADUC_Result_Failure_Cancelled };
@@ -223,7 +326,6 @@ ADUC_Result LinuxPlatformLayer::Apply(const ADUC_WorkflowData* workflowData)
     }
 
 done:
-    workflow_free_string(workflowId);
     return result;
 }
 
@@ -233,12 +335,11 @@ done:
 void LinuxPlatformLayer::Cancel(const ADUC_WorkflowData* workflowData)
 {
     ADUC_Result result{ ADUC_Result_Failure };
-    char* workflowId = workflow_get_id(workflowData->WorkflowHandle);
+    const char* workflowId = workflow_peek_id(workflowData->WorkflowHandle);
 
     Log_Info("Cancelling. workflowId: %s", workflowId);
 
     _IsCancellationRequested = true;
-    workflow_free_string(workflowId);
 
     ContentHandler* contentHandler = GetContentTypeHandler(workflowData, &result);
     if (contentHandler == nullptr)
@@ -307,14 +408,14 @@ ADUC_Result LinuxPlatformLayer::SandboxCreate(const char* workflowId, char* work
         return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
     }
 
-    // Try to delete existing directory.
+    // Try to delete existing directory. It's renamed aside right away, and deleted in the background.
     int dir_result;
     struct stat sb
     {
     };
     if (stat(workFolder, &sb) == 0 && S_ISDIR(sb.st_mode))
     {
-        dir_result = ADUC_SystemUtils_RmDirRecursive(workFolder);
+        dir_result = ADUC_SystemUtils_RmDirRecursiveDeferred(workFolder);
         if (dir_result != 0)
         {
             // Not critical if failed.
@@ -322,6 +423,14 @@ ADUC_Result LinuxPlatformLayer::SandboxCreate(const char* workflowId, char* work
         }
     }
 
+    // Files staged in RAM for an earlier sandbox of the same folder, e.g. before the agent restarted.
+    dir_result = ADUC_SystemUtils_RmRamStagingDir(workFolder);
+    if (dir_result != 0)
+    {
+        // Not critical if failed.
+        Log_Info("Unable to remove RAM staging folder of %s, error %d", workFolder, dir_result);
+    }
+
     // Note: the return value may point to a static area,
     // and may be overwritten by subsequent calls to getpwent(3), getpwnam(), or getpwuid().
     // (Do not pass the returned pointer to free(3).)
@@ -375,7 +484,8 @@ void LinuxPlatformLayer::SandboxDestroy(const char* workflowId, const char* work
     bool statOk = stat(workFolder, &st) == 0;
     if (statOk && S_ISDIR(st.st_mode))
     {
-        int ret = ADUC_SystemUtils_RmDirRecursive(workFolder);
+        // Renamed aside right away, and deleted in the background, so that the next deployment needn't wait.
+        int ret = ADUC_SystemUtils_RmDirRecursiveDeferred(workFolder);
         if (ret != 0)
         {
             // Not a fatal error.
@@ -386,6 +496,149 @@ void LinuxPlatformLayer::SandboxDestroy(const char* workflowId, const char* work
     {
         Log_Info("Can not access folder '%s', or doesn't exist. Ignored...", workFolder);
     }
+
+    // Along with the files of the sandbox staged in RAM, see ADUC_SystemUtils_BeginRamStaging.
+    int ret = ADUC_SystemUtils_RmRamStagingDir(workFolder);
+    if (ret != 0)
+    {
+        // Not a fatal error.
+        Log_Error("Unable to remove RAM staging folder of sandbox, error %d", ret);
+    }
+}
+
+/**
+ * @brief Returns whether the files of a waiting workflow are prefetched, see prefetchDownloads in the configuration
+ * file.
+ */
+static bool IsPrefetchEnabled()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    const bool enabled = config != nullptr && config->prefetchDownloads;
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+
+    return enabled;
+}
+
+void LinuxPlatformLayer::Prefetch(ADUC_WorkflowHandle workflowHandle)
+{
+    StopPrefetch();
+
+    if (workflowHandle == nullptr || !IsPrefetchEnabled())
+    {
+        return;
+    }
+
+    const std::string workflowId{ workflow_peek_id(workflowHandle) != nullptr ? workflow_peek_id(workflowHandle) : "" };
+    std::vector<ADUC_FileEntity*> entities;
+
+    // Copied, as the workflow may be freed, e.g. replaced again, while its files download.
+    const size_t fileCount = workflow_get_update_files_count(workflowHandle);
+    for (size_t i = 0; i < fileCount; ++i)
+    {
+        ADUC_FileEntity* entity = nullptr;
+        if (workflow_get_update_file(workflowHandle, i, &entity))
+        {
+            entities.push_back(entity);
+        }
+    }
+
+    ADUC_CancellationToken* cancellationToken = nullptr;
+    char workFolder[] = PREFETCH_WORK_FOLDER;
+
+    // Recreating the sandbox removes the files of an earlier prefetch, for a workflow that was replaced before it
+    // started. The files of a workflow that did start were linked or copied into its own sandbox.
+    if (entities.empty() || workflowId.empty()
+        || IsAducResultCodeFailure(SandboxCreate(workflowId.c_str(), workFolder).ResultCode)
+        || (cancellationToken = ADUC_CancellationToken_Create()) == nullptr)
+    {
+        for (ADUC_FileEntity* entity : entities)
+        {
+            workflow_free_file_entity(entity);
+        }
+
+        return;
+    }
+
+    Log_Info("Prefetching %zu file(s) of workflow %s.", entities.size(), workflowId.c_str());
+
+    std::lock_guard<std::mutex> lock{ _prefetchMutex };
+
+    // The download of the workflow, once it starts, takes the prefetched files from the payloads or the download
+    // cache of the extension manager, or waits for the one being prefetched.
+    try
+    {
+        _prefetchThread = std::thread{ [entities, workflowId, cancellationToken]() {
+            ADUC_SetCurrentThreadIdlePriority();
+            (void)ADUC_CpuAffinity_ApplyToCurrentThread(ADUC_ThreadClass_IO);
+            ADUC_DownloadThrottle_SetThreadPriority(ADUC_TransferPriority_Background);
+
+            for (ADUC_FileEntity* entity : entities)
+            {
+                if (ADUC_CancellationToken_IsCancelled(cancellationToken))
+                {
+                    break;
+                }
+
+                const ADUC_Result result = ExtensionManager::Download(
+                    entity,
+                    workflowId.c_str(),
+                    PREFETCH_WORK_FOLDER,
+                    DO_RETRY_TIMEOUT_DEFAULT,
+                    nullptr /* downloadProgressCallback */,
+                    cancellationToken);
+
+                // Not fatal; the workflow downloads the file itself.
+                if (IsAducResultCodeFailure(result.ResultCode) && result.ResultCode != ADUC_Result_Failure_Cancelled)
+                {
+                    Log_Warn(
+                        "Cannot prefetch %s, ERC %#08x.",
+                        entity->TargetFilename != nullptr ? entity->TargetFilename : "(NULL)",
+                        result.ExtendedResultCode);
+                }
+            }
+
+            for (ADUC_FileEntity* entity : entities)
+            {
+                workflow_free_file_entity(entity);
+            }
+        } };
+    }
+    catch (...)
+    {
+        Log_Error("Cannot start the prefetch of workflow %s.", workflowId.c_str());
+        ADUC_CancellationToken_Destroy(cancellationToken);
+
+        for (ADUC_FileEntity* entity : entities)
+        {
+            workflow_free_file_entity(entity);
+        }
+
+        return;
+    }
+
+    _prefetchCancellationToken = cancellationToken;
+}
+
+bool LinuxPlatformLayer::StopPrefetch()
+{
+    std::lock_guard<std::mutex> lock{ _prefetchMutex };
+
+    if (_prefetchCancellationToken == nullptr)
+    {
+        return false;
+    }
+
+    ADUC_CancellationToken_Cancel(_prefetchCancellationToken);
+
+    if (_prefetchThread.joinable())
+    {
+        _prefetchThread.join();
+    }
+
+    ADUC_CancellationToken_Destroy(_prefetchCancellationToken);
+    _prefetchCancellationToken = nullptr;
+    return true;
 }
 
 /**
@@ -413,41 +666,66 @@ void LinuxPlatformLayer::DetectAndHandleComponentsAvailabilityChangedEvent(ADUC_
     struct timeval tv;
     gettimeofday(&tv, NULL);
     time_t nowTime = tv.tv_sec;
+    const time_t checkInterval = g_hasComponentsGeneration ? COMPONENT_GENERATION_CHECK_INTERVAL_SECONDS
+                                                           : COMPONENT_CHANGED_DETECTION_INTERVAL_SECONDS;
+    uint64_t generation = 0;
+    uint64_t digest = 0;
+    ADUC_Result result = {};
 
-    if ((nowTime - g_lastComponentsCheckTime) > COMPONENT_CHANGED_DETECTION_INTERVAL_SECONDS)
+    if ((nowTime - g_lastComponentsCheckTime) <= checkInterval)
     {
-        g_lastComponentsCheckTime = nowTime;
-        Log_Info("Check whether the components collection has changed...");
-        std::string components;
-        ADUC_Result result = ExtensionManager::GetAllComponents(components);
-        if (IsAducResultCodeFailure(result.ResultCode))
-        {
-            if (result.ExtendedResultCode == ADUC_ERC_COMPONENT_ENUMERATOR_GETALLCOMPONENTS_NOTIMP)
-            {
-                // No component enumerators, no op.
-                goto done;
-            }
+        goto done;
+    }
+
+    g_lastComponentsCheckTime = nowTime;
 
-            Log_Error("Cannot get components information. erc: 0x%x", result.ExtendedResultCode);
+    // If the component enumerator tracks the changes, enumerate only once the generation changed.
+    result = ExtensionManager::GetComponentsGeneration(&generation);
+    if (IsAducResultCodeSuccess(result.ResultCode))
+    {
+        if (g_hasComponentsGeneration && generation == g_componentsGeneration)
+        {
             goto done;
         }
 
-        // If component has changed, re-process the latest deployment goal state.
-        if (g_componentsInfo.empty())
+        g_componentsGeneration = generation;
+        g_hasComponentsGeneration = true;
+    }
+    else
+    {
+        g_hasComponentsGeneration = false;
+    }
+
+    Log_Info("Check whether the components collection has changed...");
+    result = ExtensionManager::GetAllComponentsDigest(&digest);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        if (result.ExtendedResultCode == ADUC_ERC_COMPONENT_ENUMERATOR_GETALLCOMPONENTS_NOTIMP)
         {
-            // Save the baseline.
-            g_componentsInfo = components;
+            // No component enumerators, no op.
             goto done;
         }
 
-        if (g_componentsInfo != components)
-        {
-            // Something changed.
-            Log_Info("Components changed deltected");
-            g_componentsInfo = components;
+        Log_Error("Cannot get components information. erc: 0x%x", result.ExtendedResultCode);
+        goto done;
+    }
 
-            RetryWorkflowDueToComponentChanged((ADUC_WorkflowData*)workflowData);
-        }
+    // If component has changed, re-process the latest deployment goal state.
+    if (!g_hasComponentsDigest)
+    {
+        // Save the baseline.
+        g_componentsDigest = digest;
+        g_hasComponentsDigest = true;
+        goto done;
+    }
+
+    if (g_componentsDigest != digest)
+    {
+        // Something changed.
+        Log_Info("Components changed deltected");
+        g_componentsDigest = digest;
+
+        RetryWorkflowDueToComponentChanged((ADUC_WorkflowData*)workflowData);
     }
 
 done:
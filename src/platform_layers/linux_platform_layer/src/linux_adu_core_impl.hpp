@@ -10,17 +10,20 @@
 
 #include <atomic>
 #include <exception>
+#include <mutex>
 #include <thread>
 
 #include <sys/time.h> // for gettimeofday
 #include <time.h>
 
 #include "aduc/adu_core_exports.h"
+#include "aduc/cancellation_token.h"
 #include "aduc/exception_utils.hpp"
 #include "aduc/logging.h"
 #include "aduc/result.h"
 #include "aduc/types/workflow.h"
 #include "aduc/workflow_utils.h"
+#include "worker_pool.hpp"
 
 namespace ADUC
 {
@@ -34,8 +37,13 @@ public:
 
     ADUC_Result SetUpdateActionCallbacks(ADUC_UpdateActionCallbacks* data);
 
+    ~LinuxPlatformLayer();
+
 private:
-    static std::string g_componentsInfo;
+    static uint64_t g_componentsDigest;
+    static bool g_hasComponentsDigest;
+    static uint64_t g_componentsGeneration;
+    static bool g_hasComponentsGeneration;
     static time_t g_lastComponentsCheckTime;
 
     //
@@ -55,6 +63,65 @@ private:
             [&token, &workflowId]() -> void { static_cast<LinuxPlatformLayer*>(token)->Idle(workflowId); });
     }
 
+    /**
+     * @brief Cancels the workflow whose action runs when the worker pool stops.
+     *
+     * @param context The cancellation token of the workflow.
+     */
+    static void CancelWorkflowOnStop(void* context)
+    {
+        ADUC_CancellationToken_Cancel(static_cast<ADUC_CancellationToken*>(context));
+    }
+
+    /**
+     * @brief Queues an update action to run on a worker thread of the platform layer.
+     *
+     * @param token Opaque token.
+     * @param workCompletionData Contains information on what to do when the action is completed.
+     * @param workflowData The workflow data passed to the action.
+     * @param operation The action, e.g. LinuxPlatformLayer::Download.
+     * @return bool true if the action was queued; its completion is then reported through WorkCompletionCallback.
+     * Stopping the worker pool while the action runs cancels the workflow, so that it finishes early.
+     */
+    static bool PostOperation(
+        ADUC_Token token,
+        const ADUC_WorkCompletionData* workCompletionData,
+        const ADUC_WorkflowData* workflowData,
+        ADUC_Result (LinuxPlatformLayer::*operation)(const ADUC_WorkflowData*))
+    {
+        LinuxPlatformLayer* platformLayer = static_cast<LinuxPlatformLayer*>(token);
+
+        // Pointers passed to this method are guaranteed to be valid until WorkCompletionCallback is called.
+        return platformLayer->_workerPool.Post(
+            [platformLayer, workCompletionData, workflowData, operation](const ADUC_CancellationToken* stopToken) {
+                ADUC_Result result{ ADUC_Result_Failure_Cancelled };
+                ADUC_CancellationToken* workflowToken =
+                    workflow_peek_cancellation_token(workflowData->WorkflowHandle);
+
+                // An action that didn't start before the agent began shutting down is cancelled, and one that is
+                // running when it does is interrupted through the cancellation token of its workflow.
+                if (!ADUC_CancellationToken_IsCancelled(stopToken))
+                {
+                    const bool registered =
+                        ADUC_CancellationToken_Register(stopToken, &CancelWorkflowOnStop, workflowToken);
+
+                    result = ADUC::ExceptionUtils::CallResultMethodAndHandleExceptions(
+                        ADUC_Result_Failure, [platformLayer, workflowData, operation]() -> ADUC_Result {
+                            return (platformLayer->*operation)(workflowData);
+                        });
+
+                    if (registered)
+                    {
+                        ADUC_CancellationToken_Unregister(stopToken, &CancelWorkflowOnStop, workflowToken);
+                    }
+                }
+
+                // Report result to main thread.
+                workCompletionData->WorkCompletionCallback(
+                    workCompletionData->WorkCompletionToken, result, true /* isAsync */);
+            });
+    }
+
     /**
      * @brief Implements Download callback.
      *
@@ -70,23 +137,15 @@ private:
 
         try
         {
-            Log_Info("Download thread started.");
-
-            // Pointers passed to this method are guaranteed to be valid until WorkCompletionCallback is called.
-            std::thread worker{ [token, workCompletionData, workflowData] {
-                const ADUC_Result result{ ADUC::ExceptionUtils::CallResultMethodAndHandleExceptions(
-                    ADUC_Result_Failure, [&token, &workCompletionData, &workflowData]() -> ADUC_Result {
-                        return static_cast<LinuxPlatformLayer*>(token)->Download(workflowData);
-                    }) };
-
-                // Report result to main thread.
-                workCompletionData->WorkCompletionCallback(workCompletionData->WorkCompletionToken, result, true /* isAsync */);
-            } };
+            if (!PostOperation(token, workCompletionData, workflowData, &LinuxPlatformLayer::Download))
+            {
+                Log_Error("Cannot queue download, the worker threads are busy or stopping.");
+                return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
+            }
 
-            // Allow the thread to work independently of this main thread.
-            worker.detach();
+            Log_Info("Download task queued.");
 
-            // Indicate that we've spun off a thread to do the actual work.
+            // Indicate that a worker thread will do the actual work.
             return ADUC_Result{ ADUC_Result_Download_InProgress };
         }
         catch (const ADUC::Exception& e)
@@ -120,23 +179,15 @@ private:
         const ADUC_WorkflowData* workflowData = static_cast<const ADUC_WorkflowData*>(info);
         try
         {
-            Log_Info("Install thread started");
+            if (!PostOperation(token, workCompletionData, workflowData, &LinuxPlatformLayer::Install))
+            {
+                Log_Error("Cannot queue install, the worker threads are busy or stopping.");
+                return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
+            }
 
-            // Pointers passed to this method are guaranteed to be valid until WorkCompletionCallback is called.
-            std::thread worker{ [token, workCompletionData, workflowData] {
-                const ADUC_Result result{ ADUC::ExceptionUtils::CallResultMethodAndHandleExceptions(
-                    ADUC_Result_Failure, [&token, &workCompletionData, &workflowData]() -> ADUC_Result {
-                        return static_cast<LinuxPlatformLayer*>(token)->Install(workflowData);
-                    }) };
+            Log_Info("Install task queued");
 
-                // Report result to main thread.
-                workCompletionData->WorkCompletionCallback(workCompletionData->WorkCompletionToken, result, true /* isAsync */);
-            } };
-
-            // Allow the thread to work independently of this main thread.
-            worker.detach();
-
-            // Indicate that we've spun off a thread to do the actual work.
+            // Indicate that a worker thread will do the actual work.
             result = { ADUC_Result_Install_InProgress };
         }
         catch (const ADUC::Exception& e)
@@ -171,22 +222,15 @@ private:
         const ADUC_WorkflowData* workflowData = static_cast<const ADUC_WorkflowData*>(info);
         try
         {
-            Log_Info("Apply thread started");
-
-            // Pointers passed to this method are guaranteed to be valid until WorkCompletionCallback is called.
-            std::thread worker{ [token, workCompletionData, workflowData] {
-                const ADUC_Result result{ ADUC::ExceptionUtils::CallResultMethodAndHandleExceptions(
-                    ADUC_Result_Failure, [&token, &workCompletionData, &workflowData]() -> ADUC_Result {
-                        return static_cast<LinuxPlatformLayer*>(token)->Apply(workflowData);
-                    }) };
-                // Report result to main thread.
-                workCompletionData->WorkCompletionCallback(workCompletionData->WorkCompletionToken, result, true /* isAsync */);
-            } };
+            if (!PostOperation(token, workCompletionData, workflowData, &LinuxPlatformLayer::Apply))
+            {
+                Log_Error("Cannot queue apply, the worker threads are busy or stopping.");
+                return ADUC_Result{ ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE };
+            }
 
-            // Allow the thread to work independently of this main thread.
-            worker.detach();
+            Log_Info("Apply task queued");
 
-            // Indicate that we've spun off a thread to do the actual work.
+            // Indicate that a worker thread will do the actual work.
             return ADUC_Result{ ADUC_Result_Apply_InProgress };
         }
         catch (const ADUC::Exception& e)
@@ -293,6 +337,19 @@ private:
         DetectAndHandleComponentsAvailabilityChangedEvent(token, workflowData);
     }
 
+    /**
+     * @brief Implements Prefetch callback.
+     *
+     * @param token Contains pointer to our class instance.
+     * @param workflowHandle The workflow that waits for the current one, or NULL to stop the prefetch.
+     */
+    static void PrefetchCallback(ADUC_Token token, void* workflowHandle) noexcept
+    {
+        ADUC::ExceptionUtils::CallVoidMethodAndHandleExceptions([&token, &workflowHandle]() -> void {
+            static_cast<LinuxPlatformLayer*>(token)->Prefetch(workflowHandle);
+        });
+    }
+
     //
     // Implementation.
     //
@@ -326,10 +383,47 @@ private:
      */
     void SandboxDestroy(const char* workflowId, const char* workFolder);
 
+    /**
+     * @brief Starts downloading the files of @p workflowHandle on a background thread, with idle priority, if
+     * prefetchDownloads is set in the configuration file.
+     *
+     * @param workflowHandle The workflow that waits for the current one, or NULL to stop the prefetch.
+     */
+    void Prefetch(ADUC_WorkflowHandle workflowHandle);
+
+    /**
+     * @brief Cancels the prefetch in progress, if any, and waits for its thread.
+     *
+     * @return bool true if a prefetch had been started.
+     */
+    bool StopPrefetch();
+
     /**
      * @brief Was Cancel called?
      */
     std::atomic_bool _IsCancellationRequested{ false };
+
+    /**
+     * @brief Guards the prefetch thread and its cancellation token.
+     */
+    std::mutex _prefetchMutex;
+
+    /**
+     * @brief Downloads the files of the waiting workflow, see Prefetch.
+     */
+    std::thread _prefetchThread;
+
+    /**
+     * @brief Cancels _prefetchThread. NULL if no prefetch was started.
+     */
+    ADUC_CancellationToken* _prefetchCancellationToken = nullptr;
+
+    /**
+     * @brief Runs Download, Install and Apply, on the CPUs of compute threads since they hash, decompress and verify
+     * the content. Declared last so that it is stopped, and its threads joined, before the other members are
+     * destroyed.
+     */
+    WorkerPool _workerPool{ "adu-worker", 2 /* threadCount */, 4 /* queueCapacity */, ADUC_ThreadClass_Compute };
 };
 } // namespace ADUC
 
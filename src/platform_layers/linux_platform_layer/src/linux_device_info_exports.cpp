@@ -7,6 +7,7 @@
  */
 #include "aduc/device_info_exports.h"
 
+#include <fstream>
 #include <functional>
 #include <sstream>
 #include <string>
@@ -42,10 +43,10 @@ static char* DeviceInfo_GetManufacturer()
 
     char* result = nullptr;
 
-    ADUC_ConfigInfo config = {};
-    if (ADUC_ConfigInfo_Init(&config, ADUC_CONF_FILE_PATH) && config.manufacturer != nullptr)
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    if (config != nullptr && config->manufacturer != nullptr)
     {
-        result = strdup(config.manufacturer);
+        result = strdup(config->manufacturer);
     }
     else
     {
@@ -54,7 +55,7 @@ static char* DeviceInfo_GetManufacturer()
     }
 
     valueIsDirty = false;
-    ADUC_ConfigInfo_UnInit(&config);
+    ADUC_ConfigInfo_ReleaseInstance(config);
     return result;
 }
 
@@ -75,10 +76,10 @@ static char* DeviceInfo_GetModel()
     }
 
     char* result = nullptr;
-    ADUC_ConfigInfo config = {};
-    if (ADUC_ConfigInfo_Init(&config, ADUC_CONF_FILE_PATH) && config.model != nullptr)
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    if (config != nullptr && config->model != nullptr)
     {
-        result = strdup(config.model);
+        result = strdup(config->model);
     }
     else
     {
@@ -87,7 +88,7 @@ static char* DeviceInfo_GetModel()
     }
 
     valueIsDirty = false;
-    ADUC_ConfigInfo_UnInit(&config);
+    ADUC_ConfigInfo_ReleaseInstance(config);
     return result;
 }
 
@@ -194,28 +195,55 @@ static char* DeviceInfo_GetProcessorManufacturer()
     }
 
     std::string manufacturer;
-    const unsigned int kBufferSize = 256;
-    char buffer[kBufferSize];
+    std::string implementer;
 
-    FILE* pipe{ popen("/usr/bin/lscpu", "r") }; // NOLINT(cert-env33-c)
-    if (pipe != nullptr)
+    // Read the CPU information from the kernel rather than launching lscpu, which reads the same file.
+    std::ifstream cpuinfo{ "/proc/cpuinfo" };
+    std::string line;
+    while (manufacturer.empty() && std::getline(cpuinfo, line))
     {
-        const char* prefix = "Vendor ID:           ";
-        const unsigned int prefix_cch = strlen(prefix);
-        while (fgets(buffer, kBufferSize, pipe) != nullptr)
+        const std::string::size_type separator = line.find(':');
+        if (separator == std::string::npos)
         {
-            if (strncmp(buffer, prefix, prefix_cch) == 0)
-            {
-                // Trim at newline.
-                // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-constant-array-index)
-                buffer[strcspn(buffer, "\r\n")] = '\0';
-
-                // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-                manufacturer = buffer + prefix_cch;
-            }
+            continue;
         }
 
-        pclose(pipe);
+        std::string name = line.substr(0, separator);
+        ADUC::StringUtils::Trim(name);
+
+        if (name == "vendor_id")
+        {
+            // x86, e.g. GenuineIntel.
+            manufacturer = line.substr(separator + 1);
+        }
+        else if (name == "CPU implementer" && implementer.empty())
+        {
+            // ARM, e.g. 0x41.
+            implementer = line.substr(separator + 1);
+            ADUC::StringUtils::Trim(implementer);
+        }
+    }
+
+    if (manufacturer.empty() && !implementer.empty())
+    {
+        // Names used by lscpu for the most common ARM implementers.
+        const std::unordered_map<std::string, const char*> implementerNames{
+            { "0x41", "ARM" },
+            { "0x42", "Broadcom" },
+            { "0x43", "Cavium" },
+            { "0x46", "Fujitsu" },
+            { "0x48", "HiSilicon" },
+            { "0x4e", "NVIDIA" },
+            { "0x50", "APM" },
+            { "0x51", "Qualcomm" },
+            { "0x53", "Samsung" },
+            { "0x56", "Marvell" },
+            { "0x61", "Apple" },
+            { "0x69", "Intel" },
+        };
+
+        const auto entry = implementerNames.find(implementer);
+        manufacturer = (entry != implementerNames.end()) ? entry->second : implementer;
     }
 
     if (manufacturer.empty())
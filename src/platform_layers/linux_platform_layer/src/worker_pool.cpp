@@ -0,0 +1,119 @@
+/**
+ * @file worker_pool.cpp
+ * @brief Implements a small, long-lived pool of named worker threads with a bounded queue.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "worker_pool.hpp"
+
+#include <aduc/logging.h>
+
+#include <new> // for std::bad_alloc
+#include <pthread.h>
+
+using ADUC::WorkerPool;
+
+WorkerPool::WorkerPool(const char* name, size_t threadCount, size_t queueCapacity, ADUC_ThreadClass threadClass) :
+    _name{ name }, _queueCapacity{ queueCapacity }, _threadClass{ threadClass },
+    _stopToken{ ADUC_CancellationToken_Create() }
+{
+    if (_stopToken == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    _threads.reserve(threadCount);
+
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        _threads.emplace_back(&WorkerPool::WorkerThread, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    Stop();
+    ADUC_CancellationToken_Destroy(_stopToken);
+}
+
+bool WorkerPool::Post(Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_stopRequested || _queue.size() >= _queueCapacity)
+        {
+            return false;
+        }
+
+        _queue.emplace_back(std::move(task));
+    }
+
+    _queueChanged.notify_one();
+    return true;
+}
+
+void WorkerPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopRequested = true;
+    }
+
+    // Interrupts the running tasks.
+    ADUC_CancellationToken_Cancel(_stopToken);
+
+    _queueChanged.notify_all();
+
+    for (std::thread& thread : _threads)
+    {
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    _threads.clear();
+}
+
+void WorkerPool::WorkerThread(size_t index)
+{
+    // Thread names are limited to 15 characters.
+    const std::string threadName = (_name + "-" + std::to_string(index)).substr(0, 15);
+    pthread_setname_np(pthread_self(), threadName.c_str());
+
+    for (;;)
+    {
+        Task task;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _queueChanged.wait(lock, [this] { return _stopRequested || !_queue.empty(); });
+
+            if (_queue.empty())
+            {
+                // Stopping, and nothing left to run.
+                return;
+            }
+
+            task = std::move(_queue.front());
+            _queue.pop_front();
+        }
+
+        // Each task, so that the threads follow configuration changes.
+        if (!ADUC_CpuAffinity_ApplyToCurrentThread(_threadClass))
+        {
+            Log_Warn("Cannot set the CPU affinity of worker thread %s", threadName.c_str());
+        }
+
+        try
+        {
+            task(_stopToken);
+        }
+        catch (...)
+        {
+            Log_Error("Unhandled exception in worker thread %s", threadName.c_str());
+        }
+    }
+}
@@ -0,0 +1,85 @@
+/**
+ * @file worker_pool.hpp
+ * @brief A small, long-lived pool of named worker threads with a bounded queue.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <aduc/cancellation_token.h>
+#include <aduc/cpu_affinity_utils.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ADUC
+{
+/**
+ * @brief Runs tasks on a fixed set of worker threads that live as long as the pool.
+ */
+class WorkerPool
+{
+public:
+    /**
+     * @brief A task. @p stopToken is cancelled once the pool is stopping, including while the task is running;
+     * long-running tasks should observe it, e.g. by registering a callback that cancels their own operations,
+     * and finish early.
+     */
+    using Task = std::function<void(const ADUC_CancellationToken* stopToken)>;
+
+    /**
+     * @brief Starts the worker threads. Throws std::bad_alloc if out of memory.
+     *
+     * @param name Prefix of the names of the worker threads, e.g. "adu-worker" names them "adu-worker-0", ...
+     * @param threadCount The number of worker threads.
+     * @param queueCapacity The maximum number of tasks waiting for a worker thread.
+     * @param threadClass The CPUs the worker threads run the tasks on, see ADUC_CpuAffinity_SetClassCpus.
+     */
+    WorkerPool(const char* name, size_t threadCount, size_t queueCapacity, ADUC_ThreadClass threadClass);
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    WorkerPool(WorkerPool&&) = delete;
+    WorkerPool& operator=(WorkerPool&&) = delete;
+
+    ~WorkerPool();
+
+    /**
+     * @brief Queues @p task to be run by a worker thread.
+     *
+     * @param task The task.
+     * @return true if the task was queued; false if the queue is full or the pool is stopping.
+     */
+    bool Post(Task task);
+
+    /**
+     * @brief Cancels the stop token of the running tasks, runs the tasks still queued, and joins the worker threads.
+     * Queued tasks are still run, with the stop token cancelled, so that they can report their completion.
+     */
+    void Stop();
+
+private:
+    void WorkerThread(size_t index);
+
+    std::string _name;
+    size_t _queueCapacity;
+    ADUC_ThreadClass _threadClass;
+
+    std::mutex _mutex;
+    std::condition_variable _queueChanged;
+    std::deque<Task> _queue;
+    bool _stopRequested = false;
+    ADUC_CancellationToken* _stopToken;
+
+    std::vector<std::thread> _threads;
+};
+} // namespace ADUC
+
+#endif // WORKER_POOL_HPP
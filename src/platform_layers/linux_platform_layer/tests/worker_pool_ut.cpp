@@ -0,0 +1,147 @@
+/**
+ * @file worker_pool_ut.cpp
+ * @brief Unit tests for the worker pool of the linux platform layer.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+
+#include "worker_pool.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <sched.h>
+#include <string>
+
+using ADUC::WorkerPool;
+
+TEST_CASE("WorkerPool runs posted tasks")
+{
+    std::atomic_int count{ 0 };
+
+    {
+        WorkerPool pool{ "test-worker", 2, 16, ADUC_ThreadClass_Compute };
+
+        for (int i = 0; i < 10; i++)
+        {
+            CHECK(pool.Post([&count](const ADUC_CancellationToken* /*stopToken*/) { count++; }));
+        }
+    }
+
+    // Destroying the pool runs the queued tasks and joins the threads.
+    CHECK(count == 10);
+}
+
+TEST_CASE("WorkerPool bounds its queue")
+{
+    std::mutex mutex;
+    std::condition_variable released;
+    bool release = false;
+    std::atomic_int count{ 0 };
+
+    WorkerPool pool{ "test-worker", 1, 1, ADUC_ThreadClass_Compute };
+
+    auto task = [&](const ADUC_CancellationToken* /*stopToken*/) {
+        std::unique_lock<std::mutex> lock(mutex);
+        released.wait(lock, [&release] { return release; });
+        count++;
+    };
+
+    // The first task occupies the only worker, possibly after a delay, so one of the next two can't be queued.
+    REQUIRE(pool.Post(task));
+    const bool secondQueued = pool.Post(task);
+    const bool thirdQueued = pool.Post(task);
+    CHECK_FALSE((secondQueued && thirdQueued));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+    }
+    released.notify_all();
+
+    pool.Stop();
+
+    CHECK(count == 1 + (secondQueued ? 1 : 0) + (thirdQueued ? 1 : 0));
+    CHECK_FALSE(pool.Post(task));
+}
+
+TEST_CASE("WorkerPool cancels the stop token of a running task when stopping")
+{
+    std::atomic_bool sawStop{ false };
+
+    WorkerPool pool{ "test-worker", 1, 1, ADUC_ThreadClass_Compute };
+
+    REQUIRE(pool.Post([&sawStop](const ADUC_CancellationToken* stopToken) {
+        while (!ADUC_CancellationToken_IsCancelled(stopToken))
+        {
+            std::this_thread::yield();
+        }
+        sawStop = true;
+    }));
+
+    pool.Stop();
+
+    CHECK(sawStop);
+}
+
+TEST_CASE("WorkerPool calls the stop callbacks of a running task when stopping")
+{
+    std::atomic_bool started{ false };
+    std::atomic_bool callbackCalled{ false };
+
+    WorkerPool pool{ "test-worker", 1, 1, ADUC_ThreadClass_Compute };
+
+    REQUIRE(pool.Post([&started, &callbackCalled](const ADUC_CancellationToken* stopToken) {
+        auto onStop = [](void* context) { *static_cast<std::atomic_bool*>(context) = true; };
+        (void)ADUC_CancellationToken_Register(stopToken, onStop, &callbackCalled);
+        started = true;
+
+        // E.g. a download that only a callback can interrupt.
+        while (!callbackCalled)
+        {
+            std::this_thread::yield();
+        }
+
+        ADUC_CancellationToken_Unregister(stopToken, onStop, &callbackCalled);
+    }));
+
+    while (!started)
+    {
+        std::this_thread::yield();
+    }
+
+    pool.Stop();
+
+    CHECK(callbackCalled);
+}
+
+TEST_CASE("WorkerPool runs its tasks on the CPUs of its class")
+{
+    cpu_set_t processCpus;
+    REQUIRE(sched_getaffinity(0, sizeof(processCpus), &processCpus) == 0);
+
+    int firstCpu = 0;
+    while (!CPU_ISSET(firstCpu, &processCpus))
+    {
+        firstCpu++;
+    }
+
+    REQUIRE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_Compute, std::to_string(firstCpu).c_str()));
+
+    cpu_set_t taskCpus;
+    CPU_ZERO(&taskCpus);
+
+    {
+        WorkerPool pool{ "test-worker", 1, 1, ADUC_ThreadClass_Compute };
+        REQUIRE(pool.Post([&taskCpus](const ADUC_CancellationToken* /*stopToken*/) {
+            (void)sched_getaffinity(0, sizeof(taskCpus), &taskCpus);
+        }));
+    }
+
+    CHECK(CPU_COUNT(&taskCpus) == 1);
+    CHECK(CPU_ISSET(firstCpu, &taskCpus));
+
+    REQUIRE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_Compute, nullptr));
+}
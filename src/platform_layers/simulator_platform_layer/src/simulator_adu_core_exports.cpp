@@ -71,6 +71,10 @@ ADUC_Result ADUC_RegisterPlatformLayer(ADUC_UpdateActionCallbacks* data, unsigne
         };
         SimulationType simulationType = SimulationType::AllSuccessful;
 
+        // simulation_behavior_file= argument, see simulation_utils.hpp.
+        const std::string behaviorFileArgPrefix{ "simulation_behavior_file=" };
+        std::string behaviorFilePath;
+
         const std::string manufacturerArgPrefix{ "deviceinfo_manufacturer=" };
         const std::string modelArgPrefix{ "deviceinfo_model=" };
         const std::string swVersionArgPrefix{ "deviceinfo_swversion=" };
@@ -124,10 +128,15 @@ ADUC_Result ADUC_RegisterPlatformLayer(ADUC_UpdateActionCallbacks* data, unsigne
 
                 Log_Info("[Args] Using simulation mode %s", value.c_str());
             }
+            else if (argument.substr(dashdash_cch, behaviorFileArgPrefix.size()) == behaviorFileArgPrefix)
+            {
+                behaviorFilePath = argument.substr(dashdash_cch + behaviorFileArgPrefix.size());
+                Log_Info("[Args] Using simulated behavior file %s", behaviorFilePath.c_str());
+            }
         }
 
         std::unique_ptr<ADUC::SimulatorPlatformLayer> pImpl{ ADUC::SimulatorPlatformLayer::Create(
-            simulationType) };
+            simulationType, behaviorFilePath.empty() ? nullptr : behaviorFilePath.c_str()) };
         ADUC_Result result{ pImpl->SetUpdateActionCallbacks(data) };
         // The platform layer object is now owned by the UpdateActionCallbacks object.
         pImpl.release();
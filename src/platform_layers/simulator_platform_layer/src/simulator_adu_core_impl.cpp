@@ -10,13 +10,11 @@
 #include "simulator_adu_core_impl.hpp"
 #include "simulator_device_info.h"
 
-#include <chrono>
-#include <future> // this_thread
-
 #include <cstring>
 #include <vector>
 
 #include "aduc/logging.h"
+#include "aduc/simulation_utils.hpp"
 #include "aduc/string_utils.hpp"
 #include "aduc/workflow_data_utils.h"
 #include "aduc/workflow_utils.h"
@@ -24,20 +22,95 @@
 
 using ADUC::SimulatorPlatformLayer;
 
+/**
+ * @brief The phases of the platform layer that can have a simulated behavior.
+ */
+static const char* const SimulatedPhases[] = { "download", "install", "apply", "isInstalled", "sandboxCreate",
+                                               "sandboxDestroy" };
+
 std::unique_ptr<SimulatorPlatformLayer> SimulatorPlatformLayer::Create(
-    SimulationType type /*= SimulationType::AllSuccessful*/)
+    SimulationType type /*= SimulationType::AllSuccessful*/, const char* behaviorFilePath /*= nullptr*/)
 {
-    return std::unique_ptr<SimulatorPlatformLayer>{ new SimulatorPlatformLayer(type) };
+    return std::unique_ptr<SimulatorPlatformLayer>{ new SimulatorPlatformLayer(type, behaviorFilePath) };
 }
 
 /**
  * @brief Construct a new Simulator Impl object
  *
  * @param type Simulation type to run.
+ * @param behaviorFilePath Path of a JSON file whose "behavior" object overrides the default 500ms latency of the
+ * phases, see simulation_utils.hpp. May be NULL.
  */
-SimulatorPlatformLayer::SimulatorPlatformLayer(SimulationType type) :
+SimulatorPlatformLayer::SimulatorPlatformLayer(SimulationType type, const char* behaviorFilePath) :
     _simulationType(type), _cancellationRequested(false)
 {
+    SimulationUtils::PhaseBehavior defaultBehavior;
+    defaultBehavior.Distribution = SimulationUtils::LatencyDistribution::Fixed;
+    defaultBehavior.LatencyMs = 500;
+
+    for (const char* phase : SimulatedPhases)
+    {
+        if (strcmp(phase, "isInstalled") != 0)
+        {
+            _phaseBehaviors[phase] = defaultBehavior;
+        }
+    }
+
+    if (behaviorFilePath == nullptr)
+    {
+        return;
+    }
+
+    JSON_Value* root = json_parse_file_with_comments(behaviorFilePath);
+    if (root == nullptr)
+    {
+        Log_Warn("Cannot read simulated behavior file: %s", behaviorFilePath);
+        return;
+    }
+
+    const JSON_Object* behaviorObject = json_object_get_object(json_value_get_object(root), "behavior");
+    for (const char* phase : SimulatedPhases)
+    {
+        SimulationUtils::PhaseBehavior behavior;
+        if (SimulationUtils::GetPhaseBehavior(behaviorObject, phase, &behavior))
+        {
+            _phaseBehaviors[phase] = behavior;
+        }
+    }
+
+    json_value_free(root);
+}
+
+bool SimulatorPlatformLayer::SimulatePhase(
+    const char* phase, uint64_t bytes, ADUC_WorkflowHandle handle, ADUC_Result* failureResult)
+{
+    const auto it = _phaseBehaviors.find(phase);
+    if (it == _phaseBehaviors.end())
+    {
+        return false;
+    }
+
+    const SimulationUtils::PhaseBehavior& behavior = it->second;
+
+    if (behavior.Distribution != SimulationUtils::LatencyDistribution::None
+        || behavior.ThroughputBytesPerSecond != 0)
+    {
+        Log_Info("Simulator sleeping...");
+    }
+
+    if (!SimulationUtils::SimulatePhase(behavior, bytes, workflow_peek_cancellation_token(handle)))
+    {
+        return false;
+    }
+
+    Log_Warn("Simulating a %s failure", phase);
+    if (handle != nullptr && !behavior.FailureResultDetails.empty())
+    {
+        workflow_set_result_details(handle, behavior.FailureResultDetails.c_str());
+    }
+
+    *failureResult = behavior.FailureResult;
+    return true;
 }
 
 ADUC_Result SimulatorPlatformLayer::SetUpdateActionCallbacks(ADUC_UpdateActionCallbacks* data)
@@ -74,11 +147,11 @@ void SimulatorPlatformLayer::Idle(const char* workflowId)
 ADUC_Result SimulatorPlatformLayer::Download(const ADUC_WorkflowData* workflowData)
 {
     ADUC_Result result = { ADUC_Result_Failure };
-    ADUC_FileEntity* entity = nullptr;
+    const ADUC_FileEntity* entity = nullptr;
     ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
-    char* workflowId = workflow_get_id(handle);
-    char* updateType = workflow_get_update_type(handle);
-    char* workFolder = workflow_get_workfolder(handle);
+    const char* workflowId = workflow_peek_id(handle);
+    const char* updateType = workflow_peek_update_type(handle);
+    const char* workFolder = workflow_peek_workfolder(handle);
 
     Log_Info(
         "{%s} (UpdateType: %s) Downloading %d files to %s",
@@ -88,7 +161,7 @@ ADUC_Result SimulatorPlatformLayer::Download(const ADUC_WorkflowData* workflowDa
         workFolder);
 
     // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-    if (!workflow_get_update_file(handle, 0, &entity))
+    if ((entity = workflow_peek_update_file(handle, 0)) == nullptr)
     {
         result = { .ResultCode = ADUC_Result_Failure,
                    .ExtendedResultCode = ADUC_ERC_COMPONENTS_HANDLER_GET_FILE_ENTITY_FAILURE };
@@ -123,21 +196,20 @@ ADUC_Result SimulatorPlatformLayer::Download(const ADUC_WorkflowData* workflowDa
 
     // Simulation mode.
 
+    if (SimulatePhase("download", entity->SizeInBytes, handle, &result))
+    {
+        workflowData->DownloadProgressCallback(workflowId, entity->FileId, ADUC_DownloadProgressState_Error, 0, 0);
+        goto done;
+    }
+
     workflowData->DownloadProgressCallback(
         workflowId, entity->FileId, ADUC_DownloadProgressState_Completed, 424242, 424242);
 
-    Log_Info("Simulator sleeping...");
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
-
     // Download in progress.
     result = { ADUC_Result_Download_InProgress };
     Log_Info("Download resultCode: %d, extendedCode: %d", result.ResultCode, result.ExtendedResultCode);
 
 done:
-    workflow_free_string(workflowId);
-    workflow_free_string(updateType);
-    workflow_free_string(workFolder);
-    workflow_free_file_entity(entity);
 
     // Success!
     return result;
@@ -147,9 +219,9 @@ ADUC_Result SimulatorPlatformLayer::Install(const ADUC_WorkflowData* workflowDat
 {
     ADUC_Result result;
     ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
-    char* workflowId = workflow_get_id(handle);
-    char* updateType = workflow_get_update_type(handle);
-    char* workFolder = workflow_get_workfolder(handle);
+    const char* workflowId = workflow_peek_id(handle);
+    const char* updateType = workflow_peek_update_type(handle);
+    const char* workFolder = workflow_peek_workfolder(handle);
 
     Log_Info("{%s} Installing from %s", workflowId, workFolder);
 
@@ -160,8 +232,10 @@ ADUC_Result SimulatorPlatformLayer::Install(const ADUC_WorkflowData* workflowDat
         goto done;
     }
 
-    Log_Info("Simulator sleeping...");
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    if (SimulatePhase("install", 0, handle, &result))
+    {
+        goto done;
+    }
 
     if (GetSimulationType() == SimulationType::InstallationFailed)
     {
@@ -173,9 +247,6 @@ ADUC_Result SimulatorPlatformLayer::Install(const ADUC_WorkflowData* workflowDat
     result = { ADUC_Result_Install_Success };
 
 done:
-    workflow_free_string(workflowId);
-    workflow_free_string(updateType);
-    workflow_free_string(workFolder);
 
     return result;
 }
@@ -184,9 +255,9 @@ ADUC_Result SimulatorPlatformLayer::Apply(const ADUC_WorkflowData* workflowData)
 {
     ADUC_Result result;
     ADUC_WorkflowHandle handle = workflowData->WorkflowHandle;
-    char* updateType = workflow_get_update_type(handle);
-    char* workFolder = workflow_get_workfolder(handle);
-    char* workflowId = workflow_get_id(handle);
+    const char* updateType = workflow_peek_update_type(handle);
+    const char* workFolder = workflow_peek_workfolder(handle);
+    const char* workflowId = workflow_peek_id(handle);
 
     Log_Info("{%s} Applying data from %s", workflowId, workFolder);
 
@@ -197,8 +268,10 @@ ADUC_Result SimulatorPlatformLayer::Apply(const ADUC_WorkflowData* workflowData)
         goto done;
     }
 
-    Log_Info("Simulator sleeping...");
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    if (SimulatePhase("apply", 0, handle, &result))
+    {
+        goto done;
+    }
 
     if (GetSimulationType() == SimulationType::ApplyFailed)
     {
@@ -211,9 +284,6 @@ ADUC_Result SimulatorPlatformLayer::Apply(const ADUC_WorkflowData* workflowData)
     result = { ADUC_Result_Apply_Success };
 
 done:
-    workflow_free_string(updateType);
-    workflow_free_string(workFolder);
-    workflow_free_string(workflowId);
 
     // Can alternately return ADUC_Result_Apply_RequiredReboot to indicate reboot required.
     // Success is returned here to force a new swVersion to be sent back to the server.
@@ -222,9 +292,8 @@ done:
 
 void SimulatorPlatformLayer::Cancel(const ADUC_WorkflowData* workflowData)
 {
-    char* workflowId = workflow_get_id(workflowData->WorkflowHandle);
+    const char* workflowId = workflow_peek_id(workflowData->WorkflowHandle);
     Log_Info("{%s} Cancel requested", workflowId);
-    workflow_free_string(workflowId);
     _cancellationRequested = true;
 }
 
@@ -256,6 +325,11 @@ ADUC_Result SimulatorPlatformLayer::IsInstalled(const ADUC_WorkflowData* workflo
         goto done;
     }
 
+    if (SimulatePhase("isInstalled", 0, workflowData->WorkflowHandle, &result))
+    {
+        goto done;
+    }
+
     result = ExtensionManager::LoadUpdateContentHandlerExtension(updateType, &contentHandler);
     if (IsAducResultCodeFailure(result.ResultCode))
     {
@@ -274,10 +348,12 @@ ADUC_Result SimulatorPlatformLayer::SandboxCreate(const char* workflowId, char*
 {
     Log_Info("{%s} Creating sandbox %s", workflowId, workFolder);
 
+    ADUC_Result result = { ADUC_Result_SandboxCreate_Success };
+
     // Simulation.
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    SimulatePhase("sandboxCreate", 0, nullptr, &result);
 
-    return ADUC_Result{ ADUC_Result_SandboxCreate_Success };
+    return result;
 }
 
 void SimulatorPlatformLayer::SandboxDestroy(const char* workflowId, const char* workFolder)
@@ -290,6 +366,7 @@ void SimulatorPlatformLayer::SandboxDestroy(const char* workflowId, const char*
 
     Log_Info("{%s} Deleting sandbox: %s", workflowId, workFolder);
 
-    // Simulation.
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    // Simulation. A failure can't be reported.
+    ADUC_Result ignored;
+    (void)SimulatePhase("sandboxDestroy", 0, nullptr, &ignored);
 }
@@ -19,6 +19,8 @@
 #include <aduc/exception_utils.hpp>
 #include <aduc/logging.h>
 #include <aduc/result.h>
+#include <aduc/simulation_utils.hpp>
+#include <aduc/types/workflow.h> // for ADUC_WorkflowHandle
 
 /**
  * @brief Simulation type to run.
@@ -41,7 +43,7 @@ class SimulatorPlatformLayer
 {
 public:
     static std::unique_ptr<SimulatorPlatformLayer>
-    Create(SimulationType type = SimulationType::AllSuccessful);
+    Create(SimulationType type = SimulationType::AllSuccessful, const char* behaviorFilePath = nullptr);
 
     // Delete copy ctor, copy assignment, move ctor and move assignment operators.
     SimulatorPlatformLayer(const SimulatorPlatformLayer&) = delete;
@@ -316,7 +318,18 @@ private:
     //
 
     // Private constructor, must use Create factory method to creat an object.
-    SimulatorPlatformLayer(SimulationType type);
+    SimulatorPlatformLayer(SimulationType type, const char* behaviorFilePath);
+
+    /**
+     * @brief Runs the simulated behavior of @p phase: its latency, throughput limit, CPU burn and failure rate.
+     *
+     * @param phase The name of the phase, e.g. "download".
+     * @param bytes The bytes that the phase transfers.
+     * @param handle The workflow handle, for its cancellation token and result details.
+     * @param[out] failureResult The injected failure, if any.
+     * @return bool true if the phase fails with @p failureResult.
+     */
+    bool SimulatePhase(const char* phase, uint64_t bytes, ADUC_WorkflowHandle handle, ADUC_Result* failureResult);
 
     /**
      * @brief Class implementation of Idle method.
@@ -401,6 +414,11 @@ private:
      * @brief Was Cancel called?
      */
     bool _cancellationRequested;
+
+    /**
+     * @brief The simulated behavior of each phase, by name.
+     */
+    std::unordered_map<std::string, SimulationUtils::PhaseBehavior> _phaseBehaviors;
 };
 } // namespace ADUC
 
@@ -8,24 +8,36 @@
  */
 #include "uhttp_downloader.h"
 
-#include <azure_c_shared_utility/azure_base64.h>
-#include <azure_c_shared_utility/buffer_.h>
+#include <azure_c_shared_utility/httpheaders.h>
 #include <azure_c_shared_utility/platform.h>
-#include <azure_c_shared_utility/sha.h>
 #include <azure_c_shared_utility/socketio.h>
 #include <azure_c_shared_utility/tlsio.h>
 #include <azure_uhttp_c/uhttp.h>
 
+#include <cstdio> // for rename, remove
 #include <fstream>
 #include <string>
 
+#include <aduc/hash_utils.h>
 #include <aduc/logging.h>
 
+/**
+ * @brief Downloads a file in ranges of ChunkSize bytes, since uHTTP hands over whole response bodies.
+ *
+ * Each range is appended to a temporary file and fed to the hash as it arrives, and the file is renamed to the output
+ * file once the whole content is hashed, so memory use doesn't grow with the size of the file.
+ */
 class UHttpDownloader
 {
 public:
+    //! The size of the ranges requested, i.e. of the largest response body held in memory.
+    static constexpr size_t ChunkSize = 4 * 1024 * 1024;
+
     UHttpDownloader() = default;
-    ~UHttpDownloader() = default;
+    ~UHttpDownloader()
+    {
+        ADUC_HashUtils_ContextUnInit(&m_hashContext);
+    }
 
     UHttpDownloader(const UHttpDownloader&) = delete;
     UHttpDownloader& operator=(const UHttpDownloader&) = delete;
@@ -41,14 +53,17 @@ public:
     static UHttpDownloaderResult ResultFromHttpCallbackReason(HTTP_CALLBACK_REASON result);
 
 private:
-    bool HashMatches(const unsigned char* content, size_t content_len);
+    UHttpDownloaderResult DownloadRanges(
+        const std::string& hostname, unsigned int port, const std::string& relativePath, unsigned int timeoutSecs);
+
+    bool WriteContent(const unsigned char* content, size_t content_len);
 
     void OnRequestCallback(
         HTTP_CALLBACK_REASON reason,
         const unsigned char* content,
         size_t content_len,
         unsigned int statusCode,
-        HTTP_HEADERS_HANDLE /*responseHeadersHandle*/);
+        HTTP_HEADERS_HANDLE responseHeadersHandle);
 
     static UHttpDownloaderResult
     ParseUrl(const char* url, unsigned* port, std::string* hostName, std::string* relativePath)
@@ -95,37 +110,36 @@ private:
     std::string m_base64Sha256Hash;
     std::string m_outputFile;
 
+    // The content received so far goes to this file, and is hashed as it arrives.
+    std::string m_partialFile;
+    std::ofstream m_partialStream;
+    ADUC_HashUtils_Context m_hashContext = {};
+    unsigned long long m_offset = 0;
+    bool m_complete = false;
+
     bool m_keepRunning = false;
     UHttpDownloaderResult m_reason = DR_INVALID_STATE;
     unsigned int m_statusCode = 500;
 };
 
-bool UHttpDownloader::HashMatches(const unsigned char* content, size_t content_len)
+bool UHttpDownloader::WriteContent(const unsigned char* content, size_t content_len)
 {
-    bool hashMatches = false;
-
-    const SHAversion algorithm = SHAversion::SHA256;
-    USHAContext context;
-    if (USHAReset(&context, algorithm) == 0)
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    m_partialStream.write(reinterpret_cast<const char*>(content), sizeof(*content) * content_len);
+    if (m_partialStream.fail())
     {
-        if (USHAInput(&context, content, content_len) == 0)
-        {
-            // "USHAHashSize(algorithm)" is more precise, but requires a variable length array, or heap allocation.
-            unsigned char buffer_hash[USHAMaxHashSize];
+        Log_Warn("unable to write %s", m_partialFile.c_str());
+        return false;
+    }
 
-            if (USHAResult(&context, buffer_hash) == 0)
-            {
-                STRING_HANDLE encoded_file_hash = Azure_Base64_Encode_Bytes(buffer_hash, USHAHashSize(algorithm));
-                if (encoded_file_hash != nullptr)
-                {
-                    hashMatches = (strcmp(m_base64Sha256Hash.c_str(), STRING_c_str(encoded_file_hash)) == 0);
-                    STRING_delete(encoded_file_hash);
-                }
-            }
-        }
+    if (!ADUC_HashUtils_ContextInput(&m_hashContext, content, content_len))
+    {
+        Log_Warn("unable to hash %s", m_partialFile.c_str());
+        return false;
     }
 
-    return hashMatches;
+    m_offset += content_len;
+    return true;
 }
 
 void UHttpDownloader::OnRequestCallback(
@@ -133,7 +147,7 @@ void UHttpDownloader::OnRequestCallback(
     const unsigned char* content,
     size_t content_len,
     unsigned int statusCode,
-    HTTP_HEADERS_HANDLE /*responseHeadersHandle*/)
+    HTTP_HEADERS_HANDLE responseHeadersHandle)
 {
     // No more work to do after we get the callback.
     m_keepRunning = false;
@@ -145,7 +159,8 @@ void UHttpDownloader::OnRequestCallback(
         return;
     }
 
-    if (statusCode != 200)
+    // 200 means the server ignored the range, and sent the whole content at once.
+    if (statusCode != 206 && !(statusCode == 200 && m_offset == 0))
     {
         Log_Warn("onrequestcallback failed, statuscode %u", statusCode);
         m_reason = DR_CALLBACK_ERROR;
@@ -157,37 +172,87 @@ void UHttpDownloader::OnRequestCallback(
     // We've got data!
     //
 
-    // check the hash.
-
-    if (!HashMatches(content, content_len))
+    if (!WriteContent(content, content_len))
     {
-        Log_Warn("Invalid content hash");
-        m_reason = DR_CALLBACK_ERROR;
+        m_reason = DR_FILE_ERROR;
         return;
     }
 
-    // Hash checks out, so Write it to a file.
+    // e.g. "Content-Range: bytes 0-4194303/524288000"
+    unsigned long long totalSize = 0;
+    const char* contentRange = HTTPHeaders_FindHeaderValue(responseHeadersHandle, "Content-Range");
+    const bool hasTotalSize = contentRange != nullptr && sscanf(contentRange, "bytes %*u-%*u/%llu", &totalSize) == 1;
+
+    m_complete = statusCode == 200 || content_len < ChunkSize || (hasTotalSize && m_offset >= totalSize);
+}
+
+UHttpDownloaderResult UHttpDownloader::Download(
+    const char* url, const char* base64Sha256Hash, const char* outputFile, unsigned int timeoutSecs)
+{
+    unsigned int port;
+    std::string hostname;
+    std::string relativePath;
+
+    m_reason = ParseUrl(url, &port, &hostname, &relativePath);
+    if (m_reason != DR_OK)
+    {
+        Log_Warn("ParseUrl failed, error %u", m_reason);
+        return m_reason;
+    }
+
+    m_base64Sha256Hash = base64Sha256Hash;
+    m_outputFile = outputFile;
+    m_partialFile = m_outputFile + ".partial";
+    m_offset = 0;
+    m_complete = false;
+
+    m_statusCode = 200;
+
+    m_partialStream.open(m_partialFile, std::ios::binary | std::ios::trunc);
+    if (m_partialStream.fail())
+    {
+        Log_Warn("unable to open %s", m_partialFile.c_str());
+        return DR_FILE_ERROR;
+    }
+
+    ADUC_HashUtils_ContextUnInit(&m_hashContext);
+    if (!ADUC_HashUtils_ContextReset(&m_hashContext, SHAversion::SHA256))
+    {
+        return DR_ERROR;
+    }
+
+    m_reason = DownloadRanges(hostname, port, relativePath, timeoutSecs);
 
-    std::ofstream ofile(m_outputFile, std::ios::binary);
-    if (ofile.fail())
+    m_partialStream.close();
+    if (m_reason == DR_OK && m_partialStream.fail())
     {
-        Log_Warn("unable to open %s", m_outputFile.c_str());
+        Log_Warn("unable to write %s", m_partialFile.c_str());
         m_reason = DR_FILE_ERROR;
-        return;
     }
 
-    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-    ofile.write(reinterpret_cast<const char*>(content), sizeof(*content) * content_len);
-    if (ofile.fail())
+    if (m_reason == DR_OK && !ADUC_HashUtils_ContextResult(&m_hashContext, m_base64Sha256Hash.c_str(), nullptr))
+    {
+        Log_Warn("Invalid content hash");
+        m_reason = DR_CALLBACK_ERROR;
+    }
+
+    // The hash checks out, so the content becomes the output file at once.
+    if (m_reason == DR_OK && rename(m_partialFile.c_str(), m_outputFile.c_str()) != 0)
     {
-        Log_Warn("unable to write %s", m_outputFile.c_str());
+        Log_Warn("unable to rename %s", m_partialFile.c_str());
         m_reason = DR_FILE_ERROR;
-        return;
     }
+
+    if (m_reason != DR_OK)
+    {
+        remove(m_partialFile.c_str());
+    }
+
+    return m_reason;
 }
 
-UHttpDownloaderResult UHttpDownloader::Download(
-    const char* url, const char* base64Sha256Hash, const char* outputFile, unsigned int timeoutSecs)
+UHttpDownloaderResult UHttpDownloader::DownloadRanges(
+    const std::string& hostname, unsigned int port, const std::string& relativePath, unsigned int timeoutSecs)
 {
     // RAII wrapper for HTTP_CLIENT_HANDLE
     class HttpClientHandle
@@ -226,22 +291,7 @@ UHttpDownloaderResult UHttpDownloader::Download(
         HTTP_CLIENT_HANDLE _handle;
     };
 
-    unsigned int port;
-    std::string hostname;
-    std::string relativePath;
-
-    m_reason = ParseUrl(url, &port, &hostname, &relativePath);
-    if (m_reason != DR_OK)
-    {
-        Log_Warn("ParseUrl failed, error %u", m_reason);
-        return m_reason;
-    }
-
-    m_base64Sha256Hash = base64Sha256Hash;
-    m_outputFile = outputFile;
-
     m_keepRunning = true;
-    m_statusCode = 200;
 
     //
     // Create HTTP or HTTPS uHttp client.
@@ -320,50 +370,73 @@ UHttpDownloaderResult UHttpDownloader::Download(
     }
 
     //
-    // Execute the GET request.
+    // Request the content range by range, over the same connection, until the whole content arrived.
     //
 
-    result = uhttp_client_execute_request(
-        handle.Get(),
-        HTTP_CLIENT_REQUEST_GET,
-        relativePath.c_str(),
-        nullptr /*HTTP_HEADERS_HANDLE*/,
-        nullptr /*content*/,
-        0 /*content_len*/,
-        [](void* context,
-           HTTP_CALLBACK_REASON reason,
-           const unsigned char* content,
-           size_t content_len,
-           unsigned int statusCode,
-           HTTP_HEADERS_HANDLE responseHeadersHandle) -> void {
-            auto instance = static_cast<UHttpDownloader*>(context);
-
-            instance->OnRequestCallback(reason, content, content_len, statusCode, responseHeadersHandle);
-        },
-        this);
-    if (result != HTTP_CLIENT_OK)
+    while (!m_complete)
     {
-        Log_Warn("client_execute failed, error %u", result);
-        return ResultFromHttpClientResult(result);
-    }
+        char range[64];
+        snprintf(range, sizeof(range), "bytes=%llu-%llu", m_offset, m_offset + ChunkSize - 1);
 
-    //
-    // Start worker loop. Run until complete or timeout.
-    //
+        HTTP_HEADERS_HANDLE requestHeaders = HTTPHeaders_Alloc();
+        if (requestHeaders == nullptr
+            || HTTPHeaders_AddHeaderNameValuePair(requestHeaders, "Range", range) != HTTP_HEADERS_OK)
+        {
+            HTTPHeaders_Free(requestHeaders);
+            Log_Warn("unable to create the request headers");
+            return DR_HTTP_HEADERS_FAILED;
+        }
 
-    const time_t start_request_time = get_time(nullptr);
-    bool timeout = false;
+        m_keepRunning = true;
+
+        result = uhttp_client_execute_request(
+            handle.Get(),
+            HTTP_CLIENT_REQUEST_GET,
+            relativePath.c_str(),
+            requestHeaders,
+            nullptr /*content*/,
+            0 /*content_len*/,
+            [](void* context,
+               HTTP_CALLBACK_REASON reason,
+               const unsigned char* content,
+               size_t content_len,
+               unsigned int statusCode,
+               HTTP_HEADERS_HANDLE responseHeadersHandle) -> void {
+                auto instance = static_cast<UHttpDownloader*>(context);
+
+                instance->OnRequestCallback(reason, content, content_len, statusCode, responseHeadersHandle);
+            },
+            this);
+        HTTPHeaders_Free(requestHeaders);
+        if (result != HTTP_CLIENT_OK)
+        {
+            Log_Warn("client_execute failed, error %u", result);
+            return ResultFromHttpClientResult(result);
+        }
 
-    do
-    {
-        uhttp_client_dowork(handle.Get());
-        timeout = difftime(get_time(nullptr), start_request_time) > timeoutSecs;
-    } while (m_keepRunning && !timeout);
+        //
+        // Start worker loop. Run until the range arrived or timeout.
+        //
 
-    if (timeout)
-    {
-        Log_Warn("dowork timed out");
-        return DR_TIMEOUT;
+        const time_t start_request_time = get_time(nullptr);
+        bool timeout = false;
+
+        do
+        {
+            uhttp_client_dowork(handle.Get());
+            timeout = difftime(get_time(nullptr), start_request_time) > timeoutSecs;
+        } while (m_keepRunning && !timeout);
+
+        if (timeout)
+        {
+            Log_Warn("dowork timed out");
+            return DR_TIMEOUT;
+        }
+
+        if (m_reason != DR_OK)
+        {
+            return m_reason;
+        }
     }
 
     return m_reason;
@@ -0,0 +1,82 @@
+/**
+ * @file adushell_broker_utils.hpp
+ * @brief Contains utilities for running adu-shell actions through a long-lived adu-shell broker process.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_ADUSHELL_BROKER_UTILS_HPP
+#define ADUC_ADUSHELL_BROKER_UTILS_HPP
+
+#include <aduc/cancellation_token.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The adu-shell option that makes it serve requests read from its standard input, which is a socket.
+ */
+#define ADUC_ADUSHELL_BROKER_OPT "--broker"
+
+/**
+ * @brief Runs adu-shell with the specified arguments and captures its output and exit code.
+ *
+ * When aduShellBroker is set in the configuration file, the action is run by a long-lived adu-shell broker,
+ * started on first use and reused by the following calls. Otherwise, or if the broker can't be started,
+ * a new adu-shell process is launched for the action.
+ * Actions given a cancellation token always run in a new adu-shell process, which ADUC_LaunchChildProcess
+ * terminates once the token is cancelled.
+ *
+ * @param aduShellPath Path to adu-shell.
+ * @param args List of arguments for adu-shell.
+ * @param output The output of adu-shell. With the broker, the end of the output of the action's child process.
+ * @param cancellationToken Terminates adu-shell and its children once cancelled. nullptr for none.
+ *
+ * @return An exit code from adu-shell, or the signal that terminated it once the token was cancelled.
+ */
+int ADUC_LaunchAduShell(
+    const std::string& aduShellPath,
+    const std::vector<std::string>& args,
+    std::string& output,
+    const ADUC_CancellationToken* cancellationToken = nullptr);
+
+/**
+ * @brief Runs adu-shell with the specified arguments, like ADUC_LaunchAduShell, with the result channel of
+ * ADUC_LaunchChildProcessWithResultChannel, which adu-shell passes on to the child process of the action.
+ * Always launches a new adu-shell process, since the broker can't pass the channel along.
+ *
+ * @param aduShellPath Path to adu-shell.
+ * @param args List of arguments for adu-shell.
+ * @param output The output of adu-shell.
+ * @param resultLineCallback Called with each line written to the result channel, as it arrives.
+ * @param cancellationToken Terminates adu-shell and its children once cancelled. nullptr for none.
+ *
+ * @return An exit code from adu-shell, or the signal that terminated it once the token was cancelled.
+ */
+int ADUC_LaunchAduShellWithResultChannel(
+    const std::string& aduShellPath,
+    const std::vector<std::string>& args,
+    std::string& output,
+    const std::function<void(const std::string& line)>& resultLineCallback,
+    const ADUC_CancellationToken* cancellationToken = nullptr);
+
+/**
+ * @brief Writes a message made of @p fields to @p fd.
+ * @details A message is the number of fields followed by the length and bytes of each field.
+ *
+ * @param fd The socket to write to.
+ * @param fields The fields of the message.
+ * @return true on success; false if the socket failed or was closed by its peer.
+ */
+bool ADUC_AduShellBroker_WriteMessage(int fd, const std::vector<std::string>& fields);
+
+/**
+ * @brief Reads a message written by ADUC_AduShellBroker_WriteMessage from @p fd.
+ *
+ * @param fd The socket to read from.
+ * @param fields Receives the fields of the message.
+ * @return true on success; false on failures, when the message is malformed, or at the end of the stream.
+ */
+bool ADUC_AduShellBroker_ReadMessage(int fd, std::vector<std::string>* fields);
+
+#endif // ADUC_ADUSHELL_BROKER_UTILS_HPP
@@ -0,0 +1,343 @@
+/**
+ * @file adushell_broker_utils.cpp
+ * @brief Contains utilities for running adu-shell actions through a long-lived adu-shell broker process.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/adushell_broker_utils.hpp"
+
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <aduc/config_utils.h>
+#include <aduc/logging.h>
+#include <aduc/process_utils.hpp>
+
+#include <mutex>
+
+/**
+ * @brief Upper bound on the number of fields of a message.
+ */
+#define ADUSHELL_BROKER_MAX_FIELD_COUNT 1024
+
+/**
+ * @brief Upper bound on the size of a field of a message.
+ */
+#define ADUSHELL_BROKER_MAX_FIELD_SIZE (16 * 1024 * 1024)
+
+/**
+ * @brief Serializes the use of the broker; it runs one action at a time.
+ */
+static std::mutex s_brokerMutex;
+
+/**
+ * @brief The pid of the broker, -1 if it isn't running.
+ */
+static pid_t s_brokerPid = -1;
+
+/**
+ * @brief The socket connected to the standard input of the broker, -1 if it isn't running.
+ */
+static int s_brokerFd = -1;
+
+/**
+ * @brief Writes the @p size bytes of @p data to @p fd.
+ * @return true on success.
+ */
+static bool WriteAll(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        // MSG_NOSIGNAL: a broker that went away fails the write instead of raising SIGPIPE.
+        const ssize_t count = send(fd, data, size, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            return false;
+        }
+
+        data += count;
+        size -= static_cast<size_t>(count);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Reads exactly @p size bytes from @p fd into @p data.
+ * @return true on success; false on failures or at the end of the stream.
+ */
+static bool ReadAll(int fd, char* data, size_t size)
+{
+    while (size > 0)
+    {
+        const ssize_t count = read(fd, data, size);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            return false;
+        }
+
+        data += count;
+        size -= static_cast<size_t>(count);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Appends @p value to @p message.
+ */
+static void AppendUInt32(std::string& message, uint32_t value) // NOLINT(google-runtime-references)
+{
+    message.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/**
+ * @brief Reads a value written by AppendUInt32 from @p fd.
+ * @return true on success.
+ */
+static bool ReadUInt32(int fd, uint32_t* value)
+{
+    return ReadAll(fd, reinterpret_cast<char*>(value), sizeof(*value));
+}
+
+/**
+ * @brief Writes a message made of @p fields to @p fd.
+ * @details A message is the number of fields followed by the length and bytes of each field.
+ *
+ * @param fd The socket to write to.
+ * @param fields The fields of the message.
+ * @return true on success; false if the socket failed or was closed by its peer.
+ */
+bool ADUC_AduShellBroker_WriteMessage(int fd, const std::vector<std::string>& fields)
+{
+    if (fields.size() > ADUSHELL_BROKER_MAX_FIELD_COUNT)
+    {
+        return false;
+    }
+
+    std::string message;
+    AppendUInt32(message, static_cast<uint32_t>(fields.size()));
+
+    for (const std::string& field : fields)
+    {
+        if (field.size() > ADUSHELL_BROKER_MAX_FIELD_SIZE)
+        {
+            return false;
+        }
+
+        AppendUInt32(message, static_cast<uint32_t>(field.size()));
+        message += field;
+    }
+
+    return WriteAll(fd, message.data(), message.size());
+}
+
+/**
+ * @brief Reads a message written by ADUC_AduShellBroker_WriteMessage from @p fd.
+ *
+ * @param fd The socket to read from.
+ * @param fields Receives the fields of the message.
+ * @return true on success; false on failures, when the message is malformed, or at the end of the stream.
+ */
+bool ADUC_AduShellBroker_ReadMessage(int fd, std::vector<std::string>* fields)
+{
+    uint32_t fieldCount = 0;
+
+    fields->clear();
+
+    if (!ReadUInt32(fd, &fieldCount) || fieldCount > ADUSHELL_BROKER_MAX_FIELD_COUNT)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < fieldCount; i++)
+    {
+        uint32_t fieldSize = 0;
+        if (!ReadUInt32(fd, &fieldSize) || fieldSize > ADUSHELL_BROKER_MAX_FIELD_SIZE)
+        {
+            return false;
+        }
+
+        std::string field(fieldSize, '\0');
+        if (!ReadAll(fd, &field[0], fieldSize))
+        {
+            return false;
+        }
+
+        fields->emplace_back(std::move(field));
+    }
+
+    return true;
+}
+
+/**
+ * @brief Stops the broker, if it's running. Must be called with s_brokerMutex held.
+ */
+static void StopBrokerLocked()
+{
+    if (s_brokerFd != -1)
+    {
+        close(s_brokerFd);
+        s_brokerFd = -1;
+    }
+
+    if (s_brokerPid != -1)
+    {
+        // The broker exits on its own once its socket is closed, unless it's stuck.
+        kill(s_brokerPid, SIGTERM);
+        waitpid(s_brokerPid, nullptr, 0);
+        s_brokerPid = -1;
+    }
+}
+
+/**
+ * @brief Starts the broker, with a socket as its standard input. Must be called with s_brokerMutex held.
+ *
+ * @param aduShellPath Path to adu-shell.
+ * @return true on success.
+ */
+static bool StartBrokerLocked(const std::string& aduShellPath)
+{
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0)
+    {
+        Log_Error("Cannot create adu-shell broker socket, errno %d", errno);
+        return false;
+    }
+
+    char* const argv[] = { const_cast<char*>(aduShellPath.c_str()), // NOLINT(cppcoreguidelines-pro-type-const-cast)
+                           const_cast<char*>(ADUC_ADUSHELL_BROKER_OPT), // NOLINT(cppcoreguidelines-pro-type-const-cast)
+                           nullptr };
+
+    posix_spawn_file_actions_t fileActions;
+    pid_t pid = -1;
+    int status = posix_spawn_file_actions_init(&fileActions);
+
+    if (status == 0)
+    {
+        status = posix_spawn_file_actions_adddup2(&fileActions, sockets[1], STDIN_FILENO);
+        if (status == 0)
+        {
+            status = posix_spawn(&pid, aduShellPath.c_str(), &fileActions, nullptr, argv, environ);
+        }
+
+        posix_spawn_file_actions_destroy(&fileActions);
+    }
+
+    close(sockets[1]);
+
+    if (status != 0)
+    {
+        Log_Error("Cannot launch adu-shell broker %s, error %d", aduShellPath.c_str(), status);
+        close(sockets[0]);
+        return false;
+    }
+
+    Log_Info("Started adu-shell broker, pid %d", pid);
+
+    s_brokerPid = pid;
+    s_brokerFd = sockets[0];
+
+    return true;
+}
+
+/**
+ * @brief Returns whether adu-shell actions are to be run by the broker.
+ */
+static bool IsBrokerEnabled()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+    const bool enabled = config != nullptr && config->aduShellBroker;
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+
+    return enabled;
+}
+
+/**
+ * @brief Runs adu-shell with the specified arguments and captures its output and exit code.
+ *
+ * When aduShellBroker is set in the configuration file, the action is run by a long-lived adu-shell broker,
+ * started on first use and reused by the following calls. Otherwise, or if the broker can't be started,
+ * a new adu-shell process is launched for the action.
+ * Actions given a cancellation token always run in a new adu-shell process, since the broker can't interrupt them.
+ *
+ * @param aduShellPath Path to adu-shell.
+ * @param args List of arguments for adu-shell.
+ * @param output The output of adu-shell. With the broker, the end of the output of the action's child process.
+ * @param cancellationToken Terminates adu-shell and its children once cancelled. nullptr for none.
+ *
+ * @return An exit code from adu-shell, or the signal that terminated it once the token was cancelled.
+ */
+int ADUC_LaunchAduShell(
+    const std::string& aduShellPath,
+    const std::vector<std::string>& args,
+    std::string& output, // NOLINT(google-runtime-references)
+    const ADUC_CancellationToken* cancellationToken)
+{
+    if (cancellationToken == nullptr && IsBrokerEnabled())
+    {
+        std::lock_guard<std::mutex> lock(s_brokerMutex);
+
+        // A broker that exited while idle didn't receive the request, so it's safe to send it to a new one.
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            if (s_brokerFd == -1 && !StartBrokerLocked(aduShellPath))
+            {
+                break;
+            }
+
+            if (!ADUC_AduShellBroker_WriteMessage(s_brokerFd, args))
+            {
+                Log_Warn("adu-shell broker is gone, restarting it");
+                StopBrokerLocked();
+                continue;
+            }
+
+            std::vector<std::string> response;
+            if (!ADUC_AduShellBroker_ReadMessage(s_brokerFd, &response) || response.size() != 2)
+            {
+                Log_Error("No response from adu-shell broker");
+                StopBrokerLocked();
+                return EXIT_FAILURE;
+            }
+
+            output += response[1];
+            return atoi(response[0].c_str());
+        }
+
+        Log_Warn("adu-shell broker is unavailable, launching adu-shell");
+    }
+
+    return ADUC_LaunchChildProcess(aduShellPath, args, output, cancellationToken);
+}
+
+int ADUC_LaunchAduShellWithResultChannel(
+    const std::string& aduShellPath,
+    const std::vector<std::string>& args,
+    std::string& output, // NOLINT(google-runtime-references)
+    const std::function<void(const std::string& line)>& resultLineCallback,
+    const ADUC_CancellationToken* cancellationToken)
+{
+    return ADUC_LaunchChildProcessWithResultChannel(
+        aduShellPath, args, output, resultLineCallback, cancellationToken);
+}
@@ -0,0 +1,108 @@
+/**
+ * @file adushell_broker_utils_ut.cpp
+ * @brief Unit Tests for adushell_broker_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/adushell_broker_utils.hpp"
+
+#include <catch2/catch.hpp>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class SocketPair
+{
+public:
+    SocketPair()
+    {
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    }
+
+    ~SocketPair()
+    {
+        CloseWriter();
+        close(fds[1]);
+    }
+
+    SocketPair(const SocketPair&) = delete;
+    SocketPair& operator=(const SocketPair&) = delete;
+    SocketPair(SocketPair&&) = delete;
+    SocketPair& operator=(SocketPair&&) = delete;
+
+    void CloseWriter()
+    {
+        if (fds[0] != -1)
+        {
+            close(fds[0]);
+            fds[0] = -1;
+        }
+    }
+
+    int fds[2] = { -1, -1 };
+};
+
+TEST_CASE("ADUC_AduShellBroker_WriteMessage")
+{
+    SECTION("Round trip")
+    {
+        SocketPair sockets;
+        const std::vector<std::string> request{ "--update-type", "microsoft/script", "", std::string("a\0b", 3) };
+
+        REQUIRE(ADUC_AduShellBroker_WriteMessage(sockets.fds[0], request));
+        REQUIRE(ADUC_AduShellBroker_WriteMessage(sockets.fds[0], {}));
+
+        std::vector<std::string> fields;
+        REQUIRE(ADUC_AduShellBroker_ReadMessage(sockets.fds[1], &fields));
+        CHECK(fields == request);
+
+        REQUIRE(ADUC_AduShellBroker_ReadMessage(sockets.fds[1], &fields));
+        CHECK(fields.empty());
+    }
+
+    SECTION("Closed peer fails the write")
+    {
+        SocketPair sockets;
+        close(sockets.fds[1]);
+        sockets.fds[1] = -1;
+
+        CHECK_FALSE(ADUC_AduShellBroker_WriteMessage(sockets.fds[0], { "--update-type" }));
+    }
+}
+
+TEST_CASE("ADUC_AduShellBroker_ReadMessage")
+{
+    SECTION("End of stream")
+    {
+        SocketPair sockets;
+        sockets.CloseWriter();
+
+        std::vector<std::string> fields;
+        CHECK_FALSE(ADUC_AduShellBroker_ReadMessage(sockets.fds[1], &fields));
+    }
+
+    SECTION("Truncated message")
+    {
+        SocketPair sockets;
+        const uint32_t header[] = { 1, 10 };
+
+        REQUIRE(write(sockets.fds[0], header, sizeof(header)) == sizeof(header));
+        REQUIRE(write(sockets.fds[0], "abc", 3) == 3);
+        sockets.CloseWriter();
+
+        std::vector<std::string> fields;
+        CHECK_FALSE(ADUC_AduShellBroker_ReadMessage(sockets.fds[1], &fields));
+    }
+
+    SECTION("Oversized field")
+    {
+        SocketPair sockets;
+        const uint32_t header[] = { 1, 0xffffffff };
+
+        REQUIRE(write(sockets.fds[0], header, sizeof(header)) == sizeof(header));
+
+        std::vector<std::string> fields;
+        CHECK_FALSE(ADUC_AduShellBroker_ReadMessage(sockets.fds[1], &fields));
+    }
+}
@@ -0,0 +1,97 @@
+/**
+ * @file arena.h
+ * @brief A bump allocator for short-lived allocations that are all freed at once, e.g. those of a workflow.
+ *
+ * An arena hands out memory from chunks it allocates as needed, and frees it all when it is destroyed. Chunks of the
+ * default size are kept in a small process-wide pool for the next arena, so that a long-running agent reuses the same
+ * chunks across deployments instead of fragmenting the heap with many small allocations.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ADUC_ARENA_H
+#define ADUC_ARENA_H
+
+#include <aduc/c_utils.h> // for EXTERN_C_BEGIN, EXTERN_C_END
+#include <stddef.h> // for size_t
+
+/**
+ * @brief The size of an arena chunk, in bytes. Larger allocations get a chunk of their own.
+ */
+#define ADUC_ARENA_CHUNK_SIZE (16 * 1024)
+
+/**
+ * @brief The most free chunks kept in the process-wide pool.
+ */
+#define ADUC_ARENA_MAX_POOLED_CHUNKS 16
+
+EXTERN_C_BEGIN
+
+typedef struct tagADUC_Arena ADUC_Arena;
+
+/**
+ * @brief Creates an empty arena. Chunks are allocated on the first allocation.
+ *
+ * @return ADUC_Arena* The arena, or NULL if out of memory. Free it with ADUC_Arena_Destroy.
+ */
+ADUC_Arena* ADUC_Arena_Create();
+
+/**
+ * @brief Frees all the memory of the arena, and the arena. Returns its chunks to the pool.
+ *
+ * @param arena The arena, or NULL.
+ */
+void ADUC_Arena_Destroy(ADUC_Arena* arena);
+
+/**
+ * @brief Allocates @p size bytes from the arena, aligned for any type. Thread-safe.
+ *
+ * @param arena The arena.
+ * @param size The number of bytes.
+ * @return void* The memory, or NULL if out of memory or @p size is 0. Valid until the arena is destroyed; must not be
+ * freed.
+ */
+void* ADUC_Arena_Alloc(ADUC_Arena* arena, size_t size);
+
+/**
+ * @brief Allocates @p count zeroed elements of @p size bytes from the arena. Thread-safe.
+ *
+ * @param arena The arena.
+ * @param count The number of elements.
+ * @param size The size of an element.
+ * @return void* The memory, or NULL if out of memory, on overflow, or if the total size is 0. Valid until the arena is
+ * destroyed; must not be freed.
+ */
+void* ADUC_Arena_Calloc(ADUC_Arena* arena, size_t count, size_t size);
+
+/**
+ * @brief Copies @p str into the arena. Thread-safe.
+ *
+ * @param arena The arena.
+ * @param str The string.
+ * @return char* The copy, or NULL if @p str is NULL or out of memory. Valid until the arena is destroyed; must not be
+ * freed.
+ */
+char* ADUC_Arena_Strdup(ADUC_Arena* arena, const char* str);
+
+/**
+ * @brief Moves the memory of @p source into @p target, and destroys @p source. The memory allocated from @p source stays
+ * valid until @p target is destroyed.
+ *
+ * @param target The arena that takes the memory.
+ * @param source The arena to merge, or NULL.
+ */
+void ADUC_Arena_Merge(ADUC_Arena* target, ADUC_Arena* source);
+
+/**
+ * @brief Returns the number of bytes allocated from the arena, alignment padding included.
+ *
+ * @param arena The arena.
+ * @return size_t The number of bytes.
+ */
+size_t ADUC_Arena_GetUsedBytes(ADUC_Arena* arena);
+
+EXTERN_C_END
+
+#endif // ADUC_ARENA_H
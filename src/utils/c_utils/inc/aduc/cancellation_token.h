@@ -0,0 +1,101 @@
+/**
+ * @file cancellation_token.h
+ * @brief A token that a thread cancels to interrupt the blocking operations of another, e.g. downloads and child
+ * processes.
+ *
+ * Operations observe a token in one of three ways: by polling ADUC_CancellationToken_IsCancelled, by adding the file
+ * descriptor of ADUC_CancellationToken_GetFd to the descriptors they poll() for, or by registering a callback that
+ * interrupts them, e.g. aborts a transfer.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ADUC_CANCELLATION_TOKEN_H
+#define ADUC_CANCELLATION_TOKEN_H
+
+#include <aduc/c_utils.h> // for EXTERN_C_BEGIN, EXTERN_C_END
+#include <stdbool.h>
+
+EXTERN_C_BEGIN
+
+typedef struct tagADUC_CancellationToken ADUC_CancellationToken;
+
+/**
+ * @brief Called when the token it's registered with is cancelled. Must not block, nor call the functions of the token.
+ *
+ * @param context The context passed to ADUC_CancellationToken_Register.
+ */
+typedef void (*ADUC_CancellationCallback)(void* context);
+
+/**
+ * @brief Creates a token that isn't cancelled.
+ *
+ * @return ADUC_CancellationToken* The token, or NULL if out of memory. Free it with ADUC_CancellationToken_Destroy.
+ */
+ADUC_CancellationToken* ADUC_CancellationToken_Create();
+
+/**
+ * @brief Frees the token. No operation may observe it anymore.
+ *
+ * @param token The token, or NULL.
+ */
+void ADUC_CancellationToken_Destroy(ADUC_CancellationToken* token);
+
+/**
+ * @brief Cancels the token: calls its registered callbacks and makes its file descriptor readable. Thread-safe.
+ * Cancelling a cancelled token has no effect.
+ *
+ * @param token The token, or NULL.
+ */
+void ADUC_CancellationToken_Cancel(ADUC_CancellationToken* token);
+
+/**
+ * @brief Makes the token not cancelled again, for the next operations. Thread-safe.
+ *
+ * @param token The token, or NULL.
+ */
+void ADUC_CancellationToken_Reset(ADUC_CancellationToken* token);
+
+/**
+ * @brief Returns whether the token is cancelled. Thread-safe.
+ *
+ * @param token The token, or NULL for a token that is never cancelled.
+ */
+bool ADUC_CancellationToken_IsCancelled(const ADUC_CancellationToken* token);
+
+/**
+ * @brief Returns a file descriptor that is readable while the token is cancelled, to poll() along with others.
+ * It must not be read nor closed. Thread-safe.
+ *
+ * @param token The token.
+ * @return int The file descriptor, or -1 if @p token is NULL or on failure; poll() ignores negative descriptors.
+ */
+int ADUC_CancellationToken_GetFd(const ADUC_CancellationToken* token);
+
+/**
+ * @brief Registers @p callback to be called when the token is cancelled, on the cancelling thread. It's called right
+ * away, on this thread, if the token is already cancelled. Thread-safe.
+ *
+ * @param token The token, or NULL.
+ * @param callback The callback.
+ * @param context The context passed to @p callback.
+ * @return bool false if out of memory, true otherwise, including when @p token is NULL.
+ */
+bool ADUC_CancellationToken_Register(
+    const ADUC_CancellationToken* token, ADUC_CancellationCallback callback, void* context);
+
+/**
+ * @brief Unregisters a callback registered with ADUC_CancellationToken_Register. Once it returns, the callback isn't
+ * running and won't be called. Thread-safe.
+ *
+ * @param token The token, or NULL.
+ * @param callback The callback.
+ * @param context The context of the callback.
+ */
+void ADUC_CancellationToken_Unregister(
+    const ADUC_CancellationToken* token, ADUC_CancellationCallback callback, void* context);
+
+EXTERN_C_END
+
+#endif // ADUC_CANCELLATION_TOKEN_H
@@ -0,0 +1,290 @@
+/**
+ * @file arena.c
+ * @brief Implementation of the arena allocator.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#include "aduc/arena.h"
+
+#include <pthread.h>
+#include <stdint.h> // for SIZE_MAX
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief The alignment of the allocations, that of malloc on 64-bit platforms.
+ */
+#define ARENA_ALIGNMENT 16
+
+#define ARENA_ALIGN(size) (((size) + (ARENA_ALIGNMENT - 1)) & ~((size_t)ARENA_ALIGNMENT - 1))
+
+/**
+ * @brief A chunk of memory, followed by its data.
+ */
+typedef struct tagADUC_ArenaChunk
+{
+    struct tagADUC_ArenaChunk* Next; /**< The next chunk of the arena or of the pool. */
+    size_t Capacity; /**< The size of the data, in bytes. */
+    size_t Used; /**< The bytes of the data handed out. */
+} ADUC_ArenaChunk;
+
+struct tagADUC_Arena
+{
+    pthread_mutex_t Mutex; /**< Serializes the allocations. */
+    ADUC_ArenaChunk* Chunks; /**< The chunks, the one allocations are made from first. */
+    size_t UsedBytes; /**< The bytes handed out from all chunks. */
+};
+
+/**
+ * @brief The offset of the data in a chunk.
+ */
+#define ARENA_CHUNK_HEADER_SIZE ARENA_ALIGN(sizeof(ADUC_ArenaChunk))
+
+/**
+ * @brief The free chunks of the default size, for the next arenas.
+ */
+static ADUC_ArenaChunk* s_pooledChunks = NULL;
+static size_t s_pooledChunkCount = 0;
+static pthread_mutex_t s_poolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline unsigned char* ArenaChunk_Data(ADUC_ArenaChunk* chunk)
+{
+    return (unsigned char*)chunk + ARENA_CHUNK_HEADER_SIZE;
+}
+
+/**
+ * @brief Gets a chunk of at least @p capacity bytes, from the pool if it is of the default size.
+ *
+ * @param capacity The size of the data, in bytes.
+ * @return ADUC_ArenaChunk* The empty chunk, or NULL if out of memory.
+ */
+static ADUC_ArenaChunk* ArenaChunk_Acquire(size_t capacity)
+{
+    ADUC_ArenaChunk* chunk = NULL;
+
+    if (capacity <= ADUC_ARENA_CHUNK_SIZE)
+    {
+        capacity = ADUC_ARENA_CHUNK_SIZE;
+
+        pthread_mutex_lock(&s_poolMutex);
+        chunk = s_pooledChunks;
+        if (chunk != NULL)
+        {
+            s_pooledChunks = chunk->Next;
+            --s_pooledChunkCount;
+        }
+        pthread_mutex_unlock(&s_poolMutex);
+    }
+
+    if (chunk == NULL)
+    {
+        if (capacity > SIZE_MAX - ARENA_CHUNK_HEADER_SIZE)
+        {
+            return NULL;
+        }
+
+        chunk = malloc(ARENA_CHUNK_HEADER_SIZE + capacity);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+
+        chunk->Capacity = capacity;
+    }
+
+    chunk->Next = NULL;
+    chunk->Used = 0;
+    return chunk;
+}
+
+/**
+ * @brief Returns @p chunk to the pool if it is of the default size and the pool has room, else frees it.
+ *
+ * @param chunk The chunk.
+ */
+static void ArenaChunk_Release(ADUC_ArenaChunk* chunk)
+{
+    if (chunk->Capacity == ADUC_ARENA_CHUNK_SIZE)
+    {
+        pthread_mutex_lock(&s_poolMutex);
+        if (s_pooledChunkCount < ADUC_ARENA_MAX_POOLED_CHUNKS)
+        {
+            chunk->Next = s_pooledChunks;
+            s_pooledChunks = chunk;
+            ++s_pooledChunkCount;
+            chunk = NULL;
+        }
+        pthread_mutex_unlock(&s_poolMutex);
+    }
+
+    free(chunk);
+}
+
+ADUC_Arena* ADUC_Arena_Create()
+{
+    ADUC_Arena* arena = calloc(1, sizeof(*arena));
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&arena->Mutex, NULL) != 0)
+    {
+        free(arena);
+        return NULL;
+    }
+
+    return arena;
+}
+
+void ADUC_Arena_Destroy(ADUC_Arena* arena)
+{
+    if (arena == NULL)
+    {
+        return;
+    }
+
+    ADUC_ArenaChunk* chunk = arena->Chunks;
+    while (chunk != NULL)
+    {
+        ADUC_ArenaChunk* next = chunk->Next;
+        ArenaChunk_Release(chunk);
+        chunk = next;
+    }
+
+    pthread_mutex_destroy(&arena->Mutex);
+    free(arena);
+}
+
+void* ADUC_Arena_Alloc(ADUC_Arena* arena, size_t size)
+{
+    void* ptr = NULL;
+
+    if (arena == NULL || size == 0 || size > SIZE_MAX - ARENA_ALIGNMENT)
+    {
+        return NULL;
+    }
+
+    size = ARENA_ALIGN(size);
+
+    pthread_mutex_lock(&arena->Mutex);
+
+    ADUC_ArenaChunk* chunk = arena->Chunks;
+    if (chunk == NULL || chunk->Capacity - chunk->Used < size)
+    {
+        ADUC_ArenaChunk* newChunk = ArenaChunk_Acquire(size);
+        if (newChunk == NULL)
+        {
+            goto done;
+        }
+
+        if (chunk != NULL && newChunk->Capacity > ADUC_ARENA_CHUNK_SIZE)
+        {
+            // Keep allocating from the current chunk; the large one is full.
+            newChunk->Next = chunk->Next;
+            chunk->Next = newChunk;
+        }
+        else
+        {
+            newChunk->Next = chunk;
+            arena->Chunks = newChunk;
+        }
+
+        chunk = newChunk;
+    }
+
+    ptr = ArenaChunk_Data(chunk) + chunk->Used;
+    chunk->Used += size;
+    arena->UsedBytes += size;
+
+done:
+    pthread_mutex_unlock(&arena->Mutex);
+    return ptr;
+}
+
+void* ADUC_Arena_Calloc(ADUC_Arena* arena, size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+
+    void* ptr = ADUC_Arena_Alloc(arena, count * size);
+    if (ptr != NULL)
+    {
+        memset(ptr, 0, count * size);
+    }
+
+    return ptr;
+}
+
+char* ADUC_Arena_Strdup(ADUC_Arena* arena, const char* str)
+{
+    if (str == NULL)
+    {
+        return NULL;
+    }
+
+    const size_t size = strlen(str) + 1;
+    char* copy = ADUC_Arena_Alloc(arena, size);
+    if (copy != NULL)
+    {
+        memcpy(copy, str, size);
+    }
+
+    return copy;
+}
+
+void ADUC_Arena_Merge(ADUC_Arena* target, ADUC_Arena* source)
+{
+    if (target == NULL || source == NULL || target == source)
+    {
+        return;
+    }
+
+    ADUC_ArenaChunk* chunks = source->Chunks;
+    size_t usedBytes = source->UsedBytes;
+    source->Chunks = NULL;
+    ADUC_Arena_Destroy(source);
+
+    if (chunks == NULL)
+    {
+        return;
+    }
+
+    ADUC_ArenaChunk* last = chunks;
+    while (last->Next != NULL)
+    {
+        last = last->Next;
+    }
+
+    // Insert them after the current chunk of the target, which it keeps allocating from.
+    pthread_mutex_lock(&target->Mutex);
+    if (target->Chunks == NULL)
+    {
+        target->Chunks = chunks;
+    }
+    else
+    {
+        last->Next = target->Chunks->Next;
+        target->Chunks->Next = chunks;
+    }
+    target->UsedBytes += usedBytes;
+    pthread_mutex_unlock(&target->Mutex);
+}
+
+size_t ADUC_Arena_GetUsedBytes(ADUC_Arena* arena)
+{
+    size_t usedBytes = 0;
+
+    if (arena != NULL)
+    {
+        pthread_mutex_lock(&arena->Mutex);
+        usedBytes = arena->UsedBytes;
+        pthread_mutex_unlock(&arena->Mutex);
+    }
+
+    return usedBytes;
+}
@@ -0,0 +1,220 @@
+/**
+ * @file cancellation_token.c
+ * @brief Implementation of the cancellation token.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#include "aduc/cancellation_token.h"
+
+#include <pthread.h>
+#include <stdint.h> // for uint64_t
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/**
+ * @brief A callback registered with a token.
+ */
+typedef struct tagADUC_CancellationRegistration
+{
+    struct tagADUC_CancellationRegistration* Next; /**< The next registration. */
+    ADUC_CancellationCallback Callback; /**< The callback. */
+    void* Context; /**< The context of the callback. */
+} ADUC_CancellationRegistration;
+
+struct tagADUC_CancellationToken
+{
+    pthread_mutex_t Mutex; /**< Serializes the cancellation, the registrations, and the creation of the fd. */
+    bool Cancelled; /**< Whether the token is cancelled. Read with the __atomic builtins. */
+    int EventFd; /**< The eventfd of ADUC_CancellationToken_GetFd, created on the first call, or -1. */
+    ADUC_CancellationRegistration* Registrations; /**< The registered callbacks. */
+};
+
+ADUC_CancellationToken* ADUC_CancellationToken_Create()
+{
+    ADUC_CancellationToken* token = calloc(1, sizeof(*token));
+    if (token == NULL)
+    {
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&token->Mutex, NULL) != 0)
+    {
+        free(token);
+        return NULL;
+    }
+
+    token->EventFd = -1;
+    return token;
+}
+
+void ADUC_CancellationToken_Destroy(ADUC_CancellationToken* token)
+{
+    if (token == NULL)
+    {
+        return;
+    }
+
+    ADUC_CancellationRegistration* registration = token->Registrations;
+    while (registration != NULL)
+    {
+        ADUC_CancellationRegistration* next = registration->Next;
+        free(registration);
+        registration = next;
+    }
+
+    if (token->EventFd != -1)
+    {
+        close(token->EventFd);
+    }
+
+    pthread_mutex_destroy(&token->Mutex);
+    free(token);
+}
+
+void ADUC_CancellationToken_Cancel(ADUC_CancellationToken* token)
+{
+    if (token == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&token->Mutex);
+
+    if (!token->Cancelled)
+    {
+        __atomic_store_n(&token->Cancelled, true, __ATOMIC_RELEASE);
+
+        if (token->EventFd != -1)
+        {
+            const uint64_t one = 1;
+            // Can't fail: the counter is at most 1.
+            (void)!write(token->EventFd, &one, sizeof(one));
+        }
+
+        // Called with the lock held, so that a callback doesn't run once it's unregistered.
+        for (ADUC_CancellationRegistration* r = token->Registrations; r != NULL; r = r->Next)
+        {
+            r->Callback(r->Context);
+        }
+    }
+
+    pthread_mutex_unlock(&token->Mutex);
+}
+
+void ADUC_CancellationToken_Reset(ADUC_CancellationToken* token)
+{
+    if (token == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&token->Mutex);
+
+    if (token->Cancelled)
+    {
+        __atomic_store_n(&token->Cancelled, false, __ATOMIC_RELEASE);
+
+        if (token->EventFd != -1)
+        {
+            // Reading an eventfd resets its counter to 0, which makes it unreadable.
+            uint64_t count = 0;
+            (void)!read(token->EventFd, &count, sizeof(count));
+        }
+    }
+
+    pthread_mutex_unlock(&token->Mutex);
+}
+
+bool ADUC_CancellationToken_IsCancelled(const ADUC_CancellationToken* token)
+{
+    return token != NULL && __atomic_load_n(&token->Cancelled, __ATOMIC_ACQUIRE);
+}
+
+int ADUC_CancellationToken_GetFd(const ADUC_CancellationToken* token)
+{
+    if (token == NULL)
+    {
+        return -1;
+    }
+
+    // The fd is part of the state of the token, not of its value.
+    ADUC_CancellationToken* mutableToken = (ADUC_CancellationToken*)token;
+
+    pthread_mutex_lock(&mutableToken->Mutex);
+
+    if (mutableToken->EventFd == -1)
+    {
+        mutableToken->EventFd = eventfd(mutableToken->Cancelled ? 1 : 0, EFD_CLOEXEC | EFD_NONBLOCK);
+    }
+
+    const int fd = mutableToken->EventFd;
+
+    pthread_mutex_unlock(&mutableToken->Mutex);
+
+    return fd;
+}
+
+bool ADUC_CancellationToken_Register(
+    const ADUC_CancellationToken* token, ADUC_CancellationCallback callback, void* context)
+{
+    if (token == NULL)
+    {
+        return true;
+    }
+
+    ADUC_CancellationToken* mutableToken = (ADUC_CancellationToken*)token;
+
+    ADUC_CancellationRegistration* registration = malloc(sizeof(*registration));
+    if (registration == NULL)
+    {
+        return false;
+    }
+
+    registration->Callback = callback;
+    registration->Context = context;
+
+    pthread_mutex_lock(&mutableToken->Mutex);
+
+    registration->Next = mutableToken->Registrations;
+    mutableToken->Registrations = registration;
+
+    if (mutableToken->Cancelled)
+    {
+        callback(context);
+    }
+
+    pthread_mutex_unlock(&mutableToken->Mutex);
+
+    return true;
+}
+
+void ADUC_CancellationToken_Unregister(
+    const ADUC_CancellationToken* token, ADUC_CancellationCallback callback, void* context)
+{
+    if (token == NULL)
+    {
+        return;
+    }
+
+    ADUC_CancellationToken* mutableToken = (ADUC_CancellationToken*)token;
+    ADUC_CancellationRegistration* found = NULL;
+
+    pthread_mutex_lock(&mutableToken->Mutex);
+
+    for (ADUC_CancellationRegistration** r = &mutableToken->Registrations; *r != NULL; r = &(*r)->Next)
+    {
+        if ((*r)->Callback == callback && (*r)->Context == context)
+        {
+            found = *r;
+            *r = found->Next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&mutableToken->Mutex);
+
+    free(found);
+}
@@ -0,0 +1,127 @@
+/**
+ * @file arena_ut.cpp
+ * @brief Unit Tests for the arena allocator.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+using Catch::Matchers::Equals;
+
+#include "aduc/arena.h"
+
+#include <cstdint>
+#include <cstring>
+
+TEST_CASE("ADUC_Arena_Alloc")
+{
+    ADUC_Arena* arena = ADUC_Arena_Create();
+    REQUIRE(arena != nullptr);
+
+    SECTION("Allocations are aligned and do not overlap")
+    {
+        auto* a = static_cast<char*>(ADUC_Arena_Alloc(arena, 3));
+        auto* b = static_cast<char*>(ADUC_Arena_Alloc(arena, 24));
+        REQUIRE(a != nullptr);
+        REQUIRE(b != nullptr);
+        CHECK(reinterpret_cast<uintptr_t>(a) % 16 == 0);
+        CHECK(reinterpret_cast<uintptr_t>(b) % 16 == 0);
+        CHECK(b >= a + 3);
+        CHECK(ADUC_Arena_GetUsedBytes(arena) == 16 + 32);
+    }
+
+    SECTION("Invalid sizes")
+    {
+        CHECK(ADUC_Arena_Alloc(arena, 0) == nullptr);
+        CHECK(ADUC_Arena_Alloc(arena, SIZE_MAX) == nullptr);
+        CHECK(ADUC_Arena_Calloc(arena, SIZE_MAX / 2, 4) == nullptr);
+        CHECK(ADUC_Arena_Alloc(nullptr, 8) == nullptr);
+        CHECK(ADUC_Arena_GetUsedBytes(arena) == 0);
+    }
+
+    SECTION("Allocations larger than a chunk")
+    {
+        auto* small = static_cast<char*>(ADUC_Arena_Alloc(arena, 8));
+        auto* large = static_cast<char*>(ADUC_Arena_Calloc(arena, 2, ADUC_ARENA_CHUNK_SIZE));
+        auto* next = static_cast<char*>(ADUC_Arena_Alloc(arena, 8));
+        REQUIRE(small != nullptr);
+        REQUIRE(large != nullptr);
+        REQUIRE(next != nullptr);
+
+        CHECK(large[0] == 0);
+        CHECK(large[2 * ADUC_ARENA_CHUNK_SIZE - 1] == 0);
+
+        // The small allocations keep sharing their chunk.
+        CHECK(next == small + 16);
+    }
+
+    SECTION("Many allocations span several chunks")
+    {
+        for (int i = 0; i < 1000; ++i)
+        {
+            auto* p = static_cast<int*>(ADUC_Arena_Alloc(arena, 100));
+            REQUIRE(p != nullptr);
+            *p = i;
+        }
+
+        CHECK(ADUC_Arena_GetUsedBytes(arena) == 1000 * 112);
+    }
+
+    ADUC_Arena_Destroy(arena);
+}
+
+TEST_CASE("ADUC_Arena_Strdup")
+{
+    ADUC_Arena* arena = ADUC_Arena_Create();
+    REQUIRE(arena != nullptr);
+
+    CHECK(ADUC_Arena_Strdup(arena, nullptr) == nullptr);
+
+    const char* s = "/var/lib/adu/downloads/workflow";
+    char* copy = ADUC_Arena_Strdup(arena, s);
+    CHECK_THAT(copy, Equals(s));
+    CHECK(copy != s);
+
+    ADUC_Arena_Destroy(arena);
+}
+
+TEST_CASE("ADUC_Arena_Merge")
+{
+    ADUC_Arena* target = ADUC_Arena_Create();
+    ADUC_Arena* source = ADUC_Arena_Create();
+    REQUIRE(target != nullptr);
+    REQUIRE(source != nullptr);
+
+    char* t = ADUC_Arena_Strdup(target, "target");
+    char* s = ADUC_Arena_Strdup(source, "source");
+
+    // Merging destroys the source, but its memory stays valid.
+    ADUC_Arena_Merge(target, source);
+    CHECK_THAT(t, Equals("target"));
+    CHECK_THAT(s, Equals("source"));
+    CHECK(ADUC_Arena_GetUsedBytes(target) == 32);
+
+    // The target keeps allocating from its current chunk.
+    char* next = ADUC_Arena_Strdup(target, "next");
+    CHECK(next == t + 16);
+
+    ADUC_Arena_Merge(target, nullptr);
+    ADUC_Arena_Merge(target, ADUC_Arena_Create());
+    CHECK(ADUC_Arena_GetUsedBytes(target) == 48);
+
+    ADUC_Arena_Destroy(target);
+}
+
+TEST_CASE("Arena chunks are reused")
+{
+    ADUC_Arena* arena = ADUC_Arena_Create();
+    REQUIRE(arena != nullptr);
+    void* first = ADUC_Arena_Alloc(arena, 8);
+    REQUIRE(first != nullptr);
+    ADUC_Arena_Destroy(arena);
+
+    arena = ADUC_Arena_Create();
+    REQUIRE(arena != nullptr);
+    CHECK(ADUC_Arena_Alloc(arena, 8) == first);
+    ADUC_Arena_Destroy(arena);
+}
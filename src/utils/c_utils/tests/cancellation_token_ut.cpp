@@ -0,0 +1,97 @@
+/**
+ * @file cancellation_token_ut.cpp
+ * @brief Unit Tests for the cancellation token.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+
+#include "aduc/cancellation_token.h"
+
+#include <poll.h>
+#include <thread>
+
+static bool IsFdReadable(int fd)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN) != 0;
+}
+
+static void CountCancellation(void* context)
+{
+    ++*static_cast<int*>(context);
+}
+
+TEST_CASE("ADUC_CancellationToken_Cancel")
+{
+    ADUC_CancellationToken* token = ADUC_CancellationToken_Create();
+    REQUIRE(token != nullptr);
+
+    SECTION("Cancel and reset")
+    {
+        const int fd = ADUC_CancellationToken_GetFd(token);
+        REQUIRE(fd != -1);
+        CHECK_FALSE(ADUC_CancellationToken_IsCancelled(token));
+        CHECK_FALSE(IsFdReadable(fd));
+
+        ADUC_CancellationToken_Cancel(token);
+        ADUC_CancellationToken_Cancel(token);
+        CHECK(ADUC_CancellationToken_IsCancelled(token));
+        CHECK(IsFdReadable(fd));
+
+        ADUC_CancellationToken_Reset(token);
+        CHECK_FALSE(ADUC_CancellationToken_IsCancelled(token));
+        CHECK_FALSE(IsFdReadable(fd));
+        CHECK(ADUC_CancellationToken_GetFd(token) == fd);
+    }
+
+    SECTION("The fd of a cancelled token is readable")
+    {
+        ADUC_CancellationToken_Cancel(token);
+        CHECK(IsFdReadable(ADUC_CancellationToken_GetFd(token)));
+    }
+
+    SECTION("Callbacks")
+    {
+        int first = 0;
+        int second = 0;
+        REQUIRE(ADUC_CancellationToken_Register(token, CountCancellation, &first));
+        REQUIRE(ADUC_CancellationToken_Register(token, CountCancellation, &second));
+        ADUC_CancellationToken_Unregister(token, CountCancellation, &second);
+
+        ADUC_CancellationToken_Cancel(token);
+        ADUC_CancellationToken_Cancel(token);
+        CHECK(first == 1);
+        CHECK(second == 0);
+
+        // A callback registered with a cancelled token is called right away.
+        REQUIRE(ADUC_CancellationToken_Register(token, CountCancellation, &second));
+        CHECK(second == 1);
+
+        ADUC_CancellationToken_Unregister(token, CountCancellation, &first);
+        ADUC_CancellationToken_Unregister(token, CountCancellation, &second);
+    }
+
+    SECTION("Cancel from another thread wakes up poll")
+    {
+        struct pollfd pfd = { ADUC_CancellationToken_GetFd(token), POLLIN, 0 };
+        std::thread canceller{ [token]() { ADUC_CancellationToken_Cancel(token); } };
+        CHECK(poll(&pfd, 1, 10000) == 1);
+        canceller.join();
+    }
+
+    ADUC_CancellationToken_Destroy(token);
+}
+
+TEST_CASE("ADUC_CancellationToken with a NULL token")
+{
+    int count = 0;
+
+    ADUC_CancellationToken_Cancel(nullptr);
+    CHECK_FALSE(ADUC_CancellationToken_IsCancelled(nullptr));
+    CHECK(ADUC_CancellationToken_GetFd(nullptr) == -1);
+    CHECK(ADUC_CancellationToken_Register(nullptr, CountCancellation, &count));
+    ADUC_CancellationToken_Unregister(nullptr, CountCancellation, &count);
+    CHECK(count == 0);
+}
@@ -0,0 +1,236 @@
+/**
+ * @file component_inventory_file.h
+ * @brief A compact, memory mapped component inventory file, for component enumerators to select components without
+ * parsing JSON or allocating.
+ *
+ * The inventory is authored as JSON, in the format of GetAllComponents, and compiled into this format by
+ * aduc_compile_component_inventory. All integers are little-endian, and 32-bit except for the source stamp of the
+ * header. All sections are 4-byte aligned:
+ *
+ *   header       ADUC_ComponentInventoryFileHeader
+ *   strings      StringCount offsets into the string data, in strcmp order of the strings
+ *   string data  null-terminated strings
+ *   components   ComponentCount records, each the id of the component's compact JSON, then AttributeSlots
+ *                (name id, value id) pairs of its string fields in name id order, padded with
+ *                ADUC_COMPONENT_INVENTORY_NO_STRING
+ *   index        IndexCount ADUC_ComponentInventoryIndexEntry, one per (name id, value id) pair, in that order
+ *   postings     the component indexes each index entry refers to, in ascending order
+ *
+ * A component matches a selector when it has each of the selector's name-value pairs as a string field.
+ *
+ * The header records the size and modification time of the JSON inventory it was compiled from. Readers check them
+ * with ADUC_ComponentInventoryFile_IsCompiledFrom, and use the JSON inventory instead once it has changed.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_COMPONENT_INVENTORY_FILE_H
+#define ADUC_COMPONENT_INVENTORY_FILE_H
+
+#include <aduc/c_utils.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief The first 4 bytes of a component inventory file, "ADCI".
+ */
+#define ADUC_COMPONENT_INVENTORY_FILE_MAGIC 0x49434441u
+
+/**
+ * @brief The version of the format.
+ */
+#define ADUC_COMPONENT_INVENTORY_FILE_VERSION 2u
+
+/**
+ * @brief The string id of a string that isn't in the file.
+ */
+#define ADUC_COMPONENT_INVENTORY_NO_STRING UINT32_MAX
+
+/**
+ * @brief The most name-value pairs a query can have.
+ */
+#define ADUC_COMPONENT_INVENTORY_MAX_QUERY_TERMS 8
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief The size and modification time of a JSON inventory, to tell whether a file compiled from it is stale.
+ */
+typedef struct tagADUC_ComponentInventorySource
+{
+    uint64_t Size; //!< The size of the JSON inventory, in bytes.
+    int64_t ModifiedSeconds; //!< The seconds of its modification time.
+    uint32_t ModifiedNanoseconds; //!< The nanoseconds of its modification time.
+} ADUC_ComponentInventorySource;
+
+/**
+ * @brief The header of a component inventory file. Offsets are from the start of the file.
+ */
+typedef struct tagADUC_ComponentInventoryFileHeader
+{
+    uint32_t Magic; //!< ADUC_COMPONENT_INVENTORY_FILE_MAGIC.
+    uint32_t Version; //!< ADUC_COMPONENT_INVENTORY_FILE_VERSION.
+    uint32_t StringCount; //!< The number of strings.
+    uint32_t StringsOffset; //!< The offset of the string offsets.
+    uint32_t StringDataOffset; //!< The offset of the string data.
+    uint32_t StringDataSize; //!< The size of the string data.
+    uint32_t ComponentCount; //!< The number of component records.
+    uint32_t AttributeSlots; //!< The number of (name id, value id) pairs in each component record.
+    uint32_t ComponentsOffset; //!< The offset of the component records.
+    uint32_t IndexCount; //!< The number of index entries.
+    uint32_t IndexOffset; //!< The offset of the index entries.
+    uint32_t PostingsOffset; //!< The offset of the postings.
+    uint64_t SourceSize; //!< The Size of the ADUC_ComponentInventorySource compiled. 0 if unknown.
+    int64_t SourceModifiedSeconds; //!< Its ModifiedSeconds.
+    uint32_t SourceModifiedNanoseconds; //!< Its ModifiedNanoseconds.
+    uint32_t Reserved; //!< 0.
+} ADUC_ComponentInventoryFileHeader;
+
+/**
+ * @brief The components with a string field of a name and value.
+ */
+typedef struct tagADUC_ComponentInventoryIndexEntry
+{
+    uint32_t NameId; //!< The string id of the field name.
+    uint32_t ValueId; //!< The string id of the field value.
+    uint32_t FirstPosting; //!< The index of the first component index in the postings.
+    uint32_t PostingCount; //!< The number of components.
+} ADUC_ComponentInventoryIndexEntry;
+
+/**
+ * @brief A mapped component inventory file.
+ */
+typedef struct tagADUC_ComponentInventoryFile
+{
+    const uint8_t* Data; //!< The mapped file.
+    size_t Size; //!< The size of the file.
+    const ADUC_ComponentInventoryFileHeader* Header; //!< The header, at Data.
+    const uint32_t* Strings; //!< The string offsets.
+    const char* StringData; //!< The string data.
+    const uint32_t* Components; //!< The component records.
+    const ADUC_ComponentInventoryIndexEntry* Index; //!< The index entries.
+    const uint32_t* Postings; //!< The postings.
+} ADUC_ComponentInventoryFile;
+
+/**
+ * @brief The components a query selects, and the state of iterating them.
+ */
+typedef struct tagADUC_ComponentInventoryQuery
+{
+    size_t TermCount; //!< The number of terms.
+    uint32_t NameIds[ADUC_COMPONENT_INVENTORY_MAX_QUERY_TERMS]; //!< The name id of each term.
+    uint32_t ValueIds[ADUC_COMPONENT_INVENTORY_MAX_QUERY_TERMS]; //!< The value id of each term.
+    bool MatchesNone; //!< Whether a term names a string the file doesn't have, or an empty one.
+    const uint32_t* Candidates; //!< The postings of the term with the fewest components, or NULL for all.
+    size_t CandidateCount; //!< The number of candidates.
+    size_t Next; //!< The next candidate to match.
+} ADUC_ComponentInventoryQuery;
+
+/**
+ * @brief Maps the component inventory file @p filePath, and validates it.
+ *
+ * @param filePath The path of the file.
+ * @param[out] file The mapped file. Close it with ADUC_ComponentInventoryFile_Close.
+ * @returns True on success. False if the file can't be mapped or isn't a valid component inventory file.
+ */
+bool ADUC_ComponentInventoryFile_Open(const char* filePath, ADUC_ComponentInventoryFile* file);
+
+/**
+ * @brief Gets the size and modification time of the JSON inventory @p sourceFilePath.
+ *
+ * @param sourceFilePath The path of the JSON inventory.
+ * @param[out] source The size and modification time.
+ * @returns False if the file can't be stat'ed.
+ */
+bool ADUC_ComponentInventoryFile_GetSource(const char* sourceFilePath, ADUC_ComponentInventorySource* source);
+
+/**
+ * @brief Checks whether @p file was compiled from the JSON inventory @p sourceFilePath as it is now, i.e. the size
+ * and modification time recorded in @p file are those of @p sourceFilePath.
+ *
+ * @param file The file.
+ * @param sourceFilePath The path of the JSON inventory.
+ * @returns False if @p file is stale, records no source, or @p sourceFilePath can't be stat'ed.
+ */
+bool ADUC_ComponentInventoryFile_IsCompiledFrom(const ADUC_ComponentInventoryFile* file, const char* sourceFilePath);
+
+/**
+ * @brief Unmaps @p file. Strings returned from it are no longer valid.
+ *
+ * @param file The file, may be zeroed.
+ */
+void ADUC_ComponentInventoryFile_Close(ADUC_ComponentInventoryFile* file);
+
+/**
+ * @brief Returns the number of components in @p file.
+ */
+size_t ADUC_ComponentInventoryFile_GetComponentCount(const ADUC_ComponentInventoryFile* file);
+
+/**
+ * @brief Returns the compact JSON object of a component, e.g. {"id":"0","group":"motors",...}.
+ *
+ * @param file The file.
+ * @param componentIndex The index of the component.
+ * @returns The JSON, in the mapping of @p file.
+ */
+const char*
+ADUC_ComponentInventoryFile_GetComponentJson(const ADUC_ComponentInventoryFile* file, size_t componentIndex);
+
+/**
+ * @brief Returns the value of a string field of a component.
+ *
+ * @param file The file.
+ * @param componentIndex The index of the component.
+ * @param name The name of the field, e.g. "group".
+ * @returns The value, in the mapping of @p file, or NULL if the component has no such string field.
+ */
+const char* ADUC_ComponentInventoryFile_GetAttribute(
+    const ADUC_ComponentInventoryFile* file, size_t componentIndex, const char* name);
+
+/**
+ * @brief Starts a query for all components.
+ *
+ * @param file The file.
+ * @param[out] query The query. Narrow it with ADUC_ComponentInventoryFile_AddQueryTerm.
+ */
+void ADUC_ComponentInventoryFile_BeginQuery(
+    const ADUC_ComponentInventoryFile* file, ADUC_ComponentInventoryQuery* query);
+
+/**
+ * @brief Narrows @p query to the components with the string field @p name of value @p value.
+ *
+ * @param file The file.
+ * @param query The query, not yet iterated.
+ * @param name The name of the field.
+ * @param value The value of the field.
+ * @returns False if the query has ADUC_COMPONENT_INVENTORY_MAX_QUERY_TERMS terms already.
+ */
+bool ADUC_ComponentInventoryFile_AddQueryTerm(
+    const ADUC_ComponentInventoryFile* file, ADUC_ComponentInventoryQuery* query, const char* name, const char* value);
+
+/**
+ * @brief Returns the next component @p query selects, in ascending index order.
+ *
+ * @param file The file.
+ * @param query The query.
+ * @param[out] componentIndex The index of the component.
+ * @returns False when there are no more components.
+ */
+bool ADUC_ComponentInventoryFile_NextMatch(
+    const ADUC_ComponentInventoryFile* file, ADUC_ComponentInventoryQuery* query, size_t* componentIndex);
+
+/**
+ * @brief Compiles a JSON component inventory into a component inventory file.
+ *
+ * @param componentsJson The inventory, in the format of GetAllComponents, e.g. { "components": [ { ... } ] }.
+ * @param source The JSON inventory @p componentsJson was read from, gotten before reading it, or NULL if none.
+ * @param filePath The path of the file to write, replaced atomically.
+ * @returns True on success.
+ */
+bool ADUC_ComponentInventoryFile_Compile(
+    const char* componentsJson, const ADUC_ComponentInventorySource* source, const char* filePath);
+
+EXTERN_C_END
+
+#endif // ADUC_COMPONENT_INVENTORY_FILE_H
@@ -0,0 +1,351 @@
+/**
+ * @file component_inventory_compiler.c
+ * @brief Implements compiling a JSON component inventory into a component inventory file.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/component_inventory_file.h"
+
+#include <parson.h>
+#include <stdio.h> // for fopen, fwrite, rename, snprintf
+#include <stdlib.h> // for calloc, free, qsort, bsearch
+#include <string.h> // for strcmp, strlen
+
+/**
+ * @brief A (name id, value id) pair of a component, and the component.
+ */
+typedef struct tagADUC_ComponentInventoryField
+{
+    uint32_t NameId;
+    uint32_t ValueId;
+    uint32_t ComponentIndex;
+} ADUC_ComponentInventoryField;
+
+static int CompareStrings(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+static int CompareFields(const void* a, const void* b)
+{
+    const ADUC_ComponentInventoryField* left = (const ADUC_ComponentInventoryField*)a;
+    const ADUC_ComponentInventoryField* right = (const ADUC_ComponentInventoryField*)b;
+
+    if (left->NameId != right->NameId)
+    {
+        return left->NameId < right->NameId ? -1 : 1;
+    }
+
+    if (left->ValueId != right->ValueId)
+    {
+        return left->ValueId < right->ValueId ? -1 : 1;
+    }
+
+    return left->ComponentIndex < right->ComponentIndex ? -1 : (left->ComponentIndex > right->ComponentIndex);
+}
+
+/**
+ * @brief Returns the id of @p value in the sorted, unique @p strings.
+ */
+static uint32_t GetStringId(const char* const* strings, size_t stringCount, const char* value)
+{
+    const char* const* found =
+        (const char* const*)bsearch(&value, strings, stringCount, sizeof(*strings), CompareStrings);
+    return (uint32_t)(found - strings);
+}
+
+static size_t AlignSize(size_t size)
+{
+    return (size + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+}
+
+/**
+ * @brief Writes the zeros that pad @p size bytes to the next multiple of 4 bytes.
+ */
+static bool WritePadding(FILE* stream, size_t size)
+{
+    static const uint8_t zeros[sizeof(uint32_t)] = { 0 };
+    const size_t padding = AlignSize(size) - size;
+    return padding == 0 || fwrite(zeros, 1, padding, stream) == padding;
+}
+
+/**
+ * @brief Writes @p size bytes, then zeros up to the next multiple of 4 bytes.
+ */
+static bool WritePadded(FILE* stream, const void* data, size_t size)
+{
+    return (size == 0 || fwrite(data, 1, size, stream) == size) && WritePadding(stream, size);
+}
+
+bool ADUC_ComponentInventoryFile_Compile(
+    const char* componentsJson, const ADUC_ComponentInventorySource* source, const char* filePath)
+{
+    bool succeeded = false;
+    const uint32_t byteOrder = 1;
+    JSON_Value* rootValue = json_parse_string(componentsJson);
+    JSON_Array* components = json_object_get_array(json_value_get_object(rootValue), "components");
+    const size_t componentCount = json_array_get_count(components);
+    char** componentJsons = NULL;
+    const char** strings = NULL;
+    size_t stringCount = 0;
+    ADUC_ComponentInventoryField* fields = NULL;
+    size_t fieldCount = 0;
+    uint32_t* records = NULL;
+    uint32_t* stringOffsets = NULL;
+    ADUC_ComponentInventoryIndexEntry* index = NULL;
+    uint32_t* postings = NULL;
+    size_t indexCount = 0;
+    size_t attributeSlots = 0;
+    size_t stringDataSize = 0;
+    ADUC_ComponentInventoryFileHeader header;
+    uint64_t fileSize = 0;
+    char tempFilePath[4096];
+    FILE* stream = NULL;
+    bool created = false;
+
+    // The format is little-endian.
+    if (components == NULL || *(const uint8_t*)&byteOrder != 1 || componentCount > UINT32_MAX
+        || snprintf(tempFilePath, sizeof(tempFilePath), "%s.tmp", filePath) >= (int)sizeof(tempFilePath))
+    {
+        goto done;
+    }
+
+    // Count the strings: the compact JSON of each component, and the name and value of each string field.
+    size_t maxStringCount = componentCount;
+    for (size_t i = 0; i < componentCount; i++)
+    {
+        const JSON_Object* component = json_array_get_object(components, i);
+        if (component == NULL)
+        {
+            goto done;
+        }
+
+        size_t slots = 0;
+        for (size_t f = 0; f < json_object_get_count(component); f++)
+        {
+            if (json_value_get_type(json_object_get_value_at(component, f)) == JSONString)
+            {
+                slots++;
+            }
+        }
+
+        maxStringCount += 2 * slots;
+        fieldCount += slots;
+        attributeSlots = slots > attributeSlots ? slots : attributeSlots;
+    }
+
+    componentJsons = (char**)calloc(componentCount + 1, sizeof(*componentJsons));
+    strings = (const char**)calloc(maxStringCount + 1, sizeof(*strings));
+    fields = (ADUC_ComponentInventoryField*)calloc(fieldCount + 1, sizeof(*fields));
+    if (componentJsons == NULL || strings == NULL || fields == NULL)
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < componentCount; i++)
+    {
+        const JSON_Object* component = json_array_get_object(components, i);
+        componentJsons[i] = json_serialize_to_string(json_array_get_value(components, i));
+        if (componentJsons[i] == NULL)
+        {
+            goto done;
+        }
+
+        strings[stringCount++] = componentJsons[i];
+        for (size_t f = 0; f < json_object_get_count(component); f++)
+        {
+            const char* value = json_value_get_string(json_object_get_value_at(component, f));
+            if (value != NULL)
+            {
+                strings[stringCount++] = json_object_get_name(component, f);
+                strings[stringCount++] = value;
+            }
+        }
+    }
+
+    // Sort and deduplicate the strings, so that a string id is its rank.
+    qsort(strings, stringCount, sizeof(*strings), CompareStrings);
+    {
+        size_t unique = 0;
+        for (size_t i = 0; i < stringCount; i++)
+        {
+            if (unique == 0 || strcmp(strings[unique - 1], strings[i]) != 0)
+            {
+                strings[unique++] = strings[i];
+                stringDataSize += strlen(strings[i]) + 1;
+            }
+        }
+
+        stringCount = unique;
+    }
+
+    fileSize = sizeof(header) + (uint64_t)stringCount * sizeof(uint32_t) + AlignSize(stringDataSize)
+        + (uint64_t)componentCount * (1 + 2 * attributeSlots) * sizeof(uint32_t)
+        + (uint64_t)fieldCount * (sizeof(ADUC_ComponentInventoryIndexEntry) + sizeof(uint32_t));
+    if (stringCount >= ADUC_COMPONENT_INVENTORY_NO_STRING || fileSize > UINT32_MAX)
+    {
+        goto done;
+    }
+
+    stringOffsets = (uint32_t*)calloc(stringCount + 1, sizeof(*stringOffsets));
+    records = (uint32_t*)calloc(componentCount * (1 + 2 * attributeSlots) + 1, sizeof(*records));
+    if (stringOffsets == NULL || records == NULL)
+    {
+        goto done;
+    }
+
+    {
+        uint32_t offset = 0;
+        for (size_t i = 0; i < stringCount; i++)
+        {
+            stringOffsets[i] = offset;
+            offset += (uint32_t)(strlen(strings[i]) + 1);
+        }
+    }
+
+    // Each component record: its JSON, then its fields in name id order, padded.
+    fieldCount = 0;
+    for (size_t i = 0; i < componentCount; i++)
+    {
+        const JSON_Object* component = json_array_get_object(components, i);
+        uint32_t* record = records + i * (1 + 2 * attributeSlots);
+        ADUC_ComponentInventoryField* componentFields = fields + fieldCount;
+        size_t slots = 0;
+
+        for (size_t f = 0; f < json_object_get_count(component); f++)
+        {
+            const char* value = json_value_get_string(json_object_get_value_at(component, f));
+            if (value != NULL)
+            {
+                componentFields[slots].NameId =
+                    GetStringId(strings, stringCount, json_object_get_name(component, f));
+                componentFields[slots].ValueId = GetStringId(strings, stringCount, value);
+                componentFields[slots].ComponentIndex = (uint32_t)i;
+                slots++;
+            }
+        }
+
+        qsort(componentFields, slots, sizeof(*componentFields), CompareFields);
+
+        record[0] = GetStringId(strings, stringCount, componentJsons[i]);
+        for (size_t slot = 0; slot < attributeSlots; slot++)
+        {
+            record[1 + 2 * slot] = slot < slots ? componentFields[slot].NameId : ADUC_COMPONENT_INVENTORY_NO_STRING;
+            record[2 + 2 * slot] = slot < slots ? componentFields[slot].ValueId : ADUC_COMPONENT_INVENTORY_NO_STRING;
+        }
+
+        fieldCount += slots;
+    }
+
+    // The index: the fields of all components in (name id, value id, component) order, grouped by pair.
+    qsort(fields, fieldCount, sizeof(*fields), CompareFields);
+
+    index = (ADUC_ComponentInventoryIndexEntry*)calloc(fieldCount + 1, sizeof(*index));
+    postings = (uint32_t*)calloc(fieldCount + 1, sizeof(*postings));
+    if (index == NULL || postings == NULL)
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < fieldCount; i++)
+    {
+        if (indexCount == 0 || index[indexCount - 1].NameId != fields[i].NameId
+            || index[indexCount - 1].ValueId != fields[i].ValueId)
+        {
+            index[indexCount].NameId = fields[i].NameId;
+            index[indexCount].ValueId = fields[i].ValueId;
+            index[indexCount].FirstPosting = (uint32_t)i;
+            indexCount++;
+        }
+
+        index[indexCount - 1].PostingCount++;
+        postings[i] = fields[i].ComponentIndex;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.Magic = ADUC_COMPONENT_INVENTORY_FILE_MAGIC;
+    header.Version = ADUC_COMPONENT_INVENTORY_FILE_VERSION;
+    header.StringCount = (uint32_t)stringCount;
+    header.StringsOffset = sizeof(header);
+    header.StringDataOffset = header.StringsOffset + (uint32_t)(stringCount * sizeof(uint32_t));
+    header.StringDataSize = (uint32_t)stringDataSize;
+    header.ComponentCount = (uint32_t)componentCount;
+    header.AttributeSlots = (uint32_t)attributeSlots;
+    header.ComponentsOffset = header.StringDataOffset + (uint32_t)AlignSize(stringDataSize);
+    header.IndexCount = (uint32_t)indexCount;
+    header.IndexOffset =
+        header.ComponentsOffset + (uint32_t)(componentCount * (1 + 2 * attributeSlots) * sizeof(uint32_t));
+    header.PostingsOffset = header.IndexOffset + (uint32_t)(indexCount * sizeof(*index));
+    if (source != NULL)
+    {
+        header.SourceSize = source->Size;
+        header.SourceModifiedSeconds = source->ModifiedSeconds;
+        header.SourceModifiedNanoseconds = source->ModifiedNanoseconds;
+    }
+
+    stream = fopen(tempFilePath, "wb");
+    if (stream == NULL)
+    {
+        goto done;
+    }
+
+    created = true;
+
+    if (!WritePadded(stream, &header, sizeof(header))
+        || !WritePadded(stream, stringOffsets, stringCount * sizeof(*stringOffsets)))
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < stringCount; i++)
+    {
+        const size_t size = strlen(strings[i]) + 1;
+        if (fwrite(strings[i], 1, size, stream) != size)
+        {
+            goto done;
+        }
+    }
+
+    if (!WritePadding(stream, stringDataSize)
+        || !WritePadded(stream, records, componentCount * (1 + 2 * attributeSlots) * sizeof(*records))
+        || !WritePadded(stream, index, indexCount * sizeof(*index))
+        || !WritePadded(stream, postings, fieldCount * sizeof(*postings)))
+    {
+        goto done;
+    }
+
+    succeeded = fclose(stream) == 0;
+    stream = NULL;
+
+    succeeded = succeeded && rename(tempFilePath, filePath) == 0;
+
+done:
+    if (stream != NULL)
+    {
+        fclose(stream);
+    }
+
+    if (!succeeded && created)
+    {
+        remove(tempFilePath);
+    }
+
+    if (componentJsons != NULL)
+    {
+        for (size_t i = 0; i < componentCount; i++)
+        {
+            json_free_serialized_string(componentJsons[i]);
+        }
+    }
+
+    free(componentJsons);
+    free((void*)strings);
+    free(fields);
+    free(records);
+    free(stringOffsets);
+    free(index);
+    free(postings);
+    json_value_free(rootValue);
+    return succeeded;
+}
@@ -0,0 +1,378 @@
+/**
+ * @file component_inventory_file.c
+ * @brief Implements reading a component inventory file.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/component_inventory_file.h"
+
+#include <fcntl.h> // for open
+#include <string.h> // for memset, strcmp
+#include <sys/mman.h> // for mmap, munmap
+#include <sys/stat.h> // for fstat, stat
+#include <unistd.h> // for close
+
+/**
+ * @brief Returns whether @p count items of @p itemSize bytes at @p offset are within a file of @p fileSize bytes.
+ */
+static bool IsSectionInFile(size_t fileSize, uint32_t offset, uint32_t count, size_t itemSize)
+{
+    return offset % sizeof(uint32_t) == 0 && offset <= fileSize
+        && (uint64_t)count * itemSize <= (uint64_t)(fileSize - offset);
+}
+
+/**
+ * @brief Returns whether the sections of the mapped @p file are consistent, so that reading them stays in the file.
+ */
+static bool IsValidFile(const ADUC_ComponentInventoryFile* file)
+{
+    const ADUC_ComponentInventoryFileHeader* header = file->Header;
+
+    if (header->Magic != ADUC_COMPONENT_INVENTORY_FILE_MAGIC
+        || header->Version != ADUC_COMPONENT_INVENTORY_FILE_VERSION)
+    {
+        return false;
+    }
+
+    const uint64_t recordSize = (1 + 2 * (uint64_t)header->AttributeSlots) * sizeof(uint32_t);
+    if (!IsSectionInFile(file->Size, header->StringsOffset, header->StringCount, sizeof(uint32_t))
+        || !IsSectionInFile(file->Size, header->StringDataOffset, header->StringDataSize, 1)
+        || recordSize > UINT32_MAX
+        || !IsSectionInFile(file->Size, header->ComponentsOffset, header->ComponentCount, (size_t)recordSize)
+        || !IsSectionInFile(
+            file->Size, header->IndexOffset, header->IndexCount, sizeof(ADUC_ComponentInventoryIndexEntry)))
+    {
+        return false;
+    }
+
+    // Every string must be null-terminated within the string data.
+    if (header->StringCount != 0
+        && (header->StringDataSize == 0 || file->StringData[header->StringDataSize - 1] != '\0'))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header->StringCount; i++)
+    {
+        if (file->Strings[i] >= header->StringDataSize)
+        {
+            return false;
+        }
+    }
+
+    // Every string id and posting must be in range. The postings are as many as the indexed component fields.
+    uint64_t postingCount = 0;
+    for (uint32_t i = 0; i < header->IndexCount; i++)
+    {
+        const ADUC_ComponentInventoryIndexEntry* entry = &file->Index[i];
+        if (entry->NameId >= header->StringCount || entry->ValueId >= header->StringCount
+            || entry->FirstPosting != postingCount)
+        {
+            return false;
+        }
+
+        postingCount += entry->PostingCount;
+    }
+
+    if (postingCount > UINT32_MAX
+        || !IsSectionInFile(file->Size, header->PostingsOffset, (uint32_t)postingCount, sizeof(uint32_t)))
+    {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < postingCount; i++)
+    {
+        if (file->Postings[i] >= header->ComponentCount)
+        {
+            return false;
+        }
+    }
+
+    for (uint64_t i = 0; i < (uint64_t)header->ComponentCount * (recordSize / sizeof(uint32_t)); i++)
+    {
+        if (file->Components[i] >= header->StringCount && file->Components[i] != ADUC_COMPONENT_INVENTORY_NO_STRING)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ADUC_ComponentInventoryFile_Open(const char* filePath, ADUC_ComponentInventoryFile* file)
+{
+    bool succeeded = false;
+    struct stat st;
+    void* data = MAP_FAILED;
+
+    memset(file, 0, sizeof(*file));
+
+    const int fd = open(filePath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        goto done;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ADUC_ComponentInventoryFileHeader)
+        || (uint64_t)st.st_size > SIZE_MAX)
+    {
+        goto done;
+    }
+
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        goto done;
+    }
+
+    file->Data = (const uint8_t*)data;
+    file->Size = (size_t)st.st_size;
+    file->Header = (const ADUC_ComponentInventoryFileHeader*)data;
+    file->Strings = (const uint32_t*)(file->Data + file->Header->StringsOffset);
+    file->StringData = (const char*)(file->Data + file->Header->StringDataOffset);
+    file->Components = (const uint32_t*)(file->Data + file->Header->ComponentsOffset);
+    file->Index = (const ADUC_ComponentInventoryIndexEntry*)(file->Data + file->Header->IndexOffset);
+    file->Postings = (const uint32_t*)(file->Data + file->Header->PostingsOffset);
+
+    succeeded = IsValidFile(file);
+
+done:
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    if (!succeeded)
+    {
+        ADUC_ComponentInventoryFile_Close(file);
+    }
+
+    return succeeded;
+}
+
+bool ADUC_ComponentInventoryFile_GetSource(const char* sourceFilePath, ADUC_ComponentInventorySource* source)
+{
+    struct stat st;
+
+    memset(source, 0, sizeof(*source));
+    if (stat(sourceFilePath, &st) != 0)
+    {
+        return false;
+    }
+
+    source->Size = (uint64_t)st.st_size;
+    source->ModifiedSeconds = (int64_t)st.st_mtim.tv_sec;
+    source->ModifiedNanoseconds = (uint32_t)st.st_mtim.tv_nsec;
+    return true;
+}
+
+bool ADUC_ComponentInventoryFile_IsCompiledFrom(const ADUC_ComponentInventoryFile* file, const char* sourceFilePath)
+{
+    ADUC_ComponentInventorySource source;
+
+    // An empty JSON inventory isn't valid, so a size of 0 means the source is unknown.
+    return file->Header != NULL && file->Header->SourceSize != 0
+        && ADUC_ComponentInventoryFile_GetSource(sourceFilePath, &source) && source.Size == file->Header->SourceSize
+        && source.ModifiedSeconds == file->Header->SourceModifiedSeconds
+        && source.ModifiedNanoseconds == file->Header->SourceModifiedNanoseconds;
+}
+
+void ADUC_ComponentInventoryFile_Close(ADUC_ComponentInventoryFile* file)
+{
+    if (file->Data != NULL)
+    {
+        munmap((void*)file->Data, file->Size);
+    }
+
+    memset(file, 0, sizeof(*file));
+}
+
+size_t ADUC_ComponentInventoryFile_GetComponentCount(const ADUC_ComponentInventoryFile* file)
+{
+    return file->Header == NULL ? 0 : file->Header->ComponentCount;
+}
+
+/**
+ * @brief Returns the string of @p stringId.
+ */
+static const char* GetString(const ADUC_ComponentInventoryFile* file, uint32_t stringId)
+{
+    return file->StringData + file->Strings[stringId];
+}
+
+/**
+ * @brief Returns the string id of @p value, or ADUC_COMPONENT_INVENTORY_NO_STRING.
+ */
+static uint32_t FindString(const ADUC_ComponentInventoryFile* file, const char* value)
+{
+    uint32_t low = 0;
+    uint32_t high = file->Header->StringCount;
+
+    while (low < high)
+    {
+        const uint32_t middle = low + (high - low) / 2;
+        const int comparison = strcmp(GetString(file, middle), value);
+        if (comparison == 0)
+        {
+            return middle;
+        }
+
+        if (comparison < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return ADUC_COMPONENT_INVENTORY_NO_STRING;
+}
+
+/**
+ * @brief Returns the record of a component: its JSON string id, then its (name id, value id) pairs.
+ */
+static const uint32_t* GetRecord(const ADUC_ComponentInventoryFile* file, size_t componentIndex)
+{
+    return file->Components + componentIndex * (1 + 2 * (size_t)file->Header->AttributeSlots);
+}
+
+/**
+ * @brief Returns the value id of the string field @p nameId of a component, or ADUC_COMPONENT_INVENTORY_NO_STRING.
+ */
+static uint32_t GetValueId(const ADUC_ComponentInventoryFile* file, size_t componentIndex, uint32_t nameId)
+{
+    const uint32_t* attributes = GetRecord(file, componentIndex) + 1;
+    for (uint32_t slot = 0; slot < file->Header->AttributeSlots && attributes[2 * slot] <= nameId; slot++)
+    {
+        if (attributes[2 * slot] == nameId)
+        {
+            return attributes[2 * slot + 1];
+        }
+    }
+
+    return ADUC_COMPONENT_INVENTORY_NO_STRING;
+}
+
+/**
+ * @brief Returns the index entry of (@p nameId, @p valueId), or NULL if no component has the field.
+ */
+static const ADUC_ComponentInventoryIndexEntry*
+FindIndexEntry(const ADUC_ComponentInventoryFile* file, uint32_t nameId, uint32_t valueId)
+{
+    uint32_t low = 0;
+    uint32_t high = file->Header->IndexCount;
+
+    while (low < high)
+    {
+        const uint32_t middle = low + (high - low) / 2;
+        const ADUC_ComponentInventoryIndexEntry* entry = &file->Index[middle];
+        if (entry->NameId == nameId && entry->ValueId == valueId)
+        {
+            return entry;
+        }
+
+        if (entry->NameId < nameId || (entry->NameId == nameId && entry->ValueId < valueId))
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return NULL;
+}
+
+const char*
+ADUC_ComponentInventoryFile_GetComponentJson(const ADUC_ComponentInventoryFile* file, size_t componentIndex)
+{
+    return GetString(file, GetRecord(file, componentIndex)[0]);
+}
+
+const char* ADUC_ComponentInventoryFile_GetAttribute(
+    const ADUC_ComponentInventoryFile* file, size_t componentIndex, const char* name)
+{
+    const uint32_t nameId = FindString(file, name);
+    if (nameId == ADUC_COMPONENT_INVENTORY_NO_STRING)
+    {
+        return NULL;
+    }
+
+    const uint32_t valueId = GetValueId(file, componentIndex, nameId);
+    return valueId == ADUC_COMPONENT_INVENTORY_NO_STRING ? NULL : GetString(file, valueId);
+}
+
+void ADUC_ComponentInventoryFile_BeginQuery(
+    const ADUC_ComponentInventoryFile* file, ADUC_ComponentInventoryQuery* query)
+{
+    memset(query, 0, sizeof(*query));
+    query->CandidateCount = ADUC_ComponentInventoryFile_GetComponentCount(file);
+}
+
+bool ADUC_ComponentInventoryFile_AddQueryTerm(
+    const ADUC_ComponentInventoryFile* file, ADUC_ComponentInventoryQuery* query, const char* name, const char* value)
+{
+    if (query->TermCount == ADUC_COMPONENT_INVENTORY_MAX_QUERY_TERMS)
+    {
+        return false;
+    }
+
+    // Like the example enumerators, empty names and values match nothing.
+    const uint32_t nameId = *name == '\0' ? ADUC_COMPONENT_INVENTORY_NO_STRING : FindString(file, name);
+    const uint32_t valueId = *value == '\0' ? ADUC_COMPONENT_INVENTORY_NO_STRING : FindString(file, value);
+    const ADUC_ComponentInventoryIndexEntry* entry = (nameId == ADUC_COMPONENT_INVENTORY_NO_STRING
+                                                      || valueId == ADUC_COMPONENT_INVENTORY_NO_STRING)
+        ? NULL
+        : FindIndexEntry(file, nameId, valueId);
+    if (entry == NULL)
+    {
+        query->MatchesNone = true;
+        return true;
+    }
+
+    query->NameIds[query->TermCount] = nameId;
+    query->ValueIds[query->TermCount] = valueId;
+    query->TermCount++;
+
+    // Iterate the components of the term with the fewest, and match the other terms against those.
+    if (query->Candidates == NULL || entry->PostingCount < query->CandidateCount)
+    {
+        query->Candidates = file->Postings + entry->FirstPosting;
+        query->CandidateCount = entry->PostingCount;
+    }
+
+    return true;
+}
+
+bool ADUC_ComponentInventoryFile_NextMatch(
+    const ADUC_ComponentInventoryFile* file, ADUC_ComponentInventoryQuery* query, size_t* componentIndex)
+{
+    if (query->MatchesNone)
+    {
+        return false;
+    }
+
+    while (query->Next < query->CandidateCount)
+    {
+        const size_t index = query->Candidates == NULL ? query->Next : query->Candidates[query->Next];
+        query->Next++;
+
+        bool matched = true;
+        for (size_t t = 0; t < query->TermCount && matched; t++)
+        {
+            matched = GetValueId(file, index, query->NameIds[t]) == query->ValueIds[t];
+        }
+
+        if (matched)
+        {
+            *componentIndex = index;
+            return true;
+        }
+    }
+
+    return false;
+}
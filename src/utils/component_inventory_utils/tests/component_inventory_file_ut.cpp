@@ -0,0 +1,151 @@
+/**
+ * @file component_inventory_file_ut.cpp
+ * @brief Unit tests for the component inventory file.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/component_inventory_file.h"
+
+#include <catch2/catch.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+static const char* const components = R"({
+    "components": [
+        { "id": "0", "name": "host-firmware", "group": "firmware", "manufacturer": "contoso", "model": "virtual-firmware" },
+        { "id": "1", "name": "front-motor", "group": "motors", "manufacturer": "contoso", "model": "virtual-motor" },
+        { "id": "2", "name": "rear-motor", "group": "motors", "manufacturer": "contoso", "model": "virtual-motor" },
+        { "id": "3", "name": "usb-camera", "group": "cameras", "manufacturer": "fabrikam",
+          "properties": { "path": "/dev/video0" } }
+    ]
+})";
+
+static const char* const filePath = "/tmp/aduc_component_inventory_file_ut.bin";
+
+static std::vector<std::string> Select(
+    const ADUC_ComponentInventoryFile* file, const std::vector<std::pair<const char*, const char*>>& terms)
+{
+    ADUC_ComponentInventoryQuery query;
+    ADUC_ComponentInventoryFile_BeginQuery(file, &query);
+    for (const auto& term : terms)
+    {
+        REQUIRE(ADUC_ComponentInventoryFile_AddQueryTerm(file, &query, term.first, term.second));
+    }
+
+    std::vector<std::string> ids;
+    size_t componentIndex = 0;
+    while (ADUC_ComponentInventoryFile_NextMatch(file, &query, &componentIndex))
+    {
+        ids.emplace_back(ADUC_ComponentInventoryFile_GetAttribute(file, componentIndex, "id"));
+    }
+
+    return ids;
+}
+
+TEST_CASE("ADUC_ComponentInventoryFile selects components")
+{
+    REQUIRE(ADUC_ComponentInventoryFile_Compile(components, nullptr, filePath));
+
+    ADUC_ComponentInventoryFile file;
+    REQUIRE(ADUC_ComponentInventoryFile_Open(filePath, &file));
+    CHECK(ADUC_ComponentInventoryFile_GetComponentCount(&file) == 4);
+
+    CHECK(Select(&file, { { "group", "motors" } }) == std::vector<std::string>{ "1", "2" });
+    CHECK(
+        Select(&file, { { "manufacturer", "contoso" }, { "name", "rear-motor" } })
+        == std::vector<std::string>{ "2" });
+    CHECK(Select(&file, {}).size() == 4);
+
+    // Values of other fields, unknown names, empty values and non-string fields match nothing.
+    CHECK(Select(&file, { { "group", "contoso" } }).empty());
+    CHECK(Select(&file, { { "color", "red" } }).empty());
+    CHECK(Select(&file, { { "group", "" } }).empty());
+    CHECK(Select(&file, { { "model", "usb-cam" } }).empty());
+    CHECK(Select(&file, { { "properties", "/dev/video0" } }).empty());
+
+    CHECK(ADUC_ComponentInventoryFile_GetAttribute(&file, 3, "model") == nullptr);
+    CHECK(
+        std::string(ADUC_ComponentInventoryFile_GetComponentJson(&file, 3))
+        == R"({"id":"3","name":"usb-camera","group":"cameras","manufacturer":"fabrikam",)"
+           R"("properties":{"path":"\/dev\/video0"}})");
+
+    ADUC_ComponentInventoryFile_Close(&file);
+    std::remove(filePath);
+}
+
+TEST_CASE("ADUC_ComponentInventoryFile rejects invalid files")
+{
+    ADUC_ComponentInventoryFile file;
+
+    CHECK_FALSE(ADUC_ComponentInventoryFile_Compile(R"({ "devices": [] })", nullptr, filePath));
+    CHECK_FALSE(ADUC_ComponentInventoryFile_Open(filePath, &file));
+
+    REQUIRE(ADUC_ComponentInventoryFile_Compile(components, nullptr, filePath));
+
+    // Truncated.
+    std::string content;
+    {
+        std::ifstream input(filePath, std::ios::binary);
+        content.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+
+    {
+        std::ofstream output(filePath, std::ios::binary | std::ios::trunc);
+        output.write(content.data(), static_cast<std::streamsize>(content.size() - 4));
+    }
+
+    CHECK_FALSE(ADUC_ComponentInventoryFile_Open(filePath, &file));
+    CHECK(file.Data == nullptr);
+
+    // A JSON inventory.
+    {
+        std::ofstream output(filePath, std::ios::binary | std::ios::trunc);
+        output << components;
+    }
+
+    CHECK_FALSE(ADUC_ComponentInventoryFile_Open(filePath, &file));
+
+    std::remove(filePath);
+}
+
+TEST_CASE("ADUC_ComponentInventoryFile tells whether it's stale")
+{
+    const char* const sourceFilePath = "/tmp/aduc_component_inventory_file_ut.json";
+    ADUC_ComponentInventorySource source;
+    ADUC_ComponentInventoryFile file;
+
+    {
+        std::ofstream output(sourceFilePath, std::ios::trunc);
+        output << components;
+    }
+
+    REQUIRE(ADUC_ComponentInventoryFile_GetSource(sourceFilePath, &source));
+    REQUIRE(ADUC_ComponentInventoryFile_Compile(components, &source, filePath));
+    REQUIRE(ADUC_ComponentInventoryFile_Open(filePath, &file));
+    CHECK(ADUC_ComponentInventoryFile_IsCompiledFrom(&file, sourceFilePath));
+
+    // An edit changes the size or the modification time.
+    {
+        std::ofstream output(sourceFilePath, std::ios::app);
+        output << "\n";
+    }
+
+    CHECK_FALSE(ADUC_ComponentInventoryFile_IsCompiledFrom(&file, sourceFilePath));
+    ADUC_ComponentInventoryFile_Close(&file);
+
+    // Without a source, the file is never known to be current.
+    REQUIRE(ADUC_ComponentInventoryFile_Compile(components, nullptr, filePath));
+    REQUIRE(ADUC_ComponentInventoryFile_Open(filePath, &file));
+    CHECK_FALSE(ADUC_ComponentInventoryFile_IsCompiledFrom(&file, sourceFilePath));
+    ADUC_ComponentInventoryFile_Close(&file);
+
+    std::remove(sourceFilePath);
+    CHECK_FALSE(ADUC_ComponentInventoryFile_IsCompiledFrom(&file, sourceFilePath));
+    std::remove(filePath);
+}
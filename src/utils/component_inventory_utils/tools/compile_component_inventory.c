@@ -0,0 +1,49 @@
+/**
+ * @file compile_component_inventory.c
+ * @brief Compiles a JSON component inventory into a component inventory file, see component_inventory_file.h.
+ *
+ * Usage: aduc_compile_component_inventory <components-inventory.json> <components-inventory.bin>
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/component_inventory_file.h"
+
+#include <parson.h>
+#include <stdio.h>
+
+int main(int argc, char** argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <components-inventory.json> <components-inventory.bin>\n", argv[0]);
+        return 2;
+    }
+
+    // Stamped before reading, so that a change made meanwhile makes the compiled file stale rather than go unnoticed.
+    ADUC_ComponentInventorySource source;
+    if (!ADUC_ComponentInventoryFile_GetSource(argv[1], &source))
+    {
+        fprintf(stderr, "Cannot read %s\n", argv[1]);
+        return 1;
+    }
+
+    JSON_Value* inventory = json_parse_file(argv[1]);
+    char* componentsJson = json_serialize_to_string(inventory);
+    json_value_free(inventory);
+    if (componentsJson == NULL)
+    {
+        fprintf(stderr, "Cannot parse %s\n", argv[1]);
+        return 1;
+    }
+
+    const bool succeeded = ADUC_ComponentInventoryFile_Compile(componentsJson, &source, argv[2]);
+    json_free_serialized_string(componentsJson);
+    if (!succeeded)
+    {
+        fprintf(stderr, "Cannot compile %s, it must have a \"components\" array of objects.\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
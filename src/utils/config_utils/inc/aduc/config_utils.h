@@ -29,6 +29,27 @@
 
 EXTERN_C_BEGIN
 
+/**
+ * @brief Size limit of the download cache when downloadCacheSizeLimitMB isn't configured.
+ */
+#define ADUC_DEFAULT_DOWNLOAD_CACHE_SIZE_LIMIT_MB 1024
+
+/**
+ * @brief Size limit of the log of each workflow when workflowLogSizeLimitKB isn't configured.
+ */
+#define ADUC_DEFAULT_WORKFLOW_LOG_SIZE_LIMIT_KB 256
+
+/**
+ * @brief Time the enumeration of the components waits for each component enumerator when componentEnumeratorTimeoutMs
+ * isn't configured.
+ */
+#define ADUC_DEFAULT_COMPONENT_ENUMERATOR_TIMEOUT_MS 5000
+
+/**
+ * @brief Most memory taken by the downloads staged in RAM when ramStagingBudgetMB isn't configured.
+ */
+#define ADUC_DEFAULT_RAM_STAGING_BUDGET_MB 16
+
 typedef struct tagADUC_AgentInfo
 {
     char* name; /**< The name of the agent. */
@@ -68,6 +89,49 @@ typedef struct tagADUC_ConfigInfo
     unsigned int agentCount; /**< Total number of agents configured. */
 
     char* compatPropertyNames; /**< Compat property names. */
+    unsigned int maxConcurrentDownloads; /**< Maximum number of files downloaded at the same time. 0 if not configured. */
+    unsigned int downloadCacheSizeLimitMB; /**< Size limit of the download cache, in MiB. 0 disables the cache. */
+    bool aduShellBroker; /**< Whether adu-shell actions are run by a long-lived adu-shell broker. */
+    unsigned int maxConcurrentSteps; /**< Maximum number of steps downloaded, or probed by IsInstalled, at once. 0 if unset. */
+    bool fastBoot; /**< Whether the startup health check runs while the IoT Hub connection is set up. */
+    bool preloadContentHandlers; /**< Whether registered content handlers are preloaded at startup. */
+    unsigned int metricsTelemetryIntervalSeconds; /**< Interval of the metrics telemetry messages. 0 disables them. */
+    unsigned int workflowMemoryBudgetMB; /**< Memory budget of a workflow, in MiB. 0 if not configured. */
+    unsigned int progressTelemetryIntervalSeconds; /**< Interval of the progress telemetry messages. 0 disables them. */
+    unsigned int progressTelemetryMaxBytes; /**< Size limit of a progress telemetry message. 0 if not configured. */
+    unsigned int resourceSampleIntervalSeconds; /**< Interval of the resource usage samples. 0 disables them. */
+    unsigned int downloadBandwidthLimitKBps; /**< Bandwidth of all downloads together, in KiB/s. 0 for no limit. */
+    unsigned int downloadBandwidthLimitPerDownloadKBps; /**< Bandwidth of each download, in KiB/s. 0 for no limit. */
+    char* downloadWindows; /**< Comma-separated HH:MM-HH:MM times of day downloads may start at. NULL for any time. */
+    char* downloadCacheHosts; /**< Comma-separated LAN cache hosts to download content from first. NULL for none. */
+    char* downloadMirrors; /**< JSON object of URI prefixes to arrays of their mirror prefixes. NULL for none. */
+    unsigned int stepDownloadLookAhead; /**< Steps downloaded ahead of the step being installed. 0 to download first. */
+    unsigned int maxResidentSteps; /**< Step workflows kept in memory between their uses. 0 to keep them all. */
+    char* updateCgroup; /**< Path of the cgroup v2 child processes run in, e.g. apt. NULL to not move them. */
+    char* updateCgroupCpuMax; /**< cpu.max of the update cgroup, e.g. "50000 100000". NULL to leave it. */
+    char* updateCgroupIoMax; /**< io.max of the update cgroup, e.g. "179:0 wbps=10485760". NULL to leave it. */
+    char* updateCgroupMemoryHigh; /**< memory.high of the update cgroup, e.g. "256M". NULL to leave it. */
+    bool downloadIdlePriority; /**< Whether downloads, and the hashing of downloads, run with idle CPU and I/O priority. */
+    bool iotHubClientIoThread; /**< Whether the IoT Hub client is pumped by a thread of its own rather than the main loop. */
+    bool prefetchDownloads; /**< Whether the files of a deferred deployment download while the current one installs. */
+    unsigned int extensionIdleUnloadSeconds; /**< Idle time after which extensions are unloaded. 0 to keep them. */
+    unsigned int downloadTimeoutSeconds; /**< Timeout of the download of a deployment. 0 for none. */
+    unsigned int installTimeoutSeconds; /**< Timeout of the install of a deployment. 0 for none. */
+    unsigned int applyTimeoutSeconds; /**< Timeout of the apply of a deployment. 0 for none. */
+    unsigned int downloadProgressIntervalMs; /**< Least time between two download progress reports. 0 for 1000. */
+    unsigned int downloadProgressPercentStep; /**< Download progress reported anyway at each step, in %. 0 for 5. */
+    char* computeThreadCpus; /**< CPUs of the hashing and verification threads, e.g. "big" or "4-7". NULL for any. */
+    char* ioThreadCpus; /**< CPUs of the log flush and other I/O threads, e.g. "little" or "0-3". NULL for any. */
+    unsigned int heavyWorkMaxTemperatureC; /**< Temperature over which hashing and installs pause. 0 for none. */
+    unsigned int heavyWorkMinBatteryPercent; /**< Battery charge under which they pause, on battery. 0 for none. */
+    bool kexecReboot; /**< Whether reboots boot the kernel the apply loaded with kexec, skipping the firmware. */
+    unsigned int workflowLogSizeLimitKB; /**< Size limit of the compressed log of each workflow. 0 disables it. */
+    unsigned int componentEnumeratorTimeoutMs; /**< Wait for each of several component enumerators. 0 for no limit. */
+    unsigned int downloadStartJitterSeconds; /**< Window the devices spread their download starts over. 0 for none. */
+    unsigned int ramStagingThresholdKB; /**< Size up to which downloads are staged in RAM. 0 disables it. */
+    unsigned int ramStagingBudgetMB; /**< Most memory taken by the downloads staged in RAM at once. */
+
+    JSON_Value* rootJsonValue; /**< The parsed configuration file, which aduShellTrustedUsers points into. */
 } ADUC_ConfigInfo;
 
 /**
@@ -92,7 +156,7 @@ void ADUC_ConfigInfo_UnInit(ADUC_ConfigInfo* config);
  * @param index
  * @return const ADUC_AgentInfo*, NULL if failure
  */
-const ADUC_AgentInfo* ADUC_ConfigInfo_GetAgent(ADUC_ConfigInfo* config, unsigned int index);
+const ADUC_AgentInfo* ADUC_ConfigInfo_GetAgent(const ADUC_ConfigInfo* config, unsigned int index);
 
 /**
  * @brief Get the adu trusted user list
@@ -109,6 +173,45 @@ VECTOR_HANDLE ADUC_ConfigInfo_GetAduShellTrustedUsers(const ADUC_ConfigInfo* con
  */
 void ADUC_ConfigInfo_FreeAduShellTrustedUsers(VECTOR_HANDLE users);
 
+/**
+ * @brief Sets the default values of the configuration, e.g. from the performance profile of the device
+ * @details From the next ADUC_ConfigInfo_Init on, the top-level fields of @p defaults that the configuration file
+ * doesn't have are used as if the file had them; the fields of the file override them.
+ *
+ * @param defaults A JSON object of configuration fields, copied; NULL for no defaults
+ */
+void ADUC_ConfigInfo_SetDefaults(const JSON_Value* defaults);
+
+/**
+ * @brief Parses @p configFilePath and makes it the process-wide configuration returned by ADUC_ConfigInfo_GetInstance()
+ * @details Used for the initial load and for explicit reloads, e.g. on SIGHUP. If parsing fails, the current
+ * configuration stays in place. References acquired before a reload keep seeing the previous configuration.
+ *
+ * @param configFilePath The path of configuration file
+ * @return True if the configuration was loaded, False if failure
+ */
+_Bool ADUC_ConfigInfo_LoadInstance(const char* configFilePath);
+
+/**
+ * @brief Gets a reference to the process-wide configuration, loading ADUC_CONF_FILE_PATH if nothing was loaded yet
+ * @details The configuration is immutable and is parsed once; getting it doesn't take a lock.
+ *
+ * @return The configuration, to be released with ADUC_ConfigInfo_ReleaseInstance(); NULL if it can't be loaded
+ */
+const ADUC_ConfigInfo* ADUC_ConfigInfo_GetInstance();
+
+/**
+ * @brief Releases a reference returned by ADUC_ConfigInfo_GetInstance()
+ *
+ * @param config The configuration to release, may be NULL
+ */
+void ADUC_ConfigInfo_ReleaseInstance(const ADUC_ConfigInfo* config);
+
+/**
+ * @brief Drops the process-wide configuration; it is freed once all references to it are released
+ */
+void ADUC_ConfigInfo_UnloadInstance();
+
 // clang-format off
 // NOLINTNEXTLINE: clang-tidy doesn't like UMock macro expansions
 MOCKABLE_FUNCTION(, JSON_Value*, Parse_JSON_File, const char*, configFilePath)
@@ -15,6 +15,8 @@
 #include <azure_c_shared_utility/strings_types.h>
 #include <parson.h>
 #include <parson_json_utils.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,6 +24,79 @@
 
 static void ADUC_AgentInfo_Free(ADUC_AgentInfo* agent);
 
+/**
+ * @brief A reference counted, immutable configuration shared by the whole process
+ */
+typedef struct tagADUC_ConfigSnapshot
+{
+    ADUC_ConfigInfo config; /**< The configuration; must be the first member, as references point to it. */
+    unsigned int refCount; /**< Number of references, including the one held while it is the current snapshot. */
+} ADUC_ConfigSnapshot;
+
+/**
+ * @brief The current configuration snapshot, NULL until one is loaded.
+ */
+static ADUC_ConfigSnapshot* s_configSnapshot = NULL;
+
+/**
+ * @brief Number of readers between loading s_configSnapshot and taking a reference to it.
+ * @details A reload waits for it to drop to 0 before releasing the previous snapshot, so a reader never
+ * takes a reference to a freed snapshot, without readers having to take a lock.
+ */
+static unsigned int s_configSnapshotReaders = 0;
+
+/**
+ * @brief Serializes loading, reloading and unloading the snapshot.
+ */
+static pthread_mutex_t s_configSnapshotMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief The default values of the configuration fields, see ADUC_ConfigInfo_SetDefaults(); NULL for none.
+ */
+static JSON_Value* s_configDefaults = NULL;
+
+/**
+ * @brief Guards s_configDefaults.
+ */
+static pthread_mutex_t s_configDefaultsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Adds the default values of the fields that @p root_value doesn't have to it.
+ *
+ * @param root_value The parsed configuration file.
+ * @returns False on allocation failure.
+ */
+static _Bool ADUC_ConfigInfo_ApplyDefaults(JSON_Value* root_value)
+{
+    _Bool succeeded = true;
+    JSON_Object* root_object = json_value_get_object(root_value);
+
+    pthread_mutex_lock(&s_configDefaultsMutex);
+
+    const JSON_Object* defaults_object = json_value_get_object(s_configDefaults);
+    const size_t count = json_object_get_count(defaults_object);
+
+    for (size_t i = 0; succeeded && i < count; ++i)
+    {
+        const char* name = json_object_get_name(defaults_object, i);
+        if (json_object_has_value(root_object, name))
+        {
+            continue;
+        }
+
+        JSON_Value* value = json_value_deep_copy(json_object_get_value_at(defaults_object, i));
+        if (value == NULL || json_object_set_value(root_object, name, value) != JSONSuccess)
+        {
+            json_value_free(value);
+            succeeded = false;
+        }
+    }
+
+    pthread_mutex_unlock(&s_configDefaultsMutex);
+
+    return succeeded;
+}
+
 /**
  * @brief Initializes an ADUC_AgentInfo object
  * @param agent the agent to be initialized
@@ -240,6 +315,13 @@ _Bool ADUC_ConfigInfo_Init(ADUC_ConfigInfo* config, const char* configFilePath)
         goto done;
     }
 
+    config->rootJsonValue = root_value;
+
+    if (json_value_get_type(root_value) != JSONObject || !ADUC_ConfigInfo_ApplyDefaults(root_value))
+    {
+        goto done;
+    }
+
     if (!ADUC_Json_GetAgents(root_value, &(config->agentCount), &(config->agents)))
     {
         goto done;
@@ -304,6 +386,258 @@ _Bool ADUC_ConfigInfo_Init(ADUC_ConfigInfo* config, const char* configFilePath)
         }
     }
 
+    // Optional. Leave 0 to use the default.
+    if (!ADUC_JSON_GetUnsignedIntegerField(root_value, "maxConcurrentDownloads", &(config->maxConcurrentDownloads)))
+    {
+        config->maxConcurrentDownloads = 0;
+    }
+
+    // Optional. An explicit 0 disables the download cache.
+    if (!json_object_has_value_of_type(root_object, "downloadCacheSizeLimitMB", JSONNumber)
+        || !ADUC_JSON_GetUnsignedIntegerField(
+            root_value, "downloadCacheSizeLimitMB", &(config->downloadCacheSizeLimitMB)))
+    {
+        config->downloadCacheSizeLimitMB = ADUC_DEFAULT_DOWNLOAD_CACHE_SIZE_LIMIT_MB;
+    }
+
+    // Optional. Off unless set to true.
+    config->aduShellBroker = ADUC_JSON_GetBooleanField(root_value, "aduShellBroker");
+
+    // Optional. Leave 0 to download the steps of a workflow one at a time.
+    if (!ADUC_JSON_GetUnsignedIntegerField(root_value, "maxConcurrentSteps", &(config->maxConcurrentSteps)))
+    {
+        config->maxConcurrentSteps = 0;
+    }
+
+    // Optional. Off unless set to true.
+    config->fastBoot = ADUC_JSON_GetBooleanField(root_value, "fastBoot");
+
+    // Optional. Off unless set to true.
+    config->preloadContentHandlers = ADUC_JSON_GetBooleanField(root_value, "preloadContentHandlers");
+
+    // Optional. Leave 0 to not send metrics telemetry.
+    if (!ADUC_JSON_GetUnsignedIntegerField(
+            root_value, "metricsTelemetryIntervalSeconds", &(config->metricsTelemetryIntervalSeconds)))
+    {
+        config->metricsTelemetryIntervalSeconds = 0;
+    }
+
+    // Optional. Leave 0 to not limit the memory of workflows.
+    if (!ADUC_JSON_GetUnsignedIntegerField(root_value, "workflowMemoryBudgetMB", &(config->workflowMemoryBudgetMB)))
+    {
+        config->workflowMemoryBudgetMB = 0;
+    }
+
+    // Optional. Leave 0 to not send progress telemetry.
+    if (!ADUC_JSON_GetUnsignedIntegerField(
+            root_value, "progressTelemetryIntervalSeconds", &(config->progressTelemetryIntervalSeconds)))
+    {
+        config->progressTelemetryIntervalSeconds = 0;
+    }
+
+    // Optional. Leave 0 for the default size limit.
+    if (!ADUC_JSON_GetUnsignedIntegerField(
+            root_value, "progressTelemetryMaxBytes", &(config->progressTelemetryMaxBytes)))
+    {
+        config->progressTelemetryMaxBytes = 0;
+    }
+
+    // Optional. Leave 0 to not sample the resource usage of deployments.
+    if (!ADUC_JSON_GetUnsignedIntegerField(
+            root_value, "resourceSampleIntervalSeconds", &(config->resourceSampleIntervalSeconds)))
+    {
+        config->resourceSampleIntervalSeconds = 0;
+    }
+
+    // Optional. Leave 0 to not limit the download bandwidth.
+    if (!ADUC_JSON_GetUnsignedIntegerField(
+            root_value, "downloadBandwidthLimitKBps", &(config->downloadBandwidthLimitKBps)))
+    {
+        config->downloadBandwidthLimitKBps = 0;
+    }
+
+    if (!ADUC_JSON_GetUnsignedIntegerField(
+            root_value,
+            "downloadBandwidthLimitPerDownloadKBps",
+            &(config->downloadBandwidthLimitPerDownloadKBps)))
+    {
+        config->downloadBandwidthLimitPerDownloadKBps = 0;
+    }
+
+    // Optional. Leave unset to download at any time.
+    const char* downloadWindows = ADUC_JSON_GetStringFieldPtr(root_value, "downloadWindows");
+    if (downloadWindows != NULL && mallocAndStrcpy_s(&(config->downloadWindows), downloadWindows) != 0)
+    {
+        goto done;
+    }
+
+    // Optional. Leave unset to download from the origin only, or from the nested edge gateway.
+    const char* downloadCacheHosts = ADUC_JSON_GetStringFieldPtr(root_value, "downloadCacheHosts");
+    if (downloadCacheHosts != NULL && mallocAndStrcpy_s(&(config->downloadCacheHosts), downloadCacheHosts) != 0)
+    {
+        goto done;
+    }
+
+    // Optional. Leave unset to download each file from the URIs of its update only.
+    const JSON_Value* downloadMirrors = json_object_get_value(json_value_get_object(root_value), "downloadMirrors");
+    if (json_value_get_type(downloadMirrors) == JSONObject)
+    {
+        char* serializedMirrors = json_serialize_to_string(downloadMirrors);
+        const bool copied =
+            serializedMirrors != NULL && mallocAndStrcpy_s(&(config->downloadMirrors), serializedMirrors) == 0;
+        json_free_serialized_string(serializedMirrors);
+        if (!copied)
+        {
+            goto done;
+        }
+    }
+
+    // Optional. Leave 0 to download all the steps of a workflow before installing the first one.
+    if (!ADUC_JSON_GetUnsignedIntegerField(root_value, "stepDownloadLookAhead", &(config->stepDownloadLookAhead)))
+    {
+        config->stepDownloadLookAhead = 0;
+    }
+
+    // Optional. Leave 0 to keep all the step workflows of an update in memory.
+    if (!ADUC_JSON_GetUnsignedIntegerField(root_value, "maxResidentSteps", &(config->maxResidentSteps)))
+    {
+        config->maxResidentSteps = 0;
+    }
+
+    // Optional. Leave unset to run child processes in the cgroup of the agent.
+    const char* updateCgroup = ADUC_JSON_GetStringFieldPtr(root_value, "updateCgroup");
+    if (updateCgroup != NULL && mallocAndStrcpy_s(&(config->updateCgroup), updateCgroup) != 0)
+    {
+        goto done;
+    }
+
+    // Optional. Leave unset to keep the limits the cgroup has.
+    const char* updateCgroupCpuMax = ADUC_JSON_GetStringFieldPtr(root_value, "updateCgroupCpuMax");
+    if (updateCgroupCpuMax != NULL && mallocAndStrcpy_s(&(config->updateCgroupCpuMax), updateCgroupCpuMax) != 0)
+    {
+        goto done;
+    }
+
+    const char* updateCgroupIoMax = ADUC_JSON_GetStringFieldPtr(root_value, "updateCgroupIoMax");
+    if (updateCgroupIoMax != NULL && mallocAndStrcpy_s(&(config->updateCgroupIoMax), updateCgroupIoMax) != 0)
+    {
+        goto done;
+    }
+
+    const char* updateCgroupMemoryHigh = ADUC_JSON_GetStringFieldPtr(root_value, "updateCgroupMemoryHigh");
+    if (updateCgroupMemoryHigh != NULL
+        && mallocAndStrcpy_s(&(config->updateCgroupMemoryHigh), updateCgroupMemoryHigh) != 0)
+    {
+        goto done;
+    }
+
+    // Optional. Off unless set to true.
+    config->downloadIdlePriority = ADUC_JSON_GetBooleanField(root_value, "downloadIdlePriority");
+
+    // Optional. Off unless set to true.
+    config->iotHubClientIoThread = ADUC_JSON_GetBooleanField(root_value, "iotHubClientIoThread");
+
+    // Optional. Off unless set to true.
+    config->prefetchDownloads = ADUC_JSON_GetBooleanField(root_value, "prefetchDownloads");
+
+    // Optional. Leave 0 to keep the extensions loaded once they are used.
+    if (!ADUC_JSON_GetUnsignedIntegerField(
+            root_value, "extensionIdleUnloadSeconds", &(config->extensionIdleUnloadSeconds)))
+    {
+        config->extensionIdleUnloadSeconds = 0;
+    }
+
+    // Optional. Leave 0 to not time out the operations, unless the update manifest sets a timeout in handlerProperties.
+    if (!ADUC_JSON_GetUnsignedIntegerField(root_value, "downloadTimeoutSeconds", &(config->downloadTimeoutSeconds)))
+    {
+        config->downloadTimeoutSeconds = 0;
+    }
+
+    if (!ADUC_JSON_GetUnsignedIntegerField(root_value, "installTimeoutSeconds", &(config->installTimeoutSeconds)))
+    {
+        config->installTimeoutSeconds = 0;
+    }
+
+    if (!ADUC_JSON_GetUnsignedIntegerField(root_value, "applyTimeoutSeconds", &(config->applyTimeoutSeconds)))
+    {
+        config->applyTimeoutSeconds = 0;
+    }
+
+    // Optional. Leave 0 to report the download progress at most every second, or every 5% of a file.
+    if (!ADUC_JSON_GetUnsignedIntegerField(
+            root_value, "downloadProgressIntervalMs", &(config->downloadProgressIntervalMs)))
+    {
+        config->downloadProgressIntervalMs = 0;
+    }
+
+    if (!ADUC_JSON_GetUnsignedIntegerField(
+            root_value, "downloadProgressPercentStep", &(config->downloadProgressPercentStep)))
+    {
+        config->downloadProgressPercentStep = 0;
+    }
+
+    // Optional. Leave unset for the threads to run on any CPU.
+    const char* computeThreadCpus = ADUC_JSON_GetStringFieldPtr(root_value, "computeThreadCpus");
+    if (computeThreadCpus != NULL && mallocAndStrcpy_s(&(config->computeThreadCpus), computeThreadCpus) != 0)
+    {
+        goto done;
+    }
+
+    const char* ioThreadCpus = ADUC_JSON_GetStringFieldPtr(root_value, "ioThreadCpus");
+    if (ioThreadCpus != NULL && mallocAndStrcpy_s(&(config->ioThreadCpus), ioThreadCpus) != 0)
+    {
+        goto done;
+    }
+
+    // Optional. Leave 0 for hashing, decompression and installs to run whatever the temperature and battery.
+    if (!ADUC_JSON_GetUnsignedIntegerField(root_value, "heavyWorkMaxTemperatureC", &(config->heavyWorkMaxTemperatureC)))
+    {
+        config->heavyWorkMaxTemperatureC = 0;
+    }
+
+    if (!ADUC_JSON_GetUnsignedIntegerField(
+            root_value, "heavyWorkMinBatteryPercent", &(config->heavyWorkMinBatteryPercent)))
+    {
+        config->heavyWorkMinBatteryPercent = 0;
+    }
+
+    // Optional. Off unless set to true.
+    config->kexecReboot = ADUC_JSON_GetBooleanField(root_value, "kexecReboot");
+
+    // Optional. An explicit 0 disables the log of each workflow.
+    if (!json_object_has_value_of_type(root_object, "workflowLogSizeLimitKB", JSONNumber)
+        || !ADUC_JSON_GetUnsignedIntegerField(root_value, "workflowLogSizeLimitKB", &(config->workflowLogSizeLimitKB)))
+    {
+        config->workflowLogSizeLimitKB = ADUC_DEFAULT_WORKFLOW_LOG_SIZE_LIMIT_KB;
+    }
+
+    // Optional. An explicit 0 waits for all the component enumerators.
+    if (!json_object_has_value_of_type(root_object, "componentEnumeratorTimeoutMs", JSONNumber)
+        || !ADUC_JSON_GetUnsignedIntegerField(
+            root_value, "componentEnumeratorTimeoutMs", &(config->componentEnumeratorTimeoutMs)))
+    {
+        config->componentEnumeratorTimeoutMs = ADUC_DEFAULT_COMPONENT_ENUMERATOR_TIMEOUT_MS;
+    }
+
+    // Optional.
+    if (!ADUC_JSON_GetUnsignedIntegerField(
+            root_value, "downloadStartJitterSeconds", &(config->downloadStartJitterSeconds)))
+    {
+        config->downloadStartJitterSeconds = 0;
+    }
+
+    // Optional.
+    if (!ADUC_JSON_GetUnsignedIntegerField(root_value, "ramStagingThresholdKB", &(config->ramStagingThresholdKB)))
+    {
+        config->ramStagingThresholdKB = 0;
+    }
+
+    // Optional.
+    if (!ADUC_JSON_GetUnsignedIntegerField(root_value, "ramStagingBudgetMB", &(config->ramStagingBudgetMB)))
+    {
+        config->ramStagingBudgetMB = ADUC_DEFAULT_RAM_STAGING_BUDGET_MB;
+    }
+
     succeeded = true;
 
 done:
@@ -326,9 +660,22 @@ void ADUC_ConfigInfo_UnInit(ADUC_ConfigInfo* config)
         return;
     }
 
+    free(config->schemaVersion);
     free(config->manufacturer);
     free(config->model);
+    free(config->edgegatewayCertPath);
+    free(config->compatPropertyNames);
+    free(config->downloadWindows);
+    free(config->downloadCacheHosts);
+    free(config->downloadMirrors);
+    free(config->updateCgroup);
+    free(config->updateCgroupCpuMax);
+    free(config->updateCgroupIoMax);
+    free(config->updateCgroupMemoryHigh);
+    free(config->computeThreadCpus);
+    free(config->ioThreadCpus);
     ADUC_AgentInfoArray_Free(config->agentCount, config->agents);
+    json_value_free(config->rootJsonValue);
 
     memset(config, 0, sizeof(*config));
 }
@@ -340,7 +687,7 @@ void ADUC_ConfigInfo_UnInit(ADUC_ConfigInfo* config)
  * @param index the index of the Agent array in config that we want to access
  * @return const ADUC_AgentInfo*, NULL if failure
  */
-const ADUC_AgentInfo* ADUC_ConfigInfo_GetAgent(ADUC_ConfigInfo* config, unsigned int index)
+const ADUC_AgentInfo* ADUC_ConfigInfo_GetAgent(const ADUC_ConfigInfo* config, unsigned int index)
 {
     if (config == NULL)
     {
@@ -421,3 +768,156 @@ void ADUC_ConfigInfo_FreeAduShellTrustedUsers(VECTOR_HANDLE users)
 
     VECTOR_clear(users);
 }
+
+/**
+ * @brief Releases a reference to @p snapshot, freeing it with the last one.
+ *
+ * @param snapshot The snapshot, may be NULL
+ */
+static void ADUC_ConfigSnapshot_Release(ADUC_ConfigSnapshot* snapshot)
+{
+    if (snapshot != NULL && __atomic_sub_fetch(&snapshot->refCount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        ADUC_ConfigInfo_UnInit(&snapshot->config);
+        free(snapshot);
+    }
+}
+
+/**
+ * @brief Makes @p snapshot the current snapshot and releases the previous one.
+ * @details Must be called with s_configSnapshotMutex held.
+ *
+ * @param snapshot The new snapshot, or NULL to unload
+ */
+static void ADUC_ConfigSnapshot_Publish(ADUC_ConfigSnapshot* snapshot)
+{
+    ADUC_ConfigSnapshot* previous = __atomic_exchange_n(&s_configSnapshot, snapshot, __ATOMIC_SEQ_CST);
+
+    // Readers that loaded the previous snapshot are past taking their reference once this drops to 0.
+    while (__atomic_load_n(&s_configSnapshotReaders, __ATOMIC_SEQ_CST) != 0)
+    {
+        sched_yield();
+    }
+
+    ADUC_ConfigSnapshot_Release(previous);
+}
+
+/**
+ * @brief Sets the default values of the configuration, e.g. from the performance profile of the device
+ * @details From the next ADUC_ConfigInfo_Init on, the top-level fields of @p defaults that the configuration file
+ * doesn't have are used as if the file had them; the fields of the file override them.
+ *
+ * @param defaults A JSON object of configuration fields, copied; NULL for no defaults
+ */
+void ADUC_ConfigInfo_SetDefaults(const JSON_Value* defaults)
+{
+    JSON_Value* copy = (json_value_get_type(defaults) == JSONObject) ? json_value_deep_copy(defaults) : NULL;
+
+    pthread_mutex_lock(&s_configDefaultsMutex);
+    JSON_Value* previous = s_configDefaults;
+    s_configDefaults = copy;
+    pthread_mutex_unlock(&s_configDefaultsMutex);
+
+    json_value_free(previous);
+}
+
+/**
+ * @brief Parses @p configFilePath and makes it the process-wide configuration returned by ADUC_ConfigInfo_GetInstance()
+ * @details Used for the initial load and for explicit reloads, e.g. on SIGHUP. If parsing fails, the current
+ * configuration stays in place. References acquired before a reload keep seeing the previous configuration.
+ *
+ * @param configFilePath The path of configuration file
+ * @return True if the configuration was loaded, False if failure
+ */
+_Bool ADUC_ConfigInfo_LoadInstance(const char* configFilePath)
+{
+    ADUC_ConfigSnapshot* snapshot = calloc(1, sizeof(*snapshot));
+
+    if (snapshot == NULL)
+    {
+        return false;
+    }
+
+    if (!ADUC_ConfigInfo_Init(&snapshot->config, configFilePath))
+    {
+        ADUC_ConfigInfo_UnInit(&snapshot->config);
+        free(snapshot);
+        return false;
+    }
+
+    snapshot->refCount = 1;
+
+    pthread_mutex_lock(&s_configSnapshotMutex);
+    ADUC_ConfigSnapshot_Publish(snapshot);
+    pthread_mutex_unlock(&s_configSnapshotMutex);
+
+    return true;
+}
+
+/**
+ * @brief Gets a reference to the process-wide configuration, loading ADUC_CONF_FILE_PATH if nothing was loaded yet
+ * @details The configuration is immutable and is parsed once; getting it doesn't take a lock.
+ *
+ * @return The configuration, to be released with ADUC_ConfigInfo_ReleaseInstance(); NULL if it can't be loaded
+ */
+const ADUC_ConfigInfo* ADUC_ConfigInfo_GetInstance()
+{
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        __atomic_add_fetch(&s_configSnapshotReaders, 1, __ATOMIC_SEQ_CST);
+
+        ADUC_ConfigSnapshot* snapshot = __atomic_load_n(&s_configSnapshot, __ATOMIC_SEQ_CST);
+        if (snapshot != NULL)
+        {
+            __atomic_add_fetch(&snapshot->refCount, 1, __ATOMIC_RELAXED);
+        }
+
+        __atomic_sub_fetch(&s_configSnapshotReaders, 1, __ATOMIC_SEQ_CST);
+
+        if (snapshot != NULL)
+        {
+            return &snapshot->config;
+        }
+
+        if (attempt == 0)
+        {
+            // Lazily load the snapshot, unless another thread did in the meantime.
+            pthread_mutex_lock(&s_configSnapshotMutex);
+            if (__atomic_load_n(&s_configSnapshot, __ATOMIC_SEQ_CST) == NULL)
+            {
+                pthread_mutex_unlock(&s_configSnapshotMutex);
+                if (!ADUC_ConfigInfo_LoadInstance(ADUC_CONF_FILE_PATH))
+                {
+                    return NULL;
+                }
+            }
+            else
+            {
+                pthread_mutex_unlock(&s_configSnapshotMutex);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Releases a reference returned by ADUC_ConfigInfo_GetInstance()
+ *
+ * @param config The configuration to release, may be NULL
+ */
+void ADUC_ConfigInfo_ReleaseInstance(const ADUC_ConfigInfo* config)
+{
+    // config is the first member of its snapshot.
+    ADUC_ConfigSnapshot_Release((ADUC_ConfigSnapshot*)config);
+}
+
+/**
+ * @brief Drops the process-wide configuration; it is freed once all references to it are released
+ */
+void ADUC_ConfigInfo_UnloadInstance()
+{
+    pthread_mutex_lock(&s_configSnapshotMutex);
+    ADUC_ConfigSnapshot_Publish(NULL);
+    pthread_mutex_unlock(&s_configSnapshotMutex);
+}
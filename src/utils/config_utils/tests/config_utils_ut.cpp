@@ -29,6 +29,46 @@ static const char* validConfigContentStr =
         R"("manufacturer": "device_info_manufacturer",)"
         R"("model": "device_info_model",)"
         R"("compatPropertyNames": "manufacturer,model",)"
+        R"("maxConcurrentDownloads": 8,)"
+        R"("downloadCacheSizeLimitMB": 0,)"
+        R"("aduShellBroker": true,)"
+        R"("maxConcurrentSteps": 3,)"
+        R"("fastBoot": true,)"
+        R"("preloadContentHandlers": true,)"
+        R"("metricsTelemetryIntervalSeconds": 300,)"
+        R"("workflowMemoryBudgetMB": 48,)"
+        R"("progressTelemetryIntervalSeconds": 30,)"
+        R"("progressTelemetryMaxBytes": 8192,)"
+        R"("resourceSampleIntervalSeconds": 5,)"
+        R"("downloadBandwidthLimitKBps": 2048,)"
+        R"("downloadBandwidthLimitPerDownloadKBps": 512,)"
+        R"("downloadWindows": "22:00-06:00",)"
+        R"("downloadCacheHosts": "cache1:8080,10.0.0.2",)"
+        R"("downloadMirrors": { "https://origin/": [ "http://mirror/" ] },)"
+        R"("stepDownloadLookAhead": 2,)"
+        R"("maxResidentSteps": 16,)"
+        R"("updateCgroup": "/sys/fs/cgroup/adu-update",)"
+        R"("updateCgroupCpuMax": "50000 100000",)"
+        R"("updateCgroupMemoryHigh": "256M",)"
+        R"("downloadIdlePriority": true,)"
+        R"("iotHubClientIoThread": true,)"
+        R"("prefetchDownloads": true,)"
+        R"("extensionIdleUnloadSeconds": 600,)"
+        R"("downloadTimeoutSeconds": 3600,)"
+        R"("installTimeoutSeconds": 1800,)"
+        R"("applyTimeoutSeconds": 300,)"
+        R"("downloadProgressIntervalMs": 250,)"
+        R"("downloadProgressPercentStep": 10,)"
+        R"("computeThreadCpus": "big",)"
+        R"("ioThreadCpus": "0-3",)"
+        R"("heavyWorkMaxTemperatureC": 80,)"
+        R"("heavyWorkMinBatteryPercent": 20,)"
+        R"("kexecReboot": true,)"
+        R"("workflowLogSizeLimitKB": 64,)"
+        R"("componentEnumeratorTimeoutMs": 1500,)"
+        R"("downloadStartJitterSeconds": 900,)"
+        R"("ramStagingThresholdKB": 256,)"
+        R"("ramStagingBudgetMB": 8,)"
         R"("agents": [)"
             R"({ )"
             R"("name": "host-update",)"
@@ -195,6 +235,47 @@ TEST_CASE_METHOD(GlobalMockHookTestCaseFixture, "ADUC_ConfigInfo_Init Functional
         CHECK_THAT(config.manufacturer, Equals("device_info_manufacturer"));
         CHECK_THAT(config.model, Equals("device_info_model"));
         CHECK_THAT(config.compatPropertyNames, Equals("manufacturer,model"));
+        CHECK(config.maxConcurrentDownloads == 8);
+        CHECK(config.downloadCacheSizeLimitMB == 0);
+        CHECK(config.aduShellBroker);
+        CHECK(config.maxConcurrentSteps == 3);
+        CHECK(config.fastBoot);
+        CHECK(config.preloadContentHandlers);
+        CHECK(config.metricsTelemetryIntervalSeconds == 300);
+        CHECK(config.workflowMemoryBudgetMB == 48);
+        CHECK(config.progressTelemetryIntervalSeconds == 30);
+        CHECK(config.progressTelemetryMaxBytes == 8192);
+        CHECK(config.resourceSampleIntervalSeconds == 5);
+        CHECK(config.downloadBandwidthLimitKBps == 2048);
+        CHECK(config.downloadBandwidthLimitPerDownloadKBps == 512);
+        CHECK_THAT(config.downloadWindows, Equals("22:00-06:00"));
+        CHECK_THAT(config.downloadCacheHosts, Equals("cache1:8080,10.0.0.2"));
+        CHECK_THAT(config.downloadMirrors, Equals(R"({"https:\/\/origin\/":["http:\/\/mirror\/"]})"));
+        CHECK(config.stepDownloadLookAhead == 2);
+        CHECK(config.maxResidentSteps == 16);
+        CHECK_THAT(config.updateCgroup, Equals("/sys/fs/cgroup/adu-update"));
+        CHECK_THAT(config.updateCgroupCpuMax, Equals("50000 100000"));
+        CHECK(config.updateCgroupIoMax == nullptr);
+        CHECK_THAT(config.updateCgroupMemoryHigh, Equals("256M"));
+        CHECK(config.downloadIdlePriority);
+        CHECK(config.iotHubClientIoThread);
+        CHECK(config.prefetchDownloads);
+        CHECK(config.extensionIdleUnloadSeconds == 600);
+        CHECK(config.downloadTimeoutSeconds == 3600);
+        CHECK(config.installTimeoutSeconds == 1800);
+        CHECK(config.applyTimeoutSeconds == 300);
+        CHECK(config.downloadProgressIntervalMs == 250);
+        CHECK(config.downloadProgressPercentStep == 10);
+        CHECK_THAT(config.computeThreadCpus, Equals("big"));
+        CHECK_THAT(config.ioThreadCpus, Equals("0-3"));
+        CHECK(config.heavyWorkMaxTemperatureC == 80);
+        CHECK(config.heavyWorkMinBatteryPercent == 20);
+        CHECK(config.kexecReboot);
+        CHECK(config.workflowLogSizeLimitKB == 64);
+        CHECK(config.componentEnumeratorTimeoutMs == 1500);
+        CHECK(config.downloadStartJitterSeconds == 900);
+        CHECK(config.ramStagingThresholdKB == 256);
+        CHECK(config.ramStagingBudgetMB == 8);
         CHECK(config.agentCount == 2);
         const ADUC_AgentInfo* first_agent_info = ADUC_ConfigInfo_GetAgent(&config, 0);
         CHECK_THAT(first_agent_info->name, Equals("host-update"));
@@ -225,6 +306,45 @@ TEST_CASE_METHOD(GlobalMockHookTestCaseFixture, "ADUC_ConfigInfo_Init Functional
 
         CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu/du-config.json"));
         CHECK(config.compatPropertyNames == nullptr);
+        CHECK(config.maxConcurrentDownloads == 0);
+        CHECK(config.downloadCacheSizeLimitMB == ADUC_DEFAULT_DOWNLOAD_CACHE_SIZE_LIMIT_MB);
+        CHECK_FALSE(config.aduShellBroker);
+        CHECK(config.maxConcurrentSteps == 0);
+        CHECK_FALSE(config.fastBoot);
+        CHECK_FALSE(config.preloadContentHandlers);
+        CHECK(config.metricsTelemetryIntervalSeconds == 0);
+        CHECK(config.workflowMemoryBudgetMB == 0);
+        CHECK(config.progressTelemetryIntervalSeconds == 0);
+        CHECK(config.progressTelemetryMaxBytes == 0);
+        CHECK(config.resourceSampleIntervalSeconds == 0);
+        CHECK(config.downloadBandwidthLimitKBps == 0);
+        CHECK(config.downloadBandwidthLimitPerDownloadKBps == 0);
+        CHECK(config.downloadWindows == nullptr);
+        CHECK(config.downloadCacheHosts == nullptr);
+        CHECK(config.downloadMirrors == nullptr);
+        CHECK(config.stepDownloadLookAhead == 0);
+        CHECK(config.maxResidentSteps == 0);
+        CHECK(config.updateCgroup == nullptr);
+        CHECK(config.updateCgroupMemoryHigh == nullptr);
+        CHECK_FALSE(config.downloadIdlePriority);
+        CHECK_FALSE(config.iotHubClientIoThread);
+        CHECK_FALSE(config.prefetchDownloads);
+        CHECK(config.extensionIdleUnloadSeconds == 0);
+        CHECK(config.downloadTimeoutSeconds == 0);
+        CHECK(config.installTimeoutSeconds == 0);
+        CHECK(config.applyTimeoutSeconds == 0);
+        CHECK(config.downloadProgressIntervalMs == 0);
+        CHECK(config.downloadProgressPercentStep == 0);
+        CHECK(config.computeThreadCpus == nullptr);
+        CHECK(config.ioThreadCpus == nullptr);
+        CHECK(config.heavyWorkMaxTemperatureC == 0);
+        CHECK(config.heavyWorkMinBatteryPercent == 0);
+        CHECK_FALSE(config.kexecReboot);
+        CHECK(config.workflowLogSizeLimitKB == ADUC_DEFAULT_WORKFLOW_LOG_SIZE_LIMIT_KB);
+        CHECK(config.componentEnumeratorTimeoutMs == ADUC_DEFAULT_COMPONENT_ENUMERATOR_TIMEOUT_MS);
+        CHECK(config.downloadStartJitterSeconds == 0);
+        CHECK(config.ramStagingThresholdKB == 0);
+        CHECK(config.ramStagingBudgetMB == ADUC_DEFAULT_RAM_STAGING_BUDGET_MB);
 
         ADUC_ConfigInfo_UnInit(&config);
 
@@ -232,6 +352,44 @@ TEST_CASE_METHOD(GlobalMockHookTestCaseFixture, "ADUC_ConfigInfo_Init Functional
         free(g_configContentString);
     }
 
+    SECTION("Defaults seed the fields the config content doesn't have")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentStr) == 0);
+
+        JSON_Value* defaults = json_parse_string(
+            R"({ "maxConcurrentDownloads": 2, "maxResidentSteps": 4, "downloadIdlePriority": true })");
+        REQUIRE(defaults != nullptr);
+        ADUC_ConfigInfo_SetDefaults(defaults);
+        json_value_free(defaults);
+
+        ADUC_ConfigInfo config = {};
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu/du-config.json"));
+        CHECK(config.maxConcurrentDownloads == 8);
+        CHECK(config.maxResidentSteps == 16);
+        ADUC_ConfigInfo_UnInit(&config);
+
+        // NOLINTNEXTLINE(cppcoreguidelines-owning-memory, cppcoreguidelines-no-malloc, hicpp-no-malloc): g_configContentString is a basic C-string so it must be freed by a call to free()
+        free(g_configContentString);
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentNoCompatPropertyNames) == 0);
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu/du-config.json"));
+        CHECK(config.maxConcurrentDownloads == 2);
+        CHECK(config.maxResidentSteps == 4);
+        CHECK(config.downloadIdlePriority);
+        CHECK(config.maxConcurrentSteps == 0);
+        ADUC_ConfigInfo_UnInit(&config);
+
+        ADUC_ConfigInfo_SetDefaults(nullptr);
+
+        CHECK(ADUC_ConfigInfo_Init(&config, "/etc/adu/du-config.json"));
+        CHECK(config.maxConcurrentDownloads == 0);
+        ADUC_ConfigInfo_UnInit(&config);
+
+        // NOLINTNEXTLINE(cppcoreguidelines-owning-memory, cppcoreguidelines-no-malloc, hicpp-no-malloc): g_configContentString is a basic C-string so it must be freed by a call to free()
+        free(g_configContentString);
+    }
+
     SECTION("Valid config content without device info, Failure Test")
     {
         REQUIRE(mallocAndStrcpy_s(&g_configContentString, invalidConfigContentNoDeviceInfoStr) == 0);
@@ -288,3 +446,78 @@ TEST_CASE_METHOD(GlobalMockHookTestCaseFixture, "ADUC_ConfigInfo_Init Functional
         free(g_configContentString);
     }
 }
+
+TEST_CASE_METHOD(GlobalMockHookTestCaseFixture, "ADUC_ConfigInfo_GetInstance Functional Tests")
+{
+    SECTION("Instance is parsed once and shared")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentStr) == 0);
+
+        REQUIRE(ADUC_ConfigInfo_LoadInstance("/etc/adu/du-config.json"));
+
+        const ADUC_ConfigInfo* first = ADUC_ConfigInfo_GetInstance();
+        const ADUC_ConfigInfo* second = ADUC_ConfigInfo_GetInstance();
+
+        REQUIRE(first != nullptr);
+        CHECK(first == second);
+        CHECK_THAT(first->manufacturer, Equals("device_info_manufacturer"));
+        CHECK_THAT(json_array_get_string(first->aduShellTrustedUsers, 0), Equals("adu"));
+
+        ADUC_ConfigInfo_ReleaseInstance(second);
+        ADUC_ConfigInfo_ReleaseInstance(first);
+        ADUC_ConfigInfo_UnloadInstance();
+
+        // NOLINTNEXTLINE(cppcoreguidelines-owning-memory, cppcoreguidelines-no-malloc, hicpp-no-malloc): g_configContentString is a basic C-string so it must be freed by a call to free()
+        free(g_configContentString);
+    }
+
+    SECTION("Reload replaces the instance, references keep the previous one")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentStr) == 0);
+        REQUIRE(ADUC_ConfigInfo_LoadInstance("/etc/adu/du-config.json"));
+
+        const ADUC_ConfigInfo* previous = ADUC_ConfigInfo_GetInstance();
+        REQUIRE(previous != nullptr);
+
+        // NOLINTNEXTLINE(cppcoreguidelines-owning-memory, cppcoreguidelines-no-malloc, hicpp-no-malloc): g_configContentString is a basic C-string so it must be freed by a call to free()
+        free(g_configContentString);
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentNoCompatPropertyNames) == 0);
+
+        REQUIRE(ADUC_ConfigInfo_LoadInstance("/etc/adu/du-config.json"));
+
+        const ADUC_ConfigInfo* current = ADUC_ConfigInfo_GetInstance();
+        REQUIRE(current != nullptr);
+        CHECK(current != previous);
+        CHECK(current->compatPropertyNames == nullptr);
+        CHECK_THAT(previous->compatPropertyNames, Equals("manufacturer,model"));
+
+        ADUC_ConfigInfo_ReleaseInstance(previous);
+        ADUC_ConfigInfo_ReleaseInstance(current);
+        ADUC_ConfigInfo_UnloadInstance();
+
+        // NOLINTNEXTLINE(cppcoreguidelines-owning-memory, cppcoreguidelines-no-malloc, hicpp-no-malloc): g_configContentString is a basic C-string so it must be freed by a call to free()
+        free(g_configContentString);
+    }
+
+    SECTION("Failed reload keeps the current instance")
+    {
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, validConfigContentStr) == 0);
+        REQUIRE(ADUC_ConfigInfo_LoadInstance("/etc/adu/du-config.json"));
+
+        // NOLINTNEXTLINE(cppcoreguidelines-owning-memory, cppcoreguidelines-no-malloc, hicpp-no-malloc): g_configContentString is a basic C-string so it must be freed by a call to free()
+        free(g_configContentString);
+        REQUIRE(mallocAndStrcpy_s(&g_configContentString, invalidConfigContentStr) == 0);
+
+        CHECK_FALSE(ADUC_ConfigInfo_LoadInstance("/etc/adu/du-config.json"));
+
+        const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+        REQUIRE(config != nullptr);
+        CHECK_THAT(config->compatPropertyNames, Equals("manufacturer,model"));
+
+        ADUC_ConfigInfo_ReleaseInstance(config);
+        ADUC_ConfigInfo_UnloadInstance();
+
+        // NOLINTNEXTLINE(cppcoreguidelines-owning-memory, cppcoreguidelines-no-malloc, hicpp-no-malloc): g_configContentString is a basic C-string so it must be freed by a call to free()
+        free(g_configContentString);
+    }
+}
@@ -0,0 +1,98 @@
+/**
+ * @file content_encoding_utils.h
+ * @brief Decodes the transport encoding of update content, e.g. gzip, as it's downloaded.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_CONTENT_ENCODING_UTILS_H
+#define ADUC_CONTENT_ENCODING_UTILS_H
+
+#include <aduc/c_utils.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief The gzip transport encoding.
+ */
+#define ADUC_CONTENT_ENCODING_GZIP "gzip"
+
+/**
+ * @brief The most content decoded from a stream whose decoded size is unknown, in bytes, so that a decompression bomb
+ * doesn't fill the data partition before its hash can be checked.
+ */
+#define ADUC_CONTENT_ENCODING_MAX_DECODED_SIZE ((uint64_t)8 * 1024 * 1024 * 1024)
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief The state of decoding a stream of encoded content.
+ */
+typedef struct tagADUC_ContentDecoder ADUC_ContentDecoder;
+
+/**
+ * @brief Receives decoded content.
+ *
+ * @param data The decoded content.
+ * @param size The size of @p data.
+ * @param context The context passed to ADUC_ContentDecoder_Input.
+ * @returns False to stop decoding.
+ */
+typedef bool (*ADUC_ContentDecoder_OutputFunc)(const uint8_t* data, size_t size, void* context);
+
+/**
+ * @brief Returns whether @p encoding is a transport encoding the agent can decode.
+ */
+bool ADUC_ContentEncoding_IsSupported(const char* encoding);
+
+/**
+ * @brief Creates a decoder of @p encoding.
+ *
+ * @param encoding The encoding, e.g. ADUC_CONTENT_ENCODING_GZIP.
+ * @returns The decoder, or NULL if the encoding isn't supported or out of memory. Free it with ADUC_ContentDecoder_Free.
+ */
+ADUC_ContentDecoder* ADUC_ContentDecoder_Create(const char* encoding);
+
+/**
+ * @brief Decodes the next @p size bytes of encoded content, passing the decoded content to @p output.
+ *
+ * @param decoder The decoder.
+ * @param data The encoded content.
+ * @param size The size of @p data.
+ * @param output Receives the decoded content, in as many calls as it takes.
+ * @param context Passed to @p output.
+ * @returns False if the content isn't validly encoded, continues past the end of the encoded stream, or @p output
+ * failed.
+ */
+bool ADUC_ContentDecoder_Input(
+    ADUC_ContentDecoder* decoder, const uint8_t* data, size_t size, ADUC_ContentDecoder_OutputFunc output, void* context);
+
+/**
+ * @brief Returns whether the content input so far is a complete encoded stream, rather than one cut short.
+ */
+bool ADUC_ContentDecoder_IsFinished(const ADUC_ContentDecoder* decoder);
+
+/**
+ * @brief Frees @p decoder.
+ *
+ * @param decoder The decoder, may be NULL.
+ */
+void ADUC_ContentDecoder_Free(ADUC_ContentDecoder* decoder);
+
+/**
+ * @brief Decodes the file @p encodedFilePath into @p filePath, for downloaders that can't decode as they download.
+ *
+ * @param encoding The encoding of the file.
+ * @param encodedFilePath The encoded file.
+ * @param filePath The file to write the decoded content to, replaced if it exists.
+ * @param maxDecodedSize The most content decoded, e.g. the size of the file in the update manifest; 0 for
+ * ADUC_CONTENT_ENCODING_MAX_DECODED_SIZE. Decoding fails past it.
+ * @returns True on success.
+ */
+bool ADUC_ContentEncoding_DecodeFile(
+    const char* encoding, const char* encodedFilePath, const char* filePath, uint64_t maxDecodedSize);
+
+EXTERN_C_END
+
+#endif // ADUC_CONTENT_ENCODING_UTILS_H
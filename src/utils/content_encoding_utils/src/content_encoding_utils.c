@@ -0,0 +1,222 @@
+/**
+ * @file content_encoding_utils.c
+ * @brief Implements decoding the transport encoding of update content.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/content_encoding_utils.h"
+#include "aduc/thermal_utils.h"
+
+#include <stdio.h> // for fopen, fread, fwrite
+#include <stdlib.h> // for calloc, free
+#include <string.h> // for strcmp
+#include <zlib.h>
+
+/**
+ * @brief zlib window bits that accept the gzip format only, with the largest window.
+ */
+#define GZIP_WINDOW_BITS (15 + 16)
+
+/**
+ * @brief The size of the buffer the content is decoded into, and of the reads of ADUC_ContentEncoding_DecodeFile.
+ */
+#define DECODE_BUFFER_SIZE (64 * 1024)
+
+struct tagADUC_ContentDecoder
+{
+    z_stream Stream; //!< The inflate stream.
+    bool Finished; //!< Whether the end of the gzip stream was decoded.
+    uint8_t Output[DECODE_BUFFER_SIZE]; //!< The decoded content not passed on yet.
+};
+
+bool ADUC_ContentEncoding_IsSupported(const char* encoding)
+{
+    return encoding != NULL && strcmp(encoding, ADUC_CONTENT_ENCODING_GZIP) == 0;
+}
+
+ADUC_ContentDecoder* ADUC_ContentDecoder_Create(const char* encoding)
+{
+    if (!ADUC_ContentEncoding_IsSupported(encoding))
+    {
+        return NULL;
+    }
+
+    ADUC_ContentDecoder* decoder = (ADUC_ContentDecoder*)calloc(1, sizeof(*decoder));
+    if (decoder == NULL)
+    {
+        return NULL;
+    }
+
+    if (inflateInit2(&decoder->Stream, GZIP_WINDOW_BITS) != Z_OK)
+    {
+        free(decoder);
+        return NULL;
+    }
+
+    return decoder;
+}
+
+bool ADUC_ContentDecoder_Input(
+    ADUC_ContentDecoder* decoder, const uint8_t* data, size_t size, ADUC_ContentDecoder_OutputFunc output, void* context)
+{
+    z_stream* stream = &decoder->Stream;
+
+    while (size > 0)
+    {
+        if (decoder->Finished)
+        {
+            return false;
+        }
+
+        // avail_in is an unsigned int, feed larger inputs in parts.
+        const uInt chunkSize = size > UINT32_MAX ? UINT32_MAX : (uInt)size;
+        stream->next_in = (Bytef*)data;
+        stream->avail_in = chunkSize;
+
+        do
+        {
+            stream->next_out = decoder->Output;
+            stream->avail_out = sizeof(decoder->Output);
+
+            const int ret = inflate(stream, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END)
+            {
+                decoder->Finished = true;
+            }
+            else if (ret != Z_OK && ret != Z_BUF_ERROR)
+            {
+                return false;
+            }
+
+            const size_t decodedSize = sizeof(decoder->Output) - stream->avail_out;
+            if (decodedSize > 0 && !output(decoder->Output, decodedSize, context))
+            {
+                return false;
+            }
+        } while (stream->avail_out == 0 && !decoder->Finished);
+
+        // Input left after the end of the stream is trailing garbage.
+        if (stream->avail_in != 0)
+        {
+            return false;
+        }
+
+        data += chunkSize;
+        size -= chunkSize;
+    }
+
+    return true;
+}
+
+bool ADUC_ContentDecoder_IsFinished(const ADUC_ContentDecoder* decoder)
+{
+    return decoder->Finished;
+}
+
+void ADUC_ContentDecoder_Free(ADUC_ContentDecoder* decoder)
+{
+    if (decoder == NULL)
+    {
+        return;
+    }
+
+    inflateEnd(&decoder->Stream);
+    free(decoder);
+}
+
+/**
+ * @brief The decoded file of ADUC_ContentEncoding_DecodeFile.
+ */
+typedef struct tagADUC_DecodedFile
+{
+    FILE* File; //!< The file.
+    uint64_t Size; //!< The size of the content written so far.
+    uint64_t MaxSize; //!< The most content written.
+} ADUC_DecodedFile;
+
+/**
+ * @brief ADUC_ContentDecoder_OutputFunc that writes the decoded content to the ADUC_DecodedFile @p context.
+ */
+static bool WriteToFile(const uint8_t* data, size_t size, void* context)
+{
+    ADUC_DecodedFile* decodedFile = (ADUC_DecodedFile*)context;
+
+    // More content than expected is a decompression bomb or corrupt content; don't fill the disk with it.
+    if (size > decodedFile->MaxSize - decodedFile->Size)
+    {
+        return false;
+    }
+
+    decodedFile->Size += size;
+    return fwrite(data, 1, size, decodedFile->File) == size;
+}
+
+bool ADUC_ContentEncoding_DecodeFile(
+    const char* encoding, const char* encodedFilePath, const char* filePath, uint64_t maxDecodedSize)
+{
+    bool succeeded = false;
+    FILE* input = NULL;
+    FILE* output = NULL;
+    uint8_t* buffer = NULL;
+    ADUC_ContentDecoder* decoder = ADUC_ContentDecoder_Create(encoding);
+    ADUC_DecodedFile decodedFile = { NULL, 0, maxDecodedSize };
+
+    if (decodedFile.MaxSize == 0)
+    {
+        decodedFile.MaxSize = ADUC_CONTENT_ENCODING_MAX_DECODED_SIZE;
+    }
+
+    if (decoder == NULL)
+    {
+        goto done;
+    }
+
+    buffer = (uint8_t*)malloc(DECODE_BUFFER_SIZE);
+    input = fopen(encodedFilePath, "rb");
+    output = fopen(filePath, "wb");
+    if (buffer == NULL || input == NULL || output == NULL)
+    {
+        goto done;
+    }
+
+    decodedFile.File = output;
+
+    for (;;)
+    {
+        const size_t readSize = fread(buffer, 1, DECODE_BUFFER_SIZE, input);
+        if (readSize == 0)
+        {
+            break;
+        }
+
+        (void)ADUC_Thermal_WaitForHeadroom(NULL);
+
+        if (!ADUC_ContentDecoder_Input(decoder, buffer, readSize, WriteToFile, &decodedFile))
+        {
+            goto done;
+        }
+    }
+
+    succeeded = ferror(input) == 0 && ADUC_ContentDecoder_IsFinished(decoder);
+
+done:
+    if (output != NULL && fclose(output) != 0)
+    {
+        succeeded = false;
+    }
+
+    if (input != NULL)
+    {
+        fclose(input);
+    }
+
+    if (!succeeded && output != NULL)
+    {
+        remove(filePath);
+    }
+
+    free(buffer);
+    ADUC_ContentDecoder_Free(decoder);
+    return succeeded;
+}
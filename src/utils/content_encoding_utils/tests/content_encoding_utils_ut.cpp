@@ -0,0 +1,150 @@
+/**
+ * @file content_encoding_utils_ut.cpp
+ * @brief Unit tests for content_encoding_utils.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/content_encoding_utils.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+static std::vector<uint8_t> Gzip(const std::string& content)
+{
+    z_stream stream{};
+    REQUIRE(deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+
+    std::vector<uint8_t> encoded(deflateBound(&stream, content.size()));
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast, cppcoreguidelines-pro-type-const-cast)
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(content.data()));
+    stream.avail_in = static_cast<uInt>(content.size());
+    stream.next_out = encoded.data();
+    stream.avail_out = static_cast<uInt>(encoded.size());
+    REQUIRE(deflate(&stream, Z_FINISH) == Z_STREAM_END);
+
+    encoded.resize(stream.total_out);
+    deflateEnd(&stream);
+    return encoded;
+}
+
+static bool AppendToString(const uint8_t* data, size_t size, void* context)
+{
+    static_cast<std::string*>(context)->append(data, data + size);
+    return true;
+}
+
+static std::string GetContent()
+{
+    std::string content;
+    for (int i = 0; i < 20000; ++i)
+    {
+        content += "line " + std::to_string(i % 97) + " of the payload\n";
+    }
+
+    return content;
+}
+
+TEST_CASE("ADUC_ContentDecoder decodes gzip in arbitrary pieces")
+{
+    const std::string content = GetContent();
+    const std::vector<uint8_t> encoded = Gzip(content);
+    REQUIRE(encoded.size() < content.size());
+
+    for (size_t pieceSize : { size_t{ 1 }, size_t{ 7 }, size_t{ 16384 }, encoded.size() })
+    {
+        ADUC_ContentDecoder* decoder = ADUC_ContentDecoder_Create(ADUC_CONTENT_ENCODING_GZIP);
+        REQUIRE(decoder != nullptr);
+
+        std::string decoded;
+        for (size_t offset = 0; offset < encoded.size(); offset += pieceSize)
+        {
+            const size_t size = std::min(pieceSize, encoded.size() - offset);
+            REQUIRE(ADUC_ContentDecoder_Input(decoder, encoded.data() + offset, size, AppendToString, &decoded));
+            CHECK(ADUC_ContentDecoder_IsFinished(decoder) == (offset + size == encoded.size()));
+        }
+
+        CHECK(decoded == content);
+        ADUC_ContentDecoder_Free(decoder);
+    }
+}
+
+TEST_CASE("ADUC_ContentDecoder rejects invalid content")
+{
+    const std::vector<uint8_t> encoded = Gzip(GetContent());
+    std::string decoded;
+
+    CHECK_FALSE(ADUC_ContentEncoding_IsSupported("zstd"));
+    CHECK_FALSE(ADUC_ContentEncoding_IsSupported(nullptr));
+    CHECK(ADUC_ContentDecoder_Create("xz") == nullptr);
+
+    SECTION("Trailing content")
+    {
+        std::vector<uint8_t> trailing = encoded;
+        trailing.push_back(0);
+
+        ADUC_ContentDecoder* decoder = ADUC_ContentDecoder_Create(ADUC_CONTENT_ENCODING_GZIP);
+        CHECK_FALSE(ADUC_ContentDecoder_Input(decoder, trailing.data(), trailing.size(), AppendToString, &decoded));
+        ADUC_ContentDecoder_Free(decoder);
+    }
+
+    SECTION("Truncated content")
+    {
+        ADUC_ContentDecoder* decoder = ADUC_ContentDecoder_Create(ADUC_CONTENT_ENCODING_GZIP);
+        CHECK(ADUC_ContentDecoder_Input(decoder, encoded.data(), encoded.size() - 4, AppendToString, &decoded));
+        CHECK_FALSE(ADUC_ContentDecoder_IsFinished(decoder));
+        ADUC_ContentDecoder_Free(decoder);
+    }
+
+    SECTION("Corrupted content")
+    {
+        std::vector<uint8_t> corrupted = encoded;
+        corrupted[corrupted.size() / 2] ^= 0xff;
+
+        ADUC_ContentDecoder* decoder = ADUC_ContentDecoder_Create(ADUC_CONTENT_ENCODING_GZIP);
+        const bool decodedAll =
+            ADUC_ContentDecoder_Input(decoder, corrupted.data(), corrupted.size(), AppendToString, &decoded)
+            && ADUC_ContentDecoder_IsFinished(decoder);
+        CHECK_FALSE(decodedAll);
+        ADUC_ContentDecoder_Free(decoder);
+    }
+}
+
+TEST_CASE("ADUC_ContentEncoding_DecodeFile")
+{
+    const char* const encodedFilePath = "/tmp/aduc_content_encoding_utils_ut.gz";
+    const char* const filePath = "/tmp/aduc_content_encoding_utils_ut";
+    const std::string content = GetContent();
+    const std::vector<uint8_t> encoded = Gzip(content);
+
+    {
+        std::ofstream output(encodedFilePath, std::ios::binary | std::ios::trunc);
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        output.write(reinterpret_cast<const char*>(encoded.data()), static_cast<std::streamsize>(encoded.size()));
+    }
+
+    REQUIRE(ADUC_ContentEncoding_DecodeFile(ADUC_CONTENT_ENCODING_GZIP, encodedFilePath, filePath, content.size()));
+
+    std::ifstream input(filePath, std::ios::binary);
+    CHECK(std::string(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()) == content);
+
+    // A file that isn't gzip leaves no decoded file behind.
+    const char* const invalidFilePath = "/tmp/aduc_content_encoding_utils_ut.invalid";
+    CHECK_FALSE(ADUC_ContentEncoding_DecodeFile(ADUC_CONTENT_ENCODING_GZIP, filePath, invalidFilePath, 0));
+    CHECK_FALSE(std::ifstream(invalidFilePath).good());
+
+    // Content that decodes to more than expected, e.g. a decompression bomb, is cut off.
+    CHECK_FALSE(ADUC_ContentEncoding_DecodeFile(
+        ADUC_CONTENT_ENCODING_GZIP, encodedFilePath, invalidFilePath, content.size() - 1));
+    CHECK_FALSE(std::ifstream(invalidFilePath).good());
+
+    std::remove(encodedFilePath);
+    std::remove(filePath);
+}
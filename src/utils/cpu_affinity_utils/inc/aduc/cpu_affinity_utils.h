@@ -0,0 +1,67 @@
+/**
+ * @file cpu_affinity_utils.h
+ * @brief Places the threads of the agent on the CPUs of their class, e.g. hashing on the big cores of a big.LITTLE
+ * SoC, and log flushes on the LITTLE ones.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_CPU_AFFINITY_UTILS_H
+#define ADUC_CPU_AFFINITY_UTILS_H
+
+#include <stdbool.h>
+
+/**
+ * @brief The CPUs of the cores of the highest capacity, from /sys/devices/system/cpu/cpu<N>/cpu_capacity.
+ */
+#define ADUC_CPU_AFFINITY_BIG "big"
+
+/**
+ * @brief The CPUs of the cores of a lower capacity than the highest.
+ */
+#define ADUC_CPU_AFFINITY_LITTLE "little"
+
+// No EXTERN_C_BEGIN, from c_utils, since zlog uses this library too.
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief The classes of agent threads, each placed on CPUs of its own.
+ */
+typedef enum tagADUC_ThreadClass
+{
+    ADUC_ThreadClass_Compute, /**< Hashing, decompression and verification, e.g. the platform layer workers. */
+    ADUC_ThreadClass_IO, /**< Log flushes, file removals and background transfers. */
+    ADUC_ThreadClass_Count, /**< The number of classes. */
+} ADUC_ThreadClass;
+
+/**
+ * @brief Sets the CPUs of the threads of @p threadClass, from their next ADUC_CpuAffinity_ApplyToCurrentThread on.
+ *
+ * The CPUs are limited to the ones the agent was started on; if none are left, or on a SoC whose cores all have the
+ * same capacity for ADUC_CPU_AFFINITY_BIG and ADUC_CPU_AFFINITY_LITTLE, the threads run on any of them.
+ *
+ * @param threadClass The class of threads.
+ * @param cpus NULL or "" for any CPU, ADUC_CPU_AFFINITY_BIG, ADUC_CPU_AFFINITY_LITTLE, or a list of CPUs in the format
+ * of /sys/devices/system/cpu/online, e.g. "0-3,6".
+ * @returns False if @p cpus isn't valid, in which case the threads run on any CPU.
+ */
+bool ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass threadClass, const char* cpus);
+
+/**
+ * @brief Places the calling thread on the CPUs of @p threadClass. Called at the start of each unit of work of
+ * long-lived threads, so that they follow configuration changes; it only calls into the kernel when the CPUs of the
+ * class, or the class of the thread, changed. Threads the calling thread starts inherit its CPUs.
+ *
+ * @param threadClass The class of the calling thread.
+ * @returns False if the thread couldn't be placed.
+ */
+bool ADUC_CpuAffinity_ApplyToCurrentThread(ADUC_ThreadClass threadClass);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ADUC_CPU_AFFINITY_UTILS_H
@@ -0,0 +1,268 @@
+/**
+ * @file cpu_affinity_utils.c
+ * @brief Implements placing the threads of the agent on the CPUs of their class.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef _GNU_SOURCE
+#    define _GNU_SOURCE // for cpu_set_t, sched_setaffinity
+#endif
+
+#include "aduc/cpu_affinity_utils.h"
+
+#include <ctype.h> // for isdigit
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h> // for fopen, snprintf
+#include <stdlib.h> // for strtoul
+#include <string.h> // for strcmp
+
+/**
+ * @brief The folder of the CPUs in sysfs.
+ */
+#define SYSFS_CPU_FOLDER "/sys/devices/system/cpu"
+
+/**
+ * @brief Guards the CPUs below.
+ */
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief The CPUs the agent was started on, read by the first ADUC_CpuAffinity_SetClassCpus.
+ */
+static cpu_set_t s_processCpus;
+static bool s_processCpusRead = false;
+
+/**
+ * @brief The CPUs of each class, if it's placed on some rather than on s_processCpus.
+ */
+static cpu_set_t s_classCpus[ADUC_ThreadClass_Count];
+static bool s_classPlaced[ADUC_ThreadClass_Count];
+
+/**
+ * @brief Incremented by each ADUC_CpuAffinity_SetClassCpus; 0 until the first, when threads are left where they are.
+ */
+static unsigned int s_generation = 0;
+
+/**
+ * @brief The class the calling thread was last placed as, and s_generation at the time.
+ */
+static __thread ADUC_ThreadClass t_appliedClass = ADUC_ThreadClass_Compute;
+static __thread unsigned int t_appliedGeneration = 0;
+
+/**
+ * @brief Parses a list of CPUs in the format of /sys/devices/system/cpu/online, e.g. "0-3,6".
+ *
+ * @returns False if the list isn't valid.
+ */
+static bool ParseCpuList(const char* list, cpu_set_t* cpus)
+{
+    CPU_ZERO(cpus);
+
+    for (const char* next = list;;)
+    {
+        char* end = NULL;
+
+        if (!isdigit((unsigned char)*next))
+        {
+            return false;
+        }
+
+        const unsigned long first = strtoul(next, &end, 10);
+        unsigned long last = first;
+
+        if (*end == '-')
+        {
+            next = end + 1;
+            if (!isdigit((unsigned char)*next))
+            {
+                return false;
+            }
+
+            last = strtoul(next, &end, 10);
+        }
+
+        if (last < first || last >= CPU_SETSIZE)
+        {
+            return false;
+        }
+
+        for (unsigned long cpu = first; cpu <= last; ++cpu)
+        {
+            CPU_SET(cpu, cpus);
+        }
+
+        if (*end == '\0')
+        {
+            return true;
+        }
+
+        if (*end != ',')
+        {
+            return false;
+        }
+
+        next = end + 1;
+    }
+}
+
+/**
+ * @brief Reads the capacity of @p cpu, relative to the fastest core of the SoC, from sysfs.
+ *
+ * @returns The capacity, or 0 if unknown, e.g. on architectures without it.
+ */
+static unsigned long ReadCpuCapacity(int cpu)
+{
+    char path[64];
+    unsigned long capacity = 0;
+
+    (void)snprintf(path, sizeof(path), SYSFS_CPU_FOLDER "/cpu%d/cpu_capacity", cpu);
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    if (fscanf(file, "%lu", &capacity) != 1)
+    {
+        capacity = 0;
+    }
+
+    fclose(file);
+    return capacity;
+}
+
+/**
+ * @brief Gets the CPUs of s_processCpus of the highest capacity if @p big, otherwise of a lower one.
+ *
+ * @returns False if the capacities aren't known, or are all the same.
+ */
+static bool GetCpusByCapacity(bool big, cpu_set_t* cpus)
+{
+    unsigned long capacities[CPU_SETSIZE] = { 0 };
+    unsigned long highest = 0;
+    unsigned long lowest = 0;
+
+    CPU_ZERO(cpus);
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (!CPU_ISSET(cpu, &s_processCpus))
+        {
+            continue;
+        }
+
+        capacities[cpu] = ReadCpuCapacity(cpu);
+        if (capacities[cpu] == 0)
+        {
+            return false;
+        }
+
+        highest = capacities[cpu] > highest ? capacities[cpu] : highest;
+        lowest = (lowest == 0 || capacities[cpu] < lowest) ? capacities[cpu] : lowest;
+    }
+
+    if (highest == lowest)
+    {
+        return false;
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (capacities[cpu] != 0 && (capacities[cpu] == highest) == big)
+        {
+            CPU_SET(cpu, cpus);
+        }
+    }
+
+    return true;
+}
+
+bool ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass threadClass, const char* cpus)
+{
+    bool valid = true;
+    bool placed = false;
+    cpu_set_t classCpus;
+
+    if ((unsigned int)threadClass >= ADUC_ThreadClass_Count)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&s_mutex);
+
+    if (!s_processCpusRead)
+    {
+        if (sched_getaffinity(0, sizeof(s_processCpus), &s_processCpus) != 0)
+        {
+            pthread_mutex_unlock(&s_mutex);
+            return false;
+        }
+
+        s_processCpusRead = true;
+    }
+
+    if (cpus == NULL || *cpus == '\0')
+    {
+        placed = false;
+    }
+    else if (strcmp(cpus, ADUC_CPU_AFFINITY_BIG) == 0 || strcmp(cpus, ADUC_CPU_AFFINITY_LITTLE) == 0)
+    {
+        placed = GetCpusByCapacity(strcmp(cpus, ADUC_CPU_AFFINITY_BIG) == 0, &classCpus);
+    }
+    else
+    {
+        valid = ParseCpuList(cpus, &classCpus);
+        placed = valid;
+    }
+
+    if (placed)
+    {
+        CPU_AND(&classCpus, &classCpus, &s_processCpus);
+        placed = CPU_COUNT(&classCpus) > 0;
+    }
+
+    s_classPlaced[threadClass] = placed;
+    if (placed)
+    {
+        s_classCpus[threadClass] = classCpus;
+    }
+
+    __atomic_add_fetch(&s_generation, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&s_mutex);
+
+    return valid;
+}
+
+bool ADUC_CpuAffinity_ApplyToCurrentThread(ADUC_ThreadClass threadClass)
+{
+    cpu_set_t cpus;
+    const unsigned int generation = __atomic_load_n(&s_generation, __ATOMIC_ACQUIRE);
+
+    if ((unsigned int)threadClass >= ADUC_ThreadClass_Count)
+    {
+        return false;
+    }
+
+    if (generation == 0 || (t_appliedGeneration == generation && t_appliedClass == threadClass))
+    {
+        return true;
+    }
+
+    pthread_mutex_lock(&s_mutex);
+    cpus = s_classPlaced[threadClass] ? s_classCpus[threadClass] : s_processCpus;
+    pthread_mutex_unlock(&s_mutex);
+
+    // 0 is the calling thread.
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+    {
+        return false;
+    }
+
+    t_appliedClass = threadClass;
+    t_appliedGeneration = generation;
+    return true;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file cpu_affinity_utils_ut.cpp
+ * @brief Unit tests for cpu_affinity_utils.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/cpu_affinity_utils.h"
+
+#include <catch2/catch.hpp>
+
+#include <sched.h>
+#include <string>
+#include <thread>
+
+static cpu_set_t GetCurrentThreadCpus()
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    REQUIRE(sched_getaffinity(0, sizeof(cpus), &cpus) == 0);
+    return cpus;
+}
+
+static int GetFirstCpu(const cpu_set_t& cpus)
+{
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &cpus))
+        {
+            return cpu;
+        }
+    }
+
+    return -1;
+}
+
+TEST_CASE("ADUC_CpuAffinity_SetClassCpus validates the CPUs")
+{
+    CHECK(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, "0-1,3"));
+    CHECK(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, "0"));
+    CHECK(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, ADUC_CPU_AFFINITY_BIG));
+    CHECK(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, ADUC_CPU_AFFINITY_LITTLE));
+    CHECK(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, ""));
+    CHECK(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, nullptr));
+
+    CHECK_FALSE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, "fast"));
+    CHECK_FALSE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, "3-1"));
+    CHECK_FALSE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, "1,"));
+    CHECK_FALSE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, "1-"));
+    CHECK_FALSE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, "0 1"));
+    CHECK_FALSE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, "100000"));
+    CHECK_FALSE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_Count, "0"));
+
+    REQUIRE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, nullptr));
+}
+
+TEST_CASE("ADUC_CpuAffinity_ApplyToCurrentThread places threads on the CPUs of their class")
+{
+    const cpu_set_t processCpus = GetCurrentThreadCpus();
+    const int firstCpu = GetFirstCpu(processCpus);
+    REQUIRE(firstCpu >= 0);
+
+    REQUIRE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_Compute, std::to_string(firstCpu).c_str()));
+    REQUIRE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_IO, nullptr));
+
+    std::thread{ [&processCpus, firstCpu]() {
+        REQUIRE(ADUC_CpuAffinity_ApplyToCurrentThread(ADUC_ThreadClass_Compute));
+        cpu_set_t cpus = GetCurrentThreadCpus();
+        CHECK(CPU_COUNT(&cpus) == 1);
+        CHECK(CPU_ISSET(firstCpu, &cpus));
+
+        // A class without CPUs of its own runs on the CPUs of the process.
+        REQUIRE(ADUC_CpuAffinity_ApplyToCurrentThread(ADUC_ThreadClass_IO));
+        cpus = GetCurrentThreadCpus();
+        CHECK(CPU_EQUAL(&cpus, &processCpus));
+
+        // The threads follow the changes of their class.
+        REQUIRE(ADUC_CpuAffinity_ApplyToCurrentThread(ADUC_ThreadClass_Compute));
+        REQUIRE(ADUC_CpuAffinity_SetClassCpus(ADUC_ThreadClass_Compute, ""));
+        REQUIRE(ADUC_CpuAffinity_ApplyToCurrentThread(ADUC_ThreadClass_Compute));
+        cpus = GetCurrentThreadCpus();
+        CHECK(CPU_EQUAL(&cpus, &processCpus));
+    } }.join();
+
+    // Other threads are left where they are.
+    const cpu_set_t cpus = GetCurrentThreadCpus();
+    CHECK(CPU_EQUAL(&cpus, &processCpus));
+}
@@ -14,16 +14,28 @@
 
 EXTERN_C_BEGIN
 
+/**
+ * @brief The size of the buffer for the padded Base64 encoding of @p len bytes, including the null-terminator.
+ * It's also enough for their Base64URL encoding.
+ */
+#    define BASE64_ENCODED_SIZE(len) (4 * (((len) + 2) / 3) + 1)
+
 //
 // Base64 Encoding / Decoding
 //
 
+size_t Base64EncodeToBuffer(const uint8_t* bytes, size_t len, char* buffer, size_t bufferSize);
+
+size_t Base64URLEncodeToBuffer(const uint8_t* bytes, size_t len, char* buffer, size_t bufferSize);
+
 char* Base64URLEncode(const uint8_t* bytes, size_t len);
 
 size_t Base64URLDecode(const char* base64_encoded_blob, uint8_t** decoded_buffer);
 
 char* Base64URLDecodeToString(const char* base64_encoded_blob);
 
+size_t Base64URLDecodeToBuffer(const char* encoded, size_t encodedLength, uint8_t* buffer, size_t bufferSize);
+
 EXTERN_C_END
 
 #endif // BASE64_UTILS_H
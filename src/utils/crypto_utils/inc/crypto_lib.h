@@ -29,6 +29,17 @@ bool IsValidSignature(
     size_t blobLength,
     CryptoKeyHandle keyToSign);
 
+//
+// Hashing
+//
+
+/**
+ * @brief The size, in bytes, of a SHA-256 digest.
+ */
+#    define CRYPTO_SHA256_DIGEST_SIZE 32
+
+bool GetSHA256Digest(const uint8_t* blob, size_t blobLength, uint8_t* digest);
+
 //
 // Key Helper Functions
 //
@@ -41,6 +52,10 @@ CryptoKeyHandle RSAKey_ObjFromStrings(const char* N, const char* e);
 
 CryptoKeyHandle GetRootKeyForKeyID(const char* kid);
 
+bool GetRootKeysDigest(uint8_t* digest);
+
+CryptoKeyHandle DuplicateCryptoKeyHandle(CryptoKeyHandle key);
+
 void FreeCryptoKeyHandle(CryptoKeyHandle key);
 
 EXTERN_C_END
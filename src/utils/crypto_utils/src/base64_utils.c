@@ -6,12 +6,10 @@
  * Licensed under the MIT License.
  */
 #include "base64_utils.h"
-#include <azure_c_shared_utility/azure_base64.h>
-#include <azure_c_shared_utility/crt_abstractions.h>
-#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h> // for SIZE_MAX
 #include <stdlib.h>
 #include <string.h>
-#include <strings.h>
 
 /* Note: on Base64 Encoding vs Base64URL
  * Base64 encodes byte values into specified values. A chart of these can be found in
@@ -25,6 +23,132 @@
  * More information can be found in RFC 4648 in the Base64Url section.
  */
 
+/**
+ * @brief The characters of the Base64 and Base64URL alphabets, indexed by value.
+ */
+static const char base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char base64URLAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/**
+ * @brief The value of each character of either alphabet, 0xFF for the others.
+ * @details Indexing a table, a quantum of four characters is decoded without a branch per character.
+ */
+#define B64_XX 0xFF
+static const uint8_t base64CharValues[256] = {
+    // clang-format off
+    B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX,
+    B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX,
+    B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, 62,     B64_XX, 62,     B64_XX, 63,
+    52,     53,     54,     55,     56,     57,     58,     59,     60,     61,     B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX,
+    B64_XX, 0,      1,      2,      3,      4,      5,      6,      7,      8,      9,      10,     11,     12,     13,     14,
+    15,     16,     17,     18,     19,     20,     21,     22,     23,     24,     25,     B64_XX, B64_XX, B64_XX, B64_XX, 63,
+    B64_XX, 26,     27,     28,     29,     30,     31,     32,     33,     34,     35,     36,     37,     38,     39,     40,
+    41,     42,     43,     44,     45,     46,     47,     48,     49,     50,     51,     B64_XX, B64_XX, B64_XX, B64_XX, B64_XX,
+    B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX,
+    B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX,
+    B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX,
+    B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX,
+    B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX,
+    B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX,
+    B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX,
+    B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX, B64_XX,
+    // clang-format on
+};
+#undef B64_XX
+
+/**
+ * @brief Encodes @p len bytes with @p alphabet into the caller's @p buffer, a quantum of three bytes at a time
+ * @param bytes the bytes to encode
+ * @param len the number of bytes to encode
+ * @param alphabet the alphabet, base64Alphabet or base64URLAlphabet
+ * @param pad whether to pad the output with '=' to a multiple of four characters
+ * @param buffer the buffer for the null-terminated output
+ * @param bufferSize the size of @p buffer
+ * @returns the length of the output, without the null-terminator, 0 on failure or if @p buffer is too small
+ */
+static size_t
+EncodeToBuffer(const uint8_t* bytes, size_t len, const char* alphabet, _Bool pad, char* buffer, size_t bufferSize)
+{
+    if (len > (SIZE_MAX - 1) / 4 * 3 - 2)
+    {
+        return 0;
+    }
+
+    const size_t remainder = len % 3;
+    const size_t encodedLength =
+        pad ? BASE64_ENCODED_SIZE(len) - 1 : len / 3 * 4 + (remainder == 0 ? 0 : remainder + 1);
+
+    if (buffer == NULL || bufferSize <= encodedLength || (bytes == NULL && len != 0))
+    {
+        return 0;
+    }
+
+    const uint8_t* in = bytes;
+    const uint8_t* end = bytes + (len - remainder);
+    char* out = buffer;
+
+    while (in != end)
+    {
+        const uint32_t quantum = ((uint32_t)in[0] << 16) | ((uint32_t)in[1] << 8) | in[2];
+        out[0] = alphabet[quantum >> 18];
+        out[1] = alphabet[(quantum >> 12) & 0x3F];
+        out[2] = alphabet[(quantum >> 6) & 0x3F];
+        out[3] = alphabet[quantum & 0x3F];
+        in += 3;
+        out += 4;
+    }
+
+    if (remainder != 0)
+    {
+        const uint32_t quantum = ((uint32_t)in[0] << 16) | (remainder == 2 ? (uint32_t)in[1] << 8 : 0);
+        *out++ = alphabet[quantum >> 18];
+        *out++ = alphabet[(quantum >> 12) & 0x3F];
+
+        if (remainder == 2)
+        {
+            *out++ = alphabet[(quantum >> 6) & 0x3F];
+        }
+
+        if (pad)
+        {
+            *out++ = '=';
+            if (remainder == 1)
+            {
+                *out++ = '=';
+            }
+        }
+    }
+
+    *out = '\0';
+    return encodedLength;
+}
+
+/**
+ * @brief Encodes the provided bytes into padded Base64, into the caller's @p buffer
+ * @param bytes the buffer to be encoded
+ * @param len the length of the buffer to be encoded
+ * @param buffer the buffer for the null-terminated output, of at least BASE64_ENCODED_SIZE(@p len) characters
+ * @param bufferSize the size of @p buffer
+ * @returns the length of the output, without the null-terminator, 0 on failure or if @p buffer is too small
+ */
+size_t Base64EncodeToBuffer(const uint8_t* bytes, size_t len, char* buffer, size_t bufferSize)
+{
+    return EncodeToBuffer(bytes, len, base64Alphabet, true, buffer, bufferSize);
+}
+
+/**
+ * @brief Encodes the provided bytes into unpadded Base64URL, into the caller's @p buffer
+ * @param bytes the buffer to be encoded
+ * @param len the length of the buffer to be encoded
+ * @param buffer the buffer for the null-terminated output, BASE64_ENCODED_SIZE(@p len) characters are always enough
+ * @param bufferSize the size of @p buffer
+ * @returns the length of the output, without the null-terminator, 0 on failure or if @p buffer is too small
+ */
+size_t Base64URLEncodeToBuffer(const uint8_t* bytes, size_t len, char* buffer, size_t bufferSize)
+{
+    return EncodeToBuffer(bytes, len, base64URLAlphabet, false, buffer, bufferSize);
+}
+
 /**
  * @brief Encodes the provided bytes into Base64URL
  * @details the string returned to the user should be freed using the free() function
@@ -34,33 +158,25 @@
  */
 char* Base64URLEncode(const unsigned char* bytes, size_t len)
 {
-    char* output = NULL;
-
-    STRING_HANDLE strHandle = Azure_Base64_Encode_Bytes(bytes, len);
-
-    if (strHandle == NULL)
+    if (len > (SIZE_MAX - 1) / 4 * 3 - 2)
     {
         return NULL;
     }
 
-    STRING_replace(strHandle, '+', '-');
-    STRING_replace(strHandle, '/', '_');
-    STRING_replace(strHandle, '=', '\0');
-
-    size_t strLength = STRING_length(strHandle);
-
-    output = (char*)malloc(strLength + 1);
+    const size_t bufferSize = BASE64_ENCODED_SIZE(len);
+    char* output = (char*)malloc(bufferSize);
     if (output == NULL)
     {
-        goto done;
+        return NULL;
     }
 
-    strcpy(output, STRING_c_str(strHandle)); // NOLINT(clang-analyzer-security.insecureAPI.strcpy)
-    output[strLength] = '\0';
-
-done:
+    // Nothing encodes to an empty string.
+    if (Base64URLEncodeToBuffer(bytes, len, output, bufferSize) == 0 && len != 0)
+    {
+        free(output);
+        return NULL;
+    }
 
-    STRING_delete(strHandle);
     return output;
 }
 
@@ -73,126 +189,144 @@ done:
  */
 size_t Base64URLDecode(const char* base64_encoded_blob, unsigned char** decoded_buffer)
 {
-    size_t ret_size = 0;
-    size_t buffLen = 0;
-    uint8_t* tempDecodedBuffer = NULL;
-    BUFFER_HANDLE buffHandle = NULL;
-    char* temp_blob = NULL;
-
     *decoded_buffer = NULL;
 
-    size_t blob_len = strlen(base64_encoded_blob);
+    const size_t blob_len = strlen(base64_encoded_blob);
     if (blob_len == 0)
     {
-        goto done;
+        return 0;
     }
 
-    size_t padding = 0;
-    if (blob_len % 4 != 0)
+    // The decoded data is at most three bytes per four characters, rounded up.
+    const size_t bufferSize = blob_len / 4 * 3 + 3;
+    uint8_t* buffer = (uint8_t*)malloc(bufferSize);
+    if (buffer == NULL)
     {
-        padding = 4 - blob_len % 4;
+        return 0;
     }
 
-    temp_blob = (char*)malloc(blob_len + padding + 1);
-    if (temp_blob == NULL)
+    const size_t decodedSize = Base64URLDecodeToBuffer(base64_encoded_blob, blob_len, buffer, bufferSize);
+    if (decodedSize == 0)
     {
-        goto done;
+        free(buffer);
+        return 0;
     }
 
-    unsigned int i = 0;
-    for (i = 0; i < blob_len; ++i)
-    {
-        if (base64_encoded_blob[i] == '-')
-        {
-            temp_blob[i] = '+';
-        }
-        else if (base64_encoded_blob[i] == '_')
-        {
-            temp_blob[i] = '/';
-        }
-        else
-        {
-            temp_blob[i] = base64_encoded_blob[i];
-        }
-    }
+    *decoded_buffer = buffer;
+    return decodedSize;
+}
 
-    unsigned int padding_end = blob_len + padding;
-    while (i < padding_end)
+/**
+ * @brief Decodes the Base64Encoded buffers and returns the data in a null-terminated string.
+ * @details This function should only be used when the caller expects the decoded data to be used in string format with
+ * valid character values
+ * @param base64_encoded_blob the base64 encoded data to be converted to a string
+ * @returns a pointer to the newly null terminated decoded data on success, null on failure
+ */
+char* Base64URLDecodeToString(const char* base64_encoded_blob)
+{
+    const size_t blob_len = strlen(base64_encoded_blob);
+    if (blob_len == 0)
     {
-        temp_blob[i] = '=';
-        ++i;
+        return NULL;
     }
-    temp_blob[blob_len + padding] = '\0';
 
-    buffHandle = Azure_Base64_Decode(temp_blob);
-    if (buffHandle == NULL)
+    // Room for the decoded data and its null-terminator.
+    const size_t bufferSize = blob_len / 4 * 3 + 4;
+    char* blobStr = (char*)malloc(bufferSize);
+    if (blobStr == NULL)
     {
-        goto done;
+        return NULL;
     }
 
-    BUFFER_size(buffHandle, &buffLen);
-
-    tempDecodedBuffer = (uint8_t*)malloc(buffLen);
-    if (tempDecodedBuffer == NULL)
+    const size_t decodedSize =
+        Base64URLDecodeToBuffer(base64_encoded_blob, blob_len, (uint8_t*)blobStr, bufferSize - 1);
+    if (decodedSize == 0)
     {
-        buffLen = 0;
-        goto done;
+        free(blobStr);
+        return NULL;
     }
-    memcpy(tempDecodedBuffer, BUFFER_u_char(buffHandle), buffLen);
-
-done:
-
-    BUFFER_delete(buffHandle);
-    free(temp_blob);
-
-    ret_size = buffLen;
-    *decoded_buffer = tempDecodedBuffer;
 
-    return ret_size;
+    blobStr[decodedSize] = '\0';
+    return blobStr;
 }
 
 /**
- * @brief Decodes the Base64Encoded buffers and returns the data in a null-terminated string.
- * @details This function should only be used when the caller expects the decoded data to be used in string format with
- * valid character values
- * @param base64_encoded_blob the base64 encoded data to be converted to a string
- * @returns a pointer to the newly null terminated decoded data on success, null on failure
+ * @brief Decodes the first @p encodedLength characters of @p encoded into the caller's @p buffer
+ * @details Unlike Base64URLDecode, @p encoded doesn't need to be null-terminated and nothing is allocated,
+ * which allows decoding a section of a larger string in place. The decoded data is never longer than the encoded one.
+ * Both the Base64 and the Base64URL alphabets are accepted
+ * @param encoded the base64URL encoded data, with optional padding
+ * @param encodedLength the number of characters of @p encoded to decode
+ * @param buffer the buffer for the decoded data
+ * @param bufferSize the size of @p buffer
+ * @returns the size of the decoded data on success, 0 on failure or if @p buffer is too small
  */
-char* Base64URLDecodeToString(const char* base64_encoded_blob)
+size_t Base64URLDecodeToBuffer(const char* encoded, size_t encodedLength, uint8_t* buffer, size_t bufferSize)
 {
-    _Bool success = false;
+    const unsigned char* in = (const unsigned char*)encoded;
 
-    char* blobStr = NULL;
+    while (encodedLength > 0 && encoded[encodedLength - 1] == '=')
+    {
+        --encodedLength;
+    }
 
-    unsigned char* decodedBuffer = NULL;
-    const size_t decodedSize = Base64URLDecode(base64_encoded_blob, &decodedBuffer);
+    // A single character left over can't encode a byte.
+    const size_t remainder = encodedLength % 4;
+    if (encodedLength == 0 || remainder == 1)
+    {
+        return 0;
+    }
 
-    if (decodedSize == 0)
+    const size_t decodedLength = encodedLength / 4 * 3 + (remainder == 0 ? 0 : remainder - 1);
+    if (decodedLength > bufferSize)
     {
-        goto done;
+        return 0;
     }
 
-    blobStr = (char*)malloc(decodedSize + 1);
+    const unsigned char* end = in + (encodedLength - remainder);
+    uint8_t* out = buffer;
 
-    if (blobStr == NULL)
+    while (in != end)
     {
-        goto done;
+        const uint32_t a = base64CharValues[in[0]];
+        const uint32_t b = base64CharValues[in[1]];
+        const uint32_t c = base64CharValues[in[2]];
+        const uint32_t d = base64CharValues[in[3]];
+
+        // Only the invalid characters have a value with the high bit set.
+        if (((a | b | c | d) & 0x80) != 0)
+        {
+            return 0;
+        }
+
+        const uint32_t quantum = (a << 18) | (b << 12) | (c << 6) | d;
+        out[0] = (uint8_t)(quantum >> 16);
+        out[1] = (uint8_t)(quantum >> 8);
+        out[2] = (uint8_t)quantum;
+        in += 4;
+        out += 3;
     }
 
-    memcpy(blobStr, decodedBuffer, decodedSize);
-    blobStr[decodedSize] = '\0';
+    if (remainder != 0)
+    {
+        const uint32_t a = base64CharValues[in[0]];
+        const uint32_t b = base64CharValues[in[1]];
+        const uint32_t c = remainder == 3 ? base64CharValues[in[2]] : 0;
 
-    success = true;
+        if (((a | b | c) & 0x80) != 0)
+        {
+            return 0;
+        }
 
-done:
+        const uint32_t quantum = (a << 18) | (b << 12) | (c << 6);
+        *out++ = (uint8_t)(quantum >> 16);
 
-    if (!success)
-    {
-        free(blobStr);
-        blobStr = NULL;
+        if (remainder == 3)
+        {
+            *out = (uint8_t)(quantum >> 8);
+        }
     }
 
-    free(decodedBuffer);
-
-    return blobStr;
+    return decodedLength;
 }
@@ -9,12 +9,12 @@
 #include "crypto_lib.h"
 #include "base64_utils.h"
 #include "root_key_util.h"
-#include <azure_c_shared_utility/azure_base64.h>
 #include <ctype.h>
 #include <openssl/bn.h>
 #include <openssl/evp.h>
 #include <openssl/rsa.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
@@ -331,30 +331,76 @@ done:
 CryptoKeyHandle RSAKey_ObjFromB64Strings(const char* encodedN, const char* encodedE)
 {
     CryptoKeyHandle result = NULL;
-    BUFFER_HANDLE eBuff = NULL;
 
-    BUFFER_HANDLE nBuff = Azure_Base64_Decode(encodedN);
-    if (nBuff == NULL)
+    const size_t encodedNLength = strlen(encodedN);
+    const size_t encodedELength = strlen(encodedE);
+
+    // Both are decoded into one buffer; decoded data is at most three bytes per four characters, rounded up.
+    const size_t nSize = encodedNLength / 4 * 3 + 3;
+    const size_t eSize = encodedELength / 4 * 3 + 3;
+    uint8_t* buffer = (uint8_t*)malloc(nSize + eSize);
+    if (buffer == NULL)
+    {
+        goto done;
+    }
+
+    const size_t nLength = Base64URLDecodeToBuffer(encodedN, encodedNLength, buffer, nSize);
+    if (nLength == 0)
     {
         goto done;
     }
 
-    eBuff = Azure_Base64_Decode(encodedE);
-    if (eBuff == NULL)
+    const size_t eLength = Base64URLDecodeToBuffer(encodedE, encodedELength, buffer + nSize, eSize);
+    if (eLength == 0)
     {
         goto done;
     }
 
-    result =
-        RSAKey_ObjFromBytes(BUFFER_u_char(nBuff), BUFFER_length(nBuff), BUFFER_u_char(eBuff), BUFFER_length(eBuff));
+    result = RSAKey_ObjFromBytes(buffer, nLength, buffer + nSize, eLength);
 
 done:
-    BUFFER_delete(nBuff);
-    BUFFER_delete(eBuff);
+    free(buffer);
 
     return result;
 }
 
+/**
+ * @brief Calculates the SHA-256 digest of @p blob
+ * @param blob the data to hash
+ * @param blobLength the size of @p blob
+ * @param digest receives the digest, at least CRYPTO_SHA256_DIGEST_SIZE bytes
+ * @returns true on success, false on failure
+ */
+bool GetSHA256Digest(const uint8_t* blob, size_t blobLength, uint8_t* digest)
+{
+    unsigned int digestLength = 0;
+
+    if (EVP_Digest(blob, blobLength, digest, &digestLength, EVP_sha256(), NULL) != 1)
+    {
+        return false;
+    }
+
+    return digestLength == CRYPTO_SHA256_DIGEST_SIZE;
+}
+
+/**
+ * @brief Returns another reference to @p key
+ * @details The key is shared, not copied. Both handles must be freed with FreeCryptoKeyHandle()
+ * @param key the key to duplicate
+ * @returns NULL on failure and the key on success
+ */
+CryptoKeyHandle DuplicateCryptoKeyHandle(CryptoKeyHandle key)
+{
+    EVP_PKEY* pkey = CryptoKeyHandleToEVP_PKEY(key);
+
+    if (pkey == NULL || EVP_PKEY_up_ref(pkey) != 1)
+    {
+        return NULL;
+    }
+
+    return key;
+}
+
 /**
  * @brief Frees the key structure
  * @details Caller should assume the key is invalid after this call
@@ -375,3 +421,14 @@ CryptoKeyHandle GetRootKeyForKeyID(const char* kid)
 {
     return GetKeyForKid(kid);
 }
+
+/**
+ * @brief Calculates the SHA-256 digest of the list of root keys
+ * @details What was verified against a root key must be verified again when this digest changes
+ * @param digest receives the digest, at least CRYPTO_SHA256_DIGEST_SIZE bytes
+ * @returns true on success, false on failure
+ */
+bool GetRootKeysDigest(uint8_t* digest)
+{
+    return GetRootKeyListDigest(digest);
+}
@@ -8,6 +8,7 @@
  * Licensed under the MIT License.
  */
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -16,6 +17,8 @@
 #include <string.h>
 #include <strings.h>
 
+#include <openssl/evp.h>
+
 #include "crypto_lib.h"
 #include "root_key_util.h"
 //
@@ -176,6 +179,21 @@ static const RSARootKey RSARootKeyList[] =
 };
 // clang-format on
 
+/**
+ * @brief The number of keys in RSARootKeyList.
+ */
+#define RSA_ROOT_KEY_COUNT (sizeof(RSARootKeyList) / sizeof(RSARootKey))
+
+/**
+ * @brief The keys built from RSARootKeyList, on first use, and kept for the lifetime of the process.
+ */
+static CryptoKeyHandle s_rootKeys[RSA_ROOT_KEY_COUNT];
+
+/**
+ * @brief Protects s_rootKeys.
+ */
+static pthread_mutex_t s_rootKeysMutex = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * @brief Helper function that returns a CryptoKeyHandle associated with the kid
  * @details The caller must free the returned Key with the FreeCryptoKeyHandle() function
@@ -184,17 +202,68 @@ static const RSARootKey RSARootKeyList[] =
  */
 CryptoKeyHandle GetKeyForKid(const char* kid)
 {
+    CryptoKeyHandle key = NULL;
+
     //
     // Iterate through the RSA Root Keys
     //
-    const unsigned numberKeys = (sizeof(RSARootKeyList) / sizeof(RSARootKey));
-    for (unsigned i = 0; i < numberKeys; ++i)
+    for (unsigned i = 0; i < RSA_ROOT_KEY_COUNT; ++i)
     {
         if (strcmp(RSARootKeyList[i].kid, kid) == 0)
         {
-            return RSAKey_ObjFromStrings(RSARootKeyList[i].N, RSARootKeyList[i].e);
+            pthread_mutex_lock(&s_rootKeysMutex);
+
+            if (s_rootKeys[i] == NULL)
+            {
+                s_rootKeys[i] = RSAKey_ObjFromStrings(RSARootKeyList[i].N, RSARootKeyList[i].e);
+            }
+
+            key = DuplicateCryptoKeyHandle(s_rootKeys[i]);
+
+            pthread_mutex_unlock(&s_rootKeysMutex);
+            break;
         }
     }
 
-    return NULL;
+    return key;
+}
+
+/**
+ * @brief Calculates the SHA-256 digest of the root key list: the key identifiers, moduli and exponents of all keys
+ * @details The digest changes whenever a root key is added, removed or replaced, so that what was verified against
+ * the previous list can be told apart
+ * @param digest receives the digest, at least CRYPTO_SHA256_DIGEST_SIZE bytes
+ * @returns true on success, false on failure
+ */
+bool GetRootKeyListDigest(uint8_t* digest)
+{
+    bool success = false;
+    unsigned int digestLength = 0;
+
+    EVP_MD_CTX* context = EVP_MD_CTX_new();
+    if (context == NULL || EVP_DigestInit_ex(context, EVP_sha256(), NULL) != 1)
+    {
+        goto done;
+    }
+
+    for (unsigned i = 0; i < RSA_ROOT_KEY_COUNT; ++i)
+    {
+        // The null-terminators delimit the fields.
+        const char* fields[] = { RSARootKeyList[i].kid, RSARootKeyList[i].N, RSARootKeyList[i].e };
+
+        for (unsigned j = 0; j < sizeof(fields) / sizeof(fields[0]); ++j)
+        {
+            if (EVP_DigestUpdate(context, fields[j], strlen(fields[j]) + 1) != 1)
+            {
+                goto done;
+            }
+        }
+    }
+
+    success = EVP_DigestFinal_ex(context, digest, &digestLength) == 1 && digestLength == CRYPTO_SHA256_DIGEST_SIZE;
+
+done:
+    EVP_MD_CTX_free(context);
+
+    return success;
 }
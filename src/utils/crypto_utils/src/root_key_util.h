@@ -6,10 +6,14 @@
  * Licensed under the MIT License.
  */
 #include "crypto_key.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 #ifndef ROOT_KEY_UTIL_H
 #    define ROOT_KEY_UTIL_H
 
 CryptoKeyHandle GetKeyForKid(const char* kid);
 
+bool GetRootKeyListDigest(uint8_t* digest);
+
 #endif // ROOT_KEY_UTIL_H
@@ -29,6 +29,60 @@ TEST_CASE("Base64 Encoding")
 
         CHECK(strcmp(expected_output, output.get()) == 0);
     }
+
+    SECTION("Encoding into a buffer")
+    {
+        const std::array<uint8_t, 5> test_bytes{ 0xFB, 0xFF, 0xBF, 0x00, 0x01 };
+        std::array<char, BASE64_ENCODED_SIZE(5)> output{};
+
+        CHECK(Base64EncodeToBuffer(test_bytes.data(), test_bytes.size(), output.data(), output.size()) == 8);
+        CHECK(strcmp(output.data(), "+/+/AAE=") == 0);
+
+        CHECK(Base64URLEncodeToBuffer(test_bytes.data(), test_bytes.size(), output.data(), output.size()) == 7);
+        CHECK(strcmp(output.data(), "-_-_AAE") == 0);
+
+        CHECK(Base64EncodeToBuffer(test_bytes.data(), 4, output.data(), output.size()) == 8);
+        CHECK(strcmp(output.data(), "+/+/AA==") == 0);
+    }
+
+    SECTION("Encoding into a buffer that's too small")
+    {
+        const std::array<uint8_t, 5> test_bytes{ 0xFB, 0xFF, 0xBF, 0x00, 0x01 };
+        std::array<char, 8> output{};
+
+        // No room for the null-terminator.
+        CHECK(Base64EncodeToBuffer(test_bytes.data(), test_bytes.size(), output.data(), output.size()) == 0);
+        CHECK(Base64URLEncodeToBuffer(test_bytes.data(), test_bytes.size(), output.data(), 7) == 0);
+    }
+
+    SECTION("Decoding what was encoded")
+    {
+        std::array<uint8_t, 64> bytes{};
+        for (size_t i = 0; i < bytes.size(); ++i)
+        {
+            bytes[i] = static_cast<uint8_t>(i * 37 + 11);
+        }
+
+        for (size_t len = 1; len <= bytes.size(); ++len)
+        {
+            std::array<char, BASE64_ENCODED_SIZE(64)> encoded{};
+            std::array<char, BASE64_ENCODED_SIZE(64)> encodedURL{};
+            std::array<uint8_t, 64> decoded{};
+
+            const size_t encodedLength = Base64EncodeToBuffer(bytes.data(), len, encoded.data(), encoded.size());
+            const size_t encodedURLLength =
+                Base64URLEncodeToBuffer(bytes.data(), len, encodedURL.data(), encodedURL.size());
+            REQUIRE(encodedLength == BASE64_ENCODED_SIZE(len) - 1);
+            REQUIRE(encodedURLLength == (len * 4 + 2) / 3);
+
+            CHECK(Base64URLDecodeToBuffer(encoded.data(), encodedLength, decoded.data(), len) == len);
+            CHECK(memcmp(decoded.data(), bytes.data(), len) == 0);
+
+            decoded.fill(0);
+            CHECK(Base64URLDecodeToBuffer(encodedURL.data(), encodedURLLength, decoded.data(), len) == len);
+            CHECK(memcmp(decoded.data(), bytes.data(), len) == 0);
+        }
+    }
 }
 
 TEST_CASE("Base64 Decoding")
@@ -49,6 +103,38 @@ TEST_CASE("Base64 Decoding")
     }
 }
 
+TEST_CASE("Base64 Decoding To Buffer")
+{
+    const std::array<uint8_t, 16> expected_output{ '|', '|', '|', '|', '\\', '\\', '\\', '/',
+                                                   '/', '/', '/', '?', '}',  '}',  '~',  '~' };
+
+    SECTION("Decoding part of a string")
+    {
+        // Only the part before the '.' is decoded.
+        const std::string test_input = "fHx8fFxcXC8vLy8_fX1-fg.e30";
+        std::array<uint8_t, 16> output{};
+
+        CHECK(Base64URLDecodeToBuffer(test_input.c_str(), 22, output.data(), output.size()) == output.size());
+        CHECK(output == expected_output);
+    }
+
+    SECTION("Decoding into a buffer that's too small")
+    {
+        const std::string test_input = "fHx8fFxcXC8vLy8_fX1-fg==";
+        std::array<uint8_t, 15> output{};
+
+        CHECK(Base64URLDecodeToBuffer(test_input.c_str(), test_input.size(), output.data(), output.size()) == 0);
+    }
+
+    SECTION("Decoding invalid data")
+    {
+        std::array<uint8_t, 16> output{};
+
+        CHECK(Base64URLDecodeToBuffer("fHx8*Fxc", 8, output.data(), output.size()) == 0);
+        CHECK(Base64URLDecodeToBuffer("fHx8f", 5, output.data(), output.size()) == 0);
+    }
+}
+
 TEST_CASE("RSA Keys")
 {
     SECTION("Making an RSA Key From a String")
@@ -74,6 +160,24 @@ TEST_CASE("RSA Keys")
         FreeCryptoKeyHandle(key);
     }
 
+    SECTION("Getting a Root Key ID again")
+    {
+        CryptoKeyHandle key1 = GetRootKeyForKeyID("ADU.200703.R");
+        REQUIRE(key1 != nullptr);
+
+        // Root keys are built once and shared; freeing a handle keeps the others valid.
+        CryptoKeyHandle key2 = GetRootKeyForKeyID("ADU.200703.R");
+        CHECK(key2 == key1);
+
+        FreeCryptoKeyHandle(key1);
+
+        CryptoKeyHandle key3 = GetRootKeyForKeyID("ADU.200703.R");
+        CHECK(key3 == key2);
+
+        FreeCryptoKeyHandle(key2);
+        FreeCryptoKeyHandle(key3);
+    }
+
     SECTION("Failing to get a Root Key")
     {
         CryptoKeyHandle key = GetRootKeyForKeyID("foo");
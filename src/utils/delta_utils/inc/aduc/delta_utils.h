@@ -0,0 +1,58 @@
+/**
+ * @file delta_utils.h
+ * @brief Utilities for reconstructing an image from a local source image and a delta file.
+ *
+ * A delta file describes the target image as a sequence of records, each copying a range of the
+ * source image, carrying new data, or filling with zeros. All integers are little-endian.
+ *
+ *   Header:  "ADUDELTA" | uint32 version (1) | uint32 reserved (0) | uint64 sourceSize | uint64 targetSize
+ *   Records: uint8 type, then
+ *            ADUC_DELTA_RECORD_COPY: uint64 sourceOffset | uint64 length
+ *            ADUC_DELTA_RECORD_DATA: uint64 length | length bytes
+ *            ADUC_DELTA_RECORD_ZERO: uint64 length
+ *
+ * The records produce exactly targetSize bytes, and are followed by the end of the file.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_DELTA_UTILS_H
+#define ADUC_DELTA_UTILS_H
+
+#include <aduc/c_utils.h>
+#include <azure_c_shared_utility/sha.h> // for SHAversion
+#include <stdbool.h>
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Delta file record types.
+ */
+typedef enum tagADUC_DeltaRecordType
+{
+    ADUC_DELTA_RECORD_COPY = 1, /**< Copies a range of the source image. */
+    ADUC_DELTA_RECORD_DATA = 2, /**< Carries new data. */
+    ADUC_DELTA_RECORD_ZERO = 3, /**< Fills with zeros. */
+} ADUC_DeltaRecordType;
+
+/**
+ * @brief Reconstructs the target image described by @p deltaPath.
+ * The first sourceSize bytes of @p sourcePath must match @p sourceHashBase64; @p sourcePath may
+ * be bigger, e.g. a partition holding a smaller file system image.
+ * @param sourcePath The source image, e.g. the inactive partition.
+ * @param sourceHashBase64 The base64 encoded hash of the source image.
+ * @param algorithm The algorithm of @p sourceHashBase64.
+ * @param deltaPath The delta file.
+ * @param targetPath The file to write the target image to. Replaced if it exists.
+ * @returns True if the target image was written. The caller must still verify its hash.
+ */
+_Bool ADUC_DeltaUtils_ApplyDelta(
+    const char* sourcePath,
+    const char* sourceHashBase64,
+    SHAversion algorithm,
+    const char* deltaPath,
+    const char* targetPath);
+
+EXTERN_C_END
+
+#endif // ADUC_DELTA_UTILS_H
@@ -0,0 +1,283 @@
+/**
+ * @file delta_utils.c
+ * @brief Implements reconstructing an image from a local source image and a delta file.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/delta_utils.h"
+#include "aduc/hash_utils.h"
+#include "aduc/logging.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief The magic bytes at the start of a delta file.
+ */
+#define ADUC_DELTA_MAGIC "ADUDELTA"
+
+/**
+ * @brief The supported delta file format version.
+ */
+#define ADUC_DELTA_VERSION 1
+
+/**
+ * @brief Size of the buffer used to move data between files.
+ */
+#define ADUC_DELTA_BUFFER_SIZE (256 * 1024)
+
+/**
+ * @brief Reads a little-endian unsigned integer of @p size bytes.
+ * @returns True on success, false on read error or end of file.
+ */
+static _Bool ReadLittleEndian(FILE* file, size_t size, uint64_t* value)
+{
+    uint8_t bytes[8];
+
+    if (size > sizeof(bytes) || fread(bytes, 1, size, file) != size)
+    {
+        return false;
+    }
+
+    *value = 0;
+    for (size_t i = size; i > 0; --i)
+    {
+        *value = (*value << 8) | bytes[i - 1];
+    }
+
+    return true;
+}
+
+/**
+ * @brief Reads exactly @p size bytes at @p offset of @p fd.
+ * @returns True on success.
+ */
+static _Bool ReadAt(int fd, uint8_t* buffer, size_t size, uint64_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t readSize = pread(fd, buffer, size, (off_t)offset);
+        if (readSize < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (readSize <= 0)
+        {
+            return false;
+        }
+
+        buffer += readSize;
+        size -= (size_t)readSize;
+        offset += (uint64_t)readSize;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Checks that the first @p size bytes of @p fd hash to @p hashBase64.
+ * @returns True if they do.
+ */
+static _Bool IsValidSourceHash(int fd, uint64_t size, const char* hashBase64, SHAversion algorithm, uint8_t* buffer)
+{
+    _Bool succeeded = false;
+    ADUC_HashUtils_Context context = { .evpContext = NULL };
+
+    if (!ADUC_HashUtils_ContextReset(&context, algorithm))
+    {
+        goto done;
+    }
+
+    for (uint64_t offset = 0; offset < size;)
+    {
+        const size_t chunkSize = (size - offset < ADUC_DELTA_BUFFER_SIZE) ? (size_t)(size - offset) : ADUC_DELTA_BUFFER_SIZE;
+
+        if (!ReadAt(fd, buffer, chunkSize, offset) || !ADUC_HashUtils_ContextInput(&context, buffer, chunkSize))
+        {
+            goto done;
+        }
+
+        offset += chunkSize;
+    }
+
+    succeeded = ADUC_HashUtils_ContextResult(&context, hashBase64, NULL);
+
+done:
+    ADUC_HashUtils_ContextUnInit(&context);
+    return succeeded;
+}
+
+_Bool ADUC_DeltaUtils_ApplyDelta(
+    const char* sourcePath,
+    const char* sourceHashBase64,
+    SHAversion algorithm,
+    const char* deltaPath,
+    const char* targetPath)
+{
+    _Bool succeeded = false;
+    int sourceFd = -1;
+    FILE* delta = NULL;
+    FILE* target = NULL;
+    uint8_t* buffer = NULL;
+    char magic[sizeof(ADUC_DELTA_MAGIC) - 1];
+    uint64_t version = 0;
+    uint64_t reserved = 0;
+    uint64_t sourceSize = 0;
+    uint64_t targetSize = 0;
+    uint64_t written = 0;
+
+    if (sourcePath == NULL || sourceHashBase64 == NULL || deltaPath == NULL || targetPath == NULL)
+    {
+        goto done;
+    }
+
+    buffer = malloc(ADUC_DELTA_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        goto done;
+    }
+
+    delta = fopen(deltaPath, "rbe");
+    if (delta == NULL)
+    {
+        Log_Error("Cannot open delta file %s, errno: %d", deltaPath, errno);
+        goto done;
+    }
+
+    if (fread(magic, 1, sizeof(magic), delta) != sizeof(magic) || memcmp(magic, ADUC_DELTA_MAGIC, sizeof(magic)) != 0
+        || !ReadLittleEndian(delta, 4, &version) || !ReadLittleEndian(delta, 4, &reserved)
+        || !ReadLittleEndian(delta, 8, &sourceSize) || !ReadLittleEndian(delta, 8, &targetSize))
+    {
+        Log_Error("%s is not a delta file.", deltaPath);
+        goto done;
+    }
+
+    if (version != ADUC_DELTA_VERSION)
+    {
+        Log_Error("Unsupported delta file version %llu", (unsigned long long)version);
+        goto done;
+    }
+
+    sourceFd = open(sourcePath, O_RDONLY | O_CLOEXEC);
+    if (sourceFd == -1)
+    {
+        Log_Error("Cannot open delta source %s, errno: %d", sourcePath, errno);
+        goto done;
+    }
+
+    if (!IsValidSourceHash(sourceFd, sourceSize, sourceHashBase64, algorithm, buffer))
+    {
+        Log_Error("Delta source %s doesn't match the expected source image.", sourcePath);
+        goto done;
+    }
+
+    target = fopen(targetPath, "wbe");
+    if (target == NULL)
+    {
+        Log_Error("Cannot create %s, errno: %d", targetPath, errno);
+        goto done;
+    }
+
+    while (written < targetSize)
+    {
+        uint64_t type = 0;
+        uint64_t offset = 0;
+        uint64_t length = 0;
+
+        if (!ReadLittleEndian(delta, 1, &type)
+            || (type == ADUC_DELTA_RECORD_COPY && !ReadLittleEndian(delta, 8, &offset))
+            || !ReadLittleEndian(delta, 8, &length))
+        {
+            Log_Error("Truncated delta file %s", deltaPath);
+            goto done;
+        }
+
+        if (length > targetSize - written
+            || (type == ADUC_DELTA_RECORD_COPY && (offset > sourceSize || length > sourceSize - offset)))
+        {
+            Log_Error("Invalid delta record at target offset %llu", (unsigned long long)written);
+            goto done;
+        }
+
+        if (type == ADUC_DELTA_RECORD_ZERO)
+        {
+            memset(buffer, 0, ADUC_DELTA_BUFFER_SIZE);
+        }
+        else if (type != ADUC_DELTA_RECORD_COPY && type != ADUC_DELTA_RECORD_DATA)
+        {
+            Log_Error("Unknown delta record type %llu", (unsigned long long)type);
+            goto done;
+        }
+
+        while (length > 0)
+        {
+            const size_t chunkSize = (length < ADUC_DELTA_BUFFER_SIZE) ? (size_t)length : ADUC_DELTA_BUFFER_SIZE;
+
+            if (type == ADUC_DELTA_RECORD_COPY)
+            {
+                if (!ReadAt(sourceFd, buffer, chunkSize, offset))
+                {
+                    Log_Error("Cannot read delta source %s at %llu", sourcePath, (unsigned long long)offset);
+                    goto done;
+                }
+                offset += chunkSize;
+            }
+            else if (type == ADUC_DELTA_RECORD_DATA && fread(buffer, 1, chunkSize, delta) != chunkSize)
+            {
+                Log_Error("Truncated delta file %s", deltaPath);
+                goto done;
+            }
+
+            if (fwrite(buffer, 1, chunkSize, target) != chunkSize)
+            {
+                Log_Error("Cannot write %s, errno: %d", targetPath, errno);
+                goto done;
+            }
+
+            length -= chunkSize;
+            written += chunkSize;
+        }
+    }
+
+    if (fgetc(delta) != EOF)
+    {
+        Log_Error("Delta file %s has trailing data.", deltaPath);
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    if (target != NULL)
+    {
+        if (fclose(target) != 0)
+        {
+            succeeded = false;
+        }
+
+        if (!succeeded)
+        {
+            unlink(targetPath);
+        }
+    }
+
+    if (delta != NULL)
+    {
+        fclose(delta);
+    }
+
+    if (sourceFd != -1)
+    {
+        close(sourceFd);
+    }
+
+    free(buffer);
+    return succeeded;
+}
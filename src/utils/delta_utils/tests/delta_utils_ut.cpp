@@ -0,0 +1,176 @@
+/**
+ * @file delta_utils_ut.cpp
+ * @brief Unit Tests for delta_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+
+#include "aduc/delta_utils.h"
+#include "aduc/hash_utils.h"
+#include "aduc/system_utils.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+/**
+ * @brief Builds a delta file in memory.
+ */
+class DeltaBuilder
+{
+public:
+    DeltaBuilder(uint64_t sourceSize, uint64_t targetSize)
+    {
+        _delta.append("ADUDELTA");
+        AppendLittleEndian(1, 4);
+        AppendLittleEndian(0, 4);
+        AppendLittleEndian(sourceSize, 8);
+        AppendLittleEndian(targetSize, 8);
+    }
+
+    DeltaBuilder& Copy(uint64_t offset, uint64_t length)
+    {
+        AppendLittleEndian(ADUC_DELTA_RECORD_COPY, 1);
+        AppendLittleEndian(offset, 8);
+        AppendLittleEndian(length, 8);
+        return *this;
+    }
+
+    DeltaBuilder& Data(const std::string& data)
+    {
+        AppendLittleEndian(ADUC_DELTA_RECORD_DATA, 1);
+        AppendLittleEndian(data.size(), 8);
+        _delta.append(data);
+        return *this;
+    }
+
+    DeltaBuilder& Zero(uint64_t length)
+    {
+        AppendLittleEndian(ADUC_DELTA_RECORD_ZERO, 1);
+        AppendLittleEndian(length, 8);
+        return *this;
+    }
+
+    const std::string& str() const
+    {
+        return _delta;
+    }
+
+private:
+    void AppendLittleEndian(uint64_t value, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            _delta.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    }
+
+    std::string _delta;
+};
+
+static void WriteFile(const std::string& path, const std::string& content)
+{
+    std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+    file << content;
+}
+
+static std::string ReadFile(const std::string& path)
+{
+    std::ifstream file{ path, std::ios::binary };
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+static std::string GetSha256(const std::string& path)
+{
+    char* hash = nullptr;
+    REQUIRE(ADUC_HashUtils_GetFileHash(path.c_str(), SHA256, &hash));
+    std::string result{ hash };
+    free(hash); // NOLINT(cppcoreguidelines-no-malloc)
+    return result;
+}
+
+TEST_CASE("ADUC_DeltaUtils_ApplyDelta")
+{
+    const std::string testFolder{ std::string{ ADUC_SystemUtils_GetTemporaryPathName() } + "/delta_utils_ut" };
+    const std::string sourcePath{ testFolder + "/source" };
+    const std::string deltaPath{ testFolder + "/delta" };
+    const std::string targetPath{ testFolder + "/target" };
+
+    ADUC_SystemUtils_RmDirRecursive(testFolder.c_str());
+    REQUIRE(ADUC_SystemUtils_MkDirRecursiveDefault(testFolder.c_str()) == 0);
+
+    // The source is a 10 byte image followed by unrelated bytes, like a partition bigger than its file system.
+    WriteFile(sourcePath, "0123456789");
+    const std::string sourceHash{ GetSha256(sourcePath) };
+    WriteFile(sourcePath, "0123456789garbage");
+
+    SECTION("Reconstructs the target")
+    {
+        WriteFile(deltaPath, DeltaBuilder{ 10, 12 }.Copy(5, 5).Data("ab").Zero(2).Copy(0, 3).str());
+
+        CHECK(ADUC_DeltaUtils_ApplyDelta(
+            sourcePath.c_str(), sourceHash.c_str(), SHA256, deltaPath.c_str(), targetPath.c_str()));
+        CHECK(ReadFile(targetPath) == std::string("56789ab\0\0" "012", 12));
+    }
+
+    SECTION("Source mismatch")
+    {
+        WriteFile(sourcePath, "0123456780");
+        WriteFile(deltaPath, DeltaBuilder{ 10, 2 }.Data("ab").str());
+
+        CHECK_FALSE(ADUC_DeltaUtils_ApplyDelta(
+            sourcePath.c_str(), sourceHash.c_str(), SHA256, deltaPath.c_str(), targetPath.c_str()));
+        CHECK_FALSE(SystemUtils_IsFile(targetPath.c_str()));
+    }
+
+    SECTION("Copy outside of the source image")
+    {
+        WriteFile(deltaPath, DeltaBuilder{ 10, 4 }.Copy(8, 4).str());
+
+        CHECK_FALSE(ADUC_DeltaUtils_ApplyDelta(
+            sourcePath.c_str(), sourceHash.c_str(), SHA256, deltaPath.c_str(), targetPath.c_str()));
+        CHECK_FALSE(SystemUtils_IsFile(targetPath.c_str()));
+    }
+
+    SECTION("Records longer than the target")
+    {
+        WriteFile(deltaPath, DeltaBuilder{ 10, 2 }.Data("abc").str());
+
+        CHECK_FALSE(ADUC_DeltaUtils_ApplyDelta(
+            sourcePath.c_str(), sourceHash.c_str(), SHA256, deltaPath.c_str(), targetPath.c_str()));
+    }
+
+    SECTION("Truncated delta")
+    {
+        const std::string delta{ DeltaBuilder{ 10, 4 }.Data("abcd").str() };
+        WriteFile(deltaPath, delta.substr(0, delta.size() - 1));
+
+        CHECK_FALSE(ADUC_DeltaUtils_ApplyDelta(
+            sourcePath.c_str(), sourceHash.c_str(), SHA256, deltaPath.c_str(), targetPath.c_str()));
+        CHECK_FALSE(SystemUtils_IsFile(targetPath.c_str()));
+    }
+
+    SECTION("Trailing data")
+    {
+        WriteFile(deltaPath, DeltaBuilder{ 10, 2 }.Data("ab").Zero(0).str());
+
+        CHECK_FALSE(ADUC_DeltaUtils_ApplyDelta(
+            sourcePath.c_str(), sourceHash.c_str(), SHA256, deltaPath.c_str(), targetPath.c_str()));
+    }
+
+    SECTION("Not a delta file")
+    {
+        WriteFile(deltaPath, "not a delta file at all, just text");
+
+        CHECK_FALSE(ADUC_DeltaUtils_ApplyDelta(
+            sourcePath.c_str(), sourceHash.c_str(), SHA256, deltaPath.c_str(), targetPath.c_str()));
+    }
+
+    ADUC_SystemUtils_RmDirRecursive(testFolder.c_str());
+}
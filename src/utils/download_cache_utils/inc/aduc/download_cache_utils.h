@@ -0,0 +1,87 @@
+/**
+ * @file download_cache_utils.h
+ * @brief Utilities for the content-addressed store of downloaded files, shared across workflows.
+ *
+ * Files are stored by hash, so a retried or re-targeted deployment that needs the same content
+ * can get it from the cache instead of downloading it again.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_DOWNLOAD_CACHE_UTILS_H
+#define ADUC_DOWNLOAD_CACHE_UTILS_H
+
+#include <aduc/c_utils.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Creates @p targetPath with the content of @p sourcePath, using a hard link when possible, else a reflink
+ * or a copy.
+ * @param sourcePath The existing file.
+ * @param targetPath The file to create. Must not exist.
+ * @returns True on success.
+ */
+_Bool ADUC_DownloadCache_LinkOrCopyFile(const char* sourcePath, const char* targetPath);
+
+/**
+ * @brief Places the cached file with the specified hash at @p targetPath.
+ * The file is hard linked when possible, else reflinked or copied.
+ * @param cacheFolder The cache folder.
+ * @param hashType The hash algorithm name, e.g. "sha256".
+ * @param hashBase64 The base64 encoded hash of the file content.
+ * @param targetPath The path to place the file at. Must not exist.
+ * @returns True if the file was in the cache and is now at @p targetPath.
+ */
+_Bool ADUC_DownloadCache_GetFile(
+    const char* cacheFolder, const char* hashType, const char* hashBase64, const char* targetPath);
+
+/**
+ * @brief Checks whether the file with the specified hash is cached on the file system of @p targetFolder, so that
+ * ADUC_DownloadCache_GetFile places it there with a hard link, without taking up disk space.
+ * @param cacheFolder The cache folder.
+ * @param hashType The hash algorithm name, e.g. "sha256".
+ * @param hashBase64 The base64 encoded hash of the file content.
+ * @param targetFolder The folder the file would be placed in.
+ * @returns True if the file is cached on the file system of @p targetFolder.
+ */
+_Bool ADUC_DownloadCache_CanLinkFile(
+    const char* cacheFolder, const char* hashType, const char* hashBase64, const char* targetFolder);
+
+/**
+ * @brief Adds the file at @p sourcePath to the cache, then evicts the least recently used files
+ * until the cache fits in @p maxSizeInBytes.
+ * @param cacheFolder The cache folder. Created if it doesn't exist.
+ * @param hashType The hash algorithm name, e.g. "sha256".
+ * @param hashBase64 The base64 encoded hash of the file content. The caller must have validated it.
+ * @param sourcePath The path to the file.
+ * @param maxSizeInBytes The maximum total size of the cache.
+ * @returns True if the file is in the cache.
+ */
+_Bool ADUC_DownloadCache_AddFile(
+    const char* cacheFolder,
+    const char* hashType,
+    const char* hashBase64,
+    const char* sourcePath,
+    uint64_t maxSizeInBytes);
+
+/**
+ * @brief Removes the file with the specified hash from the cache, e.g. because it's corrupted.
+ * @param cacheFolder The cache folder.
+ * @param hashType The hash algorithm name, e.g. "sha256".
+ * @param hashBase64 The base64 encoded hash of the file content.
+ */
+void ADUC_DownloadCache_RemoveFile(const char* cacheFolder, const char* hashType, const char* hashBase64);
+
+/**
+ * @brief Removes the least recently used files until the cache fits in @p maxSizeInBytes.
+ * @param cacheFolder The cache folder.
+ * @param maxSizeInBytes The maximum total size of the cache.
+ */
+void ADUC_DownloadCache_Evict(const char* cacheFolder, uint64_t maxSizeInBytes);
+
+EXTERN_C_END
+
+#endif // ADUC_DOWNLOAD_CACHE_UTILS_H
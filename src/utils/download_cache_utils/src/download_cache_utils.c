@@ -0,0 +1,558 @@
+/**
+ * @file download_cache_utils.c
+ * @brief Implements the content-addressed store of downloaded files.
+ *
+ * Each cache entry is a regular file named after the hash of its content. Entries are placed into
+ * the work folder with a hard link when the cache and the work folder share a filesystem, with a
+ * reflink on filesystems that support it, and with a copy otherwise.
+ * The last use time of an entry, used for LRU eviction, is the modification time of a file of its own next to it, since
+ * a hard linked entry shares its times with the files linked to it.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/download_cache_utils.h"
+#include "aduc/logging.h"
+#include "aduc/string_c_utils.h" // for ADUC_StringFormat, IsNullOrEmpty
+#include "aduc/system_utils.h" // for ADUC_SystemUtils_MkDirRecursiveDefault
+
+#include <ctype.h> // for tolower
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h> // for pthread_self
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#    include <linux/fs.h> // for FICLONE
+#endif
+
+/**
+ * @brief Suffix of the files being added to the cache. These are never served or evicted.
+ */
+#define ADUC_DOWNLOAD_CACHE_TEMP_SUFFIX ".tmp"
+
+/**
+ * @brief Suffix of the file whose modification time is the last use time of the entry it's named after.
+ */
+#define ADUC_DOWNLOAD_CACHE_LAST_USE_SUFFIX ".lastuse"
+
+/**
+ * @brief Size of the buffer used to copy a file when it can't be linked.
+ */
+#define ADUC_DOWNLOAD_CACHE_COPY_BUFFER_SIZE (64 * 1024)
+
+/**
+ * @brief Returns the path of the cache entry for the specified hash.
+ * The hash is made filename safe by mapping the base64 alphabet to the base64url alphabet.
+ * @param cacheFolder The cache folder.
+ * @param hashType The hash algorithm name.
+ * @param hashBase64 The base64 encoded hash.
+ * @returns The path, or NULL on failure. Caller must free().
+ */
+static char* GetEntryPath(const char* cacheFolder, const char* hashType, const char* hashBase64)
+{
+    char* entryPath = NULL;
+    char* entryName = NULL;
+    size_t nameLen = 0;
+
+    if (IsNullOrEmpty(cacheFolder) || IsNullOrEmpty(hashType) || IsNullOrEmpty(hashBase64))
+    {
+        goto done;
+    }
+
+    entryName = malloc(strlen(hashType) + 1 + strlen(hashBase64) + 1);
+    if (entryName == NULL)
+    {
+        goto done;
+    }
+
+    for (const char* p = hashType; *p != '\0'; ++p)
+    {
+        if (*p == '/' || *p == '.')
+        {
+            goto done;
+        }
+        entryName[nameLen++] = (char)tolower((unsigned char)*p);
+    }
+
+    entryName[nameLen++] = '-';
+
+    for (const char* p = hashBase64; *p != '\0' && *p != '='; ++p)
+    {
+        switch (*p)
+        {
+        case '/':
+            entryName[nameLen++] = '_';
+            break;
+        case '+':
+            entryName[nameLen++] = '-';
+            break;
+        default:
+            entryName[nameLen++] = *p;
+            break;
+        }
+    }
+
+    entryName[nameLen] = '\0';
+
+    entryPath = ADUC_StringFormat("%s/%s", cacheFolder, entryName);
+
+done:
+    free(entryName);
+    return entryPath;
+}
+
+/**
+ * @brief Returns whether @p name ends with @p suffix, and has more to it.
+ */
+static _Bool HasSuffix(const char* name, const char* suffix)
+{
+    const size_t nameLen = strlen(name);
+    const size_t suffixLen = strlen(suffix);
+    return nameLen > suffixLen && strcmp(name + nameLen - suffixLen, suffix) == 0;
+}
+
+/**
+ * @brief Marks the entry at @p entryPath as used now, see ADUC_DOWNLOAD_CACHE_LAST_USE_SUFFIX. Best effort: without
+ * the mark, the modification time of the entry counts.
+ */
+static void MarkEntryUsed(const char* entryPath)
+{
+    char* lastUsePath = ADUC_StringFormat("%s" ADUC_DOWNLOAD_CACHE_LAST_USE_SUFFIX, entryPath);
+    const int fd = (lastUsePath == NULL)
+        ? -1
+        : open(lastUsePath, O_WRONLY | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+
+    if (fd == -1 || futimens(fd, NULL) != 0)
+    {
+        Log_Debug("Cannot update the use time of %s, errno: %d", entryPath, errno);
+    }
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    free(lastUsePath);
+}
+
+/**
+ * @brief Removes the entry at @p entryPath, and its last use mark.
+ * @returns True if the entry was removed.
+ */
+static _Bool RemoveEntry(const char* entryPath)
+{
+    char* lastUsePath = ADUC_StringFormat("%s" ADUC_DOWNLOAD_CACHE_LAST_USE_SUFFIX, entryPath);
+    const _Bool removed = unlink(entryPath) == 0;
+
+    if (lastUsePath != NULL)
+    {
+        unlink(lastUsePath);
+        free(lastUsePath);
+    }
+
+    return removed;
+}
+
+/**
+ * @brief Copies @p sourcePath into the new file @p targetPath, with a reflink when possible.
+ * @param sourcePath The file to copy.
+ * @param targetPath The file to create.
+ * @returns True on success.
+ */
+static _Bool CopyFile(const char* sourcePath, const char* targetPath)
+{
+    _Bool succeeded = false;
+    int sourceFd = -1;
+    int targetFd = -1;
+    char* buffer = NULL;
+
+    sourceFd = open(sourcePath, O_RDONLY | O_CLOEXEC);
+    if (sourceFd == -1)
+    {
+        goto done;
+    }
+
+    targetFd = open(targetPath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+    if (targetFd == -1)
+    {
+        goto done;
+    }
+
+#ifdef FICLONE
+    if (ioctl(targetFd, FICLONE, sourceFd) == 0)
+    {
+        succeeded = true;
+        goto done;
+    }
+#endif
+
+    buffer = malloc(ADUC_DOWNLOAD_CACHE_COPY_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        goto done;
+    }
+
+    for (;;)
+    {
+        ssize_t readSize = read(sourceFd, buffer, ADUC_DOWNLOAD_CACHE_COPY_BUFFER_SIZE);
+        if (readSize == 0)
+        {
+            break;
+        }
+
+        if (readSize < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            goto done;
+        }
+
+        for (ssize_t written = 0; written < readSize;)
+        {
+            ssize_t writeSize = write(targetFd, buffer + written, (size_t)(readSize - written));
+            if (writeSize < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                goto done;
+            }
+            written += writeSize;
+        }
+    }
+
+    succeeded = true;
+
+done:
+    free(buffer);
+
+    if (sourceFd != -1)
+    {
+        close(sourceFd);
+    }
+
+    if (targetFd != -1)
+    {
+        if (close(targetFd) != 0)
+        {
+            succeeded = false;
+        }
+
+        if (!succeeded)
+        {
+            unlink(targetPath);
+        }
+    }
+
+    return succeeded;
+}
+
+_Bool ADUC_DownloadCache_LinkOrCopyFile(const char* sourcePath, const char* targetPath)
+{
+    if (link(sourcePath, targetPath) == 0)
+    {
+        return true;
+    }
+
+    if (errno == EEXIST)
+    {
+        return false;
+    }
+
+    // Typically EXDEV, when the cache and the target are on different filesystems.
+    return CopyFile(sourcePath, targetPath);
+}
+
+_Bool ADUC_DownloadCache_GetFile(
+    const char* cacheFolder, const char* hashType, const char* hashBase64, const char* targetPath)
+{
+    _Bool succeeded = false;
+    struct stat st;
+    char* entryPath = GetEntryPath(cacheFolder, hashType, hashBase64);
+
+    if (entryPath == NULL || IsNullOrEmpty(targetPath))
+    {
+        goto done;
+    }
+
+    if (stat(entryPath, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        goto done;
+    }
+
+    if (!ADUC_DownloadCache_LinkOrCopyFile(entryPath, targetPath))
+    {
+        Log_Warn("Cannot place cached file %s at %s, errno: %d", entryPath, targetPath, errno);
+        goto done;
+    }
+
+    MarkEntryUsed(entryPath);
+
+    Log_Info("Download cache hit: %s", entryPath);
+    succeeded = true;
+
+done:
+    free(entryPath);
+    return succeeded;
+}
+
+_Bool ADUC_DownloadCache_CanLinkFile(
+    const char* cacheFolder, const char* hashType, const char* hashBase64, const char* targetFolder)
+{
+    struct stat entrySt;
+    struct stat targetSt;
+    char* entryPath = GetEntryPath(cacheFolder, hashType, hashBase64);
+
+    const _Bool canLink = entryPath != NULL && !IsNullOrEmpty(targetFolder) && stat(entryPath, &entrySt) == 0
+        && S_ISREG(entrySt.st_mode) && stat(targetFolder, &targetSt) == 0 && entrySt.st_dev == targetSt.st_dev;
+
+    free(entryPath);
+    return canLink;
+}
+
+_Bool ADUC_DownloadCache_AddFile(
+    const char* cacheFolder,
+    const char* hashType,
+    const char* hashBase64,
+    const char* sourcePath,
+    uint64_t maxSizeInBytes)
+{
+    _Bool succeeded = false;
+    struct stat st;
+    char* tempPath = NULL;
+    char* entryPath = GetEntryPath(cacheFolder, hashType, hashBase64);
+
+    if (entryPath == NULL || IsNullOrEmpty(sourcePath))
+    {
+        goto done;
+    }
+
+    if (stat(sourcePath, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        goto done;
+    }
+
+    if ((uint64_t)st.st_size > maxSizeInBytes)
+    {
+        Log_Debug("%s is bigger than the download cache, not caching.", sourcePath);
+        goto done;
+    }
+
+    if (access(entryPath, F_OK) == 0)
+    {
+        MarkEntryUsed(entryPath);
+        succeeded = true;
+        goto done;
+    }
+
+    if (ADUC_SystemUtils_MkDirRecursiveDefault(cacheFolder) != 0)
+    {
+        Log_Warn("Cannot create download cache folder %s", cacheFolder);
+        goto done;
+    }
+
+    // Place the file under a unique temporary name first, so that a concurrent reader never sees
+    // a partially copied entry.
+    tempPath = ADUC_StringFormat(
+        "%s.%ld.%lu" ADUC_DOWNLOAD_CACHE_TEMP_SUFFIX,
+        entryPath,
+        (long)getpid(),
+        (unsigned long)pthread_self());
+    if (tempPath == NULL)
+    {
+        goto done;
+    }
+
+    if (!ADUC_DownloadCache_LinkOrCopyFile(sourcePath, tempPath))
+    {
+        Log_Warn("Cannot add %s to the download cache, errno: %d", sourcePath, errno);
+        goto done;
+    }
+
+    if (rename(tempPath, entryPath) != 0)
+    {
+        Log_Warn("Cannot rename %s to %s, errno: %d", tempPath, entryPath, errno);
+        unlink(tempPath);
+        goto done;
+    }
+
+    MarkEntryUsed(entryPath);
+
+    Log_Debug("Added %s to the download cache as %s", sourcePath, entryPath);
+    succeeded = true;
+
+    ADUC_DownloadCache_Evict(cacheFolder, maxSizeInBytes);
+
+done:
+    free(tempPath);
+    free(entryPath);
+    return succeeded;
+}
+
+void ADUC_DownloadCache_RemoveFile(const char* cacheFolder, const char* hashType, const char* hashBase64)
+{
+    char* entryPath = GetEntryPath(cacheFolder, hashType, hashBase64);
+
+    if (entryPath != NULL)
+    {
+        if (RemoveEntry(entryPath))
+        {
+            Log_Info("Removed %s from the download cache", entryPath);
+        }
+        free(entryPath);
+    }
+}
+
+/**
+ * @brief A cache entry considered for eviction.
+ */
+typedef struct tagADUC_DownloadCacheEntry
+{
+    char* path; /**< Path of the entry. */
+    uint64_t size; /**< Size of the entry, in bytes. */
+    struct timespec lastUsed; /**< Last use time of the entry. */
+} ADUC_DownloadCacheEntry;
+
+/**
+ * @brief Orders cache entries from the least to the most recently used.
+ */
+static int CompareEntriesByLastUse(const void* a, const void* b)
+{
+    const ADUC_DownloadCacheEntry* entryA = (const ADUC_DownloadCacheEntry*)a;
+    const ADUC_DownloadCacheEntry* entryB = (const ADUC_DownloadCacheEntry*)b;
+
+    if (entryA->lastUsed.tv_sec != entryB->lastUsed.tv_sec)
+    {
+        return entryA->lastUsed.tv_sec < entryB->lastUsed.tv_sec ? -1 : 1;
+    }
+
+    if (entryA->lastUsed.tv_nsec != entryB->lastUsed.tv_nsec)
+    {
+        return entryA->lastUsed.tv_nsec < entryB->lastUsed.tv_nsec ? -1 : 1;
+    }
+
+    return 0;
+}
+
+void ADUC_DownloadCache_Evict(const char* cacheFolder, uint64_t maxSizeInBytes)
+{
+    DIR* dir = NULL;
+    struct dirent* dirEntry = NULL;
+    ADUC_DownloadCacheEntry* entries = NULL;
+    size_t entryCount = 0;
+    size_t entryCapacity = 0;
+    uint64_t totalSize = 0;
+
+    if (IsNullOrEmpty(cacheFolder))
+    {
+        goto done;
+    }
+
+    dir = opendir(cacheFolder);
+    if (dir == NULL)
+    {
+        goto done;
+    }
+
+    while ((dirEntry = readdir(dir)) != NULL)
+    {
+        struct stat st;
+        struct stat lastUseSt;
+
+        if (dirEntry->d_name[0] == '.' || HasSuffix(dirEntry->d_name, ADUC_DOWNLOAD_CACHE_TEMP_SUFFIX))
+        {
+            continue;
+        }
+
+        // A last use mark is kept with its entry, and removed once the entry is gone.
+        if (HasSuffix(dirEntry->d_name, ADUC_DOWNLOAD_CACHE_LAST_USE_SUFFIX))
+        {
+            char* markPath = ADUC_StringFormat("%s/%s", cacheFolder, dirEntry->d_name);
+            if (markPath != NULL)
+            {
+                markPath[strlen(markPath) - strlen(ADUC_DOWNLOAD_CACHE_LAST_USE_SUFFIX)] = '\0';
+                if (access(markPath, F_OK) != 0 && errno == ENOENT)
+                {
+                    strcat(markPath, ADUC_DOWNLOAD_CACHE_LAST_USE_SUFFIX);
+                    unlink(markPath);
+                }
+                free(markPath);
+            }
+            continue;
+        }
+
+        char* path = ADUC_StringFormat("%s/%s", cacheFolder, dirEntry->d_name);
+        if (path == NULL)
+        {
+            goto done;
+        }
+
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            free(path);
+            continue;
+        }
+
+        if (entryCount == entryCapacity)
+        {
+            size_t newCapacity = entryCapacity == 0 ? 16 : entryCapacity * 2;
+            ADUC_DownloadCacheEntry* newEntries = realloc(entries, newCapacity * sizeof(*entries));
+            if (newEntries == NULL)
+            {
+                free(path);
+                goto done;
+            }
+            entries = newEntries;
+            entryCapacity = newCapacity;
+        }
+
+        entries[entryCount].path = path;
+        entries[entryCount].size = (uint64_t)st.st_size;
+        // The modification time of the entry itself, until it's first used.
+        char* lastUsePath = ADUC_StringFormat("%s" ADUC_DOWNLOAD_CACHE_LAST_USE_SUFFIX, path);
+        entries[entryCount].lastUsed =
+            (lastUsePath != NULL && stat(lastUsePath, &lastUseSt) == 0) ? lastUseSt.st_mtim : st.st_mtim;
+        free(lastUsePath);
+        ++entryCount;
+
+        totalSize += (uint64_t)st.st_size;
+    }
+
+    if (totalSize <= maxSizeInBytes)
+    {
+        goto done;
+    }
+
+    qsort(entries, entryCount, sizeof(*entries), CompareEntriesByLastUse);
+
+    for (size_t i = 0; i < entryCount && totalSize > maxSizeInBytes; ++i)
+    {
+        if (RemoveEntry(entries[i].path))
+        {
+            Log_Debug("Evicted %s from the download cache", entries[i].path);
+            totalSize -= entries[i].size;
+        }
+    }
+
+done:
+    for (size_t i = 0; i < entryCount; ++i)
+    {
+        free(entries[i].path);
+    }
+    free(entries);
+
+    if (dir != NULL)
+    {
+        closedir(dir);
+    }
+}
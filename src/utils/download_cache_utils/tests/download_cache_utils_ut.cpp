@@ -0,0 +1,209 @@
+/**
+ * @file download_cache_utils_ut.cpp
+ * @brief Unit Tests for download_cache_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+
+#include "aduc/download_cache_utils.h"
+#include "aduc/system_utils.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static std::string GetTestFolder()
+{
+    return std::string{ ADUC_SystemUtils_GetTemporaryPathName() } + "/download_cache_ut";
+}
+
+static void WriteFile(const std::string& path, const std::string& content)
+{
+    std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+    file << content;
+}
+
+static std::string ReadFile(const std::string& path)
+{
+    std::ifstream file{ path, std::ios::binary };
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+static void SetLastUsed(const std::string& path, time_t seconds)
+{
+    const struct timeval times[2] = { { seconds, 0 }, { seconds, 0 } };
+    REQUIRE(utimes(path.c_str(), times) == 0);
+}
+
+TEST_CASE("ADUC_DownloadCache_AddFile and ADUC_DownloadCache_GetFile")
+{
+    const std::string testFolder{ GetTestFolder() };
+    const std::string cacheFolder{ testFolder + "/cache" };
+    const std::string sourcePath{ testFolder + "/source" };
+    const std::string targetPath{ testFolder + "/target" };
+    const char* const hash = "ab+c/d==";
+
+    ADUC_SystemUtils_RmDirRecursive(testFolder.c_str());
+    REQUIRE(ADUC_SystemUtils_MkDirRecursiveDefault(testFolder.c_str()) == 0);
+    WriteFile(sourcePath, "content");
+
+    SECTION("Miss on an empty cache")
+    {
+        CHECK_FALSE(ADUC_DownloadCache_GetFile(cacheFolder.c_str(), "sha256", hash, targetPath.c_str()));
+        CHECK_FALSE(SystemUtils_IsFile(targetPath.c_str()));
+    }
+
+    SECTION("Hit after add")
+    {
+        REQUIRE(ADUC_DownloadCache_AddFile(cacheFolder.c_str(), "sha256", hash, sourcePath.c_str(), 1024));
+        CHECK(SystemUtils_IsFile((cacheFolder + "/sha256-ab-c_d").c_str()));
+
+        // The source can go away, e.g. when its work folder is cleaned up.
+        REQUIRE(ADUC_SystemUtils_RemoveFile(sourcePath.c_str()) == 0);
+
+        CHECK(ADUC_DownloadCache_GetFile(cacheFolder.c_str(), "SHA256", hash, targetPath.c_str()));
+        CHECK(ReadFile(targetPath) == "content");
+
+        CHECK_FALSE(ADUC_DownloadCache_GetFile(cacheFolder.c_str(), "sha1", hash, (targetPath + "2").c_str()));
+    }
+
+    SECTION("Can link a cached file into a folder of the same file system")
+    {
+        CHECK_FALSE(ADUC_DownloadCache_CanLinkFile(cacheFolder.c_str(), "sha256", hash, testFolder.c_str()));
+
+        REQUIRE(ADUC_DownloadCache_AddFile(cacheFolder.c_str(), "sha256", hash, sourcePath.c_str(), 1024));
+        CHECK(ADUC_DownloadCache_CanLinkFile(cacheFolder.c_str(), "sha256", hash, testFolder.c_str()));
+        CHECK_FALSE(ADUC_DownloadCache_CanLinkFile(cacheFolder.c_str(), "sha256", hash, "/proc"));
+        CHECK_FALSE(ADUC_DownloadCache_CanLinkFile(cacheFolder.c_str(), "sha1", hash, testFolder.c_str()));
+    }
+
+    SECTION("Leaves the times of the cached file alone")
+    {
+        // The entry is hard linked to the source, and to the targets it's placed at.
+        SetLastUsed(sourcePath, 1000);
+        REQUIRE(ADUC_DownloadCache_AddFile(cacheFolder.c_str(), "sha256", hash, sourcePath.c_str(), 1024));
+        REQUIRE(ADUC_DownloadCache_GetFile(cacheFolder.c_str(), "sha256", hash, targetPath.c_str()));
+
+        struct stat st = {};
+        REQUIRE(stat(sourcePath.c_str(), &st) == 0);
+        CHECK(st.st_mtime == 1000);
+        REQUIRE(stat(targetPath.c_str(), &st) == 0);
+        CHECK(st.st_mtime == 1000);
+
+        // The last use time is still known: an older entry is evicted first.
+        WriteFile(cacheFolder + "/sha256-old", "old!");
+        SetLastUsed(cacheFolder + "/sha256-old", 2000);
+        ADUC_DownloadCache_Evict(cacheFolder.c_str(), 7);
+        CHECK(SystemUtils_IsFile((cacheFolder + "/sha256-ab-c_d").c_str()));
+        CHECK_FALSE(SystemUtils_IsFile((cacheFolder + "/sha256-old").c_str()));
+
+        ADUC_DownloadCache_RemoveFile(cacheFolder.c_str(), "sha256", hash);
+        CHECK_FALSE(SystemUtils_IsFile((cacheFolder + "/sha256-ab-c_d.lastuse").c_str()));
+    }
+
+    SECTION("Does not overwrite the target")
+    {
+        REQUIRE(ADUC_DownloadCache_AddFile(cacheFolder.c_str(), "sha256", hash, sourcePath.c_str(), 1024));
+        WriteFile(targetPath, "other");
+
+        CHECK_FALSE(ADUC_DownloadCache_GetFile(cacheFolder.c_str(), "sha256", hash, targetPath.c_str()));
+        CHECK(ReadFile(targetPath) == "other");
+    }
+
+    SECTION("Remove")
+    {
+        REQUIRE(ADUC_DownloadCache_AddFile(cacheFolder.c_str(), "sha256", hash, sourcePath.c_str(), 1024));
+        ADUC_DownloadCache_RemoveFile(cacheFolder.c_str(), "sha256", hash);
+
+        CHECK_FALSE(ADUC_DownloadCache_GetFile(cacheFolder.c_str(), "sha256", hash, targetPath.c_str()));
+    }
+
+    SECTION("Files bigger than the cache are not added")
+    {
+        CHECK_FALSE(ADUC_DownloadCache_AddFile(cacheFolder.c_str(), "sha256", hash, sourcePath.c_str(), 3));
+        CHECK_FALSE(ADUC_DownloadCache_GetFile(cacheFolder.c_str(), "sha256", hash, targetPath.c_str()));
+    }
+
+    SECTION("Invalid hash type")
+    {
+        CHECK_FALSE(ADUC_DownloadCache_AddFile(cacheFolder.c_str(), "../x", hash, sourcePath.c_str(), 1024));
+    }
+
+    ADUC_SystemUtils_RmDirRecursive(testFolder.c_str());
+}
+
+TEST_CASE("ADUC_DownloadCache_LinkOrCopyFile")
+{
+    const std::string testFolder{ GetTestFolder() };
+    const std::string sourcePath{ testFolder + "/source" };
+    const std::string targetPath{ testFolder + "/target" };
+
+    ADUC_SystemUtils_RmDirRecursive(testFolder.c_str());
+    REQUIRE(ADUC_SystemUtils_MkDirRecursiveDefault(testFolder.c_str()) == 0);
+    WriteFile(sourcePath, "content");
+
+    CHECK(ADUC_DownloadCache_LinkOrCopyFile(sourcePath.c_str(), targetPath.c_str()));
+    CHECK(ReadFile(targetPath) == "content");
+
+    // The target is never overwritten.
+    CHECK_FALSE(ADUC_DownloadCache_LinkOrCopyFile(sourcePath.c_str(), targetPath.c_str()));
+    CHECK_FALSE(ADUC_DownloadCache_LinkOrCopyFile((testFolder + "/missing").c_str(), (targetPath + "2").c_str()));
+
+    ADUC_SystemUtils_RmDirRecursive(testFolder.c_str());
+}
+
+TEST_CASE("ADUC_DownloadCache_Evict")
+{
+    const std::string testFolder{ GetTestFolder() };
+    const std::string cacheFolder{ testFolder + "/cache" };
+
+    ADUC_SystemUtils_RmDirRecursive(testFolder.c_str());
+    REQUIRE(ADUC_SystemUtils_MkDirRecursiveDefault(cacheFolder.c_str()) == 0);
+
+    // Three 4 byte entries, "a" being the least recently used.
+    WriteFile(cacheFolder + "/sha256-a", "aaaa");
+    WriteFile(cacheFolder + "/sha256-b", "bbbb");
+    WriteFile(cacheFolder + "/sha256-c", "cccc");
+    WriteFile(cacheFolder + "/sha256-d.1.2.tmp", "dddddddd");
+    SetLastUsed(cacheFolder + "/sha256-a", 1000);
+    SetLastUsed(cacheFolder + "/sha256-b", 3000);
+    SetLastUsed(cacheFolder + "/sha256-c", 2000);
+
+    SECTION("Nothing is evicted under the quota")
+    {
+        ADUC_DownloadCache_Evict(cacheFolder.c_str(), 12);
+        CHECK(SystemUtils_IsFile((cacheFolder + "/sha256-a").c_str()));
+        CHECK(SystemUtils_IsFile((cacheFolder + "/sha256-b").c_str()));
+        CHECK(SystemUtils_IsFile((cacheFolder + "/sha256-c").c_str()));
+    }
+
+    SECTION("Least recently used entries are evicted first")
+    {
+        ADUC_DownloadCache_Evict(cacheFolder.c_str(), 5);
+        CHECK_FALSE(SystemUtils_IsFile((cacheFolder + "/sha256-a").c_str()));
+        CHECK(SystemUtils_IsFile((cacheFolder + "/sha256-b").c_str()));
+        CHECK_FALSE(SystemUtils_IsFile((cacheFolder + "/sha256-c").c_str()));
+
+        // Files being added are not entries yet.
+        CHECK(SystemUtils_IsFile((cacheFolder + "/sha256-d.1.2.tmp").c_str()));
+    }
+
+    SECTION("Getting a file marks it as used")
+    {
+        const std::string targetPath{ testFolder + "/target" };
+        REQUIRE(ADUC_DownloadCache_GetFile(cacheFolder.c_str(), "sha256", "a", targetPath.c_str()));
+
+        ADUC_DownloadCache_Evict(cacheFolder.c_str(), 8);
+        CHECK(SystemUtils_IsFile((cacheFolder + "/sha256-a").c_str()));
+        CHECK(SystemUtils_IsFile((cacheFolder + "/sha256-b").c_str()));
+        CHECK_FALSE(SystemUtils_IsFile((cacheFolder + "/sha256-c").c_str()));
+    }
+
+    ADUC_SystemUtils_RmDirRecursive(testFolder.c_str());
+}
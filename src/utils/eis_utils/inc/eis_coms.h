@@ -15,15 +15,34 @@
 
 EXTERN_C_BEGIN
 
+/**
+ * @brief Connections to the EIS services, kept open across requests
+ */
+typedef struct tagEISSession EISSession;
+
+/**
+ * @brief Creates a session, connecting to each EIS service with its first request
+ * @returns the session, or NULL when out of memory; destroy with EISSession_Destroy()
+ */
+EISSession* EISSession_Create(void);
+
+/**
+ * @brief Closes the connections of @p session and frees it
+ * @param session the session, or NULL
+ */
+void EISSession_Destroy(EISSession* session);
+
 /**
  * @brief Requests the identities from the EIS /identity/ URI
  * @details The identity response returns the hub hostname, device id, and key handle, Caller should de-allocate returned string using free()
+ * @param session the session whose connection to use, or NULL for a connection just for this request
  * @param timeoutMS max timeoutMS for the request in milliseconds
  * @returns A value of EISErr
  */
 // clang-format off
 // NOLINTNEXTLINE: clang-tidy doesn't like UMock macro expansions
 MOCKABLE_FUNCTION(, EISErr, RequestIdentitiesFromEIS,
+    EISSession*, session,
     unsigned int, timeoutMS,
     char**, responseBuffer)
 // clang-format on
@@ -31,6 +50,7 @@ MOCKABLE_FUNCTION(, EISErr, RequestIdentitiesFromEIS,
 /**
  * @brief Requests the signed form of @p deviceUri and @p expiry using @p keyHandle with a request timeoutMS of @p timeoutMS
  * @details Caller should de-allocate @p responseBuffer using free()
+ * @param session the session whose connection to use, or NULL for a connection just for this request
  * @param keyHandle the handle for the key to be used for signing @p deviceUri and @p expiry
  * @param uri the uri to be used in the signature
  * @param expiry the expiration time in string format
@@ -40,6 +60,7 @@ MOCKABLE_FUNCTION(, EISErr, RequestIdentitiesFromEIS,
 // clang-format off
 // NOLINTNEXTLINE: clang-tidy doesn't like UMock macro expansions
 MOCKABLE_FUNCTION(,EISErr,RequestSignatureFromEIS,
+    EISSession*, session,
     const char*, keyHandle,
     const char*, uri,
     const char*, expiry,
@@ -50,6 +71,7 @@ MOCKABLE_FUNCTION(,EISErr,RequestSignatureFromEIS,
 /**
  * @brief Requests the signature related to @p certId from EIS
  * @details Caller should de-allocate @p responseBuffer using free()
+ * @param[in] session the session whose connection to use, or NULL for a connection just for this request
  * @param[in] certId the identifier associated with the certificate being retrieved
  * @param[in] timeoutMS the timeout for the call
  * @param[out] responseBuffer ptr to the buffer which will hold the response from EIS
@@ -58,6 +80,7 @@ MOCKABLE_FUNCTION(,EISErr,RequestSignatureFromEIS,
 // clang-format off
 // NOLINTNEXTLINE(cppcoreguidelines-pro-type-cstyle-cast): clang-tidy doesn't like UMock macro expansions
 MOCKABLE_FUNCTION(,EISErr, RequestCertificateFromEIS,
+    EISSession*, session,
     const char*, certId,
     unsigned int, timeoutMS,
     char**, responseBuffer)
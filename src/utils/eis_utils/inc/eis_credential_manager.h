@@ -0,0 +1,56 @@
+/**
+ * @file eis_credential_manager.h
+ * @brief Provisions the IotHub connection information from the Edge Identity Service (EIS) on a background thread,
+ * and renews the SharedAccessSignature before it expires.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <aduc/adu_types.h>
+#include <aduc/c_utils.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef EIS_CREDENTIAL_MANAGER_H
+#    define EIS_CREDENTIAL_MANAGER_H
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Starts provisioning the connection information on a background thread.
+ * @details The identity and certificate responses are requested once and reused; renewing a SharedAccessSignature
+ * only asks the KeyService to sign the new expiry. A token is renewed when @p tokenLifetimeSecs is 80% elapsed. Failed
+ * requests are retried with a backoff.
+ * @param tokenLifetimeSecs the lifetime of the SharedAccessSignatures, in seconds
+ * @param timeoutMS the timeout in milliseconds for each call to EIS
+ * @returns true if the thread was started, or already runs
+ */
+_Bool EISCredentialManager_Start(time_t tokenLifetimeSecs, uint32_t timeoutMS);
+
+/**
+ * @brief Stops the background thread, and frees the connection information and cached responses.
+ */
+void EISCredentialManager_Stop(void);
+
+/**
+ * @brief Returns whether the background thread runs.
+ */
+_Bool EISCredentialManager_IsStarted(void);
+
+/**
+ * @brief Gets a copy of the latest connection information, when it is newer than @p knownGeneration.
+ * @details Waits up to @p waitMS until the first provisioning attempt completes. Caller is required to call
+ * ADUC_ConnectionInfo_DeAlloc() to deallocate @p info.
+ * @param knownGeneration the generation of the connection information the caller has, or 0 for none
+ * @param waitMS the maximum time to wait for the first provisioning attempt, in milliseconds
+ * @param[out] info the connection information
+ * @param[out] generation the generation of @p info, increased with every renewal
+ * @returns true if @p info was set; false if there's nothing newer, the first attempt failed or the wait timed out
+ */
+_Bool EISCredentialManager_GetConnectionInfo(
+    unsigned int knownGeneration, uint32_t waitMS, ADUC_ConnectionInfo* info, unsigned int* generation);
+
+EXTERN_C_END
+
+#endif
@@ -34,6 +34,39 @@ EXTERN_C_BEGIN
 EISUtilityResult RequestConnectionStringFromEISWithExpiry(
     const time_t expirySecsSinceEpoch, uint32_t timeoutMS, ADUC_ConnectionInfo* provisioningInfo);
 
+/**
+ * @brief The EIS responses that don't change when a SharedAccessSignature is renewed, and the connections to EIS
+ */
+typedef struct tagEISProvisioningCache
+{
+    char* identityResponse; /**< The response of the IdentityService, or NULL. */
+    char* certificateResponse; /**< The response of the CertService, or NULL. */
+    struct tagEISSession* session; /**< The connections to the EIS services, see eis_coms.h, or NULL. */
+} EISProvisioningCache;
+
+/**
+ * @brief Creates a connection string using the provisioned data within EIS, reusing the responses in @p cache
+ * @details Only the SharedAccessSignature is requested on every call. On failure, @p cache is cleared.
+ * Caller is required to call ADUC_ConnectionInfo_DeAlloc() to deallocate the ADUC_ConnectionInfo struct,
+ * and EISProvisioningCache_Clear() to free the responses in @p cache
+ * @param[in] expirySecsSinceEpoch the expiration time in seconds since the epoch for the token in the connection string
+ * @param[in] timeoutMS the timeoutMS in milliseconds for each call to EIS
+ * @param[in,out] cache the responses of earlier requests; filled in with the responses of this one
+ * @param[out] provisioningInfo pointer to the struct which will be initialized with the information for creating a connection to IotHub
+ * @returns the result of the request
+ */
+EISUtilityResult RequestConnectionStringFromEISWithCache(
+    const time_t expirySecsSinceEpoch,
+    uint32_t timeoutMS,
+    EISProvisioningCache* cache,
+    ADUC_ConnectionInfo* provisioningInfo);
+
+/**
+ * @brief Frees the responses held by @p cache, and closes its connections
+ * @param cache the cache to clear
+ */
+void EISProvisioningCache_Clear(EISProvisioningCache* cache);
+
 EXTERN_C_END
 
 #endif
@@ -248,75 +248,142 @@ static void on_eis_http_connected(void* callbackCtx, HTTP_CALLBACK_REASON connec
 }
 
 //
-// EIS Communication Functions
+// EIS Connections
 //
 
 /**
- * @brief Sends an EIS request to @p apiUriPath on @p udsSocketPath with content @p payload, times out after @p timeoutMS milliseconds
- * @details Caller must release @p responseBuffer with free()
- * @param udsSocketPath the path to the UDS socket on the machine
- * @param apiUriPath the API URI you are trying to send the request to which lives on @p udsSocketPath
- * @param payload an optional payload to be sent with the request to the @p apiUriPath , if NULL the request is a GET otherwise it is a POST
- * @param timeoutMS the timeoutMS for the request in milliseconds
- * @param responseBuffer the buffer that will be allocated by the function to hold the response
- * @returns Returns a value of EISErr
+ * @brief An HTTP connection to one of the EIS sockets
  */
-EISErr SendEISRequest(
-    const char* udsSocketPath,
-    const char* apiUriPath,
-    const char* payload,
-    unsigned int timeoutMS,
-    char** responseBuff)
+typedef struct tagEIS_CONNECTION
 {
-    EISErr result = EISErr_Failed;
+    const char* udsSocketPath; //!< The path of the socket, or NULL for an unused connection slot
+    HTTP_CLIENT_HANDLE clientHandle; //!< The HTTP client, or NULL if not connected
+    EIS_HTTP_WORKLOAD_CONTEXT workloadCtx; //!< Context of the request in progress; the callbacks refer to it
+} EIS_CONNECTION;
 
-    if (udsSocketPath == NULL || apiUriPath == NULL || responseBuff == NULL)
-    {
-        return EISErr_InvalidArg;
-    }
+/**
+ * @brief The number of EIS sockets: identity, key and certificate services
+ */
+#define EIS_SOCKET_COUNT 3
 
-    *responseBuff = NULL;
-    char* response = NULL;
-    const int port = 80;
-    size_t payloadLen = 0;
+/**
+ * @brief Open connections to the EIS sockets, reused across the requests of a session
+ */
+struct tagEISSession
+{
+    EIS_CONNECTION connections[EIS_SOCKET_COUNT];
+};
 
-    HTTP_HEADERS_HANDLE httpHeadersHandle = NULL;
+/**
+ * @brief Gets the milliseconds of a monotonic clock
+ */
+static unsigned long long GetMonotonicMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    HTTP_HEADERS_RESULT httpHeadersResult;
+    return (unsigned long long)now.tv_sec * 1000 + (unsigned long long)now.tv_nsec / 1000000;
+}
 
-    HTTP_CLIENT_RESULT clientResult;
-    HTTP_CLIENT_REQUEST_TYPE clientRequestType = HTTP_CLIENT_REQUEST_GET;
+/**
+ * @brief Closes @p connection, if open
+ * @param connection the connection to close
+ */
+static void CloseEISConnection(EIS_CONNECTION* connection)
+{
+    if (connection->clientHandle != NULL)
+    {
+        uhttp_client_close(connection->clientHandle, NULL, NULL);
+        uhttp_client_destroy(connection->clientHandle);
+        connection->clientHandle = NULL;
+    }
+}
+
+/**
+ * @brief Opens @p connection to @p udsSocketPath
+ * @param connection the connection to open, closed
+ * @param udsSocketPath the path to the UDS socket on the machine
+ * @returns Returns a value of EISErr
+ */
+static EISErr OpenEISConnection(EIS_CONNECTION* connection, const char* udsSocketPath)
+{
+    EISErr result = EISErr_Failed;
+    const int port = 80;
 
     SOCKETIO_CONFIG config = {};
     config.accepted_socket = NULL;
     config.hostname = udsSocketPath;
     config.port = port; // Check on this
 
-    EIS_HTTP_WORKLOAD_CONTEXT workloadCtx;
-    workloadCtx.continue_running = true;
-    workloadCtx.http_response = NULL;
-    workloadCtx.status = EISErr_Failed;
+    connection->udsSocketPath = udsSocketPath;
+    connection->workloadCtx.continue_running = true;
+    connection->workloadCtx.http_response = NULL;
+    connection->workloadCtx.status = EISErr_Failed;
 
-    HTTP_CLIENT_HANDLE clientHandle =
-        uhttp_client_create(socketio_get_interface_description(), &config, on_eis_http_error, &workloadCtx);
+    connection->clientHandle = uhttp_client_create(
+        socketio_get_interface_description(), &config, on_eis_http_error, &connection->workloadCtx);
 
-    if (clientHandle == NULL)
+    if (connection->clientHandle == NULL)
     {
         goto done;
     }
 
-    if (uhttp_client_set_option(clientHandle, OPTION_ADDRESS_TYPE, OPTION_ADDRESS_TYPE_DOMAIN_SOCKET)
+    if (uhttp_client_set_option(connection->clientHandle, OPTION_ADDRESS_TYPE, OPTION_ADDRESS_TYPE_DOMAIN_SOCKET)
         != HTTP_CLIENT_OK)
     {
         goto done;
     }
 
-    if (uhttp_client_open(clientHandle, udsSocketPath, 0, on_eis_http_connected, &workloadCtx) != HTTP_CLIENT_OK)
+    if (uhttp_client_open(connection->clientHandle, udsSocketPath, 0, on_eis_http_connected, &connection->workloadCtx)
+        != HTTP_CLIENT_OK)
     {
-        result = workloadCtx.status;
+        result = connection->workloadCtx.status;
         goto done;
     }
 
+    result = EISErr_Ok;
+
+done:
+
+    if (result != EISErr_Ok)
+    {
+        CloseEISConnection(connection);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Sends a request to @p apiUriPath over the open @p connection, times out after @p timeoutMS milliseconds
+ * @details Caller must release @p responseBuffer with free()
+ * @param connection the open connection
+ * @param apiUriPath the API URI you are trying to send the request to which lives on the socket of @p connection
+ * @param payload an optional payload to be sent with the request to the @p apiUriPath , if NULL the request is a GET otherwise it is a POST
+ * @param timeoutMS the timeoutMS for the request in milliseconds
+ * @param responseBuffer the buffer that will be allocated by the function to hold the response
+ * @returns Returns a value of EISErr
+ */
+static EISErr ExecuteEISRequest(
+    EIS_CONNECTION* connection, const char* apiUriPath, const char* payload, unsigned int timeoutMS, char** responseBuff)
+{
+    EISErr result = EISErr_Failed;
+
+    *responseBuff = NULL;
+    char* response = NULL;
+    size_t payloadLen = 0;
+
+    HTTP_HEADERS_HANDLE httpHeadersHandle = NULL;
+
+    HTTP_HEADERS_RESULT httpHeadersResult;
+
+    HTTP_CLIENT_RESULT clientResult;
+    HTTP_CLIENT_REQUEST_TYPE clientRequestType = HTTP_CLIENT_REQUEST_GET;
+
+    EIS_HTTP_WORKLOAD_CONTEXT* workloadCtx = &connection->workloadCtx;
+    workloadCtx->continue_running = true;
+    workloadCtx->http_response = NULL;
+    workloadCtx->status = EISErr_Failed;
+
     if (payload != NULL)
     {
         httpHeadersHandle = HTTPHeaders_Alloc();
@@ -337,29 +404,30 @@ EISErr SendEISRequest(
     }
 
     clientResult = uhttp_client_execute_request(
-        clientHandle,
+        connection->clientHandle,
         clientRequestType,
         apiUriPath,
         httpHeadersHandle,
         (const unsigned char*)payload,
         payloadLen,
         on_eis_http_recv,
-        &workloadCtx);
+        workloadCtx);
 
     if (clientResult != HTTP_CLIENT_OK)
     {
+        result = EISErr_ConnErr;
         goto done;
     }
 
-    time_t startTime = get_time(NULL);
+    const unsigned long long startTimeMs = GetMonotonicMs();
     bool timedOut = false;
 
     do
     {
-        uhttp_client_dowork(clientHandle);
-        timedOut = (difftime(get_time(NULL), startTime) > timeoutMS);
+        uhttp_client_dowork(connection->clientHandle);
+        timedOut = (GetMonotonicMs() - startTimeMs > timeoutMS);
 
-    } while (workloadCtx.continue_running == true && !timedOut);
+    } while (workloadCtx->continue_running == true && !timedOut);
 
     if (timedOut)
     {
@@ -367,14 +435,14 @@ EISErr SendEISRequest(
         goto done;
     }
 
-    if (workloadCtx.status != EISErr_Ok)
+    if (workloadCtx->status != EISErr_Ok)
     {
-        result = workloadCtx.status;
+        result = workloadCtx->status;
         goto done;
     }
 
     size_t responseLen = 0;
-    if (BUFFER_size(workloadCtx.http_response, &responseLen) != 0)
+    if (BUFFER_size(workloadCtx->http_response, &responseLen) != 0)
     {
         goto done;
     }
@@ -392,7 +460,7 @@ EISErr SendEISRequest(
         goto done;
     }
 
-    memcpy(response, BUFFER_u_char(workloadCtx.http_response), responseLen);
+    memcpy(response, BUFFER_u_char(workloadCtx->http_response), responseLen);
     response[responseLen] = '\0';
 
     result = EISErr_Ok;
@@ -402,12 +470,11 @@ done:
     // Cleanup
 
     HTTPHeaders_Free(httpHeadersHandle);
-    uhttp_client_close(clientHandle, NULL, NULL);
-    uhttp_client_destroy(clientHandle);
 
-    if (workloadCtx.http_response != NULL)
+    if (workloadCtx->http_response != NULL)
     {
-        BUFFER_delete(workloadCtx.http_response);
+        BUFFER_delete(workloadCtx->http_response);
+        workloadCtx->http_response = NULL;
     }
 
     if (result != EISErr_Ok)
@@ -421,18 +488,141 @@ done:
     return result;
 }
 
+//
+// EIS Sessions
+//
+
+EISSession* EISSession_Create(void)
+{
+    return (EISSession*)calloc(1, sizeof(EISSession));
+}
+
+void EISSession_Destroy(EISSession* session)
+{
+    if (session == NULL)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < EIS_SOCKET_COUNT; ++i)
+    {
+        CloseEISConnection(&session->connections[i]);
+    }
+
+    free(session);
+}
+
+/**
+ * @brief Gets the connection slot of @p session for @p udsSocketPath
+ * @returns the slot, or NULL if all are taken by other sockets
+ */
+static EIS_CONNECTION* EISSession_GetConnection(EISSession* session, const char* udsSocketPath)
+{
+    for (size_t i = 0; i < EIS_SOCKET_COUNT; ++i)
+    {
+        EIS_CONNECTION* connection = &session->connections[i];
+        if (connection->udsSocketPath == NULL || strcmp(connection->udsSocketPath, udsSocketPath) == 0)
+        {
+            return connection;
+        }
+    }
+
+    return NULL;
+}
+
+//
+// EIS Communication Functions
+//
+
+/**
+ * @brief Sends an EIS request to @p apiUriPath on @p udsSocketPath with content @p payload, times out after @p timeoutMS milliseconds
+ * @details With a @p session, the connection to @p udsSocketPath is kept open for the next request of the session. A
+ * request on a kept connection that the service closed meanwhile is retried once on a new connection.
+ * Caller must release @p responseBuffer with free()
+ * @param session the session whose connection to use, or NULL for a connection just for this request
+ * @param udsSocketPath the path to the UDS socket on the machine
+ * @param apiUriPath the API URI you are trying to send the request to which lives on @p udsSocketPath
+ * @param payload an optional payload to be sent with the request to the @p apiUriPath , if NULL the request is a GET otherwise it is a POST
+ * @param timeoutMS the timeoutMS for the request in milliseconds
+ * @param responseBuffer the buffer that will be allocated by the function to hold the response
+ * @returns Returns a value of EISErr
+ */
+EISErr SendEISRequest(
+    EISSession* session,
+    const char* udsSocketPath,
+    const char* apiUriPath,
+    const char* payload,
+    unsigned int timeoutMS,
+    char** responseBuff)
+{
+    EISErr result = EISErr_Failed;
+
+    if (udsSocketPath == NULL || apiUriPath == NULL || responseBuff == NULL)
+    {
+        return EISErr_InvalidArg;
+    }
+
+    *responseBuff = NULL;
+
+    EIS_CONNECTION requestConnection = { NULL, NULL };
+    EIS_CONNECTION* connection =
+        (session != NULL) ? EISSession_GetConnection(session, udsSocketPath) : &requestConnection;
+
+    if (connection == NULL)
+    {
+        return EISErr_InvalidArg;
+    }
+
+    const bool reused = connection->clientHandle != NULL;
+
+    if (!reused)
+    {
+        result = OpenEISConnection(connection, udsSocketPath);
+        if (result != EISErr_Ok)
+        {
+            goto done;
+        }
+    }
+
+    result = ExecuteEISRequest(connection, apiUriPath, payload, timeoutMS, responseBuff);
+
+    if (reused && (result == EISErr_ConnErr || result == EISErr_HTTPErr))
+    {
+        CloseEISConnection(connection);
+
+        result = OpenEISConnection(connection, udsSocketPath);
+        if (result != EISErr_Ok)
+        {
+            goto done;
+        }
+
+        result = ExecuteEISRequest(connection, apiUriPath, payload, timeoutMS, responseBuff);
+    }
+
+done:
+
+    // A connection in an unknown state isn't reused.
+    if (session == NULL || result != EISErr_Ok)
+    {
+        CloseEISConnection(connection);
+    }
+
+    return result;
+}
+
 /**
  * @brief Requests the identities from the EIS /identity/ URI
  * @details The identity response returns the hub hostname, device id, and key handle
  * Caller must release @p responseBuffer with free()
+ * @param session the session whose connection to use, or NULL
  * @param timeoutMS max timeoutMS for the request in milliseconds
  * @param responseBuffer the buffer that will be allocated by the function to hold the response
  * @returns Returns a value of EISErr
  */
-EISErr RequestIdentitiesFromEIS(unsigned int timeoutMS, char** responseBuffer)
+EISErr RequestIdentitiesFromEIS(EISSession* session, unsigned int timeoutMS, char** responseBuffer)
 {
-    EISErr result =
-        SendEISRequest(EIS_UDS_IDENTITY_SOCKET_PATH, EIS_IDENTITY_REQUEST_URI, NULL, timeoutMS, responseBuffer);
+    EISErr result = SendEISRequest(
+        session, EIS_UDS_IDENTITY_SOCKET_PATH, EIS_IDENTITY_REQUEST_URI, NULL, timeoutMS, responseBuffer);
 
     if (result != EISErr_Ok)
     {
@@ -447,6 +637,7 @@ done:
 /**
  * @brief Requests the signed form of @p deviceUri and @p expiry using @p keyHandle with a request timeoutMS of @p timeoutMS
  * @details Caller should de-allocate @p responseBuffer using free()
+ * @param session the session whose connection to use, or NULL
  * @param keyHandle the handle for the key to be used for signing @p deviceUri and @p expiry
  * @param uri the uri to be used in the signature
  * @param expiry the expiration time in string format
@@ -454,7 +645,12 @@ done:
  * @returns A value of EISErr
  */
 EISErr RequestSignatureFromEIS(
-    const char* keyHandle, const char* uri, const char* expiry, unsigned int timeoutMS, char** responseBuffer)
+    EISSession* session,
+    const char* keyHandle,
+    const char* uri,
+    const char* expiry,
+    unsigned int timeoutMS,
+    char** responseBuffer)
 {
     EISErr result = EISErr_Failed;
 
@@ -533,7 +729,8 @@ EISErr RequestSignatureFromEIS(
         goto done;
     }
 
-    result = SendEISRequest(EIS_UDS_SIGN_SOCKET_PATH, EIS_SIGN_REQUEST_URI, serializedPayload, timeoutMS, &response);
+    result = SendEISRequest(
+        session, EIS_UDS_SIGN_SOCKET_PATH, EIS_SIGN_REQUEST_URI, serializedPayload, timeoutMS, &response);
 
     if (result != EISErr_Ok)
     {
@@ -545,7 +742,7 @@ done:
 
     json_value_free(payloadValue);
 
-    free(serializedPayload);
+    json_free_serialized_string(serializedPayload);
 
     STRING_delete(encodedUriToSign);
 
@@ -565,12 +762,13 @@ done:
 /**
  * @brief Requests the signature related to @p certId from EIS
  * @details Caller should de-allocate @p responseBuffer using free()
+ * @param[in] session the session whose connection to use, or NULL
  * @param[in] certId the identifier associated with the certificate being retrieved
  * @param[in] timeoutMS the timeout for the call
  * @param[out] responseBuffer ptr to the buffer which will hold the response from EIS
  * @returns a value of EISErr
  */
-EISErr RequestCertificateFromEIS(const char* certId, unsigned int timeoutMS, char** responseBuffer)
+EISErr RequestCertificateFromEIS(EISSession* session, const char* certId, unsigned int timeoutMS, char** responseBuffer)
 {
     EISErr result = EISErr_Failed;
 
@@ -589,7 +787,7 @@ EISErr RequestCertificateFromEIS(const char* certId, unsigned int timeoutMS, cha
         goto done;
     }
 
-    result = SendEISRequest(EIS_UDS_CERT_SOCKET_PATH, requestURI, NULL, timeoutMS, responseBuffer);
+    result = SendEISRequest(session, EIS_UDS_CERT_SOCKET_PATH, requestURI, NULL, timeoutMS, responseBuffer);
 
     if (result != EISErr_Ok)
     {
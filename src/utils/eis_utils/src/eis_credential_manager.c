@@ -0,0 +1,282 @@
+/**
+ * @file eis_credential_manager.c
+ * @brief Implements the background provisioning and renewal of the IotHub connection information from EIS.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#include "eis_credential_manager.h"
+#include "eis_utils.h"
+#include <aduc/logging.h>
+#include <azure_c_shared_utility/crt_abstractions.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief The delay before retrying a failed provisioning attempt, doubled after every failure.
+ */
+#define EIS_CREDENTIAL_MIN_RETRY_DELAY_SECS 10
+
+/**
+ * @brief The maximum delay before retrying a failed provisioning attempt.
+ */
+#define EIS_CREDENTIAL_MAX_RETRY_DELAY_SECS (60 * 60)
+
+/**
+ * @brief The state of the credential manager. Guarded by mutex, except thread.
+ */
+typedef struct tagEISCredentialManager
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; /**< Signaled when an attempt completes, or stop is set. */
+    pthread_t thread;
+    _Bool started;
+    _Bool stop;
+
+    time_t tokenLifetimeSecs;
+    uint32_t timeoutMS;
+
+    ADUC_ConnectionInfo info; /**< The latest connection information. */
+    unsigned int generation; /**< The generation of info; 0 until the first attempt succeeded. */
+    unsigned int attempts; /**< The number of completed provisioning attempts. */
+} EISCredentialManager;
+
+static EISCredentialManager s_manager = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/**
+ * @brief Copies the strings of @p source into @p target.
+ * @returns true on success; on failure, @p target is deallocated.
+ */
+static _Bool CopyConnectionInfo(ADUC_ConnectionInfo* target, const ADUC_ConnectionInfo* source)
+{
+    memset(target, 0, sizeof(*target));
+
+    target->authType = source->authType;
+    target->connType = source->connType;
+
+    if ((source->connectionString != NULL
+         && mallocAndStrcpy_s(&target->connectionString, source->connectionString) != 0)
+        || (source->certificateString != NULL
+            && mallocAndStrcpy_s(&target->certificateString, source->certificateString) != 0)
+        || (source->opensslEngine != NULL && mallocAndStrcpy_s(&target->opensslEngine, source->opensslEngine) != 0)
+        || (source->opensslPrivateKey != NULL
+            && mallocAndStrcpy_s(&target->opensslPrivateKey, source->opensslPrivateKey) != 0))
+    {
+        ADUC_ConnectionInfo_DeAlloc(target);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Waits until @p seconds elapsed or stop is set. The mutex must be locked.
+ */
+static void WaitLocked(time_t seconds)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += seconds;
+
+    while (!s_manager.stop && pthread_cond_timedwait(&s_manager.cond, &s_manager.mutex, &deadline) == 0)
+    {
+    }
+}
+
+/**
+ * @brief Provisions the connection information, then renews it until stopped; the body of the manager's thread.
+ */
+static void* CredentialManagerThread(void* arg)
+{
+    UNREFERENCED_PARAMETER(arg);
+
+    EISProvisioningCache cache = { NULL, NULL, NULL };
+    time_t retryDelaySecs = EIS_CREDENTIAL_MIN_RETRY_DELAY_SECS;
+
+    pthread_mutex_lock(&s_manager.mutex);
+
+    while (!s_manager.stop)
+    {
+        const time_t tokenLifetimeSecs = s_manager.tokenLifetimeSecs;
+        const uint32_t timeoutMS = s_manager.timeoutMS;
+
+        // EIS is called without the lock, so that callers are never blocked by it.
+        pthread_mutex_unlock(&s_manager.mutex);
+
+        ADUC_ConnectionInfo info = {};
+        EISUtilityResult result =
+            RequestConnectionStringFromEISWithCache(time(NULL) + tokenLifetimeSecs, timeoutMS, &cache, &info);
+
+        pthread_mutex_lock(&s_manager.mutex);
+
+        s_manager.attempts++;
+
+        time_t delaySecs;
+        if (result.err != EISErr_Ok)
+        {
+            Log_Warn(
+                "Failed to provision a connection string from eis, Failed with error %s on service %s; retrying in %ld s",
+                EISErr_ErrToString(result.err),
+                EISService_ServiceToString(result.service),
+                (long)retryDelaySecs);
+
+            delaySecs = retryDelaySecs;
+            retryDelaySecs = (retryDelaySecs * 2 < EIS_CREDENTIAL_MAX_RETRY_DELAY_SECS)
+                ? retryDelaySecs * 2
+                : EIS_CREDENTIAL_MAX_RETRY_DELAY_SECS;
+        }
+        else
+        {
+            ADUC_ConnectionInfo_DeAlloc(&s_manager.info);
+            s_manager.info = info;
+            s_manager.generation++;
+
+            retryDelaySecs = EIS_CREDENTIAL_MIN_RETRY_DELAY_SECS;
+
+            // Only SharedAccessSignatures expire; certificate credentials are provisioned once.
+            delaySecs = (info.authType == ADUC_AuthType_SASToken) ? tokenLifetimeSecs - tokenLifetimeSecs / 5 : 0;
+
+            Log_Info("Provisioned connection information from eis, generation %u.", s_manager.generation);
+        }
+
+        pthread_cond_broadcast(&s_manager.cond);
+
+        if (delaySecs > 0)
+        {
+            WaitLocked(delaySecs);
+        }
+        else
+        {
+            while (!s_manager.stop)
+            {
+                pthread_cond_wait(&s_manager.cond, &s_manager.mutex);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&s_manager.mutex);
+
+    EISProvisioningCache_Clear(&cache);
+
+    return NULL;
+}
+
+_Bool EISCredentialManager_Start(time_t tokenLifetimeSecs, uint32_t timeoutMS)
+{
+    _Bool succeeded = false;
+
+    if (tokenLifetimeSecs <= 0 || timeoutMS == 0)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&s_manager.mutex);
+
+    if (s_manager.started)
+    {
+        succeeded = true;
+        goto done;
+    }
+
+    s_manager.stop = false;
+    s_manager.tokenLifetimeSecs = tokenLifetimeSecs;
+    s_manager.timeoutMS = timeoutMS;
+    s_manager.generation = 0;
+    s_manager.attempts = 0;
+
+    if (pthread_create(&s_manager.thread, NULL, CredentialManagerThread, NULL) != 0)
+    {
+        Log_Warn("Cannot start the eis credential thread.");
+        goto done;
+    }
+
+    s_manager.started = true;
+    succeeded = true;
+
+done:
+    pthread_mutex_unlock(&s_manager.mutex);
+    return succeeded;
+}
+
+void EISCredentialManager_Stop(void)
+{
+    pthread_mutex_lock(&s_manager.mutex);
+
+    if (!s_manager.started)
+    {
+        pthread_mutex_unlock(&s_manager.mutex);
+        return;
+    }
+
+    s_manager.stop = true;
+    pthread_cond_broadcast(&s_manager.cond);
+    pthread_mutex_unlock(&s_manager.mutex);
+
+    pthread_join(s_manager.thread, NULL);
+
+    pthread_mutex_lock(&s_manager.mutex);
+    ADUC_ConnectionInfo_DeAlloc(&s_manager.info);
+    s_manager.started = false;
+    pthread_mutex_unlock(&s_manager.mutex);
+}
+
+_Bool EISCredentialManager_IsStarted(void)
+{
+    pthread_mutex_lock(&s_manager.mutex);
+    _Bool started = s_manager.started;
+    pthread_mutex_unlock(&s_manager.mutex);
+
+    return started;
+}
+
+_Bool EISCredentialManager_GetConnectionInfo(
+    unsigned int knownGeneration, uint32_t waitMS, ADUC_ConnectionInfo* info, unsigned int* generation)
+{
+    _Bool succeeded = false;
+
+    if (info == NULL || generation == NULL)
+    {
+        return false;
+    }
+
+    memset(info, 0, sizeof(*info));
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += waitMS / 1000;
+    deadline.tv_nsec += (long)(waitMS % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&s_manager.mutex);
+
+    while (s_manager.started && !s_manager.stop && s_manager.attempts == 0)
+    {
+        if (pthread_cond_timedwait(&s_manager.cond, &s_manager.mutex, &deadline) != 0)
+        {
+            break;
+        }
+    }
+
+    if (s_manager.generation == 0 || s_manager.generation == knownGeneration)
+    {
+        goto done;
+    }
+
+    if (!CopyConnectionInfo(info, &s_manager.info))
+    {
+        goto done;
+    }
+
+    *generation = s_manager.generation;
+    succeeded = true;
+
+done:
+    pthread_mutex_unlock(&s_manager.mutex);
+    return succeeded;
+}
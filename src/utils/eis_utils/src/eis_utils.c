@@ -125,6 +125,7 @@
 
 /**
  * @brief Makes a call to the EIS KeyService to sign the @p resourceUri and builds a SharedAccessSignature
+ * @param session the session whose connection to the KeyService to use, or NULL
  * @param resourceUri the uri to be signed by the EIS KeyService
  * @param keyHandle the handle of the key to be used for signing
  * @param expirySecsSinceEpoch the expiration time for this SharedAccessSignature in Unix Epoch time
@@ -132,6 +133,7 @@
  * @returns a value of EISUtilityResult
  */
 EISUtilityResult BuildSharedAccessSignature(
+    EISSession* session,
     const char* resourceUri,
     const char* keyHandle,
     const time_t expirySecsSinceEpoch,
@@ -161,7 +163,8 @@ EISUtilityResult BuildSharedAccessSignature(
         goto done;
     }
 
-    EISErr keyServiceResult = RequestSignatureFromEIS(keyHandle, resourceUri, expiryStr, timeoutMS, &signResponseStr);
+    EISErr keyServiceResult =
+        RequestSignatureFromEIS(session, keyHandle, resourceUri, expiryStr, timeoutMS, &signResponseStr);
 
     if (keyServiceResult != EISErr_Ok)
     {
@@ -433,10 +436,59 @@ done:
  */
 EISUtilityResult RequestConnectionStringFromEISWithExpiry(
     const time_t expirySecsSinceEpoch, uint32_t timeoutMS, ADUC_ConnectionInfo* provisioningInfo)
+{
+    EISProvisioningCache cache = { NULL, NULL, NULL };
+
+    EISUtilityResult result =
+        RequestConnectionStringFromEISWithCache(expirySecsSinceEpoch, timeoutMS, &cache, provisioningInfo);
+
+    EISProvisioningCache_Clear(&cache);
+
+    return result;
+}
+
+/**
+ * @brief Frees the responses held by @p cache, so that the next request asks EIS again
+ * @param cache the cache to clear
+ */
+void EISProvisioningCache_Clear(EISProvisioningCache* cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    free(cache->identityResponse);
+    cache->identityResponse = NULL;
+
+    free(cache->certificateResponse);
+    cache->certificateResponse = NULL;
+
+    EISSession_Destroy(cache->session);
+    cache->session = NULL;
+}
+
+/**
+ * @brief Creates a connection string using the provisioned data within EIS, reusing the responses in @p cache
+ * @details Only the SharedAccessSignature, which embeds the expiry, is requested from EIS on every call. The identity
+ * and certificate responses are requested when @p cache doesn't hold them yet, and kept in it, like the connections to
+ * the EIS services. On failure, @p cache is cleared, so that a retry doesn't reuse a response that may be stale. Caller is required to call
+ * ADUC_ConnectionInfo_DeAlloc() to deallocate the ADUC_ConnectionInfo struct
+ * @param[in] expirySecsSinceEpoch the expiration time in seconds since the epoch for the token in the connection string
+ * @param[in] timeoutMS the timeoutMS in milliseconds for each call to EIS
+ * @param[in,out] cache the responses of earlier requests; filled in with the responses of this one
+ * @param[out] provisioningInfo the pointer to the struct which will be initialized with the information for creating a connection to IotHub using the EIS supported provisioning information
+ * @returns the result of the request
+ */
+EISUtilityResult RequestConnectionStringFromEISWithCache(
+    const time_t expirySecsSinceEpoch,
+    uint32_t timeoutMS,
+    EISProvisioningCache* cache,
+    ADUC_ConnectionInfo* provisioningInfo)
 {
     EISUtilityResult result = { EISErr_Failed, EISService_Utils };
 
-    if (provisioningInfo == NULL)
+    if (provisioningInfo == NULL || cache == NULL)
     {
         result.err = EISErr_InvalidArg;
         return result;
@@ -461,23 +513,30 @@ EISUtilityResult RequestConnectionStringFromEISWithExpiry(
     char* resourceUri = NULL;
     char* sharedSignatureStr = NULL;
 
-    char* identityResponseStr = NULL;
     JSON_Value* identityResponseJson = NULL;
 
-    char* certResponseStr = NULL;
     JSON_Value* certResponseJson = NULL;
     char* certString = NULL;
 
-    EISErr identityResult = RequestIdentitiesFromEIS(timeoutMS, &identityResponseStr);
+    // Without a session (out of memory), every request connects anew.
+    if (cache->session == NULL)
+    {
+        cache->session = EISSession_Create();
+    }
 
-    if (identityResult != EISErr_Ok)
+    if (cache->identityResponse == NULL)
     {
-        result.service = EISService_IdentityService;
-        result.err = identityResult;
-        goto done;
+        EISErr identityResult = RequestIdentitiesFromEIS(cache->session, timeoutMS, &cache->identityResponse);
+
+        if (identityResult != EISErr_Ok)
+        {
+            result.service = EISService_IdentityService;
+            result.err = identityResult;
+            goto done;
+        }
     }
 
-    identityResponseJson = json_parse_string(identityResponseStr);
+    identityResponseJson = json_parse_string(cache->identityResponse);
 
     if (identityResponseJson == NULL)
     {
@@ -582,8 +641,8 @@ EISUtilityResult RequestConnectionStringFromEISWithExpiry(
     {
         authType = ADUC_AuthType_SASToken;
 
-        result =
-            BuildSharedAccessSignature(resourceUri, keyHandle, expirySecsSinceEpoch, timeoutMS, &sharedSignatureStr);
+        result = BuildSharedAccessSignature(
+            cache->session, resourceUri, keyHandle, expirySecsSinceEpoch, timeoutMS, &sharedSignatureStr);
 
         if (result.err != EISErr_Ok)
         {
@@ -617,16 +676,20 @@ EISUtilityResult RequestConnectionStringFromEISWithExpiry(
             goto done;
         }
 
-        EISErr certResult = RequestCertificateFromEIS(certId, timeoutMS, &certResponseStr);
-
-        if (certResult != EISErr_Ok)
+        if (cache->certificateResponse == NULL)
         {
-            result.err = certResult;
-            result.service = EISService_CertService;
-            goto done;
+            EISErr certResult =
+                RequestCertificateFromEIS(cache->session, certId, timeoutMS, &cache->certificateResponse);
+
+            if (certResult != EISErr_Ok)
+            {
+                result.err = certResult;
+                result.service = EISService_CertService;
+                goto done;
+            }
         }
 
-        certResponseJson = json_parse_string(certResponseStr);
+        certResponseJson = json_parse_string(cache->certificateResponse);
 
         if (certResponseJson == NULL)
         {
@@ -674,12 +737,12 @@ done:
 
     json_value_free(identityResponseJson);
 
+    json_value_free(certResponseJson);
+
     free(resourceUri);
 
     free(sharedSignatureStr);
 
-    free(identityResponseStr);
-
     provisioningInfo->connectionString = connectionStr;
     provisioningInfo->certificateString = certString;
     provisioningInfo->opensslPrivateKey = keyHandlePtr;
@@ -697,6 +760,7 @@ done:
     if (!success)
     {
         ADUC_ConnectionInfo_DeAlloc(provisioningInfo);
+        EISProvisioningCache_Clear(cache);
     }
 
     return result;
@@ -15,6 +15,7 @@
 #include <cstring>
 #include <iostream>
 #include <sstream>
+#include <string>
 #include <string.h>
 #include <time.h>
 
@@ -131,17 +132,27 @@ static char* g_identityResp = nullptr;
 static char* g_signatureResp = nullptr;
 static char* g_certificateResp = nullptr;
 
-static EISErr MockHookRequestIdentitiesFromEIS(unsigned int timeoutMS, char** responseBuffer)
+static unsigned int g_identityRequestCount = 0;
+
+static EISErr MockHookRequestIdentitiesFromEIS(EISSession* session, unsigned int timeoutMS, char** responseBuffer)
 {
+    UNREFERENCED_PARAMETER(session);
     UNREFERENCED_PARAMETER(timeoutMS);
 
+    ++g_identityRequestCount;
     *responseBuffer = g_identityResp;
     return EISErr_Ok;
 }
 
 static EISErr MockHookRequestSignatureFromEIS(
-    const char* keyHandle, const char* deviceUri, const char* expiry, unsigned int timeoutMS, char** responseBuffer)
+    EISSession* session,
+    const char* keyHandle,
+    const char* deviceUri,
+    const char* expiry,
+    unsigned int timeoutMS,
+    char** responseBuffer)
 {
+    UNREFERENCED_PARAMETER(session);
     UNREFERENCED_PARAMETER(keyHandle);
     UNREFERENCED_PARAMETER(deviceUri);
     UNREFERENCED_PARAMETER(expiry);
@@ -151,8 +162,10 @@ static EISErr MockHookRequestSignatureFromEIS(
     return EISErr_Ok;
 }
 
-static EISErr MockHookRequestCertificateFromEIS(const char* certId, unsigned int timeoutMS, char** responseBuffer)
+static EISErr
+MockHookRequestCertificateFromEIS(EISSession* session, const char* certId, unsigned int timeoutMS, char** responseBuffer)
 {
+    UNREFERENCED_PARAMETER(session);
     UNREFERENCED_PARAMETER(certId);
     UNREFERENCED_PARAMETER(timeoutMS);
 
@@ -482,3 +495,67 @@ TEST_CASE_METHOD(GlobalMockHookTestCaseFixture, "RequestConnectionStringFromEISW
         ADUC_ConnectionInfo_DeAlloc(&outInfo);
     }
 }
+
+TEST_CASE_METHOD(GlobalMockHookTestCaseFixture, "RequestConnectionStringFromEISWithCache Functional Tests")
+{
+    SECTION("Renewing a SAS Token reuses the identity response")
+    {
+        const auto expiry = static_cast<time_t>(time(nullptr) + 86400); // Expiry is one day after the unit test is run
+        uint32_t timeout = 5000;
+
+        EISProvisioningCache cache = { nullptr, nullptr, nullptr };
+
+        // Note: g_identityResp is owned by the cache from the first request on.
+        REQUIRE(mallocAndStrcpy_s(&g_identityResp, validDeviceSasIdentityResponseStr) == 0);
+        REQUIRE(mallocAndStrcpy_s(&g_signatureResp, validSignatureResponseStr) == 0);
+        g_identityRequestCount = 0;
+
+        ADUC_ConnectionInfo outInfo = {
+            ADUC_AuthType_NotSet, ADUC_ConnType_NotSet, nullptr, nullptr, nullptr, nullptr
+        };
+
+        EISUtilityResult result = RequestConnectionStringFromEISWithCache(expiry, timeout, &cache, &outInfo);
+
+        REQUIRE(result.err == EISErr_Ok);
+        CHECK(cache.identityResponse != nullptr);
+        CHECK(g_identityRequestCount == 1);
+        ADUC_ConnectionInfo_DeAlloc(&outInfo);
+
+        // The signature response is freed by every request.
+        REQUIRE(mallocAndStrcpy_s(&g_signatureResp, validSignatureResponseStr) == 0);
+
+        result = RequestConnectionStringFromEISWithCache(expiry + 60, timeout, &cache, &outInfo);
+
+        REQUIRE(result.err == EISErr_Ok);
+        CHECK(g_identityRequestCount == 1);
+        CHECK(outInfo.authType == ADUC_AuthType_SASToken);
+        CHECK(std::string{ outInfo.connectionString }.find("se=" + std::to_string(expiry + 60)) != std::string::npos);
+
+        ADUC_ConnectionInfo_DeAlloc(&outInfo);
+        EISProvisioningCache_Clear(&cache);
+    }
+
+    SECTION("A failed request clears the cache")
+    {
+        const auto expiry = static_cast<time_t>(time(nullptr) + 86400); // Expiry is one day after the unit test is run
+        uint32_t timeout = 5000;
+
+        EISProvisioningCache cache = { nullptr, nullptr, nullptr };
+
+        REQUIRE(mallocAndStrcpy_s(&g_identityResp, validDeviceSasIdentityResponseStr) == 0);
+        REQUIRE(mallocAndStrcpy_s(&g_signatureResp, invalidSignatureResponseStr) == 0);
+
+        ADUC_ConnectionInfo outInfo = {
+            ADUC_AuthType_NotSet, ADUC_ConnType_NotSet, nullptr, nullptr, nullptr, nullptr
+        };
+
+        EISUtilityResult result = RequestConnectionStringFromEISWithCache(expiry, timeout, &cache, &outInfo);
+
+        CHECK(result.err != EISErr_Ok);
+        CHECK(outInfo.connectionString == nullptr);
+        CHECK(cache.identityResponse == nullptr);
+
+        ADUC_ConnectionInfo_DeAlloc(&outInfo);
+        EISProvisioningCache_Clear(&cache);
+    }
+}
@@ -0,0 +1,48 @@
+/**
+ * @file event_loop_utils.h
+ * @brief Wakes up the agent's main loop when there is work to do, so that it can otherwise sleep.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_EVENT_LOOP_UTILS_H
+#define ADUC_EVENT_LOOP_UTILS_H
+
+#include <aduc/c_utils.h>
+#include <limits.h>
+#include <stdbool.h>
+
+/**
+ * @brief The delay until the next DoWork of a component that only needs it after ADUC_EventLoop_Wakeup.
+ */
+#define ADUC_EVENT_LOOP_ON_DEMAND UINT_MAX
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Initializes the main loop wakeup event. Call once, before any other thread is started.
+ * @returns True on success. On failure, ADUC_EventLoop_Wait only sleeps.
+ */
+_Bool ADUC_EventLoop_Init(void);
+
+/**
+ * @brief Releases the main loop wakeup event.
+ */
+void ADUC_EventLoop_UnInit(void);
+
+/**
+ * @brief Wakes up the main loop, e.g. when a worker thread completed an operation.
+ * Safe to call from any thread and from signal handlers. Wakeups before the next wait are merged.
+ */
+void ADUC_EventLoop_Wakeup(void);
+
+/**
+ * @brief Waits until ADUC_EventLoop_Wakeup is called or @p timeoutMilliseconds elapse.
+ * @param timeoutMilliseconds The maximum time to wait.
+ * @returns True if woken up, false on timeout.
+ */
+_Bool ADUC_EventLoop_Wait(unsigned int timeoutMilliseconds);
+
+EXTERN_C_END
+
+#endif // ADUC_EVENT_LOOP_UTILS_H
@@ -0,0 +1,84 @@
+/**
+ * @file event_loop_utils.c
+ * @brief Implements the main loop wakeup event with an eventfd.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/event_loop_utils.h"
+#include "aduc/logging.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <time.h> // for nanosleep
+#include <unistd.h>
+
+/**
+ * @brief The wakeup eventfd, or -1 when not initialized.
+ */
+static int s_eventFd = -1;
+
+_Bool ADUC_EventLoop_Init(void)
+{
+    if (s_eventFd != -1)
+    {
+        return true;
+    }
+
+    s_eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (s_eventFd == -1)
+    {
+        Log_Error("Cannot create the main loop wakeup event, errno: %d", errno);
+        return false;
+    }
+
+    return true;
+}
+
+void ADUC_EventLoop_UnInit(void)
+{
+    if (s_eventFd != -1)
+    {
+        close(s_eventFd);
+        s_eventFd = -1;
+    }
+}
+
+void ADUC_EventLoop_Wakeup(void)
+{
+    const uint64_t increment = 1;
+    const int eventFd = s_eventFd;
+
+    // Only write(2) here, so this stays async-signal-safe.
+    // EAGAIN means the counter is saturated, so the loop is woken up anyway.
+    if (eventFd != -1)
+    {
+        ssize_t ignored = write(eventFd, &increment, sizeof(increment));
+        (void)ignored;
+    }
+}
+
+_Bool ADUC_EventLoop_Wait(unsigned int timeoutMilliseconds)
+{
+    struct pollfd pollFd = { .fd = s_eventFd, .events = POLLIN };
+    uint64_t count = 0;
+
+    if (s_eventFd == -1)
+    {
+        const struct timespec duration = { .tv_sec = timeoutMilliseconds / 1000,
+                                           .tv_nsec = (long)(timeoutMilliseconds % 1000) * 1000000L };
+        nanosleep(&duration, NULL);
+        return false;
+    }
+
+    // EINTR, e.g. from a shutdown signal, returns early like a wakeup; the handler also wakes us up.
+    if (poll(&pollFd, 1, (int)timeoutMilliseconds) <= 0)
+    {
+        return false;
+    }
+
+    // Reset the counter, merging all the wakeups so far.
+    return read(s_eventFd, &count, sizeof(count)) == sizeof(count);
+}
@@ -0,0 +1,54 @@
+/**
+ * @file event_loop_utils_ut.cpp
+ * @brief Unit Tests for event_loop_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+
+#include "aduc/event_loop_utils.h"
+
+#include <chrono>
+#include <thread>
+
+TEST_CASE("ADUC_EventLoop_Wait")
+{
+    REQUIRE(ADUC_EventLoop_Init());
+
+    SECTION("Times out without a wakeup")
+    {
+        CHECK_FALSE(ADUC_EventLoop_Wait(10));
+    }
+
+    SECTION("Wakeups before the wait are merged")
+    {
+        ADUC_EventLoop_Wakeup();
+        ADUC_EventLoop_Wakeup();
+
+        CHECK(ADUC_EventLoop_Wait(1000));
+        CHECK_FALSE(ADUC_EventLoop_Wait(10));
+    }
+
+    SECTION("Woken up from another thread")
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::thread worker{ []() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            ADUC_EventLoop_Wakeup();
+        } };
+
+        CHECK(ADUC_EventLoop_Wait(10000));
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+        worker.join();
+    }
+
+    ADUC_EventLoop_UnInit();
+
+    SECTION("Sleeps when not initialized")
+    {
+        ADUC_EventLoop_Wakeup();
+        CHECK_FALSE(ADUC_EventLoop_Wait(10));
+    }
+}
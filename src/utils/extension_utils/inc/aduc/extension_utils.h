@@ -21,6 +21,8 @@ _Bool RegisterUpdateContentHandler(const char* updateType, const char* handlerFi
 
 _Bool RegisterComponentEnumeratorExtension(const char* extensionFilePath);
 
+_Bool RegisterAdditionalComponentEnumeratorExtension(const char* enumeratorId, const char* extensionFilePath);
+
 _Bool RegisterContentDownloaderExtension(const char* extensionFilePath);
 
 _Bool RegisterExtension(const char* extensionDir, const char* extensionFilePath);
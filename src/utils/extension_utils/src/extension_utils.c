@@ -16,6 +16,7 @@
 #include <pwd.h> // for getpwnam
 #include <stdio.h> // for FILE
 #include <stdlib.h> // for calloc
+#include <string.h> // for strchr
 #include <strings.h> // for strcasecmp
 #include <sys/stat.h>
 
@@ -326,6 +327,37 @@ _Bool RegisterComponentEnumeratorExtension(const char* extensionFilePath)
     return RegisterExtension(ADUC_COMPONENT_ENUMERATOR_EXTENSION_DIR, extensionFilePath);
 }
 
+/**
+ * @brief Register an additional component enumerator extension, whose components are enumerated, in parallel, along
+ * with the ones of the other component enumerators.
+ * @param enumeratorId The id of the enumerator, the name of the subfolder it is registered in.
+ * @param extensionFilePath A full path to an extension to register.
+ * @return Returns true if the extension successfully registered.
+ */
+_Bool RegisterAdditionalComponentEnumeratorExtension(const char* enumeratorId, const char* extensionFilePath)
+{
+    _Bool success = false;
+    char* extensionDir = NULL;
+
+    if (IsNullOrEmpty(enumeratorId) || enumeratorId[0] == '.' || strchr(enumeratorId, '/') != NULL)
+    {
+        Log_Error("Invalid component enumerator id '%s'.", enumeratorId == NULL ? "" : enumeratorId);
+        goto done;
+    }
+
+    extensionDir = ADUC_StringFormat("%s/%s", ADUC_COMPONENT_ENUMERATOR_EXTENSION_DIR, enumeratorId);
+    if (extensionDir == NULL)
+    {
+        goto done;
+    }
+
+    success = RegisterExtension(extensionDir, extensionFilePath);
+
+done:
+    free(extensionDir);
+    return success;
+}
+
 /**
  * @brief Register a content downloader extension.
  * @param extensionFilePath A full path to an extension to register.
@@ -8,7 +8,9 @@
 #ifndef ADUC_HASH_UTILS_H
 #define ADUC_HASH_UTILS_H
 
+#include "aduc/arena.h"
 #include "aduc/c_utils.h"
+#include "aduc/types/download.h"
 #include "aduc/types/hash.h"
 
 #include "azure_c_shared_utility/sha.h" // for SHAversion
@@ -18,11 +20,141 @@
 
 EXTERN_C_BEGIN
 
+/**
+ * @brief State for computing a hash incrementally, e.g. as the bytes of a file arrive.
+ */
+typedef struct tagADUC_HashUtils_Context
+{
+    USHAContext shaContext; /**< The RFC 6234 SHA context, used when the accelerated backend is unavailable. */
+    void* evpContext; /**< The OpenSSL digest context (EVP_MD_CTX*) when the accelerated backend is in use, else NULL. */
+    SHAversion algorithm; /**< The hashing algorithm. */
+    _Bool kernelBackend; /**< True if the kernel crypto API computes the hash. */
+    int kernelSocket; /**< The AF_ALG operation socket when kernelBackend is true. */
+} ADUC_HashUtils_Context;
+
+/**
+ * @brief Benchmarks the hashing of the kernel crypto API (AF_ALG) against the software one for each algorithm, and
+ * selects it for the algorithms it hashes faster, e.g. on SoCs whose hash engine only the kernel drives.
+ * Takes a few hundred milliseconds where AF_ALG is available; until it is called, hashing is done in software.
+ * @returns True if the kernel hashes any algorithm faster.
+ */
+_Bool ADUC_HashUtils_SelectKernelBackend(void);
+
+/**
+ * @brief Gets the algorithms ADUC_HashUtils_SelectKernelBackend selected the kernel crypto API for.
+ * The agent exports this function, so that the copies of this library linked into extensions use its selection.
+ * @returns A mask with the bit (1 << algorithm) set for each selected SHAversion.
+ */
+unsigned int ADUC_HashUtils_GetKernelBackendAlgorithms(void);
+
+/**
+ * @brief Resets @p context to start computing a new hash.
+ * The kernel crypto API is used for the algorithms ADUC_HashUtils_SelectKernelBackend selected it for; otherwise the
+ * OpenSSL EVP digests are used when available, since they use the CPU's SHA extensions; otherwise falls back to the
+ * RFC 6234 implementation.
+ * @param context The hash context. If a previous hash wasn't finished with ADUC_HashUtils_ContextResult,
+ * call ADUC_HashUtils_ContextUnInit first.
+ * @param algorithm The hashing algorithm to use.
+ * @returns True on success.
+ */
+_Bool ADUC_HashUtils_ContextReset(ADUC_HashUtils_Context* context, SHAversion algorithm);
+
+/**
+ * @brief Releases the resources held by an unfinished hash computation.
+ * @param context The hash context. Must be zero-initialized or reset. Safe to call after ADUC_HashUtils_ContextResult.
+ */
+void ADUC_HashUtils_ContextUnInit(ADUC_HashUtils_Context* context);
+
+/**
+ * @brief Feeds the next chunk of data into the hash computation.
+ * @param context The hash context.
+ * @param buffer The data.
+ * @param bufferLen The length of @p buffer.
+ * @returns True on success.
+ */
+_Bool ADUC_HashUtils_ContextInput(ADUC_HashUtils_Context* context, const uint8_t* buffer, size_t bufferLen);
+
+/**
+ * @brief Feeds the whole content of the file at @p path into the hash computation.
+ * @param context The hash context.
+ * @param path The path to the file.
+ * @returns True on success.
+ */
+_Bool ADUC_HashUtils_ContextInputFile(ADUC_HashUtils_Context* context, const char* path);
+
+/**
+ * @brief Finishes the hash computation and compares the result to @p hashBase64.
+ * @param context The hash context. Must be reset before it's used again.
+ * @param hashBase64 The expected hash. If NULL, skip hashes comparison.
+ * @param outputHash An optional output buffer for computed hash. Caller must call free() when done.
+ * @returns True if the hash was computed and equals @p hashBase64.
+ */
+_Bool ADUC_HashUtils_ContextResult(ADUC_HashUtils_Context* context, const char* hashBase64, char** outputHash);
+
+/**
+ * @brief Finishes the hash computation and compares the result to @p expected. The digest that ADUC_Hash_Init decoded
+ * is compared directly, rather than encoding the result to compare it with the value of @p expected.
+ * @param context The hash context. Must be reset before it's used again.
+ * @param expected The expected hash, of the algorithm of @p context.
+ * @returns True if the hash was computed and equals @p expected.
+ */
+_Bool ADUC_HashUtils_ContextResultHash(ADUC_HashUtils_Context* context, const ADUC_Hash* expected);
+
 _Bool ADUC_HashUtils_IsValidFileHash(const char* path, const char* hashBase64, SHAversion algorithm);
 
+/**
+ * @brief Checks the file at @p path against all the hashes of @p hashArray, e.g. of a file entity, reading it once:
+ * each block read is fed to the hash of every algorithm.
+ * @param path The path to the file.
+ * @param hashArray The expected hashes of the file.
+ * @param hashCount The number of hashes in @p hashArray.
+ * @returns True if every hash is valid. False if any isn't, or is of an unsupported type.
+ */
+_Bool ADUC_HashUtils_IsValidFileHashes(const char* path, const ADUC_Hash* hashArray, size_t hashCount);
+
 _Bool ADUC_HashUtils_IsValidBufferHash(
     const uint8_t* buffer, size_t bufferLen, const char* hashBase64, SHAversion algorithm);
 
+/**
+ * @brief Verifies the consecutive chunks of the file at @p path against their hashes, on several threads at a time.
+ * @param path The path to the file.
+ * @param chunkSize The size of the chunks, in bytes. The last chunk may be shorter.
+ * @param chunkHashes The hashes of the chunks, in order.
+ * @param chunkCount The number of chunks.
+ * @param threadCount The most threads to hash on, or 0 for one per online CPU.
+ * @param chunkValid An optional array of @p chunkCount flags, set to whether each chunk is valid. Chunks that are past
+ * the end of the file are invalid.
+ * @returns True if the chunks cover the file exactly and are all valid.
+ */
+_Bool ADUC_HashUtils_VerifyFileChunks(
+    const char* path,
+    size_t chunkSize,
+    const ADUC_Hash* chunkHashes,
+    size_t chunkCount,
+    unsigned int threadCount,
+    _Bool* chunkValid);
+
+/**
+ * @brief Verifies the first @p size bytes of the file or block device at @p path against a root hash: the hash of
+ * the concatenated digests of its consecutive chunks, each hashed with @p algorithm. The chunks are hashed on several
+ * threads at a time, so e.g. an image written to a partition is verified without reading the whole partition, nor
+ * hashing it serially.
+ * @param path The path to the file or block device.
+ * @param size The size of the content to verify, in bytes. The file may be longer.
+ * @param chunkSize The size of the chunks, in bytes. The last chunk may be shorter.
+ * @param rootHashBase64 The expected root hash, base64 encoded.
+ * @param algorithm The algorithm of the chunk digests and of the root hash.
+ * @param threadCount The most threads to hash on, or 0 for one per online CPU.
+ * @returns True if the content could be read and its root hash is @p rootHashBase64.
+ */
+_Bool ADUC_HashUtils_IsValidChunkRootHash(
+    const char* path,
+    uint64_t size,
+    size_t chunkSize,
+    const char* rootHashBase64,
+    SHAversion algorithm,
+    unsigned int threadCount);
+
 _Bool ADUC_HashUtils_GetShaVersionForTypeString(const char* hashTypeStr, SHAversion* algorithm);
 
 _Bool ADUC_HashUtils_GetFileHash(const char* path, SHAversion algorithm, char** hash);
@@ -48,7 +180,8 @@ char* ADUC_HashUtils_GetHashType(const ADUC_Hash* hashArray, size_t arraySize, s
 char* ADUC_HashUtils_GetHashValue(const ADUC_Hash* hashArray, size_t arraySize, size_t index);
 
 /**
- * @brief Allocates the memory for the ADUC_Hash struct member values
+ * @brief Allocates the memory for the ADUC_Hash struct member values, and decodes the hash value once for the
+ * verifications to compare with.
  * @param hash A pointer to an ADUC_Hash struct whose member values will be allocated
  * @param hashValue The value of the hash
  * @param hashType The type of the hash
@@ -56,6 +189,17 @@ char* ADUC_HashUtils_GetHashValue(const ADUC_Hash* hashArray, size_t arraySize,
  */
 _Bool ADUC_Hash_Init(ADUC_Hash* hash, const char* hashValue, const char* hashType);
 
+/**
+ * @brief Same as ADUC_Hash_Init, but allocates the member values from @p arena. The hash must not be uninitialized
+ * nor freed with ADUC_Hash_FreeArray; its values are freed with the arena.
+ * @param hash A pointer to an ADUC_Hash struct whose member values will be allocated
+ * @param hashValue The value of the hash
+ * @param hashType The type of the hash
+ * @param arena The arena.
+ * @returns True if successfully allocated, False if failure
+ */
+_Bool ADUC_Hash_InitInArena(ADUC_Hash* hash, const char* hashValue, const char* hashType, ADUC_Arena* arena);
+
 /**
  * @brief Free the ADUC_Hash struct members
  * @param hash a pointer to an ADUC_Hash
@@ -69,6 +213,72 @@ void ADUC_Hash_UnInit(ADUC_Hash* hash);
  */
 void ADUC_Hash_FreeArray(size_t hashCount, ADUC_Hash* hashArray);
 
+/**
+ * @brief Records that the file at @p path has been verified against @p hashBase64.
+ * The current file size and modification time are captured so that the verification
+ * can be reused later without re-hashing the file.
+ * @param verifiedFile A pointer to an ADUC_DownloadVerifiedFile struct whose member values will be allocated.
+ * @param path The path to the verified file.
+ * @param hashType The type of the verified hash.
+ * @param hashBase64 The verified hash value.
+ * @returns True if successfully initialized, False if failure
+ */
+_Bool ADUC_DownloadVerifiedFile_Init(
+    ADUC_DownloadVerifiedFile* verifiedFile, const char* path, const char* hashType, const char* hashBase64);
+
+/**
+ * @brief Checks whether @p verifiedFile still vouches for the file at @p path having the hash @p hashBase64.
+ * This is true if the recorded path and hash match, and the file size and modification time are unchanged.
+ * @param verifiedFile The verified file record.
+ * @param path The path to the file.
+ * @param hashType The expected hash type.
+ * @param hashBase64 The expected hash value.
+ * @returns True if the file doesn't need to be hashed again.
+ */
+_Bool ADUC_DownloadVerifiedFile_IsCurrent(
+    const ADUC_DownloadVerifiedFile* verifiedFile, const char* path, const char* hashType, const char* hashBase64);
+
+/**
+ * @brief Free the ADUC_DownloadVerifiedFile struct members
+ * @param verifiedFile a pointer to an ADUC_DownloadVerifiedFile
+ */
+void ADUC_DownloadVerifiedFile_UnInit(ADUC_DownloadVerifiedFile* verifiedFile);
+
+/**
+ * @brief Sets the folder ADUC_DownloadVerifiedFile_Persist persists verified file records to, and removes the stale
+ * records in it.
+ * @details The folder is created if needed. It's only used if it's owned by the effective user and not writable by
+ * others, so that only the process itself can vouch for its past verifications.
+ * @param folder The folder, or NULL to persist nothing.
+ * @returns True on success, false if the folder can't be used; nothing is persisted then.
+ */
+_Bool ADUC_DownloadVerifiedFile_InitStore(const char* folder);
+
+/**
+ * @brief Stops persisting verified file records, leaving the persisted ones as is.
+ */
+void ADUC_DownloadVerifiedFile_UninitStore(void);
+
+/**
+ * @brief Persists @p verifiedFile to the verified file store, see ADUC_DownloadVerifiedFile_InitStore, so that the
+ * verification can be reused after the agent restarts, see ADUC_DownloadVerifiedFile_InitFromPersisted.
+ * @param verifiedFile The verified file record. Nothing is persisted if the file has changed since.
+ * @returns True if persisted. False if the file has changed, or there's no verified file store.
+ */
+_Bool ADUC_DownloadVerifiedFile_Persist(const ADUC_DownloadVerifiedFile* verifiedFile);
+
+/**
+ * @brief Initializes @p verifiedFile from the record ADUC_DownloadVerifiedFile_Persist persisted for the file at
+ * @p path, if it is for @p hashBase64 and the file size, modification time and status change time are unchanged.
+ * @param verifiedFile A pointer to an ADUC_DownloadVerifiedFile struct whose member values will be allocated.
+ * @param path The path to the file.
+ * @param hashType The expected hash type.
+ * @param hashBase64 The expected hash value.
+ * @returns True if the file doesn't need to be hashed again.
+ */
+_Bool ADUC_DownloadVerifiedFile_InitFromPersisted(
+    ADUC_DownloadVerifiedFile* verifiedFile, const char* path, const char* hashType, const char* hashBase64);
+
 EXTERN_C_END
 
 #endif // ADUC_HASH_UTILS_H
@@ -5,391 +5,2379 @@
  * @copyright Copyright (c) Microsoft Corporation.
  * Licensed under the MIT License.
  */
+#ifndef _GNU_SOURCE
+#    define _GNU_SOURCE // for splice, F_SETPIPE_SZ
+#endif
+
 #include "aduc/hash_utils.h"
 
-#include <stdio.h> // for FILE
-#include <stdlib.h> // for calloc
+#include <dirent.h> // for opendir, readdir
+#include <errno.h>
+#include <fcntl.h> // for open, posix_fadvise
+#include <inttypes.h> // for PRIu64, SCNu64
+#include <limits.h> // for UINT_MAX, PATH_MAX
+#include <pthread.h>
+#include <stdio.h> // for snprintf, sscanf
+#include <stdlib.h> // for calloc, posix_memalign
+#include <string.h> // for strcmp
 #include <strings.h> // for strcasecmp
+#include <linux/if_alg.h> // for sockaddr_alg
+#include <sys/mman.h> // for mmap, madvise
+#include <sys/socket.h> // for socket, send
+#include <sys/stat.h> // for stat
+#include <unistd.h> // for read, close, sysconf
 
-#include <azure_c_shared_utility/azure_base64.h>
-#include <azure_c_shared_utility/buffer_.h>
 #include <azure_c_shared_utility/crt_abstractions.h> // for mallocAndStrcpy_s
 #include <azure_c_shared_utility/sha.h>
 
 #include <aduc/logging.h>
+#include <base64_utils.h>
+#include <aduc/metrics_utils.h>
+#include <aduc/thermal_utils.h>
+#include <aduc/timing_utils.h>
+#include <aduc/tracepoints.h>
+
+#ifdef ADUC_HASH_UTILS_USE_OPENSSL
+#    include <openssl/evp.h>
+#endif
+
+/**
+ * @brief The maximum size of a persisted verified file record, and of the hash type and value within it.
+ */
+#define ADUC_VERIFIED_FILE_RECORD_MAX_SIZE (256 + PATH_MAX)
+#define ADUC_VERIFIED_FILE_RECORD_MAX_HASH_TYPE 31
+#define ADUC_VERIFIED_FILE_RECORD_MAX_HASH_VALUE 127
+
+/**
+ * @brief The folder ADUC_DownloadVerifiedFile_Persist persists verified file records to, or NULL.
+ */
+static char* s_verifiedFileStoreFolder = NULL;
+
+/**
+ * @brief Guards s_verifiedFileStoreFolder.
+ */
+static pthread_mutex_t s_verifiedFileStoreMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Size of the buffer used to read files for hashing.
+ */
+#ifndef ADUC_HASH_UTILS_READ_BUFFER_SIZE
+#    define ADUC_HASH_UTILS_READ_BUFFER_SIZE (256 * 1024)
+#endif
+
+/**
+ * @brief Files of at least this size are memory mapped for hashing, instead of being read.
+ */
+#ifndef ADUC_HASH_UTILS_MMAP_THRESHOLD
+#    define ADUC_HASH_UTILS_MMAP_THRESHOLD (4 * 1024 * 1024)
+#endif
+
+/**
+ * @brief Size of each mapped window when hashing a memory mapped file. Must be a multiple of the page size.
+ */
+#ifndef ADUC_HASH_UTILS_MMAP_WINDOW_SIZE
+#    define ADUC_HASH_UTILS_MMAP_WINDOW_SIZE (64 * 1024 * 1024)
+#endif
+
+/**
+ * @brief Blocks of at least this size are fed to several hash contexts on a thread each, rather than one after the
+ * other.
+ */
+#ifndef ADUC_HASH_UTILS_PARALLEL_INPUT_SIZE
+#    define ADUC_HASH_UTILS_PARALLEL_INPUT_SIZE (4 * 1024 * 1024)
+#endif
+
+/**
+ * @brief How far ahead of the hashed data the kernel is asked to read the file, so that the storage has requests
+ * queued while the CPU hashes. Must be a multiple of the page size. 0 leaves it to the kernel's read-ahead.
+ */
+#ifndef ADUC_HASH_UTILS_READAHEAD_SIZE
+#    define ADUC_HASH_UTILS_READAHEAD_SIZE (8 * 1024 * 1024)
+#endif
+
+/**
+ * @brief Size of the buffer hashed by each backend to benchmark them, see ADUC_HashUtils_SelectKernelBackend.
+ * Large enough that the setup of a hardware engine doesn't dominate, as it doesn't for update payloads.
+ */
+#ifndef ADUC_HASH_UTILS_BENCHMARK_SIZE
+#    define ADUC_HASH_UTILS_BENCHMARK_SIZE (4 * 1024 * 1024)
+#endif
+
+/**
+ * @brief Size of the pipe file data is spliced through into a kernel hash, and so of each splice.
+ */
+#ifndef ADUC_HASH_UTILS_SPLICE_SIZE
+#    define ADUC_HASH_UTILS_SPLICE_SIZE (1024 * 1024)
+#endif
+
+#ifndef SOL_ALG
+#    define SOL_ALG 279
+#endif
+
+/**
+ * @brief Guards s_kernelAlgorithms.
+ */
+static pthread_mutex_t s_kernelMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief The mask of the algorithms hashed with the kernel crypto API, see ADUC_HashUtils_GetKernelBackendAlgorithms.
+ */
+static unsigned int s_kernelAlgorithms = 0;
+
+/**
+ * @brief Gets the kernel crypto API name of @p algorithm.
+ * @returns The name, or NULL if there is none.
+ */
+static const char* GetKernelHashName(SHAversion algorithm)
+{
+    switch (algorithm)
+    {
+    case SHA1:
+        return "sha1";
+    case SHA224:
+        return "sha224";
+    case SHA256:
+        return "sha256";
+    case SHA384:
+        return "sha384";
+    case SHA512:
+        return "sha512";
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * @brief Opens an AF_ALG operation socket that hashes the data sent to it with @p algorithm.
+ * The kernel uses its highest priority implementation, which is the SoC's hash engine when it has a driver.
+ * @param algorithm The hashing algorithm.
+ * @returns The socket, or -1 if the kernel doesn't provide the algorithm, or AF_ALG at all.
+ */
+static int OpenKernelHash(SHAversion algorithm)
+{
+    struct sockaddr_alg address = { .salg_family = AF_ALG };
+    const char* name = GetKernelHashName(algorithm);
+    int operationSocket = -1;
+
+    if (name == NULL)
+    {
+        return -1;
+    }
+
+    (void)snprintf((char*)address.salg_type, sizeof(address.salg_type), "hash");
+    (void)snprintf((char*)address.salg_name, sizeof(address.salg_name), "%s", name);
+
+    const int algorithmSocket = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (algorithmSocket == -1)
+    {
+        return -1;
+    }
+
+    if (bind(algorithmSocket, (const struct sockaddr*)&address, sizeof(address)) == 0)
+    {
+        operationSocket = accept4(algorithmSocket, NULL, NULL, SOCK_CLOEXEC);
+    }
+
+    close(algorithmSocket);
+    return operationSocket;
+}
+
+#ifdef ADUC_HASH_UTILS_USE_OPENSSL
+/**
+ * @brief Gets the OpenSSL digest for @p algorithm.
+ * @param algorithm The hashing algorithm.
+ * @returns The digest, or NULL if OpenSSL doesn't provide it.
+ */
+static const EVP_MD* GetEvpDigest(SHAversion algorithm)
+{
+    switch (algorithm)
+    {
+    case SHA1:
+        return EVP_sha1();
+    case SHA224:
+        return EVP_sha224();
+    case SHA256:
+        return EVP_sha256();
+    case SHA384:
+        return EVP_sha384();
+    case SHA512:
+        return EVP_sha512();
+    default:
+        return NULL;
+    }
+}
+#endif
+
+/**
+ * @brief Decodes the base64 digest @p hashBase64 into @p digest, without allocating.
+ * Only the canonical, padded encoding of a digest of exactly @p digestSize bytes is accepted, so that decoding and
+ * comparing bytes accepts the same hashes as encoding and comparing strings.
+ * @param hashBase64 The base64 digest.
+ * @param digest The output buffer, of at least @p digestSize bytes.
+ * @param digestSize The size of the digest.
+ * @returns True if @p hashBase64 is a digest of @p digestSize bytes.
+ */
+static _Bool DecodeBase64Digest(const char* hashBase64, uint8_t* digest, size_t digestSize)
+{
+    char canonical[BASE64_ENCODED_SIZE(USHAMaxHashSize)];
+    const size_t length = strlen(hashBase64);
+
+    if (digestSize > USHAMaxHashSize || length != BASE64_ENCODED_SIZE(digestSize) - 1
+        || Base64URLDecodeToBuffer(hashBase64, length, digest, digestSize) != digestSize)
+    {
+        return false;
+    }
+
+    // The decoder also accepts the Base64URL alphabet, missing padding and non-zero bits left over;
+    // re-encoding rejects them.
+    return Base64EncodeToBuffer(digest, digestSize, canonical, sizeof(canonical)) == length
+        && memcmp(canonical, hashBase64, length) == 0;
+}
+
+/**
+ * @brief Compares two digests in constant time.
+ * @returns True if the @p size bytes of @p a and @p b are equal.
+ */
+static _Bool DigestsEqual(const uint8_t* a, const uint8_t* b, size_t size)
+{
+    uint8_t difference = 0;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        difference |= a[i] ^ b[i];
+    }
+
+    return difference == 0;
+}
+
+/**
+ * @brief Encodes the calculated hash in base64.
+ * @param hash The calculated hash, of USHAHashSize(algorithm) bytes.
+ * @param algorithm The algorithm used to calculate the hash.
+ * @returns The encoded hash, or NULL on failure. Caller must call free() when done.
+ */
+static char* EncodeDigest(const uint8_t* hash, SHAversion algorithm)
+{
+    const size_t hashSize = (size_t)USHAHashSize(algorithm);
+    const size_t encodedSize = BASE64_ENCODED_SIZE(hashSize);
+
+    char* encoded = malloc(encodedSize);
+    if (encoded == NULL)
+    {
+        return NULL;
+    }
+
+    if (Base64EncodeToBuffer(hash, hashSize, encoded, encodedSize) == 0)
+    {
+        Log_Error("Error in Base64 Encoding");
+        free(encoded);
+        return NULL;
+    }
+
+    return encoded;
+}
+
+/**
+ * @brief Logs that the calculated hash doesn't match @p hashBase64.
+ */
+static void LogHashMismatch(const uint8_t* hash, const char* hashBase64, SHAversion algorithm)
+{
+    char* encoded = EncodeDigest(hash, algorithm);
+    Log_Error(
+        "Invalid Hash, Expect: %s, Result: %s, SHAversion: %d",
+        hashBase64,
+        encoded != NULL ? encoded : "(unknown)",
+        algorithm);
+    free(encoded);
+}
 
 /**
- * @brief Helper function gets the calculated hash from the @p context, compares it to @p hashBase64, and returns the appropriate value
- * @param context Context in which the hash was calculated and stored
- * @param hashBase64 The expected hash from the context. If NULL, skip hashes comparison.
+ * @brief Helper function compares the calculated hash to @p hashBase64, and returns the appropriate value.
+ * The expected hash is decoded rather than the calculated one encoded, so a valid hash takes no allocation.
+ * @param hash The calculated hash, of USHAHashSize(algorithm) bytes.
+ * @param hashBase64 The expected hash. If NULL, skip hashes comparison.
  * @param algorithm the algorithm used to calculate the hash
  * @param outputHash an optional output buffer for computed hash. Caller must call free() to deallocate the buffer when done.
  * @returns bool True if the hash is valid and equals @p hashBase64
  */
-static bool
-GetResultAndCompareHashes(USHAContext* context, const char* hashBase64, SHAversion algorithm, char** outputHash)
+static bool CompareHashes(const uint8_t* hash, const char* hashBase64, SHAversion algorithm, char** outputHash)
 {
-    bool success = false;
-    // "USHAHashSize(algorithm)" is more precise, but requires a variable length array, or heap allocation.
-    uint8_t buffer_hash[USHAMaxHashSize];
-    STRING_HANDLE encoded_file_hash = NULL;
+    uint8_t expected[USHAMaxHashSize];
+    const size_t hashSize = (size_t)USHAHashSize(algorithm);
 
-    if (USHAResult(context, (uint8_t*)buffer_hash) != 0)
+    if (hashBase64 != NULL
+        && !(DecodeBase64Digest(hashBase64, expected, hashSize) && DigestsEqual(hash, expected, hashSize)))
     {
-        Log_Error("Error in SHA Result, SHAversion: %d", algorithm);
-        goto done;
+        LogHashMismatch(hash, hashBase64, algorithm);
+        return false;
     }
 
-    encoded_file_hash = Azure_Base64_Encode_Bytes((unsigned char*)buffer_hash, USHAHashSize(algorithm));
-    if (encoded_file_hash == NULL)
+    if (outputHash != NULL)
     {
-        Log_Error("Error in Base64 Encoding");
-        goto done;
+        *outputHash = EncodeDigest(hash, algorithm);
+        if (*outputHash == NULL)
+        {
+            Log_Error("Cannot allocate output buffer and copy hash.");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Gets the algorithm of @p hash, the one ADUC_Hash_Init resolved if any.
+ * @returns True if the hash type is supported.
+ */
+static _Bool GetHashAlgorithm(const ADUC_Hash* hash, SHAversion* algorithm)
+{
+    if (hash->digestSize != 0)
+    {
+        *algorithm = (SHAversion)hash->algorithm;
+        return true;
     }
 
-    const bool hashMatches = ((hashBase64 == NULL) || (strcmp(hashBase64, STRING_c_str(encoded_file_hash)) == 0));
+    return hash->type != NULL && ADUC_HashUtils_GetShaVersionForTypeString(hash->type, algorithm);
+}
+
+/**
+ * @brief A block of data to feed into a hash context on its own thread, see ContextsInput.
+ */
+typedef struct tagADUC_HashInput
+{
+    ADUC_HashUtils_Context* context; /**< The hash context. */
+    const uint8_t* buffer; /**< The data, shared by all the contexts. */
+    size_t bufferLen; /**< The length of the data. */
+    _Bool success; /**< Whether feeding the data succeeded. */
+} ADUC_HashInput;
+
+static void* HashInputThread(void* arg)
+{
+    ADUC_HashInput* input = arg;
+    input->success = ADUC_HashUtils_ContextInput(input->context, input->buffer, input->bufferLen);
+    return NULL;
+}
 
-    if (!hashMatches)
+/**
+ * @brief Feeds the same block of data into each of @p contexts, so that several hashes of a file take a single read.
+ * Large blocks are hashed on a thread per context.
+ * @param contexts The hash contexts.
+ * @param contextCount The number of contexts.
+ * @param buffer The data.
+ * @param bufferLen The length of @p buffer.
+ * @returns True on success.
+ */
+static _Bool ContextsInput(
+    ADUC_HashUtils_Context* contexts, size_t contextCount, const uint8_t* buffer, size_t bufferLen)
+{
+    _Bool success = true;
+    ADUC_HashInput* inputs = NULL;
+    pthread_t* threads = NULL;
+    size_t startedThreads = 0;
+
+    if (contextCount > 1 && bufferLen >= ADUC_HASH_UTILS_PARALLEL_INPUT_SIZE)
     {
-        Log_Error(
-            "Invalid Hash, Expect: %s, Result: %s, SHAversion: %d",
-            hashBase64,
-            STRING_c_str(encoded_file_hash),
-            algorithm);
+        inputs = calloc(contextCount, sizeof(*inputs));
+        threads = calloc(contextCount, sizeof(*threads));
+    }
+
+    if (inputs == NULL || threads == NULL)
+    {
+        for (size_t i = 0; i < contextCount && success; ++i)
+        {
+            success = ADUC_HashUtils_ContextInput(contexts + i, buffer, bufferLen);
+        }
+
         goto done;
     }
 
-    if (outputHash != NULL)
+    // The calling thread hashes the first context, and any the threads couldn't be started for.
+    for (size_t i = 0; i < contextCount; ++i)
+    {
+        inputs[i] = (ADUC_HashInput){ .context = contexts + i, .buffer = buffer, .bufferLen = bufferLen };
+    }
+
+    while (startedThreads < contextCount - 1
+           && pthread_create(threads + startedThreads, NULL, HashInputThread, inputs + startedThreads + 1) == 0)
+    {
+        ++startedThreads;
+    }
+
+    HashInputThread(inputs);
+    for (size_t i = startedThreads + 1; i < contextCount; ++i)
+    {
+        HashInputThread(inputs + i);
+    }
+
+    for (size_t i = 0; i < startedThreads; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < contextCount; ++i)
+    {
+        success = success && inputs[i].success;
+    }
+
+done:
+    free(inputs);
+    free(threads);
+    return success;
+}
+
+/**
+ * @brief Asks the kernel to read the file up to ADUC_HASH_UTILS_READAHEAD_SIZE bytes past @p offset, without waiting.
+ * The kernel's own read-ahead is a few hundred KiB, which leaves fast storage idle while a block is hashed. The range
+ * is requested by halves, so that each call queues a sizable read.
+ * @param fd The file descriptor.
+ * @param offset The offset of the data needed next.
+ * @param readAheadEnd The end of the range requested so far, updated.
+ */
+static void ReadAhead(int fd, off_t offset, off_t* readAheadEnd)
+{
+    if (ADUC_HASH_UTILS_READAHEAD_SIZE == 0 || *readAheadEnd - offset >= ADUC_HASH_UTILS_READAHEAD_SIZE / 2)
+    {
+        return;
+    }
+
+    const off_t start = (*readAheadEnd > offset) ? *readAheadEnd : offset;
+    const off_t end = offset + ADUC_HASH_UTILS_READAHEAD_SIZE;
+
+    (void)posix_fadvise(fd, start, end - start, POSIX_FADV_WILLNEED);
+    *readAheadEnd = end;
+}
+
+/**
+ * @brief Feeds the file content into @p contexts by mapping the file in windows of
+ * ADUC_HASH_UTILS_MMAP_WINDOW_SIZE bytes. Mapping in windows keeps the address space usage
+ * bounded, which matters for multi-GB files on 32-bit devices.
+ * @param fd The file descriptor.
+ * @param fileSize The file size.
+ * @param contexts The hash contexts.
+ * @param contextCount The number of contexts.
+ * @param hashedSize Output, the number of bytes hashed. Less than @p fileSize if the file couldn't be mapped.
+ * @returns False if hashing failed. Failing to map the file is not an error, the rest can still be read.
+ */
+static _Bool HashMappedFileContent(
+    int fd, off_t fileSize, ADUC_HashUtils_Context* contexts, size_t contextCount, off_t* hashedSize)
+{
+    off_t offset = 0;
+    off_t readAheadEnd = 0;
+
+    *hashedSize = 0;
+
+    while (offset < fileSize)
     {
-        if (mallocAndStrcpy_s(outputHash, STRING_c_str(encoded_file_hash)) != 0)
+        const size_t windowSize = (fileSize - offset > ADUC_HASH_UTILS_MMAP_WINDOW_SIZE)
+            ? ADUC_HASH_UTILS_MMAP_WINDOW_SIZE
+            : (size_t)(fileSize - offset);
+
+        void* window = mmap(NULL, windowSize, PROT_READ, MAP_PRIVATE, fd, offset);
+        if (window == MAP_FAILED)
+        {
+            Log_Warn("Cannot map file content, errno: %d", errno);
+            return true;
+        }
+
+        (void)madvise(window, windowSize, MADV_SEQUENTIAL);
+
+        // Hash the window a read-ahead at a time, with the next one already requested.
+        const size_t sliceSize = ADUC_HASH_UTILS_READAHEAD_SIZE == 0 ? windowSize : ADUC_HASH_UTILS_READAHEAD_SIZE;
+        _Bool success = true;
+
+        for (size_t sliceOffset = 0; sliceOffset < windowSize && success; sliceOffset += sliceSize)
+        {
+            const size_t length = (windowSize - sliceOffset > sliceSize) ? sliceSize : windowSize - sliceOffset;
+
+            ReadAhead(fd, offset + (off_t)(sliceOffset + length), &readAheadEnd);
+            (void)ADUC_Thermal_WaitForHeadroom(NULL);
+            success = ContextsInput(contexts, contextCount, (const uint8_t*)window + sliceOffset, length);
+        }
+
+        munmap(window, windowSize);
+
+        if (!success)
+        {
+            return false;
+        }
+
+        offset += (off_t)windowSize;
+        *hashedSize = offset;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Feeds the file content into @p contexts using read() with a large, page-aligned buffer.
+ * @param fd The file descriptor.
+ * @param contexts The hash contexts.
+ * @param contextCount The number of contexts.
+ * @returns True on success.
+ */
+static _Bool HashReadFileContent(int fd, ADUC_HashUtils_Context* contexts, size_t contextCount)
+{
+    _Bool success = false;
+    void* buffer = NULL;
+    off_t offset = lseek(fd, 0, SEEK_CUR); // -1 for a pipe, which has no read-ahead.
+    off_t readAheadEnd = offset;
+
+    if (posix_memalign(&buffer, (size_t)sysconf(_SC_PAGESIZE), ADUC_HASH_UTILS_READ_BUFFER_SIZE) != 0)
+    {
+        Log_Error("Cannot allocate read buffer.");
+        return false;
+    }
+
+    // Repeatedly read and hash chunks of the file
+    for (;;)
+    {
+        const ssize_t readSize = read(fd, buffer, ADUC_HASH_UTILS_READ_BUFFER_SIZE);
+        if (readSize == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            Log_Error("Error reading file content, errno: %d", errno);
+            goto done;
+        }
+
+        if (readSize == 0)
+        {
+            // At the end of file. We're done here.
+            break;
+        }
+
+        if (offset >= 0)
+        {
+            offset += readSize;
+            ReadAhead(fd, offset, &readAheadEnd);
+        }
+
+        // Hashing is what heats up the device, not waiting on the storage.
+        (void)ADUC_Thermal_WaitForHeadroom(NULL);
+
+        if (!ContextsInput(contexts, contextCount, (const uint8_t*)buffer, (size_t)readSize))
         {
-            Log_Error("Cannot allocate output buffer and copy hash.");
             goto done;
         }
     }
 
-    success = true;
-
-done:
-    STRING_delete(encoded_file_hash);
-    return success;
+    success = true;
+
+done:
+    free(buffer);
+    return success;
+}
+
+/**
+ * @brief Feeds the first @p fileSize bytes of the file @p fd into the kernel hash of @p context, by splicing them
+ * through a pipe, so that the data goes from the page cache to the hash engine without being copied to user space.
+ * @param fd The file descriptor.
+ * @param fileSize The file size.
+ * @param context The hash context, whose kernelBackend is true.
+ * @param splicedSize Output, the number of bytes hashed. 0 if the file system doesn't support splicing.
+ * @returns False if hashing failed. Failing to splice the first bytes is not an error, the file can still be read.
+ */
+static _Bool HashSplicedFileContent(int fd, off_t fileSize, ADUC_HashUtils_Context* context, off_t* splicedSize)
+{
+    _Bool success = false;
+    int pipeFds[2] = { -1, -1 };
+    off_t offset = 0;
+    off_t readAheadEnd = 0;
+
+    *splicedSize = 0;
+
+    if (pipe2(pipeFds, O_CLOEXEC) != 0)
+    {
+        Log_Warn("Cannot create pipe to splice file content, errno: %d", errno);
+        return true;
+    }
+
+    // Fails without CAP_SYS_RESOURCE over /proc/sys/fs/pipe-max-size, which only makes each splice smaller.
+    (void)fcntl(pipeFds[1], F_SETPIPE_SZ, ADUC_HASH_UTILS_SPLICE_SIZE);
+
+    while (offset < fileSize)
+    {
+        const size_t length = (fileSize - offset > ADUC_HASH_UTILS_SPLICE_SIZE) ? ADUC_HASH_UTILS_SPLICE_SIZE
+                                                                                : (size_t)(fileSize - offset);
+
+        ReadAhead(fd, offset + (off_t)length, &readAheadEnd);
+        (void)ADUC_Thermal_WaitForHeadroom(NULL);
+
+        ssize_t pipedSize = splice(fd, &offset, pipeFds[1], NULL, length, SPLICE_F_MORE);
+        if (pipedSize == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (pipedSize == 0)
+        {
+            // The file was truncated since: hash what there is, as reading it would.
+            break;
+        }
+
+        if (pipedSize == -1)
+        {
+            // Before anything reached the hash, the file can still be read, e.g. on a file system without splice.
+            success = (*splicedSize == 0);
+            if (!success)
+            {
+                Log_Error("Cannot splice file content, errno: %d", errno);
+            }
+
+            goto done;
+        }
+
+        // SPLICE_F_MORE keeps the hash open for the next block, it is finished by FinishContext.
+        while (pipedSize > 0)
+        {
+            const ssize_t hashedSize = splice(pipeFds[0], NULL, context->kernelSocket, NULL, pipedSize, SPLICE_F_MORE);
+            if (hashedSize <= 0)
+            {
+                if (hashedSize == -1 && errno == EINTR)
+                {
+                    continue;
+                }
+
+                Log_Error("Cannot splice file content into the kernel hash, errno: %d", errno);
+                goto done;
+            }
+
+            pipedSize -= hashedSize;
+        }
+
+        *splicedSize = offset;
+    }
+
+    success = true;
+
+done:
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    return success;
+}
+
+/**
+ * @brief Feeds the whole content of the file @p fd into each of @p contexts, reading it once.
+ * Files of at least ADUC_HASH_UTILS_MMAP_THRESHOLD bytes are memory mapped, smaller
+ * files (and files that can't be mapped) are read with a large buffer.
+ * Once hashed, the file pages are dropped from the page cache, since a large update file
+ * would otherwise evict more useful pages.
+ * @param fd The file descriptor.
+ * @param contexts The hash contexts.
+ * @param contextCount The number of contexts.
+ * @returns True on success.
+ */
+static _Bool HashFileContent(int fd, ADUC_HashUtils_Context* contexts, size_t contextCount)
+{
+    _Bool success;
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+    {
+        Log_Error("Cannot stat file, errno: %d", errno);
+        return false;
+    }
+
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    _Bool allKernelBackend = true;
+    for (size_t i = 0; i < contextCount; ++i)
+    {
+        allKernelBackend = allKernelBackend && contexts[i].kernelBackend;
+    }
+
+    // Kernel hashes are fed by splicing, which reads the file from the page cache once per context.
+    if (S_ISREG(st.st_mode) && allKernelBackend)
+    {
+        off_t splicedSize = 0;
+        success = HashSplicedFileContent(fd, st.st_size, contexts, &splicedSize);
+
+        for (size_t i = 1; i < contextCount && success; ++i)
+        {
+            off_t contextSplicedSize = 0;
+            success = HashSplicedFileContent(fd, st.st_size, contexts + i, &contextSplicedSize)
+                && contextSplicedSize == splicedSize;
+        }
+
+        (void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+        // Nothing was spliced, e.g. the file system doesn't support it, or the file is empty: read it instead.
+        if (!success || splicedSize != 0)
+        {
+            return success;
+        }
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size >= ADUC_HASH_UTILS_MMAP_THRESHOLD)
+    {
+        off_t hashedSize = 0;
+        success = HashMappedFileContent(fd, st.st_size, contexts, contextCount, &hashedSize);
+        (void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+        if (!success || hashedSize == st.st_size)
+        {
+            return success;
+        }
+
+        // The file couldn't be mapped (entirely), read the rest instead.
+        if (lseek(fd, hashedSize, SEEK_SET) == -1)
+        {
+            Log_Error("Cannot seek file, errno: %d", errno);
+            return false;
+        }
+    }
+
+    return HashReadFileContent(fd, contexts, contextCount);
+}
+
+/**
+ * @brief Resets @p context to start computing a new hash.
+ * @param context The hash context.
+ * @param algorithm The hashing algorithm to use.
+ * @param kernelBackend True to compute the hash with the kernel crypto API, if it provides @p algorithm.
+ * @returns True on success.
+ */
+static _Bool ResetContext(ADUC_HashUtils_Context* context, SHAversion algorithm, _Bool kernelBackend)
+{
+    context->algorithm = algorithm;
+    context->evpContext = NULL;
+    context->kernelBackend = false;
+    context->kernelSocket = -1;
+
+    if (kernelBackend)
+    {
+        context->kernelSocket = OpenKernelHash(algorithm);
+        if (context->kernelSocket != -1)
+        {
+            context->kernelBackend = true;
+            return true;
+        }
+
+        Log_Debug("Kernel hash unavailable, SHAversion: %d, errno: %d", algorithm, errno);
+    }
+
+#ifdef ADUC_HASH_UTILS_USE_OPENSSL
+    const EVP_MD* md = GetEvpDigest(algorithm);
+    if (md != NULL)
+    {
+        EVP_MD_CTX* evpContext = EVP_MD_CTX_new();
+        if (evpContext != NULL && EVP_DigestInit_ex(evpContext, md, NULL) == 1)
+        {
+            context->evpContext = evpContext;
+            return true;
+        }
+
+        // e.g. the digest is disabled by the crypto policy. Fall back to the RFC 6234 implementation.
+        Log_Debug("EVP digest unavailable, SHAversion: %d", algorithm);
+        EVP_MD_CTX_free(evpContext);
+    }
+#endif
+
+    if (USHAReset(&context->shaContext, algorithm) != 0)
+    {
+        Log_Error("Error in SHA Reset, SHAversion: %d", algorithm);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Resets @p context to start computing a new hash.
+ * @param context The hash context.
+ * @param algorithm The hashing algorithm to use.
+ * @returns True on success.
+ */
+_Bool ADUC_HashUtils_ContextReset(ADUC_HashUtils_Context* context, SHAversion algorithm)
+{
+    if (context == NULL)
+    {
+        return false;
+    }
+
+    const unsigned int kernelAlgorithms = ADUC_HashUtils_GetKernelBackendAlgorithms();
+    return ResetContext(
+        context, algorithm, (unsigned int)algorithm < 32 && (kernelAlgorithms & (1u << algorithm)) != 0);
+}
+
+/**
+ * @brief Releases the resources held by an unfinished hash computation.
+ * @param context The hash context. Must be zero-initialized or reset. Safe to call after ADUC_HashUtils_ContextResult.
+ */
+void ADUC_HashUtils_ContextUnInit(ADUC_HashUtils_Context* context)
+{
+    if (context == NULL)
+    {
+        return;
+    }
+
+#ifdef ADUC_HASH_UTILS_USE_OPENSSL
+    EVP_MD_CTX_free((EVP_MD_CTX*)context->evpContext);
+#endif
+    context->evpContext = NULL;
+
+    if (context->kernelBackend)
+    {
+        close(context->kernelSocket);
+        context->kernelBackend = false;
+        context->kernelSocket = -1;
+    }
+}
+
+/**
+ * @brief Feeds the next chunk of data into the hash computation.
+ * @param context The hash context.
+ * @param buffer The data.
+ * @param bufferLen The length of @p buffer.
+ * @returns True on success.
+ */
+_Bool ADUC_HashUtils_ContextInput(ADUC_HashUtils_Context* context, const uint8_t* buffer, size_t bufferLen)
+{
+    if (context == NULL || (buffer == NULL && bufferLen != 0))
+    {
+        return false;
+    }
+
+    if (context->kernelBackend)
+    {
+        // MSG_MORE keeps the hash open for the next chunk, it is finished by FinishContext.
+        while (bufferLen > 0)
+        {
+            const ssize_t sentSize = send(context->kernelSocket, buffer, bufferLen, MSG_MORE);
+            if (sentSize == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                Log_Error("Error in kernel hash input, SHAversion: %d, errno: %d", context->algorithm, errno);
+                return false;
+            }
+
+            buffer += sentSize;
+            bufferLen -= (size_t)sentSize;
+        }
+
+        return true;
+    }
+
+#ifdef ADUC_HASH_UTILS_USE_OPENSSL
+    if (context->evpContext != NULL)
+    {
+        if (bufferLen > 0 && EVP_DigestUpdate((EVP_MD_CTX*)context->evpContext, buffer, bufferLen) != 1)
+        {
+            Log_Error("Error in EVP digest update, SHAversion: %d", context->algorithm);
+            return false;
+        }
+
+        return true;
+    }
+#endif
+
+    // USHAInput takes an unsigned int length, so feed very large buffers in pieces.
+    while (bufferLen > 0)
+    {
+        const unsigned int chunkLen = (bufferLen > UINT_MAX) ? UINT_MAX : (unsigned int)bufferLen;
+
+        if (USHAInput(&context->shaContext, buffer, chunkLen) != 0)
+        {
+            Log_Error("Error in SHA Input, SHAversion: %d", context->algorithm);
+            return false;
+        }
+
+        buffer += chunkLen;
+        bufferLen -= chunkLen;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Feeds the whole content of the file at @p path into the hash computation.
+ * @param context The hash context.
+ * @param path The path to the file.
+ * @returns True on success.
+ */
+_Bool ADUC_HashUtils_ContextInputFile(ADUC_HashUtils_Context* context, const char* path)
+{
+    if (context == NULL || path == NULL)
+    {
+        return false;
+    }
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        Log_Error("Cannot open file: %s", path);
+        return false;
+    }
+
+    const _Bool success = HashFileContent(fd, context, 1);
+
+    close(fd);
+    return success;
+}
+
+/**
+ * @brief Finishes the hash computation.
+ * @param context The hash context. Must be reset before it's used again.
+ * @param digest The output buffer, of USHAMaxHashSize bytes.
+ * @returns True on success.
+ */
+static _Bool FinishContext(ADUC_HashUtils_Context* context, uint8_t* digest)
+{
+    if (context->kernelBackend)
+    {
+        // Reading the digest finishes the hash.
+        const int digestSize = USHAHashSize(context->algorithm);
+        ssize_t readSize;
+
+        do
+        {
+            readSize = recv(context->kernelSocket, digest, (size_t)digestSize, 0);
+        } while (readSize == -1 && errno == EINTR);
+
+        ADUC_HashUtils_ContextUnInit(context);
+
+        if (readSize != digestSize)
+        {
+            Log_Error("Error in kernel hash result, SHAversion: %d, errno: %d", context->algorithm, errno);
+            return false;
+        }
+
+        return true;
+    }
+
+#ifdef ADUC_HASH_UTILS_USE_OPENSSL
+    if (context->evpContext != NULL)
+    {
+        const int finalResult = EVP_DigestFinal_ex((EVP_MD_CTX*)context->evpContext, digest, NULL);
+        ADUC_HashUtils_ContextUnInit(context);
+
+        if (finalResult != 1)
+        {
+            Log_Error("Error in EVP digest final, SHAversion: %d", context->algorithm);
+            return false;
+        }
+
+        return true;
+    }
+#endif
+
+    if (USHAResult(&context->shaContext, digest) != 0)
+    {
+        Log_Error("Error in SHA Result, SHAversion: %d", context->algorithm);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Finishes the hash computation and compares the result to @p hashBase64.
+ * @param context The hash context. Must be reset before it's used again.
+ * @param hashBase64 The expected hash. If NULL, skip hashes comparison.
+ * @param outputHash An optional output buffer for computed hash. Caller must call free() when done.
+ * @returns True if the hash was computed and equals @p hashBase64.
+ */
+_Bool ADUC_HashUtils_ContextResult(ADUC_HashUtils_Context* context, const char* hashBase64, char** outputHash)
+{
+    if (context == NULL)
+    {
+        return false;
+    }
+
+    // "USHAHashSize(algorithm)" is more precise, but requires a variable length array, or heap allocation.
+    uint8_t buffer_hash[USHAMaxHashSize];
+
+    if (!FinishContext(context, buffer_hash))
+    {
+        return false;
+    }
+
+    return CompareHashes(buffer_hash, hashBase64, context->algorithm, outputHash);
+}
+
+/**
+ * @brief Finishes the hash computation and compares the result to @p expected. The digest that ADUC_Hash_Init decoded
+ * is compared directly, rather than encoding the result to compare it with the value of @p expected.
+ * @param context The hash context. Must be reset before it's used again.
+ * @param expected The expected hash, of the algorithm of @p context.
+ * @returns True if the hash was computed and equals @p expected.
+ */
+_Bool ADUC_HashUtils_ContextResultHash(ADUC_HashUtils_Context* context, const ADUC_Hash* expected)
+{
+    uint8_t buffer_hash[USHAMaxHashSize];
+
+    if (context == NULL || expected == NULL)
+    {
+        return false;
+    }
+
+    if (!FinishContext(context, buffer_hash))
+    {
+        return false;
+    }
+
+    // Not decoded, e.g. not initialized with ADUC_Hash_Init.
+    if (expected->digestSize == 0 || expected->algorithm != (int)context->algorithm)
+    {
+        return CompareHashes(buffer_hash, expected->value, context->algorithm, NULL);
+    }
+
+    if (!DigestsEqual(buffer_hash, expected->digest, expected->digestSize))
+    {
+        LogHashMismatch(buffer_hash, expected->value, context->algorithm);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Times hashing @p buffer of ADUC_HASH_UTILS_BENCHMARK_SIZE bytes with @p algorithm, in chunks of
+ * ADUC_HASH_UTILS_READ_BUFFER_SIZE bytes, as files are read.
+ * @param algorithm The hashing algorithm.
+ * @param kernelBackend True to time the kernel crypto API, false the software backend.
+ * @param buffer The data to hash.
+ * @returns The time taken, in nanoseconds, or -1 if the backend can't hash @p algorithm.
+ */
+static int64_t BenchmarkHash(SHAversion algorithm, _Bool kernelBackend, const uint8_t* buffer)
+{
+    ADUC_HashUtils_Context context = { .evpContext = NULL };
+    uint8_t digest[USHAMaxHashSize];
+    _Bool success = true;
+    const int64_t startTime = ADUC_Timing_Now();
+
+    if (!ResetContext(&context, algorithm, kernelBackend) || context.kernelBackend != kernelBackend)
+    {
+        ADUC_HashUtils_ContextUnInit(&context);
+        return -1;
+    }
+
+    for (size_t offset = 0; offset < ADUC_HASH_UTILS_BENCHMARK_SIZE && success;
+         offset += ADUC_HASH_UTILS_READ_BUFFER_SIZE)
+    {
+        const size_t length = (ADUC_HASH_UTILS_BENCHMARK_SIZE - offset > ADUC_HASH_UTILS_READ_BUFFER_SIZE)
+            ? ADUC_HASH_UTILS_READ_BUFFER_SIZE
+            : ADUC_HASH_UTILS_BENCHMARK_SIZE - offset;
+
+        success = ADUC_HashUtils_ContextInput(&context, buffer + offset, length);
+    }
+
+    if (!success)
+    {
+        ADUC_HashUtils_ContextUnInit(&context);
+        return -1;
+    }
+
+    return FinishContext(&context, digest) ? ADUC_Timing_Now() - startTime : -1;
+}
+
+_Bool ADUC_HashUtils_SelectKernelBackend(void)
+{
+    unsigned int kernelAlgorithms = 0;
+    uint8_t* buffer = NULL;
+    const SHAversion algorithms[] = { SHA1, SHA224, SHA256, SHA384, SHA512 };
+
+    // Without AF_ALG, e.g. with CONFIG_CRYPTO_USER_API_HASH off, there is nothing to benchmark.
+    const int probeSocket = OpenKernelHash(SHA256);
+    if (probeSocket == -1)
+    {
+        Log_Info("Kernel crypto API hashing unavailable, errno: %d", errno);
+        goto done;
+    }
+
+    close(probeSocket);
+
+    buffer = malloc(ADUC_HASH_UTILS_BENCHMARK_SIZE);
+    if (buffer == NULL)
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < ADUC_HASH_UTILS_BENCHMARK_SIZE; ++i)
+    {
+        buffer[i] = (uint8_t)((i * 2654435761u) >> 24);
+    }
+
+    for (size_t i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); ++i)
+    {
+        const int64_t kernelTime = BenchmarkHash(algorithms[i], true /* kernelBackend */, buffer);
+        const int64_t softwareTime = BenchmarkHash(algorithms[i], false /* kernelBackend */, buffer);
+
+        if (kernelTime <= 0 || softwareTime <= 0)
+        {
+            continue;
+        }
+
+        Log_Info(
+            "Hashing %s: kernel crypto API %" PRId64 " MiB/s, software %" PRId64 " MiB/s",
+            GetKernelHashName(algorithms[i]),
+            (int64_t)ADUC_HASH_UTILS_BENCHMARK_SIZE * 1000000000 / kernelTime / (1024 * 1024),
+            (int64_t)ADUC_HASH_UTILS_BENCHMARK_SIZE * 1000000000 / softwareTime / (1024 * 1024));
+
+        if (kernelTime < softwareTime)
+        {
+            kernelAlgorithms |= 1u << algorithms[i];
+        }
+    }
+
+done:
+    free(buffer);
+
+    pthread_mutex_lock(&s_kernelMutex);
+    s_kernelAlgorithms = kernelAlgorithms;
+    pthread_mutex_unlock(&s_kernelMutex);
+
+    return kernelAlgorithms != 0;
+}
+
+unsigned int ADUC_HashUtils_GetKernelBackendAlgorithms(void)
+{
+    pthread_mutex_lock(&s_kernelMutex);
+    const unsigned int kernelAlgorithms = s_kernelAlgorithms;
+    pthread_mutex_unlock(&s_kernelMutex);
+
+    return kernelAlgorithms;
+}
+
+/**
+ * @brief Checks if the hash of the file at @p path matches @p hashBase64
+ *
+ * @param path The path to the file to check
+ * @param algorithm The hashing algorithm to use to calculate the hash.
+ * @param hash [out] The pointer to output buffer. Caller must call free() when done with the returned buffer.
+ * @return bool True if the hash data is successfully generated.
+ */
+_Bool ADUC_HashUtils_GetFileHash(const char* path, SHAversion algorithm, char** hash)
+{
+    _Bool success = false;
+    int fd = -1;
+    ADUC_HashUtils_Context context = { .evpContext = NULL };
+
+    if (hash == NULL)
+    {
+        Log_Error("Invalid input. 'hash' is NULL.");
+        goto done;
+    }
+
+    *hash = NULL;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        // Sometime we call this function to check whether the file is already exist.
+        // So, log info here instead of error.
+        Log_Info("No such file or directory: %s", path);
+        goto done;
+    }
+
+    if (!ADUC_HashUtils_ContextReset(&context, algorithm))
+    {
+        goto done;
+    }
+
+    if (!HashFileContent(fd, &context, 1))
+    {
+        goto done;
+    }
+
+    success = ADUC_HashUtils_ContextResult(&context, NULL, hash);
+
+done:
+
+    ADUC_HashUtils_ContextUnInit(&context);
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    return success;
+}
+
+/**
+ * @brief Get file hash type at specified index.
+ * @param hashArray The ADUC_Hash array.
+ * @param arraySize Size of array.
+ * @param hashIndex Index of the hash to return.
+ *
+ * @return Hash type if succeeded. Otherwise, return NULL.
+ */
+char* ADUC_HashUtils_GetHashType(const ADUC_Hash* hashArray, size_t arraySize, size_t index)
+{
+    if (index >= arraySize)
+    {
+        return NULL;
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    return hashArray[index].type;
+}
+
+/**
+ * @brief Get file hash value at specified index.
+ * @param hashArray The ADUC_Hash array.
+ * @param arraySize Size of array.
+ * @param hashIndex Index of the hash to return.
+ *
+ * @return Hash value if succeeded. Otherwise, return NULL.
+ */
+char* ADUC_HashUtils_GetHashValue(const ADUC_Hash* hashArray, size_t arraySize, size_t index)
+{
+    if (index >= arraySize)
+    {
+        return NULL;
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    return hashArray[index].value;
+}
+
+/**
+ * @brief Checks if the hash of the file at @p path matches @p hashBase64
+ *
+ * @param path The path to the file to check
+ * @param hashBase64 The expected hash of the file at @p path
+ * @param algorithm The hashing algorithm to use to calculate the hash.
+ * @return bool True if the hash is valid and matches @p hashBase64
+ */
+_Bool ADUC_HashUtils_IsValidFileHash(const char* path, const char* hashBase64, SHAversion algorithm)
+{
+    _Bool success = false;
+    ADUC_HashUtils_Context context = { .evpContext = NULL };
+    const int64_t startTime = ADUC_Timing_Now();
+    const char* fileName = strrchr(path, '/');
+
+    ADUC_TRACEPOINT1(hash_start, path);
+    struct stat st;
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        Log_Error("Cannot open file: %s", path);
+        goto done;
+    }
+
+    if (!ADUC_HashUtils_ContextReset(&context, algorithm))
+    {
+        goto done;
+    }
+
+    if (!HashFileContent(fd, &context, 1))
+    {
+        goto done;
+    }
+
+    success = ADUC_HashUtils_ContextResult(&context, hashBase64, NULL);
+
+    if (fstat(fd, &st) == 0)
+    {
+        ADUC_Metrics_AddCounter(ADUC_MetricsCounter_HashedBytes, (uint64_t)st.st_size);
+        ADUC_Metrics_ObserveThroughput(ADUC_MetricsHistogram_HashThroughput, (uint64_t)st.st_size, startTime);
+    }
+
+done:
+    ADUC_HashUtils_ContextUnInit(&context);
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    ADUC_Timing_EndSpan("hash_verify", fileName != NULL ? fileName + 1 : path, startTime);
+    ADUC_TRACEPOINT2(hash_end, path, (int)success);
+
+    return success;
+}
+
+/**
+ * @brief Checks the file at @p path against all the hashes of @p hashArray, reading it once.
+ *
+ * @param path The path to the file to check
+ * @param hashArray The expected hashes of the file, of any supported types
+ * @param hashCount The number of hashes in @p hashArray
+ * @return bool True if every hash is valid. False if any isn't, or is of an unsupported type.
+ */
+_Bool ADUC_HashUtils_IsValidFileHashes(const char* path, const ADUC_Hash* hashArray, size_t hashCount)
+{
+    _Bool success = false;
+    ADUC_HashUtils_Context* contexts = NULL;
+    size_t resetCount = 0;
+    int fd = -1;
+    const int64_t startTime = ADUC_Timing_Now();
+    const char* fileName = strrchr(path, '/');
+
+    ADUC_TRACEPOINT1(hash_start, path);
+    struct stat st;
+
+    if (hashArray == NULL || hashCount == 0)
+    {
+        goto done;
+    }
+
+    contexts = calloc(hashCount, sizeof(*contexts));
+    if (contexts == NULL)
+    {
+        goto done;
+    }
+
+    for (; resetCount < hashCount; ++resetCount)
+    {
+        SHAversion algorithm;
+        if (!GetHashAlgorithm(hashArray + resetCount, &algorithm))
+        {
+            Log_Error("Unsupported hash type: %s", hashArray[resetCount].type);
+            goto done;
+        }
+
+        if (!ADUC_HashUtils_ContextReset(contexts + resetCount, algorithm))
+        {
+            goto done;
+        }
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        Log_Error("Cannot open file: %s", path);
+        goto done;
+    }
+
+    if (!HashFileContent(fd, contexts, hashCount))
+    {
+        goto done;
+    }
+
+    // Finish every hash, even past an invalid one, so that all the contexts are released.
+    success = true;
+    for (size_t i = 0; i < hashCount; ++i)
+    {
+        if (!ADUC_HashUtils_ContextResultHash(contexts + i, hashArray + i))
+        {
+            success = false;
+        }
+    }
+
+    if (fstat(fd, &st) == 0)
+    {
+        ADUC_Metrics_AddCounter(ADUC_MetricsCounter_HashedBytes, (uint64_t)st.st_size);
+        ADUC_Metrics_ObserveThroughput(ADUC_MetricsHistogram_HashThroughput, (uint64_t)st.st_size, startTime);
+    }
+
+done:
+    for (size_t i = 0; i < resetCount; ++i)
+    {
+        ADUC_HashUtils_ContextUnInit(contexts + i);
+    }
+
+    free(contexts);
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    ADUC_Timing_EndSpan("hash_verify", fileName != NULL ? fileName + 1 : path, startTime);
+    ADUC_TRACEPOINT2(hash_end, path, (int)success);
+
+    return success;
+}
+
+/**
+ * @brief Checks if the hash of the @p buffer matches @p hashBase64
+ *
+ * @param buffer The buffer to check
+ * @param bufferLen The length of the @p buffer
+ * @param hashBase64 The expected hash of the buffer @p buffer
+ * @return bool True if the hash is valid and matches @p hashBase64
+ */
+_Bool ADUC_HashUtils_IsValidBufferHash(
+    const uint8_t* buffer, size_t bufferLen, const char* hashBase64, SHAversion algorithm)
+{
+    ADUC_HashUtils_Context context = { .evpContext = NULL };
+
+    if (!ADUC_HashUtils_ContextReset(&context, algorithm))
+    {
+        return false;
+    }
+
+    if (!ADUC_HashUtils_ContextInput(&context, buffer, bufferLen))
+    {
+        ADUC_HashUtils_ContextUnInit(&context);
+        return false;
+    }
+
+    return ADUC_HashUtils_ContextResult(&context, hashBase64, NULL);
+}
+
+/**
+ * @brief Checks if the hash of the @p buffer matches @p hash.
+ * @param buffer The buffer to check.
+ * @param bufferLen The length of the @p buffer.
+ * @param hash The expected hash.
+ * @param algorithm The algorithm of @p hash.
+ * @return bool True if the hash is valid and matches @p hash.
+ */
+static _Bool IsValidBufferForHash(const uint8_t* buffer, size_t bufferLen, const ADUC_Hash* hash, SHAversion algorithm)
+{
+    ADUC_HashUtils_Context context = { .evpContext = NULL };
+
+    if (!ADUC_HashUtils_ContextReset(&context, algorithm))
+    {
+        return false;
+    }
+
+    if (!ADUC_HashUtils_ContextInput(&context, buffer, bufferLen))
+    {
+        ADUC_HashUtils_ContextUnInit(&context);
+        return false;
+    }
+
+    return ADUC_HashUtils_ContextResultHash(&context, hash);
+}
+
+/**
+ * @brief The state shared by the threads of ADUC_HashUtils_VerifyFileChunks and ADUC_HashUtils_IsValidChunkRootHash.
+ */
+typedef struct tagADUC_ChunkVerification
+{
+    int fd; /**< The file. */
+    off_t fileSize; /**< The size of the file, or of its part that the chunks cover. */
+    size_t chunkSize; /**< The size of the chunks. */
+    const ADUC_Hash* chunkHashes; /**< The hashes of the chunks, or NULL to compute them into chunkDigests. */
+    size_t chunkCount; /**< The number of chunks. */
+    _Bool* chunkValid; /**< Whether each chunk is valid, or NULL. */
+    SHAversion algorithm; /**< The algorithm of chunkDigests. */
+    uint8_t* chunkDigests; /**< The computed digests of the chunks, of USHAHashSize(algorithm) bytes each. */
+    pthread_mutex_t mutex; /**< Guards nextChunk and allValid. */
+    size_t nextChunk; /**< The next chunk no thread has taken yet. */
+    _Bool allValid; /**< Whether all the chunks verified so far are valid. */
+} ADUC_ChunkVerification;
+
+/**
+ * @brief Reads exactly @p length bytes at @p offset of @p fd into @p buffer.
+ * @returns True on success, false on a read error or at the end of the file.
+ */
+static _Bool ReadFully(int fd, uint8_t* buffer, size_t length, off_t offset)
+{
+    while (length > 0)
+    {
+        const ssize_t count = pread(fd, buffer, length, offset);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count <= 0)
+        {
+            return false;
+        }
+
+        buffer += count;
+        length -= (size_t)count;
+        offset += count;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Computes the digest of @p buffer into @p digest, of USHAMaxHashSize bytes.
+ * @returns True on success.
+ */
+static _Bool HashBuffer(const uint8_t* buffer, size_t bufferLen, SHAversion algorithm, uint8_t* digest)
+{
+    ADUC_HashUtils_Context context = { .evpContext = NULL };
+
+    if (!ADUC_HashUtils_ContextReset(&context, algorithm))
+    {
+        return false;
+    }
+
+    if (!ADUC_HashUtils_ContextInput(&context, buffer, bufferLen))
+    {
+        ADUC_HashUtils_ContextUnInit(&context);
+        return false;
+    }
+
+    return FinishContext(&context, digest);
+}
+
+/**
+ * @brief Verifies, or computes the digests of, the chunks that no other thread has taken yet, one at a time, until
+ * there are none left.
+ * @param arg The ADUC_ChunkVerification.
+ * @returns NULL.
+ */
+static void* VerifyChunks(void* arg)
+{
+    ADUC_ChunkVerification* verification = arg;
+
+    uint8_t* buffer = malloc(verification->chunkSize);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&verification->mutex);
+        const size_t chunk = verification->nextChunk++;
+        pthread_mutex_unlock(&verification->mutex);
+
+        if (chunk >= verification->chunkCount)
+        {
+            break;
+        }
+
+        const off_t offset = (off_t)(chunk * verification->chunkSize);
+        _Bool valid = false;
+
+        (void)ADUC_Thermal_WaitForHeadroom(NULL);
+
+        if (buffer != NULL && offset < verification->fileSize)
+        {
+            const off_t remaining = verification->fileSize - offset;
+            const size_t length =
+                remaining < (off_t)verification->chunkSize ? (size_t)remaining : verification->chunkSize;
+
+            if (verification->chunkHashes == NULL)
+            {
+                uint8_t digest[USHAMaxHashSize];
+                const size_t digestSize = (size_t)USHAHashSize(verification->algorithm);
+
+                valid = ReadFully(verification->fd, buffer, length, offset)
+                    && HashBuffer(buffer, length, verification->algorithm, digest);
+                if (valid)
+                {
+                    memcpy(verification->chunkDigests + chunk * digestSize, digest, digestSize);
+                }
+            }
+            else
+            {
+                const ADUC_Hash* hash = verification->chunkHashes + chunk;
+                SHAversion algorithm;
+
+                valid = GetHashAlgorithm(hash, &algorithm) && ReadFully(verification->fd, buffer, length, offset)
+                    && IsValidBufferForHash(buffer, length, hash, algorithm);
+            }
+        }
+
+        if (verification->chunkValid != NULL)
+        {
+            verification->chunkValid[chunk] = valid;
+        }
+
+        if (!valid)
+        {
+            pthread_mutex_lock(&verification->mutex);
+            verification->allValid = false;
+            pthread_mutex_unlock(&verification->mutex);
+        }
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * @brief Runs VerifyChunks on the calling thread and up to @p threadCount - 1 more, until all the chunks of
+ * @p verification are done.
+ * @param verification The verification, with its file and chunks set.
+ * @param threadCount The most threads to hash on, or 0 for one per online CPU.
+ */
+static void RunChunkVerification(ADUC_ChunkVerification* verification, unsigned int threadCount)
+{
+    pthread_t* threads = NULL;
+    size_t startedThreads = 0;
+
+    if (threadCount == 0)
+    {
+        const long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = cpuCount > 0 ? (unsigned int)cpuCount : 1;
+    }
+
+    if (threadCount > verification->chunkCount)
+    {
+        threadCount = (unsigned int)verification->chunkCount;
+    }
+
+    // The calling thread verifies chunks too, so it still completes if no thread can be started.
+    if (threadCount > 1)
+    {
+        threads = calloc(threadCount - 1, sizeof(*threads));
+    }
+
+    if (threads != NULL)
+    {
+        while (startedThreads < threadCount - 1
+               && pthread_create(threads + startedThreads, NULL, VerifyChunks, verification) == 0)
+        {
+            ++startedThreads;
+        }
+    }
+
+    VerifyChunks(verification);
+
+    for (size_t i = 0; i < startedThreads; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+}
+
+_Bool ADUC_HashUtils_VerifyFileChunks(
+    const char* path,
+    size_t chunkSize,
+    const ADUC_Hash* chunkHashes,
+    size_t chunkCount,
+    unsigned int threadCount,
+    _Bool* chunkValid)
+{
+    _Bool success = false;
+    struct stat st;
+    ADUC_ChunkVerification verification = { .fd = -1, .mutex = PTHREAD_MUTEX_INITIALIZER, .allValid = true };
+
+    if (path == NULL || chunkSize == 0 || chunkHashes == NULL || chunkCount == 0)
+    {
+        return false;
+    }
+
+    verification.fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (verification.fd == -1 || fstat(verification.fd, &st) != 0)
+    {
+        Log_Error("Cannot open %s for chunk verification, errno: %d", path, errno);
+        if (chunkValid != NULL)
+        {
+            memset(chunkValid, 0, chunkCount * sizeof(*chunkValid));
+        }
+        goto done;
+    }
+
+    verification.fileSize = st.st_size;
+    verification.chunkSize = chunkSize;
+    verification.chunkHashes = chunkHashes;
+    verification.chunkCount = chunkCount;
+    verification.chunkValid = chunkValid;
+
+    RunChunkVerification(&verification, threadCount);
+
+    // The file must end in the last chunk.
+    success = verification.allValid && (uint64_t)st.st_size > (uint64_t)(chunkCount - 1) * chunkSize
+        && (uint64_t)st.st_size <= (uint64_t)chunkCount * chunkSize;
+
+done:
+    if (verification.fd != -1)
+    {
+        close(verification.fd);
+    }
+
+    pthread_mutex_destroy(&verification.mutex);
+
+    return success;
+}
+
+_Bool ADUC_HashUtils_IsValidChunkRootHash(
+    const char* path,
+    uint64_t size,
+    size_t chunkSize,
+    const char* rootHashBase64,
+    SHAversion algorithm,
+    unsigned int threadCount)
+{
+    _Bool success = false;
+    uint8_t rootDigest[USHAMaxHashSize];
+    ADUC_ChunkVerification verification = { .fd = -1, .mutex = PTHREAD_MUTEX_INITIALIZER, .allValid = true };
+
+    if (path == NULL || size == 0 || chunkSize == 0 || rootHashBase64 == NULL || (uint64_t)(off_t)size != size)
+    {
+        return false;
+    }
+
+    const size_t digestSize = (size_t)USHAHashSize(algorithm);
+    verification.chunkCount = (size_t)((size + chunkSize - 1) / chunkSize);
+    verification.chunkDigests = calloc(verification.chunkCount, digestSize);
+    if (verification.chunkDigests == NULL)
+    {
+        goto done;
+    }
+
+    // A block device has no size to stat, so only the given size is read, and a file may be longer.
+    verification.fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (verification.fd == -1)
+    {
+        Log_Error("Cannot open %s for chunk verification, errno: %d", path, errno);
+        goto done;
+    }
+
+    verification.fileSize = (off_t)size;
+    verification.chunkSize = chunkSize;
+    verification.algorithm = algorithm;
+
+    RunChunkVerification(&verification, threadCount);
+
+    if (!verification.allValid
+        || !HashBuffer(verification.chunkDigests, verification.chunkCount * digestSize, algorithm, rootDigest))
+    {
+        goto done;
+    }
+
+    success = CompareHashes(rootDigest, rootHashBase64, algorithm, NULL);
+
+done:
+    free(verification.chunkDigests);
+
+    if (verification.fd != -1)
+    {
+        close(verification.fd);
+    }
+
+    pthread_mutex_destroy(&verification.mutex);
+
+    return success;
+}
+
+/**
+ * @brief Helper functions returns the SHAversion associated with the @p hashTypeStr
+ * @param hashTypeStr the hash type to be used
+ * @param algorithm the destination to store the SHAversion
+ * @returns True if a hash type was found, false if it was not
+ */
+_Bool ADUC_HashUtils_GetShaVersionForTypeString(const char* hashTypeStr, SHAversion* algorithm)
+{
+    bool success = true;
+
+    if (strcasecmp(hashTypeStr, "sha1") == 0)
+    {
+        *algorithm = SHA1;
+    }
+    else if (strcasecmp(hashTypeStr, "sha224") == 0)
+    {
+        *algorithm = SHA224;
+    }
+    else if (strcasecmp(hashTypeStr, "sha256") == 0)
+    {
+        *algorithm = SHA256;
+    }
+    else if (strcasecmp(hashTypeStr, "sha384") == 0)
+    {
+        *algorithm = SHA384;
+    }
+    else if (strcasecmp(hashTypeStr, "sha512") == 0)
+    {
+        *algorithm = SHA512;
+    }
+    else
+    {
+        success = false;
+    }
+
+    return success;
+}
+
+/**
+ * @brief Free the ADUC_Hash struct members
+ * @param hash a pointer to an ADUC_Hash
+ */
+void ADUC_Hash_UnInit(ADUC_Hash* hash)
+{
+    free(hash->value);
+    hash->value = NULL;
+
+    free(hash->type);
+    hash->type = NULL;
+
+    hash->digestSize = 0;
+}
+
+/**
+ * @brief Initializes @p hash, see ADUC_Hash_Init and ADUC_Hash_InitInArena.
+ * @param hash A pointer to an ADUC_Hash struct whose member values will be allocated
+ * @param hashValue The value of the hash
+ * @param hashType The type of the hash
+ * @param arena The arena to allocate the member values from, or NULL to allocate them with malloc
+ * @returns True if successfully allocated, False if failure
+ */
+static _Bool HashInit(ADUC_Hash* hash, const char* hashValue, const char* hashType, ADUC_Arena* arena)
+{
+    _Bool success = false;
+
+    if (hash == NULL)
+    {
+        return false;
+    }
+
+    if (hashValue == NULL || hashType == NULL)
+    {
+        Log_Error("Invalid call to ADUC_Hash_Init with hashValue %s and hashType %s", hashValue, hashType);
+        return false;
+    }
+
+    hash->value = NULL;
+    hash->type = NULL;
+    hash->digestSize = 0;
+
+    if (arena != NULL)
+    {
+        hash->value = ADUC_Arena_Strdup(arena, hashValue);
+        hash->type = ADUC_Arena_Strdup(arena, hashType);
+        if (hash->value == NULL || hash->type == NULL)
+        {
+            // Whatever was copied is freed with the arena.
+            hash->value = NULL;
+            hash->type = NULL;
+            return false;
+        }
+    }
+    else if (mallocAndStrcpy_s(&(hash->value), hashValue) != 0 || mallocAndStrcpy_s(&(hash->type), hashType) != 0)
+    {
+        goto done;
+    }
+
+    // Resolve the type and decode the value once, so that verifications compare the digests directly. A value that
+    // doesn't decode is kept as is, for the verifications to report.
+    SHAversion algorithm;
+    if (ADUC_HashUtils_GetShaVersionForTypeString(hashType, &algorithm)
+        && DecodeBase64Digest(hashValue, hash->digest, (size_t)USHAHashSize(algorithm)))
+    {
+        hash->algorithm = (int)algorithm;
+        hash->digestSize = (size_t)USHAHashSize(algorithm);
+    }
+
+    success = true;
+
+done:
+
+    if (!success)
+    {
+        ADUC_Hash_UnInit(hash);
+    }
+
+    return success;
+}
+
+/**
+ * @brief Allocates the memory for the ADUC_Hash struct member values
+ * @param hash A pointer to an ADUC_Hash struct whose member values will be allocated
+ * @param hashValue The value of the hash
+ * @param hashType The type of the hash
+ * @returns True if successfully allocated, False if failure
+ */
+_Bool ADUC_Hash_Init(ADUC_Hash* hash, const char* hashValue, const char* hashType)
+{
+    return HashInit(hash, hashValue, hashType, NULL);
+}
+
+_Bool ADUC_Hash_InitInArena(ADUC_Hash* hash, const char* hashValue, const char* hashType, ADUC_Arena* arena)
+{
+    return arena != NULL && HashInit(hash, hashValue, hashType, arena);
+}
+
+/**
+ * @brief Frees an array of ADUC_Hashes of size @p hashCount
+ * @param hashCount the size of @p hashArray
+ * @param hashArray a pointer to an array of ADUC_Hash structs
+ */
+void ADUC_Hash_FreeArray(size_t hashCount, ADUC_Hash* hashArray)
+{
+    for (size_t hash_index = 0; hash_index < hashCount; ++hash_index)
+    {
+        ADUC_Hash* hashEntity = hashArray + hash_index;
+        ADUC_Hash_UnInit(hashEntity);
+    }
+    free(hashArray);
+}
+
+/**
+ * @brief Free the ADUC_DownloadVerifiedFile struct members
+ * @param verifiedFile a pointer to an ADUC_DownloadVerifiedFile
+ */
+void ADUC_DownloadVerifiedFile_UnInit(ADUC_DownloadVerifiedFile* verifiedFile)
+{
+    if (verifiedFile == NULL)
+    {
+        return;
+    }
+
+    free(verifiedFile->FilePath);
+    free(verifiedFile->HashType);
+    free(verifiedFile->HashValue);
+    memset(verifiedFile, 0, sizeof(*verifiedFile));
 }
 
 /**
- * @brief Checks if the hash of the file at @p path matches @p hashBase64
- *
- * @param path The path to the file to check
- * @param algorithm The hashing algorithm to use to calculate the hash.
- * @param hash [out] The pointer to output buffer. Caller must call free() when done with the returned buffer.
- * @return bool True if the hash data is successfully generated.
+ * @brief Records that the file at @p path has been verified against @p hashBase64.
+ * The current file size and modification time are captured so that the verification
+ * can be reused later without re-hashing the file.
+ * @param verifiedFile A pointer to an ADUC_DownloadVerifiedFile struct whose member values will be allocated.
+ * @param path The path to the verified file.
+ * @param hashType The type of the verified hash.
+ * @param hashBase64 The verified hash value.
+ * @returns True if successfully initialized, False if failure
  */
-_Bool ADUC_HashUtils_GetFileHash(const char* path, SHAversion algorithm, char** hash)
+_Bool ADUC_DownloadVerifiedFile_Init(
+    ADUC_DownloadVerifiedFile* verifiedFile, const char* path, const char* hashType, const char* hashBase64)
 {
     _Bool success = false;
-    FILE* file = NULL;
+    struct stat st;
 
-    if (hash == NULL)
+    if (verifiedFile == NULL || path == NULL || hashType == NULL || hashBase64 == NULL)
     {
-        Log_Error("Invalid input. 'hash' is NULL.");
-        goto done;
+        return false;
     }
 
-    *hash = NULL;
+    memset(verifiedFile, 0, sizeof(*verifiedFile));
 
-    file = fopen(path, "rb");
-    if (file == NULL)
+    if (stat(path, &st) != 0)
     {
-        // Sometime we call this function to check whether the file is already exist.
-        // So, log info here instead of error.
-        Log_Info("No such file or directory: %s", path);
+        Log_Error("Cannot stat verified file: %s", path);
         goto done;
     }
 
-    USHAContext context;
-
-    if (USHAReset(&context, algorithm) != 0)
+    if (mallocAndStrcpy_s(&(verifiedFile->FilePath), path) != 0)
     {
-        Log_Error("Error in SHA Reset, SHAversion: %d", algorithm);
         goto done;
-    };
+    }
 
-    // Repeatedly read and hash chunks of the file
-    while (!feof(file))
+    if (mallocAndStrcpy_s(&(verifiedFile->HashType), hashType) != 0)
     {
-        uint8_t buffer[USHA_Max_Message_Block_Size];
-        const size_t readSize = fread(buffer, sizeof(buffer[0]), ARRAY_SIZE(buffer), file);
-        if (readSize == 0)
-        {
-            if (ferror(file))
-            {
-                Log_Error("Error reading file content.");
-                goto done;
-            }
-
-            // At the end of file. We're done here.
-            break;
-        }
+        goto done;
+    }
 
-        if (USHAInput(&context, buffer, readSize) != 0)
-        {
-            Log_Error("Error in SHA Input, SHAversion: %d", algorithm);
-            goto done;
-        };
+    if (mallocAndStrcpy_s(&(verifiedFile->HashValue), hashBase64) != 0)
+    {
+        goto done;
     }
 
-    success = GetResultAndCompareHashes(&context, NULL, algorithm, hash);
+    verifiedFile->SizeInBytes = (uint64_t)st.st_size;
+    verifiedFile->ModifiedTimeSec = (int64_t)st.st_mtim.tv_sec;
+    verifiedFile->ModifiedTimeNsec = (int64_t)st.st_mtim.tv_nsec;
+    verifiedFile->ChangeTimeSec = (int64_t)st.st_ctim.tv_sec;
+    verifiedFile->ChangeTimeNsec = (int64_t)st.st_ctim.tv_nsec;
 
-done:
+    success = true;
 
-    if (file != NULL)
+done:
+    if (!success)
     {
-        fclose(file);
+        ADUC_DownloadVerifiedFile_UnInit(verifiedFile);
     }
 
     return success;
 }
 
 /**
- * @brief Get file hash type at specified index.
- * @param hashArray The ADUC_Hash array.
- * @param arraySize Size of array.
- * @param hashIndex Index of the hash to return.
- *
- * @return Hash type if succeeded. Otherwise, return NULL.
+ * @brief Checks whether @p verifiedFile still vouches for the file at @p path having the hash @p hashBase64.
+ * This is true if the recorded path and hash match, and the file size and modification time are unchanged.
+ * @param verifiedFile The verified file record.
+ * @param path The path to the file.
+ * @param hashType The expected hash type.
+ * @param hashBase64 The expected hash value.
+ * @returns True if the file doesn't need to be hashed again.
  */
-char* ADUC_HashUtils_GetHashType(const ADUC_Hash* hashArray, size_t arraySize, size_t index)
+_Bool ADUC_DownloadVerifiedFile_IsCurrent(
+    const ADUC_DownloadVerifiedFile* verifiedFile, const char* path, const char* hashType, const char* hashBase64)
 {
-    if (index >= arraySize)
+    struct stat st;
+
+    if (verifiedFile == NULL || verifiedFile->FilePath == NULL || verifiedFile->HashType == NULL
+        || verifiedFile->HashValue == NULL || path == NULL || hashType == NULL || hashBase64 == NULL)
     {
-        return NULL;
+        return false;
     }
 
-    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-    return hashArray[index].type;
+    if (strcmp(verifiedFile->FilePath, path) != 0 || strcasecmp(verifiedFile->HashType, hashType) != 0
+        || strcmp(verifiedFile->HashValue, hashBase64) != 0)
+    {
+        return false;
+    }
+
+    if (stat(path, &st) != 0)
+    {
+        return false;
+    }
+
+    return verifiedFile->SizeInBytes == (uint64_t)st.st_size
+        && verifiedFile->ModifiedTimeSec == (int64_t)st.st_mtim.tv_sec
+        && verifiedFile->ModifiedTimeNsec == (int64_t)st.st_mtim.tv_nsec;
 }
 
 /**
- * @brief Get file hash value at specified index.
- * @param hashArray The ADUC_Hash array.
- * @param arraySize Size of array.
- * @param hashIndex Index of the hash to return.
- *
- * @return Hash value if succeeded. Otherwise, return NULL.
+ * @brief A verified file record, as persisted by ADUC_DownloadVerifiedFile_Persist.
  */
-char* ADUC_HashUtils_GetHashValue(const ADUC_Hash* hashArray, size_t arraySize, size_t index)
+typedef struct tagADUC_VerifiedFileRecord
 {
-    if (index >= arraySize)
-    {
-        return NULL;
-    }
+    char HashType[ADUC_VERIFIED_FILE_RECORD_MAX_HASH_TYPE + 1]; /**< The verified hash type. */
+    char HashValue[ADUC_VERIFIED_FILE_RECORD_MAX_HASH_VALUE + 1]; /**< The verified hash value. */
+    uint64_t SizeInBytes; /**< The file size. */
+    int64_t ModifiedTimeSec; /**< The file modification time, seconds part. */
+    int64_t ModifiedTimeNsec; /**< The file modification time, nanoseconds part. */
+    int64_t ChangeTimeSec; /**< The file status change time, seconds part. */
+    int64_t ChangeTimeNsec; /**< The file status change time, nanoseconds part. */
+    const char* FilePath; /**< The file path, within Buffer. */
+    char Buffer[ADUC_VERIFIED_FILE_RECORD_MAX_SIZE]; /**< The record as read. */
+} ADUC_VerifiedFileRecord;
 
-    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-    return hashArray[index].value;
+/**
+ * @brief Checks that only the effective user can have written the store entry with status @p st.
+ * @param st The status of the entry.
+ * @param type The expected file type, S_IFREG or S_IFDIR.
+ * @returns True if the entry has type @p type, is owned by the effective user and isn't writable by others.
+ */
+static _Bool IsTrustedStoreEntry(const struct stat* st, mode_t type)
+{
+    return (st->st_mode & S_IFMT) == type && st->st_uid == geteuid() && (st->st_mode & (S_IWGRP | S_IWOTH)) == 0;
 }
 
 /**
- * @brief Checks if the hash of the file at @p path matches @p hashBase64
- *
- * @param path The path to the file to check
- * @param hashBase64 The expected hash of the file at @p path
- * @param algorithm The hashing algorithm to use to calculate the hash.
- * @return bool True if the hash is valid and matches @p hashBase64
+ * @brief Formats the path of the record of the file with status @p st in @p folder, named after its device and
+ * inode, so that a file replaced by another one, e.g. with a rename, has no record.
+ * @param folder The store folder.
+ * @param st The status of the file.
+ * @param buffer The buffer to receive the path.
+ * @param bufferSize The size of @p buffer.
+ * @returns True on success, false if the path doesn't fit.
  */
-_Bool ADUC_HashUtils_IsValidFileHash(const char* path, const char* hashBase64, SHAversion algorithm)
+static _Bool GetVerifiedFileRecordPath(const char* folder, const struct stat* st, char* buffer, size_t bufferSize)
+{
+    const int len =
+        snprintf(buffer, bufferSize, "%s/%" PRIx64 "-%" PRIx64, folder, (uint64_t)st->st_dev, (uint64_t)st->st_ino);
+    return len > 0 && (size_t)len < bufferSize;
+}
+
+/**
+ * @brief Reads the verified file record at @p recordPath.
+ * @details The record is ignored unless it's a regular file owned by the effective user and not writable by others,
+ * i.e. only the process itself can vouch for its past verifications.
+ * @param recordPath The path to the record.
+ * @param record Receives the record.
+ * @returns True on success, false if the record is missing, malformed or can't be trusted.
+ */
+static _Bool ReadVerifiedFileRecord(const char* recordPath, ADUC_VerifiedFileRecord* record)
 {
     _Bool success = false;
+    struct stat st;
+    ssize_t len = 0;
+    int pathOffset = 0;
 
-    FILE* file = fopen(path, "rb");
-    if (file == NULL)
+    const int fd = open(recordPath, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1)
     {
-        Log_Error("Cannot open file: %s", path);
-        goto done;
+        return false;
     }
 
-    USHAContext context;
-
-    if (USHAReset(&context, algorithm) != 0)
+    if (fstat(fd, &st) != 0 || !IsTrustedStoreEntry(&st, S_IFREG))
     {
-        Log_Error("Error in SHA Reset, SHAversion: %d", algorithm);
         goto done;
-    };
-
-    // Repeatedly read and hash chunks of the file
-    while (!feof(file))
-    {
-        uint8_t buffer[USHA_Max_Message_Block_Size];
-        const size_t readSize = fread(buffer, sizeof(buffer[0]), ARRAY_SIZE(buffer), file);
-        if (readSize == 0)
-        {
-            if (ferror(file))
-            {
-                Log_Error("Error reading file content.");
-                goto done;
-            }
-
-            // At the end of file. We're done here.
-            break;
-        }
-
-        if (USHAInput(&context, buffer, readSize) != 0)
-        {
-            Log_Error("Error in SHA Input, SHAversion: %d", algorithm);
-            goto done;
-        };
     }
 
-    success = GetResultAndCompareHashes(&context, hashBase64, algorithm, NULL);
-    if (!success)
+    len = read(fd, record->Buffer, sizeof(record->Buffer) - 1);
+    if (len <= 0)
     {
         goto done;
     }
 
-done:
-    if (file != NULL)
+    record->Buffer[len] = '\0';
+
+    if (sscanf(
+            record->Buffer,
+            "%31s %127s %" SCNu64 " %" SCNd64 " %" SCNd64 " %" SCNd64 " %" SCNd64 " %n",
+            record->HashType,
+            record->HashValue,
+            &record->SizeInBytes,
+            &record->ModifiedTimeSec,
+            &record->ModifiedTimeNsec,
+            &record->ChangeTimeSec,
+            &record->ChangeTimeNsec,
+            &pathOffset)
+            != 7
+        || pathOffset == 0 || record->Buffer[pathOffset] != '/')
     {
-        fclose(file);
+        goto done;
     }
 
+    record->FilePath = record->Buffer + pathOffset;
+    success = true;
+
+done:
+    close(fd);
     return success;
 }
 
 /**
- * @brief Checks if the hash of the @p buffer matches @p hashBase64
- *
- * @param buffer The buffer to check
- * @param bufferLen The length of the @p buffer
- * @param hashBase64 The expected hash of the buffer @p buffer
- * @return bool True if the hash is valid and matches @p hashBase64
+ * @brief Checks whether the file with status @p st is still the one recorded in @p record.
+ * @details Unlike the modification time, the status change time can't be set back: writing to the file, or
+ * restoring its modification time afterwards, changes it.
+ * @param record The verified file record.
+ * @param st The status of the file.
+ * @returns True if the file size, modification time and status change time are unchanged.
  */
-_Bool ADUC_HashUtils_IsValidBufferHash(
-    const uint8_t* buffer, size_t bufferLen, const char* hashBase64, SHAversion algorithm)
+static _Bool IsVerifiedFileRecordCurrent(const ADUC_VerifiedFileRecord* record, const struct stat* st)
+{
+    return record->SizeInBytes == (uint64_t)st->st_size && record->ModifiedTimeSec == (int64_t)st->st_mtim.tv_sec
+        && record->ModifiedTimeNsec == (int64_t)st->st_mtim.tv_nsec
+        && record->ChangeTimeSec == (int64_t)st->st_ctim.tv_sec
+        && record->ChangeTimeNsec == (int64_t)st->st_ctim.tv_nsec;
+}
+
+/**
+ * @brief Removes the records of @p folder whose files are gone or changed, which no lookup would match anymore.
+ * @param folder The store folder.
+ */
+static void PruneVerifiedFileStore(const char* folder)
 {
-    USHAContext context;
+    char recordPath[PATH_MAX];
+    char expectedPath[PATH_MAX];
+    ADUC_VerifiedFileRecord* record = malloc(sizeof(*record));
+    DIR* dir = opendir(folder);
 
-    if (USHAReset(&context, algorithm) != 0)
+    if (record == NULL || dir == NULL)
     {
-        Log_Error("Error in SHA Reset, SHAversion: %d", algorithm);
-        return false;
+        goto done;
     }
 
-    if (USHAInput(&context, buffer, bufferLen) != 0)
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dir)) != NULL)
     {
-        Log_Error("Error in SHA Input, SHAversion: %d", algorithm);
-        return false;
+        struct stat st;
+
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        if (snprintf(recordPath, sizeof(recordPath), "%s/%s", folder, entry->d_name) >= (int)sizeof(recordPath))
+        {
+            continue;
+        }
+
+        const _Bool current = ReadVerifiedFileRecord(recordPath, record) && stat(record->FilePath, &st) == 0
+            && GetVerifiedFileRecordPath(folder, &st, expectedPath, sizeof(expectedPath))
+            && strcmp(recordPath, expectedPath) == 0 && IsVerifiedFileRecordCurrent(record, &st);
+
+        if (!current)
+        {
+            unlink(recordPath);
+        }
+    }
+
+done:
+    if (dir != NULL)
+    {
+        closedir(dir);
     }
 
-    return GetResultAndCompareHashes(&context, hashBase64, algorithm, NULL);
+    free(record);
 }
 
 /**
- * @brief Helper functions returns the SHAversion associated with the @p hashTypeStr
- * @param hashTypeStr the hash type to be used
- * @param algorithm the destination to store the SHAversion
- * @returns True if a hash type was found, false if it was not
+ * @brief Sets the folder ADUC_DownloadVerifiedFile_Persist persists verified file records to, and removes the stale
+ * records in it.
+ * @details The folder is created if needed. It's only used if it's owned by the effective user and not writable by
+ * others, so that only the process itself can vouch for its past verifications.
+ * @param folder The folder, or NULL to persist nothing.
+ * @returns True on success, false if the folder can't be used; nothing is persisted then.
  */
-_Bool ADUC_HashUtils_GetShaVersionForTypeString(const char* hashTypeStr, SHAversion* algorithm)
+_Bool ADUC_DownloadVerifiedFile_InitStore(const char* folder)
 {
-    bool success = true;
+    _Bool success = true;
+    struct stat st;
 
-    if (strcasecmp(hashTypeStr, "sha1") == 0)
-    {
-        *algorithm = SHA1;
-    }
-    else if (strcasecmp(hashTypeStr, "sha224") == 0)
-    {
-        *algorithm = SHA224;
-    }
-    else if (strcasecmp(hashTypeStr, "sha256") == 0)
-    {
-        *algorithm = SHA256;
-    }
-    else if (strcasecmp(hashTypeStr, "sha384") == 0)
-    {
-        *algorithm = SHA384;
-    }
-    else if (strcasecmp(hashTypeStr, "sha512") == 0)
-    {
-        *algorithm = SHA512;
-    }
-    else
+    pthread_mutex_lock(&s_verifiedFileStoreMutex);
+
+    free(s_verifiedFileStoreFolder);
+    s_verifiedFileStoreFolder = NULL;
+
+    if (folder != NULL)
     {
-        success = false;
+        if (mkdir(folder, S_IRWXU) != 0 && errno != EEXIST)
+        {
+            Log_Warn("Cannot create the verified file store %s, errno: %d", folder, errno);
+            success = false;
+        }
+        else if (lstat(folder, &st) != 0 || !IsTrustedStoreEntry(&st, S_IFDIR))
+        {
+            Log_Warn("Not using the verified file store %s: it can be written by others.", folder);
+            success = false;
+        }
+        else if (mallocAndStrcpy_s(&s_verifiedFileStoreFolder, folder) != 0)
+        {
+            success = false;
+        }
+        else
+        {
+            PruneVerifiedFileStore(folder);
+        }
     }
 
+    pthread_mutex_unlock(&s_verifiedFileStoreMutex);
+
     return success;
 }
 
 /**
- * @brief Free the ADUC_Hash struct members
- * @param hash a pointer to an ADUC_Hash
+ * @brief Stops persisting verified file records, leaving the persisted ones as is.
  */
-void ADUC_Hash_UnInit(ADUC_Hash* hash)
+void ADUC_DownloadVerifiedFile_UninitStore(void)
 {
-    free(hash->value);
-    hash->value = NULL;
+    pthread_mutex_lock(&s_verifiedFileStoreMutex);
 
-    free(hash->type);
-    hash->type = NULL;
+    free(s_verifiedFileStoreFolder);
+    s_verifiedFileStoreFolder = NULL;
+
+    pthread_mutex_unlock(&s_verifiedFileStoreMutex);
 }
 
 /**
- * @brief Allocates the memory for the ADUC_Hash struct member values
- * @param hash A pointer to an ADUC_Hash struct whose member values will be allocated
- * @param hashValue The value of the hash
- * @param hashType The type of the hash
- * @returns True if successfully allocated, False if failure
+ * @brief Persists @p verifiedFile to the verified file store, see ADUC_DownloadVerifiedFile_InitStore, so that the
+ * verification can be reused after the agent restarts, see ADUC_DownloadVerifiedFile_InitFromPersisted.
+ * @param verifiedFile The verified file record. Nothing is persisted if the file has changed since.
+ * @returns True if persisted. False if the file has changed, or there's no verified file store.
  */
-_Bool ADUC_Hash_Init(ADUC_Hash* hash, const char* hashValue, const char* hashType)
+_Bool ADUC_DownloadVerifiedFile_Persist(const ADUC_DownloadVerifiedFile* verifiedFile)
 {
     _Bool success = false;
+    struct stat st;
+    char recordPath[PATH_MAX];
+    char tempPath[PATH_MAX + sizeof(".tmp")];
+    char* value = NULL;
+    int fd = -1;
 
-    if (hash == NULL)
+    if (verifiedFile == NULL || verifiedFile->FilePath == NULL || verifiedFile->HashType == NULL
+        || verifiedFile->HashValue == NULL || verifiedFile->FilePath[0] != '/')
     {
         return false;
     }
 
-    if (hashValue == NULL || hashType == NULL)
+    if (stat(verifiedFile->FilePath, &st) != 0 || verifiedFile->SizeInBytes != (uint64_t)st.st_size
+        || verifiedFile->ModifiedTimeSec != (int64_t)st.st_mtim.tv_sec
+        || verifiedFile->ModifiedTimeNsec != (int64_t)st.st_mtim.tv_nsec
+        || verifiedFile->ChangeTimeSec != (int64_t)st.st_ctim.tv_sec
+        || verifiedFile->ChangeTimeNsec != (int64_t)st.st_ctim.tv_nsec)
     {
-        Log_Error("Invalid call to ADUC_Hash_Init with hashValue %s and hashType %s", hashValue, hashType);
         return false;
     }
 
-    hash->value = NULL;
-    hash->type = NULL;
-
-    if (mallocAndStrcpy_s(&(hash->value), hashValue) != 0)
+    value = malloc(ADUC_VERIFIED_FILE_RECORD_MAX_SIZE);
+    if (value == NULL)
     {
-        goto done;
+        return false;
     }
 
-    if (mallocAndStrcpy_s(&(hash->type), hashType) != 0)
+    const int len = snprintf(
+        value,
+        ADUC_VERIFIED_FILE_RECORD_MAX_SIZE,
+        "%s %s %" PRIu64 " %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64 " %s",
+        verifiedFile->HashType,
+        verifiedFile->HashValue,
+        verifiedFile->SizeInBytes,
+        verifiedFile->ModifiedTimeSec,
+        verifiedFile->ModifiedTimeNsec,
+        verifiedFile->ChangeTimeSec,
+        verifiedFile->ChangeTimeNsec,
+        verifiedFile->FilePath);
+
+    if (len < 0 || len >= ADUC_VERIFIED_FILE_RECORD_MAX_SIZE)
     {
         goto done;
     }
 
-    success = true;
+    pthread_mutex_lock(&s_verifiedFileStoreMutex);
 
-done:
+    if (s_verifiedFileStoreFolder != NULL
+        && GetVerifiedFileRecordPath(s_verifiedFileStoreFolder, &st, recordPath, sizeof(recordPath)))
+    {
+        snprintf(tempPath, sizeof(tempPath), "%s.tmp", recordPath);
+
+        // Replaced atomically, so that a crash doesn't leave a truncated record behind.
+        fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (fd != -1)
+        {
+            success = write(fd, value, (size_t)len) == len;
+            success = close(fd) == 0 && success;
+            success = success && rename(tempPath, recordPath) == 0;
+
+            if (!success)
+            {
+                unlink(tempPath);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&s_verifiedFileStoreMutex);
 
     if (!success)
     {
-        ADUC_Hash_UnInit(hash);
+        Log_Debug("Cannot persist the verified hash of %s", verifiedFile->FilePath);
     }
 
+done:
+    free(value);
     return success;
 }
 
 /**
- * @brief Frees an array of ADUC_Hashes of size @p hashCount
- * @param hashCount the size of @p hashArray
- * @param hashArray a pointer to an array of ADUC_Hash structs
+ * @brief Initializes @p verifiedFile from the record ADUC_DownloadVerifiedFile_Persist persisted for the file at
+ * @p path, if it is for @p hashBase64 and the file size, modification time and status change time are unchanged.
+ * @param verifiedFile A pointer to an ADUC_DownloadVerifiedFile struct whose member values will be allocated.
+ * @param path The path to the file.
+ * @param hashType The expected hash type.
+ * @param hashBase64 The expected hash value.
+ * @returns True if the file doesn't need to be hashed again.
  */
-void ADUC_Hash_FreeArray(size_t hashCount, ADUC_Hash* hashArray)
+_Bool ADUC_DownloadVerifiedFile_InitFromPersisted(
+    ADUC_DownloadVerifiedFile* verifiedFile, const char* path, const char* hashType, const char* hashBase64)
 {
-    for (size_t hash_index = 0; hash_index < hashCount; ++hash_index)
+    _Bool found = false;
+    struct stat st;
+    char recordPath[PATH_MAX];
+    ADUC_VerifiedFileRecord* record = NULL;
+
+    if (verifiedFile == NULL || path == NULL || hashType == NULL || hashBase64 == NULL)
     {
-        ADUC_Hash* hashEntity = hashArray + hash_index;
-        ADUC_Hash_UnInit(hashEntity);
+        return false;
     }
-    free(hashArray);
+
+    if (stat(path, &st) != 0 || (record = malloc(sizeof(*record))) == NULL)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&s_verifiedFileStoreMutex);
+
+    found = s_verifiedFileStoreFolder != NULL
+        && GetVerifiedFileRecordPath(s_verifiedFileStoreFolder, &st, recordPath, sizeof(recordPath))
+        && ReadVerifiedFileRecord(recordPath, record);
+
+    pthread_mutex_unlock(&s_verifiedFileStoreMutex);
+
+    if (!found || strcmp(record->FilePath, path) != 0 || strcasecmp(record->HashType, hashType) != 0
+        || strcmp(record->HashValue, hashBase64) != 0 || !IsVerifiedFileRecordCurrent(record, &st))
+    {
+        free(record);
+        return false;
+    }
+
+    free(record);
+
+    if (!ADUC_DownloadVerifiedFile_Init(verifiedFile, path, hashType, hashBase64))
+    {
+        return false;
+    }
+
+    // The file may have changed since it was checked above.
+    if (verifiedFile->SizeInBytes != (uint64_t)st.st_size
+        || verifiedFile->ModifiedTimeSec != (int64_t)st.st_mtim.tv_sec
+        || verifiedFile->ModifiedTimeNsec != (int64_t)st.st_mtim.tv_nsec
+        || verifiedFile->ChangeTimeSec != (int64_t)st.st_ctim.tv_sec
+        || verifiedFile->ChangeTimeNsec != (int64_t)st.st_ctim.tv_nsec)
+    {
+        ADUC_DownloadVerifiedFile_UnInit(verifiedFile);
+        return false;
+    }
+
+    return true;
 }
@@ -10,9 +10,15 @@
 #include <catch2/catch.hpp>
 using Catch::Matchers::Equals;
 
+#include <algorithm>
 #include <array>
 #include <fstream>
 #include <unordered_map>
+#include <vector>
+#include <dirent.h> // for opendir, readdir
+#include <fcntl.h> // for AT_FDCWD
+#include <sys/stat.h> // for stat, chmod, utimensat
+#include <unistd.h> // for write, close
 
 // To generate file hashes:
 // openssl dgst -binary -sha256 < test.bin  | openssl base64
@@ -307,3 +313,514 @@ TEST_CASE("ADUC_HashUtils_GetFileHash - LargeFile")
         hash = nullptr;
     }
 }
+
+TEST_CASE("ADUC_DownloadVerifiedFile_IsCurrent")
+{
+    SmallFile testFile;
+    const char* hashValue = testFile.GetDataHashBase64(SHAversion::SHA256);
+
+    ADUC_DownloadVerifiedFile verifiedFile = {};
+    REQUIRE(ADUC_DownloadVerifiedFile_Init(&verifiedFile, testFile.Filename(), "sha256", hashValue));
+    CHECK(verifiedFile.SizeInBytes == testFile.GetDataByteLen());
+
+    SECTION("Unchanged file")
+    {
+        CHECK(ADUC_DownloadVerifiedFile_IsCurrent(&verifiedFile, testFile.Filename(), "SHA256", hashValue));
+    }
+
+    SECTION("Different expectation")
+    {
+        CHECK_FALSE(ADUC_DownloadVerifiedFile_IsCurrent(&verifiedFile, "/tmp/not-the-same-file", "sha256", hashValue));
+        CHECK_FALSE(ADUC_DownloadVerifiedFile_IsCurrent(&verifiedFile, testFile.Filename(), "sha384", hashValue));
+        CHECK_FALSE(ADUC_DownloadVerifiedFile_IsCurrent(
+            &verifiedFile, testFile.Filename(), "sha256", "xxXXXgW/Nr695oSEGijw/UPGmFCj3OX+26aZKO46iZE="));
+    }
+
+    SECTION("Modified file")
+    {
+        std::ofstream file{ testFile.Filename(), std::ios::app | std::ios::binary };
+        file << "more data";
+        file.close();
+
+        CHECK_FALSE(ADUC_DownloadVerifiedFile_IsCurrent(&verifiedFile, testFile.Filename(), "sha256", hashValue));
+    }
+
+    ADUC_DownloadVerifiedFile_UnInit(&verifiedFile);
+    CHECK(verifiedFile.FilePath == nullptr);
+}
+
+/**
+ * @brief Removes the verified file store folder @p folder and its records.
+ */
+static void RemoveVerifiedFileStore(const std::string& folder)
+{
+    DIR* dir = opendir(folder.c_str());
+    if (dir != nullptr)
+    {
+        struct dirent* entry = nullptr;
+        while ((entry = readdir(dir)) != nullptr)
+        {
+            if (entry->d_name[0] != '.')
+            {
+                (void)std::remove((folder + "/" + entry->d_name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+
+    (void)rmdir(folder.c_str());
+}
+
+TEST_CASE("ADUC_DownloadVerifiedFile_Persist")
+{
+    SmallFile testFile;
+    const char* hashValue = testFile.GetDataHashBase64(SHAversion::SHA256);
+
+    char storeFolder[] = "/tmp/verifiedfilesXXXXXX";
+    REQUIRE(mkdtemp(storeFolder) != nullptr);
+
+    ADUC_DownloadVerifiedFile verifiedFile = {};
+    ADUC_DownloadVerifiedFile persistedFile = {};
+
+    REQUIRE(ADUC_DownloadVerifiedFile_Init(&verifiedFile, testFile.Filename(), "sha256", hashValue));
+
+    // No store to persist to yet.
+    CHECK_FALSE(ADUC_DownloadVerifiedFile_Persist(&verifiedFile));
+
+    REQUIRE(ADUC_DownloadVerifiedFile_InitStore(storeFolder));
+
+    // Nothing persisted yet.
+    CHECK_FALSE(ADUC_DownloadVerifiedFile_InitFromPersisted(&persistedFile, testFile.Filename(), "sha256", hashValue));
+
+    REQUIRE(ADUC_DownloadVerifiedFile_Persist(&verifiedFile));
+
+    SECTION("Unchanged file")
+    {
+        REQUIRE(ADUC_DownloadVerifiedFile_InitFromPersisted(
+            &persistedFile, testFile.Filename(), "SHA256", hashValue));
+        CHECK(ADUC_DownloadVerifiedFile_IsCurrent(&persistedFile, testFile.Filename(), "sha256", hashValue));
+        CHECK(persistedFile.SizeInBytes == verifiedFile.SizeInBytes);
+    }
+
+    SECTION("Different expectation")
+    {
+        CHECK_FALSE(
+            ADUC_DownloadVerifiedFile_InitFromPersisted(&persistedFile, testFile.Filename(), "sha384", hashValue));
+        CHECK_FALSE(ADUC_DownloadVerifiedFile_InitFromPersisted(
+            &persistedFile, testFile.Filename(), "sha256", "xxXXXgW/Nr695oSEGijw/UPGmFCj3OX+26aZKO46iZE="));
+    }
+
+    SECTION("Modified file")
+    {
+        std::ofstream file{ testFile.Filename(), std::ios::app | std::ios::binary };
+        file << "more data";
+        file.close();
+
+        CHECK_FALSE(
+            ADUC_DownloadVerifiedFile_InitFromPersisted(&persistedFile, testFile.Filename(), "sha256", hashValue));
+
+        // Nor is a stale record persisted again.
+        CHECK_FALSE(ADUC_DownloadVerifiedFile_Persist(&verifiedFile));
+    }
+
+    SECTION("Modified file with its modification time restored")
+    {
+        struct stat st = {};
+        REQUIRE(stat(testFile.Filename(), &st) == 0);
+
+        std::fstream file{ testFile.Filename(), std::ios::in | std::ios::out | std::ios::binary };
+        file << "forged";
+        file.close();
+
+        const struct timespec times[2] = { st.st_atim, st.st_mtim };
+        REQUIRE(utimensat(AT_FDCWD, testFile.Filename(), times, 0) == 0);
+
+        CHECK_FALSE(
+            ADUC_DownloadVerifiedFile_InitFromPersisted(&persistedFile, testFile.Filename(), "sha256", hashValue));
+    }
+
+    SECTION("Stale records are removed")
+    {
+        REQUIRE(std::remove(testFile.Filename()) == 0);
+        REQUIRE(ADUC_DownloadVerifiedFile_InitStore(storeFolder));
+
+        DIR* dir = opendir(storeFolder);
+        REQUIRE(dir != nullptr);
+        size_t recordCount = 0;
+        for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+        {
+            recordCount += entry->d_name[0] != '.' ? 1 : 0;
+        }
+        closedir(dir);
+        CHECK(recordCount == 0);
+
+        // For the destructor of testFile.
+        std::ofstream{ testFile.Filename() };
+    }
+
+    SECTION("Store writable by others")
+    {
+        REQUIRE(chmod(storeFolder, S_IRWXU | S_IRWXG | S_IRWXO) == 0);
+        CHECK_FALSE(ADUC_DownloadVerifiedFile_InitStore(storeFolder));
+        CHECK_FALSE(
+            ADUC_DownloadVerifiedFile_InitFromPersisted(&persistedFile, testFile.Filename(), "sha256", hashValue));
+    }
+
+    ADUC_DownloadVerifiedFile_UninitStore();
+    RemoveVerifiedFileStore(storeFolder);
+
+    ADUC_DownloadVerifiedFile_UnInit(&persistedFile);
+    ADUC_DownloadVerifiedFile_UnInit(&verifiedFile);
+}
+
+TEST_CASE("ADUC_HashUtils_Context - incremental hashing")
+{
+    LargeFile testFile;
+
+    // clang-format off
+    auto version = GENERATE( // NOLINT(google-build-using-namespace)
+        SHAversion::SHA1,
+        SHAversion::SHA256,
+        SHAversion::SHA512);
+    // clang-format on
+
+    auto chunkSize = GENERATE(static_cast<size_t>(7), static_cast<size_t>(1000), static_cast<size_t>(64 * 1024));
+
+    INFO("SHAversion: " << version << ", chunkSize: " << chunkSize);
+
+    ADUC_HashUtils_Context context = {};
+    REQUIRE(ADUC_HashUtils_ContextReset(&context, version));
+
+    const uint8_t* data = testFile.GetData();
+    size_t remaining = testFile.GetDataByteLen();
+    bool inputSucceeded = true;
+    while (remaining > 0 && inputSucceeded)
+    {
+        const size_t len = std::min(chunkSize, remaining);
+        inputSucceeded = ADUC_HashUtils_ContextInput(&context, data, len);
+        data += len; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        remaining -= len;
+    }
+    REQUIRE(inputSucceeded);
+
+    char* hash = nullptr;
+    REQUIRE(ADUC_HashUtils_ContextResult(&context, testFile.GetDataHashBase64(version), &hash));
+    CHECK_THAT(hash, Equals(testFile.GetDataHashBase64(version)));
+    // NOLINTNEXTLINE(cppcoreguidelines-owning-memory, cppcoreguidelines-no-malloc, hicpp-no-malloc)
+    free(hash);
+}
+
+TEST_CASE("ADUC_HashUtils_ContextInputFile - resume from a partial file")
+{
+    LargeFile testFile;
+
+    // clang-format off
+    auto version = GENERATE( // NOLINT(google-build-using-namespace)
+        SHAversion::SHA1,
+        SHAversion::SHA256);
+    // clang-format on
+
+    INFO("SHAversion: " << version);
+
+    // The first part of the content is on disk, the rest arrives later.
+    const size_t partialLen = testFile.GetDataByteLen() / 3;
+    char partialPath[] = "/tmp/tmpfileXXXXXX";
+    const int fd = mkstemp(partialPath);
+    REQUIRE(fd != -1);
+    REQUIRE(write(fd, testFile.GetData(), partialLen) == static_cast<ssize_t>(partialLen));
+    close(fd);
+
+    ADUC_HashUtils_Context context = {};
+    REQUIRE(ADUC_HashUtils_ContextReset(&context, version));
+    CHECK(ADUC_HashUtils_ContextInputFile(&context, partialPath));
+    CHECK(ADUC_HashUtils_ContextInput(
+        &context,
+        testFile.GetData() + partialLen, // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        testFile.GetDataByteLen() - partialLen));
+    CHECK(ADUC_HashUtils_ContextResult(&context, testFile.GetDataHashBase64(version), nullptr));
+    ADUC_HashUtils_ContextUnInit(&context);
+
+    REQUIRE(std::remove(partialPath) == 0);
+}
+
+TEST_CASE("ADUC_HashUtils_VerifyFileChunks")
+{
+    LargeFile testFile;
+
+    const size_t chunkSize = 64 * 1024;
+    const size_t chunkCount = (testFile.GetDataByteLen() + chunkSize - 1) / chunkSize;
+    REQUIRE(chunkCount == 9);
+
+    auto* chunkHashes = static_cast<ADUC_Hash*>(calloc(chunkCount, sizeof(ADUC_Hash)));
+    REQUIRE(chunkHashes != nullptr);
+
+    for (size_t i = 0; i < chunkCount; ++i)
+    {
+        const size_t offset = i * chunkSize;
+        ADUC_HashUtils_Context context = {};
+        char* hash = nullptr;
+        REQUIRE(ADUC_HashUtils_ContextReset(&context, SHAversion::SHA256));
+        REQUIRE(ADUC_HashUtils_ContextInput(
+            &context,
+            testFile.GetData() + offset, // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+            std::min(chunkSize, testFile.GetDataByteLen() - offset)));
+        REQUIRE(ADUC_HashUtils_ContextResult(&context, nullptr, &hash));
+        REQUIRE(ADUC_Hash_Init(chunkHashes + i, hash, "sha256"));
+        free(hash);
+    }
+
+    std::array<bool, 9> valid{};
+    bool* chunkValid = valid.data();
+
+    SECTION("All chunks are valid")
+    {
+        auto threadCount = GENERATE(0U, 1U, 4U); // NOLINT(google-build-using-namespace)
+        INFO("threadCount: " << threadCount);
+
+        CHECK(ADUC_HashUtils_VerifyFileChunks(
+            testFile.Filename(), chunkSize, chunkHashes, chunkCount, threadCount, chunkValid));
+        CHECK(std::count(valid.begin(), valid.end(), true) == static_cast<ptrdiff_t>(chunkCount));
+    }
+
+    SECTION("Only the corrupted chunks are invalid")
+    {
+        std::vector<uint8_t> data{ testFile.GetData(), testFile.GetData() + testFile.GetDataByteLen() };
+        data[3 * chunkSize + 100] ^= 0xFF;
+        data[8 * chunkSize + 1] ^= 0xFF;
+
+        char corruptPath[] = "/tmp/tmpfileXXXXXX";
+        const int fd = mkstemp(corruptPath);
+        REQUIRE(fd != -1);
+        REQUIRE(write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+        close(fd);
+
+        CHECK_FALSE(ADUC_HashUtils_VerifyFileChunks(corruptPath, chunkSize, chunkHashes, chunkCount, 4, chunkValid));
+        for (size_t i = 0; i < chunkCount; ++i)
+        {
+            INFO("chunk: " << i);
+            CHECK(valid[i] == (i != 3 && i != 8));
+        }
+
+        REQUIRE(std::remove(corruptPath) == 0);
+    }
+
+    SECTION("A truncated file is invalid")
+    {
+        char truncatedPath[] = "/tmp/tmpfileXXXXXX";
+        const int fd = mkstemp(truncatedPath);
+        REQUIRE(fd != -1);
+        REQUIRE(write(fd, testFile.GetData(), 2 * chunkSize) == static_cast<ssize_t>(2 * chunkSize));
+        close(fd);
+
+        CHECK_FALSE(ADUC_HashUtils_VerifyFileChunks(truncatedPath, chunkSize, chunkHashes, chunkCount, 2, chunkValid));
+        CHECK(valid[0]);
+        CHECK(valid[1]);
+        CHECK_FALSE(valid[2]);
+        CHECK_FALSE(valid[8]);
+
+        REQUIRE(std::remove(truncatedPath) == 0);
+    }
+
+    ADUC_Hash_FreeArray(chunkCount, chunkHashes);
+}
+
+TEST_CASE("ADUC_HashUtils_IsValidChunkRootHash")
+{
+    LargeFile testFile;
+
+    const size_t chunkSize = 64 * 1024;
+    const size_t chunkCount = (testFile.GetDataByteLen() + chunkSize - 1) / chunkSize;
+
+    // The root hash is the hash of the concatenated chunk digests.
+    std::vector<uint8_t> digests(chunkCount * SHA256HashSize);
+    for (size_t i = 0; i < chunkCount; ++i)
+    {
+        const size_t offset = i * chunkSize;
+        USHAContext context;
+        REQUIRE(USHAReset(&context, SHAversion::SHA256) == 0);
+        REQUIRE(
+            USHAInput(
+                &context,
+                testFile.GetData() + offset, // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+                static_cast<unsigned int>(std::min(chunkSize, testFile.GetDataByteLen() - offset)))
+            == 0);
+        REQUIRE(USHAResult(&context, digests.data() + i * SHA256HashSize) == 0);
+    }
+
+    ADUC_HashUtils_Context context = {};
+    char* rootHash = nullptr;
+    REQUIRE(ADUC_HashUtils_ContextReset(&context, SHAversion::SHA256));
+    REQUIRE(ADUC_HashUtils_ContextInput(&context, digests.data(), digests.size()));
+    REQUIRE(ADUC_HashUtils_ContextResult(&context, nullptr, &rootHash));
+
+    SECTION("The content is valid")
+    {
+        auto threadCount = GENERATE(0U, 1U, 4U); // NOLINT(google-build-using-namespace)
+        INFO("threadCount: " << threadCount);
+
+        CHECK(ADUC_HashUtils_IsValidChunkRootHash(
+            testFile.Filename(), testFile.GetDataByteLen(), chunkSize, rootHash, SHAversion::SHA256, threadCount));
+    }
+
+    SECTION("Only the given size is verified, like an image on a bigger partition")
+    {
+        std::vector<uint8_t> data{ testFile.GetData(), testFile.GetData() + testFile.GetDataByteLen() };
+        data.resize(data.size() + chunkSize, 0xFF);
+
+        char partitionPath[] = "/tmp/tmpfileXXXXXX";
+        const int fd = mkstemp(partitionPath);
+        REQUIRE(fd != -1);
+        REQUIRE(write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+        close(fd);
+
+        CHECK(ADUC_HashUtils_IsValidChunkRootHash(
+            partitionPath, testFile.GetDataByteLen(), chunkSize, rootHash, SHAversion::SHA256, 4));
+        CHECK_FALSE(ADUC_HashUtils_IsValidChunkRootHash(
+            partitionPath, data.size(), chunkSize, rootHash, SHAversion::SHA256, 4));
+
+        REQUIRE(std::remove(partitionPath) == 0);
+    }
+
+    SECTION("Corrupted or truncated content is invalid")
+    {
+        std::vector<uint8_t> data{ testFile.GetData(), testFile.GetData() + testFile.GetDataByteLen() };
+        data[5 * chunkSize + 7] ^= 0xFF;
+
+        char corruptPath[] = "/tmp/tmpfileXXXXXX";
+        const int fd = mkstemp(corruptPath);
+        REQUIRE(fd != -1);
+        REQUIRE(write(fd, data.data(), data.size() - 1) == static_cast<ssize_t>(data.size() - 1));
+        close(fd);
+
+        CHECK_FALSE(ADUC_HashUtils_IsValidChunkRootHash(
+            corruptPath, data.size() - 1, chunkSize, rootHash, SHAversion::SHA256, 4));
+        CHECK_FALSE(
+            ADUC_HashUtils_IsValidChunkRootHash(corruptPath, data.size(), chunkSize, rootHash, SHAversion::SHA256, 4));
+
+        REQUIRE(std::remove(corruptPath) == 0);
+    }
+
+    free(rootHash);
+}
+
+TEST_CASE("ADUC_HashUtils_IsValidFileHashes")
+{
+    LargeFile testFile;
+
+    ADUC_Hash hashes[3] = {};
+    REQUIRE(ADUC_Hash_Init(&hashes[0], testFile.GetDataHashBase64(SHAversion::SHA256), "sha256"));
+    REQUIRE(ADUC_Hash_Init(&hashes[1], testFile.GetDataHashBase64(SHAversion::SHA512), "sha512"));
+    REQUIRE(ADUC_Hash_Init(&hashes[2], testFile.GetDataHashBase64(SHAversion::SHA1), "sha1"));
+
+    SECTION("All the hashes are valid")
+    {
+        CHECK(ADUC_HashUtils_IsValidFileHashes(testFile.Filename(), hashes, 3));
+        CHECK(ADUC_HashUtils_IsValidFileHashes(testFile.Filename(), hashes, 1));
+    }
+
+    SECTION("One invalid hash fails the file")
+    {
+        ADUC_Hash_UnInit(&hashes[1]);
+        REQUIRE(ADUC_Hash_Init(&hashes[1], testFile.GetDataHashBase64(SHAversion::SHA384), "sha512"));
+        CHECK_FALSE(ADUC_HashUtils_IsValidFileHashes(testFile.Filename(), hashes, 3));
+    }
+
+    SECTION("An unsupported hash type fails the file")
+    {
+        ADUC_Hash_UnInit(&hashes[2]);
+        REQUIRE(ADUC_Hash_Init(&hashes[2], testFile.GetDataHashBase64(SHAversion::SHA1), "md5"));
+        CHECK_FALSE(ADUC_HashUtils_IsValidFileHashes(testFile.Filename(), hashes, 3));
+    }
+
+    SECTION("No hashes")
+    {
+        CHECK_FALSE(ADUC_HashUtils_IsValidFileHashes(testFile.Filename(), hashes, 0));
+        CHECK_FALSE(ADUC_HashUtils_IsValidFileHashes(testFile.Filename(), nullptr, 3));
+    }
+
+    for (auto& hash : hashes)
+    {
+        ADUC_Hash_UnInit(&hash);
+    }
+}
+
+TEST_CASE("ADUC_HashUtils_ContextResultHash")
+{
+    SmallFile testFile;
+    ADUC_Hash hash = {};
+
+    SECTION("The hash is decoded once, and compared with the digest")
+    {
+        REQUIRE(ADUC_Hash_Init(&hash, testFile.GetDataHashBase64(SHAversion::SHA256), "SHA256"));
+        CHECK(hash.algorithm == SHAversion::SHA256);
+        CHECK(hash.digestSize == 32);
+
+        ADUC_HashUtils_Context context = {};
+        REQUIRE(ADUC_HashUtils_ContextReset(&context, SHAversion::SHA256));
+        REQUIRE(ADUC_HashUtils_ContextInput(&context, testFile.GetData(), testFile.GetDataByteLen()));
+        CHECK(ADUC_HashUtils_ContextResultHash(&context, &hash));
+
+        REQUIRE(ADUC_HashUtils_ContextReset(&context, SHAversion::SHA256));
+        REQUIRE(ADUC_HashUtils_ContextInput(&context, testFile.GetData(), testFile.GetDataByteLen() - 1));
+        CHECK_FALSE(ADUC_HashUtils_ContextResultHash(&context, &hash));
+    }
+
+    SECTION("Only the canonical encoding of a digest of the type decodes")
+    {
+        // Bits set past the digest, empty, and not base64.
+        for (const char* value : { "vkXLJgW/Nr695oSEGijw/UPGmFCj3OX+26aZKO46iZF=", "", "not a hash" })
+        {
+            INFO("value: " << value);
+            REQUIRE(ADUC_Hash_Init(&hash, value, "sha256"));
+            CHECK(hash.digestSize == 0);
+            ADUC_Hash_UnInit(&hash);
+        }
+
+        REQUIRE(ADUC_Hash_Init(&hash, testFile.GetDataHashBase64(SHAversion::SHA256), "sha1"));
+        CHECK(hash.digestSize == 0);
+
+        // Still compared by value, and still invalid.
+        CHECK_FALSE(ADUC_HashUtils_IsValidFileHashes(testFile.Filename(), &hash, 1));
+    }
+
+    ADUC_Hash_UnInit(&hash);
+}
+
+TEST_CASE("ADUC_HashUtils_SelectKernelBackend")
+{
+    LargeFile testFile;
+
+    // Without AF_ALG, or when the kernel hashes slower, nothing is selected and the software backend is kept.
+    const bool selected = ADUC_HashUtils_SelectKernelBackend();
+    const unsigned int kernelAlgorithms = ADUC_HashUtils_GetKernelBackendAlgorithms();
+    CHECK(selected == (kernelAlgorithms != 0));
+
+    // clang-format off
+    auto version = GENERATE( // NOLINT(google-build-using-namespace)
+        SHAversion::SHA1,
+        SHAversion::SHA224,
+        SHAversion::SHA256,
+        SHAversion::SHA384,
+        SHAversion::SHA512);
+    // clang-format on
+
+    INFO("SHAversion: " << version);
+    const bool kernelBackend = (kernelAlgorithms & (1u << version)) != 0;
+
+    // With the kernel backend, the file is spliced into the hash.
+    ADUC_HashUtils_Context context = {};
+    REQUIRE(ADUC_HashUtils_ContextReset(&context, version));
+    CHECK(context.kernelBackend == kernelBackend);
+    REQUIRE(ADUC_HashUtils_ContextInputFile(&context, testFile.Filename()));
+    CHECK(ADUC_HashUtils_ContextResult(&context, testFile.GetDataHashBase64(version), nullptr));
+
+    CHECK(ADUC_HashUtils_IsValidFileHash(testFile.Filename(), testFile.GetDataHashBase64(version), version));
+    CHECK(ADUC_HashUtils_IsValidBufferHash(
+        testFile.GetData(), testFile.GetDataByteLen(), testFile.GetDataHashBase64(version), version));
+
+    // An unfinished kernel hash is released.
+    REQUIRE(ADUC_HashUtils_ContextReset(&context, version));
+    REQUIRE(ADUC_HashUtils_ContextInput(&context, testFile.GetData(), 1));
+    ADUC_HashUtils_ContextUnInit(&context);
+    CHECK_FALSE(context.kernelBackend);
+}
@@ -2,16 +2,208 @@
  * @file installed_criteria_utils.hpp
  * @brief Contains utilities for managing Installed-Criteria data.
  *
+ * The installed criteria data file is a JSON array of {"installedCriteria", "state", "timestamp"} objects.
+ * Updates are appended to a journal next to it, one such object per line ("state" is "removed" for removals),
+ * and folded back into the data file once the journal grows past ADUC_INSTALLED_CRITERIA_JOURNAL_MAX_ENTRIES.
+ * Both are loaded once into an in-memory index, which is reloaded if either file changes behind our back.
+ *
  * @copyright Copyright (c) Microsoft Corp.
  * Licensed under the MIT License.
  */
 #include "aduc/installed_criteria_utils.hpp"
 #include "aduc/adu_core_exports.h"
 #include "aduc/logging.h"
+#include "aduc/state_journal.h"
 #include <chrono>
-#include <fstream>
+#include <errno.h>
+#include <mutex>
 #include <parson.h>
 #include <sstream>
+#include <string.h>
+#include <sys/stat.h>
+#include <unordered_map>
+
+/**
+ * @brief Number of journal entries above which the journal is folded into the installed criteria data file.
+ */
+#define ADUC_INSTALLED_CRITERIA_JOURNAL_MAX_ENTRIES 64
+
+/**
+ * @brief Suffix of the journal file, appended to the installed criteria data file path.
+ */
+#define ADUC_INSTALLED_CRITERIA_JOURNAL_SUFFIX ".journal"
+
+/**
+ * @brief The 'state' of a journal entry that removes an installed criteria.
+ */
+#define ADUC_INSTALLED_CRITERIA_STATE_REMOVED "removed"
+
+/**
+ * @brief Identifies a version of a file, to find out whether it changed since it was read.
+ */
+struct InstalledCriteriaFileStamp
+{
+    bool exists;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+
+    bool operator==(const InstalledCriteriaFileStamp& other) const
+    {
+        return exists == other.exists
+            && (!exists
+                || (inode == other.inode && size == other.size && mtime.tv_sec == other.mtime.tv_sec
+                    && mtime.tv_nsec == other.mtime.tv_nsec));
+    }
+};
+
+/**
+ * @brief An installed criteria entry of the index.
+ */
+struct InstalledCriteriaEntry
+{
+    std::string state;
+    double timestamp;
+};
+
+/**
+ * @brief The in-memory index of an installed criteria data file and its journal.
+ */
+struct InstalledCriteriaStore
+{
+    bool loaded = false;
+    InstalledCriteriaFileStamp dataFileStamp = {};
+    InstalledCriteriaFileStamp journalFileStamp = {};
+    size_t journalEntryCount = 0;
+    std::unordered_map<std::string, InstalledCriteriaEntry> entries;
+};
+
+/**
+ * @brief Protects s_stores.
+ */
+static std::mutex s_storesMutex;
+
+/**
+ * @brief The index of each installed criteria data file, by path.
+ */
+static std::unordered_map<std::string, InstalledCriteriaStore> s_stores;
+
+/**
+ * @brief Returns the path of the journal of @p installedCriteriaFilePath.
+ */
+static std::string GetJournalFilePath(const char* installedCriteriaFilePath)
+{
+    return std::string(installedCriteriaFilePath) + ADUC_INSTALLED_CRITERIA_JOURNAL_SUFFIX;
+}
+
+/**
+ * @brief Returns the current version of the file @p filePath.
+ */
+static InstalledCriteriaFileStamp GetFileStamp(const std::string& filePath)
+{
+    InstalledCriteriaFileStamp stamp = {};
+    struct stat st;
+
+    if (stat(filePath.c_str(), &st) == 0)
+    {
+        stamp.exists = true;
+        stamp.inode = st.st_ino;
+        stamp.size = st.st_size;
+        stamp.mtime = st.st_mtim;
+    }
+
+    return stamp;
+}
+
+/**
+ * @brief Applies an installed criteria object, from the data file or the journal, to @p store.
+ * As with lookups in the data file, the first entry of an installed criteria wins until it's removed.
+ */
+static void ApplyEntry(InstalledCriteriaStore& store, const JSON_Object* icObject) // NOLINT(google-runtime-references)
+{
+    const char* criteria = json_object_get_string(icObject, "installedCriteria");
+    const char* state = json_object_get_string(icObject, "state");
+
+    if (criteria == nullptr)
+    {
+        return;
+    }
+
+    if (state != nullptr && strcmp(state, ADUC_INSTALLED_CRITERIA_STATE_REMOVED) == 0)
+    {
+        store.entries.erase(criteria);
+        return;
+    }
+
+    store.entries.emplace(
+        criteria,
+        InstalledCriteriaEntry{ state == nullptr ? "" : state, json_object_get_number(icObject, "timestamp") });
+}
+
+/**
+ * @brief Applies a journal record to the store @p context, see ADUC_StateJournal_ForEach.
+ */
+static void ApplyJournalRecord(const char* record, void* context)
+{
+    InstalledCriteriaStore& store = *static_cast<InstalledCriteriaStore*>(context);
+    JSON_Value* entryValue = json_parse_string(record);
+    JSON_Object* entryObject = json_value_get_object(entryValue);
+
+    if (entryObject != nullptr)
+    {
+        ApplyEntry(store, entryObject);
+    }
+
+    json_value_free(entryValue);
+}
+
+/**
+ * @brief Makes sure @p store reflects the data file @p installedCriteriaFilePath and its journal,
+ * loading them if it wasn't loaded yet or if either changed since. Must be called with s_storesMutex held.
+ */
+static void
+RefreshStoreLocked(InstalledCriteriaStore& store, const char* installedCriteriaFilePath) // NOLINT(google-runtime-references)
+{
+    const std::string journalFilePath = GetJournalFilePath(installedCriteriaFilePath);
+    const InstalledCriteriaFileStamp dataFileStamp = GetFileStamp(installedCriteriaFilePath);
+    const InstalledCriteriaFileStamp journalFileStamp = GetFileStamp(journalFilePath);
+
+    if (store.loaded && store.dataFileStamp == dataFileStamp && store.journalFileStamp == journalFileStamp)
+    {
+        return;
+    }
+
+    Log_Debug("Loading installed criteria from %s", installedCriteriaFilePath);
+
+    store.entries.clear();
+    store.journalEntryCount = 0;
+
+    JSON_Value* rootValue = json_parse_file(installedCriteriaFilePath);
+    JSON_Array* icArray = json_value_get_array(rootValue);
+
+    for (size_t i = 0; i < json_array_get_count(icArray); i++)
+    {
+        JSON_Object* icObject = json_array_get_object(icArray, i);
+        if (icObject != nullptr)
+        {
+            ApplyEntry(store, icObject);
+        }
+    }
+
+    json_value_free(rootValue);
+
+    // A line cut short by a crash is skipped.
+    const int err =
+        ADUC_StateJournal_ForEach(journalFilePath.c_str(), ApplyJournalRecord, &store, &store.journalEntryCount);
+    if (err != 0)
+    {
+        Log_Warn("Cannot read installed criteria journal %s, errno %d", journalFilePath.c_str(), err);
+    }
+
+    store.loaded = true;
+    store.dataFileStamp = dataFileStamp;
+    store.journalFileStamp = journalFileStamp;
+}
 
 /**
  * @brief Checks if the installed content matches the installed criteria.
@@ -27,42 +219,26 @@ const ADUC_Result GetIsInstalled(const char* installedCriteriaFilePath, const st
     ADUC_Result result = ADUC_Result{ ADUC_Result_IsInstalled_NotInstalled };
     Log_Info("Evaluating installedCriteria %s", installedCriteria.c_str());
 
-    JSON_Value* rootValue = json_parse_file(installedCriteriaFilePath);
-    if (rootValue != nullptr)
-    {
-        JSON_Array* icArray = json_value_get_array(rootValue);
-        bool foundInstalledCriteria = false;
-        for (size_t i = 0; i < json_array_get_count(icArray); i++)
-        {
-            JSON_Object* icObject = json_array_get_object(icArray, i);
-            if (icObject != nullptr)
-            {
-                const char* criteria = json_object_get_string(icObject, "installedCriteria");
-                const std::string state = json_object_get_string(icObject, "state");
-
-                Log_Debug("Found installedCriteria: %s, state:%s ", criteria, state.c_str());
-                if ((criteria != nullptr) && (installedCriteria == criteria))
-                {
-                    foundInstalledCriteria = true;
-                    result = ADUC_Result{ state == "installed" ? ADUC_Result_IsInstalled_Installed
-                                                               : ADUC_Result_IsInstalled_NotInstalled };
-                    if (result.ResultCode == ADUC_Result_IsInstalled_NotInstalled)
-                    {
-                        Log_Info(
-                            "Installed criteria %s is found, but the state is %s, not Installed",
-                            installedCriteria.c_str(),
-                            state.c_str());
-                    }
-                    break;
-                }
-            }
-        }
-        if (!foundInstalledCriteria)
-        {
-            Log_Info("Installed criteria %s is not found in the list of packages.", installedCriteria.c_str());
-        }
+    std::lock_guard<std::mutex> lock(s_storesMutex);
+
+    InstalledCriteriaStore& store = s_stores[installedCriteriaFilePath];
+    RefreshStoreLocked(store, installedCriteriaFilePath);
 
-        json_value_free(rootValue);
+    const auto entry = store.entries.find(installedCriteria);
+    if (entry == store.entries.end())
+    {
+        Log_Info("Installed criteria %s is not found in the list of packages.", installedCriteria.c_str());
+    }
+    else if (entry->second.state == "installed")
+    {
+        result = ADUC_Result{ ADUC_Result_IsInstalled_Installed };
+    }
+    else
+    {
+        Log_Info(
+            "Installed criteria %s is found, but the state is %s, not Installed",
+            installedCriteria.c_str(),
+            entry->second.state.c_str());
     }
 
     return result;
@@ -99,57 +275,167 @@ const JSON_Status safe_json_serialize_to_file_pretty(const JSON_Value* value, co
 }
 
 /**
- * @brief Persist specified installedCriteria in a file and mark its state as 'installed'.
+ * @brief Creates an installed criteria object.
  *
- * @param installedCriteriaFilePath A full path to installed criteria data file.
  * @param installedCriteria An installed criteria string.
+ * @param state The state of @p installedCriteria.
+ * @param timestamp The time the state was set, in seconds since the epoch.
  *
- * @return bool A boolean indicates whether installedCriteria added successfully.
+ * @return JSON_Value* The object, to be freed with json_value_free; nullptr on failures.
  */
-const bool PersistInstalledCriteria(const char* installedCriteriaFilePath, const std::string& installedCriteria)
+static JSON_Value* CreateEntryValue(const std::string& installedCriteria, const char* state, double timestamp)
 {
-    Log_Debug("Saving installedCriteria: %s ", installedCriteria.c_str());
+    JSON_Value* icValue = json_value_init_object();
+    JSON_Object* icObject = json_value_get_object(icValue);
 
-    bool success = false;
-    JSON_Status status;
+    if (icObject == nullptr
+        || json_object_set_string(icObject, "installedCriteria", installedCriteria.c_str()) != JSONSuccess
+        || json_object_set_string(icObject, "state", state) != JSONSuccess
+        || json_object_set_number(icObject, "timestamp", timestamp) != JSONSuccess)
+    {
+        json_value_free(icValue);
+        return nullptr;
+    }
 
-    JSON_Value* rootValue = json_parse_file(installedCriteriaFilePath);
+    return icValue;
+}
+
+/**
+ * @brief Folds the journal into the installed criteria data file, which is rewritten from @p store.
+ * Must be called with s_storesMutex held.
+ *
+ * @return bool True on success. On failures, the journal is kept and still holds the updates.
+ */
+static bool
+CompactStoreLocked(InstalledCriteriaStore& store, const char* installedCriteriaFilePath) // NOLINT(google-runtime-references)
+{
+    bool success = false;
+    int err = 0;
+    const std::string journalFilePath = GetJournalFilePath(installedCriteriaFilePath);
+    JSON_Value* rootValue = json_value_init_array();
+    JSON_Array* rootArray = json_value_get_array(rootValue);
 
-    if (rootValue == nullptr)
+    if (rootArray == nullptr)
     {
-        rootValue = json_value_init_array();
+        goto done;
     }
 
-    if (rootValue != nullptr)
+    for (const auto& entry : store.entries)
     {
-        JSON_Array* rootArray = json_value_get_array(rootValue);
-        JSON_Value* icValue = json_value_init_object();
-        JSON_Object* icObject = json_value_get_object(icValue);
-
-        if (JSONSuccess == (status = json_object_set_string(icObject, "installedCriteria", installedCriteria.c_str())))
+        JSON_Value* icValue = CreateEntryValue(entry.first, entry.second.state.c_str(), entry.second.timestamp);
+        if (icValue == nullptr || json_array_append_value(rootArray, icValue) != JSONSuccess)
         {
-            std::chrono::system_clock::duration timeSinceEpoch = std::chrono::system_clock::now().time_since_epoch();
-            const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeSinceEpoch).count();
-
-            if (JSONSuccess == (status = json_object_set_string(icObject, "state", "installed")))
-            {
-                if (JSONSuccess == (status = json_object_set_number(icObject, "timestamp", seconds)))
-                {
-                    if (JSONSuccess == (status = json_array_append_value(rootArray, icValue)))
-                    {
-                        status = safe_json_serialize_to_file_pretty(rootValue, installedCriteriaFilePath);
-                    }
-                }
-            }
+            json_value_free(icValue);
+            goto done;
         }
+    }
+
+    if (safe_json_serialize_to_file_pretty(rootValue, installedCriteriaFilePath) != JSONSuccess)
+    {
+        Log_Warn("Cannot compact installed criteria file %s", installedCriteriaFilePath);
+        goto done;
+    }
 
-        success = (status == JSONSuccess);
-        json_value_free(rootValue);
+    // Once the data file holds everything, the journal has to go; until then both describe the same state.
+    err = ADUC_StateJournal_Compact(journalFilePath.c_str(), nullptr /* record */);
+    if (err != 0)
+    {
+        Log_Warn("Cannot remove installed criteria journal %s, errno %d", journalFilePath.c_str(), err);
+        store.loaded = false;
+        goto done;
     }
 
+    store.journalEntryCount = 0;
+    success = true;
+
+done:
+    json_value_free(rootValue);
+
+    store.dataFileStamp = GetFileStamp(installedCriteriaFilePath);
+    store.journalFileStamp = GetFileStamp(journalFilePath);
+
     return success;
 }
 
+/**
+ * @brief Appends an update of @p installedCriteria to the journal of @p installedCriteriaFilePath, and applies
+ * it to @p store. Must be called with s_storesMutex held.
+ *
+ * @return bool True on success.
+ */
+static bool AppendEntryLocked(
+    InstalledCriteriaStore& store, // NOLINT(google-runtime-references)
+    const char* installedCriteriaFilePath,
+    const std::string& installedCriteria,
+    const char* state)
+{
+    bool success = false;
+    const std::string journalFilePath = GetJournalFilePath(installedCriteriaFilePath);
+    std::chrono::system_clock::duration timeSinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeSinceEpoch).count();
+    char* line = nullptr;
+    int err = 0;
+
+    JSON_Value* icValue = CreateEntryValue(installedCriteria, state, static_cast<double>(seconds));
+    if (icValue == nullptr)
+    {
+        goto done;
+    }
+
+    // Compact serialization escapes newlines, so each entry takes exactly one line.
+    line = json_serialize_to_string(icValue);
+    if (line == nullptr)
+    {
+        goto done;
+    }
+
+    err = ADUC_StateJournal_Append(journalFilePath.c_str(), line);
+    if (err != 0)
+    {
+        Log_Error("Cannot write installed criteria journal %s, errno %d", journalFilePath.c_str(), err);
+
+        // The journal may now end with a partial line; reload it next time.
+        store.loaded = false;
+        goto done;
+    }
+
+    success = true;
+    ApplyEntry(store, json_value_get_object(icValue));
+    store.journalEntryCount++;
+    store.journalFileStamp = GetFileStamp(journalFilePath);
+
+    if (store.journalEntryCount > ADUC_INSTALLED_CRITERIA_JOURNAL_MAX_ENTRIES)
+    {
+        CompactStoreLocked(store, installedCriteriaFilePath);
+    }
+
+done:
+    json_free_serialized_string(line);
+    json_value_free(icValue);
+
+    return success;
+}
+
+/**
+ * @brief Persist specified installedCriteria in a file and mark its state as 'installed'.
+ *
+ * @param installedCriteriaFilePath A full path to installed criteria data file.
+ * @param installedCriteria An installed criteria string.
+ *
+ * @return bool A boolean indicates whether installedCriteria added successfully.
+ */
+const bool PersistInstalledCriteria(const char* installedCriteriaFilePath, const std::string& installedCriteria)
+{
+    Log_Debug("Saving installedCriteria: %s ", installedCriteria.c_str());
+
+    std::lock_guard<std::mutex> lock(s_storesMutex);
+
+    InstalledCriteriaStore& store = s_stores[installedCriteriaFilePath];
+    RefreshStoreLocked(store, installedCriteriaFilePath);
+
+    return AppendEntryLocked(store, installedCriteriaFilePath, installedCriteria, "installed");
+}
+
 /**
  * @brief Remove specified installedCriteria from installcriteria data file.
  *
@@ -170,60 +456,25 @@ const bool PersistInstalledCriteria(const char* installedCriteriaFilePath, const
  */
 const bool RemoveInstalledCriteria(const char* installedCriteriaFilePath, const std::string& installedCriteria)
 {
-    bool success = true;
-
-    std::ifstream dataFile(installedCriteriaFilePath);
-    if (!dataFile.good())
-    {
-        // File doesn't exist.
-        return true;
-    }
-
-    JSON_Value* rootValue = json_parse_file(installedCriteriaFilePath);
-    if (rootValue != nullptr)
-    {
-        JSON_Array* icArray = json_value_get_array(rootValue);
-        bool mutated = false;
-
-        for (size_t i = json_array_get_count(icArray); i > 0; i--)
-        {
-            JSON_Object* ic = json_array_get_object(icArray, i - 1);
-            if (ic != nullptr)
-            {
-                const char* id = json_object_get_string(ic, "installedCriteria");
-                if (installedCriteria == id)
-                {
-                    JSON_Status deleted = json_array_remove(icArray, i - 1);
-                    if (deleted != JSONSuccess)
-                    {
-                        // Failed to remove.
-                        success = false;
-                        break;
-                    }
-
-                    // otherwise, keep going to remove duplicates
-                    mutated = true;
-                }
-            }
-        }
+    std::lock_guard<std::mutex> lock(s_storesMutex);
 
-        if (success && mutated)
-        {
-            JSON_Status saved = safe_json_serialize_to_file_pretty(rootValue, installedCriteriaFilePath);
-            success = (saved == JSONSuccess);
-        }
+    InstalledCriteriaStore& store = s_stores[installedCriteriaFilePath];
+    RefreshStoreLocked(store, installedCriteriaFilePath);
 
-        json_value_free(rootValue);
-    }
-    else
+    if (store.entries.count(installedCriteria) == 0)
     {
-        success = false;
+        return true;
     }
 
-    return success;
+    return AppendEntryLocked(
+        store, installedCriteriaFilePath, installedCriteria, ADUC_INSTALLED_CRITERIA_STATE_REMOVED);
 }
 
 void RemoveAllInstalledCriteria()
 {
+    std::lock_guard<std::mutex> lock(s_storesMutex);
+
     remove(ADUC_INSTALLEDCRITERIA_FILE_PATH);
+    remove(GetJournalFilePath(ADUC_INSTALLEDCRITERIA_FILE_PATH).c_str());
+    s_stores.erase(ADUC_INSTALLEDCRITERIA_FILE_PATH);
 }
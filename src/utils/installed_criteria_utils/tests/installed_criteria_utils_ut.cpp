@@ -9,6 +9,8 @@
 #include "aduc/adu_core_exports.h"
 #include "aduc/installed_criteria_utils.hpp"
 #include <catch2/catch.hpp>
+#include <fstream>
+#include <string>
 
 class InstalledCriteriaPersistence  // NOLINT
 {
@@ -208,3 +210,58 @@ TEST_CASE("RemoveInstalledCriteriaShouldRemoveDuplicatesAndSkipNonMatching")
     isInstalled = GetIsInstalled(ADUC_INSTALLEDCRITERIA_FILE_PATH, installedCriteria_bar);
     CHECK(isInstalled.ResultCode == ADUC_Result_IsInstalled_Installed);
 }
+
+TEST_CASE("PersistInstalledCriteriaShouldCompactJournal")
+{
+    InstalledCriteriaPersistence persistence; // remove installed criteria file on destruction.
+    UNREFERENCED_PARAMETER(persistence); // avoid style warning for unused variable.
+
+    RemoveAllInstalledCriteria();
+
+    const int count = 100;
+    for (int i = 0; i < count; i++)
+    {
+        CHECK(PersistInstalledCriteria(ADUC_INSTALLEDCRITERIA_FILE_PATH, "contoso-" + std::to_string(i)));
+    }
+
+    // Older updates were folded into the data file, so the journal holds fewer entries than were persisted.
+    std::ifstream journal(std::string(ADUC_INSTALLEDCRITERIA_FILE_PATH) + ".journal");
+    std::string line;
+    int journalLineCount = 0;
+    while (std::getline(journal, line))
+    {
+        journalLineCount++;
+    }
+
+    CHECK(journalLineCount < count);
+
+    for (int i = 0; i < count; i++)
+    {
+        ADUC_Result isInstalled =
+            GetIsInstalled(ADUC_INSTALLEDCRITERIA_FILE_PATH, "contoso-" + std::to_string(i));
+        CHECK(isInstalled.ResultCode == ADUC_Result_IsInstalled_Installed);
+    }
+
+    RemoveAllInstalledCriteria();
+}
+
+TEST_CASE("GetIsInstalledShouldReloadModifiedFile")
+{
+    InstalledCriteriaPersistence persistence; // remove installed criteria file on destruction.
+    UNREFERENCED_PARAMETER(persistence); // avoid style warning for unused variable.
+
+    RemoveAllInstalledCriteria();
+
+    const char* installedCriteria_foo = "contoso-iot-edge-6.1.0.19";
+    ADUC_Result isInstalled = GetIsInstalled(ADUC_INSTALLEDCRITERIA_FILE_PATH, installedCriteria_foo);
+    CHECK(isInstalled.ResultCode == ADUC_Result_IsInstalled_NotInstalled);
+
+    // Written by someone else.
+    {
+        std::ofstream dataFile(ADUC_INSTALLEDCRITERIA_FILE_PATH);
+        dataFile << R"([{"installedCriteria": "contoso-iot-edge-6.1.0.19", "state": "installed", "timestamp": 1}])";
+    }
+
+    isInstalled = GetIsInstalled(ADUC_INSTALLEDCRITERIA_FILE_PATH, installedCriteria_foo);
+    CHECK(isInstalled.ResultCode == ADUC_Result_IsInstalled_Installed);
+}
@@ -63,6 +63,10 @@ bool GetPayloadFromJWT(const char* blob, char** destBuff);
 
 void* GetKeyFromBase64EncodedJWK(const char* blob);
 
+bool InitVerifiedJWSCache(const char* path);
+
+void UninitVerifiedJWSCache();
+
 EXTERN_C_END
 
 #endif // JWS_UTILS_H
@@ -9,227 +9,551 @@
 #include "jws_utils.h"
 #include "base64_utils.h"
 #include "crypto_lib.h"
-#include <azure_c_shared_utility/azure_base64.h>
-#include <azure_c_shared_utility/crt_abstractions.h>
 #include <parson.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h> // for lstat, chmod
+#include <unistd.h> // for geteuid
+
+/**
+ * @brief A section of a JSON Web Signature, pointing into the JWS itself.
+ */
+typedef struct tagJWSSlice
+{
+    const char* data; /**< The first character of the section. */
+    size_t length; /**< The number of characters of the section. */
+} JWSSlice;
+
+/**
+ * @brief The Base64URL encoded sections of a JSON Web Signature.
+ */
+typedef struct tagJWSSections
+{
+    JWSSlice header; /**< The header. */
+    JWSSlice payload; /**< The payload. */
+    JWSSlice signature; /**< The signature. */
+} JWSSections;
+
+/**
+ * @brief Scratch memory the sections of a JSON Web Signature are decoded into.
+ */
+typedef struct tagJWSArena
+{
+    uint8_t* buffer; /**< The memory. */
+    size_t size; /**< The size of buffer. */
+    size_t used; /**< The number of bytes of buffer holding decoded sections. */
+} JWSArena;
+
+/**
+ * @brief The number of verified Signed JSON Web Keys whose keys are kept by the verified key cache.
+ */
+#define JWS_VERIFIED_SJWK_CACHE_SIZE 8
+
+/**
+ * @brief An entry of the verified key cache.
+ */
+typedef struct tagVerifiedSJWKCacheEntry
+{
+    uint8_t digest[CRYPTO_SHA256_DIGEST_SIZE]; /**< The SHA-256 digest of the Signed JSON Web Key. */
+    CryptoKeyHandle key; /**< The key of the Signed JSON Web Key, or NULL if the entry is unused. */
+    unsigned long lastUse; /**< The value of s_verifiedSJWKCacheClock when the entry was last used. */
+} VerifiedSJWKCacheEntry;
+
+/**
+ * @brief The keys of the Signed JSON Web Keys that were verified against a root key.
+ * @details The root keys are built into the agent, so a Signed JSON Web Key that was verified once stays valid and
+ * the keys of the same SJWK used by the following update actions don't need to be verified and parsed again.
+ */
+static VerifiedSJWKCacheEntry s_verifiedSJWKCache[JWS_VERIFIED_SJWK_CACHE_SIZE];
+
+/**
+ * @brief Incremented on each use of the verified key cache, to evict the least recently used entry.
+ */
+static unsigned long s_verifiedSJWKCacheClock = 0;
+
+/**
+ * @brief Protects s_verifiedSJWKCache and s_verifiedSJWKCacheClock.
+ */
+static pthread_mutex_t s_verifiedSJWKCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief The number of verified JSON Web Signatures kept by the verified JWS cache.
+ */
+#define JWS_VERIFIED_JWS_CACHE_SIZE 16
+
+#define JWS_VERIFIED_JWS_CACHE_ROOT_KEYS_FIELDNAME "rootKeys"
+#define JWS_VERIFIED_JWS_CACHE_ENTRIES_FIELDNAME "verified"
+#define JWS_VERIFIED_JWS_CACHE_SIGNING_KEY_ID_FIELDNAME "signingKeyId"
+#define JWS_VERIFIED_JWS_CACHE_ROOT_KEY_ID_FIELDNAME "rootKeyId"
+
+/**
+ * @brief The JSON Web Signatures verified with their Signed JSON Web Key, keyed by their Base64URL encoded SHA-256
+ * digest, along with the digest of the root keys they were verified against.
+ * @details Created on first use, and loaded from s_verifiedJWSCachePath by InitVerifiedJWSCache. e.g.
+ * { "rootKeys": "...", "verified": { "<digest>": { "signingKeyId": "...", "rootKeyId": "..." } } }
+ */
+static JSON_Value* s_verifiedJWSCache = NULL;
+
+/**
+ * @brief The file s_verifiedJWSCache is persisted to, or NULL to keep it in memory only.
+ */
+static char* s_verifiedJWSCachePath = NULL;
+
+/**
+ * @brief Protects s_verifiedJWSCache and s_verifiedJWSCachePath.
+ */
+static pthread_mutex_t s_verifiedJWSCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
 //
 // Internal Functions
 //
 
-// Find the position of the period and return the next character
+/**
+ * @brief Returns the key of the verified Signed JSON Web Key with the SHA-256 @p digest
+ * @details The caller must free the returned key with FreeCryptoKeyHandle()
+ * @param digest the SHA-256 digest of the Signed JSON Web Key
+ * @returns the key, or NULL if the Signed JSON Web Key isn't in the verified key cache
+ */
+static CryptoKeyHandle GetVerifiedSJWKKey(const uint8_t* digest)
+{
+    CryptoKeyHandle key = NULL;
+
+    pthread_mutex_lock(&s_verifiedSJWKCacheMutex);
+
+    for (size_t i = 0; i < JWS_VERIFIED_SJWK_CACHE_SIZE; i++)
+    {
+        VerifiedSJWKCacheEntry* entry = &s_verifiedSJWKCache[i];
+
+        if (entry->key != NULL && memcmp(entry->digest, digest, CRYPTO_SHA256_DIGEST_SIZE) == 0)
+        {
+            entry->lastUse = ++s_verifiedSJWKCacheClock;
+            key = DuplicateCryptoKeyHandle(entry->key);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&s_verifiedSJWKCacheMutex);
+
+    return key;
+}
 
 /**
- * @brief Returns the string value of the fieldName iwthin the jsonString
- * @details Caller is expected to free the returned string using free()
- * @param jsonString a string containing a JSON object
- * @param fieldName the name of the field within jsonString to get the value from
- * @returns Returns NULL if the value doesn't exist, otherwise returns the string
+ * @brief Adds the @p key of the verified Signed JSON Web Key with the SHA-256 @p digest to the verified key cache
+ * @details Evicts the least recently used entry when the cache is full. The caller keeps its reference to @p key
+ * @param digest the SHA-256 digest of the Signed JSON Web Key
+ * @param key the key of the Signed JSON Web Key
  */
-static char* GetStringValueFromJSON(const char* jsonString, const char* fieldName)
+static void AddVerifiedSJWKKey(const uint8_t* digest, CryptoKeyHandle key)
 {
-    char* returnStr = NULL;
+    pthread_mutex_lock(&s_verifiedSJWKCacheMutex);
 
-    JSON_Value* root_value = json_parse_string(jsonString);
+    VerifiedSJWKCacheEntry* entry = &s_verifiedSJWKCache[0];
 
-    if (json_value_get_type(root_value) != JSONObject)
+    for (size_t i = 0; i < JWS_VERIFIED_SJWK_CACHE_SIZE; i++)
     {
-        goto done;
+        if (s_verifiedSJWKCache[i].key == NULL)
+        {
+            entry = &s_verifiedSJWKCache[i];
+            break;
+        }
+
+        if (s_verifiedSJWKCache[i].lastUse < entry->lastUse)
+        {
+            entry = &s_verifiedSJWKCache[i];
+        }
     }
 
-    JSON_Object* jsonObj = json_value_get_object(root_value);
-    const char* fieldValue = json_object_get_string(jsonObj, fieldName);
+    CryptoKeyHandle cachedKey = DuplicateCryptoKeyHandle(key);
 
-    if (fieldValue == NULL)
+    if (cachedKey != NULL)
     {
-        goto done;
+        FreeCryptoKeyHandle(entry->key);
+
+        memcpy(entry->digest, digest, CRYPTO_SHA256_DIGEST_SIZE);
+        entry->key = cachedKey;
+        entry->lastUse = ++s_verifiedSJWKCacheClock;
     }
 
-    if (mallocAndStrcpy_s(&returnStr, fieldValue) != 0)
+    pthread_mutex_unlock(&s_verifiedSJWKCacheMutex);
+}
+
+/**
+ * @brief Encodes the SHA-256 digest of @p data into @p buffer, as a key of the verified JWS cache
+ * @param data the data to digest
+ * @param buffer receives the Base64URL encoded digest
+ * @param bufferSize the size of @p buffer, at least BASE64_ENCODED_SIZE(CRYPTO_SHA256_DIGEST_SIZE)
+ * @returns True on success, false on failure
+ */
+static bool GetVerifiedJWSCacheKey(const char* data, char* buffer, size_t bufferSize)
+{
+    uint8_t digest[CRYPTO_SHA256_DIGEST_SIZE];
+
+    return GetSHA256Digest((const uint8_t*)data, strlen(data), digest)
+        && Base64URLEncodeToBuffer(digest, sizeof(digest), buffer, bufferSize) != 0;
+}
+
+/**
+ * @brief Creates an empty verified JWS cache for the current root keys
+ * @returns the cache, NULL on failure
+ */
+static JSON_Value* CreateVerifiedJWSCache()
+{
+    uint8_t digest[CRYPTO_SHA256_DIGEST_SIZE];
+    char rootKeys[BASE64_ENCODED_SIZE(CRYPTO_SHA256_DIGEST_SIZE)];
+
+    if (!GetRootKeysDigest(digest) || Base64URLEncodeToBuffer(digest, sizeof(digest), rootKeys, sizeof(rootKeys)) == 0)
     {
-        returnStr = NULL;
-        goto done;
+        return NULL;
     }
 
-done:
+    JSON_Value* cache = json_value_init_object();
+    JSON_Object* cacheObject = json_value_get_object(cache);
 
-    json_value_free(root_value);
-    return returnStr;
+    if (json_object_set_string(cacheObject, JWS_VERIFIED_JWS_CACHE_ROOT_KEYS_FIELDNAME, rootKeys) != JSONSuccess
+        || json_object_set_value(cacheObject, JWS_VERIFIED_JWS_CACHE_ENTRIES_FIELDNAME, json_value_init_object())
+            != JSONSuccess)
+    {
+        json_value_free(cache);
+        return NULL;
+    }
+
+    return cache;
 }
 
 /**
- * @brief Finds the character in the string, assigns a pointer to that lcoation, and returns the size of the substring from the beginning of @p string to @p foundCharPos
- * @param string string to be searched
- * @param charToFind the character to find within @p string
- * @param foundCharPos pointer will be set to the pointer to the first instance of @p charToFind within @p string
- * @returns the size of the substring from the beginning of string to the first instance of foundCharPos
+ * @brief Loads the verified JWS cache persisted at @p path
+ * @details The file is ignored unless it's a regular file owned by the effective user and not writable by others,
+ * i.e. only the process itself can vouch for its past verifications. It's also ignored if it was made for other root
+ * keys, which invalidates what was verified against the previous ones
+ * @param path the file
+ * @returns the cache, or NULL if it's missing, malformed or can't be trusted
  */
-static size_t FindCharInString(const char* string, const char charToFind, char** foundCharPos)
+static JSON_Value* LoadVerifiedJWSCache(const char* path)
 {
-    if (foundCharPos == NULL)
+    struct stat st;
+
+    if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+        || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0)
     {
-        return 0;
+        return NULL;
     }
 
-    char* found = strchr(string, charToFind);
+    JSON_Value* cache = json_parse_file(path);
+    JSON_Value* current = CreateVerifiedJWSCache();
+    const JSON_Object* cacheObject = json_value_get_object(cache);
+    const char* rootKeys = json_object_get_string(cacheObject, JWS_VERIFIED_JWS_CACHE_ROOT_KEYS_FIELDNAME);
+    const char* currentRootKeys =
+        json_object_get_string(json_value_get_object(current), JWS_VERIFIED_JWS_CACHE_ROOT_KEYS_FIELDNAME);
 
-    if (found == NULL)
+    if (rootKeys == NULL || currentRootKeys == NULL || strcmp(rootKeys, currentRootKeys) != 0
+        || json_object_get_object(cacheObject, JWS_VERIFIED_JWS_CACHE_ENTRIES_FIELDNAME) == NULL)
     {
-        *foundCharPos = NULL;
-        return 0;
+        json_value_free(cache);
+        cache = NULL;
     }
 
-    *foundCharPos = found;
-    return (size_t)(found - string);
+    json_value_free(current);
+    return cache;
 }
 
 /**
- * @brief Extracts the header, payload, and signature from the Base64Url encoded JSON Web Signature within @p jws
- * @param jws a Base64URL encoded JSON Web Signature containing a header, payload, and signature delimited by '.'
- * @param header buffer to store the Base64URL encoded header in, allocated by function to be freed by Caller using free()
- * @param payload buffer to store the Base64URL encoded payload in,  allocated by function to be freed by Caller using free()
- * @param signature buffer to store the Base64URL encoded signature in,  allocated by function to be freed by Caller using free()
- * @returns on successful extraction of all sections True is returned otherwise False
+ * @brief Persists s_verifiedJWSCache to s_verifiedJWSCachePath, if set, replacing the previous file atomically
+ * @details Called with s_verifiedJWSCacheMutex held. A failure only means verifying again after a restart
  */
-static bool ExtractJWSSections(const char* jws, char** header, char** payload, char** signature)
+static void SaveVerifiedJWSCache()
 {
-    bool success = false;
+    if (s_verifiedJWSCachePath == NULL)
+    {
+        return;
+    }
 
-    *header = NULL;
-    *payload = NULL;
-    *signature = NULL;
+    const size_t pathLength = strlen(s_verifiedJWSCachePath);
+    char* tempPath = (char*)malloc(pathLength + sizeof(".tmp"));
+    if (tempPath == NULL)
+    {
+        return;
+    }
 
-    if (jws == NULL)
+    memcpy(tempPath, s_verifiedJWSCachePath, pathLength);
+    memcpy(tempPath + pathLength, ".tmp", sizeof(".tmp"));
+
+    if (json_serialize_to_file(s_verifiedJWSCache, tempPath) != JSONSuccess || chmod(tempPath, S_IRUSR | S_IWUSR) != 0
+        || rename(tempPath, s_verifiedJWSCachePath) != 0)
     {
-        goto done;
+        remove(tempPath);
     }
 
-    const size_t jwsLen = strlen(jws);
-    if (jwsLen == 0)
+    free(tempPath);
+}
+
+/**
+ * @brief Returns whether the JSON Web Signature with the verified JWS cache key @p cacheKey was verified before
+ * @param cacheKey the key, see GetVerifiedJWSCacheKey
+ * @returns True if it's in the verified JWS cache
+ */
+static bool IsVerifiedJWS(const char* cacheKey)
+{
+    pthread_mutex_lock(&s_verifiedJWSCacheMutex);
+
+    const JSON_Object* entries =
+        json_object_get_object(json_value_get_object(s_verifiedJWSCache), JWS_VERIFIED_JWS_CACHE_ENTRIES_FIELDNAME);
+    const bool verified = json_object_get_object(entries, cacheKey) != NULL;
+
+    pthread_mutex_unlock(&s_verifiedJWSCacheMutex);
+
+    return verified;
+}
+
+/**
+ * @brief Adds the JSON Web Signature with the verified JWS cache key @p cacheKey to the verified JWS cache
+ * @details Evicts the oldest entry when the cache is full, then persists the cache
+ * @param cacheKey the key, see GetVerifiedJWSCacheKey
+ * @param signingKeyId the key identifier of the Signed JSON Web Key that verified the JWS, or NULL
+ * @param rootKeyId the key identifier of the root key that verified the Signed JSON Web Key, or NULL
+ */
+static void AddVerifiedJWS(const char* cacheKey, const char* signingKeyId, const char* rootKeyId)
+{
+    pthread_mutex_lock(&s_verifiedJWSCacheMutex);
+
+    if (s_verifiedJWSCache == NULL)
     {
-        goto done;
+        s_verifiedJWSCache = CreateVerifiedJWSCache();
     }
 
-    char* headerEnd = NULL;
-    size_t headerLen = FindCharInString(jws, '.', &headerEnd);
+    JSON_Object* entries =
+        json_object_get_object(json_value_get_object(s_verifiedJWSCache), JWS_VERIFIED_JWS_CACHE_ENTRIES_FIELDNAME);
+    JSON_Value* entry = json_value_init_object();
 
-    if (headerLen == 0 || headerLen + 1 >= jwsLen)
+    if (entries == NULL || entry == NULL)
     {
+        json_value_free(entry);
         goto done;
     }
 
-    char* payloadEnd = NULL;
-    size_t payloadLen = FindCharInString((headerEnd + 1), '.', &payloadEnd);
+    // Entries are kept in the order they were added.
+    while (json_object_get_count(entries) >= JWS_VERIFIED_JWS_CACHE_SIZE)
+    {
+        json_object_remove(entries, json_object_get_name(entries, 0));
+    }
 
-    if (payloadLen == 0 || (headerLen + payloadLen + 2 >= jwsLen))
+    JSON_Object* entryObject = json_value_get_object(entry);
+    json_object_set_string(
+        entryObject, JWS_VERIFIED_JWS_CACHE_SIGNING_KEY_ID_FIELDNAME, signingKeyId != NULL ? signingKeyId : "");
+    json_object_set_string(
+        entryObject, JWS_VERIFIED_JWS_CACHE_ROOT_KEY_ID_FIELDNAME, rootKeyId != NULL ? rootKeyId : "");
+
+    if (json_object_set_value(entries, cacheKey, entry) != JSONSuccess)
     {
+        json_value_free(entry);
         goto done;
     }
 
-    // From payloadEnd to the end of jws is the signature
+    SaveVerifiedJWSCache();
 
-    size_t sigLen = jwsLen - payloadLen - headerLen - 2; // 2 is for the periods
+done:
+    pthread_mutex_unlock(&s_verifiedJWSCacheMutex);
+}
 
-    *header = (char*)malloc(headerLen + 1);
-    *payload = (char*)malloc(payloadLen + 1);
-    *signature = (char*)malloc(sigLen + 1);
+/**
+ * @brief Splits the JSON Web Signature @p jws into its header, payload, and signature, without copying them
+ * @param jws a Base64URL encoded JSON Web Signature containing a header, payload, and signature delimited by '.'
+ * @param sections receives the sections, which point into @p jws
+ * @returns True if @p jws has three non-empty sections, false otherwise
+ */
+static bool GetJWSSections(const char* jws, JWSSections* sections)
+{
+    if (jws == NULL)
+    {
+        return false;
+    }
 
-    if (*header == NULL || *payload == NULL || *signature == NULL)
+    const char* headerEnd = strchr(jws, '.');
+    if (headerEnd == NULL || headerEnd == jws)
     {
-        goto done;
+        return false;
     }
 
-    strncpy(*header, jws, headerLen);
-    strncpy(*payload, (headerEnd + 1), payloadLen);
-    strncpy(*signature, (payloadEnd + 1), sigLen);
+    const char* payload = headerEnd + 1;
+    const char* payloadEnd = strchr(payload, '.');
+    if (payloadEnd == NULL || payloadEnd == payload || payloadEnd[1] == '\0')
+    {
+        return false;
+    }
 
-    (*header)[headerLen] = '\0';
-    (*payload)[payloadLen] = '\0';
-    (*signature)[sigLen] = '\0';
+    const char* signature = payloadEnd + 1;
 
-    success = true;
+    sections->header.data = jws;
+    sections->header.length = (size_t)(headerEnd - jws);
+    sections->payload.data = payload;
+    sections->payload.length = (size_t)(payloadEnd - payload);
+    sections->signature.data = signature;
+    sections->signature.length = strlen(signature);
 
-done:
-    if (!success)
-    {
-        if (*header != NULL)
-        {
-            free(*header);
-            *header = NULL;
-        }
+    return true;
+}
 
-        if (*payload != NULL)
-        {
-            free(*payload);
-            *payload = NULL;
-        }
+/**
+ * @brief Allocates an arena large enough to hold all the decoded @p sections
+ * @details A decoded section followed by a null-terminator is never longer than the encoded section.
+ * The caller must free the arena with FreeJWSArena()
+ * @param arena the arena to initialize
+ * @param sections the sections of a JSON Web Signature
+ * @returns True on success, false on failure
+ */
+static bool InitJWSArena(JWSArena* arena, const JWSSections* sections)
+{
+    arena->size = sections->header.length + sections->payload.length + sections->signature.length;
+    arena->used = 0;
+    arena->buffer = (uint8_t*)malloc(arena->size);
 
-        if (*signature != NULL)
-        {
-            free(*signature);
-            *signature = NULL;
-        }
+    return arena->buffer != NULL;
+}
+
+/**
+ * @brief Frees the memory of @p arena
+ * @param arena the arena to free
+ */
+static void FreeJWSArena(JWSArena* arena)
+{
+    free(arena->buffer);
+    arena->buffer = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+/**
+ * @brief Decodes the Base64URL encoded @p slice into @p arena
+ * @details The decoded data is null-terminated, so it can be used as a string; it's valid until @p arena is freed
+ * @param arena the arena to decode into
+ * @param slice the Base64URL encoded section
+ * @param decodedLength receives the size of the decoded data, without the null-terminator
+ * @returns the decoded data on success, NULL on failure
+ */
+static uint8_t* DecodeJWSSlice(JWSArena* arena, const JWSSlice* slice, size_t* decodedLength)
+{
+    uint8_t* decoded = arena->buffer + arena->used;
+    const size_t available = arena->size - arena->used;
+
+    if (available == 0)
+    {
+        return NULL;
     }
 
-    return success;
+    const size_t length = Base64URLDecodeToBuffer(slice->data, slice->length, decoded, available - 1);
+    if (length == 0)
+    {
+        return NULL;
+    }
+
+    decoded[length] = '\0';
+    arena->used += length + 1;
+
+    *decodedLength = length;
+    return decoded;
 }
 
 /**
- * @brief Extracts the header from the Base64URL encoded JSON Web Signature within @p jws
- * @details Copies the header from @p jws to @p header the header will be allocated by this method and should be freed by the caller using free
- * @param jws a Base4Url encoded JSON Web Signature contianing at least a header delimited by '.'
- * @param header destination buffer to store the Base64Url encoded header in
- * @returns on successful extraction of the header True, false otherwise
- *
+ * @brief Decodes the Base64URL encoded @p slice into @p arena and parses it as a JSON object
+ * @param arena the arena to decode into
+ * @param slice the Base64URL encoded section
+ * @param jsonValue receives the parsed value, to be freed by the caller with json_value_free()
+ * @returns the JSON object, NULL if @p slice can't be decoded or isn't a JSON object
  */
-static bool ExtractJWSHeader(const char* jws, char** header)
+static JSON_Object* ParseJWSSliceObject(JWSArena* arena, const JWSSlice* slice, JSON_Value** jsonValue)
 {
-    bool success = false;
-    char* tempHeader = NULL;
+    size_t decodedLength = 0;
+    const char* json = (const char*)DecodeJWSSlice(arena, slice, &decodedLength);
 
-    *header = NULL;
+    *jsonValue = NULL;
 
-    if (jws == NULL)
+    if (json == NULL)
     {
-        goto done;
+        return NULL;
     }
 
-    const size_t jwsLen = strlen(jws);
-    if (jwsLen == 0)
+    *jsonValue = json_parse_string(json);
+    return json_value_get_object(*jsonValue);
+}
+
+/**
+ * @brief Verifies the signature of the JSON Web Signature split into @p sections using @p key
+ * @details The signing input, the header and payload joined by a '.', is the start of the JWS and is hashed as is
+ * @param sections the sections of the JSON Web Signature
+ * @param header the parsed header of the JSON Web Signature
+ * @param arena the arena to decode the signature into
+ * @param key the public key corresponding to the one used to sign the JWS
+ * @returns a value of JWSResult
+ */
+static JWSResult
+VerifyJWSSectionsWithKey(const JWSSections* sections, const JSON_Object* header, JWSArena* arena, CryptoKeyHandle key)
+{
+    const char* alg = json_object_get_string(header, "alg");
+
+    if (alg == NULL)
     {
-        goto done;
+        return JWSResult_BadStructure;
     }
 
-    char* headerEnd = NULL;
+    size_t signatureLength = 0;
+    const uint8_t* signature = DecodeJWSSlice(arena, &sections->signature, &signatureLength);
 
-    size_t headerLen = FindCharInString(jws, '.', &headerEnd);
+    if (signature == NULL)
+    {
+        return JWSResult_InvalidSignature;
+    }
 
-    if (headerLen == 0 || headerLen + 1 >= jwsLen)
+    const uint8_t* signingInput = (const uint8_t*)sections->header.data;
+    const size_t signingInputLength = sections->header.length + 1 + sections->payload.length;
+
+    if (!IsValidSignature(alg, signature, signatureLength, signingInput, signingInputLength, key))
     {
-        goto done;
+        return JWSResult_InvalidSignature;
     }
 
-    tempHeader = (char*)malloc(headerLen + 1);
+    return JWSResult_Success;
+}
+
+/**
+ * @brief Copies the key identifiers of the Signed JSON Web Key @p sjwk
+ * @param sjwk a Base64URL encoded Signed JSON Web Key
+ * @param signingKeyId receives the identifier of the key of the SJWK, the "kid" of its payload, or NULL. The caller
+ * must free it
+ * @param rootKeyId receives the identifier of the root key that signed the SJWK, the "kid" of its header, or NULL.
+ * The caller must free it
+ */
+static void GetSJWKKeyIds(const char* sjwk, char** signingKeyId, char** rootKeyId)
+{
+    JWSSections sections;
+    JWSArena arena = { NULL, 0, 0 };
+    JSON_Value* headerValue = NULL;
+    JSON_Value* payloadValue = NULL;
 
-    if (tempHeader == NULL)
+    *signingKeyId = NULL;
+    *rootKeyId = NULL;
+
+    if (!GetJWSSections(sjwk, &sections) || !InitJWSArena(&arena, &sections))
     {
         goto done;
     }
 
-    strncpy(tempHeader, jws, headerLen);
-    success = true;
+    const char* kid = json_object_get_string(ParseJWSSliceObject(&arena, &sections.header, &headerValue), "kid");
+    if (kid != NULL)
+    {
+        *rootKeyId = strdup(kid);
+    }
 
-done:
-    if (!success)
+    kid = json_object_get_string(ParseJWSSliceObject(&arena, &sections.payload, &payloadValue), "kid");
+    if (kid != NULL)
     {
-        free(tempHeader);
-        tempHeader = NULL;
+        *signingKeyId = strdup(kid);
     }
 
-    *header = tempHeader;
-    return success;
+done:
+    json_value_free(headerValue);
+    json_value_free(payloadValue);
+    FreeJWSArena(&arena);
 }
 
 //
@@ -246,27 +570,25 @@ JWSResult VerifySJWK(const char* sjwk)
 {
     JWSResult retval = JWSResult_Failed;
 
-    char* header = NULL;
-
-    char* jsonHeader = NULL;
-    char* kid = NULL;
-    void* rootKey = NULL;
+    JWSSections sections;
+    JWSArena arena = { NULL, 0, 0 };
+    JSON_Value* headerValue = NULL;
+    CryptoKeyHandle rootKey = NULL;
 
-    if (!ExtractJWSHeader(sjwk, &header))
+    if (!GetJWSSections(sjwk, &sections))
     {
         retval = JWSResult_BadStructure;
         goto done;
     }
 
-    jsonHeader = Base64URLDecodeToString(header);
-
-    if (jsonHeader == NULL)
+    if (!InitJWSArena(&arena, &sections))
     {
         retval = JWSResult_Failed;
         goto done;
     }
 
-    kid = GetStringValueFromJSON(jsonHeader, "kid");
+    const JSON_Object* header = ParseJWSSliceObject(&arena, &sections.header, &headerValue);
+    const char* kid = json_object_get_string(header, "kid");
 
     if (kid == NULL)
     {
@@ -282,29 +604,12 @@ JWSResult VerifySJWK(const char* sjwk)
         goto done;
     }
 
-    retval = VerifyJWSWithKey(sjwk, rootKey);
-
-    if (retval != JWSResult_Success)
-    {
-        goto done;
-    }
+    retval = VerifyJWSSectionsWithKey(&sections, header, &arena, rootKey);
 
 done:
 
-    if (header != NULL)
-    {
-        free(header);
-    }
-
-    if (kid != NULL)
-    {
-        free(kid);
-    }
-
-    if (jsonHeader != NULL)
-    {
-        free(jsonHeader);
-    }
+    json_value_free(headerValue);
+    FreeJWSArena(&arena);
 
     if (rootKey != NULL)
     {
@@ -324,69 +629,93 @@ JWSResult VerifyJWSWithSJWK(const char* jws)
 {
     JWSResult result = JWSResult_Failed;
 
-    char* header = NULL;
-    char* jsonHeader = NULL;
-    char* sjwk = NULL;
+    JWSSections sections;
+    JWSArena arena = { NULL, 0, 0 };
+    JSON_Value* headerValue = NULL;
     CryptoKeyHandle key = NULL;
+    char* signingKeyId = NULL;
+    char* rootKeyId = NULL;
+
+    // Retried and re-sent deployments verify the same manifest again; skip the public key operations then.
+    char cacheKey[BASE64_ENCODED_SIZE(CRYPTO_SHA256_DIGEST_SIZE)];
+    const bool hasCacheKey = jws != NULL && GetVerifiedJWSCacheKey(jws, cacheKey, sizeof(cacheKey));
+
+    if (hasCacheKey && IsVerifiedJWS(cacheKey))
+    {
+        return JWSResult_Success;
+    }
 
-    if (!ExtractJWSHeader(jws, &header))
+    if (!GetJWSSections(jws, &sections))
     {
         result = JWSResult_BadStructure;
         goto done;
     }
 
-    jsonHeader = Base64URLDecodeToString(header);
-
-    if (jsonHeader == NULL)
+    if (!InitJWSArena(&arena, &sections))
     {
         result = JWSResult_Failed;
         goto done;
     }
 
-    sjwk = GetStringValueFromJSON(jsonHeader, "sjwk");
+    const JSON_Object* header = ParseJWSSliceObject(&arena, &sections.header, &headerValue);
 
-    if (sjwk == NULL || *sjwk == '\0')
+    if (header == NULL)
     {
-        result = JWSResult_BadStructure;
+        result = JWSResult_Failed;
         goto done;
     }
 
-    result = VerifySJWK(sjwk);
-    if (result != JWSResult_Success)
-    {
-        goto done;
-    }
+    const char* sjwk = json_object_get_string(header, "sjwk");
 
-    key = GetKeyFromBase64EncodedJWK(sjwk);
-    if (key == NULL)
+    if (sjwk == NULL || *sjwk == '\0')
     {
         result = JWSResult_BadStructure;
         goto done;
     }
 
-    result = VerifyJWSWithKey(jws, key);
+    uint8_t sjwkDigest[CRYPTO_SHA256_DIGEST_SIZE];
+    const bool hasDigest = GetSHA256Digest((const uint8_t*)sjwk, strlen(sjwk), sjwkDigest);
 
-    if (result != JWSResult_Success)
+    if (hasDigest)
     {
-        goto done;
+        key = GetVerifiedSJWKKey(sjwkDigest);
     }
 
-done:
-    if (header != NULL)
+    if (key == NULL)
     {
-        free(header);
-    }
+        result = VerifySJWK(sjwk);
+        if (result != JWSResult_Success)
+        {
+            goto done;
+        }
 
-    if (jsonHeader != NULL)
-    {
-        free(jsonHeader);
+        key = GetKeyFromBase64EncodedJWK(sjwk);
+        if (key == NULL)
+        {
+            result = JWSResult_BadStructure;
+            goto done;
+        }
+
+        if (hasDigest)
+        {
+            AddVerifiedSJWKKey(sjwkDigest, key);
+        }
     }
 
-    if (sjwk != NULL)
+    result = VerifyJWSSectionsWithKey(&sections, header, &arena, key);
+
+    if (result == JWSResult_Success && hasCacheKey)
     {
-        free(sjwk);
+        GetSJWKKeyIds(sjwk, &signingKeyId, &rootKeyId);
+        AddVerifiedJWS(cacheKey, signingKeyId, rootKeyId);
     }
 
+done:
+    json_value_free(headerValue);
+    FreeJWSArena(&arena);
+    free(signingKeyId);
+    free(rootKeyId);
+
     if (key != NULL)
     {
         FreeCryptoKeyHandle(key);
@@ -405,104 +734,37 @@ JWSResult VerifyJWSWithKey(const char* blob, CryptoKeyHandle key)
 {
     JWSResult result = JWSResult_Failed;
 
-    // Check for structure
-    char* header = NULL;
-    char* payload = NULL;
-    char* signature = NULL;
-
-    char* headerJson = NULL;
-    char* alg = NULL;
-    char* headerPlusPayload = NULL;
-    uint8_t* decodedSignature = NULL;
+    JWSSections sections;
+    JWSArena arena = { NULL, 0, 0 };
+    JSON_Value* headerValue = NULL;
 
-    if (!ExtractJWSSections(blob, &header, &payload, &signature))
+    if (!GetJWSSections(blob, &sections))
     {
         result = JWSResult_BadStructure;
         goto done;
     }
 
-    headerJson = Base64URLDecodeToString(header);
-
-    if (headerJson == NULL)
+    if (!InitJWSArena(&arena, &sections))
     {
         result = JWSResult_Failed;
         goto done;
     }
 
-    alg = GetStringValueFromJSON(headerJson, "alg");
+    const JSON_Object* header = ParseJWSSliceObject(&arena, &sections.header, &headerValue);
 
-    if (alg == NULL)
-    {
-        result = JWSResult_BadStructure;
-        goto done;
-    }
-
-    // Note: The +2 is for the "." between the header and the payload
-    // and the null terminator at the end of the string.
-    size_t headerLen = strlen(header);
-    size_t payloadLen = strlen(payload);
-    size_t hppSize = headerLen + payloadLen + 2;
-    headerPlusPayload = (char*)calloc(1, hppSize);
-
-    if (headerPlusPayload == NULL)
+    if (headerValue == NULL)
     {
         result = JWSResult_Failed;
         goto done;
     }
 
-    memcpy(headerPlusPayload, header, headerLen);
-    headerPlusPayload[headerLen] = '.';
-    memcpy(headerPlusPayload + headerLen + 1, payload, payloadLen);
-    headerPlusPayload[headerLen + payloadLen + 1] = '\0';
-
-    size_t decodedSignatureLen = Base64URLDecode(signature, &decodedSignature);
-
-    if (!IsValidSignature(
-            alg, decodedSignature, decodedSignatureLen, (uint8_t*)headerPlusPayload, strlen(headerPlusPayload), key))
-    {
-        result = JWSResult_InvalidSignature;
-    }
-    else
-    {
-        result = JWSResult_Success;
-    }
+    result = VerifyJWSSectionsWithKey(&sections, header, &arena, key);
 
 done:
 
-    if (header != NULL)
-    {
-        free(header);
-    }
+    json_value_free(headerValue);
+    FreeJWSArena(&arena);
 
-    if (payload != NULL)
-    {
-        free(payload);
-    }
-
-    if (signature != NULL)
-    {
-        free(signature);
-    }
-
-    if (headerJson != NULL)
-    {
-        free(headerJson);
-    }
-
-    if (alg != NULL)
-    {
-        free(alg);
-    }
-
-    if (headerPlusPayload != NULL)
-    {
-        free(headerPlusPayload);
-    }
-
-    if (decodedSignature != NULL)
-    {
-        free(decodedSignature);
-    }
     return result;
 }
 
@@ -516,34 +778,35 @@ bool GetPayloadFromJWT(const char* blob, char** destBuff)
 {
     bool result = false;
 
-    *destBuff = NULL;
+    JWSSections sections;
+    JWSArena arena = { NULL, 0, 0 };
+    size_t payloadLength = 0;
 
-    char* header = NULL;
-    char* payload = NULL;
-    char* signature = NULL;
-    char* tempStr = NULL;
+    *destBuff = NULL;
 
-    if (!ExtractJWSSections(blob, &header, &payload, &signature))
+    if (!GetJWSSections(blob, &sections))
     {
         goto done;
     }
 
-    tempStr = Base64URLDecodeToString(payload);
+    // The payload is decoded straight into the caller's buffer.
+    arena.size = sections.payload.length;
+    arena.buffer = (uint8_t*)malloc(arena.size);
 
-    if (tempStr == NULL)
+    if (arena.buffer == NULL || DecodeJWSSlice(&arena, &sections.payload, &payloadLength) == NULL)
     {
         goto done;
     }
 
+    *destBuff = (char*)arena.buffer;
+    arena.buffer = NULL;
+
     result = true;
 
 done:
 
-    free(header);
-    free(payload);
-    free(signature);
+    FreeJWSArena(&arena);
 
-    *destBuff = tempStr;
     return result;
 }
 
@@ -557,28 +820,18 @@ void* GetKeyFromBase64EncodedJWK(const char* blob)
 {
     CryptoKeyHandle key = NULL;
 
-    char* header = NULL;
-    char* payload = NULL;
-    char* signature = NULL;
-
-    char* strN = NULL;
-    char* stre = NULL;
-    char* payloadJson = NULL;
+    JWSSections sections;
+    JWSArena arena = { NULL, 0, 0 };
+    JSON_Value* payloadValue = NULL;
 
-    if (!ExtractJWSSections(blob, &header, &payload, &signature))
+    if (!GetJWSSections(blob, &sections) || !InitJWSArena(&arena, &sections))
     {
         goto done;
     }
 
-    payloadJson = Base64URLDecodeToString(payload);
-
-    if (payloadJson == NULL)
-    {
-        goto done;
-    }
-
-    strN = GetStringValueFromJSON(payloadJson, "n");
-    stre = GetStringValueFromJSON(payloadJson, "e");
+    const JSON_Object* payload = ParseJWSSliceObject(&arena, &sections.payload, &payloadValue);
+    const char* strN = json_object_get_string(payload, "n");
+    const char* stre = json_object_get_string(payload, "e");
 
     if (strN == NULL || stre == NULL)
     {
@@ -589,35 +842,58 @@ void* GetKeyFromBase64EncodedJWK(const char* blob)
 
 done:
 
-    if (header != NULL)
-    {
-        free(header);
-    }
+    json_value_free(payloadValue);
+    FreeJWSArena(&arena);
 
-    if (payload != NULL)
-    {
-        free(payload);
-    }
+    return key;
+}
 
-    if (signature != NULL)
-    {
-        free(signature);
-    }
+/**
+ * @brief Loads the verified JWS cache persisted at @p path, and persists it there from now on
+ * @details VerifyJWSWithSJWK caches the JSON Web Signatures it verified, with the identifiers of the keys that
+ * verified them, so that verifying one again, e.g. on a retry or after a restart, skips the public key operations.
+ * The cache is discarded when the root keys change. Without a call to this function, the cache is kept in memory only
+ * @param path the file to persist the cache to, or NULL to keep it in memory only
+ * @returns true on success, false if out of memory; the cache is then kept in memory only
+ */
+bool InitVerifiedJWSCache(const char* path)
+{
+    bool success = true;
 
-    if (payloadJson != NULL)
-    {
-        free(payloadJson);
-    }
+    pthread_mutex_lock(&s_verifiedJWSCacheMutex);
 
-    if (strN != NULL)
-    {
-        free(strN);
-    }
+    free(s_verifiedJWSCachePath);
+    s_verifiedJWSCachePath = NULL;
+    json_value_free(s_verifiedJWSCache);
+    s_verifiedJWSCache = NULL;
 
-    if (stre != NULL)
+    if (path != NULL)
     {
-        free(stre);
+        s_verifiedJWSCachePath = strdup(path);
+        success = s_verifiedJWSCachePath != NULL;
+
+        if (success)
+        {
+            s_verifiedJWSCache = LoadVerifiedJWSCache(path);
+        }
     }
 
-    return key;
+    pthread_mutex_unlock(&s_verifiedJWSCacheMutex);
+
+    return success;
+}
+
+/**
+ * @brief Frees the verified JWS cache, leaving its persisted file as is
+ */
+void UninitVerifiedJWSCache()
+{
+    pthread_mutex_lock(&s_verifiedJWSCacheMutex);
+
+    free(s_verifiedJWSCachePath);
+    s_verifiedJWSCachePath = NULL;
+    json_value_free(s_verifiedJWSCache);
+    s_verifiedJWSCache = NULL;
+
+    pthread_mutex_unlock(&s_verifiedJWSCacheMutex);
 }
@@ -11,7 +11,10 @@
 #include <aduc/calloc_wrapper.hpp>
 #include <azure_c_shared_utility/azure_base64.h>
 #include <catch2/catch.hpp>
+#include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <sstream>
 #include <openssl/evp.h>
 #include <openssl/rsa.h>
 
@@ -449,3 +452,98 @@ TEST_CASE("VerifyJWSWithKey")
         FreeCryptoKeyHandle(key);
     }
 }
+
+TEST_CASE("Verified JWS cache")
+{
+    const char* cachePath = "/tmp/adu_jws_utils_ut_verified_jws_cache.json";
+    remove(cachePath);
+
+    // JWS with a Signed JSON Web Key signed by the root key ADU.200702.R
+    const std::string signedJWT{ "eyJhbGciOiJSUzI1NiIsInNqd2siOiJleUpoYkdjaU9"
+                                 "pSlNVekkxTmlJc0ltdHBaQ0k2SWtGRVZTNHlNREEzTU"
+                                 "RJdVVpSjkuZXlKcmRIa2lPaUpTVTBFaUxDSnVJam9pY"
+                                 "2toV1FrVkdTMUl4ZG5Ob1p5dEJhRWxuTDFORVVVOHpl"
+                                 "RFJyYWpORFZWUTNaa2R1U21oQmJYVkVhSFpJWm1velo"
+                                 "waDZhVEJVTWtsQmNVTXhlREpDUTFka1QyODFkamgwZF"
+                                 "cxeFVtb3ZibGx3WnprM2FtcFFRMHQxWTJSUE5tMHpOM"
+                                 "lJqVDIxaE5EWm9OMDh3YTBod2Qwd3pibFZJUjBWeVNq"
+                                 "VkVRUzloY0ZsdWQwVmxjMlY0VkdwVU9GTndMeXRpVkh"
+                                 "GWFJXMTZaMFF6TjNCbVpFdGhjV3AwU0V4SFZtbFpkMV"
+                                 "pJVUhwMFFtRmlkM2RxYUVGMmVubFNXUzk1T1U5bWJYc"
+                                 "EVabGh0Y2xreGNtOHZLekpvUlhGRmVXdDFhbmRSUlZs"
+                                 "cmFHcEtZU3RDTkRjMkt6QnRkVWQ1VjBrMVpVbDJMMjl"
+                                 "zZERKU1pWaDRUV0k1VFd4c1dFNTViMUF6WVU1TFNVcH"
+                                 "BZbHBOY3pkMVMyTnBkMnQ1YVZWSllWbGpUV3B6T1drdl"
+                                 "VrVjVLMnhOT1haSlduRnlabkJEVlZoMU0zUnVNVXRuWX"
+                                 "pKUmN5OVVaRGgwVGxSRFIxWTJkM1JXWVhGcFNYQlVaRl"
+                                 "EwVW5KRFpFMXZUelZUVG1WbVprUjVZekpzUXpkMU9EVX"
+                                 "JiMjFVYTJOcVVHcHRObVpoY0dSSmVVWXljV1Z0ZGxOQ1"
+                                 "JHWkNOMk5oYWpWRVNVa3lOVmQzTlVWS1kyRjJabmxRTl"
+                                 "RSdGNVNVJVVE5IWTAxUllqSmtaMmhwWTJ4d2FsbHZLel"
+                                 "F6V21kWlEyUkhkR0ZhWkRKRlpreGFkMGd6VVdjeWNrUn"
+                                 "NabXN2YVdFd0x6RjVjV2xyTDFoYU1XNXpXbFJwTUVKak"
+                                 "5VTndUMDFGY1daT1NrWlJhek5DVjI5Qk1EVnlRMW9pTE"
+                                 "NKbElqb2lRVkZCUWlJc0ltRnNaeUk2SWxKVE1qVTJJaX"
+                                 "dpYTJsa0lqb2lRVVJWTGpJd01EY3dNaTVTTGxNaWZRLm"
+                                 "lTVGdBRUJYc2Q3QUFOa1FNa2FHLUZBVjZRT0dVRXV4dU"
+                                 "hnMllmU3VXaHRZWHFicE0takk1UlZMS2VzU0xDZWhLLW"
+                                 "xSQzl4Ni1fTGV5eE5oMURPRmMtRmE2b0NFR3dVajh6aU"
+                                 "9GX0FUNnM2RU9tY2txUHJ4dXZDV3R5WWtrRFJGNzRkdG"
+                                 "FLMWpOQTdTZFhyWnp2V0NzTXFPVU1OejBnQ29WUjBDcz"
+                                 "EyNTRrRk1SbVJQVmZFY2pnVDdqNGxDcHlEdVdncjlTZW"
+                                 "5TZXFnS0xZeGphYUcwc1JoOWNkaTJkS3J3Z2FOYXFBYk"
+                                 "htQ3JyaHhTUENUQnpXTUV4WnJMWXp1ZEVvZnlZSGlWVl"
+                                 "JoU0pwajBPUTE4ZWN1NERQWFYxVGN0MXkzazdMTGlvN2"
+                                 "44aXpLdXEybTNUeEY5dlBkcWI5TlA2U2M5LW15YXB0cG"
+                                 "JGcEhlRmtVTC1GNXl0bF9VQkZLcHdOOUNMNHdwNnlaLW"
+                                 "pkWE5hZ3JtVV9xTDFDeVh3MW9tTkNnVG1KRjNHZDNseX"
+                                 "FLSEhEZXJEcy1NUnBtS2p3U3dwWkNRSkdEUmNSb3ZXeU"
+                                 "wxMnZqdzNMQkpNaG1VeHNFZEJhWlA1d0dkc2ZEOGxkS1"
+                                 "lGVkZFY1owb3JNTnJVa1NNQWw2cEl4dGVmRVhpeTVscW"
+                                 "1pUHpxX0xKMWVSSXJxWTBfIn0.eyJzaGEyNTYiOiI3Mk"
+                                 "9BRTJmME5iVDArVEw5MzdvNzB4bzhvTzk2Z21WTFlESn"
+                                 "B4WEh6ZVhFPSJ9.Sagxe9ylLitBHD14QsqSCO1lhrsrq"
+                                 "qMdJo73at50-C3B2OVu6n5uiQ-6AOnuwEY07cRtxLcUl"
+                                 "i92HiLFy-itD57amI8ovIRuonLsJqcplmw6imdxDWD3C"
+                                 "CkV_I3LfUBqjuaBew71Q2HrddHn3KVTFp562xMYgFZmW"
+                                 "iERnz7c-q4IuH_7AqvNm8leznVrCscAs5UquHqz3oHLU"
+                                 "9xEn-Sur1aP0xlbN-USD9WET5wXLpiu9ECZ86CFTpc_i"
+                                 "3zlEKpl8Vbvsb0NHW_932Lrye6nz3TsYQNFxMcn5EIvH"
+                                 "ZoxIs_yHEtkJFyjFnktojrxFxGKZ5nFH-CrQH6VIwSSI"
+                                 "H1FkJOIJiI8QtovzlqdDkZNLMYQ3uM1yKt3anXTpwHbu"
+                                 "BrpYKQXN4T7bWN_9PWxyhnzKIDi6BulyrD8-H8X7P_S7"
+                                 "WBoFigb-nNrMFoSEm0qgAND01B0xJmsKf4Q6eB6L7k1S"
+                                 "0bJPx5DwrPVW-9TK8GXM0VjZYZGtiLCPUTa6SVRKTey" };
+
+    REQUIRE(InitVerifiedJWSCache(cachePath));
+    CHECK(VerifyJWSWithSJWK(signedJWT.c_str()) == JWSResult_Success);
+
+    SECTION("The verified JWS is persisted with its key identifiers")
+    {
+        std::ifstream file{ cachePath };
+        std::stringstream content;
+        content << file.rdbuf();
+
+        CHECK(content.str().find("\"rootKeyId\":\"ADU.200702.R\"") != std::string::npos);
+        CHECK(content.str().find("\"signingKeyId\":\"ADU.200702.R.S\"") != std::string::npos);
+    }
+
+    SECTION("A JWS that differs from a verified one is verified")
+    {
+        // The last characters of the signature may only hold padding bits; change one before them.
+        std::string tamperedJWT = signedJWT;
+        char& c = tamperedJWT[tamperedJWT.size() - 8];
+        c = c == 'A' ? 'B' : 'A';
+
+        CHECK(VerifyJWSWithSJWK(tamperedJWT.c_str()) == JWSResult_InvalidSignature);
+    }
+
+    SECTION("The cache is reloaded")
+    {
+        REQUIRE(InitVerifiedJWSCache(cachePath));
+        CHECK(VerifyJWSWithSJWK(signedJWT.c_str()) == JWSResult_Success);
+    }
+
+    UninitVerifiedJWSCache();
+    remove(cachePath);
+}
@@ -0,0 +1,194 @@
+/**
+ * @file metrics_utils.h
+ * @brief Counters, gauges and histograms of the agent's operations, e.g. the bytes downloaded, the peak memory usage and
+ * the download throughput, exposed in the Prometheus text format and as IoT Hub telemetry.
+ *
+ * The agent exports these functions, so handler and downloader extensions, which link their own copy of this
+ * library, update the agent's metrics too.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_METRICS_UTILS_H
+#define ADUC_METRICS_UTILS_H
+
+#include <aduc/c_utils.h>
+#include <parson.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The name of the file, in the log folder, the agent writes the metrics to in the Prometheus text format.
+ * e.g. for the textfile collector of the node exporter. The log folder is part of the diagnostics upload.
+ */
+#define ADUC_METRICS_FILE_NAME "aduc-metrics.prom"
+
+/**
+ * @brief The interval at which the agent rewrites the metrics file, in seconds.
+ */
+#ifndef ADUC_METRICS_FILE_INTERVAL_SEC
+#    define ADUC_METRICS_FILE_INTERVAL_SEC 60
+#endif
+
+/**
+ * @brief The most extended result codes counted separately by ADUC_Metrics_ObserveFailure.
+ */
+#define ADUC_METRICS_MAX_FAILURE_CODES 32
+
+/**
+ * @brief The most facility and component pairs with a time to failure histogram of their own.
+ */
+#define ADUC_METRICS_MAX_FAILURE_SOURCES 16
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief The counters. They only increase, except for the ones copied with ADUC_Metrics_SetCounter.
+ */
+typedef enum tagADUC_MetricsCounter
+{
+    ADUC_MetricsCounter_DownloadedBytes = 0, /**< Bytes downloaded by the content downloader. */
+    ADUC_MetricsCounter_Downloads, /**< Files downloaded by the content downloader. */
+    ADUC_MetricsCounter_HashedBytes, /**< Bytes of files whose hash was verified. */
+    ADUC_MetricsCounter_ChildProcessesSpawned, /**< Child processes, e.g. adu-shell, started. */
+    ADUC_MetricsCounter_TwinReportsSent, /**< Reported properties updates sent to IoT Hub. */
+    ADUC_MetricsCounter_TwinReportsThrottled, /**< Reported properties updates IoT Hub throttled. */
+    ADUC_MetricsCounter_LogRingFullWaits, /**< Times a log line waited for room in the full log buffer. */
+    ADUC_MetricsCounter_LogLinesSuppressed, /**< Log lines dropped by rate limits or collapsed as repeats. */
+    ADUC_MetricsCounter_Count /**< The number of counters, not a counter. */
+} ADUC_MetricsCounter;
+
+/**
+ * @brief The gauges. They hold the last value set.
+ */
+typedef enum tagADUC_MetricsGauge
+{
+    ADUC_MetricsGauge_JsonAllocatedBytes = 0, /**< Bytes currently allocated for JSON values. */
+    ADUC_MetricsGauge_WorkflowPeakJsonBytes, /**< Peak bytes of JSON values added by the current or last workflow. */
+    ADUC_MetricsGauge_PeakRssBytes, /**< Peak resident set size of the agent process, in bytes. */
+    ADUC_MetricsGauge_RssBeforeTrimBytes, /**< Resident set size once the last workflow was freed, in bytes. */
+    ADUC_MetricsGauge_RssAfterTrimBytes, /**< Resident set size once the heap was trimmed after it, in bytes. */
+    ADUC_MetricsGauge_Count /**< The number of gauges, not a gauge. */
+} ADUC_MetricsGauge;
+
+/**
+ * @brief The histograms.
+ */
+typedef enum tagADUC_MetricsHistogram
+{
+    ADUC_MetricsHistogram_DownloadThroughput = 0, /**< Throughput of each download, in MB/s. */
+    ADUC_MetricsHistogram_HashThroughput, /**< Throughput of each file hash verification, in MB/s. */
+    ADUC_MetricsHistogram_WorkflowDownloadDuration, /**< Duration of the download phase of workflows, in s. */
+    ADUC_MetricsHistogram_WorkflowInstallDuration, /**< Duration of the install phase of workflows, in s. */
+    ADUC_MetricsHistogram_WorkflowApplyDuration, /**< Duration of the apply phase of workflows, in s. */
+    ADUC_MetricsHistogram_Count /**< The number of histograms, not a histogram. */
+} ADUC_MetricsHistogram;
+
+/**
+ * @brief Adds @p value to @p counter. Thread-safe and lock-free.
+ *
+ * @param counter The counter.
+ * @param value The value to add.
+ */
+void ADUC_Metrics_AddCounter(ADUC_MetricsCounter counter, uint64_t value);
+
+/**
+ * @brief Sets @p counter to @p value, for counters kept elsewhere, e.g. by the logging library. Thread-safe.
+ *
+ * @param counter The counter.
+ * @param value The value.
+ */
+void ADUC_Metrics_SetCounter(ADUC_MetricsCounter counter, uint64_t value);
+
+/**
+ * @brief Returns the value of @p counter, or 0 if @p counter is invalid.
+ */
+uint64_t ADUC_Metrics_GetCounter(ADUC_MetricsCounter counter);
+
+/**
+ * @brief Sets @p gauge to @p value. Thread-safe.
+ *
+ * @param gauge The gauge.
+ * @param value The value.
+ */
+void ADUC_Metrics_SetGauge(ADUC_MetricsGauge gauge, uint64_t value);
+
+/**
+ * @brief Returns the value of @p gauge, or 0 if @p gauge is invalid.
+ */
+uint64_t ADUC_Metrics_GetGauge(ADUC_MetricsGauge gauge);
+
+/**
+ * @brief Records the observation @p value in @p histogram. Thread-safe.
+ *
+ * @param histogram The histogram.
+ * @param value The value, in the unit of the histogram.
+ */
+void ADUC_Metrics_Observe(ADUC_MetricsHistogram histogram, double value);
+
+/**
+ * @brief Records, in @p histogram, the throughput of processing @p bytes since @p startTime, in MB/s.
+ * Ignored when the elapsed time is 0.
+ *
+ * @param histogram The histogram, e.g. ADUC_MetricsHistogram_DownloadThroughput.
+ * @param bytes The number of bytes processed.
+ * @param startTime The start of the processing, from ADUC_Timing_Now.
+ */
+void ADUC_Metrics_ObserveThroughput(ADUC_MetricsHistogram histogram, uint64_t bytes, int64_t startTime);
+
+/**
+ * @brief Records, in @p histogram, the time elapsed since @p startTime, in seconds.
+ *
+ * @param histogram The histogram, e.g. ADUC_MetricsHistogram_WorkflowDownloadDuration.
+ * @param startTime The start of the operation, from ADUC_Timing_Now.
+ */
+void ADUC_Metrics_ObserveDuration(ADUC_MetricsHistogram histogram, int64_t startTime);
+
+/**
+ * @brief Records a failed operation by its extended result code: a count per code, and the time to failure per
+ * facility and component the code decodes to, see MAKE_ADUC_EXTENDEDRESULTCODE. Thread-safe.
+ * Only the first ADUC_METRICS_MAX_FAILURE_CODES codes and ADUC_METRICS_MAX_FAILURE_SOURCES facility and component
+ * pairs get series of their own; later ones are counted as "other".
+ *
+ * @param extendedResultCode The extended result code of the failure.
+ * @param startTime The start of the failed operation, from ADUC_Timing_Now.
+ */
+void ADUC_Metrics_ObserveFailure(int32_t extendedResultCode, int64_t startTime);
+
+/**
+ * @brief Returns the number of failures recorded with @p extendedResultCode by ADUC_Metrics_ObserveFailure.
+ */
+uint64_t ADUC_Metrics_GetFailureCount(int32_t extendedResultCode);
+
+/**
+ * @brief Resets all counters, gauges and histograms to 0.
+ */
+void ADUC_Metrics_Reset(void);
+
+/**
+ * @brief Returns the metrics in the Prometheus text exposition format.
+ *
+ * @returns The text, or NULL on failure. The caller must free it with free.
+ */
+char* ADUC_Metrics_GetPrometheusText(void);
+
+/**
+ * @brief Writes the metrics, see ADUC_Metrics_GetPrometheusText, to the file @p filePath, replacing it.
+ *
+ * @param filePath The path of the file.
+ * @returns True on success.
+ */
+_Bool ADUC_Metrics_WritePrometheusFile(const char* filePath);
+
+/**
+ * @brief Returns the metrics as a JSON object, for a telemetry message. Counters and gauges are reported as their value,
+ * histograms as their count and sum, failures as their count per extended result code. e.g. { "downloaded_bytes": 1024,
+ * "download_throughput_mbps": { "count": 1, "sum": 12.5 }, "failures": { "0x30100001": 2 } }
+ *
+ * @returns The JSON value, or NULL on failure. The caller must free it with json_value_free.
+ */
+JSON_Value* ADUC_Metrics_GetTelemetry(void);
+
+EXTERN_C_END
+
+#endif // ADUC_METRICS_UTILS_H
@@ -0,0 +1,137 @@
+/**
+ * @file progress_telemetry.h
+ * @brief Buffers the progress of the file downloads and of the steps of the current update, which the agent sends to
+ * IoT Hub as batched telemetry messages at the configured interval, instead of as reported properties.
+ *
+ * Only the latest record of each file and of each step is kept between two messages. Like metrics_utils.h, the agent
+ * exports these functions, so the steps handler's records reach the agent's buffer.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_PROGRESS_TELEMETRY_H
+#define ADUC_PROGRESS_TELEMETRY_H
+
+#include <aduc/c_utils.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief The maximum number of records buffered. Records of new files and steps are dropped, and counted, when full.
+ */
+#ifndef ADUC_PROGRESS_TELEMETRY_MAX_RECORDS
+#    define ADUC_PROGRESS_TELEMETRY_MAX_RECORDS 256
+#endif
+
+/**
+ * @brief The size limit of a progress telemetry message, in bytes, when not configured.
+ */
+#define ADUC_PROGRESS_TELEMETRY_DEFAULT_MAX_BYTES (16 * 1024)
+
+/**
+ * @brief The largest size limit of a progress telemetry message, in bytes: the IoT Hub limit of a D2C message.
+ */
+#define ADUC_PROGRESS_TELEMETRY_LIMIT_MAX_BYTES (256 * 1024)
+
+/**
+ * @brief The step index of the records of the update itself, rather than of one of its steps.
+ */
+#define ADUC_PROGRESS_TELEMETRY_UPDATE_STEP (-1)
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Enables or disables the buffering of records. Disabled by default; disabling empties the buffer.
+ *
+ * @param enabled Whether records are buffered.
+ */
+void ADUC_ProgressTelemetry_SetEnabled(_Bool enabled);
+
+/**
+ * @brief Returns whether records are buffered.
+ */
+_Bool ADUC_ProgressTelemetry_IsEnabled(void);
+
+/**
+ * @brief Records the download progress of a file, replacing the file's previous record. Thread-safe.
+ *
+ * @param workflowId The workflow id.
+ * @param fileId The file id.
+ * @param state The download state, e.g. "InProgress".
+ * @param bytesTransferred The bytes downloaded so far.
+ * @param bytesTotal The size of the file.
+ */
+void ADUC_ProgressTelemetry_RecordFile(
+    const char* workflowId, const char* fileId, const char* state, uint64_t bytesTransferred, uint64_t bytesTotal);
+
+/**
+ * @brief Records the throughput of the download of a file, replacing the file's previous throughput but keeping its
+ * state. Thread-safe.
+ *
+ * @param workflowId The workflow id.
+ * @param fileId The file id.
+ * @param bytesPerSecond The throughput since the previous record.
+ * @param averageBytesPerSecond The throughput since the download started.
+ * @param etaSeconds The estimated seconds until the download completes, or -1 if unknown.
+ */
+void ADUC_ProgressTelemetry_RecordFileThroughput(
+    const char* workflowId,
+    const char* fileId,
+    double bytesPerSecond,
+    double averageBytesPerSecond,
+    int64_t etaSeconds);
+
+/**
+ * @brief Records the install progress of a file, e.g. as reported by the installer, replacing the file's previous
+ * state but keeping its download progress. Thread-safe.
+ *
+ * @param workflowId The workflow id.
+ * @param fileId The file id.
+ * @param state The install state, e.g. "Installing".
+ * @param step The current install step, from 1.
+ * @param stepCount The number of install steps.
+ * @param percent The percentage of the current install step.
+ */
+void ADUC_ProgressTelemetry_RecordInstall(
+    const char* workflowId,
+    const char* fileId,
+    const char* state,
+    unsigned int step,
+    unsigned int stepCount,
+    unsigned int percent);
+
+/**
+ * @brief Records the phase of a step, or of the update, replacing the step's previous record. Thread-safe.
+ *
+ * @param workflowId The workflow id.
+ * @param stepIndex The index of the step, or ADUC_PROGRESS_TELEMETRY_UPDATE_STEP for the update itself.
+ * @param phase The phase or state, e.g. "DownloadSucceeded".
+ * @param resultCode The result code of the phase, 0 if none yet.
+ * @param extendedResultCode The extended result code of the phase, 0 if none.
+ */
+void ADUC_ProgressTelemetry_RecordStep(
+    const char* workflowId, int stepIndex, const char* phase, int32_t resultCode, int32_t extendedResultCode);
+
+/**
+ * @brief Removes the oldest buffered records, as many as fit in @p maxBytes, and returns them as a telemetry message.
+ * e.g. { "progress": [ { "workflowId": "...", "fileId": "f1", "state": "InProgress", "bytesTransferred": 512,
+ * "bytesTotal": 1024, "bytesPerSecond": 256, "averageBytesPerSecond": 200, "etaSeconds": 3, "time": 1700000000 } ],
+ * "droppedRecords": 0 }
+ *
+ * Records that don't fit stay buffered for the next message. A record that doesn't fit even alone is dropped.
+ *
+ * @param maxBytes The size limit of the message, in bytes.
+ * @returns The serialized message, or NULL if no record is buffered or on failure. The caller must free it with
+ * json_free_serialized_string.
+ */
+char* ADUC_ProgressTelemetry_TakeBatch(size_t maxBytes);
+
+/**
+ * @brief Returns the number of buffered records.
+ */
+size_t ADUC_ProgressTelemetry_GetPendingCount(void);
+
+EXTERN_C_END
+
+#endif // ADUC_PROGRESS_TELEMETRY_H
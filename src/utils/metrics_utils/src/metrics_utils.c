@@ -0,0 +1,804 @@
+/**
+ * @file metrics_utils.c
+ * @brief Implements the agent's counters, gauges and histograms.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/metrics_utils.h"
+#include "aduc/logging.h"
+#include "aduc/result.h" // for ADUC_EXTENDEDRESULTCODE_FACILITY, ADUC_EXTENDEDRESULTCODE_COMPONENT
+#include "aduc/timing_utils.h"
+
+#include <pthread.h>
+#include <stdio.h> // for open_memstream, rename, snprintf
+#include <stdlib.h> // for free
+#include <string.h> // for memcpy, memset
+
+/**
+ * @brief The maximum number of bucket upper bounds of a histogram, not counting +Inf.
+ */
+#define ADUC_METRICS_MAX_BUCKETS 10
+
+/**
+ * @brief The prefix of the Prometheus metric names.
+ */
+#define ADUC_METRICS_PROMETHEUS_PREFIX "adu_"
+
+/**
+ * @brief Describes a counter.
+ */
+typedef struct tagADUC_MetricsCounterInfo
+{
+    const char* name; //!< The name, without ADUC_METRICS_PROMETHEUS_PREFIX and the _total suffix.
+    const char* help; //!< The description.
+} ADUC_MetricsCounterInfo;
+
+/**
+ * @brief Describes a gauge.
+ */
+typedef struct tagADUC_MetricsGaugeInfo
+{
+    const char* name; //!< The name, without ADUC_METRICS_PROMETHEUS_PREFIX.
+    const char* help; //!< The description.
+} ADUC_MetricsGaugeInfo;
+
+/**
+ * @brief Describes a histogram.
+ */
+typedef struct tagADUC_MetricsHistogramInfo
+{
+    const char* name; //!< The name, without ADUC_METRICS_PROMETHEUS_PREFIX.
+    const char* help; //!< The description.
+    double bounds[ADUC_METRICS_MAX_BUCKETS]; //!< The upper bounds of the buckets, increasing.
+    size_t boundCount; //!< The number of bounds.
+} ADUC_MetricsHistogramInfo;
+
+/**
+ * @brief The values of a histogram.
+ */
+typedef struct tagADUC_MetricsHistogramValues
+{
+    uint64_t buckets[ADUC_METRICS_MAX_BUCKETS + 1]; //!< The observations of each bucket, the last one is +Inf.
+    uint64_t count; //!< The number of observations.
+    double sum; //!< The sum of the observations.
+} ADUC_MetricsHistogramValues;
+
+/**
+ * @brief The failures of an extended result code.
+ */
+typedef struct tagADUC_MetricsFailureCode
+{
+    int32_t code; //!< The extended result code.
+    uint64_t count; //!< The number of failures.
+} ADUC_MetricsFailureCode;
+
+/**
+ * @brief The failures of a facility and component.
+ */
+typedef struct tagADUC_MetricsFailureSource
+{
+    unsigned int facility; //!< The facility, an ADUC_Facility.
+    unsigned int component; //!< The component or area in the facility.
+    ADUC_MetricsHistogramValues timeToFailure; //!< The times to failure, in seconds.
+} ADUC_MetricsFailureSource;
+
+/**
+ * @brief The failures recorded by ADUC_Metrics_ObserveFailure.
+ */
+typedef struct tagADUC_MetricsFailures
+{
+    ADUC_MetricsFailureCode codes[ADUC_METRICS_MAX_FAILURE_CODES]; //!< The failures of each code, first seen first.
+    size_t codeCount; //!< The number of codes.
+    uint64_t otherCodesCount; //!< The failures of the codes beyond ADUC_METRICS_MAX_FAILURE_CODES.
+    ADUC_MetricsFailureSource sources[ADUC_METRICS_MAX_FAILURE_SOURCES]; //!< The failures of each source.
+    size_t sourceCount; //!< The number of sources.
+    ADUC_MetricsHistogramValues otherSources; //!< The times to failure of the sources beyond the max.
+} ADUC_MetricsFailures;
+
+/**
+ * @brief The counters, in the order of ADUC_MetricsCounter.
+ */
+static const ADUC_MetricsCounterInfo s_counterInfos[ADUC_MetricsCounter_Count] = {
+    { "downloaded_bytes", "Bytes downloaded by the content downloader." },
+    { "downloads", "Files downloaded by the content downloader." },
+    { "hashed_bytes", "Bytes of files whose hash was verified." },
+    { "child_processes_spawned", "Child processes started." },
+    { "twin_reports_sent", "Reported properties updates sent to IoT Hub." },
+    { "twin_reports_throttled", "Reported properties updates throttled by IoT Hub." },
+    { "log_ring_full_waits", "Log lines that waited for room in the full log buffer." },
+    { "log_lines_suppressed", "Log lines dropped by the rate limit of their call site, or collapsed as repeats." },
+};
+
+/**
+ * @brief The gauges, in the order of ADUC_MetricsGauge.
+ */
+static const ADUC_MetricsGaugeInfo s_gaugeInfos[ADUC_MetricsGauge_Count] = {
+    { "json_allocated_bytes", "Bytes currently allocated for JSON values." },
+    { "workflow_peak_json_bytes", "Peak bytes of JSON values added by the current or last workflow." },
+    { "peak_rss_bytes", "Peak resident set size of the agent process." },
+    { "rss_before_trim_bytes", "Resident set size once the last workflow was freed." },
+    { "rss_after_trim_bytes", "Resident set size once the heap was trimmed after the last workflow." },
+};
+
+/**
+ * @brief The histograms, in the order of ADUC_MetricsHistogram.
+ */
+static const ADUC_MetricsHistogramInfo s_histogramInfos[ADUC_MetricsHistogram_Count] = {
+    { "download_throughput_mbps",
+      "Throughput of each download, in MB/s.",
+      { 0.1, 0.5, 1, 2, 5, 10, 20, 50, 100 },
+      9 },
+    { "hash_throughput_mbps",
+      "Throughput of each file hash verification, in MB/s.",
+      { 1, 5, 10, 20, 50, 100, 200, 500, 1000 },
+      9 },
+    { "workflow_download_duration_seconds",
+      "Duration of the download phase of workflows, in seconds.",
+      { 1, 5, 15, 30, 60, 300, 900, 1800, 3600 },
+      9 },
+    { "workflow_install_duration_seconds",
+      "Duration of the install phase of workflows, in seconds.",
+      { 1, 5, 15, 30, 60, 300, 900, 1800, 3600 },
+      9 },
+    { "workflow_apply_duration_seconds",
+      "Duration of the apply phase of workflows, in seconds.",
+      { 1, 5, 15, 30, 60, 300, 900, 1800, 3600 },
+      9 },
+};
+
+/**
+ * @brief The time to failure histogram of each source of failures.
+ */
+static const ADUC_MetricsHistogramInfo s_timeToFailureInfo = {
+    "time_to_failure_seconds",
+    "Time until operations failed, in seconds, by the facility and component of their extended result code.",
+    { 1, 5, 15, 30, 60, 300, 900, 1800, 3600 },
+    9
+};
+
+/**
+ * @brief The names of the facilities, in the order of ADUC_Facility, for the labels of the failure metrics.
+ */
+static const char* const s_facilityNames[16] = {
+    "unknown",
+    "lower_layer",
+    "upper_layer",
+    "content_handler",
+    "content_downloader",
+    "communication_provider",
+    "log_provider",
+    "component_enumerator",
+    "utility",
+    "unused_9",
+    "unused_a",
+    "unused_b",
+    "unused_c",
+    "delivery_optimization",
+    "unused_e",
+    "unused_f",
+};
+
+/**
+ * @brief The values of the counters, updated atomically.
+ */
+static uint64_t s_counters[ADUC_MetricsCounter_Count];
+
+/**
+ * @brief The values of the gauges, updated atomically.
+ */
+static uint64_t s_gauges[ADUC_MetricsGauge_Count];
+
+/**
+ * @brief Protects s_histograms and s_failures.
+ */
+static pthread_mutex_t s_histogramMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static ADUC_MetricsHistogramValues s_histograms[ADUC_MetricsHistogram_Count];
+
+static ADUC_MetricsFailures s_failures;
+
+void ADUC_Metrics_AddCounter(ADUC_MetricsCounter counter, uint64_t value)
+{
+    if ((unsigned int)counter >= ADUC_MetricsCounter_Count)
+    {
+        return;
+    }
+
+    __atomic_fetch_add(&s_counters[counter], value, __ATOMIC_RELAXED);
+}
+
+void ADUC_Metrics_SetCounter(ADUC_MetricsCounter counter, uint64_t value)
+{
+    if ((unsigned int)counter >= ADUC_MetricsCounter_Count)
+    {
+        return;
+    }
+
+    __atomic_store_n(&s_counters[counter], value, __ATOMIC_RELAXED);
+}
+
+uint64_t ADUC_Metrics_GetCounter(ADUC_MetricsCounter counter)
+{
+    if ((unsigned int)counter >= ADUC_MetricsCounter_Count)
+    {
+        return 0;
+    }
+
+    return __atomic_load_n(&s_counters[counter], __ATOMIC_RELAXED);
+}
+
+void ADUC_Metrics_SetGauge(ADUC_MetricsGauge gauge, uint64_t value)
+{
+    if ((unsigned int)gauge >= ADUC_MetricsGauge_Count)
+    {
+        return;
+    }
+
+    __atomic_store_n(&s_gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+uint64_t ADUC_Metrics_GetGauge(ADUC_MetricsGauge gauge)
+{
+    if ((unsigned int)gauge >= ADUC_MetricsGauge_Count)
+    {
+        return 0;
+    }
+
+    return __atomic_load_n(&s_gauges[gauge], __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Records the observation @p value in the histogram @p values. Call with s_histogramMutex held.
+ *
+ * @param info The description of the histogram.
+ * @param values The values of the histogram.
+ * @param value The value.
+ */
+static void AddObservation(const ADUC_MetricsHistogramInfo* info, ADUC_MetricsHistogramValues* values, double value)
+{
+    size_t bucket = 0;
+
+    while (bucket < info->boundCount && value > info->bounds[bucket])
+    {
+        bucket++;
+    }
+
+    values->buckets[bucket]++;
+    values->count++;
+    values->sum += value;
+}
+
+void ADUC_Metrics_Observe(ADUC_MetricsHistogram histogram, double value)
+{
+    if ((unsigned int)histogram >= ADUC_MetricsHistogram_Count)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&s_histogramMutex);
+    AddObservation(&s_histogramInfos[histogram], &s_histograms[histogram], value);
+    pthread_mutex_unlock(&s_histogramMutex);
+}
+
+void ADUC_Metrics_ObserveThroughput(ADUC_MetricsHistogram histogram, uint64_t bytes, int64_t startTime)
+{
+    const int64_t elapsed = ADUC_Timing_Now() - startTime;
+
+    if (elapsed <= 0)
+    {
+        return;
+    }
+
+    // Bytes per nanosecond is 1000 MB/s.
+    ADUC_Metrics_Observe(histogram, (double)bytes * 1000.0 / (double)elapsed);
+}
+
+void ADUC_Metrics_ObserveDuration(ADUC_MetricsHistogram histogram, int64_t startTime)
+{
+    ADUC_Metrics_Observe(histogram, (double)(ADUC_Timing_Now() - startTime) / 1000000000.0);
+}
+
+void ADUC_Metrics_ObserveFailure(int32_t extendedResultCode, int64_t startTime)
+{
+    const double timeToFailure = (double)(ADUC_Timing_Now() - startTime) / 1000000000.0;
+    const unsigned int facility = ADUC_EXTENDEDRESULTCODE_FACILITY(extendedResultCode);
+    const unsigned int component = ADUC_EXTENDEDRESULTCODE_COMPONENT(extendedResultCode);
+    ADUC_MetricsFailures* failures = &s_failures;
+    ADUC_MetricsHistogramValues* timeToFailureValues = &failures->otherSources;
+    size_t i = 0;
+
+    pthread_mutex_lock(&s_histogramMutex);
+
+    while (i < failures->codeCount && failures->codes[i].code != extendedResultCode)
+    {
+        i++;
+    }
+
+    if (i < failures->codeCount)
+    {
+        failures->codes[i].count++;
+    }
+    else if (failures->codeCount < ADUC_METRICS_MAX_FAILURE_CODES)
+    {
+        failures->codes[failures->codeCount].code = extendedResultCode;
+        failures->codes[failures->codeCount].count = 1;
+        failures->codeCount++;
+    }
+    else
+    {
+        failures->otherCodesCount++;
+    }
+
+    for (i = 0; i < failures->sourceCount; i++)
+    {
+        if (failures->sources[i].facility == facility && failures->sources[i].component == component)
+        {
+            timeToFailureValues = &failures->sources[i].timeToFailure;
+            break;
+        }
+    }
+
+    if (i == failures->sourceCount && failures->sourceCount < ADUC_METRICS_MAX_FAILURE_SOURCES)
+    {
+        ADUC_MetricsFailureSource* source = &failures->sources[failures->sourceCount++];
+        source->facility = facility;
+        source->component = component;
+        timeToFailureValues = &source->timeToFailure;
+    }
+
+    AddObservation(&s_timeToFailureInfo, timeToFailureValues, timeToFailure);
+
+    pthread_mutex_unlock(&s_histogramMutex);
+}
+
+uint64_t ADUC_Metrics_GetFailureCount(int32_t extendedResultCode)
+{
+    uint64_t count = 0;
+
+    pthread_mutex_lock(&s_histogramMutex);
+
+    for (size_t i = 0; i < s_failures.codeCount; i++)
+    {
+        if (s_failures.codes[i].code == extendedResultCode)
+        {
+            count = s_failures.codes[i].count;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&s_histogramMutex);
+
+    return count;
+}
+
+void ADUC_Metrics_Reset(void)
+{
+    for (size_t i = 0; i < ADUC_MetricsCounter_Count; i++)
+    {
+        __atomic_store_n(&s_counters[i], 0, __ATOMIC_RELAXED);
+    }
+
+    for (size_t i = 0; i < ADUC_MetricsGauge_Count; i++)
+    {
+        __atomic_store_n(&s_gauges[i], 0, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&s_histogramMutex);
+    memset(s_histograms, 0, sizeof(s_histograms));
+    memset(&s_failures, 0, sizeof(s_failures));
+    pthread_mutex_unlock(&s_histogramMutex);
+}
+
+/**
+ * @brief Takes a consistent copy of the histograms and the failures.
+ *
+ * @param histograms The copy of the histograms.
+ * @param failures The copy of the failures, or NULL.
+ */
+static void
+CopyHistograms(ADUC_MetricsHistogramValues histograms[ADUC_MetricsHistogram_Count], ADUC_MetricsFailures* failures)
+{
+    pthread_mutex_lock(&s_histogramMutex);
+    memcpy(histograms, s_histograms, sizeof(s_histograms));
+    if (failures != NULL)
+    {
+        memcpy(failures, &s_failures, sizeof(s_failures));
+    }
+    pthread_mutex_unlock(&s_histogramMutex);
+}
+
+/**
+ * @brief Writes the buckets, sum and count of a histogram in the Prometheus text format.
+ *
+ * @param stream The stream.
+ * @param info The description of the histogram.
+ * @param values The values of the histogram.
+ * @param labels The labels of the histogram, e.g. 'facility="utility",', with a trailing comma, or "".
+ * @returns True on success.
+ */
+static _Bool WriteHistogram(
+    FILE* stream, const ADUC_MetricsHistogramInfo* info, const ADUC_MetricsHistogramValues* values, const char* labels)
+{
+    uint64_t cumulativeCount = 0;
+    char labelSet[128] = "";
+
+    // The labels of the sum and count, without the trailing comma.
+    const size_t labelsLength = strlen(labels);
+    if (labelsLength != 0
+        && snprintf(labelSet, sizeof(labelSet), "{%.*s}", (int)(labelsLength - 1), labels) >= (int)sizeof(labelSet))
+    {
+        return false;
+    }
+
+    // Prometheus buckets are cumulative.
+    for (size_t bucket = 0; bucket < info->boundCount; bucket++)
+    {
+        cumulativeCount += values->buckets[bucket];
+
+        if (fprintf(
+                stream,
+                ADUC_METRICS_PROMETHEUS_PREFIX "%s_bucket{%sle=\"%g\"} %llu\n",
+                info->name,
+                labels,
+                info->bounds[bucket],
+                (unsigned long long)cumulativeCount)
+            < 0)
+        {
+            return false;
+        }
+    }
+
+    return fprintf(
+               stream,
+               ADUC_METRICS_PROMETHEUS_PREFIX "%s_bucket{%sle=\"+Inf\"} %llu\n"
+               ADUC_METRICS_PROMETHEUS_PREFIX "%s_sum%s %.9g\n"
+               ADUC_METRICS_PROMETHEUS_PREFIX "%s_count%s %llu\n",
+               info->name,
+               labels,
+               (unsigned long long)values->count,
+               info->name,
+               labelSet,
+               values->sum,
+               info->name,
+               labelSet,
+               (unsigned long long)values->count)
+        >= 0;
+}
+
+/**
+ * @brief Writes the failure counts and the time to failure histograms in the Prometheus text format.
+ *
+ * @param stream The stream.
+ * @param failures The failures.
+ * @returns True on success.
+ */
+static _Bool WriteFailures(FILE* stream, const ADUC_MetricsFailures* failures)
+{
+    char labels[96];
+
+    if (fprintf(
+            stream,
+            "# HELP " ADUC_METRICS_PROMETHEUS_PREFIX "failures_total Failed operations, by extended result code.\n"
+            "# TYPE " ADUC_METRICS_PROMETHEUS_PREFIX "failures_total counter\n")
+        < 0)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < failures->codeCount; i++)
+    {
+        const int32_t code = failures->codes[i].code;
+
+        if (fprintf(
+                stream,
+                ADUC_METRICS_PROMETHEUS_PREFIX
+                "failures_total{facility=\"%s\",component=\"0x%02x\",code=\"0x%08x\"} %llu\n",
+                s_facilityNames[ADUC_EXTENDEDRESULTCODE_FACILITY(code)],
+                ADUC_EXTENDEDRESULTCODE_COMPONENT(code),
+                (unsigned int)code,
+                (unsigned long long)failures->codes[i].count)
+            < 0)
+        {
+            return false;
+        }
+    }
+
+    if (failures->otherCodesCount != 0
+        && fprintf(
+               stream,
+               ADUC_METRICS_PROMETHEUS_PREFIX "failures_total{code=\"other\"} %llu\n",
+               (unsigned long long)failures->otherCodesCount)
+            < 0)
+    {
+        return false;
+    }
+
+    if (fprintf(
+            stream,
+            "# HELP " ADUC_METRICS_PROMETHEUS_PREFIX "%s %s\n"
+            "# TYPE " ADUC_METRICS_PROMETHEUS_PREFIX "%s histogram\n",
+            s_timeToFailureInfo.name,
+            s_timeToFailureInfo.help,
+            s_timeToFailureInfo.name)
+        < 0)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < failures->sourceCount; i++)
+    {
+        const ADUC_MetricsFailureSource* source = &failures->sources[i];
+
+        snprintf(
+            labels,
+            sizeof(labels),
+            "facility=\"%s\",component=\"0x%02x\",",
+            s_facilityNames[source->facility & 0xF],
+            source->component);
+
+        if (!WriteHistogram(stream, &s_timeToFailureInfo, &source->timeToFailure, labels))
+        {
+            return false;
+        }
+    }
+
+    return failures->otherSources.count == 0
+        || WriteHistogram(stream, &s_timeToFailureInfo, &failures->otherSources, "facility=\"other\",");
+}
+
+char* ADUC_Metrics_GetPrometheusText(void)
+{
+    ADUC_MetricsHistogramValues histograms[ADUC_MetricsHistogram_Count];
+    ADUC_MetricsFailures* failures = NULL;
+    char* text = NULL;
+    size_t textSize = 0;
+    _Bool succeeded = false;
+
+    FILE* stream = open_memstream(&text, &textSize);
+    failures = (ADUC_MetricsFailures*)malloc(sizeof(*failures));
+    if (stream == NULL || failures == NULL)
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < ADUC_MetricsCounter_Count; i++)
+    {
+        const char* name = s_counterInfos[i].name;
+
+        if (fprintf(
+                stream,
+                "# HELP " ADUC_METRICS_PROMETHEUS_PREFIX "%s_total %s\n"
+                "# TYPE " ADUC_METRICS_PROMETHEUS_PREFIX "%s_total counter\n"
+                ADUC_METRICS_PROMETHEUS_PREFIX "%s_total %llu\n",
+                name,
+                s_counterInfos[i].help,
+                name,
+                name,
+                (unsigned long long)ADUC_Metrics_GetCounter((ADUC_MetricsCounter)i))
+            < 0)
+        {
+            goto done;
+        }
+    }
+
+    for (size_t i = 0; i < ADUC_MetricsGauge_Count; i++)
+    {
+        const char* name = s_gaugeInfos[i].name;
+
+        if (fprintf(
+                stream,
+                "# HELP " ADUC_METRICS_PROMETHEUS_PREFIX "%s %s\n"
+                "# TYPE " ADUC_METRICS_PROMETHEUS_PREFIX "%s gauge\n"
+                ADUC_METRICS_PROMETHEUS_PREFIX "%s %llu\n",
+                name,
+                s_gaugeInfos[i].help,
+                name,
+                name,
+                (unsigned long long)ADUC_Metrics_GetGauge((ADUC_MetricsGauge)i))
+            < 0)
+        {
+            goto done;
+        }
+    }
+
+    CopyHistograms(histograms, failures);
+
+    for (size_t i = 0; i < ADUC_MetricsHistogram_Count; i++)
+    {
+        const ADUC_MetricsHistogramInfo* info = &s_histogramInfos[i];
+
+        if (fprintf(
+                stream,
+                "# HELP " ADUC_METRICS_PROMETHEUS_PREFIX "%s %s\n"
+                "# TYPE " ADUC_METRICS_PROMETHEUS_PREFIX "%s histogram\n",
+                info->name,
+                info->help,
+                info->name)
+            < 0
+            || !WriteHistogram(stream, info, &histograms[i], ""))
+        {
+            goto done;
+        }
+    }
+
+    if (!WriteFailures(stream, failures))
+    {
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    // Closing the stream sets text.
+    if (stream != NULL && fclose(stream) != 0)
+    {
+        succeeded = false;
+    }
+
+    if (!succeeded)
+    {
+        free(text);
+        text = NULL;
+    }
+
+    free(failures);
+
+    return text;
+}
+
+_Bool ADUC_Metrics_WritePrometheusFile(const char* filePath)
+{
+    _Bool succeeded = false;
+    char tempPath[1024];
+    char* text = NULL;
+    FILE* file = NULL;
+
+    if (filePath == NULL || snprintf(tempPath, sizeof(tempPath), "%s.tmp", filePath) >= (int)sizeof(tempPath))
+    {
+        goto done;
+    }
+
+    text = ADUC_Metrics_GetPrometheusText();
+    if (text == NULL)
+    {
+        goto done;
+    }
+
+    // Write to a temporary file first, so that a scraper never sees a partial file.
+    file = fopen(tempPath, "w");
+    if (file == NULL || fputs(text, file) < 0)
+    {
+        Log_Warn("Cannot write metrics to %s", tempPath);
+        goto done;
+    }
+
+    if (fclose(file) != 0)
+    {
+        file = NULL;
+        Log_Warn("Cannot write metrics to %s", tempPath);
+        goto done;
+    }
+    file = NULL;
+
+    if (rename(tempPath, filePath) != 0)
+    {
+        Log_Warn("Cannot replace metrics file %s", filePath);
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+
+    if (!succeeded && text != NULL)
+    {
+        remove(tempPath);
+    }
+
+    free(text);
+
+    return succeeded;
+}
+
+JSON_Value* ADUC_Metrics_GetTelemetry(void)
+{
+    ADUC_MetricsHistogramValues histograms[ADUC_MetricsHistogram_Count];
+    ADUC_MetricsFailures* failures = (ADUC_MetricsFailures*)malloc(sizeof(*failures));
+    JSON_Value* telemetryValue = json_value_init_object();
+    JSON_Object* telemetryObject = json_object(telemetryValue);
+    JSON_Value* failuresValue = NULL;
+    JSON_Object* failuresObject = NULL;
+    _Bool succeeded = false;
+
+    if (telemetryObject == NULL || failures == NULL)
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < ADUC_MetricsCounter_Count; i++)
+    {
+        if (json_object_set_number(
+                telemetryObject, s_counterInfos[i].name, (double)ADUC_Metrics_GetCounter((ADUC_MetricsCounter)i))
+            != JSONSuccess)
+        {
+            goto done;
+        }
+    }
+
+    for (size_t i = 0; i < ADUC_MetricsGauge_Count; i++)
+    {
+        if (json_object_set_number(
+                telemetryObject, s_gaugeInfos[i].name, (double)ADUC_Metrics_GetGauge((ADUC_MetricsGauge)i))
+            != JSONSuccess)
+        {
+            goto done;
+        }
+    }
+
+    CopyHistograms(histograms, failures);
+
+    for (size_t i = 0; i < ADUC_MetricsHistogram_Count; i++)
+    {
+        JSON_Value* histogramValue = json_value_init_object();
+        JSON_Object* histogramObject = json_object(histogramValue);
+
+        if (histogramObject == NULL
+            || json_object_set_number(histogramObject, "count", (double)histograms[i].count) != JSONSuccess
+            || json_object_set_number(histogramObject, "sum", histograms[i].sum) != JSONSuccess
+            || json_object_set_value(telemetryObject, s_histogramInfos[i].name, histogramValue) != JSONSuccess)
+        {
+            json_value_free(histogramValue);
+            goto done;
+        }
+    }
+
+    failuresValue = json_value_init_object();
+    failuresObject = json_object(failuresValue);
+    if (failuresObject == NULL)
+    {
+        goto done;
+    }
+
+    for (size_t i = 0; i < failures->codeCount; i++)
+    {
+        char code[16];
+        snprintf(code, sizeof(code), "0x%08x", (unsigned int)failures->codes[i].code);
+
+        if (json_object_set_number(failuresObject, code, (double)failures->codes[i].count) != JSONSuccess)
+        {
+            goto done;
+        }
+    }
+
+    if (failures->otherCodesCount != 0
+        && json_object_set_number(failuresObject, "other", (double)failures->otherCodesCount) != JSONSuccess)
+    {
+        goto done;
+    }
+
+    if (json_object_set_value(telemetryObject, "failures", failuresValue) != JSONSuccess)
+    {
+        goto done;
+    }
+
+    failuresValue = NULL;
+    succeeded = true;
+
+done:
+    json_value_free(failuresValue);
+
+    if (!succeeded)
+    {
+        json_value_free(telemetryValue);
+        telemetryValue = NULL;
+    }
+
+    free(failures);
+
+    return telemetryValue;
+}
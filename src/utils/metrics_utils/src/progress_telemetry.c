@@ -0,0 +1,448 @@
+/**
+ * @file progress_telemetry.c
+ * @brief Implements the buffer of the progress telemetry records.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/progress_telemetry.h"
+
+#include <parson.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h> // for free, malloc
+#include <string.h> // for memcpy, memmove, strcmp
+#include <time.h>
+
+/**
+ * @brief A record of the progress of a file download, or of a step.
+ */
+typedef struct tagADUC_ProgressRecord
+{
+    char* workflowId; //!< The workflow id.
+    char* fileId; //!< The file id, or NULL for the records of steps.
+    int stepIndex; //!< The index of the step, for the records of steps.
+    char* state; //!< The download state, or the phase of the step.
+    uint64_t bytesTransferred; //!< The bytes downloaded so far, for the records of files.
+    uint64_t bytesTotal; //!< The size of the file, for the records of files.
+    unsigned int installStep; //!< The current install step, for the records of files being installed.
+    unsigned int installStepCount; //!< The number of install steps, 0 for the records of files not installed yet.
+    unsigned int installPercent; //!< The percentage of the current install step, for the records of files.
+    _Bool hasThroughput; //!< Whether the throughput of the file download was recorded.
+    double bytesPerSecond; //!< The recent throughput of the file download.
+    double averageBytesPerSecond; //!< The average throughput of the file download.
+    int64_t etaSeconds; //!< The estimated seconds until the file download completes, or -1 if unknown.
+    int32_t resultCode; //!< The result code, for the records of steps.
+    int32_t extendedResultCode; //!< The extended result code, for the records of steps.
+    time_t time; //!< When the record was last updated.
+} ADUC_ProgressRecord;
+
+/**
+ * @brief The buffered records, oldest first. Guarded by s_mutex.
+ */
+static ADUC_ProgressRecord s_records[ADUC_PROGRESS_TELEMETRY_MAX_RECORDS];
+
+/**
+ * @brief The number of buffered records. Guarded by s_mutex.
+ */
+static size_t s_recordCount = 0;
+
+/**
+ * @brief The number of records dropped since the last message. Guarded by s_mutex.
+ */
+static uint64_t s_droppedCount = 0;
+
+/**
+ * @brief Whether records are buffered. Guarded by s_mutex.
+ */
+static _Bool s_enabled = false;
+
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Returns a copy of @p str, or NULL on failure. The caller must free it.
+ */
+static char* CopyString(const char* str)
+{
+    const size_t size = strlen(str) + 1;
+    char* copy = malloc(size);
+    if (copy != NULL)
+    {
+        memcpy(copy, str, size);
+    }
+
+    return copy;
+}
+
+/**
+ * @brief Frees the strings of @p record.
+ */
+static void FreeRecord(ADUC_ProgressRecord* record)
+{
+    free(record->workflowId);
+    free(record->fileId);
+    free(record->state);
+    memset(record, 0, sizeof(*record));
+}
+
+/**
+ * @brief Removes the @p count oldest records. s_mutex must be locked.
+ */
+static void RemoveOldestRecordsLocked(size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        FreeRecord(&s_records[i]);
+    }
+
+    memmove(s_records, s_records + count, (s_recordCount - count) * sizeof(s_records[0]));
+    s_recordCount -= count;
+}
+
+/**
+ * @brief Returns the record of the file @p fileId, or of the step @p stepIndex when @p fileId is NULL, of the workflow
+ * @p workflowId. Adds the record if there's none.
+ *
+ * s_mutex must be locked.
+ *
+ * @returns The record, or NULL if the buffer is full or on failure, in which case the record is counted as dropped.
+ */
+static ADUC_ProgressRecord* GetRecordLocked(const char* workflowId, const char* fileId, int stepIndex)
+{
+    ADUC_ProgressRecord* record = NULL;
+
+    for (size_t i = 0; i < s_recordCount; i++)
+    {
+        record = &s_records[i];
+
+        if (strcmp(record->workflowId, workflowId) == 0
+            && (fileId == NULL ? (record->fileId == NULL && record->stepIndex == stepIndex)
+                               : (record->fileId != NULL && strcmp(record->fileId, fileId) == 0)))
+        {
+            return record;
+        }
+    }
+
+    if (s_recordCount == ADUC_PROGRESS_TELEMETRY_MAX_RECORDS)
+    {
+        s_droppedCount++;
+        return NULL;
+    }
+
+    record = &s_records[s_recordCount];
+    record->workflowId = CopyString(workflowId);
+    record->fileId = fileId == NULL ? NULL : CopyString(fileId);
+    record->stepIndex = stepIndex;
+
+    if (record->workflowId == NULL || (fileId != NULL && record->fileId == NULL))
+    {
+        FreeRecord(record);
+        s_droppedCount++;
+        return NULL;
+    }
+
+    s_recordCount++;
+    return record;
+}
+
+/**
+ * @brief Replaces the state of @p record with @p state. s_mutex must be locked.
+ */
+static void SetRecordStateLocked(ADUC_ProgressRecord* record, const char* state)
+{
+    if (record->state == NULL || strcmp(record->state, state) != 0)
+    {
+        free(record->state);
+        record->state = CopyString(state);
+    }
+
+    record->time = time(NULL);
+}
+
+void ADUC_ProgressTelemetry_SetEnabled(_Bool enabled)
+{
+    pthread_mutex_lock(&s_mutex);
+
+    s_enabled = enabled;
+
+    if (!enabled)
+    {
+        RemoveOldestRecordsLocked(s_recordCount);
+        s_droppedCount = 0;
+    }
+
+    pthread_mutex_unlock(&s_mutex);
+}
+
+_Bool ADUC_ProgressTelemetry_IsEnabled(void)
+{
+    pthread_mutex_lock(&s_mutex);
+    const _Bool enabled = s_enabled;
+    pthread_mutex_unlock(&s_mutex);
+
+    return enabled;
+}
+
+void ADUC_ProgressTelemetry_RecordFile(
+    const char* workflowId, const char* fileId, const char* state, uint64_t bytesTransferred, uint64_t bytesTotal)
+{
+    if (workflowId == NULL || fileId == NULL || state == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&s_mutex);
+
+    ADUC_ProgressRecord* record = s_enabled ? GetRecordLocked(workflowId, fileId, 0) : NULL;
+    if (record != NULL)
+    {
+        SetRecordStateLocked(record, state);
+        record->bytesTransferred = bytesTransferred;
+        record->bytesTotal = bytesTotal;
+    }
+
+    pthread_mutex_unlock(&s_mutex);
+}
+
+void ADUC_ProgressTelemetry_RecordFileThroughput(
+    const char* workflowId,
+    const char* fileId,
+    double bytesPerSecond,
+    double averageBytesPerSecond,
+    int64_t etaSeconds)
+{
+    if (workflowId == NULL || fileId == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&s_mutex);
+
+    ADUC_ProgressRecord* record = s_enabled ? GetRecordLocked(workflowId, fileId, 0) : NULL;
+    if (record != NULL)
+    {
+        record->hasThroughput = true;
+        record->bytesPerSecond = bytesPerSecond;
+        record->averageBytesPerSecond = averageBytesPerSecond;
+        record->etaSeconds = etaSeconds;
+        record->time = time(NULL);
+    }
+
+    pthread_mutex_unlock(&s_mutex);
+}
+
+void ADUC_ProgressTelemetry_RecordInstall(
+    const char* workflowId,
+    const char* fileId,
+    const char* state,
+    unsigned int step,
+    unsigned int stepCount,
+    unsigned int percent)
+{
+    if (workflowId == NULL || fileId == NULL || state == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&s_mutex);
+
+    ADUC_ProgressRecord* record = s_enabled ? GetRecordLocked(workflowId, fileId, 0) : NULL;
+    if (record != NULL)
+    {
+        SetRecordStateLocked(record, state);
+        record->installStep = step;
+        record->installStepCount = stepCount;
+        record->installPercent = percent;
+    }
+
+    pthread_mutex_unlock(&s_mutex);
+}
+
+void ADUC_ProgressTelemetry_RecordStep(
+    const char* workflowId, int stepIndex, const char* phase, int32_t resultCode, int32_t extendedResultCode)
+{
+    if (workflowId == NULL || phase == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&s_mutex);
+
+    ADUC_ProgressRecord* record = s_enabled ? GetRecordLocked(workflowId, NULL, stepIndex) : NULL;
+    if (record != NULL)
+    {
+        SetRecordStateLocked(record, phase);
+        record->resultCode = resultCode;
+        record->extendedResultCode = extendedResultCode;
+    }
+
+    pthread_mutex_unlock(&s_mutex);
+}
+
+/**
+ * @brief Returns @p record as a JSON object, or NULL on failure.
+ */
+static JSON_Value* RecordToJson(const ADUC_ProgressRecord* record)
+{
+    JSON_Value* recordValue = json_value_init_object();
+    JSON_Object* recordObject = json_object(recordValue);
+    _Bool succeeded = false;
+
+    if (recordObject == NULL || json_object_set_string(recordObject, "workflowId", record->workflowId) != JSONSuccess)
+    {
+        goto done;
+    }
+
+    if (record->fileId != NULL)
+    {
+        if (json_object_set_string(recordObject, "fileId", record->fileId) != JSONSuccess
+            || json_object_set_string(recordObject, "state", record->state == NULL ? "" : record->state) != JSONSuccess
+            || json_object_set_number(recordObject, "bytesTransferred", (double)record->bytesTransferred)
+                != JSONSuccess
+            || json_object_set_number(recordObject, "bytesTotal", (double)record->bytesTotal) != JSONSuccess)
+        {
+            goto done;
+        }
+
+        if (record->hasThroughput
+            && (json_object_set_number(recordObject, "bytesPerSecond", record->bytesPerSecond) != JSONSuccess
+                || json_object_set_number(recordObject, "averageBytesPerSecond", record->averageBytesPerSecond)
+                    != JSONSuccess
+                || json_object_set_number(recordObject, "etaSeconds", (double)record->etaSeconds) != JSONSuccess))
+        {
+            goto done;
+        }
+
+        if (record->installStepCount != 0
+            && (json_object_set_number(recordObject, "installStep", record->installStep) != JSONSuccess
+                || json_object_set_number(recordObject, "installStepCount", record->installStepCount) != JSONSuccess
+                || json_object_set_number(recordObject, "installPercent", record->installPercent) != JSONSuccess))
+        {
+            goto done;
+        }
+    }
+    else
+    {
+        if ((record->stepIndex != ADUC_PROGRESS_TELEMETRY_UPDATE_STEP
+             && json_object_set_number(recordObject, "step", record->stepIndex) != JSONSuccess)
+            || json_object_set_string(recordObject, "phase", record->state == NULL ? "" : record->state) != JSONSuccess
+            || json_object_set_number(recordObject, "resultCode", record->resultCode) != JSONSuccess
+            || json_object_set_number(recordObject, "extendedResultCode", record->extendedResultCode) != JSONSuccess)
+        {
+            goto done;
+        }
+    }
+
+    if (json_object_set_number(recordObject, "time", (double)record->time) != JSONSuccess)
+    {
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    if (!succeeded)
+    {
+        json_value_free(recordValue);
+        recordValue = NULL;
+    }
+
+    return recordValue;
+}
+
+char* ADUC_ProgressTelemetry_TakeBatch(size_t maxBytes)
+{
+    JSON_Value* batchValue = json_value_init_object();
+    JSON_Object* batchObject = json_object(batchValue);
+    JSON_Value* progressValue = json_value_init_array();
+    JSON_Array* progressArray = json_array(progressValue);
+    char* batch = NULL;
+    size_t removedCount = 0;
+    size_t takenCount = 0;
+
+    pthread_mutex_lock(&s_mutex);
+
+    if (s_recordCount == 0 && s_droppedCount == 0)
+    {
+        json_value_free(progressValue);
+        goto done;
+    }
+
+    if (batchObject == NULL || progressArray == NULL
+        || json_object_set_value(batchObject, "progress", progressValue) != JSONSuccess)
+    {
+        json_value_free(progressValue);
+        goto done;
+    }
+
+    if (json_object_set_number(batchObject, "droppedRecords", (double)s_droppedCount) != JSONSuccess)
+    {
+        goto done;
+    }
+
+    // The message is serialized without whitespace, so its size is the size of the empty message plus the size of
+    // each record and the commas between them. json_serialization_size counts the terminating null character.
+    size_t batchSize = json_serialization_size(batchValue) - 1;
+
+    for (; removedCount < s_recordCount; removedCount++)
+    {
+        JSON_Value* recordValue = RecordToJson(&s_records[removedCount]);
+        if (recordValue == NULL)
+        {
+            break;
+        }
+
+        const size_t recordSize = json_serialization_size(recordValue) - 1 + (takenCount > 0 ? 1 : 0);
+        if (batchSize + recordSize > maxBytes)
+        {
+            json_value_free(recordValue);
+
+            if (takenCount > 0)
+            {
+                break;
+            }
+
+            // Too large for any message; report it as dropped in the next one.
+            s_droppedCount++;
+            continue;
+        }
+
+        if (json_array_append_value(progressArray, recordValue) != JSONSuccess)
+        {
+            json_value_free(recordValue);
+            break;
+        }
+
+        batchSize += recordSize;
+        takenCount++;
+    }
+
+    if (takenCount == 0 && json_object_get_number(batchObject, "droppedRecords") == 0)
+    {
+        RemoveOldestRecordsLocked(removedCount);
+        goto done;
+    }
+
+    batch = json_serialize_to_string(batchValue);
+    if (batch != NULL)
+    {
+        RemoveOldestRecordsLocked(removedCount);
+        s_droppedCount -= (uint64_t)json_object_get_number(batchObject, "droppedRecords");
+    }
+
+done:
+    pthread_mutex_unlock(&s_mutex);
+
+    json_value_free(batchValue);
+
+    return batch;
+}
+
+size_t ADUC_ProgressTelemetry_GetPendingCount(void)
+{
+    pthread_mutex_lock(&s_mutex);
+    const size_t count = s_recordCount;
+    pthread_mutex_unlock(&s_mutex);
+
+    return count;
+}
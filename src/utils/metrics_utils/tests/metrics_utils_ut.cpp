@@ -0,0 +1,174 @@
+/**
+ * @file metrics_utils_ut.cpp
+ * @brief Unit Tests for metrics_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+using Catch::Matchers::Contains;
+
+#include "aduc/metrics_utils.h"
+
+#include <cstdlib>
+#include <string>
+
+/**
+ * @brief Returns the Prometheus text of the metrics.
+ */
+static std::string GetPrometheusText()
+{
+    char* text = ADUC_Metrics_GetPrometheusText();
+    REQUIRE(text != nullptr);
+
+    std::string result{ text };
+    free(text); // NOLINT(cppcoreguidelines-no-malloc)
+
+    return result;
+}
+
+TEST_CASE("ADUC_Metrics counters")
+{
+    ADUC_Metrics_Reset();
+
+    ADUC_Metrics_AddCounter(ADUC_MetricsCounter_DownloadedBytes, 1000);
+    ADUC_Metrics_AddCounter(ADUC_MetricsCounter_DownloadedBytes, 24);
+    ADUC_Metrics_SetCounter(ADUC_MetricsCounter_LogRingFullWaits, 7);
+
+    CHECK(ADUC_Metrics_GetCounter(ADUC_MetricsCounter_DownloadedBytes) == 1024);
+    CHECK(ADUC_Metrics_GetCounter(ADUC_MetricsCounter_LogRingFullWaits) == 7);
+    CHECK(ADUC_Metrics_GetCounter(ADUC_MetricsCounter_Downloads) == 0);
+    CHECK(ADUC_Metrics_GetCounter(ADUC_MetricsCounter_Count) == 0);
+
+    const std::string text = GetPrometheusText();
+    CHECK_THAT(text, Contains("# TYPE adu_downloaded_bytes_total counter\n"));
+    CHECK_THAT(text, Contains("\nadu_downloaded_bytes_total 1024\n"));
+    CHECK_THAT(text, Contains("\nadu_log_ring_full_waits_total 7\n"));
+
+    ADUC_Metrics_Reset();
+    CHECK(ADUC_Metrics_GetCounter(ADUC_MetricsCounter_DownloadedBytes) == 0);
+}
+
+TEST_CASE("ADUC_Metrics gauges")
+{
+    ADUC_Metrics_Reset();
+
+    ADUC_Metrics_SetGauge(ADUC_MetricsGauge_PeakRssBytes, 4096);
+    ADUC_Metrics_SetGauge(ADUC_MetricsGauge_PeakRssBytes, 2048);
+
+    CHECK(ADUC_Metrics_GetGauge(ADUC_MetricsGauge_PeakRssBytes) == 2048);
+    CHECK(ADUC_Metrics_GetGauge(ADUC_MetricsGauge_JsonAllocatedBytes) == 0);
+    CHECK(ADUC_Metrics_GetGauge(ADUC_MetricsGauge_Count) == 0);
+
+    const std::string text = GetPrometheusText();
+    CHECK_THAT(text, Contains("# TYPE adu_peak_rss_bytes gauge\n"));
+    CHECK_THAT(text, Contains("\nadu_peak_rss_bytes 2048\n"));
+
+    JSON_Value* telemetry = ADUC_Metrics_GetTelemetry();
+    REQUIRE(telemetry != nullptr);
+    CHECK(json_object_get_number(json_object(telemetry), "peak_rss_bytes") == 2048);
+    json_value_free(telemetry);
+
+    ADUC_Metrics_Reset();
+    CHECK(ADUC_Metrics_GetGauge(ADUC_MetricsGauge_PeakRssBytes) == 0);
+}
+
+TEST_CASE("ADUC_Metrics histograms")
+{
+    ADUC_Metrics_Reset();
+
+    ADUC_Metrics_Observe(ADUC_MetricsHistogram_DownloadThroughput, 0.05);
+    ADUC_Metrics_Observe(ADUC_MetricsHistogram_DownloadThroughput, 4);
+    ADUC_Metrics_Observe(ADUC_MetricsHistogram_DownloadThroughput, 1000);
+
+    SECTION("Prometheus buckets are cumulative")
+    {
+        const std::string text = GetPrometheusText();
+        CHECK_THAT(text, Contains("# TYPE adu_download_throughput_mbps histogram\n"));
+        CHECK_THAT(text, Contains("\nadu_download_throughput_mbps_bucket{le=\"0.1\"} 1\n"));
+        CHECK_THAT(text, Contains("\nadu_download_throughput_mbps_bucket{le=\"2\"} 1\n"));
+        CHECK_THAT(text, Contains("\nadu_download_throughput_mbps_bucket{le=\"5\"} 2\n"));
+        CHECK_THAT(text, Contains("\nadu_download_throughput_mbps_bucket{le=\"100\"} 2\n"));
+        CHECK_THAT(text, Contains("\nadu_download_throughput_mbps_bucket{le=\"+Inf\"} 3\n"));
+        CHECK_THAT(text, Contains("\nadu_download_throughput_mbps_sum 1004.05\n"));
+        CHECK_THAT(text, Contains("\nadu_download_throughput_mbps_count 3\n"));
+        CHECK_THAT(text, Contains("\nadu_workflow_install_duration_seconds_count 0\n"));
+    }
+
+    SECTION("Telemetry reports the count and sum")
+    {
+        JSON_Value* telemetry = ADUC_Metrics_GetTelemetry();
+        REQUIRE(telemetry != nullptr);
+
+        JSON_Object* throughput = json_object_get_object(json_object(telemetry), "download_throughput_mbps");
+        REQUIRE(throughput != nullptr);
+        CHECK(json_object_get_number(throughput, "count") == 3);
+        CHECK(json_object_get_number(throughput, "sum") == Approx(1004.05));
+        CHECK(json_object_get_number(json_object(telemetry), "downloaded_bytes") == 0);
+
+        json_value_free(telemetry);
+    }
+}
+
+TEST_CASE("ADUC_Metrics failures")
+{
+    ADUC_Metrics_Reset();
+
+    // A content handler code, of the handler 0x01, twice, and a Delivery Optimization code, that has no component.
+    const int32_t handlerCode = 0x30100001;
+    const auto deliveryOptimizationCode = static_cast<int32_t>(0xD0000042);
+
+    ADUC_Metrics_ObserveFailure(handlerCode, 0);
+    ADUC_Metrics_ObserveFailure(handlerCode, 0);
+    ADUC_Metrics_ObserveFailure(deliveryOptimizationCode, 0);
+
+    CHECK(ADUC_Metrics_GetFailureCount(handlerCode) == 2);
+    CHECK(ADUC_Metrics_GetFailureCount(deliveryOptimizationCode) == 1);
+    CHECK(ADUC_Metrics_GetFailureCount(0x30100002) == 0);
+
+    SECTION("Prometheus series are labeled with the decoded code")
+    {
+        const std::string text = GetPrometheusText();
+        CHECK_THAT(
+            text,
+            Contains("\nadu_failures_total{facility=\"content_handler\",component=\"0x01\",code=\"0x30100001\"} 2\n"));
+        CHECK_THAT(
+            text,
+            Contains(
+                "\nadu_failures_total{facility=\"delivery_optimization\",component=\"0x00\",code=\"0xd0000042\"} 1\n"));
+        CHECK_THAT(text, Contains("# TYPE adu_time_to_failure_seconds histogram\n"));
+        CHECK_THAT(
+            text, Contains("\nadu_time_to_failure_seconds_count{facility=\"content_handler\",component=\"0x01\"} 2\n"));
+        CHECK_THAT(
+            text,
+            Contains("\nadu_time_to_failure_seconds_bucket{facility=\"delivery_optimization\",component=\"0x00\","
+                     "le=\"+Inf\"} 1\n"));
+    }
+
+    SECTION("Telemetry reports the count of each code")
+    {
+        JSON_Value* telemetry = ADUC_Metrics_GetTelemetry();
+        REQUIRE(telemetry != nullptr);
+
+        JSON_Object* failures = json_object_get_object(json_object(telemetry), "failures");
+        REQUIRE(failures != nullptr);
+        CHECK(json_object_get_number(failures, "0x30100001") == 2);
+        CHECK(json_object_get_number(failures, "0xd0000042") == 1);
+
+        json_value_free(telemetry);
+    }
+
+    SECTION("Codes beyond the max are counted as other")
+    {
+        for (int32_t i = 0; i < ADUC_METRICS_MAX_FAILURE_CODES; i++)
+        {
+            ADUC_Metrics_ObserveFailure(0x80400000 + i, 0);
+        }
+
+        CHECK(ADUC_Metrics_GetFailureCount(0x80400000 + ADUC_METRICS_MAX_FAILURE_CODES - 1) == 0);
+        CHECK_THAT(GetPrometheusText(), Contains("\nadu_failures_total{code=\"other\"} 2\n"));
+    }
+
+    ADUC_Metrics_Reset();
+    CHECK(ADUC_Metrics_GetFailureCount(handlerCode) == 0);
+}
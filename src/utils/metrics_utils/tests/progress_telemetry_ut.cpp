@@ -0,0 +1,192 @@
+/**
+ * @file progress_telemetry_ut.cpp
+ * @brief Unit Tests for the progress telemetry buffer of the metrics_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+
+#include "aduc/progress_telemetry.h"
+
+#include <parson.h>
+#include <string>
+
+/**
+ * @brief Takes a batch of at most @p maxBytes, and returns it parsed, or nullptr if none.
+ */
+static JSON_Value* TakeBatch(size_t maxBytes)
+{
+    char* batch = ADUC_ProgressTelemetry_TakeBatch(maxBytes);
+    if (batch == nullptr)
+    {
+        return nullptr;
+    }
+
+    CHECK(std::string{ batch }.size() <= maxBytes);
+
+    JSON_Value* batchValue = json_parse_string(batch);
+    json_free_serialized_string(batch);
+    REQUIRE(batchValue != nullptr);
+
+    return batchValue;
+}
+
+TEST_CASE("ADUC_ProgressTelemetry is disabled by default")
+{
+    ADUC_ProgressTelemetry_SetEnabled(false);
+
+    ADUC_ProgressTelemetry_RecordFile("workflow", "f1", "InProgress", 1, 2);
+
+    CHECK(ADUC_ProgressTelemetry_GetPendingCount() == 0);
+    CHECK(ADUC_ProgressTelemetry_TakeBatch(ADUC_PROGRESS_TELEMETRY_DEFAULT_MAX_BYTES) == nullptr);
+}
+
+TEST_CASE("ADUC_ProgressTelemetry keeps the latest record of each file and step")
+{
+    ADUC_ProgressTelemetry_SetEnabled(true);
+
+    ADUC_ProgressTelemetry_RecordFile("workflow", "f1", "InProgress", 512, 1024);
+    ADUC_ProgressTelemetry_RecordStep("workflow", ADUC_PROGRESS_TELEMETRY_UPDATE_STEP, "DownloadStarted", 0, 0);
+    ADUC_ProgressTelemetry_RecordStep("workflow", 1, "step_download", 500, 0);
+    ADUC_ProgressTelemetry_RecordFile("workflow", "f1", "Completed", 1024, 1024);
+    ADUC_ProgressTelemetry_RecordFile("workflow", "f2", "InProgress", 0, 2048);
+
+    CHECK(ADUC_ProgressTelemetry_GetPendingCount() == 4);
+
+    JSON_Value* batchValue = TakeBatch(ADUC_PROGRESS_TELEMETRY_DEFAULT_MAX_BYTES);
+    REQUIRE(batchValue != nullptr);
+
+    const JSON_Object* batch = json_value_get_object(batchValue);
+    const JSON_Array* progress = json_object_get_array(batch, "progress");
+    REQUIRE(json_array_get_count(progress) == 4);
+    CHECK(json_object_get_number(batch, "droppedRecords") == 0);
+
+    const JSON_Object* file = json_array_get_object(progress, 0);
+    CHECK(std::string{ json_object_get_string(file, "fileId") } == "f1");
+    CHECK(std::string{ json_object_get_string(file, "state") } == "Completed");
+    CHECK(json_object_get_number(file, "bytesTransferred") == 1024);
+
+    const JSON_Object* update = json_array_get_object(progress, 1);
+    CHECK(std::string{ json_object_get_string(update, "phase") } == "DownloadStarted");
+    CHECK_FALSE(json_object_has_value(update, "step"));
+
+    const JSON_Object* step = json_array_get_object(progress, 2);
+    CHECK(json_object_get_number(step, "step") == 1);
+    CHECK(json_object_get_number(step, "resultCode") == 500);
+
+    json_value_free(batchValue);
+
+    CHECK(ADUC_ProgressTelemetry_GetPendingCount() == 0);
+    CHECK(ADUC_ProgressTelemetry_TakeBatch(ADUC_PROGRESS_TELEMETRY_DEFAULT_MAX_BYTES) == nullptr);
+
+    ADUC_ProgressTelemetry_SetEnabled(false);
+}
+
+TEST_CASE("ADUC_ProgressTelemetry splits the records into batches of the size limit")
+{
+    const size_t recordCount = 20;
+    const size_t maxBytes = 512;
+
+    ADUC_ProgressTelemetry_SetEnabled(true);
+
+    for (size_t i = 0; i < recordCount; i++)
+    {
+        const std::string fileId = "file" + std::to_string(i);
+        ADUC_ProgressTelemetry_RecordFile("workflow", fileId.c_str(), "InProgress", i, recordCount);
+    }
+
+    size_t batchCount = 0;
+    size_t takenCount = 0;
+    JSON_Value* batchValue = nullptr;
+    while ((batchValue = TakeBatch(maxBytes)) != nullptr)
+    {
+        const JSON_Array* progress = json_object_get_array(json_value_get_object(batchValue), "progress");
+        CHECK(json_array_get_count(progress) > 0);
+
+        // Oldest records first.
+        const JSON_Object* first = json_array_get_object(progress, 0);
+        CHECK(std::string{ json_object_get_string(first, "fileId") } == "file" + std::to_string(takenCount));
+
+        takenCount += json_array_get_count(progress);
+        batchCount++;
+        json_value_free(batchValue);
+    }
+
+    CHECK(takenCount == recordCount);
+    CHECK(batchCount > 1);
+
+    ADUC_ProgressTelemetry_SetEnabled(false);
+}
+
+TEST_CASE("ADUC_ProgressTelemetry counts the records dropped when full")
+{
+    ADUC_ProgressTelemetry_SetEnabled(true);
+
+    for (size_t i = 0; i < ADUC_PROGRESS_TELEMETRY_MAX_RECORDS + 3; i++)
+    {
+        ADUC_ProgressTelemetry_RecordStep("workflow", static_cast<int>(i), "step_install", 0, 0);
+    }
+
+    CHECK(ADUC_ProgressTelemetry_GetPendingCount() == ADUC_PROGRESS_TELEMETRY_MAX_RECORDS);
+
+    JSON_Value* batchValue = TakeBatch(ADUC_PROGRESS_TELEMETRY_LIMIT_MAX_BYTES);
+    REQUIRE(batchValue != nullptr);
+    CHECK(json_object_get_number(json_value_get_object(batchValue), "droppedRecords") == 3);
+    json_value_free(batchValue);
+
+    ADUC_ProgressTelemetry_SetEnabled(false);
+}
+
+TEST_CASE("ADUC_ProgressTelemetry records the install progress of a file")
+{
+    ADUC_ProgressTelemetry_SetEnabled(true);
+
+    ADUC_ProgressTelemetry_RecordFile("workflow", "f1", "Completed", 1024, 1024);
+    ADUC_ProgressTelemetry_RecordInstall("workflow", "f1", "Installing", 1, 3, 40);
+    ADUC_ProgressTelemetry_RecordInstall("workflow", "f1", "Installing", 2, 3, 10);
+
+    CHECK(ADUC_ProgressTelemetry_GetPendingCount() == 1);
+
+    JSON_Value* batchValue = TakeBatch(ADUC_PROGRESS_TELEMETRY_DEFAULT_MAX_BYTES);
+    REQUIRE(batchValue != nullptr);
+
+    const JSON_Array* progress = json_object_get_array(json_value_get_object(batchValue), "progress");
+    const JSON_Object* file = json_array_get_object(progress, 0);
+    CHECK(std::string{ json_object_get_string(file, "state") } == "Installing");
+    CHECK(json_object_get_number(file, "bytesTransferred") == 1024);
+    CHECK(json_object_get_number(file, "installStep") == 2);
+    CHECK(json_object_get_number(file, "installStepCount") == 3);
+    CHECK(json_object_get_number(file, "installPercent") == 10);
+
+    json_value_free(batchValue);
+
+    ADUC_ProgressTelemetry_SetEnabled(false);
+}
+
+TEST_CASE("ADUC_ProgressTelemetry records the download throughput of a file")
+{
+    ADUC_ProgressTelemetry_SetEnabled(true);
+
+    ADUC_ProgressTelemetry_RecordFile("workflow", "f1", "InProgress", 512, 1024);
+    ADUC_ProgressTelemetry_RecordFileThroughput("workflow", "f1", 256, 200, 3);
+    ADUC_ProgressTelemetry_RecordFile("workflow", "f2", "InProgress", 0, 1024);
+
+    JSON_Value* batchValue = TakeBatch(ADUC_PROGRESS_TELEMETRY_DEFAULT_MAX_BYTES);
+    REQUIRE(batchValue != nullptr);
+
+    const JSON_Array* progress = json_object_get_array(json_value_get_object(batchValue), "progress");
+    const JSON_Object* file = json_array_get_object(progress, 0);
+    CHECK(std::string{ json_object_get_string(file, "state") } == "InProgress");
+    CHECK(json_object_get_number(file, "bytesTransferred") == 512);
+    CHECK(json_object_get_number(file, "bytesPerSecond") == 256);
+    CHECK(json_object_get_number(file, "averageBytesPerSecond") == 200);
+    CHECK(json_object_get_number(file, "etaSeconds") == 3);
+
+    // Files without a recorded throughput don't have its fields.
+    CHECK_FALSE(json_object_has_value(json_array_get_object(progress, 1), "bytesPerSecond"));
+
+    json_value_free(batchValue);
+
+    ADUC_ProgressTelemetry_SetEnabled(false);
+}
@@ -8,6 +8,7 @@
 #ifndef PARSER_UTILS_H
 #define PARSER_UTILS_H
 
+#include "aduc/arena.h"
 #include "aduc/types/hash.h"
 #include "aduc/types/update_content.h"
 #include "parson.h"
@@ -53,6 +54,17 @@ JSON_Value* ADUC_JSON_GetUpdateManifestRoot(const JSON_Value* updateActionJson);
  */
 ADUC_Hash* ADUC_HashArray_AllocAndInit(const JSON_Object* hashObj, size_t* hashCount);
 
+/**
+ * @brief Like ADUC_HashArray_AllocAndInit, but allocates the array and its hashes from @p arena.
+ * The array is released with the arena and must not be passed to ADUC_Hash_FreeArray().
+ *
+ * @param hashObj JSON Object that contains the hashes to be returned.
+ * @param hashCount value where the count of output hashes will be stored.
+ * @param arena The arena to allocate from.
+ * @returns If success, a pointer to an array of ADUC_Hash object. Otherwise, returns NULL.
+ */
+ADUC_Hash* ADUC_HashArray_AllocAndInitInArena(const JSON_Object* hashObj, size_t* hashCount, ADUC_Arena* arena);
+
 /**
  * @brief Parse the update action JSON into a ADUC_FileEntity structure.
  * This function returns only files listed in 'updateManifest' property
@@ -88,6 +100,72 @@ _Bool ADUC_FileEntity_Init(
     size_t hashCount,
     size_t sizeInBytes);
 
+/**
+ * @brief Sets the chunk hashes of the file entity from the chunkHashes property of @p fileObj, if it has one.
+ * Chunk hashes that don't cover the file size exactly are ignored, since the whole-file hashes still apply.
+ * @param fileEntity the initialized file entity, with its size set
+ * @param fileObj the JSON object of the file in the update manifest
+ * @returns False if out of memory; true otherwise, whether or not the file has chunk hashes
+ */
+_Bool ADUC_FileEntity_InitChunkHashes(ADUC_FileEntity* fileEntity, const JSON_Object* fileObj);
+
+/**
+ * @brief Sets the transport encoding of the file entity, with the hashes and size of its encoded content, from the
+ * transportEncoding, transportHashes and transportSizeInBytes properties of @p fileObj, if it has them.
+ * Whether the encoding is supported is left to the downloader.
+ * @param fileEntity the initialized file entity
+ * @param fileObj the JSON object of the file in the update manifest
+ * @returns False if out of memory or the transport hashes are invalid; true otherwise, whether or not the file has a
+ * transport encoding
+ */
+_Bool ADUC_FileEntity_InitTransportEncoding(ADUC_FileEntity* fileEntity, const JSON_Object* fileObj);
+
+/**
+ * @brief Adds @p uri to the alternate URIs of the file entity, unless it's its download URI or already one of them.
+ * @param fileEntity the initialized file entity
+ * @param uri the URI
+ * @returns False if out of memory; true otherwise
+ */
+_Bool ADUC_FileEntity_AddAlternateUri(ADUC_FileEntity* fileEntity, const char* uri);
+
+/**
+ * @brief Like ADUC_FileEntity_AddAlternateUri, for a file entity initialized by ADUC_FileEntity_InitFromJson
+ * from an arena.
+ * @param fileEntity the file entity
+ * @param uri the URI
+ * @param arena the arena the file entity was allocated from
+ * @returns False if out of memory; true otherwise
+ */
+_Bool ADUC_FileEntity_AddAlternateUriInArena(ADUC_FileEntity* fileEntity, const char* uri, ADUC_Arena* arena);
+
+/**
+ * @brief Adds the URIs of the alternateUris property of @p fileObj, if it has one, to the alternate URIs of the file
+ * entity. Entries that aren't strings are ignored.
+ * @param fileEntity the initialized file entity
+ * @param fileObj the JSON object of the file in the update manifest
+ * @returns False if out of memory; true otherwise, whether or not the file has alternate URIs
+ */
+_Bool ADUC_FileEntity_InitAlternateUris(ADUC_FileEntity* fileEntity, const JSON_Object* fileObj);
+
+/**
+ * @brief Initializes the file entity from @p fileObj, the JSON object of file @p fileId in the update manifest,
+ * including its hashes, chunk hashes, transport encoding and alternate URIs.
+ * If @p arena isn't NULL, all of its members are allocated from it and released with it; the file entity must then
+ * not be passed to ADUC_FileEntity_Uninit(). Otherwise, caller must call ADUC_FileEntity_Uninit().
+ * @param fileEntity the file entity to be initialized
+ * @param fileId the file id
+ * @param fileObj the JSON object of the file
+ * @param downloadUri the download URI of the file, or NULL
+ * @param arena the arena to allocate from, or NULL to allocate with malloc
+ * @returns True on success and false on failure
+ */
+_Bool ADUC_FileEntity_InitFromJson(
+    ADUC_FileEntity* fileEntity,
+    const char* fileId,
+    const JSON_Object* fileObj,
+    const char* downloadUri,
+    ADUC_Arena* arena);
+
 /**
  * @brief Free memory allocated for the specified ADUC_FileEntity object's member.
  *
@@ -11,7 +11,57 @@
 #include "parson_json_utils.h"
 
 #include <azure_c_shared_utility/crt_abstractions.h> // for mallocAndStrcpy_s
-#include <stdlib.h> // for calloc
+#include <stdlib.h> // for calloc, realloc
+#include <string.h> // for strcmp, memcpy
+
+/**
+ * @brief Allocates @p count zeroed elements of @p size bytes from @p arena, or with calloc if @p arena is NULL.
+ */
+static void* ParserCalloc(ADUC_Arena* arena, size_t count, size_t size)
+{
+    return (arena != NULL) ? ADUC_Arena_Calloc(arena, count, size) : calloc(count, size);
+}
+
+/**
+ * @brief Copies @p str into @p arena, or with malloc if @p arena is NULL.
+ * @return char* The copy, or NULL if out of memory.
+ */
+static char* ParserStrdup(ADUC_Arena* arena, const char* str)
+{
+    char* copy = NULL;
+
+    if (arena != NULL)
+    {
+        return ADUC_Arena_Strdup(arena, str);
+    }
+
+    return (mallocAndStrcpy_s(&copy, str) == 0) ? copy : NULL;
+}
+
+/**
+ * @brief Same as ADUC_Hash_Init, from @p arena if it isn't NULL.
+ */
+static _Bool ParserHashInit(ADUC_Hash* hash, const char* hashValue, const char* hashType, ADUC_Arena* arena)
+{
+    return (arena != NULL) ? ADUC_Hash_InitInArena(hash, hashValue, hashType, arena)
+                           : ADUC_Hash_Init(hash, hashValue, hashType);
+}
+
+/**
+ * @brief Frees what was allocated for @p fileEntity with malloc, and zeroes it. What was allocated from an arena is
+ * freed with the arena.
+ */
+static void ParserFileEntityUninit(ADUC_FileEntity* fileEntity, ADUC_Arena* arena)
+{
+    if (arena != NULL)
+    {
+        memset(fileEntity, 0, sizeof(*fileEntity));
+    }
+    else
+    {
+        ADUC_FileEntity_Uninit(fileEntity);
+    }
+}
 
 /**
  * @brief Retrieves the updateManifest from the updateActionJson
@@ -38,10 +88,11 @@ JSON_Value* ADUC_JSON_GetUpdateManifestRoot(const JSON_Value* updateActionJson)
  *
  * @param hashObj JSON Object that contains the hashes to be returned.
  * @param hashCount A size_t* where the count of output hashes will be stored.
+ * @param arena The arena to allocate from, or NULL to allocate with malloc.
  * @returns If success, a pointer to an array of ADUC_Hash object. Otherwise, returns NULL.
- *  Caller must call ADUC_FileEntityArray_Free() to free the array.
+ *  Unless allocated from @p arena, caller must call ADUC_Hash_FreeArray() to free the array.
  */
-ADUC_Hash* ADUC_HashArray_AllocAndInit(const JSON_Object* hashObj, size_t* hashCount)
+static ADUC_Hash* HashArrayAllocAndInit(const JSON_Object* hashObj, size_t* hashCount, ADUC_Arena* arena)
 {
     _Bool success = false;
 
@@ -61,7 +112,7 @@ ADUC_Hash* ADUC_HashArray_AllocAndInit(const JSON_Object* hashObj, size_t* hashC
         goto done;
     }
 
-    tempHashArray = (ADUC_Hash*)calloc(tempHashCount, sizeof(ADUC_Hash));
+    tempHashArray = (ADUC_Hash*)ParserCalloc(arena, tempHashCount, sizeof(ADUC_Hash));
 
     if (tempHashArray == NULL)
     {
@@ -74,7 +125,7 @@ ADUC_Hash* ADUC_HashArray_AllocAndInit(const JSON_Object* hashObj, size_t* hashC
 
         const char* hashType = json_object_get_name(hashObj, hash_index);
         const char* hashValue = json_value_get_string(json_object_get_value_at(hashObj, hash_index));
-        if (!ADUC_Hash_Init(currHash, hashValue, hashType))
+        if (!ParserHashInit(currHash, hashValue, hashType, arena))
         {
             goto done;
         }
@@ -88,7 +139,10 @@ done:
 
     if (!success)
     {
-        ADUC_Hash_FreeArray(tempHashCount, tempHashArray);
+        if (arena == NULL)
+        {
+            ADUC_Hash_FreeArray(tempHashCount, tempHashArray);
+        }
         tempHashArray = NULL;
         tempHashCount = 0;
     }
@@ -98,6 +152,21 @@ done:
     return tempHashArray;
 }
 
+ADUC_Hash* ADUC_HashArray_AllocAndInit(const JSON_Object* hashObj, size_t* hashCount)
+{
+    return HashArrayAllocAndInit(hashObj, hashCount, NULL);
+}
+
+ADUC_Hash* ADUC_HashArray_AllocAndInitInArena(const JSON_Object* hashObj, size_t* hashCount, ADUC_Arena* arena)
+{
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+
+    return HashArrayAllocAndInit(hashObj, hashCount, arena);
+}
+
 /**
  * @brief Free memory allocated for the specified ADUC_FileEntity object's member.
  *
@@ -114,6 +183,14 @@ void ADUC_FileEntity_Uninit(ADUC_FileEntity* entity)
     free(entity->FileId);
     free(entity->Arguments);
     ADUC_Hash_FreeArray(entity->HashCount, entity->Hash);
+    ADUC_Hash_FreeArray(entity->ChunkHashCount, entity->ChunkHashes);
+    free(entity->TransportEncoding);
+    ADUC_Hash_FreeArray(entity->TransportHashCount, entity->TransportHashes);
+    for (size_t index = 0; index < entity->AlternateUriCount; ++index)
+    {
+        free(entity->AlternateUris[index]);
+    }
+    free(entity->AlternateUris);
     memset(entity, 0, sizeof(*entity));
 }
 
@@ -136,7 +213,7 @@ void ADUC_FileEntityArray_Free(unsigned int fileCount, ADUC_FileEntity* files)
 }
 
 /**
- * @brief Initializes the file entity
+ * @brief Initializes the file entity, see ADUC_FileEntity_Init.
  * @param file the file entity to be initialized
  * @param fileId fileId for @p fileEntity
  * @param targetFileName fileName for @p fileEntity
@@ -145,9 +222,10 @@ void ADUC_FileEntityArray_Free(unsigned int fileCount, ADUC_FileEntity* files)
  * @param hashArray a hash array for @p fileEntity
  * @param hashCount a hash count of @p hashArray
  * @param sizeInBytes file size (in bytes)
+ * @param arena the arena to allocate from, or NULL to allocate with malloc
  * @returns True on success and false on failure
  */
-_Bool ADUC_FileEntity_Init(
+static _Bool FileEntityInit(
     ADUC_FileEntity* fileEntity,
     const char* fileId,
     const char* targetFileName,
@@ -155,7 +233,8 @@ _Bool ADUC_FileEntity_Init(
     const char* arguments,
     ADUC_Hash* hashArray,
     size_t hashCount,
-    size_t sizeInBytes)
+    size_t sizeInBytes,
+    ADUC_Arena* arena)
 {
     _Bool success = false;
 
@@ -172,12 +251,12 @@ _Bool ADUC_FileEntity_Init(
 
     memset(fileEntity, 0, sizeof(*fileEntity));
 
-    if (mallocAndStrcpy_s(&(fileEntity->FileId), fileId) != 0)
+    if ((fileEntity->FileId = ParserStrdup(arena, fileId)) == NULL)
     {
         goto done;
     }
 
-    if (mallocAndStrcpy_s(&(fileEntity->TargetFilename), targetFileName) != 0)
+    if ((fileEntity->TargetFilename = ParserStrdup(arena, targetFileName)) == NULL)
     {
         goto done;
     }
@@ -186,12 +265,12 @@ _Bool ADUC_FileEntity_Init(
     {
         fileEntity->DownloadUri = NULL;
     }
-    else if (mallocAndStrcpy_s(&(fileEntity->DownloadUri), downloadUri) != 0)
+    else if ((fileEntity->DownloadUri = ParserStrdup(arena, downloadUri)) == NULL)
     {
         goto done;
     }
 
-    if (arguments != NULL && mallocAndStrcpy_s(&(fileEntity->Arguments), arguments) != 0)
+    if (arguments != NULL && (fileEntity->Arguments = ParserStrdup(arena, arguments)) == NULL)
     {
         goto done;
     }
@@ -207,11 +286,336 @@ done:
 
     if (!success)
     {
-        ADUC_FileEntity_Uninit(fileEntity);
+        ParserFileEntityUninit(fileEntity, arena);
     }
     return success;
 }
 
+/**
+ * @brief Initializes the file entity
+ * @param file the file entity to be initialized
+ * @param fileId fileId for @p fileEntity
+ * @param targetFileName fileName for @p fileEntity
+ * @param downloadUri downloadUri for @p fileEntity
+ * @param arguments arguments for @p fileEntity (payload for down-level update handler)
+ * @param hashArray a hash array for @p fileEntity
+ * @param hashCount a hash count of @p hashArray
+ * @param sizeInBytes file size (in bytes)
+ * @returns True on success and false on failure
+ */
+_Bool ADUC_FileEntity_Init(
+    ADUC_FileEntity* fileEntity,
+    const char* fileId,
+    const char* targetFileName,
+    const char* downloadUri,
+    const char* arguments,
+    ADUC_Hash* hashArray,
+    size_t hashCount,
+    size_t sizeInBytes)
+{
+    return FileEntityInit(
+        fileEntity, fileId, targetFileName, downloadUri, arguments, hashArray, hashCount, sizeInBytes, NULL);
+}
+
+/**
+ * @brief Sets the chunk hashes of the file entity from the chunkHashes property of @p fileObj, if it has one.
+ * Chunk hashes that don't cover the file size exactly are ignored, since the whole-file hashes still apply.
+ * @param fileEntity the initialized file entity, with its size set
+ * @param fileObj the JSON object of the file in the update manifest
+ * @param arena the arena to allocate from, or NULL to allocate with malloc
+ * @returns False if out of memory; true otherwise, whether or not the file has chunk hashes
+ */
+static _Bool FileEntityInitChunkHashes(ADUC_FileEntity* fileEntity, const JSON_Object* fileObj, ADUC_Arena* arena)
+{
+    const JSON_Object* chunkHashesObj = json_object_get_object(fileObj, ADUCITF_FIELDNAME_CHUNKHASHES);
+    if (chunkHashesObj == NULL)
+    {
+        return true;
+    }
+
+    const double chunkSize = json_object_get_number(chunkHashesObj, ADUCITF_FIELDNAME_CHUNKSIZE);
+
+    // The member other than the chunk size is the array of hashes, named after their type.
+    const char* hashType = NULL;
+    const JSON_Array* hashValues = NULL;
+    for (size_t index = 0; index < json_object_get_count(chunkHashesObj); ++index)
+    {
+        const char* name = json_object_get_name(chunkHashesObj, index);
+        if (strcmp(name, ADUCITF_FIELDNAME_CHUNKSIZE) != 0)
+        {
+            hashType = name;
+            hashValues = json_value_get_array(json_object_get_value_at(chunkHashesObj, index));
+            break;
+        }
+    }
+
+    SHAversion algorithm;
+    if (chunkSize < 1 || fileEntity->SizeInBytes == 0 || hashValues == NULL
+        || !ADUC_HashUtils_GetShaVersionForTypeString(hashType, &algorithm))
+    {
+        Log_Warn("Ignoring invalid chunk hashes of file %s", fileEntity->FileId);
+        return true;
+    }
+
+    const size_t chunkSizeInBytes = (size_t)chunkSize;
+    const size_t chunkCount = (fileEntity->SizeInBytes + chunkSizeInBytes - 1) / chunkSizeInBytes;
+    if (json_array_get_count(hashValues) != chunkCount)
+    {
+        Log_Warn(
+            "Ignoring chunk hashes of file %s: %zu hashes for %zu chunks",
+            fileEntity->FileId,
+            json_array_get_count(hashValues),
+            chunkCount);
+        return true;
+    }
+
+    ADUC_Hash* chunkHashes = ParserCalloc(arena, chunkCount, sizeof(ADUC_Hash));
+    if (chunkHashes == NULL)
+    {
+        return false;
+    }
+
+    for (size_t index = 0; index < chunkCount; ++index)
+    {
+        const char* hashValue = json_array_get_string(hashValues, index);
+        if (hashValue == NULL)
+        {
+            Log_Warn("Ignoring chunk hashes of file %s: chunk %zu has no hash", fileEntity->FileId, index);
+            if (arena == NULL)
+            {
+                ADUC_Hash_FreeArray(chunkCount, chunkHashes);
+            }
+            return true;
+        }
+
+        if (!ParserHashInit(chunkHashes + index, hashValue, hashType, arena))
+        {
+            if (arena == NULL)
+            {
+                ADUC_Hash_FreeArray(chunkCount, chunkHashes);
+            }
+            return false;
+        }
+    }
+
+    fileEntity->ChunkHashes = chunkHashes;
+    fileEntity->ChunkHashCount = chunkCount;
+    fileEntity->ChunkSizeInBytes = chunkSizeInBytes;
+
+    return true;
+}
+
+_Bool ADUC_FileEntity_InitChunkHashes(ADUC_FileEntity* fileEntity, const JSON_Object* fileObj)
+{
+    return FileEntityInitChunkHashes(fileEntity, fileObj, NULL);
+}
+
+/**
+ * @brief Sets the transport encoding of the file entity, with the hashes and size of its encoded content, from the
+ * transportEncoding, transportHashes and transportSizeInBytes properties of @p fileObj, if it has them.
+ * Whether the encoding is supported is left to the downloader.
+ * @param fileEntity the initialized file entity
+ * @param fileObj the JSON object of the file in the update manifest
+ * @param arena the arena to allocate from, or NULL to allocate with malloc
+ * @returns False if out of memory or the transport hashes are invalid; true otherwise, whether or not the file has a
+ * transport encoding
+ */
+static _Bool
+FileEntityInitTransportEncoding(ADUC_FileEntity* fileEntity, const JSON_Object* fileObj, ADUC_Arena* arena)
+{
+    const char* encoding = json_object_get_string(fileObj, ADUCITF_FIELDNAME_TRANSPORTENCODING);
+    if (encoding == NULL)
+    {
+        return true;
+    }
+
+    if ((fileEntity->TransportEncoding = ParserStrdup(arena, encoding)) == NULL)
+    {
+        return false;
+    }
+
+    const JSON_Object* hashObj = json_object_get_object(fileObj, ADUCITF_FIELDNAME_TRANSPORTHASHES);
+    if (hashObj != NULL)
+    {
+        fileEntity->TransportHashes = HashArrayAllocAndInit(hashObj, &fileEntity->TransportHashCount, arena);
+        if (fileEntity->TransportHashes == NULL)
+        {
+            Log_Error("Unable to parse transport hashes of file %s", fileEntity->FileId);
+            return false;
+        }
+    }
+
+    if (json_object_has_value(fileObj, ADUCITF_FIELDNAME_TRANSPORTSIZEINBYTES))
+    {
+        fileEntity->TransportSizeInBytes =
+            (size_t)json_object_get_number(fileObj, ADUCITF_FIELDNAME_TRANSPORTSIZEINBYTES);
+    }
+
+    return true;
+}
+
+_Bool ADUC_FileEntity_InitTransportEncoding(ADUC_FileEntity* fileEntity, const JSON_Object* fileObj)
+{
+    return FileEntityInitTransportEncoding(fileEntity, fileObj, NULL);
+}
+
+/**
+ * @brief Adds @p uri to the alternate URIs of the file entity, unless it's its download URI or already one of them.
+ * @param fileEntity the initialized file entity
+ * @param uri the URI
+ * @param arena the arena to allocate from, or NULL to allocate with malloc
+ * @returns False if out of memory; true otherwise
+ */
+static _Bool FileEntityAddAlternateUri(ADUC_FileEntity* fileEntity, const char* uri, ADUC_Arena* arena)
+{
+    if (fileEntity->DownloadUri != NULL && strcmp(fileEntity->DownloadUri, uri) == 0)
+    {
+        return true;
+    }
+
+    for (size_t index = 0; index < fileEntity->AlternateUriCount; ++index)
+    {
+        if (strcmp(fileEntity->AlternateUris[index], uri) == 0)
+        {
+            return true;
+        }
+    }
+
+    char** alternateUris = NULL;
+    if (arena != NULL)
+    {
+        // The previous array stays in the arena; files have few alternate URIs.
+        alternateUris = ADUC_Arena_Alloc(arena, (fileEntity->AlternateUriCount + 1) * sizeof(char*));
+        if (alternateUris != NULL && fileEntity->AlternateUriCount != 0)
+        {
+            memcpy(alternateUris, fileEntity->AlternateUris, fileEntity->AlternateUriCount * sizeof(char*));
+        }
+    }
+    else
+    {
+        alternateUris = realloc(fileEntity->AlternateUris, (fileEntity->AlternateUriCount + 1) * sizeof(char*));
+    }
+
+    if (alternateUris == NULL)
+    {
+        return false;
+    }
+
+    fileEntity->AlternateUris = alternateUris;
+    if ((alternateUris[fileEntity->AlternateUriCount] = ParserStrdup(arena, uri)) == NULL)
+    {
+        return false;
+    }
+
+    ++fileEntity->AlternateUriCount;
+    return true;
+}
+
+_Bool ADUC_FileEntity_AddAlternateUri(ADUC_FileEntity* fileEntity, const char* uri)
+{
+    return FileEntityAddAlternateUri(fileEntity, uri, NULL);
+}
+
+_Bool ADUC_FileEntity_AddAlternateUriInArena(ADUC_FileEntity* fileEntity, const char* uri, ADUC_Arena* arena)
+{
+    return arena != NULL && FileEntityAddAlternateUri(fileEntity, uri, arena);
+}
+
+/**
+ * @brief Adds the URIs of the alternateUris property of @p fileObj, if it has one, to the alternate URIs of the file
+ * entity. Entries that aren't strings are ignored.
+ * @param fileEntity the initialized file entity
+ * @param fileObj the JSON object of the file in the update manifest
+ * @param arena the arena to allocate from, or NULL to allocate with malloc
+ * @returns False if out of memory; true otherwise, whether or not the file has alternate URIs
+ */
+static _Bool FileEntityInitAlternateUris(ADUC_FileEntity* fileEntity, const JSON_Object* fileObj, ADUC_Arena* arena)
+{
+    const JSON_Array* uris = json_object_get_array(fileObj, ADUCITF_FIELDNAME_ALTERNATEURIS);
+
+    for (size_t index = 0; index < json_array_get_count(uris); ++index)
+    {
+        const char* uri = json_array_get_string(uris, index);
+        if (uri == NULL || *uri == '\0')
+        {
+            Log_Warn("Ignoring alternate URI %zu of file %s", index, fileEntity->FileId);
+            continue;
+        }
+
+        if (!FileEntityAddAlternateUri(fileEntity, uri, arena))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+_Bool ADUC_FileEntity_InitAlternateUris(ADUC_FileEntity* fileEntity, const JSON_Object* fileObj)
+{
+    return FileEntityInitAlternateUris(fileEntity, fileObj, NULL);
+}
+
+_Bool ADUC_FileEntity_InitFromJson(
+    ADUC_FileEntity* fileEntity,
+    const char* fileId,
+    const JSON_Object* fileObj,
+    const char* downloadUri,
+    ADUC_Arena* arena)
+{
+    ADUC_Hash* hashArray = NULL;
+    size_t hashCount = 0;
+    size_t sizeInBytes = 0;
+
+    if (fileEntity == NULL)
+    {
+        return false;
+    }
+
+    memset(fileEntity, 0, sizeof(*fileEntity));
+
+    hashArray = HashArrayAllocAndInit(json_object_get_object(fileObj, ADUCITF_FIELDNAME_HASHES), &hashCount, arena);
+    if (hashArray == NULL)
+    {
+        Log_Error("Unable to parse hashes for file %s", fileId);
+        return false;
+    }
+
+    if (json_object_has_value(fileObj, ADUCITF_FIELDNAME_SIZEINBYTES))
+    {
+        sizeInBytes = json_object_get_number(fileObj, ADUCITF_FIELDNAME_SIZEINBYTES);
+    }
+
+    if (!FileEntityInit(
+            fileEntity,
+            fileId,
+            json_object_get_string(fileObj, ADUCITF_FIELDNAME_FILENAME),
+            downloadUri,
+            json_object_get_string(fileObj, ADUCITF_FIELDNAME_ARGUMENTS),
+            hashArray,
+            hashCount,
+            sizeInBytes,
+            arena))
+    {
+        if (arena == NULL)
+        {
+            ADUC_Hash_FreeArray(hashCount, hashArray);
+        }
+        Log_Error("Invalid file entity arguments");
+        return false;
+    }
+
+    if (!FileEntityInitChunkHashes(fileEntity, fileObj, arena)
+        || !FileEntityInitTransportEncoding(fileEntity, fileObj, arena)
+        || !FileEntityInitAlternateUris(fileEntity, fileObj, arena))
+    {
+        ParserFileEntityUninit(fileEntity, arena);
+        return false;
+    }
+
+    return true;
+}
+
 /**
  * @brief Parse the update action JSON for the UpdateId value.
  *
@@ -428,6 +832,13 @@ _Bool ADUC_Json_GetFiles(const JSON_Value* updateActionJson, unsigned int* fileC
             Log_Error("Invalid file arguments");
             goto done;
         }
+
+        if (!ADUC_FileEntity_InitChunkHashes(curFile, fileObj)
+            || !ADUC_FileEntity_InitTransportEncoding(curFile, fileObj)
+            || !ADUC_FileEntity_InitAlternateUris(curFile, fileObj))
+        {
+            goto done;
+        }
     }
 
     succeeded = true;
@@ -11,6 +11,8 @@
 
 #include <aduc/c_utils.h>
 #include <parson.h>
+#include <stdbool.h>
+#include <stddef.h> // for size_t
 
 EXTERN_C_BEGIN
 
@@ -30,6 +32,75 @@ _Bool ADUC_JSON_GetUnsignedIntegerField(const JSON_Value* jsonValue, const char*
 //
 _Bool ADUC_JSON_GetStringFieldFromObj(const JSON_Object* jsonObj, const char* jsonFieldName, char** value);
 
+//
+// JSON allocation accounting
+//
+
+/**
+ * @brief Makes parson allocate through counting allocators, so that the bytes held by JSON values are known, see
+ * ADUC_JSON_GetAllocatedBytes. Call it first thing in main: JSON values allocated before aren't counted. Only the first
+ * call has an effect.
+ *
+ * Serialized strings must be freed with json_free_serialized_string, not free, or they stay counted.
+ */
+void ADUC_JSON_EnableAllocationAccounting(void);
+
+/**
+ * @brief Returns whether ADUC_JSON_EnableAllocationAccounting was called.
+ */
+_Bool ADUC_JSON_IsAllocationAccountingEnabled(void);
+
+/**
+ * @brief Returns the bytes currently allocated by parson, or 0 if the accounting isn't enabled. Thread-safe.
+ */
+size_t ADUC_JSON_GetAllocatedBytes(void);
+
+/**
+ * @brief Returns the highest value of ADUC_JSON_GetAllocatedBytes since the accounting was enabled, or since the last
+ * ADUC_JSON_ResetPeakAllocatedBytes. Thread-safe.
+ */
+size_t ADUC_JSON_GetPeakAllocatedBytes(void);
+
+/**
+ * @brief Resets the peak, see ADUC_JSON_GetPeakAllocatedBytes, to the bytes currently allocated, e.g. when a
+ * deployment starts.
+ */
+void ADUC_JSON_ResetPeakAllocatedBytes(void);
+
+//
+// Read-only JSON documents
+//
+
+/**
+ * @brief A JSON document that is only read once parsed, e.g. a component inventory. Its values are allocated from an
+ * arena rather than one by one, and are all freed at once with the document, see ADUC_JSON_ReadOnlyDocument_Free.
+ *
+ * The values must not be modified nor freed: parse the JSON with parson for a mutable document, or deep copy the values
+ * to modify them. Deep copies are allocated from the heap, and outlive the document.
+ */
+typedef struct tagADUC_JSON_ReadOnlyDocument ADUC_JSON_ReadOnlyDocument;
+
+/**
+ * @brief Parses @p json into a read-only document. Thread-safe.
+ *
+ * @param json The JSON string.
+ * @return ADUC_JSON_ReadOnlyDocument* The document, or NULL if @p json isn't valid JSON or out of memory. Free it with
+ * ADUC_JSON_ReadOnlyDocument_Free.
+ */
+ADUC_JSON_ReadOnlyDocument* ADUC_JSON_ParseReadOnly(const char* json);
+
+/**
+ * @brief Returns the root value of @p document. Valid until the document is freed.
+ */
+const JSON_Value* ADUC_JSON_ReadOnlyDocument_GetRoot(const ADUC_JSON_ReadOnlyDocument* document);
+
+/**
+ * @brief Frees @p document and all its values.
+ *
+ * @param document The document, or NULL.
+ */
+void ADUC_JSON_ReadOnlyDocument_Free(ADUC_JSON_ReadOnlyDocument* document);
+
 EXTERN_C_END
 
 #endif // PARSON_JSON_UTILS_H
@@ -7,10 +7,13 @@
  */
 #include "parson_json_utils.h"
 
+#include <aduc/arena.h>
 #include <aduc/logging.h>
 #include <aduc/string_c_utils.h>
 #include <azure_c_shared_utility/crt_abstractions.h>
 #include <azure_c_shared_utility/strings.h>
+#include <malloc.h> // for malloc_usable_size
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -177,3 +180,200 @@ done:
 
     return succeeded;
 }
+
+//
+// JSON allocation accounting
+//
+
+static _Bool s_allocationAccountingEnabled = false;
+
+/**
+ * @brief The bytes currently allocated by parson, as reported by malloc_usable_size. Updated atomically.
+ */
+static size_t s_allocatedBytes = 0;
+
+/**
+ * @brief The peak of s_allocatedBytes. Updated atomically.
+ */
+static size_t s_peakAllocatedBytes = 0;
+
+/**
+ * @brief The arena parson allocates from on this thread while it parses a read-only document, else NULL.
+ */
+static __thread ADUC_Arena* s_parseArena = NULL;
+
+static pthread_once_t s_allocationFunctionsOnce = PTHREAD_ONCE_INIT;
+
+static void AccountAllocated(size_t size)
+{
+    const size_t allocated = __atomic_add_fetch(&s_allocatedBytes, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&s_peakAllocatedBytes, __ATOMIC_RELAXED);
+
+    while (allocated > peak
+           && !__atomic_compare_exchange_n(
+               &s_peakAllocatedBytes, &peak, allocated, true /* weak */, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+static void AccountFreed(size_t size)
+{
+    size_t allocated = __atomic_load_n(&s_allocatedBytes, __ATOMIC_RELAXED);
+
+    // Saturate at 0: blocks allocated before the accounting was enabled were never counted.
+    while (!__atomic_compare_exchange_n(
+        &s_allocatedBytes,
+        &allocated,
+        allocated > size ? allocated - size : 0,
+        true /* weak */,
+        __ATOMIC_RELAXED,
+        __ATOMIC_RELAXED))
+    {
+    }
+}
+
+static void* JsonMalloc(size_t size)
+{
+    if (s_parseArena != NULL)
+    {
+        return ADUC_Arena_Alloc(s_parseArena, size != 0 ? size : 1);
+    }
+
+    void* ptr = malloc(size);
+    if (ptr != NULL && s_allocationAccountingEnabled)
+    {
+        AccountAllocated(malloc_usable_size(ptr));
+    }
+
+    return ptr;
+}
+
+static void JsonFree(void* ptr)
+{
+    // The values of a read-only document are freed with its arena.
+    if (ptr == NULL || s_parseArena != NULL)
+    {
+        return;
+    }
+
+    if (s_allocationAccountingEnabled)
+    {
+        AccountFreed(malloc_usable_size(ptr));
+    }
+
+    free(ptr);
+}
+
+static void SetAllocationFunctions(void)
+{
+    json_set_allocation_functions(JsonMalloc, JsonFree);
+}
+
+void ADUC_JSON_EnableAllocationAccounting(void)
+{
+    if (s_allocationAccountingEnabled)
+    {
+        return;
+    }
+
+    s_allocationAccountingEnabled = true;
+    pthread_once(&s_allocationFunctionsOnce, SetAllocationFunctions);
+}
+
+_Bool ADUC_JSON_IsAllocationAccountingEnabled(void)
+{
+    return s_allocationAccountingEnabled;
+}
+
+size_t ADUC_JSON_GetAllocatedBytes(void)
+{
+    return __atomic_load_n(&s_allocatedBytes, __ATOMIC_RELAXED);
+}
+
+size_t ADUC_JSON_GetPeakAllocatedBytes(void)
+{
+    return __atomic_load_n(&s_peakAllocatedBytes, __ATOMIC_RELAXED);
+}
+
+void ADUC_JSON_ResetPeakAllocatedBytes(void)
+{
+    __atomic_store_n(&s_peakAllocatedBytes, __atomic_load_n(&s_allocatedBytes, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+//
+// Read-only JSON documents
+//
+
+struct tagADUC_JSON_ReadOnlyDocument
+{
+    ADUC_Arena* arena; /**< The memory of all the values. */
+    const JSON_Value* root; /**< The root value. */
+    size_t accountedBytes; /**< The bytes of the arena counted in ADUC_JSON_GetAllocatedBytes. */
+};
+
+ADUC_JSON_ReadOnlyDocument* ADUC_JSON_ParseReadOnly(const char* json)
+{
+    ADUC_JSON_ReadOnlyDocument* document = NULL;
+    ADUC_Arena* arena = NULL;
+    JSON_Value* root = NULL;
+
+    if (json == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_once(&s_allocationFunctionsOnce, SetAllocationFunctions);
+
+    arena = ADUC_Arena_Create();
+    document = calloc(1, sizeof(*document));
+    if (arena == NULL || document == NULL)
+    {
+        goto done;
+    }
+
+    // parson allocates the values, and its temporary buffers, from the arena of this thread.
+    s_parseArena = arena;
+    root = json_parse_string(json);
+    s_parseArena = NULL;
+
+    if (root == NULL)
+    {
+        goto done;
+    }
+
+    document->arena = arena;
+    document->root = root;
+
+    if (s_allocationAccountingEnabled)
+    {
+        document->accountedBytes = ADUC_Arena_GetUsedBytes(arena);
+        AccountAllocated(document->accountedBytes);
+    }
+
+done:
+    if (document == NULL || document->root == NULL)
+    {
+        ADUC_Arena_Destroy(arena);
+        free(document);
+        document = NULL;
+    }
+
+    return document;
+}
+
+const JSON_Value* ADUC_JSON_ReadOnlyDocument_GetRoot(const ADUC_JSON_ReadOnlyDocument* document)
+{
+    return document == NULL ? NULL : document->root;
+}
+
+void ADUC_JSON_ReadOnlyDocument_Free(ADUC_JSON_ReadOnlyDocument* document)
+{
+    if (document == NULL)
+    {
+        return;
+    }
+
+    AccountFreed(document->accountedBytes);
+    ADUC_Arena_Destroy(document->arena);
+    free(document);
+}
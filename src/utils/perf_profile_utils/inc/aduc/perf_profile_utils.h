@@ -0,0 +1,114 @@
+/**
+ * @file perf_profile_utils.h
+ * @brief The performance profile of the device: its CPUs, memory and storage, and the throughput of hashing and of
+ * disk writes measured by a short self-test, from which the defaults of the tunables of the configuration file are
+ * derived, so that they suit both single-core boards with little memory and multi-core gateways.
+ *
+ * The profile is measured at the first start and kept in a file; it is measured again when the CPUs, memory or
+ * storage of the device changed, e.g. when an image is flashed onto other hardware.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_PERF_PROFILE_UTILS_H
+#define ADUC_PERF_PROFILE_UTILS_H
+
+#include <aduc/c_utils.h> // for EXTERN_C_BEGIN, EXTERN_C_END
+#include <parson.h>
+#include <stdbool.h>
+
+/**
+ * @brief The version of the profile files; profiles of other versions are measured again.
+ */
+#define ADUC_PERF_PROFILE_VERSION 1
+
+/**
+ * @brief The longest time of each throughput test of the self-test, in milliseconds.
+ */
+#define ADUC_PERF_PROFILE_TEST_DURATION_MS 250
+
+/**
+ * @brief The most bytes of each throughput test of the self-test.
+ */
+#define ADUC_PERF_PROFILE_TEST_MAX_BYTES (64 * 1024 * 1024)
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief The performance profile of the device.
+ */
+typedef struct tagADUC_PerfProfile
+{
+    unsigned int CpuCount; /**< The CPUs the agent may run on. */
+    unsigned int MemoryMB; /**< The physical memory, in MiB. */
+    unsigned int StorageMB; /**< The size of the file system of the data folder, in MiB. */
+    bool StorageRotational; /**< True if the data folder is on a rotational disk. */
+    unsigned int HashMBps; /**< The throughput of SHA-256 hashing on one CPU, in MiB/s. */
+    unsigned int DiskWriteMBps; /**< The throughput of synced writes to the data folder, in MiB/s. */
+} ADUC_PerfProfile;
+
+/**
+ * @brief Detects the CPUs, memory and storage of the device, without the self-test.
+ *
+ * @param profile Output, the profile, with HashMBps and DiskWriteMBps 0.
+ * @param folder The data folder, whose storage is detected.
+ * @returns False if the device couldn't be detected.
+ */
+bool ADUC_PerfProfile_Detect(ADUC_PerfProfile* profile, const char* folder);
+
+/**
+ * @brief Detects the device and runs the self-test, which takes at most about twice
+ * ADUC_PERF_PROFILE_TEST_DURATION_MS.
+ *
+ * @param profile Output, the profile.
+ * @param folder The data folder, whose storage is detected, and where the disk test writes a temporary file.
+ * @returns False if the device couldn't be detected or tested.
+ */
+bool ADUC_PerfProfile_Measure(ADUC_PerfProfile* profile, const char* folder);
+
+/**
+ * @brief Reads the profile of the file @p filePath.
+ *
+ * @param profile Output, the profile.
+ * @param filePath The profile file.
+ * @returns False if the file doesn't exist, isn't valid or is of another ADUC_PERF_PROFILE_VERSION.
+ */
+bool ADUC_PerfProfile_Load(ADUC_PerfProfile* profile, const char* filePath);
+
+/**
+ * @brief Writes @p profile to the file @p filePath, replacing it atomically.
+ *
+ * @returns False if the file couldn't be written.
+ */
+bool ADUC_PerfProfile_Save(const ADUC_PerfProfile* profile, const char* filePath);
+
+/**
+ * @brief Gets the profile of the device: the one of the file @p filePath if it was measured on the same CPUs, memory
+ * and storage, or else a new one, measured and saved to it.
+ *
+ * @param profile Output, the profile.
+ * @param filePath The profile file.
+ * @param folder The data folder, see ADUC_PerfProfile_Measure.
+ * @returns False if there is no profile file and the device couldn't be measured.
+ */
+bool ADUC_PerfProfile_LoadOrMeasure(ADUC_PerfProfile* profile, const char* filePath, const char* folder);
+
+/**
+ * @brief Derives the defaults of the configuration file from @p profile, for ADUC_ConfigInfo_SetDefaults.
+ *
+ * Only the tunables that depend on the device are set:
+ * - maxConcurrentDownloads: 1 on a single CPU or under 256 MiB, else up to 4, at most 2 on a rotational or slow disk.
+ * - maxConcurrentSteps: up to 4 with 4 CPUs, 512 MiB and hashing of at least 50 MiB/s, else unset, for one at a time.
+ * - workflowMemoryBudgetMB: an eighth of the memory under 1 GiB, else unset, for no budget.
+ * - maxResidentSteps: 8 under 256 MiB, else unset, to keep all the steps.
+ * - downloadCacheSizeLimitMB: a twentieth of the storage, when that is under the default limit.
+ * - downloadIdlePriority: true on a single CPU, so that downloads don't slow down the workloads of the device.
+ *
+ * @param profile The profile.
+ * @returns The JSON object of the defaults, to be freed with json_value_free; NULL on allocation failure.
+ */
+JSON_Value* ADUC_PerfProfile_GetConfigDefaults(const ADUC_PerfProfile* profile);
+
+EXTERN_C_END
+
+#endif // ADUC_PERF_PROFILE_UTILS_H
@@ -0,0 +1,421 @@
+/**
+ * @file perf_profile_utils.c
+ * @brief Implements the performance profile of the device.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/perf_profile_utils.h"
+#include "aduc/config_utils.h" // for ADUC_DEFAULT_DOWNLOAD_CACHE_SIZE_LIMIT_MB
+#include "aduc/hash_utils.h"
+#include "aduc/logging.h"
+
+#include <fcntl.h>
+#include <limits.h> // for PATH_MAX
+#include <sched.h> // for sched_getaffinity
+#include <stdint.h>
+#include <stdio.h> // for snprintf, rename
+#include <stdlib.h> // for malloc
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/sysmacros.h> // for major, minor
+#include <time.h> // for clock_gettime
+#include <unistd.h>
+
+/**
+ * @brief The size of the blocks hashed and written by the self-test.
+ */
+#define TEST_BLOCK_SIZE (1024 * 1024)
+
+/**
+ * @brief Returns the monotonic time in milliseconds.
+ */
+static long long ReadClock()
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Returns the throughput of @p bytes in @p elapsedMs milliseconds, in MiB/s, at least 1.
+ */
+static unsigned int GetThroughputMBps(unsigned long long bytes, long long elapsedMs)
+{
+    const unsigned long long mbps = bytes * 1000 / (1024 * 1024) / (unsigned long long)(elapsedMs > 0 ? elapsedMs : 1);
+    return mbps == 0 ? 1 : (mbps > UINT_MAX ? UINT_MAX : (unsigned int)mbps);
+}
+
+/**
+ * @brief Returns whether the block device @p device is rotational, from /sys/dev/block/<major>:<minor>.
+ */
+static bool IsRotational(dev_t device)
+{
+    // A partition has no queue of its own; its disk is its parent folder.
+    static const char* const queueFolders[] = { "queue", "../queue" };
+    char path[PATH_MAX];
+    char value[4] = "";
+
+    for (size_t i = 0; i < sizeof(queueFolders) / sizeof(queueFolders[0]); ++i)
+    {
+        if (snprintf(
+                path,
+                sizeof(path),
+                "/sys/dev/block/%u:%u/%s/rotational",
+                major(device),
+                minor(device),
+                queueFolders[i])
+            >= (int)sizeof(path))
+        {
+            continue;
+        }
+
+        FILE* file = fopen(path, "r");
+        if (file != NULL)
+        {
+            const bool read = fgets(value, sizeof(value), file) != NULL;
+            fclose(file);
+
+            if (read)
+            {
+                return value[0] == '1';
+            }
+        }
+    }
+
+    // e.g. overlay or tmpfs file systems, which have no block device.
+    return false;
+}
+
+bool ADUC_PerfProfile_Detect(ADUC_PerfProfile* profile, const char* folder)
+{
+    cpu_set_t cpus;
+    struct statvfs fileSystem;
+    struct stat folderStat;
+
+    memset(profile, 0, sizeof(*profile));
+
+    CPU_ZERO(&cpus);
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+    {
+        profile->CpuCount = (unsigned int)CPU_COUNT(&cpus);
+    }
+    else
+    {
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        profile->CpuCount = online > 0 ? (unsigned int)online : 1;
+    }
+
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || pageSize <= 0)
+    {
+        Log_Error("Cannot get the size of the memory.");
+        return false;
+    }
+
+    profile->MemoryMB = (unsigned int)((unsigned long long)pages * (unsigned long long)pageSize / (1024 * 1024));
+
+    if (statvfs(folder, &fileSystem) != 0 || stat(folder, &folderStat) != 0)
+    {
+        Log_Error("Cannot get the storage of %s.", folder);
+        return false;
+    }
+
+    profile->StorageMB =
+        (unsigned int)((unsigned long long)fileSystem.f_blocks * fileSystem.f_frsize / (1024 * 1024));
+    profile->StorageRotational = IsRotational(folderStat.st_dev);
+
+    return true;
+}
+
+/**
+ * @brief Measures the throughput of SHA-256 hashing of @p block, in MiB/s.
+ *
+ * @returns 0 on failure.
+ */
+static unsigned int MeasureHashThroughput(const uint8_t* block)
+{
+    ADUC_HashUtils_Context context;
+    unsigned long long bytes = 0;
+    bool succeeded = true;
+
+    memset(&context, 0, sizeof(context));
+    if (!ADUC_HashUtils_ContextReset(&context, SHA256))
+    {
+        return 0;
+    }
+
+    const long long start = ReadClock();
+    long long elapsed = 0;
+
+    do
+    {
+        succeeded = ADUC_HashUtils_ContextInput(&context, block, TEST_BLOCK_SIZE);
+        bytes += TEST_BLOCK_SIZE;
+        elapsed = ReadClock() - start;
+    } while (succeeded && elapsed < ADUC_PERF_PROFILE_TEST_DURATION_MS && bytes < ADUC_PERF_PROFILE_TEST_MAX_BYTES);
+
+    ADUC_HashUtils_ContextUnInit(&context);
+
+    return succeeded ? GetThroughputMBps(bytes, elapsed) : 0;
+}
+
+/**
+ * @brief Measures the throughput of writing @p block to a temporary file of @p folder, synced to the disk, in MiB/s.
+ *
+ * @returns 0 on failure.
+ */
+static unsigned int MeasureDiskWriteThroughput(const uint8_t* block, const char* folder)
+{
+    char path[PATH_MAX];
+    unsigned long long bytes = 0;
+    bool succeeded = true;
+
+    if (snprintf(path, sizeof(path), "%s/.perf-profile-test-XXXXXX", folder) >= (int)sizeof(path))
+    {
+        return 0;
+    }
+
+    const int fd = mkstemp(path);
+    if (fd == -1)
+    {
+        Log_Error("Cannot create the disk test file in %s.", folder);
+        return 0;
+    }
+
+    const long long start = ReadClock();
+    long long elapsed = 0;
+
+    do
+    {
+        succeeded = write(fd, block, TEST_BLOCK_SIZE) == TEST_BLOCK_SIZE && fdatasync(fd) == 0;
+        bytes += TEST_BLOCK_SIZE;
+        elapsed = ReadClock() - start;
+    } while (succeeded && elapsed < ADUC_PERF_PROFILE_TEST_DURATION_MS && bytes < ADUC_PERF_PROFILE_TEST_MAX_BYTES);
+
+    close(fd);
+    (void)unlink(path);
+
+    return succeeded ? GetThroughputMBps(bytes, elapsed) : 0;
+}
+
+bool ADUC_PerfProfile_Measure(ADUC_PerfProfile* profile, const char* folder)
+{
+    bool succeeded = false;
+    uint8_t* block = NULL;
+
+    if (!ADUC_PerfProfile_Detect(profile, folder))
+    {
+        goto done;
+    }
+
+    block = malloc(TEST_BLOCK_SIZE);
+    if (block == NULL)
+    {
+        goto done;
+    }
+
+    // Not all zeros, which some storage compresses or skips.
+    for (size_t i = 0; i < TEST_BLOCK_SIZE; ++i)
+    {
+        block[i] = (uint8_t)(i * 2654435761u >> 24);
+    }
+
+    profile->HashMBps = MeasureHashThroughput(block);
+    profile->DiskWriteMBps = MeasureDiskWriteThroughput(block, folder);
+
+    if (profile->HashMBps == 0 || profile->DiskWriteMBps == 0)
+    {
+        Log_Error("The performance self-test failed.");
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    free(block);
+    return succeeded;
+}
+
+/**
+ * @brief Gets the unsigned integer field @p name of @p object.
+ */
+static bool GetUnsignedField(const JSON_Object* object, const char* name, unsigned int* value)
+{
+    if (!json_object_has_value_of_type(object, name, JSONNumber))
+    {
+        return false;
+    }
+
+    const double number = json_object_get_number(object, name);
+    if (number < 0 || number > UINT_MAX)
+    {
+        return false;
+    }
+
+    *value = (unsigned int)number;
+    return true;
+}
+
+bool ADUC_PerfProfile_Load(ADUC_PerfProfile* profile, const char* filePath)
+{
+    bool succeeded = false;
+    unsigned int version = 0;
+    JSON_Value* rootValue = json_parse_file(filePath);
+    const JSON_Object* rootObject = json_value_get_object(rootValue);
+
+    memset(profile, 0, sizeof(*profile));
+
+    if (rootObject == NULL || !GetUnsignedField(rootObject, "version", &version)
+        || version != ADUC_PERF_PROFILE_VERSION || !GetUnsignedField(rootObject, "cpuCount", &profile->CpuCount)
+        || !GetUnsignedField(rootObject, "memoryMB", &profile->MemoryMB)
+        || !GetUnsignedField(rootObject, "storageMB", &profile->StorageMB)
+        || !json_object_has_value_of_type(rootObject, "storageRotational", JSONBoolean)
+        || !GetUnsignedField(rootObject, "hashMBps", &profile->HashMBps)
+        || !GetUnsignedField(rootObject, "diskWriteMBps", &profile->DiskWriteMBps))
+    {
+        goto done;
+    }
+
+    profile->StorageRotational = json_object_get_boolean(rootObject, "storageRotational") == 1;
+    succeeded = true;
+
+done:
+    json_value_free(rootValue);
+    return succeeded;
+}
+
+bool ADUC_PerfProfile_Save(const ADUC_PerfProfile* profile, const char* filePath)
+{
+    bool succeeded = false;
+    char tempPath[PATH_MAX];
+    JSON_Value* rootValue = json_value_init_object();
+    JSON_Object* rootObject = json_value_get_object(rootValue);
+
+    if (rootObject == NULL || snprintf(tempPath, sizeof(tempPath), "%s.tmp", filePath) >= (int)sizeof(tempPath))
+    {
+        goto done;
+    }
+
+    if (json_object_set_number(rootObject, "version", ADUC_PERF_PROFILE_VERSION) != JSONSuccess
+        || json_object_set_number(rootObject, "cpuCount", profile->CpuCount) != JSONSuccess
+        || json_object_set_number(rootObject, "memoryMB", profile->MemoryMB) != JSONSuccess
+        || json_object_set_number(rootObject, "storageMB", profile->StorageMB) != JSONSuccess
+        || json_object_set_boolean(rootObject, "storageRotational", profile->StorageRotational) != JSONSuccess
+        || json_object_set_number(rootObject, "hashMBps", profile->HashMBps) != JSONSuccess
+        || json_object_set_number(rootObject, "diskWriteMBps", profile->DiskWriteMBps) != JSONSuccess)
+    {
+        goto done;
+    }
+
+    if (json_serialize_to_file_pretty(rootValue, tempPath) != JSONSuccess || rename(tempPath, filePath) != 0)
+    {
+        Log_Error("Cannot write the performance profile %s.", filePath);
+        (void)unlink(tempPath);
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    json_value_free(rootValue);
+    return succeeded;
+}
+
+bool ADUC_PerfProfile_LoadOrMeasure(ADUC_PerfProfile* profile, const char* filePath, const char* folder)
+{
+    ADUC_PerfProfile device;
+    const bool detected = ADUC_PerfProfile_Detect(&device, folder);
+
+    if (ADUC_PerfProfile_Load(profile, filePath)
+        && (!detected
+            || (device.CpuCount == profile->CpuCount && device.MemoryMB == profile->MemoryMB
+                && device.StorageMB == profile->StorageMB && device.StorageRotational == profile->StorageRotational)))
+    {
+        return true;
+    }
+
+    Log_Info("Measuring the performance profile of the device.");
+
+    if (!ADUC_PerfProfile_Measure(profile, folder))
+    {
+        return false;
+    }
+
+    Log_Info(
+        "Performance profile: %u CPUs, %u MiB memory, %u MiB %s storage, hashing %u MiB/s, disk writes %u MiB/s.",
+        profile->CpuCount,
+        profile->MemoryMB,
+        profile->StorageMB,
+        profile->StorageRotational ? "rotational" : "solid-state",
+        profile->HashMBps,
+        profile->DiskWriteMBps);
+
+    // Measured again at the next start if it can't be saved.
+    (void)ADUC_PerfProfile_Save(profile, filePath);
+
+    return true;
+}
+
+JSON_Value* ADUC_PerfProfile_GetConfigDefaults(const ADUC_PerfProfile* profile)
+{
+    JSON_Value* defaultsValue = json_value_init_object();
+    JSON_Object* defaults = json_value_get_object(defaultsValue);
+    bool succeeded = defaults != NULL;
+
+    const bool small = profile->CpuCount <= 1 || profile->MemoryMB < 256;
+    const bool slowDisk = profile->StorageRotational || profile->DiskWriteMBps < 10;
+
+    unsigned int maxConcurrentDownloads = 1;
+    if (!small)
+    {
+        maxConcurrentDownloads = profile->CpuCount >= 4 ? 4 : 2;
+        if (slowDisk && maxConcurrentDownloads > 2)
+        {
+            // Concurrent writes make rotational disks and SD cards seek, which slows them down further.
+            maxConcurrentDownloads = 2;
+        }
+    }
+
+    succeeded = succeeded
+        && json_object_set_number(defaults, "maxConcurrentDownloads", maxConcurrentDownloads) == JSONSuccess;
+
+    if (succeeded && profile->CpuCount >= 4 && profile->MemoryMB >= 512 && profile->HashMBps >= 50)
+    {
+        succeeded = json_object_set_number(defaults, "maxConcurrentSteps", profile->CpuCount >= 8 ? 4 : 2)
+            == JSONSuccess;
+    }
+
+    if (succeeded && profile->MemoryMB < 1024)
+    {
+        const unsigned int budgetMB = profile->MemoryMB / 8;
+        succeeded = json_object_set_number(defaults, "workflowMemoryBudgetMB", budgetMB < 8 ? 8 : budgetMB)
+            == JSONSuccess;
+    }
+
+    if (succeeded && profile->MemoryMB < 256)
+    {
+        succeeded = json_object_set_number(defaults, "maxResidentSteps", 8) == JSONSuccess;
+    }
+
+    if (succeeded && profile->StorageMB / 20 < ADUC_DEFAULT_DOWNLOAD_CACHE_SIZE_LIMIT_MB)
+    {
+        succeeded =
+            json_object_set_number(defaults, "downloadCacheSizeLimitMB", profile->StorageMB / 20) == JSONSuccess;
+    }
+
+    if (succeeded && profile->CpuCount <= 1)
+    {
+        succeeded = json_object_set_boolean(defaults, "downloadIdlePriority", true) == JSONSuccess;
+    }
+
+    if (!succeeded)
+    {
+        json_value_free(defaultsValue);
+        defaultsValue = NULL;
+    }
+
+    return defaultsValue;
+}
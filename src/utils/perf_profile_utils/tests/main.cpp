@@ -0,0 +1,9 @@
+/**
+ * @file main.cpp
+ * @brief perf_profile_utils tests main entry point.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
@@ -0,0 +1,148 @@
+/**
+ * @file perf_profile_utils_ut.cpp
+ * @brief Unit tests for perf_profile_utils.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/perf_profile_utils.h"
+
+#include <catch2/catch.hpp>
+
+#include <fstream>
+#include <stdlib.h> // for mkdtemp
+#include <string>
+
+/**
+ * @brief A temporary folder, removed with its content.
+ */
+class TempFolder
+{
+public:
+    TempFolder()
+    {
+        char folder[] = "/tmp/perf_profile_utils_ut_XXXXXX";
+        REQUIRE(mkdtemp(folder) != nullptr);
+        _folder = folder;
+    }
+
+    ~TempFolder()
+    {
+        (void)system(("rm -rf " + _folder).c_str());
+    }
+
+    TempFolder(const TempFolder&) = delete;
+    TempFolder& operator=(const TempFolder&) = delete;
+
+    const std::string& Path() const
+    {
+        return _folder;
+    }
+
+private:
+    std::string _folder;
+};
+
+static ADUC_PerfProfile MakeProfile(unsigned int cpuCount, unsigned int memoryMB, unsigned int storageMB)
+{
+    ADUC_PerfProfile profile = {};
+    profile.CpuCount = cpuCount;
+    profile.MemoryMB = memoryMB;
+    profile.StorageMB = storageMB;
+    profile.StorageRotational = false;
+    profile.HashMBps = 400;
+    profile.DiskWriteMBps = 100;
+    return profile;
+}
+
+TEST_CASE("ADUC_PerfProfile_Measure measures the device")
+{
+    TempFolder folder;
+    ADUC_PerfProfile profile;
+
+    REQUIRE(ADUC_PerfProfile_Measure(&profile, folder.Path().c_str()));
+    CHECK(profile.CpuCount >= 1);
+    CHECK(profile.MemoryMB > 0);
+    CHECK(profile.StorageMB > 0);
+    CHECK(profile.HashMBps > 0);
+    CHECK(profile.DiskWriteMBps > 0);
+
+    CHECK_FALSE(ADUC_PerfProfile_Detect(&profile, (folder.Path() + "/missing").c_str()));
+}
+
+TEST_CASE("ADUC_PerfProfile_LoadOrMeasure keeps the profile of the same device")
+{
+    TempFolder folder;
+    const std::string filePath = folder.Path() + "/perf-profile.json";
+    ADUC_PerfProfile profile;
+    ADUC_PerfProfile loaded;
+
+    CHECK_FALSE(ADUC_PerfProfile_Load(&loaded, filePath.c_str()));
+
+    REQUIRE(ADUC_PerfProfile_LoadOrMeasure(&profile, filePath.c_str(), folder.Path().c_str()));
+    REQUIRE(ADUC_PerfProfile_Load(&loaded, filePath.c_str()));
+    CHECK(loaded.CpuCount == profile.CpuCount);
+    CHECK(loaded.MemoryMB == profile.MemoryMB);
+    CHECK(loaded.HashMBps == profile.HashMBps);
+    CHECK(loaded.DiskWriteMBps == profile.DiskWriteMBps);
+
+    // The self-test isn't run again: a made up throughput is kept.
+    loaded.HashMBps = 12345;
+    REQUIRE(ADUC_PerfProfile_Save(&loaded, filePath.c_str()));
+    REQUIRE(ADUC_PerfProfile_LoadOrMeasure(&profile, filePath.c_str(), folder.Path().c_str()));
+    CHECK(profile.HashMBps == 12345);
+
+    // On other hardware, it is.
+    loaded.CpuCount += 1;
+    REQUIRE(ADUC_PerfProfile_Save(&loaded, filePath.c_str()));
+    REQUIRE(ADUC_PerfProfile_LoadOrMeasure(&profile, filePath.c_str(), folder.Path().c_str()));
+    CHECK(profile.CpuCount == loaded.CpuCount - 1);
+    CHECK(profile.HashMBps != 12345);
+
+    // As with a profile of another version.
+    std::ofstream{ filePath } << R"({ "version": 0, "cpuCount": 1 })";
+    CHECK_FALSE(ADUC_PerfProfile_Load(&loaded, filePath.c_str()));
+}
+
+TEST_CASE("ADUC_PerfProfile_GetConfigDefaults fits the tunables to the device")
+{
+    SECTION("Single CPU board")
+    {
+        const ADUC_PerfProfile profile = MakeProfile(1, 128, 4096);
+        JSON_Value* defaultsValue = ADUC_PerfProfile_GetConfigDefaults(&profile);
+        REQUIRE(defaultsValue != nullptr);
+        const JSON_Object* defaults = json_value_get_object(defaultsValue);
+
+        CHECK(json_object_get_number(defaults, "maxConcurrentDownloads") == 1);
+        CHECK_FALSE(json_object_has_value(defaults, "maxConcurrentSteps"));
+        CHECK(json_object_get_number(defaults, "workflowMemoryBudgetMB") == 16);
+        CHECK(json_object_get_number(defaults, "maxResidentSteps") == 8);
+        CHECK(json_object_get_number(defaults, "downloadCacheSizeLimitMB") == 204);
+        CHECK(json_object_get_boolean(defaults, "downloadIdlePriority") == 1);
+
+        json_value_free(defaultsValue);
+    }
+
+    SECTION("Multi-core gateway")
+    {
+        ADUC_PerfProfile profile = MakeProfile(8, 8192, 65536);
+        JSON_Value* defaultsValue = ADUC_PerfProfile_GetConfigDefaults(&profile);
+        REQUIRE(defaultsValue != nullptr);
+        const JSON_Object* defaults = json_value_get_object(defaultsValue);
+
+        CHECK(json_object_get_number(defaults, "maxConcurrentDownloads") == 4);
+        CHECK(json_object_get_number(defaults, "maxConcurrentSteps") == 4);
+        CHECK_FALSE(json_object_has_value(defaults, "workflowMemoryBudgetMB"));
+        CHECK_FALSE(json_object_has_value(defaults, "maxResidentSteps"));
+        CHECK_FALSE(json_object_has_value(defaults, "downloadCacheSizeLimitMB"));
+        CHECK_FALSE(json_object_has_value(defaults, "downloadIdlePriority"));
+        json_value_free(defaultsValue);
+
+        // On a rotational disk, fewer downloads write at once.
+        profile.StorageRotational = true;
+        defaultsValue = ADUC_PerfProfile_GetConfigDefaults(&profile);
+        REQUIRE(defaultsValue != nullptr);
+        CHECK(json_object_get_number(json_value_get_object(defaultsValue), "maxConcurrentDownloads") == 2);
+        json_value_free(defaultsValue);
+    }
+}
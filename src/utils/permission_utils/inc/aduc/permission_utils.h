@@ -18,10 +18,13 @@ _Bool PermissionUtils_VerifyFilemodeExact(const char* path, mode_t expectedPermi
 _Bool PermissionUtils_VerifyFilemodeBitmask(const char* path, mode_t bitmask);
 _Bool PermissionUtils_UserExists(const char* user);
 _Bool PermissionUtils_GroupExists(const char* group);
+_Bool PermissionUtils_GetUserId(const char* user, uid_t* uid);
+_Bool PermissionUtils_GetGroupId(const char* group, gid_t* gid);
 _Bool PermissionUtils_UserInSupplementaryGroup(const char* user, const char* group);
 _Bool PermissionUtils_CheckOwnership(const char* path, const char* user, const char* group);
 _Bool PermissionUtils_CheckOwnerUid(const char* path, uid_t uid);
 _Bool PermissionUtils_CheckOwnerGid(const char* path, gid_t gid);
+void PermissionUtils_ClearCache(void);
 
 EXTERN_C_END
 
@@ -8,15 +8,197 @@
 #include "aduc/permission_utils.h"
 #include "aduc/bit_ops.h" // for BitOps_AreAllBitsSet
 #include <grp.h> // for getgrnam
+#include <pthread.h>
 #include <pwd.h> // for getpwnam
 #include <string.h> // for stat, etc.
 #include <sys/stat.h> // for stat, etc.
+#include <time.h> // for clock_gettime
 #include <unistd.h> // for access
 
+/**
+ * @brief How long a user, group or group membership lookup is reused, as NSS backends like LDAP are slow to query.
+ */
+#define PERMISSION_UTILS_CACHE_TTL_SECONDS 300
+
+/**
+ * @brief The number of lookups cached. The agent checks a handful of users and groups.
+ */
+#define PERMISSION_UTILS_CACHE_SIZE 16
+
+/**
+ * @brief The size of the names in a cache entry. Longer names are looked up every time.
+ */
+#define PERMISSION_UTILS_CACHE_NAME_SIZE 64
+
+typedef enum tagPermissionUtils_LookupType
+{
+    PermissionUtils_LookupType_User, //!< The uid of a user.
+    PermissionUtils_LookupType_Group, //!< The gid of a group.
+    PermissionUtils_LookupType_Membership, //!< Whether a user is a supplementary member of a group.
+} PermissionUtils_LookupType;
+
+typedef struct tagPermissionUtils_CacheEntry
+{
+    PermissionUtils_LookupType Type; //!< The type of lookup.
+    char Name[PERMISSION_UTILS_CACHE_NAME_SIZE]; //!< The user, or the group of a group lookup.
+    char Group[PERMISSION_UTILS_CACHE_NAME_SIZE]; //!< The group of a membership lookup.
+    _Bool Found; //!< Whether the user or group exists, or the user is a member of the group.
+    unsigned int Id; //!< The uid or gid.
+    time_t Expiry; //!< The monotonic time the entry expires at, 0 for an unused entry.
+} PermissionUtils_CacheEntry;
+
+static PermissionUtils_CacheEntry s_cache[PERMISSION_UTILS_CACHE_SIZE];
+
+/**
+ * @brief Guards s_cache, and the static buffers getpwnam and getgrnam return.
+ */
+static pthread_mutex_t s_cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
 //
 // Internal functions
 //
 
+/**
+ * @brief Returns the current monotonic time in seconds.
+ */
+static time_t GetMonotonicSeconds(void)
+{
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+    {
+        return 0;
+    }
+
+    return now.tv_sec;
+}
+
+/**
+ * @brief Looks up a user, a group, or a supplementary group membership in NSS.
+ * @param type The type of lookup.
+ * @param name The user, or the group of a group lookup.
+ * @param group The group of a membership lookup, else NULL.
+ * @param[out] id The uid or gid, if found.
+ * @returns true if the user or group exists, or the user is a member of the group.
+ */
+static _Bool LookupUncached(PermissionUtils_LookupType type, const char* name, const char* group, unsigned int* id)
+{
+    switch (type)
+    {
+    case PermissionUtils_LookupType_User:
+    {
+        const struct passwd* pwd = getpwnam(name);
+        if (pwd != NULL)
+        {
+            *id = pwd->pw_uid;
+        }
+
+        return pwd != NULL;
+    }
+
+    case PermissionUtils_LookupType_Group:
+    {
+        const struct group* grp = getgrnam(name);
+        if (grp != NULL)
+        {
+            *id = grp->gr_gid;
+        }
+
+        return grp != NULL;
+    }
+
+    case PermissionUtils_LookupType_Membership:
+    {
+        const struct group* groupEntry = getgrnam(group);
+        if (groupEntry != NULL && groupEntry->gr_mem != NULL)
+        {
+            for (int i = 0; groupEntry->gr_mem[i] != NULL; ++i)
+            {
+                if (strcmp(groupEntry->gr_mem[i], name) == 0)
+                {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Looks up a user, a group, or a supplementary group membership, reusing a lookup younger than
+ * PERMISSION_UTILS_CACHE_TTL_SECONDS. Lookups that found nothing are cached as well.
+ * @param type The type of lookup.
+ * @param name The user, or the group of a group lookup.
+ * @param group The group of a membership lookup, else NULL.
+ * @param[out] id The uid or gid, if found. May be NULL.
+ * @returns true if the user or group exists, or the user is a member of the group.
+ */
+static _Bool Lookup(PermissionUtils_LookupType type, const char* name, const char* group, unsigned int* id)
+{
+    unsigned int foundId = 0;
+    _Bool found = false;
+
+    if (name == NULL || (type == PermissionUtils_LookupType_Membership && group == NULL))
+    {
+        return false;
+    }
+
+    const _Bool cacheable = strlen(name) < PERMISSION_UTILS_CACHE_NAME_SIZE
+        && (group == NULL || strlen(group) < PERMISSION_UTILS_CACHE_NAME_SIZE);
+    const time_t now = GetMonotonicSeconds();
+    PermissionUtils_CacheEntry* slot = NULL;
+
+    pthread_mutex_lock(&s_cacheMutex);
+
+    for (size_t i = 0; cacheable && i < PERMISSION_UTILS_CACHE_SIZE; i++)
+    {
+        PermissionUtils_CacheEntry* entry = &s_cache[i];
+        if (entry->Expiry > now && entry->Type == type && strcmp(entry->Name, name) == 0
+            && (group == NULL || strcmp(entry->Group, group) == 0))
+        {
+            found = entry->Found;
+            foundId = entry->Id;
+            goto done;
+        }
+
+        // Replace an unused or expired entry, else the one that expires first.
+        if (slot == NULL || entry->Expiry < slot->Expiry)
+        {
+            slot = entry;
+        }
+    }
+
+    found = LookupUncached(type, name, group, &foundId);
+
+    if (slot != NULL)
+    {
+        memset(slot, 0, sizeof(*slot));
+        slot->Type = type;
+        strcpy(slot->Name, name);
+        if (group != NULL)
+        {
+            strcpy(slot->Group, group);
+        }
+
+        slot->Found = found;
+        slot->Id = foundId;
+        slot->Expiry = now + PERMISSION_UTILS_CACHE_TTL_SECONDS;
+    }
+
+done:
+    pthread_mutex_unlock(&s_cacheMutex);
+
+    if (found && id != NULL)
+    {
+        *id = foundId;
+    }
+
+    return found;
+}
+
 /**
  * @brief Checks the file mode bits on the file object.
  * @remark When isExactMatch is false, expectedPermissions is used as a bit mask (other bits could also be set).
@@ -73,7 +255,7 @@ _Bool PermissionUtils_VerifyFilemodeBitmask(const char* path, mode_t bitmask)
  */
 _Bool PermissionUtils_UserExists(const char* user)
 {
-    return getpwnam(user) != NULL;
+    return Lookup(PermissionUtils_LookupType_User, user, NULL /* group */, NULL /* id */);
 }
 
 /**
@@ -83,7 +265,43 @@ _Bool PermissionUtils_UserExists(const char* user)
  */
 _Bool PermissionUtils_GroupExists(const char* group)
 {
-    return getgrnam(group) != NULL;
+    return Lookup(PermissionUtils_LookupType_Group, group, NULL /* group */, NULL /* id */);
+}
+
+/**
+ * @brief Gets the uid of a user.
+ * @param user The case-sensitive user.
+ * @param[out] uid The uid of the user.
+ * @returns true if user exists.
+ */
+_Bool PermissionUtils_GetUserId(const char* user, uid_t* uid)
+{
+    unsigned int id = 0;
+    if (!Lookup(PermissionUtils_LookupType_User, user, NULL /* group */, &id))
+    {
+        return false;
+    }
+
+    *uid = (uid_t)id;
+    return true;
+}
+
+/**
+ * @brief Gets the gid of a group.
+ * @param group The case-sensitive group.
+ * @param[out] gid The gid of the group.
+ * @returns true if group exists.
+ */
+_Bool PermissionUtils_GetGroupId(const char* group, gid_t* gid)
+{
+    unsigned int id = 0;
+    if (!Lookup(PermissionUtils_LookupType_Group, group, NULL /* group */, &id))
+    {
+        return false;
+    }
+
+    *gid = (gid_t)id;
+    return true;
 }
 
 /**
@@ -94,22 +312,17 @@ _Bool PermissionUtils_GroupExists(const char* group)
  */
 _Bool PermissionUtils_UserInSupplementaryGroup(const char* user, const char* group)
 {
-    _Bool result = false;
-
-    struct group* groupEntry = getgrnam(group);
-    if (groupEntry != NULL && groupEntry->gr_mem != NULL)
-    {
-        for (int i = 0; groupEntry->gr_mem[i] != NULL; ++i)
-        {
-            if (strcmp(groupEntry->gr_mem[i], user) == 0)
-            {
-                result = true;
-                break;
-            }
-        }
-    }
+    return Lookup(PermissionUtils_LookupType_Membership, user, group, NULL /* id */);
+}
 
-    return result;
+/**
+ * @brief Forgets the cached user, group and group membership lookups, so that the next ones query NSS.
+ */
+void PermissionUtils_ClearCache(void)
+{
+    pthread_mutex_lock(&s_cacheMutex);
+    memset(s_cache, 0, sizeof(s_cache));
+    pthread_mutex_unlock(&s_cacheMutex);
 }
 
 /**
@@ -131,24 +344,24 @@ _Bool PermissionUtils_CheckOwnership(const char* path, const char* user, const c
 
     if (user != NULL)
     {
-        const struct passwd* pwd = getpwnam(user);
-        if (pwd == NULL)
+        uid_t uid;
+        if (!PermissionUtils_GetUserId(user, &uid))
         {
             return false;
         }
 
-        result = result && (st.st_uid == pwd->pw_uid);
+        result = result && (st.st_uid == uid);
     }
 
     if (group != NULL)
     {
-        const struct group* grp = getgrnam(group);
-        if (grp == NULL)
+        gid_t gid;
+        if (!PermissionUtils_GetGroupId(group, &gid))
         {
             return false;
         }
 
-        result = result && (st.st_gid == grp->gr_gid);
+        result = result && (st.st_gid == gid);
     }
 
     return result;
@@ -7,7 +7,9 @@
  */
 #include <aduc/permission_utils.h>
 #include <catch2/catch.hpp>
+#include <grp.h>
 #include <stdio.h>
+#include <string>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -36,3 +38,35 @@ TEST_CASE("PermissionUtils_VerifyFilemodeBit*")
     // cleanup
     unlink(tmpfile_path);
 }
+
+TEST_CASE("PermissionUtils user and group lookups")
+{
+    PermissionUtils_ClearCache();
+
+    // Repeated lookups are answered from the cache the same way.
+    for (int i = 0; i < 2; ++i)
+    {
+        uid_t uid = 1;
+        CHECK(PermissionUtils_UserExists("root"));
+        CHECK(PermissionUtils_GetUserId("root", &uid));
+        CHECK(uid == 0);
+
+        const struct group* rootGroup = getgrgid(0);
+        REQUIRE(rootGroup != nullptr);
+        gid_t gid = 1;
+        CHECK(PermissionUtils_GroupExists(rootGroup->gr_name));
+        CHECK(PermissionUtils_GetGroupId(rootGroup->gr_name, &gid));
+        CHECK(gid == 0);
+
+        CHECK_FALSE(PermissionUtils_UserExists("permissionUtilsUT_noSuchUser"));
+        CHECK_FALSE(PermissionUtils_GroupExists("permissionUtilsUT_noSuchGroup"));
+        CHECK_FALSE(PermissionUtils_UserInSupplementaryGroup("root", "permissionUtilsUT_noSuchGroup"));
+        CHECK_FALSE(PermissionUtils_UserExists(nullptr));
+    }
+
+    // Names too long to cache are looked up every time.
+    const std::string longName(100, 'x');
+    CHECK_FALSE(PermissionUtils_UserExists(longName.c_str()));
+
+    PermissionUtils_ClearCache();
+}
@@ -8,6 +8,7 @@
 #ifndef ADUC_PROCESS_UTILS_HPP
 #define ADUC_PROCESS_UTILS_HPP
 
+#include <aduc/cancellation_token.h>
 #include <azure_c_shared_utility/vector.h>
 #include <functional>
 #include <grp.h>
@@ -17,6 +18,46 @@
 #include <unistd.h>
 #include <vector>
 
+/**
+ * @brief Longest line passed to the line callback of ADUC_LaunchChildProcess; longer lines are split.
+ */
+#define ADUC_CHILD_PROCESS_MAX_LINE_SIZE 4096
+
+/**
+ * @brief The file descriptor of the result channel in the child process of ADUC_LaunchChildProcessWithResultChannel.
+ */
+#define ADUC_CHILD_PROCESS_RESULT_FD 3
+
+/**
+ * @brief The environment variable that tells the child process of ADUC_LaunchChildProcessWithResultChannel, and its own
+ * children, the file descriptor of the result channel.
+ */
+#define ADUC_CHILD_PROCESS_RESULT_FD_ENV "ADUC_RESULT_FD"
+
+/**
+ * @brief Longest line of the result channel of ADUC_LaunchChildProcessWithResultChannel; longer lines are dropped.
+ */
+#define ADUC_CHILD_PROCESS_MAX_RESULT_LINE_SIZE (64 * 1024)
+
+/**
+ * @brief How long a cancelled child process has to exit after SIGTERM before its process group is sent SIGKILL.
+ */
+#define ADUC_CHILD_PROCESS_TERMINATION_GRACE_MS 500
+
+/**
+ * @brief The file descriptor of the control channel in a child process launched with a cancellation token: the
+ * launcher writes a byte to it once the token is cancelled. A child that changes its user, e.g. adu-shell, which runs
+ * as root, can't be signaled by the launcher, so it terminates its own process group instead, see
+ * ADUC_StartChildProcessControlWatcher.
+ */
+#define ADUC_CHILD_PROCESS_CONTROL_FD 4
+
+/**
+ * @brief The environment variable that tells a child process launched with a cancellation token the file descriptor
+ * of its control channel.
+ */
+#define ADUC_CHILD_PROCESS_CONTROL_FD_ENV "ADUC_CONTROL_FD"
+
 /**
  * @brief Runs specified command in a new process and captures output, error messages, and exit code.
  *        The captured output and error messages will be written to ADUC_LOG_FILE.
@@ -25,10 +66,109 @@
  *               search for the specified command in PATH.
  * @param args List of arguments for the command.
  * @param output A standard output from the command.
+ * @param cancellationToken Optional. Once cancelled, the command is terminated.
+ *
+ * @return An exit code from the command.
+ *
+ * With a cancellation token, the command runs in a process group of its own. Once the token is cancelled, the group
+ * is sent SIGTERM, then SIGKILL if the command hasn't exited within ADUC_CHILD_PROCESS_TERMINATION_GRACE_MS, and the
+ * number of the signal the command was terminated by is returned. The command is also asked to terminate through its
+ * control channel, see ADUC_CHILD_PROCESS_CONTROL_FD, and its output is read until it exits, so that it isn't blocked
+ * writing to a full pipe. The same goes for the overloads below.
+ */
+int ADUC_LaunchChildProcess(
+    const std::string& command,
+    std::vector<std::string> args,
+    std::string& output,
+    const ADUC_CancellationToken* cancellationToken = nullptr);
+
+/**
+ * @brief Runs specified command in a new process and streams its standard output to @p outputCallback
+ *        as it arrives. Standard error is captured separately.
+ *
+ * @param command Name of a command to run. If command doesn't contain '/', this function will
+ *               search for the specified command in PATH.
+ * @param args List of arguments for the command.
+ * @param outputCallback Called with each chunk of the standard output. Return false to stop reading,
+ *                       in which case the child process is terminated.
+ * @param errorOutput A standard error from the command.
+ * @param cancellationToken Optional. Once cancelled, the command is terminated.
+ *
+ * @return An exit code from the command.
+ */
+int ADUC_LaunchChildProcess(
+    const std::string& command,
+    std::vector<std::string> args,
+    const std::function<bool(const char* data, size_t size)>& outputCallback,
+    std::string& errorOutput,
+    const ADUC_CancellationToken* cancellationToken = nullptr);
+
+/**
+ * @brief Runs specified command in a new process and passes each line of its output, standard output and
+ *        standard error combined, to @p lineCallback as it arrives. Only the last @p maxTailSize bytes of the
+ *        output are kept, for error reporting, so memory use doesn't grow with the output.
+ *
+ * @param command Name of a command to run. If command doesn't contain '/', this function will
+ *               search for the specified command in PATH.
+ * @param args List of arguments for the command.
+ * @param lineCallback Called with each line of the output, without its newline. Lines longer than
+ *                     ADUC_CHILD_PROCESS_MAX_LINE_SIZE are passed in pieces.
+ * @param maxTailSize The maximum number of bytes kept in @p outputTail.
+ * @param outputTail Receives the end of the output.
+ * @param cancellationToken Optional. Once cancelled, the command is terminated.
  *
  * @return An exit code from the command.
  */
-int ADUC_LaunchChildProcess(const std::string& command, std::vector<std::string> args, std::string& output);
+int ADUC_LaunchChildProcess(
+    const std::string& command,
+    std::vector<std::string> args,
+    const std::function<void(const std::string& line)>& lineCallback,
+    size_t maxTailSize,
+    std::string& outputTail,
+    const ADUC_CancellationToken* cancellationToken = nullptr);
+
+/**
+ * @brief Runs specified command in a new process, like the first overload of ADUC_LaunchChildProcess, with a result
+ *        channel: a pipe the command, and the processes it starts, write lines of results to, e.g. JSON lines, so
+ *        that they don't go through a file. The write end of the pipe is file descriptor ADUC_CHILD_PROCESS_RESULT_FD
+ *        in the command, whose environment variable ADUC_CHILD_PROCESS_RESULT_FD_ENV is set to it.
+ *
+ * @param command Name of a command to run. If command doesn't contain '/', this function will
+ *               search for the specified command in PATH.
+ * @param args List of arguments for the command.
+ * @param output The standard output and standard error of the command.
+ * @param resultLineCallback Called with each line written to the result channel, without its newline, as it
+ *                           arrives. Lines longer than ADUC_CHILD_PROCESS_MAX_RESULT_LINE_SIZE are dropped.
+ * @param cancellationToken Optional. Once cancelled, the command is terminated.
+ *
+ * @return An exit code from the command.
+ */
+int ADUC_LaunchChildProcessWithResultChannel(
+    const std::string& command,
+    std::vector<std::string> args,
+    std::string& output,
+    const std::function<void(const std::string& line)>& resultLineCallback,
+    const ADUC_CancellationToken* cancellationToken = nullptr);
+
+/**
+ * @brief Watches the control channel of the calling process, if it was launched with a cancellation token, see
+ * ADUC_CHILD_PROCESS_CONTROL_FD. Once the launcher cancels it, the process group of the calling process is sent
+ * SIGTERM, which the calling process then ignores, then SIGKILL after ADUC_CHILD_PROCESS_TERMINATION_GRACE_MS, unless
+ * the calling process exited meanwhile. Call it after changing user, e.g. in adu-shell, before starting any thread.
+ *
+ * @return bool true if the process has a control channel, and it is watched.
+ */
+bool ADUC_StartChildProcessControlWatcher();
+
+/**
+ * @brief Gives the calling thread, and the threads and processes it starts from now on, idle CPU and I/O priority
+ *        (SCHED_IDLE and the idle I/O scheduling class), so that they only use the CPU and storage the other work of
+ *        the device leaves unused. Unprivileged threads can't get their priority back, so call it on a thread of
+ *        its own.
+ *
+ * @return bool true if both priorities were set.
+ */
+bool ADUC_SetCurrentThreadIdlePriority();
 
 /**
  * @brief Ensure that the effective group of the process is the given group (or is root).
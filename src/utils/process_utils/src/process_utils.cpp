@@ -17,7 +17,11 @@
 #include <aduc/c_utils.h>
 #include <aduc/config_utils.h>
 #include <aduc/logging.h>
+#include <aduc/metrics_utils.h>
+#include <aduc/process_utils.hpp>
 #include <aduc/string_utils.hpp>
+#include <aduc/timing_utils.hpp>
+#include <aduc/tracepoints.h>
 #include <azure_c_shared_utility/strings.h>
 #include <azure_c_shared_utility/vector.h>
 
@@ -29,8 +33,676 @@
 #include <chrono>
 
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <mutex> // for std::call_once
+#include <pthread.h>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/stat.h> // for mkdir
+#include <sys/socket.h> // for socketpair, send
+#include <sys/syscall.h> // for SYS_ioprio_set
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <thread>
+#include <utility> // for std::pair
+#include <vector>
+
+#define READ_END 0
+#define WRITE_END 1
+
+static int GetChildExitStatus(int wstatus);
+static int WaitForChildExitStatus(pid_t pid);
+
+// From linux/ioprio.h, which older kernel headers don't have.
+#define ADUC_IOPRIO_WHO_PROCESS 1
+#define ADUC_IOPRIO_CLASS_IDLE 3
+#define ADUC_IOPRIO_CLASS_SHIFT 13
+
+/**
+ * @brief The cgroup.procs file of the cgroup child processes are moved to, see updateCgroup in the configuration
+ * file, or -1 if not configured or not writable. Opened on the first launch.
+ */
+static int s_updateCgroupProcsFd = -1;
+static std::once_flag s_updateCgroupOnce;
+
+/**
+ * @brief Writes @p value to the interface file @p fileName of the cgroup at @p cgroupPath.
+ * @return bool true on success.
+ */
+static bool WriteCgroupFile(const std::string& cgroupPath, const char* fileName, const char* value)
+{
+    const std::string path = cgroupPath + "/" + fileName;
+    const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    const size_t size = strlen(value);
+    const bool written = fd != -1 && write(fd, value, size) == static_cast<ssize_t>(size);
+
+    if (!written)
+    {
+        Log_Warn("Cannot write '%s' to %s. %s (errno %d).", value, path.c_str(), strerror(errno), errno);
+    }
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    return written;
+}
+
+/**
+ * @brief Creates the cgroup of updateCgroup in the configuration file, if any, sets its limits, and opens its
+ * cgroup.procs file into s_updateCgroupProcsFd.
+ * @details The agent needs the cgroup delegated to it, e.g. through a systemd slice; adu-shell, which runs as root,
+ * moves its own children there regardless.
+ */
+static void OpenUpdateCgroup()
+{
+    const ADUC_ConfigInfo* config = ADUC_ConfigInfo_GetInstance();
+
+    if (config != nullptr && config->updateCgroup != nullptr)
+    {
+        const std::string cgroupPath{ config->updateCgroup };
+
+        if (mkdir(cgroupPath.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            Log_Warn("Cannot create cgroup %s. %s (errno %d).", cgroupPath.c_str(), strerror(errno), errno);
+        }
+
+        // The limits need the cpu, io and memory controllers enabled in the parent cgroup.
+        if (config->updateCgroupCpuMax != nullptr)
+        {
+            WriteCgroupFile(cgroupPath, "cpu.max", config->updateCgroupCpuMax);
+        }
+
+        if (config->updateCgroupIoMax != nullptr)
+        {
+            WriteCgroupFile(cgroupPath, "io.max", config->updateCgroupIoMax);
+        }
+
+        if (config->updateCgroupMemoryHigh != nullptr)
+        {
+            WriteCgroupFile(cgroupPath, "memory.high", config->updateCgroupMemoryHigh);
+        }
+
+        const std::string procsPath = cgroupPath + "/cgroup.procs";
+        s_updateCgroupProcsFd = open(procsPath.c_str(), O_WRONLY | O_CLOEXEC);
+        if (s_updateCgroupProcsFd == -1)
+        {
+            Log_Warn(
+                "Cannot open %s, child processes run in the cgroup of the agent. %s (errno %d).",
+                procsPath.c_str(),
+                strerror(errno),
+                errno);
+        }
+    }
+
+    ADUC_ConfigInfo_ReleaseInstance(config);
+}
+
+/**
+ * @brief Returns the cgroup.procs file of the cgroup of updateCgroup in the configuration file, opening it on the
+ * first call, see OpenUpdateCgroup.
+ *
+ * @return int The file descriptor, or -1 if child processes run in the cgroup of the agent.
+ */
+static int GetUpdateCgroupProcsFd()
+{
+    std::call_once(s_updateCgroupOnce, OpenUpdateCgroup);
+    return s_updateCgroupProcsFd;
+}
+
+/**
+ * @brief The steps of ForkChildProcess that the child reports the failure of, with the errno value, through a pipe.
+ */
+enum class ForkedChildStep : int
+{
+    JoinCgroup, // Not fatal: the child runs in the cgroup of the agent.
+    Exec, // Fatal, including the redirections and the process group.
+};
+
+/**
+ * @brief Starts @p command like posix_spawnp would, but with fork and exec, so that the child joins the update cgroup
+ * by writing to @p cgroupProcsFd before it execs. Unlike moving it there once it's spawned, neither the command nor
+ * the processes it starts can then ever run outside the limits of the cgroup. Forking copies the page tables of the
+ * caller's address space, which is why this is only used when updateCgroup is configured.
+ *
+ * @param pid Receives the pid of the child process.
+ * @param command Name of a command to run. If command doesn't contain '/', it's searched for in PATH.
+ * @param argv The arguments of the command, terminated by nullptr.
+ * @param envp The environment of the command, terminated by nullptr.
+ * @param cgroupProcsFd The cgroup.procs file of the update cgroup.
+ * @param redirections The file descriptors to duplicate, in order, onto the ones paired with them.
+ * @param newProcessGroup Whether the child leads a new process group.
+ * @return int 0 on success, or the errno value of the failure.
+ */
+static int ForkChildProcess(
+    pid_t* pid,
+    const char* command,
+    char* const argv[],
+    char* const envp[],
+    int cgroupProcsFd,
+    const std::vector<std::pair<int, int>>& redirections,
+    bool newProcessGroup)
+{
+    // Closed on exec, so reading it until the end tells whether the exec succeeded.
+    int errorPipe[2];
+    if (pipe2(errorPipe, O_CLOEXEC) != 0)
+    {
+        return errno;
+    }
+
+    *pid = fork();
+    if (*pid == 0)
+    {
+        // Only async-signal-safe functions from here on, since the caller may be multithreaded.
+        int report[2] = { static_cast<int>(ForkedChildStep::JoinCgroup), 0 };
+
+        // "0" stands for the writing process.
+        if (write(cgroupProcsFd, "0", 1) == -1)
+        {
+            report[1] = errno;
+            (void)!write(errorPipe[WRITE_END], report, sizeof(report));
+        }
+
+        report[0] = static_cast<int>(ForkedChildStep::Exec);
+
+        bool ready = true;
+        for (const std::pair<int, int>& redirection : redirections)
+        {
+            ready = ready && dup2(redirection.first, redirection.second) != -1;
+        }
+
+        // Process group 0 is a new group whose id is the pid of the child.
+        if (ready && (!newProcessGroup || setpgid(0, 0) == 0))
+        {
+            execvpe(command, argv, envp);
+        }
+
+        report[1] = errno;
+        (void)!write(errorPipe[WRITE_END], report, sizeof(report));
+        _exit(127);
+    }
+
+    int error = (*pid == -1) ? errno : 0;
+    close(errorPipe[WRITE_END]);
+
+    if (*pid != -1)
+    {
+        int report[2];
+        ssize_t bytesRead;
+        while ((bytesRead = read(errorPipe[READ_END], report, sizeof(report))) == sizeof(report)
+               || (bytesRead == -1 && errno == EINTR))
+        {
+            if (bytesRead == -1)
+            {
+                continue;
+            }
+
+            if (report[0] == static_cast<int>(ForkedChildStep::JoinCgroup))
+            {
+                Log_Warn(
+                    "Cannot move process %d to the update cgroup. %s (errno %d).",
+                    *pid,
+                    strerror(report[1]),
+                    report[1]);
+            }
+            else
+            {
+                error = report[1];
+            }
+        }
+
+        if (error != 0)
+        {
+            (void)WaitForChildExitStatus(*pid);
+            *pid = -1;
+        }
+    }
+
+    close(errorPipe[READ_END]);
+    return error;
+}
+
+/**
+ * @brief Closes both ends of a control channel, see SpawnChildProcess, if open.
+ */
+static void CloseControlChannel(const int controlChannel[2])
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (controlChannel[i] != -1)
+        {
+            close(controlChannel[i]);
+        }
+    }
+}
+
+/**
+ * @brief Starts @p command in a new process, with its standard output and standard error redirected.
+ * @details Uses posix_spawnp rather than fork and exec: the child doesn't get a copy of the page tables of
+ * the caller's (large) address space first, which is slow and may fail under overcommit limits on low-RAM
+ * devices. The exception is when updateCgroup is configured, see ForkChildProcess. The pipes to redirect to must be
+ * close-on-exec, so that the child only keeps @p stdoutFd and @p stderrFd, as its stdout and stderr.
+ *
+ * @param command Name of a command to run. If command doesn't contain '/', it's searched for in PATH.
+ * @param args List of arguments for the command.
+ * @param stdoutFd The file descriptor the standard output of the command is redirected to.
+ * @param stderrFd The file descriptor the standard error of the command is redirected to.
+ * @param newProcessGroup Whether the child leads a new process group, so that it can be terminated along with its
+ * own children, see ChildTermination. It then gets a control channel too, see ADUC_CHILD_PROCESS_CONTROL_FD.
+ * @param controlFd Receives the launcher's end of the control channel, to close once done; -1 if there is none.
+ * @param resultFd The file descriptor the child gets as ADUC_CHILD_PROCESS_RESULT_FD, or -1 for none. It must not be
+ * ADUC_CHILD_PROCESS_RESULT_FD itself, since duplicating a descriptor onto itself keeps it close-on-exec.
+ * @return The pid of the child process, or -1 on failure.
+ */
+static pid_t SpawnChildProcess(
+    const std::string& command,
+    const std::vector<std::string>& args,
+    int stdoutFd,
+    int stderrFd,
+    bool newProcessGroup,
+    int* controlFd,
+    int resultFd = -1)
+{
+    // The child's end of the control channel is above ADUC_CHILD_PROCESS_CONTROL_FD, so that the redirections
+    // below don't overwrite it before it's duplicated, and isn't sent SIGPIPE by a child that closed it.
+    int controlChannel[2] = { -1, -1 };
+    *controlFd = -1;
+    if (newProcessGroup)
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, controlChannel) == 0)
+        {
+            const int fd = fcntl(controlChannel[READ_END], F_DUPFD_CLOEXEC, ADUC_CHILD_PROCESS_CONTROL_FD + 1);
+            close(controlChannel[READ_END]);
+            controlChannel[READ_END] = fd;
+        }
+
+        if (controlChannel[READ_END] == -1)
+        {
+            Log_Warn("Cannot create control channel. %s (errno %d).", strerror(errno), errno);
+            if (controlChannel[WRITE_END] != -1)
+            {
+                close(controlChannel[WRITE_END]);
+                controlChannel[WRITE_END] = -1;
+            }
+        }
+    }
+
+    std::vector<char*> argv;
+    argv.reserve(args.size() + 2);
+    argv.emplace_back(const_cast<char*>(command.c_str())); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+    for (const std::string& arg : args)
+    {
+        argv.emplace_back(const_cast<char*>(arg.c_str())); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+    }
+    argv.emplace_back(nullptr);
+
+    // The environment of the agent, plus the result and control channel variables, if any.
+    char** envp = environ;
+    std::vector<char*> channelEnv;
+    std::string resultFdVariable =
+        std::string{ ADUC_CHILD_PROCESS_RESULT_FD_ENV "=" } + std::to_string(ADUC_CHILD_PROCESS_RESULT_FD);
+    std::string controlFdVariable =
+        std::string{ ADUC_CHILD_PROCESS_CONTROL_FD_ENV "=" } + std::to_string(ADUC_CHILD_PROCESS_CONTROL_FD);
+    if (resultFd != -1 || controlChannel[READ_END] != -1)
+    {
+        for (char** variable = environ; *variable != nullptr; ++variable)
+        {
+            if (strncmp(*variable, ADUC_CHILD_PROCESS_RESULT_FD_ENV "=", sizeof(ADUC_CHILD_PROCESS_RESULT_FD_ENV)) != 0
+                && strncmp(*variable, ADUC_CHILD_PROCESS_CONTROL_FD_ENV "=", sizeof(ADUC_CHILD_PROCESS_CONTROL_FD_ENV))
+                    != 0)
+            {
+                channelEnv.emplace_back(*variable);
+            }
+        }
+
+        if (resultFd != -1)
+        {
+            channelEnv.emplace_back(&resultFdVariable[0]);
+        }
+
+        if (controlChannel[READ_END] != -1)
+        {
+            channelEnv.emplace_back(&controlFdVariable[0]);
+        }
+
+        channelEnv.emplace_back(nullptr);
+        envp = &channelEnv[0];
+    }
+
+    std::vector<std::pair<int, int>> redirections{ { stdoutFd, STDOUT_FILENO }, { stderrFd, STDERR_FILENO } };
+    if (resultFd != -1)
+    {
+        redirections.emplace_back(resultFd, ADUC_CHILD_PROCESS_RESULT_FD);
+    }
+
+    if (controlChannel[READ_END] != -1)
+    {
+        redirections.emplace_back(controlChannel[READ_END], ADUC_CHILD_PROCESS_CONTROL_FD);
+    }
+
+    pid_t pid = -1;
+    int status = 0;
+
+    const int cgroupProcsFd = GetUpdateCgroupProcsFd();
+    if (cgroupProcsFd != -1)
+    {
+        status = ForkChildProcess(&pid, command.c_str(), &argv[0], envp, cgroupProcsFd, redirections, newProcessGroup);
+    }
+    else
+    {
+        posix_spawn_file_actions_t fileActions;
+        status = posix_spawn_file_actions_init(&fileActions);
+        if (status != 0)
+        {
+            Log_Error("Cannot initialize spawn file actions, error %d", status);
+            CloseControlChannel(controlChannel);
+            return -1;
+        }
+
+        posix_spawnattr_t attributes;
+        status = posix_spawnattr_init(&attributes);
+        if (status != 0)
+        {
+            Log_Error("Cannot initialize spawn attributes, error %d", status);
+            posix_spawn_file_actions_destroy(&fileActions);
+            CloseControlChannel(controlChannel);
+            return -1;
+        }
+
+        for (size_t i = 0; status == 0 && i < redirections.size(); i++)
+        {
+            status = posix_spawn_file_actions_adddup2(&fileActions, redirections[i].first, redirections[i].second);
+        }
+
+        if (status == 0 && newProcessGroup)
+        {
+            // Process group 0 is a new group whose id is the pid of the child.
+            status = posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+            if (status == 0)
+            {
+                status = posix_spawnattr_setpgroup(&attributes, 0);
+            }
+        }
+
+        if (status == 0)
+        {
+            status = posix_spawnp(&pid, command.c_str(), &fileActions, &attributes, &argv[0], envp);
+        }
+
+        posix_spawnattr_destroy(&attributes);
+        posix_spawn_file_actions_destroy(&fileActions);
+    }
+
+    if (status != 0)
+    {
+        Log_Error("Cannot launch %s, error %d", command.c_str(), status);
+        CloseControlChannel(controlChannel);
+        return -1;
+    }
+
+    if (controlChannel[READ_END] != -1)
+    {
+        close(controlChannel[READ_END]);
+    }
+
+    *controlFd = controlChannel[WRITE_END];
+
+    ADUC_Metrics_AddCounter(ADUC_MetricsCounter_ChildProcessesSpawned, 1);
+    ADUC_TRACEPOINT2(process_spawn, command.c_str(), static_cast<int>(pid));
+
+    return pid;
+}
+
+/**
+ * @brief The termination of a child process, e.g. once its cancellation token is cancelled. The child, and its
+ * process group if it leads one, is sent SIGTERM, then SIGKILL if it hasn't exited within
+ * ADUC_CHILD_PROCESS_TERMINATION_GRACE_MS. A child that changed its user, e.g. adu-shell, which runs as root, can't be
+ * signaled, so it is also asked through its control channel to terminate its process group itself, see
+ * ADUC_StartChildProcessControlWatcher. The output of the child is read meanwhile, see PollChildOutput.
+ */
+class ChildTermination
+{
+public:
+    /**
+     * @param pid The child process id.
+     * @param processGroup Whether the child leads a process group, which is terminated along with it.
+     * @param controlFd The launcher's end of the control channel of the child, or -1. Closed by the destructor.
+     */
+    ChildTermination(pid_t pid, bool processGroup, int controlFd)
+        : _pid(pid), _processGroup(processGroup), _controlFd(controlFd)
+    {
+    }
+
+    ~ChildTermination()
+    {
+        if (_controlFd != -1)
+        {
+            close(_controlFd);
+        }
+    }
+
+    ChildTermination(const ChildTermination&) = delete;
+    ChildTermination& operator=(const ChildTermination&) = delete;
+
+    /**
+     * @brief Starts terminating the child, unless it was started already.
+     */
+    void Start()
+    {
+        if (_started)
+        {
+            return;
+        }
+
+        _started = true;
+        _killTime =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds{ ADUC_CHILD_PROCESS_TERMINATION_GRACE_MS };
+
+        if (_controlFd != -1 && send(_controlFd, "t", 1, MSG_NOSIGNAL) != 1)
+        {
+            Log_Debug("Cannot write to the control channel of child process %d, errno %d", _pid, errno);
+        }
+
+        Signal(SIGTERM);
+    }
+
+    bool IsStarted() const
+    {
+        return _started;
+    }
+
+    /**
+     * @brief Returns how long poll may wait before the next step of the termination, in milliseconds; -1 if the
+     * termination wasn't started.
+     */
+    int GetPollTimeout() const
+    {
+        if (!_started || _exited)
+        {
+            return -1;
+        }
+
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            (_killed ? _exitCheckTime : _killTime) - std::chrono::steady_clock::now());
+
+        return remaining.count() < 0 ? 0 : static_cast<int>(remaining.count());
+    }
+
+    /**
+     * @brief Takes the next step of the termination once it's due: SIGKILL after the grace period, then a check that
+     * the child exited after each further grace period.
+     *
+     * @return false once the killed child has exited while its output is still open, e.g. by a process that left its
+     * process group, so that reading stops.
+     */
+    bool Continue()
+    {
+        if (!_started || _exited)
+        {
+            return !_exited;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+
+        if (!_killed)
+        {
+            if (now >= _killTime)
+            {
+                Kill();
+            }
+
+            return true;
+        }
+
+        if (now < _exitCheckTime)
+        {
+            return true;
+        }
+
+        _exitCheckTime = now + std::chrono::milliseconds{ ADUC_CHILD_PROCESS_TERMINATION_GRACE_MS };
+
+        int wstatus = 0;
+        if (waitpid(_pid, &wstatus, WNOHANG) != _pid)
+        {
+            return true;
+        }
+
+        Log_Warn("Child process %d exited, but its output is still open. Stop reading it.", _pid);
+        _exited = true;
+        _exitStatus = GetChildExitStatus(wstatus);
+        ADUC_TRACEPOINT2(process_exit, static_cast<int>(_pid), _exitStatus);
+
+        return false;
+    }
+
+    /**
+     * @brief Waits for the child to exit, and kills it once due if the termination was started.
+     *
+     * @return The child process exit code, or the signal number if the child process was terminated by a signal.
+     */
+    int Wait()
+    {
+        if (_exited)
+        {
+            return _exitStatus;
+        }
+
+        while (_started && !_killed)
+        {
+            int wstatus = 0;
+            const pid_t waited = waitpid(_pid, &wstatus, WNOHANG);
+            if (waited == _pid)
+            {
+                const int exitStatus = GetChildExitStatus(wstatus);
+                ADUC_TRACEPOINT2(process_exit, static_cast<int>(_pid), exitStatus);
+                return exitStatus;
+            }
+
+            if (waited == -1 && errno != EINTR)
+            {
+                Log_Error("Cannot wait for child process %d, error %d", _pid, errno);
+                return EXIT_FAILURE;
+            }
+
+            if (std::chrono::steady_clock::now() >= _killTime)
+            {
+                Kill();
+                break;
+            }
+
+            usleep(10 * 1000);
+        }
+
+        return WaitForChildExitStatus(_pid);
+    }
+
+private:
+    void Kill()
+    {
+        Log_Warn("Child process %d didn't exit on SIGTERM, killing it", _pid);
+        Signal(SIGKILL);
+        _killed = true;
+        _exitCheckTime =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds{ ADUC_CHILD_PROCESS_TERMINATION_GRACE_MS };
+    }
+
+    void Signal(int signal)
+    {
+        if (kill(_processGroup ? -_pid : _pid, signal) == 0 || errno == ESRCH)
+        {
+            return;
+        }
+
+        if (errno == EPERM && _controlFd != -1)
+        {
+            Log_Info("Cannot signal child process %d (EPERM), it terminates through its control channel.", _pid);
+            return;
+        }
+
+        Log_Warn("Cannot send signal %d to child process %d. %s (errno %d).", signal, _pid, strerror(errno), errno);
+    }
+
+    pid_t _pid;
+    bool _processGroup;
+    int _controlFd;
+    bool _started = false;
+    bool _killed = false;
+    bool _exited = false;
+    int _exitStatus = EXIT_FAILURE;
+    std::chrono::steady_clock::time_point _killTime;
+    std::chrono::steady_clock::time_point _exitCheckTime;
+};
+
+/**
+ * @brief Waits until one of the output pipes of a child process can be read. The cancellation token of the child
+ * is watched meanwhile: once cancelled, the child is terminated, see ChildTermination, and its output is still read,
+ * so that it isn't blocked writing to a full pipe until it exits.
+ *
+ * @param fds The output pipes, followed by the cancellation token. Negative fd values are ignored by poll().
+ * @param pipeCount The number of output pipes.
+ * @param termination The termination of the child.
+ * @return false if reading must stop, see ChildTermination::Continue, or on poll failures.
+ */
+static bool PollChildOutput(struct pollfd* fds, size_t pipeCount, ChildTermination* termination)
+{
+    for (;;)
+    {
+        const int ready = poll(fds, pipeCount + 1, termination->GetPollTimeout());
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            Log_Error("Poll failed, error %d", errno);
+            return false;
+        }
+
+        // The token stays readable once cancelled.
+        if (fds[pipeCount].fd >= 0 && fds[pipeCount].revents != 0)
+        {
+            Log_Info("Cancelled, terminating child process group.");
+            fds[pipeCount].fd = -1;
+            termination->Start();
+        }
+
+        if (!termination->Continue())
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < pipeCount; i++)
+        {
+            if (fds[i].fd >= 0 && fds[i].revents != 0)
+            {
+                return true;
+            }
+        }
+    }
+}
 
 /**
  * @brief Runs specified command in a new process and captures output, error messages, and exit code.
@@ -40,60 +712,254 @@
  *               search for the specified command in PATH.
  * @param args List of arguments for the command.
  * @param output A standard output from the command.
+ * @param cancellationToken Optional. Once cancelled, the command is terminated, see ChildTermination.
  *
  * @return An exit code from the command.
  */
-int ADUC_LaunchChildProcess(const std::string& command, std::vector<std::string> args, std::string& output) // NOLINT(google-runtime-references)
+int ADUC_LaunchChildProcess(
+    const std::string& command,
+    std::vector<std::string> args,
+    std::string& output, // NOLINT(google-runtime-references)
+    const ADUC_CancellationToken* cancellationToken)
 {
-#define READ_END 0
-#define WRITE_END 1
+    const ADUC::TimingSpan span{ "process_launch", command };
 
     int filedes[2];
-    const int ret = pipe(filedes);
+    const int ret = pipe2(filedes, O_CLOEXEC);
     if (ret != 0)
     {
         Log_Error("Cannot create output and error pipes. %s (errno %d).", strerror(errno), errno);
         return ret;
     }
 
-    const int pid = fork();
+    // Redirect stdout and stderr to WRITE_END
+    int controlFd = -1;
+    const pid_t pid = SpawnChildProcess(
+        command, args, filedes[WRITE_END], filedes[WRITE_END], cancellationToken != nullptr, &controlFd);
+
+    close(filedes[WRITE_END]);
+
+    if (pid == -1)
+    {
+        close(filedes[READ_END]);
+        return EXIT_FAILURE;
+    }
+
+    ChildTermination termination{ pid, cancellationToken != nullptr, controlFd };
+    struct pollfd fds[2] = { { filedes[READ_END], POLLIN, 0 },
+                             { ADUC_CancellationToken_GetFd(cancellationToken), POLLIN, 0 } };
 
-    if (pid == 0)
+    while (PollChildOutput(fds, 1, &termination))
     {
-        // Running inside child process.
+        char buffer[64 * 1024];
+        ssize_t count;
+        count = read(filedes[READ_END], buffer, sizeof(buffer));
 
-        // Redirect stdout and stderr to WRITE_END
-        dup2(filedes[WRITE_END], STDOUT_FILENO);
-        dup2(filedes[WRITE_END], STDERR_FILENO);
+        if (count == -1 && errno == EINTR)
+        {
+            continue;
+        }
 
-        close(filedes[READ_END]);
-        close(filedes[WRITE_END]);
+        if (count == -1)
+        {
+            Log_Error("Read failed, error %d", errno);
+            break;
+        }
+
+        if (count <= 0)
+        {
+            break;
+        }
+
+        output.append(buffer, static_cast<size_t>(count));
+    }
+
+    const int childExitStatus = termination.Wait();
+
+    close(filedes[READ_END]);
+
+    return childExitStatus;
+}
+
+/**
+ * @brief Runs specified command in a new process and streams its standard output to @p outputCallback
+ *        as it arrives. Standard error is captured separately.
+ *
+ * @param command Name of a command to run. If command doesn't contain '/', this function will
+ *               search for the specified command in PATH.
+ * @param args List of arguments for the command.
+ * @param outputCallback Called with each chunk of the standard output. Return false to stop reading,
+ *                       in which case the child process is terminated.
+ * @param errorOutput A standard error from the command.
+ * @param cancellationToken Optional. Once cancelled, the command is terminated.
+ *
+ * @return An exit code from the command.
+ */
+int ADUC_LaunchChildProcess(
+    const std::string& command,
+    std::vector<std::string> args,
+    const std::function<bool(const char* data, size_t size)>& outputCallback,
+    std::string& errorOutput, // NOLINT(google-runtime-references)
+    const ADUC_CancellationToken* cancellationToken)
+{
+    const ADUC::TimingSpan span{ "process_launch", command };
+
+    int outPipe[2];
+    int errPipe[2];
+
+    if (pipe2(outPipe, O_CLOEXEC) != 0)
+    {
+        Log_Error("Cannot create output pipe. %s (errno %d).", strerror(errno), errno);
+        return -1;
+    }
+
+    if (pipe2(errPipe, O_CLOEXEC) != 0)
+    {
+        Log_Error("Cannot create error pipe. %s (errno %d).", strerror(errno), errno);
+        close(outPipe[READ_END]);
+        close(outPipe[WRITE_END]);
+        return -1;
+    }
+
+    int controlFd = -1;
+    const pid_t pid = SpawnChildProcess(
+        command, args, outPipe[WRITE_END], errPipe[WRITE_END], cancellationToken != nullptr, &controlFd);
+
+    close(outPipe[WRITE_END]);
+    close(errPipe[WRITE_END]);
+
+    if (pid == -1)
+    {
+        close(outPipe[READ_END]);
+        close(errPipe[READ_END]);
+        return EXIT_FAILURE;
+    }
+
+    // The output, the error output, and the cancellation token, if any. Negative fd values are ignored by poll().
+    struct pollfd fds[3] = { { outPipe[READ_END], POLLIN, 0 },
+                             { errPipe[READ_END], POLLIN, 0 },
+                             { ADUC_CancellationToken_GetFd(cancellationToken), POLLIN, 0 } };
+    const size_t pipeCount = 2;
+    ChildTermination termination{ pid, cancellationToken != nullptr, controlFd };
+    bool keepReading = true;
 
-        std::vector<char*> argv;
-        argv.reserve(args.size() + 2);
-        argv.emplace_back(const_cast<char*>(command.c_str())); // NOLINT(cppcoreguidelines-pro-type-const-cast)
-        for (const std::string& arg : args)
+    while ((fds[0].fd >= 0 || fds[1].fd >= 0) && PollChildOutput(fds, pipeCount, &termination))
+    {
+        for (size_t i = 0; i < pipeCount; i++)
         {
-            argv.emplace_back(const_cast<char*>(arg.c_str())); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+            {
+                continue;
+            }
+
+            char buffer[64 * 1024];
+            const ssize_t count = read(fds[i].fd, buffer, sizeof(buffer));
+
+            if (count == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (count <= 0)
+            {
+                if (count == -1)
+                {
+                    Log_Error("Read failed, error %d", errno);
+                }
+
+                // Negative fd values are ignored by poll().
+                fds[i].fd = -1;
+                continue;
+            }
+
+            if (i != 0)
+            {
+                errorOutput.append(buffer, static_cast<size_t>(count));
+            }
+            else if (keepReading && !termination.IsStarted())
+            {
+                keepReading = outputCallback(buffer, static_cast<size_t>(count));
+                if (!keepReading)
+                {
+                    // The rest of the output is discarded until the child exits.
+                    Log_Info("Stop reading output, terminating child process %d", pid);
+                    termination.Start();
+                }
+            }
         }
-        argv.emplace_back(nullptr);
+    }
+
+    const int childExitStatus = termination.Wait();
 
-        // The exec() functions only return if an error has occurred.
-        // The return value is -1, and errno is set to indicate the error.
-        int status = execvp(command.c_str(), &argv[0]);
+    close(outPipe[READ_END]);
+    close(errPipe[READ_END]);
+
+    return childExitStatus;
+}
 
-        fprintf(stderr, "execvp failed, returned %d, error %d\n", status, errno);
+/**
+ * @brief Runs specified command in a new process and passes each line of its output, standard output and
+ *        standard error combined, to @p lineCallback as it arrives. Only the last @p maxTailSize bytes of the
+ *        output are kept, for error reporting, so memory use doesn't grow with the output.
+ *
+ * @param command Name of a command to run. If command doesn't contain '/', this function will
+ *               search for the specified command in PATH.
+ * @param args List of arguments for the command.
+ * @param lineCallback Called with each line of the output, without its newline. Lines longer than
+ *                     ADUC_CHILD_PROCESS_MAX_LINE_SIZE are passed in pieces.
+ * @param maxTailSize The maximum number of bytes kept in @p outputTail.
+ * @param outputTail Receives the end of the output.
+ * @param cancellationToken Optional. Once cancelled, the command is terminated.
+ *
+ * @return An exit code from the command.
+ */
+int ADUC_LaunchChildProcess(
+    const std::string& command,
+    std::vector<std::string> args,
+    const std::function<void(const std::string& line)>& lineCallback,
+    size_t maxTailSize,
+    std::string& outputTail, // NOLINT(google-runtime-references)
+    const ADUC_CancellationToken* cancellationToken)
+{
+    const ADUC::TimingSpan span{ "process_launch", command };
 
-        _exit(EXIT_FAILURE);
+    int filedes[2];
+    const int ret = pipe2(filedes, O_CLOEXEC);
+    if (ret != 0)
+    {
+        Log_Error("Cannot create output and error pipes. %s (errno %d).", strerror(errno), errno);
+        return ret;
     }
 
+    // Redirect stdout and stderr to WRITE_END
+    int controlFd = -1;
+    const pid_t pid = SpawnChildProcess(
+        command, args, filedes[WRITE_END], filedes[WRITE_END], cancellationToken != nullptr, &controlFd);
+
     close(filedes[WRITE_END]);
 
-    for (;;)
+    if (pid == -1)
     {
-        char buffer[1024];
-        ssize_t count;
-        count = read(filedes[READ_END], buffer, sizeof(buffer));
+        close(filedes[READ_END]);
+        return EXIT_FAILURE;
+    }
+
+    std::string line;
+    line.reserve(ADUC_CHILD_PROCESS_MAX_LINE_SIZE);
+
+    ChildTermination termination{ pid, cancellationToken != nullptr, controlFd };
+    struct pollfd fds[2] = { { filedes[READ_END], POLLIN, 0 },
+                             { ADUC_CancellationToken_GetFd(cancellationToken), POLLIN, 0 } };
+
+    while (PollChildOutput(fds, 1, &termination))
+    {
+        char buffer[64 * 1024];
+        const ssize_t count = read(filedes[READ_END], buffer, sizeof(buffer));
+
+        if (count == -1 && errno == EINTR)
+        {
+            continue;
+        }
 
         if (count == -1)
         {
@@ -101,20 +967,224 @@ int ADUC_LaunchChildProcess(const std::string& command, std::vector<std::string>
             break;
         }
 
-        if (count <= 0)
+        if (count == 0)
         {
             break;
         }
 
-        // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-constant-array-index)
-        buffer[count] = 0;
-        output += buffer;
+        const size_t size = static_cast<size_t>(count);
+
+        // Keep the last maxTailSize bytes. Trimming only once the tail is twice as long keeps it amortized O(1).
+        outputTail.append(buffer, size);
+        if (outputTail.size() > 2 * maxTailSize)
+        {
+            outputTail.erase(0, outputTail.size() - maxTailSize);
+        }
+
+        for (size_t i = 0; i < size; i++)
+        {
+            if (buffer[i] == '\n') // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+            {
+                lineCallback(line);
+                line.clear();
+                continue;
+            }
+
+            line += buffer[i]; // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+            if (line.size() == ADUC_CHILD_PROCESS_MAX_LINE_SIZE)
+            {
+                lineCallback(line);
+                line.clear();
+            }
+        }
+    }
+
+    if (!line.empty())
+    {
+        lineCallback(line);
     }
 
-    int wstatus;
-    int childExitStatus;
+    if (outputTail.size() > maxTailSize)
+    {
+        outputTail.erase(0, outputTail.size() - maxTailSize);
+    }
+
+    const int childExitStatus = termination.Wait();
+
+    close(filedes[READ_END]);
+
+    return childExitStatus;
+}
+
+/**
+ * @brief Runs specified command in a new process, like the first overload of ADUC_LaunchChildProcess, with a result
+ *        channel: a pipe the command, and the processes it starts, write lines of results to, e.g. JSON lines, so
+ *        that they don't go through a file. The write end of the pipe is file descriptor ADUC_CHILD_PROCESS_RESULT_FD
+ *        in the command, whose environment variable ADUC_CHILD_PROCESS_RESULT_FD_ENV is set to it.
+ *
+ * @param command Name of a command to run. If command doesn't contain '/', this function will
+ *               search for the specified command in PATH.
+ * @param args List of arguments for the command.
+ * @param output The standard output and standard error of the command.
+ * @param resultLineCallback Called with each line written to the result channel, without its newline, as it
+ *                           arrives. Lines longer than ADUC_CHILD_PROCESS_MAX_RESULT_LINE_SIZE are dropped.
+ * @param cancellationToken Optional. Once cancelled, the command is terminated.
+ *
+ * @return An exit code from the command.
+ */
+int ADUC_LaunchChildProcessWithResultChannel(
+    const std::string& command,
+    std::vector<std::string> args,
+    std::string& output, // NOLINT(google-runtime-references)
+    const std::function<void(const std::string& line)>& resultLineCallback,
+    const ADUC_CancellationToken* cancellationToken)
+{
+    const ADUC::TimingSpan span{ "process_launch", command };
+
+    int outPipe[2];
+    int resultPipe[2];
+
+    if (pipe2(outPipe, O_CLOEXEC) != 0)
+    {
+        Log_Error("Cannot create output pipe. %s (errno %d).", strerror(errno), errno);
+        return -1;
+    }
+
+    if (pipe2(resultPipe, O_CLOEXEC) != 0)
+    {
+        Log_Error("Cannot create result pipe. %s (errno %d).", strerror(errno), errno);
+        close(outPipe[READ_END]);
+        close(outPipe[WRITE_END]);
+        return -1;
+    }
+
+    // Only reachable if the caller closed its standard streams.
+    if (resultPipe[WRITE_END] == ADUC_CHILD_PROCESS_RESULT_FD)
+    {
+        const int fd = fcntl(resultPipe[WRITE_END], F_DUPFD_CLOEXEC, ADUC_CHILD_PROCESS_RESULT_FD + 1);
+        close(resultPipe[WRITE_END]);
+        resultPipe[WRITE_END] = fd;
+    }
+
+    int controlFd = -1;
+    const pid_t pid = (resultPipe[WRITE_END] == -1) ? -1
+                                                    : SpawnChildProcess(
+                                                        command,
+                                                        args,
+                                                        outPipe[WRITE_END],
+                                                        outPipe[WRITE_END],
+                                                        cancellationToken != nullptr,
+                                                        &controlFd,
+                                                        resultPipe[WRITE_END]);
+
+    close(outPipe[WRITE_END]);
+    if (resultPipe[WRITE_END] != -1)
+    {
+        close(resultPipe[WRITE_END]);
+    }
+
+    if (pid == -1)
+    {
+        close(outPipe[READ_END]);
+        close(resultPipe[READ_END]);
+        return EXIT_FAILURE;
+    }
+
+    // The output, the result channel, and the cancellation token, if any. Negative fd values are ignored by poll().
+    struct pollfd fds[3] = { { outPipe[READ_END], POLLIN, 0 },
+                             { resultPipe[READ_END], POLLIN, 0 },
+                             { ADUC_CancellationToken_GetFd(cancellationToken), POLLIN, 0 } };
+    const size_t pipeCount = 2;
+    std::string line;
+    bool lineTooLong = false;
+    ChildTermination termination{ pid, cancellationToken != nullptr, controlFd };
+
+    while ((fds[0].fd >= 0 || fds[1].fd >= 0) && PollChildOutput(fds, pipeCount, &termination))
+    {
+        for (size_t i = 0; i < pipeCount; i++)
+        {
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+            {
+                continue;
+            }
+
+            char buffer[64 * 1024];
+            const ssize_t count = read(fds[i].fd, buffer, sizeof(buffer));
 
-    waitpid(pid, &wstatus, 0);
+            if (count == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (count <= 0)
+            {
+                if (count == -1)
+                {
+                    Log_Error("Read failed, error %d", errno);
+                }
+
+                // Negative fd values are ignored by poll().
+                fds[i].fd = -1;
+                continue;
+            }
+
+            if (i == 0)
+            {
+                output.append(buffer, static_cast<size_t>(count));
+                continue;
+            }
+
+            for (ssize_t j = 0; j < count; j++)
+            {
+                if (buffer[j] == '\n') // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+                {
+                    if (!lineTooLong)
+                    {
+                        resultLineCallback(line);
+                    }
+
+                    line.clear();
+                    lineTooLong = false;
+                    continue;
+                }
+
+                if (line.size() == ADUC_CHILD_PROCESS_MAX_RESULT_LINE_SIZE)
+                {
+                    Log_Warn("Result line of %s is too long, dropping it.", command.c_str());
+                    line.clear();
+                    lineTooLong = true;
+                }
+
+                if (!lineTooLong)
+                {
+                    line += buffer[j]; // NOLINT(cppcoreguidelines-pro-bounds-constant-array-index)
+                }
+            }
+        }
+    }
+
+    if (!termination.IsStarted() && !lineTooLong && !line.empty())
+    {
+        resultLineCallback(line);
+    }
+
+    const int childExitStatus = termination.Wait();
+
+    close(outPipe[READ_END]);
+    close(resultPipe[READ_END]);
+
+    return childExitStatus;
+}
+
+/**
+ * @brief Returns the exit status of a child process from its wait status.
+ *
+ * @param wstatus The wait status, from waitpid.
+ * @return The child process exit code, or the signal number if the child process was terminated by a signal.
+ */
+static int GetChildExitStatus(int wstatus)
+{
+    int childExitStatus;
 
     // Get the child process exit code.
     if (WIFEXITED(wstatus))
@@ -144,11 +1214,130 @@ int ADUC_LaunchChildProcess(const std::string& command, std::vector<std::string>
         Log_Error("Child process terminated abnormally.", childExitStatus);
     }
 
-    close(filedes[READ_END]);
-
     return childExitStatus;
 }
 
+/**
+ * @brief Waits for the child process to terminate and returns its exit status.
+ *
+ * @param pid The child process id.
+ * @return The child process exit code, or the signal number if the child process was terminated by a signal.
+ */
+static int WaitForChildExitStatus(pid_t pid)
+{
+    int wstatus = 0;
+
+    while (waitpid(pid, &wstatus, 0) == -1 && errno == EINTR)
+    {
+    }
+
+    const int exitStatus = GetChildExitStatus(wstatus);
+    ADUC_TRACEPOINT2(process_exit, static_cast<int>(pid), exitStatus);
+
+    return exitStatus;
+}
+
+/**
+ * @brief Waits for the launcher to write to the control channel @p fd, then terminates the process group of the
+ * calling process, see ADUC_StartChildProcessControlWatcher.
+ */
+static void WatchControlChannel(int fd)
+{
+    char request;
+    ssize_t count;
+
+    while ((count = read(fd, &request, 1)) == -1 && errno == EINTR)
+    {
+    }
+
+    // Closed: the launcher is done with this process, or is gone.
+    if (count != 1)
+    {
+        return;
+    }
+
+    Log_Info("Cancelled by the launcher, terminating process group %d", getpgrp());
+
+    // This process stays to kill the group if needed; it exits on its own once the processes it waits for exit.
+    signal(SIGTERM, SIG_IGN);
+    if (kill(0, SIGTERM) != 0)
+    {
+        Log_Warn("Cannot terminate process group %d. %s (errno %d).", getpgrp(), strerror(errno), errno);
+    }
+
+    usleep(ADUC_CHILD_PROCESS_TERMINATION_GRACE_MS * 1000);
+
+    Log_Warn("Process group %d didn't exit on SIGTERM, killing it", getpgrp());
+    kill(0, SIGKILL);
+}
+
+bool ADUC_StartChildProcessControlWatcher()
+{
+    const char* fdString = getenv(ADUC_CHILD_PROCESS_CONTROL_FD_ENV);
+    if (fdString == nullptr || atoi(fdString) != ADUC_CHILD_PROCESS_CONTROL_FD)
+    {
+        return false;
+    }
+
+    // The processes this one starts don't get the channel.
+    unsetenv(ADUC_CHILD_PROCESS_CONTROL_FD_ENV);
+    if (fcntl(ADUC_CHILD_PROCESS_CONTROL_FD, F_SETFD, FD_CLOEXEC) != 0)
+    {
+        return false;
+    }
+
+    // Only a process group leader was launched with a control channel; don't terminate the group of another process.
+    if (getpgrp() != getpid())
+    {
+        close(ADUC_CHILD_PROCESS_CONTROL_FD);
+        return false;
+    }
+
+    try
+    {
+        std::thread(WatchControlChannel, ADUC_CHILD_PROCESS_CONTROL_FD).detach();
+    }
+    catch (...)
+    {
+        Log_Warn("Cannot start the control channel watcher.");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Gives the calling thread, and the threads and processes it starts from now on, idle CPU and I/O priority
+ *        (SCHED_IDLE and the idle I/O scheduling class), so that they only use the CPU and storage the other work of
+ *        the device leaves unused. Unprivileged threads can't get their priority back, so call it on a thread of
+ *        its own.
+ *
+ * @return bool true if both priorities were set.
+ */
+bool ADUC_SetCurrentThreadIdlePriority()
+{
+    bool succeeded = true;
+
+    struct sched_param param = {};
+    const int status = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    if (status != 0)
+    {
+        Log_Warn("Cannot set the idle CPU priority. %s (errno %d).", strerror(status), status);
+        succeeded = false;
+    }
+
+    // Who 0 is the calling thread.
+    if (syscall(
+            SYS_ioprio_set, ADUC_IOPRIO_WHO_PROCESS, 0, ADUC_IOPRIO_CLASS_IDLE << ADUC_IOPRIO_CLASS_SHIFT)
+        != 0)
+    {
+        Log_Warn("Cannot set the idle I/O priority. %s (errno %d).", strerror(errno), errno);
+        succeeded = false;
+    }
+
+    return succeeded;
+}
+
 /**
  * @brief Ensure that the effective group of the process is the given group (or is root).
  * @remark This function is not thread-safe if called with the defaults for the optional args.
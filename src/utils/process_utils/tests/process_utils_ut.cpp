@@ -8,6 +8,12 @@
 #include <azure_c_shared_utility/strings.h>
 #include <azure_c_shared_utility/vector.h>
 #include <catch2/catch.hpp>
+#include <chrono>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
@@ -92,6 +98,231 @@ TEST_CASE("Invalid option - cp -1")
     CHECK_THAT(output.c_str(), Contains("invalid option -- '1'"));
 }
 
+TEST_CASE("Missing command")
+{
+    std::vector<std::string> args;
+    std::string output;
+    const int exitCode = ADUC_LaunchChildProcess("process_utils_ut_missing_command", args, output);
+
+    CHECK(exitCode == EXIT_FAILURE);
+    CHECK(output.empty());
+}
+
+TEST_CASE("Stream standard output separately from standard error")
+{
+    std::vector<std::string> args;
+    args.emplace_back("-1");
+    std::string streamedOutput;
+    std::string errorOutput;
+    const int exitCode = ADUC_LaunchChildProcess(
+        "cp",
+        args,
+        [&streamedOutput](const char* data, size_t size) -> bool {
+            streamedOutput.append(data, size);
+            return true;
+        },
+        errorOutput);
+
+    CHECK(exitCode != EXIT_SUCCESS);
+    CHECK(streamedOutput.empty());
+    CHECK_THAT(errorOutput.c_str(), Contains("invalid option -- '1'"));
+}
+
+TEST_CASE("Stream standard output")
+{
+    std::vector<std::string> args;
+    args.emplace_back("streamed output");
+    std::string streamedOutput;
+    std::string errorOutput;
+    const int exitCode = ADUC_LaunchChildProcess(
+        "echo",
+        args,
+        [&streamedOutput](const char* data, size_t size) -> bool {
+            streamedOutput.append(data, size);
+            return true;
+        },
+        errorOutput);
+
+    CHECK(exitCode == EXIT_SUCCESS);
+    CHECK(streamedOutput == "streamed output\n");
+    CHECK(errorOutput.empty());
+}
+
+TEST_CASE("Stream output lines")
+{
+    SECTION("Lines of standard output and standard error, and the end of the output")
+    {
+        std::vector<std::string> args{ "-c", "echo first; echo second >&2; printf 'no newline'" };
+        std::vector<std::string> lines;
+        std::string outputTail;
+        const int exitCode = ADUC_LaunchChildProcess(
+            "sh", args, [&lines](const std::string& line) { lines.emplace_back(line); }, 12, outputTail);
+
+        CHECK(exitCode == EXIT_SUCCESS);
+        REQUIRE(lines.size() == 3);
+        CHECK(lines[0] == "first");
+        CHECK(lines[1] == "second");
+        CHECK(lines[2] == "no newline");
+        CHECK(outputTail == "d\nno newline");
+    }
+
+    SECTION("Long lines are split")
+    {
+        std::vector<std::string> args{ "-c", "head -c 10000 /dev/zero | tr '\\0' x" };
+        std::vector<std::string> lines;
+        std::string outputTail;
+        const int exitCode = ADUC_LaunchChildProcess(
+            "sh", args, [&lines](const std::string& line) { lines.emplace_back(line); }, 1024, outputTail);
+
+        CHECK(exitCode == EXIT_SUCCESS);
+        REQUIRE(lines.size() == 3);
+        CHECK(lines[0].size() == ADUC_CHILD_PROCESS_MAX_LINE_SIZE);
+        CHECK(lines[2].size() == 10000 - 2 * ADUC_CHILD_PROCESS_MAX_LINE_SIZE);
+        CHECK(outputTail == std::string(1024, 'x'));
+    }
+}
+
+TEST_CASE("Result channel")
+{
+    SECTION("Results are separate from the output, and reach the children of the command")
+    {
+        std::vector<std::string> args{
+            "-c",
+            "echo output; echo '{\"resultCode\":700}' >&\"$ADUC_RESULT_FD\"; "
+            "sh -c 'printf last >&3'"
+        };
+        std::vector<std::string> lines;
+        std::string output;
+        const int exitCode = ADUC_LaunchChildProcessWithResultChannel(
+            "sh", args, output, [&lines](const std::string& line) { lines.emplace_back(line); });
+
+        CHECK(exitCode == EXIT_SUCCESS);
+        CHECK(output == "output\n");
+        CHECK(lines == std::vector<std::string>{ "{\"resultCode\":700}", "last" });
+    }
+
+    SECTION("Long lines are dropped")
+    {
+        std::vector<std::string> args{ "-c",
+                                       "{ head -c 100000 /dev/zero | tr '\\0' x; echo; echo short; } >&3" };
+        std::vector<std::string> lines;
+        std::string output;
+        const int exitCode = ADUC_LaunchChildProcessWithResultChannel(
+            "sh", args, output, [&lines](const std::string& line) { lines.emplace_back(line); });
+
+        CHECK(exitCode == EXIT_SUCCESS);
+        CHECK(lines == std::vector<std::string>{ "short" });
+    }
+}
+
+TEST_CASE("Cancel a child process")
+{
+    ADUC_CancellationToken* token = ADUC_CancellationToken_Create();
+    REQUIRE(token != nullptr);
+
+    // The shell waits for a child of its own, which must be terminated too, or the pipe stays open.
+    std::vector<std::string> args{ "-c", "echo started; sleep 60 & wait" };
+    std::string output;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::thread canceller{ [token]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 200 });
+        ADUC_CancellationToken_Cancel(token);
+    } };
+
+    const int exitCode = ADUC_LaunchChildProcess("sh", args, output, token);
+    canceller.join();
+
+    CHECK(exitCode == SIGTERM);
+    CHECK(output == "started\n");
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds{ 10 });
+
+    SECTION("A cancelled token terminates the next command right away")
+    {
+        std::string errorOutput;
+        const int streamExitCode = ADUC_LaunchChildProcess(
+            "sleep", { "60" }, [](const char*, size_t) { return true; }, errorOutput, token);
+        CHECK(streamExitCode == SIGTERM);
+    }
+
+    SECTION("A reset token doesn't")
+    {
+        ADUC_CancellationToken_Reset(token);
+
+        std::vector<std::string> lines;
+        std::string outputTail;
+        const int lineExitCode = ADUC_LaunchChildProcess(
+            "echo", { "done" }, [&lines](const std::string& line) { lines.emplace_back(line); }, 64, outputTail, token);
+        CHECK(lineExitCode == EXIT_SUCCESS);
+        CHECK(lines == std::vector<std::string>{ "done" });
+    }
+
+    ADUC_CancellationToken_Destroy(token);
+}
+
+TEST_CASE("Cancel a child process that ignores SIGTERM")
+{
+    ADUC_CancellationToken* token = ADUC_CancellationToken_Create();
+    REQUIRE(token != nullptr);
+
+    std::thread canceller{ [token]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 200 });
+        ADUC_CancellationToken_Cancel(token);
+    } };
+
+    const auto start = std::chrono::steady_clock::now();
+
+    SECTION("Its output is read until it's killed")
+    {
+        // Fills the pipe many times over, so the child would block writing if the output weren't read.
+        std::vector<std::string> args{ "-c", "trap '' TERM; while :; do echo flood; done" };
+        std::string outputTail;
+
+        const int exitCode = ADUC_LaunchChildProcess("sh", args, [](const std::string&) {}, 64, outputTail, token);
+
+        CHECK(exitCode == SIGKILL);
+    }
+
+    SECTION("It gets the cancellation on its control channel")
+    {
+        std::vector<std::string> args{ "-c",
+                                       "trap '' TERM; head -c 1 <&" + std::to_string(ADUC_CHILD_PROCESS_CONTROL_FD)
+                                           + " >/dev/null && echo control; sleep 60" };
+        std::string output;
+
+        const int exitCode = ADUC_LaunchChildProcess("sh", args, output, token);
+
+        CHECK(exitCode == SIGKILL);
+        CHECK(output == "control\n");
+    }
+
+    canceller.join();
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds{ 10 });
+
+    ADUC_CancellationToken_Destroy(token);
+}
+
+TEST_CASE("ADUC_SetCurrentThreadIdlePriority")
+{
+    int policy = -1;
+    long ioPriority = -1;
+    bool succeeded = false;
+
+    // On a thread of its own, since this one can't get its priority back.
+    std::thread idleThread{ [&]() {
+        succeeded = ADUC_SetCurrentThreadIdlePriority();
+
+        struct sched_param param = {};
+        pthread_getschedparam(pthread_self(), &policy, &param);
+        ioPriority = syscall(SYS_ioprio_get, 1 /* IOPRIO_WHO_PROCESS */, 0);
+    } };
+    idleThread.join();
+
+    CHECK(succeeded);
+    CHECK(policy == SCHED_IDLE);
+    CHECK((ioPriority >> 13) == 3 /* IOPRIO_CLASS_IDLE */);
+}
+
 TEST_CASE("VerifyProcessEffectiveGroup")
 {
     SECTION("it should return false when gegrnam returns nullptr and sets errno")
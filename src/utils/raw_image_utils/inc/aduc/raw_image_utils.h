@@ -0,0 +1,96 @@
+/**
+ * @file raw_image_utils.h
+ * @brief Utilities for writing a raw image, e.g. of a file system, to a partition.
+ *
+ * The image is read sequentially, so it may be a pipe the content downloader writes it into as it arrives, and it is
+ * hashed as it is read. It is written with O_DIRECT in large aligned blocks, so that flashing doesn't fill the page
+ * cache and is bound by the write speed of the device. Two kinds of images leave the blocks they don't describe
+ * unwritten:
+ *
+ * - Android sparse images, detected by their magic number, whose "don't care" chunks are skipped.
+ * - Raw images with a bmap file, as generated by bmaptool, whose unmapped blocks are skipped. Only the ImageSize,
+ *   BlockSize and Range elements of the bmap file are used.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_RAW_IMAGE_UTILS_H
+#define ADUC_RAW_IMAGE_UTILS_H
+
+#include <aduc/c_utils.h>
+#include <azure_c_shared_utility/sha.h> // for SHAversion
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The size of the blocks written to the target at once, in bytes.
+ */
+#ifndef ADUC_RAW_IMAGE_WRITE_BUFFER_SIZE
+#    define ADUC_RAW_IMAGE_WRITE_BUFFER_SIZE (4 * 1024 * 1024)
+#endif
+
+/**
+ * @brief The alignment of the offsets, lengths and buffers of O_DIRECT writes, in bytes. Writes that aren't aligned,
+ * e.g. the end of an image whose size isn't a multiple of it, go through the page cache instead.
+ */
+#define ADUC_RAW_IMAGE_DIRECT_IO_ALIGNMENT 4096
+
+/**
+ * @brief The magic number of Android sparse images, little-endian at the start of the image.
+ */
+#define ADUC_RAW_IMAGE_SPARSE_MAGIC 0xED26FF3A
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief What writing an image did.
+ */
+typedef struct tagADUC_RawImageStats
+{
+    uint64_t ImageBytes; /**< The bytes of the image read. */
+    uint64_t WrittenBytes; /**< The bytes written to the target. */
+    uint64_t SkippedBytes; /**< The bytes of the target left unwritten, e.g. the "don't care" chunks. */
+} ADUC_RawImageStats;
+
+/**
+ * @brief Writes the image @p imagePath to @p targetPath, and verifies the hash of the image.
+ *
+ * @param imagePath The image, a file or a pipe. Android sparse images are expanded.
+ * @param bmapPath An optional bmap file of the raw image @p imagePath, or NULL to write all of it.
+ * @param targetPath The partition, or file, to write the image to. Must exist; it isn't truncated. A block device
+ * is opened exclusively, and must not be in use, see ADUC_RawImage_WriteToDevice.
+ * @param hashBase64 The expected base64 encoded hash of @p imagePath, or NULL not to verify it.
+ * @param algorithm The algorithm of @p hashBase64.
+ * @param stats Optional output, what was written.
+ * @returns True if the image was written and synced, and matches @p hashBase64. On a hash mismatch, the image has
+ * been written nonetheless, so the target must not be used.
+ */
+_Bool ADUC_RawImage_Write(
+    const char* imagePath,
+    const char* bmapPath,
+    const char* targetPath,
+    const char* hashBase64,
+    SHAversion algorithm,
+    ADUC_RawImageStats* stats);
+
+/**
+ * @brief Writes the image @p imagePath to the block device @p devicePath, like ADUC_RawImage_Write, if the device isn't
+ * in use.
+ *
+ * The device is opened exclusively, so that it can't be mounted or claimed while it's written, and is checked once
+ * opened, so that replacing @p devicePath in between has no effect. It must not be mounted, used as swap, or held by
+ * another block device, e.g. a device-mapper, LVM or md device; for a whole disk, neither must any of its partitions.
+ *
+ * @returns True if the image was written and synced, and matches @p hashBase64.
+ */
+_Bool ADUC_RawImage_WriteToDevice(
+    const char* imagePath,
+    const char* bmapPath,
+    const char* devicePath,
+    const char* hashBase64,
+    SHAversion algorithm,
+    ADUC_RawImageStats* stats);
+
+EXTERN_C_END
+
+#endif // ADUC_RAW_IMAGE_UTILS_H
@@ -0,0 +1,1030 @@
+/**
+ * @file raw_image_utils.c
+ * @brief Implements writing a raw image to a partition.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef _GNU_SOURCE
+#    define _GNU_SOURCE // for O_DIRECT
+#endif
+
+#include "aduc/raw_image_utils.h"
+#include "aduc/hash_utils.h"
+#include "aduc/logging.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h> // for PRIu64
+#include <limits.h> // for PATH_MAX
+#include <linux/fs.h> // for BLKGETSIZE64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h> // for major, minor, makedev
+#include <unistd.h>
+
+/**
+ * @brief Size of the buffer the parts of the image that aren't written are read into, to be hashed.
+ */
+#define ADUC_RAW_IMAGE_SKIP_BUFFER_SIZE (256 * 1024)
+
+/**
+ * @brief The largest bmap file read.
+ */
+#define ADUC_RAW_IMAGE_MAX_BMAP_SIZE (16 * 1024 * 1024)
+
+/**
+ * @brief The sizes of the headers of Android sparse images, at least; the header gives the actual ones.
+ */
+#define SPARSE_FILE_HEADER_SIZE 28
+#define SPARSE_CHUNK_HEADER_SIZE 12
+
+/**
+ * @brief The chunk types of Android sparse images.
+ */
+#define SPARSE_CHUNK_RAW 0xCAC1
+#define SPARSE_CHUNK_FILL 0xCAC2
+#define SPARSE_CHUNK_DONT_CARE 0xCAC3
+#define SPARSE_CHUNK_CRC32 0xCAC4
+
+/**
+ * @brief Reads the image, hashing what is read.
+ */
+typedef struct tagADUC_RawImageReader
+{
+    int fd; /**< The image. */
+    ADUC_HashUtils_Context hashContext; /**< The hash of the image. */
+    _Bool hashing; /**< False not to hash the image. */
+    uint8_t pushback[SPARSE_FILE_HEADER_SIZE]; /**< The bytes read to detect the format, already hashed. */
+    size_t pushbackOffset; /**< The next byte of pushback to read. */
+    size_t pushbackLength; /**< The bytes in pushback. */
+    uint8_t* skipBuffer; /**< The buffer of ADUC_RAW_IMAGE_SKIP_BUFFER_SIZE bytes for Skip. */
+    ADUC_RawImageStats* stats; /**< Counts the bytes read. */
+} ADUC_RawImageReader;
+
+/**
+ * @brief Writes the target in large blocks, with O_DIRECT when they are aligned.
+ */
+typedef struct tagADUC_RawImageWriter
+{
+    int directFd; /**< The target opened with O_DIRECT, or -1 if its file system doesn't support it. */
+    int bufferedFd; /**< The target, for the writes that aren't aligned. */
+    uint64_t targetSize; /**< The size of the target partition, or 0 for a file, which can grow. */
+    uint8_t* buffer; /**< The aligned buffer of ADUC_RAW_IMAGE_WRITE_BUFFER_SIZE bytes. */
+    size_t length; /**< The bytes in buffer, not written yet. */
+    uint64_t offset; /**< The offset in the target of the start of buffer. */
+    ADUC_RawImageStats* stats; /**< Counts the bytes written. */
+} ADUC_RawImageWriter;
+
+/**
+ * @brief A range of blocks of a bmap file, first and last included.
+ */
+typedef struct tagADUC_BmapRange
+{
+    uint64_t first; /**< The first block. */
+    uint64_t last; /**< The last block. */
+} ADUC_BmapRange;
+
+/**
+ * @brief The mapped blocks of a raw image, read from its bmap file.
+ */
+typedef struct tagADUC_Bmap
+{
+    uint64_t imageSize; /**< The size of the image. */
+    uint64_t blockSize; /**< The size of the blocks. */
+    ADUC_BmapRange* ranges; /**< The mapped ranges, in order. */
+    size_t rangeCount; /**< The number of ranges. */
+} ADUC_Bmap;
+
+/**
+ * @brief Reads up to @p size bytes of the image file, and hashes them.
+ * @returns The number of bytes read, 0 at the end of the image, or -1 on error.
+ */
+static ssize_t ReadImage(ADUC_RawImageReader* reader, uint8_t* buffer, size_t size)
+{
+    ssize_t readSize;
+
+    do
+    {
+        readSize = read(reader->fd, buffer, size);
+    } while (readSize == -1 && errno == EINTR);
+
+    if (readSize == -1)
+    {
+        Log_Error("Cannot read the image, errno: %d", errno);
+        return -1;
+    }
+
+    if (reader->hashing && !ADUC_HashUtils_ContextInput(&reader->hashContext, buffer, (size_t)readSize))
+    {
+        return -1;
+    }
+
+    reader->stats->ImageBytes += (uint64_t)readSize;
+    return readSize;
+}
+
+/**
+ * @brief Reads up to @p size bytes of the image, from the pushback first.
+ * @returns The number of bytes read, 0 at the end of the image, or -1 on error.
+ */
+static ssize_t ReadSome(ADUC_RawImageReader* reader, uint8_t* buffer, size_t size)
+{
+    if (reader->pushbackOffset < reader->pushbackLength)
+    {
+        const size_t available = reader->pushbackLength - reader->pushbackOffset;
+        const size_t length = (size < available) ? size : available;
+
+        memcpy(buffer, reader->pushback + reader->pushbackOffset, length);
+        reader->pushbackOffset += length;
+        return (ssize_t)length;
+    }
+
+    return ReadImage(reader, buffer, size);
+}
+
+/**
+ * @brief Reads exactly @p size bytes of the image.
+ * @returns False on error, or if the image ends before.
+ */
+static _Bool ReadFully(ADUC_RawImageReader* reader, uint8_t* buffer, size_t size)
+{
+    while (size > 0)
+    {
+        const ssize_t readSize = ReadSome(reader, buffer, size);
+        if (readSize <= 0)
+        {
+            if (readSize == 0)
+            {
+                Log_Error("The image is truncated.");
+            }
+
+            return false;
+        }
+
+        buffer += readSize;
+        size -= (size_t)readSize;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Reads and hashes @p size bytes of the image, or up to its end if @p size is UINT64_MAX, without writing them.
+ * @returns False on error, or if the image ends before @p size bytes.
+ */
+static _Bool Skip(ADUC_RawImageReader* reader, uint64_t size)
+{
+    while (size > 0)
+    {
+        const size_t length = (size > ADUC_RAW_IMAGE_SKIP_BUFFER_SIZE) ? ADUC_RAW_IMAGE_SKIP_BUFFER_SIZE : (size_t)size;
+        const ssize_t readSize = ReadSome(reader, reader->skipBuffer, length);
+
+        if (readSize == 0 && size == UINT64_MAX)
+        {
+            return true;
+        }
+
+        if (readSize <= 0)
+        {
+            if (readSize == 0)
+            {
+                Log_Error("The image is truncated.");
+            }
+
+            return false;
+        }
+
+        if (size != UINT64_MAX)
+        {
+            size -= (uint64_t)readSize;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Writes all of @p buffer at @p offset of @p fd.
+ * @returns False on error, with errno set.
+ */
+static _Bool WriteAt(int fd, const uint8_t* buffer, size_t size, uint64_t offset)
+{
+    while (size > 0)
+    {
+        const ssize_t writtenSize = pwrite(fd, buffer, size, (off_t)offset);
+        if (writtenSize == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (writtenSize <= 0)
+        {
+            if (writtenSize == 0)
+            {
+                errno = ENOSPC;
+            }
+
+            return false;
+        }
+
+        buffer += writtenSize;
+        size -= (size_t)writtenSize;
+        offset += (uint64_t)writtenSize;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Writes the bytes in the buffer of @p writer to the target: the aligned part with O_DIRECT, the rest through
+ * the page cache.
+ * @returns True on success.
+ */
+static _Bool Flush(ADUC_RawImageWriter* writer)
+{
+    size_t directLength = 0;
+
+    if (writer->length == 0)
+    {
+        return true;
+    }
+
+    if (writer->targetSize != 0 && writer->offset + writer->length > writer->targetSize)
+    {
+        Log_Error("The image is larger than the target, %" PRIu64 " bytes.", writer->targetSize);
+        return false;
+    }
+
+    if (writer->directFd != -1 && writer->offset % ADUC_RAW_IMAGE_DIRECT_IO_ALIGNMENT == 0)
+    {
+        directLength = writer->length - writer->length % ADUC_RAW_IMAGE_DIRECT_IO_ALIGNMENT;
+    }
+
+    if (directLength > 0 && !WriteAt(writer->directFd, writer->buffer, directLength, writer->offset))
+    {
+        Log_Error("Cannot write the target, errno: %d", errno);
+        return false;
+    }
+
+    if (writer->length > directLength
+        && !WriteAt(
+            writer->bufferedFd,
+            writer->buffer + directLength,
+            writer->length - directLength,
+            writer->offset + directLength))
+    {
+        Log_Error("Cannot write the target, errno: %d", errno);
+        return false;
+    }
+
+    writer->stats->WrittenBytes += writer->length;
+    writer->offset += writer->length;
+    writer->length = 0;
+    return true;
+}
+
+/**
+ * @brief Makes the buffer of @p writer continue at @p offset of the target, writing what it holds if it doesn't.
+ * @returns True on success.
+ */
+static _Bool Seek(ADUC_RawImageWriter* writer, uint64_t offset)
+{
+    if (writer->offset + writer->length == offset)
+    {
+        return true;
+    }
+
+    if (!Flush(writer))
+    {
+        return false;
+    }
+
+    writer->offset = offset;
+    return true;
+}
+
+/**
+ * @brief Copies @p size bytes of the image to @p offset of the target, reading them straight into the write buffer.
+ * @returns True on success.
+ */
+static _Bool CopyData(ADUC_RawImageReader* reader, ADUC_RawImageWriter* writer, uint64_t offset, uint64_t size)
+{
+    if (!Seek(writer, offset))
+    {
+        return false;
+    }
+
+    while (size > 0)
+    {
+        const size_t space = ADUC_RAW_IMAGE_WRITE_BUFFER_SIZE - writer->length;
+        const size_t length = (size > space) ? space : (size_t)size;
+
+        if (!ReadFully(reader, writer->buffer + writer->length, length))
+        {
+            return false;
+        }
+
+        writer->length += length;
+        size -= length;
+
+        if (writer->length == ADUC_RAW_IMAGE_WRITE_BUFFER_SIZE && !Flush(writer))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Fills @p size bytes at @p offset of the target with the repeated 4 bytes of @p fill.
+ * @returns True on success.
+ */
+static _Bool FillData(ADUC_RawImageWriter* writer, uint64_t offset, uint64_t size, const uint8_t fill[4])
+{
+    const _Bool sameBytes = fill[0] == fill[1] && fill[0] == fill[2] && fill[0] == fill[3];
+
+    if (!Seek(writer, offset))
+    {
+        return false;
+    }
+
+    while (size > 0)
+    {
+        const size_t space = ADUC_RAW_IMAGE_WRITE_BUFFER_SIZE - writer->length;
+        const size_t length = (size > space) ? space : (size_t)size;
+        uint8_t* data = writer->buffer + writer->length;
+
+        if (sameBytes)
+        {
+            memset(data, fill[0], length);
+        }
+        else
+        {
+            // Fill chunks start on a block, so the pattern is aligned on the target offset.
+            for (size_t i = 0; i < length; ++i)
+            {
+                data[i] = fill[(writer->offset + writer->length + i) % 4];
+            }
+        }
+
+        writer->length += length;
+        size -= length;
+
+        if (writer->length == ADUC_RAW_IMAGE_WRITE_BUFFER_SIZE && !Flush(writer))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Reads a little-endian unsigned integer of @p size bytes at @p bytes.
+ */
+static uint64_t GetLittleEndian(const uint8_t* bytes, size_t size)
+{
+    uint64_t value = 0;
+
+    for (size_t i = size; i > 0; --i)
+    {
+        value = (value << 8) | bytes[i - 1];
+    }
+
+    return value;
+}
+
+/**
+ * @brief Writes the Android sparse image whose file header is in the pushback of @p reader.
+ * @returns True on success.
+ */
+static _Bool WriteSparseImage(ADUC_RawImageReader* reader, ADUC_RawImageWriter* writer)
+{
+    uint8_t header[SPARSE_FILE_HEADER_SIZE];
+    uint8_t chunkHeader[SPARSE_CHUNK_HEADER_SIZE];
+    uint64_t offset = 0;
+
+    if (!ReadFully(reader, header, sizeof(header)))
+    {
+        return false;
+    }
+
+    const uint64_t majorVersion = GetLittleEndian(header + 4, 2);
+    const uint64_t fileHeaderSize = GetLittleEndian(header + 8, 2);
+    const uint64_t chunkHeaderSize = GetLittleEndian(header + 10, 2);
+    const uint64_t blockSize = GetLittleEndian(header + 12, 4);
+    const uint64_t blockCount = GetLittleEndian(header + 16, 4);
+    const uint64_t chunkCount = GetLittleEndian(header + 20, 4);
+
+    if (majorVersion != 1 || fileHeaderSize < SPARSE_FILE_HEADER_SIZE || chunkHeaderSize < SPARSE_CHUNK_HEADER_SIZE
+        || blockSize == 0 || blockSize % 4 != 0)
+    {
+        Log_Error("Unsupported sparse image, version: %" PRIu64 ", block size: %" PRIu64, majorVersion, blockSize);
+        return false;
+    }
+
+    if (!Skip(reader, fileHeaderSize - SPARSE_FILE_HEADER_SIZE))
+    {
+        return false;
+    }
+
+    for (uint64_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        uint8_t fill[4];
+
+        if (!ReadFully(reader, chunkHeader, sizeof(chunkHeader))
+            || !Skip(reader, chunkHeaderSize - SPARSE_CHUNK_HEADER_SIZE))
+        {
+            return false;
+        }
+
+        const uint64_t chunkType = GetLittleEndian(chunkHeader, 2);
+        const uint64_t chunkSize = GetLittleEndian(chunkHeader + 4, 4) * blockSize;
+        const uint64_t dataSize = GetLittleEndian(chunkHeader + 8, 4) - chunkHeaderSize;
+        _Bool success = false;
+
+        switch (chunkType)
+        {
+        case SPARSE_CHUNK_RAW:
+            success = dataSize == chunkSize && CopyData(reader, writer, offset, chunkSize);
+            break;
+
+        case SPARSE_CHUNK_FILL:
+            success = dataSize == sizeof(fill) && ReadFully(reader, fill, sizeof(fill))
+                && FillData(writer, offset, chunkSize, fill);
+            break;
+
+        case SPARSE_CHUNK_DONT_CARE:
+            success = dataSize == 0;
+            writer->stats->SkippedBytes += chunkSize;
+            break;
+
+        case SPARSE_CHUNK_CRC32:
+            // The image hash covers the content.
+            success = dataSize == 4 && Skip(reader, dataSize);
+            break;
+
+        default:
+            break;
+        }
+
+        if (!success)
+        {
+            Log_Error("Invalid sparse image chunk %" PRIu64 ", type: 0x%" PRIx64, chunk, chunkType);
+            return false;
+        }
+
+        offset += chunkSize;
+    }
+
+    if (offset != blockCount * blockSize)
+    {
+        Log_Error("The sparse image chunks cover %" PRIu64 " bytes, not %" PRIu64, offset, blockCount * blockSize);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Gets the number in the element @p name of the bmap file @p bmapText.
+ * @returns False if there is no such element, or it isn't a number.
+ */
+static _Bool GetBmapNumber(const char* bmapText, const char* name, uint64_t* value)
+{
+    char* end = NULL;
+    const char* element = strstr(bmapText, name);
+
+    if (element == NULL)
+    {
+        return false;
+    }
+
+    errno = 0;
+    *value = strtoull(element + strlen(name), &end, 10);
+    return errno == 0 && end != element + strlen(name);
+}
+
+/**
+ * @brief Reads the ImageSize, BlockSize and Range elements of the bmap file @p bmapPath into @p bmap.
+ * @returns True if the bmap file is valid, and its ranges are in order.
+ */
+static _Bool ReadBmap(const char* bmapPath, ADUC_Bmap* bmap)
+{
+    _Bool success = false;
+    char* bmapText = NULL;
+    size_t bmapSize = 0;
+    size_t capacity = 0;
+    FILE* file = fopen(bmapPath, "r");
+
+    if (file == NULL)
+    {
+        Log_Error("Cannot open the bmap file %s, errno: %d", bmapPath, errno);
+        goto done;
+    }
+
+    bmapText = malloc(ADUC_RAW_IMAGE_MAX_BMAP_SIZE + 1);
+    if (bmapText == NULL)
+    {
+        goto done;
+    }
+
+    bmapSize = fread(bmapText, 1, ADUC_RAW_IMAGE_MAX_BMAP_SIZE, file);
+    bmapText[bmapSize] = '\0';
+
+    if (!GetBmapNumber(bmapText, "<ImageSize>", &bmap->imageSize)
+        || !GetBmapNumber(bmapText, "<BlockSize>", &bmap->blockSize) || bmap->blockSize == 0)
+    {
+        Log_Error("The bmap file %s has no ImageSize or BlockSize.", bmapPath);
+        goto done;
+    }
+
+    for (const char* range = strstr(bmapText, "<Range"); range != NULL; range = strstr(range, "<Range"))
+    {
+        ADUC_BmapRange parsed;
+        char* end = NULL;
+
+        range = strchr(range, '>');
+        if (range == NULL)
+        {
+            break;
+        }
+
+        // "<Range chksum="..."> first-last </Range>", or "> block </Range>" for a single block.
+        parsed.first = strtoull(range + 1, &end, 10);
+        parsed.last = parsed.first;
+        if (end == range + 1)
+        {
+            break;
+        }
+
+        if (*end == '-')
+        {
+            const char* lastStart = end + 1;
+            parsed.last = strtoull(lastStart, &end, 10);
+            if (end == lastStart)
+            {
+                break;
+            }
+        }
+
+        if (parsed.last < parsed.first || parsed.first * bmap->blockSize >= bmap->imageSize
+            || (bmap->rangeCount > 0 && parsed.first <= bmap->ranges[bmap->rangeCount - 1].last))
+        {
+            Log_Error("Invalid or out of order bmap range %" PRIu64 "-%" PRIu64, parsed.first, parsed.last);
+            goto done;
+        }
+
+        if (bmap->rangeCount == capacity)
+        {
+            capacity = (capacity == 0) ? 64 : capacity * 2;
+            ADUC_BmapRange* ranges = realloc(bmap->ranges, capacity * sizeof(*ranges));
+            if (ranges == NULL)
+            {
+                goto done;
+            }
+
+            bmap->ranges = ranges;
+        }
+
+        bmap->ranges[bmap->rangeCount++] = parsed;
+        range = end;
+    }
+
+    success = true;
+
+done:
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+
+    free(bmapText);
+    return success;
+}
+
+/**
+ * @brief Writes the mapped blocks of the raw image @p reader described by @p bmap, reading the others to hash them.
+ * @returns True on success.
+ */
+static _Bool WriteMappedImage(ADUC_RawImageReader* reader, ADUC_RawImageWriter* writer, const ADUC_Bmap* bmap)
+{
+    uint64_t offset = 0;
+
+    for (size_t i = 0; i < bmap->rangeCount; ++i)
+    {
+        const uint64_t start = bmap->ranges[i].first * bmap->blockSize;
+        const uint64_t end = ((bmap->ranges[i].last + 1) * bmap->blockSize < bmap->imageSize)
+            ? (bmap->ranges[i].last + 1) * bmap->blockSize
+            : bmap->imageSize;
+
+        if (!Skip(reader, start - offset) || !CopyData(reader, writer, start, end - start))
+        {
+            return false;
+        }
+
+        writer->stats->SkippedBytes += start - offset;
+        offset = end;
+    }
+
+    writer->stats->SkippedBytes += bmap->imageSize - offset;
+    return Skip(reader, bmap->imageSize - offset);
+}
+
+/**
+ * @brief Writes the raw image @p reader entirely.
+ * @returns True on success.
+ */
+static _Bool WriteWholeImage(ADUC_RawImageReader* reader, ADUC_RawImageWriter* writer)
+{
+    for (;;)
+    {
+        const ssize_t readSize = ReadSome(
+            reader, writer->buffer + writer->length, ADUC_RAW_IMAGE_WRITE_BUFFER_SIZE - writer->length);
+
+        if (readSize <= 0)
+        {
+            return readSize == 0;
+        }
+
+        writer->length += (size_t)readSize;
+
+        if (writer->length == ADUC_RAW_IMAGE_WRITE_BUFFER_SIZE && !Flush(writer))
+        {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Returns whether the block device @p dev is mounted.
+ */
+static _Bool IsMounted(dev_t dev)
+{
+    _Bool mounted = false;
+    char* line = NULL;
+    size_t lineSize = 0;
+    unsigned int devMajor = 0;
+    unsigned int devMinor = 0;
+    FILE* mountInfo = fopen("/proc/self/mountinfo", "r");
+
+    // The third field of each mount is the "major:minor" of its device.
+    while (mountInfo != NULL && !mounted && getline(&line, &lineSize, mountInfo) != -1)
+    {
+        mounted = sscanf(line, "%*s %*s %u:%u", &devMajor, &devMinor) == 2 && makedev(devMajor, devMinor) == dev;
+    }
+
+    if (mountInfo != NULL)
+    {
+        fclose(mountInfo);
+    }
+
+    free(line);
+    return mounted;
+}
+
+/**
+ * @brief Returns whether the block device @p dev is used as swap.
+ */
+static _Bool IsSwap(dev_t dev)
+{
+    _Bool swap = false;
+    char* line = NULL;
+    size_t lineSize = 0;
+    char swapPath[PATH_MAX];
+    struct stat st;
+    FILE* swaps = fopen("/proc/swaps", "r");
+
+    // The first field of each swap area, after the heading, is its path.
+    while (swaps != NULL && !swap && getline(&line, &lineSize, swaps) != -1)
+    {
+        swap = sscanf(line, "%4095s", swapPath) == 1 && stat(swapPath, &st) == 0 && S_ISBLK(st.st_mode)
+            && st.st_rdev == dev;
+    }
+
+    if (swaps != NULL)
+    {
+        fclose(swaps);
+    }
+
+    free(line);
+    return swap;
+}
+
+/**
+ * @brief Returns whether the sysfs directory @p sysPath of a block device has holders, e.g. device-mapper, LVM or md
+ * devices built on it.
+ */
+static _Bool HasHolders(const char* sysPath)
+{
+    _Bool holders = false;
+    char holdersPath[PATH_MAX];
+    DIR* dir = NULL;
+    const struct dirent* entry = NULL;
+
+    if (snprintf(holdersPath, sizeof(holdersPath), "%s/holders", sysPath) >= (int)sizeof(holdersPath))
+    {
+        return true;
+    }
+
+    dir = opendir(holdersPath);
+    while (dir != NULL && !holders && (entry = readdir(dir)) != NULL)
+    {
+        holders = strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+    }
+
+    if (dir != NULL)
+    {
+        closedir(dir);
+    }
+
+    return holders;
+}
+
+/**
+ * @brief Returns whether the block device @p dev is in use: mounted, used as swap, or held by another block device.
+ * For a whole disk, the same goes for its partitions.
+ */
+static _Bool IsBlockDeviceInUse(dev_t dev)
+{
+    _Bool inUse = false;
+    char sysPath[64];
+    char partitionPath[PATH_MAX];
+    DIR* dir = NULL;
+    const struct dirent* entry = NULL;
+    struct stat st;
+
+    (void)snprintf(sysPath, sizeof(sysPath), "/sys/dev/block/%u:%u", major(dev), minor(dev));
+
+    if (IsMounted(dev) || IsSwap(dev) || HasHolders(sysPath))
+    {
+        return true;
+    }
+
+    // The partitions of a disk are the subdirectories with a "partition" file.
+    dir = opendir(sysPath);
+    while (dir != NULL && !inUse && (entry = readdir(dir)) != NULL)
+    {
+        unsigned int partitionMajor = 0;
+        unsigned int partitionMinor = 0;
+        FILE* devFile = NULL;
+
+        if (entry->d_name[0] == '.'
+            || snprintf(partitionPath, sizeof(partitionPath), "%s/%s/partition", sysPath, entry->d_name)
+                >= (int)sizeof(partitionPath)
+            || stat(partitionPath, &st) != 0)
+        {
+            continue;
+        }
+
+        (void)snprintf(partitionPath, sizeof(partitionPath), "%s/%s/dev", sysPath, entry->d_name);
+        devFile = fopen(partitionPath, "r");
+
+        // A partition that can't be checked counts as in use.
+        inUse = devFile == NULL || fscanf(devFile, "%u:%u", &partitionMajor, &partitionMinor) != 2;
+
+        if (!inUse)
+        {
+            const dev_t partition = makedev(partitionMajor, partitionMinor);
+            (void)snprintf(partitionPath, sizeof(partitionPath), "%s/%s", sysPath, entry->d_name);
+            inUse = IsMounted(partition) || IsSwap(partition) || HasHolders(partitionPath);
+        }
+
+        if (devFile != NULL)
+        {
+            fclose(devFile);
+        }
+    }
+
+    if (dir != NULL)
+    {
+        closedir(dir);
+    }
+
+    return inUse;
+}
+
+/**
+ * @brief Opens the target @p targetPath for @p writer, with O_DIRECT if its file system supports it.
+ *
+ * A block device is opened exclusively, so that it can't be mounted or claimed while it's written, and the device
+ * opened is checked, so that replacing @p targetPath in between has no effect.
+ *
+ * @param deviceOnly Whether @p targetPath must be a block device.
+ * @returns True on success.
+ */
+static _Bool OpenTarget(const char* targetPath, _Bool deviceOnly, ADUC_RawImageWriter* writer)
+{
+    struct stat st;
+    char fdPath[32];
+
+    // O_EXCL without O_CREAT claims a block device exclusively, failing with EBUSY if e.g. it's mounted, used as swap,
+    // or a member of a device-mapper or md device. It has no effect on other files.
+    writer->bufferedFd = open(targetPath, O_WRONLY | O_CLOEXEC | O_EXCL);
+    if (writer->bufferedFd == -1 || fstat(writer->bufferedFd, &st) != 0)
+    {
+        Log_Error("Cannot open the target %s, errno: %d", targetPath, errno);
+        return false;
+    }
+
+    if (deviceOnly && !S_ISBLK(st.st_mode))
+    {
+        Log_Error("The target %s is not a block device.", targetPath);
+        return false;
+    }
+
+    // The exclusive claim doesn't cover a whole disk with partitions in use.
+    if (S_ISBLK(st.st_mode) && IsBlockDeviceInUse(st.st_rdev))
+    {
+        Log_Error("The target %s, or one of its partitions, is in use.", targetPath);
+        return false;
+    }
+
+    if (S_ISBLK(st.st_mode) && ioctl(writer->bufferedFd, BLKGETSIZE64, &writer->targetSize) != 0)
+    {
+        Log_Error("Cannot get the size of the target %s, errno: %d", targetPath, errno);
+        return false;
+    }
+
+    // Reopens the same file, rather than whatever targetPath is now. e.g. tmpfs doesn't support O_DIRECT.
+    (void)snprintf(fdPath, sizeof(fdPath), "/proc/self/fd/%d", writer->bufferedFd);
+    writer->directFd = open(fdPath, O_WRONLY | O_CLOEXEC | O_DIRECT);
+    if (writer->directFd == -1)
+    {
+        Log_Info("Writing %s through the page cache, errno: %d", targetPath, errno);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Implements ADUC_RawImage_Write and ADUC_RawImage_WriteToDevice.
+ * @param deviceOnly Whether @p targetPath must be a block device.
+ */
+static _Bool WriteImage(
+    const char* imagePath,
+    const char* bmapPath,
+    const char* targetPath,
+    _Bool deviceOnly,
+    const char* hashBase64,
+    SHAversion algorithm,
+    ADUC_RawImageStats* stats)
+{
+    _Bool success = false;
+    ADUC_RawImageStats localStats = { 0 };
+    ADUC_RawImageReader reader = { .fd = -1, .hashContext = { .evpContext = NULL } };
+    ADUC_RawImageWriter writer = { .directFd = -1, .bufferedFd = -1 };
+    ADUC_Bmap bmap = { 0 };
+    ssize_t headerSize = 0;
+
+    if (imagePath == NULL || targetPath == NULL)
+    {
+        goto done;
+    }
+
+    reader.stats = (stats != NULL) ? stats : &localStats;
+    writer.stats = reader.stats;
+    memset(reader.stats, 0, sizeof(*reader.stats));
+
+    if (bmapPath != NULL && !ReadBmap(bmapPath, &bmap))
+    {
+        goto done;
+    }
+
+    reader.hashing = hashBase64 != NULL;
+    if (reader.hashing && !ADUC_HashUtils_ContextReset(&reader.hashContext, algorithm))
+    {
+        goto done;
+    }
+
+    reader.skipBuffer = malloc(ADUC_RAW_IMAGE_SKIP_BUFFER_SIZE);
+    if (reader.skipBuffer == NULL
+        || posix_memalign((void**)&writer.buffer, ADUC_RAW_IMAGE_DIRECT_IO_ALIGNMENT, ADUC_RAW_IMAGE_WRITE_BUFFER_SIZE)
+            != 0)
+    {
+        Log_Error("Cannot allocate the image buffers.");
+        writer.buffer = NULL;
+        goto done;
+    }
+
+    reader.fd = open(imagePath, O_RDONLY | O_CLOEXEC);
+    if (reader.fd == -1)
+    {
+        Log_Error("Cannot open the image %s, errno: %d", imagePath, errno);
+        goto done;
+    }
+
+    (void)posix_fadvise(reader.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (!OpenTarget(targetPath, deviceOnly, &writer))
+    {
+        goto done;
+    }
+
+    // Reads the start of the image into the pushback, to tell the format.
+    while (reader.pushbackLength < sizeof(reader.pushback)
+           && (headerSize = ReadImage(
+                   &reader, reader.pushback + reader.pushbackLength, sizeof(reader.pushback) - reader.pushbackLength))
+               > 0)
+    {
+        reader.pushbackLength += (size_t)headerSize;
+    }
+
+    if (headerSize == -1)
+    {
+        goto done;
+    }
+
+    if (reader.pushbackLength == sizeof(reader.pushback)
+        && GetLittleEndian(reader.pushback, 4) == ADUC_RAW_IMAGE_SPARSE_MAGIC)
+    {
+        Log_Info("Writing the sparse image %s to %s", imagePath, targetPath);
+        success = WriteSparseImage(&reader, &writer);
+    }
+    else if (bmapPath != NULL)
+    {
+        Log_Info("Writing the mapped blocks of %s to %s", imagePath, targetPath);
+        success = WriteMappedImage(&reader, &writer, &bmap);
+    }
+    else
+    {
+        Log_Info("Writing the image %s to %s", imagePath, targetPath);
+        success = WriteWholeImage(&reader, &writer);
+    }
+
+    // The hash covers the whole image, e.g. data past the end of a sparse image.
+    success = success && Skip(&reader, UINT64_MAX) && Flush(&writer);
+
+    if (success && (fdatasync(writer.bufferedFd) != 0 || (writer.directFd != -1 && fdatasync(writer.directFd) != 0)))
+    {
+        Log_Error("Cannot sync the target %s, errno: %d", targetPath, errno);
+        success = false;
+    }
+
+    if (success && reader.hashing && !ADUC_HashUtils_ContextResult(&reader.hashContext, hashBase64, NULL))
+    {
+        Log_Error("The image %s doesn't match its hash.", imagePath);
+        success = false;
+    }
+
+    if (success)
+    {
+        Log_Info(
+            "Wrote %" PRIu64 " bytes of %s, skipped %" PRIu64 " bytes, of a %" PRIu64 " bytes image.",
+            reader.stats->WrittenBytes,
+            targetPath,
+            reader.stats->SkippedBytes,
+            reader.stats->ImageBytes);
+    }
+
+done:
+    ADUC_HashUtils_ContextUnInit(&reader.hashContext);
+
+    if (reader.fd != -1)
+    {
+        close(reader.fd);
+    }
+
+    if (writer.directFd != -1)
+    {
+        close(writer.directFd);
+    }
+
+    if (writer.bufferedFd != -1)
+    {
+        close(writer.bufferedFd);
+    }
+
+    free(reader.skipBuffer);
+    free(writer.buffer);
+    free(bmap.ranges);
+    return success;
+}
+
+_Bool ADUC_RawImage_Write(
+    const char* imagePath,
+    const char* bmapPath,
+    const char* targetPath,
+    const char* hashBase64,
+    SHAversion algorithm,
+    ADUC_RawImageStats* stats)
+{
+    return WriteImage(imagePath, bmapPath, targetPath, false, hashBase64, algorithm, stats);
+}
+
+_Bool ADUC_RawImage_WriteToDevice(
+    const char* imagePath,
+    const char* bmapPath,
+    const char* devicePath,
+    const char* hashBase64,
+    SHAversion algorithm,
+    ADUC_RawImageStats* stats)
+{
+    return WriteImage(imagePath, bmapPath, devicePath, true, hashBase64, algorithm, stats);
+}
@@ -0,0 +1,235 @@
+/**
+ * @file raw_image_utils_ut.cpp
+ * @brief Unit Tests for raw_image_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+
+#include "aduc/hash_utils.h"
+#include "aduc/raw_image_utils.h"
+#include "aduc/system_utils.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h> // for mkfifo
+#include <thread>
+
+// The block size of the test images; a multiple of the O_DIRECT alignment so that it is used, when supported.
+static const size_t BlockSize = ADUC_RAW_IMAGE_DIRECT_IO_ALIGNMENT;
+
+/**
+ * @brief Builds an Android sparse image in memory.
+ */
+class SparseImageBuilder
+{
+public:
+    SparseImageBuilder& Raw(const std::string& data)
+    {
+        AppendChunkHeader(0xCAC1, data.size() / BlockSize, data.size());
+        _chunks.append(data);
+        return *this;
+    }
+
+    SparseImageBuilder& Fill(uint32_t blocks, uint32_t fill)
+    {
+        AppendChunkHeader(0xCAC2, blocks, 4);
+        AppendLittleEndian(_chunks, fill, 4);
+        return *this;
+    }
+
+    SparseImageBuilder& DontCare(uint32_t blocks)
+    {
+        AppendChunkHeader(0xCAC3, blocks, 0);
+        return *this;
+    }
+
+    SparseImageBuilder& Crc32()
+    {
+        AppendChunkHeader(0xCAC4, 0, 4);
+        AppendLittleEndian(_chunks, 0, 4);
+        return *this;
+    }
+
+    std::string str() const
+    {
+        std::string image;
+        AppendLittleEndian(image, ADUC_RAW_IMAGE_SPARSE_MAGIC, 4);
+        AppendLittleEndian(image, 1, 2); // major version
+        AppendLittleEndian(image, 0, 2); // minor version
+        AppendLittleEndian(image, 28, 2); // file header size
+        AppendLittleEndian(image, 12, 2); // chunk header size
+        AppendLittleEndian(image, BlockSize, 4);
+        AppendLittleEndian(image, _blockCount, 4);
+        AppendLittleEndian(image, _chunkCount, 4);
+        AppendLittleEndian(image, 0, 4); // checksum
+        return image + _chunks;
+    }
+
+private:
+    void AppendChunkHeader(uint16_t type, uint32_t blocks, size_t dataSize)
+    {
+        AppendLittleEndian(_chunks, type, 2);
+        AppendLittleEndian(_chunks, 0, 2);
+        AppendLittleEndian(_chunks, blocks, 4);
+        AppendLittleEndian(_chunks, 12 + dataSize, 4);
+        _blockCount += blocks;
+        ++_chunkCount;
+    }
+
+    static void AppendLittleEndian(std::string& out, uint64_t value, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    }
+
+    std::string _chunks;
+    uint32_t _blockCount = 0;
+    uint32_t _chunkCount = 0;
+};
+
+static void WriteFile(const std::string& path, const std::string& content)
+{
+    std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+    file << content;
+}
+
+static std::string ReadFile(const std::string& path)
+{
+    std::ifstream file{ path, std::ios::binary };
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+static std::string GetSha256(const std::string& path)
+{
+    char* hash = nullptr;
+    REQUIRE(ADUC_HashUtils_GetFileHash(path.c_str(), SHA256, &hash));
+    std::string result{ hash };
+    free(hash); // NOLINT(cppcoreguidelines-no-malloc)
+    return result;
+}
+
+static std::string Blocks(size_t count, char c)
+{
+    return std::string(count * BlockSize, c);
+}
+
+TEST_CASE("ADUC_RawImage_Write")
+{
+    const std::string testFolder{ std::string{ ADUC_SystemUtils_GetTemporaryPathName() } + "/raw_image_utils_ut" };
+    const std::string imagePath{ testFolder + "/image" };
+    const std::string bmapPath{ testFolder + "/image.bmap" };
+    const std::string targetPath{ testFolder + "/target" };
+    ADUC_RawImageStats stats{};
+
+    ADUC_SystemUtils_RmDirRecursive(testFolder.c_str());
+    REQUIRE(ADUC_SystemUtils_MkDirRecursiveDefault(testFolder.c_str()) == 0);
+
+    // The target is bigger than the images, and its previous content shows what was left unwritten.
+    WriteFile(targetPath, Blocks(8, 'x'));
+
+    SECTION("Writes a raw image")
+    {
+        // Not a multiple of the block size, so that its end isn't written with O_DIRECT.
+        const std::string image{ Blocks(2, 'a') + "tail" };
+        WriteFile(imagePath, image);
+
+        CHECK(ADUC_RawImage_Write(
+            imagePath.c_str(), nullptr, targetPath.c_str(), GetSha256(imagePath).c_str(), SHA256, &stats));
+        CHECK(ReadFile(targetPath) == image + Blocks(8, 'x').substr(image.size()));
+        CHECK(stats.ImageBytes == image.size());
+        CHECK(stats.WrittenBytes == image.size());
+        CHECK(stats.SkippedBytes == 0);
+    }
+
+    SECTION("Skips the blocks a bmap file doesn't map")
+    {
+        const std::string image{ Blocks(1, 'a') + Blocks(2, '\0') + Blocks(1, 'b') };
+        WriteFile(imagePath, image);
+        WriteFile(
+            bmapPath,
+            "<?xml version=\"1.0\" ?>\n<bmap version=\"2.0\">\n"
+            "    <ImageSize> 16384 </ImageSize>\n    <BlockSize> 4096 </BlockSize>\n"
+            "    <BlockMap>\n        <Range chksum=\"0\"> 0 </Range>\n"
+            "        <Range chksum=\"0\"> 3-3 </Range>\n    </BlockMap>\n</bmap>\n");
+
+        CHECK(ADUC_RawImage_Write(
+            imagePath.c_str(), bmapPath.c_str(), targetPath.c_str(), GetSha256(imagePath).c_str(), SHA256, &stats));
+        CHECK(ReadFile(targetPath) == Blocks(1, 'a') + Blocks(2, 'x') + Blocks(1, 'b') + Blocks(4, 'x'));
+        CHECK(stats.ImageBytes == image.size());
+        CHECK(stats.WrittenBytes == 2 * BlockSize);
+        CHECK(stats.SkippedBytes == 2 * BlockSize);
+    }
+
+    SECTION("Expands a sparse image")
+    {
+        WriteFile(
+            imagePath, SparseImageBuilder{}.Raw(Blocks(1, 'a')).DontCare(2).Fill(1, 0x62626262).Crc32().str());
+
+        CHECK(ADUC_RawImage_Write(
+            imagePath.c_str(), nullptr, targetPath.c_str(), GetSha256(imagePath).c_str(), SHA256, &stats));
+        CHECK(ReadFile(targetPath) == Blocks(1, 'a') + Blocks(2, 'x') + Blocks(1, 'b') + Blocks(4, 'x'));
+        CHECK(stats.WrittenBytes == 2 * BlockSize);
+        CHECK(stats.SkippedBytes == 2 * BlockSize);
+    }
+
+    SECTION("Reads the image from a pipe")
+    {
+        const std::string pipePath{ testFolder + "/pipe" };
+        const std::string image{ Blocks(3, 'a') };
+        WriteFile(imagePath, image);
+        const std::string hash{ GetSha256(imagePath) };
+        REQUIRE(mkfifo(pipePath.c_str(), S_IRUSR | S_IWUSR) == 0);
+
+        std::thread writer{ [&pipePath, &image] { WriteFile(pipePath, image); } };
+        CHECK(ADUC_RawImage_Write(pipePath.c_str(), nullptr, targetPath.c_str(), hash.c_str(), SHA256, &stats));
+        writer.join();
+
+        CHECK(ReadFile(targetPath) == image + Blocks(5, 'x'));
+    }
+
+    SECTION("Hash mismatch")
+    {
+        WriteFile(imagePath, Blocks(1, 'a'));
+        const std::string hash{ GetSha256(imagePath) };
+        WriteFile(imagePath, Blocks(1, 'b'));
+
+        CHECK_FALSE(
+            ADUC_RawImage_Write(imagePath.c_str(), nullptr, targetPath.c_str(), hash.c_str(), SHA256, &stats));
+    }
+
+    SECTION("Truncated sparse image")
+    {
+        const std::string image{ SparseImageBuilder{}.Raw(Blocks(2, 'a')).str() };
+        WriteFile(imagePath, image.substr(0, image.size() - 1));
+
+        CHECK_FALSE(ADUC_RawImage_Write(imagePath.c_str(), nullptr, targetPath.c_str(), nullptr, SHA256, &stats));
+    }
+
+    SECTION("Missing target")
+    {
+        WriteFile(imagePath, Blocks(1, 'a'));
+
+        CHECK_FALSE(ADUC_RawImage_Write(
+            imagePath.c_str(), nullptr, (testFolder + "/missing").c_str(), nullptr, SHA256, &stats));
+    }
+
+    SECTION("Writes only to a block device")
+    {
+        WriteFile(imagePath, Blocks(1, 'a'));
+
+        CHECK_FALSE(
+            ADUC_RawImage_WriteToDevice(imagePath.c_str(), nullptr, targetPath.c_str(), nullptr, SHA256, &stats));
+        CHECK(ReadFile(targetPath) == Blocks(8, 'x'));
+    }
+
+    ADUC_SystemUtils_RmDirRecursive(testFolder.c_str());
+}
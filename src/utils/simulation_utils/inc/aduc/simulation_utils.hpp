@@ -0,0 +1,125 @@
+/**
+ * @file simulation_utils.hpp
+ * @brief Latency, throughput, CPU and failure injection for the simulator handler and platform layer.
+ *
+ * The behavior of each phase, e.g. "download" or "install", is read from a "behavior" object:
+ *
+ *     "behavior" : {
+ *         "seed" : 42,
+ *         "download" : {
+ *             "latencyMs" : { "distribution" : "uniform", "min" : 100, "max" : 500 },
+ *             "throughputBytesPerSecond" : 1048576,
+ *             "cpuBurnMs" : 20,
+ *             "failureRate" : 0.1,
+ *             "failureResult" : { "resultCode" : 0, "extendedResultCode" : 131, "resultDetails" : "Flaky network." }
+ *         }
+ *     }
+ *
+ * The random draws come from one process-wide generator, so a seeded run draws the same sequence of latencies and
+ * failures, as long as the phases run in the same order.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_SIMULATION_UTILS_HPP
+#define ADUC_SIMULATION_UTILS_HPP
+
+#include <aduc/cancellation_token.h>
+#include <aduc/result.h>
+#include <aduc/types/adu_core.h> // for ADUC_Result_Failure
+#include <parson.h>
+#include <stdint.h>
+#include <string>
+
+namespace ADUC
+{
+namespace SimulationUtils
+{
+/**
+ * @brief The distribution that the latency of a phase is drawn from.
+ */
+enum class LatencyDistribution
+{
+    None, /**< No latency. */
+    Fixed, /**< Always LatencyMs. */
+    Uniform, /**< Uniform in [LatencyMs, LatencyMaxMs]. */
+    Normal, /**< Normal with mean LatencyMs and standard deviation LatencyStdDevMs, clamped at 0. */
+    Exponential, /**< Exponential with mean LatencyMs. */
+};
+
+/**
+ * @brief The simulated behavior of a phase.
+ */
+struct PhaseBehavior
+{
+    LatencyDistribution Distribution = LatencyDistribution::None; /**< The distribution of the latency. */
+    double LatencyMs = 0; /**< The fixed latency, the minimum of a uniform one, or the mean of the others. */
+    double LatencyMaxMs = 0; /**< The maximum of a uniform latency. */
+    double LatencyStdDevMs = 0; /**< The standard deviation of a normal latency. */
+    uint64_t ThroughputBytesPerSecond = 0; /**< The rate the bytes of the phase are transferred at, 0 if unlimited. */
+    unsigned int CpuBurnMs = 0; /**< The CPU time the phase spins for. */
+    double FailureRate = 0; /**< The probability that the phase fails, in [0, 1]. */
+    ADUC_Result FailureResult = { ADUC_Result_Failure, ADUC_ERC_NOTRECOVERABLE }; /**< The result of a failure. */
+    std::string FailureResultDetails; /**< The result details of a failure. */
+};
+
+/**
+ * @brief Parses the behavior of a phase.
+ *
+ * @param phaseObject The object of the phase.
+ * @param[out] behavior The behavior. Left unchanged on failure.
+ * @return bool false if @p phaseObject is malformed, e.g. has an unknown distribution or a negative latency.
+ */
+bool ParsePhaseBehavior(const JSON_Object* phaseObject, PhaseBehavior* behavior);
+
+/**
+ * @brief Gets the behavior of @p phase from a "behavior" object, and seeds the generator with its "seed" if that
+ * changed since the last call.
+ *
+ * @param behaviorObject The "behavior" object, or NULL.
+ * @param phase The name of the phase, e.g. "download".
+ * @param[out] behavior The behavior. Left unchanged if the phase has none or a malformed one.
+ * @return bool true if @p behavior was set.
+ */
+bool GetPhaseBehavior(const JSON_Object* behaviorObject, const char* phase, PhaseBehavior* behavior);
+
+/**
+ * @brief Seeds the process-wide generator.
+ *
+ * @param seed The seed.
+ */
+void Seed(uint64_t seed);
+
+/**
+ * @brief Draws a latency of the phase.
+ *
+ * @param behavior The behavior of the phase.
+ * @return double The latency, in milliseconds.
+ */
+double DrawLatencyMs(const PhaseBehavior& behavior);
+
+/**
+ * @brief Draws whether the phase fails.
+ *
+ * @param behavior The behavior of the phase.
+ * @return bool true if it fails.
+ */
+bool DrawFailure(const PhaseBehavior& behavior);
+
+/**
+ * @brief Runs a phase: waits for a drawn latency plus the time to transfer @p bytes at the throughput of the phase,
+ * spins for its CPU time, and fails as drawn. Both draws are made up front, so that they don't depend on
+ * timing.
+ *
+ * @param behavior The behavior of the phase.
+ * @param bytes The bytes that the phase transfers, e.g. the size of a downloaded file.
+ * @param cancellationToken The token that interrupts the wait, or NULL.
+ * @return bool true if the phase fails with behavior.FailureResult; false if it succeeds or is cancelled.
+ */
+bool SimulatePhase(
+    const PhaseBehavior& behavior, uint64_t bytes, const ADUC_CancellationToken* cancellationToken = nullptr);
+
+} // namespace SimulationUtils
+} // namespace ADUC
+
+#endif // ADUC_SIMULATION_UTILS_HPP
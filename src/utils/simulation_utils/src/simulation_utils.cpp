@@ -0,0 +1,345 @@
+/**
+ * @file simulation_utils.cpp
+ * @brief Implementation of the simulated behavior of phases.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/simulation_utils.hpp"
+#include "aduc/logging.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <poll.h>
+#include <random>
+#include <time.h>
+
+namespace ADUC
+{
+namespace SimulationUtils
+{
+/**
+ * @brief The process-wide generator, and the seed it was last seeded with from a "behavior" object.
+ */
+static std::mt19937_64 s_generator{ std::random_device{}() };
+static bool s_seeded = false;
+static uint64_t s_seed = 0;
+static std::mutex s_generatorMutex;
+
+/**
+ * @brief Longest wait between two checks of the cancellation token; poll() takes an int timeout.
+ */
+static const int64_t MaxPollTimeoutMs = 1000;
+
+/**
+ * @brief Gets a non-negative number property.
+ *
+ * @return bool false if the property exists but isn't a non-negative number.
+ */
+static bool GetNonNegativeNumber(const JSON_Object* object, const char* name, double* value)
+{
+    const JSON_Value* numberValue = json_object_get_value(object, name);
+    if (numberValue == nullptr)
+    {
+        return true;
+    }
+
+    if (json_value_get_type(numberValue) != JSONNumber || json_value_get_number(numberValue) < 0)
+    {
+        Log_Error("Simulated behavior: '%s' must be a non-negative number.", name);
+        return false;
+    }
+
+    *value = json_value_get_number(numberValue);
+    return true;
+}
+
+static bool ParseLatency(const JSON_Value* latencyValue, PhaseBehavior* behavior)
+{
+    if (json_value_get_type(latencyValue) == JSONNumber)
+    {
+        behavior->Distribution = LatencyDistribution::Fixed;
+        behavior->LatencyMs = json_value_get_number(latencyValue);
+        return behavior->LatencyMs >= 0;
+    }
+
+    const JSON_Object* latencyObject = json_value_get_object(latencyValue);
+    if (latencyObject == nullptr)
+    {
+        return false;
+    }
+
+    const char* distribution = json_object_get_string(latencyObject, "distribution");
+    if (distribution == nullptr || strcmp(distribution, "fixed") == 0)
+    {
+        behavior->Distribution = LatencyDistribution::Fixed;
+        return GetNonNegativeNumber(latencyObject, "value", &behavior->LatencyMs);
+    }
+
+    if (strcmp(distribution, "uniform") == 0)
+    {
+        behavior->Distribution = LatencyDistribution::Uniform;
+        return GetNonNegativeNumber(latencyObject, "min", &behavior->LatencyMs)
+            && GetNonNegativeNumber(latencyObject, "max", &behavior->LatencyMaxMs)
+            && behavior->LatencyMs <= behavior->LatencyMaxMs;
+    }
+
+    if (strcmp(distribution, "normal") == 0)
+    {
+        behavior->Distribution = LatencyDistribution::Normal;
+        return GetNonNegativeNumber(latencyObject, "mean", &behavior->LatencyMs)
+            && GetNonNegativeNumber(latencyObject, "stdDev", &behavior->LatencyStdDevMs);
+    }
+
+    if (strcmp(distribution, "exponential") == 0)
+    {
+        behavior->Distribution = LatencyDistribution::Exponential;
+        return GetNonNegativeNumber(latencyObject, "mean", &behavior->LatencyMs);
+    }
+
+    Log_Error("Simulated behavior: unknown latency distribution '%s'.", distribution);
+    return false;
+}
+
+bool ParsePhaseBehavior(const JSON_Object* phaseObject, PhaseBehavior* behavior)
+{
+    if (phaseObject == nullptr || behavior == nullptr)
+    {
+        return false;
+    }
+
+    PhaseBehavior parsed;
+    double throughput = 0;
+    double cpuBurnMs = 0;
+
+    const JSON_Value* latencyValue = json_object_get_value(phaseObject, "latencyMs");
+    if (latencyValue != nullptr && !ParseLatency(latencyValue, &parsed))
+    {
+        Log_Error("Simulated behavior: invalid 'latencyMs'.");
+        return false;
+    }
+
+    if (!GetNonNegativeNumber(phaseObject, "throughputBytesPerSecond", &throughput)
+        || !GetNonNegativeNumber(phaseObject, "cpuBurnMs", &cpuBurnMs)
+        || !GetNonNegativeNumber(phaseObject, "failureRate", &parsed.FailureRate))
+    {
+        return false;
+    }
+
+    if (parsed.FailureRate > 1)
+    {
+        Log_Error("Simulated behavior: 'failureRate' must be in [0, 1].");
+        return false;
+    }
+
+    parsed.ThroughputBytesPerSecond = static_cast<uint64_t>(throughput);
+    parsed.CpuBurnMs = static_cast<unsigned int>(cpuBurnMs);
+
+    const JSON_Object* failureResult = json_object_get_object(phaseObject, "failureResult");
+    if (failureResult != nullptr)
+    {
+        parsed.FailureResult.ResultCode =
+            static_cast<ADUC_Result_t>(json_object_get_number(failureResult, "resultCode"));
+        parsed.FailureResult.ExtendedResultCode =
+            static_cast<ADUC_Result_t>(json_object_get_number(failureResult, "extendedResultCode"));
+
+        const char* resultDetails = json_object_get_string(failureResult, "resultDetails");
+        if (resultDetails != nullptr)
+        {
+            parsed.FailureResultDetails = resultDetails;
+        }
+
+        if (IsAducResultCodeSuccess(parsed.FailureResult.ResultCode))
+        {
+            Log_Warn("Simulated behavior: 'failureResult' has a success result code.");
+        }
+    }
+
+    *behavior = parsed;
+    return true;
+}
+
+bool GetPhaseBehavior(const JSON_Object* behaviorObject, const char* phase, PhaseBehavior* behavior)
+{
+    if (behaviorObject == nullptr || phase == nullptr)
+    {
+        return false;
+    }
+
+    const JSON_Value* seedValue = json_object_get_value(behaviorObject, "seed");
+    if (json_value_get_type(seedValue) == JSONNumber)
+    {
+        const auto seed = static_cast<uint64_t>(json_value_get_number(seedValue));
+
+        std::lock_guard<std::mutex> lock{ s_generatorMutex };
+        if (!s_seeded || s_seed != seed)
+        {
+            s_generator.seed(seed);
+            s_seeded = true;
+            s_seed = seed;
+        }
+    }
+
+    const JSON_Object* phaseObject = json_object_get_object(behaviorObject, phase);
+    if (phaseObject == nullptr)
+    {
+        return false;
+    }
+
+    if (!ParsePhaseBehavior(phaseObject, behavior))
+    {
+        Log_Warn("Ignoring the malformed simulated behavior of '%s'.", phase);
+        return false;
+    }
+
+    return true;
+}
+
+void Seed(uint64_t seed)
+{
+    std::lock_guard<std::mutex> lock{ s_generatorMutex };
+    s_generator.seed(seed);
+    s_seeded = true;
+    s_seed = seed;
+}
+
+/**
+ * @brief Draws a latency. Must be called with s_generatorMutex held.
+ */
+static double DrawLatencyMsLocked(const PhaseBehavior& behavior)
+{
+    switch (behavior.Distribution)
+    {
+    case LatencyDistribution::Fixed:
+        return behavior.LatencyMs;
+
+    case LatencyDistribution::Uniform:
+        return std::uniform_real_distribution<double>{ behavior.LatencyMs, behavior.LatencyMaxMs }(s_generator);
+
+    case LatencyDistribution::Normal:
+        return std::max(
+            0.0, std::normal_distribution<double>{ behavior.LatencyMs, behavior.LatencyStdDevMs }(s_generator));
+
+    case LatencyDistribution::Exponential:
+        return behavior.LatencyMs <= 0
+            ? 0.0
+            : std::exponential_distribution<double>{ 1.0 / behavior.LatencyMs }(s_generator);
+
+    case LatencyDistribution::None:
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Draws whether the phase fails. Must be called with s_generatorMutex held.
+ */
+static bool DrawFailureLocked(const PhaseBehavior& behavior)
+{
+    if (behavior.FailureRate <= 0)
+    {
+        return false;
+    }
+
+    return std::bernoulli_distribution{ std::min(behavior.FailureRate, 1.0) }(s_generator);
+}
+
+double DrawLatencyMs(const PhaseBehavior& behavior)
+{
+    std::lock_guard<std::mutex> lock{ s_generatorMutex };
+    return DrawLatencyMsLocked(behavior);
+}
+
+bool DrawFailure(const PhaseBehavior& behavior)
+{
+    std::lock_guard<std::mutex> lock{ s_generatorMutex };
+    return DrawFailureLocked(behavior);
+}
+
+/**
+ * @brief Waits for @p durationMs, or until @p cancellationToken is cancelled.
+ *
+ * @return bool false if cancelled.
+ */
+static bool Wait(int64_t durationMs, const ADUC_CancellationToken* cancellationToken)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(durationMs);
+    struct pollfd pfd = { ADUC_CancellationToken_GetFd(cancellationToken), POLLIN, 0 };
+
+    for (;;)
+    {
+        if (ADUC_CancellationToken_IsCancelled(cancellationToken))
+        {
+            return false;
+        }
+
+        const int64_t remainingUs =
+            std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remainingUs <= 0)
+        {
+            return true;
+        }
+
+        // Rounded up, so as not to return early.
+        // poll() ignores a negative fd, so this is a plain sleep without a token.
+        (void)poll(&pfd, 1, static_cast<int>(std::min((remainingUs + 999) / 1000, MaxPollTimeoutMs)));
+    }
+}
+
+static int64_t GetThreadCpuTimeNs()
+{
+    struct timespec now = {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Spins until this thread used @p durationMs of CPU time, or until @p cancellationToken is cancelled.
+ */
+static void BurnCpu(unsigned int durationMs, const ADUC_CancellationToken* cancellationToken)
+{
+    const int64_t end = GetThreadCpuTimeNs() + static_cast<int64_t>(durationMs) * 1000000;
+    volatile uint64_t state = 0x9E3779B97F4A7C15;
+
+    while (GetThreadCpuTimeNs() < end && !ADUC_CancellationToken_IsCancelled(cancellationToken))
+    {
+        for (int i = 0; i < 10000; ++i)
+        {
+            state = state * 6364136223846793005 + 1442695040888963407;
+        }
+    }
+}
+
+bool SimulatePhase(const PhaseBehavior& behavior, uint64_t bytes, const ADUC_CancellationToken* cancellationToken)
+{
+    double waitMs = 0;
+    bool failed = false;
+
+    {
+        std::lock_guard<std::mutex> lock{ s_generatorMutex };
+        waitMs = DrawLatencyMsLocked(behavior);
+        failed = DrawFailureLocked(behavior);
+    }
+
+    if (behavior.ThroughputBytesPerSecond != 0)
+    {
+        waitMs += static_cast<double>(bytes) * 1000 / static_cast<double>(behavior.ThroughputBytesPerSecond);
+    }
+
+    if (waitMs > 0 && !Wait(static_cast<int64_t>(waitMs), cancellationToken))
+    {
+        return false;
+    }
+
+    if (behavior.CpuBurnMs != 0)
+    {
+        BurnCpu(behavior.CpuBurnMs, cancellationToken);
+    }
+
+    return failed && !ADUC_CancellationToken_IsCancelled(cancellationToken);
+}
+
+} // namespace SimulationUtils
+} // namespace ADUC
@@ -0,0 +1,147 @@
+/**
+ * @file simulation_utils_ut.cpp
+ * @brief Unit Tests for the simulated behavior of phases.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+using Catch::Matchers::Equals;
+
+#include "aduc/simulation_utils.hpp"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using ADUC::SimulationUtils::LatencyDistribution;
+using ADUC::SimulationUtils::PhaseBehavior;
+
+static bool ParseBehavior(const char* json, const char* phase, PhaseBehavior* behavior)
+{
+    JSON_Value* root = json_parse_string(json);
+    REQUIRE(root != nullptr);
+    const bool found = ADUC::SimulationUtils::GetPhaseBehavior(json_value_get_object(root), phase, behavior);
+    json_value_free(root);
+    return found;
+}
+
+TEST_CASE("ParsePhaseBehavior")
+{
+    PhaseBehavior behavior;
+
+    SECTION("All properties")
+    {
+        REQUIRE(ParseBehavior(
+            R"({ "download" : { "latencyMs" : { "distribution" : "uniform", "min" : 10, "max" : 20 },)"
+            R"(  "throughputBytesPerSecond" : 1024, "cpuBurnMs" : 5, "failureRate" : 0.25,)"
+            R"(  "failureResult" : { "resultCode" : 0, "extendedResultCode" : 42, "resultDetails" : "flaky" } } })",
+            "download",
+            &behavior));
+
+        CHECK(behavior.Distribution == LatencyDistribution::Uniform);
+        CHECK(behavior.LatencyMs == 10);
+        CHECK(behavior.LatencyMaxMs == 20);
+        CHECK(behavior.ThroughputBytesPerSecond == 1024);
+        CHECK(behavior.CpuBurnMs == 5);
+        CHECK(behavior.FailureRate == 0.25);
+        CHECK(behavior.FailureResult.ResultCode == 0);
+        CHECK(behavior.FailureResult.ExtendedResultCode == 42);
+        CHECK_THAT(behavior.FailureResultDetails, Equals("flaky"));
+    }
+
+    SECTION("A number is a fixed latency")
+    {
+        REQUIRE(ParseBehavior(R"({ "install" : { "latencyMs" : 30 } })", "install", &behavior));
+        CHECK(behavior.Distribution == LatencyDistribution::Fixed);
+        CHECK(ADUC::SimulationUtils::DrawLatencyMs(behavior) == 30);
+        CHECK_FALSE(ADUC::SimulationUtils::DrawFailure(behavior));
+    }
+
+    SECTION("Missing phase")
+    {
+        CHECK_FALSE(ParseBehavior(R"({ "install" : { "latencyMs" : 30 } })", "apply", &behavior));
+        CHECK(behavior.Distribution == LatencyDistribution::None);
+    }
+
+    SECTION("Malformed behaviors are ignored")
+    {
+        CHECK_FALSE(ParseBehavior(R"({ "apply" : { "latencyMs" : -1 } })", "apply", &behavior));
+        CHECK_FALSE(ParseBehavior(
+            R"({ "apply" : { "latencyMs" : { "distribution" : "uniform", "min" : 20, "max" : 10 } } })",
+            "apply",
+            &behavior));
+        CHECK_FALSE(
+            ParseBehavior(R"({ "apply" : { "latencyMs" : { "distribution" : "pareto" } } })", "apply", &behavior));
+        CHECK_FALSE(ParseBehavior(R"({ "apply" : { "failureRate" : 2 } })", "apply", &behavior));
+        CHECK(behavior.Distribution == LatencyDistribution::None);
+    }
+}
+
+TEST_CASE("A seeded generator draws the same sequence")
+{
+    PhaseBehavior behavior;
+    behavior.Distribution = LatencyDistribution::Exponential;
+    behavior.LatencyMs = 100;
+    behavior.FailureRate = 0.5;
+
+    std::vector<double> latencies[2];
+    std::vector<bool> failures[2];
+
+    for (auto run = 0; run < 2; ++run)
+    {
+        ADUC::SimulationUtils::Seed(1234);
+        for (auto i = 0; i < 16; ++i)
+        {
+            latencies[run].push_back(ADUC::SimulationUtils::DrawLatencyMs(behavior));
+            failures[run].push_back(ADUC::SimulationUtils::DrawFailure(behavior));
+        }
+    }
+
+    CHECK(latencies[0] == latencies[1]);
+    CHECK(failures[0] == failures[1]);
+}
+
+TEST_CASE("SimulatePhase")
+{
+    PhaseBehavior behavior;
+
+    SECTION("Failure rates of 0 and 1")
+    {
+        CHECK_FALSE(ADUC::SimulationUtils::SimulatePhase(behavior, 0));
+
+        behavior.FailureRate = 1;
+        CHECK(ADUC::SimulationUtils::SimulatePhase(behavior, 0));
+    }
+
+    SECTION("Throughput limit")
+    {
+        behavior.ThroughputBytesPerSecond = 1000;
+
+        const auto start = std::chrono::steady_clock::now();
+        CHECK_FALSE(ADUC::SimulationUtils::SimulatePhase(behavior, 100));
+        CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(100));
+    }
+
+    SECTION("Cancellation interrupts the latency")
+    {
+        behavior.Distribution = LatencyDistribution::Fixed;
+        behavior.LatencyMs = 60000;
+        behavior.FailureRate = 1;
+
+        ADUC_CancellationToken* token = ADUC_CancellationToken_Create();
+        REQUIRE(token != nullptr);
+
+        std::thread canceller{ [token]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            ADUC_CancellationToken_Cancel(token);
+        } };
+
+        const auto start = std::chrono::steady_clock::now();
+        CHECK_FALSE(ADUC::SimulationUtils::SimulatePhase(behavior, 0, token));
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+
+        canceller.join();
+        ADUC_CancellationToken_Destroy(token);
+    }
+}
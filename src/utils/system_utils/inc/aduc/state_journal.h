@@ -0,0 +1,61 @@
+/**
+ * @file state_journal.h
+ * @brief An append-only journal of small state records, for state that changes often and is read rarely.
+ *
+ * Each record is appended as one line and synced, instead of rewriting a whole state file on every change. A record
+ * cut short by a crash is an unterminated last line, which readers skip. Once the state is complete, the owner
+ * compacts the journal down to a single record, or removes it.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ADUC_STATE_JOURNAL_H
+#define ADUC_STATE_JOURNAL_H
+
+#include <aduc/c_utils.h> // for EXTERN_C_BEGIN, EXTERN_C_END
+#include <stddef.h> // for size_t
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Called for each record of a journal, see ADUC_StateJournal_ForEach.
+ *
+ * @param record The record, without its line terminator.
+ * @param context The context passed to ADUC_StateJournal_ForEach.
+ */
+typedef void (*ADUC_StateJournal_RecordCallback)(const char* record, void* context);
+
+/**
+ * @brief Appends @p record to the journal at @p journalPath, creating it if needed, and syncs it to disk.
+ *
+ * @param journalPath The path of the journal.
+ * @param record The record. Must not contain a newline, e.g. compact-serialized JSON.
+ * @return int 0 on success, else an errno value.
+ */
+int ADUC_StateJournal_Append(const char* journalPath, const char* record);
+
+/**
+ * @brief Calls @p callback for each complete record of the journal at @p journalPath, oldest first.
+ *
+ * @param journalPath The path of the journal.
+ * @param callback The callback.
+ * @param context The context passed to @p callback.
+ * @param[out] recordCount Receives the number of records, if not NULL.
+ * @return int 0 on success, or if the journal doesn't exist; else an errno value.
+ */
+int ADUC_StateJournal_ForEach(
+    const char* journalPath, ADUC_StateJournal_RecordCallback callback, void* context, size_t* recordCount);
+
+/**
+ * @brief Atomically replaces the journal at @p journalPath with the single record @p record, or removes it.
+ *
+ * @param journalPath The path of the journal.
+ * @param record The record to keep, which must not contain a newline; NULL to remove the journal.
+ * @return int 0 on success, else an errno value. On failure, the journal is unchanged.
+ */
+int ADUC_StateJournal_Compact(const char* journalPath, const char* record);
+
+EXTERN_C_END
+
+#endif // ADUC_STATE_JOURNAL_H
@@ -10,6 +10,7 @@
 
 #include <aduc/c_utils.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 EXTERN_C_BEGIN
@@ -30,6 +31,10 @@ int ADUC_SystemUtils_MkSandboxDirRecursive(const char* path);
 
 int ADUC_SystemUtils_RmDirRecursive(const char* path);
 
+int ADUC_SystemUtils_RmDirRecursiveDeferred(const char* path);
+
+void ADUC_SystemUtils_WaitForDeferredRemovals();
+
 int ADUC_SystemUtils_CopyFileToDir(const char* filePath, const char* dirPath, _Bool overwriteExistingFile);
 
 int ADUC_SystemUtils_RemoveFile(const char* path);
@@ -38,6 +43,21 @@ int ADUC_SystemUtils_WriteStringToFile(const char* path, const char* buff);
 
 int ADUC_SystemUtils_ReadStringFromFile(const char* path, char* buff, size_t buffLen);
 
+int ADUC_SystemUtils_GetAvailableDiskSpace(const char* path, uint64_t* availableBytes);
+
+int ADUC_SystemUtils_ReserveFileSpace(int fd, off_t offset, off_t length);
+
+_Bool ADUC_SystemUtils_IsCurrentExecutableReplaced();
+
+void ADUC_SystemUtils_SetRamStaging(uint64_t thresholdBytes, uint64_t budgetBytes);
+
+_Bool ADUC_SystemUtils_BeginRamStaging(
+    const char* sandboxPath, uint64_t sizeInBytes, char* stagingPath, size_t stagingPathSize);
+
+void ADUC_SystemUtils_EndRamStaging(uint64_t sizeInBytes);
+
+int ADUC_SystemUtils_RmRamStagingDir(const char* sandboxPath);
+
 _Bool SystemUtils_IsDir(const char* path);
 
 _Bool SystemUtils_IsFile(const char* path);
@@ -0,0 +1,170 @@
+/**
+ * @file state_journal.c
+ * @brief Implementation of the append-only state journal.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#include "aduc/state_journal.h"
+
+#include <errno.h>
+#include <fcntl.h> // for open, O_APPEND
+#include <stdio.h> // for getline, rename
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h> // for S_IRUSR, S_IWUSR
+#include <sys/uio.h> // for writev
+#include <unistd.h>
+
+/**
+ * @brief Suffix of the temporary file a journal is compacted to.
+ */
+#define ADUC_STATE_JOURNAL_TEMP_SUFFIX ".tmp"
+
+/**
+ * @brief Writes @p record and a newline to @p fd, as one write so that concurrent appends don't interleave,
+ * and syncs the data.
+ *
+ * @return int 0 on success, else an errno value.
+ */
+static int WriteRecord(int fd, const char* record)
+{
+    char newline = '\n';
+    struct iovec iov[2] = { { (void*)record, strlen(record) }, { &newline, 1 } };
+    const ssize_t expected = (ssize_t)(iov[0].iov_len + 1);
+
+    ssize_t written = writev(fd, iov, 2);
+    if (written != expected)
+    {
+        // A short write leaves a partial line, which readers skip.
+        return written < 0 ? errno : EIO;
+    }
+
+    return fdatasync(fd) == 0 ? 0 : errno;
+}
+
+int ADUC_StateJournal_Append(const char* journalPath, const char* record)
+{
+    if (journalPath == NULL || record == NULL || strchr(record, '\n') != NULL)
+    {
+        return EINVAL;
+    }
+
+    int fd = open(journalPath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+    {
+        return errno;
+    }
+
+    int err = WriteRecord(fd, record);
+
+    if (close(fd) != 0 && err == 0)
+    {
+        err = errno;
+    }
+
+    return err;
+}
+
+int ADUC_StateJournal_ForEach(
+    const char* journalPath, ADUC_StateJournal_RecordCallback callback, void* context, size_t* recordCount)
+{
+    size_t count = 0;
+    char* line = NULL;
+    size_t lineSize = 0;
+    ssize_t lineLength = 0;
+
+    if (recordCount != NULL)
+    {
+        *recordCount = 0;
+    }
+
+    if (journalPath == NULL || callback == NULL)
+    {
+        return EINVAL;
+    }
+
+    FILE* journal = fopen(journalPath, "re");
+    if (journal == NULL)
+    {
+        return errno == ENOENT ? 0 : errno;
+    }
+
+    while ((lineLength = getline(&line, &lineSize, journal)) > 0)
+    {
+        // A record cut short by a crash has no line terminator.
+        if (line[lineLength - 1] != '\n')
+        {
+            break;
+        }
+
+        line[lineLength - 1] = '\0';
+        callback(line, context);
+        ++count;
+    }
+
+    free(line);
+    fclose(journal);
+
+    if (recordCount != NULL)
+    {
+        *recordCount = count;
+    }
+
+    return 0;
+}
+
+int ADUC_StateJournal_Compact(const char* journalPath, const char* record)
+{
+    int err = 0;
+    char* tempPath = NULL;
+    int fd = -1;
+
+    if (journalPath == NULL || (record != NULL && strchr(record, '\n') != NULL))
+    {
+        return EINVAL;
+    }
+
+    if (record == NULL)
+    {
+        return (unlink(journalPath) == 0 || errno == ENOENT) ? 0 : errno;
+    }
+
+    tempPath = malloc(strlen(journalPath) + sizeof(ADUC_STATE_JOURNAL_TEMP_SUFFIX));
+    if (tempPath == NULL)
+    {
+        return ENOMEM;
+    }
+
+    strcpy(tempPath, journalPath);
+    strcat(tempPath, ADUC_STATE_JOURNAL_TEMP_SUFFIX);
+
+    fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+    {
+        err = errno;
+        goto done;
+    }
+
+    err = WriteRecord(fd, record);
+
+    if (close(fd) != 0 && err == 0)
+    {
+        err = errno;
+    }
+
+    if (err == 0 && rename(tempPath, journalPath) != 0)
+    {
+        err = errno;
+    }
+
+    if (err != 0)
+    {
+        unlink(tempPath);
+    }
+
+done:
+    free(tempPath);
+    return err;
+}
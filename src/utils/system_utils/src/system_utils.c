@@ -5,7 +5,12 @@
  * @copyright Copyright (c) Microsoft Corporation.
  * Licensed under the MIT License.
  */
+#ifndef _GNU_SOURCE
+#    define _GNU_SOURCE // for copy_file_range, fallocate
+#endif
+
 #include "aduc/system_utils.h"
+#include "aduc/cpu_affinity_utils.h"
 #include "aduc/logging.h"
 #include "aduc/string_c_utils.h"
 
@@ -14,21 +19,34 @@
 
 #include <aduc/string_c_utils.h>
 #include <azure_c_shared_utility/strings.h>
+#include <dirent.h> // for opendir
 #include <errno.h>
 #include <fcntl.h> // for O_CLOEXEC
 #include <ftw.h> // for nftw
 #include <grp.h> // for getgrnam
 #include <limits.h> // for PATH_MAX
+#include <pthread.h>
 #include <pwd.h> // for getpwnam
 #include <stdio.h>
 #include <stdlib.h> // for getenv
 #include <string.h> // for strncpy, strlen
 #include <sys/file.h>
+#include <sys/ioctl.h> // for ioctl
+#include <sys/resource.h> // for setpriority
+#include <sys/sendfile.h> // for sendfile
+#include <sys/syscall.h> // for SYS_ioprio_set, SYS_gettid
 #include <sys/stat.h>
+#include <sys/statvfs.h> // for statvfs
 #include <sys/types.h>
+#include <sys/vfs.h> // for statfs
 #include <sys/wait.h> // for waitpid
 #include <unistd.h>
 
+#ifdef __linux__
+#    include <linux/fs.h> // for FICLONE
+#    include <linux/magic.h> // for TMPFS_MAGIC
+#endif
+
 #ifndef O_CLOEXEC
 /**
  * @brief Enable the close-on-exec flag for the new file descriptor. pecifying this flag permits a program to avoid additional
@@ -355,6 +373,262 @@ int ADUC_SystemUtils_RmDirRecursive(const char* path)
     return nftw(path, RmDirRecursive_helper, 20 /*nfds*/, FTW_MOUNT | FTW_PHYS | FTW_DEPTH);
 }
 
+// The I/O priorities of ioprio_set(2), which glibc doesn't define.
+#define ADUC_IOPRIO_WHO_PROCESS 1
+#define ADUC_IOPRIO_CLASS_IDLE 3
+#define ADUC_IOPRIO_CLASS_SHIFT 13
+
+/**
+ * @brief The infix of the names directories are renamed to while they wait for the deferred removal thread.
+ */
+#define ADUC_SYSTEMUTILS_DEFERRED_REMOVAL_INFIX ".deleting-"
+
+/**
+ * @brief A directory waiting for the deferred removal thread.
+ */
+typedef struct tagADUC_DeferredRemoval
+{
+    struct tagADUC_DeferredRemoval* Next; /**< The next directory in the queue. */
+    char* Path; /**< The path the directory was renamed to. */
+} ADUC_DeferredRemoval;
+
+static pthread_mutex_t s_deferredRemovalMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_deferredRemovalCond = PTHREAD_COND_INITIALIZER;
+static ADUC_DeferredRemoval* s_deferredRemovalHead = NULL;
+static ADUC_DeferredRemoval* s_deferredRemovalTail = NULL;
+static size_t s_deferredRemovalPendingCount = 0; /**< The directories queued or being removed. */
+static _Bool s_deferredRemovalThreadStarted = false;
+static _Bool s_deferredRemovalLeftoversQueued = false;
+static unsigned int s_deferredRemovalSequence = 0;
+
+/**
+ * @brief Removes the queued directories, one at a time, with the idle I/O class and the lowest CPU priority, so that
+ * the removal only uses the disk when nothing else does.
+ */
+static void* DeferredRemovalThread(void* arg)
+{
+    (void)arg;
+
+    const pid_t tid = (pid_t)syscall(SYS_gettid);
+    if (syscall(SYS_ioprio_set, ADUC_IOPRIO_WHO_PROCESS, tid, ADUC_IOPRIO_CLASS_IDLE << ADUC_IOPRIO_CLASS_SHIFT) != 0)
+    {
+        Log_Warn("Cannot set the idle I/O class for the sandbox removal, errno %d", errno);
+    }
+
+    if (setpriority(PRIO_PROCESS, (id_t)tid, 19) != 0)
+    {
+        Log_Warn("Cannot lower the CPU priority for the sandbox removal, errno %d", errno);
+    }
+
+    for (;;)
+    {
+        pthread_mutex_lock(&s_deferredRemovalMutex);
+        while (s_deferredRemovalHead == NULL)
+        {
+            pthread_cond_wait(&s_deferredRemovalCond, &s_deferredRemovalMutex);
+        }
+
+        ADUC_DeferredRemoval* removal = s_deferredRemovalHead;
+        s_deferredRemovalHead = removal->Next;
+        if (s_deferredRemovalHead == NULL)
+        {
+            s_deferredRemovalTail = NULL;
+        }
+        pthread_mutex_unlock(&s_deferredRemovalMutex);
+
+        (void)ADUC_CpuAffinity_ApplyToCurrentThread(ADUC_ThreadClass_IO);
+
+        const int result = ADUC_SystemUtils_RmDirRecursive(removal->Path);
+        if (result != 0)
+        {
+            Log_Warn("Unable to remove %s, error %d", removal->Path, result);
+        }
+
+        free(removal->Path);
+        free(removal);
+
+        pthread_mutex_lock(&s_deferredRemovalMutex);
+        --s_deferredRemovalPendingCount;
+        pthread_cond_broadcast(&s_deferredRemovalCond);
+        pthread_mutex_unlock(&s_deferredRemovalMutex);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Queues @p path for the deferred removal thread, starting the thread if needed.
+ *
+ * @param path The path of the directory. The queue takes ownership of it.
+ * @return _Bool false if the thread cannot be started or out of memory, in which case @p path is not queued.
+ */
+static _Bool QueueDeferredRemoval(char* path)
+{
+    _Bool queued = false;
+    ADUC_DeferredRemoval* removal = calloc(1, sizeof(*removal));
+    if (removal == NULL)
+    {
+        return false;
+    }
+
+    removal->Path = path;
+
+    pthread_mutex_lock(&s_deferredRemovalMutex);
+
+    if (!s_deferredRemovalThreadStarted)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, DeferredRemovalThread, NULL) != 0)
+        {
+            goto done;
+        }
+
+        pthread_detach(thread);
+        s_deferredRemovalThreadStarted = true;
+    }
+
+    if (s_deferredRemovalTail == NULL)
+    {
+        s_deferredRemovalHead = removal;
+    }
+    else
+    {
+        s_deferredRemovalTail->Next = removal;
+    }
+    s_deferredRemovalTail = removal;
+    ++s_deferredRemovalPendingCount;
+    pthread_cond_broadcast(&s_deferredRemovalCond);
+    queued = true;
+
+done:
+    pthread_mutex_unlock(&s_deferredRemovalMutex);
+
+    if (!queued)
+    {
+        free(removal);
+    }
+
+    return queued;
+}
+
+/**
+ * @brief Queues the directories of @p dirPath left waiting for removal by a previous run of the agent, e.g. one that
+ * was stopped before its deferred removals completed.
+ *
+ * @param dirPath The directory.
+ */
+static void QueueDeferredRemovalLeftovers(const char* dirPath)
+{
+    DIR* dir = opendir(dirPath);
+    if (dir == NULL)
+    {
+        return;
+    }
+
+    const struct dirent* entry = NULL;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strstr(entry->d_name, ADUC_SYSTEMUTILS_DEFERRED_REMOVAL_INFIX) == NULL)
+        {
+            continue;
+        }
+
+        char* leftoverPath = ADUC_StringFormat("%s/%s", dirPath, entry->d_name);
+        if (leftoverPath != NULL && !QueueDeferredRemoval(leftoverPath))
+        {
+            free(leftoverPath);
+        }
+    }
+
+    closedir(dir);
+}
+
+/**
+ * @brief Removes a directory recursively without waiting for the removal.
+ * @details Renames the directory aside, within its parent so that the rename is atomic, and queues the renamed
+ * directory for a background thread. @p path can be created again as soon as this returns. If the directory cannot be
+ * renamed, e.g. it is a mount point, it is removed before returning.
+ *
+ * @param path The path of the directory.
+ * @return int 0 if the directory is removed or queued for removal; otherwise errno.
+ */
+int ADUC_SystemUtils_RmDirRecursiveDeferred(const char* path)
+{
+    struct stat st;
+    char* trashPath = NULL;
+    char* parentPath = NULL;
+
+    if (path == NULL)
+    {
+        return EINVAL;
+    }
+
+    if (lstat(path, &st) != 0)
+    {
+        return errno;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+    {
+        return ENOTDIR;
+    }
+
+    const unsigned int sequence = __atomic_fetch_add(&s_deferredRemovalSequence, 1, __ATOMIC_RELAXED);
+    trashPath = ADUC_StringFormat("%s" ADUC_SYSTEMUTILS_DEFERRED_REMOVAL_INFIX "%d-%u", path, (int)getpid(), sequence);
+
+    if (trashPath == NULL || rename(path, trashPath) != 0)
+    {
+        Log_Warn("Cannot rename %s aside for removal, errno %d; removing it now.", path, errno);
+        free(trashPath);
+        return ADUC_SystemUtils_RmDirRecursive(path);
+    }
+
+    // The first time, also take care of the removals a previous run of the agent left behind.
+    pthread_mutex_lock(&s_deferredRemovalMutex);
+    const _Bool queueLeftovers = !s_deferredRemovalLeftoversQueued;
+    s_deferredRemovalLeftoversQueued = true;
+    pthread_mutex_unlock(&s_deferredRemovalMutex);
+
+    if (queueLeftovers)
+    {
+        // Queues the directory just renamed, too.
+        parentPath = ADUC_StringFormat("%s", trashPath);
+        char* lastSlash = (parentPath == NULL) ? NULL : strrchr(parentPath, '/');
+        if (lastSlash != NULL)
+        {
+            lastSlash[lastSlash == parentPath ? 1 : 0] = '\0';
+            QueueDeferredRemovalLeftovers(parentPath);
+            free(parentPath);
+            free(trashPath);
+            return 0;
+        }
+
+        free(parentPath);
+    }
+
+    if (!QueueDeferredRemoval(trashPath))
+    {
+        const int result = ADUC_SystemUtils_RmDirRecursive(trashPath);
+        free(trashPath);
+        return result;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Waits until the directories queued by ADUC_SystemUtils_RmDirRecursiveDeferred are removed.
+ */
+void ADUC_SystemUtils_WaitForDeferredRemovals()
+{
+    pthread_mutex_lock(&s_deferredRemovalMutex);
+    while (s_deferredRemovalPendingCount > 0)
+    {
+        pthread_cond_wait(&s_deferredRemovalCond, &s_deferredRemovalMutex);
+    }
+    pthread_mutex_unlock(&s_deferredRemovalMutex);
+}
+
 /**
  * @brief Takes the filename from @p filePath and concatenates it with @p dirPath and stores the result in @p newFilePath
  * @details newFilePath should be freed using STRING_delete() by caller
@@ -431,9 +705,143 @@ done:
     return succeeded;
 }
 
+/**
+ * @brief Size of the buffer used to copy files when the kernel can't copy them itself.
+ */
+#define ADUC_SYSTEMUTILS_COPY_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * @brief Returns whether a failed in-kernel copy can be retried with the next, more generic, method.
+ * @param error the errno of the failure
+ * @returns true if the method isn't supported for these files
+ */
+static _Bool ADUC_SystemUtils_IsCopyMethodUnsupported(int error)
+{
+    return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP || error == ENOTTY
+        || error == EPERM;
+}
+
+/**
+ * @brief Copies @p size bytes from @p sourceFd to @p destFd
+ * @details From cheapest to most expensive: shares the extents with a reflink on filesystems that support it
+ * (btrfs, XFS), copies within the kernel with copy_file_range or sendfile, and finally reads and writes
+ * through a large buffer.
+ * @param sourceFd file descriptor of the source file, at offset 0
+ * @param destFd file descriptor of the empty destination file
+ * @param size the size of the source file
+ * @returns 0 on success, -1 on failure
+ */
+static int ADUC_SystemUtils_CopyFileContents(int sourceFd, int destFd, off_t size)
+{
+    off_t copied = 0;
+
+#ifdef FICLONE
+    if (ioctl(destFd, FICLONE, sourceFd) == 0)
+    {
+        return 0;
+    }
+#endif
+
+    while (copied < size)
+    {
+        const ssize_t count = copy_file_range(sourceFd, NULL, destFd, NULL, (size_t)(size - copied), 0);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count < 0 && !(copied == 0 && ADUC_SystemUtils_IsCopyMethodUnsupported(errno)))
+        {
+            return -1;
+        }
+
+        if (count <= 0)
+        {
+            // Not supported for these files, or the file ended early: the next method carries on from here.
+            break;
+        }
+
+        copied += count;
+    }
+
+    while (copied < size)
+    {
+        const ssize_t count = sendfile(destFd, sourceFd, NULL, (size_t)(size - copied));
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (count < 0 && !(copied == 0 && ADUC_SystemUtils_IsCopyMethodUnsupported(errno)))
+        {
+            return -1;
+        }
+
+        if (count <= 0)
+        {
+            // Not supported for these files, or the file ended early: the next method carries on from here.
+            break;
+        }
+
+        copied += count;
+    }
+
+    // Files of procfs and the like report a size of 0, their content is only found by reading them.
+    if (size > 0 && copied >= size)
+    {
+        return 0;
+    }
+
+    int result = -1;
+    unsigned char* buffer = malloc(ADUC_SYSTEMUTILS_COPY_BUFFER_SIZE);
+
+    if (buffer == NULL)
+    {
+        return -1;
+    }
+
+    for (;;)
+    {
+        ssize_t readBytes = read(sourceFd, buffer, ADUC_SYSTEMUTILS_COPY_BUFFER_SIZE);
+        if (readBytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (readBytes < 0)
+        {
+            goto done;
+        }
+
+        if (readBytes == 0)
+        {
+            break;
+        }
+
+        for (ssize_t writtenBytes = 0; writtenBytes < readBytes;)
+        {
+            const ssize_t count = write(destFd, buffer + writtenBytes, (size_t)(readBytes - writtenBytes));
+            if (count < 0 && errno != EINTR)
+            {
+                goto done;
+            }
+
+            writtenBytes += (count < 0) ? 0 : count;
+        }
+    }
+
+    result = 0;
+
+done:
+    free(buffer);
+
+    return result;
+}
+
 /**
  * @brief Copies the file at @p filePath to @p dirPath with the same name
- * @details Preserves the ownership and filemode bit permissions
+ * @details Preserves the filemode bit permissions. The copy is done by the kernel when possible, see
+ * ADUC_SystemUtils_CopyFileContents.
  * @param filePath path to the file
  * @param dirPath path to the directory
  * @param overwriteExistingFile if set to true will overwrite the existing file in @p dirPath named with the filename in @p fileName if it exists
@@ -444,12 +852,9 @@ int ADUC_SystemUtils_CopyFileToDir(const char* filePath, const char* dirPath, co
     int result = -1;
     STRING_HANDLE destFilePath = NULL;
 
-    FILE* sourceFile = NULL;
-    FILE* destFile = NULL;
-    const size_t readMaxBuffSize = 1024;
-    unsigned char readBuff[readMaxBuffSize];
-
-    memset(readBuff, 0, readMaxBuffSize);
+    int sourceFd = -1;
+    int destFd = -1;
+    _Bool createdDestFile = false;
 
     if (filePath == NULL || dirPath == NULL)
     {
@@ -461,54 +866,37 @@ int ADUC_SystemUtils_CopyFileToDir(const char* filePath, const char* dirPath, co
         goto done;
     }
 
-    sourceFile = fopen(filePath, "rb");
+    sourceFd = open(filePath, O_RDONLY | O_CLOEXEC);
 
-    if (sourceFile == NULL)
+    if (sourceFd == -1)
     {
         goto done;
     }
 
-    if (overwriteExistingFile)
-    {
-        destFile = fopen(STRING_c_str(destFilePath), "wb+");
-    }
-    else
-    {
-        destFile = fopen(STRING_c_str(destFilePath), "wb");
-    }
-
-    if (destFile == NULL)
+    struct stat buff;
+    if (fstat(sourceFd, &buff) != 0)
     {
         goto done;
     }
 
-    size_t readBytes = fread(readBuff, readMaxBuffSize, sizeof(readBuff[0]), sourceFile);
+    destFd = open(
+        STRING_c_str(destFilePath),
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (overwriteExistingFile ? 0 : O_EXCL),
+        S_IRUSR | S_IWUSR);
 
-    while (readBytes != 0 && feof(sourceFile) != 0)
+    if (destFd == -1)
     {
-        const size_t writtenBytes = fwrite(readBuff, readBytes, sizeof(readBuff[0]), destFile);
-
-        result = ferror(destFile);
-        if (writtenBytes != readBytes || result != 0)
-        {
-            goto done;
-        }
-
-        readBytes = fread(readBuff, readMaxBuffSize, sizeof(readBuff[0]), sourceFile);
-        result = ferror(sourceFile);
-        if (result != 0)
-        {
-            goto done;
-        }
+        goto done;
     }
 
-    struct stat buff;
-    if (stat(filePath, &buff) != 0)
+    createdDestFile = true;
+
+    if (ADUC_SystemUtils_CopyFileContents(sourceFd, destFd, buff.st_size) != 0)
     {
         goto done;
     }
 
-    if (chmod(STRING_c_str(destFilePath), buff.st_mode) != 0)
+    if (fchmod(destFd, buff.st_mode & ALL_PERMS) != 0)
     {
         goto done;
     }
@@ -516,10 +904,17 @@ int ADUC_SystemUtils_CopyFileToDir(const char* filePath, const char* dirPath, co
     result = 0;
 done:
 
-    fclose(sourceFile);
-    fclose(destFile);
+    if (sourceFd != -1)
+    {
+        close(sourceFd);
+    }
+
+    if (destFd != -1 && close(destFd) != 0)
+    {
+        result = -1;
+    }
 
-    if (result != 0)
+    if (result != 0 && createdDestFile)
     {
         remove(STRING_c_str(destFilePath));
     }
@@ -651,6 +1046,311 @@ done:
     return status;
 }
 
+/**
+ * @brief Gets the disk space available to the agent on the file system of @p path.
+ * @details If @p path does not exist yet, e.g. a sandbox not created yet, uses its nearest existing ancestor.
+ *
+ * @param path The path.
+ * @param[out] availableBytes Receives the bytes available to unprivileged users.
+ * @return int On success 0 is returned; otherwise errno.
+ */
+int ADUC_SystemUtils_GetAvailableDiskSpace(const char* path, uint64_t* availableBytes)
+{
+    char dir[PATH_MAX];
+    struct statvfs st;
+
+    if (path == NULL || availableBytes == NULL || strlen(path) >= sizeof(dir))
+    {
+        return EINVAL;
+    }
+
+    strcpy(dir, path);
+
+    while (statvfs(dir, &st) != 0)
+    {
+        char* lastSlash = strrchr(dir, '/');
+        if (errno != ENOENT || lastSlash == NULL)
+        {
+            return errno;
+        }
+
+        // Try the parent, "/" for a top-level path.
+        lastSlash[lastSlash == dir ? 1 : 0] = '\0';
+    }
+
+    *availableBytes = (uint64_t)st.f_bavail * (uint64_t)st.f_frsize;
+    return 0;
+}
+
+/**
+ * @brief Reserves the disk space of @p length bytes from @p offset of the file, without changing its size, so that
+ * writing them later cannot fail for lack of space.
+ * @details File systems that cannot reserve space are not an error; the writes then allocate the space as usual.
+ *
+ * @param fd The file descriptor, open for writing.
+ * @param offset The offset of the range to reserve.
+ * @param length The length of the range to reserve. Nothing is reserved if it's not positive.
+ * @return int On success, or if the file system cannot reserve space, 0 is returned; otherwise errno, e.g. ENOSPC.
+ */
+int ADUC_SystemUtils_ReserveFileSpace(int fd, off_t offset, off_t length)
+{
+    if (length <= 0)
+    {
+        return 0;
+    }
+
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, length) != 0)
+    {
+        if (errno == EOPNOTSUPP || errno == ENOSYS)
+        {
+            return 0;
+        }
+
+        return errno;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Returns whether the executable of the current process was replaced, or removed, since the process started,
+ * e.g. by an update of its package.
+ * @details /proc/self/exe keeps referring to the file the process was started from, while its path refers to the
+ * file installed now, if any.
+ *
+ * @return _Bool true if the executable was replaced, or if that cannot be determined.
+ */
+_Bool ADUC_SystemUtils_IsCurrentExecutableReplaced()
+{
+    static const char deletedSuffix[] = " (deleted)";
+    char path[PATH_MAX];
+    struct stat running;
+    struct stat installed;
+
+    const ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length <= 0 || stat("/proc/self/exe", &running) != 0)
+    {
+        return true;
+    }
+
+    path[length] = '\0';
+
+    // The link names a removed file with this suffix, though a file may have been installed at its path since.
+    const size_t suffixLength = sizeof(deletedSuffix) - 1;
+    if ((size_t)length > suffixLength && strcmp(path + length - suffixLength, deletedSuffix) == 0)
+    {
+        path[length - suffixLength] = '\0';
+    }
+
+    if (stat(path, &installed) != 0)
+    {
+        return true;
+    }
+
+    return running.st_dev != installed.st_dev || running.st_ino != installed.st_ino;
+}
+
+#ifndef ADUC_RAM_STAGING_FOLDER
+/**
+ * @brief The RAM-backed folder where small downloads are staged, see ADUC_SystemUtils_BeginRamStaging.
+ */
+#    define ADUC_RAM_STAGING_FOLDER "/dev/shm/adu-staging"
+#endif
+
+/**
+ * @brief The policy of ADUC_SystemUtils_SetRamStaging, whether ADUC_RAM_STAGING_FOLDER was found usable, and the
+ * bytes of the stagings begun and not yet ended.
+ */
+static pthread_mutex_t s_ramStagingMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t s_ramStagingThresholdBytes = 0;
+static uint64_t s_ramStagingBudgetBytes = 0;
+static _Bool s_ramStagingFolderChecked = false;
+static _Bool s_ramStagingFolderUsable = false;
+static uint64_t s_ramStagingPendingBytes = 0;
+
+/**
+ * @brief The bytes of the files under ADUC_RAM_STAGING_FOLDER, summed by SumRamStagingBytes_helper, which nftw gives no
+ * context. Only used with s_ramStagingMutex held.
+ */
+static uint64_t s_ramStagingUsedBytes = 0;
+
+static int SumRamStagingBytes_helper(const char* fpath, const struct stat* sb, int typeflag, struct FTW* info)
+{
+    UNREFERENCED_PARAMETER(fpath);
+    UNREFERENCED_PARAMETER(info);
+
+    if (typeflag == FTW_F)
+    {
+        s_ramStagingUsedBytes += (uint64_t)sb->st_size;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Checks that ADUC_RAM_STAGING_FOLDER, created if needed, is a folder of the current user on a tmpfs, so that
+ * neither another user nor the storage are in the way of the staged files.
+ *
+ * @return _Bool true if small downloads can be staged there.
+ */
+static _Bool IsRamStagingFolderUsable()
+{
+    struct stat st;
+    struct statfs fs;
+
+    if (mkdir(ADUC_RAM_STAGING_FOLDER, S_IRWXU | S_IRWXG) != 0 && errno != EEXIST)
+    {
+        Log_Warn("Cannot create RAM staging folder %s, errno %d. Not staging in RAM.", ADUC_RAM_STAGING_FOLDER, errno);
+        return false;
+    }
+
+    // lstat, so that a link planted in its place isn't followed.
+    if (lstat(ADUC_RAM_STAGING_FOLDER, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid())
+    {
+        Log_Warn(
+            "RAM staging folder %s isn't a folder of the agent user. Not staging in RAM.", ADUC_RAM_STAGING_FOLDER);
+        return false;
+    }
+
+    if (statfs(ADUC_RAM_STAGING_FOLDER, &fs) != 0 || fs.f_type != TMPFS_MAGIC)
+    {
+        Log_Warn("RAM staging folder %s isn't on a tmpfs. Not staging in RAM.", ADUC_RAM_STAGING_FOLDER);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Sets which downloads ADUC_SystemUtils_BeginRamStaging stages in RAM.
+ *
+ * @param thresholdBytes The size up to which files are staged; 0 to stage none.
+ * @param budgetBytes The most bytes staged at once, across the sandboxes.
+ */
+void ADUC_SystemUtils_SetRamStaging(uint64_t thresholdBytes, uint64_t budgetBytes)
+{
+    pthread_mutex_lock(&s_ramStagingMutex);
+    s_ramStagingThresholdBytes = thresholdBytes;
+    s_ramStagingBudgetBytes = budgetBytes;
+    s_ramStagingFolderChecked = false;
+    pthread_mutex_unlock(&s_ramStagingMutex);
+
+    if (thresholdBytes != 0)
+    {
+        Log_Info(
+            "Staging downloads up to %llu bytes in RAM, up to %llu bytes at once.",
+            (unsigned long long)thresholdBytes,
+            (unsigned long long)budgetBytes);
+    }
+}
+
+/**
+ * @brief Decides whether a file of @p sizeInBytes downloaded to the sandbox @p sandboxPath is staged in RAM, and if so
+ * creates its staging folder, which mirrors the sandbox under ADUC_RAM_STAGING_FOLDER.
+ * @details Files up to the threshold of ADUC_SystemUtils_SetRamStaging are staged while they fit the budget, along
+ * with the files already staged and the stagings in progress. Larger files, or all of them once the budget is used,
+ * stay in the sandbox on the storage.
+ *
+ * @param sandboxPath The sandbox, an absolute path.
+ * @param sizeInBytes The size of the file.
+ * @param[out] stagingPath Receives the staging folder to download the file to, if it's staged.
+ * @param stagingPathSize The size of @p stagingPath.
+ * @return _Bool true if the file is staged; then ADUC_SystemUtils_EndRamStaging must be called once it's downloaded,
+ * or failed to.
+ */
+_Bool ADUC_SystemUtils_BeginRamStaging(
+    const char* sandboxPath, uint64_t sizeInBytes, char* stagingPath, size_t stagingPathSize)
+{
+    _Bool staged = false;
+
+    pthread_mutex_lock(&s_ramStagingMutex);
+
+    if (s_ramStagingThresholdBytes == 0 || sizeInBytes == 0 || sizeInBytes > s_ramStagingThresholdBytes
+        || sandboxPath == NULL || sandboxPath[0] != '/')
+    {
+        goto done;
+    }
+
+    if (snprintf(stagingPath, stagingPathSize, "%s%s", ADUC_RAM_STAGING_FOLDER, sandboxPath) >= (int)stagingPathSize)
+    {
+        goto done;
+    }
+
+    if (!s_ramStagingFolderChecked)
+    {
+        s_ramStagingFolderUsable = IsRamStagingFolderUsable();
+        s_ramStagingFolderChecked = true;
+    }
+
+    if (!s_ramStagingFolderUsable)
+    {
+        goto done;
+    }
+
+    s_ramStagingUsedBytes = 0;
+    if (nftw(ADUC_RAM_STAGING_FOLDER, SumRamStagingBytes_helper, 20 /*nfds*/, FTW_MOUNT | FTW_PHYS) != 0)
+    {
+        goto done;
+    }
+
+    if (s_ramStagingUsedBytes + s_ramStagingPendingBytes + sizeInBytes > s_ramStagingBudgetBytes)
+    {
+        Log_Debug("RAM staging budget is used, downloading to the sandbox.");
+        goto done;
+    }
+
+    if (ADUC_SystemUtils_MkSandboxDirRecursive(stagingPath) != 0)
+    {
+        Log_Warn("Cannot create RAM staging folder %s, downloading to the sandbox.", stagingPath);
+        goto done;
+    }
+
+    s_ramStagingPendingBytes += sizeInBytes;
+    staged = true;
+
+done:
+    pthread_mutex_unlock(&s_ramStagingMutex);
+    return staged;
+}
+
+/**
+ * @brief Ends a staging begun by ADUC_SystemUtils_BeginRamStaging; the staged file, if any, now counts on its own.
+ *
+ * @param sizeInBytes The size of the file, as given to ADUC_SystemUtils_BeginRamStaging.
+ */
+void ADUC_SystemUtils_EndRamStaging(uint64_t sizeInBytes)
+{
+    pthread_mutex_lock(&s_ramStagingMutex);
+    s_ramStagingPendingBytes -= sizeInBytes < s_ramStagingPendingBytes ? sizeInBytes : s_ramStagingPendingBytes;
+    pthread_mutex_unlock(&s_ramStagingMutex);
+}
+
+/**
+ * @brief Removes the RAM staging folder of the sandbox @p sandboxPath, if any, which frees its part of the budget.
+ *
+ * @param sandboxPath The sandbox, an absolute path.
+ * @return int 0 on success, or if the sandbox has no staging folder; otherwise errno.
+ */
+int ADUC_SystemUtils_RmRamStagingDir(const char* sandboxPath)
+{
+    char stagingPath[PATH_MAX];
+    struct stat st;
+
+    if (sandboxPath == NULL
+        || snprintf(stagingPath, sizeof(stagingPath), "%s%s", ADUC_RAM_STAGING_FOLDER, sandboxPath)
+            >= (int)sizeof(stagingPath))
+    {
+        return EINVAL;
+    }
+
+    if (lstat(stagingPath, &st) != 0)
+    {
+        return errno == ENOENT ? 0 : errno;
+    }
+
+    return ADUC_SystemUtils_RmDirRecursive(stagingPath) == 0 ? 0 : errno;
+}
+
 /**
  * @brief Checks if the file object at the given path is a directory.
  * @param path The path.
@@ -0,0 +1,93 @@
+/**
+ * @file state_journal_ut.cpp
+ * @brief Unit Tests for the state journal.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+
+#include "aduc/state_journal.h"
+#include "aduc/system_utils.h"
+
+#include <cerrno>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static void CollectRecord(const char* record, void* context)
+{
+    static_cast<std::vector<std::string>*>(context)->emplace_back(record);
+}
+
+static std::vector<std::string> ReadJournal(const std::string& journalPath)
+{
+    std::vector<std::string> records;
+    size_t recordCount = 0;
+
+    CHECK(ADUC_StateJournal_ForEach(journalPath.c_str(), CollectRecord, &records, &recordCount) == 0);
+    CHECK(recordCount == records.size());
+
+    return records;
+}
+
+TEST_CASE("ADUC_StateJournal")
+{
+    const std::string journalPath{ std::string{ ADUC_SystemUtils_GetTemporaryPathName() } + "/state_journal_ut.journal" };
+    (void)remove(journalPath.c_str());
+
+    SECTION("A missing journal has no records")
+    {
+        CHECK(ReadJournal(journalPath).empty());
+    }
+
+    SECTION("Records are read back in order")
+    {
+        CHECK(ADUC_StateJournal_Append(journalPath.c_str(), R"({"state":"DownloadStarted"})") == 0);
+        CHECK(ADUC_StateJournal_Append(journalPath.c_str(), R"({"state":"DownloadSucceeded"})") == 0);
+        CHECK(ADUC_StateJournal_Append(journalPath.c_str(), "") == 0);
+
+        const std::vector<std::string> records = ReadJournal(journalPath);
+        REQUIRE(records.size() == 3);
+        CHECK(records[0] == R"({"state":"DownloadStarted"})");
+        CHECK(records[1] == R"({"state":"DownloadSucceeded"})");
+        CHECK(records[2].empty());
+    }
+
+    SECTION("A record cut short is skipped")
+    {
+        CHECK(ADUC_StateJournal_Append(journalPath.c_str(), "first") == 0);
+        {
+            std::ofstream journal{ journalPath, std::ios::app };
+            journal << "partial";
+        }
+
+        const std::vector<std::string> records = ReadJournal(journalPath);
+        REQUIRE(records.size() == 1);
+        CHECK(records[0] == "first");
+    }
+
+    SECTION("Records must be one line")
+    {
+        CHECK(ADUC_StateJournal_Append(journalPath.c_str(), "two\nlines") == EINVAL);
+        CHECK(ADUC_StateJournal_Compact(journalPath.c_str(), "two\nlines") == EINVAL);
+        CHECK(ReadJournal(journalPath).empty());
+    }
+
+    SECTION("Compaction keeps one record, or none")
+    {
+        CHECK(ADUC_StateJournal_Append(journalPath.c_str(), "first") == 0);
+        CHECK(ADUC_StateJournal_Append(journalPath.c_str(), "second") == 0);
+
+        CHECK(ADUC_StateJournal_Compact(journalPath.c_str(), "last") == 0);
+        const std::vector<std::string> records = ReadJournal(journalPath);
+        REQUIRE(records.size() == 1);
+        CHECK(records[0] == "last");
+
+        CHECK(ADUC_StateJournal_Compact(journalPath.c_str(), nullptr) == 0);
+        CHECK(ReadJournal(journalPath).empty());
+        CHECK(ADUC_StateJournal_Compact(journalPath.c_str(), nullptr) == 0);
+    }
+
+    (void)remove(journalPath.c_str());
+}
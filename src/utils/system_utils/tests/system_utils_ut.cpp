@@ -9,7 +9,19 @@
 
 #include "aduc/system_utils.h"
 
+#include <climits> // for PATH_MAX
+#include <fstream>
+#include <sstream>
 #include <sys/stat.h>
+#include <unistd.h> // for rmdir
+
+static std::string ReadFile(const std::string& path)
+{
+    std::ifstream file{ path, std::ios::binary };
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
 
 TEST_CASE("ADUC_SystemUtils_GetTemporaryPathName")
 {
@@ -163,3 +175,168 @@ TEST_CASE_METHOD(TestCaseFixture, "ADUC_SystemUtils_RmDirRecursive")
         CHECK_FALSE(S_ISDIR(st.st_mode));
     }
 }
+
+TEST_CASE_METHOD(TestCaseFixture, "ADUC_SystemUtils_CopyFileToDir")
+{
+    const std::string sourceDir{ std::string{ TestPath() } + "/source" };
+    const std::string destDir{ std::string{ TestPath() } + "/dest" };
+    const std::string sourcePath{ sourceDir + "/payload.bin" };
+    const std::string destPath{ destDir + "/payload.bin" };
+
+    REQUIRE(ADUC_SystemUtils_MkDirRecursiveDefault(sourceDir.c_str()) == 0);
+    REQUIRE(ADUC_SystemUtils_MkDirRecursiveDefault(destDir.c_str()) == 0);
+
+    // Larger than the copy buffer, and not a multiple of it.
+    std::string content;
+    for (int i = 0; content.size() < 3 * 1024 * 1024 + 17; ++i)
+    {
+        content += std::to_string(i) + '\n';
+    }
+
+    {
+        std::ofstream file{ sourcePath, std::ios::binary };
+        file << content;
+    }
+    REQUIRE(chmod(sourcePath.c_str(), 0750) == 0);
+
+    SECTION("Copies content and mode")
+    {
+        CHECK(ADUC_SystemUtils_CopyFileToDir(sourcePath.c_str(), destDir.c_str(), false) == 0);
+        CHECK(ReadFile(destPath) == content);
+
+        struct stat st = {};
+        REQUIRE(stat(destPath.c_str(), &st) == 0);
+        CHECK((st.st_mode & 07777) == 0750);
+    }
+
+    SECTION("Overwrites an existing file only when asked to")
+    {
+        {
+            std::ofstream file{ destPath, std::ios::binary };
+            file << "existing content that is replaced";
+        }
+
+        CHECK(ADUC_SystemUtils_CopyFileToDir(sourcePath.c_str(), destDir.c_str(), false) != 0);
+        CHECK(ReadFile(destPath) == "existing content that is replaced");
+
+        CHECK(ADUC_SystemUtils_CopyFileToDir(sourcePath.c_str(), destDir.c_str(), true) == 0);
+        CHECK(ReadFile(destPath) == content);
+    }
+
+    SECTION("Copies an empty file")
+    {
+        {
+            std::ofstream file{ sourcePath, std::ios::binary | std::ios::trunc };
+        }
+
+        CHECK(ADUC_SystemUtils_CopyFileToDir(sourcePath.c_str(), destDir.c_str(), false) == 0);
+        CHECK(ReadFile(destPath).empty());
+    }
+
+    SECTION("Missing source file fails")
+    {
+        const std::string missingPath{ sourceDir + "/missing.bin" };
+
+        CHECK(ADUC_SystemUtils_CopyFileToDir(missingPath.c_str(), destDir.c_str(), false) != 0);
+
+        struct stat st = {};
+        CHECK(stat((destDir + "/missing.bin").c_str(), &st) != 0);
+    }
+}
+
+TEST_CASE_METHOD(TestCaseFixture, "ADUC_SystemUtils_GetAvailableDiskSpace")
+{
+    uint64_t availableBytes = 0;
+
+    SECTION("Existing folder")
+    {
+        CHECK(ADUC_SystemUtils_GetAvailableDiskSpace(ADUC_SystemUtils_GetTemporaryPathName(), &availableBytes) == 0);
+        CHECK(availableBytes > 0);
+    }
+
+    SECTION("A folder not created yet uses its nearest existing ancestor")
+    {
+        const std::string missingPath{ std::string{ TestPath() } + "/not/created/yet" };
+
+        CHECK(ADUC_SystemUtils_GetAvailableDiskSpace(missingPath.c_str(), &availableBytes) == 0);
+        CHECK(availableBytes > 0);
+    }
+
+    SECTION("Invalid arguments")
+    {
+        CHECK(ADUC_SystemUtils_GetAvailableDiskSpace(nullptr, &availableBytes) != 0);
+        CHECK(ADUC_SystemUtils_GetAvailableDiskSpace("missing-relative-path", &availableBytes) != 0);
+    }
+}
+
+TEST_CASE_METHOD(TestCaseFixture, "ADUC_SystemUtils_ReserveFileSpace")
+{
+    REQUIRE(ADUC_SystemUtils_MkDirRecursiveDefault(TestPath()) == 0);
+    const std::string filePath{ std::string{ TestPath() } + "/reserved.bin" };
+
+    FILE* file = fopen(filePath.c_str(), "wb");
+    REQUIRE(file != nullptr);
+
+    CHECK(ADUC_SystemUtils_ReserveFileSpace(fileno(file), 0, 0) == 0);
+    CHECK(ADUC_SystemUtils_ReserveFileSpace(fileno(file), 0, 64 * 1024) == 0);
+    fclose(file);
+
+    // The reservation doesn't change the size of the file.
+    struct stat st = {};
+    REQUIRE(stat(filePath.c_str(), &st) == 0);
+    CHECK(st.st_size == 0);
+}
+
+TEST_CASE("ADUC_SystemUtils_IsCurrentExecutableReplaced")
+{
+    // The test executable is the one at its path.
+    CHECK_FALSE(ADUC_SystemUtils_IsCurrentExecutableReplaced());
+}
+
+TEST_CASE_METHOD(TestCaseFixture, "ADUC_SystemUtils_RmDirRecursiveDeferred")
+{
+    const std::string sandboxPath{ std::string{ TestPath() } + "/sandbox" };
+    REQUIRE(ADUC_SystemUtils_MkDirRecursiveDefault((sandboxPath + "/sub").c_str()) == 0);
+    {
+        std::ofstream file{ sandboxPath + "/sub/payload.bin", std::ios::binary };
+        file << "payload";
+    }
+
+    CHECK(ADUC_SystemUtils_RmDirRecursiveDeferred(sandboxPath.c_str()) == 0);
+
+    // The sandbox is gone right away, and can be created again while the old one is being removed.
+    struct stat st = {};
+    CHECK(stat(sandboxPath.c_str(), &st) != 0);
+    CHECK(ADUC_SystemUtils_MkDirRecursiveDefault(sandboxPath.c_str()) == 0);
+
+    ADUC_SystemUtils_WaitForDeferredRemovals();
+
+    // Only the new sandbox is left.
+    CHECK(ADUC_SystemUtils_RmDirRecursive(sandboxPath.c_str()) == 0);
+    CHECK(rmdir(TestPath()) == 0);
+
+    CHECK(ADUC_SystemUtils_RmDirRecursiveDeferred(sandboxPath.c_str()) != 0);
+    CHECK(ADUC_SystemUtils_RmDirRecursiveDeferred(nullptr) != 0);
+}
+
+TEST_CASE("ADUC_SystemUtils_BeginRamStaging")
+{
+    char stagingPath[PATH_MAX];
+
+    // Nothing is staged without a threshold.
+    CHECK_FALSE(ADUC_SystemUtils_BeginRamStaging("/var/lib/adu/downloads/1", 1024, stagingPath, sizeof(stagingPath)));
+
+    ADUC_SystemUtils_SetRamStaging(64 * 1024, 1024 * 1024);
+
+    // Nor are files over the threshold, files of unknown size, or files of relative sandboxes.
+    CHECK_FALSE(
+        ADUC_SystemUtils_BeginRamStaging("/var/lib/adu/downloads/1", 65 * 1024, stagingPath, sizeof(stagingPath)));
+    CHECK_FALSE(ADUC_SystemUtils_BeginRamStaging("/var/lib/adu/downloads/1", 0, stagingPath, sizeof(stagingPath)));
+    CHECK_FALSE(ADUC_SystemUtils_BeginRamStaging("downloads/1", 1024, stagingPath, sizeof(stagingPath)));
+
+    ADUC_SystemUtils_SetRamStaging(0, 0);
+
+    // A sandbox without a staging folder has nothing to remove.
+    CHECK(ADUC_SystemUtils_RmRamStagingDir("/var/lib/adu/downloads/missing") == 0);
+    CHECK(ADUC_SystemUtils_RmRamStagingDir(nullptr) != 0);
+}
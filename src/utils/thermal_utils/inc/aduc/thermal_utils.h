@@ -0,0 +1,102 @@
+/**
+ * @file thermal_utils.h
+ * @brief Pauses the CPU-heavy work of deployments, e.g. hashing, decompression and installs, while the device is too
+ * hot or its battery too low, and resumes it once it has cooled down or charged.
+ *
+ * The temperature is the highest of the thermal zones in /sys/class/thermal, and the power supplies are read from
+ * /sys/class/power_supply; the readings are refreshed at most every ADUC_THERMAL_REFRESH_INTERVAL_MS.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_THERMAL_UTILS_H
+#define ADUC_THERMAL_UTILS_H
+
+#include <aduc/c_utils.h> // for EXTERN_C_BEGIN, EXTERN_C_END
+#include <aduc/cancellation_token.h>
+#include <stdbool.h>
+#include <stddef.h> // for size_t
+
+/**
+ * @brief How much the temperature must drop under the limit, in degrees Celsius, before paused work resumes, so that
+ * it doesn't pause and resume at every reading around the limit.
+ */
+#define ADUC_THERMAL_HYSTERESIS_C 5
+
+/**
+ * @brief How much the battery must charge over the limit, in percent, before paused work resumes.
+ */
+#define ADUC_THERMAL_BATTERY_HYSTERESIS_PERCENT 5
+
+/**
+ * @brief The interval of the sysfs readings, in milliseconds, and of the checks of paused work.
+ */
+#define ADUC_THERMAL_REFRESH_INTERVAL_MS 1000
+
+/**
+ * @brief The longest a wait without a cancellation token pauses, in milliseconds. Past it, the work goes on, and the
+ * thread doesn't pause again without a token until the device is back within the limits.
+ */
+#define ADUC_THERMAL_MAX_UNCANCELLABLE_WAIT_MS (10 * 60 * 1000)
+
+/**
+ * @brief The size of the reasons of ADUC_Thermal_GetPause, including the terminating null.
+ */
+#define ADUC_THERMAL_REASON_SIZE 128
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Sets the limits past which heavy work pauses, from the next ADUC_Thermal_WaitForHeadroom on.
+ *
+ * @param maxTemperatureC The highest temperature, in degrees Celsius. 0, the default, for no limit.
+ * @param minBatteryPercent The lowest battery charge while not on external power, in percent. 0, the default, for no
+ * limit.
+ */
+void ADUC_Thermal_SetLimits(unsigned int maxTemperatureC, unsigned int minBatteryPercent);
+
+/**
+ * @brief Sets the folder sysfs is read from, for tests.
+ *
+ * @param folder The folder, or NULL for /sys.
+ */
+void ADUC_Thermal_SetSysfsFolder(const char* folder);
+
+/**
+ * @brief Sets the longest a wait without a cancellation token pauses, for tests.
+ *
+ * @param maxWaitMs The wait, in milliseconds, e.g. ADUC_THERMAL_MAX_UNCANCELLABLE_WAIT_MS, the default.
+ */
+void ADUC_Thermal_SetMaxUncancellableWait(unsigned int maxWaitMs);
+
+/**
+ * @brief Keeps heavy work on the calling thread from ever pausing, e.g. on the agent's main loop, which must keep
+ * processing the twin, and cancels, while the device is hot.
+ */
+void ADUC_Thermal_ExcludeCurrentThread(void);
+
+/**
+ * @brief Called by heavy work, between units of it, e.g. blocks of a hashed file: returns right away within the
+ * limits, and otherwise waits until the device is back under them by their hysteresis.
+ *
+ * Without @p token, the wait lasts ADUC_THERMAL_MAX_UNCANCELLABLE_WAIT_MS at most. On the thread excluded with
+ * ADUC_Thermal_ExcludeCurrentThread, it returns right away.
+ *
+ * @param token Cancels the wait, or NULL.
+ * @returns False if the wait was cancelled.
+ */
+bool ADUC_Thermal_WaitForHeadroom(const ADUC_CancellationToken* token);
+
+/**
+ * @brief Gets whether heavy work is paused, and why, to report it.
+ *
+ * @param generation Output, a number that changes when heavy work pauses or resumes.
+ * @param reason Output, the reason of the pause, e.g. "temperature 86 C, over the limit of 80 C", or "" if it isn't.
+ * @param reasonSize The size of @p reason, e.g. ADUC_THERMAL_REASON_SIZE.
+ * @returns True if heavy work is paused.
+ */
+bool ADUC_Thermal_GetPause(unsigned int* generation, char* reason, size_t reasonSize);
+
+EXTERN_C_END
+
+#endif // ADUC_THERMAL_UTILS_H
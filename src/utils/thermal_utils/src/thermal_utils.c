@@ -0,0 +1,405 @@
+/**
+ * @file thermal_utils.c
+ * @brief Implements pausing heavy work while the device is too hot or its battery too low.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/thermal_utils.h"
+#include "aduc/logging.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h> // for PATH_MAX
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h> // for fopen, snprintf
+#include <stdlib.h> // for strtol
+#include <string.h> // for strcmp, strncmp
+#include <time.h> // for clock_gettime
+
+/**
+ * @brief The default folder of sysfs.
+ */
+#define SYSFS_FOLDER "/sys"
+
+/**
+ * @brief A reading of the thermal zones and power supplies.
+ */
+typedef struct tagADUC_ThermalReadings
+{
+    bool HasTemperature; /**< False if there are no thermal zones. */
+    long TemperatureMilliC; /**< The highest temperature of the thermal zones, in thousandths of a degree Celsius. */
+    long BatteryPercent; /**< The lowest charge of the batteries, or -1 if there are none. */
+    bool ExternalPower; /**< True if a mains or USB power supply is online. */
+} ADUC_ThermalReadings;
+
+/**
+ * @brief Guards the state below.
+ */
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int s_maxTemperatureC = 0;
+static unsigned int s_minBatteryPercent = 0;
+static char s_sysfsFolder[PATH_MAX] = SYSFS_FOLDER;
+
+/**
+ * @brief The last reading, and its time from ReadClock; a time of 0 for none.
+ */
+static ADUC_ThermalReadings s_readings;
+static long long s_readingTime = 0;
+
+/**
+ * @brief The threads waiting in ADUC_Thermal_WaitForHeadroom, the reason the first one gave, and the generation of
+ * ADUC_Thermal_GetPause.
+ */
+static unsigned int s_waiters = 0;
+static char s_reason[ADUC_THERMAL_REASON_SIZE] = "";
+static unsigned int s_generation = 0;
+
+/**
+ * @brief See ADUC_Thermal_SetMaxUncancellableWait and ADUC_Thermal_ExcludeCurrentThread.
+ */
+static unsigned int s_maxUncancellableWaitMs = ADUC_THERMAL_MAX_UNCANCELLABLE_WAIT_MS;
+static pthread_t s_excludedThread;
+static bool s_hasExcludedThread = false;
+
+/**
+ * @brief Whether the calling thread waited ADUC_THERMAL_MAX_UNCANCELLABLE_WAIT_MS without a token, so doesn't wait
+ * without one again until the device is back within the limits.
+ */
+static __thread bool t_uncancellableWaitExpired = false;
+
+/**
+ * @brief Returns the monotonic time in milliseconds, never 0.
+ */
+static long long ReadClock()
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000 + 1;
+}
+
+/**
+ * @brief Reads the first line of the sysfs attribute @p name of the folder @p folder, without the newline.
+ *
+ * @returns False if the attribute can't be read, e.g. doesn't exist.
+ */
+static bool ReadAttribute(const char* folder, const char* name, char* value, size_t size)
+{
+    char path[PATH_MAX];
+    bool success = false;
+
+    if (snprintf(path, sizeof(path), "%s/%s", folder, name) >= (int)sizeof(path))
+    {
+        return false;
+    }
+
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    if (fgets(value, (int)size, file) != NULL)
+    {
+        value[strcspn(value, "\n")] = '\0';
+        success = true;
+    }
+
+    fclose(file);
+    return success;
+}
+
+/**
+ * @brief Reads the sysfs attribute @p name of the folder @p folder as a number.
+ */
+static bool ReadNumberAttribute(const char* folder, const char* name, long* value)
+{
+    char text[32];
+    char* end = NULL;
+
+    if (!ReadAttribute(folder, name, text, sizeof(text)) || text[0] == '\0')
+    {
+        return false;
+    }
+
+    errno = 0;
+    *value = strtol(text, &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+/**
+ * @brief Reads the thermal zones and power supplies under @p sysfsFolder into @p readings.
+ */
+static void ReadSysfs(const char* sysfsFolder, ADUC_ThermalReadings* readings)
+{
+    char folder[PATH_MAX];
+    DIR* dir = NULL;
+    struct dirent* entry = NULL;
+
+    memset(readings, 0, sizeof(*readings));
+    readings->BatteryPercent = -1;
+
+    (void)snprintf(folder, sizeof(folder), "%s/class/thermal", sysfsFolder);
+    dir = opendir(folder);
+    while (dir != NULL && (entry = readdir(dir)) != NULL)
+    {
+        char zoneFolder[PATH_MAX];
+        long temperature = 0;
+
+        if (strncmp(entry->d_name, "thermal_zone", strlen("thermal_zone")) != 0)
+        {
+            continue;
+        }
+
+        if (snprintf(zoneFolder, sizeof(zoneFolder), "%s/%s", folder, entry->d_name) >= (int)sizeof(zoneFolder))
+        {
+            continue;
+        }
+
+        // A zone that is disabled, or whose sensor is asleep, fails the read.
+        if (ReadNumberAttribute(zoneFolder, "temp", &temperature)
+            && (!readings->HasTemperature || temperature > readings->TemperatureMilliC))
+        {
+            readings->HasTemperature = true;
+            readings->TemperatureMilliC = temperature;
+        }
+    }
+
+    if (dir != NULL)
+    {
+        closedir(dir);
+    }
+
+    (void)snprintf(folder, sizeof(folder), "%s/class/power_supply", sysfsFolder);
+    dir = opendir(folder);
+    while (dir != NULL && (entry = readdir(dir)) != NULL)
+    {
+        char supplyFolder[PATH_MAX];
+        char type[32];
+        char scope[32];
+        long value = 0;
+
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        if (snprintf(supplyFolder, sizeof(supplyFolder), "%s/%s", folder, entry->d_name) >= (int)sizeof(supplyFolder)
+            || !ReadAttribute(supplyFolder, "type", type, sizeof(type)))
+        {
+            continue;
+        }
+
+        // The batteries of peripherals, e.g. of a wireless mouse, don't power the device.
+        if (ReadAttribute(supplyFolder, "scope", scope, sizeof(scope)) && strcmp(scope, "Device") == 0)
+        {
+            continue;
+        }
+
+        if (strcmp(type, "Battery") == 0)
+        {
+            if (ReadNumberAttribute(supplyFolder, "capacity", &value)
+                && (readings->BatteryPercent < 0 || value < readings->BatteryPercent))
+            {
+                readings->BatteryPercent = value;
+            }
+        }
+        else if (ReadNumberAttribute(supplyFolder, "online", &value) && value != 0)
+        {
+            readings->ExternalPower = true;
+        }
+    }
+
+    if (dir != NULL)
+    {
+        closedir(dir);
+    }
+}
+
+/**
+ * @brief Checks the readings, refreshed if they are older than ADUC_THERMAL_REFRESH_INTERVAL_MS, against the limits.
+ *
+ * @param paused True to check against the limits less their hysteresis, for work that is paused.
+ * @param reason Output, why the readings are over the limits.
+ * @param reasonSize The size of @p reason.
+ * @returns True if the readings are over the limits.
+ */
+static bool IsOverLimits(bool paused, char* reason, size_t reasonSize)
+{
+    bool over = false;
+    const long long now = ReadClock();
+
+    pthread_mutex_lock(&s_mutex);
+
+    if (s_maxTemperatureC == 0 && s_minBatteryPercent == 0)
+    {
+        goto done;
+    }
+
+    if (s_readingTime == 0 || now - s_readingTime >= ADUC_THERMAL_REFRESH_INTERVAL_MS)
+    {
+        ReadSysfs(s_sysfsFolder, &s_readings);
+        s_readingTime = now;
+    }
+
+    if (s_maxTemperatureC != 0 && s_readings.HasTemperature)
+    {
+        const long limitMilliC = ((long)s_maxTemperatureC - (paused ? ADUC_THERMAL_HYSTERESIS_C : 0)) * 1000;
+
+        if (s_readings.TemperatureMilliC > limitMilliC)
+        {
+            (void)snprintf(
+                reason,
+                reasonSize,
+                "temperature %ld C, over the limit of %u C",
+                s_readings.TemperatureMilliC / 1000,
+                s_maxTemperatureC);
+            over = true;
+            goto done;
+        }
+    }
+
+    if (s_minBatteryPercent != 0 && s_readings.BatteryPercent >= 0 && !s_readings.ExternalPower)
+    {
+        const long limitPercent = (long)s_minBatteryPercent + (paused ? ADUC_THERMAL_BATTERY_HYSTERESIS_PERCENT : 0);
+
+        if (s_readings.BatteryPercent < limitPercent)
+        {
+            (void)snprintf(
+                reason,
+                reasonSize,
+                "battery at %ld%% without external power, under the limit of %u%%",
+                s_readings.BatteryPercent,
+                s_minBatteryPercent);
+            over = true;
+        }
+    }
+
+done:
+    pthread_mutex_unlock(&s_mutex);
+    return over;
+}
+
+void ADUC_Thermal_SetLimits(unsigned int maxTemperatureC, unsigned int minBatteryPercent)
+{
+    pthread_mutex_lock(&s_mutex);
+    s_maxTemperatureC = maxTemperatureC;
+    s_minBatteryPercent = minBatteryPercent;
+    pthread_mutex_unlock(&s_mutex);
+}
+
+void ADUC_Thermal_SetSysfsFolder(const char* folder)
+{
+    pthread_mutex_lock(&s_mutex);
+    (void)snprintf(s_sysfsFolder, sizeof(s_sysfsFolder), "%s", folder == NULL ? SYSFS_FOLDER : folder);
+    s_readingTime = 0;
+    pthread_mutex_unlock(&s_mutex);
+}
+
+void ADUC_Thermal_SetMaxUncancellableWait(unsigned int maxWaitMs)
+{
+    pthread_mutex_lock(&s_mutex);
+    s_maxUncancellableWaitMs = maxWaitMs;
+    pthread_mutex_unlock(&s_mutex);
+}
+
+void ADUC_Thermal_ExcludeCurrentThread(void)
+{
+    pthread_mutex_lock(&s_mutex);
+    s_excludedThread = pthread_self();
+    s_hasExcludedThread = true;
+    pthread_mutex_unlock(&s_mutex);
+}
+
+bool ADUC_Thermal_WaitForHeadroom(const ADUC_CancellationToken* token)
+{
+    char reason[ADUC_THERMAL_REASON_SIZE];
+    bool cancelled = false;
+    bool expired = false;
+
+    pthread_mutex_lock(&s_mutex);
+    const bool excluded = s_hasExcludedThread && pthread_equal(s_excludedThread, pthread_self());
+    const unsigned int maxWaitMs = s_maxUncancellableWaitMs;
+    pthread_mutex_unlock(&s_mutex);
+
+    const long long deadline = ReadClock() + maxWaitMs;
+
+    if (excluded)
+    {
+        return true;
+    }
+
+    if (!IsOverLimits(false /* paused */, reason, sizeof(reason)))
+    {
+        t_uncancellableWaitExpired = false;
+        return true;
+    }
+
+    if (token == NULL && t_uncancellableWaitExpired)
+    {
+        return true;
+    }
+
+    Log_Warn("Pausing heavy work: %s", reason);
+
+    pthread_mutex_lock(&s_mutex);
+    if (s_waiters++ == 0)
+    {
+        (void)snprintf(s_reason, sizeof(s_reason), "%s", reason);
+        s_generation++;
+    }
+    pthread_mutex_unlock(&s_mutex);
+
+    while (!cancelled && IsOverLimits(true /* paused */, reason, sizeof(reason)))
+    {
+        struct pollfd cancelPollFd = { ADUC_CancellationToken_GetFd(token), POLLIN, 0 };
+
+        // Without a file descriptor, e.g. without a token, poll() just waits.
+        cancelled = poll(&cancelPollFd, 1, ADUC_THERMAL_REFRESH_INTERVAL_MS) > 0
+            || ADUC_CancellationToken_IsCancelled(token);
+
+        // Nothing can cancel a wait without a token, e.g. of a hash on behalf of a worker that was cancelled.
+        if (token == NULL && ReadClock() >= deadline)
+        {
+            expired = true;
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&s_mutex);
+    if (--s_waiters == 0)
+    {
+        s_reason[0] = '\0';
+        s_generation++;
+    }
+    pthread_mutex_unlock(&s_mutex);
+
+    if (cancelled)
+    {
+        Log_Info("Stopped waiting to resume heavy work: cancelled");
+        return false;
+    }
+
+    if (expired)
+    {
+        Log_Warn("Resuming heavy work after %u ms, still over the limits: %s", maxWaitMs, reason);
+        t_uncancellableWaitExpired = true;
+        return true;
+    }
+
+    Log_Info("Resuming heavy work");
+    return true;
+}
+
+bool ADUC_Thermal_GetPause(unsigned int* generation, char* reason, size_t reasonSize)
+{
+    pthread_mutex_lock(&s_mutex);
+    const bool paused = s_waiters > 0;
+    *generation = s_generation;
+    (void)snprintf(reason, reasonSize, "%s", s_reason);
+    pthread_mutex_unlock(&s_mutex);
+
+    return paused;
+}
@@ -0,0 +1,196 @@
+/**
+ * @file thermal_utils_ut.cpp
+ * @brief Unit tests for thermal_utils.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/thermal_utils.h"
+
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <stdlib.h> // for mkdtemp
+#include <string>
+#include <sys/stat.h> // for mkdir
+#include <thread>
+
+/**
+ * @brief A sysfs folder of thermal zones and power supplies, which the tests point thermal_utils to.
+ */
+class FakeSysfs
+{
+public:
+    FakeSysfs()
+    {
+        char folder[] = "/tmp/thermal_utils_ut_XXXXXX";
+        REQUIRE(mkdtemp(folder) != nullptr);
+        _folder = folder;
+
+        for (const char* subfolder : { "/class", "/class/thermal", "/class/power_supply" })
+        {
+            REQUIRE(mkdir((_folder + subfolder).c_str(), 0755) == 0);
+        }
+
+        ADUC_Thermal_SetSysfsFolder(_folder.c_str());
+    }
+
+    ~FakeSysfs()
+    {
+        ADUC_Thermal_SetLimits(0, 0);
+        ADUC_Thermal_SetSysfsFolder(nullptr);
+        (void)system(("rm -rf " + _folder).c_str());
+    }
+
+    FakeSysfs(const FakeSysfs&) = delete;
+    FakeSysfs& operator=(const FakeSysfs&) = delete;
+
+    /**
+     * @brief Sets the attribute @p name of the device @p device of the class @p className, and drops the reading of
+     * thermal_utils, so that it reads the new value right away.
+     */
+    void Set(const std::string& className, const std::string& device, const std::string& name, const std::string& value)
+    {
+        const std::string deviceFolder = _folder + "/class/" + className + "/" + device;
+        (void)mkdir(deviceFolder.c_str(), 0755);
+        std::ofstream{ deviceFolder + "/" + name } << value << "\n";
+        ADUC_Thermal_SetSysfsFolder(_folder.c_str());
+    }
+
+private:
+    std::string _folder;
+};
+
+static bool IsPaused(std::string* reason = nullptr)
+{
+    unsigned int generation = 0;
+    char buffer[ADUC_THERMAL_REASON_SIZE];
+    const bool paused = ADUC_Thermal_GetPause(&generation, buffer, sizeof(buffer));
+    if (reason != nullptr)
+    {
+        *reason = buffer;
+    }
+    return paused;
+}
+
+TEST_CASE("ADUC_Thermal_WaitForHeadroom returns right away within the limits")
+{
+    FakeSysfs sysfs;
+    sysfs.Set("thermal", "thermal_zone0", "temp", "95000");
+    sysfs.Set("power_supply", "battery", "type", "Battery");
+    sysfs.Set("power_supply", "battery", "capacity", "5");
+
+    // No limits.
+    CHECK(ADUC_Thermal_WaitForHeadroom(nullptr));
+
+    // On external power, the battery doesn't matter.
+    ADUC_Thermal_SetLimits(100, 20);
+    sysfs.Set("power_supply", "ac", "type", "Mains");
+    sysfs.Set("power_supply", "ac", "online", "1");
+    CHECK(ADUC_Thermal_WaitForHeadroom(nullptr));
+
+    // Nor does the battery of a peripheral.
+    sysfs.Set("power_supply", "ac", "online", "0");
+    sysfs.Set("power_supply", "battery", "scope", "Device");
+    CHECK(ADUC_Thermal_WaitForHeadroom(nullptr));
+
+    CHECK_FALSE(IsPaused());
+}
+
+TEST_CASE("ADUC_Thermal_WaitForHeadroom waits until the device has cooled down")
+{
+    FakeSysfs sysfs;
+    sysfs.Set("thermal", "thermal_zone0", "temp", "45000");
+    sysfs.Set("thermal", "thermal_zone1", "temp", "86000");
+    ADUC_Thermal_SetLimits(80, 0);
+
+    std::future<bool> wait = std::async(std::launch::async, []() { return ADUC_Thermal_WaitForHeadroom(nullptr); });
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{ 5 };
+    while (!IsPaused() && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 10 });
+    }
+
+    std::string reason;
+    REQUIRE(IsPaused(&reason));
+    CHECK(reason == "temperature 86 C, over the limit of 80 C");
+
+    // Under the limit, but not by its hysteresis.
+    sysfs.Set("thermal", "thermal_zone1", "temp", "78000");
+    CHECK(wait.wait_for(std::chrono::milliseconds{ 2 * ADUC_THERMAL_REFRESH_INTERVAL_MS })
+          == std::future_status::timeout);
+
+    sysfs.Set("thermal", "thermal_zone1", "temp", "74000");
+    REQUIRE(
+        wait.wait_for(std::chrono::milliseconds{ 3 * ADUC_THERMAL_REFRESH_INTERVAL_MS }) == std::future_status::ready);
+    CHECK(wait.get());
+    CHECK_FALSE(IsPaused(&reason));
+    CHECK(reason.empty());
+}
+
+TEST_CASE("ADUC_Thermal_WaitForHeadroom waits on a low battery until it's cancelled")
+{
+    FakeSysfs sysfs;
+    sysfs.Set("power_supply", "battery", "type", "Battery");
+    sysfs.Set("power_supply", "battery", "capacity", "15");
+    ADUC_Thermal_SetLimits(0, 20);
+
+    ADUC_CancellationToken* token = ADUC_CancellationToken_Create();
+    REQUIRE(token != nullptr);
+
+    std::future<bool> wait = std::async(std::launch::async, [token]() { return ADUC_Thermal_WaitForHeadroom(token); });
+    CHECK(wait.wait_for(std::chrono::milliseconds{ 200 }) == std::future_status::timeout);
+
+    std::string reason;
+    CHECK(IsPaused(&reason));
+    CHECK(reason == "battery at 15% without external power, under the limit of 20%");
+
+    ADUC_CancellationToken_Cancel(token);
+    REQUIRE(wait.wait_for(std::chrono::seconds{ 1 }) == std::future_status::ready);
+    CHECK_FALSE(wait.get());
+    CHECK_FALSE(IsPaused());
+
+    ADUC_CancellationToken_Destroy(token);
+}
+
+TEST_CASE("ADUC_Thermal_WaitForHeadroom without a token gives up after the max wait")
+{
+    FakeSysfs sysfs;
+    sysfs.Set("thermal", "thermal_zone0", "temp", "86000");
+    ADUC_Thermal_SetLimits(80, 0);
+    ADUC_Thermal_SetMaxUncancellableWait(200);
+
+    std::future<bool> wait = std::async(std::launch::async, []() {
+        const bool firstWait = ADUC_Thermal_WaitForHeadroom(nullptr);
+
+        // Still over the limit, the same thread doesn't pause again without a token.
+        const auto start = std::chrono::steady_clock::now();
+        const bool secondWait = ADUC_Thermal_WaitForHeadroom(nullptr);
+        return firstWait && secondWait && std::chrono::steady_clock::now() - start < std::chrono::milliseconds{ 100 };
+    });
+
+    REQUIRE(
+        wait.wait_for(std::chrono::milliseconds{ 3 * ADUC_THERMAL_REFRESH_INTERVAL_MS }) == std::future_status::ready);
+    CHECK(wait.get());
+    CHECK_FALSE(IsPaused());
+
+    ADUC_Thermal_SetMaxUncancellableWait(ADUC_THERMAL_MAX_UNCANCELLABLE_WAIT_MS);
+}
+
+TEST_CASE("ADUC_Thermal_WaitForHeadroom doesn't pause the excluded thread")
+{
+    FakeSysfs sysfs;
+    sysfs.Set("thermal", "thermal_zone0", "temp", "86000");
+    ADUC_Thermal_SetLimits(80, 0);
+
+    std::future<bool> wait = std::async(std::launch::async, []() {
+        ADUC_Thermal_ExcludeCurrentThread();
+        return ADUC_Thermal_WaitForHeadroom(nullptr);
+    });
+
+    REQUIRE(wait.wait_for(std::chrono::milliseconds{ 200 }) == std::future_status::ready);
+    CHECK(wait.get());
+}
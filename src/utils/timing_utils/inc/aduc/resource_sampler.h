@@ -0,0 +1,102 @@
+/**
+ * @file resource_sampler.h
+ * @brief Samples the resource usage of the agent, i.e. CPU time, RSS, IO bytes and free disk space, on a thread
+ * while a deployment is active, to see what a deployment costs the device.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_RESOURCE_SAMPLER_H
+#define ADUC_RESOURCE_SAMPLER_H
+
+#include <aduc/c_utils.h>
+#include <parson.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The number of samples kept. Once full, the oldest samples are overwritten.
+ */
+#define ADUC_RESOURCE_SAMPLER_MAX_SAMPLES 512
+
+/**
+ * @brief The name of the file, in the log folder, the agent writes the samples of the last deployment to.
+ * The log folder is part of the diagnostics upload.
+ */
+#define ADUC_RESOURCE_SAMPLES_FILE_NAME "aduc-resource-samples.json"
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief A resource usage sample.
+ */
+typedef struct tagADUC_ResourceSample
+{
+    int64_t Time; //!< The time of the sample, in nanoseconds of the monotonic clock, see ADUC_Timing_Now.
+    uint64_t CpuTimeMs; //!< The user and system CPU time of the agent.
+    uint64_t ChildCpuTimeMs; //!< The user and system CPU time of the agent's terminated and waited for children.
+    uint64_t RssBytes; //!< The resident set size of the agent.
+    uint64_t ReadBytes; //!< The bytes the agent, and its waited for children, caused to be read from storage.
+    uint64_t WriteBytes; //!< The bytes the agent, and its waited for children, caused to be written to storage.
+    uint64_t DiskFreeBytes; //!< The bytes available to the agent on the sampled file system.
+} ADUC_ResourceSample;
+
+/**
+ * @brief Sets the interval of the samples. Takes effect at the next ADUC_ResourceSampler_Start.
+ *
+ * @param intervalSeconds The interval, 0 to not sample.
+ */
+void ADUC_ResourceSampler_SetInterval(unsigned int intervalSeconds);
+
+/**
+ * @brief Discards the samples and starts sampling, unless the interval is 0. Restarts the sampler if it's running.
+ * Not thread-safe with ADUC_ResourceSampler_Stop.
+ *
+ * @param diskPath The path whose file system's free space is sampled, e.g. the downloads folder.
+ */
+void ADUC_ResourceSampler_Start(const char* diskPath);
+
+/**
+ * @brief Takes a last sample and stops sampling, if running. The samples are kept until the next start.
+ */
+void ADUC_ResourceSampler_Stop(void);
+
+/**
+ * @brief Takes a sample of the resource usage now. Fields that can't be read are left 0.
+ *
+ * @param diskPath The path whose file system's free space is sampled, may be NULL.
+ * @param sample Receives the sample.
+ */
+void ADUC_ResourceSampler_TakeSample(const char* diskPath, ADUC_ResourceSample* sample);
+
+/**
+ * @brief Returns the samples, oldest first, as a JSON array.
+ * e.g. [ { "timeMs": 1000.2, "cpuMs": 120, "childCpuMs": 35, "rssBytes": 4145152, "readBytes": 0,
+ * "writeBytes": 1048576, "diskFreeBytes": 52428800 } ]
+ * The time of each sample is relative to the last ADUC_ResourceSampler_Start.
+ *
+ * @returns The JSON value, or NULL on failure. The caller must free it with json_value_free.
+ */
+JSON_Value* ADUC_ResourceSampler_GetSamples(void);
+
+/**
+ * @brief Returns the usage since the last ADUC_ResourceSampler_Start, as a JSON object.
+ * e.g. { "samples": 12, "cpuMs": 840, "childCpuMs": 310, "peakRssBytes": 6291456, "readBytes": 0,
+ * "writeBytes": 10485760, "minDiskFreeBytes": 41943040 }
+ *
+ * @returns The JSON value, or NULL if nothing was sampled or on failure. The caller must free it with
+ * json_value_free.
+ */
+JSON_Value* ADUC_ResourceSampler_GetSummary(void);
+
+/**
+ * @brief Writes the samples, see ADUC_ResourceSampler_GetSamples, to the file @p filePath, replacing it.
+ *
+ * @param filePath The path of the file.
+ * @returns True on success.
+ */
+_Bool ADUC_ResourceSampler_WriteSamplesFile(const char* filePath);
+
+EXTERN_C_END
+
+#endif // ADUC_RESOURCE_SAMPLER_H
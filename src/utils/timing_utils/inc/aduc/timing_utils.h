@@ -0,0 +1,92 @@
+/**
+ * @file timing_utils.h
+ * @brief Records timing spans of the agent's operations, e.g. downloads and child processes, in a ring buffer,
+ * to see where the time of a deployment goes.
+ *
+ * The agent exports these functions, so handler and downloader extensions, which link their own copy of this
+ * library, record into the agent's buffer too.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_TIMING_UTILS_H
+#define ADUC_TIMING_UTILS_H
+
+#include <aduc/c_utils.h>
+#include <parson.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief The number of spans kept. Once full, the oldest spans are overwritten.
+ */
+#define ADUC_TIMING_MAX_SPANS 512
+
+/**
+ * @brief The size of the name of a span, including the terminating null.
+ */
+#define ADUC_TIMING_SPAN_NAME_SIZE 48
+
+/**
+ * @brief The size of the detail of a span, including the terminating null.
+ */
+#define ADUC_TIMING_SPAN_DETAIL_SIZE 64
+
+/**
+ * @brief The name of the file, in the log folder, the agent writes the spans of the last deployment to.
+ * The log folder is part of the diagnostics upload.
+ */
+#define ADUC_TIMING_SPANS_FILE_NAME "aduc-timing-spans.json"
+
+EXTERN_C_BEGIN
+
+/**
+ * @brief Returns the current time of the monotonic clock, in nanoseconds. Pass it to ADUC_Timing_EndSpan.
+ */
+int64_t ADUC_Timing_Now(void);
+
+/**
+ * @brief Records a span that started at @p startTime and ends now. Thread-safe.
+ *
+ * @param name The name of the span, e.g. "extension_download". Truncated to ADUC_TIMING_SPAN_NAME_SIZE - 1
+ * characters; it's copied, since it may be a literal of an extension that gets unloaded.
+ * The summary is reported in the twin, so names can't contain '.', '$', ':', '-' or spaces.
+ * @param detail Optional, e.g. a file name. Truncated to ADUC_TIMING_SPAN_DETAIL_SIZE - 1 characters.
+ * @param startTime The start of the span, from ADUC_Timing_Now.
+ */
+void ADUC_Timing_EndSpan(const char* name, const char* detail, int64_t startTime);
+
+/**
+ * @brief Discards the recorded spans, e.g. when a new deployment starts.
+ */
+void ADUC_Timing_Clear(void);
+
+/**
+ * @brief Returns the recorded spans, oldest first, as a JSON array.
+ * e.g. [ { "name": "extension_download", "detail": "foo.swu", "startMs": 12.5, "durationMs": 3001.2 } ]
+ * The start of each span is relative to the last ADUC_Timing_Clear.
+ *
+ * @returns The JSON value, or NULL on failure. The caller must free it with json_value_free.
+ */
+JSON_Value* ADUC_Timing_GetSpans(void);
+
+/**
+ * @brief Returns the number of spans and their total duration for each span name, as a JSON object.
+ * e.g. { "extension_download": { "count": 2, "totalMs": 6002.4 } }
+ *
+ * @returns The JSON value, or NULL if no span was recorded or on failure. The caller must free it with
+ * json_value_free.
+ */
+JSON_Value* ADUC_Timing_GetSummary(void);
+
+/**
+ * @brief Writes the recorded spans, see ADUC_Timing_GetSpans, to the file @p filePath, replacing it.
+ *
+ * @param filePath The path of the file.
+ * @returns True on success.
+ */
+_Bool ADUC_Timing_WriteSpansFile(const char* filePath);
+
+EXTERN_C_END
+
+#endif // ADUC_TIMING_UTILS_H
@@ -0,0 +1,51 @@
+/**
+ * @file timing_utils.hpp
+ * @brief Scoped timing spans, see timing_utils.h.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#ifndef ADUC_TIMING_UTILS_HPP
+#define ADUC_TIMING_UTILS_HPP
+
+#include "aduc/timing_utils.h"
+
+#include <string>
+
+namespace ADUC
+{
+/**
+ * @brief Records a timing span from its construction to its destruction.
+ */
+class TimingSpan
+{
+public:
+    /**
+     * @brief Starts the span.
+     *
+     * @param name The name of the span. Must outlive the span, e.g. a string literal.
+     * @param detail Optional detail, e.g. a file name.
+     */
+    explicit TimingSpan(const char* name, std::string detail = std::string{}) :
+        _name{ name }, _detail{ std::move(detail) }, _startTime{ ADUC_Timing_Now() }
+    {
+    }
+
+    TimingSpan(const TimingSpan&) = delete;
+    TimingSpan& operator=(const TimingSpan&) = delete;
+    TimingSpan(TimingSpan&&) = delete;
+    TimingSpan& operator=(TimingSpan&&) = delete;
+
+    ~TimingSpan()
+    {
+        ADUC_Timing_EndSpan(_name, _detail.c_str(), _startTime);
+    }
+
+private:
+    const char* _name;
+    std::string _detail;
+    int64_t _startTime;
+};
+} // namespace ADUC
+
+#endif // ADUC_TIMING_UTILS_HPP
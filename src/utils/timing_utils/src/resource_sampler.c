@@ -0,0 +1,446 @@
+/**
+ * @file resource_sampler.c
+ * @brief Implements the resource usage sampler.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/resource_sampler.h"
+#include "aduc/logging.h"
+#include "aduc/timing_utils.h"
+
+#include <limits.h> // for PATH_MAX
+#include <pthread.h>
+#include <stdio.h> // for fopen, rename, snprintf
+#include <string.h> // for strcmp, strncpy
+#include <sys/resource.h> // for getrusage
+#include <sys/statvfs.h> // for statvfs
+#include <time.h> // for clock_gettime
+#include <unistd.h> // for sysconf
+
+/**
+ * @brief Protects the state below.
+ */
+static pthread_mutex_t s_samplerMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Signaled to wake the sampler thread up when it must stop. Uses the monotonic clock.
+ */
+static pthread_cond_t s_samplerCondition;
+static _Bool s_samplerConditionInitialized = false;
+
+static unsigned int s_intervalSeconds = 0;
+
+static pthread_t s_samplerThread;
+static _Bool s_samplerRunning = false;
+static _Bool s_stopRequested = false;
+
+/**
+ * @brief The path whose file system's free space is sampled. Only changed while the thread isn't running.
+ */
+static char s_diskPath[PATH_MAX];
+
+/**
+ * @brief The samples, a ring buffer whose oldest sample is at s_firstSample.
+ */
+static ADUC_ResourceSample s_samples[ADUC_RESOURCE_SAMPLER_MAX_SAMPLES];
+
+static size_t s_firstSample = 0;
+static size_t s_sampleCount = 0;
+
+/**
+ * @brief The first sample since the last start, which the usage is reported relative to, even once overwritten.
+ */
+static ADUC_ResourceSample s_baseline;
+
+/**
+ * @brief The number of samples, the peak RSS and the least free disk space since the last start, including the
+ * overwritten samples.
+ */
+static size_t s_totalSampleCount = 0;
+static uint64_t s_peakRssBytes = 0;
+static uint64_t s_minDiskFreeBytes = 0;
+
+static uint64_t TimevalToMilliseconds(const struct timeval* time)
+{
+    return (uint64_t)time->tv_sec * 1000 + (uint64_t)time->tv_usec / 1000;
+}
+
+static void ReadRss(ADUC_ResourceSample* sample)
+{
+    unsigned long long sizePages = 0;
+    unsigned long long residentPages = 0;
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    FILE* file = fopen("/proc/self/statm", "r");
+
+    if (file == NULL)
+    {
+        return;
+    }
+
+    if (fscanf(file, "%llu %llu", &sizePages, &residentPages) == 2 && pageSize > 0)
+    {
+        sample->RssBytes = residentPages * (uint64_t)pageSize;
+    }
+
+    fclose(file);
+}
+
+static void ReadIo(ADUC_ResourceSample* sample)
+{
+    char name[32];
+    unsigned long long value = 0;
+    FILE* file = fopen("/proc/self/io", "r");
+
+    // Missing without task IO accounting in the kernel.
+    if (file == NULL)
+    {
+        return;
+    }
+
+    while (fscanf(file, "%31[^:]: %llu\n", name, &value) == 2)
+    {
+        if (strcmp(name, "read_bytes") == 0)
+        {
+            sample->ReadBytes = value;
+        }
+        else if (strcmp(name, "write_bytes") == 0)
+        {
+            sample->WriteBytes = value;
+        }
+    }
+
+    fclose(file);
+}
+
+void ADUC_ResourceSampler_TakeSample(const char* diskPath, ADUC_ResourceSample* sample)
+{
+    struct rusage usage;
+    struct statvfs fileSystem;
+
+    memset(sample, 0, sizeof(*sample));
+    sample->Time = ADUC_Timing_Now();
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        sample->CpuTimeMs = TimevalToMilliseconds(&usage.ru_utime) + TimevalToMilliseconds(&usage.ru_stime);
+    }
+
+    if (getrusage(RUSAGE_CHILDREN, &usage) == 0)
+    {
+        sample->ChildCpuTimeMs = TimevalToMilliseconds(&usage.ru_utime) + TimevalToMilliseconds(&usage.ru_stime);
+    }
+
+    ReadRss(sample);
+    ReadIo(sample);
+
+    if (diskPath != NULL && diskPath[0] != '\0' && statvfs(diskPath, &fileSystem) == 0)
+    {
+        sample->DiskFreeBytes = (uint64_t)fileSystem.f_bavail * fileSystem.f_frsize;
+    }
+}
+
+/**
+ * @brief Adds a sample. Must be called with s_samplerMutex held.
+ */
+static void AddSampleLocked(const ADUC_ResourceSample* sample)
+{
+    if (s_totalSampleCount == 0)
+    {
+        s_baseline = *sample;
+        s_peakRssBytes = sample->RssBytes;
+        s_minDiskFreeBytes = sample->DiskFreeBytes;
+    }
+
+    if (sample->RssBytes > s_peakRssBytes)
+    {
+        s_peakRssBytes = sample->RssBytes;
+    }
+
+    if (sample->DiskFreeBytes < s_minDiskFreeBytes)
+    {
+        s_minDiskFreeBytes = sample->DiskFreeBytes;
+    }
+
+    s_totalSampleCount++;
+
+    if (s_sampleCount < ADUC_RESOURCE_SAMPLER_MAX_SAMPLES)
+    {
+        s_samples[(s_firstSample + s_sampleCount) % ADUC_RESOURCE_SAMPLER_MAX_SAMPLES] = *sample;
+        s_sampleCount++;
+    }
+    else
+    {
+        // Full, overwrite the oldest sample.
+        s_samples[s_firstSample] = *sample;
+        s_firstSample = (s_firstSample + 1) % ADUC_RESOURCE_SAMPLER_MAX_SAMPLES;
+    }
+}
+
+static void TakeAndAddSample(void)
+{
+    ADUC_ResourceSample sample;
+
+    ADUC_ResourceSampler_TakeSample(s_diskPath, &sample);
+
+    pthread_mutex_lock(&s_samplerMutex);
+    AddSampleLocked(&sample);
+    pthread_mutex_unlock(&s_samplerMutex);
+}
+
+static void* SamplerThread(void* arg)
+{
+    struct timespec deadline;
+
+    (void)arg;
+
+    pthread_mutex_lock(&s_samplerMutex);
+
+    while (!s_stopRequested)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += s_intervalSeconds;
+
+        while (!s_stopRequested)
+        {
+            if (pthread_cond_timedwait(&s_samplerCondition, &s_samplerMutex, &deadline) != 0)
+            {
+                break;
+            }
+        }
+
+        if (s_stopRequested)
+        {
+            break;
+        }
+
+        pthread_mutex_unlock(&s_samplerMutex);
+        TakeAndAddSample();
+        pthread_mutex_lock(&s_samplerMutex);
+    }
+
+    pthread_mutex_unlock(&s_samplerMutex);
+
+    return NULL;
+}
+
+void ADUC_ResourceSampler_SetInterval(unsigned int intervalSeconds)
+{
+    pthread_mutex_lock(&s_samplerMutex);
+    s_intervalSeconds = intervalSeconds;
+    pthread_mutex_unlock(&s_samplerMutex);
+}
+
+void ADUC_ResourceSampler_Start(const char* diskPath)
+{
+    unsigned int intervalSeconds = 0;
+
+    ADUC_ResourceSampler_Stop();
+
+    pthread_mutex_lock(&s_samplerMutex);
+
+    s_firstSample = 0;
+    s_sampleCount = 0;
+    s_totalSampleCount = 0;
+    intervalSeconds = s_intervalSeconds;
+
+    if (!s_samplerConditionInitialized)
+    {
+        pthread_condattr_t conditionAttributes;
+
+        pthread_condattr_init(&conditionAttributes);
+        pthread_condattr_setclock(&conditionAttributes, CLOCK_MONOTONIC);
+        s_samplerConditionInitialized = pthread_cond_init(&s_samplerCondition, &conditionAttributes) == 0;
+        pthread_condattr_destroy(&conditionAttributes);
+    }
+
+    pthread_mutex_unlock(&s_samplerMutex);
+
+    if (intervalSeconds == 0 || !s_samplerConditionInitialized)
+    {
+        return;
+    }
+
+    s_diskPath[0] = '\0';
+    if (diskPath != NULL)
+    {
+        strncpy(s_diskPath, diskPath, sizeof(s_diskPath) - 1);
+        s_diskPath[sizeof(s_diskPath) - 1] = '\0';
+    }
+
+    TakeAndAddSample();
+
+    s_stopRequested = false;
+    if (pthread_create(&s_samplerThread, NULL, SamplerThread, NULL) != 0)
+    {
+        Log_Warn("Cannot start the resource sampler thread.");
+        return;
+    }
+
+    s_samplerRunning = true;
+}
+
+void ADUC_ResourceSampler_Stop(void)
+{
+    if (!s_samplerRunning)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&s_samplerMutex);
+    s_stopRequested = true;
+    pthread_cond_signal(&s_samplerCondition);
+    pthread_mutex_unlock(&s_samplerMutex);
+
+    pthread_join(s_samplerThread, NULL);
+    s_samplerRunning = false;
+
+    TakeAndAddSample();
+}
+
+JSON_Value* ADUC_ResourceSampler_GetSamples(void)
+{
+    JSON_Value* samplesValue = json_value_init_array();
+    JSON_Array* samplesArray = json_array(samplesValue);
+    _Bool succeeded = false;
+
+    if (samplesArray == NULL)
+    {
+        goto done;
+    }
+
+    pthread_mutex_lock(&s_samplerMutex);
+
+    if (s_totalSampleCount > s_sampleCount)
+    {
+        Log_Debug("%zu oldest resource sample(s) were dropped.", s_totalSampleCount - s_sampleCount);
+    }
+
+    for (size_t i = 0; i < s_sampleCount; i++)
+    {
+        const ADUC_ResourceSample* sample = &s_samples[(s_firstSample + i) % ADUC_RESOURCE_SAMPLER_MAX_SAMPLES];
+        JSON_Value* sampleValue = json_value_init_object();
+        JSON_Object* sampleObject = json_object(sampleValue);
+
+        if (sampleObject == NULL
+            || json_object_set_number(sampleObject, "timeMs", (double)(sample->Time - s_baseline.Time) / 1000000.0)
+                != JSONSuccess
+            || json_object_set_number(sampleObject, "cpuMs", (double)sample->CpuTimeMs) != JSONSuccess
+            || json_object_set_number(sampleObject, "childCpuMs", (double)sample->ChildCpuTimeMs) != JSONSuccess
+            || json_object_set_number(sampleObject, "rssBytes", (double)sample->RssBytes) != JSONSuccess
+            || json_object_set_number(sampleObject, "readBytes", (double)sample->ReadBytes) != JSONSuccess
+            || json_object_set_number(sampleObject, "writeBytes", (double)sample->WriteBytes) != JSONSuccess
+            || json_object_set_number(sampleObject, "diskFreeBytes", (double)sample->DiskFreeBytes) != JSONSuccess
+            || json_array_append_value(samplesArray, sampleValue) != JSONSuccess)
+        {
+            json_value_free(sampleValue);
+            pthread_mutex_unlock(&s_samplerMutex);
+            goto done;
+        }
+    }
+
+    pthread_mutex_unlock(&s_samplerMutex);
+
+    succeeded = true;
+
+done:
+    if (!succeeded)
+    {
+        json_value_free(samplesValue);
+        samplesValue = NULL;
+    }
+
+    return samplesValue;
+}
+
+/**
+ * @brief Returns @p value - @p baseline, or 0 if the counter went backwards, e.g. because it couldn't be read.
+ */
+static double CounterDelta(uint64_t value, uint64_t baseline)
+{
+    return value > baseline ? (double)(value - baseline) : 0;
+}
+
+JSON_Value* ADUC_ResourceSampler_GetSummary(void)
+{
+    JSON_Value* summaryValue = json_value_init_object();
+    JSON_Object* summaryObject = json_object(summaryValue);
+    _Bool succeeded = false;
+
+    if (summaryObject == NULL)
+    {
+        goto done;
+    }
+
+    pthread_mutex_lock(&s_samplerMutex);
+
+    if (s_sampleCount != 0)
+    {
+        const ADUC_ResourceSample* last =
+            &s_samples[(s_firstSample + s_sampleCount - 1) % ADUC_RESOURCE_SAMPLER_MAX_SAMPLES];
+
+        succeeded = json_object_set_number(summaryObject, "samples", (double)s_totalSampleCount) == JSONSuccess
+            && json_object_set_number(summaryObject, "cpuMs", CounterDelta(last->CpuTimeMs, s_baseline.CpuTimeMs))
+                == JSONSuccess
+            && json_object_set_number(
+                   summaryObject, "childCpuMs", CounterDelta(last->ChildCpuTimeMs, s_baseline.ChildCpuTimeMs))
+                == JSONSuccess
+            && json_object_set_number(summaryObject, "peakRssBytes", (double)s_peakRssBytes) == JSONSuccess
+            && json_object_set_number(summaryObject, "readBytes", CounterDelta(last->ReadBytes, s_baseline.ReadBytes))
+                == JSONSuccess
+            && json_object_set_number(
+                   summaryObject, "writeBytes", CounterDelta(last->WriteBytes, s_baseline.WriteBytes))
+                == JSONSuccess
+            && json_object_set_number(summaryObject, "minDiskFreeBytes", (double)s_minDiskFreeBytes) == JSONSuccess;
+    }
+
+    pthread_mutex_unlock(&s_samplerMutex);
+
+done:
+    if (!succeeded)
+    {
+        json_value_free(summaryValue);
+        summaryValue = NULL;
+    }
+
+    return summaryValue;
+}
+
+_Bool ADUC_ResourceSampler_WriteSamplesFile(const char* filePath)
+{
+    _Bool succeeded = false;
+    char tempPath[1024];
+    JSON_Value* samplesValue = NULL;
+
+    if (filePath == NULL || snprintf(tempPath, sizeof(tempPath), "%s.tmp", filePath) >= (int)sizeof(tempPath))
+    {
+        goto done;
+    }
+
+    samplesValue = ADUC_ResourceSampler_GetSamples();
+    if (samplesValue == NULL)
+    {
+        goto done;
+    }
+
+    // Write to a temporary file first, so that a diagnostics upload never sees a partial file.
+    if (json_serialize_to_file(samplesValue, tempPath) != JSONSuccess)
+    {
+        Log_Warn("Cannot write resource samples to %s", tempPath);
+        goto done;
+    }
+
+    if (rename(tempPath, filePath) != 0)
+    {
+        Log_Warn("Cannot replace resource samples file %s", filePath);
+        remove(tempPath);
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    json_value_free(samplesValue);
+
+    return succeeded;
+}
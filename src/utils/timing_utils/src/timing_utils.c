@@ -0,0 +1,269 @@
+/**
+ * @file timing_utils.c
+ * @brief Implements the timing spans ring buffer.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include "aduc/timing_utils.h"
+#include "aduc/logging.h"
+
+#include <pthread.h>
+#include <stdio.h> // for rename, snprintf
+#include <string.h> // for strncpy
+#include <time.h> // for clock_gettime
+
+/**
+ * @brief A recorded span.
+ */
+typedef struct tagADUC_TimingSpan
+{
+    char name[ADUC_TIMING_SPAN_NAME_SIZE]; //!< The name of the span.
+    char detail[ADUC_TIMING_SPAN_DETAIL_SIZE]; //!< The detail of the span, may be empty.
+    int64_t startTime; //!< The start of the span, in nanoseconds of the monotonic clock.
+    int64_t duration; //!< The duration of the span, in nanoseconds.
+} ADUC_TimingSpan;
+
+/**
+ * @brief Protects the state below.
+ */
+static pthread_mutex_t s_timingMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief The spans, a ring buffer whose oldest span is at s_firstSpan.
+ */
+static ADUC_TimingSpan s_spans[ADUC_TIMING_MAX_SPANS];
+
+static size_t s_firstSpan = 0;
+static size_t s_spanCount = 0;
+
+/**
+ * @brief The number of spans overwritten since the last clear, because the buffer was full.
+ */
+static size_t s_droppedSpanCount = 0;
+
+/**
+ * @brief The time of the last clear, which span start times are reported relative to.
+ * 0, i.e. the start of the monotonic clock, until the first clear.
+ */
+static int64_t s_epoch = 0;
+
+static double NanosecondsToMilliseconds(int64_t nanoseconds)
+{
+    return (double)nanoseconds / 1000000.0;
+}
+
+int64_t ADUC_Timing_Now(void)
+{
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+    {
+        return 0;
+    }
+
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void ADUC_Timing_EndSpan(const char* name, const char* detail, int64_t startTime)
+{
+    const int64_t endTime = ADUC_Timing_Now();
+
+    if (name == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&s_timingMutex);
+
+    ADUC_TimingSpan* span = NULL;
+
+    if (s_spanCount < ADUC_TIMING_MAX_SPANS)
+    {
+        span = &s_spans[(s_firstSpan + s_spanCount) % ADUC_TIMING_MAX_SPANS];
+        s_spanCount++;
+    }
+    else
+    {
+        // Full, overwrite the oldest span.
+        span = &s_spans[s_firstSpan];
+        s_firstSpan = (s_firstSpan + 1) % ADUC_TIMING_MAX_SPANS;
+        s_droppedSpanCount++;
+    }
+
+    strncpy(span->name, name, ADUC_TIMING_SPAN_NAME_SIZE - 1);
+    span->name[ADUC_TIMING_SPAN_NAME_SIZE - 1] = '\0';
+    span->detail[0] = '\0';
+    if (detail != NULL)
+    {
+        strncpy(span->detail, detail, ADUC_TIMING_SPAN_DETAIL_SIZE - 1);
+        span->detail[ADUC_TIMING_SPAN_DETAIL_SIZE - 1] = '\0';
+    }
+    span->startTime = startTime;
+    span->duration = endTime - startTime;
+
+    pthread_mutex_unlock(&s_timingMutex);
+}
+
+void ADUC_Timing_Clear(void)
+{
+    pthread_mutex_lock(&s_timingMutex);
+
+    s_firstSpan = 0;
+    s_spanCount = 0;
+    s_droppedSpanCount = 0;
+    s_epoch = ADUC_Timing_Now();
+
+    pthread_mutex_unlock(&s_timingMutex);
+}
+
+JSON_Value* ADUC_Timing_GetSpans(void)
+{
+    JSON_Value* spansValue = json_value_init_array();
+    JSON_Array* spansArray = json_array(spansValue);
+    _Bool succeeded = false;
+
+    if (spansArray == NULL)
+    {
+        goto done;
+    }
+
+    pthread_mutex_lock(&s_timingMutex);
+
+    if (s_droppedSpanCount != 0)
+    {
+        Log_Debug("%zu oldest timing span(s) were dropped.", s_droppedSpanCount);
+    }
+
+    for (size_t i = 0; i < s_spanCount; i++)
+    {
+        const ADUC_TimingSpan* span = &s_spans[(s_firstSpan + i) % ADUC_TIMING_MAX_SPANS];
+        JSON_Value* spanValue = json_value_init_object();
+        JSON_Object* spanObject = json_object(spanValue);
+
+        if (spanObject == NULL || json_object_set_string(spanObject, "name", span->name) != JSONSuccess
+            || json_object_set_string(spanObject, "detail", span->detail) != JSONSuccess
+            || json_object_set_number(
+                   spanObject, "startMs", NanosecondsToMilliseconds(span->startTime - s_epoch))
+                != JSONSuccess
+            || json_object_set_number(spanObject, "durationMs", NanosecondsToMilliseconds(span->duration))
+                != JSONSuccess
+            || json_array_append_value(spansArray, spanValue) != JSONSuccess)
+        {
+            json_value_free(spanValue);
+            pthread_mutex_unlock(&s_timingMutex);
+            goto done;
+        }
+    }
+
+    pthread_mutex_unlock(&s_timingMutex);
+
+    succeeded = true;
+
+done:
+    if (!succeeded)
+    {
+        json_value_free(spansValue);
+        spansValue = NULL;
+    }
+
+    return spansValue;
+}
+
+JSON_Value* ADUC_Timing_GetSummary(void)
+{
+    JSON_Value* summaryValue = json_value_init_object();
+    JSON_Object* summaryObject = json_object(summaryValue);
+    _Bool succeeded = false;
+
+    if (summaryObject == NULL)
+    {
+        goto done;
+    }
+
+    pthread_mutex_lock(&s_timingMutex);
+
+    for (size_t i = 0; i < s_spanCount; i++)
+    {
+        const ADUC_TimingSpan* span = &s_spans[(s_firstSpan + i) % ADUC_TIMING_MAX_SPANS];
+        JSON_Object* nameObject = json_object_get_object(summaryObject, span->name);
+
+        if (nameObject == NULL)
+        {
+            JSON_Value* nameValue = json_value_init_object();
+
+            if (nameValue == NULL || json_object_set_value(summaryObject, span->name, nameValue) != JSONSuccess)
+            {
+                json_value_free(nameValue);
+                pthread_mutex_unlock(&s_timingMutex);
+                goto done;
+            }
+
+            nameObject = json_object(nameValue);
+        }
+
+        if (json_object_set_number(nameObject, "count", json_object_get_number(nameObject, "count") + 1)
+                != JSONSuccess
+            || json_object_set_number(
+                   nameObject,
+                   "totalMs",
+                   json_object_get_number(nameObject, "totalMs") + NanosecondsToMilliseconds(span->duration))
+                != JSONSuccess)
+        {
+            pthread_mutex_unlock(&s_timingMutex);
+            goto done;
+        }
+    }
+
+    succeeded = s_spanCount != 0;
+
+    pthread_mutex_unlock(&s_timingMutex);
+
+done:
+    if (!succeeded)
+    {
+        json_value_free(summaryValue);
+        summaryValue = NULL;
+    }
+
+    return summaryValue;
+}
+
+_Bool ADUC_Timing_WriteSpansFile(const char* filePath)
+{
+    _Bool succeeded = false;
+    char tempPath[1024];
+    JSON_Value* spansValue = NULL;
+
+    if (filePath == NULL || snprintf(tempPath, sizeof(tempPath), "%s.tmp", filePath) >= (int)sizeof(tempPath))
+    {
+        goto done;
+    }
+
+    spansValue = ADUC_Timing_GetSpans();
+    if (spansValue == NULL)
+    {
+        goto done;
+    }
+
+    // Write to a temporary file first, so that a diagnostics upload never sees a partial file.
+    if (json_serialize_to_file(spansValue, tempPath) != JSONSuccess)
+    {
+        Log_Warn("Cannot write timing spans to %s", tempPath);
+        goto done;
+    }
+
+    if (rename(tempPath, filePath) != 0)
+    {
+        Log_Warn("Cannot replace timing spans file %s", filePath);
+        remove(tempPath);
+        goto done;
+    }
+
+    succeeded = true;
+
+done:
+    json_value_free(spansValue);
+
+    return succeeded;
+}
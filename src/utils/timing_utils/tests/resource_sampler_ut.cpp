@@ -0,0 +1,104 @@
+/**
+ * @file resource_sampler_ut.cpp
+ * @brief Unit Tests for the resource sampler of the timing_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+
+#include "aduc/resource_sampler.h"
+
+#include <cstdio>
+#include <string>
+
+TEST_CASE("ADUC_ResourceSampler_TakeSample")
+{
+    ADUC_ResourceSample sample;
+    ADUC_ResourceSampler_TakeSample("/", &sample);
+
+    CHECK(sample.Time > 0);
+    CHECK(sample.RssBytes > 0);
+    CHECK(sample.DiskFreeBytes > 0);
+
+    ADUC_ResourceSampler_TakeSample(nullptr, &sample);
+    CHECK(sample.DiskFreeBytes == 0);
+}
+
+TEST_CASE("ADUC_ResourceSampler_Start")
+{
+    SECTION("Disabled")
+    {
+        ADUC_ResourceSampler_SetInterval(0);
+        ADUC_ResourceSampler_Start("/");
+        ADUC_ResourceSampler_Stop();
+
+        JSON_Value* samples = ADUC_ResourceSampler_GetSamples();
+        REQUIRE(samples != nullptr);
+        CHECK(json_array_get_count(json_array(samples)) == 0);
+        json_value_free(samples);
+
+        CHECK(ADUC_ResourceSampler_GetSummary() == nullptr);
+    }
+
+    SECTION("Samples at start and stop")
+    {
+        ADUC_ResourceSampler_SetInterval(60);
+        ADUC_ResourceSampler_Start("/");
+
+        // Busy the CPU a little, so that the CPU time goes up.
+        volatile unsigned long long state = 1;
+        for (int i = 0; i < 50000000; ++i)
+        {
+            state = state * 6364136223846793005ULL + 1;
+        }
+
+        // Stops promptly, not after the interval.
+        ADUC_ResourceSampler_Stop();
+
+        JSON_Value* samples = ADUC_ResourceSampler_GetSamples();
+        REQUIRE(samples != nullptr);
+        const JSON_Array* samplesArray = json_array(samples);
+        REQUIRE(json_array_get_count(samplesArray) == 2);
+        CHECK(json_object_get_number(json_array_get_object(samplesArray, 0), "timeMs") == 0);
+        CHECK(json_object_get_number(json_array_get_object(samplesArray, 1), "timeMs") > 0);
+        CHECK(json_object_get_number(json_array_get_object(samplesArray, 1), "rssBytes") > 0);
+        json_value_free(samples);
+
+        JSON_Value* summary = ADUC_ResourceSampler_GetSummary();
+        REQUIRE(summary != nullptr);
+        const JSON_Object* summaryObject = json_object(summary);
+        CHECK(json_object_get_number(summaryObject, "samples") == 2);
+        CHECK(json_object_get_number(summaryObject, "cpuMs") > 0);
+        CHECK(json_object_get_number(summaryObject, "peakRssBytes") > 0);
+        CHECK(json_object_get_number(summaryObject, "minDiskFreeBytes") > 0);
+        CHECK(json_object_has_value(summaryObject, "childCpuMs"));
+        CHECK(json_object_has_value(summaryObject, "readBytes"));
+        CHECK(json_object_has_value(summaryObject, "writeBytes"));
+        json_value_free(summary);
+
+        // A restart discards the samples.
+        ADUC_ResourceSampler_SetInterval(0);
+        ADUC_ResourceSampler_Start("/");
+        CHECK(ADUC_ResourceSampler_GetSummary() == nullptr);
+    }
+
+    SECTION("Write samples file")
+    {
+        const std::string filePath = "/tmp/aduc_resource_sampler_ut.json";
+
+        ADUC_ResourceSampler_SetInterval(60);
+        ADUC_ResourceSampler_Start("/");
+        ADUC_ResourceSampler_Stop();
+        ADUC_ResourceSampler_SetInterval(0);
+
+        REQUIRE(ADUC_ResourceSampler_WriteSamplesFile(filePath.c_str()));
+
+        JSON_Value* samples = json_parse_file(filePath.c_str());
+        REQUIRE(samples != nullptr);
+        CHECK(json_array_get_count(json_array(samples)) == 2);
+        json_value_free(samples);
+
+        std::remove(filePath.c_str());
+    }
+}
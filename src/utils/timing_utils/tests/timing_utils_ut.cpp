@@ -0,0 +1,126 @@
+/**
+ * @file timing_utils_ut.cpp
+ * @brief Unit Tests for timing_utils library
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+#include <catch2/catch.hpp>
+using Catch::Matchers::Equals;
+
+#include "aduc/timing_utils.h"
+#include "aduc/timing_utils.hpp"
+
+#include <string>
+
+TEST_CASE("ADUC_Timing_GetSpans")
+{
+    ADUC_Timing_Clear();
+
+    SECTION("No spans")
+    {
+        JSON_Value* spans = ADUC_Timing_GetSpans();
+        REQUIRE(spans != nullptr);
+        CHECK(json_array_get_count(json_array(spans)) == 0);
+        json_value_free(spans);
+
+        CHECK(ADUC_Timing_GetSummary() == nullptr);
+    }
+
+    SECTION("Spans are reported oldest first")
+    {
+        const int64_t start = ADUC_Timing_Now();
+        ADUC_Timing_EndSpan("test_first", "detail", start);
+
+        {
+            ADUC::TimingSpan span{ "test_second" };
+        }
+
+        JSON_Value* spans = ADUC_Timing_GetSpans();
+        REQUIRE(spans != nullptr);
+
+        JSON_Array* spansArray = json_array(spans);
+        REQUIRE(json_array_get_count(spansArray) == 2);
+
+        JSON_Object* first = json_array_get_object(spansArray, 0);
+        CHECK_THAT(json_object_get_string(first, "name"), Equals("test_first"));
+        CHECK_THAT(json_object_get_string(first, "detail"), Equals("detail"));
+        CHECK(json_object_get_number(first, "startMs") >= 0);
+        CHECK(json_object_get_number(first, "durationMs") >= 0);
+
+        JSON_Object* second = json_array_get_object(spansArray, 1);
+        CHECK_THAT(json_object_get_string(second, "name"), Equals("test_second"));
+        CHECK_THAT(json_object_get_string(second, "detail"), Equals(""));
+
+        json_value_free(spans);
+    }
+
+    SECTION("Long details are truncated")
+    {
+        const std::string detail(ADUC_TIMING_SPAN_DETAIL_SIZE * 2, 'x');
+        ADUC_Timing_EndSpan("test_long", detail.c_str(), ADUC_Timing_Now());
+
+        JSON_Value* spans = ADUC_Timing_GetSpans();
+        REQUIRE(spans != nullptr);
+
+        JSON_Object* span = json_array_get_object(json_array(spans), 0);
+        CHECK(std::string(json_object_get_string(span, "detail")).size() == ADUC_TIMING_SPAN_DETAIL_SIZE - 1);
+
+        json_value_free(spans);
+    }
+
+    SECTION("Names are copied")
+    {
+        std::string name{ "test_copied" };
+        ADUC_Timing_EndSpan(name.c_str(), nullptr, ADUC_Timing_Now());
+        name.assign(name.size(), 'x');
+
+        JSON_Value* spans = ADUC_Timing_GetSpans();
+        REQUIRE(spans != nullptr);
+
+        JSON_Object* span = json_array_get_object(json_array(spans), 0);
+        CHECK_THAT(json_object_get_string(span, "name"), Equals("test_copied"));
+
+        json_value_free(spans);
+    }
+
+    SECTION("The oldest spans are overwritten once full")
+    {
+        for (int i = 0; i < ADUC_TIMING_MAX_SPANS + 2; i++)
+        {
+            ADUC_Timing_EndSpan(i < 2 ? "test_old" : "test_new", nullptr, ADUC_Timing_Now());
+        }
+
+        JSON_Value* spans = ADUC_Timing_GetSpans();
+        REQUIRE(spans != nullptr);
+
+        JSON_Array* spansArray = json_array(spans);
+        CHECK(json_array_get_count(spansArray) == ADUC_TIMING_MAX_SPANS);
+        CHECK_THAT(json_object_get_string(json_array_get_object(spansArray, 0), "name"), Equals("test_new"));
+
+        json_value_free(spans);
+    }
+}
+
+TEST_CASE("ADUC_Timing_GetSummary")
+{
+    ADUC_Timing_Clear();
+
+    ADUC_Timing_EndSpan("test_download", "a", ADUC_Timing_Now() - 2000000);
+    ADUC_Timing_EndSpan("test_download", "b", ADUC_Timing_Now() - 3000000);
+    ADUC_Timing_EndSpan("test_install", nullptr, ADUC_Timing_Now());
+
+    JSON_Value* summary = ADUC_Timing_GetSummary();
+    REQUIRE(summary != nullptr);
+
+    JSON_Object* download = json_object_get_object(json_object(summary), "test_download");
+    REQUIRE(download != nullptr);
+    CHECK(json_object_get_number(download, "count") == 2);
+    CHECK(json_object_get_number(download, "totalMs") >= 5);
+
+    JSON_Object* install = json_object_get_object(json_object(summary), "test_install");
+    REQUIRE(install != nullptr);
+    CHECK(json_object_get_number(install, "count") == 1);
+
+    json_value_free(summary);
+}
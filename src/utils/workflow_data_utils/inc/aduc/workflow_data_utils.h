@@ -117,6 +117,15 @@ HandleUpdateActionFunc ADUC_WorkflowData_GetHandleUpdateActionFunc(const ADUC_Wo
  */
 void ADUC_WorkflowData_SaveLastGoalStateJson(ADUC_WorkflowData* workflowData, const char* goalStateJson);
 
+/**
+ * @brief Gets the digest of a serialized goal state, to recognize the same goal state delivered again without
+ * parsing it.
+ *
+ * @param goalStateJson A serialized json string containing Goal State data.
+ * @return uint64_t The 64-bit FNV-1a digest of @p goalStateJson.
+ */
+uint64_t ADUC_WorkflowData_GetGoalStateDigest(const char* goalStateJson);
+
 EXTERN_C_END
 
 #endif // ADUC_DATA_WORKFLOW_UTILS_H
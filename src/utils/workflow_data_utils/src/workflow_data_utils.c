@@ -204,6 +204,24 @@ void ADUC_WorkflowData_SaveLastGoalStateJson(ADUC_WorkflowData* workflowData, co
             workflowData->LastGoalStateJson = NULL;
         }
     }
+
+    workflowData->LastGoalStateDigest =
+        workflowData->LastGoalStateJson != NULL ? ADUC_WorkflowData_GetGoalStateDigest(goalStateJson) : 0;
+}
+
+// 64-bit FNV-1a, as used for the digest of reported properties.
+#define GOAL_STATE_DIGEST_OFFSET_BASIS 14695981039346656037ULL
+#define GOAL_STATE_DIGEST_PRIME 1099511628211ULL
+
+uint64_t ADUC_WorkflowData_GetGoalStateDigest(const char* goalStateJson)
+{
+    uint64_t digest = GOAL_STATE_DIGEST_OFFSET_BASIS;
+    for (const char* c = goalStateJson; *c != '\0'; ++c)
+    {
+        digest = (digest ^ (unsigned char)*c) * GOAL_STATE_DIGEST_PRIME;
+    }
+
+    return digest;
 }
 
 EXTERN_C_END
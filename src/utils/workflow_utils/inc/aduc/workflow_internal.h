@@ -6,12 +6,37 @@
  * Licensed under the MIT License.
  */
 
+#include <aduc/arena.h>
+#include <aduc/cancellation_token.h>
 #include <aduc/result.h>
 #include <aduc/types/update_content.h>
 #include <aduc/types/workflow.h>
 #include <azure_c_shared_utility/strings.h>
 #include <parson.h>
 
+/**
+ * @brief The files of the update manifest of a workflow, parsed once, see workflow_peek_update_file.
+ * Allocated in one block with its entities, and immutable once set on the workflow.
+ */
+typedef struct tagADUC_WorkflowFileTable
+{
+    size_t Count; /**< The count of Entities, that of the files in the update manifest. */
+    ADUC_FileEntity* Entities; /**< The entities, in update manifest order. Those that failed to parse are zeroed. */
+} ADUC_WorkflowFileTable;
+
+/**
+ * @brief The parsed selected components of a workflow, shared with the steps that select one of them, see
+ * workflow_select_component. Allocated in one block with ComponentJsons.
+ */
+typedef struct tagADUC_WorkflowComponents
+{
+    unsigned int RefCount; /**< The count of workflows sharing the record. Accessed with the __atomic builtins. */
+    JSON_Value* Value; /**< The parsed selected components JSON. */
+    JSON_Array* Components; /**< The 'components' array of Value. */
+    size_t ComponentCount; /**< The count of Components. */
+    char** ComponentJsons; /**< The JSON of each component alone, serialized on the first peek, or NULL. */
+} ADUC_WorkflowComponents;
+
 /**
  * @brief A struct containing data needed for an update workflow.
  *
@@ -26,6 +51,7 @@ typedef struct tagADUC_Workflow
     JSON_Object* UpdateManifestObject; /**< The update manifest JSON object. */
     JSON_Object* PropertiesObject; /**< The Property JSON object. */
     JSON_Object* ResultsObject; /**< The results JSON object. */
+    ADUC_WorkflowFileTable* FileTable; /**< The files of UpdateManifestObject, built on the first peek, or NULL. */
 
     //
     // Mutable state used by the agent workflow orchestration.
@@ -53,4 +79,41 @@ typedef struct tagADUC_Workflow
     ADUC_WorkflowCancellationType CancellationType; /**< What type of cancellation is it? */
     struct tagADUC_Workflow*
         DeferredReplacementWorkflow; /**< A replacement workflow that came in while another deployment was in progress. */
+
+    //
+    // Flags polled by the handlers and the worker threads, kept out of PropertiesObject so that checking them is a
+    // plain load rather than a JSON lookup. The request flags are set on the root only, and accessed with the
+    // __atomic builtins.
+    //
+    bool CancelRequested; /**< Was cancellation of the workflow requested? */
+    bool RebootRequested; /**< Was a reboot requested once the workflow completes? */
+    bool ImmediateRebootRequested; /**< Was an immediate reboot requested? */
+    bool AgentRestartRequested; /**< Was an agent restart requested once the workflow completes? */
+    bool ImmediateAgentRestartRequested; /**< Was an immediate agent restart requested? */
+    bool OperationTimedOut; /**< Was the operation in progress cancelled for running past its deadline? */
+    int64_t OperationDeadline; /**< When the operation in progress times out, see ADUC_Timing_Now. 0 for never. */
+    int64_t StepDeadline; /**< When the earliest step in progress times out. 0 for never. Set on the root only. */
+    STRING_HANDLE RestartReasons; /**< Why reboots and restarts were requested, or NULL. Set on the root only. */
+    char* WorkFolder; /**< The work folder set with workflow_set_workfolder, or NULL to derive it from the parent's. */
+    char* SelectedComponents; /**< The selected components JSON, or NULL. NULL if ComponentSelected. */
+    ADUC_WorkflowComponents* Components; /**< The parsed selected components, parsed on first use, or NULL. */
+    size_t ComponentIndex; /**< The index in Components of the component selected with workflow_select_component. */
+    bool ComponentSelected; /**< Was the component at ComponentIndex selected with workflow_select_component? */
+    char* WorkFolderCache; /**< The derived work folder, built on first peek, or NULL. */
+    char* ReplacedWorkFolder; /**< The work folder of the replaced workflow, kept for its files, or NULL. */
+    bool DownloadDeferred; /**< Was the download of the step left to the install phase? Steps handler thread only. */
+    size_t ResolvedFilesCount; /**< See workflow_set_resolved_files_count. Accessed with the __atomic builtins. */
+    char* SpillPath; /**< The file of the spilled workflow, see workflow_spill, or NULL. Accessed with the __atomic
+                        builtins. */
+
+    //
+    // Memory accounting state, see workflow_check_memory_budget.
+    //
+    size_t JsonBaselineBytes; /**< The JSON bytes allocated before the workflow was parsed. Set on the root only. */
+    ADUC_Arena* Arena; /**< The arena of workflow_arena_alloc. Set on the root only, on the first allocation. */
+
+    //
+    // Cancellation state, see workflow_peek_cancellation_token.
+    //
+    ADUC_CancellationToken* CancellationToken; /**< Cancelled with OperationCancelled. Set on the root only. */
 } ADUC_Workflow;
@@ -9,6 +9,7 @@
 #define ADUC_WORKFLOW_UTILS_H
 
 #include "aduc/adu_types.h"
+#include "aduc/cancellation_token.h"
 #include "aduc/result.h"
 #include "aduc/types/update_content.h"
 #include "aduc/types/workflow.h"
@@ -16,6 +17,7 @@
 #include "parson.h"
 
 #include <stdbool.h>
+#include <stdint.h> // for uint64_t
 #include <string.h> // strlen
 
 EXTERN_C_BEGIN
@@ -99,6 +101,159 @@ void workflow_uninit(ADUC_WorkflowHandle handle);
  */
 void workflow_free(ADUC_WorkflowHandle handle);
 
+//
+// Memory budget.
+//
+
+/**
+ * @brief Sets the memory budget of a workflow: the bytes of JSON values it may add, at their peak, to the ones allocated
+ * before it was parsed. It applies when the JSON allocation accounting is enabled, see
+ * ADUC_JSON_EnableAllocationAccounting.
+ *
+ * @param budgetBytes The budget, in bytes. 0, the default, means no budget.
+ */
+void workflow_set_memory_budget(size_t budgetBytes);
+
+/**
+ * @brief Gets the memory budget of a workflow, see workflow_set_memory_budget.
+ *
+ * @return size_t The budget, in bytes, or 0 if there is none.
+ */
+size_t workflow_get_memory_budget(void);
+
+/**
+ * @brief Sets the size limit of the compressed log each workflow keeps of its lines in its sandbox.
+ *
+ * @param limitBytes The limit, in bytes. 0, the default, means no log.
+ */
+void workflow_set_log_size_limit(size_t limitBytes);
+
+/**
+ * @brief Gets the size limit of the log of each workflow, see workflow_set_log_size_limit.
+ *
+ * @return size_t The limit, in bytes, or 0 for no log.
+ */
+size_t workflow_get_log_size_limit(void);
+
+//
+// Download start jitter.
+//
+
+/**
+ * @brief Sets the window over which the devices of a rollout spread the start of their downloads, so that they don't
+ * all download at once when a deployment reaches them at the same moment.
+ *
+ * @param windowSeconds The window, in seconds. 0, the default, starts the downloads right away.
+ */
+void workflow_set_download_start_jitter(unsigned int windowSeconds);
+
+//
+// Download mirrors.
+//
+
+/**
+ * @brief Sets the mirrors the files of updates can also be downloaded from. The download URI of a file that starts
+ * with a URI prefix of @p mirrors is also downloadable from each of the mirror prefixes of that prefix, followed by the
+ * rest of the URI; these are added to the alternate URIs of the file entity. The same applies to the alternate URIs
+ * from the update manifest.
+ *
+ * @param mirrors A JSON object of URI prefixes to arrays of mirror prefixes, e.g.
+ * { "https://contoso.blob.core.windows.net/": [ "https://contoso-eu.azureedge.net/", "http://10.0.0.5/" ] }.
+ * NULL, the default, for no mirrors.
+ * @return false if @p mirrors isn't a JSON object, leaving the mirrors unchanged.
+ */
+bool workflow_set_download_mirrors(const char* mirrors);
+
+/**
+ * @brief Sets the id of the device, whose hash places the device in the download start jitter window.
+ *
+ * @param deviceId The device id. NULL, the default, starts the downloads right away.
+ */
+void workflow_set_device_id(const char* deviceId);
+
+/**
+ * @brief Gets how long the device waits before the download of the update of @p handle starts: the hash of the device
+ * id, modulo the download start jitter window. The same device always waits the same time.
+ *
+ * Urgent updates, whose update manifest has "urgent": true, start downloading right away.
+ *
+ * @param handle A workflow object handle.
+ * @return unsigned int The delay, in seconds.
+ */
+unsigned int workflow_get_download_start_delay(ADUC_WorkflowHandle handle);
+
+/**
+ * @brief Gets the bytes of JSON values the root workflow of @p handle added, at their peak, since workflow_init parsed
+ * it. 0 when the accounting isn't enabled.
+ *
+ * @param handle A workflow object handle.
+ * @return size_t The bytes.
+ */
+size_t workflow_get_memory_usage(ADUC_WorkflowHandle handle);
+
+/**
+ * @brief Allocates @p size bytes that live as long as the root workflow of @p handle, for the transient allocations
+ * of parsers and handlers. Thread-safe.
+ *
+ * The memory comes from an arena of the root workflow, and is freed all at once by workflow_free of the root, so it
+ * must not be freed, nor kept past the deployment. Workflows removed from their root keep the memory of the arena of
+ * the root; do not allocate from them what must outlive it.
+ *
+ * @param handle A workflow object handle.
+ * @param size The number of bytes.
+ * @return void* The memory, or NULL if out of memory, @p handle is NULL or @p size is 0.
+ */
+void* workflow_arena_alloc(ADUC_WorkflowHandle handle, size_t size);
+
+/**
+ * @brief Allocates @p count zeroed elements of @p size bytes, see workflow_arena_alloc.
+ *
+ * @param handle A workflow object handle.
+ * @param count The number of elements.
+ * @param size The size of an element.
+ * @return void* The memory, or NULL on failure.
+ */
+void* workflow_arena_calloc(ADUC_WorkflowHandle handle, size_t count, size_t size);
+
+/**
+ * @brief Copies @p str into the memory of the workflow, see workflow_arena_alloc.
+ *
+ * @param handle A workflow object handle.
+ * @param str The string.
+ * @return char* The copy, or NULL if @p str is NULL or on failure. Must not be freed.
+ */
+char* workflow_arena_strdup(ADUC_WorkflowHandle handle, const char* str);
+
+/**
+ * @brief Checks the memory usage of the workflow of @p handle, see workflow_get_memory_usage, against the budget.
+ *
+ * @param handle A workflow object handle.
+ * @return ADUC_Result Failure with ADUC_ERC_UTILITIES_WORKFLOW_UTIL_MEMORY_BUDGET_EXCEEDED when the usage is over the
+ * budget, success otherwise.
+ */
+ADUC_Result workflow_check_memory_budget(ADUC_WorkflowHandle handle);
+
+/**
+ * @brief Gets the bytes the update files of the workflow of @p handle, and of its descendants, still need on disk: their
+ * sizes, less those of the files already in their work folders or partly downloaded there, and of the files the
+ * download cache hard links into them.
+ *
+ * @param handle A workflow object handle.
+ * @return uint64_t The bytes.
+ */
+uint64_t workflow_get_remaining_download_bytes(ADUC_WorkflowHandle handle);
+
+/**
+ * @brief Checks, before downloading, that the file system of the work folder of @p handle has room for the update files
+ * of the workflow and of its descendants, see workflow_get_remaining_download_bytes. If there isn't, it first waits
+ * for the sandboxes being removed in the background to free their space, see ADUC_SystemUtils_RmDirRecursiveDeferred.
+ *
+ * @param handle A workflow object handle.
+ * @return ADUC_Result Failure with ADUC_ERC_UTILITIES_WORKFLOW_UTIL_INSUFFICIENT_DISK_SPACE when there isn't room.
+ * Success if there is, or if the free space cannot be determined.
+ */
+ADUC_Result workflow_check_disk_space(ADUC_WorkflowHandle handle);
+
 //
 // Property setters and getters.
 //
@@ -124,6 +279,7 @@ char* workflow_get_update_type(ADUC_WorkflowHandle handle);
  *
  * @param handle A workflow object handle.
  * @return An UpdateType string. Caller does not own the string so must not free it.
+ * The string is valid until the workflow is freed, or its update manifest is replaced.
  */
 const char* workflow_peek_update_type(ADUC_WorkflowHandle handle);
 
@@ -164,7 +320,8 @@ char* workflow_get_id(ADUC_WorkflowHandle handle);
  * @brief Get a read-only workflow id.
  *
  * @param handle A workflow data object handle.
- * @return Return the workflow id.
+ * @return Return the workflow id. Caller must not free it.
+ * The string is valid until the workflow is freed, or its id is set again.
  */
 const char* workflow_peek_id(ADUC_WorkflowHandle handle);
 
@@ -204,6 +361,16 @@ bool workflow_set_workfolder(ADUC_WorkflowHandle handle, const char* pathFormat,
  */
 char* workflow_get_workfolder(ADUC_WorkflowHandle handle);
 
+/**
+ * @brief Gets a reference to the work folder for this workflow, without copying it.
+ *
+ * @param handle A workflow data object handle.
+ * @return const char* The full path to the work folder, or NULL if @p handle is NULL. Caller must not free it.
+ * The string is valid until the workflow is freed, or until the work folder, the id or the parent of the workflow, or
+ * of one of its ancestors, changes.
+ */
+const char* workflow_peek_workfolder(ADUC_WorkflowHandle handle);
+
 /**
  * @brief Sets selected-components (in a form of serialized json string) to be used in this workflow.
  *
@@ -215,12 +382,110 @@ bool workflow_set_selected_components(ADUC_WorkflowHandle handle, const char* se
 
 /**
  * @brief Gets a reference to the selected-components JSON string.
+ * The JSON of a component selected with workflow_select_component is serialized on the first peek.
  *
  * @param handle A workflow data object handle.
  * @return const char* Contain selected-components JSON. Caller must not free this string.
+ * The string is valid until the workflow is freed, or the selected components are set again.
  */
 const char* workflow_peek_selected_components(ADUC_WorkflowHandle handle);
 
+/**
+ * @brief Gets the count of selected components. The selected-components JSON is parsed once, on the first call.
+ *
+ * @param handle A workflow data object handle.
+ * @param count Receives the count of selected components, which may be 0.
+ * @return Returns false if the workflow has no selected components, or they're invalid.
+ */
+bool workflow_get_selected_components_count(ADUC_WorkflowHandle handle, size_t* count);
+
+/**
+ * @brief Gets a reference to the JSON of one of the selected components, i.e. a 'components' array with only
+ * that component. The JSON is serialized once, on the first call, and shared with the steps that select the component.
+ *
+ * @param handle A workflow data object handle.
+ * @param index The index of the component in the selected components.
+ * @return const char* The JSON, or NULL if there's no component at @p index. Caller must not free this string.
+ * The string is valid until the workflow is freed, or the selected components are set again.
+ */
+const char* workflow_peek_selected_component(ADUC_WorkflowHandle handle, size_t index);
+
+/**
+ * @brief Selects one of the selected components of @p sourceHandle, e.g. the steps workflow, as the selected
+ * components of @p handle, e.g. a step. The parsed components are shared, rather than serialized for the step and
+ * parsed again; see workflow_peek_selected_components for the JSON.
+ *
+ * @param handle A workflow data object handle.
+ * @param sourceHandle The workflow data object handle whose selected components to select from.
+ * @param index The index of the component in the selected components of @p sourceHandle.
+ * @return Returns true if succeeded.
+ */
+bool workflow_select_component(ADUC_WorkflowHandle handle, ADUC_WorkflowHandle sourceHandle, size_t index);
+
+/**
+ * @brief Remembers the IsInstalled result of the workflow for the @p selectedComponents, so that later phases
+ * of the same workflow needn't evaluate it again.
+ *
+ * @param handle A workflow data object handle.
+ * @param selectedComponents The selected-components JSON string the result is for. NULL for the host device.
+ * @param resultCode ADUC_Result_IsInstalled_Installed or ADUC_Result_IsInstalled_NotInstalled.
+ * @return Returns true if succeeded.
+ */
+bool workflow_set_cached_is_installed(
+    ADUC_WorkflowHandle handle, const char* selectedComponents, ADUC_Result_t resultCode);
+
+/**
+ * @brief Gets the IsInstalled result remembered by workflow_set_cached_is_installed.
+ *
+ * @param handle A workflow data object handle.
+ * @param selectedComponents The selected-components JSON string the result is for. NULL for the host device.
+ * @param[out] resultCode Receives the result.
+ * @return Returns true if a result was remembered for @p selectedComponents.
+ */
+bool workflow_get_cached_is_installed(
+    ADUC_WorkflowHandle handle, const char* selectedComponents, ADUC_Result_t* resultCode);
+
+/**
+ * @brief Forgets the IsInstalled results remembered for the workflow and all its child workflows.
+ * Must be called before anything gets installed.
+ *
+ * @param handle A workflow data object handle.
+ */
+void workflow_clear_cached_is_installed(ADUC_WorkflowHandle handle);
+
+/**
+ * @brief Marks the download of a step workflow as left to the install phase, where the steps handler downloads it
+ * while the steps before it install, or clears the mark once it is downloaded.
+ *
+ * @param handle A step workflow data object handle.
+ * @param deferred Whether the download is deferred.
+ */
+void workflow_set_download_deferred(ADUC_WorkflowHandle handle, bool deferred);
+
+/**
+ * @brief Returns whether the download of a step workflow was left to the install phase and isn't done yet.
+ *
+ * @param handle A step workflow data object handle.
+ */
+bool workflow_is_download_deferred(ADUC_WorkflowHandle handle);
+
+/**
+ * @brief Remembers that the first @p count update files of a step workflow are downloaded and verified in its work
+ * folder, so that the instances of the step on the other selected components needn't download nor hash them again.
+ * Thread-safe, as the instances on different components may run at the same time.
+ *
+ * @param handle A step workflow data object handle.
+ * @param count The number of files, from the first one.
+ */
+void workflow_set_resolved_files_count(ADUC_WorkflowHandle handle, size_t count);
+
+/**
+ * @brief Gets the number of files remembered by workflow_set_resolved_files_count, or 0.
+ *
+ * @param handle A step workflow data object handle.
+ */
+size_t workflow_get_resolved_files_count(ADUC_WorkflowHandle handle);
+
 /**
  * @brief Gets the update files count.
  *
@@ -239,6 +504,17 @@ size_t workflow_get_update_files_count(ADUC_WorkflowHandle handle);
  */
 bool workflow_get_update_file(ADUC_WorkflowHandle handle, size_t index, ADUC_FileEntity** entity);
 
+/**
+ * @brief Peeks the update file entity at specified index. The update files are parsed once per workflow, on the first
+ * peek, so that repeated lookups neither traverse the update manifest nor allocate.
+ *
+ * @param handle A workflow data object handle.
+ * @param index An index of the file to peek.
+ * @return The file entity, or NULL if there's no valid file at @p index. It's owned by the workflow, and valid until
+ * the workflow is freed or its data is transferred. Copy it with workflow_get_update_file to keep it longer.
+ */
+const ADUC_FileEntity* workflow_peek_update_file(ADUC_WorkflowHandle handle, size_t index);
+
 /**
  * @brief Gets a first file in the update files array that match specified @p fileType.
  *
@@ -345,6 +621,14 @@ char* workflow_get_expected_update_id_string(ADUC_WorkflowHandle handle);
  */
 char* workflow_get_installed_criteria(ADUC_WorkflowHandle handle);
 
+/**
+ * @brief Gets a reference to the installed-criteria string of this workflow, without copying it.
+ * @param handle A workflow object handle.
+ * @return Returns installed-criteria string, or NULL if there is none. Caller must not free it.
+ * The string is valid until the workflow is freed, or its update manifest is replaced.
+ */
+const char* workflow_peek_installed_criteria(ADUC_WorkflowHandle handle);
+
 /**
  * @brief Get the Update Manifest 'compatibility' array, in serialized json string format.
  *
@@ -369,8 +653,78 @@ void workflow_set_operation_cancel_requested(ADUC_WorkflowHandle handle, bool ca
 
 bool workflow_get_operation_cancel_requested(ADUC_WorkflowHandle handle);
 
+/**
+ * @brief Gets the cancellation token of the root workflow of @p handle, to pass to the downloads and child processes of
+ * an operation. It's cancelled when the operation is, e.g. by workflow_set_operation_cancel_requested or a replacement
+ * deployment, and reset with the cancel request.
+ *
+ * @param handle A workflow object handle.
+ * @return ADUC_CancellationToken* The token, owned by the root workflow, or NULL if @p handle is NULL or out of memory.
+ */
+ADUC_CancellationToken* workflow_peek_cancellation_token(ADUC_WorkflowHandle handle);
+
 void workflow_clear_inprogress_and_cancelrequested(ADUC_WorkflowHandle handle);
 
+//
+// Operation deadlines.
+//
+
+/**
+ * @brief Sets the default timeout of the operations of @p step, used when the update manifest doesn't set one.
+ *
+ * @param step ADUCITF_WorkflowStep_Download, ADUCITF_WorkflowStep_Install or ADUCITF_WorkflowStep_Apply.
+ * @param timeoutSeconds The timeout, in seconds. 0, the default, means no timeout.
+ */
+void workflow_set_default_operation_timeout(ADUCITF_WorkflowStep step, unsigned int timeoutSeconds);
+
+/**
+ * @brief Gets the timeout of the @p step operation of @p handle: the "downloadTimeoutSeconds",
+ * "installTimeoutSeconds" or "applyTimeoutSeconds" of its handlerProperties, a number or a numeric string, or else
+ * the default set with workflow_set_default_operation_timeout.
+ *
+ * @param handle A workflow object handle, e.g. that of a step.
+ * @param step The operation.
+ * @return unsigned int The timeout, in seconds, or 0 if there is none.
+ */
+unsigned int workflow_get_operation_timeout(ADUC_WorkflowHandle handle, ADUCITF_WorkflowStep step);
+
+/**
+ * @brief Sets when the operation in progress of the root workflow of @p handle times out.
+ *
+ * @param handle A workflow object handle.
+ * @param deadline The deadline, see ADUC_Timing_Now, or 0 for never.
+ */
+void workflow_set_operation_deadline(ADUC_WorkflowHandle handle, int64_t deadline);
+
+/**
+ * @brief Sets when the earliest step in progress of the root workflow of @p handle times out, for handlers that run
+ * steps with timeouts of their own. Thread-safe.
+ *
+ * @param handle A workflow object handle.
+ * @param deadline The deadline, see ADUC_Timing_Now, or 0 for never.
+ */
+void workflow_set_step_deadline(ADUC_WorkflowHandle handle, int64_t deadline);
+
+/**
+ * @brief Called regularly while an operation is in progress. Once the operation or a step of it is past its deadline,
+ * marks the operation as timed out and cancels it, which cancels the cancellation token and so kills the child
+ * processes launched with it.
+ *
+ * @param handle A workflow object handle.
+ * @param now The current time, see ADUC_Timing_Now.
+ * @return bool True if the operation timed out just now; the caller should cancel the handler too.
+ */
+bool workflow_check_operation_deadline(ADUC_WorkflowHandle handle, int64_t now);
+
+/**
+ * @brief Gets whether the operation in progress was cancelled by workflow_check_operation_deadline. Cleared with the
+ * cancel request.
+ *
+ * @param handle A workflow object handle.
+ * @return bool True if the operation timed out.
+ */
+bool workflow_get_operation_timed_out(ADUC_WorkflowHandle handle);
+
 //
 // Tree
 //
@@ -425,10 +779,57 @@ ADUC_WorkflowHandle workflow_get_child(ADUC_WorkflowHandle handle, int index);
  */
 bool workflow_insert_child(ADUC_WorkflowHandle handle, int index, ADUC_WorkflowHandle childHandle);
 
+/**
+ * @brief Allocates room for @p count child workflows at once, so that inserting that many doesn't grow the children
+ * array again.
+ *
+ * @param handle A parent workflow object handle.
+ * @param count The count of child workflows to make room for.
+ * @return true If succeeded, or there is room already.
+ */
+bool workflow_reserve_children(ADUC_WorkflowHandle handle, size_t count);
+
 // If success, returns removed file.
 // Note: to remove the last child, pass (-1) index.
 ADUC_WorkflowHandle workflow_remove_child(ADUC_WorkflowHandle handle, int index);
 
+/**
+ * @brief Saves the children of the root workflow @p handle to a snapshot file in its work folder, so that they can be
+ * restored without reading, verifying and selecting the components of the steps again, e.g. after a reboot.
+ *
+ * @param handle A root workflow object handle.
+ * @return true If the snapshot was written.
+ */
+bool workflow_save_children_snapshot(ADUC_WorkflowHandle handle);
+
+/**
+ * @brief Restores the children of the root workflow @p handle from the snapshot that workflow_save_children_snapshot
+ * wrote. The snapshot is only used if the agent wrote it, it is intact, and it was saved for the same workflow id,
+ * update id and selected components.
+ *
+ * @param handle A root workflow object handle, without children.
+ * @return true If the children were restored. On false, @p handle has no children.
+ */
+bool workflow_restore_children_snapshot(ADUC_WorkflowHandle handle);
+
+/**
+ * @brief Spills the step workflow @p handle to a file in its parent's work folder, freeing the memory of its Update
+ * Action and Update Manifest. They are read back on the next access to the workflow, so its handle stays valid, but
+ * strings and file entities peeked from it before are not: only spill a step that isn't in use.
+ *
+ * @param handle A child workflow object handle, without children of its own.
+ * @return true If the workflow is spilled.
+ */
+bool workflow_spill(ADUC_WorkflowHandle handle);
+
+/**
+ * @brief Returns whether the workflow @p handle is spilled, without reading it back.
+ *
+ * @param handle A workflow object handle.
+ * @return true If the workflow is spilled.
+ */
+bool workflow_is_spilled(ADUC_WorkflowHandle handle);
+
 //
 // State
 //
@@ -475,6 +876,25 @@ bool workflow_request_immediate_reboot(ADUC_WorkflowHandle handle);
 bool workflow_is_reboot_requested(ADUC_WorkflowHandle handle);
 bool workflow_is_immediate_reboot_requested(ADUC_WorkflowHandle handle);
 
+/**
+ * @brief Records why a reboot or an agent restart was requested, e.g. by which step, on the root workflow, so that
+ * the single reboot or restart the requests are coalesced into can be reported with all its reasons.
+ * Not thread-safe; callers serialize it like the requests.
+ *
+ * @param handle A workflow object handle.
+ * @param reason The reason.
+ * @return bool true on success.
+ */
+bool workflow_add_restart_reason(ADUC_WorkflowHandle handle, const char* reason);
+
+/**
+ * @brief Gets the reasons recorded with workflow_add_restart_reason, separated by "; ".
+ *
+ * @param handle A workflow object handle.
+ * @return const char* The reasons, or NULL if none. Caller must not free this pointer.
+ */
+const char* workflow_peek_restart_reasons(ADUC_WorkflowHandle handle);
+
 void workflow_set_cancellation_type(ADUC_WorkflowHandle handle, ADUC_WorkflowCancellationType cancellationType);
 ADUC_WorkflowCancellationType workflow_get_cancellation_type(ADUC_WorkflowHandle handle);
 
@@ -482,7 +902,47 @@ bool workflow_update_retry_deployment(ADUC_WorkflowHandle handle, const char* re
 
 bool workflow_update_replacement_deployment(
     ADUC_WorkflowHandle currentWorkflowHandle, ADUC_WorkflowHandle nextWorkflowHandle);
+
+/**
+ * @brief Checks whether every file and bundled update of @p handle and of its children has the same content, compared
+ * by hash, as a file or bundled update of @p otherHandle or of its children.
+ *
+ * @param handle A workflow object handle.
+ * @param otherHandle Another workflow object handle.
+ * @return bool true if all the files of @p handle are needed by @p otherHandle.
+ */
+bool workflow_files_are_needed_by(ADUC_WorkflowHandle handle, ADUC_WorkflowHandle otherHandle);
+
+/**
+ * @brief If the current workflow is downloading files that are all needed by the next workflow, defers the next
+ * workflow until the download completes, without cancelling it, instead of workflow_update_replacement_deployment.
+ * @remark As with workflow_update_replacement_deployment, the current workflow owns the next one when true is returned.
+ *
+ * @param currentWorkflowHandle The workflow handle on the current workflow Data.
+ * @param nextWorkflowHandle The workflow handle for the next workflow update deployment.
+ * @return bool true if the next workflow got deferred until the download completes.
+ */
+bool workflow_defer_replacement_after_download(
+    ADUC_WorkflowHandle currentWorkflowHandle, ADUC_WorkflowHandle nextWorkflowHandle);
+
+/**
+ * @brief Checks whether a replacement workflow is deferred until the operation in progress completes.
+ *
+ * @param handle A workflow object handle.
+ * @return bool true if a replacement workflow is deferred.
+ */
+bool workflow_has_deferred_replacement(ADUC_WorkflowHandle handle);
+
 void workflow_update_for_replacement(ADUC_WorkflowHandle handle);
+
+/**
+ * @brief Takes the work folder of the workflow that workflow_update_for_replacement replaced. Its files are kept until
+ * the replacement's download had a chance to reuse them; the caller then destroys it.
+ *
+ * @param handle A workflow object handle.
+ * @return char* The work folder, or NULL if none. Caller must free it with workflow_free_string.
+ */
+char* workflow_take_replaced_workfolder(ADUC_WorkflowHandle handle);
 void workflow_update_for_retry(ADUC_WorkflowHandle handle);
 
 //
@@ -0,0 +1,142 @@
+/**
+ * @file workflow_utils.hpp
+ * @brief Borrowed-string views of the workflow accessors, for C++ callers.
+ *
+ * @copyright Copyright (c) Microsoft Corporation.
+ * Licensed under the MIT License.
+ */
+
+#ifndef ADUC_WORKFLOW_UTILS_HPP
+#define ADUC_WORKFLOW_UTILS_HPP
+
+#include "aduc/workflow_utils.h"
+
+#include <cstring>
+#include <string>
+
+namespace ADUC
+{
+/**
+ * @brief A non-owning view of a string of a workflow, returned by a workflow_peek_* function.
+ *
+ * The view is valid as long as the string it refers to is; see the workflow_peek_* function it came from. Copy it with
+ * str() to keep it longer.
+ */
+class WorkflowStringView
+{
+public:
+    /**
+     * @brief Constructs a view of @p s.
+     *
+     * @param s The string, or nullptr for a null view.
+     */
+    explicit WorkflowStringView(const char* s) : _data(s), _size(s == nullptr ? 0 : strlen(s))
+    {
+    }
+
+    /**
+     * @brief Returns the string, or nullptr for a null view.
+     */
+    const char* data() const
+    {
+        return _data;
+    }
+
+    /**
+     * @brief Returns the length of the string.
+     */
+    size_t size() const
+    {
+        return _size;
+    }
+
+    /**
+     * @brief Returns whether the view is null or empty.
+     */
+    bool empty() const
+    {
+        return _size == 0;
+    }
+
+    /**
+     * @brief Returns whether the view is null.
+     */
+    bool is_null() const
+    {
+        return _data == nullptr;
+    }
+
+    /**
+     * @brief Returns a copy of the string; empty for a null view.
+     */
+    std::string str() const
+    {
+        return _data == nullptr ? std::string{} : std::string{ _data, _size };
+    }
+
+    /**
+     * @brief Compares the string with @p other. A null view equals nullptr only.
+     */
+    bool operator==(const char* other) const
+    {
+        if (_data == nullptr || other == nullptr)
+        {
+            return _data == other;
+        }
+
+        return strcmp(_data, other) == 0;
+    }
+
+    bool operator!=(const char* other) const
+    {
+        return !(*this == other);
+    }
+
+private:
+    const char* _data;
+    size_t _size;
+};
+
+/**
+ * @brief Returns a view of the id of the workflow. See workflow_peek_id.
+ */
+inline WorkflowStringView PeekWorkflowId(ADUC_WorkflowHandle handle)
+{
+    return WorkflowStringView{ workflow_peek_id(handle) };
+}
+
+/**
+ * @brief Returns a view of the work folder of the workflow. See workflow_peek_workfolder.
+ */
+inline WorkflowStringView PeekWorkFolder(ADUC_WorkflowHandle handle)
+{
+    return WorkflowStringView{ workflow_peek_workfolder(handle) };
+}
+
+/**
+ * @brief Returns a view of the update type of the workflow. See workflow_peek_update_type.
+ */
+inline WorkflowStringView PeekUpdateType(ADUC_WorkflowHandle handle)
+{
+    return WorkflowStringView{ workflow_peek_update_type(handle) };
+}
+
+/**
+ * @brief Returns a view of the installed criteria of the workflow. See workflow_peek_installed_criteria.
+ */
+inline WorkflowStringView PeekInstalledCriteria(ADUC_WorkflowHandle handle)
+{
+    return WorkflowStringView{ workflow_peek_installed_criteria(handle) };
+}
+
+/**
+ * @brief Returns a view of the selected components of the workflow. See workflow_peek_selected_components.
+ */
+inline WorkflowStringView PeekSelectedComponents(ADUC_WorkflowHandle handle)
+{
+    return WorkflowStringView{ workflow_peek_selected_components(handle) };
+}
+
+} // namespace ADUC
+
+#endif // ADUC_WORKFLOW_UTILS_HPP
@@ -7,6 +7,8 @@
  */
 #include "aduc/workflow_utils.h"
 #include "aduc/adu_types.h"
+#include "aduc/arena.h"
+#include "aduc/cancellation_token.h"
 #include "aduc/c_utils.h"
 #include "aduc/extension_manager.h"
 #include "aduc/hash_utils.h"
@@ -19,13 +21,23 @@
 #include "aduc/types/workflow.h"
 #include "aduc/workflow_internal.h"
 #include "jws_utils.h"
+#include "parson_json_utils.h" // for ADUC_JSON_GetAllocatedBytes, ADUC_JSON_ParseReadOnly
 
 #include <azure_c_shared_utility/crt_abstractions.h> // for mallocAndStrcpy_s
 #include <azure_c_shared_utility/strings.h> // for STRING_*
 #include <parson.h>
+#include <errno.h>
+#include <fcntl.h> // for open, O_*
+#include <limits.h> // for UINT_MAX
+#include <pthread.h>
 #include <stdarg.h> // for va_*
+#include <stdint.h>
+#include <stdio.h> // for fopen, rename, remove
 #include <stdlib.h> // for calloc, atoi
 #include <string.h>
+#include <sys/mman.h> // for mmap, munmap
+#include <sys/stat.h> // for stat
+#include <unistd.h> // for close, geteuid
 
 // Starting from version 4, the update manifest can contain both embedded manifest,
 // or a downloadable update manifest file (files["manifest"] contains the update manifest file info)
@@ -39,13 +51,7 @@
 #define WORKFLOW_PROPERTY_FIELD_WORKFLOW_DOT_RETRYTIMESTAMP "workflow.retryTimestamp"
 #define WORKFLOW_PROPERTY_FIELD_WORKFLOW_DOT_ACTION "workflow.action"
 #define WORKFLOW_PROPERTY_FIELD_SANDBOX_ROOTPATH "_sandboxRootPath"
-#define WORKFLOW_PROPERTY_FIELD_WORKFOLDER "_workFolder"
-#define WORKFLOW_PROPERTY_FIELD_CANCEL_REQUESTED "_cancelRequested"
-#define WORKFLOW_PROPERTY_FIELD_REBOOT_REQUESTED "_rebootRequested"
-#define WORKFLOW_PROPERTY_FIELD_IMMEDIATE_REBOOT_REQUESTED "_immediateRebootRequested"
-#define WORKFLOW_PROPERTY_FIELD_AGENT_RESTART_REQUESTED "_agentRestartRequested"
-#define WORKFLOW_PROPERTY_FIELD_IMMEDIATE_AGENT_RESTART_REQUESTED "_immediateAgentRestartRequested"
-#define WORKFLOW_PROPERTY_FIELD_SELECTED_COMPONENTS "_selectedComponents"
+#define WORKFLOW_PROPERTY_FIELD_IS_INSTALLED_CACHE "_isInstalledCache"
 
 // V4 and later.
 #define DEAULT_STEP_TYPE "reference"
@@ -56,6 +62,7 @@
 #define STEP_PROPERTY_FIELD_HANDLER "handler"
 #define STEP_PROPERTY_FIELD_FILES "files"
 #define STEP_PROPERTY_FIELD_HANDLER_PROPERTIES "handlerProperties"
+#define UPDATE_MANIFEST_PROPERTY_FIELD_URGENT "urgent"
 
 #define WORKFLOW_CHILDREN_BLOCK_SIZE 10
 
@@ -71,6 +78,37 @@
 
 EXTERN_C_BEGIN
 
+/**
+ * @brief The memory budget of a workflow, in bytes, see workflow_set_memory_budget. Accessed atomically.
+ */
+static size_t s_workflowMemoryBudgetBytes = 0;
+
+/**
+ * @brief The size limit of the log of each workflow, in bytes, see workflow_set_log_size_limit. Accessed atomically.
+ */
+static size_t s_workflowLogSizeLimitBytes = 0;
+
+/**
+ * @brief The download start jitter window, in seconds, and the hash of the device id, see
+ * workflow_set_download_start_jitter and workflow_set_device_id. Accessed atomically.
+ */
+static unsigned int s_downloadStartJitterSeconds = 0;
+static uint32_t s_deviceIdHash = 0;
+static bool s_hasDeviceId = false;
+
+/**
+ * @brief The download mirrors, a JSON object of URI prefixes to arrays of the prefixes of their mirrors, or NULL, see
+ * workflow_set_download_mirrors. Guarded by s_downloadMirrorsMutex.
+ */
+static JSON_Value* s_downloadMirrors = NULL;
+static pthread_mutex_t s_downloadMirrorsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief The default timeouts of the operations, in seconds, by ADUCITF_WorkflowStep, see
+ * workflow_set_default_operation_timeout. Accessed atomically.
+ */
+static unsigned int s_defaultOperationTimeoutSeconds[ADUCITF_WorkflowStep_Apply + 1];
+
 //
 // Private functions - this is an adapter for the underlying ADUC_Workflow object.
 //
@@ -102,9 +140,19 @@ ADUC_WorkflowHandle handle_from_workflow(ADUC_Workflow* workflow)
 /**
  * @brief Convert ADUC_WorkflowHandle to ADUC_Workflow*.
  */
+static void _workflow_load_spilled(ADUC_Workflow* wf);
+
 ADUC_Workflow* workflow_from_handle(ADUC_WorkflowHandle handle)
 {
-    return (ADUC_Workflow*)(handle);
+    ADUC_Workflow* wf = (ADUC_Workflow*)(handle);
+
+    // A spilled workflow is read back on its first access, see workflow_spill.
+    if (wf != NULL && __atomic_load_n(&wf->SpillPath, __ATOMIC_ACQUIRE) != NULL)
+    {
+        _workflow_load_spilled(wf);
+    }
+
+    return wf;
 }
 
 /**
@@ -160,7 +208,7 @@ _Bool _Json_ValidateManifestHash(const JSON_Value* updateActionJson)
 {
     _Bool success = false;
 
-    JSON_Value* signatureValue = NULL;
+    ADUC_JSON_ReadOnlyDocument* signatureDocument = NULL;
     char* jwtPayload = NULL;
 
     if (updateActionJson == NULL)
@@ -193,15 +241,16 @@ _Bool _Json_ValidateManifestHash(const JSON_Value* updateActionJson)
         goto done;
     }
 
-    signatureValue = json_parse_string(jwtPayload);
-    if (signatureValue == NULL)
+    // The payload is only read for its hash.
+    signatureDocument = ADUC_JSON_ParseReadOnly(jwtPayload);
+    if (signatureDocument == NULL)
     {
         Log_Error("updateManifestSignature contains an invalid body");
         goto done;
     }
 
-    const char* b64SignatureManifestHash =
-        json_object_get_string(json_object(signatureValue), ADUCITF_JWT_FIELDNAME_HASH);
+    const char* b64SignatureManifestHash = json_object_get_string(
+        json_value_get_object(ADUC_JSON_ReadOnlyDocument_GetRoot(signatureDocument)), ADUCITF_JWT_FIELDNAME_HASH);
     if (b64SignatureManifestHash == NULL)
     {
         Log_Error("updateManifestSignature does not contain a hash value. Cannot validate the manifest!");
@@ -213,7 +262,7 @@ _Bool _Json_ValidateManifestHash(const JSON_Value* updateActionJson)
 
 done:
 
-    json_value_free(signatureValue);
+    ADUC_JSON_ReadOnlyDocument_Free(signatureDocument);
 
     free(jwtPayload);
     return success;
@@ -349,8 +398,7 @@ ADUC_Result _workflow_parse(bool isFile, const char* source, bool validateManife
             JSON_Value* v = json_object_get_value(wf->UpdateActionObject, ADUCITF_FIELDNAME_UPDATEMANIFEST);
             if (v != NULL)
             {
-                char* s = json_serialize_to_string(v);
-                wf->UpdateManifestObject = json_value_get_object(json_parse_string(s));
+                wf->UpdateManifestObject = json_value_get_object(json_value_deep_copy(v));
             }
         }
 
@@ -360,6 +408,11 @@ ADUC_Result _workflow_parse(bool isFile, const char* source, bool validateManife
             goto done;
         }
 
+        // The manifest is only read through UpdateManifestObject from now on, and its signature is verified:
+        // release both rather than keep a second copy of the manifest for the life of the workflow.
+        json_object_remove(wf->UpdateActionObject, ADUCITF_FIELDNAME_UPDATEMANIFEST);
+        json_object_remove(wf->UpdateActionObject, ADUCITF_FIELDNAME_UPDATEMANIFESTSIGNATURE);
+
         int manifestVersion = workflow_get_update_manifest_version(handle_from_workflow(wf));
 
         // Starting from version 4, the update manifest can contain both embedded manifest,
@@ -485,6 +538,12 @@ void _workflow_free_updateaction(ADUC_WorkflowHandle handle)
 void _workflow_free_updatemanifest(ADUC_WorkflowHandle handle)
 {
     ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf != NULL)
+    {
+        // The file table is released with the workflow arena.
+        wf->FileTable = NULL;
+    }
+
     if (wf != NULL && wf->UpdateManifestObject != NULL)
     {
         json_value_free(json_object_get_wrapping_value(wf->UpdateManifestObject));
@@ -597,6 +656,27 @@ done:
     return versionNumber;
 }
 
+/**
+ * @brief Frees the derived work folders of @p wf and of its descendants, whose work folders derive from its.
+ *
+ * @param wf The workflow whose work folder, id or parent changed.
+ */
+static void workflow_invalidate_workfolder_cache(ADUC_Workflow* wf)
+{
+    if (wf == NULL)
+    {
+        return;
+    }
+
+    free(wf->WorkFolderCache);
+    wf->WorkFolderCache = NULL;
+
+    for (size_t i = 0; i < wf->ChildCount; i++)
+    {
+        workflow_invalidate_workfolder_cache(wf->Children[i]);
+    }
+}
+
 /**
  * @brief Set workflow id property. (PropertiesObject["_id"])
  *
@@ -613,6 +693,7 @@ bool _workflow_set_id(ADUC_WorkflowHandle handle, const char* id)
 
     ADUC_Workflow* wf = workflow_from_handle(handle);
     JSON_Status status = json_object_set_string(wf->PropertiesObject, WORKFLOW_PROPERTY_FIELD_ID, id);
+    workflow_invalidate_workfolder_cache(wf);
     return status == JSONSuccess;
 }
 
@@ -786,6 +867,26 @@ char* workflow_get_string_property(ADUC_WorkflowHandle handle, const char* prope
     return NULL;
 }
 
+/**
+ * @brief Replaces the string of a workflow field, e.g. ADUC_Workflow::WorkFolder, with a copy of @p value.
+ *
+ * @param field The field.
+ * @param value The new value, or NULL to clear the field.
+ * @return bool Returns true on success. On failure, the field is left unchanged.
+ */
+static bool workflow_set_field_string(char** field, const char* value)
+{
+    char* copy = NULL;
+    if (value != NULL && mallocAndStrcpy_s(&copy, value) != 0)
+    {
+        return false;
+    }
+
+    free(*field);
+    *field = copy;
+    return true;
+}
+
 bool workflow_set_boolean_property(ADUC_WorkflowHandle handle, const char* property, bool value)
 {
     if (handle == NULL)
@@ -829,9 +930,11 @@ bool workflow_set_workfolder(ADUC_WorkflowHandle handle, const char* format, ...
         return false;
     }
 
+    workflow_invalidate_workfolder_cache(wf);
+
     if (format == NULL)
     {
-        success = workflow_set_string_property(handle, WORKFLOW_PROPERTY_FIELD_WORKFOLDER, "");
+        success = workflow_set_field_string(&wf->WorkFolder, "");
     }
     else
     {
@@ -840,7 +943,7 @@ bool workflow_set_workfolder(ADUC_WorkflowHandle handle, const char* format, ...
         va_start(arg_list, format);
         if (vsnprintf(buffer, WORKFLOW_RESULT_DETAILS_MAX_LENGTH, format, arg_list) >= 0)
         {
-            success = workflow_set_string_property(handle, WORKFLOW_PROPERTY_FIELD_WORKFOLDER, buffer);
+            success = workflow_set_field_string(&wf->WorkFolder, buffer);
         }
         else
         {
@@ -853,2146 +956,4193 @@ bool workflow_set_workfolder(ADUC_WorkflowHandle handle, const char* format, ...
     return success;
 }
 
-bool workflow_set_selected_components(ADUC_WorkflowHandle handle, const char* selectedComponents)
-{
-    return workflow_set_string_property(handle, WORKFLOW_PROPERTY_FIELD_SELECTED_COMPONENTS, selectedComponents);
-}
-
-const char* workflow_peek_selected_components(ADUC_WorkflowHandle handle)
-{
-    return workflow_get_string_property(handle, WORKFLOW_PROPERTY_FIELD_SELECTED_COMPONENTS);
-}
-
-bool workflow_set_sandbox(ADUC_WorkflowHandle handle, const char* sandbox)
+/**
+ * @brief Releases a reference to parsed selected components, freeing them with the last one.
+ *
+ * @param components The parsed selected components, may be NULL.
+ */
+static void workflow_release_components(ADUC_WorkflowComponents* components)
 {
-    if (handle == NULL)
+    if (components == NULL || __atomic_sub_fetch(&components->RefCount, 1, __ATOMIC_ACQ_REL) != 0)
     {
-        return false;
+        return;
     }
 
-    ADUC_WorkflowHandle root = workflow_get_root(handle);
-
-    if (!workflow_set_string_property(root, WORKFLOW_PROPERTY_FIELD_SANDBOX_ROOTPATH, sandbox))
+    for (size_t i = 0; i < components->ComponentCount; i++)
     {
-        Log_Error("Cannot set sandbox root path.");
-        return false;
+        free(components->ComponentJsons[i]);
     }
 
-    return true;
+    json_value_free(components->Value);
+    free(components);
 }
 
-// Workfolder =  [root.sandboxfolder]  "/"  ( [parent.workfolder | parent.id]  "/" )+  [handle.workfolder | handle.id]
-char* workflow_get_workfolder(ADUC_WorkflowHandle handle)
+/**
+ * @brief Returns the parsed selected components of the workflow, parsing its selected components JSON on the first
+ * call.
+ *
+ * @param wf The workflow.
+ * @return The parsed selected components, or NULL if the workflow has none or they're invalid.
+ */
+static ADUC_WorkflowComponents* workflow_get_components(ADUC_Workflow* wf)
 {
-    char dir[1024] = { 0 };
-
-    char* pwf = NULL;
-    char* ret = NULL;
-    char* id = workflow_get_id(handle);
-
-    // If workfolder explicitly specified, use it.
-    char* wf = workflow_get_string_property(handle, WORKFLOW_PROPERTY_FIELD_WORKFOLDER);
-    if (wf != NULL)
+    ADUC_WorkflowComponents* components = __atomic_load_n(&wf->Components, __ATOMIC_ACQUIRE);
+    if (components != NULL || wf->SelectedComponents == NULL)
     {
-        return wf;
+        return components;
     }
 
-    // Return ([parent's workfolder] or [default sandbox folder]) + "/" + [workflow id];
-    ADUC_WorkflowHandle p = workflow_get_parent(handle);
-    if (p != NULL)
+    JSON_Value* value = json_parse_string(wf->SelectedComponents);
+    JSON_Array* array = json_object_get_array(json_object(value), "components");
+    if (array == NULL)
     {
-        pwf = workflow_get_workfolder(p);
-        sprintf(dir, "%s/%s", pwf, id);
+        Log_Error("Invalid selected components.");
+        json_value_free(value);
+        return NULL;
     }
-    else
+
+    // The serialized components follow the record in the same block.
+    const size_t count = json_array_get_count(array);
+    ADUC_WorkflowComponents* newComponents = malloc(sizeof(*newComponents) + count * sizeof(char*));
+    if (newComponents == NULL)
     {
-        Log_Info("Sandbox root path not set. Use default: '%s'", DEFAULT_SANDBOX_ROOT_PATH);
-        sprintf(dir, "%s/%s", DEFAULT_SANDBOX_ROOT_PATH, id);
+        json_value_free(value);
+        return NULL;
     }
 
-    free(pwf);
-    free(id);
+    newComponents->RefCount = 1;
+    newComponents->Value = value;
+    newComponents->Components = array;
+    newComponents->ComponentCount = count;
+    newComponents->ComponentJsons = (char**)(newComponents + 1);
+    memset(newComponents->ComponentJsons, 0, count * sizeof(char*));
 
-    if (dir[0] != 0)
+    // Handlers may parse from several threads; the first record set wins.
+    if (!__atomic_compare_exchange_n(
+            &wf->Components, &components, newComponents, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
     {
-        mallocAndStrcpy_s(&ret, dir);
+        workflow_release_components(newComponents);
+        return components;
     }
 
-    return ret;
-}
-
-/**
- * @brief Get 'updateManifest.files' map.
- *
- * @param handle A workflow object handle.
- * @return const JSON_Object* A map containing update files information.
- */
-const JSON_Object* _workflow_get_update_manifest_files_map(ADUC_WorkflowHandle handle)
-{
-    const JSON_Object* o = _workflow_get_update_manifest(handle);
-    return json_object_dotget_object(o, "files");
-}
-
-/**
- * @brief Get 'updateManifest.bundledUpdates' array.
- *
- * @param handle A workflow object handle.
- * @return const JSON_Object* A map containing bundle update manifest files information.
- */
-JSON_Array* _workflow_get_update_manifest_bundle_updates_map(ADUC_WorkflowHandle handle)
-{
-    const JSON_Object* o = _workflow_get_update_manifest(handle);
-    return json_object_get_array(o, "bundledUpdates");
+    return newComponents;
 }
 
 /**
- * @brief Get 'fileUrls' map.
+ * @brief Returns the JSON of the component at @p index alone, i.e. a 'components' array with only that component,
+ * serializing it on the first call.
  *
- * @param handle A workflow object handle.
- * @return const JSON_Object* A json object (map) containing update files information.
+ * @param components The parsed selected components.
+ * @param index The index of the component, less than ComponentCount.
+ * @return The JSON, owned by @p components, or NULL on out of memory.
  */
-const JSON_Object* _workflow_get_fileurls_map(ADUC_WorkflowHandle handle)
+static const char* workflow_get_component_json(ADUC_WorkflowComponents* components, size_t index)
 {
-    const JSON_Object* o = _workflow_get_updateaction(handle);
-    return o == NULL ? NULL : json_object_dotget_object(o, "fileUrls");
-}
+    char* json = __atomic_load_n(&components->ComponentJsons[index], __ATOMIC_ACQUIRE);
+    if (json != NULL)
+    {
+        return json;
+    }
 
-/**
- * @brief Return an update id of this workflow.
- * This id should be reported to the cloud once the update installed successfully.
- *
- * @param handle A workflow object handle.
- * @param[out] updateId A pointer to the output ADUC_UpdateId struct.
- *                      Must call 'workflow_free_update_id' function to free the memory when done.
- *
- * @return ADUC_Result Return ADUC_GeneralResult_Success if success. Otherwise, return ADUC_GeneralResult_Failure with extendedResultCode.
- */
-ADUC_Result workflow_get_expected_update_id(ADUC_WorkflowHandle handle, ADUC_UpdateId** updateId)
-{
-    ADUC_Result result = { ADUC_GeneralResult_Failure };
-    if (!ADUC_Json_GetUpdateId(json_object_get_wrapping_value(_workflow_get_updateaction(handle)), updateId))
+    char* componentJson = json_serialize_to_string(json_array_get_value(components->Components, index));
+    char* newJson = componentJson == NULL ? NULL : ADUC_StringFormat("{\"components\":[%s]}", componentJson);
+    json_free_serialized_string(componentJson);
+    if (newJson == NULL)
     {
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_INVALID_UPDATE_ID;
+        Log_Error("Cannot serialize selected component #%zu.", index);
+        return NULL;
     }
-    else
+
+    // Steps of components installed at the same time may peek at the same time; the first JSON set wins.
+    if (!__atomic_compare_exchange_n(
+            &components->ComponentJsons[index], &json, newJson, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
     {
-        result.ResultCode = ADUC_GeneralResult_Success;
+        free(newJson);
+        return json;
     }
-    return result;
+
+    return newJson;
 }
 
-/**
- * @brief Return an update id of this workflow.
- * This id should be reported to the cloud once the update installed successfully.
- *
- * @param handle A workflow object handle.
- *
- * @return char* Expected update id string.
- *         Caller must call 'workflow_free_string' function to free the memory when done.
- */
-char* workflow_get_expected_update_id_string(ADUC_WorkflowHandle handle)
+bool workflow_set_selected_components(ADUC_WorkflowHandle handle, const char* selectedComponents)
 {
-    const JSON_Object* manifest = _workflow_get_update_manifest(handle);
-    const char* provider = json_object_dotget_string(manifest, "updateId.provider");
-    const char* name = json_object_dotget_string(manifest, "updateId.name");
-    const char* version = json_object_dotget_string(manifest, "updateId.version");
-    char* id = NULL;
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        return false;
+    }
 
-    if (provider == NULL || name == NULL || version == NULL)
+    // Set again for each phase; unchanged selected components keep their parsed record.
+    const char* current = workflow_peek_selected_components(handle);
+    if (current == selectedComponents
+        || (current != NULL && selectedComponents != NULL && strcmp(current, selectedComponents) == 0))
     {
-        goto done;
+        return true;
     }
 
-    id = ADUC_StringFormat("{\"provider\":\"%s\",\"name\":\"%s\",\"version\":\"%s\"}", provider, name, version);
+    if (!workflow_set_field_string(&wf->SelectedComponents, selectedComponents))
+    {
+        return false;
+    }
 
-done:
-    return id;
+    workflow_release_components(wf->Components);
+    wf->Components = NULL;
+    wf->ComponentSelected = false;
+    return true;
 }
 
-void workflow_free_update_id(ADUC_UpdateId* updateId)
+const char* workflow_peek_selected_components(ADUC_WorkflowHandle handle)
 {
-    ADUC_UpdateId_UninitAndFree(updateId);
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        return NULL;
+    }
+
+    if (!wf->ComponentSelected)
+    {
+        return wf->SelectedComponents;
+    }
+
+    return workflow_get_component_json(wf->Components, wf->ComponentIndex);
 }
 
-/**
- * @brief Get installed-criteria string from this workflow.
- * @param handle A workflow object handle.
- * @return Returns installed-criteria string.
- *         Caller must call 'workflow_free_string' function to free the memory when done.
- */
-char* workflow_get_installed_criteria(ADUC_WorkflowHandle handle)
+bool workflow_get_selected_components_count(ADUC_WorkflowHandle handle, size_t* count)
 {
-    char* installedCriteria = NULL;
-
-    // For Update Manifest V4, customer can specify installedCriteria in 'handlerProperties' map.
-    if (workflow_get_update_manifest_version(handle) >= EMBEDDED_AND_DOWNLOADABLE_UPDATE_MANIFEST_VERSION)
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL || count == NULL)
     {
-        installedCriteria = workflow_copy_string(
-            workflow_peek_update_manifest_handler_properties_string(handle, ADUCITF_FIELDNAME_INSTALLEDCRITERIA));
+        return false;
     }
-    else
+
+    const ADUC_WorkflowComponents* components = workflow_get_components(wf);
+    if (components == NULL)
     {
-        installedCriteria = workflow_get_update_manifest_string_property(handle, ADUCITF_FIELDNAME_INSTALLEDCRITERIA);
+        return false;
     }
 
-    return installedCriteria;
+    *count = wf->ComponentSelected ? 1 : components->ComponentCount;
+    return true;
 }
 
 /**
- * @brief Get the Update Manifest 'compatibility' array, in serialized json string format.
+ * @brief Resolves the component at @p index of the selected components of @p wf to its index in the parsed record.
  *
- * @param handle A workflow handle.
- * @return char* If success, returns a serialized json string. Otherwise, returns NULL.
- *         Caller must call 'workflow_free_string' function to free the memory when done.
+ * @param wf The workflow.
+ * @param index The index of the component in the selected components of @p wf.
+ * @param[out] components The parsed selected components.
+ * @param[out] componentIndex The index of the component in @p components.
+ * @return true if there's a component at @p index.
  */
-char* workflow_get_compatibility(ADUC_WorkflowHandle handle)
+static bool workflow_resolve_component(
+    ADUC_Workflow* wf, size_t index, ADUC_WorkflowComponents** components, size_t* componentIndex)
 {
-    const JSON_Object* manifestObject = _workflow_get_update_manifest(handle);
-    if (manifestObject == NULL)
+    if (wf == NULL || (*components = workflow_get_components(wf)) == NULL)
     {
-        return NULL;
+        return false;
     }
 
-    JSON_Value* compats = json_object_get_value(manifestObject, "compatibility");
-    if (compats != NULL)
+    if (wf->ComponentSelected)
     {
-        return json_serialize_to_string(compats);
+        *componentIndex = wf->ComponentIndex;
+        return index == 0;
     }
 
-    return NULL;
+    *componentIndex = index;
+    return index < (*components)->ComponentCount;
 }
 
-void workflow_set_operation_in_progress(ADUC_WorkflowHandle handle, bool inProgress)
+const char* workflow_peek_selected_component(ADUC_WorkflowHandle handle, size_t index)
 {
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf == NULL)
+    ADUC_WorkflowComponents* components = NULL;
+    size_t componentIndex = 0;
+
+    if (!workflow_resolve_component(workflow_from_handle(handle), index, &components, &componentIndex))
     {
-        Log_Warn("Setting 'OperationInProgress' when there's no active workflow. (value:%d)", inProgress);
-        return;
+        return NULL;
     }
 
-    wf->OperationInProgress = inProgress;
+    return workflow_get_component_json(components, componentIndex);
 }
 
-bool workflow_get_operation_in_progress(ADUC_WorkflowHandle handle)
+bool workflow_select_component(ADUC_WorkflowHandle handle, ADUC_WorkflowHandle sourceHandle, size_t index)
 {
-    bool result = false;
-
     ADUC_Workflow* wf = workflow_from_handle(handle);
+    ADUC_WorkflowComponents* components = NULL;
+    size_t componentIndex = 0;
 
-    if (wf != NULL)
+    if (wf == NULL
+        || !workflow_resolve_component(workflow_from_handle(sourceHandle), index, &components, &componentIndex))
     {
-        result = wf->OperationInProgress;
+        return false;
     }
 
-    return result;
+    if (wf->Components != components)
+    {
+        __atomic_add_fetch(&components->RefCount, 1, __ATOMIC_ACQ_REL);
+        workflow_release_components(wf->Components);
+        wf->Components = components;
+    }
+
+    free(wf->SelectedComponents);
+    wf->SelectedComponents = NULL;
+    wf->ComponentIndex = componentIndex;
+    wf->ComponentSelected = true;
+    return true;
 }
 
-void workflow_set_operation_cancel_requested(ADUC_WorkflowHandle handle, bool cancel)
+bool workflow_set_cached_is_installed(
+    ADUC_WorkflowHandle handle, const char* selectedComponents, ADUC_Result_t resultCode)
 {
     ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf == NULL)
+    if (wf == NULL || wf->PropertiesObject == NULL)
     {
-        Log_Warn("Setting 'OperationCancelled' when there's no active workflow. (value:%d)", cancel);
-        return;
+        return false;
     }
 
-    wf->OperationCancelled = cancel;
+    JSON_Object* cache = json_object_get_object(wf->PropertiesObject, WORKFLOW_PROPERTY_FIELD_IS_INSTALLED_CACHE);
+    if (cache == NULL)
+    {
+        JSON_Value* cacheValue = json_value_init_object();
+        if (cacheValue == NULL
+            || json_object_set_value(wf->PropertiesObject, WORKFLOW_PROPERTY_FIELD_IS_INSTALLED_CACHE, cacheValue)
+                != JSONSuccess)
+        {
+            json_value_free(cacheValue);
+            return false;
+        }
+
+        cache = json_value_get_object(cacheValue);
+    }
+
+    // Not json_object_dotset_*, as selected components are JSON strings, which may contain dots.
+    return JSONSuccess
+        == json_object_set_number(cache, selectedComponents == NULL ? "" : selectedComponents, resultCode);
 }
 
-bool workflow_get_operation_cancel_requested(ADUC_WorkflowHandle handle)
+bool workflow_get_cached_is_installed(
+    ADUC_WorkflowHandle handle, const char* selectedComponents, ADUC_Result_t* resultCode)
 {
-    bool result = false;
-
     ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL || wf->PropertiesObject == NULL || resultCode == NULL)
+    {
+        return false;
+    }
 
-    if (wf != NULL)
+    JSON_Object* cache = json_object_get_object(wf->PropertiesObject, WORKFLOW_PROPERTY_FIELD_IS_INSTALLED_CACHE);
+    const char* key = selectedComponents == NULL ? "" : selectedComponents;
+
+    if (!json_object_has_value_of_type(cache, key, JSONNumber))
     {
-        result = wf->OperationCancelled;
+        return false;
     }
 
-    return result;
+    *resultCode = (ADUC_Result_t)json_object_get_number(cache, key);
+    return true;
 }
 
-/**
- * @brief sets both operation in progress and cancel requested to false
- * @param handle The workflow handle
- */
-void workflow_clear_inprogress_and_cancelrequested(ADUC_WorkflowHandle handle)
+void workflow_clear_cached_is_installed(ADUC_WorkflowHandle handle)
 {
     ADUC_Workflow* wf = workflow_from_handle(handle);
     if (wf == NULL)
     {
-        Log_Warn("clearing when no active workflow.");
         return;
     }
 
-    wf->OperationInProgress = false;
-    wf->OperationCancelled = false;
+    if (wf->PropertiesObject != NULL)
+    {
+        json_object_remove(wf->PropertiesObject, WORKFLOW_PROPERTY_FIELD_IS_INSTALLED_CACHE);
+    }
+
+    for (size_t i = 0; i < wf->ChildCount; i++)
+    {
+        workflow_clear_cached_is_installed(handle_from_workflow(wf->Children[i]));
+    }
 }
 
-/**
- * @brief Get an Update Action code.
- *
- * @param handle A workflow object handle.
- * @return ADUCITF_UpdateAction Returns ADUCITF_UpdateAction_Undefined if not specified.
- * Otherwise, returns ADUCITF_UpdateAction_*
- * or ADUCITF_UpdateAction_Cancel.
- */
-ADUCITF_UpdateAction workflow_get_action(ADUC_WorkflowHandle handle)
+void workflow_set_download_deferred(ADUC_WorkflowHandle handle, bool deferred)
 {
-    const JSON_Object* o = _workflow_get_updateaction(handle);
-    if (o == NULL)
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf != NULL)
     {
-        return ADUCITF_UpdateAction_Undefined;
+        wf->DownloadDeferred = deferred;
     }
+}
 
-    ADUCITF_UpdateAction action = ADUCITF_UpdateAction_Undefined;
-    if (json_object_dothas_value(o, WORKFLOW_PROPERTY_FIELD_WORKFLOW_DOT_ACTION))
+bool workflow_is_download_deferred(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    return wf != NULL && wf->DownloadDeferred;
+}
+
+void workflow_set_resolved_files_count(ADUC_WorkflowHandle handle, size_t count)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf != NULL)
     {
-        action = (ADUCITF_UpdateAction)json_object_dotget_number(o, WORKFLOW_PROPERTY_FIELD_WORKFLOW_DOT_ACTION);
+        __atomic_store_n(&wf->ResolvedFilesCount, count, __ATOMIC_RELEASE);
     }
-
-    return action;
 }
 
-// Public functions - always return a copy of value.
-size_t workflow_get_update_files_count(ADUC_WorkflowHandle handle)
+size_t workflow_get_resolved_files_count(ADUC_WorkflowHandle handle)
 {
-    const JSON_Object* files = _workflow_get_update_manifest_files_map(handle);
-    return files == NULL ? 0 : json_object_get_count(files);
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    return wf == NULL ? 0 : __atomic_load_n(&wf->ResolvedFilesCount, __ATOMIC_ACQUIRE);
 }
 
-bool workflow_get_update_file(ADUC_WorkflowHandle handle, size_t index, ADUC_FileEntity** entity)
+bool workflow_set_sandbox(ADUC_WorkflowHandle handle, const char* sandbox)
 {
-    if (entity == NULL)
+    if (handle == NULL)
     {
         return false;
     }
 
-    size_t count = workflow_get_update_files_count(handle);
-    if (index >= count)
+    ADUC_WorkflowHandle root = workflow_get_root(handle);
+
+    if (!workflow_set_string_property(root, WORKFLOW_PROPERTY_FIELD_SANDBOX_ROOTPATH, sandbox))
     {
+        Log_Error("Cannot set sandbox root path.");
         return false;
     }
 
-    _Bool succeeded = false;
-    const JSON_Object* files = NULL;
-    const JSON_Object* file = NULL;
-    const JSON_Object* fileUrls = NULL;
-    *entity = NULL;
-    const char* uri = NULL;
-    const char* fileId = NULL;
-    const char* name = NULL;
-    const char* arguments = NULL;
+    return true;
+}
 
-    if ((files = _workflow_get_update_manifest_files_map(handle)) == NULL)
+// Workfolder =  [root.sandboxfolder]  "/"  ( [parent.workfolder | parent.id]  "/" )+  [handle.workfolder | handle.id]
+const char* workflow_peek_workfolder(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
     {
-        goto done;
+        return NULL;
     }
 
-    fileId = json_object_get_name(files, index);
-
-    if ((file = json_value_get_object(json_object_get_value_at(files, index))) == NULL)
+    // If workfolder explicitly specified, use it.
+    if (wf->WorkFolder != NULL)
     {
-        goto done;
+        return wf->WorkFolder;
     }
 
-    // Find fileurls map in this workflow, and its enclosing workflow(s).
-    ADUC_WorkflowHandle h = handle;
-
-    do
+    if (wf->WorkFolderCache == NULL)
     {
-        if ((fileUrls = _workflow_get_fileurls_map(h)) != NULL)
+        // ([parent's workfolder] or [default sandbox folder]) + "/" + [workflow id];
+        const char* parentWorkFolder = workflow_peek_workfolder(workflow_get_parent(handle));
+        if (parentWorkFolder == NULL)
         {
-            uri = json_object_get_string(fileUrls, fileId);
+            Log_Info("Sandbox root path not set. Use default: '%s'", DEFAULT_SANDBOX_ROOT_PATH);
+            parentWorkFolder = DEFAULT_SANDBOX_ROOT_PATH;
         }
-        h = workflow_get_parent(h);
-    } while (uri == NULL && h != NULL);
 
-    if (uri == NULL)
-    {
-        Log_Error("Cannot find URL for fileId '%s'", fileId);
+        const char* id = workflow_peek_id(handle);
+        wf->WorkFolderCache = ADUC_StringFormat("%s/%s", parentWorkFolder, id == NULL ? "(null)" : id);
     }
 
-    name = json_object_get_string(file, ADUCITF_FIELDNAME_FILENAME);
-    arguments = json_object_get_string(file, ADUCITF_FIELDNAME_ARGUMENTS);
+    return wf->WorkFolderCache;
+}
 
-    const JSON_Object* hashObj = json_object_get_object(file, ADUCITF_FIELDNAME_HASHES);
+char* workflow_get_workfolder(ADUC_WorkflowHandle handle)
+{
+    return workflow_copy_string(workflow_peek_workfolder(handle));
+}
 
-    size_t tempHashCount = 0;
-    ADUC_Hash* tempHash = ADUC_HashArray_AllocAndInit(hashObj, &tempHashCount);
-    if (tempHash == NULL)
+/**
+ * @brief Get 'updateManifest.files' map.
+ *
+ * @param handle A workflow object handle.
+ * @return const JSON_Object* A map containing update files information.
+ */
+const JSON_Object* _workflow_get_update_manifest_files_map(ADUC_WorkflowHandle handle)
+{
+    const JSON_Object* o = _workflow_get_update_manifest(handle);
+    return json_object_dotget_object(o, "files");
+}
+
+/**
+ * @brief Get 'updateManifest.bundledUpdates' array.
+ *
+ * @param handle A workflow object handle.
+ * @return const JSON_Object* A map containing bundle update manifest files information.
+ */
+JSON_Array* _workflow_get_update_manifest_bundle_updates_map(ADUC_WorkflowHandle handle)
+{
+    const JSON_Object* o = _workflow_get_update_manifest(handle);
+    return json_object_get_array(o, "bundledUpdates");
+}
+
+/**
+ * @brief Get 'fileUrls' map.
+ *
+ * @param handle A workflow object handle.
+ * @return const JSON_Object* A json object (map) containing update files information.
+ */
+const JSON_Object* _workflow_get_fileurls_map(ADUC_WorkflowHandle handle)
+{
+    const JSON_Object* o = _workflow_get_updateaction(handle);
+    return o == NULL ? NULL : json_object_dotget_object(o, "fileUrls");
+}
+
+/**
+ * @brief Return an update id of this workflow.
+ * This id should be reported to the cloud once the update installed successfully.
+ *
+ * @param handle A workflow object handle.
+ * @param[out] updateId A pointer to the output ADUC_UpdateId struct.
+ *                      Must call 'workflow_free_update_id' function to free the memory when done.
+ *
+ * @return ADUC_Result Return ADUC_GeneralResult_Success if success. Otherwise, return ADUC_GeneralResult_Failure with extendedResultCode.
+ */
+ADUC_Result workflow_get_expected_update_id(ADUC_WorkflowHandle handle, ADUC_UpdateId** updateId)
+{
+    ADUC_Result result = { ADUC_GeneralResult_Failure };
+
+    // Use the already parsed Update Manifest, rather than parsing the Update Action's one again.
+    const JSON_Object* manifest = _workflow_get_update_manifest(handle);
+    const char* provider = json_object_dotget_string(manifest, "updateId.provider");
+    const char* name = json_object_dotget_string(manifest, "updateId.name");
+    const char* version = json_object_dotget_string(manifest, "updateId.version");
+
+    *updateId = NULL;
+
+    if (provider == NULL || name == NULL || version == NULL)
     {
-        Log_Error("Unable to parse hashes for file @ %zu", index);
-        goto done;
+        Log_Error("Invalid json. Missing required UpdateID fields");
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_INVALID_UPDATE_ID;
+        return result;
     }
 
-    size_t sizeInBytes = 0;
-    if (json_object_has_value(file, ADUCITF_FIELDNAME_SIZEINBYTES))
+    *updateId = ADUC_UpdateId_AllocAndInit(provider, name, version);
+    if (*updateId == NULL)
     {
-        sizeInBytes = json_object_get_number(file, ADUCITF_FIELDNAME_SIZEINBYTES);
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_INVALID_UPDATE_ID;
     }
-
-    *entity = malloc(sizeof(**entity));
-    if (*entity == NULL)
+    else
     {
-        goto done;
+        result.ResultCode = ADUC_GeneralResult_Success;
     }
+    return result;
+}
 
-    if (!ADUC_FileEntity_Init(*entity, fileId, name, uri, arguments, tempHash, tempHashCount, sizeInBytes))
+/**
+ * @brief Return an update id of this workflow.
+ * This id should be reported to the cloud once the update installed successfully.
+ *
+ * @param handle A workflow object handle.
+ *
+ * @return char* Expected update id string.
+ *         Caller must call 'workflow_free_string' function to free the memory when done.
+ */
+char* workflow_get_expected_update_id_string(ADUC_WorkflowHandle handle)
+{
+    const JSON_Object* manifest = _workflow_get_update_manifest(handle);
+    const char* provider = json_object_dotget_string(manifest, "updateId.provider");
+    const char* name = json_object_dotget_string(manifest, "updateId.name");
+    const char* version = json_object_dotget_string(manifest, "updateId.version");
+    char* id = NULL;
+
+    if (provider == NULL || name == NULL || version == NULL)
     {
-        Log_Error("Invalid file entity arguments");
         goto done;
     }
 
-    succeeded = true;
+    id = ADUC_StringFormat("{\"provider\":\"%s\",\"name\":\"%s\",\"version\":\"%s\"}", provider, name, version);
 
 done:
+    return id;
+}
 
-    if (!succeeded)
-    {
-        if (*entity != NULL)
-        {
-            ADUC_FileEntity_Uninit(*entity);
-            free(*entity);
-            *entity = NULL;
-        }
-    }
-
-    return succeeded;
+void workflow_free_update_id(ADUC_UpdateId* updateId)
+{
+    ADUC_UpdateId_UninitAndFree(updateId);
 }
 
-bool workflow_get_first_update_file_of_type(ADUC_WorkflowHandle handle, const char* fileType, ADUC_FileEntity** entity)
+/**
+ * @brief Get installed-criteria string from this workflow, without copying it.
+ * @param handle A workflow object handle.
+ * @return Returns installed-criteria string. Caller must not free it.
+ */
+const char* workflow_peek_installed_criteria(ADUC_WorkflowHandle handle)
 {
-    if (entity == NULL)
+    // For Update Manifest V4, customer can specify installedCriteria in 'handlerProperties' map.
+    if (workflow_get_update_manifest_version(handle) >= EMBEDDED_AND_DOWNLOADABLE_UPDATE_MANIFEST_VERSION)
     {
-        return false;
+        return workflow_peek_update_manifest_handler_properties_string(handle, ADUCITF_FIELDNAME_INSTALLEDCRITERIA);
     }
 
-    _Bool succeeded = false;
-    const JSON_Object* files = NULL;
-    const JSON_Object* file = NULL;
-    const JSON_Object* fileUrls = NULL;
-    *entity = NULL;
-    const char* uri = NULL;
-    const char* fileId = NULL;
-    const char* name = NULL;
-    const char* arguments = NULL;
+    return workflow_peek_update_manifest_string(handle, ADUCITF_FIELDNAME_INSTALLEDCRITERIA);
+}
 
-    if ((files = _workflow_get_update_manifest_files_map(handle)) == NULL)
+/**
+ * @brief Get installed-criteria string from this workflow.
+ * @param handle A workflow object handle.
+ * @return Returns installed-criteria string.
+ *         Caller must call 'workflow_free_string' function to free the memory when done.
+ */
+char* workflow_get_installed_criteria(ADUC_WorkflowHandle handle)
+{
+    return workflow_copy_string(workflow_peek_installed_criteria(handle));
+}
+
+/**
+ * @brief Get the Update Manifest 'compatibility' array, in serialized json string format.
+ *
+ * @param handle A workflow handle.
+ * @return char* If success, returns a serialized json string. Otherwise, returns NULL.
+ *         Caller must call 'workflow_free_string' function to free the memory when done.
+ */
+char* workflow_get_compatibility(ADUC_WorkflowHandle handle)
+{
+    const JSON_Object* manifestObject = _workflow_get_update_manifest(handle);
+    if (manifestObject == NULL)
     {
-        goto done;
+        return NULL;
     }
 
-    size_t count = json_object_get_count(files);
-    size_t index;
-    for (index = 0; index < count; index++)
+    JSON_Value* compats = json_object_get_value(manifestObject, "compatibility");
+    if (compats == NULL)
     {
-        file = json_object(json_object_get_value_at(files, index));
-        const char* t = json_object_get_string(file, "fileType");
-        if (t != NULL && strcmp(t, fileType) == 0)
-        {
-            fileId = json_object_get_name(files, index);
-            break;
-        }
-        file = NULL;
+        return NULL;
     }
 
-    // No file with matching 'fileType'?
-    if (file == NULL)
-    {
-        goto done;
-    }
+    // Copied, since parson strings must be freed with json_free_serialized_string rather than workflow_free_string.
+    char* serialized = json_serialize_to_string(compats);
+    char* compatibility = serialized != NULL ? workflow_copy_string(serialized) : NULL;
+    json_free_serialized_string(serialized);
 
-    // Find fileurls map in this workflow, and its enclosing workflow(s).
-    ADUC_WorkflowHandle h = handle;
+    return compatibility;
+}
 
-    do
+void workflow_set_operation_in_progress(ADUC_WorkflowHandle handle, bool inProgress)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
     {
-        if ((fileUrls = _workflow_get_fileurls_map(h)) == NULL)
-        {
-            Log_Warn("'fileUrls' property not found.");
-        }
-        else
-        {
-            uri = json_object_get_string(fileUrls, fileId);
-        }
-        h = workflow_get_parent(h);
-    } while (uri == NULL && h != NULL);
+        Log_Warn("Setting 'OperationInProgress' when there's no active workflow. (value:%d)", inProgress);
+        return;
+    }
 
-    name = json_object_get_string(file, ADUCITF_FIELDNAME_FILENAME);
-    arguments = json_object_get_string(file, ADUCITF_FIELDNAME_ARGUMENTS);
+    wf->OperationInProgress = inProgress;
+}
 
-    const JSON_Object* hashObj = json_object_get_object(file, ADUCITF_FIELDNAME_HASHES);
+bool workflow_get_operation_in_progress(ADUC_WorkflowHandle handle)
+{
+    bool result = false;
 
-    size_t tempHashCount = 0;
-    ADUC_Hash* tempHash = ADUC_HashArray_AllocAndInit(hashObj, &tempHashCount);
-    if (tempHash == NULL)
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+
+    if (wf != NULL)
     {
-        Log_Error("Unable to parse hashes for file @ %zu", index);
-        goto done;
+        result = wf->OperationInProgress;
     }
 
-    size_t sizeInBytes = 0;
-    if (json_object_has_value(file, ADUCITF_FIELDNAME_SIZEINBYTES))
+    return result;
+}
+
+/**
+ * @brief Gets the cancellation token of the root workflow of @p wf, creating it on first use.
+ *
+ * @param wf The workflow.
+ * @return ADUC_CancellationToken* The token, or NULL if @p wf is NULL or out of memory.
+ */
+static ADUC_CancellationToken* workflow_get_cancellation_token(ADUC_Workflow* wf)
+{
+    if (wf == NULL)
     {
-        sizeInBytes = json_object_get_number(file, ADUCITF_FIELDNAME_SIZEINBYTES);
+        return NULL;
     }
 
-    *entity = malloc(sizeof(**entity));
-    if (*entity == NULL)
+    while (wf->Parent != NULL)
     {
-        goto done;
+        wf = wf->Parent;
     }
 
-    if (!ADUC_FileEntity_Init(*entity, fileId, name, uri, arguments, tempHash, tempHashCount, sizeInBytes))
+    ADUC_CancellationToken* token = __atomic_load_n(&wf->CancellationToken, __ATOMIC_ACQUIRE);
+    if (token != NULL)
     {
-        Log_Error("Invalid file entity arguments");
-        goto done;
+        return token;
     }
 
-    succeeded = true;
+    // The agent thread cancels it while handlers peek it; the first token set wins.
+    ADUC_CancellationToken* newToken = ADUC_CancellationToken_Create();
+    if (newToken == NULL)
+    {
+        Log_Error("Cannot create the workflow cancellation token.");
+        return NULL;
+    }
 
-done:
+    if (!__atomic_compare_exchange_n(
+            &wf->CancellationToken, &token, newToken, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        ADUC_CancellationToken_Destroy(newToken);
+        return token;
+    }
 
-    if (!succeeded)
+    if (__atomic_load_n(&wf->OperationCancelled, __ATOMIC_RELAXED))
     {
-        if (*entity != NULL)
-        {
-            ADUC_FileEntity_Uninit(*entity);
-            free(*entity);
-            *entity = NULL;
-        }
+        ADUC_CancellationToken_Cancel(newToken);
     }
 
-    return succeeded;
+    return newToken;
 }
 
 /**
- * @brief Get total count of Components Update files in the Bundle Update.
+ * @brief Sets OperationCancelled of @p wf, and cancels or resets the cancellation token of its root accordingly.
  *
- * @param handle A workflow object handle.
- * @return Total count of components update files.
+ * @param wf The workflow.
+ * @param cancel Whether the operation is cancelled.
  */
-size_t workflow_get_bundle_updates_count(ADUC_WorkflowHandle handle)
+static void workflow_set_operation_cancelled(ADUC_Workflow* wf, bool cancel)
 {
-    JSON_Array* files = _workflow_get_update_manifest_bundle_updates_map(handle);
-    return json_array_get_count(files);
+    // Worker threads poll it while the operation is in progress.
+    __atomic_store_n(&wf->OperationCancelled, cancel, __ATOMIC_RELAXED);
+
+    if (cancel)
+    {
+        ADUC_CancellationToken_Cancel(workflow_get_cancellation_token(wf));
+    }
+    else
+    {
+        ADUC_Workflow* root = wf;
+        while (root->Parent != NULL)
+        {
+            root = root->Parent;
+        }
+
+        // Not created if nothing observed it yet.
+        ADUC_CancellationToken_Reset(__atomic_load_n(&root->CancellationToken, __ATOMIC_ACQUIRE));
+        __atomic_store_n(&root->OperationTimedOut, false, __ATOMIC_RELAXED);
+    }
 }
 
-/**
- * @brief Get a 'bundleFiles' entity at specified @p index.
- *
- * @param handle A workflow object handle.
- * @param index  File entity index.
- * @param entity Output file entity object.
- * @return True if success.
- */
-bool workflow_get_bundle_updates_file(ADUC_WorkflowHandle handle, size_t index, ADUC_FileEntity** entity)
+ADUC_CancellationToken* workflow_peek_cancellation_token(ADUC_WorkflowHandle handle)
 {
-    if (entity == NULL)
+    return workflow_get_cancellation_token(workflow_from_handle(handle));
+}
+
+void workflow_set_operation_cancel_requested(ADUC_WorkflowHandle handle, bool cancel)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
     {
-        return false;
+        Log_Warn("Setting 'OperationCancelled' when there's no active workflow. (value:%d)", cancel);
+        return;
     }
 
-    size_t count = workflow_get_bundle_updates_count(handle);
-    if (index >= count)
+    workflow_set_operation_cancelled(wf, cancel);
+}
+
+bool workflow_get_operation_cancel_requested(ADUC_WorkflowHandle handle)
+{
+    bool result = false;
+
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+
+    if (wf != NULL)
     {
-        return false;
+        result = __atomic_load_n(&wf->OperationCancelled, __ATOMIC_RELAXED);
     }
 
-    _Bool succeeded = false;
-    const JSON_Array* files = NULL;
-    const JSON_Object* file = NULL;
-    const JSON_Object* fileUrls = NULL;
-    *entity = NULL;
-    const char* uri = NULL;
-    const char* fileId = NULL;
-    const char* name = NULL;
-    const char* arguments = NULL;
+    return result;
+}
 
-    if ((files = _workflow_get_update_manifest_bundle_updates_map(handle)) == NULL)
+/**
+ * @brief sets both operation in progress and cancel requested to false
+ * @param handle The workflow handle
+ */
+void workflow_clear_inprogress_and_cancelrequested(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
     {
-        goto done;
+        Log_Warn("clearing when no active workflow.");
+        return;
     }
 
-    file = json_array_get_object(files, index);
-    fileId = json_object_get_string(file, "fileId");
+    wf->OperationInProgress = false;
+    workflow_set_operation_cancelled(wf, false);
+    workflow_set_operation_deadline(handle, 0);
+    workflow_set_step_deadline(handle, 0);
+}
 
-    // Find fileurls map in this workflow, and its enclosing workflow(s).
-    ADUC_WorkflowHandle h = handle;
+/**
+ * @brief Gets the handlerProperties field of the timeout of @p step, or NULL if the step has no timeout.
+ */
+static const char* workflow_get_operation_timeout_property(ADUCITF_WorkflowStep step)
+{
+    switch (step)
+    {
+    case ADUCITF_WorkflowStep_Download:
+        return "downloadTimeoutSeconds";
+    case ADUCITF_WorkflowStep_Install:
+        return "installTimeoutSeconds";
+    case ADUCITF_WorkflowStep_Apply:
+        return "applyTimeoutSeconds";
+    default:
+        return NULL;
+    }
+}
 
-    do
+void workflow_set_default_operation_timeout(ADUCITF_WorkflowStep step, unsigned int timeoutSeconds)
+{
+    if (workflow_get_operation_timeout_property(step) != NULL)
     {
-        if ((fileUrls = _workflow_get_fileurls_map(h)) == NULL)
-        {
-            Log_Warn("'fileUrls' property not found.");
-        }
-        else
-        {
-            uri = json_object_get_string(fileUrls, fileId);
-        }
-        h = workflow_get_parent(h);
-    } while (uri == NULL && h != NULL);
+        __atomic_store_n(&s_defaultOperationTimeoutSeconds[step], timeoutSeconds, __ATOMIC_RELAXED);
+    }
+}
 
-    name = json_object_get_string(file, ADUCITF_FIELDNAME_FILENAME);
-    arguments = json_object_get_string(file, ADUCITF_FIELDNAME_ARGUMENTS);
+unsigned int workflow_get_operation_timeout(ADUC_WorkflowHandle handle, ADUCITF_WorkflowStep step)
+{
+    const char* propertyName = workflow_get_operation_timeout_property(step);
+    if (propertyName == NULL)
+    {
+        return 0;
+    }
 
-    const JSON_Object* hashObj = json_object_get_object(file, ADUCITF_FIELDNAME_HASHES);
+    unsigned int timeoutSeconds = __atomic_load_n(&s_defaultOperationTimeoutSeconds[step], __ATOMIC_RELAXED);
 
-    size_t tempHashCount = 0;
-    ADUC_Hash* tempHash = ADUC_HashArray_AllocAndInit(hashObj, &tempHashCount);
-    if (tempHash == NULL)
+    const JSON_Object* properties =
+        json_object_get_object(_workflow_get_update_manifest(handle), STEP_PROPERTY_FIELD_HANDLER_PROPERTIES);
+    const JSON_Value* value = json_object_get_value(properties, propertyName);
+    if (json_value_get_type(value) == JSONNumber && json_value_get_number(value) >= 0
+        && json_value_get_number(value) <= UINT_MAX)
     {
-        Log_Error("Unable to parse hashes for file @ %zu", index);
-        goto done;
+        timeoutSeconds = (unsigned int)json_value_get_number(value);
     }
-
-    size_t sizeInBytes = 0;
-    if (json_object_has_value(file, ADUCITF_FIELDNAME_SIZEINBYTES))
+    else if (json_value_get_type(value) == JSONString && !atoui(json_value_get_string(value), &timeoutSeconds))
     {
-        sizeInBytes = json_object_get_number(file, ADUCITF_FIELDNAME_SIZEINBYTES);
+        Log_Warn("Ignoring invalid handlerProperties.%s '%s'.", propertyName, json_value_get_string(value));
     }
 
-    *entity = malloc(sizeof(**entity));
-    if (*entity == NULL)
+    return timeoutSeconds;
+}
+
+void workflow_set_operation_deadline(ADUC_WorkflowHandle handle, int64_t deadline)
+{
+    ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    if (root != NULL)
     {
-        goto done;
+        __atomic_store_n(&root->OperationDeadline, deadline, __ATOMIC_RELAXED);
     }
+}
 
-    if (!ADUC_FileEntity_Init(*entity, fileId, name, uri, arguments, tempHash, tempHashCount, sizeInBytes))
+void workflow_set_step_deadline(ADUC_WorkflowHandle handle, int64_t deadline)
+{
+    ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    if (root != NULL)
     {
-        Log_Error("Invalid file entity arguments");
-        goto done;
+        __atomic_store_n(&root->StepDeadline, deadline, __ATOMIC_RELAXED);
     }
+}
 
-    succeeded = true;
-
-done:
+bool workflow_check_operation_deadline(ADUC_WorkflowHandle handle, int64_t now)
+{
+    ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    if (root == NULL || !root->OperationInProgress || __atomic_load_n(&root->OperationTimedOut, __ATOMIC_RELAXED))
+    {
+        return false;
+    }
 
-    if (!succeeded)
+    const int64_t operationDeadline = __atomic_load_n(&root->OperationDeadline, __ATOMIC_RELAXED);
+    const int64_t stepDeadline = __atomic_load_n(&root->StepDeadline, __ATOMIC_RELAXED);
+    if ((operationDeadline == 0 || now < operationDeadline) && (stepDeadline == 0 || now < stepDeadline))
     {
-        if (*entity != NULL)
-        {
-            ADUC_FileEntity_Uninit(*entity);
-            free(*entity);
-            *entity = NULL;
-        }
+        return false;
     }
 
-    return succeeded;
+    __atomic_store_n(&root->OperationTimedOut, true, __ATOMIC_RELAXED);
+    workflow_set_operation_cancelled(root, true);
+    return true;
 }
 
-/**
- * @brief Uninitialize and free specified file entity object.
- *
- * @param entity A file entity object.
- */
-void workflow_free_file_entity(ADUC_FileEntity* entity)
+bool workflow_get_operation_timed_out(ADUC_WorkflowHandle handle)
 {
-    ADUC_FileEntity_Uninit(entity);
-    free(entity);
+    const ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    return root != NULL && __atomic_load_n(&root->OperationTimedOut, __ATOMIC_RELAXED);
 }
 
 /**
- * @brief Get an Update Manifest property (string) without copying the value.
- * Caller must not free the pointer.
+ * @brief Get an Update Action code.
  *
  * @param handle A workflow object handle.
- * @param[in] propertyName Name of the property to get.
- * @return const char* A reference to property value. Caller must not free this pointer.
+ * @return ADUCITF_UpdateAction Returns ADUCITF_UpdateAction_Undefined if not specified.
+ * Otherwise, returns ADUCITF_UpdateAction_*
+ * or ADUCITF_UpdateAction_Cancel.
  */
-const char* workflow_peek_update_manifest_string(ADUC_WorkflowHandle handle, const char* propertyName)
+ADUCITF_UpdateAction workflow_get_action(ADUC_WorkflowHandle handle)
 {
-    const JSON_Object* manifest = _workflow_get_update_manifest(handle);
-    const char* value = json_object_get_string(manifest, propertyName);
-    return value;
+    const JSON_Object* o = _workflow_get_updateaction(handle);
+    if (o == NULL)
+    {
+        return ADUCITF_UpdateAction_Undefined;
+    }
+
+    ADUCITF_UpdateAction action = ADUCITF_UpdateAction_Undefined;
+    if (json_object_dothas_value(o, WORKFLOW_PROPERTY_FIELD_WORKFLOW_DOT_ACTION))
+    {
+        action = (ADUCITF_UpdateAction)json_object_dotget_number(o, WORKFLOW_PROPERTY_FIELD_WORKFLOW_DOT_ACTION);
+    }
+
+    return action;
 }
 
-/**
- * @brief Get a property of type 'string' in the workflow update manifest.
- *
- * @param handle A workflow object handle.
- * @param propertyName The name of a property to get.
- * @return A copy of specified property. Caller must call workflow_free_string when done with the value.
- */
-char* workflow_get_update_manifest_string_property(ADUC_WorkflowHandle handle, const char* propertyName)
+// Public functions - always return a copy of value.
+size_t workflow_get_update_files_count(ADUC_WorkflowHandle handle)
 {
-    return workflow_copy_string(workflow_peek_update_manifest_string(handle, propertyName));
+    const JSON_Object* files = _workflow_get_update_manifest_files_map(handle);
+    return files == NULL ? 0 : json_object_get_count(files);
 }
 
 /**
- * @brief Get a 'Compatibility' entry of the workflow at a specified @p index.
+ * @brief Adds the mirrors of the download URI of @p entity and of its alternate URIs to its alternate URIs, see
+ * workflow_set_download_mirrors.
  *
- * @param handle A workflow object handle.
- * @param index Index of the compatibility set to.
- * @return A copy of compatibility entry. Caller must call workflow_free_string when done with the value.
+ * @param entity The initialized file entity, with the alternate URIs of the file.
+ * @param arena The arena @p entity was allocated from, or NULL if it was allocated with malloc.
+ * @return false if out of memory.
  */
-char* workflow_get_update_manifest_compatibility(ADUC_WorkflowHandle handle, size_t index)
+static bool workflow_add_mirror_uris(ADUC_FileEntity* entity, ADUC_Arena* arena)
 {
-    JSON_Array* array = _workflow_peek_update_manifest_array(handle, "compatibility");
-    JSON_Object* object = json_array_get_object(array, index);
-    char* output = NULL;
-    if (object != NULL)
+    bool succeeded = true;
+
+    pthread_mutex_lock(&s_downloadMirrorsMutex);
+
+    const JSON_Object* mirrors = json_value_get_object(s_downloadMirrors);
+    const size_t manifestUriCount = entity->AlternateUriCount;
+
+    for (size_t uriIndex = 0; uriIndex <= manifestUriCount && succeeded; ++uriIndex)
     {
-        char* s = json_serialize_to_string(json_object_get_wrapping_value(object));
-        output = workflow_copy_string(s);
-        json_free_serialized_string(s);
+        const char* uri = (uriIndex == 0) ? entity->DownloadUri : entity->AlternateUris[uriIndex - 1];
+
+        for (size_t index = 0; index < json_object_get_count(mirrors) && uri != NULL && succeeded; ++index)
+        {
+            const char* prefix = json_object_get_name(mirrors, index);
+            const size_t prefixLength = strlen(prefix);
+            const JSON_Array* mirrorPrefixes = json_value_get_array(json_object_get_value_at(mirrors, index));
+
+            if (prefixLength == 0 || strncmp(uri, prefix, prefixLength) != 0)
+            {
+                continue;
+            }
+
+            for (size_t mirrorIndex = 0; mirrorIndex < json_array_get_count(mirrorPrefixes) && succeeded; ++mirrorIndex)
+            {
+                const char* mirrorPrefix = json_array_get_string(mirrorPrefixes, mirrorIndex);
+                if (mirrorPrefix == NULL)
+                {
+                    continue;
+                }
+
+                STRING_HANDLE mirrorUri = STRING_construct(mirrorPrefix);
+                succeeded = mirrorUri != NULL && STRING_concat(mirrorUri, uri + prefixLength) == 0;
+                if (succeeded)
+                {
+                    succeeded = arena == NULL
+                        ? ADUC_FileEntity_AddAlternateUri(entity, STRING_c_str(mirrorUri))
+                        : ADUC_FileEntity_AddAlternateUriInArena(entity, STRING_c_str(mirrorUri), arena);
+                }
+                STRING_delete(mirrorUri);
+            }
+        }
     }
 
-    return output;
+    pthread_mutex_unlock(&s_downloadMirrorsMutex);
+
+    return succeeded;
 }
 
 /**
- * @brief Get a string copy of the update type for the specified workflow.
+ * @brief Adds the alternate URIs of the file @p file in the update manifest to @p entity, then the mirrors of its
+ * download URI and of those URIs, see workflow_set_download_mirrors.
  *
- * @param handle A workflow object handle.
- * @return An UpdateType string. Caller owns it and must free with workflow_free_string.
+ * @param entity The initialized file entity, allocated with malloc.
+ * @param file The JSON object of the file in the update manifest.
+ * @return false if out of memory.
  */
-char* workflow_get_update_type(ADUC_WorkflowHandle handle)
+static bool workflow_init_alternate_uris(ADUC_FileEntity* entity, const JSON_Object* file)
 {
-    return workflow_get_update_manifest_string_property(handle, ADUCITF_FIELDNAME_UPDATETYPE);
+    return ADUC_FileEntity_InitAlternateUris(entity, file) && workflow_add_mirror_uris(entity, NULL);
 }
 
 /**
- * @brief Gets the update type of the specified workflow.
+ * @brief Initializes @p entity from the file at @p index in the update manifest of @p handle.
  *
  * @param handle A workflow object handle.
- * @return An UpdateType string. Caller does not own the string so must not free it.
+ * @param files The files map of the update manifest.
+ * @param index The index of the file.
+ * @param entity The file entity to initialize. Left zeroed on failure.
+ * @param arena The arena to allocate the members of @p entity from, or NULL to allocate them with malloc.
+ * @return true If succeeded.
  */
-const char* workflow_peek_update_type(ADUC_WorkflowHandle handle)
+static bool workflow_init_update_file(
+    ADUC_WorkflowHandle handle, const JSON_Object* files, size_t index, ADUC_FileEntity* entity, ADUC_Arena* arena)
 {
-    return workflow_peek_update_manifest_string(handle, ADUCITF_FIELDNAME_UPDATETYPE);
-}
+    const JSON_Object* file = NULL;
+    const JSON_Object* fileUrls = NULL;
+    const char* uri = NULL;
+    const char* fileId = NULL;
 
-ADUC_Result _workflow_init_helper(ADUC_WorkflowHandle* handle)
-{
-    ADUC_Result result = { ADUC_GeneralResult_Failure };
+    memset(entity, 0, sizeof(*entity));
 
-    ADUC_Workflow* wf = workflow_from_handle(*handle);
-    wf->Parent = NULL;
-    wf->ChildCount = 0;
-    wf->ChildrenMax = 0;
-    wf->Children = 0;
-    wf->PropertiesObject = json_value_get_object(json_value_init_object());
-    if (wf->PropertiesObject == NULL)
-    {
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_ERROR_NO_MEM;
-        goto done;
-    }
+    fileId = json_object_get_name(files, index);
 
-    wf->ResultsObject = json_value_get_object(json_value_init_object());
-    if (wf->ResultsObject == NULL)
+    if ((file = json_value_get_object(json_object_get_value_at(files, index))) == NULL)
     {
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_ERROR_NO_MEM;
-        goto done;
+        return false;
     }
 
-    wf->ResultDetails = STRING_new();
-    wf->InstalledUpdateId = STRING_new();
+    // Find fileurls map in this workflow, and its enclosing workflow(s).
+    ADUC_WorkflowHandle h = handle;
 
-    result.ResultCode = ADUC_GeneralResult_Success;
-    result.ExtendedResultCode = 0;
+    do
+    {
+        if ((fileUrls = _workflow_get_fileurls_map(h)) != NULL)
+        {
+            uri = json_object_get_string(fileUrls, fileId);
+        }
+        h = workflow_get_parent(h);
+    } while (uri == NULL && h != NULL);
 
-done:
+    if (uri == NULL)
+    {
+        Log_Error("Cannot find URL for fileId '%s'", fileId);
+    }
 
-    if (IsAducResultCodeFailure(result.ResultCode))
+    if (!ADUC_FileEntity_InitFromJson(entity, fileId, file, uri, arena))
     {
-        Log_Error(
-            "Failed to init workflow handle. result:%d (erc:0x%X)", result.ResultCode, result.ExtendedResultCode);
-        if (handle != NULL)
+        Log_Error("Unable to parse file @ %zu", index);
+        return false;
+    }
+
+    if (!workflow_add_mirror_uris(entity, arena))
+    {
+        if (arena == NULL)
         {
-            workflow_free(*handle);
-            *handle = NULL;
+            ADUC_FileEntity_Uninit(entity);
         }
+        memset(entity, 0, sizeof(*entity));
+        return false;
     }
 
-    return result;
+    return true;
 }
 
-ADUC_Result workflow_init_from_file(const char* updateManifestFile, bool validateManifest, ADUC_WorkflowHandle* handle)
+bool workflow_get_update_file(ADUC_WorkflowHandle handle, size_t index, ADUC_FileEntity** entity)
 {
-    ADUC_Result result = { ADUC_GeneralResult_Failure };
-    if (updateManifestFile == NULL || handle == NULL)
+    if (entity == NULL)
     {
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_ERROR_BAD_PARAM;
-        goto done;
+        return false;
     }
 
-    result = _workflow_parse(true, updateManifestFile, validateManifest, handle);
+    *entity = NULL;
 
-    if (IsAducResultCodeFailure(result.ResultCode))
+    const JSON_Object* files = _workflow_get_update_manifest_files_map(handle);
+    if (files == NULL || index >= json_object_get_count(files))
     {
-        goto done;
+        return false;
     }
 
-    result = _workflow_init_helper(handle);
-
-done:
+    *entity = malloc(sizeof(**entity));
+    if (*entity == NULL)
+    {
+        return false;
+    }
 
-    if (IsAducResultCodeFailure(result.ResultCode))
+    if (!workflow_init_update_file(handle, files, index, *entity, NULL))
     {
-        Log_Error(
-            "Failed to init workflow handle. result:%d (erc:0x%X)", result.ResultCode, result.ExtendedResultCode);
-        if (handle != NULL)
-        {
-            workflow_free(*handle);
-            *handle = NULL;
-        }
+        free(*entity);
+        *entity = NULL;
+        return false;
     }
 
-    return result;
+    return true;
 }
 
 /**
- * @brief Get 'updateManifest.instructions.steps' array.
+ * @brief Gets the arena of the root workflow of @p handle, creating it on first use.
  *
  * @param handle A workflow object handle.
- * @return const JSON_Object* Array containing update instrutions steps.
+ * @return ADUC_Arena* The arena, or NULL if @p handle is NULL or out of memory.
  */
-static JSON_Array* workflow_get_instructions_steps_array(ADUC_WorkflowHandle handle)
+static ADUC_Arena* workflow_get_arena(ADUC_WorkflowHandle handle)
 {
-    const JSON_Object* o = _workflow_get_update_manifest(handle);
-    return json_object_dotget_array(o, WORKFLOW_PROPERTY_FIELD_INSTRUCTIONS_DOT_STEPS);
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        return NULL;
+    }
+
+    while (wf->Parent != NULL)
+    {
+        wf = wf->Parent;
+    }
+
+    ADUC_Arena* arena = __atomic_load_n(&wf->Arena, __ATOMIC_ACQUIRE);
+    if (arena != NULL)
+    {
+        return arena;
+    }
+
+    // Handlers may allocate from several threads; the first arena set wins.
+    ADUC_Arena* newArena = ADUC_Arena_Create();
+    if (newArena == NULL)
+    {
+        Log_Error("Cannot create the workflow arena.");
+        return NULL;
+    }
+
+    if (!__atomic_compare_exchange_n(&wf->Arena, &arena, newArena, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        ADUC_Arena_Destroy(newArena);
+        return arena;
+    }
+
+    return newArena;
 }
 
 /**
- * @brief Create a new workflow data handler using specified step data from base workflow.
- * Note: The 'workfolder' of the returned workflow data object will be the same as the base's.
- *
- * Example step data:
- *
- * {
- *   "handler": "microsoft/script:1",
- *   "files": [
- *     "f81347aeb04c14ebf"
- *   ],
- *   "handlerProperties": {
- *     "arguments": "--pre"
- *   }
- * }
+ * @brief Drops the file tables of @p wf and of its descendants, whose file URLs may come from its update action.
  *
- * @param base The base workflow containing valid Update Action and Manifest.
- * @param stepIndex A step index.
- * @param handle An output workflow handle.
- * @return ADUC_Result
+ * @param wf The workflow whose update action or update manifest changed.
  */
-ADUC_Result
-workflow_create_from_inline_step(const ADUC_WorkflowHandle base, int stepIndex, ADUC_WorkflowHandle* handle)
+static void workflow_invalidate_file_table(ADUC_Workflow* wf)
 {
-    ADUC_Result result = { ADUC_GeneralResult_Failure };
-    JSON_Status jsonStatus = JSONFailure;
-    JSON_Value* updateActionValue = NULL;
-    JSON_Value* updateManifestValue = NULL;
-    ADUC_Workflow* wf = NULL;
-    JSON_Array* steps = workflow_get_instructions_steps_array(base);
-    JSON_Value* stepValue = json_array_get_value(steps, stepIndex);
-
-    if (stepValue == NULL)
+    if (wf == NULL)
     {
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_INVALID_STEP_INDEX;
-        goto done;
+        return;
     }
 
-    *handle = NULL;
+    // The file table is released with the workflow arena.
+    wf->FileTable = NULL;
 
-    ADUC_Workflow* wfBase = workflow_from_handle(base);
+    for (size_t i = 0; i < wf->ChildCount; i++)
+    {
+        workflow_invalidate_file_table(wf->Children[i]);
+    }
+}
 
-    wf = malloc(sizeof(*wf));
+/**
+ * @brief Returns the file table of the workflow, parsing the files of its update manifest on the first call.
+ * The table and its entities are allocated from the workflow arena, and released by workflow_free.
+ *
+ * @param handle A workflow object handle.
+ * @return The file table, or NULL if the workflow has no update manifest or on out of memory.
+ */
+static const ADUC_WorkflowFileTable* workflow_get_file_table(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
     if (wf == NULL)
     {
-        result.ExtendedResultCode = ADUC_ERC_NOMEM;
-        goto done;
+        return NULL;
     }
 
-    memset(wf, 0, sizeof(*wf));
-
-    updateActionValue = json_value_deep_copy(json_object_get_wrapping_value(wfBase->UpdateActionObject));
-    if (updateActionValue == NULL)
+    ADUC_WorkflowFileTable* table = __atomic_load_n(&wf->FileTable, __ATOMIC_ACQUIRE);
+    if (table != NULL)
     {
-        Log_Error("Cannot copy Update Action json from base");
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_FROM_BASE_FAILURE;
-        goto done;
+        return table;
     }
 
-    JSON_Object* updateActionObject = json_object(updateActionValue);
-
-    updateManifestValue = json_value_deep_copy(json_object_get_wrapping_value(wfBase->UpdateManifestObject));
-    if (updateManifestValue == NULL)
+    const JSON_Object* files = _workflow_get_update_manifest_files_map(handle);
+    if (files == NULL)
     {
-        Log_Error("Cannot copy Update Manifest json from base");
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_FROM_BASE_FAILURE;
-        goto done;
+        return NULL;
     }
 
-    JSON_Object* updateManifestObject = json_object(updateManifestValue);
-    JSON_Object* stepObject = json_object(stepValue);
-
-    char* currentStepData = json_serialize_to_string_pretty(stepValue);
-    Log_Debug("Processing current step:\n%s", currentStepData);
-    json_free_serialized_string(currentStepData);
-
-    // Replace 'updateType' with step's handler type.
-    const char* updateType = json_object_get_string(stepObject, STEP_PROPERTY_FIELD_HANDLER);
-    if (updateType == NULL || *updateType == 0)
+    ADUC_Arena* arena = workflow_get_arena(handle);
+    if (arena == NULL)
     {
-        Log_Error("Invalid step entry.");
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_PARSE_STEP_ENTRY_NO_HANDLER_TYPE;
-        goto done;
+        return NULL;
     }
-    jsonStatus = json_object_set_string(updateManifestObject, ADUCITF_FIELDNAME_UPDATETYPE, updateType);
-    if (jsonStatus == JSONFailure)
+
+    // The entities follow the table in the same block.
+    const size_t count = json_object_get_count(files);
+    ADUC_WorkflowFileTable* newTable = ADUC_Arena_Alloc(arena, sizeof(*newTable) + count * sizeof(ADUC_FileEntity));
+    if (newTable == NULL)
     {
-        Log_Error("Cannot update step entry updateType.");
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_SET_UPDATE_TYPE_FAILURE;
-        goto done;
+        Log_Error("Cannot allocate the file table of %zu file(s).", count);
+        return NULL;
     }
 
-    // Copy 'handlerProperties'.
-    JSON_Value* handlerProperties =
-        json_value_deep_copy(json_object_get_value(stepObject, STEP_PROPERTY_FIELD_HANDLER_PROPERTIES));
-    jsonStatus =
-        json_object_set_value(updateManifestObject, STEP_PROPERTY_FIELD_HANDLER_PROPERTIES, handlerProperties);
-    if (jsonStatus == JSONFailure)
+    newTable->Count = count;
+    newTable->Entities = (ADUC_FileEntity*)(newTable + 1);
+    for (size_t i = 0; i < count; i++)
     {
-        json_value_free(handlerProperties);
-        handlerProperties = NULL;
-        Log_Error("Cannot copy 'handlerProperties'.");
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_COPY_HANDLER_PROPERTIES_FAILED;
-        goto done;
+        workflow_init_update_file(handle, files, i, &newTable->Entities[i], arena);
     }
 
-    // Keep only file needed by this step entry. Remove the rest.
-    JSON_Array* stepFiles = json_object_get_array(stepObject, ADUCITF_FIELDNAME_FILES);
-    JSON_Object* baseFiles = json_object_get_object(updateManifestObject, ADUCITF_FIELDNAME_FILES);
-    int fileCount = json_object_get_count(baseFiles);
-    for (int b = fileCount - 1; b >= 0; b--)
+    // Handlers may peek from several threads; the first table set wins, the others stay in the arena.
+    if (!__atomic_compare_exchange_n(&wf->FileTable, &table, newTable, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
     {
-        const char* baseFileId = json_object_get_name(baseFiles, b);
+        return table;
+    }
 
-        // If file is in the instruction, merge their properties.
-        bool fileRequired = false;
-        int stepFilesCount = json_array_get_count(stepFiles);
-        for (int i = stepFilesCount - 1; i >= 0; i--)
-        {
-            // Note: step's files is an array of file ids.
-            const char* stepFileId = json_array_get_string(stepFiles, i);
+    return newTable;
+}
 
-            if (baseFileId != NULL && stepFileId != NULL && strcmp(baseFileId, stepFileId) == 0)
-            {
-                // Found.
-                fileRequired = true;
+const ADUC_FileEntity* workflow_peek_update_file(ADUC_WorkflowHandle handle, size_t index)
+{
+    const ADUC_WorkflowFileTable* table = workflow_get_file_table(handle);
+    if (table == NULL || index >= table->Count || table->Entities[index].FileId == NULL)
+    {
+        return NULL;
+    }
 
-                // Done with this file, remove it (and free).
-                json_array_remove(stepFiles, i);
-                break;
-            }
-        }
+    return &table->Entities[index];
+}
 
-        // Remove file from base files list, if no longer needed.
-        if (!fileRequired)
-        {
-            json_object_remove(baseFiles, json_object_get_name(baseFiles, b));
-        }
+bool workflow_get_first_update_file_of_type(ADUC_WorkflowHandle handle, const char* fileType, ADUC_FileEntity** entity)
+{
+    if (entity == NULL)
+    {
+        return false;
     }
 
-    // Remove 'instructions' list...
-    json_object_set_null(updateManifestObject, "instructions");
-
-    wf->UpdateActionObject = updateActionObject;
-    wf->UpdateManifestObject = updateManifestObject;
+    _Bool succeeded = false;
+    const JSON_Object* files = NULL;
+    const JSON_Object* file = NULL;
+    const JSON_Object* fileUrls = NULL;
+    *entity = NULL;
+    const char* uri = NULL;
+    const char* fileId = NULL;
+    const char* name = NULL;
+    const char* arguments = NULL;
 
+    if ((files = _workflow_get_update_manifest_files_map(handle)) == NULL)
     {
-        char* baseWorkfolder = workflow_get_workfolder(base);
-        workflow_set_workfolder(wf, baseWorkfolder);
-        workflow_free_string(baseWorkfolder);
+        goto done;
     }
 
-    *handle = wf;
-    result.ResultCode = ADUC_GeneralResult_Success;
-    result.ExtendedResultCode = 0;
-
-done:
-    if (IsAducResultCodeFailure(result.ResultCode))
+    size_t count = json_object_get_count(files);
+    size_t index;
+    for (index = 0; index < count; index++)
     {
-        json_value_free(updateActionValue);
-        json_value_free(updateManifestValue);
-        workflow_free(wf);
+        file = json_object(json_object_get_value_at(files, index));
+        const char* t = json_object_get_string(file, "fileType");
+        if (t != NULL && strcmp(t, fileType) == 0)
+        {
+            fileId = json_object_get_name(files, index);
+            break;
+        }
+        file = NULL;
     }
 
-    return result;
-}
+    // No file with matching 'fileType'?
+    if (file == NULL)
+    {
+        goto done;
+    }
 
-/**
- * @brief Transfer data from @p sourceHandle to @p targetHandle.
- * The sourceHandle will no longer contains transferred action data.
- * Caller should not use sourceHandle for other workflow related purposes.
- *
- * @param targetHandle The target workflow handle
- * @param sourceHandle The source workflow handle
- * @return true if transfer succeeded.
- */
-bool workflow_transfer_data(ADUC_WorkflowHandle targetHandle, ADUC_WorkflowHandle sourceHandle)
-{
-    ADUC_Workflow* wfTarget = workflow_from_handle(targetHandle);
-    ADUC_Workflow* wfSource = workflow_from_handle(sourceHandle);
+    // Find fileurls map in this workflow, and its enclosing workflow(s).
+    ADUC_WorkflowHandle h = handle;
 
-    if (wfSource == NULL || wfSource->UpdateActionObject == NULL)
+    do
     {
-        return false;
-    }
+        if ((fileUrls = _workflow_get_fileurls_map(h)) == NULL)
+        {
+            Log_Warn("'fileUrls' property not found.");
+        }
+        else
+        {
+            uri = json_object_get_string(fileUrls, fileId);
+        }
+        h = workflow_get_parent(h);
+    } while (uri == NULL && h != NULL);
 
-    // Transfer over the parsed JSON objects
-    wfTarget->UpdateActionObject = wfSource->UpdateActionObject;
-    wfSource->UpdateActionObject = NULL;
+    name = json_object_get_string(file, ADUCITF_FIELDNAME_FILENAME);
+    arguments = json_object_get_string(file, ADUCITF_FIELDNAME_ARGUMENTS);
 
-    wfTarget->UpdateManifestObject = wfSource->UpdateManifestObject;
-    wfSource->UpdateManifestObject = NULL;
+    const JSON_Object* hashObj = json_object_get_object(file, ADUCITF_FIELDNAME_HASHES);
 
-    wfTarget->PropertiesObject = wfSource->PropertiesObject;
-    wfSource->PropertiesObject = NULL;
+    size_t tempHashCount = 0;
+    ADUC_Hash* tempHash = ADUC_HashArray_AllocAndInit(hashObj, &tempHashCount);
+    if (tempHash == NULL)
+    {
+        Log_Error("Unable to parse hashes for file @ %zu", index);
+        goto done;
+    }
 
-    return true;
-}
+    size_t sizeInBytes = 0;
+    if (json_object_has_value(file, ADUCITF_FIELDNAME_SIZEINBYTES))
+    {
+        sizeInBytes = json_object_get_number(file, ADUCITF_FIELDNAME_SIZEINBYTES);
+    }
 
-/**
- * @brief Instantiate and initialize workflow object with info from the given jsonData.
- *
- * @param updateManifestJson A JSON string containing update manifest data.
- * @param validateManifest A boolean indicates whether to validate the update manifest.
- * @param handle An output workflow object handle.
- * @return ADUC_Result
- */
-ADUC_Result workflow_init(const char* updateManifestJson, bool validateManifest, ADUC_WorkflowHandle* handle)
-{
-    ADUC_Result result = { ADUC_GeneralResult_Failure };
-    if (updateManifestJson == NULL || handle == NULL)
+    *entity = malloc(sizeof(**entity));
+    if (*entity == NULL)
     {
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_ERROR_BAD_PARAM;
         goto done;
     }
 
-    memset(handle, 0, sizeof(*handle));
+    if (!ADUC_FileEntity_Init(*entity, fileId, name, uri, arguments, tempHash, tempHashCount, sizeInBytes))
+    {
+        Log_Error("Invalid file entity arguments");
+        goto done;
+    }
 
-    result = _workflow_parse(false, updateManifestJson, validateManifest, handle);
-    if (IsAducResultCodeFailure(result.ResultCode))
+    if (!ADUC_FileEntity_InitChunkHashes(*entity, file) || !ADUC_FileEntity_InitTransportEncoding(*entity, file)
+        || !workflow_init_alternate_uris(*entity, file))
     {
         goto done;
     }
 
-    result = _workflow_init_helper(handle);
+    succeeded = true;
 
 done:
 
-    if (IsAducResultCodeFailure(result.ResultCode))
+    if (!succeeded)
     {
-        Log_Error(
-            "Failed to init workflow handle. result:%d (erc:0x%X)", result.ResultCode, result.ExtendedResultCode);
-        if (handle != NULL)
+        if (*entity != NULL)
         {
-            workflow_free(*handle);
-            *handle = NULL;
+            ADUC_FileEntity_Uninit(*entity);
+            free(*entity);
+            *entity = NULL;
         }
     }
 
-    return result;
+    return succeeded;
 }
 
 /**
- * @brief gets the current workflow step.
+ * @brief Get total count of Components Update files in the Bundle Update.
  *
- * @param handle A workflow data object handle.
- * @return the workflow step.
+ * @param handle A workflow object handle.
+ * @return Total count of components update files.
  */
-ADUCITF_WorkflowStep workflow_get_current_workflowstep(ADUC_WorkflowHandle handle)
+size_t workflow_get_bundle_updates_count(ADUC_WorkflowHandle handle)
 {
-    ADUCITF_WorkflowStep step = ADUCITF_WorkflowStep_Undefined;
-
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf != NULL)
-    {
-        step = wf->CurrentWorkflowStep;
-    }
-
-    return step;
+    JSON_Array* files = _workflow_get_update_manifest_bundle_updates_map(handle);
+    return json_array_get_count(files);
 }
 
 /**
- * @brief sets the current workflow step.
+ * @brief Get a 'bundleFiles' entity at specified @p index.
  *
- * @param handle A workflow data object handle.
- * @param workflowStep The workflow step.
+ * @param handle A workflow object handle.
+ * @param index  File entity index.
+ * @param entity Output file entity object.
+ * @return True if success.
  */
-void workflow_set_current_workflowstep(ADUC_WorkflowHandle handle, ADUCITF_WorkflowStep workflowStep)
+bool workflow_get_bundle_updates_file(ADUC_WorkflowHandle handle, size_t index, ADUC_FileEntity** entity)
 {
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf != NULL)
+    if (entity == NULL)
     {
-        wf->CurrentWorkflowStep = workflowStep;
+        return false;
     }
-}
-
-/**
- * @brief Set workflow 'property._id'. This function creates a copy of the input id.
- *
- * @param handle A workflow object handle.
- * @param id A new id of the workflow.
- * @return Return true If succeeded.
- */
-bool workflow_set_id(ADUC_WorkflowHandle handle, const char* id)
-{
-    return _workflow_set_id(handle, id);
-}
 
-/**
- * @brief Get a read-only workflow id.
- *
- * @param handle A workflow object handle.
- * @return Return the workflow id.
- */
-const char* workflow_peek_id(ADUC_WorkflowHandle handle)
-{
-    if (handle == NULL)
+    size_t count = workflow_get_bundle_updates_count(handle);
+    if (index >= count)
     {
-        return NULL;
+        return false;
     }
 
-    // Return 'properties._id', if set.
-    const char* id = _workflow_get_properties_id(handle);
-    if (id == NULL)
+    _Bool succeeded = false;
+    const JSON_Array* files = NULL;
+    const JSON_Object* file = NULL;
+    const JSON_Object* fileUrls = NULL;
+    *entity = NULL;
+    const char* uri = NULL;
+    const char* fileId = NULL;
+    const char* name = NULL;
+    const char* arguments = NULL;
+
+    if ((files = _workflow_get_update_manifest_bundle_updates_map(handle)) == NULL)
     {
-        // Return 'workflow.id' from Action json data.
-        id = _workflow_peek_workflow_dot_id(handle);
+        goto done;
     }
 
-    return id;
-}
+    file = json_array_get_object(files, index);
+    fileId = json_object_get_string(file, "fileId");
 
-/**
- * @brief Get a workflow id.
- *
- * @param handle A workflow object handle.
- * @return const char* If success, returns pointer to workflow id string. Otherwise, returns NULL.
- * Caller must free the string by calling workflow_free_string() once done with the string.
- */
-char* workflow_get_id(ADUC_WorkflowHandle handle)
-{
-    return workflow_copy_string(workflow_peek_id(handle));
-}
+    // Find fileurls map in this workflow, and its enclosing workflow(s).
+    ADUC_WorkflowHandle h = handle;
 
-/**
- * @brief Explicit set workflow retryTimestamp for this workflow.
- *
- * @param handle A workflow data object handle.
- * @param retryTimestamp The retryTimestamp
- * @return Return true if succeeded.
- */
-bool workflow_set_retryTimestamp(ADUC_WorkflowHandle handle, const char* retryTimestamp)
-{
-    return _workflow_set_retryTimestamp(handle, retryTimestamp);
-}
+    do
+    {
+        if ((fileUrls = _workflow_get_fileurls_map(h)) == NULL)
+        {
+            Log_Warn("'fileUrls' property not found.");
+        }
+        else
+        {
+            uri = json_object_get_string(fileUrls, fileId);
+        }
+        h = workflow_get_parent(h);
+    } while (uri == NULL && h != NULL);
 
-/**
- * @brief Get a read-only workflow retryTimestamp.
- *
- * @param handle A workflow object handle.
- * @return Return the workflow retryTimestamp, if it was in json message.
- */
-const char* workflow_peek_retryTimestamp(ADUC_WorkflowHandle handle)
-{
-    if (handle == NULL)
+    name = json_object_get_string(file, ADUCITF_FIELDNAME_FILENAME);
+    arguments = json_object_get_string(file, ADUCITF_FIELDNAME_ARGUMENTS);
+
+    const JSON_Object* hashObj = json_object_get_object(file, ADUCITF_FIELDNAME_HASHES);
+
+    size_t tempHashCount = 0;
+    ADUC_Hash* tempHash = ADUC_HashArray_AllocAndInit(hashObj, &tempHashCount);
+    if (tempHash == NULL)
     {
-        return NULL;
+        Log_Error("Unable to parse hashes for file @ %zu", index);
+        goto done;
     }
 
-    // Return 'properties._retryTimestamp', if set.
-    const char* retryTimestamp = _workflow_get_properties_retryTimestamp(handle);
-    if (retryTimestamp == NULL)
+    size_t sizeInBytes = 0;
+    if (json_object_has_value(file, ADUCITF_FIELDNAME_SIZEINBYTES))
     {
-        // Return 'workflow.retryTimestamp' from Action json data,
-        // which could also be null or empty, as it's optional.
-        retryTimestamp = _workflow_peek_workflow_dot_retryTimestamp(handle);
+        sizeInBytes = json_object_get_number(file, ADUCITF_FIELDNAME_SIZEINBYTES);
     }
 
-    return retryTimestamp;
-}
+    *entity = malloc(sizeof(**entity));
+    if (*entity == NULL)
+    {
+        goto done;
+    }
 
-/**
- * @brief Free string buffer returned by workflow_get_* APIs.
- * @param string A string to free.
- */
-void workflow_free_string(char* string)
-{
-    free(string);
-}
+    if (!ADUC_FileEntity_Init(*entity, fileId, name, uri, arguments, tempHash, tempHashCount, sizeInBytes))
+    {
+        Log_Error("Invalid file entity arguments");
+        goto done;
+    }
 
-/**
- * @brief Free workflow content.
- *
- * @param handle A workflow object handle.
- */
-void workflow_uninit(ADUC_WorkflowHandle handle)
-{
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf != NULL)
+    if (!ADUC_FileEntity_InitChunkHashes(*entity, file) || !ADUC_FileEntity_InitTransportEncoding(*entity, file)
+        || !workflow_init_alternate_uris(*entity, file))
     {
-        STRING_delete(wf->ResultDetails);
-        wf->ResultDetails = NULL;
-        STRING_delete(wf->InstalledUpdateId);
-        wf->InstalledUpdateId = NULL;
+        goto done;
     }
 
-    _workflow_free_updateaction(handle);
-    _workflow_free_updatemanifest(handle);
-    _workflow_free_properties(handle);
-    _workflow_free_results_object(handle);
+    succeeded = true;
 
-    // This should have been transferred, but free it if it's still around.
-    if (wf != NULL && wf->DeferredReplacementWorkflow != NULL)
+done:
+
+    if (!succeeded)
     {
-        workflow_free(wf->DeferredReplacementWorkflow);
-        wf->DeferredReplacementWorkflow = NULL;
+        if (*entity != NULL)
+        {
+            ADUC_FileEntity_Uninit(*entity);
+            free(*entity);
+            *entity = NULL;
+        }
     }
+
+    return succeeded;
 }
 
 /**
- * @brief Free workflow content and free the workflow object.
+ * @brief Uninitialize and free specified file entity object.
  *
- * @param handle A workflow object handle.
+ * @param entity A file entity object.
  */
-void workflow_free(ADUC_WorkflowHandle handle)
+void workflow_free_file_entity(ADUC_FileEntity* entity)
 {
-    if (handle == NULL)
-    {
-        return;
-    }
-
-    // Remove existing child workflow handle(s)
-    while (workflow_get_children_count(handle) > 0)
-    {
-        ADUC_WorkflowHandle child = workflow_remove_child(handle, 0);
-        workflow_free(child);
-    }
-
-    workflow_uninit(handle);
-    free(handle);
+    ADUC_FileEntity_Uninit(entity);
+    free(entity);
 }
 
 /**
- * @brief Set workflow parent.
+ * @brief Get an Update Manifest property (string) without copying the value.
+ * Caller must not free the pointer.
  *
- * @param handle A child workflow object handle.
- * @param parent A parent workflow object handle.
+ * @param handle A workflow object handle.
+ * @param[in] propertyName Name of the property to get.
+ * @return const char* A reference to property value. Caller must not free this pointer.
  */
-void workflow_set_parent(ADUC_WorkflowHandle handle, ADUC_WorkflowHandle parent)
+const char* workflow_peek_update_manifest_string(ADUC_WorkflowHandle handle, const char* propertyName)
 {
-    if (handle == NULL)
-    {
-        return;
-    }
-
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    wf->Parent = workflow_from_handle(parent);
-    wf->Level = workflow_get_level(parent) + 1;
+    const JSON_Object* manifest = _workflow_get_update_manifest(handle);
+    const char* value = json_object_get_string(manifest, propertyName);
+    return value;
 }
 
 /**
- * @brief Get the root workflow object linked by the @p handle.
+ * @brief Get a property of type 'string' in the workflow update manifest.
  *
  * @param handle A workflow object handle.
- * @return ADUC_WorkflowHandle
+ * @param propertyName The name of a property to get.
+ * @return A copy of specified property. Caller must call workflow_free_string when done with the value.
  */
-ADUC_WorkflowHandle workflow_get_root(ADUC_WorkflowHandle handle)
+char* workflow_get_update_manifest_string_property(ADUC_WorkflowHandle handle, const char* propertyName)
 {
-    if (handle == NULL)
-    {
-        return NULL;
-    }
-
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    while (wf->Parent != NULL)
-    {
-        wf = wf->Parent;
-    }
-    return (ADUC_WorkflowHandle)wf;
+    return workflow_copy_string(workflow_peek_update_manifest_string(handle, propertyName));
 }
 
 /**
- * @brief Get the parent workflow object linked by the @p handle.
+ * @brief Get a 'Compatibility' entry of the workflow at a specified @p index.
  *
  * @param handle A workflow object handle.
- * @return ADUC_WorkflowHandle
+ * @param index Index of the compatibility set to.
+ * @return A copy of compatibility entry. Caller must call workflow_free_string when done with the value.
  */
-ADUC_WorkflowHandle workflow_get_parent(ADUC_WorkflowHandle handle)
+char* workflow_get_update_manifest_compatibility(ADUC_WorkflowHandle handle, size_t index)
 {
-    if (handle == NULL)
+    JSON_Array* array = _workflow_peek_update_manifest_array(handle, "compatibility");
+    JSON_Object* object = json_array_get_object(array, index);
+    char* output = NULL;
+    if (object != NULL)
     {
-        return NULL;
+        char* s = json_serialize_to_string(json_object_get_wrapping_value(object));
+        output = workflow_copy_string(s);
+        json_free_serialized_string(s);
     }
 
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    return (ADUC_WorkflowHandle)wf->Parent;
+    return output;
 }
 
 /**
- * @brief Get workflow's children count.
+ * @brief Get a string copy of the update type for the specified workflow.
  *
  * @param handle A workflow object handle.
- * @return Total child workflow count.
+ * @return An UpdateType string. Caller owns it and must free with workflow_free_string.
  */
-int workflow_get_children_count(ADUC_WorkflowHandle handle)
+char* workflow_get_update_type(ADUC_WorkflowHandle handle)
 {
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    return wf != NULL ? wf->ChildCount : 0;
+    return workflow_get_update_manifest_string_property(handle, ADUCITF_FIELDNAME_UPDATETYPE);
 }
 
 /**
- * @brief Get child workflow at specified @p index.
+ * @brief Gets the update type of the specified workflow.
  *
  * @param handle A workflow object handle.
- * @param index Index of a child workflow to get.
- * @return A child workflow object handle, or NULL if index out of range.
+ * @return An UpdateType string. Caller does not own the string so must not free it.
  */
-ADUC_WorkflowHandle workflow_get_child(ADUC_WorkflowHandle handle, int index)
+const char* workflow_peek_update_type(ADUC_WorkflowHandle handle)
 {
-    if (handle == NULL)
-    {
-        return NULL;
-    }
+    return workflow_peek_update_manifest_string(handle, ADUCITF_FIELDNAME_UPDATETYPE);
+}
 
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (index == -1)
+ADUC_Result _workflow_init_helper(ADUC_WorkflowHandle* handle)
+{
+    ADUC_Result result = { ADUC_GeneralResult_Failure };
+
+    ADUC_Workflow* wf = workflow_from_handle(*handle);
+    wf->Parent = NULL;
+    wf->ChildCount = 0;
+    wf->ChildrenMax = 0;
+    wf->Children = 0;
+    wf->PropertiesObject = json_value_get_object(json_value_init_object());
+    if (wf->PropertiesObject == NULL)
     {
-        index = wf->ChildCount - 1;
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_ERROR_NO_MEM;
+        goto done;
     }
 
-    if (index < 0 || index >= wf->ChildCount)
+    wf->ResultsObject = json_value_get_object(json_value_init_object());
+    if (wf->ResultsObject == NULL)
     {
-        return NULL;
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_ERROR_NO_MEM;
+        goto done;
     }
 
-    return handle_from_workflow(wf->Children[index]);
-}
+    wf->ResultDetails = STRING_new();
+    wf->InstalledUpdateId = STRING_new();
 
-// To append, pass index (-1).
-bool workflow_insert_child(ADUC_WorkflowHandle handle, int index, ADUC_WorkflowHandle childHandle)
-{
-    bool succeeded = false;
-    ADUC_Workflow* wf = workflow_from_handle(handle);
+    result.ResultCode = ADUC_GeneralResult_Success;
+    result.ExtendedResultCode = 0;
+
+done:
 
-    // Expand array if needed.
-    if (wf->ChildCount == wf->ChildrenMax)
+    if (IsAducResultCodeFailure(result.ResultCode))
     {
-        size_t newSize = wf->ChildrenMax + WORKFLOW_CHILDREN_BLOCK_SIZE;
-        ADUC_Workflow** newArray = malloc(newSize * sizeof(ADUC_Workflow*));
-        if (wf->Children != NULL)
+        Log_Error(
+            "Failed to init workflow handle. result:%d (erc:0x%X)", result.ResultCode, result.ExtendedResultCode);
+        if (handle != NULL)
         {
-            memcpy(newArray, wf->Children, wf->ChildrenMax * sizeof(ADUC_Workflow*));
-            free(wf->Children);
+            workflow_free(*handle);
+            *handle = NULL;
         }
-        wf->Children = newArray;
-        wf->ChildrenMax = newSize;
     }
 
-    if (index < 0 || index >= wf->ChildCount)
-    {
-        index = wf->ChildCount;
+    return result;
+}
+
+ADUC_Result workflow_init_from_file(const char* updateManifestFile, bool validateManifest, ADUC_WorkflowHandle* handle)
+{
+    ADUC_Result result = { ADUC_GeneralResult_Failure };
+    if (updateManifestFile == NULL || handle == NULL)
+    {
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_ERROR_BAD_PARAM;
+        goto done;
+    }
+
+    const size_t baselineBytes = ADUC_JSON_GetAllocatedBytes();
+
+    result = _workflow_parse(true, updateManifestFile, validateManifest, handle);
+
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        goto done;
+    }
+
+    result = _workflow_init_helper(handle);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        goto done;
+    }
+
+    workflow_from_handle(*handle)->JsonBaselineBytes = baselineBytes;
+
+    // A manifest too large for the budget fails here, before any content is downloaded.
+    result = workflow_check_memory_budget(*handle);
+
+done:
+
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        Log_Error(
+            "Failed to init workflow handle. result:%d (erc:0x%X)", result.ResultCode, result.ExtendedResultCode);
+        if (handle != NULL)
+        {
+            workflow_free(*handle);
+            *handle = NULL;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Get 'updateManifest.instructions.steps' array.
+ *
+ * @param handle A workflow object handle.
+ * @return const JSON_Object* Array containing update instrutions steps.
+ */
+static JSON_Array* workflow_get_instructions_steps_array(ADUC_WorkflowHandle handle)
+{
+    const JSON_Object* o = _workflow_get_update_manifest(handle);
+    return json_object_dotget_array(o, WORKFLOW_PROPERTY_FIELD_INSTRUCTIONS_DOT_STEPS);
+}
+
+/**
+ * @brief Returns a deep copy of @p source, without the fields named in @p excludedNames.
+ *
+ * @param source The object to copy.
+ * @param excludedNames The names of the fields to leave out.
+ * @param excludedCount The number of names in @p excludedNames.
+ * @return JSON_Value* The copy. Caller must free it with json_value_free(). NULL on failures.
+ */
+static JSON_Value*
+_json_object_copy_except(const JSON_Object* source, const char* const* excludedNames, size_t excludedCount)
+{
+    JSON_Value* copyValue = json_value_init_object();
+    JSON_Object* copy = json_object(copyValue);
+    size_t count = json_object_get_count(source);
+
+    if (source == NULL || copy == NULL)
+    {
+        goto failure;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const char* name = json_object_get_name(source, i);
+        bool excluded = false;
+
+        for (size_t e = 0; e < excludedCount && !excluded; e++)
+        {
+            excluded = strcmp(name, excludedNames[e]) == 0;
+        }
+
+        if (excluded)
+        {
+            continue;
+        }
+
+        JSON_Value* value = json_value_deep_copy(json_object_get_value_at(source, i));
+
+        // Not json_object_dotset_value, names may contain dots.
+        if (value == NULL || json_object_set_value(copy, name, value) != JSONSuccess)
+        {
+            json_value_free(value);
+            goto failure;
+        }
+    }
+
+    return copyValue;
+
+failure:
+    json_value_free(copyValue);
+    return NULL;
+}
+
+/**
+ * @brief The fields of an Update Action that a child workflow doesn't copy from its base.
+ * The serialized (and signed) Update Manifest is only parsed and validated for the base, and
+ * the child only copies the 'fileUrls' of its own files, see _workflow_copy_file_urls.
+ */
+static const char* const s_childExcludedUpdateActionFields[] = { ADUCITF_FIELDNAME_UPDATEMANIFEST,
+                                                                 ADUCITF_FIELDNAME_UPDATEMANIFESTSIGNATURE,
+                                                                 "fileUrls" };
+
+/**
+ * @brief Copies the 'fileUrls' of the @p files from the base's Update Action to the child's.
+ * Files whose url isn't in the base's own 'fileUrls' are still looked up through the child's parents.
+ *
+ * @param childUpdateAction The child's Update Action.
+ * @param base The base workflow.
+ * @param files The child's files.
+ * @return bool True on success.
+ */
+static bool
+_workflow_copy_file_urls(JSON_Object* childUpdateAction, ADUC_WorkflowHandle base, const JSON_Object* files)
+{
+    const JSON_Object* baseFileUrls = _workflow_get_fileurls_map(base);
+    size_t fileCount = json_object_get_count(files);
+
+    if (baseFileUrls == NULL)
+    {
+        return true;
+    }
+
+    JSON_Value* fileUrlsValue = json_value_init_object();
+    JSON_Object* fileUrls = json_object(fileUrlsValue);
+
+    if (fileUrls == NULL || json_object_set_value(childUpdateAction, "fileUrls", fileUrlsValue) != JSONSuccess)
+    {
+        json_value_free(fileUrlsValue);
+        return false;
+    }
+
+    for (size_t i = 0; i < fileCount; i++)
+    {
+        const char* fileId = json_object_get_name(files, i);
+        const char* url = json_object_get_string(baseFileUrls, fileId);
+
+        if (url != NULL && json_object_set_string(fileUrls, fileId, url) != JSONSuccess)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief The fields of an Update Manifest that a step workflow doesn't copy from its base:
+ * the step only needs its own files, and none of the steps.
+ */
+static const char* const s_stepExcludedUpdateManifestFields[] = { ADUCITF_FIELDNAME_FILES, "instructions" };
+
+/**
+ * @brief Create a new workflow data handler using specified step data from base workflow.
+ * Note: The 'workfolder' of the returned workflow data object will be the same as the base's.
+ *
+ * Example step data:
+ *
+ * {
+ *   "handler": "microsoft/script:1",
+ *   "files": [
+ *     "f81347aeb04c14ebf"
+ *   ],
+ *   "handlerProperties": {
+ *     "arguments": "--pre"
+ *   }
+ * }
+ *
+ * @param base The base workflow containing valid Update Action and Manifest.
+ * @param stepIndex A step index.
+ * @param handle An output workflow handle.
+ * @return ADUC_Result
+ */
+ADUC_Result
+workflow_create_from_inline_step(const ADUC_WorkflowHandle base, int stepIndex, ADUC_WorkflowHandle* handle)
+{
+    ADUC_Result result = { ADUC_GeneralResult_Failure };
+    JSON_Status jsonStatus = JSONFailure;
+    JSON_Value* updateActionValue = NULL;
+    JSON_Value* updateManifestValue = NULL;
+    ADUC_Workflow* wf = NULL;
+    JSON_Array* steps = workflow_get_instructions_steps_array(base);
+    JSON_Value* stepValue = json_array_get_value(steps, stepIndex);
+
+    if (stepValue == NULL)
+    {
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_INVALID_STEP_INDEX;
+        goto done;
+    }
+
+    *handle = NULL;
+
+    ADUC_Workflow* wfBase = workflow_from_handle(base);
+
+    wf = malloc(sizeof(*wf));
+    if (wf == NULL)
+    {
+        result.ExtendedResultCode = ADUC_ERC_NOMEM;
+        goto done;
+    }
+
+    memset(wf, 0, sizeof(*wf));
+
+    updateActionValue = _json_object_copy_except(
+        wfBase->UpdateActionObject,
+        s_childExcludedUpdateActionFields,
+        ARRAY_SIZE(s_childExcludedUpdateActionFields));
+    if (updateActionValue == NULL)
+    {
+        Log_Error("Cannot copy Update Action json from base");
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_FROM_BASE_FAILURE;
+        goto done;
+    }
+
+    JSON_Object* updateActionObject = json_object(updateActionValue);
+
+    // Copying the whole manifest, with the files and steps of every step, would make
+    // creating all the steps of a large bundle quadratic.
+    updateManifestValue = _json_object_copy_except(
+        wfBase->UpdateManifestObject,
+        s_stepExcludedUpdateManifestFields,
+        ARRAY_SIZE(s_stepExcludedUpdateManifestFields));
+    if (updateManifestValue == NULL)
+    {
+        Log_Error("Cannot copy Update Manifest json from base");
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_FROM_BASE_FAILURE;
+        goto done;
+    }
+
+    JSON_Object* updateManifestObject = json_object(updateManifestValue);
+    JSON_Object* stepObject = json_object(stepValue);
+
+    if (ADUC_Logging_GetLevel() <= ADUC_LOG_DEBUG)
+    {
+        char* currentStepData = json_serialize_to_string_pretty(stepValue);
+        Log_Debug("Processing current step:\n%s", currentStepData);
+        json_free_serialized_string(currentStepData);
+    }
+
+    // Replace 'updateType' with step's handler type.
+    const char* updateType = json_object_get_string(stepObject, STEP_PROPERTY_FIELD_HANDLER);
+    if (updateType == NULL || *updateType == 0)
+    {
+        Log_Error("Invalid step entry.");
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_PARSE_STEP_ENTRY_NO_HANDLER_TYPE;
+        goto done;
+    }
+    jsonStatus = json_object_set_string(updateManifestObject, ADUCITF_FIELDNAME_UPDATETYPE, updateType);
+    if (jsonStatus == JSONFailure)
+    {
+        Log_Error("Cannot update step entry updateType.");
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_SET_UPDATE_TYPE_FAILURE;
+        goto done;
+    }
+
+    // Copy 'handlerProperties', if the step has any.
+    const JSON_Value* stepHandlerProperties =
+        json_object_get_value(stepObject, STEP_PROPERTY_FIELD_HANDLER_PROPERTIES);
+    if (stepHandlerProperties != NULL)
+    {
+        JSON_Value* handlerProperties = json_value_deep_copy(stepHandlerProperties);
+        jsonStatus =
+            json_object_set_value(updateManifestObject, STEP_PROPERTY_FIELD_HANDLER_PROPERTIES, handlerProperties);
+        if (jsonStatus == JSONFailure)
+        {
+            json_value_free(handlerProperties);
+            handlerProperties = NULL;
+            Log_Error("Cannot copy 'handlerProperties'.");
+            result.ExtendedResultCode =
+                ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_COPY_HANDLER_PROPERTIES_FAILED;
+            goto done;
+        }
+    }
+
+    // Copy only the files needed by this step entry, in the base's order.
+    JSON_Array* stepFiles = json_object_get_array(stepObject, ADUCITF_FIELDNAME_FILES);
+    JSON_Object* baseFiles = json_object_get_object(wfBase->UpdateManifestObject, ADUCITF_FIELDNAME_FILES);
+    JSON_Value* filesValue = json_value_init_object();
+    JSON_Object* files = json_object(filesValue);
+
+    if (files == NULL || json_object_set_value(updateManifestObject, ADUCITF_FIELDNAME_FILES, filesValue) != JSONSuccess)
+    {
+        json_value_free(filesValue);
+        Log_Error("Cannot copy step files.");
+        result.ExtendedResultCode = ADUC_ERC_NOMEM;
+        goto done;
+    }
+
+    int fileCount = json_object_get_count(baseFiles);
+    int stepFilesCount = json_array_get_count(stepFiles);
+    for (int b = 0; b < fileCount; b++)
+    {
+        const char* baseFileId = json_object_get_name(baseFiles, b);
+
+        for (int i = 0; i < stepFilesCount; i++)
+        {
+            // Note: step's files is an array of file ids.
+            const char* stepFileId = json_array_get_string(stepFiles, i);
+
+            if (baseFileId != NULL && stepFileId != NULL && strcmp(baseFileId, stepFileId) == 0)
+            {
+                JSON_Value* fileValue = json_value_deep_copy(json_object_get_value_at(baseFiles, b));
+                if (fileValue == NULL || json_object_set_value(files, baseFileId, fileValue) != JSONSuccess)
+                {
+                    json_value_free(fileValue);
+                    Log_Error("Cannot copy step file %s.", baseFileId);
+                    result.ExtendedResultCode = ADUC_ERC_NOMEM;
+                    goto done;
+                }
+
+                break;
+            }
+        }
+    }
+
+    if (!_workflow_copy_file_urls(updateActionObject, base, files))
+    {
+        Log_Error("Cannot copy step file urls.");
+        result.ExtendedResultCode = ADUC_ERC_NOMEM;
+        goto done;
+    }
+
+    // Remove 'instructions' list...
+    json_object_set_null(updateManifestObject, "instructions");
+
+    wf->UpdateActionObject = updateActionObject;
+    wf->UpdateManifestObject = updateManifestObject;
+
+    {
+        char* baseWorkfolder = workflow_get_workfolder(base);
+        workflow_set_workfolder(wf, baseWorkfolder);
+        workflow_free_string(baseWorkfolder);
+    }
+
+    *handle = wf;
+    result.ResultCode = ADUC_GeneralResult_Success;
+    result.ExtendedResultCode = 0;
+
+done:
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        json_value_free(updateActionValue);
+        json_value_free(updateManifestValue);
+        workflow_free(wf);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Transfer data from @p sourceHandle to @p targetHandle.
+ * The sourceHandle will no longer contains transferred action data.
+ * Caller should not use sourceHandle for other workflow related purposes.
+ *
+ * @param targetHandle The target workflow handle
+ * @param sourceHandle The source workflow handle
+ * @return true if transfer succeeded.
+ */
+bool workflow_transfer_data(ADUC_WorkflowHandle targetHandle, ADUC_WorkflowHandle sourceHandle)
+{
+    ADUC_Workflow* wfTarget = workflow_from_handle(targetHandle);
+    ADUC_Workflow* wfSource = workflow_from_handle(sourceHandle);
+
+    if (wfSource == NULL || wfSource->UpdateActionObject == NULL)
+    {
+        return false;
+    }
+
+    // Transfer over the parsed JSON objects
+    wfTarget->UpdateActionObject = wfSource->UpdateActionObject;
+    wfSource->UpdateActionObject = NULL;
+
+    wfTarget->UpdateManifestObject = wfSource->UpdateManifestObject;
+    wfSource->UpdateManifestObject = NULL;
+    workflow_invalidate_file_table(wfTarget);
+    workflow_invalidate_file_table(wfSource);
+
+    wfTarget->PropertiesObject = wfSource->PropertiesObject;
+    wfSource->PropertiesObject = NULL;
+
+    // And the properties kept in fields.
+    free(wfTarget->WorkFolder);
+    wfTarget->WorkFolder = wfSource->WorkFolder;
+    wfSource->WorkFolder = NULL;
+    workflow_invalidate_workfolder_cache(wfTarget);
+
+    // The memory allocated from the source lives as long as the target.
+    if (wfTarget->Arena == NULL)
+    {
+        wfTarget->Arena = wfSource->Arena;
+    }
+    else
+    {
+        ADUC_Arena_Merge(wfTarget->Arena, wfSource->Arena);
+    }
+    wfSource->Arena = NULL;
+
+    free(wfTarget->SelectedComponents);
+    wfTarget->SelectedComponents = wfSource->SelectedComponents;
+    wfSource->SelectedComponents = NULL;
+    workflow_release_components(wfTarget->Components);
+    wfTarget->Components = wfSource->Components;
+    wfTarget->ComponentIndex = wfSource->ComponentIndex;
+    wfTarget->ComponentSelected = wfSource->ComponentSelected;
+    wfSource->Components = NULL;
+    wfSource->ComponentSelected = false;
+
+    wfTarget->DownloadDeferred = wfSource->DownloadDeferred;
+    wfTarget->ResolvedFilesCount = wfSource->ResolvedFilesCount;
+    wfTarget->CancelRequested = wfSource->CancelRequested;
+    wfTarget->RebootRequested = wfSource->RebootRequested;
+    wfTarget->ImmediateRebootRequested = wfSource->ImmediateRebootRequested;
+    wfTarget->AgentRestartRequested = wfSource->AgentRestartRequested;
+    wfTarget->ImmediateAgentRestartRequested = wfSource->ImmediateAgentRestartRequested;
+
+    STRING_delete(wfTarget->RestartReasons);
+    wfTarget->RestartReasons = wfSource->RestartReasons;
+    wfSource->RestartReasons = NULL;
+
+    return true;
+}
+
+/**
+ * @brief Instantiate and initialize workflow object with info from the given jsonData.
+ *
+ * @param updateManifestJson A JSON string containing update manifest data.
+ * @param validateManifest A boolean indicates whether to validate the update manifest.
+ * @param handle An output workflow object handle.
+ * @return ADUC_Result
+ */
+ADUC_Result workflow_init(const char* updateManifestJson, bool validateManifest, ADUC_WorkflowHandle* handle)
+{
+    ADUC_Result result = { ADUC_GeneralResult_Failure };
+    if (updateManifestJson == NULL || handle == NULL)
+    {
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_ERROR_BAD_PARAM;
+        goto done;
+    }
+
+    memset(handle, 0, sizeof(*handle));
+
+    // The usage of the workflow is measured from its parse, see workflow_get_memory_usage.
+    ADUC_JSON_ResetPeakAllocatedBytes();
+    const size_t baselineBytes = ADUC_JSON_GetAllocatedBytes();
+
+    result = _workflow_parse(false, updateManifestJson, validateManifest, handle);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        goto done;
+    }
+
+    result = _workflow_init_helper(handle);
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        goto done;
+    }
+
+    workflow_from_handle(*handle)->JsonBaselineBytes = baselineBytes;
+
+    // A manifest too large for the budget fails here, before any content is downloaded.
+    result = workflow_check_memory_budget(*handle);
+
+done:
+
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        Log_Error(
+            "Failed to init workflow handle. result:%d (erc:0x%X)", result.ResultCode, result.ExtendedResultCode);
+        if (handle != NULL)
+        {
+            workflow_free(*handle);
+            *handle = NULL;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief gets the current workflow step.
+ *
+ * @param handle A workflow data object handle.
+ * @return the workflow step.
+ */
+ADUCITF_WorkflowStep workflow_get_current_workflowstep(ADUC_WorkflowHandle handle)
+{
+    ADUCITF_WorkflowStep step = ADUCITF_WorkflowStep_Undefined;
+
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf != NULL)
+    {
+        step = wf->CurrentWorkflowStep;
+    }
+
+    return step;
+}
+
+/**
+ * @brief sets the current workflow step.
+ *
+ * @param handle A workflow data object handle.
+ * @param workflowStep The workflow step.
+ */
+void workflow_set_current_workflowstep(ADUC_WorkflowHandle handle, ADUCITF_WorkflowStep workflowStep)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf != NULL)
+    {
+        wf->CurrentWorkflowStep = workflowStep;
+    }
+}
+
+/**
+ * @brief Set workflow 'property._id'. This function creates a copy of the input id.
+ *
+ * @param handle A workflow object handle.
+ * @param id A new id of the workflow.
+ * @return Return true If succeeded.
+ */
+bool workflow_set_id(ADUC_WorkflowHandle handle, const char* id)
+{
+    return _workflow_set_id(handle, id);
+}
+
+/**
+ * @brief Get a read-only workflow id.
+ *
+ * @param handle A workflow object handle.
+ * @return Return the workflow id.
+ */
+const char* workflow_peek_id(ADUC_WorkflowHandle handle)
+{
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+
+    // Return 'properties._id', if set.
+    const char* id = _workflow_get_properties_id(handle);
+    if (id == NULL)
+    {
+        // Return 'workflow.id' from Action json data.
+        id = _workflow_peek_workflow_dot_id(handle);
+    }
+
+    return id;
+}
+
+/**
+ * @brief Get a workflow id.
+ *
+ * @param handle A workflow object handle.
+ * @return const char* If success, returns pointer to workflow id string. Otherwise, returns NULL.
+ * Caller must free the string by calling workflow_free_string() once done with the string.
+ */
+char* workflow_get_id(ADUC_WorkflowHandle handle)
+{
+    return workflow_copy_string(workflow_peek_id(handle));
+}
+
+/**
+ * @brief Explicit set workflow retryTimestamp for this workflow.
+ *
+ * @param handle A workflow data object handle.
+ * @param retryTimestamp The retryTimestamp
+ * @return Return true if succeeded.
+ */
+bool workflow_set_retryTimestamp(ADUC_WorkflowHandle handle, const char* retryTimestamp)
+{
+    return _workflow_set_retryTimestamp(handle, retryTimestamp);
+}
+
+/**
+ * @brief Get a read-only workflow retryTimestamp.
+ *
+ * @param handle A workflow object handle.
+ * @return Return the workflow retryTimestamp, if it was in json message.
+ */
+const char* workflow_peek_retryTimestamp(ADUC_WorkflowHandle handle)
+{
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+
+    // Return 'properties._retryTimestamp', if set.
+    const char* retryTimestamp = _workflow_get_properties_retryTimestamp(handle);
+    if (retryTimestamp == NULL)
+    {
+        // Return 'workflow.retryTimestamp' from Action json data,
+        // which could also be null or empty, as it's optional.
+        retryTimestamp = _workflow_peek_workflow_dot_retryTimestamp(handle);
+    }
+
+    return retryTimestamp;
+}
+
+/**
+ * @brief Free string buffer returned by workflow_get_* APIs.
+ * @param string A string to free.
+ */
+void workflow_free_string(char* string)
+{
+    free(string);
+}
+
+/**
+ * @brief Free workflow content.
+ *
+ * @param handle A workflow object handle.
+ */
+void workflow_uninit(ADUC_WorkflowHandle handle)
+{
+    // Not read back only to be freed.
+    ADUC_Workflow* wf = (ADUC_Workflow*)(handle);
+    if (wf != NULL && wf->SpillPath != NULL)
+    {
+        (void)remove(wf->SpillPath);
+        free(wf->SpillPath);
+        wf->SpillPath = NULL;
+    }
+
+    if (wf != NULL)
+    {
+        STRING_delete(wf->ResultDetails);
+        wf->ResultDetails = NULL;
+        STRING_delete(wf->InstalledUpdateId);
+        wf->InstalledUpdateId = NULL;
+        STRING_delete(wf->RestartReasons);
+        wf->RestartReasons = NULL;
+        free(wf->WorkFolder);
+        wf->WorkFolder = NULL;
+        free(wf->SelectedComponents);
+        wf->SelectedComponents = NULL;
+        workflow_release_components(wf->Components);
+        wf->Components = NULL;
+        wf->ComponentSelected = false;
+        free(wf->WorkFolderCache);
+        wf->WorkFolderCache = NULL;
+        free(wf->ReplacedWorkFolder);
+        wf->ReplacedWorkFolder = NULL;
+        ADUC_Arena_Destroy(wf->Arena);
+        wf->Arena = NULL;
+        ADUC_CancellationToken_Destroy(wf->CancellationToken);
+        wf->CancellationToken = NULL;
+    }
+
+    _workflow_free_updateaction(handle);
+    _workflow_free_updatemanifest(handle);
+    _workflow_free_properties(handle);
+    _workflow_free_results_object(handle);
+
+    // This should have been transferred, but free it if it's still around.
+    if (wf != NULL && wf->DeferredReplacementWorkflow != NULL)
+    {
+        workflow_free(wf->DeferredReplacementWorkflow);
+        wf->DeferredReplacementWorkflow = NULL;
+    }
+}
+
+/**
+ * @brief Free workflow content and free the workflow object.
+ *
+ * @param handle A workflow object handle.
+ */
+void workflow_free(ADUC_WorkflowHandle handle)
+{
+    if (handle == NULL)
+    {
+        return;
+    }
+
+    // Remove existing child workflow handle(s), from the last so that none of the others move.
+    while (workflow_get_children_count(handle) > 0)
+    {
+        ADUC_WorkflowHandle child = workflow_remove_child(handle, -1);
+        workflow_free(child);
+    }
+
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    free(wf->Children);
+    wf->Children = NULL;
+    wf->ChildrenMax = 0;
+
+    workflow_uninit(handle);
+    free(handle);
+}
+
+void workflow_set_memory_budget(size_t budgetBytes)
+{
+    __atomic_store_n(&s_workflowMemoryBudgetBytes, budgetBytes, __ATOMIC_RELAXED);
+}
+
+size_t workflow_get_memory_budget(void)
+{
+    return __atomic_load_n(&s_workflowMemoryBudgetBytes, __ATOMIC_RELAXED);
+}
+
+void workflow_set_log_size_limit(size_t limitBytes)
+{
+    __atomic_store_n(&s_workflowLogSizeLimitBytes, limitBytes, __ATOMIC_RELAXED);
+}
+
+size_t workflow_get_log_size_limit(void)
+{
+    return __atomic_load_n(&s_workflowLogSizeLimitBytes, __ATOMIC_RELAXED);
+}
+
+void workflow_set_download_start_jitter(unsigned int windowSeconds)
+{
+    __atomic_store_n(&s_downloadStartJitterSeconds, windowSeconds, __ATOMIC_RELAXED);
+}
+
+bool workflow_set_download_mirrors(const char* mirrors)
+{
+    JSON_Value* value = NULL;
+
+    if (mirrors != NULL)
+    {
+        value = json_parse_string(mirrors);
+        if (json_value_get_type(value) != JSONObject)
+        {
+            Log_Error("Invalid download mirrors, expected an object of URI prefixes to arrays of mirror prefixes.");
+            json_value_free(value);
+            return false;
+        }
+    }
+
+    pthread_mutex_lock(&s_downloadMirrorsMutex);
+    JSON_Value* previous = s_downloadMirrors;
+    s_downloadMirrors = value;
+    pthread_mutex_unlock(&s_downloadMirrorsMutex);
+
+    json_value_free(previous);
+    return true;
+}
+
+void workflow_set_device_id(const char* deviceId)
+{
+    // 32-bit FNV-1a, which spreads similar ids, e.g. "device-001" and "device-002", over the window.
+    uint32_t hash = 2166136261U;
+    for (const char* c = deviceId; c != NULL && *c != '\0'; ++c)
+    {
+        hash = (hash ^ (unsigned char)*c) * 16777619U;
+    }
+
+    __atomic_store_n(&s_deviceIdHash, hash, __ATOMIC_RELAXED);
+    __atomic_store_n(&s_hasDeviceId, deviceId != NULL, __ATOMIC_RELAXED);
+}
+
+unsigned int workflow_get_download_start_delay(ADUC_WorkflowHandle handle)
+{
+    const unsigned int windowSeconds = __atomic_load_n(&s_downloadStartJitterSeconds, __ATOMIC_RELAXED);
+    if (windowSeconds == 0 || !__atomic_load_n(&s_hasDeviceId, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+
+    if (json_object_get_boolean(_workflow_get_update_manifest(handle), UPDATE_MANIFEST_PROPERTY_FIELD_URGENT) == 1)
+    {
+        return 0;
+    }
+
+    return __atomic_load_n(&s_deviceIdHash, __ATOMIC_RELAXED) % windowSeconds;
+}
+
+size_t workflow_get_memory_usage(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL || !ADUC_JSON_IsAllocationAccountingEnabled())
+    {
+        return 0;
+    }
+
+    while (wf->Parent != NULL)
+    {
+        wf = wf->Parent;
+    }
+
+    const size_t peakBytes = ADUC_JSON_GetPeakAllocatedBytes();
+    return peakBytes > wf->JsonBaselineBytes ? peakBytes - wf->JsonBaselineBytes : 0;
+}
+
+void* workflow_arena_alloc(ADUC_WorkflowHandle handle, size_t size)
+{
+    return ADUC_Arena_Alloc(workflow_get_arena(handle), size);
+}
+
+void* workflow_arena_calloc(ADUC_WorkflowHandle handle, size_t count, size_t size)
+{
+    return ADUC_Arena_Calloc(workflow_get_arena(handle), count, size);
+}
+
+char* workflow_arena_strdup(ADUC_WorkflowHandle handle, const char* str)
+{
+    if (str == NULL)
+    {
+        return NULL;
+    }
+
+    return ADUC_Arena_Strdup(workflow_get_arena(handle), str);
+}
+
+ADUC_Result workflow_check_memory_budget(ADUC_WorkflowHandle handle)
+{
+    ADUC_Result result = { ADUC_GeneralResult_Success };
+    const size_t budgetBytes = workflow_get_memory_budget();
+
+    if (budgetBytes == 0)
+    {
+        return result;
+    }
+
+    const size_t usageBytes = workflow_get_memory_usage(handle);
+    if (usageBytes > budgetBytes)
+    {
+        Log_Error("Workflow memory usage %zu bytes is over the budget of %zu bytes.", usageBytes, budgetBytes);
+        result.ResultCode = ADUC_GeneralResult_Failure;
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_MEMORY_BUDGET_EXCEEDED;
+    }
+
+    return result;
+}
+
+uint64_t workflow_get_remaining_download_bytes(ADUC_WorkflowHandle handle)
+{
+    uint64_t remainingBytes = 0;
+    const char* workFolder = workflow_peek_workfolder(handle);
+    const size_t fileCount = workflow_get_update_files_count(handle);
+
+    for (size_t i = 0; i < fileCount; i++)
+    {
+        const ADUC_FileEntity* entity = workflow_peek_update_file(handle, i);
+        if (entity == NULL)
+        {
+            continue;
+        }
+
+        // A download cache hit is hard linked into the work folder, and takes no space.
+        if (ExtensionManager_IsDownloadCacheLinkable(entity, workFolder))
+        {
+            continue;
+        }
+
+        // The file may be there already, or partly downloaded by an interrupted attempt that resumes from it.
+        uint64_t existingBytes = 0;
+        char* filePath = ADUC_StringFormat("%s/%s", workFolder, entity->TargetFilename);
+        char* partialFilePath = ADUC_StringFormat("%s/%s.partial", workFolder, entity->TargetFilename);
+        struct stat st;
+        if (filePath != NULL && stat(filePath, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            existingBytes = (uint64_t)st.st_size;
+        }
+        else if (partialFilePath != NULL && stat(partialFilePath, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            existingBytes = (uint64_t)st.st_size;
+        }
+
+        if (entity->SizeInBytes > existingBytes)
+        {
+            remainingBytes += entity->SizeInBytes - existingBytes;
+        }
+
+        free(filePath);
+        free(partialFilePath);
+    }
+
+    const size_t childCount = workflow_get_children_count(handle);
+    for (size_t i = 0; i < childCount; i++)
+    {
+        remainingBytes += workflow_get_remaining_download_bytes(workflow_get_child(handle, (int)i));
+    }
+
+    return remainingBytes;
+}
+
+ADUC_Result workflow_check_disk_space(ADUC_WorkflowHandle handle)
+{
+    ADUC_Result result = { ADUC_GeneralResult_Success };
+    const char* workFolder = workflow_peek_workfolder(handle);
+    uint64_t availableBytes = 0;
+
+    if (workFolder == NULL)
+    {
+        return result;
+    }
+
+    const int err = ADUC_SystemUtils_GetAvailableDiskSpace(workFolder, &availableBytes);
+    if (err != 0)
+    {
+        Log_Warn("Cannot get the free disk space of %s, errno %d; skipping the disk space check.", workFolder, err);
+        return result;
+    }
+
+    const uint64_t requiredBytes = workflow_get_remaining_download_bytes(handle);
+
+    // The sandboxes of previous workflows may still be being removed in the background. Their space will be free.
+    if (requiredBytes > availableBytes)
+    {
+        Log_Info("Waiting for the removal of previous sandboxes to free disk space in %s.", workFolder);
+        ADUC_SystemUtils_WaitForDeferredRemovals();
+        if (ADUC_SystemUtils_GetAvailableDiskSpace(workFolder, &availableBytes) != 0)
+        {
+            return result;
+        }
+    }
+
+    if (requiredBytes > availableBytes)
+    {
+        Log_Error(
+            "The update needs %llu bytes in %s, but only %llu are free.",
+            (unsigned long long)requiredBytes,
+            workFolder,
+            (unsigned long long)availableBytes);
+        result.ResultCode = ADUC_GeneralResult_Failure;
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_INSUFFICIENT_DISK_SPACE;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Set workflow parent.
+ *
+ * @param handle A child workflow object handle.
+ * @param parent A parent workflow object handle.
+ */
+void workflow_set_parent(ADUC_WorkflowHandle handle, ADUC_WorkflowHandle parent)
+{
+    if (handle == NULL)
+    {
+        return;
+    }
+
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    wf->Parent = workflow_from_handle(parent);
+    wf->Level = workflow_get_level(parent) + 1;
+    workflow_invalidate_workfolder_cache(wf);
+}
+
+/**
+ * @brief Get the root workflow object linked by the @p handle.
+ *
+ * @param handle A workflow object handle.
+ * @return ADUC_WorkflowHandle
+ */
+ADUC_WorkflowHandle workflow_get_root(ADUC_WorkflowHandle handle)
+{
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    while (wf->Parent != NULL)
+    {
+        wf = wf->Parent;
+    }
+    return (ADUC_WorkflowHandle)wf;
+}
+
+/**
+ * @brief Get the parent workflow object linked by the @p handle.
+ *
+ * @param handle A workflow object handle.
+ * @return ADUC_WorkflowHandle
+ */
+ADUC_WorkflowHandle workflow_get_parent(ADUC_WorkflowHandle handle)
+{
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    return (ADUC_WorkflowHandle)wf->Parent;
+}
+
+/**
+ * @brief Get workflow's children count.
+ *
+ * @param handle A workflow object handle.
+ * @return Total child workflow count.
+ */
+int workflow_get_children_count(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    return wf != NULL ? wf->ChildCount : 0;
+}
+
+/**
+ * @brief Get child workflow at specified @p index.
+ *
+ * @param handle A workflow object handle.
+ * @param index Index of a child workflow to get.
+ * @return A child workflow object handle, or NULL if index out of range.
+ */
+ADUC_WorkflowHandle workflow_get_child(ADUC_WorkflowHandle handle, int index)
+{
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (index == -1)
+    {
+        index = wf->ChildCount - 1;
+    }
+
+    if (index < 0 || index >= wf->ChildCount)
+    {
+        return NULL;
+    }
+
+    return handle_from_workflow(wf->Children[index]);
+}
+
+bool workflow_reserve_children(ADUC_WorkflowHandle handle, size_t count)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        return false;
+    }
+
+    if (count <= wf->ChildrenMax)
+    {
+        return true;
+    }
+
+    if (count > SIZE_MAX / sizeof(ADUC_Workflow*))
+    {
+        return false;
+    }
+
+    ADUC_Workflow** newArray = realloc(wf->Children, count * sizeof(ADUC_Workflow*));
+    if (newArray == NULL)
+    {
+        return false;
+    }
+
+    wf->Children = newArray;
+    wf->ChildrenMax = count;
+    return true;
+}
+
+// To append, pass index (-1).
+bool workflow_insert_child(ADUC_WorkflowHandle handle, int index, ADUC_WorkflowHandle childHandle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+
+    // Expand array if needed. Doubling keeps appending a few hundred steps to a few reallocations.
+    if (wf->ChildCount == wf->ChildrenMax
+        && !workflow_reserve_children(
+            handle, wf->ChildrenMax == 0 ? WORKFLOW_CHILDREN_BLOCK_SIZE : wf->ChildrenMax * 2))
+    {
+        Log_Error("Cannot allocate the child workflows of workflow %s.", workflow_peek_id(handle));
+        return false;
+    }
+
+    if (index < 0 || index >= wf->ChildCount)
+    {
+        index = wf->ChildCount;
+    }
+    else
+    {
+        // Make room for the new child.
+        size_t bytes = (wf->ChildCount - index) * sizeof(ADUC_Workflow*);
+        memmove(wf->Children + (index + 1), wf->Children + index, bytes);
+    }
+
+    wf->Children[index] = workflow_from_handle(childHandle);
+    wf->ChildCount++;
+    workflow_set_parent(childHandle, handle);
+
+    return true;
+}
+
+/**
+ * @brief Remove child workflow at specified @p index
+ *
+ * @param handle
+ * @param index An index of the child workflow to be remove.
+ * @return ADUC_WorkflowHandle Returns removed child, if succeeded.
+ */
+ADUC_WorkflowHandle workflow_remove_child(ADUC_WorkflowHandle handle, int index)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+
+    // Remove last?
+    if (index == -1)
+    {
+        index = wf->ChildCount - 1;
+    }
+
+    if (index < 0 || index >= wf->ChildCount)
+    {
+        return NULL;
+    }
+
+    ADUC_WorkflowHandle child = wf->Children[index];
+
+    if (index < wf->ChildCount - 1)
+    {
+        size_t bytes = sizeof(ADUC_Workflow*) * (wf->ChildCount - (index + 1));
+        memmove(wf->Children + index, wf->Children + (index + 1), bytes);
+    }
+
+    wf->ChildCount--;
+
+    workflow_set_parent(child, NULL);
+    return child;
+}
+
+//
+// Workflow state.
+//
+ADUCITF_State workflow_get_root_state(ADUC_WorkflowHandle handle)
+{
+    return workflow_get_state(workflow_get_root(handle));
+}
+
+ADUCITF_State workflow_get_state(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        return ADUCITF_State_None;
+    }
+
+    return wf->State;
+}
+
+// Save this workflow's state at the root.
+bool workflow_set_state(ADUC_WorkflowHandle handle, ADUCITF_State state)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        return false;
+    }
+
+    wf->State = state;
+
+    return true;
+}
+
+void workflow_set_result_details(ADUC_WorkflowHandle handle, const char* format, ...)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        return;
+    }
+
+    if (format == NULL)
+    {
+        STRING_empty(wf->ResultDetails);
+    }
+    else
+    {
+        char buffer[WORKFLOW_RESULT_DETAILS_MAX_LENGTH];
+        va_list arg_list;
+        va_start(arg_list, format);
+        vsnprintf(buffer, WORKFLOW_RESULT_DETAILS_MAX_LENGTH, format, arg_list);
+        va_end(arg_list);
+
+        STRING_delete(wf->ResultDetails);
+        wf->ResultDetails = STRING_construct(buffer);
+    }
+}
+
+void workflow_set_installed_update_id(ADUC_WorkflowHandle handle, const char* installedUpdateId)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        return;
+    }
+
+    if (installedUpdateId == NULL)
+    {
+        STRING_empty(wf->InstalledUpdateId);
+    }
+    else
+    {
+        wf->InstalledUpdateId = STRING_construct(installedUpdateId);
+    }
+}
+
+// The status either stored in the workflow object itself, or in root object.
+JSON_Object* _workflow_find_state(ADUC_WorkflowHandle handle, const char* workflowId)
+{
+    if (handle == NULL || workflowId == NULL || *workflowId == 0)
+    {
+        return NULL;
+    }
+
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf->ResultsObject != NULL && json_object_has_value(wf->ResultsObject, workflowId))
+    {
+        return json_object_get_object(wf->ResultsObject, workflowId);
+    }
+
+    ADUC_Workflow* wfRoot = workflow_from_handle(workflow_get_root(handle));
+    if (wfRoot->ResultsObject != NULL && json_object_has_value(wfRoot->ResultsObject, workflowId))
+    {
+        return json_object_get_object(wfRoot->ResultsObject, workflowId);
+    }
+
+    return NULL;
+}
+
+void workflow_set_result(ADUC_WorkflowHandle handle, ADUC_Result result)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf != NULL)
+    {
+        wf->Result = result;
+    }
+}
+
+ADUC_Result workflow_get_result(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        ADUC_Result result = {};
+        return result;
+    }
+
+    return wf->Result;
+}
+
+const char* workflow_peek_result_details(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        return NULL;
+    }
+
+    return STRING_c_str(wf->ResultDetails);
+}
+
+const char* workflow_peek_installed_update_id(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        return NULL;
+    }
+
+    return STRING_c_str(wf->InstalledUpdateId);
+}
+
+void workflow_set_cancellation_type(ADUC_WorkflowHandle handle, ADUC_WorkflowCancellationType cancellationType)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf != NULL)
+    {
+        wf->CancellationType = cancellationType;
+    }
+}
+
+ADUC_WorkflowCancellationType workflow_get_cancellation_type(ADUC_WorkflowHandle handle)
+{
+    ADUC_WorkflowCancellationType result;
+
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        result = ADUC_WorkflowCancellationType_Normal;
+    }
+    else
+    {
+        result = wf->CancellationType;
+    }
+
+    return result;
+}
+
+/**
+ * @brief sets both cancellation type to retry and retry timestamp.
+ * @param handle the workflow handle
+ * @param retryToken the retry token with which to update
+ * @return true if succeeded.
+ */
+bool workflow_update_retry_deployment(ADUC_WorkflowHandle handle, const char* retryToken)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    bool result = false;
+
+    if (wf != NULL)
+    {
+        wf->CancellationType = ADUC_WorkflowCancellationType_Retry;
+        result = _workflow_set_retryTimestamp(handle, retryToken);
+    }
+
+    return result;
+}
+
+/**
+ * @brief if operation is in progress on the current workflow, it will set the next workflow as a deferred workflow on the current workflow and set cancellation type to Replacement.
+ * @remark The caller must not free the next workflow handle when true is returned as it is owned by the current workflow as a deferred field. Conversely, if false is returned, then
+ *             the caller must free the current workflow handle and set the next workflow handle as the current in the workflow data.
+ * @param currentWorkflowHandle The workflow handle on the current workflow Data.
+ * @param nextWorkflowHandle The workflow handle for the next workflow update deployment.
+ * @return true if there was an operation in progress and the next workflow handle got deferred until workCompletionCallback processing.
+ */
+bool workflow_update_replacement_deployment(
+    ADUC_WorkflowHandle currentWorkflowHandle, ADUC_WorkflowHandle nextWorkflowHandle)
+{
+    bool wasDeferred = false;
+
+    ADUC_Workflow* currentWorkflow = workflow_from_handle(currentWorkflowHandle);
+
+    if (currentWorkflow->OperationInProgress)
+    {
+        currentWorkflow->CancellationType = ADUC_WorkflowCancellationType_Replacement;
+        // Interrupts the downloads and child processes of the current one right away.
+        workflow_set_operation_cancelled(currentWorkflow, true);
+        // A replacement deferred earlier is itself replaced.
+        workflow_free(currentWorkflow->DeferredReplacementWorkflow);
+        currentWorkflow->DeferredReplacementWorkflow =
+            nextWorkflowHandle; // upon return, caller must release ownership as it's owned by current workflow now
+        wasDeferred = true;
+    }
+
+    return wasDeferred;
+}
+
+/**
+ * @brief Checks whether the update manifest file entry @p file has the specified hash.
+ */
+static bool file_entry_has_hash(const JSON_Object* file, const char* hashType, const char* hashValue)
+{
+    const char* value = json_object_get_string(json_object_get_object(file, ADUCITF_FIELDNAME_HASHES), hashType);
+    return value != NULL && strcmp(value, hashValue) == 0;
+}
+
+/**
+ * @brief Checks whether the workflow, or one of its children, has a file or bundled update with the specified hash.
+ */
+static bool workflow_has_file_with_hash(ADUC_WorkflowHandle handle, const char* hashType, const char* hashValue)
+{
+    const JSON_Object* files = _workflow_get_update_manifest_files_map(handle);
+    const size_t fileCount = json_object_get_count(files);
+    for (size_t i = 0; i < fileCount; i++)
+    {
+        if (file_entry_has_hash(json_value_get_object(json_object_get_value_at(files, i)), hashType, hashValue))
+        {
+            return true;
+        }
+    }
+
+    const JSON_Array* bundledUpdates = _workflow_get_update_manifest_bundle_updates_map(handle);
+    const size_t bundledUpdateCount = json_array_get_count(bundledUpdates);
+    for (size_t i = 0; i < bundledUpdateCount; i++)
+    {
+        if (file_entry_has_hash(json_array_get_object(bundledUpdates, i), hashType, hashValue))
+        {
+            return true;
+        }
+    }
+
+    const size_t childCount = workflow_get_children_count(handle);
+    for (size_t i = 0; i < childCount; i++)
+    {
+        if (workflow_has_file_with_hash(workflow_get_child(handle, (int)i), hashType, hashValue))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Checks whether the update manifest file entry @p file has the same content as a file of @p otherHandle.
+ */
+static bool file_entry_is_needed_by(const JSON_Object* file, ADUC_WorkflowHandle otherHandle)
+{
+    const JSON_Object* hashes = json_object_get_object(file, ADUCITF_FIELDNAME_HASHES);
+
+    // Files are compared by their first hash; a file without one can't be matched.
+    if (json_object_get_count(hashes) == 0)
+    {
+        return false;
+    }
+
+    const char* hashType = json_object_get_name(hashes, 0);
+    const char* hashValue = json_value_get_string(json_object_get_value_at(hashes, 0));
+    return hashValue != NULL && workflow_has_file_with_hash(otherHandle, hashType, hashValue);
+}
+
+bool workflow_files_are_needed_by(ADUC_WorkflowHandle handle, ADUC_WorkflowHandle otherHandle)
+{
+    const JSON_Object* files = _workflow_get_update_manifest_files_map(handle);
+    const size_t fileCount = json_object_get_count(files);
+    for (size_t i = 0; i < fileCount; i++)
+    {
+        if (!file_entry_is_needed_by(json_value_get_object(json_object_get_value_at(files, i)), otherHandle))
+        {
+            return false;
+        }
+    }
+
+    // The bundled updates of a v3 bundle are downloaded like files, but aren't in the files map.
+    const JSON_Array* bundledUpdates = _workflow_get_update_manifest_bundle_updates_map(handle);
+    const size_t bundledUpdateCount = json_array_get_count(bundledUpdates);
+    for (size_t i = 0; i < bundledUpdateCount; i++)
+    {
+        if (!file_entry_is_needed_by(json_array_get_object(bundledUpdates, i), otherHandle))
+        {
+            return false;
+        }
+    }
+
+    const size_t childCount = workflow_get_children_count(handle);
+    for (size_t i = 0; i < childCount; i++)
+    {
+        if (!workflow_files_are_needed_by(workflow_get_child(handle, (int)i), otherHandle))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool workflow_defer_replacement_after_download(
+    ADUC_WorkflowHandle currentWorkflowHandle, ADUC_WorkflowHandle nextWorkflowHandle)
+{
+    ADUC_Workflow* currentWorkflow = workflow_from_handle(currentWorkflowHandle);
+
+    if (!currentWorkflow->OperationInProgress
+        || currentWorkflow->CurrentWorkflowStep != ADUCITF_WorkflowStep_Download
+        || workflow_get_operation_cancel_requested(currentWorkflowHandle)
+        || !workflow_files_are_needed_by(currentWorkflowHandle, nextWorkflowHandle))
+    {
+        return false;
+    }
+
+    // Not cancelled: WorkCompletionCallback starts the replacement once the download completes, and the replacement's
+    // download reuses the files from the work folder of this one.
+    currentWorkflow->CancellationType = ADUC_WorkflowCancellationType_Replacement;
+    workflow_free(currentWorkflow->DeferredReplacementWorkflow);
+    currentWorkflow->DeferredReplacementWorkflow = nextWorkflowHandle;
+
+    return true;
+}
+
+/**
+ * @brief Resets state for retry and replacement deployment processing.
+ * @param wf The ADUC workflow state internal representation of a handle.
+ */
+static void reset_state_for_processing_deployment(ADUC_Workflow* wf)
+{
+    wf->CurrentWorkflowStep = ADUCITF_WorkflowStep_ProcessDeployment;
+    wf->OperationInProgress = false;
+    workflow_set_operation_cancelled(wf, false);
+    wf->CancellationType = ADUC_WorkflowCancellationType_None;
+}
+
+/**
+ * @brief Resets state to process the deferred workflow deployment, which is also transferred to the current.
+ * @param handle The workflow handle on the current workflow Data.
+ */
+void workflow_update_for_replacement(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+
+    ADUC_Workflow* deferred = wf->DeferredReplacementWorkflow;
+    wf->DeferredReplacementWorkflow = NULL;
+
+    // Kept until the replacement's download had a chance to reuse its files; see workflow_take_replaced_workfolder.
+    free(wf->ReplacedWorkFolder);
+    wf->ReplacedWorkFolder = workflow_get_workfolder(handle);
+
+    workflow_transfer_data(handle /* wfTarget */, deferred /* wfSource */);
+
+    reset_state_for_processing_deployment(wf);
+}
+
+bool workflow_has_deferred_replacement(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    return wf != NULL && wf->DeferredReplacementWorkflow != NULL;
+}
+
+char* workflow_take_replaced_workfolder(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf == NULL)
+    {
+        return NULL;
+    }
+
+    char* workFolder = wf->ReplacedWorkFolder;
+    wf->ReplacedWorkFolder = NULL;
+    return workFolder;
+}
+
+/**
+ * @brief Resets state to reprocess the current workflow deployment.
+ * @param handle The workflow handle on the current workflow Data.
+ */
+void workflow_update_for_retry(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+
+    reset_state_for_processing_deployment(wf);
+}
+
+// If succeeded, free existing install state data and replace with a new one.
+// If failed, no changes to the handle.
+bool workflow_read_state_from_file(ADUC_WorkflowHandle handle, const char* stateFilename)
+{
+    if (handle == NULL || stateFilename == NULL || *stateFilename == 0)
+    {
+        return false;
+    }
+
+    JSON_Value* rootValue = json_parse_file(stateFilename);
+    if (rootValue == NULL)
+    {
+        return 0;
+    }
+
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    if (wf->ResultsObject != NULL)
+    {
+        json_value_free(json_object_get_wrapping_value(wf->ResultsObject));
+    }
+
+    wf->ResultsObject = json_value_get_object(rootValue);
+    return true;
+}
+
+bool workflow_is_cancel_requested(ADUC_WorkflowHandle handle)
+{
+    const ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    return root != NULL && __atomic_load_n(&root->CancelRequested, __ATOMIC_RELAXED);
+}
+
+bool workflow_is_agent_restart_requested(ADUC_WorkflowHandle handle)
+{
+    const ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    return root != NULL && __atomic_load_n(&root->AgentRestartRequested, __ATOMIC_RELAXED);
+}
+
+bool workflow_is_immediate_agent_restart_requested(ADUC_WorkflowHandle handle)
+{
+    const ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    return root != NULL && __atomic_load_n(&root->ImmediateAgentRestartRequested, __ATOMIC_RELAXED);
+}
+
+bool workflow_is_reboot_requested(ADUC_WorkflowHandle handle)
+{
+    const ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    return root != NULL && __atomic_load_n(&root->RebootRequested, __ATOMIC_RELAXED);
+}
+
+bool workflow_is_immediate_reboot_requested(ADUC_WorkflowHandle handle)
+{
+    const ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    return root != NULL && __atomic_load_n(&root->ImmediateRebootRequested, __ATOMIC_RELAXED);
+}
+
+bool workflow_request_reboot(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    if (root == NULL)
+    {
+        return false;
+    }
+
+    __atomic_store_n(&root->RebootRequested, true, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool workflow_request_immediate_reboot(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    if (root == NULL)
+    {
+        return false;
+    }
+
+    __atomic_store_n(&root->ImmediateRebootRequested, true, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool workflow_request_agent_restart(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    if (root == NULL)
+    {
+        return false;
+    }
+
+    __atomic_store_n(&root->AgentRestartRequested, true, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool workflow_request_immediate_agent_restart(ADUC_WorkflowHandle handle)
+{
+    ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    if (root == NULL)
+    {
+        return false;
     }
-    else
+
+    __atomic_store_n(&root->ImmediateAgentRestartRequested, true, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool workflow_add_restart_reason(ADUC_WorkflowHandle handle, const char* reason)
+{
+    ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    if (root == NULL || reason == NULL)
     {
-        // Make room for the new child.
-        size_t bytes = (wf->ChildCount - index) * sizeof(ADUC_Workflow*);
-        memmove(wf->Children + (index + 1), wf->Children + index, bytes);
+        return false;
     }
 
-    wf->Children[index] = workflow_from_handle(childHandle);
-    wf->ChildCount++;
-    workflow_set_parent(childHandle, handle);
+    if (root->RestartReasons == NULL)
+    {
+        root->RestartReasons = STRING_construct(reason);
+        return root->RestartReasons != NULL;
+    }
 
-    succeeded = true;
-    return succeeded;
+    return STRING_concat(root->RestartReasons, "; ") == 0 && STRING_concat(root->RestartReasons, reason) == 0;
+}
+
+const char* workflow_peek_restart_reasons(ADUC_WorkflowHandle handle)
+{
+    const ADUC_Workflow* root = workflow_from_handle(workflow_get_root(handle));
+    return (root == NULL || root->RestartReasons == NULL) ? NULL : STRING_c_str(root->RestartReasons);
 }
 
 /**
- * @brief Remove child workflow at specified @p index
+ * @brief Compare id of @p handle0 and @p handle1
  *
- * @param handle
- * @param index An index of the child workflow to be remove.
- * @return ADUC_WorkflowHandle Returns removed child, if succeeded.
+ * @param handle0
+ * @param handle1
+ * @return 0 if ids are equal.
  */
-ADUC_WorkflowHandle workflow_remove_child(ADUC_WorkflowHandle handle, int index)
+int workflow_id_compare(ADUC_WorkflowHandle handle0, ADUC_WorkflowHandle handle1)
 {
-    ADUC_Workflow* wf = workflow_from_handle(handle);
+    char* id0 = workflow_get_id(handle0);
+    char* id1 = workflow_get_id(handle1);
+    int result = -1;
 
-    // Remove last?
-    if (index == -1)
+    if (id0 == NULL || id1 == NULL)
     {
-        index = wf->ChildCount - 1;
+        Log_Error("Missing workflow id (id0:%s, id1:%s)", id0, id1);
+        goto done;
     }
 
-    if (index < 0 || index >= wf->ChildCount)
+    result = strcmp(id0, id1);
+
+done:
+    workflow_free_string(id0);
+    workflow_free_string(id1);
+    return result;
+}
+
+/**
+ * @brief Create a new workflow data handler using base workflow and serialized 'instruction' json string.
+ * Note: The 'workfolder' of the returned workflow data object will be the same as the base's.
+ *
+ * @param base The base workflow containing valid Update Action and Manifest.
+ * @param instruction A serialized json string containing single 'installItem' from an instruction file.
+ * @param handle An output workflow handle.
+ * @return ADUC_Result
+ */
+ADUC_Result
+workflow_create_from_instruction(ADUC_WorkflowHandle base, const char* instruction, ADUC_WorkflowHandle* handle)
+{
+    ADUC_Result result;
+
+    // Parse instruction json.
+    JSON_Value* instructionValue = json_parse_string(instruction);
+    if (instructionValue == NULL)
+    {
+        Log_Error("Invalid intruction entry.");
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_PARSE_INSTRUCTION_ENTRY_FAILURE;
+        goto done;
+    }
+
+    result = workflow_create_from_instruction_value(base, instructionValue, handle);
+
+done:
+    json_value_free(instructionValue);
+    return result;
+}
+
+/**
+ * @brief Create a new workflow data handler using base workflow and serialized 'instruction' json string.
+ * Note: The 'workfolder' of the returned workflow data object will be the same as the base's.
+ *
+ * @param base The base workflow containing valid Update Action and Manifest.
+ * @param instruction A JSON_Value object contain install-item data.
+ * @param handle An output workflow handle.
+ * @return ADUC_Result
+ */
+ADUC_Result
+workflow_create_from_instruction_value(ADUC_WorkflowHandle base, JSON_Value* instruction, ADUC_WorkflowHandle* handle)
+{
+    ADUC_Result result = { ADUC_GeneralResult_Failure };
+    JSON_Status jsonStatus = JSONFailure;
+    JSON_Value* updateActionValue = NULL;
+    JSON_Value* updateManifestValue = NULL;
+    ADUC_Workflow* wf = NULL;
+
+    if (base == NULL || instruction == NULL || handle == NULL)
+    {
+        goto done;
+    }
+
+    *handle = NULL;
+
+    ADUC_Workflow* wfBase = workflow_from_handle(base);
+
+    wf = malloc(sizeof(*wf));
+    if (wf == NULL)
+    {
+        result.ExtendedResultCode = ADUC_ERC_NOMEM;
+        goto done;
+    }
+
+    memset(wf, 0, sizeof(*wf));
+
+    updateActionValue = _json_object_copy_except(
+        wfBase->UpdateActionObject,
+        s_childExcludedUpdateActionFields,
+        ARRAY_SIZE(s_childExcludedUpdateActionFields));
+    if (updateActionValue == NULL)
+    {
+        Log_Error("Cannot copy Update Action json from base");
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_FROM_BASE_FAILURE;
+        goto done;
+    }
+
+    JSON_Object* updateActionObject = json_object(updateActionValue);
+
+    updateManifestValue = json_value_deep_copy(json_object_get_wrapping_value(wfBase->UpdateManifestObject));
+    if (updateManifestValue == NULL)
+    {
+        Log_Error("Cannot copy Update Manifest json from base");
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_FROM_BASE_FAILURE;
+        goto done;
+    }
+
+    JSON_Object* updateManifestObject = json_object(updateManifestValue);
+    JSON_Object* instructionObject = json_object(instruction);
+
+    if (ADUC_Logging_GetLevel() <= ADUC_LOG_DEBUG)
+    {
+        char* currentInstructionData = json_serialize_to_string_pretty(instruction);
+        Log_Debug("Processing current instruction:\n%s", currentInstructionData);
+        json_free_serialized_string(currentInstructionData);
+    }
+
+    // Replace 'updateType'.
+    const char* updateType = json_object_get_string(instructionObject, ADUCITF_FIELDNAME_UPDATETYPE);
+    if (updateType == NULL || *updateType == 0)
+    {
+        Log_Error("Invalid instruction entry.");
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_PARSE_INSTRUCTION_ENTRY_NO_UPDATE_TYPE;
+        goto done;
+    }
+    jsonStatus = json_object_set_string(updateManifestObject, ADUCITF_FIELDNAME_UPDATETYPE, updateType);
+    if (jsonStatus == JSONFailure)
+    {
+        Log_Error("Cannot update instruction entry updateType.");
+        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_SET_UPDATE_TYPE_FAILURE;
+        goto done;
+    }
+
+    // Keep only file needed by this entry. Remove the rest.
+    JSON_Array* instFiles = json_object_get_array(instructionObject, ADUCITF_FIELDNAME_FILES);
+    JSON_Object* baseFiles = json_object_get_object(updateManifestObject, ADUCITF_FIELDNAME_FILES);
+    int fileCount = json_object_get_count(baseFiles);
+    for (int b = fileCount - 1; b >= 0; b--)
+    {
+        JSON_Object* baseFile = json_object(json_object_get_value_at(baseFiles, b));
+
+        // If file is in the instruction, merge their properties.
+        bool fileRequired = false;
+        int instFilesCount = json_array_get_count(instFiles);
+        for (int i = instFilesCount - 1; i >= 0; i--)
+        {
+            const char* baseFilename = json_object_get_string(baseFile, ADUCITF_FIELDNAME_FILENAME);
+
+            JSON_Object* instFile = json_array_get_object(instFiles, i);
+            const char* instFilename = json_object_get_string(instFile, ADUCITF_FIELDNAME_FILENAME);
+
+            if (baseFilename != NULL && instFilename != NULL && strcmp(baseFilename, instFilename) == 0)
+            {
+                // Found.
+                fileRequired = true;
+                int valuesCount = json_object_get_count(instFile);
+                for (int v = valuesCount - 1; v >= 0; v--)
+                {
+                    const char* key = json_object_get_name(instFile, v);
+                    JSON_Value* val = json_value_deep_copy(json_object_get_value_at(instFile, v));
+                    json_object_set_value(baseFile, key, val);
+                }
+                // Done with this file, remove it (and free).
+                json_array_remove(instFiles, i);
+                break;
+            }
+        }
+
+        // Remove file from base files list, if no longer needed.
+        if (!fileRequired)
+        {
+            json_object_remove(baseFiles, json_object_get_name(baseFiles, b));
+        }
+    }
+
+    if (!_workflow_copy_file_urls(updateActionObject, base, baseFiles))
+    {
+        Log_Error("Cannot copy instruction file urls.");
+        result.ExtendedResultCode = ADUC_ERC_NOMEM;
+        goto done;
+    }
+
+    wf->UpdateActionObject = updateActionObject;
+    wf->UpdateManifestObject = updateManifestObject;
+
+    {
+        char* baseWorkfolder = workflow_get_workfolder(base);
+        workflow_set_workfolder(wf, baseWorkfolder);
+        workflow_free_string(baseWorkfolder);
+    }
+
+    *handle = wf;
+    result.ResultCode = ADUC_GeneralResult_Success;
+    result.ExtendedResultCode = 0;
+
+done:
+    if (IsAducResultCodeFailure(result.ResultCode))
+    {
+        json_value_free(updateActionValue);
+        json_value_free(updateManifestValue);
+        workflow_free(wf);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Get update manifest instructions steps count.
+ *
+ * @param handle A workflow object handle.
+ *
+ * @return Total count of the update instruction steps.
+ */
+size_t workflow_get_instructions_steps_count(ADUC_WorkflowHandle handle)
+{
+    return json_array_get_count(workflow_get_instructions_steps_array(handle));
+}
+
+/**
+ * @brief Get a read-only update manifest step type
+ *
+ * @param handle A workflow object handle.
+ * @param stepIndex A step index.
+ *
+ * @return const char* Read-only step type string, or NULL if specified step or step 'type' property doesn't exist.
+ */
+const char* workflow_peek_step_type(ADUC_WorkflowHandle handle, size_t stepIndex)
+{
+    JSON_Object* step = json_array_get_object(workflow_get_instructions_steps_array(handle), stepIndex);
+    if (step == NULL)
     {
         return NULL;
     }
 
-    ADUC_WorkflowHandle child = wf->Children[index];
-
-    if (index < wf->ChildCount - 1)
+    const char* stepType = json_object_get_string(step, STEP_PROPERTY_FIELD_TYPE);
+    if (stepType == NULL)
     {
-        int bytes = sizeof(ADUC_Workflow*) * wf->ChildCount - (index + 1);
-        memmove(wf->Children + index, wf->Children + (index + 1), bytes);
+        return DEAULT_STEP_TYPE;
     }
 
-    wf->ChildCount--;
-
-    workflow_set_parent(child, NULL);
-    return child;
+    return stepType;
 }
 
-//
-// Workflow state.
-//
-ADUCITF_State workflow_get_root_state(ADUC_WorkflowHandle handle)
+/**
+ * @brief Get a read-only handlerProperties string value.
+ *
+ * @param handle A workflow object handle.
+ * @param propertyName
+ *
+ * @return A read-only string value of specified property in handlerProperties map.
+ */
+const char*
+workflow_peek_update_manifest_handler_properties_string(ADUC_WorkflowHandle handle, const char* propertyName)
 {
-    return workflow_get_state(workflow_get_root(handle));
+    const JSON_Object* manifest = _workflow_get_update_manifest(handle);
+    const JSON_Object* properties = json_object_get_object(manifest, STEP_PROPERTY_FIELD_HANDLER_PROPERTIES);
+    return json_object_get_string(properties, propertyName);
 }
 
-ADUCITF_State workflow_get_state(ADUC_WorkflowHandle handle)
+/**
+ * @brief Returns whether the specified step is an 'inline' step.
+ *
+ * @param handle A workflow object handle.
+ * @param stepIndex A step index.
+ *
+ * @return bool Return true if the specified step exists, and is inline step.
+ * Otherwise, return false.
+ *
+ */
+bool workflow_is_inline_step(ADUC_WorkflowHandle handle, size_t stepIndex)
 {
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf == NULL)
+    JSON_Object* step = json_array_get_object(workflow_get_instructions_steps_array(handle), stepIndex);
+    if (step == NULL)
     {
-        return ADUCITF_State_None;
+        return false;
     }
 
-    return wf->State;
-}
-
-// Save this workflow's state at the root.
-bool workflow_set_state(ADUC_WorkflowHandle handle, ADUCITF_State state)
-{
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf == NULL)
+    const char* stepType = json_object_get_string(step, STEP_PROPERTY_FIELD_TYPE);
+    if (stepType != NULL && strcmp(stepType, "reference") == 0)
     {
         return false;
     }
 
-    wf->State = state;
-
     return true;
 }
 
-void workflow_set_result_details(ADUC_WorkflowHandle handle, const char* format, ...)
+/**
+ * @brief
+ *
+ * @param handle A workflow object handle.
+ * @param stepIndex A step index.
+ * @return const char* Read-only step handler name, or NULL for a 'reference' step.
+ */
+const char* workflow_peek_update_manifest_step_handler(ADUC_WorkflowHandle handle, size_t stepIndex)
 {
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf == NULL)
-    {
-        return;
-    }
-
-    if (format == NULL)
+    JSON_Object* step = json_array_get_object(workflow_get_instructions_steps_array(handle), stepIndex);
+    if (step == NULL)
     {
-        STRING_empty(wf->ResultDetails);
+        return false;
     }
-    else
-    {
-        char buffer[WORKFLOW_RESULT_DETAILS_MAX_LENGTH];
-        va_list arg_list;
-        va_start(arg_list, format);
-        vsnprintf(buffer, WORKFLOW_RESULT_DETAILS_MAX_LENGTH, format, arg_list);
-        va_end(arg_list);
 
-        STRING_delete(wf->ResultDetails);
-        wf->ResultDetails = STRING_construct(buffer);
-    }
+    const char* stepHandler = json_object_get_string(step, STEP_PROPERTY_FIELD_HANDLER);
+    return stepHandler;
 }
 
-void workflow_set_installed_update_id(ADUC_WorkflowHandle handle, const char* installedUpdateId)
+/**
+ * @brief Gets a reference step update manifest file at specified index.
+ *
+ * @param handle A workflow data object handle.
+ * @param stepIndex A step index.
+ * @param entity An output reference step update manifest file entity object.
+ *               Caller must free the object with workflow_free_file_entity().
+ * @return true If succeeded.
+ */
+bool workflow_get_step_detached_manifest_file(ADUC_WorkflowHandle handle, size_t stepIndex, ADUC_FileEntity** entity)
 {
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf == NULL)
+    if (entity == NULL)
     {
-        return;
+        return false;
     }
 
-    if (installedUpdateId == NULL)
-    {
-        STRING_empty(wf->InstalledUpdateId);
-    }
-    else
+    size_t count = workflow_get_instructions_steps_count(handle);
+    if (stepIndex >= count)
     {
-        wf->InstalledUpdateId = STRING_construct(installedUpdateId);
+        return false;
     }
-}
 
-// The status either stored in the workflow object itself, or in root object.
-JSON_Object* _workflow_find_state(ADUC_WorkflowHandle handle, const char* workflowId)
-{
-    if (handle == NULL || workflowId == NULL || *workflowId == 0)
-    {
-        return NULL;
-    }
+    _Bool succeeded = false;
+    JSON_Object* step = json_array_get_object(workflow_get_instructions_steps_array(handle), stepIndex);
+    const char* fileId = json_object_get_string(step, STEP_PROPERTY_FIELD_DETACHED_MANIFEST_FILE_ID);
+    const JSON_Object* files = _workflow_get_update_manifest_files_map(handle);
+    const JSON_Object* file = json_object_get_object(files, fileId);
+    const JSON_Object* fileUrls = NULL;
+    const char* uri = NULL;
+    const char* name = NULL;
 
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf->ResultsObject != NULL && json_object_has_value(wf->ResultsObject, workflowId))
+    *entity = NULL;
+
+    // Find fileurls map in this workflow, and its enclosing workflow(s).
+    ADUC_WorkflowHandle h = handle;
+
+    do
     {
-        return json_object_get_object(wf->ResultsObject, workflowId);
-    }
+        if ((fileUrls = _workflow_get_fileurls_map(h)) == NULL)
+        {
+            Log_Warn("'fileUrls' property not found.");
+        }
+        else
+        {
+            uri = json_object_get_string(fileUrls, fileId);
+        }
+        h = workflow_get_parent(h);
+    } while (uri == NULL && h != NULL);
 
-    ADUC_Workflow* wfRoot = workflow_from_handle(workflow_get_root(handle));
-    if (wfRoot->ResultsObject != NULL && json_object_has_value(wfRoot->ResultsObject, workflowId))
+    if (uri == NULL)
     {
-        return json_object_get_object(wfRoot->ResultsObject, workflowId);
+        goto done;
     }
 
-    return NULL;
-}
+    name = json_object_get_string(file, ADUCITF_FIELDNAME_FILENAME);
+    const JSON_Object* hashObj = json_object_get_object(file, ADUCITF_FIELDNAME_HASHES);
 
-void workflow_set_result(ADUC_WorkflowHandle handle, ADUC_Result result)
-{
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf != NULL)
+    size_t tempHashCount = 0;
+    ADUC_Hash* tempHash = ADUC_HashArray_AllocAndInit(hashObj, &tempHashCount);
+    if (tempHash == NULL)
     {
-        wf->Result = result;
+        Log_Error("Unable to parse hashes for file @ %zu", stepIndex);
+        goto done;
     }
-}
 
-ADUC_Result workflow_get_result(ADUC_WorkflowHandle handle)
-{
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf == NULL)
+    size_t sizeInBytes = 0;
+    if (json_object_has_value(file, ADUCITF_FIELDNAME_SIZEINBYTES))
     {
-        ADUC_Result result = {};
-        return result;
+        sizeInBytes = json_object_get_number(file, ADUCITF_FIELDNAME_SIZEINBYTES);
     }
 
-    return wf->Result;
-}
-
-const char* workflow_peek_result_details(ADUC_WorkflowHandle handle)
-{
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf == NULL)
+    *entity = malloc(sizeof(**entity));
+    if (*entity == NULL)
     {
-        return NULL;
+        goto done;
     }
 
-    return STRING_c_str(wf->ResultDetails);
-}
-
-const char* workflow_peek_installed_update_id(ADUC_WorkflowHandle handle)
-{
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf == NULL)
+    if (!ADUC_FileEntity_Init(*entity, fileId, name, uri, NULL /*arguments*/, tempHash, tempHashCount, sizeInBytes))
     {
-        return NULL;
+        Log_Error("Invalid file entity arguments");
+        goto done;
     }
 
-    return STRING_c_str(wf->InstalledUpdateId);
-}
-
-void workflow_set_cancellation_type(ADUC_WorkflowHandle handle, ADUC_WorkflowCancellationType cancellationType)
-{
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf != NULL)
+    if (!ADUC_FileEntity_InitChunkHashes(*entity, file) || !ADUC_FileEntity_InitTransportEncoding(*entity, file)
+        || !workflow_init_alternate_uris(*entity, file))
     {
-        wf->CancellationType = cancellationType;
+        goto done;
     }
-}
 
-ADUC_WorkflowCancellationType workflow_get_cancellation_type(ADUC_WorkflowHandle handle)
-{
-    ADUC_WorkflowCancellationType result;
+    succeeded = true;
 
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf == NULL)
-    {
-        result = ADUC_WorkflowCancellationType_Normal;
-    }
-    else
+done:
+
+    if (!succeeded)
     {
-        result = wf->CancellationType;
+        if (*entity != NULL)
+        {
+            ADUC_FileEntity_Uninit(*entity);
+            free(*entity);
+            *entity = NULL;
+        }
     }
 
-    return result;
+    return succeeded;
 }
 
 /**
- * @brief sets both cancellation type to retry and retry timestamp.
- * @param handle the workflow handle
- * @param retryToken the retry token with which to update
- * @return true if succeeded.
+ * @brief Gets a serialized json string of the specified workflow's Update Manifest.
+ *
+ * @param handle A workflow data object handle.
+ * @param pretty Whether to format the output string.
+ * @return char* An output json string. Caller must free the string with workflow_free_string().
  */
-bool workflow_update_retry_deployment(ADUC_WorkflowHandle handle, const char* retryToken)
+char* workflow_get_serialized_update_manifest(ADUC_WorkflowHandle handle, bool pretty)
 {
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    bool result = false;
-
-    if (wf != NULL)
-    {
-        wf->CancellationType = ADUC_WorkflowCancellationType_Retry;
-        result = _workflow_set_retryTimestamp(handle, retryToken);
+    const JSON_Object* o = _workflow_get_update_manifest(handle);
+    if (pretty)
+    {
+        return json_serialize_to_string_pretty(json_object_get_wrapping_value(o));
     }
 
-    return result;
+    return json_serialize_to_string(json_object_get_wrapping_value(o));
 }
 
-/**
- * @brief if operation is in progress on the current workflow, it will set the next workflow as a deferred workflow on the current workflow and set cancellation type to Replacement.
- * @remark The caller must not free the next workflow handle when true is returned as it is owned by the current workflow as a deferred field. Conversely, if false is returned, then
- *             the caller must free the current workflow handle and set the next workflow handle as the current in the workflow data.
- * @param currentWorkflowHandle The workflow handle on the current workflow Data.
- * @param nextWorkflowHandle The workflow handle for the next workflow update deployment.
- * @return true if there was an operation in progress and the next workflow handle got deferred until workCompletionCallback processing.
- */
-bool workflow_update_replacement_deployment(
-    ADUC_WorkflowHandle currentWorkflowHandle, ADUC_WorkflowHandle nextWorkflowHandle)
-{
-    bool wasDeferred = false;
+//
+// Children snapshot
+//
+// The snapshot is a header followed by a payload of length-prefixed strings: the key of the workflow (id, update id
+// and selected components), then the id, work folder, selected components, Update Action and Update Manifest of each
+// child. A string is a uint32_t length, including the terminating NUL, followed by its bytes; a length of 0 is NULL.
+// The file is written and read on the same device, so the integers are in host byte order.
+//
 
-    ADUC_Workflow* currentWorkflow = workflow_from_handle(currentWorkflowHandle);
+#define WORKFLOW_SNAPSHOT_FILE_NAME ".steps.snapshot"
+#define WORKFLOW_SNAPSHOT_VERSION 1
 
-    if (currentWorkflow->OperationInProgress)
-    {
-        currentWorkflow->CancellationType = ADUC_WorkflowCancellationType_Replacement;
-        currentWorkflow->OperationCancelled = true;
-        currentWorkflow->DeferredReplacementWorkflow =
-            nextWorkflowHandle; // upon return, caller must release ownership as it's owned by current workflow now
-        wasDeferred = true;
-    }
+// 64-bit FNV-1a, as used for the digest of reported properties.
+#define WORKFLOW_SNAPSHOT_OFFSET_BASIS 14695981039346656037ULL
+#define WORKFLOW_SNAPSHOT_PRIME 1099511628211ULL
 
-    return wasDeferred;
-}
+static const char s_snapshotMagic[8] = { 'A', 'D', 'U', 'S', 'T', 'E', 'P', 'S' };
 
 /**
- * @brief Resets state for retry and replacement deployment processing.
- * @param wf The ADUC workflow state internal representation of a handle.
+ * @brief The header of a children snapshot file.
  */
-static void reset_state_for_processing_deployment(ADUC_Workflow* wf)
+typedef struct tagADUC_WorkflowSnapshotHeader
 {
-    wf->CurrentWorkflowStep = ADUCITF_WorkflowStep_ProcessDeployment;
-    wf->OperationInProgress = false;
-    wf->OperationCancelled = false;
-    wf->CancellationType = ADUC_WorkflowCancellationType_None;
-}
+    char Magic[8]; /**< s_snapshotMagic. */
+    uint32_t Version; /**< WORKFLOW_SNAPSHOT_VERSION. */
+    uint32_t ChildCount; /**< The count of children in the payload. */
+    uint64_t PayloadSize; /**< The size of the payload that follows the header. */
+    uint64_t Checksum; /**< The FNV-1a digest of the payload. */
+} ADUC_WorkflowSnapshotHeader;
 
 /**
- * @brief Resets state to process the deferred workflow deployment, which is also transferred to the current.
- * @param handle The workflow handle on the current workflow Data.
+ * @brief A growing buffer of snapshot payload.
  */
-void workflow_update_for_replacement(ADUC_WorkflowHandle handle)
+typedef struct tagADUC_WorkflowSnapshotBuffer
 {
-    ADUC_Workflow* wf = workflow_from_handle(handle);
+    char* Data; /**< The bytes. */
+    size_t Size; /**< The count of bytes used. */
+    size_t Capacity; /**< The count of bytes allocated. */
+} ADUC_WorkflowSnapshotBuffer;
 
-    ADUC_Workflow* deferred = wf->DeferredReplacementWorkflow;
-    wf->DeferredReplacementWorkflow = NULL;
-    workflow_transfer_data(handle /* wfTarget */, deferred /* wfSource */);
-
-    reset_state_for_processing_deployment(wf);
-}
-
-/**
- * @brief Resets state to reprocess the current workflow deployment.
- * @param handle The workflow handle on the current workflow Data.
- */
-void workflow_update_for_retry(ADUC_WorkflowHandle handle)
+static uint64_t _workflow_snapshot_checksum(const char* data, size_t size)
 {
-    ADUC_Workflow* wf = workflow_from_handle(handle);
+    uint64_t digest = WORKFLOW_SNAPSHOT_OFFSET_BASIS;
+    for (size_t i = 0; i < size; i++)
+    {
+        digest = (digest ^ (unsigned char)data[i]) * WORKFLOW_SNAPSHOT_PRIME;
+    }
 
-    reset_state_for_processing_deployment(wf);
+    return digest;
 }
 
-// If succeeded, free existing install state data and replace with a new one.
-// If failed, no changes to the handle.
-bool workflow_read_state_from_file(ADUC_WorkflowHandle handle, const char* stateFilename)
+static bool _workflow_snapshot_append(ADUC_WorkflowSnapshotBuffer* buffer, const void* data, size_t size)
 {
-    if (handle == NULL || stateFilename == NULL || *stateFilename == 0)
+    if (buffer->Capacity - buffer->Size < size)
     {
-        return false;
-    }
+        size_t capacity = buffer->Capacity == 0 ? 4096 : buffer->Capacity;
+        while (capacity - buffer->Size < size)
+        {
+            capacity *= 2;
+        }
 
-    JSON_Value* rootValue = json_parse_file(stateFilename);
-    if (rootValue == NULL)
-    {
-        return 0;
-    }
+        char* newData = realloc(buffer->Data, capacity);
+        if (newData == NULL)
+        {
+            return false;
+        }
 
-    ADUC_Workflow* wf = workflow_from_handle(handle);
-    if (wf->ResultsObject != NULL)
-    {
-        json_value_free(json_object_get_wrapping_value(wf->ResultsObject));
+        buffer->Data = newData;
+        buffer->Capacity = capacity;
     }
 
-    wf->ResultsObject = json_value_get_object(rootValue);
+    memcpy(buffer->Data + buffer->Size, data, size);
+    buffer->Size += size;
     return true;
 }
 
-bool workflow_is_cancel_requested(ADUC_WorkflowHandle handle)
+static bool _workflow_snapshot_append_string(ADUC_WorkflowSnapshotBuffer* buffer, const char* value)
 {
-    return workflow_get_boolean_property(workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_CANCEL_REQUESTED);
-}
+    size_t length = value == NULL ? 0 : strlen(value) + 1;
+    if (length > UINT32_MAX)
+    {
+        return false;
+    }
 
-bool workflow_is_agent_restart_requested(ADUC_WorkflowHandle handle)
-{
-    return workflow_get_boolean_property(workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_AGENT_RESTART_REQUESTED);
+    uint32_t prefix = (uint32_t)length;
+    return _workflow_snapshot_append(buffer, &prefix, sizeof(prefix))
+        && (length == 0 || _workflow_snapshot_append(buffer, value, length));
 }
 
-bool workflow_is_immediate_agent_restart_requested(ADUC_WorkflowHandle handle)
+/**
+ * @brief Reads a string of the payload in place.
+ *
+ * @param cursor The position in the payload, moved past the string.
+ * @param end The end of the payload.
+ * @param value An output string, pointing into the payload, or NULL.
+ * @return false If the payload is truncated.
+ */
+static bool _workflow_snapshot_read_string(const char** cursor, const char* end, const char** value)
 {
-    return workflow_get_boolean_property(
-        workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_IMMEDIATE_AGENT_RESTART_REQUESTED);
-}
+    uint32_t length = 0;
+    if ((size_t)(end - *cursor) < sizeof(length))
+    {
+        return false;
+    }
 
-bool workflow_is_reboot_requested(ADUC_WorkflowHandle handle)
-{
-    return workflow_get_boolean_property(workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_REBOOT_REQUESTED);
-}
+    memcpy(&length, *cursor, sizeof(length));
+    *cursor += sizeof(length);
 
-bool workflow_is_immediate_reboot_requested(ADUC_WorkflowHandle handle)
-{
-    return workflow_get_boolean_property(
-        workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_IMMEDIATE_REBOOT_REQUESTED);
-}
+    if (length == 0)
+    {
+        *value = NULL;
+        return true;
+    }
 
-bool workflow_request_reboot(ADUC_WorkflowHandle handle)
-{
-    return workflow_set_boolean_property(workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_REBOOT_REQUESTED, true);
+    if ((size_t)(end - *cursor) < length || (*cursor)[length - 1] != '\0')
+    {
+        return false;
+    }
+
+    *value = *cursor;
+    *cursor += length;
+    return true;
 }
 
-bool workflow_request_immediate_reboot(ADUC_WorkflowHandle handle)
+static bool _workflow_snapshot_string_equals(const char* a, const char* b)
 {
-    return workflow_set_boolean_property(
-        workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_IMMEDIATE_REBOOT_REQUESTED, true);
+    return (a == NULL || b == NULL) ? a == b : strcmp(a, b) == 0;
 }
 
-bool workflow_request_agent_restart(ADUC_WorkflowHandle handle)
+static char* _workflow_snapshot_path(ADUC_WorkflowHandle handle)
 {
-    return workflow_set_boolean_property(
-        workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_AGENT_RESTART_REQUESTED, true);
+    const char* workFolder = workflow_peek_workfolder(handle);
+    return workFolder == NULL ? NULL : ADUC_StringFormat("%s/%s", workFolder, WORKFLOW_SNAPSHOT_FILE_NAME);
 }
 
-bool workflow_request_immediate_agent_restart(ADUC_WorkflowHandle handle)
+static char* _workflow_snapshot_serialize_object(const JSON_Object* object)
 {
-    return workflow_set_boolean_property(
-        workflow_get_root(handle), WORKFLOW_PROPERTY_FIELD_IMMEDIATE_AGENT_RESTART_REQUESTED, true);
+    return object == NULL ? NULL : json_serialize_to_string(json_object_get_wrapping_value(object));
 }
 
 /**
- * @brief Compare id of @p handle0 and @p handle1
+ * @brief Maps a snapshot file that the agent wrote itself, and checks that it is intact.
  *
- * @param handle0
- * @param handle1
- * @return 0 if ids are equal.
+ * @param path The path of the file.
+ * @param header The output header of the file.
+ * @param map The output mapping of the whole file, header included, to unmap with munmap. MAP_FAILED on failure.
+ * @param mapSize The output size of @p map.
+ * @return false If the file can't be read, or is invalid.
  */
-int workflow_id_compare(ADUC_WorkflowHandle handle0, ADUC_WorkflowHandle handle1)
+static bool _workflow_snapshot_map(const char* path, ADUC_WorkflowSnapshotHeader* header, void** map, size_t* mapSize)
 {
-    char* id0 = workflow_get_id(handle0);
-    char* id1 = workflow_get_id(handle1);
-    int result = -1;
+    struct stat st;
+    bool succeeded = false;
 
-    if (id0 == NULL || id1 == NULL)
+    *map = MAP_FAILED;
+
+    const int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
     {
-        Log_Error("Missing workflow id (id0:%s, id1:%s)", id0, id1);
-        goto done;
+        return false;
     }
 
-    result = strcmp(id0, id1);
-
-done:
-    workflow_free_string(id0);
-    workflow_free_string(id1);
-    return result;
-}
-
-/**
- * @brief Create a new workflow data handler using base workflow and serialized 'instruction' json string.
- * Note: The 'workfolder' of the returned workflow data object will be the same as the base's.
- *
- * @param base The base workflow containing valid Update Action and Manifest.
- * @param instruction A serialized json string containing single 'installItem' from an instruction file.
- * @param handle An output workflow handle.
- * @return ADUC_Result
- */
-ADUC_Result
-workflow_create_from_instruction(ADUC_WorkflowHandle base, const char* instruction, ADUC_WorkflowHandle* handle)
-{
-    ADUC_Result result;
-
-    // Parse instruction json.
-    JSON_Value* instructionValue = json_parse_string(instruction);
-    if (instructionValue == NULL)
+    // Only a file the agent wrote itself is trusted to skip the verification of the steps.
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+        || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0 || (size_t)st.st_size < sizeof(*header))
     {
-        Log_Error("Invalid intruction entry.");
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_PARSE_INSTRUCTION_ENTRY_FAILURE;
         goto done;
     }
 
-    result = workflow_create_from_instruction_value(base, instructionValue, handle);
-
-done:
-    json_value_free(instructionValue);
-    return result;
-}
-
-/**
- * @brief Create a new workflow data handler using base workflow and serialized 'instruction' json string.
- * Note: The 'workfolder' of the returned workflow data object will be the same as the base's.
- *
- * @param base The base workflow containing valid Update Action and Manifest.
- * @param instruction A JSON_Value object contain install-item data.
- * @param handle An output workflow handle.
- * @return ADUC_Result
- */
-ADUC_Result
-workflow_create_from_instruction_value(ADUC_WorkflowHandle base, JSON_Value* instruction, ADUC_WorkflowHandle* handle)
-{
-    ADUC_Result result = { ADUC_GeneralResult_Failure };
-    JSON_Status jsonStatus = JSONFailure;
-    JSON_Value* updateActionValue = NULL;
-    JSON_Value* updateManifestValue = NULL;
-    ADUC_Workflow* wf = NULL;
-
-    if (base == NULL || instruction == NULL || handle == NULL)
+    *mapSize = (size_t)st.st_size;
+    *map = mmap(NULL, *mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (*map == MAP_FAILED)
     {
         goto done;
     }
 
-    *handle = NULL;
+    memcpy(header, *map, sizeof(*header));
 
-    ADUC_Workflow* wfBase = workflow_from_handle(base);
+    const char* payload = (const char*)*map + sizeof(*header);
+    const size_t payloadSize = *mapSize - sizeof(*header);
 
-    wf = malloc(sizeof(*wf));
-    if (wf == NULL)
+    if (memcmp(header->Magic, s_snapshotMagic, sizeof(header->Magic)) != 0
+        || header->Version != WORKFLOW_SNAPSHOT_VERSION || header->PayloadSize != (uint64_t)payloadSize
+        || header->Checksum != _workflow_snapshot_checksum(payload, payloadSize))
     {
-        result.ExtendedResultCode = ADUC_ERC_NOMEM;
+        Log_Warn("Ignoring invalid step snapshot %s", path);
+        munmap(*map, *mapSize);
+        *map = MAP_FAILED;
         goto done;
     }
 
-    memset(wf, 0, sizeof(*wf));
+    succeeded = true;
 
-    updateActionValue = json_value_deep_copy(json_object_get_wrapping_value(wfBase->UpdateActionObject));
-    if (updateActionValue == NULL)
-    {
-        Log_Error("Cannot copy Update Action json from base");
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_FROM_BASE_FAILURE;
-        goto done;
-    }
+done:
+    close(fd);
+    return succeeded;
+}
 
-    JSON_Object* updateActionObject = json_object(updateActionValue);
+bool workflow_save_children_snapshot(ADUC_WorkflowHandle handle)
+{
+    bool succeeded = false;
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    ADUC_WorkflowSnapshotBuffer payload = { NULL, 0, 0 };
+    ADUC_WorkflowSnapshotHeader header;
+    char* updateId = NULL;
+    char* snapshotPath = NULL;
+    char* tempPath = NULL;
+    FILE* file = NULL;
 
-    updateManifestValue = json_value_deep_copy(json_object_get_wrapping_value(wfBase->UpdateManifestObject));
-    if (updateManifestValue == NULL)
+    if (wf == NULL || wf->Parent != NULL || wf->ChildCount == 0 || wf->ChildCount > UINT32_MAX)
     {
-        Log_Error("Cannot copy Update Manifest json from base");
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_FROM_BASE_FAILURE;
         goto done;
     }
 
-    JSON_Object* updateManifestObject = json_object(updateManifestValue);
-    JSON_Object* instructionObject = json_object(instruction);
-
-    char* currentInstructionData = json_serialize_to_string_pretty(instruction);
-    Log_Debug("Processing current instruction:\n%s", currentInstructionData);
-    json_free_serialized_string(currentInstructionData);
-
-    // Replace 'updateType'.
-    const char* updateType = json_object_get_string(instructionObject, ADUCITF_FIELDNAME_UPDATETYPE);
-    if (updateType == NULL || *updateType == 0)
-    {
-        Log_Error("Invalid instruction entry.");
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_PARSE_INSTRUCTION_ENTRY_NO_UPDATE_TYPE;
-        goto done;
-    }
-    jsonStatus = json_object_set_string(updateManifestObject, ADUCITF_FIELDNAME_UPDATETYPE, updateType);
-    if (jsonStatus == JSONFailure)
+    updateId = workflow_get_expected_update_id_string(handle);
+    if (!_workflow_snapshot_append_string(&payload, workflow_peek_id(handle))
+        || !_workflow_snapshot_append_string(&payload, updateId)
+        || !_workflow_snapshot_append_string(&payload, workflow_peek_selected_components(handle)))
     {
-        Log_Error("Cannot update instruction entry updateType.");
-        result.ExtendedResultCode = ADUC_ERC_UTILITIES_WORKFLOW_UTIL_COPY_UPDATE_ACTION_SET_UPDATE_TYPE_FAILURE;
         goto done;
     }
 
-    // Keep only file needed by this entry. Remove the rest.
-    JSON_Array* instFiles = json_object_get_array(instructionObject, ADUCITF_FIELDNAME_FILES);
-    JSON_Object* baseFiles = json_object_get_object(updateManifestObject, ADUCITF_FIELDNAME_FILES);
-    int fileCount = json_object_get_count(baseFiles);
-    for (int b = fileCount - 1; b >= 0; b--)
+    for (size_t i = 0; i < wf->ChildCount; i++)
     {
-        JSON_Object* baseFile = json_object(json_object_get_value_at(baseFiles, b));
-
-        // If file is in the instruction, merge their properties.
-        bool fileRequired = false;
-        int instFilesCount = json_array_get_count(instFiles);
-        for (int i = instFilesCount - 1; i >= 0; i--)
-        {
-            const char* baseFilename = json_object_get_string(baseFile, ADUCITF_FIELDNAME_FILENAME);
+        ADUC_Workflow* child = workflow_from_handle(wf->Children[i]);
+        char* updateAction = _workflow_snapshot_serialize_object(child->UpdateActionObject);
+        char* updateManifest = _workflow_snapshot_serialize_object(child->UpdateManifestObject);
 
-            JSON_Object* instFile = json_array_get_object(instFiles, i);
-            const char* instFilename = json_object_get_string(instFile, ADUCITF_FIELDNAME_FILENAME);
+        bool appended = updateAction != NULL && updateManifest != NULL
+            && _workflow_snapshot_append_string(&payload, workflow_peek_id(child))
+            && _workflow_snapshot_append_string(&payload, child->WorkFolder)
+            && _workflow_snapshot_append_string(&payload, workflow_peek_selected_components(child))
+            && _workflow_snapshot_append_string(&payload, updateAction)
+            && _workflow_snapshot_append_string(&payload, updateManifest);
 
-            if (baseFilename != NULL && instFilename != NULL && strcmp(baseFilename, instFilename) == 0)
-            {
-                // Found.
-                fileRequired = true;
-                int valuesCount = json_object_get_count(instFile);
-                for (int v = valuesCount - 1; v >= 0; v--)
-                {
-                    const char* key = json_object_get_name(instFile, v);
-                    JSON_Value* val = json_value_deep_copy(json_object_get_value_at(instFile, v));
-                    json_object_set_value(baseFile, key, val);
-                }
-                // Done with this file, remove it (and free).
-                json_array_remove(instFiles, i);
-                break;
-            }
-        }
+        json_free_serialized_string(updateAction);
+        json_free_serialized_string(updateManifest);
 
-        // Remove file from base files list, if no longer needed.
-        if (!fileRequired)
+        if (!appended)
         {
-            json_object_remove(baseFiles, json_object_get_name(baseFiles, b));
+            goto done;
         }
     }
 
-    wf->UpdateActionObject = updateActionObject;
-    wf->UpdateManifestObject = updateManifestObject;
-
+    memcpy(header.Magic, s_snapshotMagic, sizeof(header.Magic));
+    header.Version = WORKFLOW_SNAPSHOT_VERSION;
+    header.ChildCount = (uint32_t)wf->ChildCount;
+    header.PayloadSize = payload.Size;
+    header.Checksum = _workflow_snapshot_checksum(payload.Data, payload.Size);
+
+    snapshotPath = _workflow_snapshot_path(handle);
+    tempPath = snapshotPath == NULL ? NULL : ADUC_StringFormat("%s.tmp", snapshotPath);
+    if (tempPath == NULL)
+    {
+        goto done;
+    }
+
+    file = fopen(tempPath, "wb");
+    if (file == NULL)
     {
-        char* baseWorkfolder = workflow_get_workfolder(base);
-        workflow_set_workfolder(wf, baseWorkfolder);
-        workflow_free_string(baseWorkfolder);
+        Log_Debug("Cannot write step snapshot %s, errno: %d", tempPath, errno);
+        goto done;
     }
 
-    *handle = wf;
-    result.ResultCode = ADUC_GeneralResult_Success;
-    result.ExtendedResultCode = 0;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(payload.Data, 1, payload.Size, file) == payload.Size;
 
-done:
-    if (IsAducResultCodeFailure(result.ResultCode))
+    if (fclose(file) != 0 || !written || chmod(tempPath, S_IRUSR | S_IWUSR) != 0 || rename(tempPath, snapshotPath) != 0)
     {
-        json_value_free(updateActionValue);
-        json_value_free(updateManifestValue);
-        workflow_free(wf);
+        Log_Debug("Cannot replace step snapshot %s, errno: %d", snapshotPath, errno);
+        remove(tempPath);
+        goto done;
     }
 
-    return result;
-}
+    succeeded = true;
 
-/**
- * @brief Get update manifest instructions steps count.
- *
- * @param handle A workflow object handle.
- *
- * @return Total count of the update instruction steps.
- */
-size_t workflow_get_instructions_steps_count(ADUC_WorkflowHandle handle)
-{
-    return json_array_get_count(workflow_get_instructions_steps_array(handle));
+done:
+    free(payload.Data);
+    workflow_free_string(updateId);
+    free(snapshotPath);
+    free(tempPath);
+
+    return succeeded;
 }
 
 /**
- * @brief Get a read-only update manifest step type
- *
- * @param handle A workflow object handle.
- * @param stepIndex A step index.
+ * @brief Creates a child workflow from the strings of a snapshot.
  *
- * @return const char* Read-only step type string, or NULL if specified step or step 'type' property doesn't exist.
+ * @return ADUC_WorkflowHandle The child, or NULL on failure.
  */
-const char* workflow_peek_step_type(ADUC_WorkflowHandle handle, size_t stepIndex)
+static ADUC_WorkflowHandle _workflow_create_from_snapshot(
+    const char* id,
+    const char* workFolder,
+    const char* selectedComponents,
+    const char* updateActionJson,
+    const char* updateManifestJson)
 {
-    JSON_Object* step = json_array_get_object(workflow_get_instructions_steps_array(handle), stepIndex);
-    if (step == NULL)
+    ADUC_WorkflowHandle handle = NULL;
+    JSON_Value* updateActionValue = NULL;
+    JSON_Value* updateManifestValue = NULL;
+
+    if (updateActionJson == NULL || updateManifestJson == NULL)
     {
         return NULL;
     }
 
-    const char* stepType = json_object_get_string(step, STEP_PROPERTY_FIELD_TYPE);
-    if (stepType == NULL)
+    updateActionValue = json_parse_string(updateActionJson);
+    updateManifestValue = json_parse_string(updateManifestJson);
+    if (json_value_get_type(updateActionValue) != JSONObject || json_value_get_type(updateManifestValue) != JSONObject)
     {
-        return DEAULT_STEP_TYPE;
+        json_value_free(updateActionValue);
+        json_value_free(updateManifestValue);
+        return NULL;
     }
 
-    return stepType;
-}
+    ADUC_Workflow* wf = malloc(sizeof(*wf));
+    if (wf == NULL)
+    {
+        json_value_free(updateActionValue);
+        json_value_free(updateManifestValue);
+        return NULL;
+    }
 
-/**
- * @brief Get a read-only handlerProperties string value.
- *
- * @param handle A workflow object handle.
- * @param propertyName
- *
- * @return A read-only string value of specified property in handlerProperties map.
- */
-const char*
-workflow_peek_update_manifest_handler_properties_string(ADUC_WorkflowHandle handle, const char* propertyName)
-{
-    const JSON_Object* manifest = _workflow_get_update_manifest(handle);
-    const JSON_Object* properties = json_object_get_object(manifest, STEP_PROPERTY_FIELD_HANDLER_PROPERTIES);
-    return json_object_get_string(properties, propertyName);
-}
+    memset(wf, 0, sizeof(*wf));
+    wf->UpdateActionObject = json_object(updateActionValue);
+    wf->UpdateManifestObject = json_object(updateManifestValue);
+    handle = wf;
 
-/**
- * @brief Returns whether the specified step is an 'inline' step.
- *
- * @param handle A workflow object handle.
- * @param stepIndex A step index.
- *
- * @return bool Return true if the specified step exists, and is inline step.
- * Otherwise, return false.
- *
- */
-bool workflow_is_inline_step(ADUC_WorkflowHandle handle, size_t stepIndex)
-{
-    JSON_Object* step = json_array_get_object(workflow_get_instructions_steps_array(handle), stepIndex);
-    if (step == NULL)
+    // Frees the workflow on failure.
+    if (IsAducResultCodeFailure(_workflow_init_helper(&handle).ResultCode))
     {
-        return false;
+        return NULL;
     }
 
-    const char* stepType = json_object_get_string(step, STEP_PROPERTY_FIELD_TYPE);
-    if (stepType != NULL && strcmp(stepType, "reference") == 0)
+    if ((id != NULL && !workflow_set_id(handle, id))
+        || (workFolder != NULL && !workflow_set_workfolder(handle, "%s", workFolder))
+        || (selectedComponents != NULL && !workflow_set_selected_components(handle, selectedComponents)))
     {
-        return false;
+        workflow_free(handle);
+        return NULL;
     }
 
-    return true;
+    return handle;
 }
 
-/**
- * @brief
- *
- * @param handle A workflow object handle.
- * @param stepIndex A step index.
- * @return const char* Read-only step handler name, or NULL for a 'reference' step.
- */
-const char* workflow_peek_update_manifest_step_handler(ADUC_WorkflowHandle handle, size_t stepIndex)
+bool workflow_restore_children_snapshot(ADUC_WorkflowHandle handle)
 {
-    JSON_Object* step = json_array_get_object(workflow_get_instructions_steps_array(handle), stepIndex);
-    if (step == NULL)
+    bool succeeded = false;
+    ADUC_Workflow* wf = workflow_from_handle(handle);
+    ADUC_WorkflowSnapshotHeader header;
+    char* snapshotPath = NULL;
+    char* updateId = NULL;
+    void* map = MAP_FAILED;
+    size_t mapSize = 0;
+
+    if (wf == NULL || wf->Parent != NULL || wf->ChildCount != 0)
     {
         return false;
     }
 
-    const char* stepHandler = json_object_get_string(step, STEP_PROPERTY_FIELD_HANDLER);
-    return stepHandler;
-}
+    snapshotPath = _workflow_snapshot_path(handle);
+    if (snapshotPath == NULL || !_workflow_snapshot_map(snapshotPath, &header, &map, &mapSize))
+    {
+        goto done;
+    }
 
-/**
- * @brief Gets a reference step update manifest file at specified index.
- *
- * @param handle A workflow data object handle.
- * @param stepIndex A step index.
- * @param entity An output reference step update manifest file entity object.
- *               Caller must free the object with workflow_free_file_entity().
- * @return true If succeeded.
- */
-bool workflow_get_step_detached_manifest_file(ADUC_WorkflowHandle handle, size_t stepIndex, ADUC_FileEntity** entity)
-{
-    if (entity == NULL)
+    const char* cursor = (const char*)map + sizeof(header);
+    const char* end = (const char*)map + mapSize;
+    const char* id = NULL;
+    const char* snapshotUpdateId = NULL;
+    const char* selectedComponents = NULL;
+
+    updateId = workflow_get_expected_update_id_string(handle);
+    if (!_workflow_snapshot_read_string(&cursor, end, &id)
+        || !_workflow_snapshot_read_string(&cursor, end, &snapshotUpdateId)
+        || !_workflow_snapshot_read_string(&cursor, end, &selectedComponents))
     {
-        return false;
+        goto done;
     }
 
-    size_t count = workflow_get_instructions_steps_count(handle);
-    if (stepIndex >= count)
+    if (!_workflow_snapshot_string_equals(id, workflow_peek_id(handle))
+        || !_workflow_snapshot_string_equals(snapshotUpdateId, updateId)
+        || !_workflow_snapshot_string_equals(selectedComponents, workflow_peek_selected_components(handle)))
     {
-        return false;
+        Log_Debug("Step snapshot %s is of another workflow.", snapshotPath);
+        goto done;
     }
 
-    _Bool succeeded = false;
-    JSON_Object* step = json_array_get_object(workflow_get_instructions_steps_array(handle), stepIndex);
-    const char* fileId = json_object_get_string(step, STEP_PROPERTY_FIELD_DETACHED_MANIFEST_FILE_ID);
-    const JSON_Object* files = _workflow_get_update_manifest_files_map(handle);
-    const JSON_Object* file = json_object_get_object(files, fileId);
-    const JSON_Object* fileUrls = NULL;
-    const char* uri = NULL;
-    const char* name = NULL;
+    if (!workflow_reserve_children(handle, header.ChildCount))
+    {
+        goto done;
+    }
 
-    *entity = NULL;
+    for (uint32_t i = 0; i < header.ChildCount; i++)
+    {
+        const char* childId = NULL;
+        const char* workFolder = NULL;
+        const char* childSelectedComponents = NULL;
+        const char* updateAction = NULL;
+        const char* updateManifest = NULL;
 
-    // Find fileurls map in this workflow, and its enclosing workflow(s).
-    ADUC_WorkflowHandle h = handle;
+        if (!_workflow_snapshot_read_string(&cursor, end, &childId)
+            || !_workflow_snapshot_read_string(&cursor, end, &workFolder)
+            || !_workflow_snapshot_read_string(&cursor, end, &childSelectedComponents)
+            || !_workflow_snapshot_read_string(&cursor, end, &updateAction)
+            || !_workflow_snapshot_read_string(&cursor, end, &updateManifest))
+        {
+            goto done;
+        }
 
-    do
-    {
-        if ((fileUrls = _workflow_get_fileurls_map(h)) == NULL)
+        ADUC_WorkflowHandle child =
+            _workflow_create_from_snapshot(childId, workFolder, childSelectedComponents, updateAction, updateManifest);
+        if (child == NULL)
         {
-            Log_Warn("'fileUrls' property not found.");
+            goto done;
         }
-        else
+
+        if (!workflow_insert_child(handle, -1, child))
         {
-            uri = json_object_get_string(fileUrls, fileId);
+            workflow_free(child);
+            goto done;
         }
-        h = workflow_get_parent(h);
-    } while (uri == NULL && h != NULL);
+    }
 
-    if (uri == NULL)
+    succeeded = cursor == end;
+
+done:
+    if (!succeeded && wf->ChildCount != 0)
     {
-        goto done;
+        Log_Warn("Cannot restore step snapshot %s", snapshotPath);
+        while (wf->ChildCount > 0)
+        {
+            workflow_free(workflow_remove_child(handle, -1));
+        }
     }
 
-    name = json_object_get_string(file, ADUCITF_FIELDNAME_FILENAME);
-    const JSON_Object* hashObj = json_object_get_object(file, ADUCITF_FIELDNAME_HASHES);
+    if (map != MAP_FAILED)
+    {
+        munmap(map, mapSize);
+    }
 
-    size_t tempHashCount = 0;
-    ADUC_Hash* tempHash = ADUC_HashArray_AllocAndInit(hashObj, &tempHashCount);
-    if (tempHash == NULL)
+    free(snapshotPath);
+    workflow_free_string(updateId);
+
+    return succeeded;
+}
+
+//
+// Spilled workflows
+//
+// workflow_spill writes the Update Action and Update Manifest of a step workflow to a file in the snapshot format,
+// with one child and these two strings as its payload, and frees them. workflow_from_handle reads them back on the
+// next access to the workflow, so the handles of spilled workflows stay valid.
+//
+
+#define WORKFLOW_SPILL_FILE_TEMPLATE "%s/.step.spill.XXXXXX"
+
+/**
+ * @brief Guards reading spilled workflows back, in case several threads access one at the same time.
+ */
+static pthread_mutex_t s_spillMutex = PTHREAD_MUTEX_INITIALIZER;
+
+bool workflow_spill(ADUC_WorkflowHandle handle)
+{
+    bool succeeded = false;
+    ADUC_Workflow* wf = (ADUC_Workflow*)(handle);
+    ADUC_WorkflowSnapshotBuffer payload = { NULL, 0, 0 };
+    ADUC_WorkflowSnapshotHeader header;
+    char* updateAction = NULL;
+    char* updateManifest = NULL;
+    char* spillPath = NULL;
+    int fd = -1;
+
+    if (wf == NULL || wf->Parent == NULL || wf->ChildCount != 0)
+    {
+        return false;
+    }
+
+    if (__atomic_load_n(&wf->SpillPath, __ATOMIC_ACQUIRE) != NULL)
+    {
+        return true;
+    }
+
+    updateAction = _workflow_snapshot_serialize_object(wf->UpdateActionObject);
+    updateManifest = _workflow_snapshot_serialize_object(wf->UpdateManifestObject);
+    if (updateAction == NULL || updateManifest == NULL || !_workflow_snapshot_append_string(&payload, updateAction)
+        || !_workflow_snapshot_append_string(&payload, updateManifest))
     {
-        Log_Error("Unable to parse hashes for file @ %zu", stepIndex);
         goto done;
     }
 
-    size_t sizeInBytes = 0;
-    if (json_object_has_value(file, ADUCITF_FIELDNAME_SIZEINBYTES))
+    memcpy(header.Magic, s_snapshotMagic, sizeof(header.Magic));
+    header.Version = WORKFLOW_SNAPSHOT_VERSION;
+    header.ChildCount = 1;
+    header.PayloadSize = payload.Size;
+    header.Checksum = _workflow_snapshot_checksum(payload.Data, payload.Size);
+
+    spillPath = ADUC_StringFormat(WORKFLOW_SPILL_FILE_TEMPLATE, workflow_peek_workfolder(wf->Parent));
+    if (spillPath == NULL)
     {
-        sizeInBytes = json_object_get_number(file, ADUCITF_FIELDNAME_SIZEINBYTES);
+        goto done;
     }
 
-    *entity = malloc(sizeof(**entity));
-    if (*entity == NULL)
+    fd = mkstemp(spillPath);
+    if (fd < 0)
     {
+        Log_Debug("Cannot spill step workflow to %s, errno: %d", spillPath, errno);
         goto done;
     }
 
-    if (!ADUC_FileEntity_Init(*entity, fileId, name, uri, NULL /*arguments*/, tempHash, tempHashCount, sizeInBytes))
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) != 0 || write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)
+        || write(fd, payload.Data, payload.Size) != (ssize_t)payload.Size)
     {
-        Log_Error("Invalid file entity arguments");
+        Log_Debug("Cannot write spilled step workflow %s, errno: %d", spillPath, errno);
+        (void)remove(spillPath);
         goto done;
     }
 
+    _workflow_free_updateaction(handle);
+    _workflow_free_updatemanifest(handle);
+    __atomic_store_n(&wf->SpillPath, spillPath, __ATOMIC_RELEASE);
+    spillPath = NULL;
+
     succeeded = true;
 
 done:
-
-    if (!succeeded)
+    if (fd >= 0)
     {
-        if (*entity != NULL)
-        {
-            ADUC_FileEntity_Uninit(*entity);
-            free(*entity);
-            *entity = NULL;
-        }
+        close(fd);
     }
 
+    free(spillPath);
+    free(payload.Data);
+    json_free_serialized_string(updateAction);
+    json_free_serialized_string(updateManifest);
+
     return succeeded;
 }
 
+bool workflow_is_spilled(ADUC_WorkflowHandle handle)
+{
+    const ADUC_Workflow* wf = (const ADUC_Workflow*)(handle);
+    return wf != NULL && __atomic_load_n(&wf->SpillPath, __ATOMIC_ACQUIRE) != NULL;
+}
+
 /**
- * @brief Gets a serialized json string of the specified workflow's Update Manifest.
- *
- * @param handle A workflow data object handle.
- * @param pretty Whether to format the output string.
- * @return char* An output json string. Caller must free the string with workflow_free_string().
+ * @brief Reads the Update Action and Update Manifest of the spilled workflow @p wf back, and removes its file.
+ * On failure, the workflow is left without them, as if it had none.
  */
-char* workflow_get_serialized_update_manifest(ADUC_WorkflowHandle handle, bool pretty)
+static void _workflow_load_spilled(ADUC_Workflow* wf)
 {
-    const JSON_Object* o = _workflow_get_update_manifest(handle);
-    if (pretty)
+    ADUC_WorkflowSnapshotHeader header;
+    void* map = MAP_FAILED;
+    size_t mapSize = 0;
+    JSON_Value* updateActionValue = NULL;
+    JSON_Value* updateManifestValue = NULL;
+
+    pthread_mutex_lock(&s_spillMutex);
+
+    char* spillPath = wf->SpillPath;
+    if (spillPath == NULL)
     {
-        return json_serialize_to_string_pretty(json_object_get_wrapping_value(o));
+        // Another thread read it back.
+        goto done;
     }
 
-    return json_serialize_to_string(json_object_get_wrapping_value(o));
+    if (_workflow_snapshot_map(spillPath, &header, &map, &mapSize))
+    {
+        const char* cursor = (const char*)map + sizeof(header);
+        const char* end = (const char*)map + mapSize;
+        const char* updateAction = NULL;
+        const char* updateManifest = NULL;
+
+        if (header.ChildCount == 1 && _workflow_snapshot_read_string(&cursor, end, &updateAction)
+            && _workflow_snapshot_read_string(&cursor, end, &updateManifest) && cursor == end
+            && updateAction != NULL && updateManifest != NULL)
+        {
+            updateActionValue = json_parse_string(updateAction);
+            updateManifestValue = json_parse_string(updateManifest);
+        }
+
+        munmap(map, mapSize);
+    }
+
+    if (json_value_get_type(updateActionValue) == JSONObject && json_value_get_type(updateManifestValue) == JSONObject)
+    {
+        wf->UpdateActionObject = json_object(updateActionValue);
+        wf->UpdateManifestObject = json_object(updateManifestValue);
+    }
+    else
+    {
+        Log_Error("Cannot read spilled step workflow %s back", spillPath);
+        json_value_free(updateActionValue);
+        json_value_free(updateManifestValue);
+    }
+
+    (void)remove(spillPath);
+    __atomic_store_n(&wf->SpillPath, NULL, __ATOMIC_RELEASE);
+    free(spillPath);
+
+done:
+    pthread_mutex_unlock(&s_spillMutex);
 }
 
 EXTERN_C_END
@@ -7,12 +7,17 @@
  */
 #include "aduc/parser_utils.h"
 #include "aduc/workflow_utils.h"
+#include "aduc/workflow_utils.hpp"
+#include "parson_json_utils.h"
 
 #include <catch2/catch.hpp>
 using Catch::Matchers::Equals;
 
+#include <dirent.h> // for opendir
+#include <fstream>
 #include <sstream>
 #include <string>
+#include <sys/stat.h> // for mkdir
 
 /* Example of an Action PnP Data.
 {
@@ -93,6 +98,10 @@ const char* leaf0_instruction_installItems[] = {
 
 // clang-format on
 
+EXTERN_C_BEGIN
+const JSON_Object* _workflow_get_updateaction(ADUC_WorkflowHandle handle);
+EXTERN_C_END
+
 TEST_CASE("Initialization test")
 {
     ADUC_WorkflowHandle handle = nullptr;
@@ -134,6 +143,15 @@ TEST_CASE("Initialization test")
     // NOLINTNEXTLINE(cppcoreguidelines-owning-memory, cppcoreguidelines-no-malloc, hicpp-no-malloc)
     free(file0);
 
+    // Peeked entities are parsed once, and owned by the workflow.
+    const ADUC_FileEntity* peekedFile0 = workflow_peek_update_file(handle, 0);
+    REQUIRE(peekedFile0 != nullptr);
+    CHECK_THAT(peekedFile0->FileId, Equals("00000"));
+    CHECK(peekedFile0->HashCount == 1);
+    CHECK_THAT(peekedFile0->DownloadUri, Equals("file:///tmp/tests/testfiles/contoso-motor-1.0-updatemanifest.json"));
+    CHECK(workflow_peek_update_file(handle, 0) == peekedFile0);
+    CHECK(workflow_peek_update_file(handle, 1) == nullptr);
+
     char* installedCriteria = workflow_get_installed_criteria(handle);
     CHECK_THAT(installedCriteria, Equals("1.0"));
     workflow_free_string(installedCriteria);
@@ -151,6 +169,22 @@ TEST_CASE("Initialization test")
     workflow_free(handle);
 }
 
+TEST_CASE("Embedded update manifest is released once parsed")
+{
+    ADUC_WorkflowHandle handle = nullptr;
+    REQUIRE(workflow_init(action_bundle, true, &handle).ResultCode != 0);
+
+    const JSON_Object* updateAction = _workflow_get_updateaction(handle);
+    REQUIRE(updateAction != nullptr);
+    CHECK(json_object_get_value(updateAction, "updateManifest") == nullptr);
+    CHECK(json_object_get_value(updateAction, "updateManifestSignature") == nullptr);
+    CHECK(json_object_get_value(updateAction, "fileUrls") != nullptr);
+
+    CHECK_THAT(workflow_peek_update_manifest_string(handle, "installedCriteria"), Equals("1.0"));
+
+    workflow_free(handle);
+}
+
 TEST_CASE("Undefined update action")
 {
     ADUC_WorkflowHandle handle = nullptr;
@@ -279,6 +313,37 @@ TEST_CASE("Child workflow uses fileUrls from parent")
     workflow_free(bundle);
 }
 
+TEST_CASE("Download mirrors add alternate URIs")
+{
+    ADUC_WorkflowHandle bundle = nullptr;
+    REQUIRE(workflow_init(action_bundle, false, &bundle).ResultCode != 0);
+
+    CHECK_FALSE(workflow_set_download_mirrors(R"([ "http://mirror/" ])"));
+    REQUIRE(workflow_set_download_mirrors(R"({ "file:///tmp/tests/": [ "http://mirror-a/", "http://mirror-b/adu/" ],)"
+                                          R"(  "https://other/": [ "http://x/" ] })"));
+
+    ADUC_FileEntity* file = nullptr;
+    REQUIRE(workflow_get_update_file(bundle, 0, &file));
+    CHECK_THAT(file->DownloadUri, Equals("file:///tmp/tests/testfiles/contoso-motor-1.0-updatemanifest.json"));
+    REQUIRE(file->AlternateUriCount == 2);
+    CHECK_THAT(file->AlternateUris[0], Equals("http://mirror-a/testfiles/contoso-motor-1.0-updatemanifest.json"));
+    CHECK_THAT(file->AlternateUris[1], Equals("http://mirror-b/adu/testfiles/contoso-motor-1.0-updatemanifest.json"));
+
+    ADUC_FileEntity_Uninit(file);
+    // NOLINTNEXTLINE(cppcoreguidelines-owning-memory, cppcoreguidelines-no-malloc, hicpp-no-malloc)
+    free(file);
+
+    REQUIRE(workflow_set_download_mirrors(nullptr));
+    REQUIRE(workflow_get_update_file(bundle, 0, &file));
+    CHECK(file->AlternateUriCount == 0);
+
+    ADUC_FileEntity_Uninit(file);
+    // NOLINTNEXTLINE(cppcoreguidelines-owning-memory, cppcoreguidelines-no-malloc, hicpp-no-malloc)
+    free(file);
+
+    workflow_free(bundle);
+}
+
 TEST_CASE("Create leaf instruction workflow")
 {
     ADUC_WorkflowHandle bundle = nullptr;
@@ -421,6 +486,15 @@ TEST_CASE("Add and remove children")
     workflow_free_string(c6_id);
     c6_id = nullptr;
 
+    // All the children after #5 moved down by one.
+    for (int i = 0; i < 11; i++)
+    {
+        auto id = workflow_get_id(workflow_get_child(handle, i));
+        sprintf(name, "leaf%d", i < 5 ? i : i + 1);
+        CHECK_THAT(id, Equals(name));
+        workflow_free_string(id);
+    }
+
     // Child cound should be 10.
     CHECK(11 == workflow_get_children_count(handle));
 
@@ -435,6 +509,518 @@ TEST_CASE("Add and remove children")
     auto c0 = workflow_get_child(handle, 0);
     CHECK(c0 == c5);
 
+    // Reserving room keeps the children.
+    CHECK(workflow_reserve_children(handle, 200));
+    CHECK(12 == workflow_get_children_count(handle));
+    CHECK(workflow_get_child(handle, 0) == c5);
+
+    workflow_free(handle);
+}
+
+// clang-format off
+const char* action_inline_steps =
+    R"( {                    )"
+    R"(     "workflow": {    )"
+    R"(         "action": 3, )"
+    R"(         "id": "inline_steps" )"
+    R"(     },               )"
+    R"(     "updateManifest": {  )"
+    R"(         "manifestVersion": "4", )"
+    R"(         "updateId": {"provider": "Contoso", "name": "Virtual-Vacuum", "version": "5.0"}, )"
+    R"(         "compatibility": [{"deviceManufacturer": "contoso", "deviceModel": "virtual-vacuum-v1"}], )"
+    R"(         "instructions": {"steps": [ )"
+    R"(             {"handler": "microsoft/script:1", "files": ["f2"], "handlerProperties": {"arguments": "--pre", "installTimeoutSeconds": "90"}}, )"
+    R"(             {"handler": "microsoft/swupdate:1", "files": ["f1", "f3"]} )"
+    R"(         ]}, )"
+    R"(         "files": { )"
+    R"(             "f1": {"fileName": "image.swu", "sizeInBytes": 10, "hashes": {"sha256": "E2o94XQss/K8niR1pW6OdaIS/y3tInwhEKMn/6Rw1Gw="}}, )"
+    R"(             "f2": {"fileName": "pre.sh", "sizeInBytes": 20, "hashes": {"sha256": "E2o94XQss/K8niR1pW6OdaIS/y3tInwhEKMn/6Rw1Gw="}}, )"
+    R"(             "f3": {"fileName": "post.sh", "sizeInBytes": 30, "hashes": {"sha256": "E2o94XQss/K8niR1pW6OdaIS/y3tInwhEKMn/6Rw1Gw="}} )"
+    R"(         }, )"
+    R"(         "createdDateTime": "2022-01-27T13:45:05.8993329Z" )"
+    R"(     }, )"
+    R"(     "fileUrls": { )"
+    R"(         "f1": "file:///tmp/tests/testfiles/image.swu", )"
+    R"(         "f2": "file:///tmp/tests/testfiles/pre.sh", )"
+    R"(         "f3": "file:///tmp/tests/testfiles/post.sh" )"
+    R"(     } )"
+    R"( } )";
+// clang-format on
+
+TEST_CASE("Create inline step workflow")
+{
+    ADUC_WorkflowHandle base = nullptr;
+    ADUC_Result result = workflow_init(action_inline_steps, false, &base);
+    REQUIRE(result.ResultCode != 0);
+    REQUIRE(workflow_get_instructions_steps_count(base) == 2);
+
+    // Creating the same step twice yields the same workflow.
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        ADUC_WorkflowHandle step1 = nullptr;
+        result = workflow_create_from_inline_step(base, 1, &step1);
+        REQUIRE(result.ResultCode != 0);
+
+        REQUIRE(workflow_get_update_files_count(step1) == 2);
+
+        ADUC_FileEntity* file = nullptr;
+        REQUIRE(workflow_get_update_file(step1, 0, &file));
+        CHECK_THAT(file->FileId, Equals("f1"));
+        CHECK_THAT(file->TargetFilename, Equals("image.swu"));
+        CHECK_THAT(file->DownloadUri, Equals("file:///tmp/tests/testfiles/image.swu"));
+        workflow_free_file_entity(file);
+        file = nullptr;
+
+        REQUIRE(workflow_get_update_file(step1, 1, &file));
+        CHECK_THAT(file->FileId, Equals("f3"));
+        CHECK_THAT(file->DownloadUri, Equals("file:///tmp/tests/testfiles/post.sh"));
+        workflow_free_file_entity(file);
+
+        char* updateType = workflow_get_update_type(step1);
+        CHECK_THAT(updateType, Equals("microsoft/swupdate:1"));
+        workflow_free_string(updateType);
+
+        CHECK(workflow_get_instructions_steps_count(step1) == 0);
+
+        ADUC_UpdateId* updateId = nullptr;
+        result = workflow_get_expected_update_id(step1, &updateId);
+        CHECK(result.ResultCode != 0);
+        CHECK_THAT(updateId->Name, Equals("Virtual-Vacuum"));
+        workflow_free_update_id(updateId);
+
+        workflow_free(step1);
+    }
+
+    ADUC_WorkflowHandle step0 = nullptr;
+    result = workflow_create_from_inline_step(base, 0, &step0);
+    REQUIRE(result.ResultCode != 0);
+    CHECK(workflow_get_update_files_count(step0) == 1);
+    CHECK_THAT(
+        workflow_peek_update_manifest_handler_properties_string(step0, "arguments"), Equals("--pre"));
+    workflow_free(step0);
+
+    // The base keeps all its files.
+    CHECK(workflow_get_update_files_count(base) == 3);
+
+    workflow_free(base);
+}
+
+TEST_CASE("Cached IsInstalled results")
+{
+    ADUC_WorkflowHandle handle = nullptr;
+    ADUC_WorkflowHandle child = nullptr;
+    ADUC_Result_t resultCode = 0;
+    const char* component = R"({"components":[{"name":"cam.1","group":"cameras"}]})";
+
+    REQUIRE(workflow_init(action_leaf0, false, &handle).ResultCode != 0);
+    REQUIRE(workflow_init(action_leaf0, false, &child).ResultCode != 0);
+    REQUIRE(workflow_insert_child(handle, -1, child));
+
+    CHECK_FALSE(workflow_get_cached_is_installed(child, nullptr, &resultCode));
+
+    CHECK(workflow_set_cached_is_installed(child, nullptr, ADUC_Result_IsInstalled_Installed));
+    CHECK(workflow_set_cached_is_installed(child, component, ADUC_Result_IsInstalled_NotInstalled));
+
+    CHECK(workflow_get_cached_is_installed(child, nullptr, &resultCode));
+    CHECK(resultCode == ADUC_Result_IsInstalled_Installed);
+    CHECK(workflow_get_cached_is_installed(child, component, &resultCode));
+    CHECK(resultCode == ADUC_Result_IsInstalled_NotInstalled);
+    CHECK_FALSE(workflow_get_cached_is_installed(handle, component, &resultCode));
+
+    // Clearing the parent clears its children.
+    workflow_clear_cached_is_installed(handle);
+    CHECK_FALSE(workflow_get_cached_is_installed(child, nullptr, &resultCode));
+    CHECK_FALSE(workflow_get_cached_is_installed(child, component, &resultCode));
+
+    workflow_free(handle);
+}
+
+TEST_CASE("Workflow flags and folders")
+{
+    ADUC_WorkflowHandle handle = nullptr;
+    ADUC_WorkflowHandle child = nullptr;
+    const char* component = R"({"components":[{"name":"cam.1","group":"cameras"}]})";
+
+    REQUIRE(workflow_init(action_leaf0, false, &handle).ResultCode != 0);
+    REQUIRE(workflow_init(action_leaf0, false, &child).ResultCode != 0);
+    REQUIRE(workflow_insert_child(handle, -1, child));
+
+    // Requests made on a child are recorded on the root.
+    CHECK_FALSE(workflow_is_reboot_requested(handle));
+    CHECK(workflow_request_reboot(child));
+    CHECK(workflow_is_reboot_requested(handle));
+    CHECK(workflow_is_reboot_requested(child));
+    CHECK_FALSE(workflow_is_immediate_reboot_requested(handle));
+    CHECK(workflow_request_immediate_agent_restart(child));
+    CHECK(workflow_is_immediate_agent_restart_requested(handle));
+    CHECK_FALSE(workflow_is_agent_restart_requested(handle));
+
+    CHECK(workflow_peek_restart_reasons(handle) == nullptr);
+    CHECK(workflow_add_restart_reason(child, "step #0: reboot"));
+    CHECK(workflow_add_restart_reason(handle, "step #1: agent restart"));
+    CHECK_THAT(workflow_peek_restart_reasons(child), Equals("step #0: reboot; step #1: agent restart"));
+
+    CHECK(workflow_peek_selected_components(child) == nullptr);
+    CHECK(workflow_set_selected_components(child, component));
+    CHECK_THAT(workflow_peek_selected_components(child), Equals(component));
+    CHECK(workflow_set_selected_components(child, nullptr));
+    CHECK(workflow_peek_selected_components(child) == nullptr);
+
+    CHECK(workflow_set_workfolder(handle, "/tmp/%s", "bundle"));
+    char* workFolder = workflow_get_workfolder(handle);
+    CHECK_THAT(workFolder, Equals("/tmp/bundle"));
+    workflow_free_string(workFolder);
+
+    CHECK(workflow_get_resolved_files_count(child) == 0);
+    workflow_set_resolved_files_count(child, 2);
+    CHECK(workflow_get_resolved_files_count(child) == 2);
+    CHECK(workflow_get_resolved_files_count(handle) == 0);
+    CHECK(workflow_get_resolved_files_count(nullptr) == 0);
+
+    workflow_free(handle);
+}
+
+TEST_CASE("Workflow peek accessors")
+{
+    ADUC_WorkflowHandle handle = nullptr;
+    ADUC_WorkflowHandle child = nullptr;
+
+    REQUIRE(workflow_init(action_leaf0, false, &handle).ResultCode != 0);
+    REQUIRE(workflow_init(action_leaf0, false, &child).ResultCode != 0);
+    REQUIRE(workflow_set_id(handle, "bundle"));
+    REQUIRE(workflow_set_id(child, "leaf"));
+    REQUIRE(workflow_insert_child(handle, -1, child));
+
+    CHECK(workflow_peek_workfolder(nullptr) == nullptr);
+    CHECK_THAT(workflow_peek_workfolder(child), Equals("/var/lib/adu/downloads/bundle/leaf"));
+
+    // The derived work folder is built once, and rebuilt when an ancestor changes.
+    CHECK(workflow_peek_workfolder(child) == workflow_peek_workfolder(child));
+    CHECK(workflow_set_workfolder(handle, "/tmp/%s", "bundle"));
+    CHECK_THAT(workflow_peek_workfolder(child), Equals("/tmp/bundle/leaf"));
+    CHECK(workflow_set_id(child, "leaf2"));
+    CHECK_THAT(workflow_peek_workfolder(child), Equals("/tmp/bundle/leaf2"));
+
+    char* workFolder = workflow_get_workfolder(child);
+    CHECK_THAT(workFolder, Equals(workflow_peek_workfolder(child)));
+    CHECK(workFolder != workflow_peek_workfolder(child));
+    workflow_free_string(workFolder);
+
+    CHECK(workflow_remove_child(handle, 0) == child);
+    CHECK_THAT(workflow_peek_workfolder(child), Equals("/var/lib/adu/downloads/leaf2"));
+
+    CHECK_THAT(workflow_peek_installed_criteria(child), Equals("1.0"));
+
+    const ADUC::WorkflowStringView id = ADUC::PeekWorkflowId(child);
+    CHECK(id == "leaf2");
+    CHECK(id.size() == 5);
+    CHECK(id.str() == "leaf2");
+
+    const ADUC::WorkflowStringView components = ADUC::PeekSelectedComponents(child);
+    CHECK(components.is_null());
+    CHECK(components.empty());
+    CHECK(components == nullptr);
+    CHECK(components != "");
+
+    workflow_free(child);
+    workflow_free(handle);
+}
+
+TEST_CASE("Workflow selected components")
+{
+    ADUC_WorkflowHandle handle = nullptr;
+    ADUC_WorkflowHandle step = nullptr;
+    size_t count = 0;
+
+    REQUIRE(workflow_init(action_leaf0, false, &handle).ResultCode != 0);
+    REQUIRE(workflow_init(action_leaf0, false, &step).ResultCode != 0);
+
+    CHECK_FALSE(workflow_get_selected_components_count(handle, &count));
+    CHECK_FALSE(workflow_select_component(step, handle, 0));
+
+    REQUIRE(workflow_set_selected_components(
+        handle, R"({"components":[{"id":"motor-1","name":"left"},{"id":"motor-2","name":"right"}]})"));
+    REQUIRE(workflow_get_selected_components_count(handle, &count));
+    CHECK(count == 2);
+
+    // Each component is serialized once, and shared with the steps that select it.
+    const char* component1 = workflow_peek_selected_component(handle, 1);
+    CHECK_THAT(component1, Equals(R"({"components":[{"id":"motor-2","name":"right"}]})"));
+    CHECK(workflow_peek_selected_component(handle, 1) == component1);
+    CHECK(workflow_peek_selected_component(handle, 2) == nullptr);
+
+    REQUIRE(workflow_select_component(step, handle, 1));
+    CHECK(workflow_peek_selected_components(step) == component1);
+    REQUIRE(workflow_get_selected_components_count(step, &count));
+    CHECK(count == 1);
+    CHECK(workflow_peek_selected_component(step, 0) == component1);
+    CHECK(workflow_peek_selected_component(step, 1) == nullptr);
+
+    // The step keeps its component after the steps workflow selects others.
+    REQUIRE(workflow_set_selected_components(handle, R"({"components":[]})"));
+    REQUIRE(workflow_get_selected_components_count(handle, &count));
+    CHECK(count == 0);
+    CHECK_THAT(workflow_peek_selected_components(step), Equals(R"({"components":[{"id":"motor-2","name":"right"}]})"));
+
+    REQUIRE(workflow_set_selected_components(step, nullptr));
+    CHECK(workflow_peek_selected_components(step) == nullptr);
+
+    REQUIRE(workflow_set_selected_components(handle, "not json"));
+    CHECK_FALSE(workflow_get_selected_components_count(handle, &count));
+
+    workflow_free(step);
+    workflow_free(handle);
+}
+
+TEST_CASE("Workflow arena")
+{
+    ADUC_WorkflowHandle handle = nullptr;
+    ADUC_WorkflowHandle child = nullptr;
+
+    REQUIRE(workflow_init(action_leaf0, false, &handle).ResultCode != 0);
+    REQUIRE(workflow_init(action_leaf0, false, &child).ResultCode != 0);
+    REQUIRE(workflow_insert_child(handle, -1, child));
+
+    CHECK(workflow_arena_alloc(nullptr, 8) == nullptr);
+    CHECK(workflow_arena_strdup(handle, nullptr) == nullptr);
+
+    // Children allocate from the arena of the root, freed with it.
+    char* fromRoot = workflow_arena_strdup(handle, "root");
+    char* fromChild = workflow_arena_strdup(child, "child");
+    CHECK_THAT(fromRoot, Equals("root"));
+    CHECK_THAT(fromChild, Equals("child"));
+    CHECK(fromChild == fromRoot + 16);
+
+    auto* zeroed = static_cast<int*>(workflow_arena_calloc(child, 4, sizeof(int)));
+    REQUIRE(zeroed != nullptr);
+    CHECK(zeroed[3] == 0);
+
+    workflow_free(handle);
+}
+
+TEST_CASE("Workflow cancellation token")
+{
+    ADUC_WorkflowHandle handle = nullptr;
+    ADUC_WorkflowHandle child = nullptr;
+
+    REQUIRE(workflow_init(action_leaf0, false, &handle).ResultCode != 0);
+    REQUIRE(workflow_init(action_leaf0, false, &child).ResultCode != 0);
+    REQUIRE(workflow_insert_child(handle, -1, child));
+
+    CHECK(workflow_peek_cancellation_token(nullptr) == nullptr);
+
+    // Children share the token of the root.
+    const ADUC_CancellationToken* token = workflow_peek_cancellation_token(child);
+    REQUIRE(token != nullptr);
+    CHECK(workflow_peek_cancellation_token(handle) == token);
+    CHECK_FALSE(ADUC_CancellationToken_IsCancelled(token));
+
+    SECTION("Cancel request")
+    {
+        workflow_set_operation_cancel_requested(handle, true);
+        CHECK(ADUC_CancellationToken_IsCancelled(token));
+
+        workflow_clear_inprogress_and_cancelrequested(handle);
+        CHECK_FALSE(ADUC_CancellationToken_IsCancelled(token));
+    }
+
+    SECTION("Replacement deployment")
+    {
+        ADUC_WorkflowHandle next = nullptr;
+        REQUIRE(workflow_init(action_leaf0, false, &next).ResultCode != 0);
+
+        workflow_set_operation_in_progress(handle, true);
+        REQUIRE(workflow_update_replacement_deployment(handle, next));
+        CHECK(ADUC_CancellationToken_IsCancelled(token));
+
+        // The replacement gets a token that isn't cancelled.
+        workflow_update_for_replacement(handle);
+        CHECK_FALSE(ADUC_CancellationToken_IsCancelled(workflow_peek_cancellation_token(handle)));
+        workflow_free(next);
+    }
+
+    workflow_free(handle);
+}
+
+TEST_CASE("Replacement after download")
+{
+    ADUC_WorkflowHandle handle = nullptr;
+    ADUC_WorkflowHandle next = nullptr;
+    ADUC_WorkflowHandle other = nullptr;
+
+    REQUIRE(workflow_init(action_leaf0, false, &handle).ResultCode != 0);
+    REQUIRE(workflow_init(action_inline_steps, false, &next).ResultCode != 0);
+    REQUIRE(workflow_init(bundle_with_bundledUpdates, false, &other).ResultCode != 0);
+    REQUIRE(workflow_set_workfolder(handle, "/tmp/workflow_ut/replaced"));
+
+    // Files are compared by hash, not by id or name.
+    CHECK(workflow_files_are_needed_by(handle, next));
+    CHECK_FALSE(workflow_files_are_needed_by(other, next));
+
+    // Only an in-progress download is deferred.
+    CHECK_FALSE(workflow_defer_replacement_after_download(handle, next));
+    workflow_set_operation_in_progress(handle, true);
+    workflow_set_current_workflowstep(handle, ADUCITF_WorkflowStep_Install);
+    CHECK_FALSE(workflow_defer_replacement_after_download(handle, next));
+    CHECK_FALSE(workflow_has_deferred_replacement(handle));
+
+    workflow_set_current_workflowstep(handle, ADUCITF_WorkflowStep_Download);
+    REQUIRE(workflow_defer_replacement_after_download(handle, next));
+    CHECK(workflow_has_deferred_replacement(handle));
+    CHECK(workflow_get_cancellation_type(handle) == ADUC_WorkflowCancellationType_Replacement);
+    CHECK_FALSE(ADUC_CancellationToken_IsCancelled(workflow_peek_cancellation_token(handle)));
+
+    // The replacement takes over, and the folder of the replaced workflow is handed out once.
+    workflow_update_for_replacement(handle);
+    CHECK_FALSE(workflow_has_deferred_replacement(handle));
+
+    char* replacedFolder = workflow_take_replaced_workfolder(handle);
+    REQUIRE(replacedFolder != nullptr);
+    CHECK_THAT(replacedFolder, Equals("/tmp/workflow_ut/replaced"));
+    CHECK(workflow_take_replaced_workfolder(handle) == nullptr);
+    free(replacedFolder);
+
+    workflow_free(other);
+    workflow_free(next);
+    workflow_free(handle);
+}
+
+TEST_CASE("Children snapshot")
+{
+    ADUC_WorkflowHandle base = nullptr;
+    ADUC_WorkflowHandle restored = nullptr;
+    const char* workFolder = "/tmp/workflow_ut/snapshot";
+
+    (void)mkdir("/tmp/workflow_ut", 0700);
+    (void)mkdir(workFolder, 0700);
+    (void)remove("/tmp/workflow_ut/snapshot/.steps.snapshot");
+
+    REQUIRE(workflow_init(action_inline_steps, false, &base).ResultCode != 0);
+    REQUIRE(workflow_set_workfolder(base, workFolder));
+    REQUIRE(workflow_set_selected_components(base, "{\"components\":[]}"));
+
+    for (int i = 0; i < 2; i++)
+    {
+        ADUC_WorkflowHandle step = nullptr;
+        REQUIRE(workflow_create_from_inline_step(base, i, &step).ResultCode != 0);
+        REQUIRE(workflow_insert_child(base, -1, step));
+    }
+
+    // Nothing to restore yet.
+    REQUIRE(workflow_init(action_inline_steps, false, &restored).ResultCode != 0);
+    REQUIRE(workflow_set_workfolder(restored, workFolder));
+    REQUIRE(workflow_set_selected_components(restored, "{\"components\":[]}"));
+    CHECK_FALSE(workflow_restore_children_snapshot(restored));
+
+    REQUIRE(workflow_save_children_snapshot(base));
+    REQUIRE(workflow_restore_children_snapshot(restored));
+    REQUIRE(workflow_get_children_count(restored) == 2);
+
+    for (int i = 0; i < 2; i++)
+    {
+        ADUC_WorkflowHandle step = workflow_get_child(restored, i);
+        char* expected = workflow_get_serialized_update_manifest(workflow_get_child(base, i), false);
+        char* actual = workflow_get_serialized_update_manifest(step, false);
+        CHECK_THAT(actual, Equals(expected));
+        workflow_free_string(expected);
+        workflow_free_string(actual);
+
+        CHECK_THAT(workflow_peek_workfolder(step), Equals(workFolder));
+        CHECK(workflow_get_update_files_count(step) == workflow_get_update_files_count(workflow_get_child(base, i)));
+    }
+
+    workflow_free(restored);
+    restored = nullptr;
+
+    // Another selection of components doesn't use the snapshot.
+    REQUIRE(workflow_init(action_inline_steps, false, &restored).ResultCode != 0);
+    REQUIRE(workflow_set_workfolder(restored, workFolder));
+    CHECK_FALSE(workflow_restore_children_snapshot(restored));
+    CHECK(workflow_get_children_count(restored) == 0);
+
+    // Nor does a corrupted snapshot.
+    REQUIRE(workflow_set_selected_components(restored, "{\"components\":[]}"));
+    {
+        std::fstream snapshot(
+            "/tmp/workflow_ut/snapshot/.steps.snapshot", std::ios::in | std::ios::out | std::ios::binary);
+        REQUIRE(snapshot.is_open());
+        snapshot.seekp(-2, std::ios::end);
+        snapshot.put('#');
+    }
+
+    CHECK_FALSE(workflow_restore_children_snapshot(restored));
+    CHECK(workflow_get_children_count(restored) == 0);
+
+    workflow_free(restored);
+    workflow_free(base);
+}
+
+TEST_CASE("Spilled step workflows")
+{
+    ADUC_WorkflowHandle base = nullptr;
+    ADUC_WorkflowHandle step = nullptr;
+    const char* workFolder = "/tmp/workflow_ut/spill";
+
+    (void)mkdir("/tmp/workflow_ut", 0700);
+    (void)mkdir(workFolder, 0700);
+
+    REQUIRE(workflow_init(action_inline_steps, false, &base).ResultCode != 0);
+    REQUIRE(workflow_set_workfolder(base, workFolder));
+
+    // Only children are spilled.
+    CHECK_FALSE(workflow_spill(base));
+
+    REQUIRE(workflow_create_from_inline_step(base, 0, &step).ResultCode != 0);
+    REQUIRE(workflow_insert_child(base, -1, step));
+
+    char* expected = workflow_get_serialized_update_manifest(step, false);
+    const size_t fileCount = workflow_get_update_files_count(step);
+
+    REQUIRE(workflow_spill(step));
+    CHECK(workflow_is_spilled(step));
+    CHECK(workflow_spill(step));
+
+    // The next access reads it back.
+    char* actual = workflow_get_serialized_update_manifest(workflow_get_child(base, 0), false);
+    CHECK_FALSE(workflow_is_spilled(step));
+    CHECK_THAT(actual, Equals(expected));
+    CHECK(workflow_get_update_files_count(step) == fileCount);
+    workflow_free_string(actual);
+
+    // A spilled workflow is freed without being read back, and leaves no file behind.
+    REQUIRE(workflow_spill(step));
+    workflow_free(base);
+
+    DIR* dir = opendir(workFolder);
+    REQUIRE(dir != nullptr);
+    size_t entryCount = 0;
+    while (readdir(dir) != nullptr)
+    {
+        entryCount++;
+    }
+
+    closedir(dir);
+    CHECK(entryCount == 2);
+
+    workflow_free_string(expected);
+}
+
+TEST_CASE("Workflow disk space preflight")
+{
+    ADUC_WorkflowHandle handle = nullptr;
+    ADUC_WorkflowHandle child = nullptr;
+
+    REQUIRE(workflow_init(action_leaf0, false, &handle).ResultCode != 0);
+    REQUIRE(workflow_init(action_leaf0, false, &child).ResultCode != 0);
+    REQUIRE(workflow_set_workfolder(handle, "/tmp/workflow_ut/disk_space"));
+    REQUIRE(workflow_insert_child(handle, -1, child));
+
+    // The files of the children count too.
+    CHECK(workflow_get_remaining_download_bytes(child) == 1396);
+    CHECK(workflow_get_remaining_download_bytes(handle) == 2 * 1396);
+
+    CHECK(IsAducResultCodeSuccess(workflow_check_disk_space(handle).ResultCode));
+
     workflow_free(handle);
 }
 
@@ -661,3 +1247,124 @@ TEST_CASE("Mininum update manifest version check - 1")
     CHECK(result.ExtendedResultCode == ADUC_ERC_UTILITIES_UPDATE_DATA_PARSER_UNSUPPORTED_UPDATE_MANIFEST_VERSION);
     workflow_free(handle);
 }
+
+TEST_CASE("workflow memory budget")
+{
+    ADUC_JSON_EnableAllocationAccounting();
+
+    SECTION("No budget")
+    {
+        workflow_set_memory_budget(0);
+
+        ADUC_WorkflowHandle handle = nullptr;
+        ADUC_Result result = workflow_init(action_bundle, true, &handle);
+        CHECK(result.ResultCode > 0);
+        CHECK(workflow_get_memory_usage(handle) > 0);
+        CHECK(IsAducResultCodeSuccess(workflow_check_memory_budget(handle).ResultCode));
+        workflow_free(handle);
+    }
+
+    SECTION("Manifest over the budget")
+    {
+        workflow_set_memory_budget(1024);
+
+        ADUC_WorkflowHandle handle = nullptr;
+        ADUC_Result result = workflow_init(action_bundle, true, &handle);
+        CHECK(result.ResultCode == 0);
+        CHECK(result.ExtendedResultCode == ADUC_ERC_UTILITIES_WORKFLOW_UTIL_MEMORY_BUDGET_EXCEEDED);
+        CHECK(handle == nullptr);
+    }
+
+    SECTION("Manifest within the budget")
+    {
+        workflow_set_memory_budget(16 * 1024 * 1024);
+
+        ADUC_WorkflowHandle handle = nullptr;
+        ADUC_Result result = workflow_init(action_bundle, true, &handle);
+        CHECK(result.ResultCode > 0);
+        CHECK(workflow_get_memory_usage(handle) < workflow_get_memory_budget());
+        workflow_free(handle);
+    }
+
+    workflow_set_memory_budget(0);
+}
+
+TEST_CASE("workflow download start delay")
+{
+    ADUC_WorkflowHandle handle = nullptr;
+    REQUIRE(workflow_init(action_inline_steps, false, &handle).ResultCode != 0);
+
+    // No window, or no device id, starts right away.
+    workflow_set_device_id("device-001");
+    CHECK(workflow_get_download_start_delay(handle) == 0);
+    workflow_set_download_start_jitter(600);
+    workflow_set_device_id(nullptr);
+    CHECK(workflow_get_download_start_delay(handle) == 0);
+
+    // The same device waits the same time, within the window; other devices spread over it.
+    workflow_set_device_id("device-001");
+    const unsigned int delay = workflow_get_download_start_delay(handle);
+    CHECK(delay < 600);
+    CHECK(workflow_get_download_start_delay(handle) == delay);
+    workflow_set_device_id("device-002");
+    CHECK(workflow_get_download_start_delay(handle) != delay);
+
+    // Urgent updates start right away.
+    std::string urgentAction = action_inline_steps;
+    const std::string version = R"("manifestVersion": "4",)";
+    urgentAction.replace(urgentAction.find(version), version.size(), version + R"( "urgent": true,)");
+    ADUC_WorkflowHandle urgentHandle = nullptr;
+    REQUIRE(workflow_init(urgentAction.c_str(), false, &urgentHandle).ResultCode != 0);
+    CHECK(workflow_get_download_start_delay(urgentHandle) == 0);
+
+    workflow_set_download_start_jitter(0);
+    workflow_set_device_id(nullptr);
+    workflow_free(urgentHandle);
+    workflow_free(handle);
+}
+
+TEST_CASE("workflow operation timeouts")
+{
+    ADUC_WorkflowHandle base = nullptr;
+    ADUC_WorkflowHandle step0 = nullptr;
+    REQUIRE(workflow_init(action_inline_steps, false, &base).ResultCode != 0);
+    REQUIRE(workflow_create_from_inline_step(base, 0, &step0).ResultCode != 0);
+    REQUIRE(workflow_insert_child(base, -1, step0));
+
+    workflow_set_default_operation_timeout(ADUCITF_WorkflowStep_Install, 600);
+    workflow_set_default_operation_timeout(ADUCITF_WorkflowStep_Apply, 60);
+
+    // The handlerProperties of the step override the default.
+    CHECK(workflow_get_operation_timeout(step0, ADUCITF_WorkflowStep_Install) == 90);
+    CHECK(workflow_get_operation_timeout(step0, ADUCITF_WorkflowStep_Apply) == 60);
+    CHECK(workflow_get_operation_timeout(base, ADUCITF_WorkflowStep_Install) == 600);
+    CHECK(workflow_get_operation_timeout(base, ADUCITF_WorkflowStep_Download) == 0);
+    CHECK(workflow_get_operation_timeout(base, ADUCITF_WorkflowStep_ProcessDeployment) == 0);
+
+    workflow_set_operation_in_progress(base, true);
+    workflow_set_operation_deadline(base, 1000);
+
+    CHECK_FALSE(workflow_check_operation_deadline(base, 999));
+    CHECK_FALSE(workflow_get_operation_timed_out(base));
+
+    // An earlier step deadline, set through a step, applies to the operation.
+    workflow_set_step_deadline(step0, 500);
+    CHECK(workflow_check_operation_deadline(base, 500));
+    CHECK(workflow_get_operation_timed_out(step0));
+    CHECK(workflow_get_operation_cancel_requested(base));
+    CHECK(ADUC_CancellationToken_IsCancelled(workflow_peek_cancellation_token(step0)));
+
+    // It times out once.
+    CHECK_FALSE(workflow_check_operation_deadline(base, 2000));
+
+    workflow_clear_inprogress_and_cancelrequested(base);
+    CHECK_FALSE(workflow_get_operation_timed_out(base));
+    CHECK_FALSE(ADUC_CancellationToken_IsCancelled(workflow_peek_cancellation_token(base)));
+
+    workflow_set_operation_in_progress(base, true);
+    CHECK_FALSE(workflow_check_operation_deadline(base, 2000));
+
+    workflow_set_default_operation_timeout(ADUCITF_WorkflowStep_Install, 0);
+    workflow_set_default_operation_timeout(ADUCITF_WorkflowStep_Apply, 0);
+    workflow_free(base);
+}